@@ -123,7 +123,7 @@ rm -rf wayland
 # Keep this version in sync with our dependency in meson.build. If you wish to
 # raise a MR against custom protocol, please change this reference to clone
 # your relevant tree, and make sure you bump $FDO_DISTRIBUTION_TAG.
-git clone --branch 1.33 --depth=1 https://gitlab.freedesktop.org/wayland/wayland-protocols
+git clone --branch 1.38 --depth=1 https://gitlab.freedesktop.org/wayland/wayland-protocols
 cd wayland-protocols
 git show -s HEAD
 meson build --wrap-mode=nofallback
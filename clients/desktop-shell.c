@@ -33,6 +33,7 @@
 #include <errno.h>
 #include <math.h>
 #include <cairo.h>
+#include <sys/epoll.h>
 #include <sys/wait.h>
 #include <linux/input.h>
 #include <libgen.h>
@@ -48,6 +49,7 @@
 #include "shared/xalloc.h"
 #include "shared/cairo-util.h"
 #include "shared/file-util.h"
+#include "shared/image-loader.h"
 #include "shared/process-util.h"
 #include "shared/timespec-util.h"
 
@@ -125,6 +127,14 @@ struct background {
 	char *image;
 	int type;
 	uint32_t color;
+
+	/* Decoded off the main thread, once per target size. */
+	cairo_surface_t *image_surface;
+	struct weston_image_async *image_load;
+	struct task image_task;
+	int32_t image_target_width;
+	int32_t image_target_height;
+	bool image_requested;
 };
 
 struct output {
@@ -456,7 +466,12 @@ panel_clock_redraw_handler(struct widget *widget, void *data)
 	if (allocation.width == 0)
 		return;
 
-	cr = widget_cairo_create(clock->panel->widget);
+	cr = widget_cairo_create(widget);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_rgba(cr, 0, 0, 0, 0);
+	cairo_paint(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
 	cairo_set_font_size(cr, 14);
 	cairo_text_extents(cr, string, &extents);
 	if (allocation.x > 0)
@@ -475,6 +490,14 @@ panel_clock_redraw_handler(struct widget *widget, void *data)
 	cairo_destroy(cr);
 }
 
+static void
+panel_clock_resize_handler(struct widget *widget,
+			   int32_t width, int32_t height, void *data)
+{
+	/* Let input fall through to the panel */
+	widget_input_region_add(widget, NULL);
+}
+
 static int
 clock_timer_reset(struct panel_clock *clock)
 {
@@ -537,8 +560,12 @@ panel_add_clock(struct panel *panel)
 		      window_get_display(panel->window), clock_func);
 	clock_timer_reset(clock);
 
-	clock->widget = widget_add_widget(panel->widget, clock);
+	/* A sub-surface of its own, so that a clock tick only repaints
+	 * and damages the clock instead of the whole panel. */
+	clock->widget = window_add_subsurface(panel->window, clock,
+					      SUBSURFACE_DESYNCHRONIZED);
 	widget_set_redraw_handler(clock->widget, panel_clock_redraw_handler);
+	widget_set_resize_handler(clock->widget, panel_clock_resize_handler);
 }
 
 static void
@@ -781,6 +808,95 @@ enum {
 	BACKGROUND_CENTERED
 };
 
+static void
+background_image_loaded(struct task *task, uint32_t events)
+{
+	struct background *background =
+		container_of(task, struct background, image_task);
+	struct display *display = window_get_display(background->window);
+	struct weston_image_async *load = background->image_load;
+	struct weston_image *image;
+
+	display_unwatch_fd(display, weston_image_async_get_fd(load));
+	background->image_load = NULL;
+
+	image = weston_image_async_finish(load);
+	if (image) {
+		if (background->image_surface)
+			cairo_surface_destroy(background->image_surface);
+		background->image_surface =
+			cairo_surface_create_for_weston_image(image);
+	}
+
+	widget_schedule_redraw(background->widget);
+}
+
+static void
+background_cancel_image_load(struct background *background)
+{
+	struct display *display = window_get_display(background->window);
+	struct weston_image *image;
+
+	if (!background->image_load)
+		return;
+
+	display_unwatch_fd(display,
+			   weston_image_async_get_fd(background->image_load));
+	image = weston_image_async_finish(background->image_load);
+	if (image)
+		weston_image_destroy(image);
+	background->image_load = NULL;
+}
+
+static void
+background_load_image(struct background *background,
+		      int32_t width, int32_t height)
+{
+	struct weston_image_load_options options = {
+		.flags = WESTON_IMAGE_LOAD_IMAGE,
+		.use_cache = true,
+	};
+	struct display *display = window_get_display(background->window);
+	char *name;
+
+	/* Only the scaled modes can use fewer pixels than the file has;
+	 * tiled and centered images are shown at their own size. */
+	if (background->type == BACKGROUND_SCALE ||
+	    background->type == BACKGROUND_SCALE_CROP) {
+		options.max_width = width;
+		options.max_height = height;
+	}
+
+	if (background->image_requested &&
+	    background->image_target_width == options.max_width &&
+	    background->image_target_height == options.max_height)
+		return;
+
+	if (background->image)
+		name = xstrdup(background->image);
+	else if (background->color == 0)
+		name = file_name_with_datadir("pattern.png");
+	else
+		return;
+
+	background_cancel_image_load(background);
+
+	background->image_requested = true;
+	background->image_target_width = options.max_width;
+	background->image_target_height = options.max_height;
+	background->image_load = weston_image_load_async(name, &options);
+	if (background->image_load) {
+		background->image_task.run = background_image_loaded;
+		display_watch_fd(display,
+				 weston_image_async_get_fd(background->image_load),
+				 EPOLLIN, &background->image_task);
+	} else if (!background->image_surface) {
+		background->image_surface = load_cairo_surface(name);
+	}
+
+	free(name);
+}
+
 static void
 background_draw(struct widget *widget, void *data)
 {
@@ -792,6 +908,7 @@ background_draw(struct widget *widget, void *data)
 	double im_w, im_h;
 	double sx, sy, s;
 	double tx, ty;
+	int32_t scale;
 	struct rectangle allocation;
 
 	surface = window_get_surface(background->window);
@@ -805,15 +922,10 @@ background_draw(struct widget *widget, void *data)
 	cairo_paint(cr);
 
 	widget_get_allocation(widget, &allocation);
-	image = NULL;
-	if (background->image)
-		image = load_cairo_surface(background->image);
-	else if (background->color == 0) {
-		char *name = file_name_with_datadir("pattern.png");
-
-		image = load_cairo_surface(name);
-		free(name);
-	}
+	scale = window_get_buffer_scale(background->window);
+	background_load_image(background, allocation.width * scale,
+			      allocation.height * scale);
+	image = background->image_surface;
 
 	if (image && background->type != -1) {
 		im_w = cairo_image_surface_get_width(image);
@@ -859,13 +971,16 @@ background_draw(struct widget *widget, void *data)
 
 		cairo_set_source(cr, pattern);
 		cairo_pattern_destroy (pattern);
-		cairo_surface_destroy(image);
 		cairo_mask(cr, pattern);
 	}
 
 	cairo_destroy(cr);
 	cairo_surface_destroy(surface);
 
+	/* Hold desktop_ready back until the image is on screen. */
+	if (background->image_load)
+		return;
+
 	background->painted = 1;
 	check_desktop_ready(background->window);
 }
@@ -1162,6 +1277,10 @@ static const struct weston_desktop_shell_listener listener = {
 static void
 background_destroy(struct background *background)
 {
+	background_cancel_image_load(background);
+	if (background->image_surface)
+		cairo_surface_destroy(background->image_surface);
+
 	widget_destroy(background->widget);
 	window_destroy(background->window);
 
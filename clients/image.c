@@ -45,6 +45,7 @@
 #include "shared/cairo-util.h"
 #include "shared/helpers.h"
 #include "shared/image-loader.h"
+#include "shared/xalloc.h"
 
 bool verbose;
 
@@ -53,6 +54,23 @@ bool verbose;
 		fprintf(stderr, __VA_ARGS__); \
 } while (0)
 
+/* Zoomed out, the image is drawn from a pyramid: each level is half the
+ * size of the one below it, level 0 being the image as loaded. A redraw
+ * draws the tiles in view of the level closest to the scale on screen, so
+ * it costs about as much as the window is big, whatever the image size.
+ * Tiles are made the first time they are in view; until then, a coarser
+ * tile stands in and the right one is made in the background. */
+#define TILE_SIZE 256
+
+/* Source pixels read making tiles, per step in the background */
+#define TILE_STEP_PIXELS (16 * 1024 * 1024)
+
+struct image_level {
+	int width, height;
+	int columns, rows;
+	cairo_surface_t **tiles;	/* NULL until made */
+};
+
 struct image {
 	struct window *window;
 
@@ -77,6 +95,16 @@ struct image {
 
 	bool initialized;
 	cairo_matrix_t matrix;
+
+	struct image_level *levels;	/* levels[0] has no tiles */
+	int n_levels;
+
+	/* Tiles drawn with a stand-in by the last redraw */
+	struct toytimer tile_timer;
+	struct {
+		int level;
+		int column0, row0, column1, row1;
+	} pending;
 };
 
 struct cli_render_intent_option {
@@ -153,6 +181,323 @@ clamp_view(struct image *image)
 	}
 }
 
+static void
+image_init_levels(struct image *image)
+{
+	struct image_level *level;
+	int width = cairo_image_surface_get_width(image->image);
+	int height = cairo_image_surface_get_height(image->image);
+	int w, h, i;
+
+	image->n_levels = 1;
+	for (w = width, h = height; w > TILE_SIZE || h > TILE_SIZE;
+	     w = (w + 1) / 2, h = (h + 1) / 2)
+		image->n_levels++;
+
+	image->levels = xcalloc(image->n_levels, sizeof *image->levels);
+	for (i = 0, w = width, h = height; i < image->n_levels;
+	     i++, w = (w + 1) / 2, h = (h + 1) / 2) {
+		level = &image->levels[i];
+		level->width = w;
+		level->height = h;
+		if (i == 0)
+			continue;
+
+		level->columns = (w + TILE_SIZE - 1) / TILE_SIZE;
+		level->rows = (h + TILE_SIZE - 1) / TILE_SIZE;
+		level->tiles = xcalloc(level->columns * level->rows,
+				       sizeof *level->tiles);
+	}
+}
+
+static void
+image_fini_levels(struct image *image)
+{
+	struct image_level *level;
+	int i, j;
+
+	for (i = 1; i < image->n_levels; i++) {
+		level = &image->levels[i];
+		for (j = 0; j < level->columns * level->rows; j++)
+			if (level->tiles[j])
+				cairo_surface_destroy(level->tiles[j]);
+		free(level->tiles);
+	}
+	free(image->levels);
+}
+
+static cairo_surface_t *
+image_tile(struct image *image, int level, int column, int row)
+{
+	struct image_level *l = &image->levels[level];
+
+	if (level == 0 || column >= l->columns || row >= l->rows)
+		return NULL;
+
+	return l->tiles[row * l->columns + column];
+}
+
+/* Averages 2x2 blocks of premultiplied pixels; width and height are those
+ * of the source, whose odd last column or row stands for its own pair. */
+static void
+downsample_half(uint32_t *dst, int dst_stride,
+		const uint32_t *src, int src_stride, int width, int height)
+{
+	const uint32_t *s0, *s1;
+	uint32_t p[4], lo, hi;
+	int x, y, i;
+
+	for (y = 0; y < height; y += 2) {
+		s0 = src + y * src_stride;
+		s1 = y + 1 < height ? s0 + src_stride : s0;
+		for (x = 0; x < width; x += 2) {
+			p[0] = s0[x];
+			p[1] = x + 1 < width ? s0[x + 1] : s0[x];
+			p[2] = s1[x];
+			p[3] = x + 1 < width ? s1[x + 1] : s1[x];
+
+			/* Two channels at a time, in 16 bits each */
+			lo = hi = 0x00020002;
+			for (i = 0; i < 4; i++) {
+				lo += p[i] & 0x00ff00ff;
+				hi += (p[i] >> 8) & 0x00ff00ff;
+			}
+			dst[x / 2] = ((lo >> 2) & 0x00ff00ff) |
+				     (((hi >> 2) & 0x00ff00ff) << 8);
+		}
+		dst += dst_stride;
+	}
+}
+
+/* Averages factor x factor blocks of the image as loaded */
+static void
+downsample_box(struct image *image, uint32_t *dst, int dst_stride,
+	       int x0, int y0, int width, int height, int factor)
+{
+	cairo_surface_t *source = image->image;
+	int src_width = cairo_image_surface_get_width(source);
+	int src_height = cairo_image_surface_get_height(source);
+	int src_stride = cairo_image_surface_get_stride(source) / 4;
+	const uint32_t *src = (const uint32_t *)
+		cairo_image_surface_get_data(source);
+	uint32_t (*sum)[4];
+	const uint32_t *s;
+	int x, y, sx, sy, sx1, sy1, n, c;
+
+	sum = xcalloc(width, sizeof *sum);
+
+	for (y = 0; y < height; y++) {
+		memset(sum, 0, width * sizeof *sum);
+		sy = (y0 + y) * factor;
+		sy1 = MIN(sy + factor, src_height);
+		for (; sy < sy1; sy++) {
+			s = src + sy * src_stride;
+			for (x = 0; x < width; x++) {
+				sx = (x0 + x) * factor;
+				sx1 = MIN(sx + factor, src_width);
+				for (; sx < sx1; sx++)
+					for (c = 0; c < 4; c++)
+						sum[x][c] += (s[sx] >> (c * 8)) & 0xff;
+			}
+		}
+
+		sy = (y0 + y) * factor;
+		sy1 = MIN(sy + factor, src_height);
+		for (x = 0; x < width; x++) {
+			sx = (x0 + x) * factor;
+			sx1 = MIN(sx + factor, src_width);
+			n = (sx1 - sx) * (sy1 - sy);
+			dst[x] = 0;
+			for (c = 0; c < 4; c++)
+				dst[x] |= ((sum[x][c] + n / 2) / n) << (c * 8);
+		}
+		dst += dst_stride;
+	}
+
+	free(sum);
+}
+
+/* Makes a tile, from the four tiles below it if they are all there, from
+ * the image as loaded otherwise. Only if that reads no more source pixels
+ * than *budget allows, when budget is not NULL. */
+static cairo_surface_t *
+image_make_tile(struct image *image, int level, int column, int row,
+		int64_t *budget)
+{
+	struct image_level *l = &image->levels[level];
+	cairo_surface_t *tile, *child[4];
+	int width, height, stride, i, cw, ch;
+	int64_t cost;
+	uint32_t *data;
+
+	tile = image_tile(image, level, column, row);
+	if (tile)
+		return tile;
+
+	width = MIN(TILE_SIZE, l->width - column * TILE_SIZE);
+	height = MIN(TILE_SIZE, l->height - row * TILE_SIZE);
+
+	for (i = 0; i < 4; i++) {
+		child[i] = image_tile(image, level - 1,
+				      column * 2 + i % 2, row * 2 + i / 2);
+		if (!child[i] && level > 1 &&
+		    column * 2 + i % 2 < image->levels[level - 1].columns &&
+		    row * 2 + i / 2 < image->levels[level - 1].rows)
+			break;
+	}
+
+	if (i == 4 && level > 1)
+		cost = (int64_t) width * height * 4;
+	else
+		cost = ((int64_t) width * height) << (2 * level);
+	if (budget) {
+		if (*budget < cost)
+			return NULL;
+		*budget -= cost;
+	}
+
+	tile = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	cairo_surface_flush(tile);
+	data = (uint32_t *) cairo_image_surface_get_data(tile);
+	stride = cairo_image_surface_get_stride(tile) / 4;
+
+	if (i == 4 && level > 1) {
+		for (i = 0; i < 4; i++) {
+			if (!child[i])
+				continue;
+			cairo_surface_flush(child[i]);
+			cw = cairo_image_surface_get_width(child[i]);
+			ch = cairo_image_surface_get_height(child[i]);
+			downsample_half(data + (i / 2) * (TILE_SIZE / 2) * stride +
+						(i % 2) * (TILE_SIZE / 2),
+					stride,
+					(const uint32_t *)
+						cairo_image_surface_get_data(child[i]),
+					cairo_image_surface_get_stride(child[i]) / 4,
+					cw, ch);
+		}
+	} else {
+		downsample_box(image, data, stride,
+			       column * TILE_SIZE, row * TILE_SIZE,
+			       width, height, 1 << level);
+	}
+
+	cairo_surface_mark_dirty(tile);
+	l->tiles[row * l->columns + column] = tile;
+
+	return tile;
+}
+
+/* Paints the part of a tile of some level that covers the rectangle,
+ * given in pixels of the image as loaded. */
+static void
+image_paint_tile(cairo_t *cr, cairo_surface_t *tile,
+		 int level, int column, int row,
+		 double x, double y, double width, double height)
+{
+	cairo_save(cr);
+	cairo_rectangle(cr, x, y, width, height);
+	cairo_scale(cr, 1 << level, 1 << level);
+	cairo_set_source_surface(cr, tile, column * TILE_SIZE, row * TILE_SIZE);
+	cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_PAD);
+	cairo_fill(cr);
+	cairo_restore(cr);
+}
+
+static void
+image_draw_tiles(struct image *image, cairo_t *cr,
+		 struct rectangle *allocation)
+{
+	double scale = get_scale(image);
+	int level, size, column, row, c0, r0, c1, r1, up;
+	double x0, y0, x1, y1, tx, ty, tw, th;
+	cairo_surface_t *tile;
+	bool pending = false;
+
+	level = (int) floor(log2(1.0 / scale));
+	if (level > image->n_levels - 1)
+		level = image->n_levels - 1;
+
+	/* At full size or close, cairo only samples what is in view. */
+	if (level <= 0) {
+		cairo_set_source_surface(cr, image->image, 0, 0);
+		cairo_paint(cr);
+		return;
+	}
+
+	x0 = MAX((allocation->x - image->matrix.x0) / scale, 0);
+	y0 = MAX((allocation->y - image->matrix.y0) / scale, 0);
+	x1 = MIN((allocation->x + allocation->width - image->matrix.x0) / scale,
+		 image->width);
+	y1 = MIN((allocation->y + allocation->height - image->matrix.y0) / scale,
+		 image->height);
+
+	size = TILE_SIZE << level;
+	c0 = x0 / size;
+	r0 = y0 / size;
+	c1 = MIN((int) ceil(x1 / size), image->levels[level].columns);
+	r1 = MIN((int) ceil(y1 / size), image->levels[level].rows);
+
+	/* Tiles meet without seams only if each pixel comes from one. */
+	cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
+
+	for (row = r0; row < r1; row++) {
+		for (column = c0; column < c1; column++) {
+			tx = column * size;
+			ty = row * size;
+			tw = MIN(size, image->width - tx);
+			th = MIN(size, image->height - ty);
+
+			/* A coarser tile stands in for one not made yet. With
+			 * none at all, there is nothing to do but make it. */
+			for (up = 0; level + up < image->n_levels; up++) {
+				tile = image_tile(image, level + up,
+						  column >> up, row >> up);
+				if (tile)
+					break;
+			}
+			if (!tile) {
+				up = 0;
+				tile = image_make_tile(image, level,
+						       column, row, NULL);
+			}
+			pending |= up > 0;
+
+			image_paint_tile(cr, tile, level + up,
+					 column >> up, row >> up,
+					 tx, ty, tw, th);
+		}
+	}
+
+	if (pending) {
+		image->pending.level = level;
+		image->pending.column0 = c0;
+		image->pending.row0 = r0;
+		image->pending.column1 = c1;
+		image->pending.row1 = r1;
+		toytimer_arm_once_usec(&image->tile_timer, 1);
+	}
+}
+
+/* Makes the tiles the last redraw had to stand in for, a few at a time */
+static void
+tile_timer_func(struct toytimer *tt)
+{
+	struct image *image = container_of(tt, struct image, tile_timer);
+	int64_t budget = TILE_STEP_PIXELS;
+	int column, row;
+
+	for (row = image->pending.row0; row < image->pending.row1; row++)
+		for (column = image->pending.column0;
+		     column < image->pending.column1; column++)
+			if (!image_make_tile(image, image->pending.level,
+					     column, row, &budget))
+				goto out;
+
+out:
+	window_schedule_redraw(image->window);
+}
+
 static void
 frame_redraw_handler(struct widget *widget, void *data)
 {
@@ -215,9 +560,8 @@ image_redraw_handler(struct widget *widget, void *data)
 	}
 
 	cairo_set_matrix(cr, &image->matrix);
-	cairo_set_source_surface(cr, image->image, 0, 0);
 	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-	cairo_paint(cr);
+	image_draw_tiles(image, cr, &allocation);
 	cairo_destroy(cr);
 }
 
@@ -411,6 +755,8 @@ close_handler(void *data)
 	if (*image->image_counter == 0)
 		display_exit(image->display);
 
+	toytimer_fini(&image->tile_timer);
+	image_fini_levels(image);
 	cairo_surface_destroy(image->image);
 
 	free(image->filename);
@@ -464,7 +810,11 @@ image_create(struct display *display, const char *filename,
 		return NULL;
 	}
 
+	image_init_levels(image);
+
 	image->window = window_create(display);
+	toytimer_init(&image->tile_timer, CLOCK_MONOTONIC, display,
+		      tile_timer_func);
 	window_set_title(image->window, title);
 	window_set_appid(image->window, "org.freedesktop.weston.wayland-image");
 	image->display = display;
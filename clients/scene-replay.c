@@ -0,0 +1,735 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * weston-scene-replay plays back a scene recorded by the compositor's
+ * 'scene-record' debug scope, see libweston/scene-record.c, to benchmark
+ * the compositor with the workload of a real session, e.g. on the
+ * headless backend:
+ *
+ *	weston-debug -o trace scene-record
+ *	weston-scene-replay trace
+ *
+ * Every recorded surface becomes a surface of this client: xdg_toplevel and
+ * xdg_popup surfaces become toplevels, sub-surfaces sub-surfaces of their
+ * recorded parent at the recorded position, and surfaces of other roles,
+ * like cursors, are skipped. Every recorded buffer commit attaches a wl_shm
+ * buffer of the recorded size, with the recorded damage filled with the
+ * recorded average color, at the recorded time unless --fast is given.
+ * Where the shell places toplevels is up to the compositor.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+
+#include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+#include "shared/timespec-util.h"
+#include <libweston/zalloc.h>
+#include "xdg-shell-client-protocol.h"
+
+#define SCENE_RECORD_VERSION 1
+#define XRGB8888_FOURCC 0x34325258 /* 'XR24' */
+#define MAX_BUFFERS 3 /* per surface */
+
+struct replay {
+	struct {
+		bool help;
+		bool fast;
+	} opt;
+
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_compositor *compositor;
+	uint32_t compositor_version;
+	struct wl_subcompositor *subcompositor;
+	struct wl_shm *shm;
+	struct xdg_wm_base *wm_base;
+
+	struct wl_list surface_list; /* replay_surface::link */
+
+	struct {
+		unsigned commits;
+		unsigned skipped;
+		unsigned surfaces;
+		unsigned buffers;
+	} stats;
+};
+
+struct replay_buffer {
+	struct wl_list link; /* replay_surface::buffer_list */
+	struct wl_buffer *buffer;
+	void *data;
+	size_t size;
+	int width, height;
+	uint32_t format;
+	bool busy;
+};
+
+struct replay_surface {
+	struct wl_list link; /* replay::surface_list */
+	struct replay *replay;
+	uint32_t id;
+	bool skipped;
+
+	struct wl_surface *surface;
+	struct wl_subsurface *subsurface;
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *xdg_toplevel;
+	bool configured;
+
+	struct wl_list buffer_list; /* replay_buffer::link */
+};
+
+/* A commit as recorded by libweston/scene-record.c */
+struct replay_commit {
+	uint32_t id;
+	uint32_t parent;
+	int pid;
+	char role[64];
+	int width, height;
+	int scale;
+	uint32_t format;
+	uint32_t color;
+	uint64_t hash;
+	int damage_x, damage_y, damage_width, damage_height;
+	int x, y;
+};
+
+static void
+buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct replay_buffer *buffer = data;
+
+	buffer->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	buffer_release
+};
+
+static struct replay_buffer *
+buffer_create(struct replay *replay, int width, int height, uint32_t format)
+{
+	struct replay_buffer *buffer;
+	struct wl_shm_pool *pool;
+	int stride = width * 4;
+	int fd;
+
+	buffer = zalloc(sizeof *buffer);
+	if (!buffer)
+		return NULL;
+
+	buffer->size = (size_t) stride * height;
+	fd = os_create_anonymous_file(buffer->size);
+	if (fd < 0) {
+		fprintf(stderr, "creating a buffer file for %zu B failed: %s\n",
+			buffer->size, strerror(errno));
+		free(buffer);
+		return NULL;
+	}
+
+	buffer->data = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, fd, 0);
+	if (buffer->data == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+		close(fd);
+		free(buffer);
+		return NULL;
+	}
+
+	pool = wl_shm_create_pool(replay->shm, fd, buffer->size);
+	buffer->buffer = wl_shm_pool_create_buffer(pool, 0, width, height,
+						   stride, format);
+	wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	buffer->width = width;
+	buffer->height = height;
+	buffer->format = format;
+	replay->stats.buffers++;
+
+	return buffer;
+}
+
+static void
+buffer_destroy(struct replay_buffer *buffer)
+{
+	wl_buffer_destroy(buffer->buffer);
+	munmap(buffer->data, buffer->size);
+	wl_list_remove(&buffer->link);
+	free(buffer);
+}
+
+static void
+buffer_fill(struct replay_buffer *buffer, int x, int y, int width, int height,
+	    uint32_t color)
+{
+	uint32_t *pixels = buffer->data;
+	int i, j;
+
+	if (x < 0) {
+		width += x;
+		x = 0;
+	}
+	if (y < 0) {
+		height += y;
+		y = 0;
+	}
+	width = MIN(width, buffer->width - x);
+	height = MIN(height, buffer->height - y);
+
+	for (j = y; j < y + height; j++)
+		for (i = x; i < x + width; i++)
+			pixels[j * buffer->width + i] = color;
+}
+
+/* Takes a released buffer of the size and format, or makes one. Like
+ * a real client, waits for one to be released when all are in use. */
+static struct replay_buffer *
+surface_get_buffer(struct replay_surface *surface, int width, int height,
+		   uint32_t format, uint32_t color)
+{
+	struct replay_buffer *buffer, *tmp;
+	int busy;
+
+	while (true) {
+		busy = 0;
+		wl_list_for_each_safe(buffer, tmp, &surface->buffer_list, link) {
+			if (buffer->busy) {
+				busy++;
+				continue;
+			}
+
+			if (buffer->width == width &&
+			    buffer->height == height &&
+			    buffer->format == format)
+				return buffer;
+
+			buffer_destroy(buffer);
+		}
+
+		if (busy < MAX_BUFFERS)
+			break;
+
+		if (wl_display_dispatch(surface->replay->display) < 0)
+			return NULL;
+	}
+
+	buffer = buffer_create(surface->replay, width, height, format);
+	if (!buffer)
+		return NULL;
+
+	buffer_fill(buffer, 0, 0, width, height, color);
+	wl_list_insert(&surface->buffer_list, &buffer->link);
+
+	return buffer;
+}
+
+static void
+xdg_surface_handle_configure(void *data, struct xdg_surface *xdg_surface,
+			     uint32_t serial)
+{
+	struct replay_surface *surface = data;
+
+	xdg_surface_ack_configure(xdg_surface, serial);
+	surface->configured = true;
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+	xdg_surface_handle_configure,
+};
+
+static void
+xdg_toplevel_handle_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+			      int32_t width, int32_t height,
+			      struct wl_array *states)
+{
+}
+
+static void
+xdg_toplevel_handle_close(void *data, struct xdg_toplevel *xdg_toplevel)
+{
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+	xdg_toplevel_handle_configure,
+	xdg_toplevel_handle_close,
+};
+
+static struct replay_surface *
+replay_find_surface(struct replay *replay, uint32_t id)
+{
+	struct replay_surface *surface;
+
+	wl_list_for_each(surface, &replay->surface_list, link)
+		if (surface->id == id)
+			return surface;
+
+	return NULL;
+}
+
+static struct replay_surface *
+replay_create_surface(struct replay *replay, const struct replay_commit *c)
+{
+	struct replay_surface *surface, *parent = NULL;
+
+	surface = zalloc(sizeof *surface);
+	if (!surface)
+		return NULL;
+
+	surface->replay = replay;
+	surface->id = c->id;
+	wl_list_init(&surface->buffer_list);
+	wl_list_insert(&replay->surface_list, &surface->link);
+
+	if (c->parent)
+		parent = replay_find_surface(replay, c->parent);
+
+	if (strcmp(c->role, "wl_subsurface") == 0) {
+		if (!parent || parent->skipped) {
+			surface->skipped = true;
+			return surface;
+		}
+	} else if (strcmp(c->role, "xdg_toplevel") != 0 &&
+		   strcmp(c->role, "xdg_popup") != 0) {
+		surface->skipped = true;
+		return surface;
+	}
+
+	surface->surface = wl_compositor_create_surface(replay->compositor);
+
+	if (parent) {
+		surface->subsurface =
+			wl_subcompositor_get_subsurface(replay->subcompositor,
+							surface->surface,
+							parent->surface);
+		wl_subsurface_set_desync(surface->subsurface);
+		surface->configured = true;
+	} else {
+		surface->xdg_surface =
+			xdg_wm_base_get_xdg_surface(replay->wm_base,
+						    surface->surface);
+		xdg_surface_add_listener(surface->xdg_surface,
+					 &xdg_surface_listener, surface);
+		surface->xdg_toplevel =
+			xdg_surface_get_toplevel(surface->xdg_surface);
+		xdg_toplevel_add_listener(surface->xdg_toplevel,
+					  &xdg_toplevel_listener, surface);
+		xdg_toplevel_set_title(surface->xdg_toplevel, "scene-replay");
+		xdg_toplevel_set_app_id(surface->xdg_toplevel,
+					"org.freedesktop.weston.scene-replay");
+		wl_surface_commit(surface->surface);
+
+		while (!surface->configured)
+			if (wl_display_dispatch(replay->display) < 0)
+				break;
+	}
+
+	replay->stats.surfaces++;
+
+	return surface;
+}
+
+static void
+replay_destroy_surface(struct replay_surface *surface)
+{
+	struct replay_buffer *buffer, *tmp;
+
+	if (surface->subsurface)
+		wl_subsurface_destroy(surface->subsurface);
+	if (surface->xdg_toplevel)
+		xdg_toplevel_destroy(surface->xdg_toplevel);
+	if (surface->xdg_surface)
+		xdg_surface_destroy(surface->xdg_surface);
+	if (surface->surface)
+		wl_surface_destroy(surface->surface);
+
+	wl_list_for_each_safe(buffer, tmp, &surface->buffer_list, link)
+		buffer_destroy(buffer);
+
+	wl_list_remove(&surface->link);
+	free(surface);
+}
+
+static void
+replay_commit(struct replay *replay, const struct replay_commit *c)
+{
+	struct replay_surface *surface;
+	struct replay_buffer *buffer;
+	uint32_t format;
+
+	surface = replay_find_surface(replay, c->id);
+	if (!surface)
+		surface = replay_create_surface(replay, c);
+	if (!surface)
+		return;
+
+	if (surface->skipped) {
+		replay->stats.skipped++;
+		return;
+	}
+
+	format = c->format == XRGB8888_FOURCC ? WL_SHM_FORMAT_XRGB8888 :
+						WL_SHM_FORMAT_ARGB8888;
+	buffer = surface_get_buffer(surface, c->width, c->height, format,
+				    c->color);
+	if (!buffer)
+		return;
+
+	buffer_fill(buffer, c->damage_x * c->scale, c->damage_y * c->scale,
+		    c->damage_width * c->scale, c->damage_height * c->scale,
+		    c->color);
+
+	if (surface->subsurface)
+		wl_subsurface_set_position(surface->subsurface, c->x, c->y);
+	if (replay->compositor_version >= WL_SURFACE_SET_BUFFER_SCALE_SINCE_VERSION)
+		wl_surface_set_buffer_scale(surface->surface, c->scale);
+	wl_surface_attach(surface->surface, buffer->buffer, 0, 0);
+	wl_surface_damage(surface->surface, c->damage_x, c->damage_y,
+			  c->damage_width, c->damage_height);
+	wl_surface_commit(surface->surface);
+	buffer->busy = true;
+
+	replay->stats.commits++;
+}
+
+static void
+replay_unmap(struct replay *replay, uint32_t id)
+{
+	struct replay_surface *surface = replay_find_surface(replay, id);
+
+	if (!surface || surface->skipped)
+		return;
+
+	wl_surface_attach(surface->surface, NULL, 0, 0);
+	wl_surface_commit(surface->surface);
+
+	/* A toplevel needs a new initial commit to be mapped again */
+	if (surface->xdg_surface) {
+		surface->configured = false;
+		wl_surface_commit(surface->surface);
+		while (!surface->configured)
+			if (wl_display_dispatch(replay->display) < 0)
+				break;
+	}
+}
+
+static int
+replay_flush(struct replay *replay)
+{
+	if (wl_display_dispatch_pending(replay->display) < 0)
+		return -1;
+
+	if (wl_display_flush(replay->display) < 0 && errno != EAGAIN)
+		return -1;
+
+	return 0;
+}
+
+/* Dispatches events until the monotonic clock reaches the target */
+static int
+replay_wait(struct replay *replay, const struct timespec *target)
+{
+	struct pollfd pfd = {
+		.fd = wl_display_get_fd(replay->display),
+		.events = POLLIN,
+	};
+	struct timespec now;
+	int64_t msec;
+
+	while (true) {
+		if (replay_flush(replay) < 0)
+			return -1;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		msec = timespec_sub_to_msec(target, &now);
+		if (msec <= 0)
+			return 0;
+
+		if (poll(&pfd, 1, msec) > 0 &&
+		    wl_display_dispatch(replay->display) < 0)
+			return -1;
+	}
+}
+
+static int
+replay_run(struct replay *replay, FILE *trace)
+{
+	struct timespec start, target, end;
+	int64_t first = -1, last = 0, usec;
+	struct replay_surface *surface;
+	struct replay_commit c;
+	char line[512];
+	uint32_t id;
+	int version;
+	int lineno = 1;
+
+	if (!fgets(line, sizeof line, trace) ||
+	    sscanf(line, "weston-scene-record %d", &version) != 1 ||
+	    version != SCENE_RECORD_VERSION) {
+		fprintf(stderr, "Error: not a version %d scene recording.\n",
+			SCENE_RECORD_VERSION);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (fgets(line, sizeof line, trace)) {
+		lineno++;
+
+		if (sscanf(line, "%" SCNd64, &usec) != 1)
+			goto malformed;
+		if (first < 0)
+			first = usec;
+		last = usec;
+
+		if (!replay->opt.fast) {
+			timespec_add_nsec(&target, &start,
+					  (usec - first) * 1000);
+			if (replay_wait(replay, &target) < 0)
+				return -1;
+		} else if (replay_flush(replay) < 0) {
+			return -1;
+		}
+
+		if (sscanf(line, "%*d commit surface=%u parent=%u pid=%d "
+			   "role=%63s size=%dx%d scale=%d format=0x%x "
+			   "color=0x%x hash=%" SCNx64 " damage=%d,%d,%dx%d "
+			   "pos=%d,%d",
+			   &c.id, &c.parent, &c.pid, c.role,
+			   &c.width, &c.height, &c.scale, &c.format,
+			   &c.color, &c.hash,
+			   &c.damage_x, &c.damage_y,
+			   &c.damage_width, &c.damage_height,
+			   &c.x, &c.y) == 16) {
+			if (c.scale < 1)
+				c.scale = 1;
+			replay_commit(replay, &c);
+		} else if (sscanf(line, "%*d unmap surface=%u", &id) == 1) {
+			replay_unmap(replay, id);
+		} else if (sscanf(line, "%*d destroy surface=%u", &id) == 1) {
+			surface = replay_find_surface(replay, id);
+			if (surface)
+				replay_destroy_surface(surface);
+		} else {
+			goto malformed;
+		}
+	}
+
+	wl_display_roundtrip(replay->display);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("Replayed %u commits on %u surfaces with %u buffers, "
+	       "skipped %u commits.\n",
+	       replay->stats.commits, replay->stats.surfaces,
+	       replay->stats.buffers, replay->stats.skipped);
+	printf("Recorded over %.3f s, replayed in %.3f s.\n",
+	       first < 0 ? 0.0 : (last - first) / 1e6,
+	       timespec_sub_to_nsec(&end, &start) / 1e9);
+
+	return 0;
+
+malformed:
+	fprintf(stderr, "Error: malformed line %d: %s", lineno, line);
+	return -1;
+}
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t id, const char *interface, uint32_t version)
+{
+	struct replay *replay = data;
+
+	if (strcmp(interface, wl_compositor_interface.name) == 0) {
+		replay->compositor_version = MIN(version, 4);
+		replay->compositor =
+			wl_registry_bind(registry, id, &wl_compositor_interface,
+					 replay->compositor_version);
+	} else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+		replay->subcompositor =
+			wl_registry_bind(registry, id,
+					 &wl_subcompositor_interface, 1);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		replay->shm = wl_registry_bind(registry, id,
+					       &wl_shm_interface, 1);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+		replay->wm_base = wl_registry_bind(registry, id,
+						   &xdg_wm_base_interface, 1);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+static void
+xdg_wm_base_handle_ping(void *data, struct xdg_wm_base *wm_base,
+			uint32_t serial)
+{
+	xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+	xdg_wm_base_handle_ping,
+};
+
+static void
+print_help(void)
+{
+	fprintf(stderr,
+		"Usage: weston-scene-replay [options] FILE\n"
+		"Replays a recording of the scene-record debug stream.\n"
+		"Where options may be:\n"
+		"  -h, --help\n"
+		"     This help text, and exit with success.\n"
+		"  -f, --fast\n"
+		"     Commit as fast as possible instead of at the\n"
+		"     recorded times.\n"
+		"FILE is the recording, or - for stdin.\n"
+		);
+}
+
+static int
+parse_cmdline(struct replay *replay, int argc, char **argv)
+{
+	static const struct option opts[] = {
+		{ "help", no_argument, NULL, 'h' },
+		{ "fast", no_argument, NULL, 'f' },
+		{ 0 }
+	};
+	static const char optstr[] = "hf";
+	int c;
+
+	while ((c = getopt_long(argc, argv, optstr, opts, NULL)) != -1) {
+		switch (c) {
+		case 'h':
+			replay->opt.help = true;
+			break;
+		case 'f':
+			replay->opt.fast = true;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct replay replay = {};
+	struct replay_surface *surface, *tmp;
+	FILE *trace;
+	int ret = 1;
+
+	wl_list_init(&replay.surface_list);
+
+	if (parse_cmdline(&replay, argc, argv) < 0 || optind != argc - 1) {
+		print_help();
+		return 1;
+	}
+
+	if (replay.opt.help) {
+		print_help();
+		return 0;
+	}
+
+	if (strcmp(argv[optind], "-") == 0)
+		trace = stdin;
+	else
+		trace = fopen(argv[optind], "r");
+	if (!trace) {
+		fprintf(stderr, "Error: opening %s failed: %s\n",
+			argv[optind], strerror(errno));
+		return 1;
+	}
+
+	replay.display = wl_display_connect(NULL);
+	if (!replay.display) {
+		fprintf(stderr, "Error: connecting to the compositor failed.\n");
+		goto out_trace;
+	}
+
+	replay.registry = wl_display_get_registry(replay.display);
+	wl_registry_add_listener(replay.registry, &registry_listener, &replay);
+	wl_display_roundtrip(replay.display);
+
+	if (!replay.compositor || !replay.subcompositor || !replay.shm ||
+	    !replay.wm_base) {
+		fprintf(stderr, "Error: the compositor lacks wl_compositor, "
+			"wl_subcompositor, wl_shm or xdg_wm_base.\n");
+		goto out_display;
+	}
+
+	xdg_wm_base_add_listener(replay.wm_base, &wm_base_listener, NULL);
+
+	if (replay_run(&replay, trace) == 0)
+		ret = 0;
+
+	wl_list_for_each_safe(surface, tmp, &replay.surface_list, link)
+		replay_destroy_surface(surface);
+
+out_display:
+	if (replay.wm_base)
+		xdg_wm_base_destroy(replay.wm_base);
+	if (replay.shm)
+		wl_shm_destroy(replay.shm);
+	if (replay.subcompositor)
+		wl_subcompositor_destroy(replay.subcompositor);
+	if (replay.compositor)
+		wl_compositor_destroy(replay.compositor);
+	wl_registry_destroy(replay.registry);
+	wl_display_disconnect(replay.display);
+out_trace:
+	if (trace != stdin)
+		fclose(trace);
+
+	return ret;
+}
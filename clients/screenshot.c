@@ -36,7 +36,8 @@
 #include <sys/param.h>
 #include <sys/mman.h>
 #include <pixman.h>
-#include <cairo.h>
+#include <pthread.h>
+#include <zlib.h>
 #include <assert.h>
 
 #include <wayland-client.h>
@@ -56,6 +57,10 @@ struct screenshooter_app {
 	bool retry;
 	bool failed;
 	int waitcount;
+
+	/* All outputs side by side; each is copied in as soon as its
+	 * capture completes. */
+	pixman_image_t *shot;
 };
 
 struct screenshooter_buffer {
@@ -87,6 +92,22 @@ struct buffer_size {
 	int max_x, max_y;
 };
 
+/* The PNG is compressed by as many threads as there are CPUs, each taking
+ * a strip of rows. Every strip is a deflate stream of its own, flushed to
+ * a byte boundary, so that they join up into the one stream PNG wants. */
+#define PNG_MAX_STRIPS 16
+
+struct png_strip {
+	pixman_image_t *shot;
+	int first_row, rows;
+	bool last;
+
+	unsigned char *out;
+	size_t out_len;
+	uLong adler;
+	bool failed;
+};
+
 static struct screenshooter_buffer *
 screenshot_create_shm_buffer(struct screenshooter_app *app,
 			     size_t width, size_t height,
@@ -187,8 +208,19 @@ capture_source_handle_complete(void *data,
 			       struct weston_capture_source_v1 *proxy)
 {
 	struct screenshooter_output *output = data;
+	struct screenshooter_app *app = output->app;
 
-	output->app->waitcount--;
+	app->waitcount--;
+
+	if (app->shot)
+		pixman_image_composite32(PIXMAN_OP_SRC,
+					 output->buffer->image, /* src */
+					 NULL, /* mask */
+					 app->shot, /* dest */
+					 0, 0, /* src x,y */
+					 0, 0, /* mask x,y */
+					 output->offset_x, output->offset_y, /* dst x,y */
+					 output->buffer_width, output->buffer_height);
 }
 
 static void
@@ -307,46 +339,208 @@ screenshooter_output_capture(struct screenshooter_output *output)
 	output->app->waitcount++;
 }
 
+/* Rows as PNG wants them: a filter type byte, then RGB. Each row is
+ * stored as its difference to the one above (filter type 2, Up), which
+ * costs little and works well on what screens show. */
 static void
-screenshot_write_png(const struct buffer_size *buff_size,
-		     struct wl_list *output_list)
+png_filter_row(unsigned char *out, const uint32_t *row,
+	       const uint32_t *above, int width)
 {
-	pixman_image_t *shot;
-	cairo_surface_t *surface;
-	struct screenshooter_output *output;
-	FILE *fp;
-	char filepath[PATH_MAX];
+	uint32_t p, q;
+	int x;
+
+	*out++ = 2;
+	for (x = 0; x < width; x++) {
+		p = row[x];
+		q = above ? above[x] : 0;
+		*out++ = ((p >> 16) & 0xff) - ((q >> 16) & 0xff);
+		*out++ = ((p >> 8) & 0xff) - ((q >> 8) & 0xff);
+		*out++ = (p & 0xff) - (q & 0xff);
+	}
+}
 
-	shot = pixman_image_create_bits(PIXMAN_a8r8g8b8,
-					buff_size->width, buff_size->height,
-					NULL, 0);
-	abort_oom_if_null(shot);
+static void *
+png_strip_compress(void *data)
+{
+	struct png_strip *strip = data;
+	int width = pixman_image_get_width(strip->shot);
+	int stride = pixman_image_get_stride(strip->shot) / 4;
+	const uint32_t *pixels = pixman_image_get_data(strip->shot);
+	size_t row_len = 1 + (size_t) width * 3;
+	unsigned char *row;
+	z_stream zs = {};
+	int y, flush;
+
+	row = xmalloc(row_len);
+	strip->adler = adler32(0, Z_NULL, 0);
+
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+		strip->failed = true;
+		free(row);
+		return NULL;
+	}
 
-	wl_list_for_each(output, output_list, link) {
-		pixman_image_composite32(PIXMAN_OP_SRC,
-					 output->buffer->image, /* src */
-					 NULL, /* mask */
-					 shot, /* dest */
-					 0, 0, /* src x,y */
-					 0, 0, /* mask x,y */
-					 output->offset_x, output->offset_y, /* dst x,y */
-					 output->buffer_width, output->buffer_height);
+	/* Room for the whole strip, plus the flush marker at its end */
+	strip->out_len = deflateBound(&zs, row_len * strip->rows) + 16;
+	strip->out = xmalloc(strip->out_len);
+	zs.next_out = strip->out;
+	zs.avail_out = strip->out_len;
+
+	for (y = strip->first_row; y < strip->first_row + strip->rows; y++) {
+		png_filter_row(row, pixels + y * stride,
+			       y > 0 ? pixels + (y - 1) * stride : NULL,
+			       width);
+		strip->adler = adler32(strip->adler, row, row_len);
+
+		if (y + 1 < strip->first_row + strip->rows)
+			flush = Z_NO_FLUSH;
+		else
+			flush = strip->last ? Z_FINISH : Z_SYNC_FLUSH;
+
+		zs.next_in = row;
+		zs.avail_in = row_len;
+		if (deflate(&zs, flush) == Z_STREAM_ERROR || zs.avail_in > 0) {
+			strip->failed = true;
+			break;
+		}
 	}
 
-	surface = cairo_image_surface_create_for_data((void *)pixman_image_get_data(shot),
-						      CAIRO_FORMAT_ARGB32,
-						      pixman_image_get_width(shot),
-						      pixman_image_get_height(shot),
-						      pixman_image_get_stride(shot));
+	strip->out_len -= zs.avail_out;
+	deflateEnd(&zs);
+	free(row);
+
+	return NULL;
+}
+
+static void
+png_write_chunk(FILE *fp, const char *type,
+		const unsigned char *data, size_t len)
+{
+	unsigned char header[8];
+	unsigned char trailer[4];
+	uLong crc;
+
+	header[0] = len >> 24;
+	header[1] = len >> 16;
+	header[2] = len >> 8;
+	header[3] = len;
+	memcpy(&header[4], type, 4);
+
+	crc = crc32(0, Z_NULL, 0);
+	crc = crc32(crc, &header[4], 4);
+	if (len > 0)
+		crc = crc32(crc, data, len);
+	trailer[0] = crc >> 24;
+	trailer[1] = crc >> 16;
+	trailer[2] = crc >> 8;
+	trailer[3] = crc;
+
+	fwrite(header, 1, sizeof header, fp);
+	if (len > 0)
+		fwrite(data, 1, len, fp);
+	fwrite(trailer, 1, sizeof trailer, fp);
+}
+
+static int
+png_write(FILE *fp, pixman_image_t *shot)
+{
+	static const unsigned char signature[8] = {
+		0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+	};
+	static const unsigned char zlib_header[2] = { 0x78, 0x9c };
+	struct png_strip strips[PNG_MAX_STRIPS] = {};
+	pthread_t threads[PNG_MAX_STRIPS];
+	bool started[PNG_MAX_STRIPS] = {};
+	int width = pixman_image_get_width(shot);
+	int height = pixman_image_get_height(shot);
+	unsigned char ihdr[13], adler[4];
+	uLong checksum;
+	size_t row_len = 1 + (size_t) width * 3;
+	long cpus;
+	int n, i, row;
+	int ret = 0;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	n = MAX(1, MIN(MIN(cpus, PNG_MAX_STRIPS), height));
+
+	for (i = 0, row = 0; i < n; i++) {
+		strips[i].shot = shot;
+		strips[i].first_row = row;
+		strips[i].rows = height / n + (i < height % n);
+		strips[i].last = i == n - 1;
+		row += strips[i].rows;
+
+		/* The last strip is done here, while the others run. */
+		if (i < n - 1)
+			started[i] = pthread_create(&threads[i], NULL,
+						    png_strip_compress,
+						    &strips[i]) == 0;
+	}
+
+	png_strip_compress(&strips[n - 1]);
+	for (i = 0; i < n - 1; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			png_strip_compress(&strips[i]);
+	}
+
+	ihdr[0] = width >> 24;
+	ihdr[1] = width >> 16;
+	ihdr[2] = width >> 8;
+	ihdr[3] = width;
+	ihdr[4] = height >> 24;
+	ihdr[5] = height >> 16;
+	ihdr[6] = height >> 8;
+	ihdr[7] = height;
+	ihdr[8] = 8;		/* bit depth */
+	ihdr[9] = 2;		/* color type: RGB */
+	ihdr[10] = 0;		/* deflate */
+	ihdr[11] = 0;		/* adaptive filtering */
+	ihdr[12] = 0;		/* no interlace */
+
+	fwrite(signature, 1, sizeof signature, fp);
+	png_write_chunk(fp, "IHDR", ihdr, sizeof ihdr);
+	png_write_chunk(fp, "IDAT", zlib_header, sizeof zlib_header);
+
+	checksum = strips[0].adler;
+	for (i = 0; i < n; i++) {
+		if (strips[i].failed)
+			ret = -1;
+		if (i > 0)
+			checksum = adler32_combine(checksum, strips[i].adler,
+						   row_len * strips[i].rows);
+		png_write_chunk(fp, "IDAT", strips[i].out, strips[i].out_len);
+		free(strips[i].out);
+	}
+
+	adler[0] = checksum >> 24;
+	adler[1] = checksum >> 16;
+	adler[2] = checksum >> 8;
+	adler[3] = checksum;
+	png_write_chunk(fp, "IDAT", adler, sizeof adler);
+	png_write_chunk(fp, "IEND", NULL, 0);
+
+	return ret;
+}
+
+static void
+screenshot_write_png(struct screenshooter_app *app)
+{
+	FILE *fp;
+	char filepath[PATH_MAX];
 
 	fp = file_create_dated(getenv("XDG_PICTURES_DIR"), "wayland-screenshot-",
 			       ".png", filepath, sizeof(filepath));
-	if (fp) {
-		fclose (fp);
-		cairo_surface_write_to_png(surface, filepath);
-	}
-	cairo_surface_destroy(surface);
-	pixman_image_unref(shot);
+	if (!fp)
+		return;
+
+	if (png_write(fp, app->shot) < 0)
+		fprintf(stderr, "Error: failed to compress %s\n", filepath);
+	if (fclose(fp) != 0)
+		fprintf(stderr, "Error: failed to write %s: %s\n",
+			filepath, strerror(errno));
 }
 
 static int
@@ -421,6 +615,19 @@ main(int argc, char *argv[])
 	do {
 		app.retry = false;
 
+		/* The sizes of the outputs are known by now, so each capture
+		 * can go to its place in the shot as soon as it is done. */
+		if (app.shot)
+			pixman_image_unref(app.shot);
+		app.shot = NULL;
+		if (screenshot_set_buffer_size(&buff_size, &app.output_list) < 0)
+			return -1;
+		app.shot = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+						    buff_size.width,
+						    buff_size.height,
+						    NULL, 0);
+		abort_oom_if_null(app.shot);
+
 		wl_list_for_each(output, &app.output_list, link)
 			screenshooter_output_capture(output);
 
@@ -431,13 +638,12 @@ main(int argc, char *argv[])
 		}
 	} while (app.retry && !app.failed);
 
-	if (!app.failed) {
-		if (screenshot_set_buffer_size(&buff_size, &app.output_list) < 0)
-			return -1;
-		screenshot_write_png(&buff_size, &app.output_list);
-	} else {
+	if (!app.failed)
+		screenshot_write_png(&app);
+	else
 		fprintf(stderr, "Error: screenshot or protocol failure\n");
-	}
+
+	pixman_image_unref(app.shot);
 
 	wl_list_for_each_safe(output, tmp_output, &app.output_list, link)
 		destroy_output(output);
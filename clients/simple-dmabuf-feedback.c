@@ -183,6 +183,8 @@ struct window {
 	struct wp_presentation_feedback *presentation_feedback;
 	bool wait_for_configure;
 	bool presented_zero_copy;
+	unsigned int presented_frames;
+	unsigned int zero_copy_frames;
 	struct zwp_linux_dmabuf_feedback_v1 *dmabuf_feedback_obj;
 	struct dmabuf_feedback dmabuf_feedback, pending_dmabuf_feedback;
 	int card_fd;
@@ -746,6 +748,10 @@ static void presentation_feedback_handle_presented(void *data,
 	}
 
 	window->presented_zero_copy = zero_copy;
+	window->presented_frames++;
+	if (zero_copy)
+		window->zero_copy_frames++;
+
 	wp_presentation_feedback_destroy(feedback);
 	window->presentation_feedback = NULL;
 }
@@ -1566,6 +1572,14 @@ main(int argc, char **argv)
 		delta_time = current_time.tv_sec - start_time.tv_sec;
 	}
 
+	if (window->presented_frames > 0) {
+		fprintf(stderr, "Scanout: %u of %u presented frames in "
+			"zero-copy mode (%.1f%%)\n",
+			window->zero_copy_frames, window->presented_frames,
+			100.0 * window->zero_copy_frames /
+			window->presented_frames);
+	}
+
 	destroy_window(window);
 	destroy_display(display);
 
@@ -0,0 +1,1111 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * weston-simple-stress puts a configurable load on the compositor: a number
+ * of toplevels, each with a number of sub-surfaces, all updating with a
+ * chosen damage pattern and buffer type, either on every frame callback or
+ * at a fixed rate, optionally with popups appearing and disappearing. It
+ * prints the frame callback, commit and presentation rates every second,
+ * and the commit-to-present latency from wp_presentation feedback at the
+ * end. See --help for the options.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <drm_fourcc.h>
+#include <gbm.h>
+#include <wayland-client.h>
+
+#include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "xdg-shell-client-protocol.h"
+
+#define NUM_BUFFERS 3
+#define POPUP_SIZE 64
+
+enum damage_pattern {
+	DAMAGE_FULL,
+	DAMAGE_BAND,
+	DAMAGE_SCATTER,
+};
+
+enum buffer_type {
+	BUFFER_SHM,
+	BUFFER_DMABUF,
+};
+
+struct rectangle {
+	int x, y, width, height;
+};
+
+struct options {
+	int toplevels;
+	int subsurfaces;
+	int width, height;
+	enum damage_pattern damage;
+	enum buffer_type buffer_type;
+	int rate;		/* updates per second, 0 for frame callbacks */
+	int popup_rate;		/* popups per second */
+	int duration;		/* seconds */
+	const char *drm_node;
+};
+
+struct stats {
+	uint64_t frame_callbacks;
+	uint64_t commits;
+	uint64_t presented;
+	uint64_t discarded;
+	uint64_t skipped;	/* updates without a free buffer */
+	uint64_t popups;
+};
+
+struct display {
+	struct options opt;
+
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_compositor *compositor;
+	uint32_t compositor_version;
+	struct wl_subcompositor *subcompositor;
+	struct wl_shm *shm;
+	struct xdg_wm_base *wm_base;
+	struct zwp_linux_dmabuf_v1 *dmabuf;
+	struct wp_presentation *presentation;
+	clockid_t presentation_clock;
+
+	int drm_fd;
+	struct gbm_device *gbm;
+
+	struct wl_list surface_list; /* surface::link */
+	struct surface *popup;
+
+	struct stats stats, last_stats;
+	struct wl_array latencies; /* int64_t, usec */
+	bool running;
+};
+
+struct buffer {
+	struct surface *surface;
+	struct wl_buffer *wl_buffer;
+	bool busy;
+
+	/* BUFFER_SHM */
+	void *data;
+	size_t size;
+
+	/* BUFFER_DMABUF */
+	struct gbm_bo *bo;
+
+	int stride;
+};
+
+struct surface {
+	struct wl_list link; /* display::surface_list */
+	struct display *display;
+	enum buffer_type buffer_type;
+	int width, height;
+
+	struct wl_surface *wl_surface;
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *xdg_toplevel;
+	struct xdg_popup *xdg_popup;
+	struct wl_subsurface *subsurface;
+	bool configured;
+
+	struct wl_callback *frame;
+	struct buffer buffers[NUM_BUFFERS];
+	uint32_t frame_count;
+};
+
+struct feedback {
+	struct display *display;
+	struct wp_presentation_feedback *obj;
+	struct timespec commit;
+};
+
+static void
+buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct buffer *buffer = data;
+
+	buffer->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	buffer_release
+};
+
+static bool
+buffer_create_shm(struct buffer *buffer, int width, int height)
+{
+	struct display *display = buffer->surface->display;
+	struct wl_shm_pool *pool;
+	int fd;
+
+	buffer->stride = width * 4;
+	buffer->size = (size_t) buffer->stride * height;
+
+	fd = os_create_anonymous_file(buffer->size);
+	if (fd < 0) {
+		fprintf(stderr, "creating a buffer file for %zu B failed: %s\n",
+			buffer->size, strerror(errno));
+		return false;
+	}
+
+	buffer->data = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, fd, 0);
+	if (buffer->data == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+		buffer->data = NULL;
+		close(fd);
+		return false;
+	}
+
+	pool = wl_shm_create_pool(display->shm, fd, buffer->size);
+	buffer->wl_buffer =
+		wl_shm_pool_create_buffer(pool, 0, width, height,
+					  buffer->stride,
+					  WL_SHM_FORMAT_XRGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	return true;
+}
+
+static bool
+buffer_create_dmabuf(struct buffer *buffer, int width, int height)
+{
+	struct display *display = buffer->surface->display;
+	struct zwp_linux_buffer_params_v1 *params;
+	uint64_t modifier;
+	int fd;
+
+	buffer->bo = gbm_bo_create(display->gbm, width, height,
+				   DRM_FORMAT_XRGB8888,
+				   GBM_BO_USE_LINEAR | GBM_BO_USE_RENDERING);
+	if (!buffer->bo) {
+		fprintf(stderr, "creating a %dx%d GBM bo failed\n",
+			width, height);
+		return false;
+	}
+
+	fd = gbm_bo_get_fd(buffer->bo);
+	if (fd < 0) {
+		fprintf(stderr, "exporting a GBM bo failed\n");
+		gbm_bo_destroy(buffer->bo);
+		buffer->bo = NULL;
+		return false;
+	}
+
+	buffer->stride = gbm_bo_get_stride(buffer->bo);
+	modifier = gbm_bo_get_modifier(buffer->bo);
+
+	params = zwp_linux_dmabuf_v1_create_params(display->dmabuf);
+	zwp_linux_buffer_params_v1_add(params, fd, 0, 0, buffer->stride,
+				       modifier >> 32, modifier & 0xffffffff);
+	buffer->wl_buffer =
+		zwp_linux_buffer_params_v1_create_immed(params, width, height,
+							DRM_FORMAT_XRGB8888, 0);
+	zwp_linux_buffer_params_v1_destroy(params);
+	close(fd);
+
+	return true;
+}
+
+static bool
+buffer_create(struct surface *surface, struct buffer *buffer)
+{
+	bool ret;
+
+	buffer->surface = surface;
+
+	if (surface->buffer_type == BUFFER_DMABUF)
+		ret = buffer_create_dmabuf(buffer, surface->width,
+					   surface->height);
+	else
+		ret = buffer_create_shm(buffer, surface->width,
+					surface->height);
+	if (!ret)
+		return false;
+
+	wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener, buffer);
+
+	return true;
+}
+
+static void
+buffer_destroy(struct buffer *buffer)
+{
+	if (buffer->wl_buffer)
+		wl_buffer_destroy(buffer->wl_buffer);
+	if (buffer->data)
+		munmap(buffer->data, buffer->size);
+	if (buffer->bo)
+		gbm_bo_destroy(buffer->bo);
+
+	memset(buffer, 0, sizeof *buffer);
+}
+
+static void
+buffer_fill(struct buffer *buffer, const struct rectangle *rects, int n,
+	    uint32_t color)
+{
+	void *map_data = NULL;
+	uint32_t stride = buffer->stride;
+	uint8_t *data = buffer->data;
+	int i, x, y;
+
+	if (buffer->bo) {
+		data = gbm_bo_map(buffer->bo, 0, 0,
+				  buffer->surface->width,
+				  buffer->surface->height,
+				  GBM_BO_TRANSFER_WRITE, &stride, &map_data);
+		if (!data)
+			return;
+	}
+
+	for (i = 0; i < n; i++) {
+		for (y = rects[i].y; y < rects[i].y + rects[i].height; y++) {
+			uint32_t *row = (uint32_t *) (data + y * stride);
+
+			for (x = rects[i].x; x < rects[i].x + rects[i].width; x++)
+				row[x] = color;
+		}
+	}
+
+	if (buffer->bo)
+		gbm_bo_unmap(buffer->bo, map_data);
+}
+
+static struct buffer *
+surface_next_buffer(struct surface *surface)
+{
+	struct buffer *buffer;
+	struct rectangle all = { 0, 0, surface->width, surface->height };
+	int i;
+
+	for (i = 0; i < NUM_BUFFERS; i++) {
+		buffer = &surface->buffers[i];
+		if (buffer->busy)
+			continue;
+
+		if (!buffer->wl_buffer) {
+			if (!buffer_create(surface, buffer))
+				return NULL;
+			buffer_fill(buffer, &all, 1, 0xff202020);
+		}
+
+		return buffer;
+	}
+
+	return NULL;
+}
+
+/* The damage of the next frame, according to the damage pattern */
+static int
+surface_frame_damage(struct surface *surface, struct rectangle *rects)
+{
+	struct display *display = surface->display;
+	int band, size, i;
+
+	switch (display->opt.damage) {
+	case DAMAGE_FULL:
+		break;
+	case DAMAGE_BAND:
+		band = MAX(surface->height / 8, 1);
+		rects[0] = (struct rectangle) {
+			0, surface->frame_count * band % surface->height,
+			surface->width, band,
+		};
+		rects[0].height = MIN(band, surface->height - rects[0].y);
+		return 1;
+	case DAMAGE_SCATTER:
+		size = MAX(MIN(surface->width, surface->height) / 16, 1);
+		for (i = 0; i < 4; i++) {
+			rects[i] = (struct rectangle) {
+				rand() % (surface->width - size + 1),
+				rand() % (surface->height - size + 1),
+				size, size,
+			};
+		}
+		return 4;
+	}
+
+	rects[0] = (struct rectangle) { 0, 0, surface->width, surface->height };
+	return 1;
+}
+
+static void
+feedback_sync_output(void *data, struct wp_presentation_feedback *obj,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data, struct wp_presentation_feedback *obj,
+		   uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+		   uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct feedback *fb = data;
+	struct display *display = fb->display;
+	struct timespec presented;
+	int64_t *latency;
+
+	timespec_from_proto(&presented, tv_sec_hi, tv_sec_lo, tv_nsec);
+	latency = wl_array_add(&display->latencies, sizeof *latency);
+	if (latency)
+		*latency = timespec_sub_to_nsec(&presented, &fb->commit) / 1000;
+	display->stats.presented++;
+
+	wp_presentation_feedback_destroy(obj);
+	free(fb);
+}
+
+static void
+feedback_discarded(void *data, struct wp_presentation_feedback *obj)
+{
+	struct feedback *fb = data;
+
+	fb->display->stats.discarded++;
+
+	wp_presentation_feedback_destroy(obj);
+	free(fb);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded,
+};
+
+static void
+surface_redraw(struct surface *surface);
+
+static void
+frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct surface *surface = data;
+	struct display *display = surface->display;
+
+	wl_callback_destroy(callback);
+	surface->frame = NULL;
+	display->stats.frame_callbacks++;
+
+	if (display->opt.rate == 0)
+		surface_redraw(surface);
+}
+
+static const struct wl_callback_listener frame_listener = {
+	frame_done
+};
+
+static void
+surface_redraw(struct surface *surface)
+{
+	struct display *display = surface->display;
+	struct rectangle rects[4];
+	struct buffer *buffer;
+	struct feedback *fb;
+	uint32_t color;
+	int n, i;
+
+	if (!surface->configured)
+		return;
+
+	buffer = surface_next_buffer(surface);
+	if (!buffer) {
+		display->stats.skipped++;
+		return;
+	}
+
+	n = surface_frame_damage(surface, rects);
+	color = 0xff000000 | (surface->frame_count * 0x010305 & 0xffffff);
+	buffer_fill(buffer, rects, n, color);
+
+	wl_surface_attach(surface->wl_surface, buffer->wl_buffer, 0, 0);
+	for (i = 0; i < n; i++) {
+		if (display->compositor_version >=
+		    WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION)
+			wl_surface_damage_buffer(surface->wl_surface,
+						 rects[i].x, rects[i].y,
+						 rects[i].width,
+						 rects[i].height);
+		else
+			wl_surface_damage(surface->wl_surface,
+					  rects[i].x, rects[i].y,
+					  rects[i].width, rects[i].height);
+	}
+
+	if (!surface->frame) {
+		surface->frame = wl_surface_frame(surface->wl_surface);
+		wl_callback_add_listener(surface->frame, &frame_listener,
+					 surface);
+	}
+
+	if (display->presentation) {
+		fb = xzalloc(sizeof *fb);
+		fb->display = display;
+		fb->obj = wp_presentation_feedback(display->presentation,
+						   surface->wl_surface);
+		wp_presentation_feedback_add_listener(fb->obj,
+						      &feedback_listener, fb);
+		clock_gettime(display->presentation_clock, &fb->commit);
+	}
+
+	wl_surface_commit(surface->wl_surface);
+	buffer->busy = true;
+	surface->frame_count++;
+	display->stats.commits++;
+}
+
+static void
+xdg_surface_handle_configure(void *data, struct xdg_surface *xdg_surface,
+			     uint32_t serial)
+{
+	struct surface *surface = data;
+	bool first = !surface->configured;
+
+	xdg_surface_ack_configure(xdg_surface, serial);
+	surface->configured = true;
+
+	if (first)
+		surface_redraw(surface);
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+	xdg_surface_handle_configure,
+};
+
+static void
+xdg_toplevel_handle_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+			      int32_t width, int32_t height,
+			      struct wl_array *states)
+{
+	/* The load stays what it was asked to be, whatever the size. */
+}
+
+static void
+xdg_toplevel_handle_close(void *data, struct xdg_toplevel *xdg_toplevel)
+{
+	struct surface *surface = data;
+
+	surface->display->running = false;
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+	xdg_toplevel_handle_configure,
+	xdg_toplevel_handle_close,
+};
+
+static void
+xdg_popup_handle_configure(void *data, struct xdg_popup *xdg_popup,
+			   int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static void
+xdg_popup_handle_done(void *data, struct xdg_popup *xdg_popup)
+{
+}
+
+static const struct xdg_popup_listener xdg_popup_listener = {
+	xdg_popup_handle_configure,
+	xdg_popup_handle_done,
+};
+
+static struct surface *
+surface_create(struct display *display, int width, int height,
+	       enum buffer_type buffer_type)
+{
+	struct surface *surface;
+
+	surface = xzalloc(sizeof *surface);
+	surface->display = display;
+	surface->width = width;
+	surface->height = height;
+	surface->buffer_type = buffer_type;
+	surface->wl_surface = wl_compositor_create_surface(display->compositor);
+	wl_list_insert(display->surface_list.prev, &surface->link);
+
+	return surface;
+}
+
+static void
+surface_destroy(struct surface *surface)
+{
+	int i;
+
+	if (surface->frame)
+		wl_callback_destroy(surface->frame);
+	if (surface->subsurface)
+		wl_subsurface_destroy(surface->subsurface);
+	if (surface->xdg_popup)
+		xdg_popup_destroy(surface->xdg_popup);
+	if (surface->xdg_toplevel)
+		xdg_toplevel_destroy(surface->xdg_toplevel);
+	if (surface->xdg_surface)
+		xdg_surface_destroy(surface->xdg_surface);
+	wl_surface_destroy(surface->wl_surface);
+
+	for (i = 0; i < NUM_BUFFERS; i++)
+		buffer_destroy(&surface->buffers[i]);
+
+	wl_list_remove(&surface->link);
+	free(surface);
+}
+
+static struct surface *
+toplevel_create(struct display *display, int index)
+{
+	struct options *opt = &display->opt;
+	struct surface *surface;
+	char title[32];
+
+	surface = surface_create(display, opt->width, opt->height,
+				 opt->buffer_type);
+	surface->xdg_surface =
+		xdg_wm_base_get_xdg_surface(display->wm_base,
+					    surface->wl_surface);
+	xdg_surface_add_listener(surface->xdg_surface, &xdg_surface_listener,
+				 surface);
+	surface->xdg_toplevel = xdg_surface_get_toplevel(surface->xdg_surface);
+	xdg_toplevel_add_listener(surface->xdg_toplevel,
+				  &xdg_toplevel_listener, surface);
+
+	snprintf(title, sizeof title, "simple-stress %d", index);
+	xdg_toplevel_set_title(surface->xdg_toplevel, title);
+	xdg_toplevel_set_app_id(surface->xdg_toplevel,
+				"org.freedesktop.weston.simple-stress");
+	wl_surface_commit(surface->wl_surface);
+
+	return surface;
+}
+
+static void
+subsurface_create(struct display *display, struct surface *parent, int index)
+{
+	struct options *opt = &display->opt;
+	int width = MAX(opt->width / 4, 1);
+	int height = MAX(opt->height / 4, 1);
+	struct surface *surface;
+
+	surface = surface_create(display, width, height, opt->buffer_type);
+	surface->subsurface =
+		wl_subcompositor_get_subsurface(display->subcompositor,
+						surface->wl_surface,
+						parent->wl_surface);
+	wl_subsurface_set_desync(surface->subsurface);
+	wl_subsurface_set_position(surface->subsurface,
+				   (index * width / 2) % opt->width,
+				   (index * height / 3) % opt->height);
+	surface->configured = true;
+	surface_redraw(surface);
+}
+
+/* Replaces the popup, if any, by one on a random toplevel */
+static void
+popup_churn(struct display *display)
+{
+	struct xdg_positioner *positioner;
+	struct surface *parent = NULL, *surface;
+	int n = 0;
+
+	if (display->popup) {
+		surface_destroy(display->popup);
+		display->popup = NULL;
+	}
+
+	wl_list_for_each(surface, &display->surface_list, link) {
+		if (surface->xdg_toplevel && surface->configured &&
+		    rand() % ++n == 0)
+			parent = surface;
+	}
+	if (!parent)
+		return;
+
+	surface = surface_create(display, POPUP_SIZE, POPUP_SIZE, BUFFER_SHM);
+	surface->xdg_surface =
+		xdg_wm_base_get_xdg_surface(display->wm_base,
+					    surface->wl_surface);
+	xdg_surface_add_listener(surface->xdg_surface, &xdg_surface_listener,
+				 surface);
+
+	positioner = xdg_wm_base_create_positioner(display->wm_base);
+	xdg_positioner_set_size(positioner, POPUP_SIZE, POPUP_SIZE);
+	xdg_positioner_set_anchor_rect(positioner,
+				       rand() % parent->width,
+				       rand() % parent->height, 1, 1);
+	surface->xdg_popup = xdg_surface_get_popup(surface->xdg_surface,
+						   parent->xdg_surface,
+						   positioner);
+	xdg_popup_add_listener(surface->xdg_popup, &xdg_popup_listener,
+			       surface);
+	xdg_positioner_destroy(positioner);
+	wl_surface_commit(surface->wl_surface);
+
+	display->popup = surface;
+	display->stats.popups++;
+}
+
+static void
+presentation_clock_id(void *data, struct wp_presentation *presentation,
+		      uint32_t clk_id)
+{
+	struct display *display = data;
+
+	display->presentation_clock = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id
+};
+
+static void
+xdg_wm_base_ping(void *data, struct xdg_wm_base *wm_base, uint32_t serial)
+{
+	xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+	xdg_wm_base_ping,
+};
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t id, const char *interface, uint32_t version)
+{
+	struct display *d = data;
+
+	if (strcmp(interface, wl_compositor_interface.name) == 0) {
+		d->compositor_version = MIN(version, 4);
+		d->compositor = wl_registry_bind(registry, id,
+						 &wl_compositor_interface,
+						 d->compositor_version);
+	} else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+		d->subcompositor = wl_registry_bind(registry, id,
+						    &wl_subcompositor_interface,
+						    1);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		d->shm = wl_registry_bind(registry, id, &wl_shm_interface, 1);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+		d->wm_base = wl_registry_bind(registry, id,
+					      &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(d->wm_base, &wm_base_listener, d);
+	} else if (strcmp(interface, zwp_linux_dmabuf_v1_interface.name) == 0 &&
+		   version >= 2) {
+		d->dmabuf = wl_registry_bind(registry, id,
+					     &zwp_linux_dmabuf_v1_interface, 2);
+	} else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+		d->presentation = wl_registry_bind(registry, id,
+						   &wp_presentation_interface,
+						   1);
+		wp_presentation_add_listener(d->presentation,
+					     &presentation_listener, d);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+static int
+timer_create_hz(int hz)
+{
+	struct itimerspec its = { 0 };
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0)
+		return -1;
+
+	timespec_from_nsec(&its.it_interval, 1000000000 / hz);
+	its.it_value = its.it_interval;
+	timerfd_settime(fd, 0, &its, NULL);
+
+	return fd;
+}
+
+static bool
+timer_expired(struct pollfd *pfd)
+{
+	uint64_t expirations;
+
+	if (pfd->fd < 0 || !(pfd->revents & POLLIN))
+		return false;
+
+	return read(pfd->fd, &expirations, sizeof expirations) ==
+	       sizeof expirations;
+}
+
+static int
+compare_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a;
+	int64_t y = *(const int64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+print_second(struct display *display, int second)
+{
+	struct stats *s = &display->stats, *l = &display->last_stats;
+
+	printf("%3ds: %" PRIu64 " frame callbacks/s, %" PRIu64 " commits/s, "
+	       "%" PRIu64 " presented/s, %" PRIu64 " without free buffer\n",
+	       second, s->frame_callbacks - l->frame_callbacks,
+	       s->commits - l->commits, s->presented - l->presented,
+	       s->skipped - l->skipped);
+
+	*l = *s;
+}
+
+static void
+print_summary(struct display *display, double seconds)
+{
+	struct stats *s = &display->stats;
+	int surfaces = wl_list_length(&display->surface_list) -
+		       (display->popup ? 1 : 0);
+	int64_t *latencies = display->latencies.data;
+	size_t n = display->latencies.size / sizeof *latencies;
+	int64_t sum = 0;
+	size_t i;
+
+	printf("\n%d surfaces over %.1f s: %.1f frame callbacks/s "
+	       "(%.1f per surface), %.1f commits/s, %" PRIu64 " popups\n",
+	       surfaces, seconds, s->frame_callbacks / seconds,
+	       s->frame_callbacks / seconds / MAX(surfaces, 1),
+	       s->commits / seconds, s->popups);
+	printf("%" PRIu64 " presented, %" PRIu64 " discarded, %" PRIu64
+	       " updates without a free buffer\n",
+	       s->presented, s->discarded, s->skipped);
+
+	if (n == 0)
+		return;
+
+	qsort(latencies, n, sizeof *latencies, compare_int64);
+	for (i = 0; i < n; i++)
+		sum += latencies[i];
+
+	printf("commit-to-present latency: mean %.2f ms, p50 %.2f ms, "
+	       "p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+	       sum / (double) n / 1e3, latencies[n / 2] / 1e3,
+	       latencies[n * 9 / 10] / 1e3, latencies[n * 99 / 100] / 1e3,
+	       latencies[n - 1] / 1e3);
+}
+
+static void
+print_help(void)
+{
+	fprintf(stderr,
+		"Usage: weston-simple-stress [options]\n"
+		"Where options may be:\n"
+		"  -h, --help\n"
+		"     This help text, and exit with success.\n"
+		"  -t N, --toplevels N\n"
+		"     Number of toplevels, 4 by default.\n"
+		"  -s N, --subsurfaces N\n"
+		"     Number of sub-surfaces per toplevel, 2 by default.\n"
+		"  -S WxH, --size WxH\n"
+		"     Size of the toplevels, 256x256 by default. Sub-surfaces\n"
+		"     are a quarter of it in both directions.\n"
+		"  -d PATTERN, --damage PATTERN\n"
+		"     full (the default), band for a band of 1/8 of the height\n"
+		"     moving down every frame, or scatter for 4 small squares\n"
+		"     at random.\n"
+		"  -b TYPE, --buffer TYPE\n"
+		"     shm (the default) or dmabuf, for linear GBM buffers.\n"
+		"  -r HZ, --rate HZ\n"
+		"     Update every surface HZ times per second instead of on\n"
+		"     every frame callback.\n"
+		"  -p HZ, --popups HZ\n"
+		"     Replace a popup on a random toplevel HZ times per second.\n"
+		"  -T SECONDS, --time SECONDS\n"
+		"     Run for SECONDS, 10 by default.\n"
+		"  -n NODE, --drm-node NODE\n"
+		"     DRM render node for dmabuf buffers, /dev/dri/renderD128\n"
+		"     by default.\n");
+}
+
+static int
+parse_cmdline(struct options *opt, int argc, char **argv)
+{
+	static const struct option opts[] = {
+		{ "help", no_argument, NULL, 'h' },
+		{ "toplevels", required_argument, NULL, 't' },
+		{ "subsurfaces", required_argument, NULL, 's' },
+		{ "size", required_argument, NULL, 'S' },
+		{ "damage", required_argument, NULL, 'd' },
+		{ "buffer", required_argument, NULL, 'b' },
+		{ "rate", required_argument, NULL, 'r' },
+		{ "popups", required_argument, NULL, 'p' },
+		{ "time", required_argument, NULL, 'T' },
+		{ "drm-node", required_argument, NULL, 'n' },
+		{ 0 }
+	};
+	int c;
+
+	while ((c = getopt_long(argc, argv, "ht:s:S:d:b:r:p:T:n:",
+				opts, NULL)) != -1) {
+		switch (c) {
+		case 'h':
+			print_help();
+			exit(EXIT_SUCCESS);
+		case 't':
+			opt->toplevels = atoi(optarg);
+			break;
+		case 's':
+			opt->subsurfaces = atoi(optarg);
+			break;
+		case 'S':
+			if (sscanf(optarg, "%dx%d", &opt->width,
+				   &opt->height) != 2)
+				return -1;
+			break;
+		case 'd':
+			if (strcmp(optarg, "full") == 0)
+				opt->damage = DAMAGE_FULL;
+			else if (strcmp(optarg, "band") == 0)
+				opt->damage = DAMAGE_BAND;
+			else if (strcmp(optarg, "scatter") == 0)
+				opt->damage = DAMAGE_SCATTER;
+			else
+				return -1;
+			break;
+		case 'b':
+			if (strcmp(optarg, "shm") == 0)
+				opt->buffer_type = BUFFER_SHM;
+			else if (strcmp(optarg, "dmabuf") == 0)
+				opt->buffer_type = BUFFER_DMABUF;
+			else
+				return -1;
+			break;
+		case 'r':
+			opt->rate = atoi(optarg);
+			break;
+		case 'p':
+			opt->popup_rate = atoi(optarg);
+			break;
+		case 'T':
+			opt->duration = atoi(optarg);
+			break;
+		case 'n':
+			opt->drm_node = optarg;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (optind != argc || opt->toplevels < 1 || opt->subsurfaces < 0 ||
+	    opt->width < 4 || opt->height < 4 || opt->rate < 0 ||
+	    opt->popup_rate < 0 || opt->duration < 1)
+		return -1;
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct display display = {
+		.opt = {
+			.toplevels = 4,
+			.subsurfaces = 2,
+			.width = 256,
+			.height = 256,
+			.duration = 10,
+			.drm_node = "/dev/dri/renderD128",
+		},
+		.presentation_clock = CLOCK_MONOTONIC,
+		.drm_fd = -1,
+		.running = true,
+	};
+	enum { FD_DISPLAY, FD_UPDATE, FD_POPUP, FD_REPORT, FD_COUNT };
+	struct pollfd pfd[FD_COUNT];
+	struct surface *surface, *tmp;
+	struct timespec start, now;
+	int second = 0;
+	int i, j;
+
+	if (parse_cmdline(&display.opt, argc, argv) < 0) {
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	wl_list_init(&display.surface_list);
+	wl_array_init(&display.latencies);
+	srand(1);
+
+	display.display = wl_display_connect(NULL);
+	if (!display.display) {
+		fprintf(stderr, "connecting to the compositor failed\n");
+		return EXIT_FAILURE;
+	}
+
+	display.registry = wl_display_get_registry(display.display);
+	wl_registry_add_listener(display.registry, &registry_listener,
+				 &display);
+	wl_display_roundtrip(display.display);
+	wl_display_roundtrip(display.display);
+
+	if (!display.compositor || !display.subcompositor || !display.shm ||
+	    !display.wm_base) {
+		fprintf(stderr, "wl_compositor, wl_subcompositor, wl_shm or "
+			"xdg_wm_base missing\n");
+		return EXIT_FAILURE;
+	}
+
+	if (display.opt.buffer_type == BUFFER_DMABUF) {
+		if (!display.dmabuf) {
+			fprintf(stderr, "zwp_linux_dmabuf_v1 missing\n");
+			return EXIT_FAILURE;
+		}
+
+		display.drm_fd = open(display.opt.drm_node, O_RDWR | O_CLOEXEC);
+		if (display.drm_fd >= 0)
+			display.gbm = gbm_create_device(display.drm_fd);
+		if (!display.gbm) {
+			fprintf(stderr, "opening %s for GBM failed\n",
+				display.opt.drm_node);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < display.opt.toplevels; i++) {
+		surface = toplevel_create(&display, i);
+		for (j = 0; j < display.opt.subsurfaces; j++)
+			subsurface_create(&display, surface, j);
+	}
+
+	pfd[FD_DISPLAY].fd = wl_display_get_fd(display.display);
+	pfd[FD_UPDATE].fd = display.opt.rate ?
+			    timer_create_hz(display.opt.rate) : -1;
+	pfd[FD_POPUP].fd = display.opt.popup_rate ?
+			   timer_create_hz(display.opt.popup_rate) : -1;
+	pfd[FD_REPORT].fd = timer_create_hz(1);
+	for (i = 0; i < FD_COUNT; i++)
+		pfd[i].events = POLLIN;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (display.running && second < display.opt.duration) {
+		while (wl_display_prepare_read(display.display) != 0)
+			wl_display_dispatch_pending(display.display);
+
+		if (wl_display_flush(display.display) < 0 && errno != EAGAIN) {
+			wl_display_cancel_read(display.display);
+			break;
+		}
+
+		if (poll(pfd, FD_COUNT, -1) < 0 && errno != EINTR) {
+			wl_display_cancel_read(display.display);
+			break;
+		}
+
+		if (pfd[FD_DISPLAY].revents & POLLIN) {
+			if (wl_display_read_events(display.display) < 0)
+				break;
+		} else {
+			wl_display_cancel_read(display.display);
+		}
+		if (wl_display_dispatch_pending(display.display) < 0)
+			break;
+
+		if (timer_expired(&pfd[FD_UPDATE])) {
+			wl_list_for_each(surface, &display.surface_list, link)
+				surface_redraw(surface);
+		}
+
+		if (timer_expired(&pfd[FD_POPUP]))
+			popup_churn(&display);
+
+		if (timer_expired(&pfd[FD_REPORT]))
+			print_second(&display, ++second);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	print_summary(&display, timespec_sub_to_nsec(&now, &start) / 1e9);
+
+	for (i = FD_UPDATE; i < FD_COUNT; i++)
+		if (pfd[i].fd >= 0)
+			close(pfd[i].fd);
+
+	wl_list_for_each_safe(surface, tmp, &display.surface_list, link) {
+		/* Sub-surfaces first, they come after their parent */
+		if (!surface->subsurface)
+			continue;
+		surface_destroy(surface);
+	}
+	wl_list_for_each_safe(surface, tmp, &display.surface_list, link)
+		surface_destroy(surface);
+
+	wl_array_release(&display.latencies);
+	if (display.gbm)
+		gbm_device_destroy(display.gbm);
+	if (display.drm_fd >= 0)
+		close(display.drm_fd);
+	if (display.dmabuf)
+		zwp_linux_dmabuf_v1_destroy(display.dmabuf);
+	if (display.presentation)
+		wp_presentation_destroy(display.presentation);
+	xdg_wm_base_destroy(display.wm_base);
+	wl_shm_destroy(display.shm);
+	wl_subcompositor_destroy(display.subcompositor);
+	wl_compositor_destroy(display.compositor);
+	wl_registry_destroy(display.registry);
+	wl_display_disconnect(display.display);
+
+	return EXIT_SUCCESS;
+}
@@ -56,6 +56,7 @@ static char *option_font;
 static int option_font_size;
 static char *option_term;
 static char *option_shell;
+static int option_scrollback;
 
 static struct wl_list terminal_list;
 
@@ -85,6 +86,7 @@ terminal_run(struct terminal *terminal, const char *path);
 #define ATTRMASK_BLINK		0x04
 #define ATTRMASK_INVERSE	0x08
 #define ATTRMASK_CONCEALED	0x10
+#define ATTRMASK_WRAPPED	0x20
 
 /* Buffer sizes */
 #define MAX_RESPONSE		256
@@ -387,7 +389,7 @@ struct attr {
 	unsigned char fg, bg;
 	char a;        /* attributes format:
 	                * 76543210
-			*    cilub */
+			*   wcilub */
 	char s;        /* in selection */
 };
 struct color_scheme {
@@ -405,6 +407,56 @@ attr_init(struct attr *data_attr, struct attr attr, int n)
 	}
 }
 
+/* Scrollback that no longer fits the cell ring goes to the history. There
+ * a row takes its UTF-8 text and runs of equal attributes, trailing blanks
+ * cut, packed back to back into pages. Rows that wrapped are kept together
+ * as one line and laid out again at the width they are looked at with. */
+#define HISTORY_PAGE_SIZE (64 * 1024)
+#define HISTORY_CACHE_ROWS 64
+
+/* Bytes of the text standing for an empty cell and the filler of a wide
+ * character; neither starts a character the terminal stores. */
+#define HISTORY_TEXT_EMPTY 0x00
+#define HISTORY_TEXT_FILLER 0x01
+
+struct history_record {
+	uint16_t cells;		/* cells of the row, without the cut blanks */
+	uint16_t text;		/* bytes of text following */
+	uint16_t runs;		/* struct history_run following the text */
+	uint8_t wrapped;	/* the line goes on in the next record */
+	uint8_t pad;
+	struct attr fill;	/* attributes of the cut blanks */
+};
+
+struct history_run {
+	uint16_t cells;
+	struct attr attr;
+};
+
+struct history_page {
+	struct wl_list link;
+	uint32_t records;
+	uint32_t size;
+	uint32_t open;		/* start of the line the last record wraps into */
+	int rows_width;		/* width rows was worked out for, 0 if stale */
+	uint32_t rows;
+	unsigned char data[HISTORY_PAGE_SIZE];
+};
+
+struct terminal_history {
+	struct wl_list pages;	/* struct history_page, oldest first */
+	uint32_t records, max_records;
+	uint32_t serial;
+
+	/* Rows laid out for the current width, looked up by line number */
+	struct {
+		uint32_t line, serial;
+	} cache[HISTORY_CACHE_ROWS];
+	union utf8_char *cache_data;
+	struct attr *cache_attr;
+	int cache_width;
+};
+
 enum escape_state {
 	escape_state_normal = 0,
 	escape_state_escape,
@@ -431,6 +483,17 @@ enum {
 	SELECT_LINE
 };
 
+#define GLYPH_CACHE_SIZE 512
+
+/* The glyphs of one character cell, relative to the cell origin */
+struct glyph_cache_entry {
+	uint32_t ch;
+	unsigned char bold;
+	unsigned char valid;
+	int count;
+	cairo_glyph_t glyphs[4];
+};
+
 struct terminal {
 	struct window *window;
 	struct widget *widget;
@@ -453,7 +516,10 @@ struct terminal {
 	int data_pitch, attr_pitch;  /* The width in bytes of a line */
 	int width, height, row, column, max_width;
 	uint32_t buffer_height;
-	uint32_t start, end, saved_start, log_size;
+	uint32_t start, end, saved_start;
+	uint32_t history_end;	/* first line of the ring, lines before it
+				 * are in the history */
+	struct terminal_history history;
 	wl_fixed_t smooth_scroll;
 	int saved_row, saved_column;
 	int scrolling;
@@ -484,6 +550,19 @@ struct terminal {
 	int selection_end_row, selection_end_col;
 	struct wl_list link;
 	int pace_pipe;
+
+	/* What the last redraw left in the buffer, so the next one can
+	 * repaint only the rows that changed since. */
+	struct {
+		union utf8_char *data;
+		uint32_t *attr;		/* union decoded_attr keys */
+		char *dirty;
+		int width, height;
+		struct rectangle allocation;
+		int cursor_row, cursor_col;	/* unfocused cursor box */
+	} drawn;
+
+	struct glyph_cache_entry glyph_cache[GLYPH_CACHE_SIZE];
 };
 
 /* Create default tab stops, every 8 characters */
@@ -556,12 +635,408 @@ init_color_table(struct terminal *terminal)
 	}
 }
 
+static int
+attr_equal(struct attr a, struct attr b)
+{
+	return a.fg == b.fg && a.bg == b.bg && a.a == b.a;
+}
+
+static void
+history_init(struct terminal_history *history, uint32_t max_records)
+{
+	memset(history, 0, sizeof *history);
+	wl_list_init(&history->pages);
+	history->max_records = max_records;
+	history->serial = 1;
+}
+
+static void
+history_release(struct terminal_history *history)
+{
+	struct history_page *page, *next;
+
+	wl_list_for_each_safe(page, next, &history->pages, link) {
+		wl_list_remove(&page->link);
+		free(page);
+	}
+	free(history->cache_data);
+	free(history->cache_attr);
+}
+
+static struct history_page *
+history_last_page(struct terminal_history *history)
+{
+	if (wl_list_empty(&history->pages))
+		return NULL;
+
+	return container_of(history->pages.prev, struct history_page, link);
+}
+
+/* Text is padded to an even length, which keeps every record and run
+ * aligned in the page. */
+static uint32_t
+history_record_size(const struct history_record *rec)
+{
+	return sizeof *rec + rec->text + rec->runs * sizeof(struct history_run);
+}
+
+static struct history_record *
+history_record_at(struct history_page *page, uint32_t offset)
+{
+	return (struct history_record *) &page->data[offset];
+}
+
+/* Starts a new page. The line the last page ends in the middle of moves
+ * over, so that lines never span pages; if that does not fit, the line is
+ * cut where it is. */
+static struct history_page *
+history_add_page(struct terminal_history *history, uint32_t needed)
+{
+	struct history_page *last = history_last_page(history);
+	struct history_page *page;
+	struct history_record *rec = NULL;
+	uint32_t offset, moved;
+
+	page = xzalloc(sizeof *page);
+
+	if (last && last->open < last->size) {
+		moved = last->size - last->open;
+		if (moved + needed <= HISTORY_PAGE_SIZE) {
+			memcpy(page->data, &last->data[last->open], moved);
+			for (offset = 0; offset < moved;
+			     offset += history_record_size(rec)) {
+				rec = history_record_at(page, offset);
+				page->records++;
+			}
+			page->size = moved;
+			last->records -= page->records;
+			last->size = last->open;
+		} else {
+			for (offset = last->open; offset < last->size;
+			     offset += history_record_size(rec))
+				rec = history_record_at(last, offset);
+			rec->wrapped = 0;
+			last->open = last->size;
+		}
+		last->rows_width = 0;
+	}
+
+	wl_list_insert(history->pages.prev, &page->link);
+
+	return page;
+}
+
+/* Drops whole pages off the old end, as long as what is left still holds
+ * as many rows as it has to. */
+static void
+history_trim(struct terminal_history *history)
+{
+	struct history_page *page;
+
+	while (history->records > history->max_records) {
+		page = container_of(history->pages.next,
+				    struct history_page, link);
+		if (page == history_last_page(history) ||
+		    history->records - page->records < history->max_records)
+			break;
+
+		history->records -= page->records;
+		wl_list_remove(&page->link);
+		free(page);
+	}
+}
+
+static void
+history_push(struct terminal_history *history,
+	     const union utf8_char *row, const struct attr *attr_row,
+	     int width)
+{
+	struct history_page *page = history_last_page(history);
+	struct history_record *rec;
+	struct history_run *run = NULL;
+	unsigned char *text;
+	struct attr fill;
+	int wrapped, cells, i, len;
+	uint32_t bound;
+
+	if (history->max_records == 0 || width <= 0)
+		return;
+
+	wrapped = !!(attr_row[width - 1].a & ATTRMASK_WRAPPED);
+	fill = attr_row[width - 1];
+	fill.a &= ~ATTRMASK_WRAPPED;
+
+	/* A wrapped row keeps its blanks, they are inside the line. A row
+	 * continuing a line keeps a cell, so that it adds a row to it. */
+	cells = width;
+	if (!wrapped) {
+		while (cells > 0 && row[cells - 1].ch == 0 &&
+		       attr_equal(attr_row[cells - 1], fill))
+			cells--;
+		if (cells == 0 && page && page->open < page->size)
+			cells = 1;
+	}
+
+	/* At most four bytes of text and a run for each cell */
+	bound = sizeof *rec + cells * (4 + sizeof *run) + 1;
+	if (bound > HISTORY_PAGE_SIZE)
+		return;
+
+	if (!page || page->size + bound > HISTORY_PAGE_SIZE)
+		page = history_add_page(history, bound);
+
+	rec = history_record_at(page, page->size);
+	memset(rec, 0, sizeof *rec);
+	rec->cells = cells;
+	rec->wrapped = wrapped;
+	rec->fill = fill;
+
+	text = (unsigned char *) (rec + 1);
+	for (i = 0; i < cells; i++) {
+		if (row[i].ch == 0) {
+			text[rec->text++] = HISTORY_TEXT_EMPTY;
+		} else if (row[i].ch == 0x200B) {
+			text[rec->text++] = HISTORY_TEXT_FILLER;
+		} else {
+			len = strnlen((const char *) row[i].byte, 4);
+			memcpy(&text[rec->text], row[i].byte, len);
+			rec->text += len;
+		}
+	}
+	if (rec->text & 1)
+		text[rec->text++] = HISTORY_TEXT_EMPTY;
+
+	run = (struct history_run *) &text[rec->text];
+	for (i = 0; i < cells; i++) {
+		if (rec->runs > 0 && attr_equal(attr_row[i], run[-1].attr)) {
+			run[-1].cells++;
+			continue;
+		}
+		run->cells = 1;
+		run->attr = attr_row[i];
+		run->attr.a &= ~ATTRMASK_WRAPPED;
+		run++;
+		rec->runs++;
+	}
+
+	page->size += history_record_size(rec);
+	if (!wrapped)
+		page->open = page->size;
+	page->records++;
+	page->rows_width = 0;
+
+	history->records++;
+	history->serial++;
+	history_trim(history);
+}
+
+static uint32_t
+history_line_rows(uint32_t cells, int width)
+{
+	return cells > 0 ? (cells + width - 1) / width : 1;
+}
+
+/* Walks the lines of a page: from *offset, finds where the next line ends
+ * and how many cells it has. */
+static int
+history_next_line(struct history_page *page, uint32_t *offset,
+		  uint32_t *end, uint32_t *cells)
+{
+	struct history_record *rec;
+
+	if (*offset >= page->size)
+		return 0;
+
+	*end = *offset;
+	*cells = 0;
+	do {
+		rec = history_record_at(page, *end);
+		*cells += rec->cells;
+		*end += history_record_size(rec);
+	} while (rec->wrapped && *end < page->size);
+
+	return 1;
+}
+
+static uint32_t
+history_page_rows(struct history_page *page, int width)
+{
+	uint32_t offset, end, cells;
+
+	if (page->rows_width == width)
+		return page->rows;
+
+	page->rows = 0;
+	for (offset = 0; history_next_line(page, &offset, &end, &cells);
+	     offset = end)
+		page->rows += history_line_rows(cells, width);
+	page->rows_width = width;
+
+	return page->rows;
+}
+
+static uint32_t
+history_rows(struct terminal_history *history, int width)
+{
+	struct history_page *page;
+	uint32_t rows = 0;
+
+	wl_list_for_each(page, &history->pages, link)
+		rows += history_page_rows(page, width);
+
+	return rows;
+}
+
+/* Lays out cells [first, first + width) of the line of records from offset
+ * to end, as the terminal keeps them. */
+static void
+history_decode(struct history_page *page, uint32_t offset, uint32_t end,
+	       uint32_t first, int width,
+	       union utf8_char *data, struct attr *attr)
+{
+	struct history_record *rec = NULL;
+	struct history_run *run;
+	unsigned char *text;
+	uint32_t cell = 0, t, r, left;
+	int i, len;
+
+	memset(data, 0, width * sizeof *data);
+
+	for (; offset < end; offset += history_record_size(rec)) {
+		rec = history_record_at(page, offset);
+		if (cell + rec->cells <= first) {
+			cell += rec->cells;
+			continue;
+		}
+
+		text = (unsigned char *) (rec + 1);
+		run = (struct history_run *) &text[rec->text];
+		left = rec->runs > 0 ? run->cells : 0;
+		for (i = 0, t = 0, r = 0; i < rec->cells; i++, cell++) {
+			if (text[t] == HISTORY_TEXT_EMPTY ||
+			    text[t] == HISTORY_TEXT_FILLER)
+				len = 1;
+			else if (text[t] >= 0xf0)
+				len = 4;
+			else if (text[t] >= 0xe0)
+				len = 3;
+			else if (text[t] >= 0xc0)
+				len = 2;
+			else
+				len = 1;
+			if (t + len > rec->text)
+				len = rec->text - t;
+
+			if (cell >= first && cell < first + width) {
+				if (text[t] == HISTORY_TEXT_FILLER)
+					data[cell - first].ch = 0x200B;
+				else if (text[t] != HISTORY_TEXT_EMPTY)
+					memcpy(data[cell - first].byte,
+					       &text[t], len);
+				attr[cell - first] = run[r].attr;
+			}
+			t += len;
+
+			if (--left == 0 && r + 1 < rec->runs)
+				left = run[++r].cells;
+		}
+
+		if (cell >= first + width)
+			return;
+	}
+
+	/* The rest of the row is made of the blanks the last record lost */
+	for (; cell < first + width; cell++)
+		if (cell >= first)
+			attr[cell - first] = rec->fill;
+}
+
+/* Lays out row @row of the history, counting up from its newest row, into
+ * data and attr. Returns 0 if the history has no such row. */
+static int
+history_get_row(struct terminal_history *history, uint32_t row, int width,
+		union utf8_char *data, struct attr *attr)
+{
+	struct history_page *page;
+	uint32_t rows, offset, end, cells;
+
+	wl_list_for_each_reverse(page, &history->pages, link) {
+		rows = history_page_rows(page, width);
+		if (row >= rows) {
+			row -= rows;
+			continue;
+		}
+
+		/* Counting down from the top of the page */
+		row = rows - 1 - row;
+		for (offset = 0;
+		     history_next_line(page, &offset, &end, &cells);
+		     offset = end) {
+			rows = history_line_rows(cells, width);
+			if (row < rows) {
+				history_decode(page, offset, end, row * width,
+					       width, data, attr);
+				return 1;
+			}
+			row -= rows;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+/* Rows above the ring come from the history, laid out for the current
+ * width and kept for as long as the history does not change. */
+static int
+terminal_history_row(struct terminal *terminal, uint32_t line)
+{
+	struct terminal_history *history = &terminal->history;
+	int width = terminal->width;
+	int slot = line % HISTORY_CACHE_ROWS;
+	union utf8_char *data;
+	struct attr *attr;
+
+	if (history->cache_width != width) {
+		free(history->cache_data);
+		free(history->cache_attr);
+		history->cache_data = xzalloc(HISTORY_CACHE_ROWS * width *
+					      sizeof *history->cache_data);
+		history->cache_attr = xzalloc(HISTORY_CACHE_ROWS * width *
+					      sizeof *history->cache_attr);
+		history->cache_width = width;
+		memset(history->cache, 0, sizeof history->cache);
+	}
+
+	if (history->cache[slot].serial == history->serial &&
+	    history->cache[slot].line == line)
+		return slot;
+
+	data = &history->cache_data[slot * width];
+	attr = &history->cache_attr[slot * width];
+	if (!history_get_row(history, terminal->history_end - 1 - line,
+			     width, data, attr)) {
+		memset(data, 0, width * sizeof *data);
+		attr_init(attr, terminal->color_scheme->default_attr, width);
+	}
+	history->cache[slot].line = line;
+	history->cache[slot].serial = history->serial;
+
+	return slot;
+}
+
 static union utf8_char *
 terminal_get_row(struct terminal *terminal, int row)
 {
+	uint32_t line = row + terminal->start;
 	int index;
 
-	index = (row + terminal->start) & (terminal->buffer_height - 1);
+	if ((int32_t) (line - terminal->history_end) < 0) {
+		index = terminal_history_row(terminal, line);
+		return &terminal->history.cache_data[index * terminal->width];
+	}
+
+	index = line & (terminal->buffer_height - 1);
 
 	return (void *) terminal->data + index * terminal->data_pitch;
 }
@@ -569,13 +1044,51 @@ terminal_get_row(struct terminal *terminal, int row)
 static struct attr*
 terminal_get_attr_row(struct terminal *terminal, int row)
 {
+	uint32_t line = row + terminal->start;
 	int index;
 
-	index = (row + terminal->start) & (terminal->buffer_height - 1);
+	if ((int32_t) (line - terminal->history_end) < 0) {
+		index = terminal_history_row(terminal, line);
+		return &terminal->history.cache_attr[index * terminal->width];
+	}
+
+	index = line & (terminal->buffer_height - 1);
 
 	return (void *) terminal->data_attr + index * terminal->attr_pitch;
 }
 
+/* Moves the end of the log on to @end. Once the ring is full, each line
+ * it gains pushes its oldest one out to the history. */
+static void
+terminal_extend_log(struct terminal *terminal, uint32_t end)
+{
+	int index;
+
+	while ((int32_t) (end - terminal->end) > 0) {
+		if (terminal->end - terminal->history_end ==
+		    terminal->buffer_height) {
+			index = terminal->history_end &
+				(terminal->buffer_height - 1);
+			history_push(&terminal->history,
+				     (void *) terminal->data +
+					index * terminal->data_pitch,
+				     (void *) terminal->data_attr +
+					index * terminal->attr_pitch,
+				     terminal->width);
+			terminal->history_end++;
+		}
+		terminal->end++;
+	}
+}
+
+/* The value of start that shows the oldest row of the scrollback */
+static uint32_t
+terminal_log_top(struct terminal *terminal)
+{
+	return terminal->history_end -
+	       history_rows(&terminal->history, terminal->width);
+}
+
 union decoded_attr {
 	struct attr attr;
 	uint32_t key;
@@ -627,7 +1140,7 @@ terminal_decode_attr(struct terminal *terminal, int row, int col,
 
 	decoded->attr.fg = foreground;
 	decoded->attr.bg = background;
-	decoded->attr.a = attr.a;
+	decoded->attr.a = attr.a & ~ATTRMASK_WRAPPED;
 }
 
 
@@ -638,6 +1151,17 @@ terminal_scroll_buffer(struct terminal *terminal, int d)
 
 	terminal->start += d;
 	if (d < 0) {
+		/* The top of the screen can't reach into the history, it
+		 * gets new lines in front of it instead. What left at the
+		 * bottom is gone. */
+		if ((int32_t) (terminal->start - terminal->history_end) < 0) {
+			terminal->history_end = terminal->start;
+			terminal->history.serial++;
+		}
+		if ((int32_t) (terminal->end - terminal->start -
+			       terminal->height) > 0)
+			terminal->end = terminal->start + terminal->height;
+
 		d = 0 - d;
 		for (i = 0; i < d; i++) {
 			memset(terminal_get_row(terminal, i), 0, terminal->data_pitch);
@@ -645,6 +1169,8 @@ terminal_scroll_buffer(struct terminal *terminal, int d)
 			    terminal->curr_attr, terminal->width);
 		}
 	} else {
+		terminal_extend_log(terminal,
+				    terminal->start + terminal->height);
 		for (i = terminal->height - d; i < terminal->height; i++) {
 			memset(terminal_get_row(terminal, i), 0, terminal->data_pitch);
 			attr_init(terminal_get_attr_row(terminal, i),
@@ -772,8 +1298,8 @@ terminal_resize_cells(struct terminal *terminal,
 		else if (height > terminal->height &&
 			 terminal->height - 1 == terminal->row) {
 			d = terminal->height - height;
-			if (terminal->log_size < uheight)
-				d = -terminal->start;
+			if (terminal->end - terminal->history_end < uheight)
+				d = terminal->history_end - terminal->start;
 		}
 
 		terminal->start += d;
@@ -805,6 +1331,21 @@ terminal_resize_cells(struct terminal *terminal,
 				total_rows = terminal->height;
 			}
 
+			/* Lines above the screen move to the history, which
+			 * lays them out again for the new width. */
+			while ((int32_t) (terminal->start -
+					  terminal->history_end) > 0) {
+				i = terminal->history_end &
+				    (terminal->buffer_height - 1);
+				history_push(&terminal->history,
+					     (void *) terminal->data +
+						i * terminal->data_pitch,
+					     (void *) terminal->data_attr +
+						i * terminal->attr_pitch,
+					     terminal->width);
+				terminal->history_end++;
+			}
+
 			for (i = 0; i < total_rows; i++) {
 				memcpy(&data[width * i],
 				       terminal_get_row(terminal, i),
@@ -817,6 +1358,8 @@ terminal_resize_cells(struct terminal *terminal,
 			free(terminal->data);
 			free(terminal->data_attr);
 			free(terminal->tab_ruler);
+
+			terminal->end = total_rows;
 		}
 
 		terminal->data_pitch = data_pitch;
@@ -825,6 +1368,8 @@ terminal_resize_cells(struct terminal *terminal,
 		terminal->data_attr = data_attr;
 		terminal->tab_ruler = tab_ruler;
 		terminal->start = 0;
+		terminal->history_end = 0;
+		terminal->history.serial++;
 	}
 
 	terminal->margin_bottom =
@@ -1014,20 +1559,73 @@ glyph_run_flush(struct glyph_run *run, union decoded_attr attr)
 	run->attr = attr;
 }
 
+static const struct glyph_cache_entry *
+terminal_get_glyphs(struct terminal *terminal, union utf8_char *c, int bold)
+{
+	struct glyph_cache_entry *entry;
+	cairo_scaled_font_t *font;
+	cairo_glyph_t *glyphs;
+	cairo_status_t status;
+	int num_glyphs;
+
+	entry = &terminal->glyph_cache[((c->ch * 2654435761u) >> 16 ^ bold) &
+				       (GLYPH_CACHE_SIZE - 1)];
+	if (entry->valid && entry->ch == c->ch && entry->bold == bold)
+		return entry;
+
+	font = bold ? terminal->font_bold : terminal->font_normal;
+	glyphs = entry->glyphs;
+	num_glyphs = ARRAY_LENGTH(entry->glyphs);
+	status = cairo_scaled_font_text_to_glyphs(font, 0, 0,
+						  (char *) c->byte, 4,
+						  &glyphs, &num_glyphs,
+						  NULL, NULL, NULL);
+	if (glyphs != entry->glyphs) {
+		/* Too many glyphs for an entry, don't cache those. */
+		cairo_glyph_free(glyphs);
+		status = CAIRO_STATUS_NO_MEMORY;
+	}
+	if (status != CAIRO_STATUS_SUCCESS) {
+		entry->valid = 0;
+		return NULL;
+	}
+
+	entry->ch = c->ch;
+	entry->bold = bold;
+	entry->count = num_glyphs;
+	entry->valid = 1;
+
+	return entry;
+}
+
 static void
 glyph_run_add(struct glyph_run *run, int x, int y, union utf8_char *c)
 {
-	int num_glyphs;
+	const struct glyph_cache_entry *entry;
+	int num_glyphs, bold, i;
 	cairo_scaled_font_t *font;
 
+	bold = !!(run->attr.attr.a & (ATTRMASK_BOLD | ATTRMASK_BLINK));
+
+	entry = terminal_get_glyphs(run->terminal, c, bold);
+	if (entry && run->count + entry->count <= ARRAY_LENGTH(run->glyphs)) {
+		for (i = 0; i < entry->count; i++) {
+			run->g[i].index = entry->glyphs[i].index;
+			run->g[i].x = x + entry->glyphs[i].x;
+			run->g[i].y = y + entry->glyphs[i].y;
+		}
+		run->g += entry->count;
+		run->count += entry->count;
+		return;
+	}
+
 	num_glyphs = ARRAY_LENGTH(run->glyphs) - run->count;
 
-	if (run->attr.attr.a & (ATTRMASK_BOLD | ATTRMASK_BLINK))
+	if (bold)
 		font = run->terminal->font_bold;
 	else
 		font = run->terminal->font_normal;
 
-	cairo_move_to(run->cr, x, y);
 	cairo_scaled_font_text_to_glyphs (font, x, y,
 					  (char *) c->byte, 4,
 					  &run->g, &num_glyphs,
@@ -1037,31 +1635,167 @@ glyph_run_add(struct glyph_run *run, int x, int y, union utf8_char *c)
 }
 
 
+/*
+ * Compare the grid with what the last redraw left in the buffer and
+ * flag the rows that need painting, updating the snapshot on the way.
+ * Returns the number of dirty rows.
+ */
+static int
+terminal_update_drawn(struct terminal *terminal,
+		      const struct rectangle *allocation, int full)
+{
+	union utf8_char *p_row, *drawn_row;
+	uint32_t *drawn_attr;
+	union decoded_attr attr;
+	int row, col, cursor_row, count = 0;
+	size_t cells;
+
+	if (terminal->drawn.width != terminal->width ||
+	    terminal->drawn.height != terminal->height) {
+		cells = (size_t) terminal->width * terminal->height;
+
+		free(terminal->drawn.data);
+		free(terminal->drawn.attr);
+		free(terminal->drawn.dirty);
+		terminal->drawn.data = xmalloc(cells * sizeof(union utf8_char));
+		terminal->drawn.attr = xmalloc(cells * sizeof(uint32_t));
+		terminal->drawn.dirty = xmalloc(terminal->height);
+		terminal->drawn.width = terminal->width;
+		terminal->drawn.height = terminal->height;
+		full = 1;
+	}
+
+	if (memcmp(&terminal->drawn.allocation, allocation,
+		   sizeof *allocation) != 0) {
+		terminal->drawn.allocation = *allocation;
+		full = 1;
+	}
+
+	for (row = 0; row < terminal->height; row++) {
+		p_row = terminal_get_row(terminal, row);
+		drawn_row = &terminal->drawn.data[row * terminal->width];
+		drawn_attr = &terminal->drawn.attr[row * terminal->width];
+
+		terminal->drawn.dirty[row] = full;
+		if (full || memcmp(drawn_row, p_row,
+				   terminal->width * sizeof *p_row) != 0) {
+			memcpy(drawn_row, p_row,
+			       terminal->width * sizeof *p_row);
+			terminal->drawn.dirty[row] = 1;
+		}
+
+		/* The decoded attributes also cover the selection, the
+		 * focused cursor and the inverse mode. */
+		for (col = 0; col < terminal->width; col++) {
+			terminal_decode_attr(terminal, row, col, &attr);
+			if (drawn_attr[col] != attr.key) {
+				drawn_attr[col] = attr.key;
+				terminal->drawn.dirty[row] = 1;
+			}
+		}
+	}
+
+	if ((terminal->mode & MODE_SHOW_CURSOR) &&
+	    !window_has_focus(terminal->window))
+		cursor_row = terminal->row;
+	else
+		cursor_row = -1;
+
+	if (cursor_row != terminal->drawn.cursor_row ||
+	    terminal->column != terminal->drawn.cursor_col) {
+		if (terminal->drawn.cursor_row >= 0 &&
+		    terminal->drawn.cursor_row < terminal->height)
+			terminal->drawn.dirty[terminal->drawn.cursor_row] = 1;
+		if (cursor_row >= 0 && cursor_row < terminal->height)
+			terminal->drawn.dirty[cursor_row] = 1;
+		terminal->drawn.cursor_row = cursor_row;
+		terminal->drawn.cursor_col = terminal->column;
+	}
+
+	for (row = 0; row < terminal->height; row++)
+		count += terminal->drawn.dirty[row];
+
+	return count;
+}
+
+/* Rows are not pixel aligned, so painting a row has to redraw the
+ * neighbours that share its edge pixels as well. */
+static bool
+terminal_row_needs_paint(struct terminal *terminal, int row)
+{
+	char *dirty = terminal->drawn.dirty;
+
+	return dirty[row] ||
+	       (row > 0 && dirty[row - 1]) ||
+	       (row < terminal->height - 1 && dirty[row + 1]);
+}
+
 static void
 redraw_handler(struct widget *widget, void *data)
 {
 	struct terminal *terminal = data;
-	struct rectangle allocation;
+	struct rectangle allocation, damage;
 	cairo_t *cr;
 	int top_margin, side_margin;
-	int row, col, cursor_x, cursor_y;
+	int row, col, cursor_x, cursor_y, last;
 	union utf8_char *p_row;
 	union decoded_attr attr;
+	uint32_t *attr_row;
 	int text_x, text_y;
 	cairo_surface_t *surface;
-	double d;
+	double d, y1, y2;
 	struct glyph_run run;
 	cairo_font_extents_t extents;
 	double average_width;
 	double unichar_width;
+	int full, dirty;
 
 	surface = window_get_surface(terminal->window);
 	widget_get_allocation(terminal->widget, &allocation);
+
+	extents = terminal->extents;
+	average_width = terminal->average_width;
+	side_margin = (allocation.width - terminal->width * average_width) / 2;
+	top_margin = (allocation.height - terminal->height * extents.height) / 2;
+
+	full = !widget_contents_preserved(widget);
+	dirty = terminal_update_drawn(terminal, &allocation, full);
+	if (dirty == terminal->height)
+		full = 1;
+	if (dirty == 0)
+		goto out;
+
 	cr = widget_cairo_create(terminal->widget);
-	cairo_rectangle(cr, allocation.x, allocation.y,
-			allocation.width, allocation.height);
+	if (full) {
+		cairo_rectangle(cr, allocation.x, allocation.y,
+				allocation.width, allocation.height);
+		widget_add_damage(widget, &allocation);
+	} else {
+		/* Clip and damage each run of dirty rows, on whole
+		 * pixels. */
+		for (row = 0; row < terminal->height; row++) {
+			if (!terminal->drawn.dirty[row])
+				continue;
+			for (last = row; last + 1 < terminal->height &&
+			     terminal->drawn.dirty[last + 1]; last++)
+				;
+
+			y1 = floor(allocation.y + top_margin +
+				   row * extents.height);
+			y2 = ceil(allocation.y + top_margin +
+				  (last + 1) * extents.height);
+			damage.x = allocation.x;
+			damage.y = y1;
+			damage.width = allocation.width;
+			damage.height = y2 - y1;
+			cairo_rectangle(cr, damage.x, damage.y,
+					damage.width, damage.height);
+			widget_add_damage(widget, &damage);
+
+			row = last;
+		}
+	}
 	cairo_clip(cr);
-	cairo_push_group(cr);
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	terminal_set_color(terminal, cr, terminal->color_scheme->border);
@@ -1069,20 +1803,19 @@ redraw_handler(struct widget *widget, void *data)
 
 	cairo_set_scaled_font(cr, terminal->font_normal);
 
-	extents = terminal->extents;
-	average_width = terminal->average_width;
-	side_margin = (allocation.width - terminal->width * average_width) / 2;
-	top_margin = (allocation.height - terminal->height * extents.height) / 2;
-
 	cairo_set_line_width(cr, 1.0);
 	cairo_translate(cr, allocation.x + side_margin,
 			allocation.y + top_margin);
 	/* paint the background */
 	for (row = 0; row < terminal->height; row++) {
+		if (!full && !terminal_row_needs_paint(terminal, row))
+			continue;
+
 		p_row = terminal_get_row(terminal, row);
+		attr_row = &terminal->drawn.attr[row * terminal->width];
 		for (col = 0; col < terminal->width; col++) {
 			/* get the attributes for this character cell */
-			terminal_decode_attr(terminal, row, col, &attr);
+			attr.key = attr_row[col];
 
 			if (attr.attr.bg == terminal->color_scheme->border)
 				continue;
@@ -1108,10 +1841,14 @@ redraw_handler(struct widget *widget, void *data)
 	/* paint the foreground */
 	glyph_run_init(&run, terminal, cr);
 	for (row = 0; row < terminal->height; row++) {
+		if (!full && !terminal_row_needs_paint(terminal, row))
+			continue;
+
 		p_row = terminal_get_row(terminal, row);
+		attr_row = &terminal->drawn.attr[row * terminal->width];
 		for (col = 0; col < terminal->width; col++) {
 			/* get the attributes for this character cell */
-			terminal_decode_attr(terminal, row, col, &attr);
+			attr.key = attr_row[col];
 
 			glyph_run_flush(&run, attr);
 
@@ -1137,8 +1874,7 @@ redraw_handler(struct widget *widget, void *data)
 	attr.key = ~0;
 	glyph_run_flush(&run, attr);
 
-	if ((terminal->mode & MODE_SHOW_CURSOR) &&
-	    !window_has_focus(terminal->window)) {
+	if (terminal->drawn.cursor_row >= 0) {
 		d = 0.5;
 
 		cairo_set_line_width(cr, 1);
@@ -1152,9 +1888,9 @@ redraw_handler(struct widget *widget, void *data)
 		cairo_stroke(cr);
 	}
 
-	cairo_pop_group_to_source(cr);
-	cairo_paint(cr);
 	cairo_destroy(cr);
+
+out:
 	cairo_surface_destroy(surface);
 
 	if (terminal->send_cursor_position) {
@@ -1981,6 +2717,8 @@ handle_char(struct terminal *terminal, union utf8_char utf8)
 	/* handle right margin effects */
 	if (terminal->column >= terminal->width) {
 		if (terminal->mode & MODE_AUTOWRAP) {
+			attr_row = terminal_get_attr_row(terminal, terminal->row);
+			attr_row[terminal->width - 1].a |= ATTRMASK_WRAPPED;
 			terminal->column = 0;
 			terminal->row += 1;
 			if (terminal->row > terminal->margin_bottom) {
@@ -2000,12 +2738,7 @@ handle_char(struct terminal *terminal, union utf8_char utf8)
 	row[terminal->column] = utf8;
 	attr_row[terminal->column++] = terminal->curr_attr;
 
-	if (terminal->row + terminal->start + 1 > terminal->end)
-		terminal->end = terminal->row + terminal->start + 1;
-	if (terminal->end == terminal->buffer_height)
-		terminal->log_size = terminal->buffer_height;
-	else if (terminal->log_size < terminal->buffer_height)
-		terminal->log_size = terminal->end;
+	terminal_extend_log(terminal, terminal->row + terminal->start + 1);
 
 	/* cursor jump for wide character. */
 	if (is_wide(utf8))
@@ -2336,7 +3069,8 @@ handle_bound_key(struct terminal *terminal,
 	case XKB_KEY_Up:
 		if (!terminal->scrolling)
 			terminal->saved_start = terminal->start;
-		if (terminal->start == terminal->end - terminal->log_size)
+		if ((int32_t) (terminal->start -
+			       terminal_log_top(terminal)) <= 0)
 			return 1;
 
 		terminal->scrolling = 1;
@@ -2861,10 +3595,10 @@ axis_handler(struct widget *widget,
 			lines = 0;
 		}
 	} else if (lines < 0) {
-		uint32_t neg_lines = -lines;
+		uint32_t top = terminal_log_top(terminal);
 
-		if (neg_lines > terminal->log_size + terminal->start - terminal->end)
-			lines = terminal->end - terminal->log_size - terminal->start;
+		if ((int32_t) (terminal->start - top) < -lines)
+			lines = top - terminal->start;
 	}
 
 	if (lines) {
@@ -2960,6 +3694,8 @@ terminal_create(struct display *display)
 	terminal->margin = 5;
 	terminal->buffer_height = 1024;
 	terminal->end = 1;
+	history_init(&terminal->history,
+		     option_scrollback > 0 ? option_scrollback : 0);
 
 	window_set_user_data(terminal->window, terminal);
 	window_set_key_handler(terminal->window, key_handler);
@@ -2975,6 +3711,7 @@ terminal_create(struct display *display)
 
 	widget_set_redraw_handler(terminal->widget, redraw_handler);
 	widget_set_resize_handler(terminal->widget, resize_handler);
+	widget_set_preserve_contents(terminal->widget, 1);
 	widget_set_button_handler(terminal->widget, button_handler);
 	widget_set_enter_handler(terminal->widget, enter_handler);
 	widget_set_motion_handler(terminal->widget, motion_handler);
@@ -3039,6 +3776,10 @@ terminal_destroy(struct terminal *terminal)
 	free(terminal->data);
 	free(terminal->data_attr);
 	free(terminal->tab_ruler);
+	history_release(&terminal->history);
+	free(terminal->drawn.data);
+	free(terminal->drawn.attr);
+	free(terminal->drawn.dirty);
 	free(terminal->title);
 	free(terminal);
 }
@@ -3134,6 +3875,7 @@ static const struct weston_option terminal_options[] = {
 	{ WESTON_OPTION_STRING, "font", 0, &option_font },
 	{ WESTON_OPTION_INTEGER, "font-size", 0, &option_font_size },
 	{ WESTON_OPTION_STRING, "shell", 0, &option_shell },
+	{ WESTON_OPTION_INTEGER, "scrollback-lines", 0, &option_scrollback },
 };
 
 int main(int argc, char *argv[])
@@ -3159,6 +3901,8 @@ int main(int argc, char *argv[])
 	weston_config_section_get_string(s, "font", &option_font, "monospace");
 	weston_config_section_get_int(s, "font-size", &option_font_size, 14);
 	weston_config_section_get_string(s, "term", &option_term, "xterm");
+	weston_config_section_get_int(s, "scrollback-lines",
+				      &option_scrollback, 10000);
 	weston_config_destroy(config);
 
 	if (parse_options(terminal_options,
@@ -3168,7 +3912,8 @@ int main(int argc, char *argv[])
 		       "  --maximized or -m\n"
 		       "  --font=NAME\n"
 		       "  --font-size=SIZE\n"
-		       "  --shell=NAME\n", argv[0]);
+		       "  --shell=NAME\n"
+		       "  --scrollback-lines=LINES\n", argv[0]);
 		return 1;
 	}
 
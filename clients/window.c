@@ -37,6 +37,7 @@
 #include <assert.h>
 #include <time.h>
 #include <cairo.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
@@ -50,7 +51,16 @@
 #include <wayland-cursor.h>
 
 #include <linux/input.h>
+#ifdef HAVE_LINUX_UDMABUF_H
+#include <linux/udmabuf.h>
+#endif
+#include <drm_fourcc.h>
 #include <wayland-client.h>
+#ifdef HAVE_CAIRO_EGL
+#include <wayland-egl.h>
+#include <cairo-gl.h>
+#include "shared/platform.h"
+#endif
 #include "shared/cairo-util.h"
 #include "shared/helpers.h"
 #include "shared/xalloc.h"
@@ -61,6 +71,7 @@
 #include "pointer-constraints-unstable-v1-client-protocol.h"
 #include "relative-pointer-unstable-v1-client-protocol.h"
 #include "tablet-unstable-v2-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
 #include "shared/os-compatibility.h"
 #include "shared/string-helpers.h"
 #include "libweston/matrix.h"
@@ -134,6 +145,23 @@ struct display {
 
 	int data_device_manager_version;
 	struct wp_viewporter *viewporter;
+
+	/* Shm pools are also handed to the compositor as udmabufs where
+	 * it can import them, so that it textures from them directly. */
+	struct zwp_linux_dmabuf_v1 *dmabuf;
+	bool dmabuf_linear_argb8888;
+	bool dmabuf_linear_xrgb8888;
+	int udmabuf_fd;
+	bool udmabuf_failed;
+
+#ifdef HAVE_CAIRO_EGL
+	EGLDisplay dpy;
+	EGLConfig argb_config;
+	EGLContext argb_ctx;
+	cairo_device_t *argb_device;
+	bool has_buffer_age;
+	PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC swap_buffers_with_damage;
+#endif
 };
 
 struct tablet {
@@ -182,6 +210,9 @@ struct toysurface {
 	 * width,height are the new buffer size.
 	 * If flags has SURFACE_HINT_RESIZE set, the user is
 	 * doing continuous resizing.
+	 * If flags has SURFACE_HINT_PRESERVE set, the contents of the
+	 * previously posted buffer are carried over when possible, and
+	 * 'preserved' is set to tell whether that happened.
 	 * Returns the Cairo surface to draw to.
 	 */
 	cairo_surface_t *(*prepare)(struct toysurface *base, int dx, int dy,
@@ -192,16 +223,21 @@ struct toysurface {
 	 * Post the surface to the server, returning the server allocation
 	 * rectangle. The Cairo surface from prepare() must be destroyed
 	 * after calling this.
+	 * damage lists n_damage rectangles in surface coordinates, or is
+	 * NULL to damage the whole surface.
 	 */
 	void (*swap)(struct toysurface *base,
 		     enum wl_output_transform buffer_transform, int32_t buffer_scale,
-		     struct rectangle *server_allocation);
+		     struct rectangle *server_allocation,
+		     const struct rectangle *damage, int n_damage);
 
 	/*
 	 * Destroy the toysurface, including the Cairo surface, any
 	 * backing storage, and the Wayland protocol objects.
 	 */
 	void (*destroy)(struct toysurface *base);
+
+	int preserved;
 };
 
 struct surface {
@@ -231,6 +267,13 @@ struct surface {
 
 	cairo_surface_t *cairo_surface;
 
+	/* Redraws only repaint what changed, see
+	 * widget_set_preserve_contents() */
+	int preserve_contents;
+	int contents_preserved;
+	struct wl_array damage;
+	int damage_full;
+
 	struct wl_list link;
 	struct wp_viewport *viewport;
 };
@@ -445,6 +488,16 @@ struct window_frame {
 	struct widget *child;
 	struct frame *frame;
 
+	/* The decorations as last rendered, in buffer pixels. Reused
+	 * until the frame needs a repaint or the buffer size, scale or
+	 * transform changes. */
+	struct {
+		cairo_surface_t *surface;
+		int32_t width, height;
+		int32_t scale;
+		enum wl_output_transform transform;
+	} cache;
+
 	uint32_t last_time;
 	uint32_t did_double, double_click;
 	int32_t last_id, double_id;
@@ -477,6 +530,7 @@ struct shm_pool {
 	size_t size;
 	size_t used;
 	void *data;
+	int fd;		/* kept for udmabufs, or -1 */
 };
 
 struct cm_image_description {
@@ -775,8 +829,14 @@ shm_surface_data_destroy(void *p)
 	free(data);
 }
 
+static bool
+display_has_udmabuf(struct display *display)
+{
+	return display->udmabuf_fd >= 0 && !display->udmabuf_failed;
+}
+
 static struct wl_shm_pool *
-make_shm_pool(struct display *display, int size, void **data)
+make_shm_pool(struct display *display, int size, void **data, int *fd_ret)
 {
 	struct wl_shm_pool *pool;
 	int fd;
@@ -797,7 +857,10 @@ make_shm_pool(struct display *display, int size, void **data)
 
 	pool = wl_shm_create_pool(display->shm, fd, size);
 
-	close(fd);
+	if (fd_ret)
+		*fd_ret = fd;
+	else
+		close(fd);
 
 	return pool;
 }
@@ -806,11 +869,19 @@ static struct shm_pool *
 shm_pool_create(struct display *display, size_t size)
 {
 	struct shm_pool *pool = malloc(sizeof *pool);
+	long page_size = sysconf(_SC_PAGESIZE);
+	bool udmabuf = display_has_udmabuf(display);
 
 	if (!pool)
 		return NULL;
 
-	pool->pool = make_shm_pool(display, size, &pool->data);
+	/* udmabufs are made of whole pages */
+	if (udmabuf)
+		size = (size + page_size - 1) / page_size * page_size;
+
+	pool->fd = -1;
+	pool->pool = make_shm_pool(display, size, &pool->data,
+				   udmabuf ? &pool->fd : NULL);
 	if (!pool->pool) {
 		free(pool);
 		return NULL;
@@ -840,6 +911,8 @@ shm_pool_destroy(struct shm_pool *pool)
 {
 	munmap(pool->data, pool->size);
 	wl_shm_pool_destroy(pool->pool);
+	if (pool->fd >= 0)
+		close(pool->fd);
 	free(pool);
 }
 
@@ -860,6 +933,121 @@ data_length_for_shm_surface(struct rectangle *rect)
 	return stride * rect->height;
 }
 
+#ifdef HAVE_LINUX_UDMABUF_H
+struct udmabuf_import {
+	struct wl_buffer *buffer;
+	bool done;
+};
+
+static void
+udmabuf_params_created(void *data,
+		       struct zwp_linux_buffer_params_v1 *params,
+		       struct wl_buffer *buffer)
+{
+	struct udmabuf_import *import = data;
+
+	import->buffer = buffer;
+	import->done = true;
+}
+
+static void
+udmabuf_params_failed(void *data, struct zwp_linux_buffer_params_v1 *params)
+{
+	struct udmabuf_import *import = data;
+
+	import->done = true;
+}
+
+static const struct zwp_linux_buffer_params_v1_listener udmabuf_params_listener = {
+	udmabuf_params_created,
+	udmabuf_params_failed,
+};
+
+/* Wrap a part of a pool into a udmabuf and have the compositor import it
+ * as a linear dma-buf. Waits for the compositor to say whether it could,
+ * on a queue of its own, so that no other events get dispatched from
+ * here. Returns NULL to use wl_shm. */
+static struct wl_buffer *
+display_create_udmabuf_buffer(struct display *display, struct shm_pool *pool,
+			      int offset, int length, int width, int height,
+			      int stride, uint32_t flags)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	struct udmabuf_create create = { 0 };
+	struct udmabuf_import import = { NULL, false };
+	struct zwp_linux_dmabuf_v1 *wrapper;
+	struct zwp_linux_buffer_params_v1 *params;
+	struct wl_event_queue *queue;
+	uint32_t format;
+	int fd;
+
+	if (flags & SURFACE_OPAQUE) {
+		if (!display->dmabuf_linear_xrgb8888)
+			return NULL;
+		format = DRM_FORMAT_XRGB8888;
+	} else {
+		if (!display->dmabuf_linear_argb8888)
+			return NULL;
+		format = DRM_FORMAT_ARGB8888;
+	}
+
+	create.memfd = pool->fd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.offset = offset;
+	create.size = (length + page_size - 1) / page_size * page_size;
+	if (offset % page_size != 0 || create.offset + create.size > pool->size)
+		return NULL;
+
+	fd = ioctl(display->udmabuf_fd, UDMABUF_CREATE, &create);
+	if (fd < 0) {
+		fprintf(stderr, "creating a udmabuf failed, using wl_shm: %s\n",
+			strerror(errno));
+		display->udmabuf_failed = true;
+		return NULL;
+	}
+
+	queue = wl_display_create_queue(display->display);
+	wrapper = wl_proxy_create_wrapper(display->dmabuf);
+	wl_proxy_set_queue((struct wl_proxy *) wrapper, queue);
+	params = zwp_linux_dmabuf_v1_create_params(wrapper);
+	wl_proxy_wrapper_destroy(wrapper);
+
+	zwp_linux_buffer_params_v1_add_listener(params,
+						&udmabuf_params_listener,
+						&import);
+	zwp_linux_buffer_params_v1_add(params, fd, 0, 0, stride,
+				       DRM_FORMAT_MOD_LINEAR >> 32,
+				       DRM_FORMAT_MOD_LINEAR & 0xffffffff);
+	zwp_linux_buffer_params_v1_create(params, width, height, format, 0);
+	close(fd);
+
+	while (!import.done)
+		if (wl_display_dispatch_queue(display->display, queue) < 0)
+			break;
+
+	zwp_linux_buffer_params_v1_destroy(params);
+	if (import.buffer)
+		wl_proxy_set_queue((struct wl_proxy *) import.buffer, NULL);
+	wl_event_queue_destroy(queue);
+
+	if (!import.buffer) {
+		fprintf(stderr, "compositor cannot import udmabufs, "
+			"using wl_shm\n");
+		display->udmabuf_failed = true;
+	}
+
+	return import.buffer;
+}
+#else
+static struct wl_buffer *
+display_create_udmabuf_buffer(struct display *display, struct shm_pool *pool,
+			      int offset, int length, int width, int height,
+			      int stride, uint32_t flags)
+{
+	return NULL;
+}
+#endif
+
 static cairo_surface_t *
 display_create_shm_surface_from_pool(struct display *display,
 				     struct rectangle *rectangle,
@@ -900,10 +1088,18 @@ display_create_shm_surface_from_pool(struct display *display,
 	else
 		format = WL_SHM_FORMAT_ARGB8888;
 
-	data->buffer = wl_shm_pool_create_buffer(pool->pool, offset,
-						 rectangle->width,
-						 rectangle->height,
-						 stride, format);
+	data->buffer = NULL;
+	if (pool->fd >= 0 && display_has_udmabuf(display))
+		data->buffer = display_create_udmabuf_buffer(display, pool,
+							     offset, length,
+							     rectangle->width,
+							     rectangle->height,
+							     stride, flags);
+	if (!data->buffer)
+		data->buffer = wl_shm_pool_create_buffer(pool->pool, offset,
+							 rectangle->width,
+							 rectangle->height,
+							 stride, format);
 
 	return surface;
 }
@@ -985,8 +1181,14 @@ struct shm_surface_leaf {
 	/* 'data' is automatically destroyed, when 'cairo_surface' is */
 	struct shm_surface_data *data;
 
-	struct shm_pool *resize_pool;
+	/* Kept across size changes, see shm_surface_leaf_get_pool() */
+	struct shm_pool *pool;
 	int busy;
+
+	/* Rectangles in buffer coordinates that other leaves have posted
+	 * since this one was, or stale_full if that is unknown. */
+	struct wl_array stale;
+	int stale_full;
 };
 
 static void
@@ -996,12 +1198,75 @@ shm_surface_leaf_release(struct shm_surface_leaf *leaf)
 		cairo_surface_destroy(leaf->cairo_surface);
 	/* leaf->data already destroyed via cairo private */
 
-	if (leaf->resize_pool)
-		shm_pool_destroy(leaf->resize_pool);
+	if (leaf->pool)
+		shm_pool_destroy(leaf->pool);
 
+	wl_array_release(&leaf->stale);
 	memset(leaf, 0, sizeof *leaf);
 }
 
+static void
+shm_surface_leaf_add_stale(struct shm_surface_leaf *leaf,
+			   const struct rectangle *rect)
+{
+	struct rectangle *stale;
+
+	if (leaf->stale_full)
+		return;
+
+	if (leaf->stale.size >= 16 * sizeof *stale)
+		stale = NULL;
+	else
+		stale = wl_array_add(&leaf->stale, sizeof *stale);
+
+	if (!stale) {
+		leaf->stale_full = 1;
+		return;
+	}
+
+	*stale = *rect;
+}
+
+/* Bring 'dst' up to date with 'src', the leaf posted last. */
+static void
+shm_surface_leaf_catch_up(struct shm_surface_leaf *dst,
+			  struct shm_surface_leaf *src)
+{
+	unsigned char *dst_data, *src_data;
+	const struct rectangle *rect;
+	int stride, width, height;
+	int x1, y1, x2, y2, y;
+
+	width = cairo_image_surface_get_width(src->cairo_surface);
+	height = cairo_image_surface_get_height(src->cairo_surface);
+	stride = cairo_image_surface_get_stride(src->cairo_surface);
+
+	/* Reading a buffer the server still holds is fine. */
+	cairo_surface_flush(src->cairo_surface);
+	src_data = cairo_image_surface_get_data(src->cairo_surface);
+	dst_data = cairo_image_surface_get_data(dst->cairo_surface);
+
+	if (dst->stale_full) {
+		memcpy(dst_data, src_data, stride * height);
+	} else {
+		wl_array_for_each(rect, &dst->stale) {
+			x1 = MAX(rect->x, 0);
+			y1 = MAX(rect->y, 0);
+			x2 = MIN(rect->x + rect->width, width);
+			y2 = MIN(rect->y + rect->height, height);
+			if (x1 >= x2)
+				continue;
+
+			for (y = y1; y < y2; y++)
+				memcpy(dst_data + y * stride + x1 * 4,
+				       src_data + y * stride + x1 * 4,
+				       (x2 - x1) * 4);
+		}
+	}
+
+	cairo_surface_mark_dirty(dst->cairo_surface);
+}
+
 #define MAX_LEAVES 3
 
 struct shm_surface {
@@ -1013,6 +1278,11 @@ struct shm_surface {
 
 	struct shm_surface_leaf leaf[MAX_LEAVES];
 	struct shm_surface_leaf *current;
+
+	/* The leaf posted last, while its storage is still intact */
+	struct shm_surface_leaf *last;
+	enum wl_output_transform last_transform;
+	int32_t last_scale;
 };
 
 static struct shm_surface *
@@ -1072,10 +1342,13 @@ shm_surface_buffer_release(void *data, struct wl_buffer *buffer)
 		if (!leaf->cairo_surface || leaf->busy)
 			continue;
 
-		if (!free_found)
+		if (!free_found) {
 			free_found = 1;
-		else
+		} else {
+			if (leaf == surface->last)
+				surface->last = NULL;
 			shm_surface_leaf_release(leaf);
+		}
 	}
 
 	shm_surface_buffer_state_debug(surface, "buffer_release  after");
@@ -1085,21 +1358,67 @@ static const struct wl_buffer_listener shm_surface_buffer_listener = {
 	shm_surface_buffer_release
 };
 
+#ifdef USE_RESIZE_POOL
+/*
+ * Make sure the leaf has a pool that fits a buffer of the given size.
+ * Mapping a new pool in the server is relatively expensive, so the pool
+ * is reused across size changes for as long as the buffer fits and does
+ * not waste too much of it. While the user is resizing, room to grow is
+ * reserved up front.
+ */
+static void
+shm_surface_leaf_get_pool(struct shm_surface *surface,
+			  struct shm_surface_leaf *leaf,
+			  struct rectangle *rect, int resize_hint)
+{
+	size_t length = data_length_for_shm_surface(rect);
+	size_t size;
+
+	if (leaf->pool &&
+	    (leaf->pool->size < length || leaf->pool->size / 4 > length)) {
+		shm_pool_destroy(leaf->pool);
+		leaf->pool = NULL;
+	}
+
+	if (leaf->pool)
+		return;
+
+	size = length;
+	if (resize_hint)
+		size += length / 2;
+	size = ROUND_UP_N(size, 4096);
+
+	leaf->pool = shm_pool_create(surface->display, size);
+}
+#endif
+
 static cairo_surface_t *
 shm_surface_prepare(struct toysurface *base, int dx, int dy,
 		    int32_t width, int32_t height, uint32_t flags,
 		    enum wl_output_transform buffer_transform, int32_t buffer_scale)
 {
 	int resize_hint = !!(flags & SURFACE_HINT_RESIZE);
+	int preserve = !!(flags & SURFACE_HINT_PRESERVE);
 	struct shm_surface *surface = to_shm_surface(base);
 	struct rectangle rect = { 0};
 	struct shm_surface_leaf *leaf = NULL;
+	struct shm_surface_leaf *last;
 	int i;
 
 	surface->dx = dx;
 	surface->dy = dy;
-
-	/* pick a free buffer, preferably one that already has storage */
+	base->preserved = 0;
+
+	/* The previous contents are only worth anything if they still
+	 * line up with the new buffer. */
+	last = surface->last;
+	if (!preserve || dx != 0 || dy != 0 ||
+	    surface->last_transform != buffer_transform ||
+	    surface->last_scale != buffer_scale)
+		last = NULL;
+
+	/* pick a free buffer, preferably the one posted last or else
+	 * one that already has storage */
 	for (i = 0; i < MAX_LEAVES; i++) {
 		if (surface->leaf[i].busy)
 			continue;
@@ -1107,6 +1426,8 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 		if (!leaf || surface->leaf[i].cairo_surface)
 			leaf = &surface->leaf[i];
 	}
+	if (last && !last->busy)
+		leaf = last;
 	DBG_OBJ(surface->surface, "pick leaf %d\n",
 		(int)(leaf - &surface->leaf[0]));
 
@@ -1117,13 +1438,6 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 		return NULL;
 	}
 
-	if (!resize_hint && leaf->resize_pool) {
-		cairo_surface_destroy(leaf->cairo_surface);
-		leaf->cairo_surface = NULL;
-		shm_pool_destroy(leaf->resize_pool);
-		leaf->resize_pool = NULL;
-	}
-
 	surface_to_buffer_size (buffer_transform, buffer_scale, &width, &height);
 
 	if (leaf->cairo_surface &&
@@ -1131,29 +1445,24 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 	    cairo_image_surface_get_height(leaf->cairo_surface) == height)
 		goto out;
 
+	if (leaf == surface->last)
+		surface->last = last = NULL;
 	if (leaf->cairo_surface)
 		cairo_surface_destroy(leaf->cairo_surface);
-
-#ifdef USE_RESIZE_POOL
-	if (resize_hint && !leaf->resize_pool) {
-		/* Create a big pool to allocate from, while continuously
-		 * resizing. Mmapping a new pool in the server
-		 * is relatively expensive, so reusing a pool performs
-		 * better, but may temporarily reserve unneeded memory.
-		 */
-		/* We should probably base this number on the output size. */
-		leaf->resize_pool = shm_pool_create(surface->display,
-						    6 * 1024 * 1024);
-	}
-#endif
+	leaf->cairo_surface = NULL;
+	leaf->stale_full = 1;
 
 	rect.width = width;
 	rect.height = height;
 
+#ifdef USE_RESIZE_POOL
+	shm_surface_leaf_get_pool(surface, leaf, &rect, resize_hint);
+#endif
+
 	leaf->cairo_surface =
 		display_create_shm_surface(surface->display, &rect,
 					   surface->flags,
-					   leaf->resize_pool,
+					   leaf->pool,
 					   &leaf->data);
 	if (!leaf->cairo_surface)
 		return NULL;
@@ -1162,6 +1471,17 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 			       &shm_surface_buffer_listener, surface);
 
 out:
+	if (last == leaf) {
+		base->preserved = 1;
+	} else if (last &&
+		   cairo_image_surface_get_width(last->cairo_surface) == width &&
+		   cairo_image_surface_get_height(last->cairo_surface) == height) {
+		/* Like buffer age: only what changed since this leaf was
+		 * posted needs copying over. */
+		shm_surface_leaf_catch_up(leaf, last);
+		base->preserved = 1;
+	}
+
 	surface->current = leaf;
 
 	return cairo_surface_reference(leaf->cairo_surface);
@@ -1170,10 +1490,14 @@ out:
 static void
 shm_surface_swap(struct toysurface *base,
 		 enum wl_output_transform buffer_transform, int32_t buffer_scale,
-		 struct rectangle *server_allocation)
+		 struct rectangle *server_allocation,
+		 const struct rectangle *damage, int n_damage)
 {
 	struct shm_surface *surface = to_shm_surface(base);
 	struct shm_surface_leaf *leaf = surface->current;
+	struct shm_surface_leaf *other;
+	struct rectangle rect;
+	int i, j;
 
 	server_allocation->width =
 		cairo_image_surface_get_width(leaf->cairo_surface);
@@ -1186,15 +1510,48 @@ shm_surface_swap(struct toysurface *base,
 
 	wl_surface_attach(surface->surface, leaf->data->buffer,
 			  surface->dx, surface->dy);
-	wl_surface_damage(surface->surface, 0, 0,
-			  server_allocation->width, server_allocation->height);
+	if (!damage) {
+		wl_surface_damage(surface->surface, 0, 0,
+				  server_allocation->width,
+				  server_allocation->height);
+	} else {
+		for (i = 0; i < n_damage; i++)
+			wl_surface_damage(surface->surface,
+					  damage[i].x, damage[i].y,
+					  damage[i].width, damage[i].height);
+	}
 	wl_surface_commit(surface->surface);
 
 	DBG_OBJ(surface->surface, "leaf %d busy\n",
 		(int)(leaf - &surface->leaf[0]));
 
+	/* Whatever this commit updated is now stale in the other leaves. */
+	for (j = 0; j < MAX_LEAVES; j++) {
+		other = &surface->leaf[j];
+		if (other == leaf || !other->cairo_surface)
+			continue;
+
+		if (!damage || buffer_transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+			other->stale_full = 1;
+			continue;
+		}
+
+		for (i = 0; i < n_damage; i++) {
+			rect.x = damage[i].x * buffer_scale;
+			rect.y = damage[i].y * buffer_scale;
+			rect.width = damage[i].width * buffer_scale;
+			rect.height = damage[i].height * buffer_scale;
+			shm_surface_leaf_add_stale(other, &rect);
+		}
+	}
+	leaf->stale.size = 0;
+	leaf->stale_full = 0;
+
 	leaf->busy = 1;
 	surface->current = NULL;
+	surface->last = leaf;
+	surface->last_transform = buffer_transform;
+	surface->last_scale = buffer_scale;
 }
 
 static void
@@ -1228,6 +1585,317 @@ shm_surface_create(struct display *display, struct wl_surface *wl_surface,
 	return &surface->base;
 }
 
+#ifdef HAVE_CAIRO_EGL
+
+/* Frames of damage kept for EGL_EXT_buffer_age */
+#define EGL_WINDOW_HISTORY 3
+
+struct egl_window_damage {
+	/* Rectangles in buffer coordinates, or full if that is unknown */
+	struct wl_array rects;
+	int full;
+};
+
+struct egl_window_surface {
+	struct toysurface base;
+	struct display *display;
+	struct wl_surface *surface;
+	struct wl_egl_window *egl_window;
+	EGLSurface egl_surface;
+	cairo_surface_t *window;
+
+	/* What widgets draw into. Unlike the EGL back buffers it keeps its
+	 * contents, so redraws only repaint what changed, and only that is
+	 * copied into the back buffer, on the GPU. */
+	cairo_surface_t *canvas;
+	int32_t width, height;
+	enum wl_output_transform transform;
+	int32_t scale;
+
+	/* Damage of the last frames posted, newest first */
+	struct egl_window_damage history[EGL_WINDOW_HISTORY];
+};
+
+static struct egl_window_surface *
+to_egl_window_surface(struct toysurface *base)
+{
+	return container_of(base, struct egl_window_surface, base);
+}
+
+static void
+egl_window_surface_make_current(struct egl_window_surface *surface,
+				EGLSurface egl_surface)
+{
+	struct display *display = surface->display;
+
+	if (!eglMakeCurrent(display->dpy, egl_surface, egl_surface,
+			    display->argb_ctx))
+		fprintf(stderr, "failed to make surface current\n");
+}
+
+/* How many frames ago the back buffer was posted, 0 if unknown */
+static EGLint
+egl_window_surface_buffer_age(struct egl_window_surface *surface)
+{
+	struct display *display = surface->display;
+	cairo_device_t *device = display->argb_device;
+	EGLint age = 0;
+
+	if (!display->has_buffer_age)
+		return 0;
+
+	cairo_device_flush(device);
+	cairo_device_acquire(device);
+	egl_window_surface_make_current(surface, surface->egl_surface);
+	if (!eglQuerySurface(display->dpy, surface->egl_surface,
+			     EGL_BUFFER_AGE_EXT, &age))
+		age = 0;
+	egl_window_surface_make_current(surface, EGL_NO_SURFACE);
+	cairo_device_release(device);
+
+	return age;
+}
+
+static void
+egl_window_surface_push_damage(struct egl_window_surface *surface,
+			       enum wl_output_transform buffer_transform,
+			       int32_t buffer_scale,
+			       const struct rectangle *damage, int n_damage)
+{
+	struct egl_window_damage *history = surface->history;
+	struct egl_window_damage oldest = history[EGL_WINDOW_HISTORY - 1];
+	struct rectangle *rect;
+	int i;
+
+	memmove(&history[1], &history[0],
+		(EGL_WINDOW_HISTORY - 1) * sizeof history[0]);
+	history[0] = oldest;
+	history[0].rects.size = 0;
+	history[0].full = !damage || n_damage > 16 ||
+			  buffer_transform != WL_OUTPUT_TRANSFORM_NORMAL;
+	if (history[0].full)
+		return;
+
+	for (i = 0; i < n_damage; i++) {
+		rect = wl_array_add(&history[0].rects, sizeof *rect);
+		if (!rect) {
+			history[0].full = 1;
+			return;
+		}
+		rect->x = damage[i].x * buffer_scale;
+		rect->y = damage[i].y * buffer_scale;
+		rect->width = damage[i].width * buffer_scale;
+		rect->height = damage[i].height * buffer_scale;
+	}
+}
+
+static void
+egl_window_surface_reset_history(struct egl_window_surface *surface)
+{
+	int i;
+
+	for (i = 0; i < EGL_WINDOW_HISTORY; i++) {
+		surface->history[i].rects.size = 0;
+		surface->history[i].full = 1;
+	}
+}
+
+static cairo_surface_t *
+egl_window_surface_prepare(struct toysurface *base, int dx, int dy,
+			   int32_t width, int32_t height, uint32_t flags,
+			   enum wl_output_transform buffer_transform,
+			   int32_t buffer_scale)
+{
+	struct egl_window_surface *surface = to_egl_window_surface(base);
+	int preserve = !!(flags & SURFACE_HINT_PRESERVE);
+
+	surface_to_buffer_size(buffer_transform, buffer_scale, &width, &height);
+
+	base->preserved = preserve && surface->canvas &&
+			  dx == 0 && dy == 0 &&
+			  surface->width == width &&
+			  surface->height == height &&
+			  surface->transform == buffer_transform &&
+			  surface->scale == buffer_scale;
+
+	if (!surface->canvas ||
+	    surface->width != width || surface->height != height) {
+		if (surface->canvas)
+			cairo_surface_destroy(surface->canvas);
+		surface->canvas =
+			cairo_gl_surface_create(surface->display->argb_device,
+						CAIRO_CONTENT_COLOR_ALPHA,
+						width, height);
+		cairo_gl_surface_set_size(surface->window, width, height);
+		egl_window_surface_reset_history(surface);
+	}
+
+	surface->width = width;
+	surface->height = height;
+	surface->transform = buffer_transform;
+	surface->scale = buffer_scale;
+
+	wl_egl_window_resize(surface->egl_window, width, height, dx, dy);
+
+	return cairo_surface_reference(surface->canvas);
+}
+
+static void
+egl_window_surface_swap(struct toysurface *base,
+			enum wl_output_transform buffer_transform,
+			int32_t buffer_scale,
+			struct rectangle *server_allocation,
+			const struct rectangle *damage, int n_damage)
+{
+	struct egl_window_surface *surface = to_egl_window_surface(base);
+	struct display *display = surface->display;
+	cairo_device_t *device = display->argb_device;
+	struct egl_window_damage *frame;
+	const struct rectangle *rect;
+	struct wl_array rects;
+	EGLint *r;
+	EGLint age;
+	cairo_t *cr;
+	int i, full;
+
+	egl_window_surface_push_damage(surface, buffer_transform, buffer_scale,
+				       damage, n_damage);
+
+	/* The back buffer misses what the frames since it was posted
+	 * changed, this one included. */
+	age = egl_window_surface_buffer_age(surface);
+	full = age <= 0 || age > EGL_WINDOW_HISTORY;
+	for (i = 0; !full && i < age; i++)
+		full = surface->history[i].full;
+
+	cr = cairo_create(surface->window);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(cr, surface->canvas, 0, 0);
+	if (!full) {
+		for (i = 0; i < age; i++) {
+			frame = &surface->history[i];
+			wl_array_for_each(rect, &frame->rects)
+				cairo_rectangle(cr, rect->x, rect->y,
+						rect->width, rect->height);
+		}
+		cairo_clip(cr);
+	}
+	cairo_paint(cr);
+	cairo_destroy(cr);
+
+	cairo_surface_flush(surface->window);
+	cairo_device_flush(device);
+	cairo_device_acquire(device);
+	egl_window_surface_make_current(surface, surface->egl_surface);
+
+	/* Tell the compositor what this frame changed, in the bottom-left
+	 * origin of EGL. */
+	frame = &surface->history[0];
+	if (display->swap_buffers_with_damage && !frame->full) {
+		wl_array_init(&rects);
+		wl_array_for_each(rect, &frame->rects) {
+			r = wl_array_add(&rects, 4 * sizeof *r);
+			if (!r)
+				break;
+			r[0] = rect->x;
+			r[1] = surface->height - rect->y - rect->height;
+			r[2] = rect->width;
+			r[3] = rect->height;
+		}
+		display->swap_buffers_with_damage(display->dpy,
+						  surface->egl_surface,
+						  rects.data,
+						  rects.size / (4 * sizeof *r));
+		wl_array_release(&rects);
+	} else {
+		eglSwapBuffers(display->dpy, surface->egl_surface);
+	}
+
+	egl_window_surface_make_current(surface, EGL_NO_SURFACE);
+	cairo_device_release(device);
+
+	wl_egl_window_get_attached_size(surface->egl_window,
+					&server_allocation->width,
+					&server_allocation->height);
+
+	buffer_to_surface_size(buffer_transform, buffer_scale,
+			       &server_allocation->width,
+			       &server_allocation->height);
+}
+
+static void
+egl_window_surface_destroy(struct toysurface *base)
+{
+	struct egl_window_surface *surface = to_egl_window_surface(base);
+	struct display *d = surface->display;
+	int i;
+
+	if (surface->canvas)
+		cairo_surface_destroy(surface->canvas);
+	cairo_surface_destroy(surface->window);
+	weston_platform_destroy_egl_surface(d->dpy, surface->egl_surface);
+	wl_egl_window_destroy(surface->egl_window);
+
+	for (i = 0; i < EGL_WINDOW_HISTORY; i++)
+		wl_array_release(&surface->history[i].rects);
+
+	free(surface);
+}
+
+static struct toysurface *
+egl_window_surface_create(struct display *display,
+			  struct wl_surface *wl_surface,
+			  uint32_t flags,
+			  struct rectangle *rectangle)
+{
+	struct egl_window_surface *surface;
+	int i;
+
+	if (!display->argb_device)
+		return NULL;
+
+	surface = xzalloc(sizeof *surface);
+	surface->base.prepare = egl_window_surface_prepare;
+	surface->base.swap = egl_window_surface_swap;
+	surface->base.destroy = egl_window_surface_destroy;
+
+	surface->display = display;
+	surface->surface = wl_surface;
+
+	for (i = 0; i < EGL_WINDOW_HISTORY; i++)
+		wl_array_init(&surface->history[i].rects);
+
+	surface->egl_window = wl_egl_window_create(surface->surface,
+						   rectangle->width,
+						   rectangle->height);
+
+	surface->egl_surface =
+		weston_platform_create_egl_surface(display->dpy,
+						   display->argb_config,
+						   surface->egl_window, NULL);
+
+	surface->window =
+		cairo_gl_surface_create_for_egl(display->argb_device,
+						surface->egl_surface,
+						rectangle->width,
+						rectangle->height);
+
+	return &surface->base;
+}
+
+#else
+
+static struct toysurface *
+egl_window_surface_create(struct display *display,
+			  struct wl_surface *wl_surface,
+			  uint32_t flags,
+			  struct rectangle *rectangle)
+{
+	return NULL;
+}
+
+#endif
+
 /*
  * The following correspondences between file names and cursors was copied
  * from: https://bugs.kde.org/attachment.cgi?id=67313
@@ -1443,9 +2111,21 @@ surface_flush(struct surface *surface)
 					    widget->viewport_dest_height);
 	}
 
-	surface->toysurface->swap(surface->toysurface,
-				  surface->buffer_transform, surface->buffer_scale,
-				  &surface->server_allocation);
+	if (surface->damage_full)
+		surface->toysurface->swap(surface->toysurface,
+					  surface->buffer_transform,
+					  surface->buffer_scale,
+					  &surface->server_allocation,
+					  NULL, 0);
+	else
+		surface->toysurface->swap(surface->toysurface,
+					  surface->buffer_transform,
+					  surface->buffer_scale,
+					  &surface->server_allocation,
+					  surface->damage.data,
+					  surface->damage.size /
+					  sizeof(struct rectangle));
+	surface->damage.size = 0;
 
 	cairo_surface_destroy(surface->cairo_surface);
 	surface->cairo_surface = NULL;
@@ -1488,15 +2168,29 @@ surface_create_surface(struct surface *surface, uint32_t flags)
 	struct display *display = surface->window->display;
 	struct rectangle allocation = surface->allocation;
 
+	if (!surface->toysurface &&
+	    surface->buffer_type == WINDOW_BUFFER_TYPE_EGL_WINDOW)
+		surface->toysurface =
+			egl_window_surface_create(display, surface->surface,
+						  flags, &allocation);
+
 	if (!surface->toysurface)
 		surface->toysurface = shm_surface_create(display,
 							 surface->surface,
 							 flags, &allocation);
 
+	if (surface->preserve_contents)
+		flags |= SURFACE_HINT_PRESERVE;
+
 	surface->cairo_surface = surface->toysurface->prepare(
 		surface->toysurface, 0, 0,
 		allocation.width, allocation.height, flags,
 		surface->buffer_transform, surface->buffer_scale);
+
+	surface->contents_preserved = surface->preserve_contents &&
+		surface->toysurface->preserved;
+	surface->damage_full = !surface->contents_preserved;
+	surface->damage.size = 0;
 }
 
 static void
@@ -1585,6 +2279,7 @@ surface_destroy(struct surface *surface)
 	if (surface->toysurface)
 		surface->toysurface->destroy(surface->toysurface);
 
+	wl_array_release(&surface->damage);
 	wl_list_remove(&surface->link);
 	free(surface);
 }
@@ -1810,6 +2505,50 @@ widget_set_transparent(struct widget *widget, int transparent)
 	widget->opaque = !transparent;
 }
 
+/*
+ * Ask for the widget's surface to keep its contents between redraws.
+ * Every redraw handler on that surface must then check
+ * widget_contents_preserved() and, when it returns true, repaint only
+ * what changed and report it with widget_add_damage().
+ */
+void
+widget_set_preserve_contents(struct widget *widget, int preserve)
+{
+	widget->surface->preserve_contents = preserve;
+}
+
+int
+widget_contents_preserved(struct widget *widget)
+{
+	return widget->surface->contents_preserved;
+}
+
+void
+widget_add_damage(struct widget *widget, const struct rectangle *rect)
+{
+	struct surface *surface = widget->surface;
+	struct rectangle *damage;
+
+	if (surface->damage_full)
+		return;
+
+	if (!rect) {
+		surface->damage_full = 1;
+		return;
+	}
+
+	damage = wl_array_add(&surface->damage, sizeof *damage);
+	if (!damage) {
+		surface->damage_full = 1;
+		return;
+	}
+
+	damage->x = rect->x - surface->allocation.x;
+	damage->y = rect->y - surface->allocation.y;
+	damage->width = rect->width;
+	damage->height = rect->height;
+}
+
 void *
 widget_get_user_data(struct widget *widget)
 {
@@ -2341,16 +3080,82 @@ frame_resize_handler(struct widget *widget,
 	widget_schedule_redraw(widget);
 }
 
+static void
+frame_cache_update(struct window_frame *frame, struct widget *widget,
+		   int32_t width, int32_t height)
+{
+	struct surface *surface = widget->surface;
+	cairo_surface_t *cache;
+	cairo_t *cr;
+
+	if (frame->cache.surface)
+		cairo_surface_destroy(frame->cache.surface);
+	frame->cache.surface = NULL;
+
+	cache = cairo_surface_create_similar(widget_get_cairo_surface(widget),
+					     CAIRO_CONTENT_COLOR_ALPHA,
+					     width, height);
+	if (cairo_surface_status(cache) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(cache);
+		return;
+	}
+
+	cr = cairo_create(cache);
+	widget_cairo_update_transform(widget, cr);
+	cairo_translate(cr, -surface->allocation.x, -surface->allocation.y);
+	frame_repaint(frame->frame, cr);
+	cairo_destroy(cr);
+
+	frame->cache.surface = cache;
+	frame->cache.width = width;
+	frame->cache.height = height;
+	frame->cache.scale = surface->buffer_scale;
+	frame->cache.transform = surface->buffer_transform;
+}
+
 static void
 frame_redraw_handler(struct widget *widget, void *data)
 {
 	cairo_t *cr;
 	struct window_frame *frame = data;
 	struct window *window = widget->window;
+	struct surface *surface = widget->surface;
+	int32_t width = surface->allocation.width;
+	int32_t height = surface->allocation.height;
 
 	if (window->fullscreen)
 		return;
 
+	surface_to_buffer_size(surface->buffer_transform,
+			       surface->buffer_scale, &width, &height);
+
+	/* Content redraws do not touch the decorations, so blit them from
+	 * the previous rendering instead of going through the theme. */
+	if (!frame->cache.surface ||
+	    (frame_status(frame->frame) & FRAME_STATUS_REPAINT) ||
+	    frame->cache.width != width || frame->cache.height != height ||
+	    frame->cache.scale != surface->buffer_scale ||
+	    frame->cache.transform != surface->buffer_transform) {
+		frame_cache_update(frame, widget, width, height);
+	} else if (frame->cache.surface && widget_contents_preserved(widget)) {
+		/* The decorations are still in the buffer. */
+		return;
+	}
+
+	/* Everything under the frame is painted over, so the children
+	 * cannot rely on the old contents either. */
+	surface->contents_preserved = 0;
+	surface->damage_full = 1;
+
+	if (frame->cache.surface) {
+		cr = cairo_create(widget_get_cairo_surface(widget));
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		cairo_set_source_surface(cr, frame->cache.surface, 0, 0);
+		cairo_paint(cr);
+		cairo_destroy(cr);
+		return;
+	}
+
 	cr = widget_cairo_create(widget);
 
 	frame_repaint(frame->frame, cr);
@@ -2719,6 +3524,8 @@ window_frame_set_child_size(struct widget *widget, int child_width,
 static void
 window_frame_destroy(struct window_frame *frame)
 {
+	if (frame->cache.surface)
+		cairo_surface_destroy(frame->cache.surface);
 	frame_destroy(frame->frame);
 
 	/* frame->child must be destroyed by the application */
@@ -5391,6 +6198,7 @@ surface_create(struct window *window)
 	surface->window = window;
 	surface->surface = wl_compositor_create_surface(display->compositor);
 	surface->buffer_scale = 1;
+	wl_array_init(&surface->damage);
 	wl_surface_add_listener(surface->surface, &surface_listener, window);
 
 	wl_list_insert(&window->subsurface_list, &surface->link);
@@ -5402,6 +6210,11 @@ surface_create(struct window *window)
 static enum window_buffer_type
 get_preferred_buffer_type(struct display *display)
 {
+#ifdef HAVE_CAIRO_EGL
+	if (display->argb_device)
+		return WINDOW_BUFFER_TYPE_EGL_WINDOW;
+#endif
+
 	return WINDOW_BUFFER_TYPE_SHM;
 }
 
@@ -6750,6 +7563,34 @@ global_destroy(struct display *disp, struct global *g)
 	free(g);
 }
 
+static void
+dmabuf_format(void *data, struct zwp_linux_dmabuf_v1 *zwp_linux_dmabuf,
+	      uint32_t format)
+{
+	/* Superseded by the modifier event */
+}
+
+static void
+dmabuf_modifier(void *data, struct zwp_linux_dmabuf_v1 *zwp_linux_dmabuf,
+		uint32_t format, uint32_t modifier_hi, uint32_t modifier_lo)
+{
+	struct display *d = data;
+	uint64_t modifier = ((uint64_t) modifier_hi << 32) | modifier_lo;
+
+	if (modifier != DRM_FORMAT_MOD_LINEAR)
+		return;
+
+	if (format == DRM_FORMAT_ARGB8888)
+		d->dmabuf_linear_argb8888 = true;
+	else if (format == DRM_FORMAT_XRGB8888)
+		d->dmabuf_linear_xrgb8888 = true;
+}
+
+static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
+	dmabuf_format,
+	dmabuf_modifier,
+};
+
 static void
 registry_handle_global(void *data, struct wl_registry *registry, uint32_t id,
 		       const char *interface, uint32_t version)
@@ -6784,6 +7625,12 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t id,
 					 1);
 	} else if (strcmp(interface, "wl_shm") == 0) {
 		d->shm = wl_registry_bind(registry, id, &wl_shm_interface, 1);
+	} else if (strcmp(interface, "zwp_linux_dmabuf_v1") == 0 &&
+		   version >= 3) {
+		d->dmabuf = wl_registry_bind(registry, id,
+					     &zwp_linux_dmabuf_v1_interface, 3);
+		zwp_linux_dmabuf_v1_add_listener(d->dmabuf, &dmabuf_listener,
+						 d);
 	} else if (strcmp(interface, "wl_data_device_manager") == 0) {
 		display_add_data_device(d, id, version);
 	} else if (strcmp(interface, "xdg_wm_base") == 0) {
@@ -6922,6 +7769,7 @@ display_create(int *argc, char *argv[])
 	wl_list_init(&d->input_list);
 	wl_list_init(&d->output_list);
 	wl_list_init(&d->global_list);
+	d->udmabuf_fd = -1;
 
 	d->display = wl_display_connect(NULL);
 	if (d->display == NULL) {
@@ -6957,6 +7805,22 @@ display_create(int *argc, char *argv[])
 		return NULL;
 	}
 
+#ifdef HAVE_LINUX_UDMABUF_H
+	if (d->dmabuf && (d->dmabuf_linear_argb8888 ||
+			  d->dmabuf_linear_xrgb8888))
+		d->udmabuf_fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+#endif
+
+#ifdef HAVE_CAIRO_EGL
+	/* Windows render on the GPU, unless this fails or is turned off;
+	 * they use wl_shm then. */
+	if (!getenv("TOYTOOLKIT_NO_EGL") && init_egl(d) < 0) {
+		fini_egl(d);
+		d->argb_device = NULL;
+		d->dpy = EGL_NO_DISPLAY;
+	}
+#endif
+
 	create_cursors(d);
 
 	d->theme = theme_create();
@@ -6976,6 +7840,101 @@ display_destroy_outputs(struct display *display)
 		output_destroy(output);
 }
 
+#ifdef HAVE_CAIRO_EGL
+
+static int
+init_egl(struct display *d)
+{
+	EGLint major, minor;
+	EGLint n;
+	const char *extensions;
+
+	static const EGLint argb_cfg_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_NONE
+	};
+
+	static const EGLint context_attribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+
+	d->dpy = weston_platform_get_egl_display(EGL_PLATFORM_WAYLAND_KHR,
+						 d->display, NULL);
+
+	if (!eglInitialize(d->dpy, &major, &minor)) {
+		fprintf(stderr, "failed to initialize EGL\n");
+		return -1;
+	}
+
+	if (!eglBindAPI(EGL_OPENGL_ES_API)) {
+		fprintf(stderr, "failed to bind EGL client API\n");
+		return -1;
+	}
+
+	if (!eglChooseConfig(d->dpy, argb_cfg_attribs,
+			     &d->argb_config, 1, &n) || n != 1) {
+		fprintf(stderr, "failed to choose argb EGL config\n");
+		return -1;
+	}
+
+	d->argb_ctx = eglCreateContext(d->dpy, d->argb_config,
+				       EGL_NO_CONTEXT, context_attribs);
+	if (d->argb_ctx == EGL_NO_CONTEXT) {
+		fprintf(stderr, "failed to create EGL context\n");
+		return -1;
+	}
+
+	d->argb_device = cairo_egl_device_create(d->dpy, d->argb_ctx);
+	if (cairo_device_status(d->argb_device) != CAIRO_STATUS_SUCCESS) {
+		fprintf(stderr, "failed to get cairo EGL argb device\n");
+		cairo_device_destroy(d->argb_device);
+		d->argb_device = NULL;
+		return -1;
+	}
+
+	/* The toysurfaces switch the current surface themselves. */
+	cairo_gl_device_set_thread_aware(d->argb_device, 0);
+
+	extensions = eglQueryString(d->dpy, EGL_EXTENSIONS);
+	d->has_buffer_age =
+		weston_check_egl_extension(extensions, "EGL_EXT_buffer_age");
+
+	if (weston_check_egl_extension(extensions,
+				       "EGL_KHR_swap_buffers_with_damage"))
+		d->swap_buffers_with_damage = (void *)
+			eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+	else if (weston_check_egl_extension(extensions,
+					    "EGL_EXT_swap_buffers_with_damage"))
+		d->swap_buffers_with_damage = (void *)
+			eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+
+	return 0;
+}
+
+static void
+fini_egl(struct display *display)
+{
+	if (display->argb_device)
+		cairo_device_destroy(display->argb_device);
+
+	if (display->argb_ctx != EGL_NO_CONTEXT)
+		eglDestroyContext(display->dpy, display->argb_ctx);
+
+	eglMakeCurrent(display->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+		       EGL_NO_CONTEXT);
+
+	eglTerminate(display->dpy);
+	eglReleaseThread();
+}
+
+#endif
+
 static void
 display_destroy_inputs(struct display *display)
 {
@@ -7015,6 +7974,11 @@ display_destroy(struct display *display)
 		theme_destroy(display->theme);
 	destroy_cursors(display);
 
+#ifdef HAVE_CAIRO_EGL
+	if (display->dpy != EGL_NO_DISPLAY)
+		fini_egl(display);
+#endif
+
 	cleanup_after_cairo();
 
 	if (display->relative_pointer_manager)
@@ -7038,6 +8002,11 @@ display_destroy(struct display *display)
 	if (display->shm)
 		wl_shm_destroy(display->shm);
 
+	if (display->dmabuf)
+		zwp_linux_dmabuf_v1_destroy(display->dmabuf);
+	if (display->udmabuf_fd >= 0)
+		close(display->udmabuf_fd);
+
 	if (display->data_device_manager)
 		wl_data_device_manager_destroy(display->data_device_manager);
 
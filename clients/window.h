@@ -117,6 +117,7 @@ display_create_data_source(struct display *display);
 #define SURFACE_SHM    0x02
 
 #define SURFACE_HINT_RESIZE 0x10
+#define SURFACE_HINT_PRESERVE 0x20
 
 cairo_surface_t *
 display_create_surface(struct display *display,
@@ -451,6 +452,8 @@ widget_get_wl_subsurface(struct widget *widget);
 
 enum window_buffer_type {
 	WINDOW_BUFFER_TYPE_SHM,
+	/* GPU rendered, if the toytoolkit is built with cairo-glesv2 */
+	WINDOW_BUFFER_TYPE_EGL_WINDOW,
 };
 
 void
@@ -599,6 +602,12 @@ widget_set_size(struct widget *widget, int32_t width, int32_t height);
 void
 widget_set_transparent(struct widget *widget, int transparent);
 void
+widget_set_preserve_contents(struct widget *widget, int preserve);
+int
+widget_contents_preserved(struct widget *widget);
+void
+widget_add_damage(struct widget *widget, const struct rectangle *rect);
+void
 widget_schedule_resize(struct widget *widget, int32_t width, int32_t height);
 
 void *
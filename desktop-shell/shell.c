@@ -142,6 +142,7 @@ struct shell_surface {
 	} xwayland;
 
 	int focus_count;
+	struct wl_listener metadata_listener;
 
 	bool destroying;
 	struct wl_list link;	/** desktop_shell::shsurf_list */
@@ -541,6 +542,9 @@ shell_configuration(struct desktop_shell *shell)
 					   &disallow_output_changed_move, false);
 	shell->disallow_output_changed_move = disallow_output_changed_move;
 
+	weston_config_section_get_uint(section, "background-frame-rate",
+				       &shell->background_frame_rate, 0);
+
 	shell->binding_modifier = weston_config_get_binding_modifier(config, MODIFIER_SUPER);
 
 	weston_config_section_get_string(section, "animation", &s, "none");
@@ -1592,12 +1596,79 @@ has_keyboard_focused_child(struct shell_surface *shsurf)
 	return has_keyboard_focus;
 }
 
+/* The frame rate cap of an application, from the application section
+ * with its app_id, 0 for none */
+static uint32_t
+shell_get_app_frame_rate(struct desktop_shell *shell, const char *app_id)
+{
+	struct weston_config_section *section;
+	uint32_t frame_rate;
+
+	if (!app_id)
+		return 0;
+
+	section = weston_config_get_section(wet_get_config(shell->compositor),
+					    "application", "app-id", app_id);
+	weston_config_section_get_uint(section, "frame-rate", &frame_rate, 0);
+
+	return frame_rate;
+}
+
+/* Windows get the frame rate cap of their application, or the background
+ * one while they don't have keyboard focus, whichever is lower. */
+static void
+shell_surface_update_frame_rate(struct shell_surface *shsurf, bool activated)
+{
+	struct desktop_shell *shell = shsurf->shell;
+	struct weston_desktop_surface *dsurface = shsurf->desktop_surface;
+	uint32_t frame_rate;
+
+	frame_rate = shell_get_app_frame_rate(shell,
+					      weston_desktop_surface_get_app_id(dsurface));
+	if (!activated && shell->background_frame_rate > 0 &&
+	    (frame_rate == 0 || shell->background_frame_rate < frame_rate))
+		frame_rate = shell->background_frame_rate;
+
+	weston_surface_set_frame_rate_limit(weston_desktop_surface_get_surface(dsurface),
+					    frame_rate);
+}
+
+static void
+update_child_frame_rate_callback(struct weston_desktop_surface *surface,
+				 void *user_data)
+{
+	struct weston_surface *es = weston_desktop_surface_get_surface(surface);
+	struct shell_surface *shsurf = get_shell_surface(es);
+	bool *activated = user_data;
+
+	if (!shsurf)
+		return;
+
+	shell_surface_update_frame_rate(shsurf, *activated);
+	weston_desktop_surface_foreach_child(surface,
+					     update_child_frame_rate_callback,
+					     activated);
+}
+
+static struct shell_surface *
+get_toplevel_shell_surface(struct shell_surface *shsurf)
+{
+	struct weston_desktop_surface *surface = shsurf->desktop_surface;
+	struct weston_desktop_surface *parent;
+
+	while ((parent = weston_desktop_surface_get_parent(surface)))
+		surface = parent;
+
+	return get_shell_surface(weston_desktop_surface_get_surface(surface));
+}
+
 static void
 sync_surface_activated_state(struct shell_surface *shsurf)
 {
 	struct weston_desktop_surface *surface = shsurf->desktop_surface;
 	struct weston_desktop_surface *parent;
 	struct weston_surface *parent_surface;
+	bool activated;
 
 	parent = weston_desktop_surface_get_parent(surface);
 	if (parent) {
@@ -1606,10 +1677,25 @@ sync_surface_activated_state(struct shell_surface *shsurf)
 		return;
 	}
 
-	if (has_keyboard_focused_child(shsurf))
-		weston_desktop_surface_set_activated(surface, true);
-	else
-		weston_desktop_surface_set_activated(surface, false);
+	activated = has_keyboard_focused_child(shsurf);
+	weston_desktop_surface_set_activated(surface, activated);
+
+	shell_surface_update_frame_rate(shsurf, activated);
+	weston_desktop_surface_foreach_child(surface,
+					     update_child_frame_rate_callback,
+					     &activated);
+}
+
+static void
+shell_surface_metadata_changed(struct wl_listener *listener, void *data)
+{
+	struct shell_surface *shsurf =
+		container_of(listener, struct shell_surface, metadata_listener);
+	struct shell_surface *toplevel = get_toplevel_shell_surface(shsurf);
+
+	/* the app_id may have changed */
+	shell_surface_update_frame_rate(shsurf,
+					has_keyboard_focused_child(toplevel));
 }
 
 static void
@@ -2135,6 +2221,11 @@ desktop_surface_added(struct weston_desktop_surface *desktop_surface,
 	wl_list_insert(&shsurf->shell->shsurf_list, &shsurf->link);
 
 	weston_desktop_surface_set_user_data(desktop_surface, shsurf);
+
+	shsurf->metadata_listener.notify = shell_surface_metadata_changed;
+	weston_desktop_surface_add_metadata_listener(desktop_surface,
+						     &shsurf->metadata_listener);
+	shell_surface_update_frame_rate(shsurf, false);
 }
 
 static void
@@ -2167,6 +2258,9 @@ desktop_surface_removed(struct weston_desktop_surface *desktop_surface,
 		shsurf->fullscreen.black_view = NULL;
 	}
 
+	wl_list_remove(&shsurf->metadata_listener.link);
+	weston_surface_set_frame_rate_limit(surface, 0);
+
 	weston_surface_set_label_func(surface, NULL);
 	weston_desktop_surface_set_user_data(shsurf->desktop_surface, NULL);
 	shsurf->desktop_surface = NULL;
@@ -4489,6 +4583,7 @@ shell_reposition_view_on_output_change(struct weston_view *view)
 {
 	struct weston_output *output, *first_output;
 	struct weston_compositor *ec = view->surface->compositor;
+	struct weston_coord_global pos;
 	struct shell_surface *shsurf;
 	int visible;
 
@@ -4503,12 +4598,15 @@ shell_reposition_view_on_output_change(struct weston_view *view)
 
 	/* At this point the destroyed output is not in the list anymore.
 	 * If the view is still visible somewhere, we leave where it is,
-	 * otherwise, move it to the first output. */
+	 * otherwise, move it to the first output.
+	 *
+	 * The compositor has already given new outputs to the views of the
+	 * destroyed one, and views on moved outputs moved with them, so a
+	 * visible view is left alone: dirtying its geometry would damage
+	 * and re-propose planes on outputs that did not change at all. */
 	visible = 0;
+	pos = weston_view_get_pos_offset_global(view);
 	wl_list_for_each(output, &ec->output_list, link) {
-		struct weston_coord_global pos;
-
-		pos = weston_view_get_pos_offset_global(view);
 		if (weston_output_contains_coord(output, pos)) {
 			visible = 1;
 			break;
@@ -4519,25 +4617,17 @@ shell_reposition_view_on_output_change(struct weston_view *view)
 	if (!shsurf)
 		return;
 
-	if (!visible) {
-		struct weston_coord_global pos;
-
-		first_output = container_of(ec->output_list.next,
-					    struct weston_output, link);
+	if (visible)
+		return;
 
-		pos = first_output->pos;
-		pos.c.x += first_output->width / 4;
-		pos.c.y += first_output->height / 4;
+	first_output = container_of(ec->output_list.next,
+				    struct weston_output, link);
 
-		weston_view_set_position(view, pos);
-	} else {
-		weston_view_geometry_dirty(view);
-
-		if (shsurf->state.maximized ||
-		    shsurf->state.fullscreen)
-			return;
-	}
+	pos = first_output->pos;
+	pos.c.x += first_output->width / 4;
+	pos.c.y += first_output->height / 4;
 
+	weston_view_set_position(view, pos);
 
 	shsurf->saved_position_valid = false;
 	set_maximized(shsurf, false);
@@ -30,6 +30,7 @@
 
 #include "config.h"
 
+#include <assert.h>
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
@@ -45,6 +46,7 @@
 #include <libevdev/libevdev.h>
 #include <linux/input.h>
 #include <sys/time.h>
+#include <time.h>
 #include <linux/limits.h>
 
 #include "weston.h"
@@ -53,6 +55,7 @@
 #include "shared/helpers.h"
 #include "shared/process-util.h"
 #include "shared/string-helpers.h"
+#include "shared/timespec-util.h"
 #include "shared/xalloc.h"
 #include "git-version.h"
 #include <libweston/version.h>
@@ -75,6 +78,12 @@
 /* flight recorder size (in bytes) */
 #define DEFAULT_FLIGHT_REC_SIZE (5 * 1024 * 1024)
 #define DEFAULT_FLIGHT_REC_SCOPES "log,drm-backend"
+/* queue of the --async-log writer thread (in bytes) */
+#define DEFAULT_ASYNC_LOG_SIZE (1024 * 1024)
+/* binary timeline ring file size (in bytes) */
+#define DEFAULT_TIMELINE_FILE_SIZE (16 * 1024 * 1024)
+/* binary protocol ring file size (in bytes) */
+#define DEFAULT_PROTOCOL_FILE_SIZE (16 * 1024 * 1024)
 
 struct wet_output_config {
 	int width;
@@ -139,6 +148,21 @@ enum require_outputs {
         REQUIRE_OUTPUTS_NONE,
 };
 
+/** Start-up phase timing, see wet_startup_mark() */
+struct wet_startup_profile {
+	bool enabled;
+	struct timespec start;
+	struct timespec last;
+};
+
+/** Waits for the first frame of an output, see wet_watch_first_frame() */
+struct wet_first_frame_watch {
+	struct wet_compositor *wet;
+	struct wl_listener frame_listener;
+	struct wl_listener output_destroy_listener;
+	struct wl_list link;	/**< wet_compositor::first_frame_watch_list */
+};
+
 struct wet_compositor {
 	struct weston_compositor *compositor;
 	struct weston_config *config;
@@ -155,6 +179,10 @@ struct wet_compositor {
 	struct wl_listener screenshot_auth;
 	struct wl_listener output_created_listener;
 	enum require_outputs require_outputs;
+	struct wet_startup_profile startup;
+	struct wl_list first_frame_watch_list;	/**< wet_first_frame_watch::link */
+	char *deferred_modules;
+	struct wl_event_source *deferred_modules_idle;
 };
 
 static FILE *weston_logfile = NULL;
@@ -264,14 +292,229 @@ get_next_argument(const char *signature, char* type)
 	return signature;
 }
 
+enum wet_protocol_record_type {
+	WET_PROTOCOL_RECORD_INTERFACE = 1,	/**< an interface name */
+	WET_PROTOCOL_RECORD_MESSAGE,		/**< a request or an event */
+	WET_PROTOCOL_RECORD_STRING,		/**< a piece of a string argument */
+};
+
+#define WET_PROTOCOL_RECORD_ARGS 9
+#define WET_PROTOCOL_RECORD_LABEL_LEN 48
+
+/* Longer string arguments are cut to this many bytes. */
+#define WET_PROTOCOL_STRING_MAX (4 * WET_PROTOCOL_RECORD_LABEL_LEN)
+
+/* Interfaces are described again every so many records, so a ring that
+ * wrapped around still has their names. */
+#define WET_PROTOCOL_DESCRIBE_INTERVAL 16384
+
+/** Fixed-size record of the binary protocol capture, written to the
+ * subscribers of the proto scope that take binary data instead of text,
+ * like the --protocol-file ring. tools/protocol-dump.py decodes it.
+ *
+ * A message record holds its first WET_PROTOCOL_RECORD_ARGS arguments
+ * raw: integers, fixed-point numbers and file descriptors as they are,
+ * objects and new IDs by object ID, arrays by their size in bytes, and
+ * strings by their length including the NUL, or 0 when NULL. The
+ * contents of the strings follow in string records, in argument order.
+ *
+ * Everything is in native byte order.
+ */
+struct wet_protocol_record {
+	uint32_t type;		/**< enum wet_protocol_record_type */
+	uint32_t id;		/**< interface ID; for strings, the argument index */
+	uint64_t timestamp;	/**< CLOCK_MONOTONIC, in nanoseconds */
+	union {
+		struct {
+			uint32_t client;	/**< PID of the client */
+			uint32_t object;	/**< ID of the target object */
+			uint16_t opcode;
+			uint8_t event;		/**< 1 for events, 0 for requests */
+			uint8_t n_args;		/**< number of arguments in the message */
+			uint32_t args[WET_PROTOCOL_RECORD_ARGS];
+		} message;
+		/** interface name, or a piece of a string argument; not
+		 * NUL-terminated when it fills the whole field */
+		char label[WET_PROTOCOL_RECORD_LABEL_LEN];
+	};
+};
+
+static_assert(sizeof(struct wet_protocol_record) == 64,
+	      "binary protocol records are 64 bytes");
+
+struct wet_protocol_interface {
+	const char *name;
+	uint64_t described_at;
+};
+
+/* Interfaces seen by the binary capture; an interface ID is its index in
+ * the array plus one. */
+static struct wl_array protocol_interfaces;
+static uint64_t protocol_records;
+
 static void
-protocol_log_fn(void *user_data,
-		enum wl_protocol_logger_type direction,
-		const struct wl_protocol_logger_message *message)
+protocol_capture_emit(const struct wet_protocol_record *rec)
+{
+	struct weston_log_subscription *sub = NULL;
+
+	while ((sub = weston_log_subscription_iterate(protocol_scope, sub))) {
+		if (weston_log_subscription_is_binary(sub))
+			weston_log_subscription_write(sub, (const char *) rec,
+						      sizeof(*rec));
+	}
+
+	protocol_records++;
+}
+
+static uint32_t
+protocol_capture_interface(const char *name, uint64_t timestamp)
+{
+	struct wet_protocol_interface *iface, *found = NULL;
+	struct wet_protocol_record rec = {
+		.type = WET_PROTOCOL_RECORD_INTERFACE,
+		.timestamp = timestamp,
+	};
+	uint32_t id = 0;
+
+	/* Class names are the name strings of the wl_interfaces, so the
+	 * pointers tell interfaces apart. */
+	wl_array_for_each(iface, &protocol_interfaces) {
+		id++;
+		if (iface->name == name) {
+			found = iface;
+			break;
+		}
+	}
+
+	if (!found) {
+		found = wl_array_add(&protocol_interfaces, sizeof(*found));
+		if (!found)
+			return 0;
+		found->name = name;
+		id++;
+	} else if (protocol_records - found->described_at <
+		   WET_PROTOCOL_DESCRIBE_INTERVAL) {
+		return id;
+	}
+
+	found->described_at = protocol_records;
+	rec.id = id;
+	strncpy(rec.label, name, sizeof(rec.label));
+	protocol_capture_emit(&rec);
+
+	return id;
+}
+
+static void
+protocol_capture_string(uint32_t index, const char *str, size_t len,
+			uint64_t timestamp)
+{
+	struct wet_protocol_record rec = {
+		.type = WET_PROTOCOL_RECORD_STRING,
+		.id = index,
+		.timestamp = timestamp,
+	};
+	size_t off, n;
+
+	for (off = 0; off < len; off += n) {
+		n = MIN(len - off, sizeof(rec.label));
+		memset(rec.label, 0, sizeof(rec.label));
+		memcpy(rec.label, str + off, n);
+		protocol_capture_emit(&rec);
+	}
+}
+
+/** Write a message as binary records to the binary subscriptions of the
+ * proto scope; nothing is formatted, names are resolved offline.
+ */
+static void
+protocol_log_binary(enum wl_protocol_logger_type direction,
+		    const struct wl_protocol_logger_message *message)
+{
+	struct wl_resource *res = message->resource;
+	const char *signature = message->message->signature;
+	const union wl_argument *arg;
+	struct wet_protocol_record rec = {
+		.type = WET_PROTOCOL_RECORD_MESSAGE,
+	};
+	struct timespec ts;
+	pid_t pid = 0;
+	uint32_t *raw;
+	size_t len;
+	int i;
+	char type;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec.timestamp = timespec_to_nsec(&ts);
+
+	wl_client_get_credentials(wl_resource_get_client(res), &pid,
+				  NULL, NULL);
+
+	rec.id = protocol_capture_interface(wl_resource_get_class(res),
+					    rec.timestamp);
+	rec.message.client = pid;
+	rec.message.object = wl_resource_get_id(res);
+	rec.message.opcode = message->message_opcode;
+	rec.message.event = direction == WL_PROTOCOL_LOGGER_EVENT;
+	rec.message.n_args = message->arguments_count;
+
+	for (i = 0; i < message->arguments_count &&
+		    i < WET_PROTOCOL_RECORD_ARGS; i++) {
+		signature = get_next_argument(signature, &type);
+		arg = &message->arguments[i];
+		raw = &rec.message.args[i];
+
+		switch (type) {
+		case 'u':
+			*raw = arg->u;
+			break;
+		case 'i':
+			*raw = arg->i;
+			break;
+		case 'f':
+			*raw = arg->f;
+			break;
+		case 's':
+			*raw = arg->s ? MIN(strlen(arg->s) + 1,
+					    WET_PROTOCOL_STRING_MAX) : 0;
+			break;
+		case 'o':
+			*raw = arg->o ?
+				wl_resource_get_id((struct wl_resource *) arg->o) : 0;
+			break;
+		case 'n':
+			*raw = arg->n;
+			break;
+		case 'a':
+			*raw = arg->a ? arg->a->size : 0;
+			break;
+		case 'h':
+			*raw = arg->h;
+			break;
+		}
+	}
+
+	protocol_capture_emit(&rec);
+
+	/* The string contents, cut like their lengths above. */
+	signature = message->message->signature;
+	for (i = 0; i < message->arguments_count &&
+		    i < WET_PROTOCOL_RECORD_ARGS; i++) {
+		signature = get_next_argument(signature, &type);
+		len = rec.message.args[i];
+		if (type == 's' && len > 0)
+			protocol_capture_string(i, message->arguments[i].s,
+						len, rec.timestamp);
+	}
+}
+
+static char *
+protocol_log_format(enum wl_protocol_logger_type direction,
+		    const struct wl_protocol_logger_message *message,
+		    size_t *logsize)
 {
 	FILE *fp;
 	char *logstr;
-	size_t logsize;
 	char timestr[128];
 	struct wl_resource *res = message->resource;
 	struct wl_client *client = wl_resource_get_client(res);
@@ -280,12 +523,9 @@ protocol_log_fn(void *user_data,
 	int i;
 	char type;
 
-	if (!weston_log_scope_is_enabled(protocol_scope))
-		return;
-
-	fp = open_memstream(&logstr, &logsize);
+	fp = open_memstream(&logstr, logsize);
 	if (!fp)
-		return;
+		return NULL;
 
 	wl_client_get_credentials(client, &pid, NULL, NULL);
 
@@ -351,10 +591,50 @@ protocol_log_fn(void *user_data,
 
 	fprintf(fp, ")\n");
 
-	if (fclose(fp) == 0)
-		weston_log_scope_write(protocol_scope, logstr, logsize);
+	if (fclose(fp) != 0) {
+		free(logstr);
+		return NULL;
+	}
+
+	return logstr;
+}
+
+static void
+protocol_log_fn(void *user_data,
+		enum wl_protocol_logger_type direction,
+		const struct wl_protocol_logger_message *message)
+{
+	struct weston_log_subscription *sub = NULL;
+	char *logstr = NULL;
+	size_t logsize = 0;
+	bool formatted = false;
+	bool binary = false;
+
+	if (!weston_log_scope_is_enabled(protocol_scope))
+		return;
+
+	/* Format the text at most once, and only if a subscription wants
+	 * it; binary subscriptions get records instead. */
+	while ((sub = weston_log_subscription_iterate(protocol_scope, sub))) {
+		if (weston_log_subscription_is_binary(sub)) {
+			binary = true;
+			continue;
+		}
+
+		if (!formatted) {
+			logstr = protocol_log_format(direction, message,
+						     &logsize);
+			formatted = true;
+		}
+
+		if (logstr)
+			weston_log_subscription_write(sub, logstr, logsize);
+	}
 
 	free(logstr);
+
+	if (binary)
+		protocol_log_binary(direction, message);
 }
 
 static struct wet_compositor *
@@ -721,16 +1001,25 @@ usage(int error_code)
 #endif
 		"  --modules\t\tLoad the comma-separated list of modules\n"
 		"  --log=FILE\t\tLog to the given file\n"
+		"  --async-log\t\tWrite the log from a thread, dropping "
+			"messages\n\t\t\trather than stalling when it falls "
+			"behind\n"
 		"  -c, --config=FILE\tConfig file to load, defaults to weston.ini\n"
 		"  --no-config\t\tDo not read weston.ini\n"
 		"  --wait-for-debugger\tRaise SIGSTOP on start-up\n"
 		"  --debug\t\tEnable debug extension\n"
+		"  --startup-profile\tLog the time spent in each start-up phase\n"
 		"  -l, --logger-scopes=SCOPE\n\t\t\tSpecify log scopes to "
 			"subscribe to.\n\t\t\tCan specify multiple scopes, "
 			"each followed by comma\n"
 		"  -f, --flight-rec-scopes=SCOPE\n\t\t\tSpecify log scopes to "
 			"subscribe to.\n\t\t\tCan specify multiple scopes, "
 			"each followed by comma\n"
+		"  --timeline-file=FILE\tRecord the binary timeline into a "
+			"ring in FILE\n"
+		"  --trace-marker\tWrite the timeline to the kernel trace_marker\n"
+		"  --protocol-file=FILE\tRecord the Wayland protocol in binary "
+			"into a ring in FILE\n"
 		"  -h, --help\t\tThis help message\n\n");
 
 #if defined(BUILD_DRM_COMPOSITOR)
@@ -757,6 +1046,9 @@ usage(int error_code)
 		"  --use-gl\t\tUse the GL renderer (deprecated alias for --renderer=gl)\n"
 		"  --no-outputs\t\tDo not create any virtual outputs\n"
 		"  --refresh-rate=RATE\tThe output refresh rate (in mHz)\n"
+		"  --vblank\t\tFinish frames on a virtual vblank grid\n"
+		"  --vblank-jitter=USEC\tDelay virtual vblank events by up to USEC\n"
+		"  --use-dmabuf\t\tRender into GBM allocated DMABUFs with the GL renderer\n"
 		"\n");
 #endif
 
@@ -806,6 +1098,7 @@ usage(int error_code)
 		"  --use-pixman\t\tUse the pixman (CPU) renderer (deprecated alias for --renderer=pixman)\n"
 		"  --output-count=COUNT\tCreate multiple outputs\n"
 		"  --sprawl\t\tCreate one fullscreen output for every parent output\n"
+		"  --passthrough\t\tForward client dmabufs to the parent compositor as sub-surfaces\n"
 		"  --display=DISPLAY\tWayland display to connect to\n\n");
 #endif
 
@@ -818,7 +1111,8 @@ usage(int error_code)
 		"  --fullscreen\t\tRun in fullscreen mode\n"
 		"  --use-pixman\t\tUse the pixman (CPU) renderer (deprecated alias for --renderer=pixman)\n"
 		"  --output-count=COUNT\tCreate multiple outputs\n"
-		"  --no-input\t\tDont create input devices\n\n");
+		"  --no-input\t\tDont create input devices\n"
+		"  --present\t\tPresent through the X Present and DRI3 extensions\n\n");
 #endif
 
 	exit(error_code);
@@ -1062,6 +1356,144 @@ load_modules(struct weston_compositor *ec, const char *modules,
 	return 0;
 }
 
+static void
+wet_startup_profile_init(struct wet_compositor *wet, bool enabled)
+{
+	wet->startup.enabled = enabled;
+	clock_gettime(CLOCK_MONOTONIC, &wet->startup.start);
+	wet->startup.last = wet->startup.start;
+}
+
+/** Log how long the start-up phase that just ended took
+ *
+ * Only logs when the start-up profile is enabled. Phases are named after
+ * the work done since the previous mark.
+ */
+static void
+wet_startup_mark(struct wet_compositor *wet, const char *phase)
+{
+	struct timespec now;
+
+	if (!wet->startup.enabled)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	weston_log("startup: %-22s %6.1f ms (total %6.1f ms)\n", phase,
+		   timespec_sub_to_nsec(&now, &wet->startup.last) / 1e6,
+		   timespec_sub_to_nsec(&now, &wet->startup.start) / 1e6);
+	wet->startup.last = now;
+}
+
+static void
+deferred_modules_idle(void *data)
+{
+	struct wet_compositor *wet = data;
+	static char prog[] = "weston";
+	char *argv[] = { prog, NULL };
+	int argc = 1;
+
+	wet->deferred_modules_idle = NULL;
+
+	if (load_modules(wet->compositor, wet->deferred_modules,
+			 &argc, argv) < 0)
+		weston_log("Failed to load deferred modules '%s'\n",
+			   wet->deferred_modules);
+
+	wet_startup_mark(wet, "deferred modules");
+}
+
+static void
+wet_schedule_deferred_modules(struct wet_compositor *wet)
+{
+	struct wl_event_loop *loop;
+
+	if (!wet->deferred_modules || wet->deferred_modules[0] == '\0' ||
+	    wet->deferred_modules_idle)
+		return;
+
+	loop = wl_display_get_event_loop(wet->compositor->wl_display);
+	wet->deferred_modules_idle =
+		wl_event_loop_add_idle(loop, deferred_modules_idle, wet);
+}
+
+static void
+first_frame_watch_destroy(struct wet_first_frame_watch *watch)
+{
+	wl_list_remove(&watch->frame_listener.link);
+	wl_list_remove(&watch->output_destroy_listener.link);
+	wl_list_remove(&watch->link);
+	free(watch);
+}
+
+static void
+wet_stop_first_frame_watch(struct wet_compositor *wet)
+{
+	struct wet_first_frame_watch *watch, *tmp;
+
+	wl_list_for_each_safe(watch, tmp, &wet->first_frame_watch_list, link)
+		first_frame_watch_destroy(watch);
+}
+
+static void
+first_frame_output_destroy_handler(struct wl_listener *listener, void *data)
+{
+	struct wet_first_frame_watch *watch =
+		container_of(listener, struct wet_first_frame_watch,
+			     output_destroy_listener);
+	struct wet_compositor *wet = watch->wet;
+
+	first_frame_watch_destroy(watch);
+
+	/* Don't hold deferred modules back on an output that is gone. */
+	if (wl_list_empty(&wet->first_frame_watch_list))
+		wet_schedule_deferred_modules(wet);
+}
+
+static void
+first_frame_handler(struct wl_listener *listener, void *data)
+{
+	struct wet_first_frame_watch *watch =
+		container_of(listener, struct wet_first_frame_watch,
+			     frame_listener);
+	struct wet_compositor *wet = watch->wet;
+
+	wet_stop_first_frame_watch(wet);
+	wet_startup_mark(wet, "first frame");
+	wet_schedule_deferred_modules(wet);
+}
+
+/** Report the first rendered frame and load deferred modules after it
+ *
+ * Watches the frame signal of every enabled output; the first one to
+ * fire ends the start-up. With no output enabled, deferred modules are
+ * loaded right away.
+ */
+static void
+wet_watch_first_frame(struct wet_compositor *wet)
+{
+	struct weston_output *output;
+	struct wet_first_frame_watch *watch;
+
+	if (!wet->startup.enabled &&
+	    (!wet->deferred_modules || wet->deferred_modules[0] == '\0'))
+		return;
+
+	wl_list_for_each(output, &wet->compositor->output_list, link) {
+		watch = xzalloc(sizeof *watch);
+		watch->wet = wet;
+		watch->frame_listener.notify = first_frame_handler;
+		wl_signal_add(&output->frame_signal, &watch->frame_listener);
+		watch->output_destroy_listener.notify =
+			first_frame_output_destroy_handler;
+		wl_signal_add(&output->destroy_signal,
+			      &watch->output_destroy_listener);
+		wl_list_insert(&wet->first_frame_watch_list, &watch->link);
+	}
+
+	if (wl_list_empty(&wet->first_frame_watch_list))
+		wet_schedule_deferred_modules(wet);
+}
+
 static void
 load_additional_modules(struct wet_compositor wet)
 {
@@ -1160,6 +1592,8 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
 	int repaint_msec;
+	int occluded_frame_rate;
+	char *shadow_format;
 	bool color_management;
 	bool cal;
 
@@ -1200,6 +1634,88 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	weston_log("Output repaint window is %d ms maximum.\n",
 		   ec->repaint_msec);
 
+	weston_config_section_get_bool(s, "repaint-window-adaptive",
+				       &ec->repaint_window_adaptive, false);
+	if (ec->repaint_window_adaptive)
+		weston_log("Output repaint window adapts to render times.\n");
+
+	weston_config_section_get_int(s, "repaint-stagger",
+				      &ec->repaint_stagger_msec, 0);
+	if (ec->repaint_stagger_msec < 0 || ec->repaint_stagger_msec > 100) {
+		weston_log("Invalid repaint-stagger value in config: %d\n",
+			   ec->repaint_stagger_msec);
+		ec->repaint_stagger_msec = 0;
+	} else if (ec->repaint_stagger_msec) {
+		weston_log("Output repaints due together are staggered by "
+			   "%d ms.\n", ec->repaint_stagger_msec);
+	}
+
+	weston_config_section_get_uint(s, "client-request-budget",
+				       &ec->client_request_budget, 0);
+	if (ec->client_request_budget)
+		weston_log("Repaints and page flips preempt clients after "
+			   "%u requests.\n", ec->client_request_budget);
+
+	weston_config_section_get_string(s, "gl-program-cache",
+					 &ec->gl_program_cache_dir, NULL);
+	weston_config_section_get_bool(s, "gl-shm-atlas",
+				       &ec->gl_shm_atlas, false);
+	weston_config_section_get_int(s, "gl-memory-budget",
+				      &ec->gl_memory_budget_mb, 0);
+	if (ec->gl_memory_budget_mb < 0)
+		ec->gl_memory_budget_mb = 0;
+	weston_config_section_get_string(s, "gl-shadow-format",
+					 &shadow_format, "fp16");
+	if (strcmp(shadow_format, "rgb10a2") == 0) {
+		ec->gl_shadow_format = WESTON_GL_SHADOW_FORMAT_RGB10A2;
+	} else {
+		if (strcmp(shadow_format, "fp16") != 0)
+			weston_log("warning: no such gl-shadow-format: %s, "
+				   "using fp16\n", shadow_format);
+		ec->gl_shadow_format = WESTON_GL_SHADOW_FORMAT_FP16;
+	}
+	free(shadow_format);
+	weston_config_section_get_string(s, "color-lut-cache",
+					 &ec->color_lut_cache_dir, NULL);
+
+	weston_config_section_get_int(s, "damage-max-rects",
+				      &ec->damage_max_rects, 0);
+	weston_config_section_get_double(s, "damage-max-overdraw",
+					 &ec->damage_max_overdraw, 2.0);
+	if (ec->damage_max_rects > 0)
+		weston_log("Output damage is merged past %d rectangles, "
+			   "up to %.1fx overdraw.\n", ec->damage_max_rects,
+			   MAX(ec->damage_max_overdraw, 1.0));
+	weston_config_section_get_int(s, "client-damage-max-rects",
+				      &ec->client_damage_max_rects, 0);
+	weston_config_section_get_double(s, "client-damage-max-overdraw",
+					 &ec->client_damage_max_overdraw, 2.0);
+	if (ec->client_damage_max_rects > 0)
+		weston_log("Client damage is merged past %d rectangles, "
+			   "up to %.1fx overdraw.\n",
+			   ec->client_damage_max_rects,
+			   MAX(ec->client_damage_max_overdraw, 1.0));
+
+	weston_config_section_get_int(s, "occluded-frame-rate",
+				      &occluded_frame_rate, 0);
+	if (occluded_frame_rate > 0) {
+		ec->occluded_frame_interval_msec =
+			DIV_ROUND_UP(1000, occluded_frame_rate);
+		weston_log("Hidden surfaces get frame callbacks at %d Hz "
+			   "at most.\n", occluded_frame_rate);
+	}
+
+	weston_config_section_get_bool(s, "low-latency-fullscreen",
+				       &ec->low_latency_fullscreen, false);
+	if (ec->low_latency_fullscreen)
+		weston_log("Fullscreen clients are presented with async page "
+			   "flips where supported.\n");
+
+	weston_config_section_get_int(s, "pixman-repaint-threads",
+				      &ec->pixman_repaint_threads, 0);
+	weston_config_section_get_bool(s, "pixman-direct-copy",
+				       &ec->pixman_direct_copy, false);
+
 	weston_config_section_get_bool(s, "color-management",
 				       &color_management, false);
 	if (color_management) {
@@ -1321,14 +1837,23 @@ wet_output_set_scale(struct weston_output *output,
 		     int32_t default_scale,
 		     int32_t parsed_scale)
 {
-	int32_t scale = default_scale;
+	double scale;
 
-	weston_config_section_get_int(section, "scale", &scale, default_scale);
+	/* Fractional scales are kept in 120ths, like wp_fractional_scale_v1
+	 * counts them. */
+	weston_config_section_get_double(section, "scale", &scale,
+					 default_scale);
 
 	if (parsed_scale)
 		scale = parsed_scale;
 
-	weston_output_set_scale(output, scale);
+	if (scale * 120 < 1.0) {
+		weston_log("Invalid scale %f for output %s, using %d.\n",
+			   scale, output->name, default_scale);
+		scale = default_scale;
+	}
+
+	weston_output_set_fractional_scale(output, scale * 120 + 0.5);
 }
 
 /* UINT32_MAX is treated as invalid because 0 is a valid
@@ -1685,6 +2210,17 @@ allow_content_protection(struct weston_output *output,
 	weston_output_allow_protection(output, allow_hdcp);
 }
 
+static void
+wet_output_set_frame_callback_offset(struct weston_output *output,
+				     struct weston_config_section *section)
+{
+	int offset_msec;
+
+	weston_config_section_get_int(section, "frame-callback-offset",
+				      &offset_msec, 0);
+	weston_output_set_frame_callback_offset(output, offset_msec);
+}
+
 static int
 wet_config_find_output_mirror(struct weston_output *output,
 				 struct wet_compositor *wet,
@@ -1871,6 +2407,7 @@ wet_configure_windowed_output_from_config(struct weston_output *output,
 			  parsed_options);
 
 	allow_content_protection(output, section);
+	wet_output_set_frame_callback_offset(output, section);
 
 	wet_output_set_scale(output, section, defaults->scale, parsed_options->scale);
 	if (wet_output_set_transform(output, section, defaults->transform,
@@ -2344,6 +2881,9 @@ drm_backend_output_configure(struct weston_output *output,
 	char *modeline = NULL;
 	char *gbm_format = NULL;
 	char *content_type = NULL;
+	char *vrr_mode = NULL;
+	bool color_offload;
+	uint32_t idle_refresh_timeout;
 	char *seat = NULL;
 
 	api = weston_drm_output_get_api(output->compositor);
@@ -2407,12 +2947,29 @@ drm_backend_output_configure(struct weston_output *output,
 		return -1;
 	free(content_type);
 
+	weston_config_section_get_string(section,
+					 "vrr-mode", &vrr_mode, NULL);
+	if (api->set_vrr_mode(output, vrr_mode) < 0) {
+		free(vrr_mode);
+		return -1;
+	}
+	free(vrr_mode);
+
+	weston_config_section_get_bool(section, "color-offload",
+				       &color_offload, false);
+	api->set_color_offload(output, color_offload);
+
+	weston_config_section_get_uint(section, "idle-refresh-timeout",
+				       &idle_refresh_timeout, 0);
+	api->set_idle_refresh_timeout(output, idle_refresh_timeout);
+
 	weston_config_section_get_string(section, "seat", &seat, "");
 
 	api->set_seat(output, seat);
 	free(seat);
 
 	allow_content_protection(output, section);
+	wet_output_set_frame_callback_offset(output, section);
 
 	if (wet_output_set_eotf_mode(output, section, wet->use_color_manager) < 0)
 		return -1;
@@ -3052,6 +3609,7 @@ drm_backend_remoted_output_configure(struct weston_output *output,
 	char *seat = NULL;
 	char *host = NULL;
 	char *pipeline = NULL;
+	bool dmabuf, adaptive;
 	int port, ret;
 
 	ret = api->set_mode(output, modeline);
@@ -3082,6 +3640,13 @@ drm_backend_remoted_output_configure(struct weston_output *output,
 	api->set_seat(output, seat);
 	free(seat);
 
+	weston_config_section_get_bool(section, "gst-dmabuf", &dmabuf, false);
+	api->set_dmabuf(output, dmabuf);
+
+	weston_config_section_get_bool(section, "adaptive-quality", &adaptive,
+				       false);
+	api->set_adaptive_quality(output, adaptive);
+
 	weston_config_section_get_string(section, "gst-pipeline", &pipeline,
 					 NULL);
 	if (pipeline) {
@@ -3419,6 +3984,33 @@ load_drm_backend(struct weston_compositor *c, int *argc, char **argv,
 	                               &config.pageflip_timeout, 0);
 	weston_config_section_get_bool(section, "pixman-shadow",
 				       &config.use_pixman_shadow, true);
+	weston_config_section_get_bool(section, "independent-device-commits",
+				       &config.independent_device_commits,
+				       false);
+	weston_config_section_get_bool(section, "shm-scanout",
+				       &config.shm_scanout, false);
+	weston_config_section_get_bool(section, "fastboot",
+				       &config.fastboot, false);
+	weston_config_section_get_bool(section, "kms-thread",
+				       &config.kms_thread, false);
+	weston_config_section_get_bool(section, "vblank-sequence",
+				       &config.vblank_sequence, false);
+	weston_config_section_get_bool(section, "plane-color-pipeline",
+				       &config.plane_color_pipeline, false);
+	weston_config_section_get_string(section, "output-cache",
+					 &config.output_cache, NULL);
+	weston_config_section_get_bool(section, "dpms-off-release-buffers",
+				       &config.dpms_off_release_buffers, false);
+
+	section = weston_config_get_section(wc, "libinput", NULL, NULL);
+	weston_config_section_get_bool(section, "coalesce-motion",
+				       &config.coalesce_pointer_motion, false);
+	weston_config_section_get_bool(section, "frame-resample",
+				       &config.resample_touch_tablet, false);
+	weston_config_section_get_bool(section, "input-thread",
+				       &config.input_thread, false);
+	weston_config_section_get_bool(section, "async-devices",
+				       &config.async_input_devices, false);
 	if (without_input)
 		c->require_input = !without_input;
 
@@ -3439,6 +4031,7 @@ load_drm_backend(struct weston_compositor *c, int *argc, char **argv,
 
 	free(config.gbm_format);
 	free(config.seat_id);
+	free(config.output_cache);
 	free(config.specific_device);
 
 	return 0;
@@ -3456,6 +4049,8 @@ headless_backend_output_configure(struct weston_output *output)
 	struct wet_compositor *wet = to_wet_compositor(output->compositor);
 	struct weston_config *wc = wet->config;
 	struct weston_config_section *section;
+	const struct weston_headless_output_api *api;
+	int32_t refresh;
 
 	section = weston_config_get_section(wc, "output", "name", output->name);
 	if (wet_output_set_eotf_mode(output, section, wet->use_color_manager) < 0)
@@ -3466,8 +4061,22 @@ headless_backend_output_configure(struct weston_output *output)
 	if (wet_output_set_color_characteristics(output, wc, section) < 0)
 		return -1;
 
-	return wet_configure_windowed_output_from_config(output, &defaults,
-							 WESTON_WINDOWED_OUTPUT_HEADLESS);
+	if (wet_configure_windowed_output_from_config(output, &defaults,
+						      WESTON_WINDOWED_OUTPUT_HEADLESS) < 0)
+		return -1;
+
+	weston_config_section_get_int(section, "refresh-rate", &refresh, 0);
+	if (refresh == 0)
+		return 0;
+
+	api = weston_headless_output_get_api(output->compositor);
+	if (!api || api->output_set_refresh(output, refresh) < 0) {
+		weston_log("Cannot set refresh rate of output \"%s\".\n",
+			   output->name);
+		return -1;
+	}
+
+	return 0;
 }
 
 static int
@@ -3505,6 +4114,9 @@ load_headless_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_STRING, "transform", 0, &transform },
 		{ WESTON_OPTION_BOOLEAN, "no-outputs", 0, &no_outputs },
 		{ WESTON_OPTION_INTEGER, "refresh-rate", 0, &config.refresh },
+		{ WESTON_OPTION_BOOLEAN, "vblank", 0, &config.vblank },
+		{ WESTON_OPTION_INTEGER, "vblank-jitter", 0, &config.vblank_jitter },
+		{ WESTON_OPTION_BOOLEAN, "use-dmabuf", 0, &config.use_dmabuf },
 	};
 	config.refresh = -1;
 
@@ -3556,6 +4168,31 @@ load_headless_backend(struct weston_compositor *c,
 	return 0;
 }
 
+static int
+pipewire_output_add_scaled_streams(struct weston_output *output,
+				   const struct weston_pipewire_output_api *api,
+				   const char *sizes)
+{
+	const char *p = sizes;
+	int width, height, len;
+
+	while (*p) {
+		if (sscanf(p, "%dx%d%n", &width, &height, &len) != 2 ||
+		    (p[len] != ',' && p[len] != '\0') ||
+		    api->output_add_scaled_stream(output, width, height) < 0) {
+			weston_log("Invalid scaled-streams \"%s\" for output %s\n",
+				   sizes, output->name);
+			return -1;
+		}
+
+		p += len;
+		if (*p == ',')
+			p++;
+	}
+
+	return 0;
+}
+
 static int
 pipewire_backend_output_configure(struct weston_output *output)
 {
@@ -3569,8 +4206,10 @@ pipewire_backend_output_configure(struct weston_output *output)
 	struct weston_config *wc = wet_get_config(output->compositor);
 	struct weston_config_section *section;
 	char *gbm_format = NULL;
+	char *scaled_streams = NULL;
 	int width;
 	int height;
+	int ret = 0;
 
 	assert(parsed_options);
 
@@ -3597,6 +4236,16 @@ pipewire_backend_output_configure(struct weston_output *output)
 			   output->name);
 		return -1;
 	}
+
+	weston_config_section_get_string(section, "scaled-streams",
+					 &scaled_streams, NULL);
+	if (scaled_streams)
+		ret = pipewire_output_add_scaled_streams(output, api,
+							 scaled_streams);
+	free(scaled_streams);
+	if (ret < 0)
+		return -1;
+
 	weston_log("pipewire_backend_output_configure.. Done\n");
 
 	return 0;
@@ -3640,10 +4289,15 @@ load_pipewire_backend(struct weston_compositor *c,
 	section = weston_config_get_section(wc, "pipewire", NULL, NULL);
 	weston_config_section_get_int(section, "num-outputs",
 				      &config.num_outputs, 1);
+	weston_config_section_get_bool(section, "vaapi-encode",
+				       &config.vaapi_encode, false);
+	weston_config_section_get_string(section, "vaapi-device",
+					 &config.vaapi_device, NULL);
 
 	wb = wet_compositor_load_backend(c, WESTON_BACKEND_PIPEWIRE,
 					 &config.base, simple_heads_changed,
 					 pipewire_backend_output_configure);
+	free(config.vaapi_device);
 	if (!wb)
 		return -1;
 
@@ -3668,6 +4322,7 @@ weston_rdp_backend_config_init(struct weston_rdp_backend_config *config)
 	config->force_no_compression = 0;
 	config->remotefx_codec = true;
 	config->refresh_rate = RDP_DEFAULT_FREQ;
+	config->gfx = false;
 }
 
 static int
@@ -3761,6 +4416,7 @@ load_rdp_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_INTEGER, "scale", 0, &parsed_options->scale },
 		{ WESTON_OPTION_BOOLEAN, "force-no-compression", 0, &config.force_no_compression },
 		{ WESTON_OPTION_BOOLEAN, "no-remotefx-codec", 0, &no_remotefx_codec },
+		{ WESTON_OPTION_BOOLEAN, "gfx", 0, &config.gfx },
 	};
 
 	parse_options(rdp_options, ARRAY_LENGTH(rdp_options), argc, argv);
@@ -3853,6 +4509,8 @@ weston_vnc_backend_config_init(struct weston_vnc_backend_config *config)
 	config->bind_address = NULL;
 	config->port = 5900;
 	config->refresh_rate = VNC_DEFAULT_FREQ;
+	config->vaapi_encode = false;
+	config->vaapi_device = NULL;
 }
 
 static int
@@ -3893,6 +4551,10 @@ load_vnc_backend(struct weston_compositor *c,
 					 config.server_cert);
 	weston_config_section_get_string(section, "tls-key",
 					 &config.server_key, config.server_key);
+	weston_config_section_get_bool(section, "vaapi-encode",
+				       &config.vaapi_encode, false);
+	weston_config_section_get_string(section, "vaapi-device",
+					 &config.vaapi_device, NULL);
 
 	wb = wet_compositor_load_backend(c, WESTON_BACKEND_VNC, &config.base,
 					 simple_heads_changed,
@@ -3901,6 +4563,7 @@ load_vnc_backend(struct weston_compositor *c,
 	free(config.bind_address);
 	free(config.server_cert);
 	free(config.server_key);
+	free(config.vaapi_device);
 
 	if (!wb)
 		return -1;
@@ -3954,6 +4617,7 @@ load_x11_backend(struct weston_compositor *c,
 	       { WESTON_OPTION_INTEGER, "output-count", 0, &option_count },
 	       { WESTON_OPTION_BOOLEAN, "no-input", 0, &config.no_input },
 	       { WESTON_OPTION_BOOLEAN, "use-pixman", 0, &force_pixman },
+	       { WESTON_OPTION_BOOLEAN, "present", 0, &config.present },
 	};
 
 	parse_options(options, ARRAY_LENGTH(options), argc, argv);
@@ -4078,6 +4742,7 @@ load_wayland_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_INTEGER, "output-count", 0, &count },
 		{ WESTON_OPTION_BOOLEAN, "fullscreen", 0, &config.fullscreen },
 		{ WESTON_OPTION_BOOLEAN, "sprawl", 0, &config.sprawl },
+		{ WESTON_OPTION_BOOLEAN, "passthrough", 0, &config.passthrough },
 	};
 
 	parse_options(wayland_options, ARRAY_LENGTH(wayland_options), argc, argv);
@@ -4429,6 +5094,8 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	char *log = NULL;
 	char *log_scopes = NULL;
 	char *flight_rec_scopes = NULL;
+	char *timeline_file = NULL;
+	char *protocol_file = NULL;
 	char *server_socket = NULL;
 	char *require_outputs = NULL;
 	int32_t idle_time = -1;
@@ -4437,6 +5104,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	int32_t version = 0;
 	int32_t noconfig = 0;
 	int32_t debug_protocol = 0;
+	bool startup_profile = false;
 	bool numlock_on;
 	char *config_file = NULL;
 	struct weston_config *config = NULL;
@@ -4448,12 +5116,17 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	struct weston_log_context *log_ctx = NULL;
 	struct weston_log_subscriber *logger = NULL;
 	struct weston_log_subscriber *flight_rec = NULL;
+	struct weston_log_subscriber *timeline_ring = NULL;
+	struct weston_log_subscriber *trace_marker = NULL;
+	struct weston_log_subscriber *protocol_ring = NULL;
 	struct wet_process *process, *process_tmp;
 	void *wet_xwl = NULL;
 	sigset_t mask;
 	struct sigaction action;
 
 	bool wait_for_debugger = false;
+	bool async_log = false;
+	bool trace_marker_enabled = false;
 	struct wl_protocol_logger *protologger = NULL;
 
 	const struct weston_option core_options[] = {
@@ -4468,18 +5141,24 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 #endif
 		{ WESTON_OPTION_STRING, "modules", 0, &option_modules },
 		{ WESTON_OPTION_STRING, "log", 0, &log },
+		{ WESTON_OPTION_BOOLEAN, "async-log", 0, &async_log },
 		{ WESTON_OPTION_BOOLEAN, "help", 'h', &help },
 		{ WESTON_OPTION_BOOLEAN, "version", 0, &version },
 		{ WESTON_OPTION_BOOLEAN, "no-config", 0, &noconfig },
 		{ WESTON_OPTION_STRING, "config", 'c', &config_file },
 		{ WESTON_OPTION_BOOLEAN, "wait-for-debugger", 0, &wait_for_debugger },
 		{ WESTON_OPTION_BOOLEAN, "debug", 0, &debug_protocol },
+		{ WESTON_OPTION_BOOLEAN, "startup-profile", 0, &startup_profile },
 		{ WESTON_OPTION_STRING, "logger-scopes", 'l', &log_scopes },
 		{ WESTON_OPTION_STRING, "flight-rec-scopes", 'f', &flight_rec_scopes },
+		{ WESTON_OPTION_STRING, "timeline-file", 0, &timeline_file },
+		{ WESTON_OPTION_BOOLEAN, "trace-marker", 0, &trace_marker_enabled },
+		{ WESTON_OPTION_STRING, "protocol-file", 0, &protocol_file },
 	};
 
 	wl_list_init(&wet.layoutput_list);
 	wl_list_init(&wet.backend_list);
+	wl_list_init(&wet.first_frame_watch_list);
 
 	os_fd_set_cloexec(fileno(stdin));
 
@@ -4512,7 +5191,11 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 
 	weston_log_set_handler(vlog, vlog_continue);
 
-	logger = weston_log_subscriber_create_log(weston_logfile);
+	if (async_log)
+		logger = weston_log_subscriber_create_log_async(weston_logfile,
+								DEFAULT_ASYNC_LOG_SIZE);
+	if (!logger)
+		logger = weston_log_subscriber_create_log(weston_logfile);
 
 	if (!flight_rec_scopes)
 		flight_rec_scopes = DEFAULT_FLIGHT_REC_SCOPES;
@@ -4523,6 +5206,26 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	weston_log_subscribe_to_scopes(log_ctx, logger, flight_rec,
 				       log_scopes, flight_rec_scopes);
 
+	if (timeline_file) {
+		timeline_ring = weston_log_subscriber_create_mmap(timeline_file,
+								  DEFAULT_TIMELINE_FILE_SIZE);
+		if (timeline_ring)
+			weston_log_subscribe(log_ctx, timeline_ring, "timeline");
+	}
+
+	if (trace_marker_enabled) {
+		trace_marker = weston_log_subscriber_create_trace_marker();
+		if (trace_marker)
+			weston_log_subscribe(log_ctx, trace_marker, "timeline");
+	}
+
+	if (protocol_file) {
+		protocol_ring = weston_log_subscriber_create_mmap(protocol_file,
+								  DEFAULT_PROTOCOL_FILE_SIZE);
+		if (protocol_ring)
+			weston_log_subscribe(log_ctx, protocol_ring, "proto");
+	}
+
 	weston_log("%s\n"
 		   STAMP_SPACE "%s\n"
 		   STAMP_SPACE "Bug reports to: %s\n"
@@ -4617,6 +5320,11 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		goto out;
 	}
 
+	if (!startup_profile)
+		weston_config_section_get_bool(section, "startup-profile",
+					       &startup_profile, false);
+	wet_startup_profile_init(&wet, startup_profile);
+
 	protocol_scope =
 		weston_log_ctx_add_log_scope(log_ctx, "proto",
 					     "Wayland protocol dump for all clients.\n",
@@ -4652,6 +5360,14 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		free(require_outputs);
 	}
 
+	weston_config_section_get_bool(section, "early-buffer-release",
+				       &wet.compositor->early_buffer_release,
+				       false);
+
+	weston_config_section_get_bool(section, "skip-late-buffers",
+				       &wet.compositor->skip_late_buffers,
+				       false);
+
 	wet.compositor->multi_backend = backends && strchr(backends, ',');
 	if (load_backends(wet.compositor, backends, &argc, argv, config,
 			  renderer) < 0) {
@@ -4662,6 +5378,8 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	if (weston_compositor_backends_loaded(wet.compositor) < 0)
 		goto out;
 
+	wet_startup_mark(&wet, "backends");
+
 	wet_handle_mirror_outputs(&wet);
 
 	if (test_data && !check_compositor_capabilities(wet.compositor,
@@ -4674,6 +5392,8 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	if (wet.init_failed)
 		goto out;
 
+	wet_startup_mark(&wet, "outputs");
+
 	if (idle_time < 0)
 		weston_config_section_get_int(section, "idle-time", &idle_time, -1);
 	if (idle_time < 0)
@@ -4716,6 +5436,8 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	if (wet_load_shell(wet.compositor, shell, &argc, argv) < 0)
 		goto out;
 
+	wet_startup_mark(&wet, "shell");
+
 	/* Load xwayland before other modules - this way if we're using
 	 * the systemd-notify module it will notify after we're ready
 	 * to receive xwayland connections.
@@ -4728,6 +5450,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		wet_xwl = wet_load_xwayland(wet.compositor);
 		if (!wet_xwl)
 			goto out;
+		wet_startup_mark(&wet, "xwayland");
 	}
 
 	weston_config_section_get_string(section, "modules", &modules, "");
@@ -4739,6 +5462,12 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 
 	load_additional_modules(wet);
 
+	/* Modules not needed for the first frame can wait until after it. */
+	weston_config_section_get_string(section, "deferred-modules",
+					 &wet.deferred_modules, NULL);
+
+	wet_startup_mark(&wet, "modules");
+
 	section = weston_config_get_section(config, "keyboard", NULL, NULL);
 	weston_config_section_get_bool(section, "numlock-on", &numlock_on, false);
 	if (numlock_on) {
@@ -4767,6 +5496,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	}
 
 	weston_compositor_wake(wet.compositor);
+	wet_watch_first_frame(&wet);
 
 	if (argc > 1) {
 		if (execute_command(&wet, argc, argv) < 0)
@@ -4776,6 +5506,8 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 			goto out;
 	}
 
+	wet_startup_mark(&wet, "autolaunch");
+
 	wl_display_run(display);
 
 	/* Allow for setting return exit code after
@@ -4789,6 +5521,11 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 out:
 	wet_compositor_destroy_backend_callbacks(&wet);
 
+	wet_stop_first_frame_watch(&wet);
+	if (wet.deferred_modules_idle)
+		wl_event_source_remove(wet.deferred_modules_idle);
+	free(wet.deferred_modules);
+
 	/* free(NULL) is valid, and it won't be NULL if it's used */
 	free(wet.parsed_options);
 
@@ -4804,6 +5541,8 @@ out:
 	wet_compositor_destroy_layout(&wet);
 	weston_log_scope_destroy(protocol_scope);
 	protocol_scope = NULL;
+	wl_array_release(&protocol_interfaces);
+	wl_array_init(&protocol_interfaces);
 
 	wl_list_for_each_safe(process, process_tmp, &wet.child_process_list, link)
 		wet_process_destroy(process, 0, false);
@@ -4821,6 +5560,12 @@ out_display:
 	weston_log_subscriber_destroy(logger);
 	if (flight_rec)
 		weston_log_subscriber_destroy(flight_rec);
+	if (timeline_ring)
+		weston_log_subscriber_destroy(timeline_ring);
+	if (trace_marker)
+		weston_log_subscriber_destroy(trace_marker);
+	if (protocol_ring)
+		weston_log_subscriber_destroy(protocol_ring);
 	weston_log_ctx_destroy(log_ctx);
 	weston_log_file_close();
 
@@ -4834,6 +5579,8 @@ out_display:
 	free(option_modules);
 	free(log);
 	free(log_scopes);
+	free(timeline_file);
+	free(protocol_file);
 	free(modules);
 
 	return ret;
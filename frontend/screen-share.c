@@ -43,13 +43,16 @@
 #include <libweston/libweston.h>
 #include "backend.h"
 #include "libweston-internal.h"
+#include "linux-dmabuf.h"
 #include "pixel-formats.h"
 #include "weston.h"
 #include "shared/helpers.h"
 #include "shared/os-compatibility.h"
 #include "shared/timespec-util.h"
+#include "shared/weston-drm-fourcc.h"
 #include <libweston/shell-utils.h>
 #include "fullscreen-shell-unstable-v1-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
 
 struct shared_output {
 	struct weston_output *output;
@@ -63,6 +66,8 @@ struct shared_output {
 		struct wl_compositor *compositor;
 		struct wl_shm *shm;
 		bool shm_formats_has_xrgb;
+		struct zwp_linux_dmabuf_v1 *dmabuf;
+		bool dmabuf_has_xrgb_linear;
 		struct zwp_fullscreen_shell_v1 *fshell;
 		struct wl_output *output;
 		struct wl_surface *surface;
@@ -82,8 +87,42 @@ struct shared_output {
 
 	int cache_dirty;
 	pixman_image_t *cache_image;
-	uint32_t *tmp_data;
-	size_t tmp_data_size;
+	struct wl_list pending_reads;	/** ss_read::link */
+
+	/* GPU copies of the output's frames, handed to the parent as
+	 * dmabufs instead of going through cache_image and shm. */
+	struct {
+		int32_t width, height;
+
+		struct wl_list buffers;		/** ss_dmabuf_buffer::link */
+		struct wl_list free_buffers;	/** ss_dmabuf_buffer::free_link */
+		struct ss_dmabuf_buffer *ready;	/** copied, not yet committed */
+		pixman_region32_t commit_damage;
+		struct wl_event_source *commit_idle;
+		bool active;
+		bool missed;
+		bool failed;
+	} dmabuf;
+};
+
+struct ss_dmabuf_buffer {
+	struct shared_output *output;	/** NULL once orphaned */
+	struct wl_list link;
+	struct wl_list free_link;
+
+	struct wl_buffer *buffer;
+	struct weston_renderbuffer *renderbuffer;
+	/* What this buffer misses, in output pixel coordinates */
+	pixman_region32_t damage;
+};
+
+/** A damaged rectangle being read back into the cache image */
+struct ss_read {
+	struct shared_output *output;	/** NULL once the output is gone */
+	struct wl_list link;
+	int32_t x, y, width, height;
+	bool do_yflip;
+	bool last;
 };
 
 struct ss_seat {
@@ -579,42 +618,6 @@ output_compute_transform(struct weston_output *output,
 static void
 shared_output_destroy(struct shared_output *so);
 
-static int
-shared_output_ensure_tmp_data(struct shared_output *so,
-			      pixman_region32_t *region)
-{
-	pixman_box32_t *ext;
-	size_t size;
-
-	if (!pixman_region32_not_empty(region))
-		return 0;
-
-	ext = pixman_region32_extents(region);
-
-	/* Damage is in output coordinates.
-	 *
-	 * We are multiplying by 4 because the temporary data needs to be able
-	 * to store an 32 bit-per-pixel buffer.
-	 */
-	size = 4 * (ext->x2 - ext->x1) * (ext->y2 - ext->y1)
-		 * so->output->current_scale * so->output->current_scale;
-
-	if (so->tmp_data != NULL && size <= so->tmp_data_size)
-		return 0;
-
-	free(so->tmp_data);
-	so->tmp_data = malloc(size);
-	if (so->tmp_data == NULL) {
-		so->tmp_data_size = 0;
-		errno = ENOMEM;
-		return -1;
-	}
-
-	so->tmp_data_size = size;
-
-	return 0;
-}
-
 static void
 shared_output_update(struct shared_output *so);
 
@@ -629,6 +632,15 @@ shared_output_frame_callback(void *data, struct wl_callback *cb, uint32_t time)
 	wl_callback_destroy(cb);
 	so->parent.frame_cb = NULL;
 
+	if (so->dmabuf.active) {
+		shared_output_commit_dmabuf(so);
+		if (so->dmabuf.missed) {
+			so->dmabuf.missed = false;
+			weston_output_damage(so->output);
+		}
+		return;
+	}
+
 	shared_output_update(so);
 }
 
@@ -700,6 +712,281 @@ shared_output_update(struct shared_output *so)
 	pixman_region32_init(&sb->damage);
 }
 
+static void
+ss_dmabuf_buffer_destroy(struct ss_dmabuf_buffer *db)
+{
+	wl_buffer_destroy(db->buffer);
+	weston_renderbuffer_unref(db->renderbuffer);
+	pixman_region32_fini(&db->damage);
+
+	wl_list_remove(&db->link);
+	wl_list_remove(&db->free_link);
+	free(db);
+}
+
+/* Take the buffer out of the renderer's hands; a buffer the parent still
+ * uses is destroyed once it is released. */
+static void
+ss_dmabuf_buffer_drop(struct shared_output *so, struct ss_dmabuf_buffer *db,
+		      bool busy)
+{
+	struct weston_renderer *renderer = so->output->compositor->renderer;
+
+	renderer->remove_renderbuffer_dmabuf(so->output, db->renderbuffer);
+
+	if (busy) {
+		db->output = NULL;
+		wl_list_remove(&db->link);
+		wl_list_init(&db->link);
+	} else {
+		ss_dmabuf_buffer_destroy(db);
+	}
+}
+
+static void
+dmabuf_buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct ss_dmabuf_buffer *db = data;
+
+	if (db->output)
+		wl_list_insert(&db->output->dmabuf.free_buffers,
+			       &db->free_link);
+	else
+		ss_dmabuf_buffer_destroy(db);
+}
+
+static const struct wl_buffer_listener dmabuf_buffer_listener = {
+	dmabuf_buffer_release
+};
+
+static void
+shared_output_drop_dmabufs(struct shared_output *so, bool destroy_busy)
+{
+	struct ss_dmabuf_buffer *db, *next;
+
+	wl_list_for_each_safe(db, next, &so->dmabuf.free_buffers, free_link)
+		ss_dmabuf_buffer_drop(so, db, false);
+
+	/* The one waiting for commit is neither free nor with the parent */
+	if (so->dmabuf.ready) {
+		ss_dmabuf_buffer_drop(so, so->dmabuf.ready, false);
+		so->dmabuf.ready = NULL;
+	}
+
+	wl_list_for_each_safe(db, next, &so->dmabuf.buffers, link)
+		ss_dmabuf_buffer_drop(so, db, !destroy_busy);
+}
+
+static struct ss_dmabuf_buffer *
+shared_output_get_dmabuf(struct shared_output *so)
+{
+	struct weston_renderer *renderer = so->output->compositor->renderer;
+	const uint64_t modifier = DRM_FORMAT_MOD_LINEAR;
+	struct linux_dmabuf_memory *memory;
+	struct dmabuf_attributes *attributes;
+	struct zwp_linux_buffer_params_v1 *params;
+	struct ss_dmabuf_buffer *db;
+	int i;
+
+	if (!wl_list_empty(&so->dmabuf.free_buffers)) {
+		db = container_of(so->dmabuf.free_buffers.next,
+				  struct ss_dmabuf_buffer, free_link);
+		wl_list_remove(&db->free_link);
+		wl_list_init(&db->free_link);
+
+		return db;
+	}
+
+	memory = renderer->dmabuf_alloc(renderer,
+					so->dmabuf.width, so->dmabuf.height,
+					DRM_FORMAT_XRGB8888, &modifier, 1);
+	if (!memory)
+		return NULL;
+
+	db = zalloc(sizeof *db);
+	if (!db) {
+		memory->destroy(memory);
+		return NULL;
+	}
+
+	/* The renderbuffer owns the memory from here on. */
+	attributes = memory->attributes;
+	db->renderbuffer = renderer->create_renderbuffer_dmabuf(so->output,
+								memory);
+	if (!db->renderbuffer) {
+		memory->destroy(memory);
+		free(db);
+		return NULL;
+	}
+
+	params = zwp_linux_dmabuf_v1_create_params(so->parent.dmabuf);
+	for (i = 0; i < attributes->n_planes; i++)
+		zwp_linux_buffer_params_v1_add(params, attributes->fd[i], i,
+					       attributes->offset[i],
+					       attributes->stride[i],
+					       attributes->modifier >> 32,
+					       attributes->modifier & 0xffffffff);
+	db->buffer = zwp_linux_buffer_params_v1_create_immed(params,
+							     attributes->width,
+							     attributes->height,
+							     attributes->format,
+							     attributes->flags);
+	zwp_linux_buffer_params_v1_destroy(params);
+	wl_buffer_add_listener(db->buffer, &dmabuf_buffer_listener, db);
+
+	db->output = so;
+	wl_list_init(&db->free_link);
+	pixman_region32_init_rect(&db->damage, 0, 0,
+				  so->dmabuf.width, so->dmabuf.height);
+	wl_list_insert(&so->dmabuf.buffers, &db->link);
+
+	return db;
+}
+
+static void
+shared_output_commit_dmabuf(struct shared_output *so)
+{
+	struct ss_dmabuf_buffer *db = so->dmabuf.ready;
+	pixman_box32_t *r;
+	int i, nrects;
+
+	if (!db || so->parent.frame_cb)
+		return;
+
+	r = pixman_region32_rectangles(&so->dmabuf.commit_damage, &nrects);
+	for (i = 0; i < nrects; ++i)
+		wl_surface_damage(so->parent.surface, r[i].x1, r[i].y1,
+				  r[i].x2 - r[i].x1, r[i].y2 - r[i].y1);
+	pixman_region32_clear(&so->dmabuf.commit_damage);
+
+	wl_surface_attach(so->parent.surface, db->buffer, 0, 0);
+
+	so->parent.frame_cb = wl_surface_frame(so->parent.surface);
+	wl_callback_add_listener(so->parent.frame_cb,
+				 &shared_output_frame_listener, so);
+
+	wl_surface_commit(so->parent.surface);
+	wl_display_flush(so->parent.display);
+
+	so->dmabuf.ready = NULL;
+}
+
+static void
+shared_output_commit_idle(void *data)
+{
+	struct shared_output *so = data;
+
+	so->dmabuf.commit_idle = NULL;
+	shared_output_commit_dmabuf(so);
+}
+
+static bool
+shared_output_can_use_dmabuf(struct shared_output *so)
+{
+	struct weston_renderer *renderer = so->output->compositor->renderer;
+
+	/* The parent gets the output's pixels 1:1, so only outputs whose
+	 * pixels already match the global space qualify. */
+	return so->parent.dmabuf && so->parent.dmabuf_has_xrgb_linear &&
+	       !so->dmabuf.failed &&
+	       renderer->dmabuf_alloc &&
+	       renderer->create_renderbuffer_dmabuf &&
+	       renderer->copy_output_to_renderbuffer &&
+	       so->output->current_scale == 1 &&
+	       so->output->transform == WL_OUTPUT_TRANSFORM_NORMAL;
+}
+
+/* Copy the damaged part of the frame into a dmabuf on the GPU. The commit
+ * to the parent is deferred to an idle callback, i.e. after the renderer
+ * has flushed the copy.
+ */
+static void
+shared_output_repainted_dmabuf(struct shared_output *so,
+			       pixman_region32_t *global_damage)
+{
+	struct weston_compositor *compositor = so->output->compositor;
+	struct weston_renderer *renderer = compositor->renderer;
+	struct wl_event_loop *loop;
+	struct ss_dmabuf_buffer *db;
+	pixman_region32_t damage;
+	int32_t width = so->output->current_mode->width;
+	int32_t height = so->output->current_mode->height;
+
+	pixman_region32_init(&damage);
+	if (!so->dmabuf.active ||
+	    so->dmabuf.width != width || so->dmabuf.height != height) {
+		shared_output_drop_dmabufs(so, false);
+		so->dmabuf.width = width;
+		so->dmabuf.height = height;
+		so->dmabuf.active = true;
+		pixman_region32_init_rect(&damage, 0, 0, width, height);
+	} else {
+		weston_region_global_to_output(&damage, so->output,
+					       global_damage);
+	}
+
+	wl_list_for_each(db, &so->dmabuf.buffers, link)
+		pixman_region32_union(&db->damage, &db->damage, &damage);
+	pixman_region32_union(&so->dmabuf.commit_damage,
+			      &so->dmabuf.commit_damage, &damage);
+	pixman_region32_fini(&damage);
+
+	db = so->dmabuf.ready;
+	if (!db)
+		db = shared_output_get_dmabuf(so);
+	if (!db) {
+		/* All buffers are with the parent; catch up on the next
+		 * frame callback. */
+		so->dmabuf.missed = true;
+		return;
+	}
+
+	if (!renderer->copy_output_to_renderbuffer(so->output,
+						   db->renderbuffer,
+						   &db->damage)) {
+		weston_log("Screen share: GPU copy failed, "
+			   "falling back to read back\n");
+		wl_list_insert(&so->dmabuf.free_buffers, &db->free_link);
+		so->dmabuf.ready = NULL;
+		so->dmabuf.failed = true;
+		weston_output_damage(so->output);
+		return;
+	}
+	pixman_region32_clear(&db->damage);
+	so->dmabuf.ready = db;
+
+	if (!so->dmabuf.commit_idle) {
+		loop = wl_display_get_event_loop(compositor->wl_display);
+		so->dmabuf.commit_idle =
+			wl_event_loop_add_idle(loop, shared_output_commit_idle,
+					       so);
+	}
+}
+
+static void
+dmabuf_handle_format(void *data, struct zwp_linux_dmabuf_v1 *dmabuf,
+		     uint32_t format)
+{
+	/* Superseded by the modifier event */
+}
+
+static void
+dmabuf_handle_modifier(void *data, struct zwp_linux_dmabuf_v1 *dmabuf,
+		       uint32_t format, uint32_t modifier_hi,
+		       uint32_t modifier_lo)
+{
+	struct shared_output *so = data;
+	uint64_t modifier = ((uint64_t) modifier_hi << 32) | modifier_lo;
+
+	if (format == DRM_FORMAT_XRGB8888 && modifier == DRM_FORMAT_MOD_LINEAR)
+		so->parent.dmabuf_has_xrgb_linear = true;
+}
+
+static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
+	dmabuf_handle_format,
+	dmabuf_handle_modifier
+};
+
 static void
 shm_handle_format(void *data, struct wl_shm *wl_shm, uint32_t format)
 {
@@ -734,6 +1021,13 @@ registry_handle_global(void *data, struct wl_registry *registry,
 			wl_registry_bind(registry,
 					 id, &wl_shm_interface, 1);
 		wl_shm_add_listener(so->parent.shm, &shm_listener, so);
+	} else if (strcmp(interface, "zwp_linux_dmabuf_v1") == 0 &&
+		   version >= 3) {
+		so->parent.dmabuf =
+			wl_registry_bind(registry,
+					 id, &zwp_linux_dmabuf_v1_interface, 3);
+		zwp_linux_dmabuf_v1_add_listener(so->parent.dmabuf,
+						 &dmabuf_listener, so);
 	} else if (strcmp(interface, "zwp_fullscreen_shell_v1") == 0) {
 		so->parent.fshell =
 			wl_registry_bind(registry,
@@ -819,6 +1113,60 @@ struct zwp_fullscreen_shell_mode_feedback_v1_listener mode_feedback_listener = {
 	mode_feedback_ok,
 };
 
+static void
+shared_output_read_done(void *data, const void *pixels, int stride)
+{
+	struct ss_read *read = data;
+	struct shared_output *so = read->output;
+	pixman_format_code_t pixman_format;
+	pixman_image_t *damaged_image = NULL;
+	pixman_transform_t transform;
+
+	wl_list_remove(&read->link);
+
+	if (!so)
+		goto out;
+
+	pixman_format = so->output->compositor->read_format->pixman_format;
+	if (pixels)
+		damaged_image = pixman_image_create_bits(pixman_format,
+							 read->width,
+							 read->height,
+							 (uint32_t *) pixels,
+							 stride);
+	if (damaged_image) {
+		if (read->do_yflip) {
+			pixman_transform_init_scale(&transform,
+						    pixman_fixed_1,
+						    pixman_fixed_minus_1);
+
+			pixman_transform_translate(&transform, NULL,
+						   0,
+						   pixman_int_to_fixed(read->height));
+
+			pixman_image_set_transform(damaged_image, &transform);
+		}
+
+		pixman_image_composite32(PIXMAN_OP_SRC,
+					 damaged_image,
+					 NULL,
+					 so->cache_image,
+					 0, 0,
+					 0, 0,
+					 read->x, read->y,
+					 read->width, read->height);
+		pixman_image_unref(damaged_image);
+	}
+
+	if (read->last) {
+		so->cache_dirty = 1;
+		shared_output_update(so);
+	}
+
+out:
+	free(read);
+}
+
 static void
 shared_output_repainted(struct wl_listener *listener, void *data)
 {
@@ -828,19 +1176,29 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 	pixman_region32_t output_damage;
 	pixman_region32_t *global_output_damage;
 	struct ss_shm_buffer *sb;
-	int32_t x, y, width, height, stride;
+	struct ss_read *read;
+	int32_t width, height, stride;
 	int i, nrects, do_yflip, y_orig;
 	pixman_box32_t *r;
-	pixman_image_t *damaged_image;
-	pixman_transform_t transform;
-	const struct pixel_format_info *read_format =
-		so->output->compositor->read_format;
-	const pixman_format_code_t pixman_format = read_format->pixman_format;
+
+	if (shared_output_can_use_dmabuf(so)) {
+		shared_output_repainted_dmabuf(so, data);
+		return;
+	}
 
 	width = so->output->current_mode->width;
 	height = so->output->current_mode->height;
 	stride = width;
 
+	if (so->dmabuf.active) {
+		/* Leaving the dmabuf path: the cache is out of date. */
+		shared_output_drop_dmabufs(so, false);
+		so->dmabuf.active = false;
+		if (so->cache_image)
+			pixman_image_unref(so->cache_image);
+		so->cache_image = NULL;
+	}
+
 	if (!so->cache_image ||
 	    pixman_image_get_width(so->cache_image) != width ||
 	    pixman_image_get_height(so->cache_image) != height) {
@@ -885,69 +1243,51 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 	weston_region_global_to_output(&output_damage, so->output,
 				       global_output_damage);
 
-	if (shared_output_ensure_tmp_data(so, &output_damage) < 0)
-		goto err_pixman_init;
-
 	do_yflip = !!(so->output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 
-	/* Create our cache image - a 1:1 copy of the output of interest's
-	 * pixels from the output space.
+	/* Update our cache image - a 1:1 copy of the output of interest's
+	 * pixels from the output space - as the read backs complete. The
+	 * last one pushes the update to the parent.
 	 */
 	r = pixman_region32_rectangles(&output_damage, &nrects);
+	if (nrects == 0) {
+		so->cache_dirty = 1;
+		shared_output_update(so);
+	}
+
 	for (i = 0; i < nrects; ++i) {
-		x = r[i].x1;
-		y = r[i].y1;
-		width = r[i].x2 - r[i].x1;
-		height = r[i].y2 - r[i].y1;
+		read = zalloc(sizeof *read);
+		if (!read) {
+			pixman_region32_fini(&output_damage);
+			goto err_shared_output;
+		}
+
+		read->output = so;
+		read->x = r[i].x1;
+		read->y = r[i].y1;
+		read->width = r[i].x2 - r[i].x1;
+		read->height = r[i].y2 - r[i].y1;
+		read->do_yflip = do_yflip;
+		read->last = i == nrects - 1;
+		wl_list_insert(so->pending_reads.prev, &read->link);
 
 		if (do_yflip)
 			y_orig = so->output->current_mode->height - r[i].y2;
 		else
-			y_orig = y;
-
-		so->output->compositor->renderer->read_pixels(
-			so->output, read_format,
-			so->tmp_data, x, y_orig, width, height);
-
-		damaged_image = pixman_image_create_bits(pixman_format,
-							 width, height,
-							 so->tmp_data,
-				(PIXMAN_FORMAT_BPP(pixman_format) / 8) * width);
-		if (!damaged_image)
-			goto err_pixman_init;
-
-		if (do_yflip) {
-			pixman_transform_init_scale(&transform,
-						    pixman_fixed_1,
-						    pixman_fixed_minus_1);
-
-			pixman_transform_translate(&transform, NULL,
-						   0,
-						   pixman_int_to_fixed(height));
-
-			pixman_image_set_transform(damaged_image, &transform);
-		}
-
-		pixman_image_composite32(PIXMAN_OP_SRC,
-					 damaged_image,
-					 NULL,
-					 so->cache_image,
-					 0, 0,
-					 0, 0,
-					 x, y,
-					 width, height);
-		pixman_image_unref(damaged_image);
+			y_orig = read->y;
+
+		weston_renderer_read_pixels_async(so->output,
+						  so->output->compositor->read_format,
+						  read->x, y_orig,
+						  read->width, read->height,
+						  shared_output_read_done,
+						  read);
 	}
 
-	so->cache_dirty = 1;
-
 	pixman_region32_fini(&output_damage);
-	shared_output_update(so);
 
 	return;
 
-err_pixman_init:
-	pixman_region32_fini(&output_damage);
 err_shared_output:
 	shared_output_destroy(so);
 }
@@ -965,6 +1305,10 @@ shared_output_create(struct weston_output *output, struct screen_share *ss, int
 		goto err_close;
 
 	wl_list_init(&so->seat_list);
+	wl_list_init(&so->pending_reads);
+	wl_list_init(&so->dmabuf.buffers);
+	wl_list_init(&so->dmabuf.free_buffers);
+	pixman_region32_init(&so->dmabuf.commit_damage);
 
 	so->parent.display = wl_display_connect_to_fd(parent_fd);
 	if (!so->parent.display)
@@ -1062,14 +1406,28 @@ shared_output_destroy(struct shared_output *so)
 {
 	struct ss_shm_buffer *buffer, *bnext;
 	struct ss_seat *seat, *tmp;
+	struct ss_read *read, *rnext;
 
 	weston_output_disable_planes_decr(so->output);
 
+	/* Pending read backs complete later, they just free themselves. */
+	wl_list_for_each_safe(read, rnext, &so->pending_reads, link) {
+		read->output = NULL;
+		wl_list_remove(&read->link);
+		wl_list_init(&read->link);
+	}
+
 	wl_list_for_each_safe(buffer, bnext, &so->shm.buffers, link)
 		ss_shm_buffer_destroy(buffer);
 	wl_list_for_each_safe(buffer, bnext, &so->shm.free_buffers, free_link)
 		ss_shm_buffer_destroy(buffer);
 
+	/* Buffers still with the parent go away with its connection. */
+	shared_output_drop_dmabufs(so, true);
+	if (so->dmabuf.commit_idle)
+		wl_event_source_remove(so->dmabuf.commit_idle);
+	pixman_region32_fini(&so->dmabuf.commit_damage);
+
 	wl_list_for_each_safe(seat, tmp, &so->seat_list, link)
 		ss_seat_destroy(seat);
 
@@ -1079,8 +1437,8 @@ shared_output_destroy(struct shared_output *so)
 	wl_list_remove(&so->output_destroyed.link);
 	wl_list_remove(&so->frame_listener.link);
 
-	pixman_image_unref(so->cache_image);
-	free(so->tmp_data);
+	if (so->cache_image)
+		pixman_image_unref(so->cache_image);
 
 	free(so);
 }
@@ -34,6 +34,7 @@
 #include <assert.h>
 
 #include <libweston/libweston.h>
+#include <libweston/weston-log.h>
 #include "frontend/weston.h"
 #include "fullscreen-shell-unstable-v1-server-protocol.h"
 #include "shared/helpers.h"
@@ -59,6 +60,10 @@ struct fullscreen_shell {
 	 * implementation to support more than one client.
 	 */
 	struct wl_list default_surface_list; /* struct fs_client_surface::link */
+
+	/* Fit the output mode to the client, so it is scanned out as is */
+	bool direct_scanout;
+	struct weston_log_scope *debug;
 };
 
 struct fs_output {
@@ -87,6 +92,14 @@ struct fs_output {
 	int presented_for_mode;
 	enum zwp_fullscreen_shell_v1_present_method method;
 	uint32_t framerate;
+
+	/* Mode size last looked for in direct scanout mode */
+	int32_t match_width, match_height;
+
+	/* Placement of the view last reported in the debug scope */
+	bool placement_known;
+	bool scanned_out;
+	uint32_t failure_reasons;
 };
 
 struct pointer_focus_listener {
@@ -409,6 +422,89 @@ fs_output_scale_view(struct fs_output *fsout, float width, float height)
 	}
 }
 
+/* The actual output mode is in physical units.  We need to transform the
+ * surface size to physical unit size by flipping and possibly scaling it.
+ */
+static void
+fs_output_mode_size(struct fs_output *fsout,
+		    int32_t surf_width, int32_t surf_height,
+		    int32_t *width, int32_t *height)
+{
+	switch (fsout->output->transform) {
+	case WL_OUTPUT_TRANSFORM_90:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+	case WL_OUTPUT_TRANSFORM_270:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		*width = surf_height * fsout->output->native_scale;
+		*height = surf_width * fsout->output->native_scale;
+		break;
+
+	case WL_OUTPUT_TRANSFORM_NORMAL:
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+	case WL_OUTPUT_TRANSFORM_180:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+	default:
+		*width = surf_width * fsout->output->native_scale;
+		*height = surf_height * fsout->output->native_scale;
+	}
+}
+
+/* Switch to the output mode of the size of the presented surface, if there
+ * is one, so that its buffers can go to a plane unscaled. */
+static void
+fs_output_match_mode(struct fs_output *fsout)
+{
+	struct weston_output *output = fsout->output;
+	struct weston_log_scope *debug = fsout->shell->debug;
+	struct weston_mode *mode, *match = NULL;
+	int32_t surf_x, surf_y, surf_width, surf_height;
+	int32_t width, height;
+
+	weston_shell_utils_subsurfaces_boundingbox(fsout->view->surface,
+						   &surf_x, &surf_y,
+						   &surf_width, &surf_height);
+	fs_output_mode_size(fsout, surf_width, surf_height, &width, &height);
+
+	if (width == fsout->match_width && height == fsout->match_height)
+		return;
+	fsout->match_width = width;
+	fsout->match_height = height;
+
+	if (output->current_mode->width == width &&
+	    output->current_mode->height == height)
+		return;
+
+	wl_list_for_each(mode, &output->mode_list, link) {
+		if (mode->width != width || mode->height != height)
+			continue;
+		if (!match || mode->refresh > match->refresh)
+			match = mode;
+	}
+
+	if (!match) {
+		weston_log_scope_printf(debug, "output %s: no %dx%d mode, "
+					"the surface will be composited\n",
+					output->name, width, height);
+		restore_output_mode(output);
+		return;
+	}
+
+	if (match == output->native_mode) {
+		restore_output_mode(output);
+	} else if (weston_output_mode_switch_to_temporary(output, match,
+						output->native_scale) < 0) {
+		weston_log_scope_printf(debug, "output %s: switching to "
+					"%dx%d failed\n",
+					output->name, width, height);
+		restore_output_mode(output);
+		return;
+	}
+
+	weston_log_scope_printf(debug, "output %s: mode %dx%d@%.3f for "
+				"the surface\n", output->name, width, height,
+				match->refresh / 1000.0);
+}
+
 static void
 fs_output_configure(struct fs_output *fsout, struct weston_surface *surface);
 
@@ -426,7 +522,10 @@ fs_output_configure_simple(struct fs_output *fsout,
 
 	assert(fsout->view);
 
-	restore_output_mode(fsout->output);
+	if (fsout->shell->direct_scanout)
+		fs_output_match_mode(fsout);
+	else
+		restore_output_mode(fsout->output);
 
 	wl_list_remove(&fsout->transform.link);
 	wl_list_init(&fsout->transform.link);
@@ -503,27 +602,8 @@ fs_output_configure_for_mode(struct fs_output *fsout,
 						   &surf_x, &surf_y,
 						   &surf_width, &surf_height);
 
-	/* The actual output mode is in physical units.  We need to
-	 * transform the surface size to physical unit size by flipping and
-	 * possibly scaling it.
-	 */
-	switch (fsout->output->transform) {
-	case WL_OUTPUT_TRANSFORM_90:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-	case WL_OUTPUT_TRANSFORM_270:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		mode.width = surf_height * fsout->output->native_scale;
-		mode.height = surf_width * fsout->output->native_scale;
-		break;
-
-	case WL_OUTPUT_TRANSFORM_NORMAL:
-	case WL_OUTPUT_TRANSFORM_FLIPPED:
-	case WL_OUTPUT_TRANSFORM_180:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-	default:
-		mode.width = surf_width * fsout->output->native_scale;
-		mode.height = surf_height * fsout->output->native_scale;
-	}
+	fs_output_mode_size(fsout, surf_width, surf_height,
+			    &mode.width, &mode.height);
 	mode.flags = 0;
 	mode.refresh = fsout->pending.framerate;
 
@@ -578,6 +658,58 @@ fs_output_configure(struct fs_output *fsout,
 	weston_output_schedule_repaint(fsout->output);
 }
 
+static void
+fs_output_print_placement(struct fs_output *fsout,
+			  struct weston_log_subscription *sub)
+{
+	struct weston_output *output = fsout->output;
+	struct weston_mode *mode = output->current_mode;
+	char buf[128];
+
+	if (!fsout->view) {
+		snprintf(buf, sizeof buf, "no surface");
+	} else if (fsout->scanned_out) {
+		snprintf(buf, sizeof buf, "surface on a hardware plane");
+	} else {
+		snprintf(buf, sizeof buf, "surface composited, "
+			 "plane failure reasons 0x%x", fsout->failure_reasons);
+	}
+
+	if (sub)
+		weston_log_subscription_printf(sub, "output %s (%dx%d): %s\n",
+					       output->name, mode->width,
+					       mode->height, buf);
+	else
+		weston_log_scope_printf(fsout->shell->debug,
+					"output %s (%dx%d): %s\n",
+					output->name, mode->width,
+					mode->height, buf);
+}
+
+/* Report where the last repaint put the view, when that changes. A client
+ * commits about once a frame, so this is checked on commit. */
+static void
+fs_output_update_placement(struct fs_output *fsout)
+{
+	uint32_t failure_reasons;
+	bool scanned_out;
+
+	if (!fsout->view || !weston_log_scope_is_enabled(fsout->shell->debug))
+		return;
+
+	scanned_out = weston_view_is_scanned_out(fsout->view, fsout->output,
+						 &failure_reasons);
+	if (fsout->placement_known &&
+	    fsout->scanned_out == scanned_out &&
+	    fsout->failure_reasons == failure_reasons)
+		return;
+
+	fsout->placement_known = true;
+	fsout->scanned_out = scanned_out;
+	fsout->failure_reasons = failure_reasons;
+	fs_output_print_placement(fsout, NULL);
+}
+
 static void
 configure_presented_surface(struct weston_surface *surface,
 			    struct weston_coord_surface new_origin)
@@ -600,10 +732,14 @@ configure_presented_surface_internal(struct weston_surface *surface)
 	if (!weston_surface_is_mapped(surface))
 		weston_surface_map(surface);
 
-	wl_list_for_each(fsout, &shell->output_list, link)
+	wl_list_for_each(fsout, &shell->output_list, link) {
+		if (fsout->surface == surface)
+			fs_output_update_placement(fsout);
+
 		if (fsout->surface == surface ||
 		    fsout->pending.surface == surface)
 			fs_output_configure(fsout, surface);
+	}
 }
 
 static void
@@ -621,6 +757,10 @@ fs_output_apply_pending(struct fs_output *fsout)
 		weston_view_destroy(fsout->view);
 		fsout->view = NULL;
 
+		if (fsout->shell->direct_scanout)
+			weston_surface_set_scanout_preferred(fsout->surface,
+							     false);
+
 		if (wl_list_empty(&fsout->surface->views)) {
 			fsout->surface->committed = NULL;
 			fsout->surface->committed_private = NULL;
@@ -648,6 +788,13 @@ fs_output_apply_pending(struct fs_output *fsout)
 			      &fsout->surface_destroyed);
 		weston_view_move_to_layer(fsout->view,
 					  &fsout->shell->layer.view_list);
+
+		fsout->match_width = 0;
+		fsout->match_height = 0;
+		fsout->placement_known = false;
+		if (fsout->shell->direct_scanout)
+			weston_surface_set_scanout_preferred(fsout->surface,
+							     true);
 	}
 
 	fs_output_clear_pending(fsout);
@@ -697,6 +844,10 @@ fs_output_set_surface(struct fs_output *fsout, struct weston_surface *surface,
 		weston_view_destroy(fsout->view);
 		fsout->view = NULL;
 
+		if (fsout->shell->direct_scanout)
+			weston_surface_set_scanout_preferred(fsout->surface,
+							     false);
+
 		if (wl_list_empty(&fsout->surface->views)) {
 			fsout->surface->committed = NULL;
 			fsout->surface->committed_private = NULL;
@@ -888,6 +1039,27 @@ bind_fullscreen_shell(struct wl_client *client, void *data, uint32_t version,
 			ZWP_FULLSCREEN_SHELL_V1_CAPABILITY_ARBITRARY_MODES);
 }
 
+static void
+fullscreen_shell_debug_begin(struct weston_log_subscription *sub, void *data)
+{
+	struct fullscreen_shell *shell = data;
+	struct fs_output *fsout;
+
+	weston_log_subscription_printf(sub, "direct scanout mode %s\n",
+				       shell->direct_scanout ? "on" : "off");
+
+	wl_list_for_each(fsout, &shell->output_list, link) {
+		if (fsout->view) {
+			fsout->scanned_out =
+				weston_view_is_scanned_out(fsout->view,
+							   fsout->output,
+							   &fsout->failure_reasons);
+			fsout->placement_known = true;
+		}
+		fs_output_print_placement(fsout, sub);
+	}
+}
+
 static void
 fullscreen_shell_destroy(struct wl_listener *listener, void *data)
 {
@@ -910,6 +1082,7 @@ fullscreen_shell_destroy(struct wl_listener *listener, void *data)
 		remove_default_surface(surf);
 	}
 
+	weston_log_scope_destroy(shell->debug);
 	weston_layer_fini(&shell->layer);
 	free(shell);
 }
@@ -919,6 +1092,7 @@ wet_shell_init(struct weston_compositor *compositor,
 	       int *argc, char *argv[])
 {
 	struct fullscreen_shell *shell;
+	struct weston_config_section *section;
 	struct weston_seat *seat;
 	struct weston_output *output;
 
@@ -940,6 +1114,18 @@ wet_shell_init(struct weston_compositor *compositor,
 
 	shell->client_destroyed.notify = client_destroyed;
 
+	section = weston_config_get_section(wet_get_config(compositor),
+					    "shell", NULL, NULL);
+	weston_config_section_get_bool(section, "direct-scanout",
+				       &shell->direct_scanout, false);
+
+	shell->debug =
+		weston_compositor_add_log_scope(compositor, "fullscreen-shell",
+						"Fullscreen shell mode matching and "
+						"plane placement\n",
+						fullscreen_shell_debug_begin,
+						NULL, shell);
+
 	weston_layer_init(&shell->layer, compositor);
 	weston_layer_set_position(&shell->layer,
 				  WESTON_LAYER_POSITION_FULLSCREEN);
@@ -35,7 +35,7 @@
 extern "C" {
 #endif
 
-#define WESTON_DRM_BACKEND_CONFIG_VERSION 6
+#define WESTON_DRM_BACKEND_CONFIG_VERSION 12
 
 struct libinput_device;
 
@@ -104,6 +104,35 @@ struct weston_drm_output_api {
 	 */
 	int (*set_content_type)(struct weston_output *output,
 				const char *content_type);
+
+	/** When to run the output with a variable refresh rate. Valid values
+	 * are:
+	 * - NULL or "off" - Always use the fixed refresh rate of the mode
+	 * - "fullscreen" - While a client buffer is scanned out directly,
+	 *   e.g. a fullscreen game or video
+	 * - "on" - Always, as long as the connected display supports it
+	 *
+	 * With a variable refresh rate a repaint is presented as soon as it
+	 * is done, at most at the refresh rate of the mode.
+	 */
+	int (*set_vrr_mode)(struct weston_output *output,
+			    const char *vrr_mode);
+
+	/** Apply the blend-to-output color transformation in the KMS CRTC
+	 * (DEGAMMA_LUT, CTM, GAMMA_LUT) instead of the renderer, when it
+	 * fits. Must be set before the output is enabled.
+	 */
+	void (*set_color_offload)(struct weston_output *output,
+				  bool offload);
+
+	/** Lower the refresh rate of the output after it has not been
+	 * repainted for timeout_sec seconds, 0 to never. The output switches
+	 * to the lowest refresh rate mode with the same resolution, or lets
+	 * VRR run at the display's minimum rate, and back on the next
+	 * repaint. Only done where the driver can do it without a modeset.
+	 */
+	void (*set_idle_refresh_timeout)(struct weston_output *output,
+					 uint32_t timeout_sec);
 };
 
 static inline const struct weston_drm_output_api *
@@ -258,6 +287,121 @@ struct weston_drm_backend_config {
 	 * rendering device.
 	 */
 	char *additional_devices;
+
+	/** Commit each DRM device as soon as its outputs are repainted
+	 *
+	 * When driving additional devices, apply the KMS update of a device
+	 * as soon as all of its outputs due in the current repaint cycle
+	 * have been repainted, instead of waiting for the outputs of the
+	 * other devices. A slow output then no longer delays the page flips
+	 * on unrelated devices.
+	 */
+	bool independent_device_commits;
+
+	/** Scan out fullscreen wl_shm buffers through dumb buffers
+	 *
+	 * Copy the damage of wl_shm buffers as large as the output's mode
+	 * into a pair of dumb buffers per output, which can then be put on
+	 * a plane instead of compositing the buffer with the renderer.
+	 */
+	bool shm_scanout;
+
+	/** Take over the display configuration left by the firmware
+	 *
+	 * Keep the video mode already on a connector when it is equivalent
+	 * to the configured one, and try the first KMS commit without a
+	 * modeset, so that nothing blanks between the boot splash and the
+	 * first composited frame. Falls back to a full modeset when the
+	 * kernel requires one.
+	 */
+	bool fastboot;
+
+	/** Merge relative pointer motion
+	 *
+	 * Send a run of relative motion events from one input device, read
+	 * in one go, as a single motion event with the summed deltas. This
+	 * cuts down the picking and the client events for high rate mice.
+	 */
+	bool coalesce_pointer_motion;
+
+	/** Resample touch and tablet motion to the output frame rate
+	 *
+	 * Hold back touch and tablet tool motion, and send one event per
+	 * touch point and tool just before each repaint of the output of
+	 * the device, with the position interpolated or extrapolated to
+	 * that time. Clients get evenly spaced samples, one per frame,
+	 * instead of whatever the device rate happens to line up with.
+	 */
+	bool resample_touch_tablet;
+
+	/** Read input devices on a thread of their own
+	 *
+	 * Dispatch libinput on a separate thread which hands the events to
+	 * the main loop, so that reading the devices does not wait for
+	 * repaints or slow clients.
+	 */
+	bool input_thread;
+
+	/** Submit page flips on a thread of their own
+	 *
+	 * Hand the atomic commits of page flips to a thread per DRM device,
+	 * so that drivers taking long in the commit ioctl do not hold up the
+	 * main loop. Commits needing a modeset are still done on the main
+	 * loop. Only applies with atomic modesetting.
+	 */
+	bool kms_thread;
+
+	/** Keep the repaint loop on the CRTC vblank counter
+	 *
+	 * Restart the repaint loop from the CRTC's sequence counter, waiting
+	 * for a CRTC sequence event rather than doing a page flip when the
+	 * counter is stale, and count the frames which missed the vblank
+	 * their repaint was meant for.
+	 */
+	bool vblank_sequence;
+
+	/** Add the input devices after startup
+	 *
+	 * Open the input devices once the first output has shown a frame,
+	 * or right away on the input thread if there is one, instead of
+	 * before the backend is up. Without any input device, while input
+	 * is required, the compositor then exits instead of failing to
+	 * start.
+	 */
+	bool async_input_devices;
+
+	/** Use plane color pipelines for surface color transformations
+	 *
+	 * Program the color pipeline of a plane (KMS colorop objects) with
+	 * the transformation of a surface into blending space, so that the
+	 * surface can still go on that plane. Only applies to outputs whose
+	 * color transformation is done by the CRTC, see
+	 * weston_drm_output_api::set_color_offload, and to kernels and
+	 * drivers with plane color pipelines.
+	 */
+	bool plane_color_pipeline;
+
+	/** File to keep the output configuration in between runs
+	 *
+	 * After each modeset the kernel accepts, the CRTC, mode and format of
+	 * the outputs of the primary device are written to this file, with
+	 * a fingerprint of the connectors, the EDIDs and the planes. When the
+	 * fingerprint matches at the next start, outputs get their CRTC back,
+	 * and those enabled in the same mode have their first frame
+	 * committed without TEST_ONLY commits. NULL for no cache. Only
+	 * applies with atomic modesetting.
+	 */
+	char *output_cache;
+
+	/** Free the buffers of outputs while DPMS is off
+	 *
+	 * Once an output is off, release its renderer state: the GBM surface
+	 * or dumb buffers, shadow buffers and cursor buffers, as well as the
+	 * buffers of shm scanout and writeback captures. They are set up
+	 * again when the output comes back on, which costs the first frame
+	 * some time.
+	 */
+	bool dpms_off_release_buffers;
 };
 
 #ifdef  __cplusplus
@@ -33,8 +33,9 @@ extern "C" {
 #include <stdint.h>
 
 #include <libweston/libweston.h>
+#include <libweston/plugin-registry.h>
 
-#define WESTON_HEADLESS_BACKEND_CONFIG_VERSION 3
+#define WESTON_HEADLESS_BACKEND_CONFIG_VERSION 4
 
 struct weston_headless_backend_config {
 	struct weston_backend_config base;
@@ -49,8 +50,46 @@ struct weston_headless_backend_config {
 	 * mHz to 1,000,000 mHz. 0 is a special value that triggers repaints
 	 * only on capture requests, not on damages. */
 	int refresh;
+
+	/** Finish frames on a virtual vblank: a fixed grid of the refresh
+	 * period, with the frame stamped at the grid point like a DRM page
+	 * flip, instead of one period after each repaint. */
+	bool vblank;
+
+	/** Delay the virtual vblank events by up to this many microseconds,
+	 * at random. The presentation stamps stay on the grid. Requires
+	 * vblank = true. */
+	int vblank_jitter;
+
+	/** With the GL renderer, render into dmabufs allocated with GBM on
+	 * the renderer's DRM device instead of GL renderbuffers. */
+	bool use_dmabuf;
 };
 
+#define WESTON_HEADLESS_OUTPUT_API_NAME "weston_headless_output_api_v1"
+
+struct weston_headless_output_api {
+	/** Override the refresh rate of an output
+	 *
+	 * \param output An output configured with output_set_size() of the
+	 * windowed output API, and not enabled yet.
+	 * \param refresh The refresh rate in mHz, from 1 to 1,000,000.
+	 *
+	 * Returns 0 on success, -1 on failure.
+	 */
+	int (*output_set_refresh)(struct weston_output *output, int refresh);
+};
+
+static inline const struct weston_headless_output_api *
+weston_headless_output_get_api(struct weston_compositor *compositor)
+{
+	const void *api;
+	api = weston_plugin_api_get(compositor, WESTON_HEADLESS_OUTPUT_API_NAME,
+				    sizeof(struct weston_headless_output_api));
+
+	return (const struct weston_headless_output_api *)api;
+}
+
 #ifdef  __cplusplus
 }
 #endif
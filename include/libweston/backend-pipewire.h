@@ -80,6 +80,23 @@ struct weston_pipewire_output_api {
 	 */
 	void (*set_gbm_format)(struct weston_output *output,
 			       const char *gbm_format);
+
+	/** Add a stream of the output at another size.
+	 *
+	 * The frames of the output are scaled to the given size on the GPU
+	 * and sent to a stream of their own, next to the full size stream.
+	 * Needs the GL renderer with DMABUF allocation; the stream is
+	 * dropped at enable time otherwise. Must be called before the
+	 * output is enabled.
+	 *
+	 * \param output     The weston output to add a stream to
+	 * \param width      Width of the stream
+	 * \param height     Height of the stream
+	 *
+	 * Returns 0 on success, -1 on failure.
+	 */
+	int (*output_add_scaled_stream)(struct weston_output *output,
+					int width, int height);
 };
 
 static inline const struct weston_pipewire_output_api *
@@ -99,6 +116,16 @@ struct weston_pipewire_backend_config {
 	enum weston_renderer_type renderer;
 	char *gbm_format;
 	int32_t num_outputs;
+
+	/** Stream H.264 encoded with VA-API instead of raw frames
+	 *
+	 * Needs the GL renderer. Outputs that can't be encoded fall back to
+	 * raw frames.
+	 */
+	bool vaapi_encode;
+
+	/** DRM device node for the encoder, NULL for /dev/dri/renderD128 */
+	char *vaapi_device;
 };
 
 #ifdef  __cplusplus
@@ -68,7 +68,7 @@ weston_rdp_output_get_api(struct weston_compositor *compositor)
 	return (const struct weston_rdp_output_api *)api;
 }
 
-#define WESTON_RDP_BACKEND_CONFIG_VERSION 3
+#define WESTON_RDP_BACKEND_CONFIG_VERSION 4
 
 typedef void *(*rdp_audio_in_setup)(struct weston_compositor *c, void *vcm);
 typedef void (*rdp_audio_in_teardown)(void *audio_private);
@@ -93,6 +93,9 @@ struct weston_rdp_backend_config {
 	rdp_audio_in_teardown audio_in_teardown;
 	rdp_audio_out_setup audio_out_setup;
 	rdp_audio_out_teardown audio_out_teardown;
+	/** Send frames over the graphics pipeline channel, H.264 encoded
+	 * where the client supports it. */
+	bool gfx;
 };
 
 #ifdef  __cplusplus
@@ -55,7 +55,7 @@ weston_vnc_output_get_api(struct weston_compositor *compositor)
 	return (const struct weston_vnc_output_api *)api;
 }
 
-#define WESTON_VNC_BACKEND_CONFIG_VERSION 2
+#define WESTON_VNC_BACKEND_CONFIG_VERSION 3
 
 struct weston_vnc_backend_config {
 	struct weston_backend_config base;
@@ -66,6 +66,18 @@ struct weston_vnc_backend_config {
 	char *server_cert;
 	char *server_key;
 	bool disable_tls;
+
+	/** Render into dmabufs for Neat VNC's H.264 encoder
+	 *
+	 * Needs the GL renderer, and Neat VNC built with H.264 and GBM
+	 * support. Other encodings keep working, from a mapping of the
+	 * dmabufs.
+	 */
+	bool vaapi_encode;
+
+	/** DRM device node to import the dmabufs on, NULL for
+	 * /dev/dri/renderD128 */
+	char *vaapi_device;
 };
 
 #ifdef  __cplusplus
@@ -34,7 +34,7 @@ extern "C" {
 
 #include <stdint.h>
 
-#define WESTON_WAYLAND_BACKEND_CONFIG_VERSION 3
+#define WESTON_WAYLAND_BACKEND_CONFIG_VERSION 4
 
 struct weston_wayland_backend_config {
 	struct weston_backend_config base;
@@ -44,6 +44,10 @@ struct weston_wayland_backend_config {
 	bool fullscreen;
 	char *cursor_theme;
 	int cursor_size;
+
+	/** Show client dmabufs as sub-surfaces of the output surface instead of
+	 * compositing them, where the parent compositor supports it. */
+	bool passthrough;
 };
 
 #ifdef  __cplusplus
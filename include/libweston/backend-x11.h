@@ -34,7 +34,7 @@ extern "C" {
 
 #include <libweston/libweston.h>
 
-#define WESTON_X11_BACKEND_CONFIG_VERSION 3
+#define WESTON_X11_BACKEND_CONFIG_VERSION 4
 
 struct weston_x11_backend_config {
 	struct weston_backend_config base;
@@ -43,6 +43,10 @@ struct weston_x11_backend_config {
 	bool no_input;
 
 	enum weston_renderer_type renderer;
+
+	/** Present frames with the Present extension, and render GL into
+	 * DRI3 pixmaps, when the X server supports it */
+	bool present;
 };
 
 #ifdef  __cplusplus
@@ -92,6 +92,14 @@ struct pixel_format_info;
 struct weston_output_capture_info;
 struct weston_output_color_outcome;
 struct weston_tearing_control;
+struct weston_client_memory;
+struct weston_commit_timer;
+struct weston_drm_syncobj_surface;
+struct weston_drm_syncobj_timeline;
+struct weston_output_latency;
+struct weston_output_perf_hud;
+struct weston_repaint_profile;
+struct weston_surface_latency;
 struct di_info;
 
 enum weston_keyboard_modifier {
@@ -129,6 +137,15 @@ enum weston_surface_protection_mode {
 	WESTON_SURFACE_PROTECTION_MODE_ENFORCED
 };
 
+/** Kind of content a surface shows, as hinted by its client through
+ * wp_content_type_v1; the values match that protocol's. */
+enum weston_content_type {
+	WESTON_CONTENT_TYPE_NONE = 0,
+	WESTON_CONTENT_TYPE_PHOTO,
+	WESTON_CONTENT_TYPE_VIDEO,
+	WESTON_CONTENT_TYPE_GAME,
+};
+
 /** Possible mode of an output
  *
  * \ingroup output
@@ -531,6 +548,10 @@ struct weston_plane {
 	struct wl_list link;
 };
 
+/** Number of render time samples kept per output for the adaptive repaint
+ * window. */
+#define WESTON_REPAINT_TIMING_SAMPLES 128
+
 /** Content producer for heads
  *
  * \rst
@@ -571,9 +592,20 @@ struct weston_output {
 	 */
 	struct wl_list paint_node_z_order_list;
 
+	/** The view whose opaque area, together with the ones above it,
+	 *  covers the whole output. The views below it in
+	 *  weston_compositor::view_list get no paint nodes on this output.
+	 *  NULL if nothing covers the output. */
+	struct weston_view *z_order_occluder;
+
 	/** Output area in global coordinates, simple rect */
 	pixman_region32_t region;
 
+	/** Scratch space for region temporaries on the repaint path. Kept
+	 *  from frame to frame so that their rectangle storage is reused;
+	 *  the contents are only meaningful within a single function. */
+	pixman_region32_t scratch_region[2];
+
 	/** True if damage has occurred since the last repaint for this output;
 	 *  if set, a repaint will eventually occur. */
 	bool repaint_needed;
@@ -585,12 +617,18 @@ struct weston_output {
 	 *  repaint handler. */
 	bool will_repaint;
 
-	/** Used only between repaint_begin and repaint_cancel. */
+	/** Used only between repaint_begin and repaint_cancel: true if the
+	 *  output has been repainted, but its update has not been flushed. */
 	bool repainted;
 
 	/** Repaints are triggered only on capture requests, not on damages. */
 	bool repaint_only_on_capture;
 
+	/** Set by the backend while the display runs with a variable refresh
+	 *  rate: a repaint starting after the earliest next refresh is not
+	 *  held back to a fixed vblank grid. */
+	bool vrr_active;
+
 	/** State of the repaint loop */
 	enum {
 		REPAINT_NOT_SCHEDULED = 0, /**< idle; no repaint will occur */
@@ -606,6 +644,19 @@ struct weston_output {
 	/** For cancelling the idle_repaint callback on output destruction. */
 	struct wl_event_source *idle_repaint_source;
 
+	/** Render time tracking for the adaptive repaint window, see
+	 *  weston_compositor::repaint_window_adaptive */
+	struct {
+		uint32_t samples_usec[WESTON_REPAINT_TIMING_SAMPLES];
+		unsigned int count; /* valid samples */
+		unsigned int next; /* ring position */
+		int64_t estimate_nsec; /* percentile of samples, or -1 */
+
+		bool pending; /* repaint awaiting finish_frame */
+		int64_t pending_nsec;
+		struct timespec start_monotonic;
+	} repaint_timing;
+
 	struct wl_signal frame_signal;
 	struct wl_signal destroy_signal;	/**< sent when disabled */
 	struct weston_coord_global move;
@@ -614,12 +665,30 @@ struct weston_output {
 	int disable_planes;
 	int destroying;
 	struct wl_list feedback_list;
+
+	/* Frame callbacks of the last repaint are held back until this
+	 * long before the vblank the clients' next frames target, see
+	 * weston_output_set_frame_callback_offset(). 0 sends them right
+	 * after the repaint. */
+	int frame_callback_offset_msec;
+	struct wl_list frame_callback_deferred_list;
+	uint32_t frame_callback_deferred_time;
+	struct wl_event_source *frame_callback_timer;
+	/* Wakes the repaint loop for the earliest held back content update */
+	struct wl_event_source *commit_queue_timer;
 	struct weston_output_capture_info *capture_info;
+	struct weston_output_latency *latency;
+	struct weston_repaint_profile *repaint_profile;
+	struct weston_output_perf_hud *perf_hud;
 
 	uint32_t transform;
 	int32_t native_scale;
 	int32_t current_scale;
 	int32_t original_scale;
+	/** The scale in 120ths when it is not an integer, or 0. The output
+	 * is then composited at this scale, while current_scale is rounded
+	 * up from it. */
+	uint32_t fractional_scale;
 
 	struct weston_mode *native_mode;
 	struct weston_mode *current_mode;
@@ -658,6 +727,18 @@ struct weston_output {
 	void (*set_backlight)(struct weston_output *output, uint32_t value);
 	void (*set_dpms)(struct weston_output *output, enum dpms_enum level);
 
+	/** Move a view shown on a cursor plane right away
+	 *
+	 * @param output The output the view is shown on.
+	 * @param view The view, with its transform already updated.
+	 * @return True if the plane now shows the view at its new position,
+	 * in which case the output is not repainted for the move.
+	 *
+	 * Optional.
+	 */
+	bool (*move_cursor)(struct weston_output *output,
+			    struct weston_view *view);
+
 	uint16_t gamma_size;
 	void (*set_gamma)(struct weston_output *output,
 			  uint16_t size,
@@ -711,6 +792,13 @@ struct weston_output {
 	 * mirror-of key in [output] section.
 	 */
 	struct weston_output *mirror_of;
+
+	/** Damage, in global coordinates, that the output being mirrored
+	 * repainted since this output's last repaint. Renderers that can
+	 * copy the mirrored output's image need this on top of the scene
+	 * damage, since the two outputs repaint at their own pace.
+	 */
+	pixman_region32_t mirror_damage;
 };
 
 enum weston_pointer_motion_mask {
@@ -980,7 +1068,8 @@ struct weston_touch {
 
 	struct wl_list device_list;	/* struct weston_touch_device::link */
 
-	struct wl_list resource_list;
+	/* wl_touch resources of the focused client, the others are kept
+	 * per client */
 	struct wl_list focus_resource_list;
 	struct weston_view *focus;
 	struct wl_listener focus_view_listener;
@@ -1006,7 +1095,8 @@ struct weston_tablet_tool {
 	uint32_t type;
 	struct weston_tablet *current_tablet;
 
-	struct wl_list resource_list;
+	/* Tool resources of the focused client, the others are kept per
+	 * client */
 	struct wl_list focus_resource_list;
 	struct weston_view *focus;
 	struct wl_listener focus_view_listener;
@@ -1042,7 +1132,6 @@ struct weston_tablet_tool {
 struct weston_tablet {
 	struct weston_seat *seat;
 
-	struct wl_list resource_list;
 	struct wl_list tool_list;
 
 	struct wl_list link;
@@ -1228,7 +1317,8 @@ struct weston_xkb_info {
 struct weston_keyboard {
 	struct weston_seat *seat;
 
-	struct wl_list resource_list;
+	/* wl_keyboard resources of the focused client; those of the others
+	 * are kept per client, see weston_seat::client_list */
 	struct wl_list focus_resource_list;
 	struct weston_surface *focus;
 	struct wl_listener focus_resource_listener;
@@ -1301,6 +1391,10 @@ struct weston_seat {
 	struct wl_list tablet_tool_list;
 	struct wl_list tablet_seat_resource_list;
 	struct wl_signal tablet_tool_added_signal;
+
+	/* Keyboard, touch and tablet resources of each client, while their
+	 * device has the focus elsewhere */
+	struct wl_list client_list;	/* weston_seat_client::link */
 };
 
 enum {
@@ -1381,6 +1475,9 @@ struct weston_layer {
 	enum weston_layer_position position;
 	pixman_box32_t mask;
 	struct weston_layer_entry view_list;
+	/* Views were added to or removed from this layer since the last
+	 * view list build */
+	bool view_list_dirty;
 };
 
 struct weston_drm_format_array;
@@ -1473,6 +1570,81 @@ struct weston_dmabuf_feedback;
 struct weston_dmabuf_feedback_format_table;
 struct weston_renderer;
 
+/** A set of weston_output::id values, of any size
+ *
+ * Outputs 0-63 fit the inline word; higher IDs grow the heap-allocated
+ * words as needed.
+ *
+ * \ingroup output
+ */
+struct weston_output_mask {
+	uint64_t low;
+	uint64_t *high;
+	unsigned int num_high;
+};
+
+void
+weston_output_mask_init(struct weston_output_mask *mask);
+
+void
+weston_output_mask_fini(struct weston_output_mask *mask);
+
+void
+weston_output_mask_clear(struct weston_output_mask *mask);
+
+void
+weston_output_mask_set(struct weston_output_mask *mask, uint32_t id);
+
+void
+weston_output_mask_unset(struct weston_output_mask *mask, uint32_t id);
+
+bool
+weston_output_mask_has(const struct weston_output_mask *mask, uint32_t id);
+
+bool
+weston_output_mask_is_empty(const struct weston_output_mask *mask);
+
+unsigned int
+weston_output_mask_count(const struct weston_output_mask *mask);
+
+bool
+weston_output_mask_equal(const struct weston_output_mask *a,
+			 const struct weston_output_mask *b);
+
+void
+weston_output_mask_union(struct weston_output_mask *dst,
+			 const struct weston_output_mask *src);
+
+void
+weston_output_mask_copy(struct weston_output_mask *dst,
+			const struct weston_output_mask *src);
+
+int
+weston_output_mask_next(const struct weston_output_mask *mask, int after);
+
+uint32_t
+weston_output_mask_first_unset(const struct weston_output_mask *mask);
+
+/** Iterate over the output IDs in a mask, in ascending order
+ *
+ * \param id An int receiving each ID
+ * \param mask The struct weston_output_mask to walk
+ */
+#define weston_output_mask_for_each(id, mask)				\
+	for (id = weston_output_mask_next(mask, -1); id >= 0;		\
+	     id = weston_output_mask_next(mask, id))
+
+/** Format of the GL renderer's blending space shadow
+ *
+ * \ingroup compositor
+ */
+enum weston_gl_shadow_format {
+	/** Half float, keeps values outside [0, 1] */
+	WESTON_GL_SHADOW_FORMAT_FP16 = 0,
+	/** 10 bits per colour channel, half the memory bandwidth */
+	WESTON_GL_SHADOW_FORMAT_RGB10A2,
+};
+
 /** Main object, container-like structure which aggregates all other objects.
  *
  * \ingroup compositor
@@ -1531,12 +1703,58 @@ struct weston_compositor {
 	struct wl_list debug_binding_list;
 
 	bool view_list_needs_rebuild;
+	/* Layers were added, removed or moved since the last view list
+	 * build, see also weston_layer::view_list_dirty */
+	bool layer_list_dirty;
+	/* Bumped on any change to the sub-surface trees that affects
+	 * the view list, see weston_view::subsurface_order */
+	uint32_t subsurface_order_serial;
+
+	/* Uniform grid over the output layout used by
+	 * weston_compositor_pick_view(). Each cell holds the views whose
+	 * transform.boundingbox touches it, sorted by view_list order.
+	 */
+	struct {
+		bool valid;
+		pixman_box32_t extents;
+		int cell_width, cell_height;
+		int cols, rows;
+		struct wl_array *cells; /* cols * rows of struct weston_view * */
+		struct wl_list dirty_list; /* weston_view::pick_index.dirty_link */
+		/* weston_compositor::subsurface_order_serial the view list
+		 * was last built with */
+		uint32_t subsurface_order_serial;
+	} pick_index;
+
+	/* Where views accepting input moved, resized or changed their input
+	 * region since the last repick; all is set when the stacking
+	 * changed, so only pointers in there need their focus repicked.
+	 */
+	struct {
+		bool all;
+		pixman_region32_t region;
+	} repick;
+
+	/* Free lists recycling the cache-line aligned allocations of
+	 * weston_view and weston_paint_node, which come and go with every
+	 * popup, tooltip and output hotplug.
+	 */
+	struct weston_object_pool {
+		size_t size;
+		void *free_list;
+		unsigned int count;
+	} view_pool, paint_node_pool;
 
 	uint32_t state;
 	struct wl_event_source *idle_source;
 	uint32_t idle_inhibit;
 	int idle_time;			/* timeout, s */
-	struct wl_event_source *repaint_timer;
+	struct wl_event_source *repaint_timer;	/**< on priority_loop */
+
+	/* Sources dispatched ahead of client requests, see
+	 * weston_compositor_get_priority_loop() */
+	struct wl_event_loop *priority_loop;
+	struct wl_event_source *priority_loop_source;
 
 	const struct weston_pointer_grab_interface *default_pointer_grab;
 
@@ -1561,12 +1779,23 @@ struct weston_compositor {
 
 	struct wl_list plugin_api_list; /* struct weston_plugin_api::link */
 
-	uint32_t output_id_pool;
+	struct weston_output_mask output_id_pool;
 	bool output_flow_dirty;
 
 	struct xkb_rule_names xkb_names;
 	struct xkb_context *xkb_context;
 	struct weston_xkb_info *xkb_info;
+	struct wl_list xkb_keymap_cache; /* weston_xkb_keymap_cache_entry::link */
+	struct wl_list client_memory_list; /* weston_client_memory::link */
+	struct wl_list client_requests_list; /* weston_client_requests::link */
+	struct wl_protocol_logger *client_requests_logger;
+	struct wl_event_source *client_requests_reset;
+	/* Requests of one client in one event loop iteration after which
+	 * the priority loop is dispatched, 0 for no budget */
+	uint32_t client_request_budget;
+	/* Client in between two of whose requests the priority loop is
+	 * being dispatched, if any */
+	struct wl_client *preempted_client;
 
 	int32_t kb_repeat_rate;
 	int32_t kb_repeat_delay;
@@ -1575,8 +1804,75 @@ struct weston_compositor {
 
 	clockid_t presentation_clock;
 	int32_t repaint_msec;
+	/* Shorten the repaint window of each output to its measured
+	 * render time, with repaint_msec as the upper bound. */
+	bool repaint_window_adaptive;
+	/* Start the repaint of an output this much ahead of another one's
+	 * due at about the same time, 0 disables it. */
+	int32_t repaint_stagger_msec;
 	struct timespec last_repaint_start;
 
+	/* Merge output damage past this many rectangles, 0 disables it.
+	 * Merged boxes may cover up to damage_max_overdraw times the area
+	 * actually damaged. */
+	int damage_max_rects;
+	double damage_max_overdraw;
+
+	/* The same, for the damage a client sends to a wl_surface, applied
+	 * as the requests arrive so that the region never grows past
+	 * client_damage_max_rects rectangles. */
+	int client_damage_max_rects;
+	double client_damage_max_overdraw;
+	struct {
+		uint64_t rects;		/* damage requests received */
+		uint64_t merges;	/* times the pending damage was merged */
+		uint64_t merged_rects;	/* rectangles removed by merging */
+	} client_damage_stats;
+
+	/* Frame callbacks of surfaces with nothing visible on their output
+	 * are held back until they are visible again. A non-zero interval
+	 * sends them at most this often instead. The timer repaints when
+	 * these, or those held back by a frame rate limit, are due. */
+	int occluded_frame_interval_msec;
+	struct wl_event_source *occluded_frame_timer;
+
+	/* Show an opaque dmabuf view that covers a whole output with async
+	 * page flips, as if its client had asked for tearing, so that a new
+	 * buffer is put on screen right away instead of at the next vblank. */
+	bool low_latency_fullscreen;
+
+	/* Surfaces with content updates waiting for their target time,
+	 * struct weston_surface::commit_queue_link */
+	struct wl_list commit_queue_list;
+
+	/* Threads the pixman renderer splits each repaint over, counting
+	 * the compositor thread. 0 or 1 repaints on the compositor only. */
+	int pixman_repaint_threads;
+	/* Let the pixman renderer copy an opaque client buffer that covers
+	 * all damage 1:1 in the output format straight into the output. */
+	bool pixman_direct_copy;
+
+	/* Directory where the GL renderer caches linked shader programs
+	 * across runs, or NULL. Freed by weston_compositor_destroy(). */
+	char *gl_program_cache_dir;
+
+	/* Let the GL renderer pack small wl_shm buffers into shared texture
+	 * pages and draw neighbouring ones together. */
+	bool gl_shm_atlas;
+
+	/* Texture memory in MiB past which the GL renderer evicts the
+	 * textures of wl_shm buffers that were not drawn recently, or 0 for
+	 * no limit. */
+	int gl_memory_budget_mb;
+
+	/* Format of the shadow the GL renderer blends into when an output's
+	 * blending space needs a color transformation to reach the output. */
+	enum weston_gl_shadow_format gl_shadow_format;
+
+	/* Directory where the LittleCMS color manager caches baked 3D LUTs
+	 * across runs, or NULL. Freed by weston_compositor_destroy(). */
+	char *color_lut_cache_dir;
+
 	unsigned int activate_serial;
 
 	struct wl_global *pointer_constraints;
@@ -1595,6 +1891,15 @@ struct weston_compositor {
 	/* Whether to load multiple backends. */
 	bool multi_backend;
 
+	/* Whether renderers may copy client dmabufs to release them before
+	 * the next commit, trading GPU bandwidth for client memory. */
+	bool early_buffer_release;
+
+	/* Whether a content update is held back, keeping the current buffer
+	 * on screen, while its acquire fence is still unsignalled when the
+	 * output repaints. */
+	bool skip_late_buffers;
+
 	/* Test suite data */
 	struct weston_testsuite_data test_data;
 
@@ -1614,6 +1919,14 @@ struct weston_compositor {
 	struct weston_log_context *weston_log_ctx;
 	struct weston_log_scope *debug_scene;
 	struct weston_log_scope *timeline;
+	struct weston_log_scope *latency_scope;
+	struct weston_log_scope *repaint_profile_scope;
+	struct weston_log_scope *client_memory_scope;
+	struct weston_log_scope *client_requests_scope;
+	struct weston_log_scope *client_damage_scope;
+	struct weston_log_scope *scene_record_scope;
+	uint32_t scene_record_next_id;
+	bool perf_hud;			/**< performance HUD shown */
 	struct weston_log_scope *libseat_debug;
 
 	struct content_protection *content_protection;
@@ -1666,6 +1979,11 @@ struct weston_buffer {
 
 	const struct pixel_format_info *pixel_format;
 	uint64_t format_modifier;
+
+	/* Accounting of the client that created the buffer, and what the
+	 * buffer itself is charged, see client-memory.c */
+	struct weston_client_memory *client_memory;
+	uint64_t client_memory_bytes;
 };
 
 enum weston_buffer_reference_type {
@@ -1712,6 +2030,10 @@ struct weston_buffer_release {
 	/* The fence fd, if any, associated with this release. If the fence fd
 	 * is -1 then this is considered an immediate release. */
 	int fence_fd;
+	/* For wp_linux_drm_syncobj_surface_v1 releases, which have no
+	 * resource: the timeline point to signal instead. */
+	struct weston_drm_syncobj_timeline *release_timeline;
+	uint64_t release_point;
 };
 
 struct weston_buffer_release_reference {
@@ -1765,6 +2087,9 @@ struct weston_view {
 
 	/* struct weston_paint_node::view_link */
 	struct wl_list paint_node_list;
+	/* The same paint nodes indexed by weston_output::id, NULL where the
+	 * view has none */
+	struct wl_array paint_node_index;
 
 	struct wl_list link;             /* weston_compositor::view_list */
 	struct weston_layer_entry layer_link; /* part of geometry */
@@ -1772,6 +2097,13 @@ struct weston_view {
 	/* For weston_layer inheritance from another view */
 	struct weston_view *parent_view;
 
+	/* This view and its sub-surface views in z-order, valid while the
+	 * serial matches weston_compositor::subsurface_order_serial */
+	struct {
+		struct wl_array views; /* struct weston_view * */
+		uint32_t serial;
+	} subsurface_order;
+
 	unsigned int click_to_activate_serial;
 
 	pixman_region32_t visible;       /* Unoccluded region in global space */
@@ -1841,10 +2173,21 @@ struct weston_view {
 	 * A more complete representation of all outputs this surface is
 	 * displayed on.
 	 */
-	uint32_t output_mask;
+	struct weston_output_mask output_mask;
 
 	bool is_mapped;
 	struct weston_log_pacer subsurface_parent_log_pacer;
+
+	/* Set while weston_view_move_cursor() moves the view */
+	bool repaint_inhibited;
+
+	/* Membership in weston_compositor::pick_index */
+	struct {
+		bool indexed;
+		uint32_t order; /* position in weston_compositor::view_list */
+		int col1, row1, col2, row2; /* covered cells, exclusive end */
+		struct wl_list dirty_link;
+	} pick_index;
 };
 
 enum weston_surface_status {
@@ -1914,6 +2257,9 @@ struct weston_surface_state {
 	 * color_management_surface_v1_interface.unset_image_description */
 	struct weston_color_profile *color_profile;
 	const struct weston_render_intent_info *render_intent;
+
+	/* wp_content_type_v1.set_content_type */
+	enum weston_content_type content_type;
 };
 
 struct weston_surface_activation_data {
@@ -1984,10 +2330,17 @@ struct weston_surface {
 	 * A more complete representation of all outputs this surface is
 	 * displayed on.
 	 */
-	uint32_t output_mask;
+	struct weston_output_mask output_mask;
 
 	struct wl_list frame_callback_list;
 	struct wl_list feedback_list;
+	/* Frame time at which frame callbacks were last sent */
+	struct timespec frame_callback_time;
+	/* Shortest time between frame callbacks, 0 for none, and the frame
+	 * time the next ones are due at, see
+	 * weston_surface_set_frame_rate_limit() */
+	int64_t frame_interval_nsec;
+	struct timespec frame_limit_next;
 
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_viewport buffer_viewport;
@@ -1998,6 +2351,11 @@ struct weston_surface {
 	/* wp_viewport resource for this surface */
 	struct wl_resource *viewport_resource;
 
+	/* wp_fractional_scale_v1 resource for this surface, and the
+	 * preferred scale last sent on it, in 120ths; 0 if none yet */
+	struct wl_resource *fractional_scale_resource;
+	uint32_t preferred_fractional_scale;
+
 	/* All the pending state, that wl_surface.commit will apply. */
 	struct weston_surface_state pending;
 
@@ -2052,14 +2410,36 @@ struct weston_surface {
 	int acquire_fence_fd;
 	struct weston_buffer_release_reference buffer_release_ref;
 
+	/* wp_linux_drm_syncobj_surface_v1 for this surface */
+	struct weston_drm_syncobj_surface *syncobj_surface;
+
 	struct weston_dmabuf_feedback *dmabuf_feedback;
 
+	/* Set by the shell for a surface it keeps alone and unscaled on an
+	 * output, see weston_surface_set_scanout_preferred() */
+	bool scanout_preferred;
+
 	enum weston_hdcp_protection desired_protection;
 	enum weston_hdcp_protection current_protection;
 	enum weston_surface_protection_mode protection_mode;
 
 	struct weston_tearing_control *tear_control;
 
+	/* wp_content_type_v1 resource for this surface, and the hint */
+	struct wl_resource *content_type_resource;
+	enum weston_content_type content_type;
+
+	/* wp_commit_timer_v1 for this surface, and the content updates it
+	 * held back until their target time, oldest first */
+	struct weston_commit_timer *commit_timer;
+	struct wl_list commit_queue;
+	struct wl_list commit_queue_link;
+
+	struct weston_surface_latency *latency;
+
+	/* Id of the surface in scene recordings, 0 until first recorded */
+	uint32_t scene_record_id;
+
 	struct weston_color_profile *color_profile;
 	struct weston_color_profile *preferred_color_profile;
 	const struct weston_render_intent_info *render_intent;
@@ -2186,6 +2566,9 @@ void
 weston_view_move_to_layer(struct weston_view *view,
 			  struct weston_layer_entry *layer);
 
+void
+weston_view_prewarm(struct weston_view *view, struct weston_output *output);
+
 void
 weston_layer_init(struct weston_layer *layer,
 		  struct weston_compositor *compositor);
@@ -2369,6 +2752,11 @@ weston_view_set_mask_infinite(struct weston_view *view);
 bool
 weston_view_is_mapped(struct weston_view *view);
 
+bool
+weston_view_is_scanned_out(struct weston_view *view,
+			   struct weston_output *output,
+			   uint32_t *failure_reasons);
+
 void
 weston_view_schedule_repaint(struct weston_view *view);
 
@@ -2385,6 +2773,14 @@ void
 weston_surface_set_size(struct weston_surface *surface,
 			int32_t width, int32_t height);
 
+void
+weston_surface_set_scanout_preferred(struct weston_surface *surface,
+				     bool preferred);
+
+void
+weston_surface_set_frame_rate_limit(struct weston_surface *surface,
+				    uint32_t fps);
+
 void
 weston_surface_damage(struct weston_surface *surface);
 
@@ -2429,6 +2825,25 @@ weston_surface_copy_content(struct weston_surface *surface,
 			    int src_x, int src_y,
 			    int width, int height);
 
+/** Completion callback of weston_surface_thumbnail_async()
+ *
+ * \param data The user data passed with the request.
+ * \param pixels The thumbnail in PIXMAN_a8b8g8r8, or NULL on failure.
+ * Only valid during the call.
+ * \param width The width of the thumbnail in pixels.
+ * \param height The height of the thumbnail in pixels.
+ * \param stride The row stride of pixels in bytes.
+ */
+typedef void (*weston_surface_thumbnail_func_t)(void *data,
+						const void *pixels,
+						int width, int height,
+						int stride);
+
+void
+weston_surface_thumbnail_async(struct weston_surface *surface, int max_size,
+			       weston_surface_thumbnail_func_t done,
+			       void *data);
+
 struct weston_buffer *
 weston_buffer_from_resource(struct weston_compositor *ec,
 			    struct wl_resource *resource);
@@ -2491,6 +2906,9 @@ weston_output_get_destroy_listener(struct weston_output *output,
 int
 weston_compositor_set_xkb_rule_names(struct weston_compositor *ec,
 				     struct xkb_rule_names *names);
+struct xkb_keymap *
+weston_compositor_get_keymap(struct weston_compositor *ec,
+			     const struct xkb_rule_names *names);
 
 /* String literal of spaces, the same width as the timestamp. */
 #define STAMP_SPACE "               "
@@ -2695,6 +3113,13 @@ void
 weston_output_set_scale(struct weston_output *output,
 			int32_t scale);
 
+void
+weston_output_set_fractional_scale(struct weston_output *output,
+				   uint32_t scale);
+
+uint32_t
+weston_output_get_fractional_scale(const struct weston_output *output);
+
 void
 weston_output_set_transform(struct weston_output *output,
 			    uint32_t transform);
@@ -2764,6 +3189,10 @@ void
 weston_output_allow_protection(struct weston_output *output,
 			       bool allow_protection);
 
+void
+weston_output_set_frame_callback_offset(struct weston_output *output,
+					int offset_msec);
+
 bool
 weston_output_contains_coord(struct weston_output *output,
 			     struct weston_coord_global pos);
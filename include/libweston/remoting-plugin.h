@@ -63,6 +63,22 @@ struct weston_remoting_api {
 	/** Set the pipeline for gstreamer */
 	void (*set_gst_pipeline)(struct weston_output *output,
 				 char *gst_pipeline);
+
+	/** Hand the frames to the pipeline as dmabuf memory
+	 *
+	 * The appsrc caps carry the memory:DMABuf feature, so that hardware
+	 * encoders can import the frames without a copy.
+	 */
+	void (*set_dmabuf)(struct weston_output *output, bool dmabuf);
+
+	/** Adapt the stream to a congested link
+	 *
+	 * While the pipeline falls behind or drops late frames, the
+	 * bitrate or quality of the element named "encoder" and the frame
+	 * rate are lowered step by step, and raised again once it keeps up.
+	 */
+	void (*set_adaptive_quality)(struct weston_output *output,
+				     bool adaptive);
 };
 
 static inline const struct weston_remoting_api *
@@ -84,6 +84,48 @@ weston_log_scope_destroy(struct weston_log_scope *scope);
 bool
 weston_log_scope_is_enabled(struct weston_log_scope *scope);
 
+/** The start of every weston_log_scope, read by the inline checks
+ *
+ * Only weston-log.c writes to it.
+ *
+ * \memberof weston_log_scope
+ */
+struct weston_log_scope_state {
+	bool enabled;
+};
+
+/** Are there any active subscriptions to the scope? Inline version
+ *
+ * \param scope The log scope to check; may be NULL.
+ *
+ * Same as weston_log_scope_is_enabled(), without a function call and with
+ * the branch hinted as not taken, for repaint paths.
+ *
+ * \memberof weston_log_scope
+ */
+static inline bool
+weston_log_scope_enabled(struct weston_log_scope *scope)
+{
+	const struct weston_log_scope_state *state =
+		(const struct weston_log_scope_state *)scope;
+
+	return __builtin_expect(state && state->enabled, 0);
+}
+
+/** Print to a log scope, if anyone is subscribed
+ *
+ * Unlike weston_log_scope_printf(), the arguments are not even evaluated
+ * while nobody is subscribed to the scope.
+ *
+ * \memberof weston_log_scope
+ */
+#define weston_log_scope_printf_lazy(scope, ...)				\
+	do {								\
+		struct weston_log_scope *scope_ = (scope);		\
+		if (weston_log_scope_enabled(scope_))			\
+			weston_log_scope_printf(scope_, __VA_ARGS__);	\
+	} while (0)
+
 void
 weston_log_scope_write(struct weston_log_scope *scope,
 			 const char *data, size_t len);
@@ -123,9 +165,18 @@ weston_log_subscribe(struct weston_log_context *log_ctx,
 struct weston_log_subscriber *
 weston_log_subscriber_create_log(FILE *dump_to);
 
+struct weston_log_subscriber *
+weston_log_subscriber_create_log_async(FILE *dump_to, size_t size);
+
 struct weston_log_subscriber *
 weston_log_subscriber_create_flight_rec(size_t size);
 
+struct weston_log_subscriber *
+weston_log_subscriber_create_mmap(const char *path, size_t size);
+
+struct weston_log_subscriber *
+weston_log_subscriber_create_trace_marker(void);
+
 void
 weston_log_subscriber_display_flight_rec(struct weston_log_subscriber *sub);
 
@@ -133,6 +184,13 @@ struct weston_log_subscription *
 weston_log_subscription_iterate(struct weston_log_scope *scope,
 				struct weston_log_subscription *sub_iter);
 
+void
+weston_log_subscription_write(struct weston_log_subscription *sub,
+			      const char *data, size_t len);
+
+bool
+weston_log_subscription_is_binary(struct weston_log_subscription *sub);
+
 void
 weston_log_flight_recorder_display_buffer(FILE *file);
 
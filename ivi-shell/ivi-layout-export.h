@@ -65,6 +65,7 @@ extern "C" {
 
 struct ivi_layout_layer;
 struct ivi_layout_surface;
+struct ivi_layout_transaction;
 
 enum ivi_layout_surface_type {
 	IVI_LAYOUT_SURFACE_TYPE_IVI,
@@ -636,6 +637,94 @@ struct ivi_layout_interface {
 	 * See add_listener_show_input_panel for more details.
 	 */
 	void (*add_listener_update_input_panel)(struct wl_listener *listener);
+
+	/**
+	 * transactions
+	 *
+	 * A transaction collects render orders and properties of any number
+	 * of screens, layers and surfaces without touching the pending
+	 * state, and applies all of them with a single commit. A controller
+	 * can build up a change spanning several outputs over several
+	 * events, while commits done in the meantime (e.g. by transitions)
+	 * do not pick up half of it. Objects destroyed before the commit
+	 * are dropped from the transaction.
+	 */
+
+	/**
+	 * \brief Create an empty transaction
+	 */
+	struct ivi_layout_transaction *(*transaction_create)(void);
+
+	/**
+	 * \brief Discard a transaction without applying it
+	 */
+	void (*transaction_destroy)(struct ivi_layout_transaction *transaction);
+
+	/**
+	 * \brief Apply all changes of a transaction and commit them
+	 *
+	 * Changes already pending through the immediate setters are
+	 * committed along with them. The transaction is destroyed.
+	 *
+	 * \return IVI_SUCCEEDED if the method call was successful
+	 * \return IVI_FAILED if the method call was failed
+	 */
+	int32_t (*transaction_commit)(struct ivi_layout_transaction *transaction);
+
+	/**
+	 * \brief Stage the order of ivi_layers on a weston_output
+	 *
+	 * \return IVI_SUCCEEDED if the method call was successful
+	 * \return IVI_FAILED if the output is not managed by the service
+	 */
+	int32_t (*transaction_screen_set_render_order)(
+				struct ivi_layout_transaction *transaction,
+				struct weston_output *output,
+				struct ivi_layout_layer **pLayer,
+				int32_t number);
+
+	/**
+	 * \brief Stage the order of ivi_surfaces in an ivi_layer
+	 */
+	void (*transaction_layer_set_render_order)(
+				struct ivi_layout_transaction *transaction,
+				struct ivi_layout_layer *ivilayer,
+				struct ivi_layout_surface **pSurface,
+				int32_t number);
+
+	/**
+	 * \brief Stage the visibility of an ivi_layer
+	 */
+	void (*transaction_layer_set_visibility)(
+				struct ivi_layout_transaction *transaction,
+				struct ivi_layout_layer *ivilayer,
+				bool newVisibility);
+
+	/**
+	 * \brief Stage the destination area of an ivi_layer
+	 */
+	void (*transaction_layer_set_destination_rectangle)(
+				struct ivi_layout_transaction *transaction,
+				struct ivi_layout_layer *ivilayer,
+				int32_t x, int32_t y,
+				int32_t width, int32_t height);
+
+	/**
+	 * \brief Stage the visibility of an ivi_surface
+	 */
+	void (*transaction_surface_set_visibility)(
+				struct ivi_layout_transaction *transaction,
+				struct ivi_layout_surface *ivisurf,
+				bool newVisibility);
+
+	/**
+	 * \brief Stage the destination area of an ivi_surface
+	 */
+	void (*transaction_surface_set_destination_rectangle)(
+				struct ivi_layout_transaction *transaction,
+				struct ivi_layout_surface *ivisurf,
+				int32_t x, int32_t y,
+				int32_t width, int32_t height);
 };
 
 static inline const struct ivi_layout_interface *
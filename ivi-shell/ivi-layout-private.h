@@ -32,6 +32,16 @@
 #include "ivi-layout-export.h"
 #include <libweston/desktop.h>
 
+struct ivi_rectangle
+{
+	int32_t x;
+	int32_t y;
+	int32_t width;
+	int32_t height;
+};
+
+#define IVI_VIEW_TRANSFORM_KEY_LENGTH 5
+
 struct ivi_layout_view {
 	struct wl_list link;	/* ivi_layout::view_list */
 	struct wl_list surf_link;	/*ivi_layout_surface::view_list */
@@ -40,6 +50,10 @@ struct ivi_layout_view {
 
 	struct weston_view *view;
 	struct weston_transform transform;
+	/* the surface, layer and screen rectangles the transform was
+	 * computed from, see update_prop() */
+	struct ivi_rectangle transform_key[IVI_VIEW_TRANSFORM_KEY_LENGTH];
+	bool transform_valid;
 
 	struct ivi_layout_surface *ivisurf;
 	struct ivi_layout_layer *on_layer;
@@ -98,8 +112,14 @@ struct ivi_layout {
 
 	struct wl_list surface_list;	/* ivi_layout_surface::link */
 	struct wl_list layer_list;	/* ivi_layout_layer::link */
+
+	/* The same surfaces and layers indexed by ID; surfaces without an
+	 * ID yet (IVI_INVALID_ID) are left out. */
+	struct hash_table *surface_ids;
+	struct hash_table *layer_ids;
 	struct wl_list screen_list;	/* ivi_layout_screen::link */
 	struct wl_list view_list;	/* ivi_layout_view::link */
+	struct wl_list transaction_list; /* ivi_layout_transaction::link */
 
 	struct {
 		struct wl_signal destroy_signal;
@@ -145,6 +165,9 @@ struct ivi_layout_transition;
 struct ivi_layout_transition_set {
 	struct wl_event_source  *event_source;
 	struct wl_list          transition_list;
+	/* apply the in-between frames of view transitions straight to
+	 * the weston_views instead of committing the layout */
+	bool                    direct;
 };
 
 typedef void (*ivi_layout_transition_destroy_user_func)(void *user_data);
@@ -183,6 +206,15 @@ ivi_layout_transition_fade_layer(struct ivi_layout_layer *layer,
 int32_t
 is_surface_transition(struct ivi_layout_surface *surface);
 
+void
+ivi_layout_surface_apply_opacity(struct ivi_layout_surface *ivisurf,
+				 double opacity);
+
+void
+ivi_layout_surface_apply_destination_rectangle(struct ivi_layout_surface *ivisurf,
+					       int32_t x, int32_t y,
+					       int32_t width, int32_t height);
+
 void
 ivi_layout_remove_all_surface_transitions(struct ivi_layout_surface *surface);
 
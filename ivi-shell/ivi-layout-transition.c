@@ -35,6 +35,7 @@
 #include "ivi-shell.h"
 #include "ivi-layout-export.h"
 #include "ivi-layout-private.h"
+#include "frontend/weston.h"
 
 struct ivi_layout_transition;
 
@@ -55,6 +56,8 @@ struct ivi_layout_transition {
 	uint32_t  is_done;
 	ivi_layout_is_transition_func is_transition_func;
 	ivi_layout_transition_frame_func frame_func;
+	/* in-between frames in direct mode, may be NULL */
+	ivi_layout_transition_frame_func direct_frame_func;
 	ivi_layout_transition_destroy_func destroy_func;
 };
 
@@ -142,18 +145,32 @@ static float time_to_nowpos(struct ivi_layout_transition *transition)
 		   (float)transition->time_duration * M_PI_2);
 }
 
-static void
+/* Returns whether the frame changed layout properties that need a commit. */
+static bool
 do_transition_frame(struct ivi_layout_transition *transition,
-		    uint32_t timestamp)
+		    uint32_t timestamp, bool direct)
 {
-	if (0 == transition->time_start)
+	bool first = transition->time_start == 0;
+
+	if (first)
 		transition->time_start = timestamp;
 
 	tick_transition(transition, timestamp);
+
+	/* The first and the last frame still go through the layout, so
+	 * that visibility and the final properties get committed. */
+	if (direct && transition->direct_frame_func &&
+	    !first && !transition->is_done) {
+		transition->direct_frame_func(transition);
+		return false;
+	}
+
 	transition->frame_func(transition);
 
 	if (transition->is_done)
 		layout_transition_destroy(transition);
+
+	return true;
 }
 
 static int32_t
@@ -165,6 +182,7 @@ layout_transition_frame(void *data)
 	uint32_t msec = 0;
 	struct transition_node *node = NULL;
 	struct transition_node *next = NULL;
+	bool commit = false;
 
 	if (wl_list_empty(&transitions->transition_list)) {
 		wl_event_source_timer_update(transitions->event_source, 0);
@@ -177,10 +195,13 @@ layout_transition_frame(void *data)
 	msec = (1e+3 * timestamp.tv_sec + 1e-6 * timestamp.tv_nsec);
 
 	wl_list_for_each_safe(node, next, &transitions->transition_list, link) {
-		do_transition_frame(node->transition, msec);
+		if (do_transition_frame(node->transition, msec,
+					transitions->direct))
+			commit = true;
 	}
 
-	ivi_layout_commit_changes();
+	if (commit)
+		ivi_layout_commit_changes();
 	return 1;
 }
 
@@ -188,6 +209,7 @@ struct ivi_layout_transition_set *
 ivi_layout_transition_set_create(struct weston_compositor *ec)
 {
 	struct ivi_layout_transition_set *transitions;
+	struct weston_config_section *section;
 	struct wl_event_loop *loop;
 
 	transitions = malloc(sizeof(*transitions));
@@ -198,6 +220,11 @@ ivi_layout_transition_set_create(struct weston_compositor *ec)
 
 	wl_list_init(&transitions->transition_list);
 
+	section = weston_config_get_section(wet_get_config(ec),
+					    "ivi-shell", NULL, NULL);
+	weston_config_section_get_bool(section, "direct-transitions",
+				       &transitions->direct, false);
+
 	loop = wl_display_get_event_loop(ec->wl_display);
 	transitions->event_source =
 		wl_event_loop_add_timer(loop, layout_transition_frame,
@@ -282,6 +309,7 @@ create_layout_transition(void)
 	transition->user_data = NULL;
 
 	transition->frame_func = NULL;
+	transition->direct_frame_func = NULL;
 	transition->destroy_func = NULL;
 
 	return transition;
@@ -341,6 +369,19 @@ transition_move_resize_view_user_frame(struct ivi_layout_transition *transition)
 						     dest_width, dest_height);
 }
 
+static void
+transition_move_resize_view_direct_frame(struct ivi_layout_transition *transition)
+{
+	struct move_resize_view_data *mrv = transition->private_data;
+	const double current = time_to_nowpos(transition);
+
+	ivi_layout_surface_apply_destination_rectangle(mrv->surface,
+		mrv->start_x + (mrv->end_x - mrv->start_x) * current,
+		mrv->start_y + (mrv->end_y - mrv->start_y) * current,
+		mrv->start_width + (mrv->end_width - mrv->start_width) * current,
+		mrv->start_height + (mrv->end_height - mrv->start_height) * current);
+}
+
 static int32_t
 is_transition_move_resize_view_func(struct move_resize_view_data *data,
 				    struct ivi_layout_surface *view)
@@ -444,6 +485,10 @@ ivi_layout_transition_move_resize_view(struct ivi_layout_surface *surface,
 		transition_move_resize_view_destroy,
 		duration);
 
+	if (transition)
+		transition->direct_frame_func =
+			transition_move_resize_view_direct_frame;
+
 	if (transition && layout_transition_register(transition))
 		return;
 	layout_transition_destroy(transition);
@@ -474,6 +519,16 @@ fade_view_user_frame(struct ivi_layout_transition *transition)
 	ivi_layout_surface_set_visibility(surface, true);
 }
 
+static void
+fade_view_direct_frame(struct ivi_layout_transition *transition)
+{
+	struct fade_view_data *fade = transition->private_data;
+	const double current = time_to_nowpos(transition);
+
+	ivi_layout_surface_apply_opacity(fade->surface,
+		fade->start_alpha + (fade->end_alpha - fade->start_alpha) * current);
+}
+
 static int32_t
 is_transition_fade_view_func(struct fade_view_data *data,
 			     struct ivi_layout_surface *view)
@@ -540,6 +595,9 @@ create_visibility_transition(struct ivi_layout_surface *surface,
 		destroy_func,
 		duration);
 
+	if (transition)
+		transition->direct_frame_func = fade_view_direct_frame;
+
 	if (transition && layout_transition_register(transition))
 		return;
 	layout_transition_destroy(transition);
@@ -68,6 +68,7 @@
 #include "ivi-layout-private.h"
 #include "ivi-layout-shell.h"
 
+#include "shared/hash.h"
 #include "shared/helpers.h"
 #include "shared/os-compatibility.h"
 #include "shared/xalloc.h"
@@ -92,12 +93,30 @@ struct ivi_layout_screen {
 	} order;
 };
 
-struct ivi_rectangle
-{
-	int32_t x;
-	int32_t y;
-	int32_t width;
-	int32_t height;
+enum ivi_layout_transaction_op_type {
+	TRANSACTION_SCREEN_RENDER_ORDER,
+	TRANSACTION_LAYER_RENDER_ORDER,
+	TRANSACTION_LAYER_VISIBILITY,
+	TRANSACTION_LAYER_DESTINATION_RECTANGLE,
+	TRANSACTION_SURFACE_VISIBILITY,
+	TRANSACTION_SURFACE_DESTINATION_RECTANGLE,
+};
+
+struct ivi_layout_transaction_op {
+	struct wl_list link;	/* ivi_layout_transaction::op_list */
+	enum ivi_layout_transaction_op_type type;
+
+	/* weston_output, ivi_layout_layer or ivi_layout_surface */
+	void *target;
+
+	struct wl_array order;	/* layers or surfaces of a render order */
+	bool visibility;
+	struct ivi_rectangle rect;
+};
+
+struct ivi_layout_transaction {
+	struct wl_list link;	/* ivi_layout::transaction_list */
+	struct wl_list op_list;	/* ivi_layout_transaction_op::link */
 };
 
 static struct ivi_layout ivilayout = {0};
@@ -112,31 +131,18 @@ get_instance(void)
  * Internal API to add/remove an ivi_layer to/from ivi_screen.
  */
 static struct ivi_layout_surface *
-get_surface(struct wl_list *surf_list, uint32_t id_surface)
+get_surface(struct ivi_layout *layout, uint32_t id_surface)
 {
-	struct ivi_layout_surface *ivisurf;
-
-	wl_list_for_each(ivisurf, surf_list, link) {
-		if (ivisurf->id_surface == id_surface) {
-			return ivisurf;
-		}
-	}
+	if (id_surface == IVI_INVALID_ID)
+		return NULL;
 
-	return NULL;
+	return hash_table_lookup(layout->surface_ids, id_surface);
 }
 
 static struct ivi_layout_layer *
-get_layer(struct wl_list *layer_list, uint32_t id_layer)
+get_layer(struct ivi_layout *layout, uint32_t id_layer)
 {
-	struct ivi_layout_layer *ivilayer;
-
-	wl_list_for_each(ivilayer, layer_list, link) {
-		if (ivilayer->id_layer == id_layer) {
-			return ivilayer;
-		}
-	}
-
-	return NULL;
+	return hash_table_lookup(layout->layer_ids, id_layer);
 }
 
 static bool
@@ -230,6 +236,38 @@ get_screen_from_output(struct weston_output *output)
 	return NULL;
 }
 
+/*
+ * Drop everything a transaction staged for an object that goes away,
+ * be it the target of a change or an entry of a render order.
+ */
+static void
+transactions_forget(struct ivi_layout *layout, void *object)
+{
+	struct ivi_layout_transaction *transaction;
+	struct ivi_layout_transaction_op *op, *next;
+	void **entries;
+	size_t count, i, j;
+
+	wl_list_for_each(transaction, &layout->transaction_list, link) {
+		wl_list_for_each_safe(op, next, &transaction->op_list, link) {
+			if (op->target == object) {
+				wl_list_remove(&op->link);
+				wl_array_release(&op->order);
+				free(op);
+				continue;
+			}
+
+			entries = op->order.data;
+			count = op->order.size / sizeof *entries;
+			for (i = 0, j = 0; i < count; i++) {
+				if (entries[i] != object)
+					entries[j++] = entries[i];
+			}
+			op->order.size = j * sizeof *entries;
+		}
+	}
+}
+
 /**
  * Called at destruction of wl_surface/ivi_surface
  */
@@ -245,6 +283,8 @@ ivi_layout_surface_destroy(struct ivi_layout_surface *ivisurf)
 	}
 
 	wl_list_remove(&ivisurf->link);
+	if (ivisurf->id_surface != IVI_INVALID_ID)
+		hash_table_remove(layout->surface_ids, ivisurf->id_surface);
 
 	wl_list_for_each_safe(ivi_view, next, &ivisurf->view_list, surf_link) {
 		ivi_view_destroy(ivi_view);
@@ -253,6 +293,7 @@ ivi_layout_surface_destroy(struct ivi_layout_surface *ivisurf)
 	wl_signal_emit(&layout->surface_notification.removed, ivisurf);
 
 	ivi_layout_remove_all_surface_transitions(ivisurf);
+	transactions_forget(layout, ivisurf);
 
 	free(ivisurf);
 }
@@ -292,6 +333,7 @@ output_destroyed_event(struct wl_listener *listener, void *data)
 	iviscrn = get_screen_from_output(destroyed_output);
 	assert(iviscrn != NULL);
 	destroy_screen(iviscrn);
+	transactions_forget(get_instance(), destroyed_output);
 
 }
 
@@ -522,11 +564,10 @@ static void
 calc_surface_to_global_matrix_and_mask_to_weston_surface(
 	struct ivi_layout_screen  *iviscrn,
 	struct ivi_layout_layer *ivilayer,
-	struct ivi_layout_surface *ivisurf,
+	const struct ivi_layout_surface_properties *sp,
 	struct weston_matrix *m,
 	struct ivi_rectangle *result)
 {
-	const struct ivi_layout_surface_properties *sp = &ivisurf->prop;
 	const struct ivi_layout_layer_properties *lp = &ivilayer->prop;
 	struct weston_output *output = iviscrn->output;
 	struct ivi_rectangle surface_source_rect = { sp->source_x,
@@ -584,13 +625,32 @@ calc_surface_to_global_matrix_and_mask_to_weston_surface(
 				      result);
 }
 
+static void
+ivi_view_set_transform(struct ivi_layout_view *ivi_view,
+		       const struct ivi_layout_surface_properties *sp)
+{
+	struct ivi_layout_layer *ivilayer = ivi_view->on_layer;
+	struct ivi_rectangle r;
+
+	weston_matrix_init(&ivi_view->transform.matrix);
+
+	calc_surface_to_global_matrix_and_mask_to_weston_surface(
+		ivilayer->on_screen, ivilayer, sp,
+		&ivi_view->transform.matrix, &r);
+
+	weston_view_set_mask(ivi_view->view, r.x, r.y, r.width, r.height);
+	weston_view_add_transform(ivi_view->view,
+				  &ivi_view->view->geometry.transformation_list,
+				  &ivi_view->transform);
+	weston_view_set_transform_parent(ivi_view->view, NULL);
+}
+
 static void
 update_prop(struct ivi_layout_view *ivi_view)
 {
 	struct ivi_layout_surface *ivisurf = ivi_view->ivisurf;
 	struct ivi_layout_layer *ivilayer = ivi_view->on_layer;
 	struct ivi_layout_screen *iviscrn = ivilayer->on_screen;
-	struct ivi_rectangle r;
 	bool can_calc = true;
 
 	/*In case of no prop change, this just returns*/
@@ -610,16 +670,31 @@ update_prop(struct ivi_layout_view *ivi_view)
 	}
 
 	if (can_calc) {
-		weston_matrix_init(&ivi_view->transform.matrix);
-
-		calc_surface_to_global_matrix_and_mask_to_weston_surface(
-			iviscrn, ivilayer, ivisurf, &ivi_view->transform.matrix, &r);
-
-		weston_view_set_mask(ivi_view->view, r.x, r.y, r.width, r.height);
-		weston_view_add_transform(ivi_view->view,
-					  &ivi_view->view->geometry.transformation_list,
-					  &ivi_view->transform);
-		weston_view_set_transform_parent(ivi_view->view, NULL);
+		const struct ivi_layout_surface_properties *sp = &ivisurf->prop;
+		const struct ivi_layout_layer_properties *lp = &ivilayer->prop;
+		struct weston_output *output = iviscrn->output;
+		struct ivi_rectangle key[IVI_VIEW_TRANSFORM_KEY_LENGTH] = {
+			{ sp->source_x, sp->source_y,
+			  sp->source_width, sp->source_height },
+			{ sp->dest_x, sp->dest_y,
+			  sp->dest_width, sp->dest_height },
+			{ lp->source_x, lp->source_y,
+			  lp->source_width, lp->source_height },
+			{ lp->dest_x, lp->dest_y,
+			  lp->dest_width, lp->dest_height },
+			{ output->pos.c.x, output->pos.c.y,
+			  output->width, output->height },
+		};
+
+		/* Opacity or visibility changes leave the geometry alone,
+		 * and so does a commit of a layer the view merely sits in. */
+		if (!ivi_view->transform_valid ||
+		    memcmp(key, ivi_view->transform_key, sizeof key) != 0) {
+			ivi_view_set_transform(ivi_view, sp);
+
+			memcpy(ivi_view->transform_key, key, sizeof key);
+			ivi_view->transform_valid = true;
+		}
 	}
 
 	ivisurf->update_count++;
@@ -634,6 +709,58 @@ ivi_view_is_mapped(struct ivi_layout_view *ivi_view)
 		ivi_view->ivisurf->prop.visibility);
 }
 
+/*
+ * Show an in-between opacity of a surface transition on its views,
+ * without going through the pending properties and a layout commit.
+ */
+void
+ivi_layout_surface_apply_opacity(struct ivi_layout_surface *ivisurf,
+				 double opacity)
+{
+	struct ivi_layout_view *ivi_view;
+	double layer_alpha;
+
+	wl_list_for_each(ivi_view, &ivisurf->view_list, surf_link) {
+		if (!ivi_view_is_mapped(ivi_view))
+			continue;
+
+		layer_alpha = wl_fixed_to_double(ivi_view->on_layer->prop.opacity);
+		weston_view_set_alpha(ivi_view->view, layer_alpha * opacity);
+	}
+}
+
+/*
+ * Show an in-between destination rectangle of a surface transition on
+ * its views, without going through the pending properties and a layout
+ * commit.
+ */
+void
+ivi_layout_surface_apply_destination_rectangle(struct ivi_layout_surface *ivisurf,
+					       int32_t x, int32_t y,
+					       int32_t width, int32_t height)
+{
+	struct ivi_layout_surface_properties prop = ivisurf->prop;
+	struct ivi_layout_view *ivi_view;
+
+	if (prop.source_width == 0 || prop.source_height == 0 ||
+	    width == 0 || height == 0)
+		return;
+
+	prop.dest_x = x;
+	prop.dest_y = y;
+	prop.dest_width = width;
+	prop.dest_height = height;
+
+	wl_list_for_each(ivi_view, &ivisurf->view_list, surf_link) {
+		if (!ivi_view_is_mapped(ivi_view))
+			continue;
+
+		ivi_view_set_transform(ivi_view, &prop);
+		/* The committed properties no longer match. */
+		ivi_view->transform_valid = false;
+	}
+}
+
 static void
 commit_changes(struct ivi_layout *layout)
 {
@@ -753,6 +880,57 @@ commit_surface_list(struct ivi_layout *layout)
 	}
 }
 
+/*
+ * The render order setters fill the pending lists front to back and the
+ * commit below reverses them into the order lists, so a pending list
+ * that matches its order list read backwards restates the current order.
+ */
+static bool
+layer_order_unchanged(struct ivi_layout_layer *ivilayer)
+{
+	struct wl_list *pending = ivilayer->pending.view_list.next;
+	struct wl_list *order = ivilayer->order.view_list.prev;
+	struct ivi_layout_view *pending_view, *order_view;
+
+	while (pending != &ivilayer->pending.view_list &&
+	       order != &ivilayer->order.view_list) {
+		pending_view = wl_container_of(pending, pending_view,
+					       pending_link);
+		order_view = wl_container_of(order, order_view, order_link);
+		if (pending_view != order_view)
+			return false;
+
+		pending = pending->next;
+		order = order->prev;
+	}
+
+	return pending == &ivilayer->pending.view_list &&
+	       order == &ivilayer->order.view_list;
+}
+
+static bool
+screen_order_unchanged(struct ivi_layout_screen *iviscrn)
+{
+	struct wl_list *pending = iviscrn->pending.layer_list.next;
+	struct wl_list *order = iviscrn->order.layer_list.prev;
+	struct ivi_layout_layer *pending_layer, *order_layer;
+
+	while (pending != &iviscrn->pending.layer_list &&
+	       order != &iviscrn->order.layer_list) {
+		pending_layer = wl_container_of(pending, pending_layer,
+						pending.link);
+		order_layer = wl_container_of(order, order_layer, order.link);
+		if (pending_layer != order_layer)
+			return false;
+
+		pending = pending->next;
+		order = order->prev;
+	}
+
+	return pending == &iviscrn->pending.layer_list &&
+	       order == &iviscrn->order.layer_list;
+}
+
 static void
 commit_layer_list(struct ivi_layout *layout)
 {
@@ -777,6 +955,13 @@ commit_layer_list(struct ivi_layout *layout)
 			continue;
 		}
 
+		/* Do not flag the views of a layer whose order was only
+		 * restated, that would update all of them. */
+		if (layer_order_unchanged(ivilayer)) {
+			ivilayer->order.dirty = 0;
+			continue;
+		}
+
 		wl_list_for_each_safe(ivi_view, next, &ivilayer->order.view_list,
 					 order_link) {
 			wl_list_remove(&ivi_view->order_link);
@@ -805,6 +990,9 @@ commit_screen_list(struct ivi_layout *layout)
 	struct ivi_layout_layer   *next     = NULL;
 
 	wl_list_for_each(iviscrn, &layout->screen_list, link) {
+		if (iviscrn->order.dirty && screen_order_unchanged(iviscrn))
+			iviscrn->order.dirty = 0;
+
 		if (iviscrn->order.dirty) {
 			wl_list_for_each_safe(ivilayer, next,
 					      &iviscrn->order.layer_list, order.link) {
@@ -832,34 +1020,48 @@ commit_screen_list(struct ivi_layout *layout)
 	}
 }
 
+static void
+ivi_view_hide(struct ivi_layout_view *ivi_view)
+{
+	if (ivi_view->view->layer_link.layer)
+		weston_view_move_to_layer(ivi_view->view, NULL);
+}
+
 static void
 build_view_list(struct ivi_layout *layout)
 {
 	struct ivi_layout_screen  *iviscrn;
 	struct ivi_layout_layer   *ivilayer;
 	struct ivi_layout_view   *ivi_view;
+	struct weston_layer_entry *pos;
 
 	/* If ivi_view is not part of the scenegrapgh, we have to unmap
 	 * weston_views
 	 */
 	wl_list_for_each(ivi_view, &layout->view_list, link) {
 		if (!ivi_view_is_mapped(ivi_view))
-			weston_view_move_to_layer(ivi_view->view, NULL);
+			ivi_view_hide(ivi_view);
 	}
 
-	wl_list_for_each(iviscrn, &layout->screen_list, link) {
-		wl_list_for_each(ivilayer, &iviscrn->order.layer_list, order.link) {
-			wl_list_for_each(ivi_view, &ivilayer->order.view_list, order_link) {
+	/*
+	 * Walk the scenegraph from the top and only move the views that
+	 * are not already right below the previous one. Restacking every
+	 * view would damage all of them on every commit.
+	 */
+	pos = &layout->layout_layer.view_list;
+	wl_list_for_each_reverse(iviscrn, &layout->screen_list, link) {
+		wl_list_for_each_reverse(ivilayer, &iviscrn->order.layer_list, order.link) {
+			wl_list_for_each_reverse(ivi_view, &ivilayer->order.view_list, order_link) {
 				if (ivilayer->prop.visibility == false ||
 				    ivi_view->ivisurf->prop.visibility == false) {
-					weston_view_move_to_layer(ivi_view->view,
-								  NULL);
+					ivi_view_hide(ivi_view);
 					continue;
 				}
 
 				weston_surface_map(ivi_view->ivisurf->surface);
-				weston_view_move_to_layer(ivi_view->view,
-							  &layout->layout_layer.view_list);
+				if (pos->link.next != &ivi_view->view->layer_link.link)
+					weston_view_move_to_layer(ivi_view->view, pos);
+				pos = &ivi_view->view->layer_link;
 			}
 		}
 	}
@@ -1019,31 +1221,13 @@ ivi_layout_get_id_of_layer(struct ivi_layout_layer *ivilayer)
 static struct ivi_layout_layer *
 ivi_layout_get_layer_from_id(uint32_t id_layer)
 {
-	struct ivi_layout *layout = get_instance();
-	struct ivi_layout_layer *ivilayer = NULL;
-
-	wl_list_for_each(ivilayer, &layout->layer_list, link) {
-		if (ivilayer->id_layer == id_layer) {
-			return ivilayer;
-		}
-	}
-
-	return NULL;
+	return get_layer(get_instance(), id_layer);
 }
 
 struct ivi_layout_surface *
 ivi_layout_get_surface_from_id(uint32_t id_surface)
 {
-	struct ivi_layout *layout = get_instance();
-	struct ivi_layout_surface *ivisurf = NULL;
-
-	wl_list_for_each(ivisurf, &layout->surface_list, link) {
-		if (ivisurf->id_surface == id_surface) {
-			return ivisurf;
-		}
-	}
-
-	return NULL;
+	return get_surface(get_instance(), id_surface);
 }
 
 static void
@@ -1235,7 +1419,7 @@ ivi_layout_layer_create_with_dimension(uint32_t id_layer,
 	struct ivi_layout *layout = get_instance();
 	struct ivi_layout_layer *ivilayer = NULL;
 
-	ivilayer = get_layer(&layout->layer_list, id_layer);
+	ivilayer = get_layer(layout, id_layer);
 	if (ivilayer != NULL) {
 		weston_log("id_layer is already created\n");
 		++ivilayer->ref_count;
@@ -1244,6 +1428,12 @@ ivi_layout_layer_create_with_dimension(uint32_t id_layer,
 
 	ivilayer = xzalloc(sizeof *ivilayer);
 
+	if (hash_table_insert(layout->layer_ids, id_layer, ivilayer) < 0) {
+		weston_log("could not index layer %u\n", id_layer);
+		free(ivilayer);
+		return NULL;
+	}
+
 	ivilayer->ref_count = 1;
 	wl_signal_init(&ivilayer->property_changed);
 	ivilayer->layout = layout;
@@ -1287,6 +1477,8 @@ ivi_layout_layer_destroy(struct ivi_layout_layer *ivilayer)
 	wl_list_remove(&ivilayer->pending.link);
 	wl_list_remove(&ivilayer->order.link);
 	wl_list_remove(&ivilayer->link);
+	hash_table_remove(layout->layer_ids, ivilayer->id_layer);
+	transactions_forget(layout, ivilayer);
 
 	free(ivilayer);
 }
@@ -1706,6 +1898,233 @@ ivi_layout_commit_current(void)
 	return IVI_SUCCEEDED;
 }
 
+static struct ivi_layout_transaction *
+ivi_layout_transaction_create(void)
+{
+	struct ivi_layout *layout = get_instance();
+	struct ivi_layout_transaction *transaction;
+
+	transaction = xzalloc(sizeof *transaction);
+	wl_list_init(&transaction->op_list);
+	wl_list_insert(&layout->transaction_list, &transaction->link);
+
+	return transaction;
+}
+
+static void
+ivi_layout_transaction_destroy(struct ivi_layout_transaction *transaction)
+{
+	struct ivi_layout_transaction_op *op, *next;
+
+	assert(transaction);
+
+	wl_list_for_each_safe(op, next, &transaction->op_list, link) {
+		wl_list_remove(&op->link);
+		wl_array_release(&op->order);
+		free(op);
+	}
+
+	wl_list_remove(&transaction->link);
+	free(transaction);
+}
+
+/*
+ * Staging the same change for the same object again replaces it, like
+ * calling a setter twice before a commit.
+ */
+static struct ivi_layout_transaction_op *
+transaction_get_op(struct ivi_layout_transaction *transaction,
+		   enum ivi_layout_transaction_op_type type, void *target)
+{
+	struct ivi_layout_transaction_op *op;
+
+	wl_list_for_each(op, &transaction->op_list, link) {
+		if (op->type == type && op->target == target)
+			return op;
+	}
+
+	op = xzalloc(sizeof *op);
+	op->type = type;
+	op->target = target;
+	wl_array_init(&op->order);
+	wl_list_insert(transaction->op_list.prev, &op->link);
+
+	return op;
+}
+
+static void
+transaction_op_set_order(struct ivi_layout_transaction_op *op,
+			 void **entries, int32_t number)
+{
+	size_t size = number * sizeof *entries;
+
+	op->order.size = 0;
+	if (number > 0)
+		memcpy(abort_oom_if_null(wl_array_add(&op->order, size)),
+		       entries, size);
+}
+
+static int32_t
+ivi_layout_transaction_screen_set_render_order(struct ivi_layout_transaction *transaction,
+					       struct weston_output *output,
+					       struct ivi_layout_layer **pLayer,
+					       int32_t number)
+{
+	struct ivi_layout_transaction_op *op;
+
+	assert(transaction);
+	assert(output);
+
+	if (!get_screen_from_output(output)) {
+		weston_log("%s: output is not managed by ivi-layout\n",
+			   __func__);
+		return IVI_FAILED;
+	}
+
+	op = transaction_get_op(transaction,
+				TRANSACTION_SCREEN_RENDER_ORDER, output);
+	transaction_op_set_order(op, (void **)pLayer, number);
+
+	return IVI_SUCCEEDED;
+}
+
+static void
+ivi_layout_transaction_layer_set_render_order(struct ivi_layout_transaction *transaction,
+					      struct ivi_layout_layer *ivilayer,
+					      struct ivi_layout_surface **pSurface,
+					      int32_t number)
+{
+	struct ivi_layout_transaction_op *op;
+
+	assert(transaction);
+	assert(ivilayer);
+
+	op = transaction_get_op(transaction,
+				TRANSACTION_LAYER_RENDER_ORDER, ivilayer);
+	transaction_op_set_order(op, (void **)pSurface, number);
+}
+
+static void
+ivi_layout_transaction_layer_set_visibility(struct ivi_layout_transaction *transaction,
+					    struct ivi_layout_layer *ivilayer,
+					    bool newVisibility)
+{
+	struct ivi_layout_transaction_op *op;
+
+	assert(transaction);
+	assert(ivilayer);
+
+	op = transaction_get_op(transaction,
+				TRANSACTION_LAYER_VISIBILITY, ivilayer);
+	op->visibility = newVisibility;
+}
+
+static void
+ivi_layout_transaction_layer_set_destination_rectangle(struct ivi_layout_transaction *transaction,
+						       struct ivi_layout_layer *ivilayer,
+						       int32_t x, int32_t y,
+						       int32_t width, int32_t height)
+{
+	struct ivi_layout_transaction_op *op;
+
+	assert(transaction);
+	assert(ivilayer);
+
+	op = transaction_get_op(transaction,
+				TRANSACTION_LAYER_DESTINATION_RECTANGLE,
+				ivilayer);
+	op->rect = (struct ivi_rectangle) { x, y, width, height };
+}
+
+static void
+ivi_layout_transaction_surface_set_visibility(struct ivi_layout_transaction *transaction,
+					      struct ivi_layout_surface *ivisurf,
+					      bool newVisibility)
+{
+	struct ivi_layout_transaction_op *op;
+
+	assert(transaction);
+	assert(ivisurf);
+
+	op = transaction_get_op(transaction,
+				TRANSACTION_SURFACE_VISIBILITY, ivisurf);
+	op->visibility = newVisibility;
+}
+
+static void
+ivi_layout_transaction_surface_set_destination_rectangle(struct ivi_layout_transaction *transaction,
+							 struct ivi_layout_surface *ivisurf,
+							 int32_t x, int32_t y,
+							 int32_t width, int32_t height)
+{
+	struct ivi_layout_transaction_op *op;
+
+	assert(transaction);
+	assert(ivisurf);
+
+	op = transaction_get_op(transaction,
+				TRANSACTION_SURFACE_DESTINATION_RECTANGLE,
+				ivisurf);
+	op->rect = (struct ivi_rectangle) { x, y, width, height };
+}
+
+/*
+ * Move the staged changes into the pending state and commit once, so
+ * that all screens change in the same repaint. Screens and layers whose
+ * order is restated unchanged are left alone by the commit.
+ */
+static int32_t
+ivi_layout_transaction_commit(struct ivi_layout_transaction *transaction)
+{
+	struct ivi_layout_transaction_op *op;
+	int32_t number;
+
+	assert(transaction);
+
+	wl_list_for_each(op, &transaction->op_list, link) {
+		number = op->order.size / sizeof(void *);
+
+		switch (op->type) {
+		case TRANSACTION_SCREEN_RENDER_ORDER:
+			ivi_layout_screen_set_render_order(op->target,
+							   op->order.data,
+							   number);
+			break;
+		case TRANSACTION_LAYER_RENDER_ORDER:
+			ivi_layout_layer_set_render_order(op->target,
+							  op->order.data,
+							  number);
+			break;
+		case TRANSACTION_LAYER_VISIBILITY:
+			ivi_layout_layer_set_visibility(op->target,
+							op->visibility);
+			break;
+		case TRANSACTION_LAYER_DESTINATION_RECTANGLE:
+			ivi_layout_layer_set_destination_rectangle(op->target,
+								   op->rect.x,
+								   op->rect.y,
+								   op->rect.width,
+								   op->rect.height);
+			break;
+		case TRANSACTION_SURFACE_VISIBILITY:
+			ivi_layout_surface_set_visibility(op->target,
+							  op->visibility);
+			break;
+		case TRANSACTION_SURFACE_DESTINATION_RECTANGLE:
+			ivi_layout_surface_set_destination_rectangle(op->target,
+								     op->rect.x,
+								     op->rect.y,
+								     op->rect.width,
+								     op->rect.height);
+			break;
+		}
+	}
+
+	ivi_layout_transaction_destroy(transaction);
+
+	return ivi_layout_commit_changes();
+}
+
 static void
 ivi_layout_layer_set_transition(struct ivi_layout_layer *ivilayer,
 				enum ivi_layout_transition_type type,
@@ -1761,12 +2180,18 @@ ivi_layout_surface_set_id(struct ivi_layout_surface *ivisurf,
 		return IVI_FAILED;
 	}
 
-	search_ivisurf = get_surface(&layout->surface_list, id_surface);
+	search_ivisurf = get_surface(layout, id_surface);
 	if (search_ivisurf) {
 		weston_log("id_surface(%d) is already created\n", id_surface);
 		return IVI_FAILED;
 	}
 
+	if (id_surface != IVI_INVALID_ID &&
+	    hash_table_insert(layout->surface_ids, id_surface, ivisurf) < 0) {
+		weston_log("could not index surface %u\n", id_surface);
+		return IVI_FAILED;
+	}
+
 	ivisurf->id_surface = id_surface;
 
 	wl_signal_emit(&layout->surface_notification.configure_changed,
@@ -1879,6 +2304,13 @@ surface_create(struct weston_surface *wl_surface, uint32_t id_surface,
 
 	ivisurf = xzalloc(sizeof *ivisurf);
 
+	if (id_surface != IVI_INVALID_ID &&
+	    hash_table_insert(layout->surface_ids, id_surface, ivisurf) < 0) {
+		weston_log("could not index surface %u\n", id_surface);
+		free(ivisurf);
+		return NULL;
+	}
+
 	wl_signal_init(&ivisurf->property_changed);
 	ivisurf->id_surface = id_surface;
 	ivisurf->layout = layout;
@@ -2068,7 +2500,7 @@ ivi_layout_surface_create(struct weston_surface *wl_surface,
 	struct ivi_layout *layout = get_instance();
 	struct ivi_layout_surface *ivisurf = NULL;
 
-	ivisurf = get_surface(&layout->surface_list, id_surface);
+	ivisurf = get_surface(layout, id_surface);
 	if (ivisurf) {
 		weston_log("id_surface(%d) is already created\n", id_surface);
 		return NULL;
@@ -2104,7 +2536,10 @@ ivi_layout_init(struct weston_compositor *ec, struct ivi_shell *shell)
 	wl_list_init(&layout->surface_list);
 	wl_list_init(&layout->layer_list);
 	wl_list_init(&layout->screen_list);
+	layout->surface_ids = abort_oom_if_null(hash_table_create());
+	layout->layer_ids = abort_oom_if_null(hash_table_create());
 	wl_list_init(&layout->view_list);
+	wl_list_init(&layout->transaction_list);
 
 	wl_signal_init(&layout->layer_notification.created);
 	wl_signal_init(&layout->layer_notification.removed);
@@ -2152,6 +2587,9 @@ ivi_layout_fini(void)
 	/* XXX: tear down everything else */
 	wl_list_remove(&layout->output_created.link);
 	wl_list_remove(&layout->output_destroyed.link);
+
+	hash_table_destroy(layout->surface_ids);
+	hash_table_destroy(layout->layer_ids);
 }
 
 static struct ivi_layout_interface ivi_layout_interface = {
@@ -2241,4 +2679,17 @@ static struct ivi_layout_interface ivi_layout_interface = {
 	.add_listener_show_input_panel			= ivi_layout_add_listener_show_input_panel,
 	.add_listener_hide_input_panel			= ivi_layout_add_listener_hide_input_panel,
 	.add_listener_update_input_panel		= ivi_layout_add_listener_update_input_panel,
+
+	/**
+	 * transactions
+	 */
+	.transaction_create		= ivi_layout_transaction_create,
+	.transaction_destroy		= ivi_layout_transaction_destroy,
+	.transaction_commit		= ivi_layout_transaction_commit,
+	.transaction_screen_set_render_order	= ivi_layout_transaction_screen_set_render_order,
+	.transaction_layer_set_render_order	= ivi_layout_transaction_layer_set_render_order,
+	.transaction_layer_set_visibility	= ivi_layout_transaction_layer_set_visibility,
+	.transaction_layer_set_destination_rectangle	= ivi_layout_transaction_layer_set_destination_rectangle,
+	.transaction_surface_set_visibility	= ivi_layout_transaction_surface_set_visibility,
+	.transaction_surface_set_destination_rectangle	= ivi_layout_transaction_surface_set_destination_rectangle,
 };
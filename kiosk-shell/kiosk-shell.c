@@ -453,12 +453,52 @@ kiosk_shell_surface_reconfigure_for_output(struct kiosk_shell_surface *shsurf)
 	weston_view_update_transform(shsurf->view);
 }
 
+/* Surfaces get the frame rate cap of their application, from the
+ * application section with its app_id, or the background one while they
+ * don't have keyboard focus, whichever is lower. */
+static void
+kiosk_shell_surface_update_frame_rate(struct kiosk_shell_surface *shsurf)
+{
+	struct kiosk_shell *shell = shsurf->shell;
+	struct weston_desktop_surface *dsurface = shsurf->desktop_surface;
+	struct weston_config_section *section = NULL;
+	const char *app_id = weston_desktop_surface_get_app_id(dsurface);
+	uint32_t frame_rate;
+
+	if (app_id)
+		section = weston_config_get_section(shell->config, "application",
+						    "app-id", app_id);
+	weston_config_section_get_uint(section, "frame-rate", &frame_rate, 0);
+
+	if (shsurf->focus_count == 0 && shell->background_frame_rate > 0 &&
+	    (frame_rate == 0 || shell->background_frame_rate < frame_rate))
+		frame_rate = shell->background_frame_rate;
+
+	weston_surface_set_frame_rate_limit(weston_desktop_surface_get_surface(dsurface),
+					    frame_rate);
+}
+
+static void
+kiosk_shell_surface_notify_metadata(struct wl_listener *listener, void *data)
+{
+	struct kiosk_shell_surface *shsurf =
+		container_of(listener, struct kiosk_shell_surface,
+			     metadata_listener);
+
+	/* the app_id may have changed */
+	kiosk_shell_surface_update_frame_rate(shsurf);
+}
+
 static void
 kiosk_shell_surface_destroy(struct kiosk_shell_surface *shsurf)
 {
 	wl_signal_emit(&shsurf->destroy_signal, shsurf);
 	wl_list_remove(&shsurf->surface_tree_link);
 
+	wl_list_remove(&shsurf->metadata_listener.link);
+	weston_surface_set_frame_rate_limit(weston_desktop_surface_get_surface(shsurf->desktop_surface),
+					    0);
+
 	weston_desktop_surface_set_user_data(shsurf->desktop_surface, NULL);
 	shsurf->desktop_surface = NULL;
 
@@ -519,6 +559,11 @@ kiosk_shell_surface_create(struct kiosk_shell *shell,
 	wl_list_init(&shsurf->surface_tree_link);
 	wl_list_insert(&shsurf->surface_tree_list, &shsurf->surface_tree_link);
 
+	shsurf->metadata_listener.notify = kiosk_shell_surface_notify_metadata;
+	weston_desktop_surface_add_metadata_listener(desktop_surface,
+						     &shsurf->metadata_listener);
+	kiosk_shell_surface_update_frame_rate(shsurf);
+
 	return shsurf;
 }
 
@@ -544,14 +589,22 @@ kiosk_shell_surface_activate(struct kiosk_shell_surface *shsurf,
 		assert(current_focus);
 
 		dsurface_focus = current_focus->desktop_surface;
-		if (--current_focus->focus_count == 0)
+		if (--current_focus->focus_count == 0) {
 			weston_desktop_surface_set_activated(dsurface_focus, false);
+			kiosk_shell_surface_update_frame_rate(current_focus);
+		}
 	}
 
 	/* xdg-shell activation for the new one */
 	kiosk_seat->focused_surface = surface;
-	if (shsurf->focus_count++ == 0)
+	if (shsurf->focus_count++ == 0) {
 		weston_desktop_surface_set_activated(dsurface, true);
+		kiosk_shell_surface_update_frame_rate(shsurf);
+	}
+
+	/* get the renderer ready before the view comes to the top, so that
+	 * switching apps does not stall on buffer import or shader builds */
+	weston_view_prewarm(shsurf->view, shsurf->output);
 
 	/* raise the focused subtree to the top of the visible layer */
 	kiosk_shell_output_raise_surface_subtree(shoutput, shsurf);
@@ -1045,6 +1098,7 @@ desktop_surface_committed(struct weston_desktop_surface *desktop_surface,
 						      shsurf->output);
 		struct kiosk_shell_seat *kiosk_seat;
 
+		weston_view_prewarm(shsurf->view, shsurf->output);
 		weston_surface_map(surface);
 
 		kiosk_seat = get_kiosk_shell_seat(seat);
@@ -1478,6 +1532,7 @@ wet_shell_init(struct weston_compositor *ec,
 	struct kiosk_shell *shell;
 	struct weston_seat *seat;
 	struct weston_output *output;
+	struct weston_config_section *section;
 	const char *config_file;
 
 	shell = zalloc(sizeof *shell);
@@ -1498,6 +1553,9 @@ wet_shell_init(struct weston_compositor *ec,
 
 	config_file = weston_config_get_name_from_env();
 	shell->config = weston_config_parse(config_file);
+	section = weston_config_get_section(shell->config, "shell", NULL, NULL);
+	weston_config_section_get_uint(section, "background-frame-rate",
+				       &shell->background_frame_rate, 0);
 
 	weston_layer_init(&shell->background_layer, ec);
 	weston_layer_init(&shell->normal_layer, ec);
@@ -49,6 +49,8 @@ struct kiosk_shell {
 	const struct weston_xwayland_surface_api *xwayland_surface_api;
 	struct weston_config *config;
 	struct wl_listener session_listener;
+
+	uint32_t background_frame_rate;
 };
 
 struct kiosk_shell_surface {
@@ -70,6 +72,7 @@ struct kiosk_shell_surface {
 	struct wl_list surface_tree_link;
 
 	int focus_count;
+	struct wl_listener metadata_listener;
 
 	int32_t last_width, last_height;
 	bool grabbed;
@@ -223,7 +223,7 @@ weston_view_animation_frame(struct weston_animation *base,
 	 * the animation stops running. Therefore if we catch this situation
 	 * and schedule a repaint on all outputs it will be avoided.
 	 */
-	if (animation->view->output_mask == 0)
+	if (weston_output_mask_is_empty(&animation->view->output_mask))
 		weston_compositor_schedule_repaint(compositor);
 }
 
@@ -0,0 +1,494 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include <libweston/libweston.h>
+#include "drm-internal.h"
+#include "pixel-formats.h"
+#include "shared/helpers.h"
+#include "shared/string-helpers.h"
+#include "shared/xalloc.h"
+
+/**
+ * On fixed hardware, every start ends up with the same CRTCs driving the
+ * same connectors in the same modes, yet the first frame of each output
+ * still goes through the TEST_ONLY commits of drm_assign_planes(), each
+ * carrying the full modeset. With the output-cache option, the backend
+ * writes down the configuration of the primary device after every modeset
+ * the kernel took, along with a fingerprint of the hardware: the driver,
+ * the connectors and the EDID of what is plugged into them, and the planes
+ * with their formats.
+ *
+ * When the fingerprint still matches at the next start, outputs get the
+ * CRTC they had, and an output enabled in the mode and format it had gets
+ * its first frame committed renderer-only without testing. The commit
+ * itself is the check: if the kernel refuses it, the cache is dropped and
+ * the repaint is redone the usual way.
+ *
+ * The connectors and planes are still read from the kernel, since the
+ * fingerprint needs them and their property IDs are only valid for the
+ * running kernel.
+ */
+
+#define CONFIG_CACHE_MAGIC "weston-drm-output-cache 1"
+
+struct drm_config_cache_entry {
+	char heads[128];
+	uint32_t crtc_id;
+	uint32_t width;
+	uint32_t height;
+	uint32_t refresh;
+	uint32_t flags;
+	uint32_t format;
+};
+
+struct drm_config_cache {
+	char *path;
+	uint64_t fingerprint;
+
+	/* The entries describe the hardware as it is now, and no modeset
+	 * has been committed since they were read. */
+	bool warm;
+
+	/* The file holds the entries */
+	bool written;
+
+	struct wl_array entries; /* struct drm_config_cache_entry */
+};
+
+static uint64_t
+fingerprint_add(uint64_t hash, const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+#define FINGERPRINT_ADD(hash, value) \
+	do { \
+		__typeof__(value) fingerprint_tmp_ = (value); \
+		hash = fingerprint_add(hash, &fingerprint_tmp_, \
+				       sizeof(fingerprint_tmp_)); \
+	} while (0)
+
+static uint64_t
+drm_config_cache_fingerprint(struct drm_device *device)
+{
+	struct weston_compositor *compositor = device->backend->compositor;
+	struct weston_head *base;
+	struct drm_head *head;
+	struct drm_plane *plane;
+	drmVersion *version;
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	version = drmGetVersion(device->drm.fd);
+	if (version) {
+		hash = fingerprint_add(hash, version->name, version->name_len);
+		drmFreeVersion(version);
+	}
+
+	wl_list_for_each(base, &compositor->head_list, compositor_link) {
+		head = to_drm_head(base);
+		if (!head || head->connector.device != device)
+			continue;
+
+		FINGERPRINT_ADD(hash, head->connector.connector_id);
+		FINGERPRINT_ADD(hash, weston_head_is_connected(base));
+		hash = fingerprint_add(hash, head->display_data,
+				       head->display_data_len);
+	}
+
+	wl_list_for_each(plane, &device->plane_list, link) {
+		FINGERPRINT_ADD(hash, plane->plane_id);
+		FINGERPRINT_ADD(hash, plane->type);
+		FINGERPRINT_ADD(hash, plane->possible_crtcs);
+		FINGERPRINT_ADD(hash,
+				weston_drm_format_array_count_pairs(&plane->formats));
+	}
+
+	return hash;
+}
+
+/* Names of the heads of the output, separated by commas. Returns false if
+ * they do not fit. */
+static bool
+drm_output_get_head_names(struct drm_output *output, char *buf, size_t size)
+{
+	struct weston_head *head;
+	size_t len = 0;
+	int ret;
+
+	buf[0] = '\0';
+	wl_list_for_each(head, &output->base.head_list, output_link) {
+		ret = snprintf(buf + len, size - len, "%s%s",
+			       len > 0 ? "," : "", head->name);
+		if (ret < 0 || (size_t) ret >= size - len)
+			return false;
+		len += ret;
+	}
+
+	return len > 0;
+}
+
+static struct drm_config_cache_entry *
+drm_config_cache_find(struct drm_output *output)
+{
+	struct drm_config_cache *cache = output->backend->config_cache;
+	struct drm_config_cache_entry *entry;
+	char heads[sizeof entry->heads];
+
+	if (!cache || !cache->warm || output->device != output->backend->drm)
+		return NULL;
+
+	if (!drm_output_get_head_names(output, heads, sizeof heads))
+		return NULL;
+
+	wl_array_for_each(entry, &cache->entries) {
+		if (strcmp(entry->heads, heads) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static bool
+drm_config_cache_read(struct drm_config_cache *cache, FILE *fp)
+{
+	struct drm_config_cache_entry entry, *dst;
+	char line[256];
+	uint64_t fingerprint;
+
+	if (!fgets(line, sizeof line, fp) ||
+	    strcmp(line, CONFIG_CACHE_MAGIC "\n") != 0)
+		return false;
+
+	if (!fgets(line, sizeof line, fp) ||
+	    sscanf(line, "fingerprint %" SCNx64, &fingerprint) != 1)
+		return false;
+
+	if (fingerprint != cache->fingerprint) {
+		weston_log("DRM: hardware changed since the output cache "
+			   "was written, ignoring it\n");
+		return false;
+	}
+
+	while (fgets(line, sizeof line, fp)) {
+		memset(&entry, 0, sizeof entry);
+		if (sscanf(line, "output %" SCNu32 " %" SCNu32 " %" SCNu32
+			   " %" SCNu32 " %" SCNx32 " %" SCNx32 " %127s",
+			   &entry.crtc_id, &entry.width, &entry.height,
+			   &entry.refresh, &entry.flags, &entry.format,
+			   entry.heads) != 7)
+			return false;
+
+		dst = wl_array_add(&cache->entries, sizeof *dst);
+		if (!dst)
+			return false;
+		*dst = entry;
+	}
+
+	return true;
+}
+
+/** Read the output cache of the primary device
+ *
+ * Must be called once the heads and planes of the device exist.
+ *
+ * @param b The backend
+ * @param path The file to keep the cache in
+ */
+void
+drm_config_cache_load(struct drm_backend *b, const char *path)
+{
+	struct drm_config_cache *cache;
+	FILE *fp;
+
+	if (!b->drm->atomic_modeset) {
+		weston_log("DRM: the output cache needs atomic modesetting\n");
+		return;
+	}
+
+	cache = xzalloc(sizeof *cache);
+	cache->path = xstrdup(path);
+	cache->fingerprint = drm_config_cache_fingerprint(b->drm);
+	wl_array_init(&cache->entries);
+	b->config_cache = cache;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		if (errno != ENOENT)
+			weston_log("DRM: cannot read the output cache %s: %s\n",
+				   path, strerror(errno));
+		return;
+	}
+
+	if (drm_config_cache_read(cache, fp)) {
+		cache->warm = true;
+		cache->written = true;
+		weston_log("DRM: output cache matches the hardware, "
+			   "reusing %zu output configuration(s)\n",
+			   cache->entries.size / sizeof(struct drm_config_cache_entry));
+	} else {
+		wl_array_release(&cache->entries);
+		wl_array_init(&cache->entries);
+	}
+
+	fclose(fp);
+}
+
+void
+drm_config_cache_destroy(struct drm_backend *b)
+{
+	struct drm_config_cache *cache = b->config_cache;
+
+	if (!cache)
+		return;
+
+	wl_array_release(&cache->entries);
+	free(cache->path);
+	free(cache);
+	b->config_cache = NULL;
+}
+
+/** Get the CRTC the output had when the cache was written
+ *
+ * @param output The output to pick a CRTC for
+ * @return The CRTC, or NULL if the cache has none or it is taken.
+ */
+struct drm_crtc *
+drm_config_cache_get_crtc(struct drm_output *output)
+{
+	struct drm_config_cache_entry *entry;
+	struct drm_crtc *crtc;
+
+	entry = drm_config_cache_find(output);
+	if (!entry)
+		return NULL;
+
+	crtc = drm_crtc_find(output->device, entry->crtc_id);
+	if (!crtc || crtc->output)
+		return NULL;
+
+	return crtc;
+}
+
+/** Check an output just enabled against the cache
+ *
+ * Sets drm_output::config_cache_hit when the output got the CRTC, mode and
+ * format it had when the cache was written.
+ */
+void
+drm_config_cache_output_enabled(struct drm_output *output)
+{
+	struct drm_config_cache_entry *entry;
+	struct drm_mode *mode = to_drm_mode(output->base.current_mode);
+
+	entry = drm_config_cache_find(output);
+	output->config_cache_hit =
+		entry &&
+		entry->crtc_id == output->crtc->crtc_id &&
+		entry->width == mode->mode_info.hdisplay &&
+		entry->height == mode->mode_info.vdisplay &&
+		entry->refresh == (uint32_t) mode->base.refresh &&
+		entry->flags == mode->mode_info.flags &&
+		entry->format == output->format->format;
+
+	if (output->config_cache_hit)
+		drm_debug(output->backend, "[output-cache] %s has the cached "
+			  "configuration\n", output->base.name);
+}
+
+/* Enter the configuration of an enabled output, returns whether that
+ * changed anything. */
+static bool
+drm_config_cache_update_output(struct drm_config_cache *cache,
+			       struct drm_output *output)
+{
+	struct drm_mode *mode = to_drm_mode(output->base.current_mode);
+	struct drm_config_cache_entry entry = {
+		.crtc_id = output->crtc->crtc_id,
+		.width = mode->mode_info.hdisplay,
+		.height = mode->mode_info.vdisplay,
+		.refresh = mode->base.refresh,
+		.flags = mode->mode_info.flags,
+		.format = output->format->format,
+	};
+	struct drm_config_cache_entry *dst;
+
+	if (!drm_output_get_head_names(output, entry.heads, sizeof entry.heads))
+		return false;
+
+	wl_array_for_each(dst, &cache->entries) {
+		if (strcmp(dst->heads, entry.heads) == 0)
+			goto found;
+	}
+
+	dst = wl_array_add(&cache->entries, sizeof *dst);
+	if (!dst)
+		return false;
+	memset(dst, 0, sizeof *dst);
+
+found:
+	if (memcmp(dst, &entry, sizeof entry) == 0)
+		return false;
+
+	*dst = entry;
+	return true;
+}
+
+/* Outputs which are off keep their entries, so that shutting down or
+ * unplugging a monitor for a while does not lose what they had. */
+static void
+drm_config_cache_save(struct drm_backend *b)
+{
+	struct drm_config_cache *cache = b->config_cache;
+	struct drm_config_cache_entry *entry;
+	struct weston_output *base;
+	struct drm_output *output;
+	uint64_t fingerprint;
+	bool changed = false;
+	char *tmp;
+	FILE *fp;
+	bool ok;
+
+	/* Hotplug since startup changes the fingerprint */
+	fingerprint = drm_config_cache_fingerprint(b->drm);
+	if (fingerprint != cache->fingerprint) {
+		cache->fingerprint = fingerprint;
+		changed = true;
+	}
+
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		output = to_drm_output(base);
+		if (!output || output->device != b->drm || !output->crtc ||
+		    output->is_virtual)
+			continue;
+
+		if (drm_config_cache_update_output(cache, output))
+			changed = true;
+	}
+
+	if (!changed && cache->written)
+		return;
+
+	str_printf(&tmp, "%s.tmp", cache->path);
+	if (!tmp)
+		return;
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		weston_log("DRM: cannot write the output cache %s: %s\n",
+			   tmp, strerror(errno));
+		free(tmp);
+		return;
+	}
+
+	fprintf(fp, CONFIG_CACHE_MAGIC "\n");
+	fprintf(fp, "fingerprint %016" PRIx64 "\n", cache->fingerprint);
+	wl_array_for_each(entry, &cache->entries) {
+		fprintf(fp, "output %" PRIu32 " %" PRIu32 " %" PRIu32
+			" %" PRIu32 " %" PRIx32 " %" PRIx32 " %s\n",
+			entry->crtc_id, entry->width, entry->height,
+			entry->refresh, entry->flags, entry->format,
+			entry->heads);
+	}
+
+	ok = !ferror(fp);
+	if (fclose(fp) != 0)
+		ok = false;
+
+	/* Replace the old cache in one go, a reader never sees half */
+	if (!ok || rename(tmp, cache->path) < 0) {
+		weston_log("DRM: cannot write the output cache %s: %s\n",
+			   cache->path, strerror(errno));
+		remove(tmp);
+	} else {
+		cache->written = true;
+	}
+
+	free(tmp);
+}
+
+/** Record the result of a modeset commit
+ *
+ * A modeset the kernel took is written to the cache. One it refused while
+ * outputs went on the cached configuration untested means the cache is
+ * wrong after all; it is removed, and the repaint gets redone with the
+ * usual tests.
+ *
+ * @param device The device the commit was for
+ * @param ret The result of the commit
+ */
+void
+drm_config_cache_commit_done(struct drm_device *device, int ret)
+{
+	struct drm_backend *b = device->backend;
+	struct drm_config_cache *cache = b->config_cache;
+	struct weston_output *base;
+	struct drm_output *output;
+	bool untested = false;
+
+	if (!cache || device != b->drm)
+		return;
+
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		output = to_drm_output(base);
+		if (!output || output->device != device)
+			continue;
+
+		untested |= output->config_cache_hit;
+		output->config_cache_hit = false;
+	}
+	cache->warm = false;
+
+	if (ret != 0 && untested) {
+		weston_log("DRM: cached output configuration rejected, "
+			   "removing %s\n", cache->path);
+		remove(cache->path);
+		wl_array_release(&cache->entries);
+		wl_array_init(&cache->entries);
+		cache->written = false;
+	}
+
+	if (ret == 0)
+		drm_config_cache_save(b);
+}
@@ -29,12 +29,14 @@
 
 #include "config.h"
 
+#include <assert.h>
 #include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
 #include <dlfcn.h>
+#include <unistd.h>
 
 #include "drm-internal.h"
 #include "pixman-renderer.h"
@@ -43,6 +45,7 @@
 #include "shared/weston-egl-ext.h"
 #include "linux-dmabuf.h"
 #include "linux-explicit-synchronization.h"
+#include "shared/xalloc.h"
 
 static struct gbm_device *
 create_gbm_device(int fd)
@@ -127,6 +130,7 @@ static void drm_output_fini_cursor_egl(struct drm_output *output)
 			output->gbm_cursor_fb[i]->type = BUFFER_PIXMAN_DUMB;
 		drm_fb_unref(output->gbm_cursor_fb[i]);
 		output->gbm_cursor_fb[i] = NULL;
+		output->gbm_cursor_last_use[i] = 0;
 	}
 }
 
@@ -179,6 +183,170 @@ err:
 	return -1;
 }
 
+/* Modifiers for framebuffer compression, which saves memory bandwidth
+ * for both rendering and scanout */
+static bool
+drm_modifier_is_compressed(uint64_t modifier)
+{
+	switch (modifier >> 56) {
+	case DRM_FORMAT_MOD_VENDOR_ARM:
+		/* AFBC; the other types are tiled or interleaved layouts */
+		return ((modifier >> 52) & 0xf) == DRM_FORMAT_MOD_ARM_TYPE_AFBC;
+	case DRM_FORMAT_MOD_VENDOR_QCOM:
+		return modifier == DRM_FORMAT_MOD_QCOM_COMPRESSED;
+#ifdef AMD_FMT_MOD
+	case DRM_FORMAT_MOD_VENDOR_AMD:
+		return AMD_FMT_MOD_GET(DCC, modifier) != 0;
+#endif
+	case DRM_FORMAT_MOD_VENDOR_INTEL:
+		switch (modifier) {
+		case I915_FORMAT_MOD_Y_TILED_CCS:
+		case I915_FORMAT_MOD_Yf_TILED_CCS:
+#ifdef I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS
+		case I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS:
+		case I915_FORMAT_MOD_Y_TILED_GEN12_MC_CCS:
+#endif
+#ifdef I915_FORMAT_MOD_4_TILED_DG2_RC_CCS
+		case I915_FORMAT_MOD_4_TILED_DG2_RC_CCS:
+		case I915_FORMAT_MOD_4_TILED_DG2_MC_CCS:
+#endif
+#ifdef I915_FORMAT_MOD_4_TILED_MTL_RC_CCS
+		case I915_FORMAT_MOD_4_TILED_MTL_RC_CCS:
+		case I915_FORMAT_MOD_4_TILED_MTL_MC_CCS:
+#endif
+#ifdef I915_FORMAT_MOD_4_TILED_LNL_CCS
+		case I915_FORMAT_MOD_4_TILED_LNL_CCS:
+#endif
+#ifdef I915_FORMAT_MOD_4_TILED_BMG_CCS
+		case I915_FORMAT_MOD_4_TILED_BMG_CCS:
+#endif
+			return true;
+		default:
+			return false;
+		}
+	default:
+		return false;
+	}
+}
+
+/* Whether KMS takes a buffer allocated with these modifiers on the
+ * scanout plane, as the GBM surface would hand it out */
+static bool
+drm_output_test_gbm_modifiers(struct gbm_device *gbm,
+			      struct drm_output *output,
+			      const uint64_t *modifiers,
+			      unsigned int num_modifiers)
+{
+	struct drm_device *device = output->device;
+	struct weston_mode *mode = output->base.current_mode;
+	struct drm_pending_state *pending_state;
+	struct drm_output_state *state;
+	struct drm_plane_state *scanout_state;
+	struct gbm_bo *bo;
+	struct drm_fb *fb;
+	int ret;
+
+	bo = gbm_bo_create_with_modifiers(gbm, mode->width, mode->height,
+					  output->format->format,
+					  modifiers, num_modifiers);
+	if (!bo)
+		return false;
+
+	/* A standalone bo, destroyed on the last unref like a client's */
+	fb = drm_fb_get_from_bo(bo, device, !output->format->opaque_substitute,
+				BUFFER_CLIENT);
+	if (!fb) {
+		gbm_bo_destroy(bo);
+		return false;
+	}
+
+	pending_state = drm_pending_state_alloc(device);
+	state = drm_output_state_duplicate(output->state_cur, pending_state,
+					   DRM_OUTPUT_STATE_CLEAR_PLANES);
+	state->dpms = WESTON_DPMS_ON;
+
+	scanout_state = drm_output_state_get_plane(state,
+						   output->scanout_plane);
+	scanout_state->fb = fb;
+	scanout_state->output = output;
+	scanout_state->src_w = fb->width << 16;
+	scanout_state->src_h = fb->height << 16;
+	scanout_state->dest_w = mode->width;
+	scanout_state->dest_h = mode->height;
+	scanout_state->zpos = output->scanout_plane->zpos_min;
+
+	ret = drm_pending_state_test(pending_state);
+	drm_pending_state_free(pending_state);
+
+	return ret == 0;
+}
+
+/* Prefer the compressed modifiers of the scanout plane, if a test commit
+ * shows that KMS takes them, then the uncompressed ones. Allocating with
+ * them all would leave the choice to the GBM driver, which may not
+ * favour compression, or pick a modifier that only fails at the first
+ * real commit. */
+static void
+create_gbm_surface_with_modifiers(struct gbm_device *gbm,
+				  struct drm_output *output,
+				  const uint64_t *modifiers,
+				  unsigned int num_modifiers)
+{
+	struct weston_mode *mode = output->base.current_mode;
+	unsigned int num_compressed = 0;
+	unsigned int i, j;
+	uint64_t *ranked;
+
+	ranked = xcalloc(num_modifiers, sizeof(*ranked));
+	for (i = 0; i < num_modifiers; i++)
+		if (drm_modifier_is_compressed(modifiers[i]))
+			ranked[num_compressed++] = modifiers[i];
+	for (i = 0, j = num_compressed; i < num_modifiers; i++)
+		if (!drm_modifier_is_compressed(modifiers[i]))
+			ranked[j++] = modifiers[i];
+
+	/* Only atomic modesetting can test, and compression does not
+	 * carry over to another GPU's display engine. */
+	if (num_compressed > 0 && output->device->atomic_modeset &&
+	    gbm_device_get_fd(gbm) == output->device->drm.fd) {
+		if (drm_output_test_gbm_modifiers(gbm, output, ranked,
+						  num_compressed))
+			output->gbm_surface =
+				gbm_surface_create_with_modifiers(gbm,
+								  mode->width,
+								  mode->height,
+								  output->format->format,
+								  ranked,
+								  num_compressed);
+		if (output->gbm_surface) {
+			weston_log("Output %s: rendering into compressed "
+				   "buffers\n", output->base.name);
+			free(ranked);
+			return;
+		}
+
+		weston_log("Output %s: compressed buffers cannot be scanned "
+			   "out, falling back to uncompressed ones\n",
+			   output->base.name);
+	}
+
+	if (num_compressed < num_modifiers)
+		output->gbm_surface =
+			gbm_surface_create_with_modifiers(gbm,
+							  mode->width, mode->height,
+							  output->format->format,
+							  ranked + num_compressed,
+							  num_modifiers - num_compressed);
+	if (!output->gbm_surface)
+		output->gbm_surface =
+			gbm_surface_create_with_modifiers(gbm,
+							  mode->width, mode->height,
+							  output->format->format,
+							  modifiers, num_modifiers);
+
+	free(ranked);
+}
+
 static void
 create_gbm_surface(struct gbm_device *gbm, struct drm_output *output)
 {
@@ -199,11 +367,8 @@ create_gbm_surface(struct gbm_device *gbm, struct drm_output *output)
 
 	if (!weston_drm_format_has_modifier(fmt, DRM_FORMAT_MOD_INVALID)) {
 		modifiers = weston_drm_format_get_modifiers(fmt, &num_modifiers);
-		output->gbm_surface =
-			gbm_surface_create_with_modifiers(gbm,
-							  mode->width, mode->height,
-							  output->format->format,
-							  modifiers, num_modifiers);
+		create_gbm_surface_with_modifiers(gbm, output,
+						  modifiers, num_modifiers);
 	}
 
 	/*
@@ -290,6 +455,10 @@ drm_output_fini_egl(struct drm_output *output)
 	renderer->gl->output_destroy(&output->base);
 	gbm_surface_destroy(output->gbm_surface);
 	output->gbm_surface = NULL;
+	if (output->render_fence_fd >= 0) {
+		close(output->render_fence_fd);
+		output->render_fence_fd = -1;
+	}
 	drm_output_fini_cursor_egl(output);
 }
 
@@ -301,8 +470,7 @@ drm_output_render_gl(struct drm_output_state *state, pixman_region32_t *damage)
 	struct gbm_bo *bo;
 	struct drm_fb *ret;
 
-	output->base.compositor->renderer->repaint_output(&output->base,
-							  damage, NULL);
+	weston_renderer_repaint_output(&output->base, damage, NULL);
 
 	bo = gbm_surface_lock_front_buffer(output->gbm_surface);
 	if (!bo) {
@@ -322,5 +490,14 @@ drm_output_render_gl(struct drm_output_state *state, pixman_region32_t *damage)
 	}
 	ret->gbm_surface = output->gbm_surface;
 
+	/* When another GPU scans the frame out, wait on the render fence in
+	 * KMS instead of relying on implicit sync between the two drivers. */
+	if (ret->scanout_device && device->atomic_modeset &&
+	    output->scanout_plane->props[WDRM_PLANE_IN_FENCE_FD].prop_id != 0) {
+		assert(output->render_fence_fd < 0);
+		output->render_fence_fd =
+			output->backend->compositor->renderer->gl->create_fence_fd(&output->base);
+	}
+
 	return ret;
 }
@@ -78,6 +78,10 @@
 #define DRM_PLANE_ALPHA_OPAQUE	0xffffUL
 #endif
 
+#ifndef DRM_MODE_OBJECT_COLOROP
+#define DRM_MODE_OBJECT_COLOROP	0xfafafafa
+#endif
+
 /**
  * A small wrapper to print information into the 'drm-backend' debug scope.
  *
@@ -112,7 +116,7 @@
  * possible type and use a matching format specifier.
  */
 #define drm_debug(b, ...) \
-	weston_log_scope_printf((b)->debug, __VA_ARGS__)
+	weston_log_scope_printf_lazy((b)->debug, __VA_ARGS__)
 
 #define MAX_CLONED_CONNECTORS 4
 
@@ -169,6 +173,28 @@ enum try_view_on_plane_failure_reasons {
 	FAILURE_REASONS_NO_GBM = 1 << 12,
 	FAILURE_REASONS_GBM_BO_IMPORT_FAILED = 1 << 13,
 	FAILURE_REASONS_GBM_BO_GET_HANDLE_FAILED = 1 << 14,
+	FAILURE_REASONS_COLOR_TRANSFORM = 1 << 15,
+};
+
+#define DRM_FAILURE_REASONS_COUNT 16
+
+/** How often views were shown through each kind of plane, counted once
+ * per view and repaint. See drm_scanout_stats_record(). */
+struct drm_scanout_stats {
+	uint64_t renderer;
+	uint64_t primary;
+	uint64_t overlay;
+	uint64_t cursor;
+	/* renderer frames with each failure reason, by bit */
+	uint64_t failures[DRM_FAILURE_REASONS_COUNT];
+};
+
+/* Scanout statistics of a surface, across outputs */
+struct drm_surface_scanout_stats {
+	struct wl_list link; /* drm_backend::scanout_surface_list */
+	struct weston_surface *surface;
+	struct wl_listener surface_destroy_listener;
+	struct drm_scanout_stats stats;
 };
 
 /**
@@ -202,6 +228,16 @@ struct drm_device {
 	 */
 	struct hash_table *gem_handle_refcnt;
 
+	/* Recently used client dmabuf fbs, most recent first;
+	 * drm_fb::cache_link */
+	struct wl_list fb_cache;
+	unsigned int fb_cache_size;
+
+	/* 1x1 dumb fbs for solid-colour views, most recent first;
+	 * drm_fb::cache_link */
+	struct wl_list solid_fb_cache;
+	unsigned int solid_fb_cache_size;
+
 	/* drm_crtc::link */
 	struct wl_list crtc_list;
 
@@ -214,8 +250,40 @@ struct drm_device {
 
 	bool state_invalid;
 
+	/* The first commit still has to try keeping the firmware's
+	 * configuration, see weston_drm_backend_config::fastboot. */
+	bool fastboot_pending;
+
+	/* The first commit after switching back to our session tries
+	 * keeping the mode we left behind, see session_notify(). */
+	bool resume_pending;
+
+	/* A commit brings an output back from its idle refresh rate; try
+	 * it without a modeset first, see drm_output_apply_state_atomic(). */
+	bool refresh_restore_pending;
+
+	/* Submits page flips when the kms-thread option is set, see
+	 * kms-thread.c */
+	struct drm_commit_thread *commit_thread;
+
+	/* Reads the connectors at startup, see
+	 * drm_device_start_connector_probe() */
+	struct drm_connector_probe *connector_probe;
+
+	/* The output overlay planes are kept for, and the one which wants
+	 * more of them since challenger_since_msec. */
+	struct {
+		struct drm_output *output;
+		struct drm_output *challenger;
+		int64_t challenger_since_msec;
+	} plane_broker;
+
 	bool atomic_modeset;
 
+	/* Planes expose their color pipelines, see
+	 * weston_drm_backend_config::plane_color_pipeline. */
+	bool plane_color_pipeline;
+
 	bool tearing_supported;
 
 	bool aspect_ratio_supported;
@@ -259,6 +327,17 @@ struct drm_backend {
 	const struct pixel_format_info *format;
 
 	bool use_pixman_shadow;
+	bool independent_device_commits;
+	bool shm_scanout;
+	bool fastboot;
+	bool kms_thread;
+	bool vblank_sequence;
+	bool plane_color_pipeline;
+	bool dpms_off_release_buffers;
+
+	/* Configuration of the primary device from the last run, see
+	 * config-cache.c */
+	struct drm_config_cache *config_cache;
 
 	struct udev_input input;
 
@@ -268,6 +347,10 @@ struct drm_backend {
 	bool has_underlay;
 
 	struct weston_log_scope *debug;
+
+	/* drm_surface_scanout_stats::link */
+	struct wl_list scanout_surface_list;
+	struct weston_log_scope *scanout_scope;
 };
 
 struct drm_mode {
@@ -285,6 +368,16 @@ enum drm_fb_type {
 	BUFFER_CURSOR, /**< internal cursor buffer */
 };
 
+/* What makes two client dmabuf imports the same KMS framebuffer */
+struct drm_fb_cache_key {
+	uint32_t handles[4];
+	uint32_t strides[4];
+	uint32_t offsets[4];
+	uint32_t format;
+	uint64_t modifier;
+	int width, height;
+};
+
 struct drm_fb {
 	enum drm_fb_type type;
 
@@ -311,6 +404,14 @@ struct drm_fb {
 
 	/* Used by dumb fbs */
 	void *map;
+
+	/* Used by cached dmabuf fbs, see drm_device::fb_cache, and by
+	 * solid-colour fbs, see drm_device::solid_fb_cache */
+	struct drm_fb_cache_key cache_key;
+	struct wl_list cache_link;
+
+	/* Used by solid-colour fbs: the premultiplied pixel they hold */
+	uint32_t solid_pixel;
 };
 
 struct drm_buffer_fb {
@@ -354,6 +455,11 @@ struct drm_output_state {
 	enum weston_hdcp_protection protection;
 	struct wl_list plane_list;
 	bool tear;
+	bool vrr_enabled;
+	enum wdrm_content_type content_type;
+	/* at the refresh rate for static content, see
+	 * drm_output_idle_refresh_handler() */
+	bool idle_refresh;
 };
 
 /**
@@ -391,11 +497,60 @@ struct drm_plane_state {
 	/* We don't own the fd, so we shouldn't close it */
 	int in_fence_fd;
 
+	/* Implicit fence exported from the client dmabuf when it came
+	 * without an explicit one; owned, and what in_fence_fd points to
+	 * then. */
+	int implicit_fence_fd;
+
 	uint32_t damage_blob_id; /* damage to kernel */
 
+	/* Surface color transformation done by the plane color pipeline,
+	 * NULL for none; holds a reference. */
+	struct weston_color_transform *color_xform;
+
 	struct wl_list link; /* drm_output_state::plane_list */
 };
 
+/**
+ * One stage of a plane color pipeline, a KMS colorop object.
+ */
+struct drm_colorop {
+	uint32_t colorop_id;
+	enum wdrm_colorop_type type;
+	/* Entries of a 1D LUT */
+	uint32_t size;
+	struct drm_property_info props[WDRM_COLOROP__COUNT];
+};
+
+/**
+ * The plane color pipeline a surface color transformation goes into.
+ *
+ * Of the pipelines a plane offers, the one with a 1D LUT, a 3x4 matrix
+ * and another 1D LUT in this order, for the pre-curve, mapping and
+ * post-curve, is used. Any other stages are bypassed.
+ */
+struct drm_plane_color_pipeline {
+	/* COLOR_PIPELINE property, and its value selecting this pipeline:
+	 * the ID of the first colorop */
+	uint32_t prop_id;
+	uint64_t id;
+
+	struct drm_colorop *colorops;
+	unsigned int n_colorops;
+	/* Index into colorops of each step, or -1 without one */
+	int pre_curve;
+	int mapping;
+	int post_curve;
+
+	/* The transformation last programmed and its DATA blobs, kept
+	 * while it is in use; holds a reference. */
+	struct weston_color_transform *xform;
+	bool fits;
+	uint32_t pre_curve_blob_id;
+	uint32_t mapping_blob_id;
+	uint32_t post_curve_blob_id;
+};
+
 /**
  * A plane represents one buffer, positioned within a CRTC, and stacked
  * relative to other planes on the same CRTC.
@@ -436,6 +591,17 @@ struct drm_plane {
 	uint16_t alpha_min;
 	uint16_t alpha_max;
 
+	/* Whether the plane takes YUV formats and can be set to convert
+	 * them the same way the renderer does. */
+	bool scans_out_yuv;
+
+	/* NULL unless the plane can apply surface color transformations */
+	struct drm_plane_color_pipeline *color_pipeline;
+
+	/* The output the plane broker keeps this overlay plane for, or NULL
+	 * for whichever output takes it first. See drm_plane_broker_update(). */
+	struct drm_output *broker_output;
+
 	struct wl_list link;
 
 	struct weston_drm_format_array formats;
@@ -453,6 +619,15 @@ struct drm_connector {
 	struct drm_property_info props[WDRM_CONNECTOR__COUNT];
 };
 
+enum drm_vrr_mode {
+	DRM_VRR_MODE_OFF = 0,
+	/* only while a client buffer is on the scanout plane */
+	DRM_VRR_MODE_FULLSCREEN,
+	/* only while that buffer is hinted as game or video content */
+	DRM_VRR_MODE_CONTENT,
+	DRM_VRR_MODE_ON,
+};
+
 enum writeback_screenshot_state {
 	/* No writeback connector screenshot ongoing. */
 	DRM_OUTPUT_WB_SCREENSHOT_OFF,
@@ -508,12 +683,14 @@ struct drm_head {
 	drmModeModeInfo inherited_mode;	/**< Original mode on the connector */
 	uint32_t inherited_max_bpc;	/**< Original max_bpc on the connector */
 	uint32_t inherited_crtc_id;	/**< Original CRTC assignment */
+	bool vrr_capable;		/**< Sink supports variable refresh */
 
 	/* drm_output::disable_head */
 	struct wl_list disable_head_link;
 
 	void *display_data;             /**< EDID or DisplayID blob */
 	size_t display_data_len;        /**< bytes */
+	uint32_t display_data_blob_id;  /**< KMS blob display_data came from */
 };
 
 struct drm_crtc {
@@ -529,8 +706,14 @@ struct drm_crtc {
 
 	/* Holds the properties for the CRTC */
 	struct drm_property_info props_crtc[WDRM_CRTC__COUNT];
+
+	/* Entries in DEGAMMA_LUT and GAMMA_LUT, 0 if not supported */
+	uint32_t degamma_lut_size;
+	uint32_t gamma_lut_size;
 };
 
+#define DRM_OUTPUT_CURSOR_BUFFERS 4
+
 struct drm_output {
 	struct weston_output base;
 	struct drm_backend *backend;
@@ -547,8 +730,17 @@ struct drm_output {
 	bool dpms_off_pending;
 	bool mode_switch_pending;
 
-	uint32_t gbm_cursor_handle[2];
-	struct drm_fb *gbm_cursor_fb[2];
+	/* The renderer state and buffers were freed for DPMS off, see
+	 * drm_output_sleep() */
+	bool renderer_released;
+
+	/* Cursor buffers, kept filled with the images last shown on
+	 * the cursor plane so that cycling through them only flips fbs */
+	uint32_t gbm_cursor_handle[DRM_OUTPUT_CURSOR_BUFFERS];
+	struct drm_fb *gbm_cursor_fb[DRM_OUTPUT_CURSOR_BUFFERS];
+	uint64_t gbm_cursor_hash[DRM_OUTPUT_CURSOR_BUFFERS];
+	uint64_t gbm_cursor_last_use[DRM_OUTPUT_CURSOR_BUFFERS]; /* 0: empty */
+	uint64_t cursor_use_count;
 	struct drm_plane *cursor_plane;
 	struct weston_view *cursor_view;
 	struct wl_listener cursor_view_destroy_listener;
@@ -557,6 +749,9 @@ struct drm_output {
 	struct gbm_surface *gbm_surface;
 	const struct pixel_format_info *format;
 	uint32_t gbm_bo_flags;
+	/* Render fence of the last frame drawn for a scanout device other
+	 * than the render device, handed to KMS as the IN_FENCE_FD. */
+	int render_fence_fd;
 
 	uint32_t hdr_output_metadata_blob_id;
 	uint64_t ackd_color_outcome_serial;
@@ -567,6 +762,16 @@ struct drm_output {
 	bool deprecated_gamma_is_set;
 	bool legacy_gamma_not_supported;
 
+	/* The blend-to-output color transform is done by the CRTC color
+	 * pipeline instead of the renderer: requested, and decided when
+	 * the output was enabled. */
+	bool color_offload;
+	bool color_offload_active;
+	uint64_t color_pipeline_serial;
+	uint32_t degamma_lut_blob_id;
+	uint32_t ctm_blob_id;
+	uint32_t gamma_lut_blob_id;
+
 	/* Plane being displayed directly on the CRTC */
 	struct drm_plane *scanout_plane;
 
@@ -578,11 +783,48 @@ struct drm_output {
 
 	/* only set when a writeback screenshot is ongoing */
 	struct drm_writeback_state *wb_state;
+	/* dumb buffer reused by writeback captures into wl_shm buffers */
+	struct drm_fb *wb_dumb_fb;
+
+	/* Last plane assignment that passed the atomic test, and a
+	 * fingerprint of the scene it was made for. See drm_assign_planes(). */
+	struct {
+		bool valid;
+		uint64_t fingerprint;
+		int mode; /* enum drm_output_propose_state_mode */
+	} propose_cache;
+
+	/* Lowest weston_paint_node::plane_score that gets an overlay plane
+	 * in mixed mode, and the scores it was picked from, updated once
+	 * per repaint by drm_assign_planes(). */
+	float overlay_score_threshold;
+	struct wl_array overlay_scores; /* float */
+
+	/* Enabled as in the output cache; the first frame goes untested,
+	 * see config-cache.c */
+	bool config_cache_hit;
+
+	uint64_t scanout_repaints;
+	struct drm_scanout_stats scanout_stats;
+
+	/* Views which could go on an overlay plane at the last assignment */
+	unsigned int plane_demand;
 
 	struct drm_fb *dumb[2];
 	struct weston_renderbuffer *renderbuffer[2];
 	int current_image;
 
+	/* Dumb buffers fullscreen wl_shm buffers are copied into for
+	 * scanout. See drm_fb_get_from_paint_node(). */
+	struct {
+		struct drm_fb *fb[2];
+		/* buffer damage not copied into fb[i] yet */
+		pixman_region32_t damage[2];
+		/* the surface the buffers were last updated from */
+		struct weston_surface *surface;
+		struct wl_listener surface_destroy_listener;
+	} shm_scanout;
+
 	struct vaapi_recorder *recorder;
 	struct wl_listener recorder_frame_listener;
 
@@ -594,6 +836,22 @@ struct drm_output {
 	submit_frame_cb virtual_submit_frame;
 
 	enum wdrm_content_type content_type;
+	enum drm_vrr_mode vrr_mode;
+
+	/* Lower the refresh rate after that long without a repaint, 0 to
+	 * never; idle_refresh_mode is the lower rate mode while idle, or
+	 * NULL for VRR doing it. */
+	uint32_t idle_refresh_timeout_ms;
+	struct wl_event_source *idle_refresh_timer;
+	struct drm_mode *idle_refresh_mode;
+	bool idle_refresh_enter;	/**< the next repaint lowers the rate */
+
+	/* With vblank-sequence: a CRTC sequence event restarts the repaint
+	 * loop, and the repaint in flight is meant for the vblank with
+	 * repaint_target_msc, 0 when there is no deadline. */
+	bool vblank_sequence_pending;
+	uint64_t repaint_target_msc;
+	uint64_t late_repaints;
 };
 
 void
@@ -745,6 +1003,8 @@ int
 drm_plane_populate_formats(struct drm_plane *plane, const drmModePlane *kplane,
 			   const drmModeObjectProperties *props,
 			   const bool use_modifiers);
+bool
+drm_plane_can_scan_out_yuv(struct drm_plane *plane);
 void
 drm_property_info_free(struct drm_property_info *info, int num_props);
 
@@ -755,6 +1015,7 @@ extern struct drm_property_enum_info content_protection_enums[];
 extern struct drm_property_enum_info hdcp_content_type_enums[];
 extern const struct drm_property_info connector_props[];
 extern const struct drm_property_info crtc_props[];
+extern const struct drm_property_info colorop_props[];
 
 int
 init_kms_caps(struct drm_device *device);
@@ -778,36 +1039,112 @@ drm_output_update_complete(struct drm_output *output, uint32_t flags,
 int
 on_drm_input(int fd, uint32_t mask, void *data);
 
+int
+drm_device_start_commit_thread(struct drm_device *device);
+void
+drm_device_stop_commit_thread(struct drm_device *device);
+void
+drm_commit_thread_queue(struct drm_commit_thread *thread,
+			drmModeAtomicReq *req, uint32_t flags,
+			struct drm_pending_state *pending_state);
+void
+drm_commit_thread_wait(struct drm_commit_thread *thread);
+void
+drm_commit_thread_flush(struct drm_commit_thread *thread);
+
+void
+drm_config_cache_load(struct drm_backend *b, const char *path);
+void
+drm_config_cache_destroy(struct drm_backend *b);
+struct drm_crtc *
+drm_config_cache_get_crtc(struct drm_output *output);
+void
+drm_config_cache_output_enabled(struct drm_output *output);
+void
+drm_config_cache_commit_done(struct drm_device *device, int ret);
+
 struct drm_fb *
 drm_fb_ref(struct drm_fb *fb);
 void
 drm_fb_unref(struct drm_fb *fb);
 
+void
+drm_fb_cache_flush(struct drm_device *device);
+
+struct drm_fb *
+drm_fb_get_for_writeback(struct drm_output *output,
+			 struct weston_buffer *buffer);
+
 struct drm_fb *
 drm_fb_create_dumb(struct drm_device *device, int width, int height,
 		   uint32_t format);
 struct drm_fb *
 drm_fb_get_from_bo(struct gbm_bo *bo, struct drm_device *device,
 		   bool is_opaque, enum drm_fb_type type);
+void
+drm_output_fini_shm_scanout(struct drm_output *output);
+
+static inline bool
+drm_output_shm_scanout_has_fb(struct drm_output *output, struct drm_fb *fb)
+{
+	return fb && (fb == output->shm_scanout.fb[0] ||
+		      fb == output->shm_scanout.fb[1]);
+}
 
 void
 drm_output_set_cursor_view(struct drm_output *output, struct weston_view *ev);
 
+void
+drm_plane_broker_release_output(struct drm_output *output);
+
+bool
+drm_output_move_cursor(struct weston_output *output_base,
+		       struct weston_view *ev);
+
 int
 drm_output_ensure_hdr_output_metadata_blob(struct drm_output *output);
 
 enum wdrm_colorspace
 wdrm_colorspace_from_output(struct weston_output *output);
 
+void
+drm_output_update_color_pipeline(struct drm_output *output);
+
+void
+drm_output_release_color_pipeline(struct drm_output *output);
+
+void
+drm_plane_populate_color_pipeline(struct drm_plane *plane,
+				  const drmModeObjectProperties *props);
+
+void
+drm_plane_destroy_color_pipeline(struct drm_plane *plane);
+
+int
+drm_plane_prepare_color_transform(struct drm_plane *plane,
+				  struct weston_color_transform *xform);
+
+int
+drm_plane_add_color_pipeline(drmModeAtomicReq *req,
+			     struct drm_plane_state *plane_state);
+
 #ifdef BUILD_DRM_GBM
 extern struct drm_fb *
 drm_fb_get_from_paint_node(struct drm_output_state *state,
 			   struct weston_paint_node *pnode,
 			   uint32_t *try_view_on_plane_failure_reasons);
 
+struct drm_fb *
+drm_fb_get_from_solid(struct drm_device *device,
+		      struct weston_paint_node *pnode,
+		      uint32_t *try_view_on_plane_failure_reasons);
+
 extern bool
 drm_can_scanout_dmabuf(struct weston_backend *backend,
 		       struct linux_dmabuf_buffer *dmabuf);
+
+void
+drm_output_update_shm_scanout(struct drm_output_state *state);
 #else
 static inline struct drm_fb *
 drm_fb_get_from_paint_node(struct drm_output_state *state,
@@ -816,12 +1153,24 @@ drm_fb_get_from_paint_node(struct drm_output_state *state,
 {
 	return NULL;
 }
+static inline struct drm_fb *
+drm_fb_get_from_solid(struct drm_device *device,
+		      struct weston_paint_node *pnode,
+		      uint32_t *try_view_on_plane_failure_reasons)
+{
+	return NULL;
+}
 static inline bool
 drm_can_scanout_dmabuf(struct weston_backend *backend,
 		       struct linux_dmabuf_buffer *dmabuf)
 {
 	return false;
 }
+
+static inline void
+drm_output_update_shm_scanout(struct drm_output_state *state)
+{
+}
 #endif
 
 struct drm_pending_state *
@@ -879,6 +1228,12 @@ drm_plane_reset_state(struct drm_plane *plane);
 void
 drm_assign_planes(struct weston_output *output_base);
 
+void
+drm_scanout_debug_scope_cb(struct weston_log_subscription *sub, void *data);
+
+void
+drm_backend_scanout_stats_fini(struct drm_backend *b);
+
 bool
 drm_plane_is_available(struct drm_plane *plane, struct drm_output *output);
 
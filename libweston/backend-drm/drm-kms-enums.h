@@ -121,6 +121,7 @@ enum wdrm_connector_property {
 	WDRM_CONNECTOR_MAX_BPC,
 	WDRM_CONNECTOR_CONTENT_TYPE,
 	WDRM_CONNECTOR_COLORSPACE,
+	WDRM_CONNECTOR_VRR_CAPABLE,
 	WDRM_CONNECTOR__COUNT
 };
 
@@ -196,3 +197,28 @@ enum wdrm_crtc_property {
 	WDRM_CRTC_VRR_ENABLED,
 	WDRM_CRTC__COUNT
 };
+
+/**
+ * List of properties attached to DRM color operations, the stages of a
+ * plane color pipeline
+ */
+enum wdrm_colorop_property {
+	WDRM_COLOROP_TYPE = 0,
+	WDRM_COLOROP_BYPASS,
+	WDRM_COLOROP_NEXT,
+	WDRM_COLOROP_SIZE,
+	WDRM_COLOROP_DATA,
+	WDRM_COLOROP__COUNT
+};
+
+/**
+ * Possible values for the WDRM_COLOROP_TYPE property.
+ */
+enum wdrm_colorop_type {
+	WDRM_COLOROP_TYPE_1D_CURVE = 0,
+	WDRM_COLOROP_TYPE_1D_LUT,
+	WDRM_COLOROP_TYPE_CTM_3X4,
+	WDRM_COLOROP_TYPE_MULTIPLIER,
+	WDRM_COLOROP_TYPE_3D_LUT,
+	WDRM_COLOROP_TYPE__COUNT
+};
@@ -291,8 +291,8 @@ drm_virtual_output_enable(struct weston_output *output_base)
 
 	assert(output->is_virtual);
 
-	if (output_base->compositor->renderer->type == WESTON_RENDERER_PIXMAN) {
-		weston_log("Not support pixman renderer on Virtual output\n");
+	if (output_base->compositor->renderer->type != WESTON_RENDERER_GL) {
+		weston_log("Virtual outputs are only supported with the GL renderer\n");
 		goto err;
 	}
 
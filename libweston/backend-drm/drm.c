@@ -42,6 +42,8 @@
 #include <sys/mman.h>
 #include <time.h>
 #include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -68,6 +70,7 @@
 #include "linux-dmabuf.h"
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
 #include "linux-explicit-synchronization.h"
+#include "linux-drm-syncobj.h"
 
 static const char default_seat[] = "seat0";
 
@@ -209,6 +212,10 @@ drm_plane_is_available(struct drm_plane *plane, struct drm_output *output)
 	if (plane->state_cur->output && plane->state_cur->output != output)
 		return false;
 
+	/* The plane broker keeps the plane for another output. */
+	if (plane->broker_output && plane->broker_output != output)
+		return false;
+
 	/* Check whether the plane can be used with this CRTC; possible_crtcs
 	 * is a bitmask of CRTC indices (pipe), rather than CRTC object ID. */
 	return !!(plane->possible_crtcs & (1 << output->crtc->pipe));
@@ -293,6 +300,12 @@ drm_output_get_disable_state(struct drm_pending_state *pending_state,
 static int
 drm_output_apply_mode(struct drm_output *output);
 
+static void
+drm_output_sleep(struct drm_output *output);
+
+static int
+drm_output_wake(struct drm_output *output);
+
 /**
  * Mark a drm_output_state (the output's last state) as complete. This handles
  * any post-completion actions such as updating the repaint timer, disabling the
@@ -339,6 +352,8 @@ drm_output_update_complete(struct drm_output *output, uint32_t flags,
 		output->mode_switch_pending = false;
 		drm_output_apply_mode(output);
 	}
+	if (output->state_cur->dpms == WESTON_DPMS_OFF)
+		drm_output_sleep(output);
 	if (output->state_cur->dpms == WESTON_DPMS_OFF &&
 	    output->base.repaint_status != REPAINT_AWAITING_COMPLETION) {
 		/* DPMS can happen to us either in the middle of a repaint
@@ -367,17 +382,19 @@ drm_output_update_complete(struct drm_output *output, uint32_t flags,
 		weston_output_schedule_repaint(&output->base);
 }
 
+/* Pixman draws into the mapped dumb buffers. The no-op renderer draws
+ * nothing, but the dumb buffers still go through plane assignment and the
+ * KMS commits like rendered ones. */
 static struct drm_fb *
-drm_output_render_pixman(struct drm_output_state *state,
-			 pixman_region32_t *damage)
+drm_output_render_dumb(struct drm_output_state *state,
+		       pixman_region32_t *damage)
 {
 	struct drm_output *output = state->output;
-	struct weston_compositor *ec = output->base.compositor;
 
 	output->current_image ^= 1;
 
-	ec->renderer->repaint_output(&output->base, damage,
-				     output->renderbuffer[output->current_image]);
+	weston_renderer_repaint_output(&output->base, damage,
+				       output->renderbuffer[output->current_image]);
 
 	return drm_fb_ref(output->dumb[output->current_image]);
 }
@@ -403,6 +420,12 @@ drm_output_render(struct drm_output_state *state)
 	if (scanout_state->fb)
 		return;
 
+	/* The previous frame's fence was consumed by its commit. */
+	if (output->render_fence_fd >= 0) {
+		close(output->render_fence_fd);
+		output->render_fence_fd = -1;
+	}
+
 	pixman_region32_init(&damage);
 
 	weston_output_flush_damage_for_primary_plane(&output->base, &damage);
@@ -421,8 +444,9 @@ drm_output_render(struct drm_output_state *state)
 	    (scanout_plane->state_cur->fb->type == BUFFER_GBM_SURFACE ||
 	     scanout_plane->state_cur->fb->type == BUFFER_PIXMAN_DUMB)) {
 		fb = drm_fb_ref(scanout_plane->state_cur->fb);
-	} else if (c->renderer->type == WESTON_RENDERER_PIXMAN) {
-		fb = drm_output_render_pixman(state, &damage);
+	} else if (c->renderer->type == WESTON_RENDERER_PIXMAN ||
+		   c->renderer->type == WESTON_RENDERER_NOOP) {
+		fb = drm_output_render_dumb(state, &damage);
 	} else {
 		fb = drm_output_render_gl(state, &damage);
 	}
@@ -434,6 +458,7 @@ drm_output_render(struct drm_output_state *state)
 
 	scanout_state->fb = fb;
 	scanout_state->output = output;
+	scanout_state->in_fence_fd = output->render_fence_fd;
 
 	scanout_state->src_x = 0;
 	scanout_state->src_y = 0;
@@ -615,9 +640,9 @@ drm_output_pick_writeback_capture_task(struct drm_output *output)
 		goto err;
 	}
 
-	output->wb_state->fb = drm_fb_create_dumb(output->device, width, height, format);
+	output->wb_state->fb = drm_fb_get_for_writeback(output, buffer);
 	if (!output->wb_state->fb) {
-		msg = "drm: failed to create dumb buffer for writeback state";
+		msg = "drm: failed to get a framebuffer for writeback state";
 		goto err_fb;
 	}
 
@@ -636,21 +661,41 @@ err:
 }
 
 #ifdef BUILD_DRM_GBM
+static uint64_t
+cursor_image_hash(const uint32_t *pixels, size_t count)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	size_t i;
+
+	/* FNV-1a, a pixel at a time */
+	for (i = 0; i < count; i++) {
+		hash ^= pixels[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
 /**
- * Update the image for the current cursor surface
+ * Get a cursor buffer with the image of the current cursor surface
  *
- * @param plane_state DRM cursor plane state
+ * Reuses a cursor buffer which already holds the same image, otherwise
+ * fills the least recently used one that is not on screen.
+ *
+ * @param output DRM output
  * @param ev Source view for cursor
+ * @return index of the cursor buffer to show
  */
-static void
+static int
 cursor_bo_update(struct drm_output *output, struct weston_view *ev)
 {
 	struct drm_device *device = output->device;
-	struct gbm_bo *bo = output->gbm_cursor_fb[output->current_cursor]->bo;
 	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
 	uint32_t buf[device->cursor_width * device->cursor_height];
+	struct gbm_bo *bo;
+	uint64_t hash;
 	uint8_t *s;
-	int i;
+	int i, slot = -1;
 
 	assert(buffer && buffer->shm_buffer);
 	assert(buffer->width <= device->cursor_width);
@@ -667,18 +712,47 @@ cursor_bo_update(struct drm_output *output, struct weston_view *ev)
 		       buffer->width * 4);
 	wl_shm_buffer_end_access(buffer->shm_buffer);
 
+	hash = cursor_image_hash(buf, ARRAY_LENGTH(buf));
+	output->cursor_use_count++;
+
+	for (i = 0; i < (int) ARRAY_LENGTH(output->gbm_cursor_fb); i++) {
+		if (output->gbm_cursor_last_use[i] &&
+		    output->gbm_cursor_hash[i] == hash) {
+			output->gbm_cursor_last_use[i] = output->cursor_use_count;
+			return i;
+		}
+	}
+
+	/* Never write to the buffer on screen, to not tear. */
+	for (i = 0; i < (int) ARRAY_LENGTH(output->gbm_cursor_fb); i++) {
+		if (i == output->current_cursor)
+			continue;
+		if (slot < 0 || output->gbm_cursor_last_use[i] <
+				output->gbm_cursor_last_use[slot])
+			slot = i;
+	}
+
+	bo = output->gbm_cursor_fb[slot]->bo;
 	if (bo) {
-		if (gbm_bo_write(bo, buf, sizeof buf) < 0)
+		if (gbm_bo_write(bo, buf, sizeof buf) < 0) {
 			weston_log("failed update cursor: %s\n", strerror(errno));
+			output->gbm_cursor_last_use[slot] = 0;
+			return slot;
+		}
 	} else {
-		memcpy(output->gbm_cursor_fb[output->current_cursor]->map,
-		       buf, sizeof buf);
+		memcpy(output->gbm_cursor_fb[slot]->map, buf, sizeof buf);
 	}
+
+	output->gbm_cursor_hash[slot] = hash;
+	output->gbm_cursor_last_use[slot] = output->cursor_use_count;
+
+	return slot;
 }
 #else
-static void
+static int
 cursor_bo_update(struct drm_output *output, struct weston_view *ev)
 {
+	return output->current_cursor;
 }
 #endif
 
@@ -690,6 +764,206 @@ drm_output_prepare_repaint(struct weston_output *output_base)
 	output->device->will_repaint = true;
 }
 
+/* The CRTC can switch to a variable refresh rate and every display it
+ * drives supports one. VRR_ENABLED is only reachable through atomic. */
+static bool
+drm_output_is_vrr_capable(struct drm_output *output)
+{
+	struct drm_head *head;
+
+	if (!output->device->atomic_modeset || !output->crtc ||
+	    output->crtc->props_crtc[WDRM_CRTC_VRR_ENABLED].prop_id == 0)
+		return false;
+
+	wl_list_for_each(head, &output->base.head_list, base.output_link) {
+		if (!head->vrr_capable)
+			return false;
+	}
+
+	return true;
+}
+
+static enum weston_content_type
+drm_plane_state_content_type(struct drm_plane_state *scanout_state)
+{
+	if (!scanout_state->ev)
+		return WESTON_CONTENT_TYPE_NONE;
+
+	return scanout_state->ev->surface->content_type;
+}
+
+static bool
+drm_output_state_wants_vrr(struct drm_output_state *state,
+			   struct drm_plane_state *scanout_state)
+{
+	struct drm_output *output = state->output;
+	enum weston_content_type type;
+
+	switch (output->vrr_mode) {
+	case DRM_VRR_MODE_OFF:
+		return false;
+	case DRM_VRR_MODE_FULLSCREEN:
+		if (!scanout_state->ev)
+			return false;
+		break;
+	case DRM_VRR_MODE_CONTENT:
+		type = drm_plane_state_content_type(scanout_state);
+		if (type != WESTON_CONTENT_TYPE_GAME &&
+		    type != WESTON_CONTENT_TYPE_VIDEO)
+			return false;
+		break;
+	case DRM_VRR_MODE_ON:
+		break;
+	}
+
+	return drm_output_is_vrr_capable(output);
+}
+
+/* The content type to signal to the sink: the one configured for the
+ * output, or else the hint of the client buffer on the primary plane. */
+static enum wdrm_content_type
+drm_output_state_content_type(struct drm_output_state *state,
+			      struct drm_plane_state *scanout_state)
+{
+	struct drm_output *output = state->output;
+
+	if (output->content_type != WDRM_CONTENT_TYPE_NO_DATA)
+		return output->content_type;
+
+	switch (drm_plane_state_content_type(scanout_state)) {
+	case WESTON_CONTENT_TYPE_NONE:
+		break;
+	case WESTON_CONTENT_TYPE_PHOTO:
+		return WDRM_CONTENT_TYPE_PHOTO;
+	case WESTON_CONTENT_TYPE_VIDEO:
+		return WDRM_CONTENT_TYPE_CINEMA;
+	case WESTON_CONTENT_TYPE_GAME:
+		return WDRM_CONTENT_TYPE_GAME;
+	}
+
+	return WDRM_CONTENT_TYPE_NO_DATA;
+}
+
+/* The lowest refresh rate mode with the same timings otherwise, to run a
+ * static output at */
+static struct drm_mode *
+drm_output_find_idle_refresh_mode(struct drm_output *output)
+{
+	struct drm_mode *current = to_drm_mode(output->base.current_mode);
+	struct drm_mode *mode, *lowest = NULL;
+	uint32_t refresh = output->base.current_mode->refresh;
+
+	wl_list_for_each(mode, &output->base.mode_list, base.link) {
+		if (mode->mode_info.hdisplay != current->mode_info.hdisplay ||
+		    mode->mode_info.vdisplay != current->mode_info.vdisplay ||
+		    (mode->mode_info.flags & DRM_MODE_FLAG_INTERLACE) ||
+		    mode->base.refresh >= refresh)
+			continue;
+
+		lowest = mode;
+		refresh = mode->base.refresh;
+	}
+
+	return lowest;
+}
+
+static void
+drm_output_state_set_idle_refresh(struct drm_output_state *state, bool idle)
+{
+	struct drm_output *output = state->output;
+
+	state->idle_refresh = idle;
+
+	/* Without a lower rate mode, let VRR drop to the display's minimum
+	 * rate, since nothing is flipped until the next repaint. */
+	if (idle && !output->idle_refresh_mode)
+		state->vrr_enabled = true;
+}
+
+static void
+drm_output_arm_idle_refresh(struct drm_output *output)
+{
+	if (!output->idle_refresh_timer)
+		return;
+
+	wl_event_source_timer_update(output->idle_refresh_timer,
+				     output->idle_refresh_timeout_ms);
+}
+
+/* Nothing was repainted for idle_refresh_timeout_ms: have the next
+ * repaint lower the refresh rate, if the kernel takes it without a
+ * modeset, i.e. without the display going blank. */
+static int
+drm_output_idle_refresh_handler(void *data)
+{
+	struct drm_output *output = data;
+	struct drm_device *device = output->device;
+	struct drm_pending_state *pending_state;
+	struct drm_output_state *state;
+	int ret;
+
+	if (!output->base.enabled || output->state_cur->idle_refresh ||
+	    output->state_cur->vrr_enabled ||
+	    output->state_cur->dpms != WESTON_DPMS_ON ||
+	    output->page_flip_pending || output->atomic_complete_pending ||
+	    device->state_invalid)
+		return 0;
+
+	output->idle_refresh_mode = drm_output_find_idle_refresh_mode(output);
+	if (!output->idle_refresh_mode && !drm_output_is_vrr_capable(output))
+		return 0;
+
+	pending_state = drm_pending_state_alloc(device);
+	state = drm_output_state_duplicate(output->state_cur, pending_state,
+					   DRM_OUTPUT_STATE_PRESERVE_PLANES);
+	drm_output_state_set_idle_refresh(state, true);
+	ret = drm_pending_state_test(pending_state);
+	drm_pending_state_free(pending_state);
+
+	if (ret != 0) {
+		weston_log("%s: cannot lower the refresh rate without a "
+			   "modeset, keeping it\n", output->base.name);
+		output->idle_refresh_mode = NULL;
+		wl_event_source_remove(output->idle_refresh_timer);
+		output->idle_refresh_timer = NULL;
+		return 0;
+	}
+
+	drm_debug(output->backend, "[repaint] %s idle, lowering refresh rate "
+		  "to %s\n", output->base.name,
+		  output->idle_refresh_mode ?
+		  output->idle_refresh_mode->mode_info.name : "VRR minimum");
+	output->idle_refresh_enter = true;
+	weston_output_schedule_repaint(&output->base);
+
+	return 0;
+}
+
+/* The repaint loop starts a repaint ahead of the first vblank to come,
+ * so that is the one the frame is meant for. There is no deadline with
+ * tearing or VRR, and none we know of across a refresh rate change. */
+static uint64_t
+drm_output_repaint_target_msc(struct drm_output *output,
+			      struct drm_output_state *state)
+{
+	struct weston_compositor *compositor = output->base.compositor;
+	struct timespec now;
+	int64_t refresh_nsec;
+	int64_t since_nsec;
+
+	if (state->tear || state->vrr_enabled || state->idle_refresh ||
+	    output->state_cur->idle_refresh || output->base.msc == 0)
+		return 0;
+
+	refresh_nsec = millihz_to_nsec(output->base.current_mode->refresh);
+	weston_compositor_read_presentation_clock(compositor, &now);
+	since_nsec = timespec_sub_to_nsec(&now, &output->base.frame_time);
+	if (refresh_nsec <= 0 || since_nsec < 0)
+		return 0;
+
+	return output->base.msc + 1 + since_nsec / refresh_nsec;
+}
+
 static int
 drm_output_repaint(struct weston_output *output_base)
 {
@@ -710,6 +984,10 @@ drm_output_repaint(struct weston_output *output_base)
 	if (output->disable_pending || output->destroy_pending)
 		goto err;
 
+	/* Buffers released while off, which could not be restored */
+	if (output->renderer_released && drm_output_wake(output) < 0)
+		goto err;
+
 	assert(!output->state_last);
 
 	/* If planes have been disabled in the core, we might not have
@@ -734,13 +1012,9 @@ drm_output_repaint(struct weston_output *output_base)
 		weston_output_flush_damage_for_plane(&output->base,
 						     &output->cursor_plane->base,
 						     &damage);
-		if (pixman_region32_not_empty(&damage)) {
-			output->current_cursor++;
+		if (pixman_region32_not_empty(&damage))
 			output->current_cursor =
-				output->current_cursor %
-					ARRAY_LENGTH(output->gbm_cursor_fb);
-			cursor_bo_update(output, output->cursor_view);
-		}
+				cursor_bo_update(output, output->cursor_view);
 		pixman_region32_fini(&damage);
 
 		cursor_state->fb = drm_fb_ref(output->gbm_cursor_fb[output->current_cursor]);
@@ -756,6 +1030,9 @@ drm_output_repaint(struct weston_output *output_base)
 	if (drm_output_ensure_hdr_output_metadata_blob(output) < 0)
 		goto err;
 
+	if (output->color_pipeline_serial != output_base->color_outcome_serial)
+		drm_output_update_color_pipeline(output);
+
 	if (device->atomic_modeset)
 		drm_output_pick_writeback_capture_task(output);
 
@@ -765,6 +1042,21 @@ drm_output_repaint(struct weston_output *output_base)
 	if (!scanout_state || !scanout_state->fb)
 		goto err;
 
+	state->vrr_enabled = drm_output_state_wants_vrr(state, scanout_state);
+	state->content_type = drm_output_state_content_type(state,
+							    scanout_state);
+
+	/* Only the repaint the idle timer asked for runs at the lower
+	 * refresh rate, any other one, i.e. damage, restores the mode's. */
+	drm_output_state_set_idle_refresh(state, output->idle_refresh_enter);
+	output->idle_refresh_enter = false;
+	if (!state->idle_refresh)
+		drm_output_arm_idle_refresh(output);
+
+	if (device->backend->vblank_sequence)
+		output->repaint_target_msc =
+			drm_output_repaint_target_msc(output, state);
+
 	return 0;
 
 err:
@@ -797,6 +1089,43 @@ drm_waitvblank_pipe(struct drm_crtc *crtc)
 		return 0;
 }
 
+/* Takes the last vblank from the CRTC's 64-bit sequence counter, with a
+ * nanosecond timestamp. When the vblank interrupt was off and the counter
+ * is stale, waits for the next vblank instead of page flipping just to
+ * learn when it is. */
+static int
+drm_output_start_repaint_loop_sequence(struct drm_output *output)
+{
+	struct drm_device *device = output->device;
+	struct weston_compositor *compositor = output->base.compositor;
+	struct drm_crtc *crtc = output->crtc;
+	struct timespec ts, now;
+	uint64_t seq, ns;
+	int64_t refresh_nsec;
+
+	refresh_nsec = millihz_to_nsec(output->base.current_mode->refresh);
+	if (drmCrtcGetSequence(device->drm.fd, crtc->crtc_id, &seq, &ns) == 0 &&
+	    ns > 0) {
+		timespec_from_nsec(&ts, ns);
+		weston_compositor_read_presentation_clock(compositor, &now);
+		if (timespec_sub_to_nsec(&now, &ts) < refresh_nsec) {
+			output->base.msc = seq;
+			weston_output_finish_frame(&output->base, &ts,
+						   WP_PRESENTATION_FEEDBACK_INVALID);
+			return 0;
+		}
+	}
+
+	if (drmCrtcQueueSequence(device->drm.fd, crtc->crtc_id,
+				 DRM_CRTC_SEQUENCE_RELATIVE, 1, NULL,
+				 (uintptr_t) crtc) != 0)
+		return -1;
+
+	output->vblank_sequence_pending = true;
+
+	return 0;
+}
+
 static int
 drm_output_start_repaint_loop(struct weston_output *output_base)
 {
@@ -843,6 +1172,10 @@ drm_output_start_repaint_loop(struct weston_output *output_base)
 		goto finish_frame;
 	}
 
+	if (backend->vblank_sequence &&
+	    drm_output_start_repaint_loop_sequence(output) == 0)
+		return 0;
+
 	/* Try to get current msc and timestamp via instant query */
 	vbl.request.type |= drm_waitvblank_pipe(output->crtc);
 	ret = drmWaitVBlank(device->drm.fd, &vbl);
@@ -906,7 +1239,7 @@ drm_repaint_begin_device(struct drm_device *device)
 	pending_state = drm_pending_state_alloc(device);
 	device->repaint_data = pending_state;
 
-	if (weston_log_scope_is_enabled(b->debug))
+	if (weston_log_scope_enabled(b->debug))
 		drm_debug(b, "[repaint] Beginning repaint (%s); pending_state %p\n",
 			  device->drm.filename, device->repaint_data);
 }
@@ -932,7 +1265,7 @@ drm_repaint_begin(struct weston_backend *backend)
 			drm_repaint_begin_device(device);
 	}
 
-	if (weston_log_scope_is_enabled(b->debug)) {
+	if (weston_log_scope_enabled(b->debug)) {
 		char *dbg = weston_compositor_print_scene_graph(b->compositor);
 		drm_debug(b, "%s", dbg);
 		free(dbg);
@@ -995,6 +1328,58 @@ drm_repaint_flush(struct weston_backend *backend)
 		drm_repaint_flush_device(device);
 }
 
+/**
+ * Flush a device early
+ *
+ * Called by the core compositor after each successful output repaint. With
+ * independent device commits enabled, the pending state of the output's
+ * device is applied right away once no other output of that device is left
+ * to be repainted in this cycle, so the other devices' outputs cannot delay
+ * its page flips.
+ */
+static void
+drm_repaint_output_done(struct weston_backend *backend,
+			struct weston_output *output_base)
+{
+	struct drm_backend *b = container_of(backend, struct drm_backend, base);
+	struct drm_output *output = to_drm_output(output_base);
+	struct drm_device *device;
+	struct weston_output *base;
+
+	if (!b->independent_device_commits || wl_list_empty(&b->kms_list))
+		return;
+
+	if (!output)
+		return;
+
+	device = output->device;
+	if (!device->repaint_data)
+		return;
+
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		struct drm_output *tmp = to_drm_output(base);
+
+		if (!tmp || tmp->device != device)
+			continue;
+
+		if (base->will_repaint && !base->repainted)
+			return;
+	}
+
+	drm_debug(b, "[repaint] flushing %s early\n", device->drm.filename);
+
+	/* Failures are handled for the device's outputs here; a later
+	 * repaint_cancel must leave them alone. */
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		struct drm_output *tmp = to_drm_output(base);
+
+		if (tmp && tmp->device == device)
+			base->repainted = false;
+	}
+
+	drm_repaint_flush_device(device);
+}
+
 static void
 drm_repaint_cancel_device(struct drm_device *device)
 {
@@ -1033,6 +1418,92 @@ drm_output_init_pixman(struct drm_output *output, struct drm_backend *b);
 static void
 drm_output_fini_pixman(struct drm_output *output);
 
+static int
+drm_output_init_noop(struct drm_output *output);
+
+static void
+drm_output_fini_noop(struct drm_output *output);
+
+/* Set up what the renderer draws the output with */
+static int
+drm_output_init_renderer(struct drm_output *output)
+{
+	struct drm_backend *b = output->backend;
+
+	if (b->compositor->renderer->type == WESTON_RENDERER_PIXMAN) {
+		if (drm_output_init_pixman(output, b) < 0) {
+			weston_log("Failed to init output pixman state\n");
+			return -1;
+		}
+	} else if (b->compositor->renderer->type == WESTON_RENDERER_NOOP) {
+		if (drm_output_init_noop(output) < 0) {
+			weston_log("Failed to init output dumb buffers\n");
+			return -1;
+		}
+	} else if (drm_output_init_egl(output, b) < 0) {
+		weston_log("Failed to init output gl state\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+drm_output_fini_renderer(struct drm_output *output)
+{
+	struct drm_backend *b = output->backend;
+
+	if (b->compositor->renderer->type == WESTON_RENDERER_PIXMAN)
+		drm_output_fini_pixman(output);
+	else if (b->compositor->renderer->type == WESTON_RENDERER_NOOP)
+		drm_output_fini_noop(output);
+	else
+		drm_output_fini_egl(output);
+}
+
+/* DPMS off has reached the display, and nothing gets repainted on the
+ * output until it is back on, see weston_output_schedule_repaint(). The
+ * overlay planes kept for it go to the other outputs; with the
+ * dpms-off-release-buffers option, the buffers the renderer and the
+ * scanout paths hold for it are freed as well. */
+static void
+drm_output_sleep(struct drm_output *output)
+{
+	struct drm_backend *b = output->backend;
+
+	drm_plane_broker_release_output(output);
+	output->propose_cache.valid = false;
+
+	if (!b->dpms_off_release_buffers || output->renderer_released)
+		return;
+
+	drm_output_fini_renderer(output);
+	drm_output_fini_shm_scanout(output);
+	drm_fb_unref(output->wb_dumb_fb);
+	output->wb_dumb_fb = NULL;
+	output->renderer_released = true;
+
+	drm_debug(b, "[repaint] %s: released buffers while off\n",
+		  output->base.name);
+}
+
+/* Undoes drm_output_sleep(), before the output gets repainted again */
+static int
+drm_output_wake(struct drm_output *output)
+{
+	if (!output->renderer_released)
+		return 0;
+
+	if (drm_output_init_renderer(output) < 0)
+		return -1;
+	output->renderer_released = false;
+
+	drm_debug(output->backend, "[repaint] %s: buffers restored\n",
+		  output->base.name);
+
+	return 0;
+}
+
 static int
 drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mode)
 {
@@ -1069,7 +1540,6 @@ static int
 drm_output_apply_mode(struct drm_output *output)
 {
 	struct drm_device *device = output->device;
-	struct drm_backend *b = device->backend;
 	struct weston_size fb_size;
 
 	/* XXX: This drops our current buffer too early, before we've started
@@ -1083,22 +1553,16 @@ drm_output_apply_mode(struct drm_output *output)
 	fb_size.width = output->base.current_mode->width;
 	fb_size.height = output->base.current_mode->height;
 
-	weston_renderer_resize_output(&output->base, &fb_size, NULL);
+	/* Asleep without buffers, they come back in the new mode on wake */
+	if (!output->renderer_released) {
+		weston_renderer_resize_output(&output->base, &fb_size, NULL);
 
-	if (b->compositor->renderer->type == WESTON_RENDERER_PIXMAN) {
-		drm_output_fini_pixman(output);
-		if (drm_output_init_pixman(output, b) < 0) {
-			weston_log("failed to init output pixman state with "
+		drm_output_fini_renderer(output);
+		if (drm_output_init_renderer(output) < 0) {
+			weston_log("failed to init output renderer state with "
 				   "new mode\n");
 			return -1;
 		}
-	} else {
-		drm_output_fini_egl(output);
-		if (drm_output_init_egl(output, b) < 0) {
-			weston_log("failed to init output egl state with "
-				   "new mode");
-			return -1;
-		}
 	}
 
 	if (device->atomic_modeset)
@@ -1202,8 +1666,12 @@ drm_plane_create(struct drm_device *device, const drmModePlane *kplane)
 		goto err;
 	}
 
+	drm_plane_populate_color_pipeline(plane, props);
+
 	drmModeFreeObjectProperties(props);
 
+	plane->scans_out_yuv = drm_plane_can_scan_out_yuv(plane);
+
 	if (plane->type == WDRM_PLANE_TYPE__COUNT)
 		goto err_props;
 
@@ -1221,6 +1689,7 @@ drm_plane_create(struct drm_device *device, const drmModePlane *kplane)
 	return plane;
 
 err_props:
+	drm_plane_destroy_color_pipeline(plane);
 	drm_property_info_free(plane->props, WDRM_PLANE__COUNT);
 err:
 	weston_drm_format_array_fini(&plane->formats);
@@ -1303,6 +1772,7 @@ drm_plane_destroy(struct drm_plane *plane)
 		drmModeSetPlane(device->drm.fd, plane->plane_id,
 				0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
 	drm_plane_state_free(plane->state_cur, true);
+	drm_plane_destroy_color_pipeline(plane);
 	drm_property_info_free(plane->props, WDRM_PLANE__COUNT);
 	weston_plane_release(&plane->base);
 	weston_drm_format_array_fini(&plane->formats);
@@ -1495,6 +1965,10 @@ drm_set_dpms(struct weston_output *output_base, enum dpms_enum level)
 	if (output->state_cur->dpms == level)
 		return;
 
+	if (level == WESTON_DPMS_ON && drm_output_wake(output) < 0)
+		weston_log("%s: cannot restore the output buffers after DPMS "
+			   "off\n", output_base->name);
+
 	/* If we're being called during the repaint loop, then this is
 	 * simple: discard any previously-generated state, and create a new
 	 * state where we disable everything. When we come to flush, this
@@ -1539,6 +2013,8 @@ drm_set_dpms(struct weston_output *output_base, enum dpms_enum level)
 	ret = drm_pending_state_apply_sync(pending_state);
 	if (ret != 0)
 		weston_log("drm_set_dpms: couldn't disable output?\n");
+	else
+		drm_output_sleep(output);
 }
 
 static const char * const connector_type_names[] = {
@@ -1619,54 +2095,100 @@ drm_output_init_pixman(struct drm_output *output, struct drm_backend *b)
 	/* FIXME error checking */
 	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
 		output->dumb[i] = drm_fb_create_dumb(device, w, h,
-						     options.format->format);
+						     options.format->format);
+		if (!output->dumb[i])
+			goto err;
+
+		output->renderbuffer[i] =
+			pixman->create_image_from_ptr(&output->base,
+						      options.format, w, h,
+						      output->dumb[i]->map,
+						      output->dumb[i]->strides[0]);
+		if (!output->renderbuffer[i])
+			goto err;
+	}
+
+	weston_log("DRM: output %s %s shadow framebuffer.\n", output->base.name,
+		   b->use_pixman_shadow ? "uses" : "does not use");
+
+	return 0;
+
+err:
+	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
+		if (output->dumb[i])
+			drm_fb_unref(output->dumb[i]);
+		if (output->renderbuffer[i])
+			weston_renderbuffer_unref(output->renderbuffer[i]);
+
+		output->dumb[i] = NULL;
+		output->renderbuffer[i] = NULL;
+	}
+	pixman->output_destroy(&output->base);
+
+	return -1;
+}
+
+static void
+drm_output_fini_pixman(struct drm_output *output)
+{
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct drm_backend *b = output->backend;
+	unsigned int i;
+
+	/* Destroying the Pixman surface will destroy all our buffers,
+	 * regardless of refcount. Ensure we destroy them here. */
+	if (!b->compositor->shutting_down &&
+	    output->scanout_plane->state_cur->fb &&
+	    output->scanout_plane->state_cur->fb->type == BUFFER_PIXMAN_DUMB) {
+		drm_plane_reset_state(output->scanout_plane);
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
+		weston_renderbuffer_unref(output->renderbuffer[i]);
+		drm_fb_unref(output->dumb[i]);
+		output->dumb[i] = NULL;
+		output->renderbuffer[i] = NULL;
+	}
+
+	renderer->pixman->output_destroy(&output->base);
+}
+
+/* Only the dumb buffers of the Pixman case, which stay black. */
+static int
+drm_output_init_noop(struct drm_output *output)
+{
+	struct drm_device *device = output->device;
+	int w = output->base.current_mode->width;
+	int h = output->base.current_mode->height;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
+		output->dumb[i] = drm_fb_create_dumb(device, w, h,
+						     output->format->format);
 		if (!output->dumb[i])
 			goto err;
-
-		output->renderbuffer[i] =
-			pixman->create_image_from_ptr(&output->base,
-						      options.format, w, h,
-						      output->dumb[i]->map,
-						      output->dumb[i]->strides[0]);
-		if (!output->renderbuffer[i])
-			goto err;
-
-		pixman_region32_init_rect(&output->renderbuffer[i]->damage,
-					  output->base.pos.c.x,
-					  output->base.pos.c.y,
-					  output->base.width,
-					  output->base.height);
 	}
 
-	weston_log("DRM: output %s %s shadow framebuffer.\n", output->base.name,
-		   b->use_pixman_shadow ? "uses" : "does not use");
+	weston_log("DRM: output %s uses the no-op renderer, "
+		   "nothing will be drawn.\n", output->base.name);
 
 	return 0;
 
 err:
 	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
-		if (output->dumb[i])
-			drm_fb_unref(output->dumb[i]);
-		if (output->renderbuffer[i])
-			weston_renderbuffer_unref(output->renderbuffer[i]);
-
+		drm_fb_unref(output->dumb[i]);
 		output->dumb[i] = NULL;
-		output->renderbuffer[i] = NULL;
 	}
-	pixman->output_destroy(&output->base);
 
 	return -1;
 }
 
 static void
-drm_output_fini_pixman(struct drm_output *output)
+drm_output_fini_noop(struct drm_output *output)
 {
-	struct weston_renderer *renderer = output->base.compositor->renderer;
 	struct drm_backend *b = output->backend;
 	unsigned int i;
 
-	/* Destroying the Pixman surface will destroy all our buffers,
-	 * regardless of refcount. Ensure we destroy them here. */
 	if (!b->compositor->shutting_down &&
 	    output->scanout_plane->state_cur->fb &&
 	    output->scanout_plane->state_cur->fb->type == BUFFER_PIXMAN_DUMB) {
@@ -1674,13 +2196,9 @@ drm_output_fini_pixman(struct drm_output *output)
 	}
 
 	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
-		weston_renderbuffer_unref(output->renderbuffer[i]);
 		drm_fb_unref(output->dumb[i]);
 		output->dumb[i] = NULL;
-		output->renderbuffer[i] = NULL;
 	}
-
-	renderer->pixman->output_destroy(&output->base);
 }
 
 static void
@@ -1872,6 +2390,75 @@ drm_output_set_content_type(struct weston_output *base,
 	return -1;
 }
 
+static const struct { const char *name; enum drm_vrr_mode mode; } vrr_modes[] = {
+	{ "off",        DRM_VRR_MODE_OFF },
+	{ "fullscreen", DRM_VRR_MODE_FULLSCREEN },
+	{ "content",    DRM_VRR_MODE_CONTENT },
+	{ "on",         DRM_VRR_MODE_ON },
+};
+
+static int
+drm_output_set_vrr_mode(struct weston_output *base, const char *vrr_mode)
+{
+	unsigned int i;
+	struct drm_output *output = to_drm_output(base);
+
+	if (vrr_mode == NULL) {
+		output->vrr_mode = DRM_VRR_MODE_OFF;
+		return 0;
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(vrr_modes); i++)
+		if (strcmp(vrr_modes[i].name, vrr_mode) == 0) {
+			output->vrr_mode = vrr_modes[i].mode;
+			return 0;
+		}
+
+	weston_log("Error: unknown vrr-mode for output %s: \"%s\"\n",
+		   base->name, vrr_mode);
+	output->vrr_mode = DRM_VRR_MODE_OFF;
+	return -1;
+}
+
+static void
+drm_output_set_color_offload(struct weston_output *base, bool offload)
+{
+	struct drm_output *output = to_drm_output(base);
+
+	output->color_offload = offload;
+}
+
+static void
+drm_output_set_idle_refresh_timeout(struct weston_output *base,
+				    uint32_t timeout_sec)
+{
+	struct drm_output *output = to_drm_output(base);
+	struct drm_device *device = output->device;
+	struct wl_event_loop *loop;
+
+	output->idle_refresh_timeout_ms = timeout_sec * 1000;
+
+	if (output->idle_refresh_timer) {
+		wl_event_source_remove(output->idle_refresh_timer);
+		output->idle_refresh_timer = NULL;
+	}
+
+	if (timeout_sec == 0)
+		return;
+
+	/* Legacy KMS cannot change the mode along with a page flip */
+	if (!device->atomic_modeset) {
+		weston_log("%s: idle-refresh-timeout needs atomic "
+			   "modesetting, ignoring it\n", base->name);
+		return;
+	}
+
+	loop = wl_display_get_event_loop(base->compositor->wl_display);
+	output->idle_refresh_timer =
+		wl_event_loop_add_timer(loop, drm_output_idle_refresh_handler,
+					output);
+}
+
 static int
 drm_output_init_gamma_size(struct drm_output *output)
 {
@@ -1923,6 +2510,11 @@ drm_output_pick_crtc(struct drm_output *output)
 	unsigned int i;
 	bool match;
 
+	/* What drove these heads on the last run, on the same hardware */
+	crtc = drm_config_cache_get_crtc(output);
+	if (crtc)
+		return crtc;
+
 	/* This algorithm ignores drmModeEncoder::possible_clones restriction,
 	 * because it is more often set wrong than not in the kernel. */
 
@@ -2034,6 +2626,12 @@ drm_crtc_create(struct drm_device *device, uint32_t crtc_id, uint32_t pipe)
 
 	drm_property_info_populate(device, crtc_props, crtc->props_crtc,
 				   WDRM_CRTC__COUNT, props);
+	crtc->degamma_lut_size =
+		drm_property_get_value(&crtc->props_crtc[WDRM_CRTC_DEGAMMA_LUT_SIZE],
+				       props, 0);
+	crtc->gamma_lut_size =
+		drm_property_get_value(&crtc->props_crtc[WDRM_CRTC_GAMMA_LUT_SIZE],
+				       props, 0);
 	crtc->device = device;
 	crtc->crtc_id = crtc_id;
 	crtc->pipe = pipe;
@@ -2312,11 +2910,14 @@ drm_output_enable(struct weston_output *base)
 	 * not find DRM objects available and fail. So we spin here until the
 	 * flip completes and the output gets destroyed/disabled and release the
 	 * DRM objects. */
+	if (device->commit_thread)
+		drm_commit_thread_flush(device->commit_thread);
 	while (should_wait_drm_events(device))
 		on_drm_input(device->drm.fd, 0 /* unused mask */, device);
 
 	if (!output->format) {
-		if (output->base.eotf_mode != WESTON_EOTF_MODE_SDR)
+		if (output->base.eotf_mode != WESTON_EOTF_MODE_SDR ||
+		    output->color_offload)
 			output->format =
 				pixel_format_get_info(DRM_FORMAT_XRGB2101010);
 		else
@@ -2338,18 +2939,15 @@ drm_output_enable(struct weston_output *base)
 	if (drm_output_init_gamma_size(output) < 0)
 		goto err_planes;
 
+	/* Before the renderer, which must know who does the blend-to-output
+	 * color transformation. */
+	drm_output_update_color_pipeline(output);
+
 	if (b->pageflip_timeout)
 		drm_output_pageflip_timer_create(output);
 
-	if (b->compositor->renderer->type == WESTON_RENDERER_PIXMAN) {
-		if (drm_output_init_pixman(output, b) < 0) {
-			weston_log("Failed to init output pixman state\n");
-			goto err_planes;
-		}
-	} else if (drm_output_init_egl(output, b) < 0) {
-		weston_log("Failed to init output gl state\n");
+	if (drm_output_init_renderer(output) < 0)
 		goto err_planes;
-	}
 
 	drm_output_init_backlight(output);
 
@@ -2358,6 +2956,7 @@ drm_output_enable(struct weston_output *base)
 	output->base.repaint = drm_output_repaint;
 	output->base.assign_planes = drm_assign_planes;
 	output->base.set_dpms = drm_set_dpms;
+	output->base.move_cursor = drm_output_move_cursor;
 	output->base.switch_mode = drm_output_switch_mode;
 	output->base.set_gamma = drm_output_set_gamma;
 
@@ -2371,9 +2970,17 @@ drm_output_enable(struct weston_output *base)
 		   output->base.name, output->crtc->crtc_id);
 	drm_output_print_modes(output);
 
+	if (output->vrr_mode != DRM_VRR_MODE_OFF &&
+	    !drm_output_is_vrr_capable(output))
+		weston_log("Output %s: variable refresh rate requested but "
+			   "not supported\n", output->base.name);
+
+	drm_config_cache_output_enabled(output);
+
 	return 0;
 
 err_planes:
+	drm_output_release_color_pipeline(output);
 	drm_output_deinit_planes(output);
 err_crtc:
 	drm_output_detach_crtc(output);
@@ -2394,19 +3001,32 @@ drm_output_deinit(struct weston_output *base)
 		drm_pending_state_apply_sync(pending);
 	}
 
-	if (b->compositor->renderer->type == WESTON_RENDERER_PIXMAN)
-		drm_output_fini_pixman(output);
-	else
-		drm_output_fini_egl(output);
+	if (!output->renderer_released)
+		drm_output_fini_renderer(output);
+	output->renderer_released = false;
 
+	drm_output_fini_shm_scanout(output);
+	drm_plane_broker_release_output(output);
 	drm_output_deinit_planes(output);
 	drm_output_detach_crtc(output);
 
+	drm_fb_unref(output->wb_dumb_fb);
+	output->wb_dumb_fb = NULL;
+
 	if (output->hdr_output_metadata_blob_id) {
 		drmModeDestroyPropertyBlob(device->drm.fd,
 					   output->hdr_output_metadata_blob_id);
 		output->hdr_output_metadata_blob_id = 0;
 	}
+
+	drm_output_release_color_pipeline(output);
+
+	if (output->idle_refresh_timer)
+		wl_event_source_timer_update(output->idle_refresh_timer, 0);
+	output->idle_refresh_mode = NULL;
+	output->idle_refresh_enter = false;
+	output->vblank_sequence_pending = false;
+	output->repaint_target_msc = 0;
 }
 
 void
@@ -2439,11 +3059,18 @@ drm_output_destroy(struct weston_output *base)
 	if (output->base.enabled)
 		drm_output_deinit(&output->base);
 
+	drm_output_fini_shm_scanout(output);
+	pixman_region32_fini(&output->shm_scanout.damage[0]);
+	pixman_region32_fini(&output->shm_scanout.damage[1]);
+
 	drm_mode_list_destroy(device, &output->base.mode_list);
 
 	if (output->pageflip_timer)
 		wl_event_source_remove(output->pageflip_timer);
 
+	if (output->idle_refresh_timer)
+		wl_event_source_remove(output->idle_refresh_timer);
+
 	weston_output_release(&output->base);
 
 	assert(!output->state_last);
@@ -2452,6 +3079,7 @@ drm_output_destroy(struct weston_output *base)
 	assert(output->hdr_output_metadata_blob_id == 0);
 
 	wl_list_remove(&output->disable_head);
+	wl_array_release(&output->overlay_scores);
 
 	free(output);
 }
@@ -2850,10 +3478,14 @@ drm_output_create(struct weston_backend *backend, const char *name)
 	output->crtc = NULL;
 
 	wl_list_init(&output->disable_head);
+	pixman_region32_init(&output->shm_scanout.damage[0]);
+	pixman_region32_init(&output->shm_scanout.damage[1]);
+	wl_array_init(&output->overlay_scores);
 
 	output->max_bpc = 16;
 #ifdef BUILD_DRM_GBM
 	output->gbm_bo_flags = GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING;
+	output->render_fence_fd = -1;
 #endif
 
 	weston_output_init(&output->base, b->compositor, name);
@@ -2915,6 +3547,10 @@ drm_writeback_success_screenshot(struct drm_writeback_state *state)
 	int dst_stride, src_stride;
 	uint32_t *src, *dst;
 
+	/* A dmabuf destination was written by the writeback itself. */
+	if (buffer->type != WESTON_BUFFER_SHM)
+		goto out;
+
 	src = state->fb->map;
 	src_stride = state->fb->strides[0];
 
@@ -2930,6 +3566,7 @@ drm_writeback_success_screenshot(struct drm_writeback_state *state)
 			       width, height);
 	wl_shm_buffer_end_access(buffer->shm_buffer);
 
+out:
 	weston_capture_task_retire_complete(state->ct);
 	drm_writeback_state_free(state);
 	output->wb_state = NULL;
@@ -3154,6 +3791,112 @@ drm_backend_add_connector(struct drm_device *device, drmModeConnector *conn,
 	return ret;
 }
 
+struct drm_connector_probe {
+	pthread_t thread;
+	int fd;
+	int count;
+	const uint32_t *connector_ids;
+	drmModeConnector **conns;
+};
+
+static void *
+drm_connector_probe_run(void *data)
+{
+	struct drm_connector_probe *probe = data;
+	int i;
+
+	for (i = 0; i < probe->count; i++)
+		probe->conns[i] = drmModeGetConnector(probe->fd,
+						      probe->connector_ids[i]);
+
+	return NULL;
+}
+
+/** Start reading the connectors of a device on a thread
+ *
+ * drmModeGetConnector() has the kernel probe the connector, which reads the
+ * EDID of a monitor over DDC, slow on some hubs. The kernel probes the
+ * connectors of one device one at a time, so one thread per device reads
+ * them while the main thread carries on with setting up the renderer, input
+ * and other devices. drm_backend_discover_connectors() picks the results up.
+ *
+ * @param device The DRM device structure
+ * @param resources The DRM resources, must stay until the discovery
+ */
+static void
+drm_device_start_connector_probe(struct drm_device *device,
+				 drmModeRes *resources)
+{
+	struct drm_connector_probe *probe;
+	sigset_t blocked, saved;
+	int ret;
+
+	if (resources->count_connectors == 0)
+		return;
+
+	/* On failure, the connectors get read on the main thread instead */
+	probe = zalloc(sizeof *probe);
+	if (!probe)
+		return;
+	probe->fd = device->drm.fd;
+	probe->count = resources->count_connectors;
+	probe->connector_ids = resources->connectors;
+	probe->conns = calloc(probe->count, sizeof *probe->conns);
+	if (!probe->conns) {
+		free(probe);
+		return;
+	}
+
+	sigfillset(&blocked);
+	pthread_sigmask(SIG_BLOCK, &blocked, &saved);
+	ret = pthread_create(&probe->thread, NULL,
+			     drm_connector_probe_run, probe);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (ret != 0) {
+		free(probe->conns);
+		free(probe);
+		return;
+	}
+
+	device->connector_probe = probe;
+}
+
+/* Waits for the probe thread, returns the connectors it read, or NULL
+ * if there is none. */
+static drmModeConnector **
+drm_device_finish_connector_probe(struct drm_device *device)
+{
+	struct drm_connector_probe *probe = device->connector_probe;
+	drmModeConnector **conns;
+
+	if (!probe)
+		return NULL;
+
+	pthread_join(probe->thread, NULL);
+	conns = probe->conns;
+	free(probe);
+	device->connector_probe = NULL;
+
+	return conns;
+}
+
+static void
+drm_device_discard_connector_probe(struct drm_device *device)
+{
+	struct drm_connector_probe *probe = device->connector_probe;
+	drmModeConnector **conns;
+	int count, i;
+
+	if (!probe)
+		return;
+
+	count = probe->count;
+	conns = drm_device_finish_connector_probe(device);
+	for (i = 0; i < count; i++)
+		drmModeFreeConnector(conns[i]);
+	free(conns);
+}
+
 /** Find all connectors of the fd and create drm_head or drm_writeback objects
  * (depending on the type of connector they are) for each of them
  *
@@ -3169,6 +3912,7 @@ drm_backend_discover_connectors(struct drm_device *device,
 				struct udev_device *drm_device,
 				drmModeRes *resources)
 {
+	drmModeConnector **conns;
 	drmModeConnector *conn;
 	int i, ret;
 
@@ -3177,10 +3921,15 @@ drm_backend_discover_connectors(struct drm_device *device,
 	device->min_height = resources->min_height;
 	device->max_height = resources->max_height;
 
+	conns = drm_device_finish_connector_probe(device);
+
 	for (i = 0; i < resources->count_connectors; i++) {
 		uint32_t connector_id = resources->connectors[i];
 
-		conn = drmModeGetConnector(device->drm.fd, connector_id);
+		if (conns)
+			conn = conns[i];
+		else
+			conn = drmModeGetConnector(device->drm.fd, connector_id);
 		if (!conn)
 			continue;
 
@@ -3189,6 +3938,8 @@ drm_backend_discover_connectors(struct drm_device *device,
 			drmModeFreeConnector(conn);
 	}
 
+	free(conns);
+
 	return 0;
 }
 
@@ -3203,6 +3954,45 @@ resources_has_connector(drmModeRes *resources, uint32_t connector_id)
 	return false;
 }
 
+/** Update the head or writeback of a connector, or create one for it
+ *
+ * @param device The DRM device structure
+ * @param conn The DRM connector object
+ * @param drm_device udev device pointer
+ *
+ * Takes ownership of @c conn.
+ */
+static void
+drm_backend_update_connector_info(struct drm_device *device,
+				  drmModeConnector *conn,
+				  struct udev_device *drm_device)
+{
+	struct drm_backend *b = device->backend;
+	struct drm_head *head;
+	struct drm_writeback *writeback;
+	int ret;
+
+	head = drm_head_find_by_connector(b, device, conn->connector_id);
+	writeback = drm_writeback_find_by_connector(device, conn->connector_id);
+
+	/* Connector can't be owned by both a head and a writeback, so
+	 * one of the searches must fail. */
+	assert(head == NULL || writeback == NULL);
+
+	if (head) {
+		ret = drm_head_update_info(head, conn);
+		if (head->base.device_changed)
+			drm_head_log_info(head, "updated");
+	} else if (writeback) {
+		ret = drm_writeback_update_info(writeback, conn);
+	} else {
+		ret = drm_backend_add_connector(device, conn, drm_device);
+	}
+
+	if (ret < 0)
+		drmModeFreeConnector(conn);
+}
+
 static void
 drm_backend_update_connectors(struct drm_device *device,
 			      struct udev_device *drm_device)
@@ -3214,7 +4004,7 @@ drm_backend_update_connectors(struct drm_device *device,
 	struct drm_head *head;
 	struct drm_writeback *writeback, *writeback_next;
 	uint32_t connector_id;
-	int i, ret;
+	int i;
 
 	resources = drmModeGetResources(device->drm.fd);
 	if (!resources) {
@@ -3230,25 +4020,7 @@ drm_backend_update_connectors(struct drm_device *device,
 		if (!conn)
 			continue;
 
-		head = drm_head_find_by_connector(b, device, connector_id);
-		writeback = drm_writeback_find_by_connector(device, connector_id);
-
-		/* Connector can't be owned by both a head and a writeback, so
-		 * one of the searches must fail. */
-		assert(head == NULL || writeback == NULL);
-
-		if (head) {
-			ret = drm_head_update_info(head, conn);
-			if (head->base.device_changed)
-				drm_head_log_info(head, "updated");
-		} else if (writeback) {
-			ret = drm_writeback_update_info(writeback, conn);
-		} else {
-			ret = drm_backend_add_connector(device, conn, drm_device);
-		}
-
-		if (ret < 0)
-			drmModeFreeConnector(conn);
+		drm_backend_update_connector_info(device, conn, drm_device);
 	}
 
 	/* Destroy head objects of connectors (except writeback connectors) that
@@ -3288,6 +4060,38 @@ drm_backend_update_connectors(struct drm_device *device,
 	drmModeFreeResources(resources);
 }
 
+/** Re-probe the one connector a hotplug event is about
+ *
+ * @param device The DRM device structure
+ * @param drm_device udev device pointer
+ * @param connector_id The connector named by the event
+ *
+ * Connectors we do not know about yet, and known connectors that are gone,
+ * change the connector list itself, so those fall back to a full update.
+ */
+static void
+drm_backend_update_connector(struct drm_device *device,
+			     struct udev_device *drm_device,
+			     uint32_t connector_id)
+{
+	struct drm_backend *b = device->backend;
+	drmModeConnector *conn;
+
+	if (!drm_head_find_by_connector(b, device, connector_id) &&
+	    !drm_writeback_find_by_connector(device, connector_id)) {
+		drm_backend_update_connectors(device, drm_device);
+		return;
+	}
+
+	conn = drmModeGetConnector(device->drm.fd, connector_id);
+	if (!conn) {
+		drm_backend_update_connectors(device, drm_device);
+		return;
+	}
+
+	drm_backend_update_connector_info(device, conn, drm_device);
+}
+
 static enum wdrm_connector_property
 drm_connector_find_property_by_id(struct drm_connector *connector,
 				  uint32_t property_id)
@@ -3352,6 +4156,22 @@ udev_event_is_hotplug(struct drm_device *device, struct udev_device *udev_device
 	return strcmp(val, "1") == 0;
 }
 
+static int
+udev_event_get_connector(struct udev_device *udev_device,
+			 uint32_t *connector_id)
+{
+	const char *val;
+	int id;
+
+	val = udev_device_get_property_value(udev_device, "CONNECTOR");
+	if (!val || !safe_strtoint(val, &id))
+		return 0;
+
+	*connector_id = id;
+
+	return 1;
+}
+
 static int
 udev_event_is_conn_prop_change(struct drm_backend *b,
 			       struct udev_device *udev_device,
@@ -3362,11 +4182,8 @@ udev_event_is_conn_prop_change(struct drm_backend *b,
 	const char *val;
 	int id;
 
-	val = udev_device_get_property_value(udev_device, "CONNECTOR");
-	if (!val || !safe_strtoint(val, &id))
+	if (!udev_event_get_connector(udev_device, connector_id))
 		return 0;
-	else
-		*connector_id = id;
 
 	val = udev_device_get_property_value(udev_device, "PROPERTY");
 	if (!val || !safe_strtoint(val, &id))
@@ -3377,30 +4194,37 @@ udev_event_is_conn_prop_change(struct drm_backend *b,
 	return 1;
 }
 
+static void
+drm_backend_handle_hotplug(struct drm_backend *b, struct drm_device *device,
+			   struct udev_device *event)
+{
+	uint32_t conn_id, prop_id;
+
+	/* Events naming a connector only concern that one connector, so
+	 * spare re-probing every other one on the device. */
+	if (udev_event_is_conn_prop_change(b, event, &conn_id, &prop_id))
+		drm_backend_update_conn_props(b, device, conn_id, prop_id);
+	else if (udev_event_get_connector(event, &conn_id))
+		drm_backend_update_connector(device, event, conn_id);
+	else
+		drm_backend_update_connectors(device, event);
+}
+
 static int
 udev_drm_event(int fd, uint32_t mask, void *data)
 {
 	struct drm_backend *b = data;
 	struct udev_device *event;
-	uint32_t conn_id, prop_id;
 	struct drm_device *device;
 
 	event = udev_monitor_receive_device(b->udev_monitor);
 
-	if (udev_event_is_hotplug(b->drm, event)) {
-		if (udev_event_is_conn_prop_change(b, event, &conn_id, &prop_id))
-			drm_backend_update_conn_props(b, b->drm, conn_id, prop_id);
-		else
-			drm_backend_update_connectors(b->drm, event);
-	}
+	if (udev_event_is_hotplug(b->drm, event))
+		drm_backend_handle_hotplug(b, b->drm, event);
 
 	wl_list_for_each(device, &b->kms_list, link) {
-		if (udev_event_is_hotplug(device, event)) {
-			if (udev_event_is_conn_prop_change(b, event, &conn_id, &prop_id))
-				drm_backend_update_conn_props(b, device, conn_id, prop_id);
-			else
-				drm_backend_update_connectors(device, event);
-		}
+		if (udev_event_is_hotplug(device, event))
+			drm_backend_handle_hotplug(b, device, event);
 	}
 
 	udev_device_unref(event);
@@ -3415,6 +4239,11 @@ drm_shutdown(struct weston_backend *backend)
 	struct weston_compositor *ec = b->compositor;
 	struct weston_output *output_base;
 	struct drm_output *output;
+	struct drm_device *device;
+
+	drm_device_stop_commit_thread(b->drm);
+	wl_list_for_each(device, &b->kms_list, link)
+		drm_device_stop_commit_thread(device);
 
 	udev_input_destroy(&b->input);
 
@@ -3451,6 +4280,10 @@ drm_shutdown(struct weston_backend *backend)
 
 	destroy_sprites(b->drm);
 
+	drm_backend_scanout_stats_fini(b);
+	weston_log_scope_destroy(b->scanout_scope);
+	b->scanout_scope = NULL;
+
 	weston_log_scope_destroy(b->debug);
 	b->debug = NULL;
 }
@@ -3461,12 +4294,15 @@ drm_destroy(struct weston_backend *backend)
 	struct drm_backend *b = container_of(backend, struct drm_backend, base);
 	struct weston_compositor *ec = b->compositor;
 	struct drm_device *device = b->drm;
+	struct drm_device *kms_device;
 	struct weston_head *base, *next;
 	struct drm_crtc *crtc, *crtc_tmp;
 	struct drm_writeback *writeback, *writeback_tmp;
 
 	wl_list_remove(&b->base.link);
 
+	drm_config_cache_destroy(b);
+
 	wl_list_for_each_safe(crtc, crtc_tmp, &b->drm->crtc_list, link)
 		drm_crtc_destroy(crtc);
 
@@ -3479,6 +4315,10 @@ drm_destroy(struct weston_backend *backend)
 			      &b->drm->writeback_connector_list, link)
 		drm_writeback_destroy(writeback);
 
+	drm_fb_cache_flush(b->drm);
+	wl_list_for_each(kms_device, &b->kms_list, link)
+		drm_fb_cache_flush(kms_device);
+
 #ifdef BUILD_DRM_GBM
 	if (b->gbm)
 		gbm_device_destroy(b->gbm);
@@ -3508,9 +4348,23 @@ session_notify(struct wl_listener *listener, void *data)
 
 	if (compositor->session_active) {
 		weston_log("activating session\n");
-		weston_compositor_wake(compositor);
-		weston_compositor_damage_all(compositor);
 		device->state_invalid = true;
+		weston_compositor_wake(compositor);
+
+		if (device->atomic_modeset) {
+			/* Our framebuffers and the renderer's textures
+			 * survive the switch, only KMS state may have been
+			 * changed by the other session. Repaint just what
+			 * changed meanwhile, and take the CRTCs back without
+			 * a modeset if we can, so the last frame stays up. */
+			device->resume_pending = true;
+			wl_list_for_each(output, &compositor->output_list, link)
+				if (to_drm_output(output))
+					weston_output_schedule_repaint(output);
+		} else {
+			weston_compositor_damage_all(compositor);
+		}
+
 		udev_input_enable(&b->input);
 	} else {
 		weston_log("deactivating session\n");
@@ -3770,6 +4624,7 @@ recorder_frame_notify(struct wl_listener *listener, void *data)
 {
 	struct drm_output *output;
 	struct drm_device *device;
+	pixman_region32_t damage;
 	int fd, ret;
 
 	output = container_of(listener, struct drm_output,
@@ -3788,8 +4643,14 @@ recorder_frame_notify(struct wl_listener *listener, void *data)
 		return;
 	}
 
+	pixman_region32_init(&damage);
+	pixman_region32_intersect(&damage, &output->base.region, data);
+	weston_region_global_to_output(&damage, &output->base, &damage);
+
 	ret = vaapi_recorder_frame(output->recorder, fd,
-				   output->scanout_plane->state_cur->fb->strides[0]);
+				   output->scanout_plane->state_cur->fb->strides[0],
+				   &damage);
+	pixman_region32_fini(&damage);
 	if (ret < 0) {
 		weston_log("[libva recorder] aborted: %s\n", strerror(errno));
 		recorder_destroy(output);
@@ -3882,9 +4743,12 @@ drm_device_create(struct drm_backend *backend, const char *name)
 	if (device == NULL)
 		return NULL;
 	device->state_invalid = true;
+	device->fastboot_pending = backend->fastboot;
 	device->drm.fd = -1;
 	device->backend = backend;
 	device->gem_handle_refcnt = hash_table_create();
+	wl_list_init(&device->fb_cache);
+	wl_list_init(&device->solid_fb_cache);
 
 	udev_device = open_specific_drm_device(backend, device, name);
 	if (!udev_device) {
@@ -3897,19 +4761,24 @@ drm_device_create(struct drm_backend *backend, const char *name)
 		goto err;
 	}
 
+	if (backend->kms_thread)
+		drm_device_start_commit_thread(device);
+
 	res = drmModeGetResources(device->drm.fd);
 	if (!res) {
 		weston_log("Failed to get drmModeRes\n");
 		goto err;
 	}
 
+	drm_device_start_connector_probe(device, res);
+
 	wl_list_init(&device->crtc_list);
 	if (drm_backend_create_crtc_list(device, res) == -1) {
 		weston_log("Failed to create CRTC list for DRM-backend\n");
 		goto err;
 	}
 
-	loop = wl_display_get_event_loop(compositor->wl_display);
+	loop = weston_compositor_get_priority_loop(compositor);
 	wl_event_loop_add_fd(loop, device->drm.fd,
 			     WL_EVENT_READABLE, on_drm_input, device);
 
@@ -3927,6 +4796,8 @@ drm_device_create(struct drm_backend *backend, const char *name)
 
 	return device;
 err:
+	drm_device_discard_connector_probe(device);
+	drm_device_stop_commit_thread(device);
 	return NULL;
 }
 
@@ -3961,6 +4832,9 @@ static const struct weston_drm_output_api api = {
 	drm_output_set_seat,
 	drm_output_set_max_bpc,
 	drm_output_set_content_type,
+	drm_output_set_vrr_mode,
+	drm_output_set_color_offload,
+	drm_output_set_idle_refresh_timeout,
 };
 
 static struct drm_backend *
@@ -3999,6 +4873,8 @@ drm_backend_create(struct weston_compositor *compositor,
 	device->gem_handle_refcnt = hash_table_create();
 	if (!device->gem_handle_refcnt)
 		goto err_device;
+	wl_list_init(&device->fb_cache);
+	wl_list_init(&device->solid_fb_cache);
 
 	b->drm = device;
 	wl_list_init(&b->kms_list);
@@ -4006,12 +4882,28 @@ drm_backend_create(struct weston_compositor *compositor,
 	b->compositor = compositor;
 	b->pageflip_timeout = config->pageflip_timeout;
 	b->use_pixman_shadow = config->use_pixman_shadow;
+	b->independent_device_commits = config->independent_device_commits;
+	b->shm_scanout = config->shm_scanout;
+	b->fastboot = config->fastboot;
+	device->fastboot_pending = b->fastboot;
+	b->kms_thread = config->kms_thread;
+	b->vblank_sequence = config->vblank_sequence;
+	b->plane_color_pipeline = config->plane_color_pipeline;
+	b->dpms_off_release_buffers = config->dpms_off_release_buffers;
 	b->has_underlay = false;
 
 	b->debug = weston_compositor_add_log_scope(compositor, "drm-backend",
 						   "Debug messages from DRM/KMS backend\n",
 						   NULL, NULL, NULL);
 
+	wl_list_init(&b->scanout_surface_list);
+	b->scanout_scope =
+		weston_compositor_add_log_scope(compositor, "drm-scanout",
+						"How often outputs and surfaces "
+						"hit scanout, and why not\n",
+						drm_scanout_debug_scope_cb,
+						NULL, b);
+
 	wl_list_insert(&compositor->backend_list, &b->base.link);
 
 	if (parse_gbm_format(config->gbm_format,
@@ -4051,6 +4943,18 @@ drm_backend_create(struct weston_compositor *compositor,
 		goto err_udev_dev;
 	}
 
+	if (b->kms_thread)
+		drm_device_start_commit_thread(device);
+
+	res = drmModeGetResources(b->drm->drm.fd);
+	if (!res) {
+		weston_log("Failed to get drmModeRes\n");
+		goto err_udev_dev;
+	}
+
+	/* Read the connectors while the renderer and input get set up */
+	drm_device_start_connector_probe(device, res);
+
 	if (config->additional_devices)
 		open_additional_devices(b, config->additional_devices);
 
@@ -4066,24 +4970,33 @@ drm_backend_create(struct weston_compositor *compositor,
 	case WESTON_RENDERER_PIXMAN:
 		if (init_pixman(b) < 0) {
 			weston_log("failed to initialize pixman renderer\n");
-			goto err_udev_dev;
+			goto err_create_crtc_list;
 		}
 		break;
 	case WESTON_RENDERER_GL:
 		if (init_egl(b) < 0) {
 			weston_log("failed to initialize egl\n");
-			goto err_udev_dev;
+			goto err_create_crtc_list;
+		}
+		break;
+	case WESTON_RENDERER_NOOP:
+		/* For profiling the CPU side of the compositor and KMS
+		 * without any rendering. */
+		if (noop_renderer_init(compositor) < 0) {
+			weston_log("failed to initialize no-op renderer\n");
+			goto err_create_crtc_list;
 		}
 		break;
 	default:
 		weston_log("unsupported renderer for DRM backend\n");
-		goto err_udev_dev;
+		goto err_create_crtc_list;
 	}
 
 	b->base.shutdown = drm_shutdown;
 	b->base.destroy = drm_destroy;
 	b->base.repaint_begin = drm_repaint_begin;
 	b->base.repaint_flush = drm_repaint_flush;
+	b->base.repaint_output_done = drm_repaint_output_done;
 	b->base.repaint_cancel = drm_repaint_cancel;
 	b->base.create_output = drm_output_create;
 	b->base.device_changed = drm_device_changed;
@@ -4091,12 +5004,6 @@ drm_backend_create(struct weston_compositor *compositor,
 
 	weston_setup_vt_switch_bindings(compositor);
 
-	res = drmModeGetResources(b->drm->drm.fd);
-	if (!res) {
-		weston_log("Failed to get drmModeRes\n");
-		goto err_udev_dev;
-	}
-
 	wl_list_init(&b->drm->crtc_list);
 	if (drm_backend_create_crtc_list(b->drm, res) == -1) {
 		weston_log("Failed to create CRTC list for DRM-backend\n");
@@ -4108,10 +5015,15 @@ drm_backend_create(struct weston_compositor *compositor,
 
 	if (udev_input_init(&b->input,
 			    compositor, b->udev, seat_id,
-			    config->configure_device) < 0) {
+			    config->configure_device,
+			    config->async_input_devices) < 0) {
 		weston_log("failed to create input devices\n");
 		goto err_sprite;
 	}
+	b->input.coalesce_motion = config->coalesce_pointer_motion;
+	b->input.resample = config->resample_touch_tablet;
+	if (config->input_thread && udev_input_start_thread(&b->input) < 0)
+		weston_log("reading input devices on the main loop instead\n");
 
 	wl_list_init(&b->drm->writeback_connector_list);
 	if (drm_backend_discover_connectors(b->drm, drm_device, res) < 0) {
@@ -4124,16 +5036,22 @@ drm_backend_create(struct weston_compositor *compositor,
 	/* 'compute' faked zpos values in case HW doesn't expose any */
 	drm_backend_create_faked_zpos(b->drm);
 
+	if (config->output_cache)
+		drm_config_cache_load(b, config->output_cache);
+
 	/* A this point we have some idea of whether or not we have a working
 	 * cursor plane. */
 	if (!device->cursors_are_broken)
 		compositor->capabilities |= WESTON_CAP_CURSOR_PLANE;
 
-	loop = wl_display_get_event_loop(compositor->wl_display);
+	/* Page flip events must not wait behind client requests */
 	b->drm_source =
-		wl_event_loop_add_fd(loop, b->drm->drm.fd,
+		wl_event_loop_add_fd(weston_compositor_get_priority_loop(compositor),
+				     b->drm->drm.fd,
 				     WL_EVENT_READABLE, on_drm_input, b->drm);
 
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
 	b->udev_monitor = udev_monitor_new_from_netlink(b->udev, "udev");
 	if (b->udev_monitor == NULL) {
 		weston_log("failed to initialize udev monitor\n");
@@ -4188,6 +5106,9 @@ drm_backend_create(struct weston_compositor *compositor,
 		if (linux_explicit_synchronization_setup(compositor) < 0)
 			weston_log("Error: initializing explicit "
 				   " synchronization support failed.\n");
+		if (linux_drm_syncobj_setup(compositor, device->drm.fd) < 0)
+			weston_log("Error: initializing linux-drm-syncobj "
+				   "support failed.\n");
 	}
 
 	if (device->atomic_modeset)
@@ -4221,8 +5142,10 @@ err_udev_input:
 err_sprite:
 	destroy_sprites(b->drm);
 err_create_crtc_list:
+	drm_device_discard_connector_probe(device);
 	drmModeFreeResources(res);
 err_udev_dev:
+	drm_device_stop_commit_thread(device);
 	udev_device_unref(drm_device);
 err_udev:
 	udev_unref(b->udev);
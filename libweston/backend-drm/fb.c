@@ -41,6 +41,7 @@
 #include "shared/hash.h"
 #include "shared/helpers.h"
 #include "shared/weston-drm-fourcc.h"
+#include "client-memory.h"
 #include "drm-internal.h"
 #include "linux-dmabuf.h"
 
@@ -339,6 +340,59 @@ drm_fb_ref(struct drm_fb *fb)
 	return fb;
 }
 
+static void
+drm_output_shm_scanout_set_surface(struct drm_output *output,
+				   struct weston_surface *surface);
+
+static void
+drm_output_handle_shm_scanout_surface_destroy(struct wl_listener *listener,
+					      void *data)
+{
+	struct drm_output *output =
+		container_of(listener, struct drm_output,
+			     shm_scanout.surface_destroy_listener);
+
+	drm_output_shm_scanout_set_surface(output, NULL);
+}
+
+static void
+drm_output_shm_scanout_set_surface(struct drm_output *output,
+				   struct weston_surface *surface)
+{
+	if (output->shm_scanout.surface == surface)
+		return;
+
+	if (output->shm_scanout.surface)
+		wl_list_remove(&output->shm_scanout.surface_destroy_listener.link);
+
+	output->shm_scanout.surface = surface;
+
+	if (surface) {
+		output->shm_scanout.surface_destroy_listener.notify =
+			drm_output_handle_shm_scanout_surface_destroy;
+		wl_signal_add(&surface->destroy_signal,
+			      &output->shm_scanout.surface_destroy_listener);
+	}
+}
+
+/** Release the dumb buffers used for wl_shm scanout
+ *
+ * Plane states still showing them keep their own references.
+ */
+void
+drm_output_fini_shm_scanout(struct drm_output *output)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(output->shm_scanout.fb); i++) {
+		drm_fb_unref(output->shm_scanout.fb[i]);
+		output->shm_scanout.fb[i] = NULL;
+		pixman_region32_clear(&output->shm_scanout.damage[i]);
+	}
+
+	drm_output_shm_scanout_set_surface(output, NULL);
+}
+
 #ifdef BUILD_DRM_GBM
 static void
 drm_fb_destroy_gbm(struct gbm_bo *bo, void *data)
@@ -371,13 +425,71 @@ drm_fb_destroy_dmabuf(struct drm_fb *fb)
 	drm_fb_destroy(fb);
 }
 
+/*
+ * Clients recycling the same dmabufs behind new wl_buffers, e.g. camera
+ * frames, would otherwise pay for AddFB2 and RmFB on every frame. The cache
+ * holds a reference on each fb, and so on its GBM bo and the GEM handles
+ * the key is made of, until it is evicted.
+ */
+#define DRM_FB_CACHE_MAX 32
+
+static void
+drm_fb_cache_key_init(struct drm_fb_cache_key *key, const struct drm_fb *fb)
+{
+	memset(key, 0, sizeof(*key));
+	ARRAY_COPY(key->handles, fb->handles);
+	ARRAY_COPY(key->strides, fb->strides);
+	ARRAY_COPY(key->offsets, fb->offsets);
+	key->format = fb->format->format;
+	key->modifier = fb->modifier;
+	key->width = fb->width;
+	key->height = fb->height;
+}
+
+static struct drm_fb *
+drm_fb_cache_lookup(struct drm_device *device,
+		    const struct drm_fb_cache_key *key)
+{
+	struct drm_fb *fb;
+
+	wl_list_for_each(fb, &device->fb_cache, cache_link) {
+		if (memcmp(&fb->cache_key, key, sizeof(*key)) != 0)
+			continue;
+
+		wl_list_remove(&fb->cache_link);
+		wl_list_insert(&device->fb_cache, &fb->cache_link);
+		return drm_fb_ref(fb);
+	}
+
+	return NULL;
+}
+
+static void
+drm_fb_cache_insert(struct drm_device *device, struct drm_fb *fb,
+		    const struct drm_fb_cache_key *key)
+{
+	struct drm_fb *lru;
+
+	fb->cache_key = *key;
+	wl_list_insert(&device->fb_cache, &drm_fb_ref(fb)->cache_link);
+
+	if (++device->fb_cache_size <= DRM_FB_CACHE_MAX)
+		return;
+
+	lru = container_of(device->fb_cache.prev, struct drm_fb, cache_link);
+	wl_list_remove(&lru->cache_link);
+	device->fb_cache_size--;
+	drm_fb_unref(lru);
+}
+
 static struct drm_fb *
 drm_fb_get_from_dmabuf(struct linux_dmabuf_buffer *dmabuf,
 		       struct drm_device *device, bool is_opaque,
 		       uint32_t *try_view_on_plane_failure_reasons)
 {
 	struct drm_backend *backend = device->backend;
-	struct drm_fb *fb;
+	struct drm_fb_cache_key key;
+	struct drm_fb *fb, *cached;
 	int i;
 	struct gbm_import_fd_modifier_data import_mod = {
 		.width = dmabuf->attributes.width,
@@ -474,6 +586,15 @@ drm_fb_get_from_dmabuf(struct linux_dmabuf_buffer *dmabuf,
 		fb->handles[i] = handle.u32;
 	}
 
+	/* Importing the same dmabuf again yields the same GEM handles, so
+	 * this finds the fb of a buffer we have scanned out before. */
+	drm_fb_cache_key_init(&key, fb);
+	cached = drm_fb_cache_lookup(device, &key);
+	if (cached) {
+		drm_fb_destroy_dmabuf(fb);
+		return cached;
+	}
+
 	if (drm_fb_addfb(device, fb) != 0) {
 		if (try_view_on_plane_failure_reasons)
 			*try_view_on_plane_failure_reasons |=
@@ -481,6 +602,8 @@ drm_fb_get_from_dmabuf(struct linux_dmabuf_buffer *dmabuf,
 		goto err_free;
 	}
 
+	drm_fb_cache_insert(device, fb, &key);
+
 	return fb;
 
 err_free:
@@ -591,6 +714,79 @@ drm_fb_unref(struct drm_fb *fb)
 	}
 }
 
+/** Get the framebuffer a writeback capture writes into
+ *
+ * \param output The output being captured
+ * \param buffer The capture task's destination buffer
+ * \return A new reference to the framebuffer, or NULL on failure
+ *
+ * A dmabuf destination is imported and written by the writeback connector
+ * directly, so the frame reaches the client without any copy; clients
+ * streaming the output cycle through a few of them, whose framebuffers
+ * then come from the dmabuf fb cache. wl_shm destinations are written
+ * into a dumb buffer that the output keeps for the next capture, and
+ * copied out from there.
+ */
+struct drm_fb *
+drm_fb_get_for_writeback(struct drm_output *output,
+			 struct weston_buffer *buffer)
+{
+	struct drm_device *device = output->device;
+	struct drm_fb *fb = output->wb_dumb_fb;
+
+	if (buffer->type == WESTON_BUFFER_DMABUF) {
+#ifdef BUILD_DRM_GBM
+		uint32_t failure_reasons = 0;
+
+		if (!output->backend->gbm)
+			return NULL;
+
+		return drm_fb_get_from_dmabuf(buffer->dmabuf, device, false,
+					      &failure_reasons);
+#else
+		return NULL;
+#endif
+	}
+
+	if (fb && fb->width == buffer->width &&
+	    fb->height == buffer->height &&
+	    fb->format->format == buffer->pixel_format->format)
+		return drm_fb_ref(fb);
+
+	drm_fb_unref(fb);
+	output->wb_dumb_fb = drm_fb_create_dumb(device, buffer->width,
+						buffer->height,
+						buffer->pixel_format->format);
+	if (!output->wb_dumb_fb)
+		return NULL;
+
+	return drm_fb_ref(output->wb_dumb_fb);
+}
+
+/** Drop the device's cached client dmabuf and solid-colour fbs
+ *
+ * \param device The DRM device whose caches to empty
+ *
+ * The fbs are destroyed once nothing else is referencing them.
+ */
+void
+drm_fb_cache_flush(struct drm_device *device)
+{
+	struct drm_fb *fb, *tmp;
+
+	wl_list_for_each_safe(fb, tmp, &device->fb_cache, cache_link) {
+		wl_list_remove(&fb->cache_link);
+		drm_fb_unref(fb);
+	}
+	device->fb_cache_size = 0;
+
+	wl_list_for_each_safe(fb, tmp, &device->solid_fb_cache, cache_link) {
+		wl_list_remove(&fb->cache_link);
+		drm_fb_unref(fb);
+	}
+	device->solid_fb_cache_size = 0;
+}
+
 #ifdef BUILD_DRM_GBM
 bool
 drm_can_scanout_dmabuf(struct weston_backend *backend,
@@ -649,9 +845,204 @@ drm_fb_compatible_with_plane(struct drm_fb *fb, struct drm_plane *plane,
 	return false;
 }
 
+static bool
+drm_output_state_uses_fb(struct drm_output_state *state, struct drm_fb *fb)
+{
+	struct drm_plane_state *plane_state;
+
+	if (!state)
+		return false;
+
+	wl_list_for_each(plane_state, &state->plane_list, link) {
+		if (plane_state->fb == fb)
+			return true;
+	}
+
+	return false;
+}
+
+static bool
+drm_output_ensure_shm_scanout(struct drm_output *output,
+			      struct weston_paint_node *pnode)
+{
+	struct drm_device *device = output->device;
+	struct weston_buffer *buffer = pnode->surface->buffer_ref.buffer;
+	const struct pixel_format_info *format = buffer->pixel_format;
+	struct drm_fb *fb = output->shm_scanout.fb[0];
+	struct drm_plane *plane;
+	uint32_t plane_mask = 0;
+	unsigned int i;
+
+	if (fb && fb->format == format &&
+	    fb->width == buffer->width && fb->height == buffer->height)
+		return true;
+
+	drm_output_fini_shm_scanout(output);
+
+	if (!format->addfb_legacy_depth || !format->bpp)
+		return false;
+
+	for (i = 0; i < ARRAY_LENGTH(output->shm_scanout.fb); i++) {
+		fb = drm_fb_create_dumb(device, buffer->width, buffer->height,
+					format->format);
+		if (!fb) {
+			drm_output_fini_shm_scanout(output);
+			return false;
+		}
+		output->shm_scanout.fb[i] = fb;
+
+		/* Nothing copied yet. */
+		pixman_region32_union_rect(&output->shm_scanout.damage[i],
+					   &output->shm_scanout.damage[i],
+					   0, 0, buffer->width, buffer->height);
+	}
+
+	wl_list_for_each(plane, &device->plane_list, link) {
+		if (plane->type == WDRM_PLANE_TYPE_CURSOR)
+			continue;
+
+		if (drm_fb_compatible_with_plane(fb, plane, pnode->view))
+			plane_mask |= 1 << (plane->plane_idx);
+	}
+	if (plane_mask == 0) {
+		drm_output_fini_shm_scanout(output);
+		return false;
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(output->shm_scanout.fb); i++)
+		output->shm_scanout.fb[i]->plane_mask = plane_mask;
+
+	return true;
+}
+
+/** Get a dumb buffer to stand in for a fullscreen wl_shm buffer
+ *
+ * The buffer contents are only copied in drm_output_update_shm_scanout(),
+ * once the plane assignment is final. Of the two dumb buffers, this picks
+ * the one that is not being displayed.
+ */
+static struct drm_fb *
+drm_fb_get_from_shm_paint_node(struct drm_output_state *state,
+			       struct weston_paint_node *pnode,
+			       uint32_t *try_view_on_plane_failure_reasons)
+{
+	struct drm_output *output = state->output;
+	struct weston_buffer *buffer = pnode->surface->buffer_ref.buffer;
+	struct weston_mode *mode = output->base.current_mode;
+	unsigned int i;
+
+	if (!buffer->shm_buffer ||
+	    buffer->width != mode->width || buffer->height != mode->height) {
+		*try_view_on_plane_failure_reasons |= FAILURE_REASONS_BUFFER_TYPE;
+		return NULL;
+	}
+
+	if (!drm_output_ensure_shm_scanout(output, pnode)) {
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_FB_FORMAT_INCOMPATIBLE;
+		return NULL;
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(output->shm_scanout.fb); i++) {
+		struct drm_fb *fb = output->shm_scanout.fb[i];
+
+		if (!drm_output_state_uses_fb(output->state_cur, fb) &&
+		    !drm_output_state_uses_fb(output->state_last, fb))
+			return drm_fb_ref(fb);
+	}
+
+	*try_view_on_plane_failure_reasons |= FAILURE_REASONS_NO_PLANES_AVAILABLE;
+	return NULL;
+}
+
+/** Copy wl_shm damage into the dumb buffer chosen for scanout
+ *
+ * Called once the plane assignment of the state is final. The dumb buffer
+ * is brought up to date with the client buffer, so the plane state does not
+ * need to keep the client buffer busy.
+ */
+void
+drm_output_update_shm_scanout(struct drm_output_state *state)
+{
+	struct drm_output *output = state->output;
+	struct drm_plane_state *plane_state;
+	struct weston_surface *surface;
+	struct weston_buffer *buffer;
+	pixman_region32_t damage;
+	pixman_box32_t *boxes;
+	struct drm_fb *fb = NULL;
+	unsigned int i, k = 0;
+	const uint8_t *src;
+	int cpp, n_box, j, y;
+
+	wl_list_for_each(plane_state, &state->plane_list, link) {
+		for (i = 0; i < ARRAY_LENGTH(output->shm_scanout.fb); i++) {
+			if (plane_state->fb &&
+			    plane_state->fb == output->shm_scanout.fb[i]) {
+				fb = plane_state->fb;
+				k = i;
+			}
+		}
+		if (fb)
+			break;
+	}
+
+	/* The surface damage went to the renderer, forget about it. */
+	if (!fb) {
+		drm_output_shm_scanout_set_surface(output, NULL);
+		return;
+	}
+
+	assert(plane_state->ev);
+	surface = plane_state->ev->surface;
+	buffer = surface->buffer_ref.buffer;
+	assert(buffer && buffer->shm_buffer);
+
+	if (output->shm_scanout.surface == surface) {
+		pixman_region32_init(&damage);
+		weston_surface_to_buffer_region(surface, &surface->damage,
+						&damage);
+	} else {
+		drm_output_shm_scanout_set_surface(output, surface);
+		pixman_region32_init_rect(&damage, 0, 0,
+					  buffer->width, buffer->height);
+	}
+	for (i = 0; i < ARRAY_LENGTH(output->shm_scanout.damage); i++)
+		pixman_region32_union(&output->shm_scanout.damage[i],
+				      &output->shm_scanout.damage[i], &damage);
+	pixman_region32_fini(&damage);
+
+	pixman_region32_intersect_rect(&output->shm_scanout.damage[k],
+				       &output->shm_scanout.damage[k],
+				       0, 0, buffer->width, buffer->height);
+
+	cpp = buffer->pixel_format->bpp / 8;
+	src = wl_shm_buffer_get_data(buffer->shm_buffer);
+	boxes = pixman_region32_rectangles(&output->shm_scanout.damage[k],
+					   &n_box);
+
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	for (j = 0; j < n_box; j++) {
+		for (y = boxes[j].y1; y < boxes[j].y2; y++) {
+			memcpy((uint8_t *) fb->map + y * fb->strides[0] +
+			       boxes[j].x1 * cpp,
+			       src + y * buffer->stride + boxes[j].x1 * cpp,
+			       (boxes[j].x2 - boxes[j].x1) * cpp);
+		}
+	}
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+	pixman_region32_clear(&output->shm_scanout.damage[k]);
+
+	weston_buffer_reference(&plane_state->fb_ref.buffer, NULL,
+				BUFFER_WILL_NOT_BE_ACCESSED);
+	weston_buffer_release_reference(&plane_state->fb_ref.release, NULL);
+}
+
 static void
 drm_fb_handle_buffer_destroy(struct wl_listener *listener, void *data)
 {
+	struct weston_buffer *buffer = data;
 	struct drm_fb_private *private =
 		container_of(listener, struct drm_fb_private, buffer_destroy_listener);
 	struct drm_buffer_fb *buf_fb;
@@ -663,6 +1054,9 @@ drm_fb_handle_buffer_destroy(struct wl_listener *listener, void *data)
 		if (buf_fb->fb) {
 			assert(buf_fb->fb->type == BUFFER_CLIENT ||
 			       buf_fb->fb->type == BUFFER_DMABUF);
+			weston_client_memory_uncharge(buffer->client_memory,
+						      WESTON_CLIENT_MEMORY_DRM_FB,
+						      0);
 			drm_fb_unref(buf_fb->fb);
 		}
 		wl_list_remove(&buf_fb->link);
@@ -672,6 +1066,91 @@ drm_fb_handle_buffer_destroy(struct wl_listener *listener, void *data)
 	free(private);
 }
 
+#define DRM_SOLID_FB_CACHE_MAX 8
+
+static uint32_t
+solid_channel(float v)
+{
+	return (uint32_t) (CLIP(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+/** Get a 1x1 fb holding the colour of a solid-colour paint node
+ *
+ * \param device The DRM device the fb is for
+ * \param pnode A paint node whose buffer is WESTON_BUFFER_SOLID
+ * \param try_view_on_plane_failure_reasons Failure reasons are added here
+ * \return A new reference to the fb, or NULL
+ *
+ * The plane scales the single pixel up to the view size, so a solid-colour
+ * view can be scanned out without the renderer touching it. Fbs are kept
+ * in a small per-device cache keyed by colour, as shells tend to reuse the
+ * same few colours for backgrounds and fullscreen letterboxing.
+ */
+struct drm_fb *
+drm_fb_get_from_solid(struct drm_device *device,
+		      struct weston_paint_node *pnode,
+		      uint32_t *try_view_on_plane_failure_reasons)
+{
+	struct weston_buffer *buffer = pnode->surface->buffer_ref.buffer;
+	const struct weston_solid_buffer_values *solid = &buffer->solid;
+	struct drm_plane *plane;
+	struct drm_fb *fb, *lru;
+	uint32_t format, pixel;
+
+	assert(buffer->type == WESTON_BUFFER_SOLID);
+
+	/* Solid buffer values are already premultiplied. */
+	format = solid->a == 1.0f ? DRM_FORMAT_XRGB8888 : DRM_FORMAT_ARGB8888;
+	pixel = solid_channel(solid->a) << 24 |
+		solid_channel(solid->r) << 16 |
+		solid_channel(solid->g) << 8 |
+		solid_channel(solid->b);
+
+	wl_list_for_each(fb, &device->solid_fb_cache, cache_link) {
+		if (fb->solid_pixel != pixel || fb->format->format != format)
+			continue;
+
+		wl_list_remove(&fb->cache_link);
+		wl_list_insert(&device->solid_fb_cache, &fb->cache_link);
+		return drm_fb_ref(fb);
+	}
+
+	fb = drm_fb_create_dumb(device, 1, 1, format);
+	if (!fb) {
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_ADD_FB_FAILED;
+		return NULL;
+	}
+	fb->solid_pixel = pixel;
+	*(uint32_t *) fb->map = pixel;
+
+	wl_list_for_each(plane, &device->plane_list, link) {
+		if (plane->type == WDRM_PLANE_TYPE_CURSOR)
+			continue;
+
+		if (drm_fb_compatible_with_plane(fb, plane, pnode->view))
+			fb->plane_mask |= 1 << (plane->plane_idx);
+	}
+	if (fb->plane_mask == 0) {
+		drm_fb_unref(fb);
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_FB_FORMAT_INCOMPATIBLE;
+		return NULL;
+	}
+
+	/* The cache holds its own reference. */
+	wl_list_insert(&device->solid_fb_cache, &drm_fb_ref(fb)->cache_link);
+	if (++device->solid_fb_cache_size > DRM_SOLID_FB_CACHE_MAX) {
+		lru = container_of(device->solid_fb_cache.prev,
+				   struct drm_fb, cache_link);
+		wl_list_remove(&lru->cache_link);
+		device->solid_fb_cache_size--;
+		drm_fb_unref(lru);
+	}
+
+	return fb;
+}
+
 struct drm_fb *
 drm_fb_get_from_paint_node(struct drm_output_state *state,
 			   struct weston_paint_node *pnode,
@@ -700,6 +1179,11 @@ drm_fb_get_from_paint_node(struct drm_output_state *state,
 		return NULL;
 	}
 
+	/* Copied rather than imported, so not cached with the buffer. */
+	if (buffer->type == WESTON_BUFFER_SHM && b->shm_scanout)
+		return drm_fb_get_from_shm_paint_node(state, pnode,
+						      try_view_on_plane_failure_reasons);
+
 	if (!buffer->backend_private) {
 		private = zalloc(sizeof(*private));
 		buffer->backend_private = private;
@@ -771,6 +1255,8 @@ drm_fb_get_from_paint_node(struct drm_output_state *state,
 	/* The caller holds its own ref to the drm_fb, so when creating a new
 	 * drm_fb we take an additional ref for the weston_buffer's cache. */
 	buf_fb->fb = drm_fb_ref(fb);
+	weston_client_memory_charge(buffer->client_memory,
+				    WESTON_CLIENT_MEMORY_DRM_FB, 0);
 
 	drm_debug(b, "\t\t\t[view] view %p format: %s\n",
 		  ev, fb->format->drm_format_name);
@@ -32,6 +32,9 @@
 #include <math.h>
 
 #include "drm-internal.h"
+#include "color.h"
+#include "pixel-formats.h"
+#include "shared/xalloc.h"
 
 static inline uint16_t
 color_xy_to_u16(float v)
@@ -193,3 +196,665 @@ wdrm_colorspace_from_output(struct weston_output *output)
 
 	return cm->wdrm;
 }
+
+/* How far a sampled curve may stray outside of [0, 1] before we refuse to
+ * clamp it for a KMS LUT. */
+#define DRM_COLOR_LUT_SLACK (1.0f / 1024.0f)
+
+static uint16_t
+color_lut_to_u16(float v)
+{
+	return (uint16_t)round(MIN(MAX(v, 0.0f), 1.0f) * 0xffff);
+}
+
+static uint32_t
+color_lut_to_u32(float v)
+{
+	return (uint32_t)llround(MIN(MAX(v, 0.0f), 1.0f) * 0xffffffffu);
+}
+
+/* Samples a curve into len entries per channel, or returns NULL if it
+ * leaves the [0, 1] range of a KMS LUT. */
+static float *
+color_curve_sample_lut(struct weston_color_transform *xform,
+		       const struct weston_color_curve *curve, uint32_t len)
+{
+	float *values;
+	uint32_t i;
+
+	values = xcalloc(3 * len, sizeof *values);
+	weston_color_curve_sample(xform, curve, values, len);
+
+	for (i = 0; i < 3 * len; i++) {
+		/* Written this way to reject NaN too. */
+		if (!(values[i] >= -DRM_COLOR_LUT_SLACK &&
+		      values[i] <= 1.0f + DRM_COLOR_LUT_SLACK)) {
+			free(values);
+			return NULL;
+		}
+	}
+
+	return values;
+}
+
+static int
+drm_output_create_curve_blob(struct drm_output *output,
+			     struct weston_color_transform *xform,
+			     const struct weston_color_curve *curve,
+			     uint32_t len, uint32_t *blob_id)
+{
+	struct drm_device *device = output->device;
+	struct drm_color_lut *lut;
+	float *values;
+	uint32_t i;
+	int ret;
+
+	if (curve->type == WESTON_COLOR_CURVE_TYPE_IDENTITY)
+		return 0;
+
+	if (len < 2)
+		return -1;
+
+	values = color_curve_sample_lut(xform, curve, len);
+	if (!values)
+		return -1;
+
+	lut = xcalloc(len, sizeof *lut);
+	for (i = 0; i < len; i++) {
+		lut[i].red = color_lut_to_u16(values[0 * len + i]);
+		lut[i].green = color_lut_to_u16(values[1 * len + i]);
+		lut[i].blue = color_lut_to_u16(values[2 * len + i]);
+	}
+
+	ret = drmModeCreatePropertyBlob(device->drm.fd, lut,
+					len * sizeof *lut, blob_id);
+
+	free(lut);
+	free(values);
+
+	return ret;
+}
+
+static uint64_t
+color_ctm_coeff(float v)
+{
+	/* S31.32 sign-magnitude */
+	uint64_t mag = (uint64_t)llround(fabs(v) * 4294967296.0);
+
+	return v < 0.0f ? mag | (1ULL << 63) : mag;
+}
+
+static int
+drm_output_create_ctm_blob(struct drm_output *output,
+			   const struct weston_color_mapping *mapping,
+			   uint32_t *blob_id)
+{
+	struct drm_device *device = output->device;
+	const struct weston_color_mapping_matrix *mat = &mapping->u.mat;
+	struct drm_color_ctm ctm;
+	unsigned r, c;
+
+	switch (mapping->type) {
+	case WESTON_COLOR_MAPPING_TYPE_IDENTITY:
+		return 0;
+	case WESTON_COLOR_MAPPING_TYPE_3D_LUT:
+		return -1;
+	case WESTON_COLOR_MAPPING_TYPE_MATRIX:
+		break;
+	}
+
+	if (output->crtc->props_crtc[WDRM_CRTC_CTM].prop_id == 0)
+		return -1;
+
+	/* The CTM has no offset. */
+	for (r = 0; r < 3; r++) {
+		if (mat->offset[r] != 0.0f)
+			return -1;
+	}
+
+	/* drm_color_ctm is row-major, mat->matrix is column-major. */
+	for (r = 0; r < 3; r++)
+		for (c = 0; c < 3; c++)
+			ctm.matrix[r * 3 + c] = color_ctm_coeff(mat->matrix[c * 3 + r]);
+
+	return drmModeCreatePropertyBlob(device->drm.fd, &ctm, sizeof ctm,
+					 blob_id);
+}
+
+/* Returns NULL on success, or why the transformation does not fit. */
+static const char *
+drm_output_create_color_pipeline(struct drm_output *output,
+				 struct weston_color_transform *xform)
+{
+	struct drm_crtc *crtc = output->crtc;
+
+	if (!output->device->atomic_modeset)
+		return "atomic modesetting is not in use";
+
+	/* Blending space content above 1.0 would be clipped in the
+	 * framebuffer. */
+	if (output->base.eotf_mode != WESTON_EOTF_MODE_SDR)
+		return "the output is not in SDR mode";
+
+	/* The framebuffer holds blending space, i.e. optical values. */
+	if (output->format->bits.r < 10)
+		return "the framebuffer format has less than 10 bits per channel";
+
+	if (drm_output_create_ctm_blob(output, &xform->mapping,
+				       &output->ctm_blob_id) < 0)
+		return "the color mapping is not a plain matrix";
+
+	if (drm_output_create_curve_blob(output, xform, &xform->pre_curve,
+					 crtc->degamma_lut_size,
+					 &output->degamma_lut_blob_id) < 0)
+		return "the pre-curve does not fit DEGAMMA_LUT";
+
+	if (drm_output_create_curve_blob(output, xform, &xform->post_curve,
+					 crtc->gamma_lut_size,
+					 &output->gamma_lut_blob_id) < 0)
+		return "the post-curve does not fit GAMMA_LUT";
+
+	return NULL;
+}
+
+/**
+ * Program the blend-to-output color transformation into the CRTC
+ *
+ * The pre-curve, matrix and post-curve of the transformation go into
+ * the CRTC DEGAMMA_LUT, CTM and GAMMA_LUT. The renderer then leaves the
+ * output in blending space, saving a full-screen shader pass, and client
+ * buffers already in blending space may be scanned out directly.
+ *
+ * Whether to do this is decided when the output is enabled, because the
+ * renderer sets up its output state accordingly. If a later color
+ * profile does not fit the CRTC, the output goes without its color
+ * transformation until it is enabled again.
+ */
+void
+drm_output_update_color_pipeline(struct drm_output *output)
+{
+	struct weston_output *base = &output->base;
+	struct weston_color_transform *xform;
+	const char *why;
+
+	drm_output_release_color_pipeline(output);
+	output->color_pipeline_serial = base->color_outcome_serial;
+
+	if (!base->enabled)
+		output->color_offload_active = output->color_offload;
+	if (!output->color_offload_active)
+		return;
+
+	base->from_blend_to_output_by_backend = true;
+
+	xform = base->color_outcome->from_blend_to_output;
+	if (!xform)
+		return;
+
+	why = drm_output_create_color_pipeline(output, xform);
+	if (!why) {
+		weston_log("Output '%s' applies its color transformation in KMS.\n",
+			   base->name);
+		return;
+	}
+
+	drm_output_release_color_pipeline(output);
+
+	if (base->enabled) {
+		weston_log("Error: output '%s' cannot apply its new color "
+			   "transformation in KMS: %s. Re-enable the output "
+			   "to have it rendered instead.\n", base->name, why);
+		return;
+	}
+
+	weston_log("Output '%s' cannot apply its color transformation in "
+		   "KMS, rendering it instead: %s.\n", base->name, why);
+	output->color_offload_active = false;
+	base->from_blend_to_output_by_backend = false;
+}
+
+void
+drm_output_release_color_pipeline(struct drm_output *output)
+{
+	int fd = output->device->drm.fd;
+
+	if (output->degamma_lut_blob_id)
+		drmModeDestroyPropertyBlob(fd, output->degamma_lut_blob_id);
+	if (output->ctm_blob_id)
+		drmModeDestroyPropertyBlob(fd, output->ctm_blob_id);
+	if (output->gamma_lut_blob_id)
+		drmModeDestroyPropertyBlob(fd, output->gamma_lut_blob_id);
+
+	output->degamma_lut_blob_id = 0;
+	output->ctm_blob_id = 0;
+	output->gamma_lut_blob_id = 0;
+}
+
+
+/* Longest chain of colorops followed, against loops. */
+#define DRM_COLOR_PIPELINE_MAX_COLOROPS 32
+
+static void
+drm_color_pipeline_release_transform(struct drm_device *device,
+				     struct drm_plane_color_pipeline *pipeline)
+{
+	int fd = device->drm.fd;
+
+	if (pipeline->pre_curve_blob_id)
+		drmModeDestroyPropertyBlob(fd, pipeline->pre_curve_blob_id);
+	if (pipeline->mapping_blob_id)
+		drmModeDestroyPropertyBlob(fd, pipeline->mapping_blob_id);
+	if (pipeline->post_curve_blob_id)
+		drmModeDestroyPropertyBlob(fd, pipeline->post_curve_blob_id);
+
+	pipeline->pre_curve_blob_id = 0;
+	pipeline->mapping_blob_id = 0;
+	pipeline->post_curve_blob_id = 0;
+
+	weston_color_transform_unref(pipeline->xform);
+	pipeline->xform = NULL;
+	pipeline->fits = false;
+}
+
+static void
+drm_color_pipeline_destroy(struct drm_device *device,
+			   struct drm_plane_color_pipeline *pipeline)
+{
+	unsigned int i;
+
+	drm_color_pipeline_release_transform(device, pipeline);
+
+	for (i = 0; i < pipeline->n_colorops; i++)
+		drm_property_info_free(pipeline->colorops[i].props,
+				       WDRM_COLOROP__COUNT);
+	free(pipeline->colorops);
+	free(pipeline);
+}
+
+static bool
+drm_colorop_is_lut(const struct drm_colorop *op)
+{
+	return op->type == WDRM_COLOROP_TYPE_1D_LUT && op->size >= 2 &&
+	       op->props[WDRM_COLOROP_DATA].prop_id != 0;
+}
+
+static bool
+drm_colorop_is_matrix(const struct drm_colorop *op)
+{
+	return op->type == WDRM_COLOROP_TYPE_CTM_3X4 &&
+	       op->props[WDRM_COLOROP_DATA].prop_id != 0;
+}
+
+static struct drm_plane_color_pipeline *
+drm_color_pipeline_create(struct drm_device *device, uint32_t prop_id,
+			  uint64_t first)
+{
+	struct drm_plane_color_pipeline *pipeline;
+	drmModeObjectProperties *props;
+	struct drm_colorop *op;
+	uint64_t id = first;
+	int idx;
+
+	pipeline = xzalloc(sizeof *pipeline);
+	pipeline->prop_id = prop_id;
+	pipeline->id = first;
+	pipeline->pre_curve = -1;
+	pipeline->mapping = -1;
+	pipeline->post_curve = -1;
+
+	while (id != 0) {
+		if (pipeline->n_colorops == DRM_COLOR_PIPELINE_MAX_COLOROPS)
+			goto err;
+
+		props = drmModeObjectGetProperties(device->drm.fd, id,
+						   DRM_MODE_OBJECT_COLOROP);
+		if (!props)
+			goto err;
+
+		pipeline->colorops = xrealloc(pipeline->colorops,
+					      (pipeline->n_colorops + 1) *
+					      sizeof *pipeline->colorops);
+		idx = pipeline->n_colorops++;
+		op = &pipeline->colorops[idx];
+		memset(op, 0, sizeof *op);
+		op->colorop_id = id;
+
+		drm_property_info_populate(device, colorop_props, op->props,
+					   WDRM_COLOROP__COUNT, props);
+		op->type = drm_property_get_value(&op->props[WDRM_COLOROP_TYPE],
+						  props, WDRM_COLOROP_TYPE__COUNT);
+		op->size = drm_property_get_value(&op->props[WDRM_COLOROP_SIZE],
+						  props, 0);
+		id = drm_property_get_value(&op->props[WDRM_COLOROP_NEXT],
+					    props, 0);
+		drmModeFreeObjectProperties(props);
+
+		/* The first 1D LUT, 3x4 matrix and 1D LUT, in this order,
+		 * take the transformation; anything else is bypassed. */
+		if (drm_colorop_is_lut(op) &&
+		    pipeline->pre_curve < 0 && pipeline->mapping < 0)
+			pipeline->pre_curve = idx;
+		else if (drm_colorop_is_matrix(op) && pipeline->mapping < 0)
+			pipeline->mapping = idx;
+		else if (drm_colorop_is_lut(op) &&
+			 pipeline->mapping >= 0 && pipeline->post_curve < 0)
+			pipeline->post_curve = idx;
+		else if (op->props[WDRM_COLOROP_BYPASS].prop_id == 0)
+			goto err;
+	}
+
+	if (pipeline->pre_curve < 0 && pipeline->mapping < 0 &&
+	    pipeline->post_curve < 0)
+		goto err;
+
+	return pipeline;
+
+err:
+	drm_color_pipeline_destroy(device, pipeline);
+	return NULL;
+}
+
+static int
+drm_color_pipeline_steps(const struct drm_plane_color_pipeline *pipeline)
+{
+	return (pipeline->pre_curve >= 0) + (pipeline->mapping >= 0) +
+	       (pipeline->post_curve >= 0);
+}
+
+/**
+ * Find the color pipeline of a plane to put surface color transformations in
+ *
+ * Of the pipelines in the COLOR_PIPELINE property of the plane, keeps the
+ * one offering the most steps of a weston_color_transform. A plane left
+ * without one takes no views needing a color transformation.
+ */
+void
+drm_plane_populate_color_pipeline(struct drm_plane *plane,
+				  const drmModeObjectProperties *props)
+{
+	struct drm_device *device = plane->device;
+	struct drm_backend *b = device->backend;
+	struct drm_plane_color_pipeline *pipeline, *best = NULL;
+	drmModePropertyRes *prop;
+	uint32_t i;
+	int j;
+
+	if (!device->plane_color_pipeline ||
+	    plane->type == WDRM_PLANE_TYPE_CURSOR)
+		return;
+
+	for (i = 0; i < props->count_props; i++) {
+		prop = drmModeGetProperty(device->drm.fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		if (strcmp(prop->name, "COLOR_PIPELINE") != 0 ||
+		    !(prop->flags & DRM_MODE_PROP_ENUM)) {
+			drmModeFreeProperty(prop);
+			continue;
+		}
+
+		for (j = 0; j < prop->count_enums; j++) {
+			/* Skip "Bypass" */
+			if (prop->enums[j].value == 0)
+				continue;
+
+			pipeline = drm_color_pipeline_create(device,
+							     prop->prop_id,
+							     prop->enums[j].value);
+			if (!pipeline)
+				continue;
+
+			if (best && drm_color_pipeline_steps(best) >=
+				    drm_color_pipeline_steps(pipeline)) {
+				drm_color_pipeline_destroy(device, pipeline);
+				continue;
+			}
+
+			if (best)
+				drm_color_pipeline_destroy(device, best);
+			best = pipeline;
+		}
+
+		drmModeFreeProperty(prop);
+		break;
+	}
+
+	plane->color_pipeline = best;
+	if (best)
+		drm_debug(b, "\t[plane %u] color pipeline %llu: pre-curve %s, "
+			     "mapping %s, post-curve %s\n", plane->plane_id,
+			  (unsigned long long) best->id,
+			  best->pre_curve >= 0 ? "yes" : "no",
+			  best->mapping >= 0 ? "yes" : "no",
+			  best->post_curve >= 0 ? "yes" : "no");
+}
+
+void
+drm_plane_destroy_color_pipeline(struct drm_plane *plane)
+{
+	if (!plane->color_pipeline)
+		return;
+
+	drm_color_pipeline_destroy(plane->device, plane->color_pipeline);
+	plane->color_pipeline = NULL;
+}
+
+static int
+drm_colorop_create_lut_blob(struct drm_device *device,
+			    const struct drm_colorop *op,
+			    struct weston_color_transform *xform,
+			    const struct weston_color_curve *curve,
+			    uint32_t *blob_id)
+{
+	uint32_t len = op->size;
+	uint32_t *lut;
+	float *values;
+	uint32_t i;
+	int ret;
+
+	values = color_curve_sample_lut(xform, curve, len);
+	if (!values)
+		return -1;
+
+	/* struct drm_color_lut32: red, green, blue, reserved */
+	lut = xcalloc(4 * len, sizeof *lut);
+	for (i = 0; i < len; i++) {
+		lut[4 * i + 0] = color_lut_to_u32(values[0 * len + i]);
+		lut[4 * i + 1] = color_lut_to_u32(values[1 * len + i]);
+		lut[4 * i + 2] = color_lut_to_u32(values[2 * len + i]);
+	}
+
+	ret = drmModeCreatePropertyBlob(device->drm.fd, lut,
+					4 * len * sizeof *lut, blob_id);
+
+	free(lut);
+	free(values);
+
+	return ret;
+}
+
+static int
+drm_colorop_create_matrix_blob(struct drm_device *device,
+			       const struct weston_color_mapping *mapping,
+			       uint32_t *blob_id)
+{
+	const struct weston_color_mapping_matrix *mat = &mapping->u.mat;
+	/* struct drm_color_ctm_3x4, row-major with the offset last */
+	uint64_t ctm[12];
+	unsigned r, c;
+
+	for (r = 0; r < 3; r++) {
+		for (c = 0; c < 3; c++)
+			ctm[r * 4 + c] = color_ctm_coeff(mat->matrix[c * 3 + r]);
+		ctm[r * 4 + 3] = color_ctm_coeff(mat->offset[r]);
+	}
+
+	return drmModeCreatePropertyBlob(device->drm.fd, ctm, sizeof ctm,
+					 blob_id);
+}
+
+static uint32_t
+drm_color_pipeline_blob(const struct drm_plane_color_pipeline *pipeline,
+			int idx)
+{
+	if (idx == pipeline->pre_curve)
+		return pipeline->pre_curve_blob_id;
+	if (idx == pipeline->mapping)
+		return pipeline->mapping_blob_id;
+	if (idx == pipeline->post_curve)
+		return pipeline->post_curve_blob_id;
+	return 0;
+}
+
+/**
+ * Program a surface color transformation into the color pipeline of a plane
+ *
+ * The pre-curve, matrix and post-curve of the transformation go into the
+ * DATA of the LUT, matrix and LUT colorops of the pipeline, see
+ * drm_plane_color_pipeline. The result is kept for the last
+ * transformation, so that this is cheap to call on every repaint.
+ *
+ * \return 0 if the plane can apply xform, -1 otherwise.
+ */
+int
+drm_plane_prepare_color_transform(struct drm_plane *plane,
+				  struct weston_color_transform *xform)
+{
+	struct drm_device *device = plane->device;
+	struct drm_plane_color_pipeline *pipeline = plane->color_pipeline;
+	unsigned int i;
+
+	if (!pipeline)
+		return -1;
+
+	if (pipeline->xform == xform)
+		return pipeline->fits ? 0 : -1;
+
+	drm_color_pipeline_release_transform(device, pipeline);
+	pipeline->xform = weston_color_transform_ref(xform);
+
+	if (xform->pre_curve.type != WESTON_COLOR_CURVE_TYPE_IDENTITY &&
+	    (pipeline->pre_curve < 0 ||
+	     drm_colorop_create_lut_blob(device,
+					 &pipeline->colorops[pipeline->pre_curve],
+					 xform, &xform->pre_curve,
+					 &pipeline->pre_curve_blob_id) < 0))
+		return -1;
+
+	switch (xform->mapping.type) {
+	case WESTON_COLOR_MAPPING_TYPE_IDENTITY:
+		break;
+	case WESTON_COLOR_MAPPING_TYPE_3D_LUT:
+		return -1;
+	case WESTON_COLOR_MAPPING_TYPE_MATRIX:
+		if (pipeline->mapping < 0 ||
+		    drm_colorop_create_matrix_blob(device, &xform->mapping,
+						   &pipeline->mapping_blob_id) < 0)
+			return -1;
+		break;
+	}
+
+	if (xform->post_curve.type != WESTON_COLOR_CURVE_TYPE_IDENTITY &&
+	    (pipeline->post_curve < 0 ||
+	     drm_colorop_create_lut_blob(device,
+					 &pipeline->colorops[pipeline->post_curve],
+					 xform, &xform->post_curve,
+					 &pipeline->post_curve_blob_id) < 0))
+		return -1;
+
+	/* Steps left unused by this transformation are bypassed. */
+	for (i = 0; i < pipeline->n_colorops; i++) {
+		if (drm_color_pipeline_blob(pipeline, i) == 0 &&
+		    pipeline->colorops[i].props[WDRM_COLOROP_BYPASS].prop_id == 0)
+			return -1;
+	}
+
+	pipeline->fits = true;
+
+	return 0;
+}
+
+static int
+colorop_add_prop(drmModeAtomicReq *req, struct drm_device *device,
+		 struct drm_colorop *op, enum wdrm_colorop_property prop,
+		 uint64_t val)
+{
+	struct drm_backend *b = device->backend;
+	struct drm_property_info *info = &op->props[prop];
+	int ret;
+
+	drm_debug(b, "\t\t\t[COLOROP:%lu] %lu (%s) -> %llu (0x%llx)\n",
+		  (unsigned long) op->colorop_id,
+		  (unsigned long) info->prop_id, info->name,
+		  (unsigned long long) val, (unsigned long long) val);
+
+	if (info->prop_id == 0)
+		return -1;
+
+	ret = drmModeAtomicAddProperty(req, op->colorop_id, info->prop_id,
+				       val);
+	return (ret <= 0) ? -1 : 0;
+}
+
+/**
+ * Add the color pipeline of a plane state to an atomic request
+ *
+ * Selects the pipeline programmed with the color transformation of the
+ * plane state, or no pipeline if the state has none. Nothing is added for
+ * planes without a color pipeline.
+ */
+int
+drm_plane_add_color_pipeline(drmModeAtomicReq *req,
+			     struct drm_plane_state *plane_state)
+{
+	struct drm_plane *plane = plane_state->plane;
+	struct drm_device *device = plane->device;
+	struct drm_backend *b = device->backend;
+	struct drm_plane_color_pipeline *pipeline = plane->color_pipeline;
+	uint64_t selected = 0;
+	uint32_t blob_id;
+	unsigned int i;
+	int ret = 0;
+
+	if (!pipeline)
+		return 0;
+
+	if (plane_state->color_xform) {
+		if (drm_plane_prepare_color_transform(plane,
+						      plane_state->color_xform) < 0)
+			return -1;
+		selected = pipeline->id;
+	}
+
+	drm_debug(b, "\t\t\t[PLANE:%lu] %lu (COLOR_PIPELINE) -> %llu\n",
+		  (unsigned long) plane->plane_id,
+		  (unsigned long) pipeline->prop_id,
+		  (unsigned long long) selected);
+
+	if (drmModeAtomicAddProperty(req, plane->plane_id, pipeline->prop_id,
+				     selected) <= 0)
+		return -1;
+
+	if (selected == 0)
+		return 0;
+
+	for (i = 0; i < pipeline->n_colorops; i++) {
+		struct drm_colorop *op = &pipeline->colorops[i];
+
+		blob_id = drm_color_pipeline_blob(pipeline, i);
+		if (blob_id == 0) {
+			ret |= colorop_add_prop(req, device, op,
+						WDRM_COLOROP_BYPASS, 1);
+			continue;
+		}
+
+		if (op->props[WDRM_COLOROP_BYPASS].prop_id != 0)
+			ret |= colorop_add_prop(req, device, op,
+						WDRM_COLOROP_BYPASS, 0);
+		ret |= colorop_add_prop(req, device, op, WDRM_COLOROP_DATA,
+					blob_id);
+	}
+
+	return ret;
+}
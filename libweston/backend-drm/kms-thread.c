@@ -0,0 +1,373 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include <libweston/libweston.h>
+#include "drm-internal.h"
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+
+/**
+ * Non-blocking atomic commits still do their checks and wait for the fences
+ * of the previous commit inside the ioctl, which some drivers take
+ * milliseconds over. With the kms-thread option, page flips are compiled on
+ * the main thread as usual and then handed to a thread of their own per
+ * device, which submits them in order.
+ *
+ * The flip events are read from the DRM fd by the main loop as before. A
+ * commit can only fail after the repaint loop took it for done, so the
+ * thread wakes up the priority loop, which puts the outputs concerned back
+ * on their feet, see drm_commit_thread_fail_output().
+ *
+ * Test commits, commits needing a modeset, the legacy KMS API and writeback
+ * screenshots stay on the main thread; those have their result acted upon
+ * straight away.
+ */
+
+struct drm_commit_job {
+	struct wl_list link;
+	drmModeAtomicReq *req;
+	uint32_t flags;
+	int ret;
+	int err;
+
+	/* Outputs the commit carries a state for; these are not destroyed
+	 * while they wait for its flip event. */
+	struct drm_output **outputs;
+	unsigned int n_outputs;
+};
+
+struct drm_commit_thread {
+	struct drm_device *device;
+	pthread_t worker;
+	int wake_fd;
+	struct wl_event_source *wake_source;
+
+	/* Protects all below. The condition is signalled on new jobs, on
+	 * quit and whenever the worker is done with a job. */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/* drm_commit_job::link, oldest first */
+	struct wl_list queue;
+	/* drm_commit_job::link, failed commits */
+	struct wl_list failed;
+	bool busy;
+	bool quit;
+};
+
+static void
+drm_commit_job_destroy(struct drm_commit_job *job)
+{
+	drmModeAtomicFree(job->req);
+	free(job->outputs);
+	free(job);
+}
+
+static void
+drm_commit_thread_wake(int fd)
+{
+	uint64_t one = 1;
+
+	/* Only fails with the counter saturated, so a wake-up is pending */
+	if (write(fd, &one, sizeof one) < 0)
+		return;
+}
+
+static void *
+drm_commit_thread_run(void *data)
+{
+	struct drm_commit_thread *thread = data;
+	struct drm_device *device = thread->device;
+	struct drm_commit_job *job;
+
+	pthread_mutex_lock(&thread->mutex);
+	for (;;) {
+		while (wl_list_empty(&thread->queue) && !thread->quit)
+			pthread_cond_wait(&thread->cond, &thread->mutex);
+
+		/* Whatever was queued before quitting still goes out */
+		if (wl_list_empty(&thread->queue))
+			break;
+
+		job = container_of(thread->queue.next,
+				   struct drm_commit_job, link);
+		wl_list_remove(&job->link);
+		thread->busy = true;
+		pthread_mutex_unlock(&thread->mutex);
+
+		job->ret = drmModeAtomicCommit(device->drm.fd, job->req,
+					       job->flags, device);
+		job->err = errno;
+
+		pthread_mutex_lock(&thread->mutex);
+		thread->busy = false;
+		if (job->ret != 0)
+			wl_list_insert(thread->failed.prev, &job->link);
+		pthread_cond_broadcast(&thread->cond);
+
+		if (job->ret == 0)
+			drm_commit_job_destroy(job);
+		else
+			drm_commit_thread_wake(thread->wake_fd);
+	}
+	pthread_mutex_unlock(&thread->mutex);
+
+	return NULL;
+}
+
+/* The repaint loop took the commit for done and waits for a flip event
+ * which never comes. Complete the frame right away, forget what we
+ * assumed to be on screen, and repaint all of it with the next commit. */
+static void
+drm_commit_thread_fail_output(struct drm_output *output)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	struct drm_device *device = output->device;
+	struct timespec now;
+
+	output->propose_cache.valid = false;
+	device->state_invalid = true;
+
+	if (!output->atomic_complete_pending)
+		return;
+	output->atomic_complete_pending = false;
+
+	if (output->base.enabled)
+		weston_output_damage(&output->base);
+
+	weston_compositor_read_presentation_clock(ec, &now);
+	drm_output_update_complete(output, 0, now.tv_sec, now.tv_nsec / 1000);
+}
+
+static void
+drm_commit_thread_fail_jobs(struct drm_commit_thread *thread)
+{
+	struct drm_commit_job *job, *tmp;
+	struct wl_list failed;
+	unsigned int i;
+
+	wl_list_init(&failed);
+	pthread_mutex_lock(&thread->mutex);
+	wl_list_insert_list(&failed, &thread->failed);
+	wl_list_init(&thread->failed);
+	pthread_mutex_unlock(&thread->mutex);
+
+	wl_list_for_each_safe(job, tmp, &failed, link) {
+		weston_log("atomic: couldn't commit new state on the KMS "
+			   "thread: %s\n", strerror(job->err));
+
+		for (i = 0; i < job->n_outputs; i++)
+			drm_commit_thread_fail_output(job->outputs[i]);
+
+		wl_list_remove(&job->link);
+		drm_commit_job_destroy(job);
+	}
+}
+
+static int
+drm_commit_thread_wake_handler(int fd, uint32_t mask, void *data)
+{
+	struct drm_commit_thread *thread = data;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		weston_log("DRM: failed to read KMS thread wake-up: %s\n",
+			   strerror(errno));
+
+	drm_commit_thread_fail_jobs(thread);
+
+	return 0;
+}
+
+/** Hand a compiled page flip to the KMS thread
+ *
+ * Takes ownership of req. Must be called before the states of
+ * pending_state are assigned to their outputs.
+ */
+void
+drm_commit_thread_queue(struct drm_commit_thread *thread,
+			drmModeAtomicReq *req, uint32_t flags,
+			struct drm_pending_state *pending_state)
+{
+	struct drm_output_state *output_state;
+	struct drm_commit_job *job;
+
+	job = xzalloc(sizeof *job);
+	job->req = req;
+	job->flags = flags;
+
+	job->outputs = xcalloc(wl_list_length(&pending_state->output_list),
+			       sizeof *job->outputs);
+	wl_list_for_each(output_state, &pending_state->output_list, link) {
+		if (!output_state->output->is_virtual)
+			job->outputs[job->n_outputs++] = output_state->output;
+	}
+
+	pthread_mutex_lock(&thread->mutex);
+	wl_list_insert(thread->queue.prev, &job->link);
+	pthread_cond_broadcast(&thread->cond);
+	pthread_mutex_unlock(&thread->mutex);
+}
+
+/** Wait until the KMS thread has submitted everything queued
+ *
+ * For commits done on the main thread, which must come after those. Failed
+ * commits are still handled from the priority loop.
+ */
+void
+drm_commit_thread_wait(struct drm_commit_thread *thread)
+{
+	pthread_mutex_lock(&thread->mutex);
+	while (!wl_list_empty(&thread->queue) || thread->busy)
+		pthread_cond_wait(&thread->cond, &thread->mutex);
+	pthread_mutex_unlock(&thread->mutex);
+}
+
+/** Wait for the KMS thread and handle the commits which failed
+ *
+ * For callers about to wait for flip events. Must not be called from within
+ * a commit, as it may complete frames.
+ */
+void
+drm_commit_thread_flush(struct drm_commit_thread *thread)
+{
+	drm_commit_thread_wait(thread);
+	drm_commit_thread_fail_jobs(thread);
+}
+
+static void
+drm_commit_thread_destroy(struct drm_commit_thread *thread)
+{
+	struct drm_commit_job *job, *tmp;
+
+	if (thread->wake_source)
+		wl_event_source_remove(thread->wake_source);
+
+	wl_list_for_each_safe(job, tmp, &thread->failed, link) {
+		wl_list_remove(&job->link);
+		drm_commit_job_destroy(job);
+	}
+
+	if (thread->wake_fd >= 0)
+		close(thread->wake_fd);
+	pthread_cond_destroy(&thread->cond);
+	pthread_mutex_destroy(&thread->mutex);
+	free(thread);
+}
+
+/** Submit the page flips of a device on a thread of their own
+ *
+ * Only for devices with atomic modesetting. Falls back to committing on the
+ * main thread if the thread cannot be started.
+ */
+int
+drm_device_start_commit_thread(struct drm_device *device)
+{
+	struct weston_compositor *compositor = device->backend->compositor;
+	struct drm_commit_thread *thread;
+	sigset_t blocked, saved;
+	int ret;
+
+	if (!device->atomic_modeset) {
+		weston_log("DRM: %s: no atomic modesetting, committing on the "
+			   "main thread\n", device->drm.filename);
+		return -1;
+	}
+
+	thread = xzalloc(sizeof *thread);
+	thread->device = device;
+	wl_list_init(&thread->queue);
+	wl_list_init(&thread->failed);
+	pthread_mutex_init(&thread->mutex, NULL);
+	pthread_cond_init(&thread->cond, NULL);
+
+	thread->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (thread->wake_fd < 0)
+		goto err;
+
+	thread->wake_source =
+		wl_event_loop_add_fd(weston_compositor_get_priority_loop(compositor),
+				     thread->wake_fd, WL_EVENT_READABLE,
+				     drm_commit_thread_wake_handler, thread);
+	if (!thread->wake_source)
+		goto err;
+
+	sigfillset(&blocked);
+	pthread_sigmask(SIG_BLOCK, &blocked, &saved);
+	ret = pthread_create(&thread->worker, NULL,
+			     drm_commit_thread_run, thread);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (ret != 0)
+		goto err;
+
+	device->commit_thread = thread;
+	weston_log("DRM: %s: committing page flips on a thread\n",
+		   device->drm.filename);
+
+	return 0;
+
+err:
+	weston_log("DRM: %s: failed to start the KMS thread\n",
+		   device->drm.filename);
+	drm_commit_thread_destroy(thread);
+	return -1;
+}
+
+/** Submit what is still queued and stop the KMS thread
+ *
+ * Commits which failed meanwhile are dropped, this is only for shutting
+ * down.
+ */
+void
+drm_device_stop_commit_thread(struct drm_device *device)
+{
+	struct drm_commit_thread *thread = device->commit_thread;
+
+	if (!thread)
+		return;
+
+	pthread_mutex_lock(&thread->mutex);
+	thread->quit = true;
+	pthread_cond_broadcast(&thread->cond);
+	pthread_mutex_unlock(&thread->mutex);
+
+	pthread_join(thread->worker, NULL);
+
+	device->commit_thread = NULL;
+	drm_commit_thread_destroy(thread);
+}
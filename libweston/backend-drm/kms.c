@@ -29,23 +29,34 @@
 
 #include "config.h"
 
+#include <inttypes.h>
 #include <stdint.h>
+#include <sys/stat.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
 #include <libweston/libweston.h>
 #include <libweston/backend-drm.h>
+#include "shared/fd-util.h"
 #include "shared/helpers.h"
+#include "shared/timespec-util.h"
 #include "shared/weston-drm-fourcc.h"
 #include "drm-internal.h"
+#include "linux-dmabuf.h"
+#include "linux-sync-file.h"
 #include "pixel-formats.h"
 #include "presentation-time-server-protocol.h"
+#include "timeline.h"
 
 #ifndef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
 #define DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP 0x15
 #endif
 
+#ifndef DRM_CLIENT_CAP_PLANE_COLOR_PIPELINE
+#define DRM_CLIENT_CAP_PLANE_COLOR_PIPELINE 7
+#endif
+
 struct drm_property_enum_info plane_type_enums[] = {
 	[WDRM_PLANE_TYPE_PRIMARY] = {
 		.name = "Primary",
@@ -249,6 +260,7 @@ const struct drm_property_info connector_props[] = {
 		.enum_values = colorspace_enums,
 		.num_enum_values = WDRM_COLORSPACE__COUNT,
 	},
+	[WDRM_CONNECTOR_VRR_CAPABLE] = { .name = "vrr_capable", },
 };
 
 const struct drm_property_info crtc_props[] = {
@@ -262,6 +274,36 @@ const struct drm_property_info crtc_props[] = {
 	[WDRM_CRTC_VRR_ENABLED] = { .name = "VRR_ENABLED", },
 };
 
+struct drm_property_enum_info colorop_type_enums[] = {
+	[WDRM_COLOROP_TYPE_1D_CURVE] = {
+		.name = "1D Curve",
+	},
+	[WDRM_COLOROP_TYPE_1D_LUT] = {
+		.name = "1D LUT",
+	},
+	[WDRM_COLOROP_TYPE_CTM_3X4] = {
+		.name = "3x4 Matrix",
+	},
+	[WDRM_COLOROP_TYPE_MULTIPLIER] = {
+		.name = "Multiplier",
+	},
+	[WDRM_COLOROP_TYPE_3D_LUT] = {
+		.name = "3D LUT",
+	},
+};
+
+const struct drm_property_info colorop_props[] = {
+	[WDRM_COLOROP_TYPE] = {
+		.name = "TYPE",
+		.enum_values = colorop_type_enums,
+		.num_enum_values = WDRM_COLOROP_TYPE__COUNT,
+	},
+	[WDRM_COLOROP_BYPASS] = { .name = "BYPASS", },
+	[WDRM_COLOROP_NEXT] = { .name = "NEXT", },
+	[WDRM_COLOROP_SIZE] = { .name = "SIZE", },
+	[WDRM_COLOROP_DATA] = { .name = "DATA", },
+};
+
 
 /**
  * Mode for drm_pending_state_apply and co.
@@ -657,6 +699,49 @@ fallback:
 	return 0;
 }
 
+/**
+ * Check whether a plane can show YUV buffers as the renderer would
+ *
+ * The GL renderer converts YUV with the BT.601 limited range matrix, so a
+ * plane only gives the same picture when it can be set to that encoding
+ * and range as well. Planes without the properties are left at the driver
+ * default, which in practice is BT.601 limited range.
+ *
+ * @param plane The plane to check, with formats and properties populated
+ * @return True if YUV buffers can be scanned out on the plane
+ */
+bool
+drm_plane_can_scan_out_yuv(struct drm_plane *plane)
+{
+	struct drm_property_info *encoding =
+		&plane->props[WDRM_PLANE_COLOR_ENCODING];
+	struct drm_property_info *range = &plane->props[WDRM_PLANE_COLOR_RANGE];
+	const struct pixel_format_info *info;
+	struct weston_drm_format *fmt;
+	bool has_yuv = false;
+
+	wl_array_for_each(fmt, &plane->formats.arr) {
+		info = pixel_format_get_info(fmt->format);
+		if (info && pixel_format_is_yuv(info)) {
+			has_yuv = true;
+			break;
+		}
+	}
+
+	if (!has_yuv)
+		return false;
+
+	if (encoding->prop_id != 0 &&
+	    !encoding->enum_values[WDRM_PLANE_COLOR_ENCODING_BT601].valid)
+		return false;
+
+	if (range->prop_id != 0 &&
+	    !range->enum_values[WDRM_PLANE_COLOR_RANGE_LIMITED].valid)
+		return false;
+
+	return true;
+}
+
 void
 drm_output_set_gamma(struct weston_output *output_base,
 		     uint16_t size, uint16_t *r, uint16_t *g, uint16_t *b)
@@ -671,6 +756,10 @@ drm_output_set_gamma(struct weston_output *output_base,
 	if (output_base->gamma_size != size)
 		return;
 
+	/* The CRTC color pipeline is taken. */
+	if (output->color_offload_active)
+		return;
+
 	output->deprecated_gamma_is_set = true;
 	rc = drmModeCrtcSetGamma(device->drm.fd,
 				 output->crtc->crtc_id,
@@ -707,6 +796,7 @@ drm_output_assign_state(struct drm_output_state *state,
 	state->pending_state = NULL;
 
 	output->state_cur = state;
+	output->base.vrr_active = state->vrr_enabled;
 
 	if (device->atomic_modeset && mode == DRM_STATE_APPLY_ASYNC) {
 		drm_debug(b, "\t[CRTC:%u] setting pending flip\n",
@@ -793,6 +883,67 @@ err:
 	drmModeSetCursor(device->drm.fd, crtc->crtc_id, 0, 0, 0);
 }
 
+/** Move the cursor plane to a view's new position outside of a repaint
+ *
+ * The legacy cursor ioctl takes effect without waiting for a page flip, on
+ * atomic drivers too, so the cursor follows the pointer with no latency from
+ * the repaint loop. The next repaint commits the same position again.
+ */
+bool
+drm_output_move_cursor(struct weston_output *output_base,
+		       struct weston_view *ev)
+{
+	struct drm_output *output = to_drm_output(output_base);
+	struct drm_device *device;
+	struct drm_plane *plane;
+	struct drm_plane_state *state;
+	pixman_region32_t dest_rect;
+	pixman_box32_t *box;
+	int32_t x, y;
+
+	assert(output);
+	device = output->device;
+	plane = output->cursor_plane;
+
+	if (!plane || device->cursors_are_broken ||
+	    output->cursor_view != ev || output->dpms != WESTON_DPMS_ON)
+		return false;
+
+	state = plane->state_cur;
+	if (!state->fb || state->ev != ev || state->output != output)
+		return false;
+
+	/* A commit in flight would put the cursor back where it was. */
+	if (device->atomic_modeset &&
+	    (output->atomic_complete_pending || output->page_flip_pending))
+		return false;
+
+	/* Cursors which need cropping do not go on the plane. */
+	box = pixman_region32_extents(&ev->transform.boundingbox);
+	if (pixman_region32_contains_rectangle(&output->base.region,
+					       box) != PIXMAN_REGION_IN)
+		return false;
+
+	pixman_region32_init(&dest_rect);
+	weston_region_global_to_output(&dest_rect, &output->base,
+				       &ev->transform.boundingbox);
+	x = pixman_region32_extents(&dest_rect)->x1;
+	y = pixman_region32_extents(&dest_rect)->y1;
+	pixman_region32_fini(&dest_rect);
+
+	if (drmModeMoveCursor(device->drm.fd, output->crtc->crtc_id, x, y)) {
+		weston_log("failed to move cursor: %s\n", strerror(errno));
+		return false;
+	}
+
+	plane->base.x = box->x1;
+	plane->base.y = box->y1;
+	state->dest_x = x;
+	state->dest_y = y;
+
+	return true;
+}
+
 static void
 drm_output_reset_legacy_gamma(struct drm_output *output)
 {
@@ -1068,6 +1219,23 @@ plane_add_prop(drmModeAtomicReq *req, struct drm_plane *plane,
 	return (ret <= 0) ? -1 : 0;
 }
 
+static int
+plane_add_enum_prop(drmModeAtomicReq *req, struct drm_plane *plane,
+		    enum wdrm_plane_property prop, unsigned int enum_value)
+{
+	struct drm_property_info *info = &plane->props[prop];
+
+	/* Planes without the property use a fixed default. */
+	if (info->prop_id == 0)
+		return 0;
+
+	if (!info->enum_values[enum_value].valid)
+		return -1;
+
+	return plane_add_prop(req, plane, prop,
+			      info->enum_values[enum_value].value);
+}
+
 static bool
 drm_connector_has_prop(struct drm_connector *connector,
 		       enum wdrm_connector_property prop)
@@ -1228,6 +1396,48 @@ drm_connector_set_colorspace(struct drm_connector *connector,
 				  WDRM_CONNECTOR_COLORSPACE, enum_info->value);
 }
 
+/**
+ * Turn the implicit fence of a client dmabuf into an explicit one
+ *
+ * A client buffer without an acquire fence may still be written by the GPU
+ * when it goes on a plane. Leaving the wait to the driver's implicit sync
+ * is not something every driver does well; handing the fence in through
+ * IN_FENCE_FD makes it part of the commit, same as with explicit sync.
+ * Buffers spread over several objects are left to implicit sync, as a
+ * plane takes only one fence.
+ */
+static void
+drm_plane_state_export_implicit_fence(struct drm_plane_state *state)
+{
+	struct weston_buffer *buffer = state->fb_ref.buffer.buffer;
+	struct linux_dmabuf_buffer *dmabuf;
+	const struct dmabuf_attributes *attributes;
+	struct stat st0, st;
+	int i;
+
+	if (state->in_fence_fd >= 0 ||
+	    state->plane->props[WDRM_PLANE_IN_FENCE_FD].prop_id == 0)
+		return;
+
+	if (!buffer || buffer->type != WESTON_BUFFER_DMABUF)
+		return;
+
+	dmabuf = buffer->dmabuf;
+	attributes = &dmabuf->attributes;
+	if (fstat(attributes->fd[0], &st0) < 0)
+		return;
+
+	for (i = 1; i < attributes->n_planes; i++) {
+		if (fstat(attributes->fd[i], &st) < 0 ||
+		    st.st_ino != st0.st_ino || st.st_dev != st0.st_dev)
+			return;
+	}
+
+	state->implicit_fence_fd =
+		weston_linux_sync_file_export_from_dmabuf(attributes->fd[0]);
+	state->in_fence_fd = state->implicit_fence_fd;
+}
+
 static int
 drm_output_apply_state_atomic(struct drm_output_state *state,
 			      drmModeAtomicReq *req,
@@ -1260,6 +1470,19 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 		*flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
 	}
 
+	if (state->idle_refresh && output->idle_refresh_mode)
+		current_mode = output->idle_refresh_mode;
+
+	/* Lowering the rate was tested without a modeset, see
+	 * drm_output_idle_refresh_handler(), but the display must come
+	 * back to the mode's rate in any case. */
+	if (!state->idle_refresh && output->state_cur->idle_refresh &&
+	    output->idle_refresh_mode) {
+		drm_debug(b, "\t\t\t[atomic] restoring refresh rate, modeset OK\n");
+		*flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+		device->refresh_restore_pending = true;
+	}
+
 	if (state->dpms == WESTON_DPMS_ON) {
 		ret = drm_mode_ensure_blob(device, current_mode);
 		if (ret != 0)
@@ -1271,12 +1494,16 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 
 		if (!output->deprecated_gamma_is_set) {
 			ret |= crtc_add_prop_zero_ok(req, crtc,
-						     WDRM_CRTC_GAMMA_LUT, 0);
+						     WDRM_CRTC_GAMMA_LUT,
+						     output->gamma_lut_blob_id);
 			ret |= crtc_add_prop_zero_ok(req, crtc,
-						     WDRM_CRTC_DEGAMMA_LUT, 0);
+						     WDRM_CRTC_DEGAMMA_LUT,
+						     output->degamma_lut_blob_id);
 		}
-		ret |= crtc_add_prop_zero_ok(req, crtc, WDRM_CRTC_CTM, 0);
-		ret |= crtc_add_prop_zero_ok(req, crtc, WDRM_CRTC_VRR_ENABLED, 0);
+		ret |= crtc_add_prop_zero_ok(req, crtc, WDRM_CRTC_CTM,
+					     output->ctm_blob_id);
+		ret |= crtc_add_prop_zero_ok(req, crtc, WDRM_CRTC_VRR_ENABLED,
+					     state->vrr_enabled);
 
 		/* No need for the DPMS property, since it is implicit in
 		 * routing and CRTC activity. */
@@ -1327,7 +1554,7 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 		drm_connector_set_hdcp_property(&head->connector,
 						state->protection, req);
 		ret |= drm_connector_set_content_type(&head->connector,
-						      output->content_type, req);
+						      state->content_type, req);
 
 		if (drm_connector_has_prop(&head->connector,
 					   WDRM_CONNECTOR_HDR_OUTPUT_METADATA)) {
@@ -1381,6 +1608,9 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 			  (unsigned long) plane->plane_id,
 			  pinfo ? pinfo->drm_format_name : "UNKNOWN");
 
+		if (!(*flags & DRM_MODE_ATOMIC_TEST_ONLY))
+			drm_plane_state_export_implicit_fence(plane_state);
+
 		if (plane_state->in_fence_fd >= 0) {
 			ret |= plane_add_prop(req, plane,
 					      WDRM_PLANE_IN_FENCE_FD,
@@ -1404,6 +1634,19 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 					      WDRM_PLANE_ALPHA,
 					      plane_state->alpha);
 
+		/* Convert YUV the way the renderer would, so that moving a
+		 * video between plane and renderer does not shift colours. */
+		if (pinfo && pixel_format_is_yuv(pinfo)) {
+			ret |= plane_add_enum_prop(req, plane,
+						   WDRM_PLANE_COLOR_ENCODING,
+						   WDRM_PLANE_COLOR_ENCODING_BT601);
+			ret |= plane_add_enum_prop(req, plane,
+						   WDRM_PLANE_COLOR_RANGE,
+						   WDRM_PLANE_COLOR_RANGE_LIMITED);
+		}
+
+		ret |= drm_plane_add_color_pipeline(req, plane_state);
+
 		if (ret != 0) {
 			weston_log("couldn't set plane state\n");
 			return ret;
@@ -1440,11 +1683,14 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 	drmModeAtomicReq *req = drmModeAtomicAlloc();
 	uint32_t flags, tear_flag = 0;
 	bool may_tear = true;
+	bool threaded;
 	int ret = 0;
 
 	if (!req)
 		return -1;
 
+	threaded = device->commit_thread && mode == DRM_STATE_APPLY_ASYNC;
+
 	switch (mode) {
 	case DRM_STATE_APPLY_SYNC:
 		flags = 0;
@@ -1549,6 +1795,10 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 			continue;
 		if (mode == DRM_STATE_APPLY_SYNC)
 			assert(output_state->dpms == WESTON_DPMS_OFF);
+		/* The writeback fence is looked at once the flip is in */
+		if (drm_output_get_writeback_state(output_state->output) !=
+		    DRM_OUTPUT_WB_SCREENSHOT_OFF)
+			threaded = false;
 		may_tear &= output_state->tear;
 		ret |= drm_output_apply_state_atomic(output_state, req, &flags);
 	}
@@ -1560,9 +1810,85 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 	if (may_tear)
 		tear_flag = DRM_MODE_PAGE_FLIP_ASYNC;
 
-	ret = drmModeAtomicCommit(device->drm.fd, req, flags | tear_flag,
-				  device);
-	drm_debug(b, "[atomic] drmModeAtomicCommit\n");
+	/* A modeset has its result acted upon right away, and anything
+	 * committed here must come after what the KMS thread still holds. */
+	if (flags & DRM_MODE_ATOMIC_ALLOW_MODESET)
+		threaded = false;
+	if (device->commit_thread && !threaded &&
+	    mode != DRM_STATE_TEST_ONLY)
+		drm_commit_thread_wait(device->commit_thread);
+
+	if (mode != DRM_STATE_TEST_ONLY) {
+		wl_list_for_each(output_state, &pending_state->output_list, link)
+			TL_POINT(b->compositor, "drm_atomic_commit_begin",
+				 TLP_OUTPUT(&output_state->output->base), TLP_END);
+	}
+
+	if (threaded) {
+		drm_commit_thread_queue(device->commit_thread, req,
+					flags | tear_flag, pending_state);
+		req = NULL;
+		drm_debug(b, "[atomic] drmModeAtomicCommit queued on the KMS thread\n");
+	} else if (device->fastboot_pending && mode != DRM_STATE_TEST_ONLY &&
+	    (flags & DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+		/* Try to carry on with what the firmware left on screen; the
+		 * kernel refuses if anything needs a modeset after all. */
+		ret = drmModeAtomicCommit(device->drm.fd, req,
+					  (flags & ~DRM_MODE_ATOMIC_ALLOW_MODESET) |
+					  tear_flag, device);
+		drm_debug(b, "[atomic] drmModeAtomicCommit (fastboot, no modeset)\n");
+		if (ret == 0) {
+			weston_log("DRM: fastboot: kept the boot display "
+				   "configuration\n");
+		} else {
+			weston_log("DRM: fastboot: boot display configuration "
+				   "not reusable, doing a full modeset\n");
+			ret = drmModeAtomicCommit(device->drm.fd, req,
+						  flags | tear_flag, device);
+			drm_debug(b, "[atomic] drmModeAtomicCommit\n");
+		}
+	} else if (device->resume_pending && mode != DRM_STATE_TEST_ONLY &&
+		   (flags & DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+		/* Same as fastboot, with the mode we had before the session
+		 * switch: unless the other session changed it, taking the
+		 * CRTCs back is a plain flip and nothing goes blank. */
+		ret = drmModeAtomicCommit(device->drm.fd, req,
+					  (flags & ~DRM_MODE_ATOMIC_ALLOW_MODESET) |
+					  tear_flag, device);
+		drm_debug(b, "[atomic] drmModeAtomicCommit (resume, no modeset)\n");
+		if (ret != 0) {
+			weston_log("DRM: display configuration changed while "
+				   "switched away, doing a full modeset\n");
+			ret = drmModeAtomicCommit(device->drm.fd, req,
+						  flags | tear_flag, device);
+			drm_debug(b, "[atomic] drmModeAtomicCommit\n");
+		}
+	} else if (device->refresh_restore_pending &&
+		   mode != DRM_STATE_TEST_ONLY &&
+		   (flags & DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+		/* Going back from the idle refresh rate is seamless where
+		 * going there was, unless something else needs a modeset. */
+		ret = drmModeAtomicCommit(device->drm.fd, req,
+					  (flags & ~DRM_MODE_ATOMIC_ALLOW_MODESET) |
+					  tear_flag, device);
+		drm_debug(b, "[atomic] drmModeAtomicCommit (refresh rate, no modeset)\n");
+		if (ret != 0) {
+			ret = drmModeAtomicCommit(device->drm.fd, req,
+						  flags | tear_flag, device);
+			drm_debug(b, "[atomic] drmModeAtomicCommit\n");
+		}
+	} else {
+		ret = drmModeAtomicCommit(device->drm.fd, req, flags | tear_flag,
+					  device);
+		drm_debug(b, "[atomic] drmModeAtomicCommit\n");
+	}
+	if (mode != DRM_STATE_TEST_ONLY) {
+		device->fastboot_pending = false;
+		device->resume_pending = false;
+		device->refresh_restore_pending = false;
+		if (flags & DRM_MODE_ATOMIC_ALLOW_MODESET)
+			drm_config_cache_commit_done(device, ret);
+	}
 	if (ret != 0 && may_tear && mode == DRM_STATE_TEST_ONLY) {
 		/* If we failed trying to set up a tearing commit, try again
 		 * without tearing. If that succeeds, knock the tearing flag
@@ -1581,18 +1907,24 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 	}
 
 	if (ret != 0) {
-		wl_list_for_each(output_state, &pending_state->output_list, link)
+		wl_list_for_each(output_state, &pending_state->output_list, link) {
+			/* The cached plane assignment may be what failed. */
+			output_state->output->propose_cache.valid = false;
 			if (drm_output_get_writeback_state(output_state->output) != DRM_OUTPUT_WB_SCREENSHOT_OFF)
 				drm_writeback_fail_screenshot(output_state->output->wb_state,
 							      "drm: atomic commit failed");
+		}
 		weston_log("atomic: couldn't commit new state: %s\n",
 			   strerror(errno));
 		goto out;
 	}
 
 	wl_list_for_each_safe(output_state, tmp, &pending_state->output_list,
-			      link)
+			      link) {
+		TL_POINT(b->compositor, "drm_atomic_commit_end",
+			 TLP_OUTPUT(&output_state->output->base), TLP_END);
 		drm_output_assign_state(output_state, mode);
+	}
 
 	device->state_invalid = false;
 
@@ -1773,6 +2105,24 @@ drm_output_update_msc(struct drm_output *output, unsigned int seq)
 	output->base.msc = u64_from_u32s(msc_hi, seq);
 }
 
+/* With vblank-sequence, count the frames which were not on screen by the
+ * vblank the repaint was meant for. */
+static void
+drm_output_check_late_repaint(struct drm_output *output)
+{
+	struct drm_backend *b = output->device->backend;
+	uint64_t target = output->repaint_target_msc;
+
+	output->repaint_target_msc = 0;
+	if (target == 0 || output->base.msc <= target)
+		return;
+
+	output->late_repaints++;
+	drm_debug(b, "[repaint] %s: late, presented at vblank %" PRIu64
+		     " instead of %" PRIu64 "\n",
+		  output->base.name, output->base.msc, target);
+}
+
 static void
 page_flip_handler(int fd, unsigned int frame,
 		  unsigned int sec, unsigned int usec, void *data)
@@ -1784,6 +2134,7 @@ page_flip_handler(int fd, unsigned int frame,
 			 WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK;
 
 	drm_output_update_msc(output, frame);
+	drm_output_check_late_repaint(output);
 
 	assert(!device->atomic_modeset);
 	assert(output->page_flip_pending);
@@ -1818,6 +2169,7 @@ atomic_flip_handler(int fd, unsigned int frame, unsigned int sec,
 		return;
 
 	drm_output_update_msc(output, frame);
+	drm_output_check_late_repaint(output);
 
 	if (output->state_cur->tear) {
 		/* When tearing we might not get accurate timestamps from
@@ -1839,6 +2191,25 @@ atomic_flip_handler(int fd, unsigned int frame, unsigned int sec,
 	drm_debug(b, "[atomic][CRTC:%u] flip processing completed\n", crtc_id);
 }
 
+static void
+crtc_sequence_handler(int fd, uint64_t sequence, uint64_t ns,
+		      uint64_t user_data)
+{
+	struct drm_crtc *crtc = (struct drm_crtc *)(uintptr_t) user_data;
+	struct drm_output *output = crtc->output;
+	struct timespec ts;
+
+	/* The output may have been disabled meanwhile */
+	if (!output || !output->vblank_sequence_pending)
+		return;
+	output->vblank_sequence_pending = false;
+
+	output->base.msc = sequence;
+	timespec_from_nsec(&ts, ns);
+	weston_output_finish_frame(&output->base, &ts,
+				   WP_PRESENTATION_FEEDBACK_INVALID);
+}
+
 int
 on_drm_input(int fd, uint32_t mask, void *data)
 {
@@ -1861,11 +2232,12 @@ on_drm_input(int fd, uint32_t mask, void *data)
 		return 1;
 
 	memset(&evctx, 0, sizeof evctx);
-	evctx.version = 3;
+	evctx.version = 4;
 	if (device->atomic_modeset)
 		evctx.page_flip_handler2 = atomic_flip_handler;
 	else
 		evctx.page_flip_handler = page_flip_handler;
+	evctx.sequence_handler = crtc_sequence_handler;
 	drmHandleEvent(fd, &evctx);
 
 	return 1;
@@ -1916,6 +2288,16 @@ init_kms_caps(struct drm_device *device)
 	weston_log("DRM: %s atomic modesetting\n",
 		   device->atomic_modeset ? "supports" : "does not support");
 
+	/* Planes only show their COLOR_PIPELINE property with this set. */
+	if (device->atomic_modeset && b->plane_color_pipeline) {
+		ret = drmSetClientCap(device->drm.fd,
+				      DRM_CLIENT_CAP_PLANE_COLOR_PIPELINE, 1);
+		device->plane_color_pipeline = (ret == 0);
+		weston_log("DRM: %s plane color pipelines\n",
+			   device->plane_color_pipeline ?
+			   "supports" : "does not support");
+	}
+
 	if (!getenv("WESTON_DISABLE_GBM_MODIFIERS")) {
 		ret = drmGetCap(device->drm.fd, DRM_CAP_ADDFB2_MODIFIERS, &cap);
 		if (ret == 0)
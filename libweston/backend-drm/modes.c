@@ -368,6 +368,13 @@ drm_head_maybe_update_display_data(struct drm_head *head,
 		drm_property_get_value(
 			&head->connector.props[WDRM_CONNECTOR_EDID],
 			props, 0);
+
+	/* KMS replaces the blob whenever the EDID is updated, so an
+	 * unchanged blob ID means unchanged contents: skip fetching it. */
+	if (blob_id && blob_id == head->display_data_blob_id)
+		return false;
+	head->display_data_blob_id = blob_id;
+
 	if (blob_id)
 		edid_blob = drmModeGetPropertyBlob(device->drm.fd, blob_id);
 
@@ -602,6 +609,8 @@ update_head_from_connector(struct drm_head *head)
 
 	weston_head_set_non_desktop(&head->base,
 				    check_non_desktop(connector, props));
+	head->vrr_capable = drm_property_get_value(
+		&connector->props[WDRM_CONNECTOR_VRR_CAPABLE], props, 0) != 0;
 	weston_head_set_subpixel(&head->base,
 				 drm_subpixel_to_wayland(conn->subpixel));
 
@@ -638,6 +647,26 @@ update_head_from_connector(struct drm_head *head)
 	drm_head_info_fini(&dhi);
 }
 
+/* With fastboot, prefer the mode the firmware left on the connector over
+ * an equivalent choice, as keeping it spares the modeset. */
+static struct drm_mode *
+drm_mode_fastboot_keep_current(struct drm_device *device,
+			       struct drm_mode *choice,
+			       struct drm_mode *current)
+{
+	if (!device->backend->fastboot || !current || choice == current)
+		return choice;
+
+	if (choice->mode_info.hdisplay != current->mode_info.hdisplay ||
+	    choice->mode_info.vdisplay != current->mode_info.vdisplay ||
+	    choice->base.refresh != current->base.refresh ||
+	    (device->aspect_ratio_supported &&
+	     choice->base.aspect_ratio != current->base.aspect_ratio))
+		return choice;
+
+	return current;
+}
+
 /**
  * Choose suitable mode for an output
  *
@@ -736,13 +765,14 @@ drm_output_choose_initial_mode(struct drm_device *device,
 		configured = current;
 
 	if (configured)
-		return configured;
+		return drm_mode_fastboot_keep_current(device, configured, current);
 
 	if (config_fall_back)
-		return config_fall_back;
+		return drm_mode_fastboot_keep_current(device, config_fall_back,
+						      current);
 
 	if (preferred)
-		return preferred;
+		return drm_mode_fastboot_keep_current(device, preferred, current);
 
 	if (current)
 		return current;
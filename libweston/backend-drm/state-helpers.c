@@ -33,6 +33,8 @@
 #include <xf86drmMode.h>
 
 #include "drm-internal.h"
+#include "color.h"
+#include "shared/fd-util.h"
 #include "shared/weston-drm-fourcc.h"
 
 /**
@@ -48,6 +50,7 @@ drm_plane_state_alloc(struct drm_output_state *state_output,
 	state->output_state = state_output;
 	state->plane = plane;
 	state->in_fence_fd = -1;
+	state->implicit_fence_fd = -1;
 	state->rotation = drm_rotation_from_output_transform(plane,
 							     WL_OUTPUT_TRANSFORM_NORMAL);
 	assert(state->rotation);
@@ -87,6 +90,7 @@ drm_plane_state_free(struct drm_plane_state *state, bool force)
 	wl_list_init(&state->link);
 	state->output_state = NULL;
 	state->in_fence_fd = -1;
+	fd_clear(&state->implicit_fence_fd);
 	state->zpos = DRM_PLANE_ZPOS_INVALID_PLANE;
 	state->alpha = DRM_PLANE_ALPHA_OPAQUE;
 
@@ -102,6 +106,7 @@ drm_plane_state_free(struct drm_plane_state *state, bool force)
 	}
 
 	if (force || state != state->plane->state_cur) {
+		weston_color_transform_unref(state->color_xform);
 		drm_fb_unref(state->fb);
 		weston_buffer_reference(&state->fb_ref.buffer, NULL,
 					BUFFER_WILL_NOT_BE_ACCESSED);
@@ -134,6 +139,7 @@ drm_plane_state_duplicate(struct drm_output_state *state_output,
 	 * again is not necessary
 	 */
 	dst->in_fence_fd = -1;
+	dst->implicit_fence_fd = -1;
 
 	wl_list_for_each_safe(old, tmp, &state_output->plane_list, link) {
 		/* Duplicating a plane state into the same output state, so
@@ -170,6 +176,7 @@ drm_plane_state_duplicate(struct drm_output_state *state_output,
 		assert(!src->fb_ref.buffer.buffer);
 		assert(!src->fb_ref.release.buffer_release);
 	}
+	weston_color_transform_ref(dst->color_xform);
 	dst->output_state = state_output;
 	dst->complete = false;
 
@@ -378,6 +385,7 @@ drm_output_state_alloc(struct drm_output *output)
 	state->output = output;
 	state->dpms = WESTON_DPMS_OFF;
 	state->protection = WESTON_HDCP_DISABLE;
+	state->content_type = output->content_type;
 	wl_list_init(&state->link);
 
 	wl_list_init(&state->plane_list);
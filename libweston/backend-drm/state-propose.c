@@ -29,6 +29,9 @@
 
 #include "config.h"
 
+#include <inttypes.h>
+#include <stdio.h>
+
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
@@ -43,7 +46,9 @@
 #include "presentation-time-server-protocol.h"
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
 #include "shared/string-helpers.h"
+#include "shared/timespec-util.h"
 #include "shared/weston-assert.h"
+#include "shared/xalloc.h"
 
 enum drm_output_propose_state_mode {
 	DRM_OUTPUT_PROPOSE_STATE_MIXED, /**< mix renderer & planes */
@@ -51,6 +56,13 @@ enum drm_output_propose_state_mode {
 	DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY, /**< no renderer use, only planes */
 };
 
+/** How a proposed state gets checked with TEST_ONLY commits */
+enum drm_output_propose_test {
+	DRM_OUTPUT_PROPOSE_TEST_INCREMENTAL, /**< test each plane assignment */
+	DRM_OUTPUT_PROPOSE_TEST_FINAL, /**< only test the complete state */
+	DRM_OUTPUT_PROPOSE_TEST_NONE, /**< known to pass from the cache */
+};
+
 static const char *const drm_output_propose_state_mode_as_string[] = {
 	[DRM_OUTPUT_PROPOSE_STATE_MIXED] = "mixed state",
 	[DRM_OUTPUT_PROPOSE_STATE_RENDERER_ONLY] = "render-only state",
@@ -80,6 +92,375 @@ drm_mixed_mode_check_underlay(enum drm_output_propose_state_mode mode,
 	return false;
 }
 
+static bool
+drm_paint_node_is_overlay_candidate(struct weston_paint_node *pnode)
+{
+	struct weston_view *ev = pnode->view;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	struct weston_compositor *compositor = ev->surface->compositor;
+
+	if (ev->layer_link.layer == &compositor->cursor_layer)
+		return false;
+
+	if (!weston_view_has_valid_buffer(ev))
+		return false;
+
+	return buffer->type == WESTON_BUFFER_DMABUF ||
+	       buffer->type == WESTON_BUFFER_RENDERER_OPAQUE;
+}
+
+/* Views that are updated often and cover a large area benefit the most
+ * from a plane. Views that are never updated still rank by their area.
+ *
+ * In mixed mode, a view below renderer content can only go on an underlay,
+ * which must be opaque and needs planes that stack below the primary one;
+ * without those it cannot get a plane at all. Whether a plane can scale
+ * the view is left out: KMS has no property telling, only the test commit
+ * of the placement does, and guessing would keep scaled video off planes
+ * that would take it. */
+static float
+drm_paint_node_plane_score(struct drm_backend *b,
+			   struct weston_paint_node *pnode,
+			   pixman_region32_t *renderer_above)
+{
+	pixman_region32_t clipped;
+	pixman_box32_t *box;
+	float area;
+
+	pixman_region32_init(&clipped);
+	pixman_region32_intersect(&clipped, &pnode->view->transform.boundingbox,
+				  &pnode->output->region);
+	box = pixman_region32_extents(&clipped);
+	area = (float)(box->x2 - box->x1) * (float)(box->y2 - box->y1);
+
+	pixman_region32_intersect(&clipped, &clipped, renderer_above);
+	if (pixman_region32_not_empty(&clipped) &&
+	    (!b->has_underlay ||
+	     !weston_view_is_opaque(pnode->view,
+				    &pnode->view->transform.boundingbox)))
+		area = 0.0f;
+	pixman_region32_fini(&clipped);
+
+	/* Clients hinting video or game content want every frame shown
+	 * without delay, so those come first. */
+	switch (pnode->surface->content_type) {
+	case WESTON_CONTENT_TYPE_VIDEO:
+	case WESTON_CONTENT_TYPE_GAME:
+		area *= 4.0f;
+		break;
+	default:
+		break;
+	}
+
+	return area * (pnode->update_rate + 1.0f / 16.0f);
+}
+
+/* In mixed mode, planes are handed out top to bottom, so views on top could
+ * take all the overlay planes away from more important views below them.
+ * Once per repaint, score the candidate views into
+ * weston_paint_node::plane_score, and when there are more of them than
+ * overlay planes, find the lowest score that still gets a plane; views
+ * scoring below it stay on the renderer. The threshold is 0 if every
+ * candidate may try for a plane.
+ */
+static void
+drm_output_update_overlay_scores(struct drm_output *output)
+{
+	struct drm_device *device = output->device;
+	struct drm_backend *b = device->backend;
+	struct wl_array *scores = &output->overlay_scores;
+	struct weston_paint_node *pnode;
+	struct drm_plane *plane;
+	pixman_region32_t renderer_above;
+	float *score;
+	unsigned int num_planes = 0;
+	unsigned int count;
+
+	output->overlay_score_threshold = 0.0f;
+	scores->size = 0;
+
+	pixman_region32_init(&renderer_above);
+	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
+			 z_order_link) {
+		if (!drm_paint_node_is_overlay_candidate(pnode)) {
+			pnode->plane_score = 0.0f;
+			pixman_region32_union(&renderer_above, &renderer_above,
+					      &pnode->view->transform.boundingbox);
+			continue;
+		}
+
+		pnode->plane_score = drm_paint_node_plane_score(b, pnode,
+								&renderer_above);
+
+		score = wl_array_add(scores, sizeof(*score));
+		if (!score) {
+			pixman_region32_fini(&renderer_above);
+			return;
+		}
+		*score = pnode->plane_score;
+	}
+	pixman_region32_fini(&renderer_above);
+
+	wl_list_for_each(plane, &device->plane_list, link) {
+		if (plane->type == WDRM_PLANE_TYPE_OVERLAY &&
+		    drm_plane_is_available(plane, output))
+			num_planes++;
+	}
+
+	count = scores->size / sizeof(*score);
+	if (num_planes > 0 && count > num_planes) {
+		unsigned int i, j;
+
+		/* Partial selection sort: we only need the top num_planes. */
+		score = scores->data;
+		for (i = 0; i < num_planes; i++) {
+			for (j = i + 1; j < count; j++) {
+				if (score[j] > score[i]) {
+					float tmp = score[i];
+
+					score[i] = score[j];
+					score[j] = tmp;
+				}
+			}
+		}
+		output->overlay_score_threshold = score[num_planes - 1];
+	}
+}
+
+/* Whether the view stays on the renderer so that views scoring higher get
+ * the overlay planes, see drm_output_update_overlay_scores() */
+static bool
+drm_paint_node_below_overlay_threshold(struct drm_output *output,
+				       struct weston_paint_node *pnode)
+{
+	return output->overlay_score_threshold > 0.0f &&
+	       drm_paint_node_is_overlay_candidate(pnode) &&
+	       pnode->plane_score < output->overlay_score_threshold;
+}
+
+/* A view composited by the renderer, as seen by the views below it */
+struct drm_renderer_view {
+	pixman_box32_t extents;
+	float update_rate;
+};
+
+static float
+box_overlap_area(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	int32_t w = MIN(a->x2, b->x2) - MAX(a->x1, b->x1);
+	int32_t h = MIN(a->y2, b->y2) - MAX(a->y1, b->y1);
+
+	if (w <= 0 || h <= 0)
+		return 0.0f;
+
+	return (float) w * (float) h;
+}
+
+/* An underlay takes the view out of the renderer, but every renderer view
+ * above it then has to be blended over the hole punched through the
+ * primary plane whenever it changes. Weigh both sides by area and update
+ * rate: video below a mostly static UI is worth an underlay, a static
+ * background below busy renderer content is not worth a plane.
+ */
+static bool
+drm_paint_node_underlay_worthwhile(struct drm_backend *b,
+				   struct weston_paint_node *pnode,
+				   pixman_region32_t *visible,
+				   struct wl_array *renderer_views)
+{
+	struct drm_renderer_view *rv;
+	pixman_box32_t *extents = pixman_region32_extents(visible);
+	unsigned int punched = 0;
+	float gain, cost = 0.0f;
+
+	gain = (float) (extents->x2 - extents->x1) *
+	       (float) (extents->y2 - extents->y1) *
+	       (pnode->update_rate + 1.0f / 16.0f);
+
+	wl_array_for_each(rv, renderer_views) {
+		float area = box_overlap_area(extents, &rv->extents);
+
+		if (area == 0.0f)
+			continue;
+
+		cost += area * (rv->update_rate + 1.0f / 16.0f);
+		punched++;
+	}
+
+	drm_debug(b, "\t\t\t\t[view] underlay for view %p punches through "
+		     "%u renderer view(s): gain %.0f, cost %.0f\n",
+		  pnode->view, punched, gain, cost);
+
+	return gain >= cost;
+}
+
+/* Test the device's pending state, either after assigning a single plane
+ * (incremental) or once the state is complete, according to the test
+ * policy of the proposal. */
+static int
+drm_output_state_test(struct drm_output_state *state,
+		      enum drm_output_propose_test test,
+		      bool incremental)
+{
+	struct drm_output *output = state->output;
+
+	if (test == DRM_OUTPUT_PROPOSE_TEST_NONE) {
+		drm_debug(output->backend, "\t\t\t[state] skipping atomic "
+			  "test: scene unchanged from last assignment\n");
+		return 0;
+	}
+
+	if (incremental && test == DRM_OUTPUT_PROPOSE_TEST_FINAL)
+		return 0;
+
+	return drm_pending_state_test(state->pending_state);
+}
+
+static uint64_t
+fingerprint_add(uint64_t hash, const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+#define FINGERPRINT_ADD(hash, value) \
+	do { \
+		__typeof__(value) fingerprint_tmp_ = (value); \
+		hash = fingerprint_add(hash, &fingerprint_tmp_, \
+				       sizeof(fingerprint_tmp_)); \
+	} while (0)
+
+static uint64_t
+fingerprint_add_box(uint64_t hash, pixman_region32_t *region)
+{
+	pixman_box32_t *box = pixman_region32_extents(region);
+
+	FINGERPRINT_ADD(hash, box->x1);
+	FINGERPRINT_ADD(hash, box->y1);
+	FINGERPRINT_ADD(hash, box->x2);
+	FINGERPRINT_ADD(hash, box->y2);
+
+	return hash;
+}
+
+/* Whether the view may be presented with an async page flip. Clients ask
+ * for it through tearing control; with low-latency fullscreen, an opaque
+ * dmabuf covering the whole output gets it too unless its client asked
+ * for vsync. */
+static bool
+drm_paint_node_may_tear(struct weston_paint_node *pnode)
+{
+	struct weston_view *ev = pnode->view;
+	struct weston_surface *surface = ev->surface;
+	struct weston_buffer *buffer = surface->buffer_ref.buffer;
+
+	if (surface->tear_control)
+		return surface->tear_control->may_tear;
+
+	return surface->compositor->low_latency_fullscreen &&
+	       buffer && buffer->type == WESTON_BUFFER_DMABUF &&
+	       weston_view_is_opaque(ev, &ev->transform.boundingbox) &&
+	       weston_view_matches_output_entirely(ev, pnode->output);
+}
+
+/* Whether the view must go through the renderer for its colors. When the
+ * CRTC does the blend-to-output color transformation, planes must carry
+ * content that is already in blending space. */
+static bool
+drm_paint_node_needs_color_transform(struct drm_output *output,
+				     struct weston_paint_node *pnode)
+{
+	struct weston_color_transform *xform = pnode->surf_xform.transform;
+
+	if (!output->color_offload_active)
+		return xform != NULL || !pnode->surf_xform.identity_pipeline;
+
+	return xform != NULL &&
+	       (xform->pre_curve.type != WESTON_COLOR_CURVE_TYPE_IDENTITY ||
+		xform->mapping.type != WESTON_COLOR_MAPPING_TYPE_IDENTITY ||
+		xform->post_curve.type != WESTON_COLOR_CURVE_TYPE_IDENTITY);
+}
+
+/* Whether a plane color pipeline could take the color transformation of
+ * the view. Only while the CRTC does the blend-to-output transformation,
+ * as planes then need just the transformation into blending space. */
+static bool
+drm_paint_node_color_transform_on_plane(struct drm_output *output,
+					struct weston_paint_node *pnode)
+{
+	return output->device->plane_color_pipeline &&
+	       output->color_offload_active &&
+	       pnode->surf_xform.transform != NULL;
+}
+
+/* Everything that plane assignment and the kernel's verdict on it depend on,
+ * except for the identity of the client buffers, which are assumed to be
+ * interchangeable as long as size, format and modifier stay the same.
+ */
+static uint64_t
+drm_output_scene_fingerprint(struct drm_output *output)
+{
+	struct drm_device *device = output->device;
+	struct drm_fb *scanout_fb = output->scanout_plane->state_cur->fb;
+	struct weston_paint_node *pnode;
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	FINGERPRINT_ADD(hash, (uintptr_t) output->base.current_mode);
+	FINGERPRINT_ADD(hash, output->base.current_protection);
+	FINGERPRINT_ADD(hash, device->sprites_are_broken);
+	FINGERPRINT_ADD(hash, device->cursors_are_broken);
+
+	/* Mixed mode depends on having a renderer fb from the last repaint */
+	FINGERPRINT_ADD(hash, scanout_fb ? scanout_fb->type : -1);
+	FINGERPRINT_ADD(hash, scanout_fb ? scanout_fb->width : 0);
+	FINGERPRINT_ADD(hash, scanout_fb ? scanout_fb->height : 0);
+
+	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
+			 z_order_link) {
+		struct weston_view *ev = pnode->view;
+		struct weston_surface *surface = ev->surface;
+		struct weston_buffer *buffer = surface->buffer_ref.buffer;
+
+		FINGERPRINT_ADD(hash, (uintptr_t) ev);
+		FINGERPRINT_ADD(hash, drm_paint_node_below_overlay_threshold(output,
+									     pnode));
+		FINGERPRINT_ADD(hash, ev->alpha);
+		hash = fingerprint_add_box(hash, &ev->transform.boundingbox);
+		hash = fingerprint_add_box(hash, &ev->transform.opaque);
+		hash = fingerprint_add(hash, pnode->buffer_to_output_matrix.d,
+				       sizeof(pnode->buffer_to_output_matrix.d));
+
+		FINGERPRINT_ADD(hash, pnode->surf_xform_valid);
+		FINGERPRINT_ADD(hash, (uintptr_t) pnode->surf_xform.transform);
+		FINGERPRINT_ADD(hash, pnode->surf_xform.identity_pipeline);
+
+		FINGERPRINT_ADD(hash, surface->protection_mode);
+		FINGERPRINT_ADD(hash, surface->desired_protection);
+		FINGERPRINT_ADD(hash, surface->acquire_fence_fd >= 0);
+		FINGERPRINT_ADD(hash, drm_paint_node_may_tear(pnode));
+
+		FINGERPRINT_ADD(hash, buffer ? buffer->type : -1);
+		if (!buffer)
+			continue;
+
+		FINGERPRINT_ADD(hash, buffer->width);
+		FINGERPRINT_ADD(hash, buffer->height);
+		FINGERPRINT_ADD(hash, buffer->pixel_format ?
+				      buffer->pixel_format->format : 0);
+		FINGERPRINT_ADD(hash, buffer->format_modifier);
+	}
+
+	return hash;
+}
+
 static bool
 drm_output_check_plane_has_view_assigned(struct drm_plane *plane,
                                          struct drm_output_state *output_state)
@@ -97,6 +478,7 @@ drm_output_try_paint_node_on_plane(struct drm_plane *plane,
 				   struct drm_output_state *output_state,
 				   struct weston_paint_node *node,
 				   enum drm_output_propose_state_mode mode,
+				   enum drm_output_propose_test test,
 				   struct drm_fb *fb, uint64_t zpos)
 {
 	struct drm_output *output = output_state->output;
@@ -124,6 +506,19 @@ drm_output_try_paint_node_on_plane(struct drm_plane *plane,
 		goto out;
 	}
 
+	if (drm_paint_node_needs_color_transform(output, node)) {
+		if (drm_plane_prepare_color_transform(plane,
+						      node->surf_xform.transform) < 0) {
+			drm_debug(b, "\t\t\t\t[view] not placing view %p on "
+				     "plane %lu: color transform does not fit "
+				     "its color pipeline\n", ev,
+				  (unsigned long) plane->plane_id);
+			goto out;
+		}
+		state->color_xform =
+			weston_color_transform_ref(node->surf_xform.transform);
+	}
+
 	/* Should've been ensured by weston_view_matches_entire_output. */
 	if (plane->type == WDRM_PLANE_TYPE_PRIMARY) {
 		assert(state->dest_x == 0 && state->dest_y == 0 &&
@@ -142,7 +537,7 @@ drm_output_try_paint_node_on_plane(struct drm_plane *plane,
 	/* In planes-only mode, we don't have an incremental state to
 	 * test against, so we just hope it'll work. */
 	if (mode != DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY &&
-	    drm_pending_state_test(output_state->pending_state) != 0) {
+	    drm_output_state_test(output_state, test, true) != 0) {
 		drm_debug(b, "\t\t\t[view] not placing view %p on plane %lu: "
 		             "atomic test failed\n",
 			  ev, (unsigned long) plane->plane_id);
@@ -308,18 +703,169 @@ action_needed_to_str(enum actions_needed_dmabuf_feedback action_needed)
       }
 }
 
+/* The formats of the plane the view would most likely be scanned out on:
+ * the primary plane if the view covers the whole output, the overlay
+ * planes otherwise. */
+static bool
+drm_paint_node_is_yuv(struct weston_paint_node *pnode)
+{
+	struct weston_buffer *buffer = pnode->view->surface->buffer_ref.buffer;
+
+	if (!buffer || buffer->type == WESTON_BUFFER_SHM ||
+	    buffer->type == WESTON_BUFFER_SOLID || !buffer->pixel_format)
+		return false;
+
+	return pixel_format_is_yuv(buffer->pixel_format);
+}
+
+static uint32_t
+drm_output_yuv_overlay_mask(struct drm_output *output)
+{
+	struct drm_device *device = output->device;
+	struct drm_plane *plane;
+	uint32_t mask = 0;
+
+	wl_list_for_each(plane, &device->plane_list, link) {
+		if (plane->type == WDRM_PLANE_TYPE_OVERLAY &&
+		    plane->scans_out_yuv &&
+		    (plane->possible_crtcs & (1 << output->crtc->pipe)))
+			mask |= 1 << plane->plane_idx;
+	}
+
+	return mask;
+}
+
+/* Add only the YUV formats of a plane, so that a client showing video is
+ * not told to reallocate in a format that would only scan out as RGB. */
+static int
+drm_format_array_join_yuv(struct weston_drm_format_array *formats,
+			  const struct weston_drm_format_array *plane_formats)
+{
+	const struct pixel_format_info *info;
+	struct weston_drm_format_array yuv;
+	struct weston_drm_format *fmt, *yuv_fmt;
+	const uint64_t *modifiers;
+	unsigned int num_modifiers, i;
+	int ret = -1;
+
+	weston_drm_format_array_init(&yuv);
+
+	wl_array_for_each(fmt, &plane_formats->arr) {
+		info = pixel_format_get_info(fmt->format);
+		if (!info || !pixel_format_is_yuv(info))
+			continue;
+
+		yuv_fmt = weston_drm_format_array_add_format(&yuv, fmt->format);
+		if (!yuv_fmt)
+			goto out;
+
+		modifiers = weston_drm_format_get_modifiers(fmt, &num_modifiers);
+		for (i = 0; i < num_modifiers; i++)
+			if (weston_drm_format_add_modifier(yuv_fmt,
+							   modifiers[i]) < 0)
+				goto out;
+	}
+
+	ret = weston_drm_format_array_join(formats, &yuv);
+
+out:
+	weston_drm_format_array_fini(&yuv);
+	return ret;
+}
+
+static int
+drm_output_get_view_scanout_formats(struct drm_output *output,
+				    struct weston_paint_node *pnode,
+				    struct weston_drm_format_array *formats)
+{
+	struct drm_device *device = output->device;
+	struct drm_plane *plane;
+
+	/* A video may be scanned out from any YUV capable plane, but only
+	 * in the formats those planes can convert like the renderer. */
+	if (drm_paint_node_is_yuv(pnode)) {
+		wl_list_for_each(plane, &device->plane_list, link) {
+			if (!plane->scans_out_yuv ||
+			    !(plane->possible_crtcs & (1 << output->crtc->pipe)))
+				continue;
+
+			if (plane->type == WDRM_PLANE_TYPE_CURSOR)
+				continue;
+
+			if (plane->type == WDRM_PLANE_TYPE_PRIMARY &&
+			    (plane != output->scanout_plane ||
+			     !weston_view_matches_output_entirely(pnode->view,
+								  &output->base)))
+				continue;
+
+			if (drm_format_array_join_yuv(formats,
+						      &plane->formats) < 0)
+				return -1;
+		}
+
+		return 0;
+	}
+
+	if (weston_view_matches_output_entirely(pnode->view, &output->base))
+		return weston_drm_format_array_join(formats,
+						    &output->scanout_plane->formats);
+
+	wl_list_for_each(plane, &device->plane_list, link) {
+		if (plane->type != WDRM_PLANE_TYPE_OVERLAY ||
+		    !(plane->possible_crtcs & (1 << output->crtc->pipe)))
+			continue;
+
+		if (weston_drm_format_array_join(formats, &plane->formats) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
 static void
-dmabuf_feedback_maybe_update(struct drm_device *device, struct weston_view *ev,
+dmabuf_feedback_set_scanout_formats(struct drm_output *output,
+				    struct weston_paint_node *pnode,
+				    struct weston_dmabuf_feedback_tranche *tranche)
+{
+	struct weston_compositor *compositor = output->base.compositor;
+	struct weston_drm_format_array formats;
+	int ret;
+
+	weston_drm_format_array_init(&formats);
+
+	if (drm_output_get_view_scanout_formats(output, pnode, &formats) == 0 &&
+	    weston_drm_format_array_count_pairs(&formats) > 0)
+		ret = weston_dmabuf_feedback_tranche_set_scanout_formats(tranche,
+				compositor->dmabuf_feedback_format_table, &formats);
+	else
+		ret = -1;
+
+	/* Fall back to the formats of all planes. */
+	if (ret < 0)
+		weston_dmabuf_feedback_tranche_set_scanout_formats(tranche,
+				compositor->dmabuf_feedback_format_table, NULL);
+
+	weston_drm_format_array_fini(&formats);
+}
+
+static void
+dmabuf_feedback_maybe_update(struct drm_output *output,
+			     struct weston_paint_node *pnode,
 			     uint32_t try_view_on_plane_failure_reasons)
 {
+	struct drm_device *device = output->device;
+	struct weston_view *ev = pnode->view;
 	struct weston_dmabuf_feedback *dmabuf_feedback = ev->surface->dmabuf_feedback;
 	struct weston_dmabuf_feedback_tranche *scanout_tranche;
 	struct drm_backend *b = device->backend;
 	dev_t scanout_dev = device->drm.devnum;
 	uint32_t scanout_flags = ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT;
 	enum actions_needed_dmabuf_feedback action_needed = ACTION_NEEDED_NONE;
-	struct timespec current_time, delta_time;
+	struct timespec current_time;
 	const time_t MAX_TIME_SECONDS = 2;
+	const time_t MAX_HOLD_SECONDS = 32;
+	const uint32_t MIN_VOTES = 5;
+	time_t hold;
 
 	/* Look for scanout tranche. If not found, add it but in disabled mode
 	 * (we still don't know if we'll have to send it to clients). This
@@ -339,7 +885,8 @@ dmabuf_feedback_maybe_update(struct drm_device *device, struct weston_view *ev,
 	 * params from the scanout tranche, so keep only the renderer tranche. */
 	if (try_view_on_plane_failure_reasons & (FAILURE_REASONS_FORCE_RENDERER |
 						 FAILURE_REASONS_NO_PLANES_AVAILABLE |
-						 FAILURE_REASONS_INADEQUATE_CONTENT_PROTECTION)) {
+						 FAILURE_REASONS_INADEQUATE_CONTENT_PROTECTION |
+						 FAILURE_REASONS_COLOR_TRANSFORM)) {
 		action_needed = ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE;
 	/* Direct scanout may be possible if client re-allocates using the
 	 * params from the scanout tranche. */
@@ -354,14 +901,29 @@ dmabuf_feedback_maybe_update(struct drm_device *device, struct weston_view *ev,
 		action_needed = ACTION_NEEDED_ADD_SCANOUT_TRANCHE;
 	}
 
-	/* No actions needed, so disarm timer and return */
-	if (action_needed == ACTION_NEEDED_NONE ||
-	    (action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE && scanout_tranche->active) ||
+	/* This repaint tells us nothing either way, e.g. the kernel rejected
+	 * the plane configuration as a whole. Leave the timer as it is, so
+	 * that a single odd frame does not restart it. */
+	if (action_needed == ACTION_NEEDED_NONE)
+		return;
+
+	/* The tranche is already how it should be, so disarm the timer. */
+	if ((action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE && scanout_tranche->active) ||
 	    (action_needed == ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE && !scanout_tranche->active)) {
 		dmabuf_feedback->action_needed = ACTION_NEEDED_NONE;
 		return;
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &current_time);
+
+	/* The shell keeps this surface alone on the output, so the scene
+	 * will not flip between scanout and composition: act right away. */
+	if (ev->surface->scanout_preferred) {
+		dmabuf_feedback->hold_seconds = MAX_TIME_SECONDS;
+		dmabuf_feedback->last_change = current_time;
+		goto update;
+	}
+
 	/* We hit this if:
 	 *
 	 * 1. timer is still off, or
@@ -370,32 +932,48 @@ dmabuf_feedback_maybe_update(struct drm_device *device, struct weston_view *ev,
 	 *
 	 * So we reset the timestamp, set the timer to on it with the most
 	 * recent needed action, return and leave the timer running. */
-	if (dmabuf_feedback->action_needed == ACTION_NEEDED_NONE ||
-	    dmabuf_feedback->action_needed != action_needed) {
-		clock_gettime(CLOCK_MONOTONIC, &dmabuf_feedback->timer);
+	if (dmabuf_feedback->action_needed != action_needed) {
+		dmabuf_feedback->timer = current_time;
 		dmabuf_feedback->action_needed = action_needed;
+		dmabuf_feedback->votes = 1;
 		return;
+	}
+
 	/* Timer is already on and the action needed when it was set to on does
 	 * not conflict with the most recent needed action we've detected. If
-	 * more than MAX_TIME_SECONDS has passed, we need to resend the dma-buf
-	 * feedback. Otherwise, return and leave the timer running. */
-	} else {
-		clock_gettime(CLOCK_MONOTONIC, &current_time);
-		delta_time.tv_sec = current_time.tv_sec -
-				    dmabuf_feedback->timer.tv_sec;
-		if (delta_time.tv_sec < MAX_TIME_SECONDS)
-			return;
-	}
+	 * the action has been needed long enough and by enough repaints, we
+	 * need to resend the dma-buf feedback. Otherwise, return and leave the
+	 * timer running. */
+	dmabuf_feedback->votes++;
+	hold = MAX(dmabuf_feedback->hold_seconds, MAX_TIME_SECONDS);
+	if (current_time.tv_sec - dmabuf_feedback->timer.tv_sec < hold ||
+	    dmabuf_feedback->votes < MIN_VOTES)
+		return;
 
+	/* Undoing the previous change soon after it means the scene keeps
+	 * toggling between scanout and composition. Wait longer before the
+	 * next change, so that the client is not made to reallocate over and
+	 * over again. */
+	if (dmabuf_feedback->last_change.tv_sec != 0 &&
+	    current_time.tv_sec - dmabuf_feedback->last_change.tv_sec < 2 * hold)
+		dmabuf_feedback->hold_seconds = MIN(2 * hold, MAX_HOLD_SECONDS);
+	else
+		dmabuf_feedback->hold_seconds = MAX_TIME_SECONDS;
+	dmabuf_feedback->last_change = current_time;
+
+update:
 	/* If we got here it means that the timer has triggered, so we have
 	 * pending actions with the dma-buf feedback. So we update and resend
 	 * them. */
-	if (action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE)
+	if (action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE) {
+		dmabuf_feedback_set_scanout_formats(output, pnode,
+						    scanout_tranche);
 		scanout_tranche->active = true;
-	else if (action_needed == ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE)
+	} else if (action_needed == ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE) {
 		scanout_tranche->active = false;
-	else
+	} else {
 		assert(0);
+	}
 
 	drm_debug(b, "\t[repaint] Need to update and resend the "
 		     "dma-buf feedback for surface of view %p: %s\n",
@@ -427,18 +1005,222 @@ failure_reasons_to_str(enum try_view_on_plane_failure_reasons failure_reasons)
 	case FAILURE_REASONS_NO_GBM:			    return "no gbm";
 	case FAILURE_REASONS_GBM_BO_IMPORT_FAILED:	    return "gbm bo import failed";
 	case FAILURE_REASONS_GBM_BO_GET_HANDLE_FAILED:	    return "gbm bo get handle failed";
+	case FAILURE_REASONS_COLOR_TRANSFORM:		    return "color transform";
 	}
 	return "???";
 }
 
+static void
+drm_surface_scanout_stats_destroy(struct drm_surface_scanout_stats *ss)
+{
+	wl_list_remove(&ss->surface_destroy_listener.link);
+	wl_list_remove(&ss->link);
+	free(ss);
+}
+
+static void
+drm_surface_scanout_stats_handle_destroy(struct wl_listener *listener,
+					 void *data)
+{
+	struct drm_surface_scanout_stats *ss =
+		container_of(listener, struct drm_surface_scanout_stats,
+			     surface_destroy_listener);
+
+	drm_surface_scanout_stats_destroy(ss);
+}
+
+static struct drm_surface_scanout_stats *
+drm_surface_get_scanout_stats(struct drm_backend *b,
+			      struct weston_surface *surface)
+{
+	struct drm_surface_scanout_stats *ss;
+	struct wl_listener *listener;
+
+	listener = wl_signal_get(&surface->destroy_signal,
+				 drm_surface_scanout_stats_handle_destroy);
+	if (listener)
+		return container_of(listener, struct drm_surface_scanout_stats,
+				    surface_destroy_listener);
+
+	ss = xzalloc(sizeof *ss);
+	ss->surface = surface;
+	ss->surface_destroy_listener.notify =
+		drm_surface_scanout_stats_handle_destroy;
+	wl_signal_add(&surface->destroy_signal, &ss->surface_destroy_listener);
+	wl_list_insert(&b->scanout_surface_list, &ss->link);
+
+	return ss;
+}
+
+static void
+drm_scanout_stats_add(struct drm_scanout_stats *stats,
+		      struct drm_plane *plane, uint32_t failure_reasons)
+{
+	int i;
+
+	if (!plane) {
+		stats->renderer++;
+		for (i = 0; i < DRM_FAILURE_REASONS_COUNT; i++)
+			if (failure_reasons & (1 << i))
+				stats->failures[i]++;
+		return;
+	}
+
+	switch (plane->type) {
+	case WDRM_PLANE_TYPE_PRIMARY:
+		stats->primary++;
+		break;
+	case WDRM_PLANE_TYPE_CURSOR:
+		stats->cursor++;
+		break;
+	default:
+		stats->overlay++;
+		break;
+	}
+}
+
+/* Counts where a paint node was shown by this repaint, for the output and
+ * for its surface: on a plane of which type, or by the renderer and why. */
+static void
+drm_scanout_stats_record(struct drm_output *output,
+			 struct weston_paint_node *pnode,
+			 struct drm_plane *plane, uint32_t failure_reasons)
+{
+	struct drm_backend *b = output->device->backend;
+	struct drm_surface_scanout_stats *ss;
+
+	drm_scanout_stats_add(&output->scanout_stats, plane, failure_reasons);
+
+	ss = drm_surface_get_scanout_stats(b, pnode->surface);
+	drm_scanout_stats_add(&ss->stats, plane, failure_reasons);
+}
+
+static void
+drm_scanout_stats_print(struct weston_log_subscription *sub,
+			const struct drm_scanout_stats *stats)
+{
+	uint64_t planes = stats->primary + stats->overlay + stats->cursor;
+	uint64_t total = planes + stats->renderer;
+	int i;
+
+	weston_log_subscription_printf(sub,
+		"\tscanout %.1f%%: primary %" PRIu64 ", overlay %" PRIu64
+		", cursor %" PRIu64 ", renderer %" PRIu64 "\n",
+		total ? 100.0 * planes / total : 0.0,
+		stats->primary, stats->overlay, stats->cursor,
+		stats->renderer);
+
+	for (i = 0; i < DRM_FAILURE_REASONS_COUNT; i++) {
+		if (!stats->failures[i])
+			continue;
+
+		weston_log_subscription_printf(sub,
+			"\t\tnot on a plane, %s: %" PRIu64 "\n",
+			failure_reasons_to_str(1 << i), stats->failures[i]);
+	}
+}
+
+void
+drm_scanout_debug_scope_cb(struct weston_log_subscription *sub, void *data)
+{
+	struct drm_backend *b = data;
+	struct drm_surface_scanout_stats *ss;
+	struct weston_output *base;
+	struct drm_output *output;
+	char desc[512];
+
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		output = to_drm_output(base);
+		if (!output)
+			continue;
+
+		weston_log_subscription_printf(sub,
+			"output %s, %" PRIu64 " repaints:\n",
+			base->name, output->scanout_repaints);
+		if (b->vblank_sequence)
+			weston_log_subscription_printf(sub,
+				"\t%" PRIu64 " late for their vblank\n",
+				output->late_repaints);
+		drm_scanout_stats_print(sub, &output->scanout_stats);
+	}
+
+	wl_list_for_each(ss, &b->scanout_surface_list, link) {
+		if (!ss->surface->get_label ||
+		    ss->surface->get_label(ss->surface, desc, sizeof desc) < 0)
+			snprintf(desc, sizeof desc, "%s",
+				 ss->surface->role_name ?: "unknown role");
+
+		weston_log_subscription_printf(sub, "surface %p, %s:\n",
+					       ss->surface, desc);
+		drm_scanout_stats_print(sub, &ss->stats);
+	}
+
+	weston_log_subscription_complete(sub);
+}
+
+void
+drm_backend_scanout_stats_fini(struct drm_backend *b)
+{
+	struct drm_surface_scanout_stats *ss, *tmp;
+
+	wl_list_for_each_safe(ss, tmp, &b->scanout_surface_list, link)
+		drm_surface_scanout_stats_destroy(ss);
+}
+
+/* YUV buffers may only go on planes which convert them the same way the
+ * renderer does. Overlay planes able to do so are scarce, so while a video
+ * still waits below, RGB views are kept off them where other planes will
+ * do. */
+static uint32_t
+drm_output_filter_yuv_planes(struct drm_output *output,
+			     struct weston_view *ev, struct drm_fb *fb,
+			     uint32_t possible_plane_mask,
+			     bool reserve_yuv_planes)
+{
+	struct drm_device *device = output->device;
+	struct drm_backend *b = device->backend;
+	struct drm_plane *plane;
+	uint32_t yuv_mask, rgb_mask;
+
+	if (fb->format && pixel_format_is_yuv(fb->format)) {
+		wl_list_for_each(plane, &device->plane_list, link) {
+			if (!plane->scans_out_yuv)
+				possible_plane_mask &= ~(1 << plane->plane_idx);
+		}
+		return possible_plane_mask;
+	}
+
+	if (!reserve_yuv_planes)
+		return possible_plane_mask;
+
+	yuv_mask = drm_output_yuv_overlay_mask(output);
+	rgb_mask = 0;
+	wl_list_for_each(plane, &device->plane_list, link) {
+		if (plane->type == WDRM_PLANE_TYPE_OVERLAY &&
+		    !(yuv_mask & (1 << plane->plane_idx)))
+			rgb_mask |= 1 << plane->plane_idx;
+	}
+
+	if ((possible_plane_mask & yuv_mask) &&
+	    (possible_plane_mask & rgb_mask)) {
+		drm_debug(b, "\t\t\t\t[view] keeping view %p off YUV "
+			     "capable planes (reserved for video)\n", ev);
+		possible_plane_mask &= ~yuv_mask;
+	}
+
+	return possible_plane_mask;
+}
+
 static struct drm_plane_state *
 drm_output_find_plane_for_view(struct drm_output_state *state,
 			       struct weston_paint_node *pnode,
 			       enum drm_output_propose_state_mode mode,
+			       enum drm_output_propose_test test,
 			       struct drm_plane_state *scanout_state,
 			       uint64_t current_lowest_zpos_overlay,
 			       uint64_t current_lowest_zpos_underlay,
-			       bool need_underlay)
+			       bool need_underlay,
+			       bool reserve_yuv_planes)
 {
 	struct drm_output *output = state->output;
 	struct drm_device *device = output->device;
@@ -455,6 +1237,7 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 	                               current_lowest_zpos_overlay;
 
 	bool view_matches_entire_output, scanout_has_view_assigned;
+	bool needs_color = drm_paint_node_needs_color_transform(output, pnode);
 	uint32_t possible_plane_mask = 0;
 	uint32_t fb_failure_reasons = 0;
 	bool any_candidate_picked = false;
@@ -474,10 +1257,7 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 	}
 
 	buffer = ev->surface->buffer_ref.buffer;
-	if (buffer->type == WESTON_BUFFER_SOLID) {
-		pnode->try_view_on_plane_failure_reasons |=
-			FAILURE_REASONS_BUFFER_TYPE;
-	} else if (buffer->type == WESTON_BUFFER_SHM) {
+	if (buffer->type == WESTON_BUFFER_SHM) {
 		if (!output->cursor_plane || device->cursors_are_broken)
 			pnode->try_view_on_plane_failure_reasons |=
 				FAILURE_REASONS_BUFFER_TYPE;
@@ -501,6 +1281,11 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 				FAILURE_REASONS_BUFFER_TOO_BIG;
 		}
 
+		/* Cursor planes have no color pipeline. */
+		if (needs_color)
+			pnode->try_view_on_plane_failure_reasons |=
+				FAILURE_REASONS_COLOR_TRANSFORM;
+
 		if (pnode->try_view_on_plane_failure_reasons == FAILURE_REASONS_NONE)
 			possible_plane_mask = (1 << output->cursor_plane->plane_idx);
 	} else {
@@ -514,17 +1299,30 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 			if (plane->type == WDRM_PLANE_TYPE_CURSOR)
 				continue;
 
+			if (needs_color && !plane->color_pipeline)
+				continue;
+
 			if (drm_paint_node_transform_supported(pnode, plane))
 				possible_plane_mask |= 1 << plane->plane_idx;
 		}
 
 		if (!possible_plane_mask)
 			pnode->try_view_on_plane_failure_reasons |=
-				FAILURE_REASONS_INCOMPATIBLE_TRANSFORM;
+				needs_color ? FAILURE_REASONS_COLOR_TRANSFORM :
+					      FAILURE_REASONS_INCOMPATIBLE_TRANSFORM;
 
-		fb = drm_fb_get_from_paint_node(state, pnode, &fb_failure_reasons);
+		if (buffer->type == WESTON_BUFFER_SOLID)
+			fb = drm_fb_get_from_solid(device, pnode,
+						   &fb_failure_reasons);
+		else
+			fb = drm_fb_get_from_paint_node(state, pnode,
+							&fb_failure_reasons);
 		if (fb) {
 			possible_plane_mask &= fb->plane_mask;
+			possible_plane_mask =
+				drm_output_filter_yuv_planes(output, ev, fb,
+							     possible_plane_mask,
+							     reserve_yuv_planes);
 		} else {
 			char *fr_str = bits_to_str(fb_failure_reasons, failure_reasons_to_str);
 			weston_assert_ptr(b->compositor, fr_str);
@@ -663,7 +1461,8 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 			if (fb)
 				ps = drm_output_try_paint_node_on_plane(plane, state,
 									pnode, mode,
-									fb, zpos);
+									test, fb,
+									zpos);
 		}
 
 		if (ps) {
@@ -697,10 +1496,42 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 	return ps;
 }
 
+/* Clipped views are a single box nearly always, which pixman can test
+ * against a region directly; only complex ones go through a subtraction or
+ * intersection, and the allocations that come with it. */
+static bool
+clipped_view_is_covered(pixman_region32_t *clipped_view,
+			pixman_region32_t *region,
+			pixman_region32_t *scratch)
+{
+	if (pixman_region32_n_rects(clipped_view) == 1)
+		return pixman_region32_contains_rectangle(region,
+				pixman_region32_extents(clipped_view)) ==
+			PIXMAN_REGION_IN;
+
+	pixman_region32_subtract(scratch, clipped_view, region);
+	return !pixman_region32_not_empty(scratch);
+}
+
+static bool
+clipped_view_overlaps(pixman_region32_t *clipped_view,
+		      pixman_region32_t *region,
+		      pixman_region32_t *scratch)
+{
+	if (pixman_region32_n_rects(clipped_view) == 1)
+		return pixman_region32_contains_rectangle(region,
+				pixman_region32_extents(clipped_view)) !=
+			PIXMAN_REGION_OUT;
+
+	pixman_region32_intersect(scratch, region, clipped_view);
+	return pixman_region32_not_empty(scratch);
+}
+
 static struct drm_output_state *
 drm_output_propose_state(struct weston_output *output_base,
 			 struct drm_pending_state *pending_state,
-			 enum drm_output_propose_state_mode mode)
+			 enum drm_output_propose_state_mode mode,
+			 enum drm_output_propose_test test)
 {
 	struct drm_output *output = to_drm_output(output_base);
 	struct drm_device *device = output->device;
@@ -711,8 +1542,11 @@ drm_output_propose_state(struct weston_output *output_base,
 
 	pixman_region32_t renderer_region;
 	pixman_region32_t occluded_region;
+	pixman_region32_t scratch_region;
+	struct wl_array renderer_views;
 
 	bool renderer_ok = (mode != DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY);
+	unsigned int yuv_views = 0;
 	int ret;
 	/* Record the current lowest zpos of the overlay planes */
 	uint64_t current_lowest_zpos_overlay = DRM_PLANE_ZPOS_INVALID_PLANE;
@@ -796,6 +1630,14 @@ drm_output_propose_state(struct weston_output *output_base,
 	 */
 	pixman_region32_init(&renderer_region);
 	pixman_region32_init(&occluded_region);
+	pixman_region32_init(&scratch_region);
+	wl_array_init(&renderer_views);
+
+	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
+			 z_order_link) {
+		if (drm_paint_node_is_yuv(pnode))
+			yuv_views++;
+	}
 
 	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
 			 z_order_link) {
@@ -803,16 +1645,19 @@ drm_output_propose_state(struct weston_output *output_base,
 		struct drm_plane_state *ps = NULL;
 		bool force_renderer = false;
 		pixman_region32_t clipped_view;
-		pixman_region32_t surface_overlap;
 		bool totally_occluded = false;
 		bool need_underlay = false;
 
+		/* Count down the videos still to come below this view. */
+		if (drm_paint_node_is_yuv(pnode))
+			yuv_views--;
+
 		drm_debug(b, "\t\t\t[view] evaluating view %p for "
 		             "output %s (%lu)\n",
 		          ev, output->base.name,
 			  (unsigned long) output->base.id);
 
-		assert(ev->output_mask & (1u << output->base.id));
+		assert(weston_output_mask_has(&ev->output_mask, output->base.id));
 
 		/* Cannot show anything without a color transform. */
 		if (!pnode->surf_xform_valid) {
@@ -827,17 +1672,15 @@ drm_output_propose_state(struct weston_output *output_base,
 					  &ev->transform.boundingbox,
 					  &output->base.region);
 
-		pixman_region32_init(&surface_overlap);
-		pixman_region32_subtract(&surface_overlap, &clipped_view,
-					 &occluded_region);
 		/* if the view is completely occluded then ignore that
 		 * view; includes the case where occluded_region covers
 		 * the entire output */
-		totally_occluded = !pixman_region32_not_empty(&surface_overlap);
+		totally_occluded = clipped_view_is_covered(&clipped_view,
+							   &occluded_region,
+							   &scratch_region);
 		if (totally_occluded) {
 			drm_debug(b, "\t\t\t\t[view] ignoring view %p "
 			             "(occluded on our output)\n", ev);
-			pixman_region32_fini(&surface_overlap);
 			pixman_region32_fini(&clipped_view);
 			continue;
 		}
@@ -854,19 +1697,8 @@ drm_output_propose_state(struct weston_output *output_base,
 			force_renderer = true;
 		}
 
-		/* We can support this with the 'CRTC background colour' property,
-		 * if it is fullscreen (i.e. we disable the primary plane), and
-		 * opaque (as it is only shown in the absence of any covering
-		 * plane, not as a replacement for the primary plane per se). */
-		if (ev->surface->buffer_ref.buffer &&
-		    ev->surface->buffer_ref.buffer->type == WESTON_BUFFER_SOLID) {
-			drm_debug(b, "\t\t\t\t[view] not assigning view %p to plane "
-			             "(solid-colour surface)\n", ev);
-			force_renderer = true;
-		}
-
-		if (pnode->surf_xform.transform != NULL ||
-		    !pnode->surf_xform.identity_pipeline) {
+		if (drm_paint_node_needs_color_transform(output, pnode) &&
+		    !drm_paint_node_color_transform_on_plane(output, pnode)) {
 			drm_debug(b, "\t\t\t\t[view] not assigning view %p to plane "
 			             "(requires color transform)\n", ev);
 			force_renderer = true;
@@ -876,9 +1708,8 @@ drm_output_propose_state(struct weston_output *output_base,
 		 * the view intersects the calculated renderer region, it must
 		 * be part of, or occluded by, it, and cannot go on an overlay
 		 * plane. */
-		pixman_region32_intersect(&surface_overlap, &renderer_region,
-					  &clipped_view);
-		if (pixman_region32_not_empty(&surface_overlap)) {
+		if (clipped_view_overlaps(&clipped_view, &renderer_region,
+					  &scratch_region)) {
 			if (b->has_underlay) {
 				need_underlay = true;
 			} else {
@@ -889,17 +1720,32 @@ drm_output_propose_state(struct weston_output *output_base,
 					     current_lowest_zpos_underlay);
 			}
 		}
-		pixman_region32_fini(&surface_overlap);
 
-		/* If need_underlay, but view contains alpha, then it needs to
-		 * be rendered. Only fully-opaque views can go on an underlay.
+		/* If need_underlay, but the view shows alpha, then it needs to
+		 * be rendered. Only the part not already hidden by opaque
+		 * content above has to be opaque, as the renderer covers the
+		 * rest of the hole anyway.
 		 */
-		if (need_underlay &&
-		    !weston_view_is_opaque(ev, &ev->transform.boundingbox)) {
-			force_renderer = true;
-			drm_debug(b, "\t\t\t\t[view] not assigning view %p to "
-				     "a plane (alpha view occluded by renderer "
-				     "views)", ev);
+		if (need_underlay && !force_renderer) {
+			pixman_region32_t visible;
+
+			pixman_region32_init(&visible);
+			pixman_region32_subtract(&visible, &clipped_view,
+						 &occluded_region);
+			if (!weston_view_is_opaque(ev, &visible)) {
+				force_renderer = true;
+				drm_debug(b, "\t\t\t\t[view] not assigning view %p to "
+					     "a plane (alpha view occluded by renderer "
+					     "views)\n", ev);
+			} else if (!drm_paint_node_underlay_worthwhile(b, pnode,
+								       &visible,
+								       &renderer_views)) {
+				force_renderer = true;
+				drm_debug(b, "\t\t\t\t[view] not assigning view %p to "
+					     "an underlay (renderer views above "
+					     "change more than the view)\n", ev);
+			}
+			pixman_region32_fini(&visible);
 		}
 
 		/* In case of enforced mode of content-protection do not
@@ -912,10 +1758,15 @@ drm_output_propose_state(struct weston_output *output_base,
 			force_renderer = true;
 		}
 
-		if (pnode->view->surface->tear_control)
-			state->tear &= pnode->view->surface->tear_control->may_tear;
-		else
-			state->tear = 0;
+		if (mode == DRM_OUTPUT_PROPOSE_STATE_MIXED && !force_renderer &&
+		    drm_paint_node_below_overlay_threshold(output, pnode)) {
+			drm_debug(b, "\t\t\t\t[view] not assigning view %p to plane "
+				     "(overlay planes reserved for views updated "
+				     "more often or larger)\n", ev);
+			force_renderer = true;
+		}
+
+		state->tear &= drm_paint_node_may_tear(pnode);
 
 		/* Now try to place it on a plane if we can. */
 		if (!force_renderer) {
@@ -923,10 +1774,11 @@ drm_output_propose_state(struct weston_output *output_base,
 				      need_underlay ? current_lowest_zpos_underlay :
 				      current_lowest_zpos_overlay);
 			ps = drm_output_find_plane_for_view(state, pnode, mode,
-							    scanout_state,
+							    test, scanout_state,
 							    current_lowest_zpos_overlay,
 							    current_lowest_zpos_underlay,
-							    need_underlay);
+							    need_underlay,
+							    yuv_views > 0);
 		} else {
 			/* We are forced to place the view in the renderer, set
 			 * the failure reason accordingly. */
@@ -966,6 +1818,16 @@ drm_output_propose_state(struct weston_output *output_base,
 					      &clipped_view);
 		}
 
+		if (!ps && b->has_underlay) {
+			struct drm_renderer_view *rv;
+
+			rv = wl_array_add(&renderer_views, sizeof(*rv));
+			if (rv) {
+				rv->extents = *pixman_region32_extents(&clipped_view);
+				rv->update_rate = pnode->update_rate;
+			}
+		}
+
 		/* Opaque areas of our clipped view occlude areas behind it;
 		 * however, anything not in the opaque region (which is the
 		 * entire clipped area if the whole view is known to be
@@ -984,6 +1846,8 @@ drm_output_propose_state(struct weston_output *output_base,
 
 	pixman_region32_fini(&renderer_region);
 	pixman_region32_fini(&occluded_region);
+	pixman_region32_fini(&scratch_region);
+	wl_array_release(&renderer_views);
 
 	/* In renderer-only mode, we can't test the state as we don't have a
 	 * renderer buffer yet. */
@@ -994,7 +1858,7 @@ drm_output_propose_state(struct weston_output *output_base,
 	drm_output_check_zpos_plane_states(state);
 
 	/* Check to see if this state will actually work. */
-	ret = drm_pending_state_test(state->pending_state);
+	ret = drm_output_state_test(state, test, false);
 	if (ret != 0) {
 		drm_debug(b, "\t\t[view] failing state generation: "
 			     "atomic test not OK\n");
@@ -1015,11 +1879,124 @@ drm_output_propose_state(struct weston_output *output_base,
 err_region:
 	pixman_region32_fini(&renderer_region);
 	pixman_region32_fini(&occluded_region);
+	pixman_region32_fini(&scratch_region);
+	wl_array_release(&renderer_views);
 err:
 	drm_output_state_free(state);
 	return NULL;
 }
 
+/* Time an output must keep wanting more overlay planes than the one they
+ * are kept for, before the broker hands them over. */
+#define DRM_PLANE_BROKER_HYSTERESIS_MS 500
+
+static bool
+drm_plane_broker_output_is_candidate(struct drm_output *output,
+				     struct drm_device *device)
+{
+	return output && output->device == device && output->base.enabled &&
+	       !output->is_virtual && output->crtc;
+}
+
+/* Keep as many overlay planes as it has views for, that could go on them,
+ * for the output which has the most, so that outputs which rarely use
+ * overlays do not hold on to the ones shared with a busier output. Which
+ * output is favoured only changes after another one has been ahead for
+ * DRM_PLANE_BROKER_HYSTERESIS_MS, so that they do not thrash. */
+static void
+drm_plane_broker_update(struct drm_device *device)
+{
+	struct drm_backend *b = device->backend;
+	struct drm_output *favoured = device->plane_broker.output;
+	struct drm_output *top = favoured;
+	struct drm_output *output, *holder;
+	struct weston_output *base;
+	struct drm_plane *plane;
+	unsigned int top_demand = favoured ? favoured->plane_demand : 0;
+	unsigned int count, pass;
+	struct timespec now;
+	int64_t now_msec;
+
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		output = to_drm_output(base);
+		if (!drm_plane_broker_output_is_candidate(output, device))
+			continue;
+		if (output->plane_demand > top_demand) {
+			top = output;
+			top_demand = output->plane_demand;
+		}
+	}
+
+	if (top == favoured) {
+		device->plane_broker.challenger = NULL;
+	} else {
+		weston_compositor_read_presentation_clock(b->compositor, &now);
+		now_msec = timespec_to_msec(&now);
+
+		if (device->plane_broker.challenger != top) {
+			device->plane_broker.challenger = top;
+			device->plane_broker.challenger_since_msec = now_msec;
+		} else if (now_msec - device->plane_broker.challenger_since_msec >=
+			   DRM_PLANE_BROKER_HYSTERESIS_MS) {
+			drm_debug(b, "\t[repaint] plane broker: overlay planes "
+				     "go to output %s\n", top->base.name);
+			favoured = top;
+			device->plane_broker.output = top;
+			device->plane_broker.challenger = NULL;
+		}
+	}
+
+	count = favoured ? favoured->plane_demand : 0;
+
+	/* Planes the favoured output already uses first, then the others
+	 * its CRTC can take. */
+	wl_list_for_each(plane, &device->plane_list, link)
+		if (plane->type == WDRM_PLANE_TYPE_OVERLAY)
+			plane->broker_output = NULL;
+
+	for (pass = 0; pass < 2 && count > 0; pass++) {
+		wl_list_for_each(plane, &device->plane_list, link) {
+			if (count == 0)
+				break;
+			if (plane->type != WDRM_PLANE_TYPE_OVERLAY ||
+			    plane->broker_output ||
+			    !(plane->possible_crtcs & (1 << favoured->crtc->pipe)))
+				continue;
+
+			holder = plane->state_cur->output;
+			if ((pass == 0) != (holder == favoured))
+				continue;
+
+			plane->broker_output = favoured;
+			count--;
+
+			/* Have the output holding the plane let go of it */
+			if (holder && holder != favoured) {
+				holder->propose_cache.valid = false;
+				weston_output_schedule_repaint(&holder->base);
+			}
+		}
+	}
+}
+
+/** Stop keeping overlay planes for an output which goes away */
+void
+drm_plane_broker_release_output(struct drm_output *output)
+{
+	struct drm_device *device = output->device;
+	struct drm_plane *plane;
+
+	wl_list_for_each(plane, &device->plane_list, link)
+		if (plane->broker_output == output)
+			plane->broker_output = NULL;
+
+	if (device->plane_broker.output == output)
+		device->plane_broker.output = NULL;
+	if (device->plane_broker.challenger == output)
+		device->plane_broker.challenger = NULL;
+	output->plane_demand = 0;
+}
+
 void
 drm_assign_planes(struct weston_output *output_base)
 {
@@ -1033,24 +2010,75 @@ drm_assign_planes(struct weston_output *output_base)
 	struct weston_paint_node *pnode;
 	struct weston_plane *primary = &output_base->primary_plane;
 	enum drm_output_propose_state_mode mode = DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY;
+	bool use_cache;
+	uint64_t fingerprint;
 
 	assert(output);
 
 	drm_debug(b, "\t[repaint] preparing state for output %s (%lu)\n",
 		  output_base->name, (unsigned long) output_base->id);
 
-	if (!device->sprites_are_broken && !output->is_virtual && b->gbm) {
+	/* When the scene is the same as for the last assignment that passed
+	 * the atomic test, go straight to its mode and skip the test
+	 * commits. A state that needs a modeset, or a writeback screenshot,
+	 * always gets tested. Coming back from a session switch, the
+	 * assignment from before the switch is tried as is. */
+	use_cache = (!device->state_invalid || device->resume_pending) &&
+		    drm_output_get_writeback_state(output) == DRM_OUTPUT_WB_SCREENSHOT_OFF;
+	drm_output_update_overlay_scores(output);
+	fingerprint = drm_output_scene_fingerprint(output);
+	if (use_cache && output->propose_cache.valid &&
+	    output->propose_cache.fingerprint == fingerprint) {
+		mode = output->propose_cache.mode;
+		drm_debug(b, "\t[repaint] reusing %s from last repaint\n",
+			  drm_propose_state_mode_to_string(mode));
+		state = drm_output_propose_state(output_base, pending_state,
+						 mode,
+						 DRM_OUTPUT_PROPOSE_TEST_NONE);
+	}
+	output->propose_cache.valid = false;
+
+	/* First frame in the configuration the kernel took on the last run,
+	 * see config-cache.c: the commit is the test. */
+	if (!state && output->config_cache_hit &&
+	    drm_output_get_writeback_state(output) == DRM_OUTPUT_WB_SCREENSHOT_OFF) {
+		mode = DRM_OUTPUT_PROPOSE_STATE_RENDERER_ONLY;
+		drm_debug(b, "\t[repaint] trying cached renderer-only state "
+			     "untested\n");
+		state = drm_output_propose_state(output_base, pending_state,
+						 mode,
+						 DRM_OUTPUT_PROPOSE_TEST_NONE);
+	}
+
+	if (!state && !device->sprites_are_broken && !output->is_virtual && b->gbm) {
+		mode = DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY;
 		drm_debug(b, "\t[repaint] trying planes-only build state\n");
-		state = drm_output_propose_state(output_base, pending_state, mode);
+		state = drm_output_propose_state(output_base, pending_state,
+						 mode,
+						 DRM_OUTPUT_PROPOSE_TEST_FINAL);
 		if (!state) {
 			drm_debug(b, "\t[repaint] could not build planes-only "
 				     "state, trying mixed\n");
 			mode = DRM_OUTPUT_PROPOSE_STATE_MIXED;
+			/* Optimistically place every candidate and test the
+			 * complete state with a single commit; only when
+			 * that fails fall back to testing each plane as it
+			 * is assigned, searching for a working subset. */
 			state = drm_output_propose_state(output_base,
 							 pending_state,
-							 mode);
+							 mode,
+							 DRM_OUTPUT_PROPOSE_TEST_FINAL);
+			if (!state) {
+				drm_debug(b, "\t[repaint] could not build "
+					     "mixed state in one test, "
+					     "testing incrementally\n");
+				state = drm_output_propose_state(output_base,
+								 pending_state,
+								 mode,
+								 DRM_OUTPUT_PROPOSE_TEST_INCREMENTAL);
+			}
 		}
-	} else {
+	} else if (!state) {
 		drm_debug(b, "\t[state] no overlay plane support\n");
 	}
 
@@ -1062,7 +2090,8 @@ drm_assign_planes(struct weston_output *output_base)
 			     "trying renderer-only\n");
 		mode = DRM_OUTPUT_PROPOSE_STATE_RENDERER_ONLY;
 		state = drm_output_propose_state(output_base, pending_state,
-						 mode);
+						 mode,
+						 DRM_OUTPUT_PROPOSE_TEST_INCREMENTAL);
 		/* If renderer only mode failed and we are in a writeback
 		 * screenshot, let's abort the writeback screenshot and try
 		 * again. */
@@ -1071,7 +2100,8 @@ drm_assign_planes(struct weston_output *output_base)
 				     "state, trying without writeback setup\n");
 			drm_writeback_fail_screenshot(wb_state, "drm: failed to propose state");
 			state = drm_output_propose_state(output_base, pending_state,
-							 mode);
+							 mode,
+							 DRM_OUTPUT_PROPOSE_TEST_INCREMENTAL);
 		}
 	}
 
@@ -1079,16 +2109,31 @@ drm_assign_planes(struct weston_output *output_base)
 	drm_debug(b, "\t[repaint] Using %s composition\n",
 		  drm_propose_state_mode_to_string(mode));
 
+	if (use_cache) {
+		output->propose_cache.valid = true;
+		output->propose_cache.fingerprint = fingerprint;
+		output->propose_cache.mode = mode;
+	}
+
+	output->scanout_repaints++;
+	output->plane_demand = 0;
+
+	/* Copy shm damage into the dumb buffer chosen for scanout while the
+	 * plane states still point at their views. */
+	drm_output_update_shm_scanout(state);
+
 	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
 			 z_order_link) {
 		struct weston_view *ev = pnode->view;
 		struct drm_plane *target_plane = NULL;
+		uint32_t failure_reasons = pnode->try_view_on_plane_failure_reasons;
+		bool shm_copy = false;
 
-		assert(ev->output_mask & (1u << output->base.id));
+		assert(weston_output_mask_has(&ev->output_mask, output->base.id));
 
 		/* Update dmabuf-feedback if needed */
 		if (ev->surface->dmabuf_feedback)
-			dmabuf_feedback_maybe_update(device, ev,
+			dmabuf_feedback_maybe_update(output, pnode,
 						     pnode->try_view_on_plane_failure_reasons);
 		pnode->try_view_on_plane_failure_reasons = FAILURE_REASONS_NONE;
 
@@ -1105,6 +2150,11 @@ drm_assign_planes(struct weston_output *output_base)
 				 (ev->surface->width <= device->cursor_width &&
 		       		  ev->surface->height <= device->cursor_height))
 				ev->surface->keep_buffer = true;
+			else if (buffer->type == WESTON_BUFFER_SHM &&
+				 b->shm_scanout &&
+				 buffer->width == output->base.current_mode->width &&
+				 buffer->height == output->base.current_mode->height)
+				ev->surface->keep_buffer = true;
 		}
 
 		/* This is a bit unpleasant, but lacking a temporary place to
@@ -1116,6 +2166,8 @@ drm_assign_planes(struct weston_output *output_base)
 			if (plane_state->ev == ev) {
 				plane_state->ev = NULL;
 				target_plane = plane_state->plane;
+				shm_copy = drm_output_shm_scanout_has_fb(output,
+									 plane_state->fb);
 				break;
 			}
 		}
@@ -1132,9 +2184,20 @@ drm_assign_planes(struct weston_output *output_base)
 			pnode->need_hole = false;
 		}
 
+		drm_scanout_stats_record(output, pnode, target_plane,
+					 failure_reasons);
+
+		/* Client buffers KMS could scan out, other than the one
+		 * which took the scanout plane, want an overlay. */
+		if (ev->surface->keep_buffer &&
+		    ev->surface->buffer_ref.buffer->type != WESTON_BUFFER_SHM &&
+		    target_plane != output->scanout_plane)
+			output->plane_demand++;
+
 		if (!target_plane ||
-		    target_plane->type == WDRM_PLANE_TYPE_CURSOR) {
-			/* cursor plane & renderer involve a copy */
+		    target_plane->type == WDRM_PLANE_TYPE_CURSOR ||
+		    shm_copy) {
+			/* cursor plane, shm scanout & renderer involve a copy */
 			pnode->psf_flags = 0;
 		} else {
 			/* All other planes are a direct scanout of a
@@ -1160,6 +2223,9 @@ drm_assign_planes(struct weston_output *output_base)
 
 	if (drm_output_get_writeback_state(output) == DRM_OUTPUT_WB_SCREENSHOT_PREPARE_COMMIT)
 		drm_writeback_reference_planes(wb_state, &state->plane_list);
+
+	if (!output->is_virtual)
+		drm_plane_broker_update(device);
 }
 
 static void
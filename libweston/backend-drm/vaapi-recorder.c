@@ -72,6 +72,8 @@
 
 struct vaapi_recorder {
 	int drm_fd, output_fd;
+	vaapi_recorder_write_func_t write_func;
+	void *write_data;
 	int width, height;
 	int frame_count;
 
@@ -84,6 +86,8 @@ struct vaapi_recorder {
 	struct {
 		int valid;
 		int prime_fd, stride;
+		/* nothing changed since the previous frame */
+		int undamaged;
 	} input;
 
 	VADisplay va_dpy;
@@ -767,7 +771,11 @@ encoder_write_output(struct vaapi_recorder *r, VABufferID output_buf)
 		return OUTPUT_WRITE_OVERFLOW;
 	}
 
-	count = write(r->output_fd, segment->buf, segment->size);
+	if (r->write_func)
+		count = r->write_func(r->write_data, segment->buf,
+				      segment->size);
+	else
+		count = write(r->output_fd, segment->buf, segment->size);
 
 	vaUnmapBuffer(r->va_dpy, output_buf);
 
@@ -924,13 +932,13 @@ destroy_worker_thread(struct vaapi_recorder *r)
 	pthread_cond_destroy(&r->input_cond);
 }
 
-struct vaapi_recorder *
-vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
+static struct vaapi_recorder *
+recorder_create(int drm_fd, int width, int height, int output_fd,
+		vaapi_recorder_write_func_t write_func, void *data)
 {
 	struct vaapi_recorder *r;
 	VAStatus status;
 	int major, minor;
-	int flags;
 
 	r = zalloc(sizeof *r);
 	if (r == NULL)
@@ -939,25 +947,23 @@ vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
 	r->width = width;
 	r->height = height;
 	r->drm_fd = drm_fd;
+	r->output_fd = output_fd;
+	r->write_func = write_func;
+	r->write_data = data;
 
 	if (setup_worker_thread(r) < 0)
 		goto err_free;
 
-	flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
-	r->output_fd = open(filename, flags, 0644);
-	if (r->output_fd < 0)
-		goto err_thread;
-
 	r->va_dpy = vaGetDisplayDRM(drm_fd);
 	if (!r->va_dpy) {
 		weston_log("failed to create VA display\n");
-		goto err_fd;
+		goto err_thread;
 	}
 
 	status = vaInitialize(r->va_dpy, &major, &minor);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("vaapi: failed to initialize display\n");
-		goto err_fd;
+		goto err_thread;
 	}
 
 	if (setup_vpp(r) < 0) {
@@ -975,8 +981,6 @@ err_vpp:
 	vpp_destroy(r);
 err_va_dpy:
 	vaTerminate(r->va_dpy);
-err_fd:
-	close(r->output_fd);
 err_thread:
 	destroy_worker_thread(r);
 err_free:
@@ -985,6 +989,38 @@ err_free:
 	return NULL;
 }
 
+struct vaapi_recorder *
+vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
+{
+	struct vaapi_recorder *r;
+	int flags;
+	int fd;
+
+	flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	fd = open(filename, flags, 0644);
+	if (fd < 0)
+		return NULL;
+
+	r = recorder_create(drm_fd, width, height, fd, NULL, NULL);
+	if (!r)
+		close(fd);
+
+	return r;
+}
+
+/** Create a recorder handing the encoded stream to a callback
+ *
+ * Like vaapi_recorder_create(), but each encoded access unit is passed to
+ * write_func on the encoder thread instead of being written to a file.
+ */
+struct vaapi_recorder *
+vaapi_recorder_create_with_sink(int drm_fd, int width, int height,
+				vaapi_recorder_write_func_t write_func,
+				void *data)
+{
+	return recorder_create(drm_fd, width, height, -1, write_func, data);
+}
+
 void
 vaapi_recorder_destroy(struct vaapi_recorder *r)
 {
@@ -995,7 +1031,8 @@ vaapi_recorder_destroy(struct vaapi_recorder *r)
 
 	vaTerminate(r->va_dpy);
 
-	close(r->output_fd);
+	if (r->output_fd >= 0)
+		close(r->output_fd);
 	close(r->drm_fd);
 
 	free(r);
@@ -1085,6 +1122,15 @@ recorder_frame(struct vaapi_recorder *r)
 	VASurfaceID rgb_surface;
 	VAStatus status;
 
+	/* vpp.output still holds the previous frame, so there is nothing to
+	 * import or convert; encoding it again gives a P frame made of skipped
+	 * macroblocks and keeps the stream at a constant frame rate. */
+	if (r->input.undamaged && r->frame_count > 0) {
+		close(r->input.prime_fd);
+		encoder_encode(r, r->vpp.output);
+		return;
+	}
+
 	status = create_surface_from_fd(r, r->input.prime_fd,
 					r->input.stride, &rgb_surface);
 	if (status != VA_STATUS_SUCCESS) {
@@ -1132,8 +1178,18 @@ worker_thread_function(void *data)
 	return NULL;
 }
 
+/** Queue a frame for encoding
+ *
+ * \param r The recorder.
+ * \param prime_fd A dmabuf fd of the frame, owned by the recorder from now on.
+ * \param stride The stride of the frame in bytes.
+ * \param damage What changed since the previous frame in frame coordinates,
+ * or NULL if unknown. An empty region lets the recorder skip the import and
+ * colour conversion of the frame.
+ */
 int
-vaapi_recorder_frame(struct vaapi_recorder *r, int prime_fd, int stride)
+vaapi_recorder_frame(struct vaapi_recorder *r, int prime_fd, int stride,
+		     const pixman_region32_t *damage)
 {
 	int ret = 0;
 
@@ -1151,6 +1207,7 @@ vaapi_recorder_frame(struct vaapi_recorder *r, int prime_fd, int stride)
 
 	r->input.prime_fd = prime_fd;
 	r->input.stride = stride;
+	r->input.undamaged = damage && !pixman_region32_not_empty(damage);
 	r->input.valid = 1;
 	pthread_cond_signal(&r->input_cond);
 
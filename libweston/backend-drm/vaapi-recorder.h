@@ -26,13 +26,29 @@
 #ifndef _VAAPI_RECORDER_H_
 #define _VAAPI_RECORDER_H_
 
+#include <stddef.h>
+#include <pixman.h>
+
 struct vaapi_recorder;
 
+/** Receives one encoded H.264 access unit
+ *
+ * Called from the encoder thread. Returns a negative value and sets errno
+ * on failure, which stops the recorder.
+ */
+typedef int (*vaapi_recorder_write_func_t)(void *data, const void *bitstream,
+					   size_t size);
+
 struct vaapi_recorder *
 vaapi_recorder_create(int drm_fd, int width, int height, const char *filename);
+struct vaapi_recorder *
+vaapi_recorder_create_with_sink(int drm_fd, int width, int height,
+				vaapi_recorder_write_func_t write_func,
+				void *data);
 void
 vaapi_recorder_destroy(struct vaapi_recorder *r);
 int
-vaapi_recorder_frame(struct vaapi_recorder *r, int fd, int stride);
+vaapi_recorder_frame(struct vaapi_recorder *r, int fd, int stride,
+		     const pixman_region32_t *damage);
 
 #endif /* _VAAPI_RECORDER_H_ */
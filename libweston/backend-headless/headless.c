@@ -69,6 +69,10 @@ struct headless_backend {
 
 	int refresh;
 	bool repaint_only_on_capture;
+
+	bool vblank;
+	int vblank_jitter; /* in usec */
+	bool use_dmabuf;
 };
 
 struct headless_head {
@@ -83,6 +87,11 @@ struct headless_output {
 	struct wl_event_source *finish_frame_timer;
 	struct weston_renderbuffer *renderbuffer;
 
+	/* Virtual vblank grid: vblank number n is at
+	 * vblank_base + n * refresh period. */
+	struct timespec vblank_base;
+	uint64_t pending_msc;
+
 	struct frame *frame;
 	struct {
 		struct weston_gl_borders borders;
@@ -122,13 +131,44 @@ to_headless_backend(struct weston_backend *base)
 	return container_of(base, struct headless_backend, base);
 }
 
+/* Number of the last virtual vblank at or before now */
+static uint64_t
+headless_output_vblank_msc(struct headless_output *output,
+			   const struct timespec *now)
+{
+	int64_t period = millihz_to_nsec(output->mode.refresh);
+
+	return timespec_sub_to_nsec(now, &output->vblank_base) / period;
+}
+
+static void
+headless_output_vblank_time(struct headless_output *output, uint64_t msc,
+			    struct timespec *ts)
+{
+	int64_t period = millihz_to_nsec(output->mode.refresh);
+
+	timespec_add_nsec(ts, &output->vblank_base, msc * period);
+}
+
 static int
-headless_output_start_repaint_loop(struct weston_output *output)
+headless_output_start_repaint_loop(struct weston_output *output_base)
 {
+	struct headless_output *output = to_headless_output(output_base);
 	struct timespec ts;
+	uint64_t msc;
 
-	weston_compositor_read_presentation_clock(output->compositor, &ts);
-	weston_output_finish_frame(output, &ts, WP_PRESENTATION_FEEDBACK_INVALID);
+	assert(output);
+
+	weston_compositor_read_presentation_clock(output_base->compositor, &ts);
+
+	/* Like the DRM backend, start from the last vblank */
+	if (output->backend->vblank) {
+		msc = headless_output_vblank_msc(output, &ts);
+		output_base->msc = msc;
+		headless_output_vblank_time(output, msc, &ts);
+	}
+
+	weston_output_finish_frame(output_base, &ts, WP_PRESENTATION_FEEDBACK_INVALID);
 
 	return 0;
 }
@@ -137,12 +177,46 @@ static int
 finish_frame_handler(void *data)
 {
 	struct headless_output *output = data;
+	struct timespec ts;
+
+	if (!output->backend->vblank) {
+		weston_output_finish_frame_from_timer(&output->base);
+		return 1;
+	}
 
-	weston_output_finish_frame_from_timer(&output->base);
+	output->base.msc = output->pending_msc;
+	headless_output_vblank_time(output, output->pending_msc, &ts);
+	weston_output_finish_frame(&output->base, &ts,
+				   WP_PRESENTATION_FEEDBACK_KIND_VSYNC);
 
 	return 1;
 }
 
+/* Arm the timer for the first virtual vblank after now, late by the
+ * configured jitter. */
+static void
+headless_output_arm_vblank(struct headless_output *output)
+{
+	struct headless_backend *b = output->backend;
+	struct timespec now, vblank;
+	int64_t delay_nsec;
+
+	weston_compositor_read_presentation_clock(b->compositor, &now);
+
+	output->pending_msc = MAX(headless_output_vblank_msc(output, &now),
+				  output->base.msc) + 1;
+	headless_output_vblank_time(output, output->pending_msc, &vblank);
+
+	delay_nsec = timespec_sub_to_nsec(&vblank, &now);
+	if (b->vblank_jitter > 0)
+		delay_nsec += (random() % (b->vblank_jitter + 1)) * 1000;
+
+	/* The timer has millisecond granularity and 0 disarms it, so round
+	 * up: the event may come late, but never before the vblank. */
+	wl_event_source_timer_update(output->finish_frame_timer,
+				     (delay_nsec + 999999) / 1000000);
+}
+
 static void
 headless_output_update_gl_border(struct headless_output *output)
 {
@@ -173,11 +247,16 @@ headless_output_repaint(struct weston_output *output_base)
 
 	weston_output_flush_damage_for_primary_plane(output_base, &damage);
 
-	ec->renderer->repaint_output(&output->base, &damage,
-				     output->renderbuffer);
+	weston_renderer_repaint_output(&output->base, &damage,
+				       output->renderbuffer);
 
 	pixman_region32_fini(&damage);
 
+	if (output->backend->vblank) {
+		headless_output_arm_vblank(output);
+		return 0;
+	}
+
 	delay_msec = millihz_to_nsec(output->mode.refresh) / 1000000;
 	wl_event_source_timer_update(output->finish_frame_timer, delay_msec);
 
@@ -257,6 +336,38 @@ headless_output_destroy(struct weston_output *base)
 	free(output);
 }
 
+static struct weston_renderbuffer *
+headless_output_create_dmabuf_renderbuffer(struct headless_output *output,
+					   int width, int height)
+{
+	struct headless_backend *b = output->backend;
+	struct weston_renderer *renderer = b->compositor->renderer;
+	uint64_t modifier[] = { DRM_FORMAT_MOD_LINEAR };
+	struct linux_dmabuf_memory *dmabuf;
+	struct weston_renderbuffer *renderbuffer;
+
+	if (!renderer->dmabuf_alloc || !renderer->create_renderbuffer_dmabuf) {
+		weston_log("GL renderer cannot allocate DMABUFs\n");
+		return NULL;
+	}
+
+	dmabuf = renderer->dmabuf_alloc(renderer, width, height,
+					b->formats[0]->format,
+					modifier, ARRAY_LENGTH(modifier));
+	if (!dmabuf) {
+		weston_log("Failed to allocate DMABUF (%dx%d %s)\n",
+			   width, height, b->formats[0]->drm_format_name);
+		return NULL;
+	}
+
+	renderbuffer = renderer->create_renderbuffer_dmabuf(&output->base,
+							    dmabuf);
+	if (!renderbuffer)
+		dmabuf->destroy(dmabuf);
+
+	return renderbuffer;
+}
+
 static int
 headless_output_enable_gl(struct headless_output *output)
 {
@@ -300,10 +411,16 @@ headless_output_enable_gl(struct headless_output *output)
 		return -1;
 	}
 
-	output->renderbuffer =
-		renderer->gl->create_fbo(&output->base, b->formats[0],
-					 options.fb_size.width,
-					 options.fb_size.height, NULL);
+	if (b->use_dmabuf)
+		output->renderbuffer =
+			headless_output_create_dmabuf_renderbuffer(output,
+								   options.fb_size.width,
+								   options.fb_size.height);
+	else
+		output->renderbuffer =
+			renderer->gl->create_fbo(&output->base, b->formats[0],
+						 options.fb_size.width,
+						 options.fb_size.height, NULL);
 	if (!output->renderbuffer)
 		goto err_renderbuffer;
 
@@ -369,6 +486,9 @@ headless_output_enable(struct weston_output *base)
 		return -1;
 	}
 
+	weston_compositor_read_presentation_clock(b->compositor,
+						  &output->vblank_base);
+
 	switch (b->compositor->renderer->type) {
 	case WESTON_RENDERER_GL:
 		ret = headless_output_enable_gl(output);
@@ -397,6 +517,7 @@ headless_output_set_size(struct weston_output *base,
 	struct headless_output *output = to_headless_output(base);
 	struct weston_head *head;
 	int output_width, output_height;
+	uint32_t scale;
 
 	if (!output)
 		return -1;
@@ -415,8 +536,9 @@ headless_output_set_size(struct weston_output *base,
 		weston_head_set_physical_size(head, width, height);
 	}
 
-	output_width = width * output->base.current_scale;
-	output_height = height * output->base.current_scale;
+	scale = weston_output_get_fractional_scale(&output->base);
+	output_width = (int64_t) width * scale / 120;
+	output_height = (int64_t) height * scale / 120;
 
 	output->mode.flags =
 		WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
@@ -437,6 +559,29 @@ headless_output_set_size(struct weston_output *base,
 	return 0;
 }
 
+static int
+headless_output_set_refresh(struct weston_output *base, int refresh)
+{
+	struct headless_output *output = to_headless_output(base);
+
+	if (!output || output->base.enabled)
+		return -1;
+
+	/* Must come after set_size(), which creates the mode */
+	if (output->base.current_mode != &output->mode)
+		return -1;
+
+	if (refresh <= 0 || refresh > 1000000) {
+		weston_log("Invalid refresh rate %d mHz for output %s\n",
+			   refresh, output->base.name);
+		return -1;
+	}
+
+	output->mode.refresh = refresh;
+
+	return 0;
+}
+
 static struct weston_output *
 headless_output_create(struct weston_backend *backend, const char *name)
 {
@@ -542,6 +687,10 @@ static const struct weston_windowed_output_api api = {
 	headless_head_create,
 };
 
+static const struct weston_headless_output_api headless_api = {
+	headless_output_set_refresh,
+};
+
 static struct headless_backend *
 headless_backend_create(struct weston_compositor *compositor,
 			struct weston_headless_backend_config *config)
@@ -586,6 +735,19 @@ headless_backend_create(struct weston_compositor *compositor,
 		b->refresh = DEFAULT_OUTPUT_REPAINT_REFRESH;
 	}
 
+	b->vblank = config->vblank;
+	if (config->vblank_jitter > 0 && !config->vblank) {
+		weston_log("Error: vblank jitter needs the virtual vblank.\n");
+		goto err_input;
+	}
+	b->vblank_jitter = MAX(config->vblank_jitter, 0);
+
+	b->use_dmabuf = config->use_dmabuf;
+	if (b->use_dmabuf && config->renderer != WESTON_RENDERER_GL) {
+		weston_log("Error: DMABUF renderbuffers need the GL renderer.\n");
+		goto err_input;
+	}
+
 	if (!compositor->renderer) {
 		switch (config->renderer) {
 		case WESTON_RENDERER_GL: {
@@ -641,6 +803,15 @@ headless_backend_create(struct weston_compositor *compositor,
 		goto err_input;
 	}
 
+	ret = weston_plugin_api_register(compositor,
+					 WESTON_HEADLESS_OUTPUT_API_NAME,
+					 &headless_api, sizeof(headless_api));
+
+	if (ret < 0) {
+		weston_log("Failed to register headless output API.\n");
+		goto err_input;
+	}
+
 	return b;
 
 err_input:
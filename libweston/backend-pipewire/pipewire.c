@@ -39,7 +39,12 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <drm_fourcc.h>
+#include <errno.h>
 #include <fcntl.h>
+#ifdef BUILD_PIPEWIRE_VAAPI
+#include <pthread.h>
+#include <sys/eventfd.h>
+#endif
 
 #include <pipewire/pipewire.h>
 #include <spa/buffer/meta.h>
@@ -56,10 +61,14 @@
 #include <libweston/backend-pipewire.h>
 #include <libweston/linux-dmabuf.h>
 #include <libweston/weston-log.h>
+#include "linux-sync-file.h"
 #include "pixel-formats.h"
 #include "pixman-renderer.h"
 #include "renderer-gl/gl-renderer.h"
 #include "shared/weston-egl-ext.h"
+#ifdef BUILD_PIPEWIRE_VAAPI
+#include "../backend-drm/vaapi-recorder.h"
+#endif
 
 struct pipewire_backend {
 	struct weston_backend base;
@@ -78,8 +87,15 @@ struct pipewire_backend {
 
 	const struct pixel_format_info **formats;
 	unsigned int formats_count;
+
+	bool vaapi_encode;
+	char *vaapi_device;
 };
 
+#define PIPEWIRE_ENCODE_BUFFERS 2
+/* Rectangles of SPA_META_VideoDamage, beyond that the extents are sent */
+#define PIPEWIRE_DAMAGE_RECTS 16
+
 struct pipewire_output {
 	struct weston_output base;
 	struct pipewire_backend *backend;
@@ -91,8 +107,44 @@ struct pipewire_output {
 	struct wl_list fence_list;
 	const struct pixel_format_info *pixel_format;
 
+	/* See pipewire_output_frame_wanted() */
+	struct pw_buffer *next_buffer;
+	int64_t frame_interval_nsec;
+	struct timespec last_frame;
+	bool frame_deferred;
+
+	/* pipewire_scaled_stream::link */
+	struct wl_list scaled_stream_list;
+	/* Rendered into when only the scaled streams have consumers */
+	struct weston_renderbuffer *scale_source;
+
 	struct wl_event_source *finish_frame_timer;
 	struct wl_list link;
+
+#ifdef BUILD_PIPEWIRE_VAAPI
+	/* H.264 stream, frames are rendered into dmabufs which the VA-API
+	 * encoder imports, the encoded access units are copied into the
+	 * PipeWire buffers. */
+	struct {
+		bool enabled;
+		struct vaapi_recorder *recorder;
+		struct pipewire_dmabuf *dmabuf[PIPEWIRE_ENCODE_BUFFERS];
+		struct weston_renderbuffer *renderbuffer[PIPEWIRE_ENCODE_BUFFERS];
+		int fence_fd[PIPEWIRE_ENCODE_BUFFERS];
+		struct wl_event_source *fence_source[PIPEWIRE_ENCODE_BUFFERS];
+		/* Output damage of the frame in each buffer, relative to the
+		 * frame encoded before it. */
+		pixman_region32_t damage[PIPEWIRE_ENCODE_BUFFERS];
+		int current;
+		bool failed;
+
+		/* Filled by the encoder thread. */
+		pthread_mutex_t mutex;
+		struct wl_list packet_list; /* pipewire_encoded_packet::link */
+		int event_fd;
+		struct wl_event_source *event_source;
+	} encode;
+#endif
 };
 
 struct pipewire_head {
@@ -104,6 +156,31 @@ struct pipewire_frame_data {
 	struct weston_renderbuffer *renderbuffer;
 	struct pipewire_memfd *memfd;
 	struct pipewire_dmabuf *dmabuf;
+	/* Output damage of the frame in the buffer, relative to the frame
+	 * queued before it. */
+	pixman_region32_t damage;
+};
+
+/* The frames of an output scaled to another size on the GPU, for another
+ * consumer, see pipewire_output_repaint_scaled(). Its buffers are always
+ * DMABUFs in the output's format. */
+struct pipewire_scaled_stream {
+	struct pipewire_output *output;
+	struct wl_list link; /* pipewire_output::scaled_stream_list */
+	struct weston_size size;
+
+	uint32_t seq;
+	struct pw_stream *stream;
+	struct spa_hook stream_listener;
+
+	/* Output damage since the last frame queued, in output pixels */
+	pixman_region32_t damage;
+
+	/* Frame waiting for rendering, if the fence can't go with the
+	 * DMABUF */
+	struct pw_buffer *fence_buffer;
+	int fence_fd;
+	struct wl_event_source *fence_source;
 };
 
 /* Pipewire default configuration for heads */
@@ -123,7 +200,7 @@ pipewire_debug_impl(struct pipewire_backend *pipewire,
 	size_t logsize;
 	char timestr[128];
 
-	if (!weston_log_scope_is_enabled(pipewire->debug))
+	if (!weston_log_scope_enabled(pipewire->debug))
 		return;
 
 	fp = open_memstream(&logstr, &logsize);
@@ -179,6 +256,15 @@ pipewire_head_destroy(struct weston_head *base);
 static void
 pipewire_destroy(struct weston_backend *backend);
 
+static void
+pipewire_output_connect_scaled_streams(struct pipewire_output *output);
+
+static void
+pipewire_output_disconnect_scaled_streams(struct pipewire_output *output);
+
+static void
+pipewire_scaled_stream_destroy(struct pipewire_scaled_stream *scaled);
+
 static inline struct pipewire_head *
 to_pipewire_head(struct weston_head *base)
 {
@@ -213,6 +299,25 @@ pipewire_backend_has_dmabuf_allocator(struct pipewire_backend *backend)
 	return renderer->dmabuf_alloc != NULL;
 }
 
+/* The metadata of raw frames, fills two params */
+static void
+spa_pod_build_raw_meta_params(struct spa_pod_builder *builder,
+			      const struct spa_pod **params)
+{
+	params[0] = spa_pod_builder_add_object(builder,
+		SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+		SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Header),
+		SPA_PARAM_META_size, SPA_POD_Int(sizeof(struct spa_meta_header)));
+
+	params[1] = spa_pod_builder_add_object(builder,
+		SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+		SPA_PARAM_META_type, SPA_POD_Id(SPA_META_VideoDamage),
+		SPA_PARAM_META_size, SPA_POD_CHOICE_RANGE_Int(
+			sizeof(struct spa_meta_region) * PIPEWIRE_DAMAGE_RECTS,
+			sizeof(struct spa_meta_region) * 1,
+			sizeof(struct spa_meta_region) * PIPEWIRE_DAMAGE_RECTS));
+}
+
 static struct spa_pod *
 spa_pod_build_format(struct spa_pod_builder *builder,
 		     int width, int height, int framerate,
@@ -252,6 +357,43 @@ spa_pod_build_format(struct spa_pod_builder *builder,
 	return spa_pod_builder_pop(builder, &f);
 }
 
+#ifdef BUILD_PIPEWIRE_VAAPI
+static struct spa_pod *
+spa_pod_build_h264_format(struct spa_pod_builder *builder,
+			  int width, int height, int framerate)
+{
+	struct spa_pod_frame f;
+
+	spa_pod_builder_push_object(builder, &f,
+				    SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat);
+	spa_pod_builder_add(builder,
+			    SPA_FORMAT_mediaType, SPA_POD_Id(SPA_MEDIA_TYPE_video), 0);
+	spa_pod_builder_add(builder,
+			    SPA_FORMAT_mediaSubtype, SPA_POD_Id(SPA_MEDIA_SUBTYPE_h264), 0);
+	spa_pod_builder_add(builder,
+			    SPA_FORMAT_VIDEO_H264_streamFormat,
+			    SPA_POD_Id(SPA_H264_STREAM_FORMAT_BYTESTREAM), 0);
+	spa_pod_builder_add(builder,
+			    SPA_FORMAT_VIDEO_H264_alignment,
+			    SPA_POD_Id(SPA_H264_ALIGNMENT_AU), 0);
+
+	spa_pod_builder_prop(builder, SPA_FORMAT_VIDEO_size, 0);
+	spa_pod_builder_rectangle(builder, width, height);
+
+	spa_pod_builder_add(builder,
+			    SPA_FORMAT_VIDEO_framerate,
+			    SPA_POD_Fraction(&SPA_FRACTION(0, 1)), 0);
+	spa_pod_builder_add(builder,
+			    SPA_FORMAT_VIDEO_maxFramerate,
+			    SPA_POD_CHOICE_RANGE_Fraction(
+				    &SPA_FRACTION(framerate,1),
+				    &SPA_FRACTION(1,1),
+				    &SPA_FRACTION(framerate,1)), 0);
+
+	return spa_pod_builder_pop(builder, &f);
+}
+#endif
+
 static int
 pipewire_output_connect(struct pipewire_output *output)
 {
@@ -262,6 +404,16 @@ pipewire_output_connect(struct pipewire_output *output)
 	int i = 0;
 	int ret;
 
+#ifdef BUILD_PIPEWIRE_VAAPI
+	if (output->encode.enabled) {
+		params[i++] = spa_pod_build_h264_format(&builder,
+							output->base.width,
+							output->base.height,
+							output->base.current_mode->refresh / 1000);
+		goto connect;
+	}
+#endif
+
 	if (pipewire_backend_has_dmabuf_allocator(output->backend)) {
 		/* TODO: Add support for modifier discovery and negotiation. */
 		uint64_t modifier[] = { DRM_FORMAT_MOD_LINEAR };
@@ -277,6 +429,9 @@ pipewire_output_connect(struct pipewire_output *output)
 					   output->base.current_mode->refresh / 1000,
 					   output->pixel_format->format, NULL);
 
+#ifdef BUILD_PIPEWIRE_VAAPI
+connect:
+#endif
 	ret = pw_stream_connect(output->stream, PW_DIRECTION_OUTPUT, PW_ID_ANY,
 				PW_STREAM_FLAG_DRIVER |
 				PW_STREAM_FLAG_ALLOC_BUFFERS,
@@ -297,6 +452,12 @@ finish_frame_handler(void *data)
 
 	weston_output_finish_frame_from_timer(&output->base);
 
+	/* Try again with the damage left over */
+	if (output->frame_deferred) {
+		output->frame_deferred = false;
+		weston_output_schedule_repaint(&output->base);
+	}
+
 	return 1;
 }
 
@@ -385,10 +546,21 @@ pipewire_output_enable(struct weston_output *base)
 							     finish_frame_handler,
 							     output);
 
+#ifdef BUILD_PIPEWIRE_VAAPI
+	output->encode.enabled = backend->vaapi_encode &&
+				 pipewire_output_can_encode(output);
+	if (backend->vaapi_encode && !output->encode.enabled)
+		weston_log("PipeWire: output %s can't be H.264 encoded, "
+			   "it needs the GL renderer with dmabuf support "
+			   "and xrgb8888, streaming raw frames\n", base->name);
+#endif
+
 	ret = pipewire_output_connect(output);
 	if (ret < 0)
 		goto err;
 
+	pipewire_output_connect_scaled_streams(output);
+
 	return 0;
 err:
 	switch (renderer->type) {
@@ -418,6 +590,8 @@ pipewire_output_disable(struct weston_output *base)
 		return 0;
 
 	pw_stream_disconnect(output->stream);
+	pipewire_output_encode_stop(output);
+	pipewire_output_disconnect_scaled_streams(output);
 
 	switch (renderer->type) {
 	case WESTON_RENDERER_PIXMAN:
@@ -439,13 +613,17 @@ static void
 pipewire_output_destroy(struct weston_output *base)
 {
 	struct pipewire_output *output = to_pipewire_output(base);
+	struct pipewire_scaled_stream *scaled, *tmp;
 
 	assert(output);
 
 	pipewire_output_disable(&output->base);
 	weston_output_release(&output->base);
 
+	wl_list_for_each_safe(scaled, tmp, &output->scaled_stream_list, link)
+		pipewire_scaled_stream_destroy(scaled);
 	pw_stream_destroy(output->stream);
+	pipewire_output_fini_encode(output);
 
 	free(output);
 }
@@ -478,20 +656,17 @@ struct pipewire_dmabuf {
 };
 
 static struct pipewire_dmabuf *
-pipewire_output_create_dmabuf(struct pipewire_output *output)
+pipewire_output_create_dmabuf(struct pipewire_output *output,
+			      unsigned int width, unsigned int height)
 {
 	struct pipewire_backend *b = output->backend;
 	struct weston_renderer *renderer = b->compositor->renderer;
 	struct linux_dmabuf_memory *linux_dmabuf_memory;
 	struct pipewire_dmabuf *dmabuf;
 	const struct pixel_format_info *format;
-	unsigned int width;
-	unsigned int height;
 	uint64_t modifier[] = { DRM_FORMAT_MOD_LINEAR };
 
 	format = output->pixel_format;
-	width = output->base.width;
-	height = output->base.height;
 
 	linux_dmabuf_memory = renderer->dmabuf_alloc(renderer, width, height,
 						     format->format,
@@ -517,196 +692,662 @@ pipewire_destroy_dmabuf(struct pipewire_output *output,
 	free(dmabuf);
 }
 
+#ifdef BUILD_PIPEWIRE_VAAPI
 static void
-pipewire_output_stream_param_changed(void *data, uint32_t id,
-				     const struct spa_pod *format)
-{
-	struct pipewire_output *output = data;
-	uint8_t buffer[1024];
-	struct spa_pod_builder builder =
-		SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
-	const struct spa_pod *params[2];
-	struct spa_video_info video_info;
-	uint32_t buffertype;
-	int32_t width;
-	int32_t height;
-	int32_t stride;
-	int32_t size;
+pipewire_queue_buffer(struct pipewire_output *output,
+		      struct pw_buffer *buffer,
+		      unsigned int stride, size_t size);
 
-	if (!format || id != SPA_PARAM_Format)
-		return;
-
-	if (spa_format_parse(format, &video_info.media_type,
-			     &video_info.media_subtype) < 0)
-		return;
-	if (video_info.media_type != SPA_MEDIA_TYPE_video ||
-	    video_info.media_subtype != SPA_MEDIA_SUBTYPE_raw)
-		return;
+static void
+pipewire_output_repaint_scaled(struct pipewire_output *output);
 
-	spa_format_video_raw_parse(format, &video_info.info.raw);
+struct pipewire_encoded_packet {
+	struct wl_list link;
+	size_t size;
+	uint8_t data[];
+};
 
-	width = video_info.info.raw.size.width;
-	height = video_info.info.raw.size.height;
+static bool
+pipewire_output_is_encoded(struct pipewire_output *output)
+{
+	return output->encode.enabled;
+}
 
-	/* Default to MemFd */
-	buffertype = SPA_DATA_MemFd;
-	stride = width * output->pixel_format->bpp / 8;
-	size = height * stride;
+static bool
+pipewire_output_can_encode(struct pipewire_output *output)
+{
+	struct weston_renderer *renderer = output->base.compositor->renderer;
 
-	/* Use DmaBuf if requested and supported */
-	if (spa_pod_find_prop(format, NULL, SPA_FORMAT_VIDEO_modifier)) {
-		struct pipewire_dmabuf *dmabuf;
+	return renderer->type == WESTON_RENDERER_GL &&
+	       pipewire_backend_has_dmabuf_allocator(output->backend) &&
+	       output->pixel_format->format == DRM_FORMAT_XRGB8888;
+}
 
-		dmabuf = pipewire_output_create_dmabuf(output);
-		if (dmabuf) {
-			buffertype = SPA_DATA_DmaBuf;
-			stride = dmabuf->linux_dmabuf_memory->attributes->stride[0];
-			size = dmabuf->size;
+/* Called on the encoder thread. */
+static int
+pipewire_output_encode_write(void *data, const void *bitstream, size_t size)
+{
+	struct pipewire_output *output = data;
+	struct pipewire_encoded_packet *packet;
+	uint64_t one = 1;
 
-			dmabuf->linux_dmabuf_memory->destroy(dmabuf->linux_dmabuf_memory);
-			pipewire_destroy_dmabuf(output, dmabuf);
-		}
+	packet = malloc(sizeof *packet + size);
+	if (!packet) {
+		errno = ENOMEM;
+		return -1;
 	}
+	packet->size = size;
+	memcpy(packet->data, bitstream, size);
 
-	pipewire_output_debug(output, "param changed: %dx%d@(%d/%d) (%s) (%s)",
-			      video_info.info.raw.size.width,
-			      video_info.info.raw.size.height,
-			      video_info.info.raw.max_framerate.num,
-			      video_info.info.raw.max_framerate.denom,
-			      spa_debug_type_find_short_name(spa_type_video_format,
-				      video_info.info.raw.format),
-			      spa_debug_type_find_short_name(spa_type_data_type,
-				      buffertype));
-
-	params[0] = spa_pod_builder_add_object(&builder,
-		SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
-		SPA_PARAM_BUFFERS_size, SPA_POD_Int(size),
-		SPA_PARAM_BUFFERS_stride, SPA_POD_Int(stride),
-		SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(4, 2, 8),
-		SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(1u << buffertype));
+	pthread_mutex_lock(&output->encode.mutex);
+	wl_list_insert(output->encode.packet_list.prev, &packet->link);
+	pthread_mutex_unlock(&output->encode.mutex);
 
-	params[1] = spa_pod_builder_add_object(&builder,
-		SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
-		SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Header),
-		SPA_PARAM_META_size, SPA_POD_Int(sizeof(struct spa_meta_header)));
+	if (write(output->encode.event_fd, &one, sizeof one) != sizeof one)
+		weston_log("PipeWire: failed to signal encoded frame\n");
 
-	pw_stream_update_params(output->stream, params, 2);
+	return size;
 }
 
-static struct weston_renderbuffer *
-pipewire_output_stream_add_buffer_pixman(struct pipewire_output *output,
-					 struct pw_buffer *buffer)
+static void
+pipewire_output_encode_flush(struct pipewire_output *output)
 {
-	struct weston_compositor *ec = output->base.compositor;
-	const struct weston_renderer *renderer = ec->renderer;
-	struct spa_buffer *buf = buffer->buffer;
-	struct spa_data *d = buf->datas;
-	const struct pixel_format_info *format;
-	unsigned int width;
-	unsigned int height;
-	unsigned int stride;
-	void *ptr;
-
-	format = output->pixel_format;
-	width = output->base.width;
-	height = output->base.height;
-	stride = width * format->bpp / 8;
-	ptr = d[0].data;
+	struct pipewire_encoded_packet *packet;
+	struct pw_buffer *buffer;
+	struct spa_data *d;
+
+	pthread_mutex_lock(&output->encode.mutex);
+	while (!wl_list_empty(&output->encode.packet_list)) {
+		/* Keep the packets around until a buffer frees up, dropping
+		 * one would corrupt the stream up to the next I-frame. */
+		buffer = pw_stream_dequeue_buffer(output->stream);
+		if (!buffer)
+			break;
 
-	return renderer->pixman->create_image_from_ptr(&output->base,
-						       format, width, height,
-						       ptr, stride);
+		packet = wl_container_of(output->encode.packet_list.next,
+					 packet, link);
+		wl_list_remove(&packet->link);
+
+		d = &buffer->buffer->datas[0];
+		if (packet->size > d[0].maxsize) {
+			weston_log("PipeWire: encoded frame of %zu bytes "
+				   "does not fit into a %u byte buffer\n",
+				   packet->size, d[0].maxsize);
+			pipewire_queue_buffer(output, buffer, 0, 0);
+		} else {
+			memcpy(d[0].data, packet->data, packet->size);
+			pipewire_queue_buffer(output, buffer, 0, packet->size);
+		}
+		free(packet);
+	}
+	pthread_mutex_unlock(&output->encode.mutex);
 }
 
-static struct weston_renderbuffer *
-pipewire_output_stream_add_buffer_gl(struct pipewire_output *output,
-				     struct pw_buffer *buffer)
+static int
+pipewire_output_encode_event_handler(int fd, uint32_t mask, void *data)
 {
-	struct weston_compositor *ec = output->base.compositor;
-	const struct weston_renderer *renderer = ec->renderer;
-	struct spa_buffer *buf = buffer->buffer;
-	struct spa_data *d = buf->datas;
-	const struct pixel_format_info *format;
-	unsigned int width;
-	unsigned int height;
-	void *ptr;
-	struct pipewire_frame_data *frame_data = buffer->user_data;
-	struct pipewire_dmabuf *dmabuf = frame_data->dmabuf;
+	struct pipewire_output *output = data;
+	uint64_t count;
 
-	if (dmabuf)
-		return renderer->create_renderbuffer_dmabuf(&output->base,
-							    dmabuf->linux_dmabuf_memory);
+	if (read(fd, &count, sizeof count) != sizeof count)
+		return 0;
 
-	format = output->pixel_format;
-	width = output->base.width;
-	height = output->base.height;
-	ptr = d[0].data;
+	pipewire_output_encode_flush(output);
 
-	return renderer->gl->create_fbo(&output->base,
-					format, width, height, ptr);
+	return 0;
 }
 
-struct pipewire_memfd {
-	int fd;
-	unsigned int size;
-};
-
-static struct pipewire_memfd *
-pipewire_output_create_memfd(struct pipewire_output *output)
+static void
+pipewire_output_encode_frame(struct pipewire_output *output, int slot)
 {
-	struct pipewire_memfd *memfd;
-	const struct pixel_format_info *format;
-	unsigned int width;
-	unsigned int height;
-	unsigned int stride;
-	size_t size;
+	struct dmabuf_attributes *attributes =
+		output->encode.dmabuf[slot]->linux_dmabuf_memory->attributes;
 	int fd;
 
-	memfd = xzalloc(sizeof *memfd);
-
-	format = output->pixel_format;
-	width = output->base.width;
-	height = output->base.height;
-	stride = width * format->bpp / 8;
-	size = height * stride;
-
-	fd = memfd_create("weston-pipewire", MFD_CLOEXEC);
-	if (fd == -1)
-		return NULL;
-	if (ftruncate(fd, size) == -1)
-		return NULL;
+	if (!output->encode.recorder || output->encode.failed)
+		return;
 
-	memfd->fd = fd;
-	memfd->size = size;
+	/* The recorder closes the fd once the frame is imported. */
+	fd = dup(attributes->fd[0]);
+	if (fd < 0)
+		return;
 
-	return memfd;
+	if (vaapi_recorder_frame(output->encode.recorder, fd,
+				 attributes->stride[0],
+				 &output->encode.damage[slot]) < 0) {
+		weston_log("PipeWire: encoding failed: %s\n",
+			   strerror(errno));
+		output->encode.failed = true;
+		close(fd);
+	}
 }
 
 static void
-pipewire_destroy_memfd(struct pipewire_output *output,
-			struct pipewire_memfd *memfd)
+pipewire_output_encode_clear_fence(struct pipewire_output *output, int slot)
 {
-	close(memfd->fd);
-	free(memfd);
+	if (!output->encode.fence_source[slot])
+		return;
+
+	wl_event_source_remove(output->encode.fence_source[slot]);
+	output->encode.fence_source[slot] = NULL;
+	close(output->encode.fence_fd[slot]);
+	output->encode.fence_fd[slot] = -1;
 }
 
-static void
-pipewire_output_setup_memfd(struct pipewire_output *output,
-			    struct pw_buffer *buffer,
-			    struct pipewire_memfd *memfd)
+static int
+pipewire_output_encode_fence_handler(int fd, uint32_t mask, void *data)
 {
-	struct spa_buffer *buf = buffer->buffer;
-	struct spa_data *d = buf->datas;
+	struct pipewire_output *output = data;
+	int slot;
 
-	d[0].type = SPA_DATA_MemFd;
-	d[0].flags = SPA_DATA_FLAG_READWRITE;
-	d[0].fd = memfd->fd;
-	d[0].mapoffset = 0;
-	d[0].maxsize = memfd->size;
-	d[0].data = mmap(NULL, d[0].maxsize,
-			 PROT_READ|PROT_WRITE, MAP_SHARED,
-			 d[0].fd, d[0].mapoffset);
-	buf->n_datas = 1;
+	for (slot = 0; slot < PIPEWIRE_ENCODE_BUFFERS; slot++) {
+		if (output->encode.fence_fd[slot] == fd)
+			break;
+	}
+	assert(slot < PIPEWIRE_ENCODE_BUFFERS);
+
+	pipewire_output_encode_clear_fence(output, slot);
+	pipewire_output_encode_frame(output, slot);
+
+	return 0;
+}
+
+static void
+pipewire_output_encode_stop(struct pipewire_output *output)
+{
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct pipewire_encoded_packet *packet, *tmp;
+	int i;
+
+	if (output->encode.recorder) {
+		/* Joins the encoder thread, no packets arrive after this. */
+		vaapi_recorder_destroy(output->encode.recorder);
+		output->encode.recorder = NULL;
+	}
+
+	for (i = 0; i < PIPEWIRE_ENCODE_BUFFERS; i++) {
+		pipewire_output_encode_clear_fence(output, i);
+
+		if (output->encode.renderbuffer[i]) {
+			renderer->remove_renderbuffer_dmabuf(&output->base,
+							     output->encode.renderbuffer[i]);
+			weston_renderbuffer_unref(output->encode.renderbuffer[i]);
+			output->encode.renderbuffer[i] = NULL;
+		} else if (output->encode.dmabuf[i]) {
+			struct linux_dmabuf_memory *memory =
+				output->encode.dmabuf[i]->linux_dmabuf_memory;
+
+			memory->destroy(memory);
+		}
+		if (output->encode.dmabuf[i]) {
+			pipewire_destroy_dmabuf(output, output->encode.dmabuf[i]);
+			output->encode.dmabuf[i] = NULL;
+		}
+	}
+
+	if (output->encode.event_source) {
+		wl_event_source_remove(output->encode.event_source);
+		output->encode.event_source = NULL;
+		close(output->encode.event_fd);
+		output->encode.event_fd = -1;
+	}
+
+	wl_list_for_each_safe(packet, tmp, &output->encode.packet_list, link) {
+		wl_list_remove(&packet->link);
+		free(packet);
+	}
+}
+
+static int
+pipewire_output_encode_start(struct pipewire_output *output)
+{
+	struct pipewire_backend *b = output->backend;
+	struct weston_renderer *renderer = b->compositor->renderer;
+	struct wl_event_loop *loop;
+	struct pipewire_dmabuf *dmabuf;
+	int drm_fd;
+	int i;
+
+	pipewire_output_encode_stop(output);
+	output->encode.failed = false;
+
+	for (i = 0; i < PIPEWIRE_ENCODE_BUFFERS; i++) {
+		dmabuf = pipewire_output_create_dmabuf(output,
+						       output->base.width,
+						       output->base.height);
+		if (!dmabuf)
+			goto err;
+		output->encode.dmabuf[i] = dmabuf;
+		output->encode.renderbuffer[i] =
+			renderer->create_renderbuffer_dmabuf(&output->base,
+							     dmabuf->linux_dmabuf_memory);
+		if (!output->encode.renderbuffer[i])
+			goto err;
+	}
+
+	output->encode.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (output->encode.event_fd < 0)
+		goto err;
+	loop = wl_display_get_event_loop(b->compositor->wl_display);
+	output->encode.event_source =
+		wl_event_loop_add_fd(loop, output->encode.event_fd,
+				     WL_EVENT_READABLE,
+				     pipewire_output_encode_event_handler,
+				     output);
+
+	drm_fd = open(b->vaapi_device, O_RDWR | O_CLOEXEC);
+	if (drm_fd < 0) {
+		weston_log("PipeWire: failed to open %s: %s\n",
+			   b->vaapi_device, strerror(errno));
+		goto err;
+	}
+
+	/* Takes ownership of drm_fd. */
+	output->encode.recorder =
+		vaapi_recorder_create_with_sink(drm_fd, output->base.width,
+						output->base.height,
+						pipewire_output_encode_write,
+						output);
+	if (!output->encode.recorder) {
+		weston_log("PipeWire: failed to create VA-API encoder\n");
+		close(drm_fd);
+		goto err;
+	}
+
+	return 0;
+
+err:
+	pipewire_output_encode_stop(output);
+	return -1;
+}
+
+static bool
+pipewire_output_repaint_encoded(struct pipewire_output *output,
+				pixman_region32_t *damage)
+{
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct wl_event_loop *loop;
+	int slot, fd;
+
+	if (!output->encode.enabled)
+		return false;
+
+	pipewire_output_encode_flush(output);
+
+	if (!output->encode.recorder)
+		return true;
+
+	slot = (output->encode.current + 1) % PIPEWIRE_ENCODE_BUFFERS;
+	if (output->encode.fence_source[slot]) {
+		/* Still waiting to hand the last frame in this buffer to the
+		 * encoder, catch up on the next repaint. */
+		output->base.full_repaint_needed = true;
+		return true;
+	}
+	output->encode.current = slot;
+
+	weston_renderer_repaint_output(&output->base, damage,
+				       output->encode.renderbuffer[slot]);
+	pipewire_output_repaint_scaled(output);
+
+	pixman_region32_intersect(&output->encode.damage[slot],
+				  &output->base.region, damage);
+	weston_region_global_to_output(&output->encode.damage[slot],
+				       &output->base,
+				       &output->encode.damage[slot]);
+
+	fd = renderer->gl->create_fence_fd(&output->base);
+	if (fd < 0) {
+		pipewire_output_encode_frame(output, slot);
+		return true;
+	}
+
+	/* The encoder's import of the dmabuf waits for the implicit fence. */
+	if (weston_linux_sync_file_attach_to_dmabuf(output->encode.dmabuf[slot]->linux_dmabuf_memory->attributes->fd[0],
+						    fd) == 0) {
+		close(fd);
+		pipewire_output_encode_frame(output, slot);
+		return true;
+	}
+
+	loop = wl_display_get_event_loop(output->base.compositor->wl_display);
+	output->encode.fence_fd[slot] = fd;
+	output->encode.fence_source[slot] =
+		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+				     pipewire_output_encode_fence_handler,
+				     output);
+
+	return true;
+}
+
+static void
+pipewire_output_init_encode(struct pipewire_output *output)
+{
+	int i;
+
+	pthread_mutex_init(&output->encode.mutex, NULL);
+	wl_list_init(&output->encode.packet_list);
+	output->encode.event_fd = -1;
+	for (i = 0; i < PIPEWIRE_ENCODE_BUFFERS; i++) {
+		output->encode.fence_fd[i] = -1;
+		pixman_region32_init(&output->encode.damage[i]);
+	}
+}
+
+static void
+pipewire_output_fini_encode(struct pipewire_output *output)
+{
+	int i;
+
+	pipewire_output_encode_stop(output);
+	for (i = 0; i < PIPEWIRE_ENCODE_BUFFERS; i++)
+		pixman_region32_fini(&output->encode.damage[i]);
+	pthread_mutex_destroy(&output->encode.mutex);
+}
+#else
+static inline bool
+pipewire_output_is_encoded(struct pipewire_output *output)
+{
+	return false;
+}
+
+static inline bool
+pipewire_output_can_encode(struct pipewire_output *output)
+{
+	return false;
+}
+
+static inline int
+pipewire_output_encode_start(struct pipewire_output *output)
+{
+	return -1;
+}
+
+static inline void
+pipewire_output_encode_stop(struct pipewire_output *output)
+{
+}
+
+static inline bool
+pipewire_output_repaint_encoded(struct pipewire_output *output,
+				pixman_region32_t *damage)
+{
+	return false;
+}
+
+static inline void
+pipewire_output_init_encode(struct pipewire_output *output)
+{
+}
+
+static inline void
+pipewire_output_fini_encode(struct pipewire_output *output)
+{
+}
+#endif
+
+static unsigned int
+pipewire_output_encoded_buffer_size(struct pipewire_output *output)
+{
+	/* An access unit does not get bigger than the raw YUV 4:2:0 frame. */
+	return output->base.width * output->base.height * 3 / 2;
+}
+
+static void
+pipewire_output_encoded_param_changed(struct pipewire_output *output)
+{
+	uint8_t buffer[1024];
+	struct spa_pod_builder builder =
+		SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[2];
+
+	if (pipewire_output_encode_start(output) < 0) {
+		pw_stream_set_error(output->stream, -EIO,
+				    "failed to set up the H.264 encoder");
+		return;
+	}
+
+	pipewire_output_debug(output, "param changed: %dx%d H.264",
+			      output->base.width, output->base.height);
+
+	params[0] = spa_pod_builder_add_object(&builder,
+		SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+		SPA_PARAM_BUFFERS_size,
+		SPA_POD_Int(pipewire_output_encoded_buffer_size(output)),
+		SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(4, 2, 8),
+		SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(1u << SPA_DATA_MemFd));
+
+	params[1] = spa_pod_builder_add_object(&builder,
+		SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+		SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Header),
+		SPA_PARAM_META_size, SPA_POD_Int(sizeof(struct spa_meta_header)));
+
+	pw_stream_update_params(output->stream, params, 2);
+}
+
+/* The consumer may have picked less than the output refresh rate. */
+static void
+pipewire_output_set_max_framerate(struct pipewire_output *output,
+				  const struct spa_fraction *max_framerate)
+{
+	if (max_framerate->num == 0 || max_framerate->denom == 0) {
+		output->frame_interval_nsec = 0;
+		return;
+	}
+
+	output->frame_interval_nsec =
+		(int64_t)max_framerate->denom * NSEC_PER_SEC /
+		max_framerate->num;
+}
+
+static void
+pipewire_output_stream_param_changed(void *data, uint32_t id,
+				     const struct spa_pod *format)
+{
+	struct pipewire_output *output = data;
+	uint8_t buffer[1024];
+	struct spa_pod_builder builder =
+		SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[3];
+	struct spa_video_info video_info;
+	uint32_t buffertype;
+	int32_t width;
+	int32_t height;
+	int32_t stride;
+	int32_t size;
+
+	if (id != SPA_PARAM_Format)
+		return;
+
+	if (!format) {
+		pipewire_output_encode_stop(output);
+		return;
+	}
+
+	if (spa_format_parse(format, &video_info.media_type,
+			     &video_info.media_subtype) < 0)
+		return;
+	if (video_info.media_type != SPA_MEDIA_TYPE_video)
+		return;
+
+	if (video_info.media_subtype == SPA_MEDIA_SUBTYPE_h264) {
+		spa_format_video_h264_parse(format, &video_info.info.h264);
+		pipewire_output_set_max_framerate(output,
+						  &video_info.info.h264.max_framerate);
+		pipewire_output_encoded_param_changed(output);
+		return;
+	}
+
+	if (video_info.media_subtype != SPA_MEDIA_SUBTYPE_raw)
+		return;
+
+	spa_format_video_raw_parse(format, &video_info.info.raw);
+	pipewire_output_set_max_framerate(output,
+					  &video_info.info.raw.max_framerate);
+
+	width = video_info.info.raw.size.width;
+	height = video_info.info.raw.size.height;
+
+	/* Default to MemFd */
+	buffertype = SPA_DATA_MemFd;
+	stride = width * output->pixel_format->bpp / 8;
+	size = height * stride;
+
+	/* Use DmaBuf if requested and supported */
+	if (spa_pod_find_prop(format, NULL, SPA_FORMAT_VIDEO_modifier)) {
+		struct pipewire_dmabuf *dmabuf;
+
+		dmabuf = pipewire_output_create_dmabuf(output,
+						       output->base.width,
+						       output->base.height);
+		if (dmabuf) {
+			buffertype = SPA_DATA_DmaBuf;
+			stride = dmabuf->linux_dmabuf_memory->attributes->stride[0];
+			size = dmabuf->size;
+
+			dmabuf->linux_dmabuf_memory->destroy(dmabuf->linux_dmabuf_memory);
+			pipewire_destroy_dmabuf(output, dmabuf);
+		}
+	}
+
+	pipewire_output_debug(output, "param changed: %dx%d@(%d/%d) (%s) (%s)",
+			      video_info.info.raw.size.width,
+			      video_info.info.raw.size.height,
+			      video_info.info.raw.max_framerate.num,
+			      video_info.info.raw.max_framerate.denom,
+			      spa_debug_type_find_short_name(spa_type_video_format,
+				      video_info.info.raw.format),
+			      spa_debug_type_find_short_name(spa_type_data_type,
+				      buffertype));
+
+	params[0] = spa_pod_builder_add_object(&builder,
+		SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+		SPA_PARAM_BUFFERS_size, SPA_POD_Int(size),
+		SPA_PARAM_BUFFERS_stride, SPA_POD_Int(stride),
+		SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(4, 2, 8),
+		SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(1u << buffertype));
+
+	spa_pod_build_raw_meta_params(&builder, &params[1]);
+
+	pw_stream_update_params(output->stream, params, 3);
+}
+
+static struct weston_renderbuffer *
+pipewire_output_stream_add_buffer_pixman(struct pipewire_output *output,
+					 struct pw_buffer *buffer)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	const struct weston_renderer *renderer = ec->renderer;
+	struct spa_buffer *buf = buffer->buffer;
+	struct spa_data *d = buf->datas;
+	const struct pixel_format_info *format;
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	void *ptr;
+
+	format = output->pixel_format;
+	width = output->base.width;
+	height = output->base.height;
+	stride = width * format->bpp / 8;
+	ptr = d[0].data;
+
+	return renderer->pixman->create_image_from_ptr(&output->base,
+						       format, width, height,
+						       ptr, stride);
+}
+
+static struct weston_renderbuffer *
+pipewire_output_stream_add_buffer_gl(struct pipewire_output *output,
+				     struct pw_buffer *buffer)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	const struct weston_renderer *renderer = ec->renderer;
+	struct spa_buffer *buf = buffer->buffer;
+	struct spa_data *d = buf->datas;
+	const struct pixel_format_info *format;
+	unsigned int width;
+	unsigned int height;
+	void *ptr;
+	struct pipewire_frame_data *frame_data = buffer->user_data;
+	struct pipewire_dmabuf *dmabuf = frame_data->dmabuf;
+
+	if (dmabuf)
+		return renderer->create_renderbuffer_dmabuf(&output->base,
+							    dmabuf->linux_dmabuf_memory);
+
+	format = output->pixel_format;
+	width = output->base.width;
+	height = output->base.height;
+	ptr = d[0].data;
+
+	return renderer->gl->create_fbo(&output->base,
+					format, width, height, ptr);
+}
+
+struct pipewire_memfd {
+	int fd;
+	unsigned int size;
+};
+
+static struct pipewire_memfd *
+pipewire_output_create_memfd(struct pipewire_output *output)
+{
+	struct pipewire_memfd *memfd;
+	const struct pixel_format_info *format;
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	size_t size;
+	int fd;
+
+	memfd = xzalloc(sizeof *memfd);
+
+	format = output->pixel_format;
+	width = output->base.width;
+	height = output->base.height;
+	stride = width * format->bpp / 8;
+	size = height * stride;
+	if (pipewire_output_is_encoded(output))
+		size = pipewire_output_encoded_buffer_size(output);
+
+	fd = memfd_create("weston-pipewire", MFD_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	if (ftruncate(fd, size) == -1)
+		return NULL;
+
+	memfd->fd = fd;
+	memfd->size = size;
+
+	return memfd;
+}
+
+static void
+pipewire_destroy_memfd(struct pipewire_output *output,
+			struct pipewire_memfd *memfd)
+{
+	close(memfd->fd);
+	free(memfd);
+}
+
+static void
+pipewire_output_setup_memfd(struct pipewire_output *output,
+			    struct pw_buffer *buffer,
+			    struct pipewire_memfd *memfd)
+{
+	struct spa_buffer *buf = buffer->buffer;
+	struct spa_data *d = buf->datas;
+
+	d[0].type = SPA_DATA_MemFd;
+	d[0].flags = SPA_DATA_FLAG_READWRITE;
+	d[0].fd = memfd->fd;
+	d[0].mapoffset = 0;
+	d[0].maxsize = memfd->size;
+	d[0].data = mmap(NULL, d[0].maxsize,
+			 PROT_READ|PROT_WRITE, MAP_SHARED,
+			 d[0].fd, d[0].mapoffset);
+	buf->n_datas = 1;
 }
 
 static void
@@ -743,12 +1384,15 @@ pipewire_output_stream_add_buffer(void *data, struct pw_buffer *buffer)
 	pipewire_output_debug(output, "add buffer: %p", buffer);
 
 	frame_data = xzalloc(sizeof *frame_data);
+	pixman_region32_init(&frame_data->damage);
 	buffer->user_data = frame_data;
 
 	if (buffertype & (1u << SPA_DATA_DmaBuf)) {
 		struct pipewire_dmabuf *dmabuf;
 
-		dmabuf = pipewire_output_create_dmabuf(output);
+		dmabuf = pipewire_output_create_dmabuf(output,
+						       output->base.width,
+						       output->base.height);
 		if (!dmabuf) {
 			pw_stream_set_error(output->stream, -ENOMEM,
 					    "failed to allocate DMABUF buffer");
@@ -769,6 +1413,10 @@ pipewire_output_stream_add_buffer(void *data, struct pw_buffer *buffer)
 		frame_data->memfd = memfd;
 	}
 
+	/* Encoded frames are copied in, nothing renders into the buffer. */
+	if (pipewire_output_is_encoded(output))
+		return;
+
 	switch (renderer->type) {
 	case WESTON_RENDERER_PIXMAN:
 		frame_data->renderbuffer = pipewire_output_stream_add_buffer_pixman(output, buffer);
@@ -819,6 +1467,9 @@ pipewire_output_stream_remove_buffer(void *data, struct pw_buffer *buffer)
 		if (fence_data->buffer == buffer)
 			fence_data->buffer = NULL;
 	}
+	if (output->next_buffer == buffer)
+		output->next_buffer = NULL;
+	pixman_region32_fini(&frame_data->damage);
 	free(frame_data);
 }
 
@@ -850,223 +1501,803 @@ pipewire_create_output(struct weston_backend *backend, const char *name)
 
 	weston_compositor_add_pending_output(&output->base, b->compositor);
 
-	output->backend = b;
-	output->pixel_format = b->pixel_format;
+	output->backend = b;
+	output->pixel_format = b->pixel_format;
+
+	wl_list_init(&output->fence_list);
+	wl_list_init(&output->scaled_stream_list);
+	pipewire_output_init_encode(output);
+
+	props = pw_properties_new(NULL, NULL);
+	pw_properties_setf(props, PW_KEY_NODE_NAME, "weston.%s", name);
+
+	output->stream = pw_stream_new(b->core, name, props);
+	if (!output->stream) {
+		weston_log("Cannot initialize PipeWire stream\n");
+		pipewire_output_fini_encode(output);
+		free(output);
+		return NULL;
+	}
+
+	pw_stream_add_listener(output->stream, &output->stream_listener,
+			       &stream_events, output);
+
+	return &output->base;
+}
+
+static void
+pipewire_destroy(struct weston_backend *base)
+{
+	struct pipewire_backend *b = container_of(base, struct pipewire_backend, base);
+	struct weston_compositor *ec = b->compositor;
+	struct weston_head *head, *next;
+
+	weston_log_scope_destroy(b->debug);
+	b->debug = NULL;
+
+	wl_list_remove(&b->base.link);
+
+	pw_loop_leave(b->loop);
+	pw_loop_destroy(b->loop);
+	wl_event_source_remove(b->loop_source);
+
+	wl_list_for_each_safe(head, next, &ec->head_list, compositor_link)
+		pipewire_head_destroy(head);
+
+	free(b->vaapi_device);
+	free(b);
+}
+
+static void
+pipewire_head_create(struct weston_backend *backend, const char *name,
+		     const struct pipewire_config *config)
+{
+	struct pipewire_backend *b = to_pipewire_backend(backend);
+	struct pipewire_head *head;
+	struct weston_head *base;
+
+	head = xzalloc(sizeof *head);
+
+	head->config = *config;
+
+	base = &head->base;
+	weston_head_init(base, name);
+	weston_head_set_monitor_strings(base, "PipeWire", name, NULL);
+	weston_head_set_physical_size(base, config->width, config->height);
+
+	base->backend = &b->base;
+
+	weston_head_set_connection_status(base, true);
+	weston_compositor_add_head(b->compositor, base);
+}
+
+static void
+pipewire_head_destroy(struct weston_head *base)
+{
+	struct pipewire_head *head = to_pipewire_head(base);
+
+	if (!head)
+		return;
+
+	weston_head_release(&head->base);
+	free(head);
+}
+
+static int
+pipewire_output_start_repaint_loop(struct weston_output *output)
+{
+	struct timespec ts;
+
+	weston_compositor_read_presentation_clock(output->compositor, &ts);
+	weston_output_finish_frame(output, &ts, WP_PRESENTATION_FEEDBACK_INVALID);
+
+	return 0;
+}
+
+/* Only consumers of raw frames negotiate the meta. */
+static void
+pipewire_buffer_set_damage(struct spa_buffer *spa_buffer,
+			   pixman_region32_t *damage)
+{
+	struct spa_meta *meta;
+	struct spa_meta_region *r;
+	pixman_box32_t *rects;
+	int n_rects, i = 0;
+
+	meta = spa_buffer_find_meta(spa_buffer, SPA_META_VideoDamage);
+	if (!meta)
+		return;
+
+	rects = pixman_region32_rectangles(damage, &n_rects);
+	if ((size_t)n_rects * sizeof(*r) > meta->size) {
+		rects = pixman_region32_extents(damage);
+		n_rects = 1;
+	}
+
+	/* The array ends at the first empty region, or at its end. */
+	spa_meta_for_each(r, meta) {
+		if (i == n_rects) {
+			r->region = SPA_REGION(0, 0, 0, 0);
+			break;
+		}
+		r->region = SPA_REGION(rects[i].x1, rects[i].y1,
+				       rects[i].x2 - rects[i].x1,
+				       rects[i].y2 - rects[i].y1);
+		i++;
+	}
+}
+
+static void
+pipewire_buffer_set_header(struct spa_buffer *spa_buffer, uint32_t seq)
+{
+	struct spa_meta_header *h;
+	struct timespec ts;
+
+	h = spa_buffer_find_meta_data(spa_buffer, SPA_META_Header,
+				      sizeof(struct spa_meta_header));
+	if (!h)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	h->pts = SPA_TIMESPEC_TO_NSEC(&ts);
+	h->flags = 0;
+	h->seq = seq;
+	h->dts_offset = 0;
+}
+
+static void
+pipewire_queue_buffer(struct pipewire_output *output,
+		      struct pw_buffer *buffer,
+		      unsigned int stride, size_t size)
+{
+	struct pipewire_frame_data *frame_data = buffer->user_data;
+	struct spa_buffer *spa_buffer;
+
+	spa_buffer = buffer->buffer;
+
+	pipewire_buffer_set_damage(spa_buffer, &frame_data->damage);
+	pipewire_buffer_set_header(spa_buffer, output->seq);
+
+	spa_buffer->datas[0].chunk->offset = 0;
+	spa_buffer->datas[0].chunk->stride = stride;
+	spa_buffer->datas[0].chunk->size = size;
+
+	pipewire_output_debug(output, "queue buffer: %p (seq %d)",
+			      buffer, output->seq);
+	pw_stream_queue_buffer(output->stream, buffer);
+
+	output->seq++;
+}
+
+static void
+pipewire_submit_buffer(struct pipewire_output *output,
+		       struct pw_buffer *buffer)
+{
+	struct pipewire_frame_data *frame_data = buffer->user_data;
+	struct pipewire_dmabuf *dmabuf = frame_data->dmabuf;
+	const struct pixel_format_info *pixel_format;
+	unsigned int stride;
+	size_t size;
+
+	pixel_format = output->pixel_format;
+	if (dmabuf)
+		stride = dmabuf->linux_dmabuf_memory->attributes->stride[0];
+	else
+		stride = output->base.width * pixel_format->bpp / 8;
+	size = output->base.height * stride;
+
+	pipewire_queue_buffer(output, buffer, stride, size);
+}
+
+static int
+pipewire_output_fence_sync_handler(int fd, uint32_t mask, void *data)
+{
+	struct pipewire_fence_data *fence_data = data;
+
+	if (fence_data->buffer)
+		pipewire_submit_buffer(fence_data->output, fence_data->buffer);
+
+	wl_event_source_remove(fence_data->fence_sync_event_source);
+	close(fence_data->fence_sync_fd);
+	wl_list_remove(&fence_data->link);
+	free(fence_data);
+
+	return 0;
+}
+
+static int
+pipewire_schedule_submit_buffer(struct pipewire_output *output,
+				struct pw_buffer *buffer)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	struct weston_renderer *renderer = ec->renderer;
+	struct pipewire_frame_data *frame_data = buffer->user_data;
+	struct pipewire_fence_data *fence_data;
+	struct wl_event_loop *loop;
+	int fence_sync_fd;
+
+	fence_sync_fd = renderer->gl->create_fence_fd(&output->base);
+	if (fence_sync_fd == -1)
+		return -1;
+
+	/* Let the consumer wait for rendering through the implicit fence of
+	 * the dmabuf, so the frame can be queued right away. */
+	if (frame_data->dmabuf &&
+	    weston_linux_sync_file_attach_to_dmabuf(frame_data->dmabuf->linux_dmabuf_memory->attributes->fd[0],
+						    fence_sync_fd) == 0) {
+		close(fence_sync_fd);
+		pipewire_submit_buffer(output, buffer);
+		return 0;
+	}
+
+	fence_data = zalloc(sizeof *fence_data);
+	if (!fence_data) {
+		close(fence_sync_fd);
+		return -1;
+	}
+	wl_list_insert(&output->fence_list, &fence_data->link);
+
+	loop = wl_display_get_event_loop(output->backend->compositor->wl_display);
+
+	fence_data->output = output;
+	fence_data->buffer = buffer;
+	fence_data->fence_sync_fd = fence_sync_fd;
+	fence_data->fence_sync_event_source =
+		wl_event_loop_add_fd(loop, fence_data->fence_sync_fd,
+				     WL_EVENT_READABLE,
+				     pipewire_output_fence_sync_handler,
+				     fence_data);
+
+	return 0;
+}
+
+static bool
+pipewire_output_scaled_streaming(struct pipewire_output *output)
+{
+	struct pipewire_scaled_stream *scaled;
+
+	wl_list_for_each(scaled, &output->scaled_stream_list, link) {
+		if (pw_stream_get_state(scaled->stream, NULL) ==
+		    PW_STREAM_STATE_STREAMING)
+			return true;
+	}
+
+	return false;
+}
+
+/* Keep the damage of a repaint for all scaled streams, whether or not they
+ * get a frame out of it. */
+static void
+pipewire_output_damage_scaled(struct pipewire_output *output,
+			      pixman_region32_t *damage)
+{
+	struct pipewire_scaled_stream *scaled;
+	pixman_region32_t output_damage;
+
+	if (wl_list_empty(&output->scaled_stream_list))
+		return;
+
+	pixman_region32_init(&output_damage);
+	pixman_region32_intersect(&output_damage, &output->base.region, damage);
+	weston_region_global_to_output(&output_damage, &output->base,
+				       &output_damage);
+
+	wl_list_for_each(scaled, &output->scaled_stream_list, link)
+		pixman_region32_union(&scaled->damage, &scaled->damage,
+				      &output_damage);
+
+	pixman_region32_fini(&output_damage);
+}
+
+/* The damage of the scaled frame, rounded outwards and grown by a pixel
+ * for the reach of the linear filter. */
+static void
+pipewire_scaled_stream_get_damage(struct pipewire_scaled_stream *scaled,
+				  pixman_region32_t *damage)
+{
+	int64_t src_width = scaled->output->base.width;
+	int64_t src_height = scaled->output->base.height;
+	int64_t width = scaled->size.width;
+	int64_t height = scaled->size.height;
+	pixman_box32_t *rects;
+	int32_t x1, y1, x2, y2;
+	int i, n_rects;
+
+	pixman_region32_clear(damage);
+
+	rects = pixman_region32_rectangles(&scaled->damage, &n_rects);
+	for (i = 0; i < n_rects; i++) {
+		x1 = (rects[i].x1 - 1) * width / src_width;
+		y1 = (rects[i].y1 - 1) * height / src_height;
+		x2 = ((rects[i].x2 + 1) * width + src_width - 1) / src_width;
+		y2 = ((rects[i].y2 + 1) * height + src_height - 1) / src_height;
+		pixman_region32_union_rect(damage, damage,
+					   x1, y1, x2 - x1, y2 - y1);
+	}
+
+	pixman_region32_intersect_rect(damage, damage,
+				       0, 0, width, height);
+}
+
+static void
+pipewire_scaled_stream_queue_buffer(struct pipewire_scaled_stream *scaled,
+				    struct pw_buffer *buffer)
+{
+	struct pipewire_frame_data *frame_data = buffer->user_data;
+	struct linux_dmabuf_memory *memory =
+		frame_data->dmabuf->linux_dmabuf_memory;
+	struct spa_buffer *spa_buffer = buffer->buffer;
+
+	pipewire_buffer_set_damage(spa_buffer, &frame_data->damage);
+	pipewire_buffer_set_header(spa_buffer, scaled->seq);
+
+	spa_buffer->datas[0].chunk->offset = 0;
+	spa_buffer->datas[0].chunk->stride = memory->attributes->stride[0];
+	spa_buffer->datas[0].chunk->size = frame_data->dmabuf->size;
+
+	pipewire_output_debug(scaled->output,
+			      "queue %dx%d buffer: %p (seq %d)",
+			      scaled->size.width, scaled->size.height,
+			      buffer, scaled->seq);
+	pw_stream_queue_buffer(scaled->stream, buffer);
+
+	scaled->seq++;
+}
+
+static void
+pipewire_scaled_stream_clear_fence(struct pipewire_scaled_stream *scaled)
+{
+	if (!scaled->fence_source)
+		return;
+
+	wl_event_source_remove(scaled->fence_source);
+	close(scaled->fence_fd);
+	scaled->fence_source = NULL;
+	scaled->fence_fd = -1;
+	scaled->fence_buffer = NULL;
+}
+
+static int
+pipewire_scaled_stream_fence_handler(int fd, uint32_t mask, void *data)
+{
+	struct pipewire_scaled_stream *scaled = data;
+
+	if (scaled->fence_buffer)
+		pipewire_scaled_stream_queue_buffer(scaled,
+						    scaled->fence_buffer);
+	pipewire_scaled_stream_clear_fence(scaled);
 
-	wl_list_init(&output->fence_list);
+	return 0;
+}
 
-	props = pw_properties_new(NULL, NULL);
-	pw_properties_setf(props, PW_KEY_NODE_NAME, "weston.%s", name);
+static void
+pipewire_scaled_stream_submit_buffer(struct pipewire_scaled_stream *scaled,
+				     struct pw_buffer *buffer)
+{
+	struct pipewire_output *output = scaled->output;
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct pipewire_frame_data *frame_data = buffer->user_data;
+	struct wl_event_loop *loop;
+	int fd;
 
-	output->stream = pw_stream_new(b->core, name, props);
-	if (!output->stream) {
-		weston_log("Cannot initialize PipeWire stream\n");
-		free(output);
-		return NULL;
+	fd = renderer->gl->create_fence_fd(&output->base);
+	if (fd < 0) {
+		pipewire_scaled_stream_queue_buffer(scaled, buffer);
+		return;
 	}
 
-	pw_stream_add_listener(output->stream, &output->stream_listener,
-			       &stream_events, output);
+	if (weston_linux_sync_file_attach_to_dmabuf(frame_data->dmabuf->linux_dmabuf_memory->attributes->fd[0],
+						    fd) == 0) {
+		close(fd);
+		pipewire_scaled_stream_queue_buffer(scaled, buffer);
+		return;
+	}
 
-	return &output->base;
+	loop = wl_display_get_event_loop(output->base.compositor->wl_display);
+	scaled->fence_buffer = buffer;
+	scaled->fence_fd = fd;
+	scaled->fence_source =
+		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+				     pipewire_scaled_stream_fence_handler,
+				     scaled);
 }
 
+/* Scale the frame just rendered into a buffer of each scaled stream with
+ * one to spare; must be called while the renderer's target still holds
+ * it. Streams left out get the damage with their next frame. */
 static void
-pipewire_destroy(struct weston_backend *base)
+pipewire_output_repaint_scaled(struct pipewire_output *output)
 {
-	struct pipewire_backend *b = container_of(base, struct pipewire_backend, base);
-	struct weston_compositor *ec = b->compositor;
-	struct weston_head *head, *next;
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct pipewire_scaled_stream *scaled;
+	struct pipewire_frame_data *frame_data;
+	struct pw_buffer *buffer;
 
-	weston_log_scope_destroy(b->debug);
-	b->debug = NULL;
+	wl_list_for_each(scaled, &output->scaled_stream_list, link) {
+		if (pw_stream_get_state(scaled->stream, NULL) !=
+		    PW_STREAM_STATE_STREAMING)
+			continue;
+
+		if (!pixman_region32_not_empty(&scaled->damage))
+			continue;
+
+		/* The last frame is still waiting for rendering. */
+		if (scaled->fence_source)
+			continue;
+
+		buffer = pw_stream_dequeue_buffer(scaled->stream);
+		if (!buffer)
+			continue;
+
+		frame_data = buffer->user_data;
+		if (!renderer->scale_output_to_renderbuffer(&output->base,
+							    frame_data->renderbuffer,
+							    &scaled->size)) {
+			pw_stream_set_error(scaled->stream, -ENOTSUP,
+					    "renderer can't scale frames");
+			continue;
+		}
 
-	wl_list_remove(&b->base.link);
+		pipewire_scaled_stream_get_damage(scaled, &frame_data->damage);
+		pixman_region32_clear(&scaled->damage);
 
-	pw_loop_leave(b->loop);
-	pw_loop_destroy(b->loop);
-	wl_event_source_remove(b->loop_source);
+		pipewire_scaled_stream_submit_buffer(scaled, buffer);
+	}
+}
 
-	wl_list_for_each_safe(head, next, &ec->head_list, compositor_link)
-		pipewire_head_destroy(head);
+/* Only the scaled streams have consumers, render the frame to scale from
+ * into a buffer of our own. */
+static void
+pipewire_output_repaint_scale_source(struct pipewire_output *output,
+				     pixman_region32_t *damage)
+{
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct pipewire_dmabuf *dmabuf;
 
-	free(b);
+	if (!output->scale_source) {
+		dmabuf = pipewire_output_create_dmabuf(output,
+						       output->base.width,
+						       output->base.height);
+		if (!dmabuf)
+			return;
+
+		output->scale_source =
+			renderer->create_renderbuffer_dmabuf(&output->base,
+							     dmabuf->linux_dmabuf_memory);
+		if (!output->scale_source)
+			dmabuf->linux_dmabuf_memory->destroy(dmabuf->linux_dmabuf_memory);
+		pipewire_destroy_dmabuf(output, dmabuf);
+		if (!output->scale_source)
+			return;
+	}
+
+	weston_renderer_repaint_output(&output->base, damage,
+				       output->scale_source);
+	pipewire_output_repaint_scaled(output);
 }
 
 static void
-pipewire_head_create(struct weston_backend *backend, const char *name,
-		     const struct pipewire_config *config)
+pipewire_output_release_scale_source(struct pipewire_output *output)
 {
-	struct pipewire_backend *b = to_pipewire_backend(backend);
-	struct pipewire_head *head;
-	struct weston_head *base;
+	struct weston_renderer *renderer = output->base.compositor->renderer;
 
-	head = xzalloc(sizeof *head);
+	if (!output->scale_source)
+		return;
 
-	head->config = *config;
+	renderer->remove_renderbuffer_dmabuf(&output->base,
+					     output->scale_source);
+	weston_renderbuffer_unref(output->scale_source);
+	output->scale_source = NULL;
+}
 
-	base = &head->base;
-	weston_head_init(base, name);
-	weston_head_set_monitor_strings(base, "PipeWire", name, NULL);
-	weston_head_set_physical_size(base, config->width, config->height);
+static void
+pipewire_scaled_stream_state_changed(void *data, enum pw_stream_state old,
+				     enum pw_stream_state state,
+				     const char *error_message)
+{
+	struct pipewire_scaled_stream *scaled = data;
+	struct pipewire_output *output = scaled->output;
 
-	base->backend = &b->base;
+	pipewire_output_debug(output, "%dx%d state changed: %s -> %s",
+			      scaled->size.width, scaled->size.height,
+			      pw_stream_state_as_string(old),
+			      pw_stream_state_as_string(state));
 
-	weston_head_set_connection_status(base, true);
-	weston_compositor_add_head(b->compositor, base);
+	switch (state) {
+	case PW_STREAM_STATE_STREAMING:
+		/* The new consumer starts from a complete frame. */
+		pixman_region32_fini(&scaled->damage);
+		pixman_region32_init_rect(&scaled->damage, 0, 0,
+					  output->base.width,
+					  output->base.height);
+		weston_output_damage(&output->base);
+		weston_output_schedule_repaint(&output->base);
+		break;
+	default:
+		break;
+	}
 }
 
 static void
-pipewire_head_destroy(struct weston_head *base)
+pipewire_scaled_stream_param_changed(void *data, uint32_t id,
+				     const struct spa_pod *format)
 {
-	struct pipewire_head *head = to_pipewire_head(base);
+	struct pipewire_scaled_stream *scaled = data;
+	struct pipewire_output *output = scaled->output;
+	uint8_t buffer[1024];
+	struct spa_pod_builder builder =
+		SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[3];
+	struct pipewire_dmabuf *dmabuf;
+	int32_t stride;
+	int32_t size;
 
-	if (!head)
+	if (id != SPA_PARAM_Format || !format)
 		return;
 
-	weston_head_release(&head->base);
-	free(head);
+	/* Only the format offered at connection can be negotiated. */
+	dmabuf = pipewire_output_create_dmabuf(output, scaled->size.width,
+					       scaled->size.height);
+	if (!dmabuf) {
+		pw_stream_set_error(scaled->stream, -ENOMEM,
+				    "failed to allocate DMABUF buffer");
+		return;
+	}
+	stride = dmabuf->linux_dmabuf_memory->attributes->stride[0];
+	size = dmabuf->size;
+	dmabuf->linux_dmabuf_memory->destroy(dmabuf->linux_dmabuf_memory);
+	pipewire_destroy_dmabuf(output, dmabuf);
+
+	pipewire_output_debug(output, "%dx%d param changed",
+			      scaled->size.width, scaled->size.height);
+
+	params[0] = spa_pod_builder_add_object(&builder,
+		SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+		SPA_PARAM_BUFFERS_size, SPA_POD_Int(size),
+		SPA_PARAM_BUFFERS_stride, SPA_POD_Int(stride),
+		SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(4, 2, 8),
+		SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(1u << SPA_DATA_DmaBuf));
+
+	spa_pod_build_raw_meta_params(&builder, &params[1]);
+
+	pw_stream_update_params(scaled->stream, params, 3);
 }
 
-static int
-pipewire_output_start_repaint_loop(struct weston_output *output)
+static void
+pipewire_scaled_stream_add_buffer(void *data, struct pw_buffer *buffer)
 {
-	struct timespec ts;
+	struct pipewire_scaled_stream *scaled = data;
+	struct pipewire_output *output = scaled->output;
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct pipewire_frame_data *frame_data;
+	struct pipewire_dmabuf *dmabuf;
 
-	weston_compositor_read_presentation_clock(output->compositor, &ts);
-	weston_output_finish_frame(output, &ts, WP_PRESENTATION_FEEDBACK_INVALID);
+	pipewire_output_debug(output, "%dx%d add buffer: %p",
+			      scaled->size.width, scaled->size.height, buffer);
 
-	return 0;
+	frame_data = xzalloc(sizeof *frame_data);
+	pixman_region32_init(&frame_data->damage);
+	buffer->user_data = frame_data;
+
+	dmabuf = pipewire_output_create_dmabuf(output, scaled->size.width,
+					       scaled->size.height);
+	if (!dmabuf) {
+		pw_stream_set_error(scaled->stream, -ENOMEM,
+				    "failed to allocate DMABUF buffer");
+		return;
+	}
+	pipewire_output_setup_dmabuf(output, buffer, dmabuf);
+	frame_data->dmabuf = dmabuf;
+
+	frame_data->renderbuffer =
+		renderer->create_renderbuffer_dmabuf(&output->base,
+						     dmabuf->linux_dmabuf_memory);
+	if (!frame_data->renderbuffer)
+		pw_stream_set_error(scaled->stream, -ENOMEM,
+				    "failed to create renderbuffer");
 }
 
 static void
-pipewire_submit_buffer(struct pipewire_output *output,
-		       struct pw_buffer *buffer)
+pipewire_scaled_stream_remove_buffer(void *data, struct pw_buffer *buffer)
 {
+	struct pipewire_scaled_stream *scaled = data;
+	struct pipewire_output *output = scaled->output;
+	struct weston_renderer *renderer = output->base.compositor->renderer;
 	struct pipewire_frame_data *frame_data = buffer->user_data;
-	struct pipewire_dmabuf *dmabuf = frame_data->dmabuf;
-	struct spa_buffer *spa_buffer;
-	struct spa_meta_header *h;
-	const struct pixel_format_info *pixel_format;
-	unsigned int stride;
-	size_t size;
 
-	pixel_format = output->pixel_format;
-	if (dmabuf)
-		stride = dmabuf->linux_dmabuf_memory->attributes->stride[0];
-	else
-		stride = output->base.width * pixel_format->bpp / 8;
-	size = output->base.height * stride;
+	pipewire_output_debug(output, "%dx%d remove buffer: %p",
+			      scaled->size.width, scaled->size.height, buffer);
 
-	spa_buffer = buffer->buffer;
+	if (frame_data->renderbuffer) {
+		renderer->remove_renderbuffer_dmabuf(&output->base,
+						     frame_data->renderbuffer);
+		weston_renderbuffer_unref(frame_data->renderbuffer);
+	} else if (frame_data->dmabuf) {
+		frame_data->dmabuf->linux_dmabuf_memory->destroy(frame_data->dmabuf->linux_dmabuf_memory);
+	}
+	if (frame_data->dmabuf)
+		pipewire_destroy_dmabuf(output, frame_data->dmabuf);
 
-	if ((h = spa_buffer_find_meta_data(spa_buffer, SPA_META_Header,
-				     sizeof(struct spa_meta_header)))) {
-		struct timespec ts;
+	if (scaled->fence_buffer == buffer)
+		scaled->fence_buffer = NULL;
+	pixman_region32_fini(&frame_data->damage);
+	free(frame_data);
+}
 
-		clock_gettime(CLOCK_MONOTONIC, &ts);
-		h->pts = SPA_TIMESPEC_TO_NSEC(&ts);
-		h->flags = 0;
-		h->seq = output->seq;
-		h->dts_offset = 0;
-	}
+static const struct pw_stream_events scaled_stream_events = {
+	PW_VERSION_STREAM_EVENTS,
+	.state_changed = pipewire_scaled_stream_state_changed,
+	.param_changed = pipewire_scaled_stream_param_changed,
+	.add_buffer = pipewire_scaled_stream_add_buffer,
+	.remove_buffer = pipewire_scaled_stream_remove_buffer,
+};
 
-	spa_buffer->datas[0].chunk->offset = 0;
-	spa_buffer->datas[0].chunk->stride = stride;
-	spa_buffer->datas[0].chunk->size = size;
+static int
+pipewire_scaled_stream_connect(struct pipewire_scaled_stream *scaled)
+{
+	struct pipewire_output *output = scaled->output;
+	uint8_t buffer[1024];
+	struct spa_pod_builder builder =
+		SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[1];
+	uint64_t modifier[] = { DRM_FORMAT_MOD_LINEAR };
+	int ret;
 
-	pipewire_output_debug(output, "queue buffer: %p (seq %d)",
-			      buffer, output->seq);
-	pw_stream_queue_buffer(output->stream, buffer);
+	params[0] = spa_pod_build_format(&builder,
+					 scaled->size.width, scaled->size.height,
+					 output->base.current_mode->refresh / 1000,
+					 output->pixel_format->format,
+					 modifier);
 
-	output->seq++;
+	ret = pw_stream_connect(scaled->stream, PW_DIRECTION_OUTPUT, PW_ID_ANY,
+				PW_STREAM_FLAG_DRIVER |
+				PW_STREAM_FLAG_ALLOC_BUFFERS,
+				params, ARRAY_LENGTH(params));
+	if (ret != 0) {
+		weston_log("Failed to connect PipeWire stream: %s",
+			   spa_strerror(ret));
+		return -1;
+	}
+
+	return 0;
 }
 
-static int
-pipewire_output_fence_sync_handler(int fd, uint32_t mask, void *data)
+static void
+pipewire_scaled_stream_destroy(struct pipewire_scaled_stream *scaled)
 {
-	struct pipewire_fence_data *fence_data = data;
+	pipewire_scaled_stream_clear_fence(scaled);
+	pw_stream_destroy(scaled->stream);
+	pixman_region32_fini(&scaled->damage);
+	wl_list_remove(&scaled->link);
+	free(scaled);
+}
 
-	if (fence_data->buffer)
-		pipewire_submit_buffer(fence_data->output, fence_data->buffer);
+static void
+pipewire_output_connect_scaled_streams(struct pipewire_output *output)
+{
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct pipewire_scaled_stream *scaled, *tmp;
+	bool can_scale;
 
-	wl_event_source_remove(fence_data->fence_sync_event_source);
-	close(fence_data->fence_sync_fd);
-	wl_list_remove(&fence_data->link);
-	free(fence_data);
+	if (wl_list_empty(&output->scaled_stream_list))
+		return;
 
-	return 0;
+	can_scale = pipewire_backend_has_dmabuf_allocator(output->backend) &&
+		    renderer->scale_output_to_renderbuffer;
+	if (!can_scale)
+		weston_log("PipeWire: output %s can't be scaled, it needs the "
+			   "GL renderer with dmabuf support, dropping its "
+			   "scaled streams\n", output->base.name);
+
+	wl_list_for_each_safe(scaled, tmp, &output->scaled_stream_list, link) {
+		if (!can_scale || pipewire_scaled_stream_connect(scaled) < 0)
+			pipewire_scaled_stream_destroy(scaled);
+	}
 }
 
-static int
-pipewire_schedule_submit_buffer(struct pipewire_output *output,
-				struct pw_buffer *buffer)
+static void
+pipewire_output_disconnect_scaled_streams(struct pipewire_output *output)
 {
-	struct weston_compositor *ec = output->base.compositor;
-	struct weston_renderer *renderer = ec->renderer;
-	struct pipewire_fence_data *fence_data;
-	struct wl_event_loop *loop;
-	int fence_sync_fd;
+	struct pipewire_scaled_stream *scaled;
 
-	fence_sync_fd = renderer->gl->create_fence_fd(&output->base);
-	if (fence_sync_fd == -1)
-		return -1;
+	wl_list_for_each(scaled, &output->scaled_stream_list, link) {
+		pw_stream_disconnect(scaled->stream);
+		pipewire_scaled_stream_clear_fence(scaled);
+	}
 
-	fence_data = zalloc(sizeof *fence_data);
-	if (!fence_data) {
-		close(fence_sync_fd);
-		return -1;
+	pipewire_output_release_scale_source(output);
+}
+
+/* Frames are rendered only once the consumer can take them: when it is
+ * due at the framerate the consumer negotiated, and, for raw frames,
+ * when it has given a buffer back. Until then the damage stays with the
+ * output and the repaint loop idles along. */
+static bool
+pipewire_output_frame_wanted(struct pipewire_output *output)
+{
+	struct timespec now;
+	int refresh_nsec;
+
+	if (output->frame_interval_nsec) {
+		refresh_nsec = millihz_to_nsec(output->base.current_mode->refresh);
+		weston_compositor_read_presentation_clock(output->base.compositor,
+							  &now);
+		if (timespec_sub_to_nsec(&now, &output->last_frame) <
+		    output->frame_interval_nsec - refresh_nsec / 2)
+			return false;
 	}
-	wl_list_insert(&output->fence_list, &fence_data->link);
 
-	loop = wl_display_get_event_loop(output->backend->compositor->wl_display);
+	if (pipewire_output_is_encoded(output))
+		return true;
 
-	fence_data->output = output;
-	fence_data->buffer = buffer;
-	fence_data->fence_sync_fd = fence_sync_fd;
-	fence_data->fence_sync_event_source =
-		wl_event_loop_add_fd(loop, fence_data->fence_sync_fd,
-				     WL_EVENT_READABLE,
-				     pipewire_output_fence_sync_handler,
-				     fence_data);
+	if (!output->next_buffer)
+		output->next_buffer = pw_stream_dequeue_buffer(output->stream);
+	if (!output->next_buffer)
+		return false;
 
-	return 0;
+	return true;
 }
 
 static int
 pipewire_output_repaint(struct weston_output *base)
 {
 	struct pipewire_output *output = to_pipewire_output(base);
-	struct weston_compositor *ec = output->base.compositor;
 	struct pw_buffer *buffer;
 	struct pipewire_frame_data *frame_data;
 	pixman_region32_t damage;
+	bool streaming;
 	bool submit_scheduled = false;
 
 	assert(output);
 
 	pixman_region32_init(&damage);
 
-	if (pw_stream_get_state(output->stream, NULL) != PW_STREAM_STATE_STREAMING)
+	streaming = pw_stream_get_state(output->stream, NULL) ==
+		    PW_STREAM_STATE_STREAMING;
+	if (!streaming && !pipewire_output_scaled_streaming(output))
 		goto out;
 
+	if (streaming && !pipewire_output_frame_wanted(output)) {
+		output->frame_deferred = true;
+		goto out;
+	}
+
 	weston_output_flush_damage_for_primary_plane(base, &damage);
 
 	if (!pixman_region32_not_empty(&damage))
 		goto out;
 
-	buffer = pw_stream_dequeue_buffer(output->stream);
-	if (!buffer) {
-		weston_log("Failed to dequeue PipeWire buffer\n");
+	weston_compositor_read_presentation_clock(base->compositor,
+						  &output->last_frame);
+
+	pipewire_output_damage_scaled(output, &damage);
+
+	if (!streaming) {
+		pipewire_output_repaint_scale_source(output, &damage);
 		goto out;
 	}
+
+	if (pipewire_output_repaint_encoded(output, &damage))
+		goto out;
+
+	buffer = output->next_buffer;
+	output->next_buffer = NULL;
 	pipewire_output_debug(output, "dequeued buffer: %p", buffer);
 
 	frame_data = buffer->user_data;
-	if (frame_data->renderbuffer)
-		ec->renderer->repaint_output(&output->base, &damage, frame_data->renderbuffer);
-	else
+	if (frame_data->renderbuffer) {
+		weston_renderer_repaint_output(&output->base, &damage,
+					       frame_data->renderbuffer);
+		weston_region_global_to_output(&frame_data->damage, base,
+					       &damage);
+		pipewire_output_repaint_scaled(output);
+	} else {
 		output->base.full_repaint_needed = true;
+		pixman_region32_fini(&frame_data->damage);
+		pixman_region32_init_rect(&frame_data->damage, 0, 0,
+					  output->base.current_mode->width,
+					  output->base.current_mode->height);
+	}
 
 	if (buffer->buffer->datas[0].type == SPA_DATA_DmaBuf) {
 		if (pipewire_schedule_submit_buffer(output, buffer) == 0)
@@ -1136,6 +2367,7 @@ pipewire_switch_mode(struct weston_output *base, struct weston_mode *target_mode
 	fb_size.width = target_mode->width;
 	fb_size.height = target_mode->height;
 
+	pipewire_output_release_scale_source(output);
 	weston_renderer_resize_output(base, &fb_size, NULL);
 
 	return 0;
@@ -1215,10 +2447,51 @@ pipewire_output_set_gbm_format(struct weston_output *base, const char *gbm_forma
 			 &output->pixel_format);
 }
 
+static int
+pipewire_output_add_scaled_stream(struct weston_output *base,
+				  int width, int height)
+{
+	struct pipewire_output *output = to_pipewire_output(base);
+	struct pipewire_backend *b = output->backend;
+	struct pipewire_scaled_stream *scaled;
+	struct pw_properties *props;
+
+	assert(!output->base.enabled);
+
+	if (width <= 0 || height <= 0)
+		return -1;
+
+	scaled = xzalloc(sizeof *scaled);
+	scaled->output = output;
+	scaled->size.width = width;
+	scaled->size.height = height;
+	scaled->fence_fd = -1;
+	pixman_region32_init(&scaled->damage);
+
+	props = pw_properties_new(NULL, NULL);
+	pw_properties_setf(props, PW_KEY_NODE_NAME, "weston.%s.%dx%d",
+			   base->name, width, height);
+
+	scaled->stream = pw_stream_new(b->core, base->name, props);
+	if (!scaled->stream) {
+		weston_log("Cannot initialize PipeWire stream\n");
+		pixman_region32_fini(&scaled->damage);
+		free(scaled);
+		return -1;
+	}
+
+	pw_stream_add_listener(scaled->stream, &scaled->stream_listener,
+			       &scaled_stream_events, scaled);
+	wl_list_insert(output->scaled_stream_list.prev, &scaled->link);
+
+	return 0;
+}
+
 static const struct weston_pipewire_output_api api = {
 	pipewire_head_create,
 	pipewire_output_set_size,
 	pipewire_output_set_gbm_format,
+	pipewire_output_add_scaled_stream,
 };
 
 static int
@@ -1380,6 +2653,16 @@ pipewire_backend_create(struct weston_compositor *compositor,
 			 pixel_format_get_info(DRM_FORMAT_XRGB8888),
 			 &backend->pixel_format);
 
+#ifdef BUILD_PIPEWIRE_VAAPI
+	backend->vaapi_encode = config->vaapi_encode;
+	backend->vaapi_device = xstrdup(config->vaapi_device ?:
+					"/dev/dri/renderD128");
+#else
+	if (config->vaapi_encode)
+		weston_log("PipeWire: built without VA-API support, "
+			   "streaming raw frames\n");
+#endif
+
 	pipewire_backend_create_outputs(backend, config->num_outputs);
 
 	return backend;
@@ -32,6 +32,7 @@
 #include <string.h>
 #include <errno.h>
 #include <linux/input.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #include "rdp.h"
@@ -61,7 +62,7 @@ extern PWtsApiFunctionTable FreeRDP_InitWtsApi(void);
 static BOOL
 xf_peer_adjust_monitor_layout(freerdp_peer *client);
 
-static struct rdp_output *
+struct rdp_output *
 rdp_get_first_output(struct rdp_backend *b)
 {
 	struct weston_output *output;
@@ -77,42 +78,41 @@ rdp_get_first_output(struct rdp_backend *b)
 }
 
 static void
-rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_encode_rfx(RFX_CONTEXT *rfx_context, wStream *stream, RFX_RECT **rfx_rects,
+	       pixman_region32_t *damage, pixman_image_t *image,
+	       SURFACE_BITS_COMMAND *cmd)
 {
 	int width, height, nrects, i;
 	pixman_box32_t *region, *rects;
 	uint32_t *ptr;
 	RFX_RECT *rfxRect;
-	rdpUpdate *update = peer->context->update;
-	SURFACE_BITS_COMMAND cmd = { 0 };
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 
-	Stream_Clear(context->encode_stream);
-	Stream_SetPosition(context->encode_stream, 0);
+	Stream_Clear(stream);
+	Stream_SetPosition(stream, 0);
 
 	width = (damage->extents.x2 - damage->extents.x1);
 	height = (damage->extents.y2 - damage->extents.y1);
 
-	cmd.skipCompression = TRUE;
-	cmd.cmdType = CMDTYPE_STREAM_SURFACE_BITS;
-	cmd.destLeft = damage->extents.x1;
-	cmd.destTop = damage->extents.y1;
-	cmd.destRight = damage->extents.x2;
-	cmd.destBottom = damage->extents.y2;
-	cmd.bmp.bpp = 32;
-	cmd.bmp.codecID = freerdp_settings_get_uint32(peer->context->settings, FreeRDP_RemoteFxCodecId);
-	cmd.bmp.width = width;
-	cmd.bmp.height = height;
+	memset(cmd, 0, sizeof *cmd);
+	cmd->skipCompression = TRUE;
+	cmd->cmdType = CMDTYPE_STREAM_SURFACE_BITS;
+	cmd->destLeft = damage->extents.x1;
+	cmd->destTop = damage->extents.y1;
+	cmd->destRight = damage->extents.x2;
+	cmd->destBottom = damage->extents.y2;
+	cmd->bmp.bpp = 32;
+	cmd->bmp.width = width;
+	cmd->bmp.height = height;
 
 	ptr = pixman_image_get_data(image) + damage->extents.x1 +
 				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
 
 	rects = pixman_region32_rectangles(damage, &nrects);
-	context->rfx_rects = realloc(context->rfx_rects, nrects * sizeof *rfxRect);
+	*rfx_rects = realloc(*rfx_rects, nrects * sizeof *rfxRect);
 
 	for (i = 0; i < nrects; i++) {
 		region = &rects[i];
-		rfxRect = &context->rfx_rects[i];
+		rfxRect = &(*rfx_rects)[i];
 
 		rfxRect->x = (region->x1 - damage->extents.x1);
 		rfxRect->y = (region->y1 - damage->extents.y1);
@@ -120,62 +120,245 @@ rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 		rfxRect->height = (region->y2 - region->y1);
 	}
 
-	rfx_compose_message(context->rfx_context, context->encode_stream, context->rfx_rects, nrects,
+	rfx_compose_message(rfx_context, stream, *rfx_rects, nrects,
 			(BYTE *)ptr, width, height,
 			pixman_image_get_stride(image)
 	);
 
-	cmd.bmp.bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd.bmp.bitmapData = Stream_Buffer(context->encode_stream);
-
-	update->SurfaceBits(update->context, &cmd);
+	cmd->bmp.bitmapDataLength = Stream_GetPosition(stream);
+	cmd->bmp.bitmapData = Stream_Buffer(stream);
 }
 
+/* nsc_compose_message() appears to require a 16 byte alignment,
+ * otherwise it will read off the end of the region while doing
+ * SIMD optimizations. Align our left edge and post a little
+ * extra damage to hit this constraint.
+ */
+static int32_t
+rdp_nsc_aligned_left(pixman_region32_t *damage)
+{
+	return damage->extents.x1 - (damage->extents.x1 % 16);
+}
 
 static void
-rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_encode_nsc(NSC_CONTEXT *nsc_context, wStream *stream,
+	       pixman_region32_t *damage, pixman_image_t *image,
+	       SURFACE_BITS_COMMAND *cmd)
 {
 	int width, height;
 	int32_t left;
 	uint32_t *ptr;
-	rdpUpdate *update = peer->context->update;
-	SURFACE_BITS_COMMAND cmd = { 0 };
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 
-	Stream_Clear(context->encode_stream);
-	Stream_SetPosition(context->encode_stream, 0);
+	Stream_Clear(stream);
+	Stream_SetPosition(stream, 0);
 
-	/* nsc_compose_message() appears to require a 16 byte alignment,
-	 * otherwise it will read off the end of the region while doing
-	 * SIMD optimizations. Align our left edge and post a little
-	 * extra damage to hit this constraint.
-	 */
-	left = damage->extents.x1 - (damage->extents.x1 % 16);
+	left = rdp_nsc_aligned_left(damage);
 	width = (damage->extents.x2 - left);
 	height = (damage->extents.y2 - damage->extents.y1);
 
-	cmd.cmdType = CMDTYPE_SET_SURFACE_BITS;
-	cmd.skipCompression = TRUE;
-	cmd.destLeft = left;
-	cmd.destTop = damage->extents.y1;
-	cmd.destRight = damage->extents.x2;
-	cmd.destBottom = damage->extents.y2;
-	cmd.bmp.bpp = 32;
-	cmd.bmp.codecID = freerdp_settings_get_uint32(peer->context->settings, FreeRDP_NSCodecId);
-	cmd.bmp.width = width;
-	cmd.bmp.height = height;
+	memset(cmd, 0, sizeof *cmd);
+	cmd->cmdType = CMDTYPE_SET_SURFACE_BITS;
+	cmd->skipCompression = TRUE;
+	cmd->destLeft = left;
+	cmd->destTop = damage->extents.y1;
+	cmd->destRight = damage->extents.x2;
+	cmd->destBottom = damage->extents.y2;
+	cmd->bmp.bpp = 32;
+	cmd->bmp.width = width;
+	cmd->bmp.height = height;
 
 	ptr = pixman_image_get_data(image) + left +
 				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
 
-	nsc_compose_message(context->nsc_context, context->encode_stream, (BYTE *)ptr,
+	nsc_compose_message(nsc_context, stream, (BYTE *)ptr,
 			width, height,
 			pixman_image_get_stride(image));
 
-	cmd.bmp.bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd.bmp.bitmapData = Stream_Buffer(context->encode_stream);
+	cmd->bmp.bitmapDataLength = Stream_GetPosition(stream);
+	cmd->bmp.bitmapData = Stream_Buffer(stream);
+}
+
+static RFX_CONTEXT *
+rdp_rfx_context_new(uint32_t width, uint32_t height)
+{
+	RFX_CONTEXT *rfx_context;
+
+	rfx_context = rfx_context_new(TRUE);
+	if (!rfx_context)
+		return NULL;
+
+#if USE_FREERDP_VERSION >= 3
+	rfx_context_set_mode(rfx_context, RLGR3);
+	rfx_context_reset(rfx_context, width, height);
+#else
+	rfx_context->mode = RLGR3;
+	rfx_context->width = width;
+	rfx_context->height = height;
+#endif
+	rfx_context_set_pixel_format(rfx_context, DEFAULT_PIXEL_FORMAT);
+
+	return rfx_context;
+}
+
+static NSC_CONTEXT *
+rdp_nsc_context_new(void)
+{
+	NSC_CONTEXT *nsc_context;
+
+	nsc_context = nsc_context_new();
+	if (!nsc_context)
+		return NULL;
+
+	nsc_context_set_parameters(nsc_context, NSC_COLOR_FORMAT, DEFAULT_PIXEL_FORMAT);
+
+	return nsc_context;
+}
+
+static void
+rdp_encode_cache_fini(struct rdp_encode_cache *cache)
+{
+	if (cache->stream)
+		Stream_Free(cache->stream, TRUE);
+	if (cache->nsc_context)
+		nsc_context_free(cache->nsc_context);
+	if (cache->rfx_context)
+		rfx_context_free(cache->rfx_context);
+	free(cache->rfx_rects);
+	pthread_mutex_destroy(&cache->mutex);
+}
+
+/* Called on an encoder thread, with the cache mutex held. */
+static bool
+rdp_encode_cache_update(struct rdp_encode_cache *cache, RdpPeerContext *context)
+{
+	pixman_image_t *image = context->encoder.image;
+	int width = pixman_image_get_width(image);
+	int height = pixman_image_get_height(image);
+
+	if (cache->valid && cache->seq == context->encoder.seq &&
+	    cache->rfx == context->encoder.rfx &&
+	    cache->width == width && cache->height == height)
+		return true;
+
+	cache->valid = false;
+
+	if (!cache->stream) {
+		cache->stream = Stream_New(NULL, 65536);
+		if (!cache->stream)
+			return false;
+	}
+
+	if (cache->width != width || cache->height != height) {
+		if (cache->rfx_context)
+			rfx_context_reset(cache->rfx_context, width, height);
+		if (cache->nsc_context)
+			nsc_context_reset(cache->nsc_context, width, height);
+		cache->width = width;
+		cache->height = height;
+	}
+
+	if (context->encoder.rfx) {
+		if (!cache->rfx_context) {
+			cache->rfx_context = rdp_rfx_context_new(width, height);
+			if (!cache->rfx_context)
+				return false;
+		}
+		rdp_encode_rfx(cache->rfx_context, cache->stream,
+			       &cache->rfx_rects, &context->encoder.damage,
+			       image, &cache->cmd);
+	} else {
+		if (!cache->nsc_context) {
+			cache->nsc_context = rdp_nsc_context_new();
+			if (!cache->nsc_context)
+				return false;
+			nsc_context_reset(cache->nsc_context, width, height);
+		}
+		rdp_encode_nsc(cache->nsc_context, cache->stream,
+			       &context->encoder.damage, image, &cache->cmd);
+	}
+
+	cache->seq = context->encoder.seq;
+	cache->rfx = context->encoder.rfx;
+	cache->valid = true;
+
+	return true;
+}
+
+/* Called on an encoder thread. The first peer to get here encodes the
+ * frame, all the others copy its bitstream. */
+static bool
+rdp_peer_encode_shared(RdpPeerContext *context)
+{
+	struct rdp_encode_cache *cache = &context->rdpBackend->encode_cache;
+	SURFACE_BITS_COMMAND *cmd = &context->encoder.cmd;
+	size_t length;
+	bool ret = false;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	if (!rdp_encode_cache_update(cache, context))
+		goto out;
+
+	length = Stream_GetPosition(cache->stream);
+	Stream_Clear(context->encode_stream);
+	Stream_SetPosition(context->encode_stream, 0);
+	if (!Stream_EnsureCapacity(context->encode_stream, length))
+		goto out;
+	Stream_Write(context->encode_stream, Stream_Buffer(cache->stream), length);
+
+	*cmd = cache->cmd;
+	cmd->bmp.bitmapData = Stream_Buffer(context->encode_stream);
+	ret = true;
+
+out:
+	pthread_mutex_unlock(&cache->mutex);
+
+	return ret;
+}
+
+/* Called on the encoder thread. */
+static void
+rdp_peer_encode(RdpPeerContext *context)
+{
+	rdpSettings *settings = context->item.peer->context->settings;
+	SURFACE_BITS_COMMAND *cmd = &context->encoder.cmd;
+
+	if (context->encoder.reset) {
+		rfx_context_reset(context->rfx_context,
+				  context->encoder.width,
+				  context->encoder.height);
+		nsc_context_reset(context->nsc_context,
+				  context->encoder.width,
+				  context->encoder.height);
+		rdp_gfx_reset_codecs(context,
+				     context->encoder.width,
+				     context->encoder.height);
+		context->encoder.reset = false;
+	}
+
+	if (context->encoder.gfx) {
+		rdp_gfx_encode(context);
+		return;
+	}
 
-	update->SurfaceBits(update->context, &cmd);
+	if (!context->encoder.shared || !rdp_peer_encode_shared(context)) {
+		if (context->encoder.rfx)
+			rdp_encode_rfx(context->rfx_context,
+				       context->encode_stream,
+				       &context->rfx_rects,
+				       &context->encoder.damage,
+				       context->encoder.image, cmd);
+		else
+			rdp_encode_nsc(context->nsc_context,
+				       context->encode_stream,
+				       &context->encoder.damage,
+				       context->encoder.image, cmd);
+	}
+
+	cmd->bmp.codecID = freerdp_settings_get_uint32(settings,
+						       context->encoder.rfx ?
+						       FreeRDP_RemoteFxCodecId :
+						       FreeRDP_NSCodecId);
 }
 
 static void
@@ -195,6 +378,7 @@ pixman_image_flipped_subrect(const pixman_box32_t *rect, pixman_image_t *img, BY
 static void
 rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_peer *peer)
 {
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 	rdpUpdate *update = peer->context->update;
 	SURFACE_BITS_COMMAND cmd = { 0 };
 	SURFACE_FRAME_MARKER marker;
@@ -206,7 +390,7 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 	if (!nrects)
 		return;
 
-	marker.frameId++;
+	marker.frameId = ++context->encoder.frame_id;
 	marker.frameAction = SURFACECMD_FRAMEACTION_BEGIN;
 	update->SurfaceFrameMarker(peer->context, &marker);
 
@@ -254,18 +438,234 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 }
 
 static void
-rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+rdp_peer_encoder_done(bool freeOnly, void *data);
+
+static void *
+rdp_peer_encoder_thread(void *data)
 {
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	RdpPeerContext *context = data;
+
+	pthread_mutex_lock(&context->encoder.mutex);
+
+	while (!context->encoder.destroying) {
+		if (!context->encoder.job) {
+			pthread_cond_wait(&context->encoder.cond,
+					  &context->encoder.mutex);
+			continue;
+		}
+
+		/* A frame queued before the desktop was resized is dropped
+		 * by rdp_peer_encoder_done(), don't bother encoding it. */
+		if (context->encoder.job_generation == context->encoder.generation)
+			rdp_peer_encode(context);
+		context->encoder.job = false;
+
+		rdp_dispatch_task_to_display_loop(context,
+						  rdp_peer_encoder_done,
+						  &context->encoder.done_task);
+	}
+
+	pthread_mutex_unlock(&context->encoder.mutex);
+
+	return NULL;
+}
+
+static bool
+rdp_peer_encoder_init(RdpPeerContext *context)
+{
+	pthread_mutex_init(&context->encoder.mutex, NULL);
+	pthread_cond_init(&context->encoder.cond, NULL);
+	pixman_region32_init(&context->encoder.damage);
+	pixman_region32_init(&context->encoder.pending_damage);
+
+	if (pthread_create(&context->encoder.thread, NULL,
+			   rdp_peer_encoder_thread, context) != 0) {
+		weston_log("failed to start the RDP encoder thread\n");
+		return false;
+	}
+	context->encoder.started = true;
+
+	return true;
+}
+
+static void
+rdp_peer_encoder_fini(RdpPeerContext *context)
+{
+	if (context->encoder.started) {
+		pthread_mutex_lock(&context->encoder.mutex);
+		context->encoder.destroying = true;
+		pthread_cond_signal(&context->encoder.cond);
+		pthread_mutex_unlock(&context->encoder.mutex);
+
+		pthread_join(context->encoder.thread, NULL);
+		context->encoder.started = false;
+	}
+
+	if (context->encoder.image)
+		pixman_image_unref(context->encoder.image);
+	pixman_region32_fini(&context->encoder.damage);
+	pixman_region32_fini(&context->encoder.pending_damage);
+	pthread_cond_destroy(&context->encoder.cond);
+	pthread_mutex_destroy(&context->encoder.mutex);
+}
+
+/* Takes a snapshot of the damaged part of the frame for the worker, so
+ * the next repaint can go ahead while the frame is being encoded. */
+static void
+rdp_peer_encoder_copy_damage(RdpPeerContext *context, pixman_image_t *image)
+{
+	pixman_region32_t *damage = &context->encoder.damage;
+	int width = pixman_image_get_width(image);
+	int height = pixman_image_get_height(image);
+	int32_t left = rdp_nsc_aligned_left(damage);
+
+	if (context->encoder.image &&
+	    (pixman_image_get_width(context->encoder.image) != width ||
+	     pixman_image_get_height(context->encoder.image) != height)) {
+		pixman_image_unref(context->encoder.image);
+		context->encoder.image = NULL;
+	}
+
+	if (!context->encoder.image)
+		context->encoder.image =
+			pixman_image_create_bits(pixman_image_get_format(image),
+						 width, height, NULL,
+						 pixman_image_get_stride(image));
+
+	pixman_image_composite32(PIXMAN_OP_SRC, image, NULL,
+				 context->encoder.image,
+				 left, damage->extents.y1, 0, 0,
+				 left, damage->extents.y1,
+				 damage->extents.x2 - left,
+				 damage->extents.y2 - damage->extents.y1);
+}
+
+static bool
+rdp_peer_is_behind(RdpPeerContext *context)
+{
+	rdpSettings *settings = context->item.peer->context->settings;
+	uint32_t max_frames;
+
+	/* Only pace clients which have shown they send acknowledgements. */
+	if (!context->encoder.acked)
+		return false;
+
+	max_frames = freerdp_settings_get_uint32(settings, FreeRDP_FrameAcknowledge);
+	if (max_frames == 0)
+		max_frames = RDP_MAX_UNACKED_FRAMES;
+
+	return context->encoder.frame_id - context->encoder.acked_frame_id >=
+	       max_frames;
+}
+
+void
+rdp_peer_encoder_kick(RdpPeerContext *context)
+{
+	freerdp_peer *peer = context->item.peer;
 	struct rdp_output *output = rdp_get_first_output(context->rdpBackend);
 	rdpSettings *settings = peer->context->settings;
+	pixman_region32_t *pending = &context->encoder.pending_damage;
+	bool rfx;
 
-	if (freerdp_settings_get_bool(settings, FreeRDP_RemoteFxCodec))
-		rdp_peer_refresh_rfx(region, output->shadow_surface, peer);
-	else if (freerdp_settings_get_bool(settings, FreeRDP_NSCodec))
-		rdp_peer_refresh_nsc(region, output->shadow_surface, peer);
-	else
-		rdp_peer_refresh_raw(region, output->shadow_surface, peer);
+	if (context->encoder.busy || !pixman_region32_not_empty(pending) ||
+	    rdp_peer_is_behind(context) || !output)
+		return;
+
+	if (context->gfx.active) {
+		rdp_gfx_prepare_surface(context,
+					pixman_image_get_width(output->shadow_surface),
+					pixman_image_get_height(output->shadow_surface));
+	} else if (!freerdp_settings_get_bool(settings, FreeRDP_RemoteFxCodec) &&
+		   !freerdp_settings_get_bool(settings, FreeRDP_NSCodec)) {
+		rdp_peer_refresh_raw(pending, output->shadow_surface, peer);
+		pixman_region32_clear(pending);
+		return;
+	}
+
+	pixman_region32_copy(&context->encoder.damage, pending);
+	pixman_region32_clear(pending);
+	rdp_peer_encoder_copy_damage(context, output->shadow_surface);
+
+	context->encoder.busy = true;
+	context->encoder.job_generation = context->encoder.generation;
+	rfx = freerdp_settings_get_bool(settings, FreeRDP_RemoteFxCodec);
+
+	pthread_mutex_lock(&context->encoder.mutex);
+	context->encoder.rfx = rfx;
+	context->encoder.gfx = context->gfx.active;
+	context->encoder.gfx_codec = context->gfx.codec;
+	context->encoder.seq = context->encoder.shareable_seq;
+	/* The client needs the RemoteFX headers of our own codec context
+	 * before it can decode frames from the shared one. Graphics
+	 * pipeline codecs keep state per peer and can't be shared. */
+	context->encoder.shared = context->encoder.shareable &&
+				  !context->gfx.active &&
+				  (!rfx || context->encoder.rfx_primed);
+	if (rfx && !context->encoder.shared)
+		context->encoder.rfx_primed = true;
+	context->encoder.job = true;
+	pthread_cond_signal(&context->encoder.cond);
+	pthread_mutex_unlock(&context->encoder.mutex);
+}
+
+static void
+rdp_peer_encoder_done(bool freeOnly, void *data)
+{
+	struct rdp_loop_task *task = data;
+	RdpPeerContext *context = task->peerCtx;
+	rdpUpdate *update = context->item.peer->context->update;
+	SURFACE_FRAME_MARKER marker = { 0 };
+
+	/* The task is embedded in the peer context, nothing to free. */
+	if (freeOnly)
+		return;
+
+	context->encoder.busy = false;
+
+	/* Encoded before the codecs were reset for a new desktop size. */
+	if (context->encoder.job_generation != context->encoder.generation) {
+		if (context->encoder.gfx)
+			rdp_gfx_release_frame(context);
+	} else if (context->encoder.gfx) {
+		rdp_gfx_send_frame(context);
+	} else {
+		marker.frameId = ++context->encoder.frame_id;
+		marker.frameAction = SURFACECMD_FRAMEACTION_BEGIN;
+		update->SurfaceFrameMarker(update->context, &marker);
+
+		update->SurfaceBits(update->context, &context->encoder.cmd);
+
+		marker.frameAction = SURFACECMD_FRAMEACTION_END;
+		update->SurfaceFrameMarker(update->context, &marker);
+	}
+
+	rdp_peer_encoder_kick(context);
+}
+
+static void
+rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+
+	/* Frames the peer can't keep up with are merged into the next one. */
+	pixman_region32_union(&context->encoder.pending_damage,
+			      &context->encoder.pending_damage, region);
+	rdp_peer_encoder_kick(context);
+}
+
+/* Damage is exactly what changed in frame seq of the output, so peers
+ * that are caught up can share a single encoding of it. */
+static void
+rdp_peer_refresh_frame(pixman_region32_t *damage, freerdp_peer *peer,
+		       uint32_t seq)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+
+	context->encoder.shareable =
+		!pixman_region32_not_empty(&context->encoder.pending_damage);
+	context->encoder.shareable_seq = seq;
+	rdp_peer_refresh_region(damage, peer);
+	context->encoder.shareable = false;
 }
 
 static int
@@ -283,7 +683,6 @@ static int
 rdp_output_repaint(struct weston_output *output_base)
 {
 	struct rdp_output *output = container_of(output_base, struct rdp_output, base);
-	struct weston_compositor *ec = output->base.compositor;
 	struct rdp_backend *b = output->backend;
 	struct rdp_peers_item *peer;
 	pixman_region32_t damage;
@@ -294,8 +693,8 @@ rdp_output_repaint(struct weston_output *output_base)
 
 	weston_output_flush_damage_for_primary_plane(output_base, &damage);
 
-	ec->renderer->repaint_output(&output->base, &damage,
-				     output->renderbuffer);
+	weston_renderer_repaint_output(&output->base, &damage,
+				       output->renderbuffer);
 
 	if (pixman_region32_not_empty(&damage)) {
 		pixman_region32_t transformed_damage;
@@ -303,10 +702,12 @@ rdp_output_repaint(struct weston_output *output_base)
 		weston_region_global_to_output(&transformed_damage,
 					       output_base,
 					       &damage);
+		b->frame_seq++;
 		wl_list_for_each(peer, &b->peers, link) {
 			if ((peer->flags & RDP_PEER_ACTIVATED) &&
 			    (peer->flags & RDP_PEER_OUTPUT_ENABLED)) {
-				rdp_peer_refresh_region(&transformed_damage, peer->peer);
+				rdp_peer_refresh_frame(&transformed_damage,
+						       peer->peer, b->frame_seq);
 			}
 		}
 		pixman_region32_fini(&transformed_damage);
@@ -698,6 +1099,8 @@ rdp_destroy(struct weston_backend *backend)
 
 	freerdp_listener_free(b->listener);
 
+	rdp_encode_cache_fini(&b->encode_cache);
+
 	free(b->server_cert);
 	free(b->server_key);
 	free(b->rdp_key);
@@ -755,33 +1158,28 @@ rdp_peer_context_new(freerdp_peer* client, RdpPeerContext* context)
 	context->loop_task_event_source = NULL;
 	wl_list_init(&context->loop_task_list);
 
-	context->rfx_context = rfx_context_new(TRUE);
+	context->rfx_context =
+		rdp_rfx_context_new(freerdp_settings_get_uint32(client->context->settings, FreeRDP_DesktopWidth),
+				    freerdp_settings_get_uint32(client->context->settings, FreeRDP_DesktopHeight));
 	if (!context->rfx_context)
 		return FALSE;
 
-#if USE_FREERDP_VERSION >= 3
-	rfx_context_set_mode(context->rfx_context, RLGR3);
-	rfx_context_reset(context->rfx_context,
-			  freerdp_settings_get_uint32(client->context->settings, FreeRDP_DesktopWidth),
-			  freerdp_settings_get_uint32(client->context->settings, FreeRDP_DesktopHeight));
-#else
-	context->rfx_context->mode = RLGR3;
-	context->rfx_context->width = client->context->settings->DesktopWidth;
-	context->rfx_context->height = client->context->settings->DesktopHeight;
-#endif
-	rfx_context_set_pixel_format(context->rfx_context, DEFAULT_PIXEL_FORMAT);
-
-	context->nsc_context = nsc_context_new();
+	context->nsc_context = rdp_nsc_context_new();
 	if (!context->nsc_context)
 		goto out_error_nsc;
 
-	nsc_context_set_parameters(context->nsc_context, NSC_COLOR_FORMAT, DEFAULT_PIXEL_FORMAT);
 	context->encode_stream = Stream_New(NULL, 65536);
 	if (!context->encode_stream)
 		goto out_error_stream;
 
+	if (!rdp_peer_encoder_init(context))
+		goto out_error_encoder;
+
 	return TRUE;
 
+out_error_encoder:
+	rdp_peer_encoder_fini(context);
+	Stream_Free(context->encode_stream, TRUE);
 out_error_stream:
 	nsc_context_free(context->nsc_context);
 out_error_nsc:
@@ -814,10 +1212,15 @@ rdp_peer_context_free(freerdp_peer* client, RdpPeerContext* context)
 		b->audio_out_teardown(context->audio_out_private);
 
 	rdp_clipboard_destroy(context);
+	rdp_gfx_close(context);
 
 	if (context->vcm)
 		WTSCloseServer(context->vcm);
 
+	/* Joins the encoder thread, so no more tasks get queued. */
+	rdp_peer_encoder_fini(context);
+	rdp_gfx_destroy(context);
+
 	rdp_destroy_dispatch_task_event_source(context);
 
 	if (context->item.flags & RDP_PEER_ACTIVATED) {
@@ -851,6 +1254,8 @@ rdp_client_activity(int fd, uint32_t mask, void *data)
 			weston_log("failed to check FreeRDP WTS VC file descriptor for %p\n", client);
 			goto out_clean;
 		}
+
+		rdp_gfx_check_channel(peerCtx);
 	}
 
 	return 0;
@@ -1037,7 +1442,7 @@ convert_rdp_keyboard_to_xkb_rule_names(UINT32 KeyboardType,
 		   xkbRuleNames->variant);
 }
 
-static void
+void
 rdp_full_refresh(freerdp_peer *peer, struct rdp_output *output)
 {
 	pixman_box32_t box;
@@ -1054,6 +1459,29 @@ rdp_full_refresh(freerdp_peer *peer, struct rdp_output *output)
 	pixman_region32_fini(&damage);
 }
 
+/* Areas are inclusive rectangles in desktop coordinates. */
+static void
+rdp_peer_refresh_areas(freerdp_peer *peer, struct rdp_output *output,
+		       unsigned int count, const RECTANGLE_16 *areas)
+{
+	pixman_region32_t damage;
+	unsigned int i;
+
+	pixman_region32_init(&damage);
+	for (i = 0; i < count; i++)
+		pixman_region32_union_rect(&damage, &damage,
+					   areas[i].left, areas[i].top,
+					   areas[i].right - areas[i].left + 1,
+					   areas[i].bottom - areas[i].top + 1);
+	pixman_region32_intersect_rect(&damage, &damage, 0, 0,
+				       output->base.current_mode->width,
+				       output->base.current_mode->height);
+
+	rdp_peer_refresh_region(&damage, peer);
+
+	pixman_region32_fini(&damage);
+}
+
 static BOOL
 xf_peer_activate(freerdp_peer* client)
 {
@@ -1133,11 +1561,22 @@ xf_peer_activate(freerdp_peer* client)
 	weston_output = &output->base;
 	width = weston_output->width * weston_output->current_scale;
 	height = weston_output->height * weston_output->current_scale;
-	rfx_context_reset(peerCtx->rfx_context, width, height);
-	nsc_context_reset(peerCtx->nsc_context, width, height);
-
-	if (peersItem->flags & RDP_PEER_ACTIVATED)
+	/* The codecs are reset by the encoder thread before the next frame
+	 * is encoded, frames still in flight are dropped. */
+	pthread_mutex_lock(&peerCtx->encoder.mutex);
+	peerCtx->encoder.reset = true;
+	peerCtx->encoder.width = width;
+	peerCtx->encoder.height = height;
+	peerCtx->encoder.generation++;
+	peerCtx->encoder.rfx_primed = false;
+	pthread_mutex_unlock(&peerCtx->encoder.mutex);
+
+	/* The client starts over from a blank desktop, and frames still
+	 * being encoded are dropped. */
+	if (peersItem->flags & RDP_PEER_ACTIVATED) {
+		rdp_full_refresh(client, output);
 		return TRUE;
+	}
 
 	/* when here it's the first reactivation, we need to setup a little more */
 	rdp_debug(b, "kbd_layout:0x%x kbd_type:0x%x kbd_subType:0x%x kbd_functionKeys:0x%x\n",
@@ -1153,8 +1592,8 @@ xf_peer_activate(freerdp_peer* client)
 
 	keymap = NULL;
 	if (xkbRuleNames.layout) {
-		keymap = xkb_keymap_new_from_names(b->compositor->xkb_context,
-						   &xkbRuleNames, 0);
+		keymap = weston_compositor_get_keymap(b->compositor,
+						      &xkbRuleNames);
 	}
 
 	cl_hostname = freerdp_settings_get_string(settings, FreeRDP_ClientHostname);
@@ -1181,6 +1620,8 @@ xf_peer_activate(freerdp_peer* client)
 		if (rdp_clipboard_init(client) != 0)
 			goto error_exit;
 
+	rdp_gfx_init(peerCtx);
+
 	peersItem->flags |= RDP_PEER_ACTIVATED;
 
 	/* disable pointer on the client side */
@@ -1484,10 +1925,8 @@ xf_extendedMouseEvent(rdpInput *input, UINT16 flags, UINT16 x, UINT16 y)
 static BOOL
 xf_input_synchronize_event(rdpInput *input, UINT32 flags)
 {
-	freerdp_peer *client = input->context->peer;
 	RdpPeerContext *peerCtx = (RdpPeerContext *)input->context;
 	struct rdp_backend *b = peerCtx->rdpBackend;
-	struct rdp_output *output = rdp_get_first_output(b);
 	struct weston_keyboard *keyboard;
 
         rdp_debug_verbose(b, "RDP backend: %s ScrLk:%d, NumLk:%d, CapsLk:%d, KanaLk:%d\n",
@@ -1510,8 +1949,6 @@ xf_input_synchronize_event(rdpInput *input, UINT32 flags)
 					  value);
 	}
 
-	rdp_full_refresh(client, output);
-
 	return TRUE;
 }
 
@@ -1621,12 +2058,42 @@ static BOOL
 xf_suppress_output(rdpContext *context, BYTE allow, const RECTANGLE_16 *area)
 {
 	RdpPeerContext *peerContext = (RdpPeerContext *)context;
+	struct rdp_output *output = rdp_get_first_output(peerContext->rdpBackend);
 
 	if (allow)
 		peerContext->item.flags |= RDP_PEER_OUTPUT_ENABLED;
 	else
 		peerContext->item.flags &= (~RDP_PEER_OUTPUT_ENABLED);
 
+	/* Nothing was sent while the output was suppressed. */
+	if (allow && area && output &&
+	    (peerContext->item.flags & RDP_PEER_ACTIVATED))
+		rdp_peer_refresh_areas(context->peer, output, 1, area);
+
+	return TRUE;
+}
+
+static BOOL
+xf_refresh_rect(rdpContext *context, BYTE count, const RECTANGLE_16 *areas)
+{
+	RdpPeerContext *peerContext = (RdpPeerContext *)context;
+	struct rdp_output *output = rdp_get_first_output(peerContext->rdpBackend);
+
+	if (output && (peerContext->item.flags & RDP_PEER_ACTIVATED))
+		rdp_peer_refresh_areas(context->peer, output, count, areas);
+
+	return TRUE;
+}
+
+static BOOL
+xf_surface_frame_acknowledge(rdpContext *context, UINT32 frameId)
+{
+	RdpPeerContext *peerContext = (RdpPeerContext *)context;
+
+	peerContext->encoder.acked = true;
+	peerContext->encoder.acked_frame_id = frameId;
+	rdp_peer_encoder_kick(peerContext);
+
 	return TRUE;
 }
 
@@ -1788,8 +2255,10 @@ rdp_peer_init(freerdp_peer *client, struct rdp_backend *b)
 	freerdp_settings_set_bool(settings, FreeRDP_RefreshRect, TRUE);
 	freerdp_settings_set_bool(settings, FreeRDP_RemoteFxCodec, b->remotefx_codec);
 	freerdp_settings_set_bool(settings, FreeRDP_NSCodec, TRUE);
+	freerdp_settings_set_bool(settings, FreeRDP_SupportGraphicsPipeline, b->gfx);
 	freerdp_settings_set_bool(settings, FreeRDP_FrameMarkerCommandEnabled, TRUE);
 	freerdp_settings_set_bool(settings, FreeRDP_SurfaceFrameMarkerEnabled, TRUE);
+	freerdp_settings_set_uint32(settings, FreeRDP_FrameAcknowledge, RDP_MAX_UNACKED_FRAMES);
 	freerdp_settings_set_bool(settings, FreeRDP_RedirectClipboard, TRUE);
 	freerdp_settings_set_bool(settings, FreeRDP_HasExtendedMouseEvent, TRUE);
 	freerdp_settings_set_bool(settings, FreeRDP_HasHorizontalWheel, TRUE);
@@ -1804,6 +2273,8 @@ rdp_peer_init(freerdp_peer *client, struct rdp_backend *b)
 	}
 
 	client->context->update->SuppressOutput = (pSuppressOutput)xf_suppress_output;
+	client->context->update->RefreshRect = xf_refresh_rect;
+	client->context->update->SurfaceFrameAcknowledge = xf_surface_frame_acknowledge;
 
 	input = client->context->input;
 	input->SynchronizeEvent = xf_input_synchronize_event;
@@ -1900,6 +2371,7 @@ rdp_backend_create(struct weston_compositor *compositor,
 	b = xzalloc(sizeof *b);
 	b->compositor_tid = gettid();
 	b->compositor = compositor;
+	pthread_mutex_init(&b->encode_cache.mutex, NULL);
 	b->base.shutdown = rdp_shutdown;
 	b->base.destroy = rdp_destroy;
 	b->base.create_output = rdp_output_create;
@@ -1907,6 +2379,7 @@ rdp_backend_create(struct weston_compositor *compositor,
 	b->resizeable = config->resizeable;
 	b->force_no_compression = config->force_no_compression;
 	b->remotefx_codec = config->remotefx_codec;
+	b->gfx = config->gfx;
 	b->audio_in_setup = config->audio_in_setup;
 	b->audio_in_teardown = config->audio_in_teardown;
 	b->audio_out_setup = config->audio_out_setup;
@@ -2063,6 +2536,7 @@ err_free_strings:
 	free(b->rdp_key);
 	free(b->server_cert);
 	free(b->server_key);
+	pthread_mutex_destroy(&b->encode_cache.mutex);
 	free(b);
 	return NULL;
 }
@@ -2080,6 +2554,7 @@ config_init_to_defaults(struct weston_rdp_backend_config *config)
 	config->resizeable = true;
 	config->force_no_compression = 0;
 	config->remotefx_codec = true;
+	config->gfx = false;
 	config->external_listener_fd = -1;
 	config->refresh_rate = RDP_DEFAULT_FREQ;
 	config->audio_in_setup = NULL;
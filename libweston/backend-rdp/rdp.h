@@ -44,9 +44,16 @@
 #include <freerdp/codec/color.h>
 #include <freerdp/codec/rfx.h>
 #include <freerdp/codec/nsc.h>
+#include <freerdp/codec/h264.h>
+#if USE_FREERDP_VERSION >= 3
+#include <freerdp/codec/progressive.h>
+#include <freerdp/codec/region.h>
+#endif
 #include <freerdp/locale/keyboard.h>
 #include <freerdp/channels/wtsvc.h>
+#include <freerdp/channels/drdynvc.h>
 #include <freerdp/server/cliprdr.h>
+#include <freerdp/server/rdpgfx.h>
 
 #include <libweston/libweston.h>
 #include <libweston/backend-rdp.h>
@@ -63,6 +70,12 @@
 #define RDP_MAX_MONITOR 16
 #define DEFAULT_AXIS_STEP_DISTANCE 10
 #define DEFAULT_PIXEL_FORMAT PIXEL_FORMAT_BGRA32
+#define RDP_MAX_UNACKED_FRAMES 2
+#define RDP_GFX_H264_BITRATE 10000000
+
+#ifndef MONITOR_PRIMARY
+#define MONITOR_PRIMARY 0x00000001
+#endif
 
 /* https://docs.microsoft.com/en-us/windows/win32/api/winuser/nf-winuser-getkeyboardtype
  * defines a keyboard type that isn't currently defined in FreeRDP, but is
@@ -89,6 +102,22 @@
 #define XF_KEV_CODE_TYPE		UINT16
 #endif
 
+/* Last frame encoded for the peers that are caught up with the output,
+ * shared by all of them instead of encoding it once per peer. */
+struct rdp_encode_cache {
+	pthread_mutex_t mutex;
+	bool valid;
+	uint32_t seq;
+	bool rfx;
+	int width, height;
+
+	RFX_CONTEXT *rfx_context;
+	NSC_CONTEXT *nsc_context;
+	RFX_RECT *rfx_rects;
+	wStream *stream;
+	SURFACE_BITS_COMMAND cmd;
+};
+
 struct rdp_backend {
 	struct weston_backend base;
 	struct weston_compositor *compositor;
@@ -110,6 +139,7 @@ struct rdp_backend {
 	int resizeable;
 	int force_no_compression;
 	bool remotefx_codec;
+	bool gfx;
 	int external_listener_fd;
 	int rdp_monitor_refresh_rate;
 	pid_t compositor_tid;
@@ -121,6 +151,9 @@ struct rdp_backend {
 
 	uint32_t head_index;
 
+	uint32_t frame_seq;
+	struct rdp_encode_cache encode_cache;
+
 	const struct pixel_format_info **formats;
 	unsigned int formats_count;
 };
@@ -153,6 +186,16 @@ struct rdp_output {
 	pixman_image_t *shadow_surface;
 };
 
+struct rdp_peer_context;
+
+typedef void (*rdp_loop_task_func_t)(bool freeOnly, void *data);
+
+struct rdp_loop_task {
+	struct wl_list link;
+	struct rdp_peer_context *peerCtx;
+	rdp_loop_task_func_t func;
+};
+
 struct rdp_peer_context {
 	rdpContext _p;
 
@@ -163,6 +206,71 @@ struct rdp_peer_context {
 	RFX_RECT *rfx_rects;
 	NSC_CONTEXT *nsc_context;
 
+	/* RemoteFX and NSCodec frames are encoded on a worker thread and sent
+	 * from the display loop. One frame is in flight at a time, damage
+	 * piles up in pending_damage while the worker is busy or the client
+	 * is behind on frame acknowledgements. */
+	struct {
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		bool started;
+		bool destroying;
+		/* protected by mutex */
+		bool job;
+		bool rfx;
+		bool shared;
+		/* frames go over the graphics pipeline, as gfx_codec */
+		bool gfx;
+		uint32_t gfx_codec;
+		uint32_t seq;
+		bool reset;
+		int width, height;
+
+		bool shareable;
+		uint32_t shareable_seq;
+		bool rfx_primed;
+
+		bool busy;
+		uint32_t generation;
+		uint32_t job_generation;
+		pixman_image_t *image;
+		pixman_region32_t damage;
+		pixman_region32_t pending_damage;
+		SURFACE_BITS_COMMAND cmd;
+		struct rdp_loop_task done_task;
+
+		uint32_t frame_id;
+		uint32_t acked_frame_id;
+		bool acked;
+	} encoder;
+
+	/* Graphics pipeline, see rdpgfx.c */
+	struct {
+		RdpgfxServerContext *context;
+		bool opened;
+		/* set once the client confirmed capabilities, codec is the
+		 * best one they allow */
+		bool active;
+		uint32_t codec;
+		bool surface_created;
+		int surface_width, surface_height;
+
+		/* Used by the encoder thread, and by the display loop while
+		 * sending the frame the encoder handed over. */
+		H264_CONTEXT *h264;
+#if USE_FREERDP_VERSION >= 3
+		PROGRESSIVE_CONTEXT *progressive;
+#else
+		RECTANGLE_16 region_rect;
+		RDPGFX_H264_QUANT_QUALITY quant_quality;
+#endif
+		bool has_cmd;
+		RDPGFX_SURFACE_COMMAND cmd;
+		RDPGFX_AVC420_BITMAP_STREAM avc420;
+		RDPGFX_AVC444_BITMAP_STREAM avc444;
+	} gfx;
+
 	struct rdp_peers_item item;
 
 	bool button_state[5];
@@ -198,14 +306,6 @@ struct rdp_peer_context {
 
 typedef struct rdp_peer_context RdpPeerContext;
 
-typedef void (*rdp_loop_task_func_t)(bool freeOnly, void *data);
-
-struct rdp_loop_task {
-	struct wl_list link;
-	RdpPeerContext *peerCtx;
-	rdp_loop_task_func_t func;
-};
-
 #define rdp_debug_verbose(b, ...) \
 	rdp_debug_print(b->verbose, false, __VA_ARGS__)
 #define rdp_debug_verbose_continue(b, ...) \
@@ -274,7 +374,44 @@ rdp_clipboard_init(freerdp_peer *client);
 void
 rdp_clipboard_destroy(RdpPeerContext *peerCtx);
 
+/* rdpgfx.c */
+void
+rdp_gfx_init(RdpPeerContext *peerCtx);
+
+void
+rdp_gfx_check_channel(RdpPeerContext *peerCtx);
+
+void
+rdp_gfx_prepare_surface(RdpPeerContext *peerCtx, int width, int height);
+
+void
+rdp_gfx_reset_codecs(RdpPeerContext *peerCtx, int width, int height);
+
+void
+rdp_gfx_encode(RdpPeerContext *peerCtx);
+
+void
+rdp_gfx_release_frame(RdpPeerContext *peerCtx);
+
+void
+rdp_gfx_send_frame(RdpPeerContext *peerCtx);
+
+void
+rdp_gfx_close(RdpPeerContext *peerCtx);
+
+void
+rdp_gfx_destroy(RdpPeerContext *peerCtx);
+
 /* rdp.c */
+struct rdp_output *
+rdp_get_first_output(struct rdp_backend *b);
+
+void
+rdp_full_refresh(freerdp_peer *peer, struct rdp_output *output);
+
+void
+rdp_peer_encoder_kick(RdpPeerContext *context);
+
 void
 rdp_head_create(struct rdp_backend *backend, rdpMonitor *config);
 
@@ -0,0 +1,651 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rdp.h"
+
+#include "shared/xalloc.h"
+
+/*
+ * The graphics pipeline extension (MS-RDPEGFX) is a dynamic virtual channel
+ * carrying the desktop as a surface, which the client maps to its monitor.
+ * Unlike the surface commands it can carry H.264, so with the gfx option
+ * peers opening it get their frames encoded as AVC444 or AVC420, or as
+ * progressive RemoteFX for clients without H.264 support. Frames are still
+ * encoded on the peer's encoder thread and paced by the frame
+ * acknowledgements of the channel.
+ */
+
+/* The one surface, covering the whole desktop */
+#define RDP_GFX_SURFACE_ID 1
+
+/* Quantization parameter told to clients along with H.264 frames */
+#define RDP_GFX_H264_QP 22
+
+#ifdef RDPGFX_CAPVERSION_107
+#define RDP_GFX_MAX_CAPVERSION RDPGFX_CAPVERSION_107
+#else
+#define RDP_GFX_MAX_CAPVERSION RDPGFX_CAPVERSION_106
+#endif
+
+struct rdp_gfx_caps_task {
+	struct rdp_loop_task task_base;
+	uint32_t codec;
+};
+
+struct rdp_gfx_ack_task {
+	struct rdp_loop_task task_base;
+	uint32_t queue_depth;
+	uint32_t frame_id;
+};
+
+static const char *
+rdp_gfx_codec_name(uint32_t codec)
+{
+	switch (codec) {
+	case RDPGFX_CODECID_AVC444:
+		return "AVC444";
+	case RDPGFX_CODECID_AVC420:
+		return "AVC420";
+	case RDPGFX_CODECID_CAPROGRESSIVE:
+		return "progressive RemoteFX";
+	case RDPGFX_CODECID_UNCOMPRESSED:
+		return "uncompressed";
+	default:
+		return "unknown";
+	}
+}
+
+/* Best codec a capability set allows us to use */
+static uint32_t
+rdp_gfx_codec_for_caps(const RDPGFX_CAPSET *caps)
+{
+	bool avc420 = false, avc444 = false;
+
+	if (caps->version >= RDPGFX_CAPVERSION_10) {
+		avc420 = avc444 = !(caps->flags & RDPGFX_CAPS_FLAG_AVC_DISABLED);
+	} else if (caps->version == RDPGFX_CAPVERSION_81) {
+		avc420 = caps->flags & RDPGFX_CAPS_FLAG_AVC420_ENABLED;
+	}
+
+#if USE_FREERDP_VERSION >= 3
+	if (avc444)
+		return RDPGFX_CODECID_AVC444;
+#endif
+	if (avc420)
+		return RDPGFX_CODECID_AVC420;
+#if USE_FREERDP_VERSION >= 3
+	return RDPGFX_CODECID_CAPROGRESSIVE;
+#else
+	return RDPGFX_CODECID_UNCOMPRESSED;
+#endif
+}
+
+static void
+rdp_gfx_caps_confirmed(bool freeOnly, void *data)
+{
+	struct rdp_gfx_caps_task *task = data;
+	RdpPeerContext *peerCtx = task->task_base.peerCtx;
+	struct rdp_backend *b = peerCtx->rdpBackend;
+	struct rdp_output *output;
+
+	if (!freeOnly && peerCtx->gfx.context) {
+		rdp_debug(b, "RDPGFX: sending frames as %s\n",
+			  rdp_gfx_codec_name(task->codec));
+		peerCtx->gfx.codec = task->codec;
+		peerCtx->gfx.active = true;
+
+		/* The client starts from a blank surface */
+		output = rdp_get_first_output(b);
+		if (output)
+			rdp_full_refresh(peerCtx->item.peer, output);
+	}
+
+	free(task);
+}
+
+/* Called on the RDPGFX channel thread. */
+static UINT
+rdp_gfx_caps_advertise(RdpgfxServerContext *context,
+		       const RDPGFX_CAPS_ADVERTISE_PDU *advertise)
+{
+	RdpPeerContext *peerCtx = context->custom;
+	RDPGFX_CAPSET *caps = NULL;
+	RDPGFX_CAPS_CONFIRM_PDU confirm = { 0 };
+	struct rdp_gfx_caps_task *task;
+	UINT ret;
+	uint16_t i;
+
+	for (i = 0; i < advertise->capsSetCount; i++) {
+		RDPGFX_CAPSET *set = &advertise->capsSets[i];
+
+		if (set->version > RDP_GFX_MAX_CAPVERSION)
+			continue;
+		if (!caps || set->version > caps->version)
+			caps = set;
+	}
+
+	if (!caps) {
+		weston_log("RDPGFX: no capability set in common with the client\n");
+		return CHANNEL_RC_UNSUPPORTED_VERSION;
+	}
+
+	confirm.capsSet = caps;
+	ret = context->CapsConfirm(context, &confirm);
+	if (ret != CHANNEL_RC_OK)
+		return ret;
+
+	task = xzalloc(sizeof *task);
+	task->codec = rdp_gfx_codec_for_caps(caps);
+	rdp_dispatch_task_to_display_loop(peerCtx, rdp_gfx_caps_confirmed,
+					  &task->task_base);
+
+	return CHANNEL_RC_OK;
+}
+
+static void
+rdp_gfx_frame_acknowledged(bool freeOnly, void *data)
+{
+	struct rdp_gfx_ack_task *task = data;
+	RdpPeerContext *peerCtx = task->task_base.peerCtx;
+
+	if (!freeOnly) {
+		/* A client which suspends acknowledgements isn't paced. */
+		peerCtx->encoder.acked =
+			task->queue_depth != SUSPEND_FRAME_ACKNOWLEDGEMENT;
+		peerCtx->encoder.acked_frame_id = task->frame_id;
+		rdp_peer_encoder_kick(peerCtx);
+	}
+
+	free(task);
+}
+
+/* Called on the RDPGFX channel thread. */
+static UINT
+rdp_gfx_frame_acknowledge(RdpgfxServerContext *context,
+			  const RDPGFX_FRAME_ACKNOWLEDGE_PDU *ack)
+{
+	RdpPeerContext *peerCtx = context->custom;
+	struct rdp_gfx_ack_task *task;
+
+	task = xzalloc(sizeof *task);
+	task->queue_depth = ack->queueDepth;
+	task->frame_id = ack->frameId;
+	rdp_dispatch_task_to_display_loop(peerCtx, rdp_gfx_frame_acknowledged,
+					  &task->task_base);
+
+	return CHANNEL_RC_OK;
+}
+
+/** Set up the graphics pipeline for a peer which supports it
+ *
+ * The channel is only opened by rdp_gfx_check_channel(), once the dynamic
+ * virtual channels are ready. Until the client has confirmed capabilities,
+ * frames keep going out as surface commands.
+ */
+void
+rdp_gfx_init(RdpPeerContext *peerCtx)
+{
+	struct rdp_backend *b = peerCtx->rdpBackend;
+	rdpSettings *settings = peerCtx->item.peer->context->settings;
+	RdpgfxServerContext *context;
+
+	if (!b->gfx || !peerCtx->vcm || peerCtx->gfx.context ||
+	    peerCtx->gfx.opened ||
+	    !freerdp_settings_get_bool(settings, FreeRDP_SupportGraphicsPipeline))
+		return;
+
+	context = rdpgfx_server_context_new(peerCtx->vcm);
+	if (!context) {
+		weston_log("RDPGFX: failed to create the server context\n");
+		return;
+	}
+
+	context->custom = peerCtx;
+	context->rdpcontext = &peerCtx->_p;
+	context->CapsAdvertise = rdp_gfx_caps_advertise;
+	context->FrameAcknowledge = rdp_gfx_frame_acknowledge;
+	peerCtx->gfx.context = context;
+}
+
+/** Open the graphics pipeline channel once the client can take it */
+void
+rdp_gfx_check_channel(RdpPeerContext *peerCtx)
+{
+	RdpgfxServerContext *context = peerCtx->gfx.context;
+
+	if (!context || peerCtx->gfx.opened)
+		return;
+
+	if (!WTSVirtualChannelManagerIsChannelJoined(peerCtx->vcm,
+						     DRDYNVC_SVC_CHANNEL_NAME) ||
+	    WTSVirtualChannelManagerGetDrdynvcState(peerCtx->vcm) !=
+	    DRDYNVC_STATE_READY)
+		return;
+
+	peerCtx->gfx.opened = true;
+	if (!context->Open(context)) {
+		weston_log("RDPGFX: failed to open the channel, sending "
+			   "surface commands\n");
+		rdpgfx_server_context_free(context);
+		peerCtx->gfx.context = NULL;
+	}
+}
+
+/** Make sure the client has a surface of the size of the output
+ *
+ * Called before handing a frame to the encoder. A new surface needs new
+ * codec state, which the encoder thread sets up before its next frame.
+ */
+void
+rdp_gfx_prepare_surface(RdpPeerContext *peerCtx, int width, int height)
+{
+	RdpgfxServerContext *context = peerCtx->gfx.context;
+	MONITOR_DEF monitor = { 0 };
+	RDPGFX_RESET_GRAPHICS_PDU reset = { 0 };
+	RDPGFX_CREATE_SURFACE_PDU create = { 0 };
+	RDPGFX_MAP_SURFACE_TO_OUTPUT_PDU map = { 0 };
+	RDPGFX_DELETE_SURFACE_PDU delete = { 0 };
+
+	if (peerCtx->gfx.surface_created &&
+	    peerCtx->gfx.surface_width == width &&
+	    peerCtx->gfx.surface_height == height)
+		return;
+
+	if (peerCtx->gfx.surface_created) {
+		delete.surfaceId = RDP_GFX_SURFACE_ID;
+		context->DeleteSurface(context, &delete);
+	}
+
+	monitor.right = width - 1;
+	monitor.bottom = height - 1;
+	monitor.flags = MONITOR_PRIMARY;
+	reset.width = width;
+	reset.height = height;
+	reset.monitorCount = 1;
+	reset.monitorDefArray = &monitor;
+	context->ResetGraphics(context, &reset);
+
+	create.surfaceId = RDP_GFX_SURFACE_ID;
+	create.width = width;
+	create.height = height;
+	create.pixelFormat = GFX_PIXEL_FORMAT_XRGB_8888;
+	context->CreateSurface(context, &create);
+
+	map.surfaceId = RDP_GFX_SURFACE_ID;
+	context->MapSurfaceToOutput(context, &map);
+
+	peerCtx->gfx.surface_created = true;
+	peerCtx->gfx.surface_width = width;
+	peerCtx->gfx.surface_height = height;
+
+	pthread_mutex_lock(&peerCtx->encoder.mutex);
+	peerCtx->encoder.reset = true;
+	peerCtx->encoder.width = width;
+	peerCtx->encoder.height = height;
+	pthread_mutex_unlock(&peerCtx->encoder.mutex);
+}
+
+/* Called on the encoder thread. */
+void
+rdp_gfx_reset_codecs(RdpPeerContext *peerCtx, int width, int height)
+{
+	if (peerCtx->gfx.h264)
+		h264_context_reset(peerCtx->gfx.h264, width, height);
+#if USE_FREERDP_VERSION >= 3
+	if (peerCtx->gfx.progressive)
+		progressive_context_reset(peerCtx->gfx.progressive);
+#endif
+}
+
+static bool
+rdp_gfx_ensure_h264(RdpPeerContext *peerCtx, int width, int height)
+{
+	struct rdp_backend *b = peerCtx->rdpBackend;
+	H264_CONTEXT *h264;
+
+	if (peerCtx->gfx.h264)
+		return true;
+
+	h264 = h264_context_new(TRUE);
+	if (!h264)
+		return false;
+
+	h264_context_set_option(h264, H264_CONTEXT_OPTION_RATECONTROL,
+				H264_RATECONTROL_VBR);
+	h264_context_set_option(h264, H264_CONTEXT_OPTION_BITRATE,
+				RDP_GFX_H264_BITRATE);
+	h264_context_set_option(h264, H264_CONTEXT_OPTION_FRAMERATE,
+				b->rdp_monitor_refresh_rate);
+	h264_context_set_option(h264, H264_CONTEXT_OPTION_QP,
+				RDP_GFX_H264_QP);
+#if USE_FREERDP_VERSION >= 3
+	/* Encodes through VA-API where FreeRDP's encoder supports it */
+	h264_context_set_option(h264, H264_CONTEXT_OPTION_HW_ACCEL, TRUE);
+#endif
+
+	if (!h264_context_reset(h264, width, height)) {
+		h264_context_free(h264);
+		return false;
+	}
+
+	peerCtx->gfx.h264 = h264;
+
+	return true;
+}
+
+#if USE_FREERDP_VERSION < 3
+/* FreeRDP 2 leaves the metablock to the caller */
+static void
+rdp_gfx_set_metablock(RdpPeerContext *peerCtx, RDPGFX_H264_METABLOCK *meta,
+		      pixman_region32_t *damage)
+{
+	RECTANGLE_16 *rect = &peerCtx->gfx.region_rect;
+	RDPGFX_H264_QUANT_QUALITY *quality = &peerCtx->gfx.quant_quality;
+
+	rect->left = damage->extents.x1;
+	rect->top = damage->extents.y1;
+	rect->right = damage->extents.x2;
+	rect->bottom = damage->extents.y2;
+
+	quality->qp = RDP_GFX_H264_QP;
+	quality->p = 0;
+	quality->qualityVal = 100 - RDP_GFX_H264_QP;
+
+	meta->numRegionRects = 1;
+	meta->regionRects = rect;
+	meta->quantQualityVals = quality;
+}
+#endif
+
+static INT32
+rdp_gfx_encode_avc420(RdpPeerContext *peerCtx, const BYTE *data,
+		      UINT32 stride, int width, int height,
+		      pixman_region32_t *damage)
+{
+	RDPGFX_AVC420_BITMAP_STREAM *avc420 = &peerCtx->gfx.avc420;
+	RDPGFX_SURFACE_COMMAND *cmd = &peerCtx->gfx.cmd;
+	INT32 ret;
+
+	memset(avc420, 0, sizeof *avc420);
+#if USE_FREERDP_VERSION >= 3
+	RECTANGLE_16 rect = {
+		.left = damage->extents.x1,
+		.top = damage->extents.y1,
+		.right = damage->extents.x2,
+		.bottom = damage->extents.y2,
+	};
+
+	ret = avc420_compress(peerCtx->gfx.h264, data, PIXEL_FORMAT_BGRX32,
+			      stride, width, height, &rect,
+			      &avc420->data, &avc420->length, &avc420->meta);
+#else
+	ret = avc420_compress(peerCtx->gfx.h264, data, PIXEL_FORMAT_BGRX32,
+			      stride, width, height,
+			      &avc420->data, &avc420->length);
+	rdp_gfx_set_metablock(peerCtx, &avc420->meta, damage);
+#endif
+
+	cmd->extra = avc420;
+
+	return ret;
+}
+
+#if USE_FREERDP_VERSION >= 3
+static INT32
+rdp_gfx_encode_avc444(RdpPeerContext *peerCtx, const BYTE *data,
+		      UINT32 stride, int width, int height,
+		      pixman_region32_t *damage)
+{
+	RDPGFX_AVC444_BITMAP_STREAM *avc444 = &peerCtx->gfx.avc444;
+	RDPGFX_AVC420_BITMAP_STREAM *main = &avc444->bitstream[0];
+	RDPGFX_SURFACE_COMMAND *cmd = &peerCtx->gfx.cmd;
+	RECTANGLE_16 rect = {
+		.left = damage->extents.x1,
+		.top = damage->extents.y1,
+		.right = damage->extents.x2,
+		.bottom = damage->extents.y2,
+	};
+	INT32 ret;
+
+	memset(avc444, 0, sizeof *avc444);
+	ret = avc444_compress(peerCtx->gfx.h264, data, PIXEL_FORMAT_BGRX32,
+			      stride, width, height, 1, &rect, &avc444->LC,
+			      &main->data, &main->length,
+			      &avc444->bitstream[1].data,
+			      &avc444->bitstream[1].length,
+			      &main->meta, &avc444->bitstream[1].meta);
+
+	/* Size of the first stream with its metablock, see
+	 * RFX_AVC444_BITMAP_STREAM in MS-RDPEGFX */
+	avc444->cbAvc420EncodedBitstream1 =
+		4 + main->meta.numRegionRects * (8 + 2) + main->length;
+	cmd->extra = avc444;
+
+	return ret;
+}
+
+static INT32
+rdp_gfx_encode_progressive(RdpPeerContext *peerCtx, const BYTE *data,
+			   UINT32 stride, int width, int height,
+			   pixman_region32_t *damage)
+{
+	RDPGFX_SURFACE_COMMAND *cmd = &peerCtx->gfx.cmd;
+	pixman_box32_t *rects;
+	RECTANGLE_16 rect;
+	REGION16 region;
+	int nrects, i;
+	int ret;
+
+	if (!peerCtx->gfx.progressive) {
+		peerCtx->gfx.progressive = progressive_context_new(TRUE);
+		if (!peerCtx->gfx.progressive)
+			return -1;
+	}
+
+	region16_init(&region);
+	rects = pixman_region32_rectangles(damage, &nrects);
+	for (i = 0; i < nrects; i++) {
+		rect.left = rects[i].x1;
+		rect.top = rects[i].y1;
+		rect.right = rects[i].x2;
+		rect.bottom = rects[i].y2;
+		region16_union_rect(&region, &region, &rect);
+	}
+
+	ret = progressive_compress(peerCtx->gfx.progressive, data,
+				   stride * height, PIXEL_FORMAT_BGRX32,
+				   width, height, stride, &region,
+				   &cmd->data, &cmd->length);
+	region16_uninit(&region);
+
+	return ret < 0 ? ret : 1;
+}
+#endif
+
+static INT32
+rdp_gfx_encode_uncompressed(RdpPeerContext *peerCtx, const BYTE *data,
+			    UINT32 stride, pixman_region32_t *damage)
+{
+	RDPGFX_SURFACE_COMMAND *cmd = &peerCtx->gfx.cmd;
+	wStream *stream = peerCtx->encode_stream;
+	size_t row = (damage->extents.x2 - damage->extents.x1) * 4;
+	int y;
+
+	cmd->left = damage->extents.x1;
+	cmd->top = damage->extents.y1;
+	cmd->right = damage->extents.x2;
+	cmd->bottom = damage->extents.y2;
+
+	Stream_SetPosition(stream, 0);
+	if (!Stream_EnsureCapacity(stream, row * (cmd->bottom - cmd->top)))
+		return -1;
+
+	for (y = cmd->top; y < (int)cmd->bottom; y++)
+		Stream_Write(stream, data + y * stride + cmd->left * 4, row);
+
+	cmd->data = Stream_Buffer(stream);
+	cmd->length = Stream_GetPosition(stream);
+
+	return 1;
+}
+
+/** Encode the damage of the encoder image for the graphics pipeline
+ *
+ * Called on the encoder thread. Leaves gfx.has_cmd set if there is a
+ * surface command to send.
+ */
+void
+rdp_gfx_encode(RdpPeerContext *peerCtx)
+{
+	pixman_image_t *image = peerCtx->encoder.image;
+	pixman_region32_t *damage = &peerCtx->encoder.damage;
+	RDPGFX_SURFACE_COMMAND *cmd = &peerCtx->gfx.cmd;
+	uint32_t codec = peerCtx->encoder.gfx_codec;
+	const BYTE *data = (const BYTE *)pixman_image_get_data(image);
+	UINT32 stride = pixman_image_get_stride(image);
+	int width = pixman_image_get_width(image);
+	int height = pixman_image_get_height(image);
+	INT32 ret = -1;
+
+	peerCtx->gfx.has_cmd = false;
+
+	memset(cmd, 0, sizeof *cmd);
+	cmd->surfaceId = RDP_GFX_SURFACE_ID;
+	cmd->codecId = codec;
+	cmd->format = PIXEL_FORMAT_BGRX32;
+	cmd->right = width;
+	cmd->bottom = height;
+
+	switch (codec) {
+	case RDPGFX_CODECID_AVC420:
+		if (rdp_gfx_ensure_h264(peerCtx, width, height))
+			ret = rdp_gfx_encode_avc420(peerCtx, data, stride,
+						    width, height, damage);
+		break;
+#if USE_FREERDP_VERSION >= 3
+	case RDPGFX_CODECID_AVC444:
+		if (rdp_gfx_ensure_h264(peerCtx, width, height))
+			ret = rdp_gfx_encode_avc444(peerCtx, data, stride,
+						    width, height, damage);
+		break;
+	case RDPGFX_CODECID_CAPROGRESSIVE:
+		ret = rdp_gfx_encode_progressive(peerCtx, data, stride,
+						 width, height, damage);
+		break;
+#endif
+	default:
+		ret = rdp_gfx_encode_uncompressed(peerCtx, data, stride,
+						  damage);
+		break;
+	}
+
+	if (ret < 0) {
+		weston_log("RDPGFX: failed to encode a frame as %s\n",
+			   rdp_gfx_codec_name(codec));
+		rdp_gfx_release_frame(peerCtx);
+		return;
+	}
+
+	cmd->width = cmd->right - cmd->left;
+	cmd->height = cmd->bottom - cmd->top;
+	/* Nothing new for the encoder, the client keeps its frame. */
+	peerCtx->gfx.has_cmd = ret > 0;
+}
+
+/** Free what the codecs allocated for the last frame */
+void
+rdp_gfx_release_frame(RdpPeerContext *peerCtx)
+{
+#if USE_FREERDP_VERSION >= 3
+	switch (peerCtx->gfx.cmd.codecId) {
+	case RDPGFX_CODECID_AVC420:
+		free_h264_metablock(&peerCtx->gfx.avc420.meta);
+		break;
+	case RDPGFX_CODECID_AVC444:
+		free_h264_metablock(&peerCtx->gfx.avc444.bitstream[0].meta);
+		free_h264_metablock(&peerCtx->gfx.avc444.bitstream[1].meta);
+		break;
+	default:
+		break;
+	}
+#endif
+	peerCtx->gfx.has_cmd = false;
+}
+
+/** Send the frame rdp_gfx_encode() left, on the display loop */
+void
+rdp_gfx_send_frame(RdpPeerContext *peerCtx)
+{
+	RdpgfxServerContext *context = peerCtx->gfx.context;
+	RDPGFX_START_FRAME_PDU start = { 0 };
+	RDPGFX_END_FRAME_PDU end = { 0 };
+
+	if (context && peerCtx->gfx.has_cmd) {
+		start.frameId = ++peerCtx->encoder.frame_id;
+		end.frameId = start.frameId;
+		context->SurfaceFrameCommand(context, &peerCtx->gfx.cmd,
+					     &start, &end);
+	}
+
+	rdp_gfx_release_frame(peerCtx);
+}
+
+/** Close the graphics pipeline channel, before the channel manager goes */
+void
+rdp_gfx_close(RdpPeerContext *peerCtx)
+{
+	RdpgfxServerContext *context = peerCtx->gfx.context;
+
+	if (!context)
+		return;
+
+	if (peerCtx->gfx.opened)
+		context->Close(context);
+	rdpgfx_server_context_free(context);
+	peerCtx->gfx.context = NULL;
+	peerCtx->gfx.active = false;
+}
+
+/** Free the codecs, once the encoder thread is gone */
+void
+rdp_gfx_destroy(RdpPeerContext *peerCtx)
+{
+	rdp_gfx_release_frame(peerCtx);
+
+	if (peerCtx->gfx.h264)
+		h264_context_free(peerCtx->gfx.h264);
+#if USE_FREERDP_VERSION >= 3
+	if (peerCtx->gfx.progressive)
+		progressive_context_free(peerCtx->gfx.progressive);
+#endif
+}
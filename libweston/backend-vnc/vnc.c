@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/input.h>
 #include <netinet/in.h>
 #include <pwd.h>
@@ -46,6 +47,9 @@
 #include <aml.h>
 #include <neatvnc.h>
 #include <drm_fourcc.h>
+#ifdef HAVE_GBM
+#include <gbm.h>
+#endif
 
 #include "shared/helpers.h"
 #include "shared/xalloc.h"
@@ -59,6 +63,7 @@
 #include "shared/weston-egl-ext.h"
 
 #define DEFAULT_AXIS_STEP_DISTANCE 10
+#define VNC_TILE_SIZE 64
 
 struct vnc_output;
 
@@ -78,6 +83,11 @@ struct vnc_backend {
 
 	const struct pixel_format_info **formats;
 	unsigned int formats_count;
+
+	/* Imports the GL renderer's dmabufs for neatvnc's H.264 encoder,
+	 * NULL when encoding on the CPU. */
+	struct gbm_device *gbm;
+	int gbm_fd;
 };
 
 struct vnc_output {
@@ -90,6 +100,21 @@ struct vnc_output {
 
 	struct nvnc_fb_pool *fb_pool;
 
+	/* Hashes of the VNC_TILE_SIZE tiles last fed to neatvnc, used to
+	 * drop damage over content that did not actually change. */
+	struct {
+		uint64_t *hashes;
+		int width, height;
+		bool valid;
+	} tiles;
+
+	/* GPU rendered buffers fed to neatvnc instead of the fb_pool ones,
+	 * so that H.264 clients get them encoded in hardware. */
+	struct {
+		bool enabled;
+		struct wl_list buffers; /* vnc_gpu_buffer::link */
+	} gpu;
+
 	struct wl_list peers;
 
 	bool resizeable;
@@ -108,6 +133,16 @@ struct vnc_head {
 	struct weston_head base;
 };
 
+struct vnc_gpu_buffer {
+	struct vnc_output *output;
+	struct wl_list link;
+	struct nvnc_fb *fb;
+	struct weston_renderbuffer *renderbuffer;
+	/* neatvnc holds the buffer last fed to it, and those it is still
+	 * encoding. */
+	bool held;
+};
+
 static void
 vnc_output_destroy(struct weston_output *base);
 
@@ -367,7 +402,7 @@ vnc_log_desktop_layout(struct vnc_backend *backend,
 	uint8_t num_displays = nvnc_desktop_layout_get_display_count(layout);
 	char timestr[128];
 
-	if (!weston_log_scope_is_enabled(backend->debug))
+	if (!weston_log_scope_enabled(backend->debug))
 		return;
 
 	weston_log_scope_timestamp(backend->debug, timestr, sizeof timestr);
@@ -658,7 +693,7 @@ vnc_log_damage(struct vnc_backend *backend, pixman_region32_t *buffer_damage,
 {
 	char timestr[128];
 
-	if (!weston_log_scope_is_enabled(backend->debug))
+	if (!weston_log_scope_enabled(backend->debug))
 		return;
 
 	weston_log_scope_timestamp(backend->debug, timestr, sizeof timestr);
@@ -672,6 +707,248 @@ vnc_log_damage(struct vnc_backend *backend, pixman_region32_t *buffer_damage,
 	weston_log_scope_printf(backend->debug, "\n\n");
 }
 
+static void
+vnc_output_reset_tiles(struct vnc_output *output, int width, int height)
+{
+	free(output->tiles.hashes);
+
+	output->tiles.width = DIV_ROUND_UP(width, VNC_TILE_SIZE);
+	output->tiles.height = DIV_ROUND_UP(height, VNC_TILE_SIZE);
+	output->tiles.hashes = xcalloc(output->tiles.width *
+				       output->tiles.height,
+				       sizeof *output->tiles.hashes);
+	output->tiles.valid = false;
+}
+
+static uint64_t
+vnc_hash_tile(const uint32_t *pixels, int stride, const pixman_box32_t *box)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	int x, y;
+
+	/* FNV-1a over whole pixels rather than bytes */
+	for (y = box->y1; y < box->y2; y++) {
+		const uint32_t *row = pixels + y * stride;
+
+		for (x = box->x1; x < box->x2; x++) {
+			hash ^= row[x];
+			hash *= 0x100000001b3ull;
+		}
+	}
+
+	return hash;
+}
+
+/* Removes the tiles whose content is the same as in the previous frame
+ * from damage, which is in output-local coordinates. */
+static void
+vnc_output_filter_damage(struct vnc_output *output, struct nvnc_fb *fb,
+			 pixman_region32_t *damage)
+{
+	const uint32_t *pixels = nvnc_fb_get_addr(fb);
+	int width = nvnc_fb_get_width(fb);
+	int height = nvnc_fb_get_height(fb);
+	pixman_box32_t full = { 0, 0, width, height };
+	pixman_region32_t unchanged;
+	pixman_box32_t *extents;
+	bool full_damage;
+	int tx, ty;
+
+	full_damage = pixman_region32_contains_rectangle(damage, &full) ==
+		      PIXMAN_REGION_IN;
+	extents = pixman_region32_extents(damage);
+	pixman_region32_init(&unchanged);
+
+	for (ty = extents->y1 / VNC_TILE_SIZE;
+	     ty < output->tiles.height &&
+	     ty * VNC_TILE_SIZE < extents->y2; ty++) {
+		for (tx = extents->x1 / VNC_TILE_SIZE;
+		     tx < output->tiles.width &&
+		     tx * VNC_TILE_SIZE < extents->x2; tx++) {
+			uint64_t *stored;
+			uint64_t hash;
+			pixman_box32_t tile = {
+				.x1 = tx * VNC_TILE_SIZE,
+				.y1 = ty * VNC_TILE_SIZE,
+				.x2 = MIN((tx + 1) * VNC_TILE_SIZE, width),
+				.y2 = MIN((ty + 1) * VNC_TILE_SIZE, height),
+			};
+
+			if (pixman_region32_contains_rectangle(damage, &tile) ==
+			    PIXMAN_REGION_OUT)
+				continue;
+
+			stored = &output->tiles.hashes[ty * output->tiles.width + tx];
+			hash = vnc_hash_tile(pixels, width, &tile);
+			if (output->tiles.valid && *stored == hash)
+				pixman_region32_union_rect(&unchanged, &unchanged,
+							   tile.x1, tile.y1,
+							   tile.x2 - tile.x1,
+							   tile.y2 - tile.y1);
+			*stored = hash;
+		}
+	}
+
+	/* Tiles outside the damage keep their content and so their hash,
+	 * all hashes are known once every tile got hashed at least once. */
+	if (full_damage)
+		output->tiles.valid = true;
+
+	pixman_region32_subtract(damage, damage, &unchanged);
+	pixman_region32_fini(&unchanged);
+}
+
+#ifdef HAVE_GBM
+static void
+vnc_gpu_buffer_release(struct nvnc_fb *fb, void *data)
+{
+	struct vnc_gpu_buffer *buffer = data;
+
+	buffer->held = false;
+}
+
+static struct vnc_gpu_buffer *
+vnc_gpu_buffer_create(struct vnc_output *output)
+{
+	struct vnc_backend *backend = output->backend;
+	struct weston_renderer *renderer = backend->compositor->renderer;
+	uint64_t modifier = DRM_FORMAT_MOD_LINEAR;
+	struct gbm_import_fd_modifier_data data = { 0 };
+	struct linux_dmabuf_memory *dmabuf;
+	struct dmabuf_attributes *attributes;
+	struct weston_renderbuffer *renderbuffer;
+	struct vnc_gpu_buffer *buffer;
+	struct gbm_bo *bo;
+	struct nvnc_fb *fb;
+	int i;
+
+	dmabuf = renderer->dmabuf_alloc(renderer, output->base.width,
+					output->base.height,
+					backend->formats[0]->format,
+					&modifier, 1);
+	if (!dmabuf)
+		return NULL;
+
+	attributes = dmabuf->attributes;
+	data.width = attributes->width;
+	data.height = attributes->height;
+	data.format = attributes->format;
+	data.num_fds = attributes->n_planes;
+	for (i = 0; i < attributes->n_planes; i++) {
+		data.fds[i] = attributes->fd[i];
+		data.strides[i] = attributes->stride[i];
+		data.offsets[i] = attributes->offset[i];
+	}
+	data.modifier = attributes->modifier;
+
+	bo = gbm_bo_import(backend->gbm, GBM_BO_IMPORT_FD_MODIFIER, &data,
+			   GBM_BO_USE_RENDERING);
+	if (!bo) {
+		dmabuf->destroy(dmabuf);
+		return NULL;
+	}
+
+	/* Takes the bo, unless neatvnc was built without GBM. */
+	fb = nvnc_fb_from_gbm_bo(bo);
+	if (!fb) {
+		gbm_bo_destroy(bo);
+		dmabuf->destroy(dmabuf);
+		return NULL;
+	}
+
+	renderbuffer = renderer->create_renderbuffer_dmabuf(&output->base,
+							    dmabuf);
+	if (!renderbuffer) {
+		nvnc_fb_unref(fb);
+		dmabuf->destroy(dmabuf);
+		return NULL;
+	}
+
+	/* This is a new buffer, so the whole surface is damaged. */
+	pixman_region32_copy(&renderbuffer->damage, &output->base.region);
+
+	buffer = xzalloc(sizeof *buffer);
+	buffer->output = output;
+	buffer->fb = fb;
+	buffer->renderbuffer = renderbuffer;
+	nvnc_fb_set_release_fn(fb, vnc_gpu_buffer_release, buffer);
+	wl_list_insert(output->gpu.buffers.prev, &buffer->link);
+
+	return buffer;
+}
+
+static void
+vnc_gpu_buffer_destroy(struct vnc_gpu_buffer *buffer)
+{
+	struct weston_output *base = &buffer->output->base;
+	struct weston_renderer *renderer = base->compositor->renderer;
+
+	/* neatvnc may keep its reference until it is fed another buffer */
+	nvnc_fb_set_release_fn(buffer->fb, NULL, NULL);
+	nvnc_fb_unref(buffer->fb);
+
+	renderer->remove_renderbuffer_dmabuf(base, buffer->renderbuffer);
+	weston_renderbuffer_unref(buffer->renderbuffer);
+
+	wl_list_remove(&buffer->link);
+	free(buffer);
+}
+
+/* Renders into a dmabuf neatvnc gets as a GBM buffer, which its H.264
+ * encoder imports without the pixels going through the CPU. Other
+ * encodings map the buffer. Returns false if there is no such buffer. */
+static bool
+vnc_update_gpu_buffer(struct vnc_output *output, pixman_region32_t *damage)
+{
+	struct vnc_gpu_buffer *buffer, *free_buffer = NULL;
+	pixman_region32_t local_damage;
+	pixman_region16_t nvnc_damage;
+
+	wl_list_for_each(buffer, &output->gpu.buffers, link) {
+		if (!buffer->held) {
+			free_buffer = buffer;
+			break;
+		}
+	}
+	if (!free_buffer)
+		free_buffer = vnc_gpu_buffer_create(output);
+	if (!free_buffer)
+		return false;
+
+	vnc_log_damage(output->backend, &free_buffer->renderbuffer->damage,
+		       damage);
+
+	weston_renderer_repaint_output(&output->base, damage,
+				       free_buffer->renderbuffer);
+
+	pixman_region32_init(&local_damage);
+	weston_region_global_to_output(&local_damage, &output->base, damage);
+	pixman_region_init(&nvnc_damage);
+	vnc_region32_to_region16(&nvnc_damage, &local_damage);
+
+	/* Tiles are not hashed here, that would need the pixels read back. */
+	free_buffer->held = true;
+	nvnc_display_feed_buffer(output->display, free_buffer->fb,
+				 &nvnc_damage);
+
+	pixman_region32_fini(&local_damage);
+	pixman_region_fini(&nvnc_damage);
+
+	return true;
+}
+#endif
+
+static void
+vnc_output_destroy_gpu_buffers(struct vnc_output *output)
+{
+#ifdef HAVE_GBM
+	struct vnc_gpu_buffer *buffer, *tmp;
+
+	wl_list_for_each_safe(buffer, tmp, &output->gpu.buffers, link)
+		vnc_gpu_buffer_destroy(buffer);
+#endif
+}
+
 static void
 vnc_update_buffer(struct nvnc_display *display, struct pixman_region32 *damage)
 {
@@ -684,6 +961,18 @@ vnc_update_buffer(struct nvnc_display *display, struct pixman_region32 *damage)
 	pixman_region16_t nvnc_damage;
 	struct nvnc_fb *fb;
 
+#ifdef HAVE_GBM
+	if (output->gpu.enabled) {
+		if (vnc_update_gpu_buffer(output, damage))
+			return;
+
+		weston_log("VNC: failed to create a GPU buffer, encoding "
+			   "on the CPU from now on\n");
+		vnc_output_destroy_gpu_buffers(output);
+		output->gpu.enabled = false;
+	}
+#endif
+
 	fb = nvnc_fb_pool_acquire(output->fb_pool);
 	assert(fb);
 
@@ -729,17 +1018,22 @@ vnc_update_buffer(struct nvnc_display *display, struct pixman_region32 *damage)
 
 	vnc_log_damage(backend, &renderbuffer->damage, damage);
 
-	ec->renderer->repaint_output(&output->base, damage, renderbuffer);
+	weston_renderer_repaint_output(&output->base, damage, renderbuffer);
 
 	/* Convert to local coordinates */
 	pixman_region32_init(&local_damage);
 	weston_region_global_to_output(&local_damage, &output->base, damage);
 
+	vnc_output_filter_damage(output, fb, &local_damage);
+
 	/* Convert to 16-bit */
 	pixman_region_init(&nvnc_damage);
 	vnc_region32_to_region16(&nvnc_damage, &local_damage);
 
-	nvnc_display_feed_buffer(output->display, fb, &nvnc_damage);
+	/* The pixels neatvnc already has are identical when nothing is
+	 * left, so keep it on its current buffer. */
+	if (pixman_region32_not_empty(&local_damage))
+		nvnc_display_feed_buffer(output->display, fb, &nvnc_damage);
 	nvnc_fb_unref(fb);
 	pixman_region32_fini(&local_damage);
 	pixman_region_fini(&nvnc_damage);
@@ -846,6 +1140,10 @@ vnc_output_enable(struct weston_output *base)
 					   output->base.height,
 					   backend->formats[0]->format,
 					   output->base.width);
+	vnc_output_reset_tiles(output, output->base.width, output->base.height);
+
+	wl_list_init(&output->gpu.buffers);
+	output->gpu.enabled = backend->gbm != NULL;
 
 	output->display = nvnc_display_new(0, 0);
 
@@ -871,6 +1169,9 @@ vnc_output_disable(struct weston_output *base)
 	nvnc_remove_display(backend->server, output->display);
 	nvnc_display_unref(output->display);
 	nvnc_fb_pool_unref(output->fb_pool);
+	vnc_output_destroy_gpu_buffers(output);
+	free(output->tiles.hashes);
+	output->tiles.hashes = NULL;
 
 	switch (renderer->type) {
 	case WESTON_RENDERER_PIXMAN:
@@ -949,6 +1250,13 @@ vnc_destroy(struct weston_backend *base)
 
 	xkb_keymap_unref(backend->xkb_keymap);
 
+#ifdef HAVE_GBM
+	if (backend->gbm) {
+		gbm_device_destroy(backend->gbm);
+		close(backend->gbm_fd);
+	}
+#endif
+
 	if (backend->debug)
 		weston_log_scope_destroy(backend->debug);
 
@@ -1078,6 +1386,8 @@ vnc_switch_mode(struct weston_output *base, struct weston_mode *target_mode)
 	nvnc_fb_pool_resize(output->fb_pool, target_mode->width,
 			    target_mode->height, DRM_FORMAT_XRGB8888,
 			    target_mode->width);
+	vnc_output_destroy_gpu_buffers(output);
+	vnc_output_reset_tiles(output, target_mode->width, target_mode->height);
 
 	return 0;
 }
@@ -1128,6 +1438,41 @@ vnc_aml_dispatch(int fd, uint32_t mask, void *data)
 	return 0;
 }
 
+static void
+vnc_backend_init_gpu(struct vnc_backend *backend, const char *device)
+{
+#ifdef HAVE_GBM
+	struct weston_renderer *renderer = backend->compositor->renderer;
+
+	if (renderer->type != WESTON_RENDERER_GL || !renderer->dmabuf_alloc ||
+	    !renderer->create_renderbuffer_dmabuf) {
+		weston_log("VNC: H.264 encoding in hardware needs the GL "
+			   "renderer with dmabuf support\n");
+		return;
+	}
+
+	backend->gbm_fd = open(device, O_RDWR | O_CLOEXEC);
+	if (backend->gbm_fd < 0) {
+		weston_log("VNC: failed to open %s: %s\n", device,
+			   strerror(errno));
+		return;
+	}
+
+	backend->gbm = gbm_create_device(backend->gbm_fd);
+	if (!backend->gbm) {
+		weston_log("VNC: failed to create a GBM device on %s\n",
+			   device);
+		close(backend->gbm_fd);
+		return;
+	}
+
+	weston_log("VNC: rendering into dmabufs for H.264 encoding on %s\n",
+		   device);
+#else
+	weston_log("VNC: built without GBM, no H.264 encoding in hardware\n");
+#endif
+}
+
 static struct vnc_backend *
 vnc_backend_create(struct weston_compositor *compositor,
 		   struct weston_vnc_backend_config *config)
@@ -1197,9 +1542,8 @@ vnc_backend_create(struct weston_compositor *compositor,
 	backend->xkb_rule_name.model = strdup(compositor->xkb_names.model);
 	backend->xkb_rule_name.layout = strdup(compositor->xkb_names.layout);
 
-	backend->xkb_keymap = xkb_keymap_new_from_names(
-					backend->compositor->xkb_context,
-					&backend->xkb_rule_name, 0);
+	backend->xkb_keymap = weston_compositor_get_keymap(compositor,
+						&backend->xkb_rule_name);
 
 	loop = wl_display_get_event_loop(backend->compositor->wl_display);
 
@@ -1208,6 +1552,12 @@ vnc_backend_create(struct weston_compositor *compositor,
 		goto err_output;
 	aml_set_default(backend->aml);
 
+	/* neatvnc runs its encoders on the aml thread pool, without workers
+	 * they would all run on the compositor thread. */
+	if (aml_require_workers(backend->aml, -1) < 0)
+		weston_log("VNC: failed to start encoder threads, "
+			   "encoding on the main thread\n");
+
 	fd = aml_get_fd(backend->aml);
 
 	backend->aml_event = wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
@@ -1285,6 +1635,10 @@ vnc_backend_create(struct weston_compositor *compositor,
 		goto err_output;
 	}
 
+	if (config->vaapi_encode)
+		vnc_backend_init_gpu(backend, config->vaapi_device ?:
+					      "/dev/dri/renderD128");
+
 	return backend;
 
 err_output:
@@ -1302,6 +1656,8 @@ config_init_to_defaults(struct weston_vnc_backend_config *config)
 	config->bind_address = NULL;
 	config->port = 5900;
 	config->refresh_rate = VNC_DEFAULT_FREQ;
+	config->vaapi_encode = false;
+	config->vaapi_device = NULL;
 }
 
 WL_EXPORT int
@@ -59,6 +59,7 @@
 #include "shared/timespec-util.h"
 #include "shared/xalloc.h"
 #include "fullscreen-shell-unstable-v1-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
 #include "presentation-time-server-protocol.h"
 #include "linux-dmabuf.h"
@@ -73,6 +74,9 @@
 #define WINDOW_MAX_WIDTH 8192
 #define WINDOW_MAX_HEIGHT 8192
 
+/* Sub-surfaces per output for client dmabufs in passthrough mode */
+#define WAYLAND_OUTPUT_MAX_PLANES 4
+
 static const uint32_t wayland_formats[] = {
 	DRM_FORMAT_ARGB8888,
 };
@@ -88,6 +92,9 @@ struct wayland_backend {
 		struct xdg_wm_base *xdg_wm_base;
 		struct zwp_fullscreen_shell_v1 *fshell;
 		struct wl_shm *shm;
+		struct wl_subcompositor *subcompositor;
+		struct zwp_linux_dmabuf_v1 *dmabuf;
+		struct weston_drm_format_array dmabuf_formats;
 
 		struct wl_list output_list;
 
@@ -97,6 +104,9 @@ struct wayland_backend {
 
 	bool sprawl_across_outputs;
 	bool fullscreen;
+	bool passthrough;
+
+	struct wl_list dmabuf_list;
 
 	struct theme *theme;
 	cairo_device_t *frame_device;
@@ -112,6 +122,38 @@ struct wayland_backend {
 	unsigned int formats_count;
 };
 
+/** A client dmabuf imported into the parent compositor
+ *
+ * Hung off weston_buffer::backend_private, so every client buffer is
+ * imported at most once.
+ */
+struct wayland_dmabuf {
+	struct wl_list link; /* wayland_backend::dmabuf_list */
+
+	struct weston_buffer *buffer;
+	struct wl_listener buffer_destroy_listener;
+
+	/* NULL if the parent compositor cannot take this buffer */
+	struct wl_buffer *parent_buffer;
+
+	/* Held from the attach until the parent releases the buffer */
+	struct weston_buffer_reference busy_ref;
+};
+
+/** A sub-surface of the output surface, used as an overlay plane */
+struct wayland_plane {
+	struct weston_plane base;
+
+	struct wl_surface *surface;
+	struct wl_subsurface *subsurface;
+
+	/* Assigned by wayland_output_assign_planes() for the next repaint */
+	struct wayland_dmabuf *dmabuf;
+	int32_t x, y;
+
+	bool mapped;
+};
+
 struct wayland_output {
 	struct weston_output base;
 	struct wayland_backend *backend;
@@ -141,8 +183,15 @@ struct wayland_output {
 	struct {
 		struct wl_list buffers;
 		struct wl_list free_buffers;
+		/* The next attach must damage everything, e.g. after a
+		 * resize */
+		bool full_damage;
 	} shm;
 
+	/* Ordered from the top of the sub-surface stack */
+	struct wayland_plane planes[WAYLAND_OUTPUT_MAX_PLANES];
+	bool planes_created;
+
 	struct weston_mode mode;
 	struct weston_mode native_mode;
 
@@ -190,6 +239,7 @@ struct wayland_shm_buffer {
 	size_t size;
 	int width;
 	int height;
+	/* The decorations in this buffer are older than the frame's */
 	int frame_damaged;
 
 	struct weston_renderbuffer *renderbuffer;
@@ -311,6 +361,9 @@ wayland_output_get_shm_buffer(struct wayland_output *output)
 	int fd;
 	unsigned char *data;
 
+	/* Released buffers are pushed to the head, so this picks the most
+	 * recently used one: the renderer's per-buffer damage then has the
+	 * least to catch up on. */
 	if (!wl_list_empty(&output->shm.free_buffers)) {
 		sb = container_of(output->shm.free_buffers.next,
 				  struct wayland_shm_buffer, free_link);
@@ -401,8 +454,6 @@ wayland_output_get_shm_buffer(struct wayland_output *output)
 						      area.width, area.height,
 						      (uint32_t *)(data + area.y * stride) + area.x,
 						      stride);
-		pixman_region32_copy(&sb->renderbuffer->damage,
-				     &output->base.region);
 	}
 
 	return sb;
@@ -435,6 +486,21 @@ static const struct wl_callback_listener frame_listener = {
 	frame_done
 };
 
+/* The output surface has no buffer transform or scale, so before
+ * wl_surface.damage_buffer the surface damage is the same. */
+static void
+wayland_output_damage_buffer(struct wayland_output *output,
+			     int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct wl_surface *surface = output->parent.surface;
+
+	if (wl_surface_get_version(surface) >=
+	    WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION)
+		wl_surface_damage_buffer(surface, x, y, width, height);
+	else
+		wl_surface_damage(surface, x, y, width, height);
+}
+
 static void
 draw_initial_frame(struct wayland_output *output)
 {
@@ -448,8 +514,7 @@ draw_initial_frame(struct wayland_output *output)
 		sb->output = NULL;
 
 	wl_surface_attach(output->parent.surface, sb->buffer, 0, 0);
-	wl_surface_damage(output->parent.surface, 0, 0,
-			  sb->width, sb->height);
+	wayland_output_damage_buffer(output, 0, 0, sb->width, sb->height);
 }
 
 #ifdef ENABLE_EGL
@@ -483,6 +548,327 @@ wayland_output_start_repaint_loop(struct weston_output *output_base)
 	return 0;
 }
 
+static void
+wayland_dmabuf_destroy(struct wayland_dmabuf *dmabuf)
+{
+	wl_list_remove(&dmabuf->buffer_destroy_listener.link);
+	dmabuf->buffer->backend_private = NULL;
+
+	weston_buffer_reference(&dmabuf->busy_ref, NULL,
+				BUFFER_WILL_NOT_BE_ACCESSED);
+	if (dmabuf->parent_buffer)
+		wl_buffer_destroy(dmabuf->parent_buffer);
+
+	wl_list_remove(&dmabuf->link);
+	free(dmabuf);
+}
+
+static void
+wayland_dmabuf_handle_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct wayland_dmabuf *dmabuf =
+		container_of(listener, struct wayland_dmabuf,
+			     buffer_destroy_listener);
+
+	wayland_dmabuf_destroy(dmabuf);
+}
+
+static void
+wayland_dmabuf_release(void *data, struct wl_buffer *buffer)
+{
+	struct wayland_dmabuf *dmabuf = data;
+
+	/* May destroy the weston_buffer, and with it this import. */
+	weston_buffer_reference(&dmabuf->busy_ref, NULL,
+				BUFFER_WILL_NOT_BE_ACCESSED);
+}
+
+static const struct wl_buffer_listener dmabuf_buffer_listener = {
+	wayland_dmabuf_release
+};
+
+/** Import a client dmabuf into the parent compositor
+ *
+ * The result is cached with the buffer, including a failure to import:
+ * dmabuf::parent_buffer is then NULL, and the buffer is always composited.
+ */
+static struct wayland_dmabuf *
+wayland_backend_import_dmabuf(struct wayland_backend *b,
+			      struct weston_buffer *buffer)
+{
+	struct linux_dmabuf_buffer *client_dmabuf = buffer->dmabuf;
+	const struct dmabuf_attributes *attributes = &client_dmabuf->attributes;
+	struct zwp_linux_buffer_params_v1 *params;
+	struct weston_drm_format *fmt;
+	struct wayland_dmabuf *dmabuf;
+	int i;
+
+	if (buffer->backend_private)
+		return buffer->backend_private;
+
+	dmabuf = xzalloc(sizeof(*dmabuf));
+	dmabuf->buffer = buffer;
+	dmabuf->buffer_destroy_listener.notify =
+		wayland_dmabuf_handle_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal,
+		      &dmabuf->buffer_destroy_listener);
+	wl_list_insert(&b->dmabuf_list, &dmabuf->link);
+	buffer->backend_private = dmabuf;
+
+	/* Anything not advertised would be a fatal protocol error. */
+	fmt = weston_drm_format_array_find_format(&b->parent.dmabuf_formats,
+						  attributes->format);
+	if (!fmt || !weston_drm_format_has_modifier(fmt, attributes->modifier))
+		return dmabuf;
+
+	params = zwp_linux_dmabuf_v1_create_params(b->parent.dmabuf);
+	for (i = 0; i < attributes->n_planes; i++)
+		zwp_linux_buffer_params_v1_add(params, attributes->fd[i], i,
+					       attributes->offset[i],
+					       attributes->stride[i],
+					       attributes->modifier >> 32,
+					       attributes->modifier & 0xffffffff);
+
+	dmabuf->parent_buffer =
+		zwp_linux_buffer_params_v1_create_immed(params,
+							attributes->width,
+							attributes->height,
+							attributes->format,
+							attributes->flags);
+	zwp_linux_buffer_params_v1_destroy(params);
+	wl_buffer_add_listener(dmabuf->parent_buffer,
+			       &dmabuf_buffer_listener, dmabuf);
+
+	return dmabuf;
+}
+
+static void
+wayland_output_create_planes(struct wayland_output *output)
+{
+	struct wayland_backend *b = output->backend;
+	struct wl_region *empty;
+	int i;
+
+	if (output->planes_created)
+		return;
+
+	/* Input always goes to the output surface underneath. */
+	empty = wl_compositor_create_region(b->parent.compositor);
+
+	for (i = WAYLAND_OUTPUT_MAX_PLANES - 1; i >= 0; i--) {
+		struct wayland_plane *plane = &output->planes[i];
+
+		plane->surface =
+			wl_compositor_create_surface(b->parent.compositor);
+		wl_surface_set_input_region(plane->surface, empty);
+		plane->subsurface =
+			wl_subcompositor_get_subsurface(b->parent.subcompositor,
+							plane->surface,
+							output->parent.surface);
+		if (i < WAYLAND_OUTPUT_MAX_PLANES - 1)
+			wl_subsurface_place_above(plane->subsurface,
+						  output->planes[i + 1].surface);
+		plane->mapped = false;
+	}
+
+	wl_region_destroy(empty);
+	output->planes_created = true;
+}
+
+/* Needed before the output surface goes away, the sub-surfaces are tied to
+ * it. The planes get created again on the next use. */
+static void
+wayland_output_destroy_planes(struct wayland_output *output)
+{
+	int i;
+
+	if (!output->planes_created)
+		return;
+
+	for (i = 0; i < WAYLAND_OUTPUT_MAX_PLANES; i++) {
+		struct wayland_plane *plane = &output->planes[i];
+
+		wl_subsurface_destroy(plane->subsurface);
+		wl_surface_destroy(plane->surface);
+		plane->subsurface = NULL;
+		plane->surface = NULL;
+		plane->dmabuf = NULL;
+		plane->mapped = false;
+	}
+
+	output->planes_created = false;
+}
+
+/** Check whether a paint node can be shown as a sub-surface
+ *
+ * The sub-surface shows the client buffer as is, so the buffer must map
+ * one-to-one to output pixels, entirely inside the output. Positions are
+ * returned in output surface coordinates.
+ */
+static struct wayland_dmabuf *
+wayland_output_plane_dmabuf_for_paint_node(struct wayland_output *output,
+					   struct weston_paint_node *pnode,
+					   int32_t *x, int32_t *y)
+{
+	struct weston_view *ev = pnode->view;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	const struct weston_mode *mode = output->base.current_mode;
+	struct wayland_dmabuf *dmabuf;
+	pixman_box32_t *extents;
+	pixman_box32_t box, view_box;
+
+	if (!buffer || buffer->type != WESTON_BUFFER_DMABUF)
+		return NULL;
+
+	if (ev->alpha != 1.0f)
+		return NULL;
+
+	if (!pnode->valid_transform ||
+	    pnode->transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    pnode->needs_filtering)
+		return NULL;
+
+	box = weston_matrix_transform_rect(&pnode->buffer_to_output_matrix,
+					   (pixman_box32_t) {
+						   0, 0,
+						   buffer->width, buffer->height
+					   });
+	if (box.x2 - box.x1 != buffer->width ||
+	    box.y2 - box.y1 != buffer->height)
+		return NULL;
+
+	if (box.x1 < 0 || box.y1 < 0 ||
+	    box.x2 > mode->width || box.y2 > mode->height)
+		return NULL;
+
+	/* A viewport crop would show more of the buffer than the view. */
+	extents = pixman_region32_extents(&ev->transform.boundingbox);
+	view_box = weston_matrix_transform_rect(&output->base.matrix, *extents);
+	if (view_box.x1 != box.x1 || view_box.y1 != box.y1 ||
+	    view_box.x2 != box.x2 || view_box.y2 != box.y2)
+		return NULL;
+
+	dmabuf = wayland_backend_import_dmabuf(output->backend, buffer);
+	if (!dmabuf->parent_buffer)
+		return NULL;
+
+	*x = box.x1;
+	*y = box.y1;
+	if (output->frame) {
+		int32_t ix, iy;
+
+		frame_interior(output->frame, &ix, &iy, NULL, NULL);
+		*x += ix;
+		*y += iy;
+	}
+
+	return dmabuf;
+}
+
+static void
+wayland_output_assign_planes(struct weston_output *output_base)
+{
+	struct wayland_output *output = to_wayland_output(output_base);
+	struct weston_plane *primary = &output_base->primary_plane;
+	struct weston_paint_node *pnode;
+	pixman_region32_t composited, overlap;
+	int n_planes = 0;
+	int i;
+
+	assert(output);
+
+	for (i = 0; i < WAYLAND_OUTPUT_MAX_PLANES; i++)
+		output->planes[i].dmabuf = NULL;
+
+	/* Views are walked from the top. Sub-surfaces stack above the output
+	 * surface, so a view can only go on one if nothing composited above
+	 * it overlaps it. */
+	pixman_region32_init(&composited);
+	pixman_region32_init(&overlap);
+
+	wl_list_for_each(pnode, &output_base->paint_node_z_order_list,
+			 z_order_link) {
+		struct weston_view *ev = pnode->view;
+		struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+		struct wayland_plane *plane = NULL;
+		struct wayland_dmabuf *dmabuf = NULL;
+		int32_t x, y;
+
+		/* Keep the buffer so that it can move to a plane later. */
+		ev->surface->keep_buffer = buffer &&
+					   buffer->type == WESTON_BUFFER_DMABUF;
+
+		pixman_region32_intersect(&overlap, &composited,
+					  &ev->transform.boundingbox);
+		if (n_planes < WAYLAND_OUTPUT_MAX_PLANES &&
+		    !pixman_region32_not_empty(&overlap))
+			dmabuf = wayland_output_plane_dmabuf_for_paint_node(output,
+									     pnode,
+									     &x, &y);
+
+		if (dmabuf) {
+			plane = &output->planes[n_planes++];
+			plane->dmabuf = dmabuf;
+			plane->x = x;
+			plane->y = y;
+
+			weston_paint_node_move_to_plane(pnode, &plane->base);
+			pnode->psf_flags = WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY;
+		} else {
+			weston_paint_node_move_to_plane(pnode, primary);
+			pnode->psf_flags = 0;
+			pixman_region32_union(&composited, &composited,
+					      &ev->transform.boundingbox);
+		}
+		pnode->need_hole = false;
+	}
+
+	pixman_region32_fini(&overlap);
+	pixman_region32_fini(&composited);
+}
+
+/** Update the sub-surfaces for the planes assigned in this repaint
+ *
+ * The sub-surfaces are synchronized, so this must come before the output
+ * surface commit, which then applies everything at once.
+ */
+static void
+wayland_output_commit_planes(struct wayland_output *output)
+{
+	int i;
+
+	if (!output->base.assign_planes)
+		return;
+
+	for (i = 0; i < WAYLAND_OUTPUT_MAX_PLANES; i++) {
+		struct wayland_plane *plane = &output->planes[i];
+		struct wayland_dmabuf *dmabuf = plane->dmabuf;
+
+		if (dmabuf) {
+			wayland_output_create_planes(output);
+
+			wl_subsurface_set_position(plane->subsurface,
+						   plane->x, plane->y);
+			wl_surface_attach(plane->surface,
+					  dmabuf->parent_buffer, 0, 0);
+			wl_surface_damage(plane->surface, 0, 0,
+					  INT32_MAX, INT32_MAX);
+			wl_surface_commit(plane->surface);
+			weston_buffer_reference(&dmabuf->busy_ref,
+						dmabuf->buffer,
+						BUFFER_MAY_BE_ACCESSED);
+			plane->mapped = true;
+		} else if (plane->mapped) {
+			wl_surface_attach(plane->surface, NULL, 0, 0);
+			wl_surface_commit(plane->surface);
+			plane->mapped = false;
+		}
+
+		/* Repaints without assign_planes() composite everything. */
+		plane->dmabuf = NULL;
+	}
+}
+
 #ifdef ENABLE_EGL
 static int
 wayland_output_repaint_gl(struct weston_output *output_base)
@@ -503,8 +889,9 @@ wayland_output_repaint_gl(struct weston_output *output_base)
 	wl_callback_add_listener(output->frame_cb, &frame_listener, output);
 
 	wayland_output_update_gl_border(output);
+	wayland_output_commit_planes(output);
 
-	ec->renderer->repaint_output(&output->base, &damage, NULL);
+	weston_renderer_repaint_output(&output->base, &damage, NULL);
 
 	pixman_region32_fini(&damage);
 
@@ -552,27 +939,45 @@ wayland_output_update_shm_border(struct wayland_shm_buffer *buffer)
 	cairo_destroy(cr);
 }
 
+/** Attach a repainted shm buffer to the output surface
+ *
+ * The renderer has brought the buffer up to date with everything since it
+ * was last used, but the parent compositor only needs the difference from
+ * the previous buffer: this repaint's damage, and the decorations when
+ * they changed in this repaint.
+ */
 static void
 wayland_shm_buffer_attach(struct wayland_shm_buffer *sb,
-			  pixman_region32_t *repaint_damage)
+			  pixman_region32_t *repaint_damage,
+			  bool border_changed)
 {
+	struct wayland_output *output = sb->output;
 	pixman_region32_t damage;
 	pixman_box32_t *rects;
 	int32_t ix, iy, iwidth, iheight, fwidth, fheight;
 	int i, n;
 
+	wl_surface_attach(output->parent.surface, sb->buffer, 0, 0);
+
+	if (output->shm.full_damage) {
+		wayland_output_damage_buffer(output, 0, 0,
+					     sb->width, sb->height);
+		output->shm.full_damage = false;
+		return;
+	}
+
 	pixman_region32_init(&damage);
-	weston_region_global_to_output(&damage, &sb->output->base,
+	weston_region_global_to_output(&damage, &output->base,
 				       repaint_damage);
 
-	if (sb->output->frame) {
-		frame_interior(sb->output->frame, &ix, &iy, &iwidth, &iheight);
-		fwidth = frame_width(sb->output->frame);
-		fheight = frame_height(sb->output->frame);
+	if (output->frame) {
+		frame_interior(output->frame, &ix, &iy, &iwidth, &iheight);
+		fwidth = frame_width(output->frame);
+		fheight = frame_height(output->frame);
 
 		pixman_region32_translate(&damage, ix, iy);
 
-		if (sb->frame_damaged) {
+		if (border_changed) {
 			pixman_region32_union_rect(&damage, &damage,
 						   0, 0, fwidth, iy);
 			pixman_region32_union_rect(&damage, &damage,
@@ -587,11 +992,10 @@ wayland_shm_buffer_attach(struct wayland_shm_buffer *sb,
 	}
 
 	rects = pixman_region32_rectangles(&damage, &n);
-	wl_surface_attach(sb->output->parent.surface, sb->buffer, 0, 0);
 	for (i = 0; i < n; ++i)
-		wl_surface_damage(sb->output->parent.surface, rects[i].x1,
-				  rects[i].y1, rects[i].x2 - rects[i].x1,
-				  rects[i].y2 - rects[i].y1);
+		wayland_output_damage_buffer(output, rects[i].x1, rects[i].y1,
+					     rects[i].x2 - rects[i].x1,
+					     rects[i].y2 - rects[i].y1);
 
 	pixman_region32_fini(&damage);
 }
@@ -603,6 +1007,7 @@ wayland_output_repaint_pixman(struct weston_output *output_base)
 	struct wayland_backend *b;
 	struct wayland_shm_buffer *sb;
 	pixman_region32_t damage;
+	bool border_changed = false;
 
 	assert(output);
 
@@ -612,22 +1017,27 @@ wayland_output_repaint_pixman(struct weston_output *output_base)
 
 	weston_output_flush_damage_for_primary_plane(output_base, &damage);
 
-	if (output->frame) {
-		if (frame_status(output->frame) & FRAME_STATUS_REPAINT)
-			wl_list_for_each(sb, &output->shm.buffers, link)
-				sb->frame_damaged = 1;
+	/* Every buffer needs the new decorations eventually, but the parent
+	 * compositor only needs to hear about them once. */
+	if (output->frame &&
+	    (frame_status(output->frame) & FRAME_STATUS_REPAINT)) {
+		border_changed = true;
+		wl_list_for_each(sb, &output->shm.buffers, link)
+			sb->frame_damaged = 1;
 	}
 
 	sb = wayland_output_get_shm_buffer(output);
 
 	wayland_output_update_shm_border(sb);
-	b->compositor->renderer->repaint_output(output_base, &damage,
-						sb->renderbuffer);
+	weston_renderer_repaint_output(output_base, &damage,
+				       sb->renderbuffer);
 
-	wayland_shm_buffer_attach(sb, &damage);
+	wayland_shm_buffer_attach(sb, &damage, border_changed);
 
 	pixman_region32_fini(&damage);
 
+	wayland_output_commit_planes(output);
+
 	output->frame_cb = wl_surface_frame(output->parent.surface);
 	wl_callback_add_listener(output->frame_cb, &frame_listener, output);
 	wl_surface_commit(output->parent.surface);
@@ -662,6 +1072,8 @@ wayland_output_destroy_shm_buffers(struct wayland_output *output)
 {
 	struct wayland_shm_buffer *buffer, *next;
 
+	output->shm.full_damage = true;
+
 	/* Throw away any remaining SHM buffers */
 	wl_list_for_each_safe(buffer, next, &output->shm.free_buffers, free_link)
 		wayland_shm_buffer_destroy(buffer);
@@ -680,6 +1092,7 @@ wayland_output_disable(struct weston_output *base)
 {
 	const struct weston_renderer *renderer = base->compositor->renderer;
 	struct wayland_output *output = to_wayland_output(base);
+	int i;
 
 	assert(output);
 
@@ -688,6 +1101,12 @@ wayland_output_disable(struct weston_output *base)
 
 	wayland_output_destroy_shm_buffers(output);
 
+	if (output->base.assign_planes) {
+		wayland_output_destroy_planes(output);
+		for (i = 0; i < WAYLAND_OUTPUT_MAX_PLANES; i++)
+			weston_plane_release(&output->planes[i].base);
+	}
+
 	switch (renderer->type) {
 	case WESTON_RENDERER_PIXMAN:
 		renderer->pixman->output_destroy(&output->base);
@@ -1061,6 +1480,8 @@ wayland_output_switch_mode_fshell(struct wayland_output *output,
 	if (output->base.current_mode == mode)
 		return 0;
 
+	wayland_output_destroy_planes(output);
+
 	old_mode = output->base.current_mode;
 	old_surface = output->parent.surface;
 	output->base.current_mode = mode;
@@ -1259,6 +1680,7 @@ wayland_output_enable(struct weston_output *base)
 	struct wayland_backend *b;
 	enum mode_status mode_status;
 	int ret = 0;
+	int i;
 
 	assert(output);
 
@@ -1266,6 +1688,7 @@ wayland_output_enable(struct weston_output *base)
 
 	wl_list_init(&output->shm.buffers);
 	wl_list_init(&output->shm.free_buffers);
+	output->shm.full_damage = true;
 
 	weston_log("Creating %dx%d wayland output at (%d, %d)\n",
 		   output->base.current_mode->width,
@@ -1300,6 +1723,11 @@ wayland_output_enable(struct weston_output *base)
 
 	output->base.start_repaint_loop = wayland_output_start_repaint_loop;
 	output->base.assign_planes = NULL;
+	if (b->passthrough) {
+		for (i = 0; i < WAYLAND_OUTPUT_MAX_PLANES; i++)
+			weston_plane_init(&output->planes[i].base, b->compositor);
+		output->base.assign_planes = wayland_output_assign_planes;
+	}
 	output->base.set_backlight = NULL;
 	output->base.set_dpms = NULL;
 	output->base.switch_mode = wayland_output_switch_mode;
@@ -2673,6 +3101,35 @@ static const struct xdg_wm_base_listener wm_base_listener = {
 	xdg_wm_base_ping,
 };
 
+static void
+dmabuf_format(void *data, struct zwp_linux_dmabuf_v1 *zwp_linux_dmabuf,
+	      uint32_t format)
+{
+	/* Superseded by the modifier event */
+}
+
+static void
+dmabuf_modifier(void *data, struct zwp_linux_dmabuf_v1 *zwp_linux_dmabuf,
+		uint32_t format, uint32_t modifier_hi, uint32_t modifier_lo)
+{
+	struct wayland_backend *b = data;
+	uint64_t modifier = ((uint64_t) modifier_hi << 32) | modifier_lo;
+	struct weston_drm_format *fmt;
+
+	fmt = weston_drm_format_array_find_format(&b->parent.dmabuf_formats,
+						  format);
+	if (!fmt)
+		fmt = weston_drm_format_array_add_format(&b->parent.dmabuf_formats,
+							 format);
+	if (fmt && !weston_drm_format_has_modifier(fmt, modifier))
+		weston_drm_format_add_modifier(fmt, modifier);
+}
+
+static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
+	dmabuf_format,
+	dmabuf_modifier
+};
+
 static void
 registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
 		       const char *interface, uint32_t version)
@@ -2701,6 +3158,18 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
 	} else if (strcmp(interface, "wl_shm") == 0) {
 		b->parent.shm =
 			wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, "wl_subcompositor") == 0) {
+		b->parent.subcompositor =
+			wl_registry_bind(registry, name,
+					 &wl_subcompositor_interface, 1);
+	} else if (strcmp(interface, "zwp_linux_dmabuf_v1") == 0 &&
+		   version >= 3) {
+		/* Version 3 announces the modifiers without feedback. */
+		b->parent.dmabuf =
+			wl_registry_bind(registry, name,
+					 &zwp_linux_dmabuf_v1_interface, 3);
+		zwp_linux_dmabuf_v1_add_listener(b->parent.dmabuf,
+						 &dmabuf_listener, b);
 	}
 }
 
@@ -2768,6 +3237,7 @@ wayland_destroy(struct weston_backend *backend)
 	struct weston_head *base, *next;
 	struct wayland_parent_output *output, *next_output;
 	struct wayland_input *input, *next_input;
+	struct wayland_dmabuf *dmabuf, *next_dmabuf;
 
 	wl_list_remove(&b->base.link);
 
@@ -2785,6 +3255,16 @@ wayland_destroy(struct weston_backend *backend)
 	wl_list_for_each_safe(input, next_input, &b->pending_input_list, link)
 		wayland_input_destroy(input);
 
+	wl_list_for_each_safe(dmabuf, next_dmabuf, &b->dmabuf_list, link)
+		wayland_dmabuf_destroy(dmabuf);
+	weston_drm_format_array_fini(&b->parent.dmabuf_formats);
+
+	if (b->parent.dmabuf)
+		zwp_linux_dmabuf_v1_destroy(b->parent.dmabuf);
+
+	if (b->parent.subcompositor)
+		wl_subcompositor_destroy(b->parent.subcompositor);
+
 	if (b->parent.shm)
 		wl_shm_destroy(b->parent.shm);
 
@@ -2901,6 +3381,8 @@ wayland_backend_create(struct weston_compositor *compositor,
 	wl_list_init(&b->parent.output_list);
 	wl_list_init(&b->input_list);
 	wl_list_init(&b->pending_input_list);
+	wl_list_init(&b->dmabuf_list);
+	weston_drm_format_array_init(&b->parent.dmabuf_formats);
 	b->parent.registry = wl_display_get_registry(b->parent.wl_display);
 	wl_registry_add_listener(b->parent.registry, &registry_listener, b);
 	wl_display_roundtrip(b->parent.wl_display);
@@ -2914,6 +3396,22 @@ wayland_backend_create(struct weston_compositor *compositor,
 
 	b->fullscreen = new_config->fullscreen;
 
+	if (new_config->passthrough) {
+		/* The format list arrives after the global. */
+		wl_display_roundtrip(b->parent.wl_display);
+
+		if (b->parent.subcompositor && b->parent.dmabuf) {
+			b->passthrough = true;
+			weston_log("wayland-backend: passing client dmabufs "
+				   "through as sub-surfaces\n");
+		} else {
+			weston_log("wayland-backend: passthrough needs "
+				   "wl_subcompositor and zwp_linux_dmabuf_v1 "
+				   "version 3 from the parent compositor, "
+				   "compositing everything instead\n");
+		}
+	}
+
 	b->formats_count = ARRAY_LENGTH(wayland_formats);
 	b->formats = pixel_format_get_array(wayland_formats, b->formats_count);
 
@@ -2976,6 +3474,7 @@ err_renderer:
 	compositor->renderer->destroy(compositor);
 err_display:
 	wl_display_disconnect(b->parent.wl_display);
+	weston_drm_format_array_fini(&b->parent.dmabuf_formats);
 err_compositor:
 	wl_list_remove(&b->base.link);
 	free(b->formats);
@@ -2986,6 +3485,12 @@ err_compositor:
 static void
 wayland_backend_destroy(struct wayland_backend *b)
 {
+	struct wayland_dmabuf *dmabuf, *next;
+
+	wl_list_for_each_safe(dmabuf, next, &b->dmabuf_list, link)
+		wayland_dmabuf_destroy(dmabuf);
+	weston_drm_format_array_fini(&b->parent.dmabuf_formats);
+
 	wl_display_disconnect(b->parent.wl_display);
 
 	if (b->theme)
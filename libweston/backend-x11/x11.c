@@ -44,6 +44,13 @@
 #ifdef HAVE_XCB_XKB
 #include <xcb/xkb.h>
 #endif
+#ifdef HAVE_XCB_PRESENT
+#include <xcb/present.h>
+#include <xcb/xfixes.h>
+#endif
+#ifdef HAVE_XCB_DRI3
+#include <xcb/dri3.h>
+#endif
 
 #include <X11/Xlib.h>
 #include <X11/Xlib-xcb.h>
@@ -75,6 +82,9 @@
 #define WINDOW_MAX_WIDTH 8192
 #define WINDOW_MAX_HEIGHT 8192
 
+/* One on screen, one queued and one to render into */
+#define X11_DRI3_BUFFER_COUNT 3
+
 static const uint32_t x11_formats[] = {
 	DRM_FORMAT_XRGB8888,
 };
@@ -97,6 +107,14 @@ struct x11_backend {
 
 	int			 has_net_wm_state_fullscreen;
 
+	/* Present and XFixes are usable */
+	bool			 present;
+	uint8_t			 present_opcode;
+	/* DRI3 is usable as well */
+	bool			 dri3;
+	/* DRI3 1.2: modifier queries and multi-planar pixmaps */
+	bool			 dri3_modifiers;
+
 	/* We could map multi-pointer X to multiple wayland seats, but
 	 * for now we only support core X input. */
 	struct weston_seat		 core_seat;
@@ -129,6 +147,13 @@ struct x11_head {
 	struct weston_head	base;
 };
 
+struct x11_dri3_buffer {
+	struct weston_renderbuffer *renderbuffer;
+	xcb_pixmap_t		pixmap;
+	/* Presented and not released by an IdleNotify yet */
+	bool			busy;
+};
+
 struct x11_output {
 	struct weston_output	base;
 	struct x11_backend	*backend;
@@ -147,6 +172,18 @@ struct x11_output {
 	int32_t                 scale;
 	bool			resize_pending;
 	bool			window_resized;
+
+#ifdef HAVE_XCB_PRESENT
+	uint32_t		present_eid;
+	uint32_t		present_region;
+	uint32_t		present_serial;
+	bool			present_pending;
+	/* Pixmap on the SHM segment, for the Pixman renderer */
+	xcb_pixmap_t		shm_pixmap;
+	/* Renderbuffers shared with the X server, for the GL renderer */
+	struct x11_dri3_buffer	dri3[X11_DRI3_BUFFER_COUNT];
+	bool			use_dri3;
+#endif
 };
 
 struct window_delete_data {
@@ -232,7 +269,7 @@ x11_backend_get_keymap(struct x11_backend *b)
 	copy_prop_value(options);
 #undef copy_prop_value
 
-	ret = xkb_keymap_new_from_names(b->compositor->xkb_context, &names, 0);
+	ret = weston_compositor_get_keymap(b->compositor, &names);
 
 	free(reply);
 	return ret;
@@ -432,18 +469,15 @@ static int
 x11_output_repaint_gl(struct weston_output *output_base)
 {
 	struct x11_output *output = to_x11_output(output_base);
-	struct weston_compositor *ec;
 	pixman_region32_t damage;
 
 	assert(output);
 
-	ec = output->base.compositor;
-
 	pixman_region32_init(&damage);
 
 	weston_output_flush_damage_for_primary_plane(output_base, &damage);
 
-	ec->renderer->repaint_output(output_base, &damage, NULL);
+	weston_renderer_repaint_output(output_base, &damage, NULL);
 
 	pixman_region32_fini(&damage);
 
@@ -451,37 +485,30 @@ x11_output_repaint_gl(struct weston_output *output_base)
 	return 0;
 }
 
-static void
-set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region)
+/* Returns the region in output coordinates, or NULL if there is none */
+static xcb_rectangle_t *
+x11_output_region_to_rects(struct weston_output *output_base,
+			   pixman_region32_t *region, int *nrects)
 {
-	struct x11_output *output = to_x11_output(output_base);
-	struct x11_backend *b;
 	pixman_region32_t transformed_region;
 	pixman_box32_t *rects;
 	xcb_rectangle_t *output_rects;
-	xcb_void_cookie_t cookie;
-	int nrects, i;
-	xcb_generic_error_t *err;
-
-	if (!output)
-		return;
-
-	b = output->backend;
+	int i;
 
 	pixman_region32_init(&transformed_region);
 	weston_region_global_to_output(&transformed_region,
 				       output_base,
 				       region);
 
-	rects = pixman_region32_rectangles(&transformed_region, &nrects);
-	output_rects = calloc(nrects, sizeof(xcb_rectangle_t));
+	rects = pixman_region32_rectangles(&transformed_region, nrects);
+	output_rects = calloc(*nrects, sizeof(xcb_rectangle_t));
 
 	if (output_rects == NULL) {
 		pixman_region32_fini(&transformed_region);
-		return;
+		return NULL;
 	}
 
-	for (i = 0; i < nrects; i++) {
+	for (i = 0; i < *nrects; i++) {
 		output_rects[i].x = rects[i].x1;
 		output_rects[i].y = rects[i].y1;
 		output_rects[i].width = rects[i].x2 - rects[i].x1;
@@ -490,6 +517,28 @@ set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region
 
 	pixman_region32_fini(&transformed_region);
 
+	return output_rects;
+}
+
+static void
+set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region)
+{
+	struct x11_output *output = to_x11_output(output_base);
+	struct x11_backend *b;
+	xcb_rectangle_t *output_rects;
+	xcb_void_cookie_t cookie;
+	int nrects;
+	xcb_generic_error_t *err;
+
+	if (!output)
+		return;
+
+	b = output->backend;
+
+	output_rects = x11_output_region_to_rects(output_base, region, &nrects);
+	if (output_rects == NULL)
+		return;
+
 	cookie = xcb_set_clip_rectangles_checked(b->conn, XCB_CLIP_ORDERING_UNSORTED,
 					output->gc,
 					0, 0, nrects,
@@ -502,6 +551,354 @@ set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region
 	free(output_rects);
 }
 
+#ifdef HAVE_XCB_PRESENT
+/** Queue a pixmap for the next vblank of the output window
+ *
+ * Only the damaged part of the window is updated, the rest of the pixmap is
+ * not read. The CompleteNotify for this request finishes the frame, see
+ * x11_output_present_complete().
+ */
+static int
+x11_output_present(struct x11_output *output, xcb_pixmap_t pixmap,
+		   pixman_region32_t *damage)
+{
+	struct x11_backend *b = output->backend;
+	xcb_rectangle_t *rects;
+	xcb_void_cookie_t cookie;
+	xcb_generic_error_t *err;
+	uint32_t update = XCB_NONE;
+	uint64_t target_msc;
+	int nrects;
+
+	rects = x11_output_region_to_rects(&output->base, damage, &nrects);
+	if (rects) {
+		xcb_xfixes_set_region(b->conn, output->present_region,
+				      nrects, rects);
+		update = output->present_region;
+		free(rects);
+	}
+
+	/* Until the first completion tells us the MSC, take whatever vblank
+	 * comes first. */
+	target_msc = output->base.msc ? output->base.msc + 1 : 0;
+
+	output->present_serial++;
+	cookie = xcb_present_pixmap_checked(b->conn, output->window, pixmap,
+					    output->present_serial,
+					    XCB_NONE, update, 0, 0,
+					    XCB_NONE, XCB_NONE, XCB_NONE,
+					    XCB_PRESENT_OPTION_NONE,
+					    target_msc, 0, 0, 0, NULL);
+	err = xcb_request_check(b->conn, cookie);
+	if (err != NULL) {
+		weston_log("Failed to present pixmap, err: %d\n",
+			   err->error_code);
+		free(err);
+		return -1;
+	}
+
+	output->present_pending = true;
+
+	return 0;
+}
+
+static void
+x11_output_present_complete(struct x11_output *output,
+			    const xcb_present_complete_notify_event_t *complete)
+{
+	struct timespec ts;
+	uint32_t flags;
+
+	if (!output->present_pending ||
+	    complete->serial != output->present_serial)
+		return;
+
+	output->present_pending = false;
+
+	/* The UST is CLOCK_MONOTONIC in microseconds, which is why the
+	 * backend offers only that clock when Present is in use. */
+	timespec_from_usec(&ts, complete->ust);
+	if (complete->mode == XCB_PRESENT_COMPLETE_MODE_SKIP ||
+	    timespec_sub_to_nsec(&ts, &output->base.frame_time) < 0) {
+		weston_compositor_read_presentation_clock(output->base.compositor,
+							  &ts);
+		weston_output_finish_frame(&output->base, &ts,
+					   WP_PRESENTATION_FEEDBACK_INVALID);
+		return;
+	}
+
+	output->base.msc = complete->msc;
+
+	flags = WP_PRESENTATION_FEEDBACK_KIND_VSYNC |
+		WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK |
+		WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION;
+	if (complete->mode == XCB_PRESENT_COMPLETE_MODE_FLIP)
+		flags |= WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY;
+
+	weston_output_finish_frame(&output->base, &ts, flags);
+}
+
+static void
+x11_output_present_idle(struct x11_output *output, xcb_pixmap_t pixmap)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(output->dri3); i++) {
+		if (output->dri3[i].pixmap == pixmap)
+			output->dri3[i].busy = false;
+	}
+}
+
+static void
+x11_output_init_present(struct x11_backend *b, struct x11_output *output)
+{
+	output->present_eid = xcb_generate_id(b->conn);
+	xcb_present_select_input(b->conn, output->present_eid, output->window,
+				 XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY |
+				 XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY);
+
+	output->present_region = xcb_generate_id(b->conn);
+	xcb_xfixes_create_region(b->conn, output->present_region, 0, NULL);
+}
+
+static void
+x11_output_fini_present(struct x11_backend *b, struct x11_output *output)
+{
+	/* The event selection goes away with the window */
+	xcb_xfixes_destroy_region(b->conn, output->present_region);
+	output->present_pending = false;
+}
+#endif
+
+#ifdef HAVE_XCB_DRI3
+static void
+x11_output_fini_dri3(struct x11_backend *b, struct x11_output *output)
+{
+	struct weston_renderer *renderer = b->compositor->renderer;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(output->dri3); i++) {
+		struct x11_dri3_buffer *buffer = &output->dri3[i];
+
+		if (buffer->pixmap != XCB_NONE)
+			xcb_free_pixmap(b->conn, buffer->pixmap);
+
+		if (buffer->renderbuffer) {
+			renderer->remove_renderbuffer_dmabuf(&output->base,
+							     buffer->renderbuffer);
+			weston_renderbuffer_unref(buffer->renderbuffer);
+		}
+
+		memset(buffer, 0, sizeof *buffer);
+	}
+}
+
+/* The modifiers the X server can use on this window, preferring those it
+ * can flip, or only LINEAR when it does not say. */
+static uint64_t *
+x11_output_get_dri3_modifiers(struct x11_backend *b, struct x11_output *output,
+			      unsigned int *count)
+{
+	xcb_dri3_get_supported_modifiers_reply_t *reply = NULL;
+	const uint64_t *supported = NULL;
+	uint64_t *modifiers;
+	unsigned int n = 0;
+
+	if (b->dri3_modifiers) {
+		reply = xcb_dri3_get_supported_modifiers_reply(b->conn,
+				xcb_dri3_get_supported_modifiers(b->conn,
+								 output->window,
+								 output->depth,
+								 32),
+				NULL);
+	}
+
+	if (reply) {
+		n = xcb_dri3_get_supported_modifiers_window_modifiers_length(reply);
+		supported = xcb_dri3_get_supported_modifiers_window_modifiers(reply);
+		if (n == 0) {
+			n = xcb_dri3_get_supported_modifiers_screen_modifiers_length(reply);
+			supported = xcb_dri3_get_supported_modifiers_screen_modifiers(reply);
+		}
+	}
+
+	if (n == 0) {
+		modifiers = xmalloc(sizeof *modifiers);
+		modifiers[0] = DRM_FORMAT_MOD_LINEAR;
+		*count = 1;
+	} else {
+		modifiers = xcalloc(n, sizeof *modifiers);
+		memcpy(modifiers, supported, n * sizeof *modifiers);
+		*count = n;
+	}
+
+	free(reply);
+
+	return modifiers;
+}
+
+static xcb_pixmap_t
+x11_output_create_dri3_pixmap(struct x11_backend *b, struct x11_output *output,
+			      const struct dmabuf_attributes *attributes)
+{
+	xcb_pixmap_t pixmap;
+	xcb_void_cookie_t cookie;
+	xcb_generic_error_t *err;
+	int32_t fds[MAX_DMABUF_PLANES];
+	uint32_t stride[MAX_DMABUF_PLANES] = { 0 };
+	uint32_t offset[MAX_DMABUF_PLANES] = { 0 };
+	int i;
+
+	/* Before 1.2, PixmapFromBuffer takes a single plane with no offset
+	 * and no explicit modifier. */
+	if (!b->dri3_modifiers &&
+	    (attributes->n_planes != 1 || attributes->offset[0] != 0 ||
+	     (attributes->modifier != DRM_FORMAT_MOD_LINEAR &&
+	      attributes->modifier != DRM_FORMAT_MOD_INVALID))) {
+		weston_log("x11dri3: unsupported DMABUF layout\n");
+		return XCB_NONE;
+	}
+
+	/* xcb closes the fds it sends */
+	for (i = 0; i < attributes->n_planes; i++) {
+		fds[i] = dup(attributes->fd[i]);
+		if (fds[i] < 0) {
+			while (i--)
+				close(fds[i]);
+			return XCB_NONE;
+		}
+		stride[i] = attributes->stride[i];
+		offset[i] = attributes->offset[i];
+	}
+
+	pixmap = xcb_generate_id(b->conn);
+	if (b->dri3_modifiers) {
+		cookie = xcb_dri3_pixmap_from_buffers_checked(b->conn, pixmap,
+							      output->window,
+							      attributes->n_planes,
+							      attributes->width,
+							      attributes->height,
+							      stride[0], offset[0],
+							      stride[1], offset[1],
+							      stride[2], offset[2],
+							      stride[3], offset[3],
+							      output->depth, 32,
+							      attributes->modifier,
+							      fds);
+	} else {
+		cookie = xcb_dri3_pixmap_from_buffer_checked(b->conn, pixmap,
+							     output->window,
+							     stride[0] * attributes->height,
+							     attributes->width,
+							     attributes->height,
+							     stride[0],
+							     output->depth, 32,
+							     fds[0]);
+	}
+
+	err = xcb_request_check(b->conn, cookie);
+	if (err) {
+		weston_log("x11dri3: pixmap from DMABUF error %d\n",
+			   err->error_code);
+		free(err);
+		return XCB_NONE;
+	}
+
+	return pixmap;
+}
+
+static int
+x11_output_init_dri3(struct x11_backend *b, struct x11_output *output,
+		     int width, int height)
+{
+	struct weston_renderer *renderer = b->compositor->renderer;
+	uint64_t *modifiers;
+	unsigned int count;
+	unsigned int i;
+
+	modifiers = x11_output_get_dri3_modifiers(b, output, &count);
+
+	for (i = 0; i < ARRAY_LENGTH(output->dri3); i++) {
+		struct x11_dri3_buffer *buffer = &output->dri3[i];
+		struct linux_dmabuf_memory *dmabuf;
+
+		dmabuf = renderer->dmabuf_alloc(renderer, width, height,
+						b->formats[0]->format,
+						modifiers, count);
+		if (!dmabuf) {
+			weston_log("x11dri3: failed to allocate DMABUF\n");
+			goto err;
+		}
+
+		buffer->pixmap = x11_output_create_dri3_pixmap(b, output,
+							       dmabuf->attributes);
+		if (buffer->pixmap == XCB_NONE) {
+			dmabuf->destroy(dmabuf);
+			goto err;
+		}
+
+		buffer->renderbuffer =
+			renderer->create_renderbuffer_dmabuf(&output->base,
+							     dmabuf);
+		if (!buffer->renderbuffer) {
+			dmabuf->destroy(dmabuf);
+			goto err;
+		}
+	}
+
+	free(modifiers);
+
+	return 0;
+
+err:
+	free(modifiers);
+	x11_output_fini_dri3(b, output);
+	return -1;
+}
+
+static int
+x11_output_repaint_dri3(struct weston_output *output_base)
+{
+	struct x11_output *output = to_x11_output(output_base);
+	struct x11_dri3_buffer *buffer = NULL;
+	pixman_region32_t damage;
+	unsigned int i;
+
+	assert(output);
+
+	for (i = 0; i < ARRAY_LENGTH(output->dri3); i++) {
+		if (!output->dri3[i].busy) {
+			buffer = &output->dri3[i];
+			break;
+		}
+	}
+
+	/* The X server still holds every buffer, keep the damage for the
+	 * next frame. */
+	if (!buffer) {
+		weston_output_arm_frame_timer(output_base,
+					      output->finish_frame_timer);
+		return 0;
+	}
+
+	pixman_region32_init(&damage);
+
+	weston_output_flush_damage_for_primary_plane(output_base, &damage);
+
+	weston_renderer_repaint_output(output_base, &damage,
+				       buffer->renderbuffer);
+
+	if (x11_output_present(output, buffer->pixmap, &damage) == 0)
+		buffer->busy = true;
+	else
+		weston_output_arm_frame_timer(output_base,
+					      output->finish_frame_timer);
+
+	pixman_region32_fini(&damage);
+
+	return 0;
+}
+#endif
 
 static int
 x11_output_repaint_shm(struct weston_output *output_base)
@@ -527,7 +924,21 @@ x11_output_repaint_shm(struct weston_output *output_base)
 
 	weston_output_flush_damage_for_primary_plane(output_base, &damage);
 
-	ec->renderer->repaint_output(output_base, &damage, output->renderbuffer);
+	weston_renderer_repaint_output(output_base, &damage,
+				       output->renderbuffer);
+
+#ifdef HAVE_XCB_PRESENT
+	if (output->shm_pixmap != XCB_NONE) {
+		int ret = x11_output_present(output, output->shm_pixmap,
+					     &damage);
+
+		pixman_region32_fini(&damage);
+		if (ret < 0)
+			weston_output_arm_frame_timer(output_base,
+						      output->finish_frame_timer);
+		return 0;
+	}
+#endif
 
 	set_clip_for_output(output_base, &damage);
 
@@ -568,6 +979,13 @@ x11_output_deinit_shm(struct x11_backend *b, struct x11_output *output)
 	xcb_generic_error_t *err;
 	xcb_free_gc(b->conn, output->gc);
 
+#ifdef HAVE_XCB_PRESENT
+	if (output->shm_pixmap != XCB_NONE) {
+		xcb_free_pixmap(b->conn, output->shm_pixmap);
+		output->shm_pixmap = XCB_NONE;
+	}
+#endif
+
 	weston_renderbuffer_unref(output->renderbuffer);
 	output->renderbuffer = NULL;
 	cookie = xcb_shm_detach_checked(b->conn, output->segment);
@@ -825,6 +1243,15 @@ x11_output_init_shm(struct x11_backend *b, struct x11_output *output,
 
 	shmctl(output->shm_id, IPC_RMID, NULL);
 
+#ifdef HAVE_XCB_PRESENT
+	if (b->present) {
+		output->shm_pixmap = xcb_generate_id(b->conn);
+		xcb_shm_create_pixmap(b->conn, output->shm_pixmap,
+				      output->window, width, height,
+				      output->depth, output->segment, 0);
+	}
+#endif
+
 	/* Now create pixman image */
 	output->renderbuffer =
 		renderer->pixman->create_image_from_ptr(&output->base,
@@ -875,8 +1302,23 @@ x11_output_switch_mode(struct weston_output *base, struct weston_mode *mode)
 	fb_size.width = output->mode.width = mode->width;
 	fb_size.height = output->mode.height = mode->height;
 
+#ifdef HAVE_XCB_DRI3
+	/* Resizing drops the renderer's references to the renderbuffers */
+	if (output->use_dri3)
+		x11_output_fini_dri3(b, output);
+#endif
+
 	weston_renderer_resize_output(&output->base, &fb_size, NULL);
 
+#ifdef HAVE_XCB_DRI3
+	if (output->use_dri3 &&
+	    x11_output_init_dri3(b, output,
+				 fb_size.width, fb_size.height) < 0) {
+		weston_log("Failed to initialize DRI3 for the X11 output\n");
+		return -1;
+	}
+#endif
+
 	if (base->compositor->renderer->type == WESTON_RENDERER_PIXMAN) {
 		const struct pixel_format_info *pfmt;
 		x11_output_deinit_shm(b, output);
@@ -918,12 +1360,21 @@ x11_output_disable(struct weston_output *base)
 		renderer->pixman->output_destroy(&output->base);
 		break;
 	case WESTON_RENDERER_GL:
+#ifdef HAVE_XCB_DRI3
+		if (output->use_dri3)
+			x11_output_fini_dri3(backend, output);
+#endif
 		renderer->gl->output_destroy(&output->base);
 		break;
 	default:
 		unreachable("invalid renderer");
 	}
 
+#ifdef HAVE_XCB_PRESENT
+	if (backend->present)
+		x11_output_fini_present(backend, output);
+#endif
+
 	xcb_destroy_window(backend->conn, output->window);
 	xcb_flush(backend->conn);
 
@@ -943,6 +1394,45 @@ x11_output_destroy(struct weston_output *base)
 	free(output);
 }
 
+#ifdef HAVE_XCB_DRI3
+static int
+x11_output_enable_dri3(struct x11_backend *b, struct x11_output *output)
+{
+	const struct weston_renderer *renderer = b->compositor->renderer;
+	const struct weston_mode *mode = output->base.current_mode;
+	const struct gl_renderer_fbo_options options = {
+		.area.x = 0,
+		.area.y = 0,
+		.area.width = mode->width,
+		.area.height = mode->height,
+		.fb_size.width = mode->width,
+		.fb_size.height = mode->height,
+	};
+
+	if (!b->dri3 || !renderer->dmabuf_alloc ||
+	    !renderer->create_renderbuffer_dmabuf)
+		return -1;
+
+	/* The buffers are XRGB8888, which needs a depth 24 window */
+	output->depth = get_depth_of_visual(b->screen, b->screen->root_visual);
+	if (output->depth != 24)
+		return -1;
+
+	if (renderer->gl->output_fbo_create(&output->base, &options) < 0)
+		return -1;
+
+	if (x11_output_init_dri3(b, output, mode->width, mode->height) < 0) {
+		renderer->gl->output_destroy(&output->base);
+		weston_log("Falling back to an EGL window surface\n");
+		return -1;
+	}
+
+	output->use_dri3 = true;
+
+	return 0;
+}
+#endif
+
 static int
 x11_output_enable(struct weston_output *base)
 {
@@ -1052,6 +1542,11 @@ x11_output_enable(struct weston_output *base)
 	if (b->fullscreen)
 		x11_output_wait_for_map(b, output);
 
+#ifdef HAVE_XCB_PRESENT
+	if (b->present)
+		x11_output_init_present(b, output);
+#endif
+
 	switch (renderer->type) {
 	case WESTON_RENDERER_PIXMAN: {
 		const struct pixman_renderer_output_options options = {
@@ -1079,6 +1574,12 @@ x11_output_enable(struct weston_output *base)
 		break;
 	}
 	case WESTON_RENDERER_GL: {
+#ifdef HAVE_XCB_DRI3
+		if (x11_output_enable_dri3(b, output) == 0) {
+			output->base.repaint = x11_output_repaint_dri3;
+			break;
+		}
+#endif
 		/* eglCreatePlatformWindowSurfaceEXT takes a Window*
 		 * but eglCreateWindowSurface takes a Window. */
 		Window xid = (Window) output->window;
@@ -1122,6 +1623,10 @@ x11_output_enable(struct weston_output *base)
 	return 0;
 
 err:
+#ifdef HAVE_XCB_PRESENT
+	if (b->present)
+		x11_output_fini_present(b, output);
+#endif
 	xcb_destroy_window(b->conn, output->window);
 	xcb_flush(b->conn);
 
@@ -1513,6 +2018,39 @@ x11_backend_next_event(struct x11_backend *b,
 	return *event != NULL;
 }
 
+#ifdef HAVE_XCB_PRESENT
+static void
+x11_backend_handle_present_event(struct x11_backend *b,
+				 xcb_ge_generic_event_t *event)
+{
+	xcb_present_complete_notify_event_t *complete;
+	xcb_present_idle_notify_event_t *idle;
+	struct x11_output *output;
+
+	if (!b->present || event->extension != b->present_opcode)
+		return;
+
+	switch (event->event_type) {
+	case XCB_PRESENT_EVENT_COMPLETE_NOTIFY:
+		complete = (xcb_present_complete_notify_event_t *) event;
+		if (complete->kind != XCB_PRESENT_COMPLETE_KIND_PIXMAP)
+			break;
+		output = x11_backend_find_output(b, complete->window);
+		if (output)
+			x11_output_present_complete(output, complete);
+		break;
+	case XCB_PRESENT_EVENT_IDLE_NOTIFY:
+		idle = (xcb_present_idle_notify_event_t *) event;
+		output = x11_backend_find_output(b, idle->window);
+		if (output)
+			x11_output_present_idle(output, idle->pixmap);
+		break;
+	default:
+		break;
+	}
+}
+#endif
+
 static int
 x11_backend_handle_event(int fd, uint32_t mask, void *data)
 {
@@ -1721,6 +2259,13 @@ x11_backend_handle_event(int fd, uint32_t mask, void *data)
 			notify_keyboard_focus_out(&b->core_seat);
 			break;
 
+#ifdef HAVE_XCB_PRESENT
+		case XCB_GE_GENERIC:
+			x11_backend_handle_present_event(b,
+				(xcb_ge_generic_event_t *) event);
+			break;
+#endif
+
 		default:
 			break;
 		}
@@ -1877,6 +2422,59 @@ x11_destroy(struct weston_backend *base)
 	free(backend);
 }
 
+#ifdef HAVE_XCB_PRESENT
+static void
+x11_backend_init_present(struct x11_backend *b)
+{
+	const xcb_query_extension_reply_t *ext;
+	xcb_present_query_version_reply_t *present;
+	xcb_xfixes_query_version_reply_t *xfixes;
+
+	ext = xcb_get_extension_data(b->conn, &xcb_present_id);
+	if (ext == NULL || !ext->present) {
+		weston_log("Present extension is not available\n");
+		return;
+	}
+	b->present_opcode = ext->major_opcode;
+
+	ext = xcb_get_extension_data(b->conn, &xcb_xfixes_id);
+	if (ext == NULL || !ext->present) {
+		weston_log("XFixes extension is not available\n");
+		return;
+	}
+
+	/* Both must be asked for their version before use */
+	present = xcb_present_query_version_reply(b->conn,
+			xcb_present_query_version(b->conn, 1, 0), NULL);
+	xfixes = xcb_xfixes_query_version_reply(b->conn,
+			xcb_xfixes_query_version(b->conn, 2, 0), NULL);
+	b->present = present && xfixes;
+	free(present);
+	free(xfixes);
+
+	if (!b->present)
+		return;
+
+#ifdef HAVE_XCB_DRI3
+	xcb_dri3_query_version_reply_t *dri3;
+
+	ext = xcb_get_extension_data(b->conn, &xcb_dri3_id);
+	if (ext && ext->present) {
+		dri3 = xcb_dri3_query_version_reply(b->conn,
+				xcb_dri3_query_version(b->conn, 1, 2), NULL);
+		b->dri3 = dri3 != NULL;
+		b->dri3_modifiers = dri3 &&
+				    (dri3->major_version > 1 ||
+				     dri3->minor_version >= 2);
+		free(dri3);
+	}
+#endif
+
+	weston_log("Presenting with the Present extension%s\n",
+		   b->dri3 ? ", DRI3 is available" : "");
+}
+#endif
+
 static const struct weston_windowed_output_api api = {
 	x11_output_set_size,
 	x11_head_create,
@@ -1925,6 +2523,18 @@ x11_backend_create(struct weston_compositor *compositor,
 		config->fullscreen = 0;
 	}
 
+	if (config->present) {
+#ifdef HAVE_XCB_PRESENT
+		x11_backend_init_present(b);
+#else
+		weston_log("Built without Present support\n");
+#endif
+	}
+
+	/* Present timestamps frames with CLOCK_MONOTONIC */
+	if (b->present)
+		b->base.supported_presentation_clocks = 1 << CLOCK_MONOTONIC;
+
 	b->formats_count = ARRAY_LENGTH(x11_formats);
 	b->formats = pixel_format_get_array(x11_formats, b->formats_count);
 
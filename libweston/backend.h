@@ -91,6 +91,18 @@ struct weston_backend {
 	 */
 	void (*repaint_flush)(struct weston_backend *backend);
 
+	/** An output of a repaint sequence has been repainted (optional)
+	 *
+	 * Called after each successful output repaint between repaint_begin
+	 * and repaint_flush/repaint_cancel. The backend may apply the updates
+	 * it has collected so far, if it knows no other output in the
+	 * sequence can end up in the same update. In that case it must clear
+	 * weston_output::repainted for the outputs it has flushed, so that a
+	 * later repaint_cancel does not reset them.
+	 */
+	void (*repaint_output_done)(struct weston_backend *backend,
+				    struct weston_output *output);
+
 	/** Allocate a new output
 	 *
 	 * @param backend The backend.
@@ -0,0 +1,341 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "client-memory.h"
+#include "libweston-internal.h"
+#include "linux-dmabuf.h"
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+
+/**
+ * Per-client memory accounting: what the compositor holds on behalf of
+ * every client, so that a client pinning memory can be told apart from
+ * a leak in the compositor.
+ *
+ * Buffers are charged to their client when first attached, wl_shm ones
+ * with the size of their data and dma-bufs with the size of their
+ * backing storage. The GL renderer charges the textures it uploads
+ * wl_shm buffers to, and the DRM backend the fbs it creates for client
+ * buffers; an fb wraps the client's dma-buf, so it only has a count.
+ *
+ * The 'client-memory' debug scope prints the current amounts and their
+ * high-water marks.
+ */
+
+static const char *const kind_names[] = {
+	[WESTON_CLIENT_MEMORY_SHM] = "wl_shm buffers",
+	[WESTON_CLIENT_MEMORY_DMABUF] = "dma-bufs",
+	[WESTON_CLIENT_MEMORY_GL_TEXTURE] = "GL textures",
+	[WESTON_CLIENT_MEMORY_DRM_FB] = "DRM fbs",
+};
+
+static_assert(ARRAY_LENGTH(kind_names) == WESTON_CLIENT_MEMORY_KIND_COUNT,
+	      "Every client memory kind needs a name");
+
+WL_EXPORT struct weston_client_memory *
+weston_client_memory_ref(struct weston_client_memory *memory)
+{
+	if (memory)
+		memory->refcount++;
+
+	return memory;
+}
+
+WL_EXPORT void
+weston_client_memory_unref(struct weston_client_memory *memory)
+{
+	if (!memory)
+		return;
+
+	assert(memory->refcount > 0);
+	if (--memory->refcount > 0)
+		return;
+
+	wl_list_remove(&memory->link);
+	free(memory);
+}
+
+WL_EXPORT void
+weston_client_memory_charge(struct weston_client_memory *memory,
+			    enum weston_client_memory_kind kind,
+			    uint64_t bytes)
+{
+	struct weston_client_memory_usage *usage;
+
+	if (!memory)
+		return;
+
+	usage = &memory->usage[kind];
+	usage->bytes += bytes;
+	usage->count++;
+	usage->peak_bytes = MAX(usage->peak_bytes, usage->bytes);
+	usage->peak_count = MAX(usage->peak_count, usage->count);
+}
+
+WL_EXPORT void
+weston_client_memory_uncharge(struct weston_client_memory *memory,
+			      enum weston_client_memory_kind kind,
+			      uint64_t bytes)
+{
+	struct weston_client_memory_usage *usage;
+
+	if (!memory)
+		return;
+
+	usage = &memory->usage[kind];
+	assert(usage->count > 0 && usage->bytes >= bytes);
+	usage->bytes -= bytes;
+	usage->count--;
+}
+
+static void
+client_memory_handle_client_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_client_memory *memory =
+		container_of(listener, struct weston_client_memory,
+			     client_destroy_listener);
+
+	wl_list_remove(&memory->client_destroy_listener.link);
+	memory->client_gone = true;
+	weston_client_memory_unref(memory);
+}
+
+void
+weston_client_read_process_name(pid_t pid, char *name, size_t size)
+{
+	char path[64];
+	ssize_t len;
+	int fd;
+
+	name[0] = '\0';
+
+	snprintf(path, sizeof(path), "/proc/%d/comm", (int) pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	len = read(fd, name, size - 1);
+	close(fd);
+	if (len <= 0)
+		len = 0;
+	else if (name[len - 1] == '\n')
+		len--;
+	name[len] = '\0';
+}
+
+/* The accounting of a client, which holds a reference to it until it
+ * disconnects */
+static struct weston_client_memory *
+client_memory_get(struct weston_compositor *compositor,
+		  struct wl_client *client)
+{
+	struct weston_client_memory *memory;
+	struct wl_listener *listener;
+
+	listener = wl_client_get_destroy_listener(client,
+						  client_memory_handle_client_destroy);
+	if (listener)
+		return container_of(listener, struct weston_client_memory,
+				    client_destroy_listener);
+
+	memory = xzalloc(sizeof(*memory));
+	memory->refcount = 1;
+	wl_client_get_credentials(client, &memory->pid, NULL, NULL);
+	weston_client_read_process_name(memory->pid, memory->name,
+					sizeof(memory->name));
+
+	memory->client_destroy_listener.notify =
+		client_memory_handle_client_destroy;
+	wl_client_add_destroy_listener(client,
+				       &memory->client_destroy_listener);
+	wl_list_insert(compositor->client_memory_list.prev, &memory->link);
+
+	return memory;
+}
+
+/* Size of the memory backing a dma-buf, from the size of its fds, or as
+ * laid out by its attributes when they cannot tell */
+static uint64_t
+dmabuf_size(const struct dmabuf_attributes *attributes)
+{
+	uint64_t size = 0;
+	off_t fd_size;
+	int i, j;
+
+	for (i = 0; i < attributes->n_planes; i++) {
+		/* Planes often share one fd. */
+		for (j = 0; j < i; j++) {
+			if (attributes->fd[j] == attributes->fd[i])
+				break;
+		}
+		if (j < i)
+			continue;
+
+		fd_size = lseek(attributes->fd[i], 0, SEEK_END);
+		if (fd_size > 0)
+			size += fd_size;
+		else
+			size += (uint64_t) attributes->offset[i] +
+				(uint64_t) attributes->stride[i] *
+				attributes->height;
+	}
+
+	return size;
+}
+
+/** Charge a new buffer to the client that created it */
+void
+weston_buffer_charge_client_memory(struct weston_compositor *compositor,
+				   struct weston_buffer *buffer)
+{
+	struct linux_dmabuf_buffer *dmabuf;
+	struct wl_client *client = wl_resource_get_client(buffer->resource);
+
+	buffer->client_memory =
+		weston_client_memory_ref(client_memory_get(compositor, client));
+
+	switch (buffer->type) {
+	case WESTON_BUFFER_SHM:
+		buffer->client_memory_bytes =
+			(uint64_t) buffer->stride * buffer->height;
+		weston_client_memory_charge(buffer->client_memory,
+					    WESTON_CLIENT_MEMORY_SHM,
+					    buffer->client_memory_bytes);
+		break;
+	case WESTON_BUFFER_DMABUF:
+		dmabuf = buffer->dmabuf;
+		buffer->client_memory_bytes = dmabuf_size(&dmabuf->attributes);
+		weston_client_memory_charge(buffer->client_memory,
+					    WESTON_CLIENT_MEMORY_DMABUF,
+					    buffer->client_memory_bytes);
+		break;
+	case WESTON_BUFFER_SOLID:
+	case WESTON_BUFFER_RENDERER_OPAQUE:
+		/* Nothing to speak of, or no way to tell the size of legacy
+		 * EGL buffers; fbs for them are still accounted. */
+		break;
+	}
+}
+
+/** Give back what a buffer was charged, as it is destroyed */
+void
+weston_buffer_uncharge_client_memory(struct weston_buffer *buffer)
+{
+	switch (buffer->type) {
+	case WESTON_BUFFER_SHM:
+		weston_client_memory_uncharge(buffer->client_memory,
+					      WESTON_CLIENT_MEMORY_SHM,
+					      buffer->client_memory_bytes);
+		break;
+	case WESTON_BUFFER_DMABUF:
+		weston_client_memory_uncharge(buffer->client_memory,
+					      WESTON_CLIENT_MEMORY_DMABUF,
+					      buffer->client_memory_bytes);
+		break;
+	case WESTON_BUFFER_SOLID:
+	case WESTON_BUFFER_RENDERER_OPAQUE:
+		break;
+	}
+
+	weston_client_memory_unref(buffer->client_memory);
+	buffer->client_memory = NULL;
+}
+
+/* Client and buffer destruction can come after the compositor is gone,
+ * so unlink the accounting from it. */
+void
+weston_compositor_client_memory_fini(struct weston_compositor *compositor)
+{
+	struct weston_client_memory *memory, *tmp;
+
+	wl_list_for_each_safe(memory, tmp, &compositor->client_memory_list,
+			      link) {
+		wl_list_remove(&memory->link);
+		wl_list_init(&memory->link);
+	}
+}
+
+static void
+client_memory_usage_print(struct weston_log_subscription *sub,
+			  const char *name,
+			  const struct weston_client_memory_usage *usage)
+{
+	weston_log_subscription_printf(sub,
+				       "\t%-16s %6" PRIu32 " (peak %6" PRIu32 "), "
+				       "%10.1f KiB (peak %10.1f KiB)\n",
+				       name, usage->count, usage->peak_count,
+				       usage->bytes / 1024.0,
+				       usage->peak_bytes / 1024.0);
+}
+
+void
+weston_client_memory_debug_scope_cb(struct weston_log_subscription *sub,
+				    void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_client_memory *memory;
+	struct weston_client_memory_usage total[WESTON_CLIENT_MEMORY_KIND_COUNT];
+	unsigned int kind;
+
+	memset(total, 0, sizeof(total));
+
+	wl_list_for_each(memory, &ec->client_memory_list, link) {
+		weston_log_subscription_printf(sub, "Client PID %d (%s)%s:\n",
+					       (int) memory->pid,
+					       memory->name[0] ?
+					       memory->name : "unknown",
+					       memory->client_gone ?
+					       ", disconnected" : "");
+
+		for (kind = 0; kind < WESTON_CLIENT_MEMORY_KIND_COUNT; kind++) {
+			const struct weston_client_memory_usage *usage =
+				&memory->usage[kind];
+
+			client_memory_usage_print(sub, kind_names[kind], usage);
+			total[kind].bytes += usage->bytes;
+			total[kind].count += usage->count;
+			total[kind].peak_bytes += usage->peak_bytes;
+			total[kind].peak_count += usage->peak_count;
+		}
+	}
+
+	weston_log_subscription_printf(sub, "All clients "
+				       "(peaks are the sum of the clients' ones):\n");
+	for (kind = 0; kind < WESTON_CLIENT_MEMORY_KIND_COUNT; kind++)
+		client_memory_usage_print(sub, kind_names[kind], &total[kind]);
+
+	weston_log_subscription_complete(sub);
+}
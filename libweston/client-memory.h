@@ -0,0 +1,106 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_CLIENT_MEMORY_H
+#define WESTON_CLIENT_MEMORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <wayland-server-core.h>
+
+struct weston_buffer;
+struct weston_compositor;
+struct weston_log_subscription;
+
+/** What client memory is accounted as */
+enum weston_client_memory_kind {
+	WESTON_CLIENT_MEMORY_SHM = 0,		/**< wl_shm buffers */
+	WESTON_CLIENT_MEMORY_DMABUF,		/**< imported dma-bufs */
+	WESTON_CLIENT_MEMORY_GL_TEXTURE,	/**< GL textures for wl_shm */
+	WESTON_CLIENT_MEMORY_DRM_FB,		/**< DRM fbs for client buffers */
+	WESTON_CLIENT_MEMORY_KIND_COUNT,
+};
+
+/** Amount of one kind of memory held for a client */
+struct weston_client_memory_usage {
+	uint64_t bytes;
+	uint64_t peak_bytes;	/**< high-water mark of bytes */
+	uint32_t count;
+	uint32_t peak_count;	/**< high-water mark of count */
+};
+
+/** Memory held by the compositor on behalf of a client
+ *
+ * Lives as long as the client, or as anything charged to it, e.g. a
+ * weston_buffer outliving its wl_buffer.
+ */
+struct weston_client_memory {
+	struct wl_list link;	/**< weston_compositor::client_memory_list */
+	int refcount;
+
+	struct wl_listener client_destroy_listener;
+	bool client_gone;
+	pid_t pid;
+	char name[16];		/**< process name when the client connected */
+
+	struct weston_client_memory_usage usage[WESTON_CLIENT_MEMORY_KIND_COUNT];
+};
+
+struct weston_client_memory *
+weston_client_memory_ref(struct weston_client_memory *memory);
+
+void
+weston_client_memory_unref(struct weston_client_memory *memory);
+
+void
+weston_client_memory_charge(struct weston_client_memory *memory,
+			    enum weston_client_memory_kind kind,
+			    uint64_t bytes);
+
+void
+weston_client_memory_uncharge(struct weston_client_memory *memory,
+			      enum weston_client_memory_kind kind,
+			      uint64_t bytes);
+
+void
+weston_buffer_charge_client_memory(struct weston_compositor *compositor,
+				   struct weston_buffer *buffer);
+
+void
+weston_buffer_uncharge_client_memory(struct weston_buffer *buffer);
+
+void
+weston_client_read_process_name(pid_t pid, char *name, size_t size);
+
+void
+weston_compositor_client_memory_fini(struct weston_compositor *compositor);
+
+void
+weston_client_memory_debug_scope_cb(struct weston_log_subscription *sub,
+				    void *data);
+
+#endif /* WESTON_CLIENT_MEMORY_H */
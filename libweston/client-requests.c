@@ -0,0 +1,249 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "client-memory.h"
+#include "client-requests.h"
+#include "libweston-internal.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+
+/**
+ * Per-client request accounting, from a protocol logger which sees every
+ * request before it is dispatched.
+ *
+ * All of a client's buffered requests are dispatched in one go, so a
+ * client flooding the compositor can hold up the event loop, and with it
+ * DRM page flip events and the repaint timer. Those live on the
+ * compositor's priority loop instead, see weston_compositor_get_priority_loop(),
+ * and every weston_compositor::client_request_budget requests of one
+ * client in one event loop iteration the priority loop is dispatched
+ * in between two of its requests.
+ *
+ * The 'client-requests' debug scope prints the counts with their
+ * high-water marks.
+ */
+
+static void
+client_requests_handle_client_destroy(struct wl_listener *listener,
+				      void *data)
+{
+	struct weston_client_requests *requests =
+		container_of(listener, struct weston_client_requests,
+			     client_destroy_listener);
+
+	wl_list_remove(&requests->client_destroy_listener.link);
+	wl_list_remove(&requests->link);
+	free(requests);
+}
+
+static struct weston_client_requests *
+client_requests_get(struct weston_compositor *compositor,
+		    struct wl_client *client)
+{
+	struct weston_client_requests *requests;
+	struct wl_listener *listener;
+
+	listener = wl_client_get_destroy_listener(client,
+						  client_requests_handle_client_destroy);
+	if (listener)
+		return container_of(listener, struct weston_client_requests,
+				    client_destroy_listener);
+
+	requests = xzalloc(sizeof(*requests));
+	wl_client_get_credentials(client, &requests->pid, NULL, NULL);
+	weston_client_read_process_name(requests->pid, requests->name,
+					sizeof(requests->name));
+
+	requests->client_destroy_listener.notify =
+		client_requests_handle_client_destroy;
+	wl_client_add_destroy_listener(client,
+				       &requests->client_destroy_listener);
+	wl_list_insert(compositor->client_requests_list.prev, &requests->link);
+
+	return requests;
+}
+
+/* Runs once the event loop iteration which dispatched requests is done */
+static void
+client_requests_reset(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_client_requests *requests;
+
+	compositor->client_requests_reset = NULL;
+
+	wl_list_for_each(requests, &compositor->client_requests_list, link)
+		requests->dispatch = 0;
+}
+
+static void
+client_requests_count_second(struct weston_client_requests *requests)
+{
+	struct timespec now;
+	int64_t now_msec;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	now_msec = timespec_to_msec(&now);
+
+	if (now_msec - requests->second_start_msec >= 1000) {
+		if (now_msec - requests->second_start_msec < 2000)
+			requests->last_second = requests->this_second;
+		else
+			requests->last_second = 0;
+		requests->this_second = 0;
+		requests->second_start_msec = now_msec;
+	}
+
+	requests->this_second++;
+	requests->peak_second = MAX(requests->peak_second,
+				    requests->this_second);
+}
+
+static void
+client_requests_logger(void *user_data,
+		       enum wl_protocol_logger_type direction,
+		       const struct wl_protocol_logger_message *message)
+{
+	struct weston_compositor *compositor = user_data;
+	struct weston_client_requests *requests;
+	struct wl_event_loop *loop;
+	struct wl_client *client;
+
+	if (direction != WL_PROTOCOL_LOGGER_REQUEST)
+		return;
+
+	client = wl_resource_get_client(message->resource);
+	requests = client_requests_get(compositor, client);
+	requests->total++;
+	requests->dispatch++;
+	requests->peak_dispatch = MAX(requests->peak_dispatch,
+				      requests->dispatch);
+	client_requests_count_second(requests);
+
+	if (!compositor->client_requests_reset) {
+		loop = wl_display_get_event_loop(compositor->wl_display);
+		compositor->client_requests_reset =
+			wl_event_loop_add_idle(loop, client_requests_reset,
+					       compositor);
+	}
+
+	if (compositor->client_request_budget == 0 ||
+	    requests->dispatch % compositor->client_request_budget != 0)
+		return;
+
+	/* The previous request is done and this one is not dispatched yet,
+	 * so the client's state is consistent for a repaint.
+	 *
+	 * libwayland has already looked up the target and the arguments of
+	 * this request, so the priority loop sources must not destroy any
+	 * object which takes requests, nor the client. Repaints and page
+	 * flips only destroy wl_callback and wp_presentation_feedback
+	 * objects, which take none, and they only queue events to clients.
+	 * The priority loop cannot dispatch client requests itself, so
+	 * this does not nest. Input which could run a binding is only read
+	 * here, see libinput_source_dispatch(). */
+	requests->over_budget++;
+	compositor->preempted_client = client;
+	wl_event_loop_dispatch(compositor->priority_loop, 0);
+	compositor->preempted_client = NULL;
+}
+
+void
+weston_compositor_client_requests_init(struct weston_compositor *compositor)
+{
+	wl_list_init(&compositor->client_requests_list);
+	compositor->client_requests_logger =
+		wl_display_add_protocol_logger(compositor->wl_display,
+					       client_requests_logger,
+					       compositor);
+}
+
+/* Clients disconnect after the compositor is gone, so stop listening
+ * to them. */
+void
+weston_compositor_client_requests_fini(struct weston_compositor *compositor)
+{
+	struct weston_client_requests *requests, *tmp;
+
+	if (compositor->client_requests_reset)
+		wl_event_source_remove(compositor->client_requests_reset);
+	compositor->client_requests_reset = NULL;
+
+	if (compositor->client_requests_logger)
+		wl_protocol_logger_destroy(compositor->client_requests_logger);
+	compositor->client_requests_logger = NULL;
+
+	wl_list_for_each_safe(requests, tmp,
+			      &compositor->client_requests_list, link) {
+		wl_list_remove(&requests->client_destroy_listener.link);
+		wl_list_remove(&requests->link);
+		free(requests);
+	}
+}
+
+void
+weston_client_requests_debug_scope_cb(struct weston_log_subscription *sub,
+				      void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_client_requests *requests;
+
+	if (ec->client_request_budget)
+		weston_log_subscription_printf(sub, "Budget: %" PRIu32
+					       " requests per client and "
+					       "dispatch\n",
+					       ec->client_request_budget);
+	else
+		weston_log_subscription_printf(sub, "Budget: none\n");
+
+	wl_list_for_each(requests, &ec->client_requests_list, link) {
+		weston_log_subscription_printf(sub, "Client PID %d (%s):\n",
+					       (int) requests->pid,
+					       requests->name[0] ?
+					       requests->name : "unknown");
+		weston_log_subscription_printf(sub,
+					       "\ttotal %" PRIu64 ", last second "
+					       "%" PRIu32 " (peak %" PRIu32 "), "
+					       "peak per dispatch %" PRIu32 ", "
+					       "over budget %" PRIu32 "\n",
+					       requests->total,
+					       requests->last_second,
+					       requests->peak_second,
+					       requests->peak_dispatch,
+					       requests->over_budget);
+	}
+
+	weston_log_subscription_complete(sub);
+}
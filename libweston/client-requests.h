@@ -0,0 +1,66 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_CLIENT_REQUESTS_H
+#define WESTON_CLIENT_REQUESTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <wayland-server-core.h>
+
+struct weston_compositor;
+struct weston_log_subscription;
+
+/** Requests dispatched for a client */
+struct weston_client_requests {
+	struct wl_list link;	/**< weston_compositor::client_requests_list */
+
+	struct wl_listener client_destroy_listener;
+	pid_t pid;
+	char name[16];		/**< process name when the client connected */
+
+	uint64_t total;
+	uint32_t dispatch;	/**< in the current event loop iteration */
+	uint32_t peak_dispatch;	/**< high-water mark of dispatch */
+	uint32_t last_second;	/**< in the last full second */
+	uint32_t this_second;
+	uint32_t peak_second;	/**< high-water mark of last_second */
+	int64_t second_start_msec;
+	uint32_t over_budget;	/**< times the priority loop ran for it */
+};
+
+void
+weston_compositor_client_requests_init(struct weston_compositor *compositor);
+
+void
+weston_compositor_client_requests_fini(struct weston_compositor *compositor);
+
+void
+weston_client_requests_debug_scope_cb(struct weston_log_subscription *sub,
+				      void *data);
+
+#endif /* WESTON_CLIENT_REQUESTS_H */
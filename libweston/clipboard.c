@@ -25,21 +25,32 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/types.h>
 #include <sys/uio.h>
 
 #include <libweston/libweston.h>
 #include "libweston-internal.h"
 #include "shared/helpers.h"
+#include "shared/os-compatibility.h"
 
+/* Most bytes moved per wake-up, so that a big transfer does not hold up
+ * the main loop; this is also the default pipe capacity. */
+#define CLIPBOARD_CHUNK_SIZE (64 * 1024)
+
+/* The contents are kept in an anonymous file rather than in compositor
+ * memory, and moved in and out of it with splice() where the other end is
+ * a pipe, so they never pass through user space. */
 struct clipboard_source {
 	struct weston_data_source base;
-	struct wl_array contents;
+	int contents_fd;
+	size_t contents_size;
 	struct clipboard *clipboard;
 	struct wl_event_source *event_source;
 	uint32_t serial;
@@ -74,7 +85,7 @@ clipboard_source_unref(struct clipboard_source *source)
 	s = source->base.mime_types.data;
 	free(*s);
 	wl_array_release(&source->base.mime_types);
-	wl_array_release(&source->contents);
+	close(source->contents_fd);
 	free(source);
 }
 
@@ -83,17 +94,14 @@ clipboard_source_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_source *source = data;
 	struct clipboard *clipboard = source->clipboard;
-	char *p;
-	int len, size;
+	loff_t offset = source->contents_size;
+	ssize_t len;
 
-	if (source->contents.alloc - source->contents.size < 1024) {
-		wl_array_add(&source->contents, 1024);
-		source->contents.size -= 1024;
-	}
+	len = splice(fd, NULL, source->contents_fd, &offset,
+		     CLIPBOARD_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (len < 0 && errno == EAGAIN)
+		return 1;
 
-	p = source->contents.data + source->contents.size;
-	size = source->contents.alloc - source->contents.size;
-	len = read(fd, p, size);
 	if (len == 0) {
 		wl_event_source_remove(source->event_source);
 		close(fd);
@@ -102,7 +110,7 @@ clipboard_source_data(int fd, uint32_t mask, void *data)
 		clipboard_source_unref(source);
 		clipboard->source = NULL;
 	} else {
-		source->contents.size += len;
+		source->contents_size += len;
 	}
 
 	return 1;
@@ -147,7 +155,14 @@ clipboard_source_create(struct clipboard *clipboard,
 	if (source == NULL)
 		return NULL;
 
-	wl_array_init(&source->contents);
+	/* The file cannot be created empty; it grows as the contents
+	 * are spliced in. */
+	source->contents_fd = os_create_anonymous_file(4096);
+	if (source->contents_fd < 0) {
+		free(source);
+		return NULL;
+	}
+
 	wl_array_init(&source->base.mime_types);
 	source->base.resource = NULL;
 	source->base.accept = clipboard_source_accept;
@@ -178,6 +193,7 @@ clipboard_source_create(struct clipboard *clipboard,
  err_strdup:
 	wl_array_release(&source->base.mime_types);
  err_add:
+	close(source->contents_fd);
 	free(source);
 
 	return NULL;
@@ -189,17 +205,46 @@ struct clipboard_client {
 	struct clipboard_source *source;
 };
 
+/** Write up to len bytes of the contents, from offset on, to fd
+ *
+ * Pipes are spliced to, so nothing is copied through the compositor; any
+ * other kind of fd falls back to a bounded copy.
+ */
+static ssize_t
+clipboard_source_write_contents(struct clipboard_source *source, int fd,
+				size_t offset, size_t len)
+{
+	loff_t off = offset;
+	char buf[4096];
+	ssize_t ret;
+
+	ret = splice(source->contents_fd, &off, fd, NULL, len,
+		     SPLICE_F_NONBLOCK);
+	if (ret >= 0 || errno != EINVAL)
+		return ret;
+
+	ret = pread(source->contents_fd, buf, MIN(len, sizeof buf), offset);
+	if (ret <= 0)
+		return ret;
+
+	return write(fd, buf, ret);
+}
+
 static int
 clipboard_client_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_client *client = data;
-	char *p;
 	size_t size;
-	int len;
+	ssize_t len;
+
+	size = client->source->contents_size;
+	len = clipboard_source_write_contents(client->source, fd,
+					      client->offset,
+					      MIN(size - client->offset,
+						  CLIPBOARD_CHUNK_SIZE));
+	if (len < 0 && errno == EAGAIN)
+		return 1;
 
-	size = client->source->contents.size;
-	p = client->source->contents.data;
-	len = write(fd, p + client->offset, size - client->offset);
 	if (len > 0)
 		client->offset += len;
 
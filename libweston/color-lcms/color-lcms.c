@@ -33,6 +33,7 @@
 #include "color.h"
 #include "color-lcms.h"
 #include "color-properties.h"
+#include "shared/hash.h"
 #include "shared/helpers.h"
 #include "shared/xalloc.h"
 #include "shared/weston-assert.h"
@@ -408,6 +409,10 @@ cmlcms_init(struct weston_color_manager *cm_base)
 
 	cmsSetLogErrorHandlerTHR(cm->lcms_ctx, lcms_error_logger);
 
+	cm->profile_index = hash_table_create();
+	if (!cm->profile_index)
+		goto out_err;
+
 	if (!cmlcms_create_stock_profile(cm)) {
 		weston_log("color-lcms: error: cmlcms_create_stock_profile failed\n");
 		goto out_err;
@@ -417,6 +422,10 @@ cmlcms_init(struct weston_color_manager *cm_base)
 	return true;
 
 out_err:
+	if (cm->profile_index)
+		hash_table_destroy(cm->profile_index);
+	cm->profile_index = NULL;
+
 	if (cm->lcms_ctx)
 		cmsDeleteContext(cm->lcms_ctx);
 	cm->lcms_ctx = NULL;
@@ -464,6 +473,9 @@ cmlcms_destroy(struct weston_color_manager *cm_base)
 	assert(wl_list_empty(&cm->color_transform_list));
 	assert(wl_list_empty(&cm->color_profile_list));
 
+	if (cm->profile_index)
+		hash_table_destroy(cm->profile_index);
+
 	if (cm->lcms_ctx)
 		cmsDeleteContext(cm->lcms_ctx);
 
@@ -491,6 +503,9 @@ weston_color_manager_create(struct weston_compositor *compositor)
 	cm->base.destroy_color_profile = cmlcms_destroy_color_profile;
 	cm->base.ref_stock_sRGB_color_profile = cmlcms_ref_stock_sRGB_color_profile;
 	cm->base.get_color_profile_from_icc = cmlcms_get_color_profile_from_icc;
+	cm->base.parse_icc = cmlcms_parse_icc;
+	cm->base.get_color_profile_from_parsed_icc =
+		cmlcms_get_color_profile_from_parsed_icc;
 	cm->base.get_color_profile_from_params = cmlcms_get_color_profile_from_params;
 	cm->base.send_image_desc_info = cmlcms_send_image_desc_info;
 	cm->base.destroy_color_transform = cmlcms_destroy_color_transform;
@@ -63,6 +63,13 @@ struct weston_color_manager_lcms {
 
 	struct wl_list color_transform_list; /* cmlcms_color_transform::link */
 	struct wl_list color_profile_list; /* cmlcms_color_profile::link */
+
+	/* color_profile_list indexed by MD5 sum or params. A profile whose
+	 * key is already taken stays out of the index, and
+	 * unindexed_profiles counts those to fall back to the list. */
+	struct hash_table *profile_index;
+	unsigned int unindexed_profiles;
+
 	struct cmlcms_color_profile *sRGB_profile; /* stock profile */
 };
 
@@ -107,6 +114,7 @@ struct cmlcms_color_profile {
 
 	/* struct weston_color_manager_lcms::color_profile_list */
 	struct wl_list link;
+	bool indexed; /* in weston_color_manager_lcms::profile_index */
 
 	/* Only for CMLCMS_PROFILE_TYPE_ICC */
 	struct {
@@ -166,6 +174,21 @@ cmlcms_get_color_profile_from_icc(struct weston_color_manager *cm,
 				  struct weston_color_profile **cprof_out,
 				  char **errmsg);
 
+struct weston_color_parsed_icc *
+cmlcms_parse_icc(struct weston_color_manager *cm_base,
+		 const void *icc_data,
+		 size_t icc_len,
+		 char **errmsg);
+
+bool
+cmlcms_get_color_profile_from_parsed_icc(struct weston_color_manager *cm_base,
+					 struct weston_color_parsed_icc *parsed_base,
+					 const void *icc_data,
+					 size_t icc_len,
+					 const char *name_part,
+					 struct weston_color_profile **cprof_out,
+					 char **errmsg);
+
 bool
 cmlcms_get_color_profile_from_params(struct weston_color_manager *cm_base,
 				     const struct weston_color_profile_params *params,
@@ -33,6 +33,7 @@
 #include "color.h"
 #include "color-lcms.h"
 #include "color-management.h"
+#include "shared/hash.h"
 #include "shared/helpers.h"
 #include "shared/string-helpers.h"
 #include "shared/xalloc.h"
@@ -359,18 +360,109 @@ validate_icc_profile(struct lcmsProfilePtr profile, char **errmsg)
 	return true;
 }
 
+static uint32_t
+cmlcms_md5_key(const struct cmlcms_md5_sum *md5sum)
+{
+	uint32_t key;
+
+	/* A digest is as good a hash as any part of it. */
+	memcpy(&key, md5sum->bytes, sizeof(key));
+
+	return key;
+}
+
+static uint32_t
+cmlcms_params_key(const struct weston_color_profile_params *params)
+{
+	const uint8_t *bytes = (const uint8_t *)params;
+	uint32_t key = 2166136261u;
+	size_t i;
+
+	/* FNV-1a, over the same bytes find_color_profile_by_params()
+	 * compares. */
+	for (i = 0; i < sizeof(*params); i++) {
+		key ^= bytes[i];
+		key *= 16777619u;
+	}
+
+	return key;
+}
+
+static uint32_t
+cmlcms_color_profile_key(const struct cmlcms_color_profile *cprof)
+{
+	switch (cprof->type) {
+	case CMLCMS_PROFILE_TYPE_ICC:
+		return cmlcms_md5_key(&cprof->icc.md5sum);
+	case CMLCMS_PROFILE_TYPE_PARAMS:
+		return cmlcms_params_key(cprof->params);
+	}
+
+	weston_assert_not_reached(cprof->base.cm->compositor,
+				  "unknown profile type");
+	return 0;
+}
+
+static void
+cmlcms_color_profile_index(struct weston_color_manager_lcms *cm,
+			   struct cmlcms_color_profile *cprof)
+{
+	uint32_t key = cmlcms_color_profile_key(cprof);
+
+	if (!hash_table_lookup(cm->profile_index, key) &&
+	    hash_table_insert(cm->profile_index, key, cprof) == 0) {
+		cprof->indexed = true;
+		return;
+	}
+
+	cm->unindexed_profiles++;
+}
+
+static void
+cmlcms_color_profile_unindex(struct weston_color_manager_lcms *cm,
+			     struct cmlcms_color_profile *cprof)
+{
+	if (!cprof->indexed) {
+		cm->unindexed_profiles--;
+		return;
+	}
+
+	hash_table_remove(cm->profile_index, cmlcms_color_profile_key(cprof));
+	cprof->indexed = false;
+}
+
+static bool
+cmlcms_color_profile_has_md5(const struct cmlcms_color_profile *cprof,
+			     const struct cmlcms_md5_sum *md5sum)
+{
+	return cprof->type == CMLCMS_PROFILE_TYPE_ICC &&
+	       memcmp(cprof->icc.md5sum.bytes,
+		      md5sum->bytes, sizeof(md5sum->bytes)) == 0;
+}
+
+static bool
+cmlcms_color_profile_has_params(const struct cmlcms_color_profile *cprof,
+				const struct weston_color_profile_params *params)
+{
+	return cprof->type == CMLCMS_PROFILE_TYPE_PARAMS &&
+	       memcmp(cprof->params, params, sizeof(*params)) == 0;
+}
+
 static struct cmlcms_color_profile *
 cmlcms_find_color_profile_by_md5(const struct weston_color_manager_lcms *cm,
 				 const struct cmlcms_md5_sum *md5sum)
 {
 	struct cmlcms_color_profile *cprof;
 
-	wl_list_for_each(cprof, &cm->color_profile_list, link) {
-		if (cprof->type != CMLCMS_PROFILE_TYPE_ICC)
-			continue;
+	cprof = hash_table_lookup(cm->profile_index, cmlcms_md5_key(md5sum));
+	if (cprof && cmlcms_color_profile_has_md5(cprof, md5sum))
+		return cprof;
 
-		if (memcmp(cprof->icc.md5sum.bytes,
-			   md5sum->bytes, sizeof(md5sum->bytes)) == 0)
+	if (cm->unindexed_profiles == 0)
+		return NULL;
+
+	wl_list_for_each(cprof, &cm->color_profile_list, link) {
+		if (cmlcms_color_profile_has_md5(cprof, md5sum))
 			return cprof;
 	}
 
@@ -395,11 +487,15 @@ cmlcms_find_color_profile_by_params(const struct weston_color_manager_lcms *cm,
 			sizeof(params->maxFALL),
 		"struct weston_color_profile_params must not contain implicit padding");
 
-	wl_list_for_each(cprof, &cm->color_profile_list, link) {
-		if (cprof->type != CMLCMS_PROFILE_TYPE_PARAMS)
-			continue;
+	cprof = hash_table_lookup(cm->profile_index, cmlcms_params_key(params));
+	if (cprof && cmlcms_color_profile_has_params(cprof, params))
+		return cprof;
 
-		if (memcmp(cprof->params, params, sizeof(*params)) == 0)
+	if (cm->unindexed_profiles == 0)
+		return NULL;
+
+	wl_list_for_each(cprof, &cm->color_profile_list, link) {
+		if (cmlcms_color_profile_has_params(cprof, params))
 			return cprof;
 	}
 
@@ -434,9 +530,11 @@ cmlcms_color_profile_create(struct weston_color_manager_lcms *cm,
 
 	weston_color_profile_init(&cprof->base, &cm->base);
 	cprof->base.description = desc;
+	cprof->type = CMLCMS_PROFILE_TYPE_ICC;
 	cprof->icc.profile = profile;
 	cmsGetHeaderProfileID(profile.p, cprof->icc.md5sum.bytes);
 	wl_list_insert(&cm->color_profile_list, &cprof->link);
+	cmlcms_color_profile_index(cm, cprof);
 
 	weston_log_scope_printf(cm->profiles_scope,
 				"New color profile: p%u\n", cprof->base.id);
@@ -453,6 +551,7 @@ cmlcms_color_profile_destroy(struct cmlcms_color_profile *cprof)
 {
 	struct weston_color_manager_lcms *cm = to_cmlcms(cprof->base.cm);
 
+	cmlcms_color_profile_unindex(cm, cprof);
 	wl_list_remove(&cprof->link);
 	cmsCloseProfile(cprof->extract.vcgt.p);
 	cmsCloseProfile(cprof->extract.inv_eotf.p);
@@ -554,8 +653,6 @@ cmlcms_create_stock_profile(struct weston_color_manager_lcms *cm)
 	if (!cm->sRGB_profile)
 		goto err_close;
 
-	cm->sRGB_profile->type = CMLCMS_PROFILE_TYPE_ICC;
-
 	if (!ensure_output_profile_extract(cm->sRGB_profile, cm->lcms_ctx,
 					   cmlcms_reasonable_1D_points(), &err_msg))
 		goto err_close;
@@ -582,34 +679,51 @@ cmlcms_ref_stock_sRGB_color_profile(struct weston_color_manager *cm_base)
 	return &cprof->base;
 }
 
-bool
-cmlcms_get_color_profile_from_icc(struct weston_color_manager *cm_base,
-				  const void *icc_data,
-				  size_t icc_len,
-				  const char *name_part,
-				  struct weston_color_profile **cprof_out,
-				  char **errmsg)
+struct cmlcms_parsed_icc {
+	struct weston_color_parsed_icc base;
+	struct lcmsProfilePtr profile;
+	struct cmlcms_md5_sum md5sum;
+};
+
+static void
+cmlcms_parsed_icc_destroy(struct weston_color_parsed_icc *parsed_base)
+{
+	struct cmlcms_parsed_icc *parsed =
+		container_of(parsed_base, struct cmlcms_parsed_icc, base);
+
+	cmsCloseProfile(parsed->profile.p);
+	free(parsed);
+}
+
+/**
+ * Reads, validates and fingerprints an ICC profile.
+ *
+ * Touches nothing but the LittleCMS context, so that the color management
+ * protocol can run it on a worker thread.
+ */
+struct weston_color_parsed_icc *
+cmlcms_parse_icc(struct weston_color_manager *cm_base,
+		 const void *icc_data,
+		 size_t icc_len,
+		 char **errmsg)
 {
 	struct weston_color_manager_lcms *cm = to_cmlcms(cm_base);
+	struct cmlcms_parsed_icc *parsed;
 	struct lcmsProfilePtr profile;
-	struct cmlcms_md5_sum md5sum;
-	struct ro_anonymous_file *prof_rofile = NULL;
-	struct cmlcms_color_profile *cprof = NULL;
-	char *desc = NULL;
 
 	if (!icc_data || icc_len < 1) {
 		str_printf(errmsg, "No ICC data.");
-		return false;
+		return NULL;
 	}
 	if (icc_len >= UINT32_MAX) {
 		str_printf(errmsg, "Too much ICC data.");
-		return false;
+		return NULL;
 	}
 
 	profile.p = cmsOpenProfileFromMemTHR(cm->lcms_ctx, icc_data, icc_len);
 	if (!profile.p) {
 		str_printf(errmsg, "ICC data not understood.");
-		return false;
+		return NULL;
 	}
 
 	if (!validate_icc_profile(profile, errmsg))
@@ -620,15 +734,46 @@ cmlcms_get_color_profile_from_icc(struct weston_color_manager *cm_base,
 		goto err_close;
 	}
 
-	cmsGetHeaderProfileID(profile.p, md5sum.bytes);
-	cprof = cmlcms_find_color_profile_by_md5(cm, &md5sum);
+	parsed = zalloc(sizeof(*parsed));
+	if (!parsed)
+		goto err_close;
+
+	parsed->base.destroy = cmlcms_parsed_icc_destroy;
+	parsed->profile = profile;
+	cmsGetHeaderProfileID(profile.p, parsed->md5sum.bytes);
+
+	return &parsed->base;
+
+err_close:
+	cmsCloseProfile(profile.p);
+	return NULL;
+}
+
+bool
+cmlcms_get_color_profile_from_parsed_icc(struct weston_color_manager *cm_base,
+					 struct weston_color_parsed_icc *parsed_base,
+					 const void *icc_data,
+					 size_t icc_len,
+					 const char *name_part,
+					 struct weston_color_profile **cprof_out,
+					 char **errmsg)
+{
+	struct weston_color_manager_lcms *cm = to_cmlcms(cm_base);
+	struct cmlcms_parsed_icc *parsed =
+		container_of(parsed_base, struct cmlcms_parsed_icc, base);
+	struct ro_anonymous_file *prof_rofile = NULL;
+	struct cmlcms_color_profile *cprof = NULL;
+	char *desc = NULL;
+
+	cprof = cmlcms_find_color_profile_by_md5(cm, &parsed->md5sum);
 	if (cprof) {
 		*cprof_out = weston_color_profile_ref(&cprof->base);
-		cmsCloseProfile(profile.p);
+		cmlcms_parsed_icc_destroy(&parsed->base);
 		return true;
 	}
 
-	desc = make_icc_file_description(profile, &md5sum, name_part);
+	desc = make_icc_file_description(parsed->profile, &parsed->md5sum,
+					 name_part);
 	if (!desc)
 		goto err_close;
 
@@ -636,26 +781,46 @@ cmlcms_get_color_profile_from_icc(struct weston_color_manager *cm_base,
 	if (!prof_rofile)
 		goto err_close;
 
-	cprof = cmlcms_color_profile_create(cm, profile, desc, errmsg);
+	cprof = cmlcms_color_profile_create(cm, parsed->profile, desc, errmsg);
 	if (!cprof)
 		goto err_close;
 
-	cprof->type = CMLCMS_PROFILE_TYPE_ICC;
 	cprof->icc.prof_rofile = prof_rofile;
 
+	/* The profile is the cprof's now. */
+	free(parsed);
+
 	*cprof_out = &cprof->base;
 	return true;
 
 err_close:
 	if (prof_rofile)
 		os_ro_anonymous_file_destroy(prof_rofile);
-	if (cprof)
-		cmlcms_color_profile_destroy(cprof);
 	free(desc);
-	cmsCloseProfile(profile.p);
+	cmlcms_parsed_icc_destroy(&parsed->base);
 	return false;
 }
 
+bool
+cmlcms_get_color_profile_from_icc(struct weston_color_manager *cm_base,
+				  const void *icc_data,
+				  size_t icc_len,
+				  const char *name_part,
+				  struct weston_color_profile **cprof_out,
+				  char **errmsg)
+{
+	struct weston_color_parsed_icc *parsed;
+
+	parsed = cmlcms_parse_icc(cm_base, icc_data, icc_len, errmsg);
+	if (!parsed)
+		return false;
+
+	return cmlcms_get_color_profile_from_parsed_icc(cm_base, parsed,
+							icc_data, icc_len,
+							name_part, cprof_out,
+							errmsg);
+}
+
 bool
 cmlcms_get_color_profile_from_params(struct weston_color_manager *cm_base,
 				     const struct weston_color_profile_params *params,
@@ -697,6 +862,7 @@ cmlcms_get_color_profile_from_params(struct weston_color_manager *cm_base,
 	weston_color_profile_init(&cprof->base, &cm->base);
 	cprof->base.description = desc;
 	wl_list_insert(&cm->color_profile_list, &cprof->link);
+	cmlcms_color_profile_index(cm, cprof);
 
 	weston_log_scope_printf(cm->profiles_scope,
 				"New color profile: p%u. WARNING: this is a " \
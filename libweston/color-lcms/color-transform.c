@@ -27,7 +27,16 @@
 #include "config.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <libweston/libweston.h>
+#include <libweston/version.h>
 #include <lcms2_plugin.h>
 
 #include "color.h"
@@ -121,33 +130,280 @@ ensure_unorm(float v)
 	return v;
 }
 
-static void
-cmlcms_fill_in_3dlut(struct weston_color_transform *xform_base,
-		     float *lut, unsigned int len)
+#define CMLCMS_LUT_FILL_MAX_THREADS 8
+/* Threads are not worth starting for fewer LUT points than this each. */
+#define CMLCMS_LUT_FILL_MIN_POINTS 4096
+
+struct cmlcms_lut_fill_job {
+	struct cmlcms_color_transform *xform;
+	float *lut;
+	unsigned int len;
+	unsigned int b_begin;
+	unsigned int b_end;
+};
+
+/* Evaluate the blue slices [b_begin, b_end) of the LUT, a row of len
+ * points per cmsDoTransform() call. */
+static void *
+cmlcms_lut_fill_job_run(void *data)
 {
-	struct cmlcms_color_transform *xform = to_cmlcms_xform(xform_base);
-	float rgb_in[3];
-	float rgb_out[3];
-	unsigned int index;
-	unsigned int value_b, value_r, value_g;
+	struct cmlcms_lut_fill_job *job = data;
+	unsigned int len = job->len;
 	float divider = len - 1;
+	float *rgb_in;
+	float *row;
+	unsigned int value_b, value_g, value_r;
+	unsigned int i;
+
+	rgb_in = xcalloc(3 * len, sizeof *rgb_in);
 
-	for (value_b = 0; value_b < len; value_b++) {
+	for (value_b = job->b_begin; value_b < job->b_end; value_b++) {
 		for (value_g = 0; value_g < len; value_g++) {
 			for (value_r = 0; value_r < len; value_r++) {
-				rgb_in[0] = (float)value_r / divider;
-				rgb_in[1] = (float)value_g / divider;
-				rgb_in[2] = (float)value_b / divider;
+				rgb_in[3 * value_r    ] = (float)value_r / divider;
+				rgb_in[3 * value_r + 1] = (float)value_g / divider;
+				rgb_in[3 * value_r + 2] = (float)value_b / divider;
+			}
 
-				cmsDoTransform(xform->cmap_3dlut, rgb_in, rgb_out, 1);
+			row = job->lut + 3 * len * (value_g + len * value_b);
+			cmsDoTransform(job->xform->cmap_3dlut, rgb_in, row, len);
 
-				index = 3 * (value_r + len * (value_g + len * value_b));
-				lut[index    ] = ensure_unorm(rgb_out[0]);
-				lut[index + 1] = ensure_unorm(rgb_out[1]);
-				lut[index + 2] = ensure_unorm(rgb_out[2]);
-			}
+			for (i = 0; i < 3 * len; i++)
+				row[i] = ensure_unorm(row[i]);
 		}
 	}
+
+	free(rgb_in);
+
+	return NULL;
+}
+
+static void
+cmlcms_evaluate_3dlut(struct cmlcms_color_transform *xform,
+		      float *lut, unsigned int len)
+{
+	struct cmlcms_lut_fill_job jobs[CMLCMS_LUT_FILL_MAX_THREADS];
+	pthread_t threads[CMLCMS_LUT_FILL_MAX_THREADS];
+	bool started[CMLCMS_LUT_FILL_MAX_THREADS] = { false };
+	sigset_t blocked, saved;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int n, i;
+
+	n = len * len * len / CMLCMS_LUT_FILL_MIN_POINTS;
+	n = MIN(n, CMLCMS_LUT_FILL_MAX_THREADS);
+	n = MIN(n, len);
+	if (cpus > 0)
+		n = MIN(n, (unsigned int) cpus);
+	n = MAX(n, 1u);
+
+	for (i = 0; i < n; i++) {
+		jobs[i].xform = xform;
+		jobs[i].lut = lut;
+		jobs[i].len = len;
+		jobs[i].b_begin = len * i / n;
+		jobs[i].b_end = len * (i + 1) / n;
+	}
+
+	/* The transform is created with cmsFLAGS_NOCACHE, so separate
+	 * threads can evaluate it at the same time. Leave signal handling
+	 * to the main loop. */
+	sigfillset(&blocked);
+	pthread_sigmask(SIG_BLOCK, &blocked, &saved);
+	for (i = 1; i < n; i++)
+		started[i] = pthread_create(&threads[i], NULL,
+					    cmlcms_lut_fill_job_run,
+					    &jobs[i]) == 0;
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+	cmlcms_lut_fill_job_run(&jobs[0]);
+
+	for (i = 1; i < n; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			cmlcms_lut_fill_job_run(&jobs[i]);
+	}
+}
+
+#define CMLCMS_LUT_CACHE_MAGIC 0x4c33574c /* "LW3L" */
+
+/** Header of a baked 3D LUT cache file
+ *
+ * The file name is a hash of the header, and the header is compared in
+ * full on load, so that a renamed or foreign file gets rejected.
+ */
+struct cmlcms_lut_cache_header {
+	uint32_t magic;
+	uint32_t len;
+	uint64_t identity; /* weston and LittleCMS versions */
+	struct cmlcms_md5_sum input_md5;
+	struct cmlcms_md5_sum output_md5;
+	uint32_t category;
+	uint32_t intent;
+};
+
+static uint64_t
+cmlcms_lut_cache_hash(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+/* LUTs can only be recognized across runs by the MD5 sums of ICC
+ * profiles; parametric profiles are not cached. */
+static bool
+cmlcms_lut_cache_header_init(struct cmlcms_lut_cache_header *header,
+			     const struct cmlcms_color_transform *xform,
+			     unsigned int len)
+{
+	const struct cmlcms_color_transform_search_param *key = &xform->search_key;
+	int lcms_version = LCMS_VERSION;
+
+	memset(header, 0, sizeof *header);
+
+	if (key->input_profile) {
+		if (key->input_profile->type != CMLCMS_PROFILE_TYPE_ICC)
+			return false;
+		header->input_md5 = key->input_profile->icc.md5sum;
+	}
+
+	if (!key->output_profile ||
+	    key->output_profile->type != CMLCMS_PROFILE_TYPE_ICC)
+		return false;
+	header->output_md5 = key->output_profile->icc.md5sum;
+
+	header->magic = CMLCMS_LUT_CACHE_MAGIC;
+	header->len = len;
+	header->identity = cmlcms_lut_cache_hash(0xcbf29ce484222325ull,
+						 WESTON_VERSION,
+						 strlen(WESTON_VERSION));
+	header->identity = cmlcms_lut_cache_hash(header->identity,
+						 &lcms_version,
+						 sizeof lcms_version);
+	header->category = key->category;
+	header->intent = key->render_intent ? key->render_intent->intent :
+					      UINT32_MAX;
+
+	return true;
+}
+
+static char *
+cmlcms_lut_cache_path(const char *dir,
+		      const struct cmlcms_lut_cache_header *header)
+{
+	uint64_t hash;
+	char *path;
+
+	hash = cmlcms_lut_cache_hash(0xcbf29ce484222325ull,
+				     header, sizeof *header);
+	if (asprintf(&path, "%s/lut3d-%016" PRIx64 ".bin", dir, hash) < 0)
+		return NULL;
+
+	return path;
+}
+
+static bool
+cmlcms_lut_cache_load(const char *dir,
+		      const struct cmlcms_lut_cache_header *header,
+		      float *lut)
+{
+	struct cmlcms_lut_cache_header found;
+	size_t count = 3 * header->len * header->len * header->len;
+	bool ok = false;
+	char *path;
+	FILE *fp;
+
+	path = cmlcms_lut_cache_path(dir, header);
+	if (!path)
+		return false;
+
+	fp = fopen(path, "re");
+	if (fp) {
+		ok = fread(&found, sizeof found, 1, fp) == 1 &&
+		     memcmp(&found, header, sizeof found) == 0 &&
+		     fread(lut, sizeof *lut, count, fp) == count;
+		fclose(fp);
+		if (!ok)
+			unlink(path);
+	}
+	free(path);
+
+	return ok;
+}
+
+static void
+cmlcms_lut_cache_store(const char *dir,
+		       const struct cmlcms_lut_cache_header *header,
+		       const float *lut)
+{
+	size_t count = 3 * header->len * header->len * header->len;
+	char *path, *tmp;
+	FILE *fp;
+	bool ok;
+
+	if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		weston_log("Warning: cannot create color LUT cache %s: %s\n",
+			   dir, strerror(errno));
+		return;
+	}
+
+	path = cmlcms_lut_cache_path(dir, header);
+	if (!path)
+		return;
+	if (asprintf(&tmp, "%s.tmp", path) < 0) {
+		free(path);
+		return;
+	}
+
+	/* Write to a temporary file and rename it into place, so that a
+	 * crash or a concurrent instance never leaves a torn LUT. */
+	fp = fopen(tmp, "we");
+	if (fp) {
+		ok = fwrite(header, sizeof *header, 1, fp) == 1 &&
+		     fwrite(lut, sizeof *lut, count, fp) == count;
+		if (fclose(fp) != 0)
+			ok = false;
+		if (!ok || rename(tmp, path) < 0) {
+			weston_log("Warning: failed to write color LUT cache "
+				   "file %s\n", path);
+			unlink(tmp);
+		}
+	}
+
+	free(tmp);
+	free(path);
+}
+
+static void
+cmlcms_fill_in_3dlut(struct weston_color_transform *xform_base,
+		     float *lut, unsigned int len)
+{
+	struct cmlcms_color_transform *xform = to_cmlcms_xform(xform_base);
+	struct weston_color_manager_lcms *cm = to_cmlcms(xform_base->cm);
+	const char *dir = cm->base.compositor->color_lut_cache_dir;
+	struct cmlcms_lut_cache_header header;
+	bool cacheable;
+
+	cacheable = dir && cmlcms_lut_cache_header_init(&header, xform, len);
+	if (cacheable && cmlcms_lut_cache_load(dir, &header, lut)) {
+		weston_log_scope_printf(cm->transforms_scope,
+					"t%u: 3D LUT loaded from cache.\n",
+					xform_base->id);
+		return;
+	}
+
+	cmlcms_evaluate_3dlut(xform, lut, len);
+
+	if (cacheable)
+		cmlcms_lut_cache_store(dir, &header, lut);
 }
 
 void
@@ -797,6 +1053,57 @@ translate_curve_element_parametric(struct cmlcms_color_transform *xform,
 	return ret;
 }
 
+#define CMLCMS_CURVE_FIT_SAMPLES 1024
+#define CMLCMS_CURVE_FIT_TOLERANCE (1.0f / 8192.0f)
+
+/*
+ * Sampled curves are common in ICC profiles even where they tabulate a
+ * plain power law. Recognize those, so that the renderer evaluates them
+ * in ALU instead of sampling a LUT texture.
+ */
+static bool
+translate_curve_element_power_fit(struct cmlcms_color_transform *xform,
+				  _cmsStageToneCurvesData *trc_data,
+				  enum color_transform_step step)
+{
+	struct weston_compositor *compositor = xform->base.cm->compositor;
+	struct weston_color_curve *curve;
+	float params[3][10] = { { 0.0f } };
+	unsigned int ch, i;
+	double g;
+	float x;
+
+	switch(step) {
+	case PRE_CURVE:
+		curve = &xform->base.pre_curve;
+		break;
+	case POST_CURVE:
+		curve = &xform->base.post_curve;
+		break;
+	default:
+		weston_assert_not_reached(compositor,
+					  "curve should be a pre or post curve");
+	}
+
+	for (ch = 0; ch < 3; ch++) {
+		g = cmsEstimateGamma(trc_data->TheCurves[ch], 0.01);
+		if (g <= 0.0)
+			return false;
+
+		for (i = 0; i < CMLCMS_CURVE_FIT_SAMPLES; i++) {
+			x = (float)i / (CMLCMS_CURVE_FIT_SAMPLES - 1);
+			if (fabsf(cmsEvalToneCurveFloat(trc_data->TheCurves[ch], x) -
+				  powf(x, g)) > CMLCMS_CURVE_FIT_TOLERANCE)
+				return false;
+		}
+
+		params[ch][0] = g;
+	}
+
+	/* Sampled curves clamp their input to [0, 1]. */
+	return linpow_from_type_1(compositor, curve, params, true);
+}
+
 static bool
 translate_curve_element_LUT(struct cmlcms_color_transform *xform,
 			    _cmsStageToneCurvesData *trc_data,
@@ -853,6 +1160,9 @@ translate_curve_element(struct cmlcms_color_transform *xform,
 	if (translate_curve_element_parametric(xform, trc_data, step))
 		return true;
 
+	if (translate_curve_element_power_fit(xform, trc_data, step))
+		return true;
+
 	/* Curve does not fit any of the parametric curves that we implement, so
 	 * fallback to LUT. */
 	return translate_curve_element_LUT(xform, trc_data, step);
@@ -864,9 +1174,6 @@ translate_matrix_element(struct weston_color_mapping *map, cmsStage *elem)
 	_cmsStageMatrixData *data = cmsStageData(elem);
 	int c, r;
 
-	if (!is_matrix_stage_with_zero_offset(elem))
-		return false;
-
 	if (cmsStageInputChannels(elem) != 3 ||
 	    cmsStageOutputChannels(elem) != 3)
 		return false;
@@ -881,6 +1188,10 @@ translate_matrix_element(struct weston_color_mapping *map, cmsStage *elem)
 		for (r = 0; r < 3; r++)
 			map->u.mat.matrix[c * 3 + r] = data->Double[r * 3 + c];
 
+	/* Black point compensation, for one, leaves an offset behind. */
+	for (r = 0; r < 3; r++)
+		map->u.mat.offset[r] = data->Offset ? data->Offset[r] : 0.0f;
+
 	return true;
 }
 
@@ -1282,6 +1593,8 @@ xform_realize_chain(struct cmlcms_color_transform *xform)
 	assert(xform->status == CMLCMS_TRANSFORM_FAILED);
 	/* transform_factory() is invoked by this call. */
 	dwFlags = render_intent->bps ? cmsFLAGS_BLACKPOINTCOMPENSATION : 0;
+	/* No shared pixel cache, cmlcms_evaluate_3dlut() uses threads. */
+	dwFlags |= cmsFLAGS_NOCACHE;
 	xform->cmap_3dlut = cmsCreateMultiprofileTransformTHR(xform->lcms_ctx,
 							      from_lcmsProfilePtr_array(chain),
 							      chain_len,
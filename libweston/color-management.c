@@ -31,8 +31,12 @@
 #include "shared/weston-assert.h"
 #include "shared/xalloc.h"
 #include "shared/helpers.h"
+#include "shared/os-compatibility.h"
 
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include "color-management-v1-server-protocol.h"
 
@@ -61,6 +65,30 @@ struct cm_image_desc {
 	/* Depending how the image description is created, the protocol states
 	 * that get_information() request should be invalid. */
 	bool supports_get_info;
+
+	/* ICC profile being parsed for this image description, if any. */
+	struct cm_icc_job *icc_job;
+};
+
+/**
+ * Parsing of a client ICC profile on a worker thread. The image description
+ * it is for gets its 'ready' or 'failed' event when the worker is done, so
+ * that a large profile does not stall the compositor.
+ */
+struct cm_icc_job {
+	struct cm_image_desc *cm_image_desc;
+	struct weston_color_manager *cm;
+
+	pthread_t thread;
+	int fd[2];
+	struct wl_event_source *source;
+
+	void *icc_data;
+	size_t icc_len;
+
+	/* Written by the worker, only read after joining it. */
+	struct weston_color_parsed_icc *parsed;
+	char *err_msg;
 };
 
 /**
@@ -310,6 +338,9 @@ image_description_destroy(struct wl_client *client,
 static void
 cm_image_desc_destroy(struct cm_image_desc *cm_image_desc);
 
+static void
+cm_icc_job_destroy(struct cm_icc_job *job);
+
 /**
  * Resource destruction function for the image description. Destroys the image
  * description backing object.
@@ -374,6 +405,9 @@ cm_image_desc_create(struct weston_color_manager *cm,
 static void
 cm_image_desc_destroy(struct cm_image_desc *cm_image_desc)
 {
+	if (cm_image_desc->icc_job)
+		cm_icc_job_destroy(cm_image_desc->icc_job);
+
 	weston_color_profile_unref(cm_image_desc->cprof);
 	free(cm_image_desc);
 }
@@ -921,6 +955,152 @@ do_length_and_offset_fit(struct cm_creator_icc *cm_creator_icc)
 	return true;
 }
 
+static void *
+cm_icc_job_thread(void *data)
+{
+	struct cm_icc_job *job = data;
+
+	job->parsed = job->cm->parse_icc(job->cm, job->icc_data, job->icc_len,
+					 &job->err_msg);
+
+	/* The compositor sees EOF on fd[0] once we are done. */
+	close(job->fd[1]);
+
+	return NULL;
+}
+
+static void
+cm_icc_job_join(struct cm_icc_job *job)
+{
+	pthread_join(job->thread, NULL);
+	wl_event_source_remove(job->source);
+	close(job->fd[0]);
+	job->cm_image_desc->icc_job = NULL;
+}
+
+static void
+cm_icc_job_free(struct cm_icc_job *job)
+{
+	if (job->parsed)
+		job->parsed->destroy(job->parsed);
+	free(job->err_msg);
+	free(job->icc_data);
+	free(job);
+}
+
+/**
+ * Abandons the parsing, for an image description destroyed before it got
+ * ready. Waits for the worker if it is still busy.
+ */
+static void
+cm_icc_job_destroy(struct cm_icc_job *job)
+{
+	cm_icc_job_join(job);
+	cm_icc_job_free(job);
+}
+
+static int
+cm_icc_job_done(int fd, uint32_t mask, void *data)
+{
+	struct cm_icc_job *job = data;
+	struct cm_image_desc *cm_image_desc = job->cm_image_desc;
+	struct weston_color_manager *cm = job->cm;
+	struct weston_color_profile *cprof;
+	char *err_msg = NULL;
+	bool ret = false;
+
+	cm_icc_job_join(job);
+
+	if (job->parsed) {
+		ret = cm->get_color_profile_from_parsed_icc(cm, job->parsed,
+							    job->icc_data,
+							    job->icc_len,
+							    "icc-from-client",
+							    &cprof, &err_msg);
+		job->parsed = NULL;
+	} else {
+		err_msg = job->err_msg;
+		job->err_msg = NULL;
+	}
+	cm_icc_job_free(job);
+
+	if (!ret) {
+		/* Same as a failure in cm_creator_icc_create(). */
+		xx_image_description_v4_send_failed(cm_image_desc->owner,
+						    XX_IMAGE_DESCRIPTION_V4_CAUSE_UNSUPPORTED,
+						    err_msg);
+		free(err_msg);
+		wl_resource_set_user_data(cm_image_desc->owner, NULL);
+		cm_image_desc_destroy(cm_image_desc);
+		return 0;
+	}
+
+	cm_image_desc->cprof = cprof;
+	xx_image_description_v4_send_ready(cm_image_desc->owner,
+					   cm_image_desc->cprof->id);
+	return 0;
+}
+
+/**
+ * Hands the ICC data to a worker thread to create the color profile of
+ * the image description. Takes ownership of icc_data on success.
+ *
+ * Returns false if the color manager can't parse off the compositor thread
+ * or the worker could not be started.
+ */
+static bool
+cm_icc_job_start(struct cm_image_desc *cm_image_desc,
+		 void *icc_data, size_t icc_len)
+{
+	struct weston_color_manager *cm = cm_image_desc->cm;
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(cm->compositor->wl_display);
+	struct cm_icc_job *job;
+	sigset_t blocked, saved;
+	int ret;
+
+	if (!cm->parse_icc || !cm->get_color_profile_from_parsed_icc)
+		return false;
+
+	job = xzalloc(sizeof(*job));
+	job->cm_image_desc = cm_image_desc;
+	job->cm = cm;
+	job->icc_data = icc_data;
+	job->icc_len = icc_len;
+
+	if (pipe(job->fd) < 0)
+		goto err_free;
+
+	if (os_fd_set_cloexec(job->fd[0]) < 0 ||
+	    os_fd_set_cloexec(job->fd[1]) < 0)
+		goto err_pipe;
+
+	job->source = wl_event_loop_add_fd(loop, job->fd[0], WL_EVENT_READABLE,
+					   cm_icc_job_done, job);
+	if (!job->source)
+		goto err_pipe;
+
+	/* Leave signal handling to the compositor thread. */
+	sigfillset(&blocked);
+	pthread_sigmask(SIG_BLOCK, &blocked, &saved);
+	ret = pthread_create(&job->thread, NULL, cm_icc_job_thread, job);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (ret != 0)
+		goto err_source;
+
+	cm_image_desc->icc_job = job;
+	return true;
+
+err_source:
+	wl_event_source_remove(job->source);
+err_pipe:
+	close(job->fd[0]);
+	close(job->fd[1]);
+err_free:
+	free(job);
+	return false;
+}
+
 static int
 create_image_description_color_profile_from_icc_creator(struct cm_image_desc *cm_image_desc,
 							struct cm_creator_icc *cm_creator_icc)
@@ -990,6 +1170,11 @@ create_image_description_color_profile_from_icc_creator(struct cm_image_desc *cm
 	}
 	weston_assert_true(compositor, bytes_read == cm_creator_icc->icc_data_length);
 
+	/* The image description gets ready once the worker is done. */
+	if (cm_icc_job_start(cm_image_desc, icc_prof_data,
+			     cm_creator_icc->icc_data_length))
+		return 0;
+
 	/* We've read the ICC file so let's create the color profile. */
 	ret = cm->get_color_profile_from_icc(cm, icc_prof_data,
 					     cm_creator_icc->icc_data_length,
@@ -34,6 +34,7 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <errno.h>
+#include <math.h>
 #include <string.h>
 
 #include "color.h"
@@ -261,6 +262,96 @@ weston_color_transform_string(const struct weston_color_transform *xform)
 	return str;
 }
 
+/**
+ * Check whether a color transform leaves every value unchanged
+ *
+ * A transform may be built from identity steps only, e.g. when the source
+ * and destination color spaces turn out to be the same.
+ *
+ * \param xform The color transform, NULL meaning identity.
+ * \return True if applying the transform is a no-op.
+ */
+WL_EXPORT bool
+weston_color_transform_is_identity(const struct weston_color_transform *xform)
+{
+	if (!xform)
+		return true;
+
+	return xform->pre_curve.type == WESTON_COLOR_CURVE_TYPE_IDENTITY &&
+	       xform->mapping.type == WESTON_COLOR_MAPPING_TYPE_IDENTITY &&
+	       xform->post_curve.type == WESTON_COLOR_CURVE_TYPE_IDENTITY;
+}
+
+static float
+linpow(float x, const float *p)
+{
+	/* See WESTON_COLOR_CURVE_TYPE_LINPOW for details about LINPOW. */
+	if (x >= p[4])
+		return powf(p[1] * x + p[2], p[0]);
+
+	return p[3] * x;
+}
+
+static float
+powlin(float x, const float *p)
+{
+	/* See WESTON_COLOR_CURVE_TYPE_POWLIN for details about POWLIN. */
+	if (x >= p[4])
+		return p[1] * powf(x, p[0]) + p[2];
+
+	return p[3] * x;
+}
+
+/**
+ * Sample a color curve into three 1D LUTs
+ *
+ * \param xform The color transform the curve belongs to.
+ * \param curve Either the pre or the post curve of \c xform.
+ * \param values Array of 3 x len elements, laid out like
+ * weston_color_curve_lut_3x1d::fill_in does.
+ * \param len The number of elements in each 1D LUT, at least 2.
+ *
+ * This is for users that cannot evaluate parametric curves themselves,
+ * e.g. a KMS color pipeline. Input values are in [0.0, 1.0], so
+ * weston_color_curve_parametric::clamped_input makes no difference.
+ */
+WL_EXPORT void
+weston_color_curve_sample(struct weston_color_transform *xform,
+			  const struct weston_color_curve *curve,
+			  float *values, unsigned len)
+{
+	unsigned ch, i;
+	float x;
+
+	assert(len >= 2);
+
+	if (curve->type == WESTON_COLOR_CURVE_TYPE_LUT_3x1D) {
+		curve->u.lut_3x1d.fill_in(xform, values, len);
+		return;
+	}
+
+	for (ch = 0; ch < 3; ch++) {
+		const float *p = curve->u.parametric.params[ch];
+
+		for (i = 0; i < len; i++) {
+			x = (float)i / (len - 1);
+
+			switch (curve->type) {
+			case WESTON_COLOR_CURVE_TYPE_IDENTITY:
+			case WESTON_COLOR_CURVE_TYPE_LUT_3x1D:
+				values[ch * len + i] = x;
+				break;
+			case WESTON_COLOR_CURVE_TYPE_LINPOW:
+				values[ch * len + i] = linpow(x, p);
+				break;
+			case WESTON_COLOR_CURVE_TYPE_POWLIN:
+				values[ch * len + i] = powlin(x, p);
+				break;
+			}
+		}
+	}
+}
+
 /** Deep copy */
 void
 weston_surface_color_transform_copy(struct weston_surface_color_transform *dst,
@@ -297,6 +388,7 @@ weston_paint_node_ensure_color_transform(struct weston_paint_node *pnode)
 	struct weston_color_manager *cm = surface->compositor->color_manager;
 	struct weston_surface_color_transform surf_xform = {};
 	struct weston_paint_node *it;
+	struct weston_view *view;
 	bool ok;
 
 	/*
@@ -308,14 +400,16 @@ weston_paint_node_ensure_color_transform(struct weston_paint_node *pnode)
 
 	ok = cm->get_surface_color_transform(cm, surface, output, &surf_xform);
 
-	wl_list_for_each(it, &surface->paint_node_list, surface_link) {
-		if (it->output == output) {
-			assert(it->surf_xform_valid == false);
-			assert(it->surf_xform.transform == NULL);
-			weston_surface_color_transform_copy(&it->surf_xform,
-							    &surf_xform);
-			it->surf_xform_valid = ok;
-		}
+	wl_list_for_each(view, &surface->views, surface_link) {
+		it = weston_view_find_paint_node(view, output);
+		if (!it)
+			continue;
+
+		assert(it->surf_xform_valid == false);
+		assert(it->surf_xform.transform == NULL);
+		weston_surface_color_transform_copy(&it->surf_xform,
+						    &surf_xform);
+		it->surf_xform_valid = ok;
 	}
 
 	weston_surface_color_transform_fini(&surf_xform);
@@ -328,6 +328,7 @@ struct weston_color_mapping_3dlut {
  */
 struct weston_color_mapping_matrix {
 	float matrix[9];
+	float offset[3]; /* added after the matrix multiplication */
 };
 
 /**
@@ -408,6 +409,16 @@ struct weston_surface_color_transform {
 
 struct cm_image_desc_info;
 
+/** ICC data parsed by weston_color_manager::parse_icc
+ *
+ * The color manager embeds this in its own parse result.
+ */
+struct weston_color_parsed_icc {
+	/** Drop a parse result that was not turned into a profile */
+	void
+	(*destroy)(struct weston_color_parsed_icc *parsed);
+};
+
 struct weston_color_manager {
 	/** Identifies this CMS component */
 	const char *name;
@@ -495,6 +506,51 @@ struct weston_color_manager {
 				      struct weston_color_profile **cprof_out,
 				      char **errmsg);
 
+	/** Parse ICC data for get_color_profile_from_parsed_icc()
+	 *
+	 * \param cm The color manager.
+	 * \param icc_data Pointer to the ICC binary data.
+	 * \param icc_len Length of the ICC data in bytes.
+	 * \param errmsg On success, untouched. On failure, a pointer to a
+	 * string describing the error is stored here. The string must be
+	 * free()'d.
+	 * \return The parse result, or NULL on failure.
+	 *
+	 * Optional, the expensive half of get_color_profile_from_icc(). It
+	 * is called on a worker thread, so it must not touch any state of
+	 * the color manager that the compositor thread uses.
+	 */
+	struct weston_color_parsed_icc *
+	(*parse_icc)(struct weston_color_manager *cm,
+		     const void *icc_data,
+		     size_t icc_len,
+		     char **errmsg);
+
+	/** Create a color profile from ICC data parsed by parse_icc()
+	 *
+	 * \param cm The color manager.
+	 * \param parsed The parse result, always consumed.
+	 * \param icc_data The ICC binary data given to parse_icc().
+	 * \param icc_len Length of the ICC data in bytes.
+	 * \param name_part A string to be used in describing the profile.
+	 * \param cprof_out On success, the created object is returned here.
+	 * On failure, untouched.
+	 * \param errmsg On success, untouched. On failure, a pointer to a
+	 * string describing the error is stored here. The string must be
+	 * free()'d.
+	 * \return True on success, false on failure.
+	 *
+	 * Like get_color_profile_from_icc() otherwise.
+	 */
+	bool
+	(*get_color_profile_from_parsed_icc)(struct weston_color_manager *cm,
+					     struct weston_color_parsed_icc *parsed,
+					     const void *icc_data,
+					     size_t icc_len,
+					     const char *name_part,
+					     struct weston_color_profile **cprof_out,
+					     char **errmsg);
+
 	/** Create a color profile from parameters
 	 *
 	 * \param cm The color manager.
@@ -588,6 +644,14 @@ weston_color_transform_init(struct weston_color_transform *xform,
 char *
 weston_color_transform_string(const struct weston_color_transform *xform);
 
+bool
+weston_color_transform_is_identity(const struct weston_color_transform *xform);
+
+void
+weston_color_curve_sample(struct weston_color_transform *xform,
+			  const struct weston_color_curve *curve,
+			  float *values, unsigned len);
+
 void
 weston_surface_color_transform_copy(struct weston_surface_color_transform *dst,
 				    const struct weston_surface_color_transform *src);
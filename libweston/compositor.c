@@ -55,16 +55,26 @@
 #include <drm_fourcc.h>
 
 #include "timeline.h"
+#include "client-memory.h"
+#include "client-requests.h"
+#include "frame-latency.h"
+#include "perf-hud.h"
+#include "repaint-profile.h"
+#include "scene-record.h"
 
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
 #include "linux-dmabuf.h"
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
 #include "viewporter-server-protocol.h"
+#include "fractional-scale-v1-server-protocol.h"
+#include "content-type-v1-server-protocol.h"
 #include "presentation-time-server-protocol.h"
 #include "xdg-output-unstable-v1-server-protocol.h"
 #include "linux-explicit-synchronization-unstable-v1-server-protocol.h"
 #include "linux-explicit-synchronization.h"
+#include "linux-drm-syncobj.h"
+#include "linux-sync-file.h"
 #include "single-pixel-buffer-v1-server-protocol.h"
 #include "shared/fd-util.h"
 #include "shared/helpers.h"
@@ -74,6 +84,7 @@
 #include "shared/xalloc.h"
 #include "shared/weston-assert.h"
 #include "tearing-control-v1-server-protocol.h"
+#include "commit-timing-v1-server-protocol.h"
 #include "git-version.h"
 #include <libweston/version.h>
 #include <libweston/plugin-registry.h>
@@ -97,13 +108,15 @@
 
 #define DEFAULT_REPAINT_WINDOW 7 /* milliseconds */
 
+/* Objects in a weston_object_pool start on their own cache line */
+#define OBJECT_POOL_ALIGNMENT 64
+/* Upper bound on the allocations a pool keeps around for reuse */
+#define OBJECT_POOL_MAX_FREE 256
+
 static void
 weston_output_transform_scale_init(struct weston_output *output,
 				   uint32_t transform, uint32_t scale);
 
-static void
-weston_compositor_build_view_list(struct weston_compositor *compositor);
-
 static char *
 weston_output_create_heads_string(struct weston_output *output);
 
@@ -114,6 +127,15 @@ subsurface_committed(struct weston_surface *surface,
 static void
 weston_view_geometry_dirty_internal(struct weston_view *view);
 
+static void
+weston_compositor_invalidate_pick_index(struct weston_compositor *compositor);
+
+static void
+weston_compositor_subsurface_order_changed(struct weston_compositor *compositor);
+
+static void
+weston_view_pick_index_remove(struct weston_view *view);
+
 static bool
 weston_view_is_fully_blended(struct weston_view *ev,
 			     pixman_region32_t *region);
@@ -172,6 +194,25 @@ weston_output_dirty_paint_nodes(struct weston_output *output)
 	}
 }
 
+/* dst = dst op src, keeping the rectangle storage of dst around.
+ *
+ * pixman allocates a new rectangle array whenever the destination of an
+ * operation is also a source, and frees the old one. Computing into a
+ * scratch region and swapping the two instead leaves both arrays in use,
+ * so that in steady state the repaint path stops going through malloc.
+ */
+static void
+region_union_in_place(pixman_region32_t *dst, pixman_region32_t *src,
+		      pixman_region32_t *scratch)
+{
+	pixman_region32_t tmp;
+
+	pixman_region32_union(scratch, dst, src);
+	tmp = *dst;
+	*dst = *scratch;
+	*scratch = tmp;
+}
+
 static void
 paint_node_damage_below(struct weston_paint_node *pnode)
 {
@@ -187,8 +228,8 @@ paint_node_damage_below(struct weston_paint_node *pnode)
 		if (lower_node == pnode)
 			break;
 
-		pixman_region32_union(&lower_node->damage, &lower_node->damage,
-				      &pnode->visible);
+		region_union_in_place(&lower_node->damage, &pnode->visible,
+				      &pnode->output->scratch_region[0]);
 	}
 }
 
@@ -323,8 +364,8 @@ paint_node_update_late(struct weston_paint_node *pnode)
 		pixman_region32_copy(&pnode->damage, &pnode->visible);
 
 	if (content_dirty && pnode->plane)
-		pixman_region32_union(&pnode->damage,
-				      &pnode->damage, &pnode->visible);
+		region_union_in_place(&pnode->damage, &pnode->visible,
+				      &pnode->output->scratch_region[0]);
 
 	if (plane_dirty) {
 		assert(pnode->plane_next);
@@ -337,6 +378,9 @@ paint_node_update_late(struct weston_paint_node *pnode)
 	if (buffer_dirty)
 		surf->compositor->renderer->attach(pnode);
 
+	pnode->update_rate += ((buffer_dirty ? 1.0f : 0.0f) -
+			       pnode->update_rate) / 8.0f;
+
 	pnode->status &= ~(PAINT_NODE_VISIBILITY_DIRTY |
 			   PAINT_NODE_PLANE_DIRTY |
 			   PAINT_NODE_CONTENT_DIRTY |
@@ -348,6 +392,82 @@ paint_node_update_late(struct weston_paint_node *pnode)
 	assert(pnode->status == PAINT_NODE_CLEAN);
 }
 
+static void
+object_pool_init(struct weston_object_pool *pool, size_t size)
+{
+	pool->size = ROUND_UP_N(MAX(size, sizeof(void *)),
+				OBJECT_POOL_ALIGNMENT);
+	pool->free_list = NULL;
+	pool->count = 0;
+}
+
+/** Get a zeroed object from the pool
+ *
+ * Reuses the most recently freed object, so that it likely is still in
+ * the cache, and only falls back to the allocator when the pool is empty.
+ */
+static void *
+object_pool_zalloc(struct weston_object_pool *pool)
+{
+	void *obj = pool->free_list;
+
+	if (obj) {
+		pool->free_list = *(void **)obj;
+		pool->count--;
+	} else {
+		obj = aligned_alloc(OBJECT_POOL_ALIGNMENT, pool->size);
+		if (!obj)
+			return NULL;
+	}
+
+	memset(obj, 0, pool->size);
+
+	return obj;
+}
+
+static void
+object_pool_free(struct weston_object_pool *pool, void *obj)
+{
+	if (pool->count >= OBJECT_POOL_MAX_FREE) {
+		free(obj);
+		return;
+	}
+
+	*(void **)obj = pool->free_list;
+	pool->free_list = obj;
+	pool->count++;
+}
+
+static void
+object_pool_release(struct weston_object_pool *pool)
+{
+	void *obj;
+
+	while ((obj = pool->free_list)) {
+		pool->free_list = *(void **)obj;
+		free(obj);
+	}
+	pool->count = 0;
+}
+
+/* Slot for the view's paint node on the output with the given ID, growing
+ * the per-view index as needed. */
+static struct weston_paint_node **
+view_paint_node_slot(struct weston_view *view, uint32_t id)
+{
+	struct wl_array *index = &view->paint_node_index;
+	size_t needed = (id + 1) * sizeof(struct weston_paint_node *);
+	size_t old_size = index->size;
+
+	if (needed > old_size) {
+		if (!wl_array_add(index, needed - old_size))
+			return NULL;
+		memset((char *)index->data + old_size, 0, needed - old_size);
+	}
+
+	return (struct weston_paint_node **)index->data + id;
+}
+
 static struct weston_paint_node *
 weston_paint_node_create(struct weston_surface *surface,
 			 struct weston_view *view,
@@ -355,10 +475,16 @@ weston_paint_node_create(struct weston_surface *surface,
 {
 	struct weston_paint_node *pnode;
 	struct weston_paint_node *existing_node;
+	struct weston_paint_node **slot;
+	struct weston_view *other_view;
 
 	assert(view->surface == surface);
 
-	pnode = zalloc(sizeof *pnode);
+	slot = view_paint_node_slot(view, output->id);
+	if (!slot)
+		return NULL;
+
+	pnode = object_pool_zalloc(&surface->compositor->paint_node_pool);
 	if (!pnode)
 		return NULL;
 
@@ -366,9 +492,9 @@ weston_paint_node_create(struct weston_surface *surface,
 	 * Invariant: all paint nodes with the same surface+output have the
 	 * same surf_xform state.
 	 */
-	wl_list_for_each(existing_node, &surface->paint_node_list, surface_link) {
-		assert(existing_node->surface == surface);
-		if (existing_node->output != output)
+	wl_list_for_each(other_view, &surface->views, surface_link) {
+		existing_node = weston_view_find_paint_node(other_view, output);
+		if (!existing_node)
 			continue;
 
 		weston_surface_color_transform_copy(&pnode->surf_xform,
@@ -377,6 +503,8 @@ weston_paint_node_create(struct weston_surface *surface,
 		break;
 	}
 
+	*slot = pnode;
+
 	pnode->surface = surface;
 	wl_list_insert(&surface->paint_node_list, &pnode->surface_link);
 
@@ -408,6 +536,7 @@ weston_paint_node_destroy(struct weston_paint_node *pnode)
 
 	paint_node_damage_below(pnode);
 
+	*view_paint_node_slot(pnode->view, pnode->output->id) = NULL;
 	wl_list_remove(&pnode->surface_link);
 	wl_list_remove(&pnode->view_link);
 	wl_list_remove(&pnode->output_link);
@@ -416,7 +545,7 @@ weston_paint_node_destroy(struct weston_paint_node *pnode)
 	weston_surface_color_transform_fini(&pnode->surf_xform);
 	pixman_region32_fini(&pnode->damage);
 	pixman_region32_fini(&pnode->visible);
-	free(pnode);
+	object_pool_free(&pnode->surface->compositor->paint_node_pool, pnode);
 }
 
 /** Send wl_output events for mode and scale changes
@@ -531,6 +660,9 @@ static void
 weston_compositor_reflow_outputs(struct weston_compositor *compositor,
 				struct weston_output *resized_output, int delta_width);
 
+static void
+weston_surface_update_preferred_scale(struct weston_surface *surface);
+
 /** Set up the native mode for an output
  *
  * \param output     The weston_output object
@@ -593,6 +725,14 @@ weston_output_mode_set_native(struct weston_output *output,
 
 	weston_mode_switch_finish(output, mode_changed, scale_changed);
 
+	if (scale_changed) {
+		struct weston_view *view;
+
+		/* The surfaces on this output may prefer another scale now. */
+		wl_list_for_each(view, &output->compositor->view_list, link)
+			weston_surface_update_preferred_scale(view->surface);
+	}
+
 	if (mode_changed || scale_changed) {
 		weston_compositor_reflow_outputs(output->compositor, output, output->width - old_width);
 
@@ -684,7 +824,7 @@ weston_view_create_internal(struct weston_surface *surface)
 {
 	struct weston_view *view;
 
-	view = zalloc(sizeof *view);
+	view = object_pool_zalloc(&surface->compositor->view_pool);
 	if (view == NULL)
 		return NULL;
 
@@ -699,6 +839,9 @@ weston_view_create_internal(struct weston_surface *surface)
 	wl_list_init(&view->link);
 	wl_list_init(&view->layer_link.link);
 	wl_list_init(&view->paint_node_list);
+	wl_list_init(&view->pick_index.dirty_link);
+	wl_array_init(&view->subsurface_order.views);
+	wl_array_init(&view->paint_node_index);
 
 	pixman_region32_init(&view->visible);
 
@@ -735,6 +878,7 @@ weston_view_create_subsurfaces(struct weston_view *parent_view,
 	child_view->parent_view = parent_view;
 	weston_view_update_transform(child_view);
 	child_surface->compositor->view_list_needs_rebuild = true;
+	weston_compositor_subsurface_order_changed(child_surface->compositor);
 
 	wl_list_for_each(sub_sub, &child_surface->subsurface_list, parent_link) {
 		if (sub_sub->surface == sub->surface)
@@ -897,6 +1041,8 @@ weston_surface_state_init(struct weston_surface *surface,
 
 	state->color_profile = NULL;
 	state->render_intent = NULL;
+
+	state->content_type = WESTON_CONTENT_TYPE_NONE;
 }
 
 static void
@@ -926,6 +1072,49 @@ weston_surface_state_fini(struct weston_surface_state *state)
 	state->render_intent = NULL;
 }
 
+static void
+weston_queued_commit_destroy(struct weston_queued_commit *qc)
+{
+	if (qc->acquire_wait)
+		weston_drm_syncobj_wait_destroy(qc->acquire_wait);
+	if (qc->fence_source)
+		wl_event_source_remove(qc->fence_source);
+	weston_buffer_reference(&qc->buffer_ref, NULL,
+				BUFFER_WILL_NOT_BE_ACCESSED);
+	weston_surface_state_fini(&qc->state);
+	wl_list_remove(&qc->link);
+	free(qc);
+}
+
+static void
+weston_surface_discard_commit_queue(struct weston_surface *surface)
+{
+	struct weston_queued_commit *qc, *tmp;
+	struct weston_surface *main_surface, *next;
+
+	wl_list_for_each_safe(qc, tmp, &surface->commit_queue, link)
+		weston_queued_commit_destroy(qc);
+
+	wl_list_remove(&surface->commit_queue_link);
+	wl_list_init(&surface->commit_queue_link);
+
+	/* Updates of a sub-surface are queued on its main surface. */
+	wl_list_for_each_safe(main_surface, next,
+			      &surface->compositor->commit_queue_list,
+			      commit_queue_link) {
+		wl_list_for_each_safe(qc, tmp, &main_surface->commit_queue,
+				      link) {
+			if (qc->surface == surface)
+				weston_queued_commit_destroy(qc);
+		}
+
+		if (wl_list_empty(&main_surface->commit_queue)) {
+			wl_list_remove(&main_surface->commit_queue_link);
+			wl_list_init(&main_surface->commit_queue_link);
+		}
+	}
+}
+
 static void
 weston_surface_state_set_buffer(struct weston_surface_state *state,
 				struct weston_buffer *buffer)
@@ -990,6 +1179,42 @@ weston_surface_update_preferred_color_profile(struct weston_surface *surface)
 	weston_surface_send_preferred_image_description_changed(surface);
 }
 
+/* The fractional-scale protocol counts scales in 120ths. */
+#define FRACTIONAL_SCALE_DENOMINATOR 120
+
+/** Send the preferred scale of the surface, if it changed
+ *
+ * Like the preferred color profile, this follows the primary output, or
+ * for a surface that is not mapped yet, the first output, where it will
+ * most likely show up. A client drawing at this scale and mapping its
+ * buffer with wp_viewport.set_destination gets exactly the output's pixel
+ * size, with no scaling on either side.
+ */
+static void
+weston_surface_update_preferred_scale(struct weston_surface *surface)
+{
+	struct weston_output *output = surface->output;
+	uint32_t scale = 1;
+
+	if (!surface->fractional_scale_resource)
+		return;
+
+	if (!output && !wl_list_empty(&surface->compositor->output_list))
+		output = wl_container_of(surface->compositor->output_list.next,
+					 output, link);
+	if (output && output->current_scale > 0)
+		scale = weston_output_get_fractional_scale(output);
+	else
+		scale *= FRACTIONAL_SCALE_DENOMINATOR;
+
+	if (scale == surface->preferred_fractional_scale)
+		return;
+
+	surface->preferred_fractional_scale = scale;
+	wp_fractional_scale_v1_send_preferred_scale(surface->fractional_scale_resource,
+						    scale);
+}
+
 WL_EXPORT struct weston_surface *
 weston_surface_create(struct weston_compositor *compositor)
 {
@@ -1027,6 +1252,9 @@ weston_surface_create(struct weston_compositor *compositor)
 	wl_list_init(&surface->subsurface_list);
 	wl_list_init(&surface->subsurface_list_pending);
 
+	wl_list_init(&surface->commit_queue);
+	wl_list_init(&surface->commit_queue_link);
+
 	weston_matrix_init(&surface->buffer_to_surface_matrix);
 	weston_matrix_init(&surface->surface_to_buffer_matrix);
 
@@ -1114,12 +1342,65 @@ weston_coord_global_clamp_for_output(struct weston_coord_global pos,
 	return clamped_pos;
 }
 
+static bool
+matrix_is_integer_translation(const struct weston_matrix *matrix)
+{
+	return (matrix->type & ~WESTON_MATRIX_TRANSFORM_TRANSLATE) == 0 &&
+	       matrix->d[12] == floorf(matrix->d[12]) &&
+	       matrix->d[13] == floorf(matrix->d[13]);
+}
+
+/* Scaling, translation and rotations in 90-degree steps keep the edges
+ * of a rectangle axis-aligned.
+ */
+static bool
+matrix_is_axis_aligned(const struct weston_matrix *matrix)
+{
+	if (matrix->type & WESTON_MATRIX_TRANSFORM_OTHER)
+		return false;
+
+	if (!(matrix->type & WESTON_MATRIX_TRANSFORM_ROTATE))
+		return true;
+
+	return (matrix->d[1] == 0.0f && matrix->d[4] == 0.0f) ||
+	       (matrix->d[0] == 0.0f && matrix->d[5] == 0.0f);
+}
+
 WL_EXPORT pixman_box32_t
 weston_matrix_transform_rect(struct weston_matrix *matrix,
 			     pixman_box32_t rect)
 {
 	int i;
 	pixman_box32_t out;
+	struct weston_coord a, b;
+
+	if (matrix->type == 0)
+		return rect;
+
+	if (matrix_is_integer_translation(matrix)) {
+		int32_t dx = matrix->d[12];
+		int32_t dy = matrix->d[13];
+
+		out.x1 = rect.x1 + dx;
+		out.y1 = rect.y1 + dy;
+		out.x2 = rect.x2 + dx;
+		out.y2 = rect.y2 + dy;
+		return out;
+	}
+
+	/* Opposite corners still span the result. */
+	if (matrix_is_axis_aligned(matrix)) {
+		a = weston_matrix_transform_coord(matrix,
+						  weston_coord(rect.x1, rect.y1));
+		b = weston_matrix_transform_coord(matrix,
+						  weston_coord(rect.x2, rect.y2));
+
+		out.x1 = floor(MIN(a.x, b.x));
+		out.y1 = floor(MIN(a.y, b.y));
+		out.x2 = ceil(MAX(a.x, b.x));
+		out.y2 = ceil(MAX(a.y, b.y));
+		return out;
+	}
 
 	/* since pixman regions are defined by two corners we have
 	 * to be careful with rotations that aren't multiples of 90.
@@ -1155,13 +1436,102 @@ weston_matrix_transform_rect(struct weston_matrix *matrix,
 	return out;
 }
 
+/* Horizontal bands covering one rectangle that a matrix does not keep
+ * axis-aligned, and how many rectangles of a region get their own bands
+ * before the region is only covered by the bands of its extents. */
+#define TRANSFORM_RECT_BANDS 8
+#define TRANSFORM_REGION_MAX_RECTS 16
+
+/* Covers a rectangle transformed by a rotation, shear or projection with
+ * a few horizontal bands, each only as wide as the transformed
+ * quadrilateral within it. A rectangle rotated by 45 degrees covers half of
+ * its bounding box; the bands leave out most of the other half.
+ *
+ * Returns the number of bands stored in out.
+ */
+static int
+matrix_transform_rect_banded(struct weston_matrix *matrix,
+			     pixman_box32_t rect,
+			     pixman_box32_t out[TRANSFORM_RECT_BANDS])
+{
+	/* In order around the edges. */
+	struct weston_coord p[4] = {
+		weston_coord(rect.x1, rect.y1),
+		weston_coord(rect.x2, rect.y1),
+		weston_coord(rect.x2, rect.y2),
+		weston_coord(rect.x1, rect.y2),
+	};
+	double min_y = HUGE_VAL, max_y = -HUGE_VAL;
+	int32_t top, height;
+	int nbands, n = 0;
+	int b, i;
+
+	if (rect.x1 >= rect.x2 || rect.y1 >= rect.y2)
+		return 0;
+
+	for (i = 0; i < 4; i++) {
+		p[i] = weston_matrix_transform_coord(matrix, p[i]);
+		min_y = MIN(min_y, p[i].y);
+		max_y = MAX(max_y, p[i].y);
+	}
+
+	top = floor(min_y);
+	height = (int32_t)ceil(max_y) - top;
+	nbands = MIN(height, TRANSFORM_RECT_BANDS);
+
+	for (b = 0; b < nbands; b++) {
+		double y1 = top + (int64_t)height * b / nbands;
+		double y2 = top + (int64_t)height * (b + 1) / nbands;
+		double min_x = HUGE_VAL, max_x = -HUGE_VAL;
+
+		/* The quadrilateral is convex, so its part within the band
+		 * spans as far as its edges clipped to the band do. */
+		for (i = 0; i < 4; i++) {
+			struct weston_coord a = p[i];
+			struct weston_coord c = p[(i + 1) % 4];
+			double lo = MAX(MIN(a.y, c.y), y1);
+			double hi = MIN(MAX(a.y, c.y), y2);
+			double x_lo, x_hi;
+
+			if (lo > hi)
+				continue;
+
+			if (a.y == c.y) {
+				x_lo = a.x;
+				x_hi = c.x;
+			} else {
+				x_lo = a.x + (c.x - a.x) * (lo - a.y) / (c.y - a.y);
+				x_hi = a.x + (c.x - a.x) * (hi - a.y) / (c.y - a.y);
+			}
+
+			min_x = MIN(min_x, MIN(x_lo, x_hi));
+			max_x = MAX(max_x, MAX(x_lo, x_hi));
+		}
+
+		if (min_x > max_x)
+			continue;
+
+		out[n].x1 = floor(min_x);
+		out[n].y1 = y1;
+		out[n].x2 = ceil(max_x);
+		out[n].y2 = y2;
+		n++;
+	}
+
+	return n;
+}
+
 /** Transform a region by a matrix
  *
- * Warning: This function does not work perfectly for projective,
- * affine, or matrices that encode arbitrary rotations. Only 90-degree
- * step rotations are exact.
+ * Scaling, translation and 90-degree step rotations are exact, apart
+ * from rounding fractional edges outwards.
+ *
+ * Other matrices cover each rectangle with a few horizontal bands
+ * following the transformed shape, which results in some expansion. Regions
+ * with many rectangles only get the bands of their extents.
  *
- * More complicated matrices result in some expansion.
+ * Identity and integer translation matrices, which nearly all views
+ * have, are handled without touching the individual rectangles.
  */
 WL_EXPORT void
 weston_matrix_transform_region(pixman_region32_t *dest,
@@ -1169,18 +1539,53 @@ weston_matrix_transform_region(pixman_region32_t *dest,
 			       pixman_region32_t *src)
 {
 	pixman_box32_t *src_rects, *dest_rects;
-	int nrects, i;
+	int nrects, ndest = 0, i;
+
+	if (matrix->type == 0) {
+		pixman_region32_copy(dest, src);
+		return;
+	}
+
+	if (matrix_is_integer_translation(matrix)) {
+		pixman_region32_copy(dest, src);
+		pixman_region32_translate(dest, matrix->d[12], matrix->d[13]);
+		return;
+	}
 
 	src_rects = pixman_region32_rectangles(src, &nrects);
-	dest_rects = malloc(nrects * sizeof(*dest_rects));
-	if (!dest_rects)
+	if (nrects == 0) {
+		pixman_region32_clear(dest);
 		return;
+	}
 
-	for (i = 0; i < nrects; i++)
-		dest_rects[i] = weston_matrix_transform_rect(matrix, src_rects[i]);
+	if (matrix_is_axis_aligned(matrix)) {
+		dest_rects = malloc(nrects * sizeof(*dest_rects));
+		if (!dest_rects)
+			return;
+
+		for (i = 0; i < nrects; i++)
+			dest_rects[i] = weston_matrix_transform_rect(matrix,
+								     src_rects[i]);
+		ndest = nrects;
+	} else {
+		if (nrects > TRANSFORM_REGION_MAX_RECTS) {
+			src_rects = pixman_region32_extents(src);
+			nrects = 1;
+		}
+
+		dest_rects = malloc(nrects * TRANSFORM_RECT_BANDS *
+				    sizeof(*dest_rects));
+		if (!dest_rects)
+			return;
+
+		for (i = 0; i < nrects; i++)
+			ndest += matrix_transform_rect_banded(matrix,
+							      src_rects[i],
+							      &dest_rects[ndest]);
+	}
 
 	pixman_region32_clear(dest);
-	pixman_region32_init_rects(dest, dest_rects, nrects);
+	pixman_region32_init_rects(dest, dest_rects, ndest);
 	free(dest_rects);
 }
 
@@ -1361,7 +1766,7 @@ weston_surface_compute_protection(struct protected_surface *psurface)
 	struct weston_output *output;
 
 	wl_list_for_each(output, &surface->compositor->output_list, link)
-		if (surface->output_mask & (1u << output->id)) {
+		if (weston_output_mask_has(&surface->output_mask, output->id)) {
 			/*
 			 * If the content-protection is enabled with protection
 			 * mode as RELAXED for a surface, and if
@@ -1442,30 +1847,32 @@ weston_schedule_surface_protection_update(struct weston_compositor *compositor)
  * outputs as appropriate.
  */
 static void
-weston_surface_update_output_mask(struct weston_surface *es, uint32_t mask)
+weston_surface_update_output_mask(struct weston_surface *es,
+				  struct weston_output_mask *mask)
 {
-	uint32_t different = es->output_mask ^ mask;
-	uint32_t entered = mask & different;
-	uint32_t left = es->output_mask & different;
-	uint32_t output_bit;
+	struct weston_output_mask old = es->output_mask;
 	struct weston_output *output;
 	struct weston_head *head;
+	bool entered, left;
+
+	/* Swap the masks; the caller gets the old one back to finish. */
+	es->output_mask = *mask;
+	*mask = old;
 
-	es->output_mask = mask;
 	if (es->resource == NULL)
 		return;
-	if (different == 0)
+	if (weston_output_mask_equal(&es->output_mask, &old))
 		return;
 
 	wl_list_for_each(output, &es->compositor->output_list, link) {
-		output_bit = 1u << output->id;
-		if (!(output_bit & different))
+		entered = weston_output_mask_has(&es->output_mask, output->id);
+		left = weston_output_mask_has(&old, output->id);
+		if (entered == left)
 			continue;
 
 		wl_list_for_each(head, &output->head_list, output_link) {
 			weston_surface_send_enter_leave(es, head,
-							output_bit & entered,
-							output_bit & left);
+							entered, left);
 		}
 	}
 	/*
@@ -1543,12 +1950,13 @@ weston_surface_assign_output(struct weston_surface *es)
 	struct weston_output *new_output;
 	struct weston_view *view;
 	pixman_region32_t region;
-	uint32_t max, area, mask;
+	struct weston_output_mask mask;
+	uint32_t max, area;
 	pixman_box32_t *e;
 
 	new_output = NULL;
 	max = 0;
-	mask = 0;
+	weston_output_mask_init(&mask);
 	pixman_region32_init(&region);
 	wl_list_for_each(view, &es->views, surface_link) {
 		/* Only views that are visible on some layer participate in
@@ -1562,7 +1970,7 @@ weston_surface_assign_output(struct weston_surface *es)
 		e = pixman_region32_extents(&region);
 		area = (e->x2 - e->x1) * (e->y2 - e->y1);
 
-		mask |= view->output_mask;
+		weston_output_mask_union(&mask, &view->output_mask);
 
 		/* Do not switch from an active output to an inactive output. */
 		if (new_output &&
@@ -1600,12 +2008,16 @@ weston_surface_assign_output(struct weston_surface *es)
 	pixman_region32_fini(&region);
 
 	es->output = new_output;
-	weston_surface_update_output_mask(es, mask);
+	weston_surface_update_output_mask(es, &mask);
+	weston_output_mask_fini(&mask);
 
 	/* Surface primary output may have changed, and that may change the
 	 * surface preferred color profile. Part of the CM&HDR protocol
 	 * extension implementation. */
 	weston_surface_update_preferred_color_profile(es);
+
+	/* Same for the preferred scale. */
+	weston_surface_update_preferred_scale(es);
 }
 
 /** Recalculate which output(s) the view is displayed on
@@ -1626,12 +2038,12 @@ weston_view_assign_output(struct weston_view *ev)
 	struct weston_output *output, *new_output;
 	struct weston_paint_node *pnode, *pntmp;
 	pixman_region32_t region;
-	uint32_t new_output_area, area, mask;
+	uint32_t new_output_area, area;
 	pixman_box32_t *e;
 
 	new_output = NULL;
 	new_output_area = 0;
-	mask = 0;
+	weston_output_mask_clear(&ev->output_mask);
 	pixman_region32_init(&region);
 	wl_list_for_each(output, &ec->output_list, link) {
 		if (output->destroying)
@@ -1646,7 +2058,7 @@ weston_view_assign_output(struct weston_view *ev)
 		if (area == 0)
 			continue;
 
-		mask |= 1u << output->id;
+		weston_output_mask_set(&ev->output_mask, output->id);
 
 		/* Regardless of what we have now, even if it's off, a turned
 		 * off output is not better.
@@ -1672,13 +2084,13 @@ weston_view_assign_output(struct weston_view *ev)
 	pixman_region32_fini(&region);
 
 	weston_view_set_output(ev, new_output);
-	ev->output_mask = mask;
 
 	weston_surface_assign_output(ev->surface);
 
 	/* Destroy any paint nodes that no longer appear on their output */
 	wl_list_for_each_safe(pnode, pntmp, &ev->paint_node_list, view_link) {
-		if (!(pnode->view->output_mask & (1u << pnode->output->id)))
+		if (!weston_output_mask_has(&pnode->view->output_mask,
+					    pnode->output->id))
 			weston_paint_node_destroy(pnode);
 	}
 }
@@ -1898,6 +2310,25 @@ weston_view_update_transform_enable(struct weston_view *view)
 	return 0;
 }
 
+/* Marks the area of the view for the next weston_compositor_repick().
+ * Views that never take input, like the cursor, can't change what is under
+ * a pointer unless their input region is what changed. */
+static void
+weston_view_repick_damage(struct weston_view *view, bool input_changed)
+{
+	struct weston_compositor *compositor = view->surface->compositor;
+
+	if (compositor->repick.all)
+		return;
+
+	if (!input_changed && !pixman_region32_not_empty(&view->surface->input))
+		return;
+
+	pixman_region32_union(&compositor->repick.region,
+			      &compositor->repick.region,
+			      &view->transform.boundingbox);
+}
+
 WL_EXPORT void
 weston_view_update_transform(struct weston_view *view)
 {
@@ -1915,6 +2346,7 @@ weston_view_update_transform(struct weston_view *view)
 	view->transform.dirty = 0;
 
 	weston_view_damage_below(view);
+	weston_view_repick_damage(view, false);
 
 	pixman_region32_fini(&view->transform.boundingbox);
 	pixman_region32_fini(&view->transform.opaque);
@@ -1943,6 +2375,7 @@ weston_view_update_transform(struct weston_view *view)
 	}
 
 	weston_view_damage_below(view);
+	weston_view_repick_damage(view, false);
 
 	weston_view_assign_output(view);
 
@@ -1976,6 +2409,15 @@ weston_view_geometry_dirty_internal(struct weston_view *view)
 			 geometry.parent_link)
 		weston_view_geometry_dirty_internal(child);
 
+	if (view->pick_index.indexed &&
+	    view->surface->compositor->pick_index.valid &&
+	    wl_list_empty(&view->pick_index.dirty_link)) {
+		struct weston_compositor *compositor = view->surface->compositor;
+
+		wl_list_insert(compositor->pick_index.dirty_list.prev,
+			       &view->pick_index.dirty_link);
+	}
+
 	weston_view_dirty_paint_nodes(view);
 
 	weston_view_schedule_repaint(view);
@@ -2038,7 +2480,7 @@ weston_surface_schedule_repaint(struct weston_surface *surface)
 	struct weston_output *output;
 
 	wl_list_for_each(output, &surface->compositor->output_list, link)
-		if (surface->output_mask & (1u << output->id))
+		if (weston_output_mask_has(&surface->output_mask, output->id))
 			weston_output_schedule_repaint(output);
 }
 
@@ -2053,8 +2495,11 @@ weston_view_schedule_repaint(struct weston_view *view)
 {
 	struct weston_output *output;
 
+	if (view->repaint_inhibited)
+		return;
+
 	wl_list_for_each(output, &view->surface->compositor->output_list, link)
-		if (view->output_mask & (1u << output->id))
+		if (weston_output_mask_has(&view->output_mask, output->id))
 			weston_output_schedule_repaint(output);
 }
 
@@ -2125,6 +2570,68 @@ weston_view_set_position_with_offset(struct weston_view *view,
 	weston_view_set_position(view, newpos);
 }
 
+/* The output whose cursor plane shows the view, if it is shown on only one
+ * output and that output can move the plane by itself. */
+static struct weston_output *
+weston_view_cursor_plane_output(struct weston_view *view)
+{
+	struct weston_paint_node *pnode;
+
+	if (view->transform.dirty ||
+	    weston_output_mask_count(&view->output_mask) != 1)
+		return NULL;
+
+	wl_list_for_each(pnode, &view->paint_node_list, view_link) {
+		if (!weston_output_mask_has(&view->output_mask, pnode->output->id))
+			continue;
+
+		if (!pnode->output->move_cursor ||
+		    pnode->plane == &pnode->output->primary_plane)
+			return NULL;
+
+		return pnode->output;
+	}
+
+	return NULL;
+}
+
+/** Move a pointer or tablet tool cursor view
+ *
+ * \param view The cursor view.
+ * \param pos The cursor position.
+ * \param offset The inverted hotspot.
+ *
+ * Same as weston_view_set_position_with_offset(), except that when the view
+ * is on the plane of the one output it is shown on and stays within it, the
+ * backend moves the plane straight away and the output is not repainted.
+ */
+void
+weston_view_move_cursor(struct weston_view *view,
+			struct weston_coord_global pos,
+			struct weston_coord_surface offset)
+{
+	struct weston_output *output = weston_view_cursor_plane_output(view);
+
+	if (!output) {
+		weston_view_set_position_with_offset(view, pos, offset);
+		return;
+	}
+
+	view->repaint_inhibited = true;
+	weston_view_set_position_with_offset(view, pos, offset);
+	weston_view_update_transform(view);
+	view->repaint_inhibited = false;
+
+	if (weston_output_mask_count(&view->output_mask) == 1 &&
+	    weston_output_mask_has(&view->output_mask, output->id) &&
+	    output->move_cursor(output, view))
+		return;
+
+	/* Take the long way, also taking the view off the output it left */
+	weston_output_schedule_repaint(output);
+	weston_view_schedule_repaint(view);
+}
+
 WL_EXPORT struct weston_coord_surface
 weston_view_get_pos_offset_rel(struct weston_view *view)
 {
@@ -2383,6 +2890,32 @@ weston_view_matches_output_entirely(struct weston_view *ev,
 	return true;
 }
 
+/** Check if the view was put on a hardware plane in the last repaint
+ *
+ * \param view The view to check.
+ * \param output The output to check on.
+ * \param failure_reasons If not NULL, set to why the backend could not put
+ * the view on a plane, as a backend specific bit mask. The DRM backend
+ * spells them out in its debug scope.
+ *
+ * Returns true if the output showed the view without compositing it.
+ */
+WL_EXPORT bool
+weston_view_is_scanned_out(struct weston_view *view,
+			   struct weston_output *output,
+			   uint32_t *failure_reasons)
+{
+	struct weston_paint_node *pnode;
+
+	pnode = weston_view_find_paint_node(view, output);
+
+	if (failure_reasons)
+		*failure_reasons = pnode ?
+				   pnode->try_view_on_plane_failure_reasons : 0;
+
+	return pnode && pnode->plane && pnode->plane != &output->primary_plane;
+}
+
 /** Find paint node for the given view and output
  */
 WL_EXPORT struct weston_paint_node *
@@ -2391,13 +2924,14 @@ weston_view_find_paint_node(struct weston_view *view,
 {
 	struct weston_paint_node *pnode;
 
-	wl_list_for_each(pnode, &view->paint_node_list, view_link) {
-		assert(pnode->surface == view->surface);
-		if (pnode->output == output)
-			return pnode;
-	}
+	if (output->id >= view->paint_node_index.size / sizeof(pnode))
+		return NULL;
 
-	return NULL;
+	pnode = ((struct weston_paint_node **)view->paint_node_index.data)[output->id];
+	assert(!pnode || (pnode->surface == view->surface &&
+			  pnode->output == output));
+
+	return pnode;
 }
 
 /* Check if a surface has a view assigned to it
@@ -2478,6 +3012,55 @@ weston_surface_set_size(struct weston_surface *surface,
 	surface_set_size(surface, width, height);
 }
 
+/** Hint that a surface is meant to be scanned out
+ *
+ * \param surface The surface.
+ * \param preferred Whether the shell keeps the surface alone and unscaled
+ * on its output.
+ *
+ * Backends then offer the scanout dma-buf feedback for the surface as
+ * soon as it would help, rather than waiting for the scene to settle:
+ * a shell setting this promises that the scene does not keep changing
+ * between scanout and composition.
+ */
+WL_EXPORT void
+weston_surface_set_scanout_preferred(struct weston_surface *surface,
+				     bool preferred)
+{
+	if (surface->scanout_preferred == preferred)
+		return;
+
+	surface->scanout_preferred = preferred;
+	weston_surface_schedule_repaint(surface);
+}
+
+/** Limit the rate of the frame callbacks of a surface
+ *
+ * \param surface The surface.
+ * \param fps The most frame callbacks per second to send, 0 for no limit.
+ *
+ * Frame callbacks of the surface are held back at repaint until they are
+ * due, which slows down clients that draw whenever they are told to. Meant
+ * for shells to throttle windows that are not worth the full refresh rate,
+ * such as those in the background. Presentation feedback is not affected.
+ */
+WL_EXPORT void
+weston_surface_set_frame_rate_limit(struct weston_surface *surface,
+				    uint32_t fps)
+{
+	int64_t interval = fps ? NSEC_PER_SEC / fps : 0;
+
+	if (surface->frame_interval_nsec == interval)
+		return;
+
+	surface->frame_interval_nsec = interval;
+	surface->frame_limit_next.tv_sec = 0;
+	surface->frame_limit_next.tv_nsec = 0;
+
+	/* Callbacks that were held back may be due now */
+	weston_surface_schedule_repaint(surface);
+}
+
 static int
 fixed_round_up_to_int(wl_fixed_t f)
 {
@@ -2565,7 +3148,289 @@ weston_view_takes_input_at_point(struct weston_view *view,
 	return true;
 }
 
-/** weston_compositor_pick_view
+/* The pick index cells are at least this big in global coordinates, and
+ * the grid never has more than this many cells along either axis.
+ */
+#define PICK_INDEX_MIN_CELL_SIZE 64
+#define PICK_INDEX_MAX_CELLS 64
+
+static struct wl_array *
+pick_index_get_cell(struct weston_compositor *compositor, int col, int row)
+{
+	return &compositor->pick_index.cells[row * compositor->pick_index.cols + col];
+}
+
+static int
+pick_index_col(struct weston_compositor *compositor, int x)
+{
+	int col = (x - compositor->pick_index.extents.x1) /
+		  compositor->pick_index.cell_width;
+
+	return MAX(0, MIN(col, compositor->pick_index.cols - 1));
+}
+
+static int
+pick_index_row(struct weston_compositor *compositor, int y)
+{
+	int row = (y - compositor->pick_index.extents.y1) /
+		  compositor->pick_index.cell_height;
+
+	return MAX(0, MIN(row, compositor->pick_index.rows - 1));
+}
+
+static void
+weston_compositor_invalidate_pick_index(struct weston_compositor *compositor)
+{
+	struct weston_view *view, *tmp;
+
+	wl_list_for_each_safe(view, tmp, &compositor->pick_index.dirty_list,
+			      pick_index.dirty_link) {
+		wl_list_remove(&view->pick_index.dirty_link);
+		wl_list_init(&view->pick_index.dirty_link);
+	}
+
+	compositor->pick_index.valid = false;
+	compositor->repick.all = true;
+}
+
+static void
+weston_compositor_release_pick_index(struct weston_compositor *compositor)
+{
+	int i;
+
+	weston_compositor_invalidate_pick_index(compositor);
+
+	for (i = 0; i < compositor->pick_index.cols * compositor->pick_index.rows; i++)
+		wl_array_release(&compositor->pick_index.cells[i]);
+	free(compositor->pick_index.cells);
+	compositor->pick_index.cells = NULL;
+	compositor->pick_index.cols = 0;
+	compositor->pick_index.rows = 0;
+}
+
+/* Insert into a cell, keeping the cell sorted by view_list order. */
+static bool
+pick_index_cell_insert(struct wl_array *cell, struct weston_view *view)
+{
+	struct weston_view **views;
+	size_t count = cell->size / sizeof(*views);
+	size_t i;
+
+	if (!wl_array_add(cell, sizeof(*views)))
+		return false;
+
+	views = cell->data;
+	for (i = count; i > 0; i--) {
+		if (views[i - 1]->pick_index.order < view->pick_index.order)
+			break;
+		views[i] = views[i - 1];
+	}
+	views[i] = view;
+
+	return true;
+}
+
+static void
+pick_index_cell_remove(struct wl_array *cell, struct weston_view *view)
+{
+	struct weston_view **views = cell->data;
+	size_t count = cell->size / sizeof(*views);
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (views[i] != view)
+			continue;
+
+		memmove(&views[i], &views[i + 1],
+			(count - i - 1) * sizeof(*views));
+		cell->size -= sizeof(*views);
+		return;
+	}
+}
+
+static void
+weston_view_pick_index_unbin(struct weston_view *view)
+{
+	struct weston_compositor *compositor = view->surface->compositor;
+	int col, row;
+
+	for (row = view->pick_index.row1; row < view->pick_index.row2; row++)
+		for (col = view->pick_index.col1; col < view->pick_index.col2; col++)
+			pick_index_cell_remove(pick_index_get_cell(compositor, col, row),
+					       view);
+
+	view->pick_index.col1 = view->pick_index.col2 = 0;
+	view->pick_index.row1 = view->pick_index.row2 = 0;
+}
+
+/* Views are added to every cell their bounding box touches. The bounding
+ * box must be up-to-date.
+ */
+static bool
+weston_view_pick_index_bin(struct weston_view *view)
+{
+	struct weston_compositor *compositor = view->surface->compositor;
+	pixman_box32_t *box = pixman_region32_extents(&view->transform.boundingbox);
+	int col, row;
+
+	view->pick_index.indexed = true;
+
+	if (box->x1 >= box->x2 || box->y1 >= box->y2)
+		return true;
+
+	view->pick_index.col1 = pick_index_col(compositor, box->x1);
+	view->pick_index.col2 = pick_index_col(compositor, box->x2 - 1) + 1;
+	view->pick_index.row1 = pick_index_row(compositor, box->y1);
+	view->pick_index.row2 = pick_index_row(compositor, box->y2 - 1) + 1;
+
+	for (row = view->pick_index.row1; row < view->pick_index.row2; row++) {
+		for (col = view->pick_index.col1; col < view->pick_index.col2; col++) {
+			struct wl_array *cell;
+
+			cell = pick_index_get_cell(compositor, col, row);
+			if (!pick_index_cell_insert(cell, view))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static void
+weston_view_pick_index_remove(struct weston_view *view)
+{
+	if (!view->pick_index.indexed)
+		return;
+
+	if (view->surface->compositor->pick_index.valid)
+		weston_view_pick_index_unbin(view);
+	wl_list_remove(&view->pick_index.dirty_link);
+	wl_list_init(&view->pick_index.dirty_link);
+	view->pick_index.indexed = false;
+}
+
+static bool
+weston_compositor_rebuild_pick_index(struct weston_compositor *compositor)
+{
+	struct weston_output *output;
+	struct weston_view *view;
+	pixman_box32_t extents = { 0, 0, 1, 1 };
+	bool first = true;
+	int cols, rows, width, height, i;
+	uint32_t order = 0;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		pixman_box32_t *box = pixman_region32_extents(&output->region);
+
+		if (first) {
+			extents = *box;
+			first = false;
+			continue;
+		}
+
+		extents.x1 = MIN(extents.x1, box->x1);
+		extents.y1 = MIN(extents.y1, box->y1);
+		extents.x2 = MAX(extents.x2, box->x2);
+		extents.y2 = MAX(extents.y2, box->y2);
+	}
+
+	width = MAX(extents.x2 - extents.x1, 1);
+	height = MAX(extents.y2 - extents.y1, 1);
+	cols = MIN(DIV_ROUND_UP(width, PICK_INDEX_MIN_CELL_SIZE),
+		   PICK_INDEX_MAX_CELLS);
+	rows = MIN(DIV_ROUND_UP(height, PICK_INDEX_MIN_CELL_SIZE),
+		   PICK_INDEX_MAX_CELLS);
+
+	if (cols != compositor->pick_index.cols ||
+	    rows != compositor->pick_index.rows) {
+		weston_compositor_release_pick_index(compositor);
+
+		compositor->pick_index.cells = xcalloc(cols * rows,
+						       sizeof(struct wl_array));
+		for (i = 0; i < cols * rows; i++)
+			wl_array_init(&compositor->pick_index.cells[i]);
+		compositor->pick_index.cols = cols;
+		compositor->pick_index.rows = rows;
+	} else {
+		for (i = 0; i < cols * rows; i++)
+			compositor->pick_index.cells[i].size = 0;
+	}
+
+	compositor->pick_index.extents = extents;
+	compositor->pick_index.cell_width = DIV_ROUND_UP(width, cols);
+	compositor->pick_index.cell_height = DIV_ROUND_UP(height, rows);
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		weston_view_update_transform(view);
+
+		view->pick_index.order = order++;
+		view->pick_index.col1 = view->pick_index.col2 = 0;
+		view->pick_index.row1 = view->pick_index.row2 = 0;
+		if (!weston_view_pick_index_bin(view))
+			return false;
+	}
+
+	compositor->pick_index.valid = true;
+
+	return true;
+}
+
+/* Bring the pick index up-to-date: rebuild it from scratch after the view
+ * list or output layout changed, otherwise only re-bin the views whose
+ * geometry changed since the last pick.
+ */
+static bool
+weston_compositor_update_pick_index(struct weston_compositor *compositor)
+{
+	struct wl_list *dirty_list = &compositor->pick_index.dirty_list;
+	struct weston_view *view;
+
+	if (!compositor->pick_index.valid) {
+		/* Views from an older index must not claim membership. */
+		wl_list_for_each(view, &compositor->view_list, link)
+			view->pick_index.indexed = false;
+
+		if (!weston_compositor_rebuild_pick_index(compositor))
+			goto fail;
+
+		return true;
+	}
+
+	while (!wl_list_empty(dirty_list)) {
+		view = container_of(dirty_list->next, struct weston_view,
+				    pick_index.dirty_link);
+		wl_list_remove(&view->pick_index.dirty_link);
+		wl_list_init(&view->pick_index.dirty_link);
+
+		weston_view_update_transform(view);
+		weston_view_pick_index_unbin(view);
+		if (!weston_view_pick_index_bin(view))
+			goto fail;
+	}
+
+	return true;
+
+fail:
+	weston_compositor_invalidate_pick_index(compositor);
+	return false;
+}
+
+static bool
+weston_view_accepts_pick(struct weston_view *view,
+			 struct weston_coord_global pos)
+{
+	struct weston_coord_surface surf_pos;
+
+	if (!pixman_region32_contains_point(&view->transform.boundingbox,
+					    pos.c.x, pos.c.y, NULL))
+		return false;
+
+	surf_pos = weston_coord_global_to_surface(view, pos);
+
+	return weston_view_takes_input_at_point(view, surf_pos);
+}
+
+/** weston_compositor_pick_view
  * \ingroup compositor
  */
 WL_EXPORT struct weston_view *
@@ -2575,20 +3440,31 @@ weston_compositor_pick_view(struct weston_compositor *compositor,
 	struct weston_view *view;
 
 	/* Can't use paint node list: occlusion by input regions, not opaque. */
-	wl_list_for_each(view, &compositor->view_list, link) {
-		struct weston_coord_surface surf_pos;
-
-		weston_view_update_transform(view);
+	if (weston_compositor_update_pick_index(compositor)) {
+		struct weston_view **views;
+		struct wl_array *cell;
+		size_t count, i;
+
+		cell = pick_index_get_cell(compositor,
+					   pick_index_col(compositor, pos.c.x),
+					   pick_index_row(compositor, pos.c.y));
+		views = cell->data;
+		count = cell->size / sizeof(*views);
+
+		for (i = 0; i < count; i++) {
+			if (weston_view_accepts_pick(views[i], pos))
+				return views[i];
+		}
 
-		if (!pixman_region32_contains_point(
-				&view->transform.boundingbox, pos.c.x, pos.c.y, NULL))
-			continue;
+		return NULL;
+	}
 
-		surf_pos = weston_coord_global_to_surface(view, pos);
-		if (!weston_view_takes_input_at_point(view, surf_pos))
-			continue;
+	/* Fall back to walking the whole list if the index is unusable. */
+	wl_list_for_each(view, &compositor->view_list, link) {
+		weston_view_update_transform(view);
 
-		return view;
+		if (weston_view_accepts_pick(view, pos))
+			return view;
 	}
 	return NULL;
 }
@@ -2598,11 +3474,32 @@ weston_compositor_repick(struct weston_compositor *compositor)
 {
 	struct weston_seat *seat;
 
-	if (!compositor->session_active)
+	/* Nothing under the pointers is known to hold while away */
+	if (!compositor->session_active) {
+		compositor->repick.all = true;
 		return;
+	}
+
+	if (!compositor->repick.all &&
+	    !pixman_region32_not_empty(&compositor->repick.region))
+		return;
+
+	wl_list_for_each(seat, &compositor->seat_list, link) {
+		struct weston_pointer *pointer = weston_seat_get_pointer(seat);
+
+		if (!pointer)
+			continue;
 
-	wl_list_for_each(seat, &compositor->seat_list, link)
-		weston_seat_repick(seat);
+		/* A cleared focus is picked again, as it always was */
+		if (compositor->repick.all || !pointer->focus ||
+		    pixman_region32_contains_point(&compositor->repick.region,
+						   pointer->pos.c.x,
+						   pointer->pos.c.y, NULL))
+			weston_seat_repick(seat);
+	}
+
+	compositor->repick.all = false;
+	pixman_region32_clear(&compositor->repick.region);
 }
 
 static void
@@ -2631,14 +3528,16 @@ weston_view_unmap(struct weston_view *view)
 	}
 
 	weston_view_damage_below(view);
+	weston_view_repick_damage(view, false);
 	weston_view_set_output(view, NULL);
 	view->is_mapped = false;
 	wl_list_remove(&view->layer_link.link);
 	wl_list_init(&view->layer_link.link);
 	view->layer_link.layer = NULL;
+	weston_view_pick_index_remove(view);
 	wl_list_remove(&view->link);
 	wl_list_init(&view->link);
-	view->output_mask = 0;
+	weston_output_mask_clear(&view->output_mask);
 	weston_surface_assign_output(view->surface);
 
 	if (!weston_surface_is_mapped(view->surface)) {
@@ -2676,6 +3575,8 @@ static void weston_surface_start_mapping(struct weston_surface *surface)
 	surface->is_mapping = true;
 	surface->is_mapped = true;
 	surface->compositor->view_list_needs_rebuild = true;
+	if (weston_surface_to_subsurface(surface))
+		weston_compositor_subsurface_order_changed(surface->compositor);
 	wl_signal_emit_mutable(&surface->map_signal, surface);
 }
 
@@ -2696,6 +3597,8 @@ weston_surface_unmap(struct weston_surface *surface)
 	struct weston_view *view;
 
 	surface->is_mapped = false;
+	if (weston_surface_to_subsurface(surface))
+		weston_compositor_subsurface_order_changed(surface->compositor);
 	wl_list_for_each(view, &surface->views, surface_link)
 		weston_view_unmap(view);
 	surface->output = NULL;
@@ -2705,6 +3608,8 @@ weston_surface_unmap(struct weston_surface *surface)
 WL_EXPORT void
 weston_view_destroy(struct weston_view *view)
 {
+	struct weston_output *output;
+
 	if (weston_view_is_mapped(view))
 		weston_view_unmap(view);
 
@@ -2714,14 +3619,24 @@ weston_view_destroy(struct weston_view *view)
 
 	assert(wl_list_empty(&view->paint_node_list));
 
+	wl_list_for_each(output, &view->surface->compositor->output_list, link) {
+		if (output->z_order_occluder == view)
+			output->z_order_occluder = NULL;
+	}
+
 	if (!wl_list_empty(&view->link))
 		view->surface->compositor->view_list_needs_rebuild = true;
+	weston_view_pick_index_remove(view);
 	wl_list_remove(&view->link);
 
 	wl_list_remove(&view->layer_link.link);
 	wl_list_init(&view->layer_link.link);
 	view->layer_link.layer = NULL;
 
+	if (view->parent_view)
+		weston_compositor_subsurface_order_changed(view->surface->compositor);
+	wl_array_release(&view->subsurface_order.views);
+
 	pixman_region32_fini(&view->visible);
 	pixman_region32_fini(&view->geometry.scissor);
 	pixman_region32_fini(&view->transform.boundingbox);
@@ -2732,7 +3647,10 @@ weston_view_destroy(struct weston_view *view)
 
 	wl_list_remove(&view->surface_link);
 
-	free(view);
+	weston_output_mask_fini(&view->output_mask);
+	wl_array_release(&view->paint_node_index);
+
+	object_pool_free(&view->surface->compositor->view_pool, view);
 }
 
 WL_EXPORT struct weston_surface *
@@ -2765,6 +3683,8 @@ weston_surface_unref(struct weston_surface *surface)
 
 	wl_signal_emit_mutable(&surface->destroy_signal, surface);
 
+	weston_surface_scene_record_destroy(surface);
+
 	assert(wl_list_empty(&surface->subsurface_list_pending));
 	assert(wl_list_empty(&surface->subsurface_list));
 
@@ -2804,6 +3724,18 @@ weston_surface_unref(struct weston_surface *surface)
 	if (surface->tear_control)
 		surface->tear_control->surface = NULL;
 
+	if (surface->content_type_resource)
+		wl_resource_set_user_data(surface->content_type_resource, NULL);
+
+	if (surface->syncobj_surface)
+		weston_drm_syncobj_surface_detach(surface->syncobj_surface);
+
+	if (surface->commit_timer)
+		surface->commit_timer->surface = NULL;
+	weston_surface_discard_commit_queue(surface);
+
+	weston_surface_latency_destroy(surface);
+
 	weston_color_profile_unref(surface->color_profile);
 	weston_color_profile_unref(surface->preferred_color_profile);
 
@@ -2817,6 +3749,7 @@ weston_surface_unref(struct weston_surface *surface)
 	if (surface->cm_surface)
 		wl_resource_set_user_data(surface->cm_surface, NULL);
 
+	weston_output_mask_fini(&surface->output_mask);
 	free(surface);
 }
 
@@ -2835,6 +3768,10 @@ destroy_surface(struct wl_resource *resource)
 	if (surface->viewport_resource)
 		wl_resource_set_user_data(surface->viewport_resource, NULL);
 
+	if (surface->fractional_scale_resource)
+		wl_resource_set_user_data(surface->fractional_scale_resource,
+					  NULL);
+
 	if (surface->synchronization_resource) {
 		wl_resource_set_user_data(surface->synchronization_resource,
 					  NULL);
@@ -2873,6 +3810,7 @@ weston_buffer_destroy_handler(struct wl_listener *listener, void *data)
 		return;
 
 	wl_signal_emit_mutable(&buffer->destroy_signal, buffer);
+	weston_buffer_uncharge_client_memory(buffer);
 	free(buffer);
 }
 
@@ -2955,6 +3893,8 @@ weston_buffer_from_resource(struct weston_compositor *ec,
 		buffer->type = WESTON_BUFFER_RENDERER_OPAQUE;
 	}
 
+	weston_buffer_charge_client_memory(ec, buffer);
+
 	if (ec->renderer->buffer_init)
 		ec->renderer->buffer_init(ec, buffer);
 
@@ -3023,6 +3963,7 @@ weston_buffer_reference(struct weston_buffer_reference *ref,
 	    !old_ref.buffer->resource) {
 		wl_signal_emit_mutable(&old_ref.buffer->destroy_signal,
 					   old_ref.buffer);
+		weston_buffer_uncharge_client_memory(old_ref.buffer);
 		free(old_ref.buffer);
 	}
 }
@@ -3045,6 +3986,11 @@ weston_buffer_release_destroy(struct weston_buffer_release *buffer_release)
 	struct wl_resource *resource = buffer_release->resource;
 	int release_fence_fd = buffer_release->fence_fd;
 
+	if (buffer_release->release_timeline) {
+		weston_drm_syncobj_buffer_release_destroy(buffer_release);
+		return;
+	}
+
 	if (release_fence_fd >= 0) {
 		zwp_linux_buffer_release_v1_send_fenced_release(
 			resource, release_fence_fd);
@@ -3072,8 +4018,11 @@ weston_buffer_release_reference(struct weston_buffer_release_reference *ref,
 
 	if (buffer_release) {
 		buffer_release->ref_count++;
-		wl_resource_add_destroy_listener(buffer_release->resource,
-						 &ref->destroy_listener);
+		if (buffer_release->resource)
+			wl_resource_add_destroy_listener(buffer_release->resource,
+							 &ref->destroy_listener);
+		else
+			wl_list_init(&ref->destroy_listener.link);
 	}
 
 	ref->buffer_release = buffer_release;
@@ -3262,6 +4211,7 @@ weston_surface_attach(struct weston_surface *surface,
 {
 	struct weston_buffer *buffer = state->buffer;
 	struct weston_buffer *old_buffer = surface->buffer_ref.buffer;
+	struct weston_view *view;
 
 	if (!buffer) {
 		if (weston_surface_is_mapped(surface)) {
@@ -3309,8 +4259,16 @@ weston_surface_attach(struct weston_surface *surface,
 	if (!old_buffer ||
 	    buffer->pixel_format != old_buffer->pixel_format ||
 	    buffer->format_modifier != old_buffer->format_modifier) {
+		bool was_opaque = surface->is_opaque;
+
 		surface->is_opaque = pixel_format_is_opaque(buffer->pixel_format);
 		status |= WESTON_SURFACE_DIRTY_BUFFER_PARAMS;
+
+		/* The opaque area of the views follows */
+		if (surface->is_opaque != was_opaque) {
+			wl_list_for_each(view, &surface->views, surface_link)
+				weston_view_geometry_dirty(view);
+		}
 	}
 
 	status |= WESTON_SURFACE_DIRTY_BUFFER;
@@ -3349,28 +4307,27 @@ static void
 paint_node_add_damage(struct weston_paint_node *node)
 {
 	struct weston_view *view = node->view;
-	pixman_region32_t damage;
+	pixman_region32_t *scratch = node->output->scratch_region;
 
 	assert(!view->transform.dirty);
 
 	if (node->draw_solid)
 		return;
 
-	pixman_region32_init(&damage);
 	if (view->transform.enabled) {
-		pixman_box32_t *extents;
-
-		extents = pixman_region32_extents(&view->surface->damage);
-		view_compute_bbox(view, extents, &damage);
+		/* Rather than the box around all of the damage, which on a
+		 * rotated or zooming view is much more than was damaged. */
+		weston_matrix_transform_region(&scratch[1],
+					       &view->transform.matrix,
+					       &view->surface->damage);
+		region_union_in_place(&node->damage, &scratch[1], &scratch[0]);
 	} else {
-		pixman_region32_copy(&damage, &view->surface->damage);
-		pixman_region32_translate(&damage,
+		pixman_region32_copy(&scratch[1], &view->surface->damage);
+		pixman_region32_translate(&scratch[1],
 					  view->geometry.pos_offset.x,
 					  view->geometry.pos_offset.y);
+		region_union_in_place(&node->damage, &scratch[1], &scratch[0]);
 	}
-
-	pixman_region32_union(&node->damage, &node->damage, &damage);
-	pixman_region32_fini(&damage);
 }
 
 static void
@@ -3402,41 +4359,69 @@ paint_node_flush_surface_damage(struct weston_paint_node *pnode)
 	pixman_region32_clear(&surface->damage);
 }
 
-static void
-view_update_visible(struct weston_view *view,
-                             pixman_region32_t *opaque)
+static bool
+box_overlaps(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+	       a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+/* Returns true if the accumulated opaque region now covers the output. */
+static bool
+view_update_visible(struct weston_view *view, pixman_region32_t *opaque,
+		    const pixman_box32_t *output_box,
+		    pixman_region32_t *scratch)
 {
+	pixman_box32_t *bbox = pixman_region32_extents(&view->transform.boundingbox);
+
 	assert(!view->transform.dirty);
 
-	pixman_region32_subtract(&view->visible, &view->transform.boundingbox,
-				 opaque);
-	pixman_region32_union(opaque, opaque, &view->transform.opaque);
-}
+	if (!pixman_region32_not_empty(opaque) ||
+	    !box_overlaps(bbox, pixman_region32_extents(opaque))) {
+		pixman_region32_copy(&view->visible,
+				     &view->transform.boundingbox);
+	} else if (pixman_region32_contains_rectangle(opaque, bbox) ==
+		   PIXMAN_REGION_IN) {
+		pixman_region32_clear(&view->visible);
+	} else {
+		pixman_region32_subtract(&view->visible,
+					 &view->transform.boundingbox, opaque);
+	}
 
+	if (!pixman_region32_not_empty(&view->transform.opaque))
+		return false;
 
-static void
-output_update_visibility(struct weston_output *output)
+	region_union_in_place(opaque, &view->transform.opaque, scratch);
+
+	return pixman_region32_contains_rectangle(opaque, output_box) ==
+		PIXMAN_REGION_IN;
+}
+
+WESTON_EXPORT_FOR_TESTS void
+weston_output_update_visibility(struct weston_output *output)
 {
 	struct weston_paint_node *pnode;
-	pixman_region32_t opaque, clip;
+	pixman_region32_t *opaque = &output->scratch_region[1];
+	pixman_box32_t *output_box = pixman_region32_extents(&output->region);
+	bool covered = false;
 
-	pixman_region32_init(&clip);
-
-	pixman_region32_init(&opaque);
+	pixman_region32_clear(opaque);
 
 	wl_list_for_each(pnode, &output->paint_node_z_order_list,
 			 z_order_link) {
-		view_update_visible(pnode->view, &opaque);
+		/* Nothing below a fully covered output can be seen. */
+		if (covered) {
+			pixman_region32_clear(&pnode->view->visible);
+			continue;
+		}
 
-		pixman_region32_union(&clip, &clip, &opaque);
+		covered = view_update_visible(pnode->view, opaque, output_box,
+					      &output->scratch_region[0]);
 	}
-
-	pixman_region32_fini(&opaque);
-	pixman_region32_fini(&clip);
 }
 
-static void
-output_accumulate_damage(struct weston_output *output)
+WESTON_EXPORT_FOR_TESTS void
+weston_output_accumulate_damage(struct weston_output *output)
 {
 	struct weston_paint_node *pnode;
 
@@ -3508,10 +4493,51 @@ add_to_z_order_list(struct weston_output *output,
 	weston_paint_node_ensure_color_transform(pnode);
 }
 
+/** Prepare the renderer for drawing a view that is about to be shown
+ *
+ * \param view The view that will be shown.
+ * \param output The output it will be shown on.
+ *
+ * Imports the current buffer of the view's surface and builds the shader
+ * program needed to draw it on the output, so that the first repaint showing
+ * the view does not have to. Shells call this just before mapping or raising
+ * a view. Renderers that have nothing to prepare ignore it.
+ */
+WL_EXPORT void
+weston_view_prewarm(struct weston_view *view, struct weston_output *output)
+{
+	struct weston_compositor *compositor = view->surface->compositor;
+	struct weston_paint_node *pnode;
+
+	if (!compositor->renderer->prewarm)
+		return;
+
+	if (!output || !output->enabled || !view->surface->buffer_ref.buffer)
+		return;
+
+	weston_view_update_transform(view);
+
+	pnode = view_ensure_paint_node(view, output);
+	if (!pnode)
+		return;
+
+	weston_paint_node_ensure_color_transform(pnode);
+	compositor->renderer->prewarm(pnode);
+}
+
+static void
+subsurface_order_append(struct wl_array *order, struct weston_view *view)
+{
+	struct weston_view **v;
+
+	v = abort_oom_if_null(wl_array_add(order, sizeof *v));
+	*v = view;
+}
+
 static void
-view_list_add_subsurface_view(struct weston_compositor *compositor,
-			      struct weston_subsurface *sub,
-			      struct weston_view *parent)
+subsurface_order_add_subsurface_view(struct wl_array *order,
+				     struct weston_subsurface *sub,
+				     struct weston_view *parent)
 {
 	struct weston_subsurface *child;
 	struct weston_view *view = NULL, *iv;
@@ -3528,34 +4554,46 @@ view_list_add_subsurface_view(struct weston_compositor *compositor,
 
 	assert(view);
 
-	weston_view_update_transform(view);
-	view->is_mapped = true;
-
 	if (wl_list_empty(&sub->surface->subsurface_list)) {
-		wl_list_insert(compositor->view_list.prev, &view->link);
+		subsurface_order_append(order, view);
 		return;
 	}
 
 	wl_list_for_each(child, &sub->surface->subsurface_list, parent_link) {
 		if (child->surface == sub->surface) {
-			wl_list_insert(compositor->view_list.prev, &view->link);
+			subsurface_order_append(order, view);
 		} else {
-			view_list_add_subsurface_view(compositor, child, view);
+			subsurface_order_add_subsurface_view(order, child, view);
 		}
 	}
 }
 
-/* This recursively adds the sub-surfaces for a view, relying on the
- * sub-surface order. Thus, if a client restacks the sub-surfaces, that
- * change first happens to the sub-surface list, and then automatically
- * propagates here. See weston_surface_damage_subsurfaces() for how the
- * sub-surfaces receive damage when the client changes the state.
+/* Invalidate the flattened sub-surface order cached in all views */
+static void
+weston_compositor_subsurface_order_changed(struct weston_compositor *compositor)
+{
+	/* zero is never valid */
+	if (++compositor->subsurface_order_serial == 0)
+		compositor->subsurface_order_serial = 1;
+}
+
+/* This adds the sub-surfaces for a view, relying on the sub-surface
+ * order. Thus, if a client restacks the sub-surfaces, that change first
+ * happens to the sub-surface list, and then automatically propagates
+ * here. See weston_surface_damage_subsurfaces() for how the sub-surfaces
+ * receive damage when the client changes the state.
+ *
+ * Walking the sub-surface trees is only needed after something changed
+ * in any of them, see weston_compositor_subsurface_order_changed().
+ * Otherwise the flattened order from the previous walk is reused.
  */
 static void
 view_list_add(struct weston_compositor *compositor,
 	      struct weston_view *view)
 {
+	struct wl_array *order = &view->subsurface_order.views;
 	struct weston_subsurface *sub;
+	struct weston_view **v;
 
 	weston_view_update_transform(view);
 
@@ -3564,24 +4602,114 @@ view_list_add(struct weston_compositor *compositor,
 		return;
 	}
 
-	wl_list_for_each(sub, &view->surface->subsurface_list, parent_link) {
-		if (sub->surface == view->surface) {
-			wl_list_insert(compositor->view_list.prev, &view->link);
-		} else {
-			view_list_add_subsurface_view(compositor, sub, view);
+	if (view->subsurface_order.serial !=
+	    compositor->subsurface_order_serial) {
+		order->size = 0;
+		wl_list_for_each(sub, &view->surface->subsurface_list,
+				 parent_link) {
+			if (sub->surface == view->surface) {
+				subsurface_order_append(order, view);
+			} else {
+				subsurface_order_add_subsurface_view(order,
+								     sub, view);
+			}
+		}
+		view->subsurface_order.serial =
+			compositor->subsurface_order_serial;
+	}
+
+	wl_array_for_each(v, order) {
+		if (*v != view) {
+			weston_view_update_transform(*v);
+			(*v)->is_mapped = true;
 		}
+		wl_list_insert(compositor->view_list.prev, &(*v)->link);
 	}
 }
 
-static void
-weston_output_build_z_order_list(struct weston_compositor *compositor,
-				 struct weston_output *output)
+/* Check whether rebuilding the z-order list from the view list would give
+ * the list we already have. This is the common case where only geometry or
+ * content has changed, and lets us keep the previous z-order list as is.
+ */
+/* Accumulate the opaque area of the views from the top of the view list
+ * down, and tell whether it now covers the whole output, at which point
+ * nothing below can be seen there.
+ */
+static bool
+weston_output_occluded_by(struct weston_output *output,
+			  pixman_region32_t *opaque,
+			  struct weston_view *view)
 {
-	struct weston_paint_node *pnode;
-	struct weston_view *view;
+	if (!pixman_region32_not_empty(&view->transform.opaque))
+		return false;
+
+	region_union_in_place(opaque, &view->transform.opaque,
+			      &output->scratch_region[0]);
+
+	return pixman_region32_contains_rectangle(opaque,
+			pixman_region32_extents(&output->region)) ==
+		PIXMAN_REGION_IN;
+}
+
+static bool
+weston_output_z_order_list_is_current(struct weston_compositor *compositor,
+				      struct weston_output *output)
+{
+	struct wl_list *pos = output->paint_node_z_order_list.next;
+	pixman_region32_t *opaque = &output->scratch_region[1];
+	struct weston_paint_node *pnode;
+	struct weston_view *view;
+
+	pixman_region32_clear(opaque);
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		/* Let the full rebuild deal with erroneous views. */
+		if (!weston_surface_is_mapped(view->surface) ||
+		    !weston_view_is_mapped(view) ||
+		    !weston_surface_has_content(view->surface))
+			return false;
+
+		if (!weston_output_mask_has(&view->output_mask, output->id))
+			continue;
+
+		if (pos == &output->paint_node_z_order_list)
+			return false;
+
+		pnode = container_of(pos, struct weston_paint_node, z_order_link);
+		if (pnode->view != view)
+			return false;
+
+		pos = pos->next;
+
+		if (weston_output_occluded_by(output, opaque, view))
+			return output->z_order_occluder == view &&
+			       pos == &output->paint_node_z_order_list;
+	}
+
+	return output->z_order_occluder == NULL &&
+	       pos == &output->paint_node_z_order_list;
+}
+
+static void
+weston_output_build_z_order_list(struct weston_compositor *compositor,
+				 struct weston_output *output)
+{
+	pixman_region32_t *opaque = &output->scratch_region[1];
+	struct weston_paint_node *pnode;
+	struct weston_view *view;
+	bool occluded = false;
+
+	if (weston_output_z_order_list_is_current(compositor, output)) {
+		wl_list_for_each(pnode, &output->paint_node_z_order_list,
+				 z_order_link)
+			weston_paint_node_ensure_color_transform(pnode);
+		return;
+	}
 
 	wl_list_remove(&output->paint_node_z_order_list);
 	wl_list_init(&output->paint_node_z_order_list);
+	output->z_order_occluder = NULL;
+	pixman_region32_clear(opaque);
 
 	wl_list_for_each(view, &compositor->view_list, link) {
 		/* It is possible for a view to appear in the layer list even though
@@ -3602,34 +4730,79 @@ weston_output_build_z_order_list(struct weston_compositor *compositor,
 			continue;
 		}
 
-		if (!(view->output_mask & (1u << output->id)))
+		if (!weston_output_mask_has(&view->output_mask, output->id))
+			continue;
+
+		/* Hidden behind opaque views: no paint node to update. */
+		if (occluded) {
+			pnode = weston_view_find_paint_node(view, output);
+			if (pnode)
+				weston_paint_node_destroy(pnode);
+
 			continue;
+		}
 
 		pnode = view_ensure_paint_node(view, output);
 		add_to_z_order_list(output, pnode);
+
+		if (weston_output_occluded_by(output, opaque, view)) {
+			output->z_order_occluder = view;
+			occluded = true;
+		}
 	}
 }
 
-static void
+WESTON_EXPORT_FOR_TESTS void
 weston_compositor_build_view_list(struct weston_compositor *compositor)
 {
 	struct weston_output *output;
 	struct weston_view *view, *tmp;
 	struct weston_layer *layer;
-
-	wl_list_for_each_safe(view, tmp, &compositor->view_list, link)
+	bool changed;
+
+	/* Views only leave the list outside of the layers by being unmapped,
+	 * which takes them out of the pick index as well. Only layer and
+	 * sub-surface changes can add or reorder views. */
+	changed = compositor->layer_list_dirty ||
+		  compositor->pick_index.subsurface_order_serial !=
+		  compositor->subsurface_order_serial;
+	wl_list_for_each(layer, &compositor->layer_list, link)
+		changed |= layer->view_list_dirty;
+
+	wl_list_for_each_safe(view, tmp, &compositor->view_list, link) {
+		if (changed)
+			view->pick_index.indexed = false;
 		wl_list_init(&view->link);
+	}
 	wl_list_init(&compositor->view_list);
 
 	wl_list_for_each(layer, &compositor->layer_list, link) {
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link) {
 			view_list_add(compositor, view);
 		}
+		layer->view_list_dirty = false;
+	}
+
+	/* Unmapped sub-surfaces come back without any of those. */
+	if (!changed) {
+		wl_list_for_each(view, &compositor->view_list, link) {
+			if (!view->pick_index.indexed) {
+				changed = true;
+				break;
+			}
+		}
 	}
 
 	wl_list_for_each(output, &compositor->output_list, link)
 		weston_output_build_z_order_list(compositor, output);
 
+	/* Geometry changes alone re-bin the views they moved. */
+	if (changed)
+		weston_compositor_invalidate_pick_index(compositor);
+
+	compositor->layer_list_dirty = false;
+	compositor->pick_index.subsurface_order_serial =
+		compositor->subsurface_order_serial;
 	compositor->view_list_needs_rebuild = false;
 }
 
@@ -3639,15 +4812,17 @@ weston_output_take_feedback_list(struct weston_output *output,
 {
 	struct weston_presentation_feedback *feedback;
 	struct weston_paint_node *pnode;
+	struct weston_view *view;
 	uint32_t flags = 0xffffffff;
 
 	if (wl_list_empty(&surface->feedback_list))
 		return;
 
 	/* All views must have the flag for the flag to survive. */
-	wl_list_for_each(pnode, &surface->paint_node_list, surface_link) {
+	wl_list_for_each(view, &surface->views, surface_link) {
 		/* ignore views that are not on this output at all */
-		if (pnode->output != output)
+		pnode = weston_view_find_paint_node(view, output);
+		if (!pnode)
 			continue;
 		flags &= pnode->psf_flags;
 	}
@@ -3700,14 +4875,99 @@ weston_output_flush_damage_for_plane(struct weston_output *output,
 		 * and the visibility regions for paint nodes on this
 		 * output are up to date.
 		 */
-		pixman_region32_intersect(&pnode->damage, &pnode->damage, &pnode->visible);
-		pixman_region32_union(damage, damage, &pnode->damage);
+		pixman_region32_intersect(&output->scratch_region[1],
+					  &pnode->damage, &pnode->visible);
+		region_union_in_place(damage, &output->scratch_region[1],
+				      &output->scratch_region[0]);
 		pixman_region32_clear(&pnode->damage);
 	}
 	pixman_region32_intersect(damage, damage, &output->region);
 	return changed;
 }
 
+static uint64_t
+box_area(const pixman_box32_t *box)
+{
+	return (uint64_t) (box->x2 - box->x1) * (uint64_t) (box->y2 - box->y1);
+}
+
+/* Trade exactness for fewer rectangles once damage gets fragmented.
+ *
+ * When the region has more than max_rects rectangles, they are merged in
+ * band order into boxes covering at most max_overdraw times the damaged
+ * area they replace. Should that still leave too many, the damage becomes
+ * its bounding box. Damage only ever grows, so nothing is missed. Returns
+ * false if the region was left alone.
+ */
+static bool
+region_simplify(pixman_region32_t *damage, int max_rects, double max_overdraw)
+{
+	pixman_region32_t merged;
+	pixman_box32_t *rects;
+	pixman_box32_t extents, box, candidate;
+	uint64_t area = 0, box_damage;
+	int nrects, i;
+
+	rects = pixman_region32_rectangles(damage, &nrects);
+	if (max_rects <= 0 || nrects <= max_rects)
+		return false;
+
+	max_overdraw = MAX(max_overdraw, 1.0);
+
+	for (i = 0; i < nrects; i++)
+		area += box_area(&rects[i]);
+
+	extents = *pixman_region32_extents(damage);
+	if (box_area(&extents) <= area * max_overdraw) {
+		pixman_region32_reset(damage, &extents);
+		return true;
+	}
+
+	pixman_region32_init(&merged);
+	box = rects[0];
+	box_damage = box_area(&box);
+	for (i = 1; i < nrects; i++) {
+		candidate.x1 = MIN(box.x1, rects[i].x1);
+		candidate.y1 = MIN(box.y1, rects[i].y1);
+		candidate.x2 = MAX(box.x2, rects[i].x2);
+		candidate.y2 = MAX(box.y2, rects[i].y2);
+
+		if (box_area(&candidate) <=
+		    (box_damage + box_area(&rects[i])) * max_overdraw) {
+			box = candidate;
+			box_damage += box_area(&rects[i]);
+			continue;
+		}
+
+		pixman_region32_union_rect(&merged, &merged, box.x1, box.y1,
+					   box.x2 - box.x1, box.y2 - box.y1);
+		box = rects[i];
+		box_damage = box_area(&box);
+	}
+	pixman_region32_union_rect(&merged, &merged, box.x1, box.y1,
+				   box.x2 - box.x1, box.y2 - box.y1);
+
+	if (pixman_region32_n_rects(&merged) > max_rects)
+		pixman_region32_reset(damage, &extents);
+	else
+		pixman_region32_copy(damage, &merged);
+
+	pixman_region32_fini(&merged);
+	return true;
+}
+
+/* Each rectangle of output damage costs the renderers vertices, draw or
+ * composite calls, and the backends damage clips. */
+static void
+weston_output_simplify_damage(struct weston_output *output,
+			      pixman_region32_t *damage)
+{
+	struct weston_compositor *compositor = output->compositor;
+
+	region_simplify(damage, compositor->damage_max_rects,
+			compositor->damage_max_overdraw);
+}
+
 WL_EXPORT void
 weston_output_flush_damage_for_primary_plane(struct weston_output *output,
 					     pixman_region32_t *damage)
@@ -3716,21 +4976,226 @@ weston_output_flush_damage_for_primary_plane(struct weston_output *output,
 					     &output->primary_plane,
 					     damage);
 
+	if (output->mirror_of) {
+		pixman_region32_intersect(&output->mirror_damage,
+					  &output->mirror_damage,
+					  &output->region);
+		pixman_region32_union(damage, damage, &output->mirror_damage);
+		pixman_region32_clear(&output->mirror_damage);
+	}
+
 	if (output->full_repaint_needed) {
 		pixman_region32_copy(damage, &output->region);
 		output->full_repaint_needed = false;
 	}
+
+	weston_output_perf_hud_damage(output, damage);
+	weston_output_simplify_damage(output, damage);
 }
 
 WL_EXPORT void
 weston_output_schedule_repaint_reset(struct weston_output *output)
 {
 	weston_output_put_back_feedback_list(output);
+	weston_output_latency_put_back(output);
 	output->repaint_status = REPAINT_NOT_SCHEDULED;
 	TL_POINT(output->compositor, "core_repaint_exit_loop",
 		 TLP_OUTPUT(output), TLP_END);
 }
 
+/* Whether a surface with nothing visible gets its frame callbacks anyway.
+ * Otherwise keeps the time until it is due in *next_msec, if sooner. */
+static bool
+weston_surface_occluded_frame_due(struct weston_surface *surface,
+				  struct weston_output *output,
+				  int64_t *next_msec)
+{
+	int interval = output->compositor->occluded_frame_interval_msec;
+	int64_t left;
+
+	if (interval <= 0 || wl_list_empty(&surface->frame_callback_list))
+		return false;
+
+	left = interval - timespec_sub_to_msec(&output->frame_time,
+					       &surface->frame_callback_time);
+	if (left <= 0)
+		return true;
+
+	if (*next_msec == 0 || left < *next_msec)
+		*next_msec = left;
+
+	return false;
+}
+
+/* Whether the frame callbacks of a surface are due under its frame rate
+ * limit. Otherwise keeps the time until they are in *next_msec, if sooner.
+ * A millisecond of slack keeps frame times that jitter around the target
+ * from costing a whole refresh. */
+static bool
+weston_surface_frame_limit_due(struct weston_surface *surface,
+			       struct weston_output *output,
+			       int64_t *next_msec)
+{
+	int64_t left;
+	int64_t msec;
+
+	if (surface->frame_interval_nsec == 0 ||
+	    wl_list_empty(&surface->frame_callback_list))
+		return true;
+
+	left = timespec_sub_to_nsec(&surface->frame_limit_next,
+				    &output->frame_time);
+	if (left <= 1000000)
+		return true;
+
+	msec = DIV_ROUND_UP(left, 1000000);
+	if (*next_msec == 0 || msec < *next_msec)
+		*next_msec = msec;
+
+	return false;
+}
+
+/* Moves the frame callbacks of a surface to the list to be sent. Under a
+ * frame rate limit, the next ones are due an interval after the target of
+ * these rather than after the frame time, so that the average rate holds
+ * on outputs whose refresh is not a multiple of it. */
+static void
+weston_surface_take_frame_callbacks(struct weston_surface *surface,
+				    struct weston_output *output,
+				    struct wl_list *frame_callback_list)
+{
+	struct timespec next;
+
+	if (wl_list_empty(&surface->frame_callback_list))
+		return;
+
+	surface->frame_callback_time = output->frame_time;
+	if (surface->frame_interval_nsec > 0) {
+		timespec_add_nsec(&next, &surface->frame_limit_next,
+				  surface->frame_interval_nsec);
+		if (timespec_sub_to_nsec(&next, &output->frame_time) <= 0)
+			timespec_add_nsec(&next, &output->frame_time,
+					  surface->frame_interval_nsec);
+		surface->frame_limit_next = next;
+	}
+
+	wl_list_insert_list(frame_callback_list,
+			    &surface->frame_callback_list);
+	wl_list_init(&surface->frame_callback_list);
+}
+
+/* The views culled from the z-order list are occluded too, and get their
+ * throttled frame callbacks like the occluded ones that have paint nodes.
+ */
+static void
+weston_output_take_culled_frame_callbacks(struct weston_output *output,
+					  struct wl_list *frame_callback_list,
+					  int64_t *next_msec)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_view *occluder = output->z_order_occluder;
+	struct weston_surface *surface;
+	struct weston_view *view;
+	struct wl_list *pos;
+
+	if (!occluder || wl_list_empty(&occluder->link))
+		return;
+
+	for (pos = occluder->link.next; pos != &compositor->view_list;
+	     pos = pos->next) {
+		view = container_of(pos, struct weston_view, link);
+		surface = view->surface;
+
+		if (!weston_output_mask_has(&view->output_mask, output->id) ||
+		    surface->output != output)
+			continue;
+
+		if (!weston_surface_occluded_frame_due(surface, output,
+						       next_msec) ||
+		    !weston_surface_frame_limit_due(surface, output,
+						    next_msec))
+			continue;
+
+		weston_surface_take_frame_callbacks(surface, output,
+						    frame_callback_list);
+	}
+}
+
+static int
+occluded_frame_timer_handler(void *data)
+{
+	struct weston_compositor *compositor = data;
+
+	/* Repaint to send the frame callbacks that are due */
+	weston_compositor_schedule_repaint(compositor);
+
+	return 0;
+}
+
+static void
+weston_output_send_deferred_frame_callbacks(struct weston_output *output)
+{
+	struct wl_resource *cb, *cnext;
+
+	wl_resource_for_each_safe(cb, cnext,
+				  &output->frame_callback_deferred_list) {
+		wl_callback_send_done(cb, output->frame_callback_deferred_time);
+		wl_resource_destroy(cb);
+	}
+}
+
+static int
+frame_callback_timer_handler(void *data)
+{
+	struct weston_output *output = data;
+
+	weston_output_send_deferred_frame_callbacks(output);
+
+	return 0;
+}
+
+/* With a frame callback offset, hold the frame callbacks of this repaint
+ * back until that long before the vblank after the one being repainted
+ * for, which is the one the clients' next frames can make at the earliest.
+ * Clients then render as late as they can while still making it, instead
+ * of a whole refresh earlier. Returns false if the callbacks are due
+ * already and must be sent right away. */
+static bool
+weston_output_defer_frame_callbacks(struct weston_output *output,
+				    struct wl_list *frame_callback_list,
+				    uint32_t frame_time_msec)
+{
+	struct timespec now, target;
+	int64_t refresh_nsec;
+	int64_t delay_msec;
+
+	/* Callbacks of an earlier repaint that are still held go first. */
+	weston_output_send_deferred_frame_callbacks(output);
+
+	if (output->frame_callback_offset_msec <= 0 ||
+	    wl_list_empty(frame_callback_list) ||
+	    output->vrr_active ||
+	    output->current_mode->refresh == 0)
+		return false;
+
+	refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+	timespec_add_nsec(&target, &output->frame_time, 2 * refresh_nsec);
+	timespec_add_msec(&target, &target,
+			  -output->frame_callback_offset_msec);
+
+	weston_compositor_read_presentation_clock(output->compositor, &now);
+	delay_msec = timespec_sub_to_msec(&target, &now);
+	if (delay_msec <= 0)
+		return false;
+
+	wl_list_insert_list(&output->frame_callback_deferred_list,
+			    frame_callback_list);
+	output->frame_callback_deferred_time = frame_time_msec;
+	wl_event_source_timer_update(output->frame_callback_timer, delay_msec);
+
+	return true;
+}
+
 static int
 weston_output_repaint(struct weston_output *output, struct timespec *now)
 {
@@ -3738,17 +5203,29 @@ weston_output_repaint(struct weston_output *output, struct timespec *now)
 	struct weston_paint_node *pnode;
 	struct weston_animation *animation, *next;
 	struct wl_resource *cb, *cnext;
+	struct weston_repaint_profile *profile = output->repaint_profile;
 	struct wl_list frame_callback_list;
 	int r;
 	uint32_t frame_time_msec;
 	enum weston_hdcp_protection highest_requested = WESTON_HDCP_DISABLE;
+	int64_t phase_start;
+	int64_t held_next_msec = 0;
+	bool visible;
 
 	TL_POINT(ec, "core_repaint_begin", TLP_OUTPUT(output), TLP_END);
+	weston_output_latency_repaint_begin(output, now);
+	weston_output_perf_hud_repaint_begin(output, now);
+
+	phase_start = weston_repaint_profile_now();
 
 	/* Rebuild the surface list and update surface transforms up front. */
 	if (ec->view_list_needs_rebuild)
 		weston_compositor_build_view_list(ec);
 
+	phase_start = weston_repaint_profile_mark(profile,
+						  WESTON_REPAINT_PHASE_VIEW_LIST,
+						  phase_start);
+
 	/* If the scene graph is empty, we could end up passing a buffer
 	 * we've never drawn into to a hardware plane later. If that hardware
 	 * plane uses compression, the results can be very messy.
@@ -3760,7 +5237,8 @@ weston_output_repaint(struct weston_output *output, struct timespec *now)
 
 	wl_list_for_each(pnode, &output->paint_node_z_order_list,
 			 z_order_link) {
-		assert(pnode->view->output_mask & (1u << pnode->output->id));
+		assert(weston_output_mask_has(&pnode->view->output_mask,
+					      pnode->output->id));
 		assert(pnode->output == output);
 	}
 
@@ -3783,8 +5261,16 @@ weston_output_repaint(struct weston_output *output, struct timespec *now)
 			 z_order_link)
 		paint_node_update_early(pnode);
 
+	phase_start = weston_repaint_profile_mark(profile,
+						  WESTON_REPAINT_PHASE_PAINT_NODES,
+						  phase_start);
+
 	if (output->assign_planes && !output->disable_planes) {
+		TL_POINT(ec, "core_assign_planes_begin", TLP_OUTPUT(output),
+			 TLP_END);
 		output->assign_planes(output);
+		TL_POINT(ec, "core_assign_planes_end", TLP_OUTPUT(output),
+			 TLP_END);
 	} else {
 		wl_list_for_each(pnode, &output->paint_node_z_order_list,
 				 z_order_link) {
@@ -3793,21 +5279,55 @@ weston_output_repaint(struct weston_output *output, struct timespec *now)
 		}
 	}
 
-	output_update_visibility(output);
+	phase_start = weston_repaint_profile_mark(profile,
+						  WESTON_REPAINT_PHASE_ASSIGN_PLANES,
+						  phase_start);
+
+	weston_output_update_visibility(output);
+
+	phase_start = weston_repaint_profile_mark(profile,
+						  WESTON_REPAINT_PHASE_VISIBILITY,
+						  phase_start);
 
 	wl_list_for_each(pnode, &output->paint_node_z_order_list,
 			 z_order_link)
 		paint_node_update_late(pnode);
 
-	output_accumulate_damage(output);
+	phase_start = weston_repaint_profile_mark(profile,
+						  WESTON_REPAINT_PHASE_PAINT_NODES,
+						  phase_start);
+
+	weston_output_accumulate_damage(output);
 
+	phase_start = weston_repaint_profile_mark(profile,
+						  WESTON_REPAINT_PHASE_DAMAGE,
+						  phase_start);
+
+	/* weston_renderer_repaint_output() moves its own time from the
+	 * backend phase to the renderer one */
 	r = output->repaint(output);
 
+	weston_repaint_profile_mark(profile, WESTON_REPAINT_PHASE_BACKEND,
+				    phase_start);
+	weston_repaint_profile_commit(profile);
+
 	output->repaint_needed = false;
 	if (r == 0) {
 		output->repaint_status = REPAINT_AWAITING_COMPLETION;
 		output->repainted = true;
 	}
+	weston_output_latency_repaint_done(output, r == 0);
+	weston_output_perf_hud_repaint_done(output, r == 0);
+
+	if (r == 0 && ec->repaint_window_adaptive) {
+		struct timespec end;
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		output->repaint_timing.pending = true;
+		output->repaint_timing.pending_nsec =
+			timespec_sub_to_nsec(&end,
+					     &output->repaint_timing.start_monotonic);
+	}
 
 	weston_compositor_repick(ec);
 
@@ -3825,24 +5345,43 @@ weston_output_repaint(struct weston_output *output, struct timespec *now)
 		/*
 		 * avoid adding pnode's frame callbacks/presented
 		 * feedback to the respective lists if pnode/surface is
-		 * occluded
+		 * occluded, except for the throttled frame callbacks
 		 */
-		if (!pixman_region32_not_empty(&pnode->visible))
+		visible = pixman_region32_not_empty(&pnode->visible);
+		if (!visible &&
+		    !weston_surface_occluded_frame_due(pnode->surface, output,
+						       &held_next_msec))
 			continue;
 
-		wl_list_insert_list(&frame_callback_list,
-				    &pnode->surface->frame_callback_list);
-		wl_list_init(&pnode->surface->frame_callback_list);
+		if (weston_surface_frame_limit_due(pnode->surface, output,
+						   &held_next_msec))
+			weston_surface_take_frame_callbacks(pnode->surface,
+							    output,
+							    &frame_callback_list);
+
+		if (!visible)
+			continue;
 
 		weston_output_take_feedback_list(output, pnode->surface);
+		weston_output_latency_take(output, pnode->surface);
 	}
 
+	weston_output_take_culled_frame_callbacks(output, &frame_callback_list,
+						  &held_next_msec);
 
-	wl_resource_for_each_safe(cb, cnext, &frame_callback_list) {
-		wl_callback_send_done(cb, frame_time_msec);
-		wl_resource_destroy(cb);
+
+	if (!weston_output_defer_frame_callbacks(output, &frame_callback_list,
+						 frame_time_msec)) {
+		wl_resource_for_each_safe(cb, cnext, &frame_callback_list) {
+			wl_callback_send_done(cb, frame_time_msec);
+			wl_resource_destroy(cb);
+		}
 	}
 
+	if (held_next_msec > 0)
+		wl_event_source_timer_update(ec->occluded_frame_timer,
+					     held_next_msec);
+
 	wl_list_for_each_safe(animation, next, &output->animation_list, link) {
 		animation->frame_counter++;
 		animation->frame(animation, output, &output->frame_time);
@@ -3864,6 +5403,9 @@ weston_output_repaint(struct weston_output *output, struct timespec *now)
 	return r;
 }
 
+static void
+weston_output_apply_commit_queues(struct weston_output *output);
+
 static bool
 weston_output_check_repaint(struct weston_output *output, struct timespec *now)
 {
@@ -3884,6 +5426,9 @@ weston_output_check_repaint(struct weston_output *output, struct timespec *now)
 	    compositor->state == WESTON_COMPOSITOR_OFFSCREEN)
 		goto out;
 
+	/* Content updates due by this repaint go in before deciding. */
+	weston_output_apply_commit_queues(output);
+
 	/* We don't actually need to repaint this output; drop it from
 	 * repaint until something causes damage. */
 	if (!output->repaint_needed)
@@ -3959,6 +5504,16 @@ weston_output_schedule_repaint_restart(struct weston_output *output)
 	weston_output_damage(output);
 }
 
+static int
+priority_loop_handler(int fd, uint32_t mask, void *data)
+{
+	struct weston_compositor *compositor = data;
+
+	wl_event_loop_dispatch(compositor->priority_loop, 0);
+
+	return 0;
+}
+
 static int
 output_repaint_timer_handler(void *data)
 {
@@ -3966,10 +5521,12 @@ output_repaint_timer_handler(void *data)
 	struct weston_backend *backend;
 	struct weston_output *output;
 	struct timespec now;
+	struct timespec now_monotonic;
 	int ret = 0;
 
 	weston_compositor_read_presentation_clock(compositor, &now);
 	compositor->last_repaint_start = now;
+	clock_gettime(CLOCK_MONOTONIC, &now_monotonic);
 
 	wl_list_for_each(output, &compositor->output_list, link) {
 		if (!weston_output_check_repaint(output, &now)) {
@@ -3978,6 +5535,7 @@ output_repaint_timer_handler(void *data)
 		}
 
 		output->will_repaint = true;
+		output->repaint_timing.start_monotonic = now_monotonic;
 		output->backend->will_repaint = true;
 
 		if (output->prepare_repaint)
@@ -4003,6 +5561,9 @@ output_repaint_timer_handler(void *data)
 			ret = weston_output_repaint(output, &now);
 			if (ret)
 				break;
+
+			if (backend->repaint_output_done)
+				backend->repaint_output_done(backend, output);
 		}
 		if (ret == 0) {
 			if (backend->repaint_flush)
@@ -4062,6 +5623,145 @@ convert_presentation_time_now(struct weston_compositor *compositor,
 	return target_stamp;
 }
 
+/* The adaptive repaint window covers this percentile of the recent render
+ * times, once at least REPAINT_TIMING_MIN_SAMPLES have been collected.
+ * The margin accounts for timer slack and applying the KMS update.
+ */
+#define REPAINT_TIMING_PERCENTILE 98
+#define REPAINT_TIMING_MIN_SAMPLES 16
+#define REPAINT_TIMING_MARGIN_NSEC 1000000
+
+static int
+compare_uint32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+weston_output_add_repaint_timing_sample(struct weston_output *output,
+					int64_t nsec)
+{
+	uint32_t sorted[WESTON_REPAINT_TIMING_SAMPLES];
+	unsigned int count;
+	unsigned int idx;
+	int64_t usec = MAX(nsec, 0) / 1000;
+
+	output->repaint_timing.samples_usec[output->repaint_timing.next] =
+		MIN(usec, (int64_t)UINT32_MAX);
+	output->repaint_timing.next = (output->repaint_timing.next + 1) %
+				      WESTON_REPAINT_TIMING_SAMPLES;
+	if (output->repaint_timing.count < WESTON_REPAINT_TIMING_SAMPLES)
+		output->repaint_timing.count++;
+
+	count = output->repaint_timing.count;
+	if (count < REPAINT_TIMING_MIN_SAMPLES) {
+		output->repaint_timing.estimate_nsec = -1;
+		return;
+	}
+
+	memcpy(sorted, output->repaint_timing.samples_usec,
+	       count * sizeof(sorted[0]));
+	qsort(sorted, count, sizeof(sorted[0]), compare_uint32);
+
+	idx = DIV_ROUND_UP(count * REPAINT_TIMING_PERCENTILE, 100) - 1;
+	output->repaint_timing.estimate_nsec = (int64_t)sorted[idx] * 1000;
+}
+
+/* How long before the next vblank the repaint of the output should start. */
+static int64_t
+weston_output_get_repaint_window_nsec(struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	int64_t window_nsec = (int64_t)compositor->repaint_msec * 1000000;
+	int64_t estimate_nsec = output->repaint_timing.estimate_nsec;
+
+	if (!compositor->repaint_window_adaptive ||
+	    estimate_nsec < 0 || window_nsec <= 0)
+		return window_nsec;
+
+	return MIN(window_nsec, estimate_nsec + REPAINT_TIMING_MARGIN_NSEC);
+}
+
+/** Report when the renderer finished an output repaint
+ *
+ * \param output The output that was repainted.
+ * \param done When rendering completed, in CLOCK_MONOTONIC.
+ *
+ * Renderers that execute asynchronously call this once the rendering of
+ * the last repaint has completed, so that the adaptive repaint window
+ * accounts for the actual render time rather than only the CPU time spent
+ * in weston_output_repaint().
+ *
+ * \ingroup output
+ */
+WL_EXPORT void
+weston_output_report_render_done(struct weston_output *output,
+				 const struct timespec *done)
+{
+	int64_t nsec;
+
+	nsec = timespec_sub_to_nsec(done, &output->repaint_timing.start_monotonic);
+	weston_output_perf_hud_render_done(output, nsec);
+
+	if (!output->repaint_timing.pending)
+		return;
+
+	output->repaint_timing.pending_nsec =
+		MAX(output->repaint_timing.pending_nsec, nsec);
+}
+
+/* Outputs with the same refresh rate and vblank phase would all repaint
+ * from one timer expiry, along with the frame callbacks of their clients.
+ * Move the repaint of the output ahead of the others due within
+ * weston_compositor::repaint_stagger_msec of it, so that the work spreads
+ * over the refresh period. Outputs with different phases are left alone.
+ * The repaint only ever starts earlier, by half a refresh period at most,
+ * so it still makes its vblank. */
+static void
+weston_output_stagger_repaint(struct weston_output *output,
+			      const struct timespec *now, int64_t refresh_nsec)
+{
+	struct weston_compositor *compositor = output->compositor;
+	int64_t step_nsec = (int64_t)compositor->repaint_stagger_msec * 1000000;
+	struct timespec due = output->next_repaint;
+	struct timespec earlier;
+	struct weston_output *other;
+	bool moved;
+
+	if (step_nsec <= 0 || output->vrr_active)
+		return;
+
+	do {
+		moved = false;
+
+		wl_list_for_each(other, &compositor->output_list, link) {
+			int64_t delta_nsec;
+
+			if (other == output ||
+			    other->repaint_status != REPAINT_SCHEDULED ||
+			    other->vrr_active)
+				continue;
+
+			delta_nsec = timespec_sub_to_nsec(&output->next_repaint,
+							  &other->next_repaint);
+			if (delta_nsec <= -step_nsec || delta_nsec >= step_nsec)
+				continue;
+
+			timespec_add_nsec(&earlier, &other->next_repaint,
+					  -step_nsec);
+			if (timespec_sub_to_nsec(&due, &earlier) > refresh_nsec / 2 ||
+			    timespec_sub_to_nsec(&earlier, now) < 0)
+				return;
+
+			output->next_repaint = earlier;
+			moved = true;
+		}
+	} while (moved);
+}
+
 /**
  * \ingroup output
  */
@@ -4078,6 +5778,12 @@ weston_output_finish_frame(struct weston_output *output,
 
 	assert(output->repaint_status == REPAINT_AWAITING_COMPLETION);
 
+	if (output->repaint_timing.pending) {
+		output->repaint_timing.pending = false;
+		weston_output_add_repaint_timing_sample(output,
+			output->repaint_timing.pending_nsec);
+	}
+
 	/*
 	 * If timestamp of latest vblank is given, it must always go forwards.
 	 * If not given, INVALID flag must be set.
@@ -4092,6 +5798,9 @@ weston_output_finish_frame(struct weston_output *output,
 	/* If we haven't been supplied any timestamp at all, we don't have a
 	 * timebase to work against, so any delay just wastes time. Push a
 	 * repaint as soon as possible so we can get on with it. */
+	weston_output_latency_present(output, stamp);
+	weston_output_perf_hud_present(output, stamp);
+
 	if (!stamp) {
 		output->next_repaint = now;
 		goto out;
@@ -4118,8 +5827,8 @@ weston_output_finish_frame(struct weston_output *output,
 	}
 
 	timespec_add_nsec(&output->next_repaint, stamp, refresh_nsec);
-	timespec_add_msec(&output->next_repaint, &output->next_repaint,
-			  -compositor->repaint_msec);
+	timespec_add_nsec(&output->next_repaint, &output->next_repaint,
+			  -weston_output_get_repaint_window_nsec(output));
 	msec_rel = timespec_sub_to_msec(&output->next_repaint, &now);
 
 	if (msec_rel < -1000 || msec_rel > 1000) {
@@ -4138,6 +5847,11 @@ weston_output_finish_frame(struct weston_output *output,
 	 * timing of the repaint cycle to lock on. */
 	if (presented_flags == WP_PRESENTATION_FEEDBACK_INVALID &&
 	    msec_rel < 0) {
+		/* With variable refresh the display waits for us, so there is
+		 * no deadline to miss: go right away. */
+		if (output->vrr_active)
+			output->next_repaint = now;
+
 		while (timespec_sub_to_nsec(&output->next_repaint, &now) < 0) {
 			timespec_add_nsec(&output->next_repaint,
 					  &output->next_repaint,
@@ -4145,6 +5859,8 @@ weston_output_finish_frame(struct weston_output *output,
 		}
 	}
 
+	weston_output_stagger_repaint(output, &now, refresh_nsec);
+
 out:
 	output->repaint_status = REPAINT_SCHEDULED;
 	output_repaint_timer_arm(compositor);
@@ -4185,6 +5901,10 @@ idle_repaint(void *data)
 WL_EXPORT void
 weston_view_set_alpha(struct weston_view *view, float alpha)
 {
+	/* Only fully opaque views occlude the ones below */
+	if ((alpha == 1.0) != (view->alpha == 1.0))
+		view->surface->compositor->view_list_needs_rebuild = true;
+
 	view->alpha = alpha;
 	weston_surface_damage(view->surface);
 	if (alpha != 1.0 || !view->surface->is_opaque)
@@ -4221,6 +5941,10 @@ weston_view_move_to_layer(struct weston_view *view,
 		return;
 
 	view->surface->compositor->view_list_needs_rebuild = true;
+	if (view->layer_link.layer)
+		view->layer_link.layer->view_list_dirty = true;
+	if (layer)
+		layer->layer->view_list_dirty = true;
 
 	/* Damage the view's old region, and remove it from the layer. */
 	if (weston_view_is_mapped(view))
@@ -4303,6 +6027,8 @@ weston_layer_set_position(struct weston_layer *layer,
 	 * background with the smallest position value */
 
 	layer->position = position;
+	layer->compositor->layer_list_dirty = true;
+	layer->compositor->view_list_needs_rebuild = true;
 	wl_list_for_each_reverse(below, &layer->compositor->layer_list, link) {
 		if (below->position >= layer->position) {
 			wl_list_insert(&below->link, &layer->link);
@@ -4320,6 +6046,11 @@ weston_layer_set_position(struct weston_layer *layer,
 WL_EXPORT void
 weston_layer_unset_position(struct weston_layer *layer)
 {
+	if (!wl_list_empty(&layer->link)) {
+		layer->compositor->layer_list_dirty = true;
+		layer->compositor->view_list_needs_rebuild = true;
+	}
+
 	wl_list_remove(&layer->link);
 	wl_list_init(&layer->link);
 }
@@ -4469,6 +6200,65 @@ surface_attach(struct wl_client *client,
 	surface->pending.status |= WESTON_SURFACE_DIRTY_BUFFER;
 }
 
+/* Some clients send a damage request per glyph or per dirty cell, thousands
+ * per commit. Every union is linear in the size of the pending region, so
+ * merge it as soon as it gets past the limit instead of carrying all of
+ * them to the commit and on into every output's damage.
+ */
+static void
+weston_surface_add_client_damage(struct weston_surface *surface,
+				 pixman_region32_t *pending,
+				 int32_t x, int32_t y,
+				 int32_t width, int32_t height)
+{
+	struct weston_compositor *compositor = surface->compositor;
+	int before;
+
+	compositor->client_damage_stats.rects++;
+	pixman_region32_union_rect(pending, pending, x, y, width, height);
+
+	before = pixman_region32_n_rects(pending);
+	if (!region_simplify(pending, compositor->client_damage_max_rects,
+			     compositor->client_damage_max_overdraw))
+		return;
+
+	compositor->client_damage_stats.merges++;
+	compositor->client_damage_stats.merged_rects +=
+		before - pixman_region32_n_rects(pending);
+
+	if (weston_log_scope_is_enabled(compositor->client_damage_scope)) {
+		char desc[512];
+
+		if (!surface->get_label ||
+		    surface->get_label(surface, desc, sizeof(desc)) < 0)
+			strcpy(desc, "[no description available]");
+		weston_log_scope_printf(compositor->client_damage_scope,
+					"surface %u (%s): merged %d damage "
+					"rectangles into %d\n",
+					wl_resource_get_id(surface->resource),
+					desc, before,
+					pixman_region32_n_rects(pending));
+	}
+}
+
+static void
+weston_client_damage_debug_scope_cb(struct weston_log_subscription *sub,
+				    void *data)
+{
+	struct weston_compositor *compositor = data;
+
+	weston_log_subscription_printf(sub,
+				       "limit %d rectangles, overdraw %.2f\n"
+				       "received %" PRIu64 " rectangles, "
+				       "merged %" PRIu64 " times, "
+				       "removing %" PRIu64 " rectangles\n",
+				       compositor->client_damage_max_rects,
+				       compositor->client_damage_max_overdraw,
+				       compositor->client_damage_stats.rects,
+				       compositor->client_damage_stats.merges,
+				       compositor->client_damage_stats.merged_rects);
+}
+
 static void
 surface_damage(struct wl_client *client,
 	       struct wl_resource *resource,
@@ -4479,9 +6269,9 @@ surface_damage(struct wl_client *client,
 	if (width <= 0 || height <= 0)
 		return;
 
-	pixman_region32_union_rect(&surface->pending.damage_surface,
-				   &surface->pending.damage_surface,
-				   x, y, width, height);
+	weston_surface_add_client_damage(surface,
+					 &surface->pending.damage_surface,
+					 x, y, width, height);
 }
 
 static void
@@ -4494,9 +6284,9 @@ surface_damage_buffer(struct wl_client *client,
 	if (width <= 0 || height <= 0)
 		return;
 
-	pixman_region32_union_rect(&surface->pending.damage_buffer,
-				   &surface->pending.damage_buffer,
-				   x, y, width, height);
+	weston_surface_add_client_damage(surface,
+					 &surface->pending.damage_buffer,
+					 x, y, width, height);
 }
 
 static void
@@ -4582,11 +6372,33 @@ weston_surface_damage_subsurfaces(struct weston_subsurface *sub)
 			weston_surface_damage_subsurfaces(child);
 }
 
+/* Whether committing the pending sub-surface order would change it */
+static bool
+weston_surface_subsurface_order_is_pending(struct weston_surface *surface)
+{
+	struct wl_list *pos = surface->subsurface_list.next;
+	struct weston_subsurface *sub;
+
+	wl_list_for_each(sub, &surface->subsurface_list_pending,
+			 parent_link_pending) {
+		if (pos != &sub->parent_link)
+			return true;
+		pos = pos->next;
+	}
+
+	return pos != &surface->subsurface_list;
+}
+
 static void
 weston_surface_commit_subsurface_order(struct weston_surface *surface)
 {
 	struct weston_subsurface *sub;
 
+	if (!weston_surface_subsurface_order_is_pending(surface))
+		return;
+
+	weston_compositor_subsurface_order_changed(surface->compositor);
+
 	wl_list_for_each_reverse(sub, &surface->subsurface_list_pending,
 				 parent_link_pending) {
 		wl_list_remove(&sub->parent_link);
@@ -4806,6 +6618,8 @@ weston_surface_commit_state(struct weston_surface *surface,
 
 	/* wl_surface.attach */
 	if (status & WESTON_SURFACE_DIRTY_BUFFER) {
+		weston_surface_latency_commit(surface);
+
 		/* zwp_surface_synchronization_v1.set_acquire_fence */
 		fd_move(&surface->acquire_fence_fd,
 			&state->acquire_fence_fd);
@@ -4837,116 +6651,444 @@ weston_surface_commit_state(struct weston_surface *surface,
 	     surface->committed)
 		surface->committed(surface, state->buf_offset);
 
-	state->buf_offset = weston_coord_surface(0, 0, surface);
+	state->buf_offset = weston_coord_surface(0, 0, surface);
+
+	/* wl_surface.damage and wl_surface.damage_buffer; only valid
+	 * in the same cycle as wl_surface.commit */
+	if (status & WESTON_SURFACE_DIRTY_BUFFER) {
+		TL_POINT(surface->compositor, "core_commit_damage",
+			TLP_SURFACE(surface), TLP_END);
+
+		pixman_region32_union(&surface->damage, &surface->damage,
+				      &state->damage_surface);
+
+		apply_damage_buffer(&surface->damage, surface, state);
+
+		pixman_region32_intersect_rect(&surface->damage,
+					       &surface->damage,
+					       0, 0,
+					       surface->width, surface->height);
+	}
+	pixman_region32_clear(&state->damage_buffer);
+	pixman_region32_clear(&state->damage_surface);
+
+	/* wl_surface.set_opaque_region */
+	if (status & (WESTON_SURFACE_DIRTY_SIZE |
+		      WESTON_SURFACE_DIRTY_BUFFER_PARAMS)) {
+		pixman_region32_init(&opaque);
+		pixman_region32_intersect_rect(&opaque, &state->opaque,
+					       0, 0,
+					       surface->width, surface->height);
+
+		if (!pixman_region32_equal(&opaque, &surface->opaque)) {
+			pixman_region32_copy(&surface->opaque, &opaque);
+			wl_list_for_each(view, &surface->views, surface_link)
+				weston_view_geometry_dirty(view);
+		}
+
+		pixman_region32_fini(&opaque);
+	}
+
+	/* wl_surface.set_input_region */
+	if (status & (WESTON_SURFACE_DIRTY_SIZE | WESTON_SURFACE_DIRTY_INPUT)) {
+		struct weston_view *view;
+
+		pixman_region32_intersect_rect(&surface->input, &state->input,
+					       0, 0,
+					       surface->width, surface->height);
+
+		wl_list_for_each(view, &surface->views, surface_link)
+			weston_view_repick_damage(view, true);
+	}
+
+	/* wl_surface.frame */
+	wl_list_insert_list(&surface->frame_callback_list,
+			    &state->frame_callback_list);
+	wl_list_init(&state->frame_callback_list);
+
+	/* XXX:
+	 * What should happen with a feedback request, if there
+	 * is no wl_buffer attached for this commit?
+	 */
+
+	/* presentation.feedback */
+	wl_list_insert_list(&surface->feedback_list,
+			    &state->feedback_list);
+	wl_list_init(&state->feedback_list);
+
+	/* weston_protected_surface.enforced/relaxed */
+	if (surface->protection_mode != state->protection_mode)
+		weston_surface_set_protection_mode(surface,
+						   state->protection_mode);
+
+	/* weston_protected_surface.set_type */
+	weston_surface_set_desired_protection(surface, state->desired_protection);
+
+	/* color_management_surface_v1_interface.set_image_description or
+	 * color_management_surface_v1_interface.unset_image_description */
+	weston_surface_set_color_profile(surface, state->color_profile,
+					 state->render_intent);
+
+	/* wp_content_type_v1.set_content_type */
+	surface->content_type = state->content_type;
+
+	if (status & WESTON_SURFACE_DIRTY_BUFFER) {
+		struct weston_subsurface *sub =
+			weston_surface_to_subsurface(surface);
+
+		weston_surface_scene_record_commit(surface, sub);
+	}
+
+	wl_signal_emit(&surface->commit_signal, surface);
+
+	/* Surface is now quiescent */
+	surface->is_unmapping = false;
+	surface->is_mapping = false;
+	state->status = WESTON_SURFACE_CLEAN;
+
+	return status;
+}
+
+static enum weston_surface_status
+weston_surface_commit(struct weston_surface *surface,
+		      struct weston_surface_state *state)
+{
+	enum weston_surface_status status;
+
+	status = weston_surface_commit_state(surface, state);
+
+	if (status & WESTON_SURFACE_DIRTY_SUBSURFACE_CONFIG)
+		weston_surface_commit_subsurface_order(surface);
+
+	weston_surface_schedule_repaint(surface);
+
+	return status;
+}
+
+static enum weston_surface_status
+weston_subsurface_commit(struct weston_subsurface *sub,
+			 struct weston_surface_state *state);
+
+static enum weston_surface_status
+weston_subsurface_parent_commit(struct weston_subsurface *sub,
+				int parent_is_synchronized);
+
+static void
+weston_surface_state_merge(struct weston_surface *surface,
+			   struct weston_surface_state *state,
+			   struct weston_surface_state *src);
+
+static void
+weston_surface_apply_commit_queue(struct weston_surface *surface,
+				  const struct timespec *target)
+{
+	struct weston_queued_commit *qc, *tmp;
+	struct weston_subsurface *sub;
+	enum weston_surface_status status;
+
+	wl_list_for_each_safe(qc, tmp, &surface->commit_queue, link) {
+		/* The fence may have signalled since the event loop ran. */
+		if (qc->fence_source &&
+		    linux_sync_file_is_signalled(qc->state.acquire_fence_fd)) {
+			wl_event_source_remove(qc->fence_source);
+			qc->fence_source = NULL;
+		}
+
+		if (qc->acquire_wait || qc->fence_source)
+			break;
+		if (target && timespec_sub_to_nsec(&qc->target, target) > 0)
+			break;
+
+		/* A sub-surface update, applied as if committed now */
+		if (qc->surface != surface) {
+			sub = weston_surface_to_subsurface(qc->surface);
+			if (sub)
+				status = weston_subsurface_commit(sub,
+								  &qc->state);
+			else
+				status = weston_surface_commit(qc->surface,
+							       &qc->state);
+			if (status & WESTON_SURFACE_DIRTY_SUBSURFACE_CONFIG)
+				surface->compositor->view_list_needs_rebuild = true;
+			weston_queued_commit_destroy(qc);
+			continue;
+		}
+
+		status = WESTON_SURFACE_CLEAN;
+		wl_list_for_each(sub, &surface->subsurface_list, parent_link) {
+			if (sub->surface != surface)
+				status |= weston_subsurface_parent_commit(sub, 0);
+		}
+
+		status |= weston_surface_commit_state(surface, &qc->state);
+		if (status & WESTON_SURFACE_DIRTY_SUBSURFACE_CONFIG) {
+			weston_surface_commit_subsurface_order(surface);
+			surface->compositor->view_list_needs_rebuild = true;
+		}
+
+		weston_surface_schedule_repaint(surface);
+		weston_queued_commit_destroy(qc);
+	}
+
+	if (wl_list_empty(&surface->commit_queue)) {
+		wl_list_remove(&surface->commit_queue_link);
+		wl_list_init(&surface->commit_queue_link);
+	}
+}
+
+static int
+commit_queue_timer_handler(void *data)
+{
+	struct weston_output *output = data;
+
+	weston_output_schedule_repaint(output);
+
+	return 0;
+}
+
+static void
+weston_output_apply_commit_queues(struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_surface *surface, *tmp;
+	struct timespec target, earliest, now;
+	bool waiting = false;
+	int64_t window_nsec;
+	int64_t delay_msec;
+
+	if (wl_list_empty(&compositor->commit_queue_list))
+		return;
+
+	/* When this repaint is expected to reach the screen */
+	window_nsec = weston_output_get_repaint_window_nsec(output);
+	timespec_add_nsec(&target, &output->next_repaint, window_nsec);
+
+	wl_list_for_each_safe(surface, tmp, &compositor->commit_queue_list,
+			      commit_queue_link) {
+		struct weston_queued_commit *qc;
+
+		if (surface->output && surface->output != output)
+			continue;
+
+		weston_surface_apply_commit_queue(surface, &target);
+		if (wl_list_empty(&surface->commit_queue))
+			continue;
+
+		/* Fence waits schedule their own repaint when done. */
+		qc = wl_container_of(surface->commit_queue.next, qc, link);
+		if (qc->acquire_wait || qc->fence_source)
+			continue;
+
+		if (!waiting || timespec_sub_to_nsec(&qc->target, &earliest) < 0)
+			earliest = qc->target;
+		waiting = true;
+	}
+
+	if (!waiting)
+		return;
+
+	/* Rather than repainting every refresh until the rest are due, wake
+	 * up for the repaint before the one the earliest target is for. That
+	 * repaint holds it back again if it is too early, and re-arms the
+	 * timer for the next one. */
+	timespec_add_nsec(&earliest, &earliest, -window_nsec);
+	if (output->current_mode->refresh > 0)
+		timespec_add_nsec(&earliest, &earliest,
+				  -millihz_to_nsec(output->current_mode->refresh));
+
+	weston_compositor_read_presentation_clock(compositor, &now);
+	delay_msec = MAX(timespec_sub_to_msec(&earliest, &now), 1);
+	wl_event_source_timer_update(output->commit_queue_timer, delay_msec);
+}
+
+static void
+weston_queued_commit_ready(struct weston_queued_commit *qc)
+{
+	struct weston_surface *surface = qc->main_surface;
+
+	if (!surface->output)
+		weston_surface_apply_commit_queue(surface, NULL);
+	else
+		weston_surface_schedule_repaint(surface);
+}
+
+static int
+weston_queued_commit_fence_signalled(int fd, uint32_t mask, void *data)
+{
+	struct weston_queued_commit *qc = data;
+
+	wl_event_source_remove(qc->fence_source);
+	qc->fence_source = NULL;
+	weston_queued_commit_ready(qc);
+
+	return 0;
+}
+
+/* With skip_late_buffers, hold a content update back until its acquire
+ * fence signals, so that repaints keep the previous buffer instead of
+ * waiting for the client's rendering. */
+static bool
+weston_queued_commit_watch_fence(struct weston_queued_commit *qc)
+{
+	struct weston_compositor *compositor = qc->surface->compositor;
+	struct wl_event_loop *loop;
+	int fd = qc->state.acquire_fence_fd;
 
-	/* wl_surface.damage and wl_surface.damage_buffer; only valid
-	 * in the same cycle as wl_surface.commit */
-	if (status & WESTON_SURFACE_DIRTY_BUFFER) {
-		TL_POINT(surface->compositor, "core_commit_damage",
-			TLP_SURFACE(surface), TLP_END);
+	if (!compositor->skip_late_buffers || fd < 0 ||
+	    linux_sync_file_is_signalled(fd))
+		return false;
 
-		pixman_region32_union(&surface->damage, &surface->damage,
-				      &state->damage_surface);
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	qc->fence_source = wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+						weston_queued_commit_fence_signalled,
+						qc);
 
-		apply_damage_buffer(&surface->damage, surface, state);
+	return qc->fence_source != NULL;
+}
 
-		pixman_region32_intersect_rect(&surface->damage,
-					       &surface->damage,
-					       0, 0,
-					       surface->width, surface->height);
-	}
-	pixman_region32_clear(&state->damage_buffer);
-	pixman_region32_clear(&state->damage_surface);
+static void
+weston_queued_commit_acquire_done(struct weston_drm_syncobj_wait *wait,
+				  int fence_fd)
+{
+	struct weston_queued_commit *qc = wait->data;
 
-	/* wl_surface.set_opaque_region */
-	if (status & (WESTON_SURFACE_DIRTY_SIZE |
-		      WESTON_SURFACE_DIRTY_BUFFER_PARAMS)) {
-		pixman_region32_init(&opaque);
-		pixman_region32_intersect_rect(&opaque, &state->opaque,
-					       0, 0,
-					       surface->width, surface->height);
+	weston_drm_syncobj_wait_destroy(wait);
+	qc->acquire_wait = NULL;
 
-		if (!pixman_region32_equal(&opaque, &surface->opaque)) {
-			pixman_region32_copy(&surface->opaque, &opaque);
-			wl_list_for_each(view, &surface->views, surface_link)
-				weston_view_geometry_dirty(view);
-		}
+	if (fence_fd < 0)
+		weston_log("linux-drm-syncobj: failed to export acquire "
+			   "fence, presenting without it\n");
+	fd_update(&qc->state.acquire_fence_fd, fence_fd);
 
-		pixman_region32_fini(&opaque);
-	}
+	if (!weston_queued_commit_watch_fence(qc))
+		weston_queued_commit_ready(qc);
+}
 
-	/* wl_surface.set_input_region */
-	if (status & (WESTON_SURFACE_DIRTY_SIZE | WESTON_SURFACE_DIRTY_INPUT)) {
-		pixman_region32_intersect_rect(&surface->input, &state->input,
-					       0, 0,
-					       surface->width, surface->height);
-	}
+static bool
+weston_surface_pending_fence_is_late(struct weston_surface *surface)
+{
+	int fd = surface->pending.acquire_fence_fd;
 
-	/* wl_surface.frame */
-	wl_list_insert_list(&surface->frame_callback_list,
-			    &state->frame_callback_list);
-	wl_list_init(&state->frame_callback_list);
+	return surface->compositor->skip_late_buffers && fd >= 0 &&
+	       !linux_sync_file_is_signalled(fd);
+}
 
-	/* XXX:
-	 * What should happen with a feedback request, if there
-	 * is no wl_buffer attached for this commit?
-	 */
+static bool
+weston_subsurface_is_synchronized(struct weston_subsurface *sub);
 
-	/* presentation.feedback */
-	wl_list_insert_list(&surface->feedback_list,
-			    &state->feedback_list);
-	wl_list_init(&state->feedback_list);
+static bool
+weston_commit_queue_has_surface(struct weston_surface *main_surface,
+				struct weston_surface *surface)
+{
+	struct weston_queued_commit *qc;
 
-	/* weston_protected_surface.enforced/relaxed */
-	if (surface->protection_mode != state->protection_mode)
-		weston_surface_set_protection_mode(surface,
-						   state->protection_mode);
+	wl_list_for_each(qc, &main_surface->commit_queue, link) {
+		if (qc->surface == surface)
+			return true;
+	}
 
-	/* weston_protected_surface.set_type */
-	weston_surface_set_desired_protection(surface, state->desired_protection);
+	return false;
+}
 
-	/* color_management_surface_v1_interface.set_image_description or
-	 * color_management_surface_v1_interface.unset_image_description */
-	weston_surface_set_color_profile(surface, state->color_profile,
-					 state->render_intent);
+/* Whether the pending state must queue up behind the updates already
+ * held back on the main surface. Those of the surface itself must apply
+ * first, and those of the main surface too if the state waits for a
+ * parent commit to be applied. */
+static bool
+weston_surface_must_follow_commit_queue(struct weston_surface *surface,
+					struct weston_surface *main_surface)
+{
+	struct weston_subsurface *sub = weston_surface_to_subsurface(surface);
 
-	wl_signal_emit(&surface->commit_signal, surface);
+	if (wl_list_empty(&main_surface->commit_queue))
+		return false;
 
-	/* Surface is now quiescent */
-	surface->is_unmapping = false;
-	surface->is_mapping = false;
-	state->status = WESTON_SURFACE_CLEAN;
+	if (!sub || weston_subsurface_is_synchronized(sub))
+		return true;
 
-	return status;
+	return weston_commit_queue_has_surface(main_surface, surface);
 }
 
-static enum weston_surface_status
-weston_surface_commit(struct weston_surface *surface)
+/* Content updates one surface may have held back at once */
+#define COMMIT_QUEUE_MAX 32
+
+/* Hold the pending state back if it, or an update before it, has a
+ * wp_commit_timer_v1 target time, or its acquire point has no fence
+ * yet, or its acquire fence is late. Sub-surface updates are held on
+ * the queue of their main surface, so that they stay in order with the
+ * parent commits that apply them. */
+static bool
+weston_surface_queue_commit(struct weston_surface *surface,
+			    struct weston_drm_syncobj_wait *acquire_wait)
 {
-	enum weston_surface_status status;
+	struct weston_surface *main_surface =
+		weston_surface_get_main_surface(surface);
+	struct weston_commit_timer *timer = surface->commit_timer;
+	struct weston_queued_commit *qc;
 
-	status = weston_surface_commit_state(surface, &surface->pending);
+	if (!acquire_wait && (!timer || !timer->has_timestamp) &&
+	    !weston_surface_pending_fence_is_late(surface) &&
+	    !weston_surface_must_follow_commit_queue(surface, main_surface))
+		return false;
 
-	if (status & WESTON_SURFACE_DIRTY_SUBSURFACE_CONFIG)
-		weston_surface_commit_subsurface_order(surface);
+	/* Target times far ahead must not grow the queue without bound:
+	 * give up on the times of the updates already held, and on the
+	 * client if fences still hold too many back. */
+	if (wl_list_length(&main_surface->commit_queue) >= COMMIT_QUEUE_MAX) {
+		weston_surface_apply_commit_queue(main_surface, NULL);
+		if (wl_list_length(&main_surface->commit_queue) >=
+		    COMMIT_QUEUE_MAX) {
+			if (acquire_wait)
+				weston_drm_syncobj_wait_destroy(acquire_wait);
+			wl_client_post_no_memory(wl_resource_get_client(surface->resource));
+			return true;
+		}
+	}
 
-	weston_surface_schedule_repaint(surface);
+	qc = xzalloc(sizeof *qc);
+	qc->surface = surface;
+	qc->main_surface = main_surface;
+	if (acquire_wait) {
+		acquire_wait->done = weston_queued_commit_acquire_done;
+		acquire_wait->data = qc;
+		qc->acquire_wait = acquire_wait;
+	}
+	weston_surface_state_init(surface, &qc->state);
+	if (surface->pending.status & WESTON_SURFACE_DIRTY_BUFFER)
+		weston_buffer_reference(&qc->buffer_ref,
+					surface->pending.buffer,
+					surface->pending.buffer ?
+						BUFFER_MAY_BE_ACCESSED :
+						BUFFER_WILL_NOT_BE_ACCESSED);
+	pixman_region32_copy(&qc->state.opaque, &surface->pending.opaque);
+	pixman_region32_copy(&qc->state.input, &surface->pending.input);
+	weston_surface_state_merge(surface, &qc->state, &surface->pending);
 
-	return status;
-}
+	if (timer && timer->has_timestamp) {
+		qc->target = timer->timestamp;
+		timer->has_timestamp = false;
+	}
 
-static enum weston_surface_status
-weston_subsurface_commit(struct weston_subsurface *sub);
+	if (wl_list_empty(&main_surface->commit_queue))
+		wl_list_insert(surface->compositor->commit_queue_list.prev,
+			       &main_surface->commit_queue_link);
+	wl_list_insert(main_surface->commit_queue.prev, &qc->link);
 
-static enum weston_surface_status
-weston_subsurface_parent_commit(struct weston_subsurface *sub,
-				int parent_is_synchronized);
+	/* Fence waits schedule the repaint themselves once done. */
+	if (qc->acquire_wait || weston_queued_commit_watch_fence(qc))
+		return true;
+
+	weston_queued_commit_ready(qc);
+
+	return true;
+}
 
 static void
 surface_commit(struct wl_client *client, struct wl_resource *resource)
 {
 	struct weston_surface *surface = wl_resource_get_user_data(resource);
 	struct weston_subsurface *sub = weston_surface_to_subsurface(surface);
+	struct weston_drm_syncobj_wait *acquire_wait = NULL;
 	enum weston_surface_status status;
 
 	if (!weston_surface_is_pending_viewport_source_valid(surface)) {
@@ -4991,6 +7133,11 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 		}
 	}
 
+	if (surface->syncobj_surface &&
+	    !weston_drm_syncobj_surface_commit(surface->syncobj_surface,
+					       &acquire_wait))
+		return;
+
 	if (surface->pending.buffer_release_ref.buffer_release &&
 	    !surface->pending.buffer) {
 		assert(surface->synchronization_resource);
@@ -5002,15 +7149,21 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 		return;
 	}
 
-	if (sub) {
-		status = weston_subsurface_commit(sub);
+	/* Sub-surfaces follow the timing of their parent. */
+	if (sub && surface->commit_timer)
+		surface->commit_timer->has_timestamp = false;
+
+	if (weston_surface_queue_commit(surface, acquire_wait)) {
+		return;
+	} else if (sub) {
+		status = weston_subsurface_commit(sub, &surface->pending);
 	} else {
 		status = WESTON_SURFACE_CLEAN;
 		wl_list_for_each(sub, &surface->subsurface_list, parent_link) {
 			if (sub->surface != surface)
 				status |= weston_subsurface_parent_commit(sub, 0);
 		}
-		status |= weston_surface_commit(surface);
+		status |= weston_surface_commit(surface, &surface->pending);
 	}
 
 	if (status & WESTON_SURFACE_DIRTY_SUBSURFACE_CONFIG)
@@ -5213,84 +7366,116 @@ weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 	return status;
 }
 
+/* Move the contents of src into dst, leaving src empty. Takes over the
+ * rectangles of src as they are when dst is empty, which is the common
+ * case of one commit per cache flush. */
 static void
-weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
+region_move_into(pixman_region32_t *dst, pixman_region32_t *src)
 {
-	struct weston_surface *surface = sub->surface;
+	pixman_region32_t tmp;
+
+	if (!pixman_region32_not_empty(dst)) {
+		tmp = *dst;
+		*dst = *src;
+		*src = tmp;
+	} else {
+		pixman_region32_union(dst, dst, src);
+	}
+	pixman_region32_clear(src);
+}
+
+/* The opaque and input regions of the pending state stay as they are
+ * after a commit, so a state which has seen all commits of the surface
+ * only needs them again when the client set them anew in src. */
+static void
+weston_surface_state_update_regions(struct weston_surface_state *state,
+				    struct weston_surface_state *src)
+{
+	if (src->status & WESTON_SURFACE_DIRTY_BUFFER_PARAMS)
+		pixman_region32_copy(&state->opaque, &src->opaque);
+
+	if (src->status & WESTON_SURFACE_DIRTY_INPUT)
+		pixman_region32_copy(&state->input, &src->input);
+}
 
+/* Fold src, the pending state of surface or an update of it held back,
+ * into state, leaving src clean. The caller holds its own reference to a
+ * newly attached buffer, and takes care of the opaque and input regions. */
+static void
+weston_surface_state_merge(struct weston_surface *surface,
+			   struct weston_surface_state *state,
+			   struct weston_surface_state *src)
+{
 	/*
 	 * If this commit would cause the surface to move by the
 	 * attach(dx, dy) parameters, the old damage region must be
 	 * translated to correspond to the new surface coordinate system
 	 * origin.
 	 */
-	if (surface->pending.status & WESTON_SURFACE_DIRTY_POS) {
-		pixman_region32_translate(&sub->cached.damage_surface,
-					  -surface->pending.buf_offset.c.x,
-					  -surface->pending.buf_offset.c.y);
-	}
-	pixman_region32_union(&sub->cached.damage_surface,
-			      &sub->cached.damage_surface,
-			      &surface->pending.damage_surface);
-	pixman_region32_clear(&surface->pending.damage_surface);
-
-	pixman_region32_union(&sub->cached.damage_buffer,
-			      &sub->cached.damage_buffer,
-			      &surface->pending.damage_buffer);
-	pixman_region32_clear(&surface->pending.damage_buffer);
-
-	sub->cached.render_intent = surface->pending.render_intent;
-	weston_color_profile_unref(sub->cached.color_profile);
-	sub->cached.color_profile =
-		weston_color_profile_ref(surface->pending.color_profile);
-
-	if (surface->pending.status & WESTON_SURFACE_DIRTY_BUFFER) {
-		weston_surface_state_set_buffer(&sub->cached,
-						surface->pending.buffer);
-		weston_buffer_reference(&sub->cached_buffer_ref,
-					surface->pending.buffer,
-					surface->pending.buffer ?
-						BUFFER_MAY_BE_ACCESSED :
-						BUFFER_WILL_NOT_BE_ACCESSED);
+	if (src->status & WESTON_SURFACE_DIRTY_POS) {
+		pixman_region32_translate(&state->damage_surface,
+					  -src->buf_offset.c.x,
+					  -src->buf_offset.c.y);
+	}
+	region_move_into(&state->damage_surface, &src->damage_surface);
+	region_move_into(&state->damage_buffer, &src->damage_buffer);
+
+	state->render_intent = src->render_intent;
+	weston_color_profile_unref(state->color_profile);
+	state->color_profile = weston_color_profile_ref(src->color_profile);
+
+	if (src->status & WESTON_SURFACE_DIRTY_BUFFER) {
+		weston_surface_state_set_buffer(state, src->buffer);
 		weston_presentation_feedback_discard_list(
-					&sub->cached.feedback_list);
+					&state->feedback_list);
 		/* zwp_surface_synchronization_v1.set_acquire_fence */
-		fd_move(&sub->cached.acquire_fence_fd,
-			&surface->pending.acquire_fence_fd);
+		fd_move(&state->acquire_fence_fd,
+			&src->acquire_fence_fd);
 		/* zwp_surface_synchronization_v1.get_release */
-		weston_buffer_release_move(&sub->cached.buffer_release_ref,
-					   &surface->pending.buffer_release_ref);
+		weston_buffer_release_move(&state->buffer_release_ref,
+					   &src->buffer_release_ref);
 	}
-	sub->cached.desired_protection = surface->pending.desired_protection;
-	sub->cached.protection_mode = surface->pending.protection_mode;
-	assert(surface->pending.acquire_fence_fd == -1);
-	assert(surface->pending.buffer_release_ref.buffer_release == NULL);
-	sub->cached.buf_offset = weston_coord_surface_add(sub->cached.buf_offset,
-							  surface->pending.buf_offset);
+	state->desired_protection = src->desired_protection;
+	state->protection_mode = src->protection_mode;
+	state->content_type = src->content_type;
+	assert(src->acquire_fence_fd == -1);
+	assert(src->buffer_release_ref.buffer_release == NULL);
+	state->buf_offset = weston_coord_surface_add(state->buf_offset,
+						     src->buf_offset);
 
-	sub->cached.buffer_viewport.buffer =
-		surface->pending.buffer_viewport.buffer;
-	sub->cached.buffer_viewport.surface =
-		surface->pending.buffer_viewport.surface;
+	state->buffer_viewport.buffer = src->buffer_viewport.buffer;
+	state->buffer_viewport.surface = src->buffer_viewport.surface;
 
-	weston_surface_state_set_buffer(&surface->pending, NULL);
+	weston_surface_state_set_buffer(src, NULL);
 
-	surface->pending.buf_offset = weston_coord_surface(0, 0, surface);
+	src->buf_offset = weston_coord_surface(0, 0, surface);
 
-	pixman_region32_copy(&sub->cached.opaque, &surface->pending.opaque);
+	wl_list_insert_list(&state->frame_callback_list,
+			    &src->frame_callback_list);
+	wl_list_init(&src->frame_callback_list);
 
-	pixman_region32_copy(&sub->cached.input, &surface->pending.input);
+	wl_list_insert_list(&state->feedback_list, &src->feedback_list);
+	wl_list_init(&src->feedback_list);
 
-	wl_list_insert_list(&sub->cached.frame_callback_list,
-			    &surface->pending.frame_callback_list);
-	wl_list_init(&surface->pending.frame_callback_list);
+	state->status |= src->status;
+	src->status = WESTON_SURFACE_CLEAN;
+}
+
+static void
+weston_subsurface_commit_to_cache(struct weston_subsurface *sub,
+				  struct weston_surface_state *state)
+{
+	struct weston_surface *surface = sub->surface;
 
-	wl_list_insert_list(&sub->cached.feedback_list,
-			    &surface->pending.feedback_list);
-	wl_list_init(&surface->pending.feedback_list);
+	if (state->status & WESTON_SURFACE_DIRTY_BUFFER)
+		weston_buffer_reference(&sub->cached_buffer_ref,
+					state->buffer,
+					state->buffer ?
+						BUFFER_MAY_BE_ACCESSED :
+						BUFFER_WILL_NOT_BE_ACCESSED);
 
-	sub->cached.status |= surface->pending.status;
-	surface->pending.status = WESTON_SURFACE_CLEAN;
+	weston_surface_state_update_regions(&sub->cached, state);
+	weston_surface_state_merge(surface, &sub->cached, state);
 	sub->has_cached_data = 1;
 }
 
@@ -5310,8 +7495,11 @@ weston_subsurface_is_synchronized(struct weston_subsurface *sub)
 	return false;
 }
 
+/* Commit state, the pending state of the sub-surface or an update of it
+ * that was held back */
 static enum weston_surface_status
-weston_subsurface_commit(struct weston_subsurface *sub)
+weston_subsurface_commit(struct weston_subsurface *sub,
+			 struct weston_surface_state *state)
 {
 	struct weston_surface *surface = sub->surface;
 	enum weston_surface_status status = WESTON_SURFACE_CLEAN;
@@ -5319,14 +7507,17 @@ weston_subsurface_commit(struct weston_subsurface *sub)
 
 	/* Recursive check for effectively synchronized. */
 	if (weston_subsurface_is_synchronized(sub)) {
-		weston_subsurface_commit_to_cache(sub);
+		weston_subsurface_commit_to_cache(sub, state);
 	} else {
 		if (sub->has_cached_data) {
 			/* flush accumulated state from cache */
-			weston_subsurface_commit_to_cache(sub);
+			weston_subsurface_commit_to_cache(sub, state);
 			status |= weston_subsurface_commit_from_cache(sub);
 		} else {
-			status |= weston_surface_commit(surface);
+			/* Keep the cache up to date with the regions */
+			weston_surface_state_update_regions(&sub->cached,
+							    state);
+			status |= weston_surface_commit(surface, state);
 		}
 
 		wl_list_for_each(tmp, &surface->subsurface_list, parent_link) {
@@ -5636,6 +7827,103 @@ weston_surface_copy_content(struct weston_surface *surface,
 					 src_x, src_y, width, height);
 }
 
+/** Walk a surface and its sub-surfaces, bottom-most first
+ *
+ * \param surface The root of the tree.
+ * \param x The X position of surface.
+ * \param y The Y position of surface.
+ * \param func Called for each surface with its position, offset by the
+ * sub-surface positions from surface.
+ * \param data User data passed to func.
+ *
+ * This is the order to draw the tree in. Unmapped surfaces are included.
+ */
+WL_EXPORT void
+weston_surface_tree_for_each(struct weston_surface *surface,
+			     float x, float y,
+			     weston_surface_tree_func_t func, void *data)
+{
+	struct weston_subsurface *sub;
+
+	/* The list holds the surface itself too, once it has any
+	 * sub-surface. */
+	if (wl_list_empty(&surface->subsurface_list)) {
+		func(surface, x, y, data);
+		return;
+	}
+
+	wl_list_for_each_reverse(sub, &surface->subsurface_list, parent_link) {
+		if (sub->surface == surface)
+			func(surface, x, y, data);
+		else
+			weston_surface_tree_for_each(sub->surface,
+						     x + sub->position.offset.c.x,
+						     y + sub->position.offset.c.y,
+						     func, data);
+	}
+}
+
+struct surface_thumbnail {
+	weston_surface_thumbnail_func_t done;
+	void *data;
+	int width;
+	int height;
+};
+
+static void
+surface_thumbnail_done(void *data, const void *pixels, int stride)
+{
+	struct surface_thumbnail *thumb = data;
+
+	thumb->done(thumb->data, pixels, thumb->width, thumb->height, stride);
+	free(thumb);
+}
+
+/** Get a scaled down copy of a surface and its sub-surfaces
+ *
+ * \param surface The surface to copy from.
+ * \param max_size The largest width or height of the thumbnail in pixels.
+ * \param done Called with the thumbnail once it is available.
+ * \param data User data passed to done.
+ *
+ * The bounding box of the surface and its sub-surfaces is drawn, as last
+ * rendered, at the largest size fitting max_size x max_size without
+ * scaling up, and handed to done in the same format as
+ * weston_surface_copy_content() writes. Unlike the latter, the renderer
+ * does the scaling and does not need a full size copy, and the GL
+ * renderer reads back without waiting for the GPU: done is called from
+ * the event loop later. On failure, done gets NULL pixels.
+ */
+WL_EXPORT void
+weston_surface_thumbnail_async(struct weston_surface *surface, int max_size,
+			       weston_surface_thumbnail_func_t done,
+			       void *data)
+{
+	struct weston_renderer *rer = surface->compositor->renderer;
+	struct weston_geometry box = weston_surface_get_bounding_box(surface);
+	struct surface_thumbnail *thumb;
+	int longest = MAX(box.width, box.height);
+
+	if (!rer->surface_thumbnail_async || max_size <= 0 || longest <= 0 ||
+	    !weston_surface_has_content(surface)) {
+		done(data, NULL, 0, 0, 0);
+		return;
+	}
+
+	thumb = xzalloc(sizeof *thumb);
+	thumb->done = done;
+	thumb->data = data;
+	thumb->width = box.width;
+	thumb->height = box.height;
+	if (longest > max_size) {
+		thumb->width = MAX((int64_t) box.width * max_size / longest, 1);
+		thumb->height = MAX((int64_t) box.height * max_size / longest, 1);
+	}
+
+	rer->surface_thumbnail_async(surface, &box, thumb->width, thumb->height,
+				     surface_thumbnail_done, thumb);
+}
+
 static void
 subsurface_set_position(struct wl_client *client,
 			struct wl_resource *resource, int32_t x, int32_t y)
@@ -5768,6 +8056,7 @@ weston_subsurface_unlink_parent(struct weston_subsurface *sub)
 	wl_list_remove(&sub->parent_link_pending);
 	wl_list_remove(&sub->parent_destroy_listener.link);
 	sub->parent->pending.status |= WESTON_SURFACE_DIRTY_SUBSURFACE_CONFIG;
+	weston_compositor_subsurface_order_changed(sub->parent->compositor);
 	sub->parent = NULL;
 }
 
@@ -5828,6 +8117,7 @@ weston_subsurface_link_parent(struct weston_subsurface *sub,
 		      &sub->parent_destroy_listener);
 
 	parent->pending.status |= WESTON_SURFACE_DIRTY_SUBSURFACE_CONFIG;
+	weston_compositor_subsurface_order_changed(parent->compositor);
 
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
@@ -5883,6 +8173,7 @@ weston_subsurface_destroy(struct weston_subsurface *sub)
 	} else {
 		/* the dummy weston_subsurface for the parent itself */
 		assert(sub->parent_destroy_listener.notify == NULL);
+		weston_compositor_subsurface_order_changed(sub->surface->compositor);
 		wl_list_remove(&sub->parent_link);
 		wl_list_remove(&sub->parent_link_pending);
 	}
@@ -5926,6 +8217,8 @@ weston_subsurface_create(uint32_t id, struct weston_surface *surface,
 	weston_subsurface_link_surface(sub, surface);
 	weston_subsurface_link_parent(sub, parent);
 	weston_surface_state_init(surface, &sub->cached);
+	pixman_region32_copy(&sub->cached.opaque, &surface->pending.opaque);
+	pixman_region32_copy(&sub->cached.input, &surface->pending.input);
 	sub->cached_buffer_ref.buffer = NULL;
 	sub->synchronized = 1;
 
@@ -5946,6 +8239,7 @@ weston_subsurface_create_for_parent(struct weston_surface *parent)
 
 	weston_subsurface_link_surface(sub, parent);
 	sub->parent = parent;
+	weston_compositor_subsurface_order_changed(parent->compositor);
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
@@ -7351,20 +9645,38 @@ weston_output_update_matrix(struct weston_output *output)
 				     output->width, output->height,
 				     output->current_scale);
 
+	if (output->fractional_scale) {
+		float scale = (float) weston_output_get_fractional_scale(output) /
+			      (FRACTIONAL_SCALE_DENOMINATOR * output->current_scale);
+
+		weston_matrix_scale(&output->matrix, scale, scale, 1);
+	}
+
 	weston_matrix_invert(&output->inverse_matrix, &output->matrix);
 }
 
 static void
 weston_output_transform_scale_init(struct weston_output *output, uint32_t transform, uint32_t scale)
 {
+	uint32_t fractional_scale;
+	int32_t width, height;
+
 	output->transform = transform;
 	output->native_scale = scale;
 	assert(output->current_scale > 0);
 
-	convert_size_by_transform_scale(&output->width, &output->height,
+	convert_size_by_transform_scale(&width, &height,
 					output->current_mode->width,
 					output->current_mode->height,
-					transform, scale);
+					transform, 1);
+
+	/* The same as dividing by the integer scale when there is no
+	 * fractional one. */
+	fractional_scale = weston_output_get_fractional_scale(output);
+	output->width = (int64_t) width * FRACTIONAL_SCALE_DENOMINATOR /
+			fractional_scale;
+	output->height = (int64_t) height * FRACTIONAL_SCALE_DENOMINATOR /
+			 fractional_scale;
 }
 
 static void
@@ -7380,6 +9692,8 @@ weston_output_init_geometry(struct weston_output *output,
 				  output->pos.c.x, output->pos.c.y,
 				  output->width,
 				  output->height);
+
+	weston_compositor_invalidate_pick_index(output->compositor);
 }
 
 /**
@@ -7487,15 +9801,11 @@ weston_compositor_add_output(struct weston_compositor *compositor,
 
 	assert(!output->enabled);
 
-	/* Verify we haven't reached the limit of 32 available output IDs */
-	assert(ffs(~compositor->output_id_pool) > 0);
-
-	/* Invert the output id pool and look for the lowest numbered
-	 * switch (the least significant bit).  Take that bit's position
-	 * as our ID, and mark it used in the compositor's output_id_pool.
+	/* Take the lowest ID not yet in use as ours, and mark it used in
+	 * the compositor's output_id_pool.
 	 */
-	output->id = ffs(~compositor->output_id_pool) - 1;
-	compositor->output_id_pool |= 1u << output->id;
+	output->id = weston_output_mask_first_unset(&compositor->output_id_pool);
+	weston_output_mask_set(&compositor->output_id_pool, output->id);
 
 	wl_list_remove(&output->link);
 	wl_list_insert(compositor->output_list.prev, &output->link);
@@ -7702,21 +10012,31 @@ weston_compositor_remove_output(struct weston_output *output)
 	}
 	assert(wl_list_empty(&output->paint_node_z_order_list));
 
+	weston_output_color_outcome_destroy(&output->color_outcome);
+
+	weston_presentation_feedback_discard_list(&output->feedback_list);
+	weston_output_latency_put_back(output);
+
+	wl_event_source_timer_update(output->frame_callback_timer, 0);
+	weston_output_send_deferred_frame_callbacks(output);
+	wl_event_source_timer_update(output->commit_queue_timer, 0);
+
+	weston_compositor_reflow_outputs(compositor, output, -output->width);
+
 	/*
+	 * Only views that were on the removed output need new outputs, and
+	 * only after the reflow, which may have moved another output under
+	 * them. Views on the other outputs keep their paint nodes and
+	 * planes, so nothing but the moved outputs gets repainted.
+	 *
 	 * Use view_list in case the output did not go through repaint
 	 * after a view came on it, lacking a paint node. Just to be sure.
 	 */
 	wl_list_for_each(view, &compositor->view_list, link) {
-		if (view->output_mask & (1u << output->id))
+		if (weston_output_mask_has(&view->output_mask, output->id))
 			weston_view_assign_output(view);
 	}
 
-	weston_output_color_outcome_destroy(&output->color_outcome);
-
-	weston_presentation_feedback_discard_list(&output->feedback_list);
-
-	weston_compositor_reflow_outputs(compositor, output, -output->width);
-
 	wl_list_remove(&output->link);
 	wl_list_insert(compositor->pending_output_list.prev, &output->link);
 	output->enabled = false;
@@ -7729,7 +10049,7 @@ weston_compositor_remove_output(struct weston_output *output)
 
 	weston_output_capture_info_destroy(&output->capture_info);
 
-	compositor->output_id_pool &= ~(1u << output->id);
+	weston_output_mask_unset(&compositor->output_id_pool, output->id);
 	output->id = 0xffffffff; /* invalid */
 }
 /** Sets the output scale for a given output.
@@ -7743,19 +10063,78 @@ WL_EXPORT void
 weston_output_set_scale(struct weston_output *output,
 			int32_t scale)
 {
+	weston_output_set_fractional_scale(output,
+					   scale * FRACTIONAL_SCALE_DENOMINATOR);
+}
+
+/** Sets a possibly fractional output scale for a given output.
+ *
+ * \param output The weston_output object that the scale is set for.
+ * \param scale  Scale factor in 120ths, as wp_fractional_scale_v1 counts.
+ *
+ * The output is composited at this scale, and wl_output advertises it
+ * rounded up, so that clients unaware of fractional scales render at
+ * least at the output resolution. A temporary mode switch to an integer
+ * scale overrides it until the output switches back to its native mode.
+ *
+ * The backend must derive its mode size from
+ * weston_output_get_fractional_scale() rather than current_scale for a
+ * fractional scale to make sense.
+ *
+ * \ingroup output
+ */
+WL_EXPORT void
+weston_output_set_fractional_scale(struct weston_output *output,
+				   uint32_t scale)
+{
+	int32_t integer_scale = DIV_ROUND_UP(scale, FRACTIONAL_SCALE_DENOMINATOR);
+	uint32_t fractional_scale = 0;
+	struct weston_view *view;
+
+	assert(scale > 0);
+
+	if (scale % FRACTIONAL_SCALE_DENOMINATOR != 0)
+		fractional_scale = scale;
+
 	if (!output->enabled) {
-		output->current_scale = scale;
+		output->current_scale = integer_scale;
+		output->fractional_scale = fractional_scale;
 		return;
 	}
 
-	if (output->current_scale == scale)
+	if (output->current_scale == integer_scale &&
+	    output->fractional_scale == fractional_scale)
 		return;
 
-	output->current_scale = scale;
+	output->current_scale = integer_scale;
+	output->fractional_scale = fractional_scale;
 	weston_mode_switch_finish(output, false, true);
+
+	wl_list_for_each(view, &output->compositor->view_list, link)
+		weston_surface_update_preferred_scale(view->surface);
+
 	wl_signal_emit(&output->compositor->output_resized_signal, output);
 }
 
+/** Returns the scale the output is composited at, in 120ths.
+ *
+ * This is current_scale unless a fractional scale was set and a
+ * temporary mode switch has not replaced it.
+ *
+ * \ingroup output
+ */
+WL_EXPORT uint32_t
+weston_output_get_fractional_scale(const struct weston_output *output)
+{
+	if (output->fractional_scale &&
+	    (int32_t) DIV_ROUND_UP(output->fractional_scale,
+				   FRACTIONAL_SCALE_DENOMINATOR) ==
+	    output->current_scale)
+		return output->fractional_scale;
+
+	return output->current_scale * FRACTIONAL_SCALE_DENOMINATOR;
+}
+
 /** Sets the output transform for a given output.
  *
  * \param output    The weston_output object that the transform is set for.
@@ -8127,6 +10506,7 @@ weston_output_init(struct weston_output *output,
 		   const char *name)
 {
 	struct weston_color_manager *cm;
+	struct wl_event_loop *loop;
 
 	output->pos.c = weston_coord(0, 0);
 	output->compositor = compositor;
@@ -8150,11 +10530,27 @@ weston_output_init(struct weston_output *output,
 	output->current_scale = 0;
 	/* Can't use -1 on uint32_t and 0 is valid enum value */
 	output->transform = UINT32_MAX;
+	output->repaint_timing.estimate_nsec = -1;
 
 	pixman_region32_init(&output->region);
+	pixman_region32_init(&output->mirror_damage);
+	pixman_region32_init(&output->scratch_region[0]);
+	pixman_region32_init(&output->scratch_region[1]);
 	wl_list_init(&output->mode_list);
 
 	weston_plane_init(&output->primary_plane, compositor);
+	weston_output_latency_init(output);
+	weston_output_perf_hud_init(output);
+	output->repaint_profile = xzalloc(sizeof(*output->repaint_profile));
+
+	wl_list_init(&output->frame_callback_deferred_list);
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	output->frame_callback_timer =
+		wl_event_loop_add_timer(loop, frame_callback_timer_handler,
+					output);
+	output->commit_queue_timer =
+		wl_event_loop_add_timer(loop, commit_queue_timer_handler,
+					output);
 
 	/* Set the stock sRGB color profile for the output. Libweston users are
 	 * free to set the color profile to whatever they want later on. */
@@ -8225,10 +10621,10 @@ weston_output_create_heads_string(struct weston_output *output)
  * Establishes a repaint timer for the output with the relevant display
  * object's event loop. See output_repaint_timer_handler().
  *
- * The output is assigned an ID. Weston can support up to 32 distinct
- * outputs, with IDs numbered from 0-31; the compositor's output_id_pool
- * is referred to and used to find the first available ID number, and
- * then this ID is marked as used in output_id_pool.
+ * The output is assigned an ID. There is no fixed limit on the number of
+ * outputs; the compositor's output_id_pool is referred to and used to find
+ * the lowest available ID number, and then this ID is marked as used in
+ * output_id_pool.
  *
  * The output is also assigned a Wayland global with the wl_output
  * external interface.
@@ -8475,6 +10871,7 @@ WL_EXPORT void
 weston_output_release(struct weston_output *output)
 {
 	struct weston_head *head, *tmp;
+	struct weston_output *iter;
 
 	output->destroying = 1;
 
@@ -8491,12 +10888,27 @@ weston_output_release(struct weston_output *output)
 
 	assert(output->color_outcome == NULL);
 
+	wl_list_for_each(iter, &output->compositor->output_list, link) {
+		if (iter->mirror_of == output)
+			iter->mirror_of = NULL;
+	}
+
 	pixman_region32_fini(&output->region);
+	pixman_region32_fini(&output->mirror_damage);
+	pixman_region32_fini(&output->scratch_region[0]);
+	pixman_region32_fini(&output->scratch_region[1]);
 	wl_list_remove(&output->link);
 
 	wl_list_for_each_safe(head, tmp, &output->head_list, output_link)
 		weston_head_detach(head);
 
+	weston_output_latency_release(output);
+	weston_output_perf_hud_release(output);
+	free(output->repaint_profile);
+	output->repaint_profile = NULL;
+	weston_output_send_deferred_frame_callbacks(output);
+	wl_event_source_remove(output->frame_callback_timer);
+	wl_event_source_remove(output->commit_queue_timer);
 	free(output->name);
 }
 
@@ -8621,7 +11033,28 @@ WL_EXPORT void
 weston_output_allow_protection(struct weston_output *output,
 			       bool allow_protection)
 {
-	output->allow_protection = allow_protection;
+	output->allow_protection = allow_protection;
+}
+
+/** Send frame callbacks at a fixed time before the next vblank
+ *
+ * \param output The weston_output to configure.
+ * \param offset_msec How long before the vblank the clients' next frames
+ * target the frame callbacks go out, or 0 to send them right after each
+ * repaint.
+ *
+ * Clients that render quickly can use a late frame callback to draw from
+ * fresher input and still make the next repaint. The offset has to leave
+ * them the repaint window plus their own rendering time. Outputs with
+ * variable refresh always send frame callbacks right away.
+ *
+ * \ingroup output
+ */
+WL_EXPORT void
+weston_output_set_frame_callback_offset(struct weston_output *output,
+					int offset_msec)
+{
+	output->frame_callback_offset_msec = MAX(offset_msec, 0);
 }
 
 /** Get supported EOTF modes as a bit mask
@@ -8704,7 +11137,7 @@ weston_output_force_power(struct weston_output *output,
 		return;
 
 	wl_list_for_each(view, &output->compositor->view_list, link)
-		if (view->output_mask & (1u << output->id))
+		if (weston_output_mask_has(&view->output_mask, output->id))
 			weston_view_assign_output(view);
 
 	if (!output->set_dpms || !output->enabled)
@@ -9017,6 +11450,93 @@ bind_viewporter(struct wl_client *client,
 				       NULL, NULL);
 }
 
+static void
+destroy_fractional_scale(struct wl_resource *resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(resource);
+
+	if (!surface)
+		return;
+
+	surface->fractional_scale_resource = NULL;
+	surface->preferred_fractional_scale = 0;
+}
+
+static void
+fractional_scale_destroy(struct wl_client *client,
+			 struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct wp_fractional_scale_v1_interface fractional_scale_interface = {
+	fractional_scale_destroy,
+};
+
+static void
+fractional_scale_manager_destroy(struct wl_client *client,
+				 struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+fractional_scale_manager_get_fractional_scale(struct wl_client *client,
+					      struct wl_resource *manager,
+					      uint32_t id,
+					      struct wl_resource *surface_resource)
+{
+	int version = wl_resource_get_version(manager);
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct wl_resource *resource;
+
+	if (surface->fractional_scale_resource) {
+		wl_resource_post_error(manager,
+			WP_FRACTIONAL_SCALE_MANAGER_V1_ERROR_FRACTIONAL_SCALE_EXISTS,
+			"a fractional scale object for that surface already exists");
+		return;
+	}
+
+	resource = wl_resource_create(client, &wp_fractional_scale_v1_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &fractional_scale_interface,
+				       surface, destroy_fractional_scale);
+
+	surface->fractional_scale_resource = resource;
+	weston_surface_update_preferred_scale(surface);
+}
+
+static const struct wp_fractional_scale_manager_v1_interface fractional_scale_manager_interface = {
+	fractional_scale_manager_destroy,
+	fractional_scale_manager_get_fractional_scale,
+};
+
+static void
+bind_fractional_scale_manager(struct wl_client *client,
+			      void *data, uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client,
+				      &wp_fractional_scale_manager_v1_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &fractional_scale_manager_interface,
+				       NULL, NULL);
+}
+
 static void
 destroy_presentation_feedback(struct wl_resource *feedback_resource)
 {
@@ -9203,6 +11723,238 @@ tearing_control_manager_implementation = {
 	get_tearing_control,
 };
 
+static void
+destroy_content_type(struct wl_resource *resource)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	if (!surface)
+		return;
+
+	/* Destroying the object resets the hint with the next commit. */
+	surface->content_type_resource = NULL;
+	surface->pending.content_type = WESTON_CONTENT_TYPE_NONE;
+}
+
+static void
+content_type_set_content_type(struct wl_client *client,
+			      struct wl_resource *resource,
+			      uint32_t content_type)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	if (!surface)
+		return;
+
+	switch (content_type) {
+	case WP_CONTENT_TYPE_V1_TYPE_PHOTO:
+		surface->pending.content_type = WESTON_CONTENT_TYPE_PHOTO;
+		break;
+	case WP_CONTENT_TYPE_V1_TYPE_VIDEO:
+		surface->pending.content_type = WESTON_CONTENT_TYPE_VIDEO;
+		break;
+	case WP_CONTENT_TYPE_V1_TYPE_GAME:
+		surface->pending.content_type = WESTON_CONTENT_TYPE_GAME;
+		break;
+	default:
+		surface->pending.content_type = WESTON_CONTENT_TYPE_NONE;
+		break;
+	}
+}
+
+static void
+content_type_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct wp_content_type_v1_interface content_type_interface = {
+	content_type_destroy,
+	content_type_set_content_type,
+};
+
+static void
+content_type_manager_destroy(struct wl_client *client,
+			     struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+content_type_manager_get_surface_content_type(struct wl_client *client,
+					      struct wl_resource *manager,
+					      uint32_t id,
+					      struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct wl_resource *resource;
+
+	if (surface->content_type_resource) {
+		wl_resource_post_error(manager,
+				       WP_CONTENT_TYPE_MANAGER_V1_ERROR_ALREADY_CONSTRUCTED,
+				       "Surface already has a content type object");
+		return;
+	}
+
+	resource = wl_resource_create(client, &wp_content_type_v1_interface,
+				      wl_resource_get_version(manager), id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &content_type_interface,
+				       surface, destroy_content_type);
+	surface->content_type_resource = resource;
+}
+
+static const struct wp_content_type_manager_v1_interface
+content_type_manager_implementation = {
+	content_type_manager_destroy,
+	content_type_manager_get_surface_content_type,
+};
+
+static void
+commit_timer_set_timestamp(struct wl_client *client,
+			   struct wl_resource *resource,
+			   uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+			   uint32_t tv_nsec)
+{
+	struct weston_commit_timer *timer = wl_resource_get_user_data(resource);
+
+	if (!timer->surface) {
+		wl_resource_post_error(resource,
+				       WP_COMMIT_TIMER_V1_ERROR_SURFACE_DESTROYED,
+				       "The surface has been destroyed");
+		return;
+	}
+
+	if (tv_nsec >= 1000000000) {
+		wl_resource_post_error(resource,
+				       WP_COMMIT_TIMER_V1_ERROR_INVALID_TIMESTAMP,
+				       "tv_nsec out of range");
+		return;
+	}
+
+	if (timer->has_timestamp) {
+		wl_resource_post_error(resource,
+				       WP_COMMIT_TIMER_V1_ERROR_TIMESTAMP_EXISTS,
+				       "A timestamp is already set for this commit");
+		return;
+	}
+
+	timespec_from_proto(&timer->timestamp, tv_sec_hi, tv_sec_lo, tv_nsec);
+	timer->has_timestamp = true;
+}
+
+static void
+commit_timer_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct wp_commit_timer_v1_interface commit_timer_interface = {
+	commit_timer_set_timestamp,
+	commit_timer_destroy,
+};
+
+static void
+free_commit_timer(struct wl_resource *res)
+{
+	struct weston_commit_timer *timer = wl_resource_get_user_data(res);
+
+	if (timer->surface)
+		timer->surface->commit_timer = NULL;
+
+	free(timer);
+}
+
+static void
+destroy_commit_timing_manager(struct wl_client *client,
+			      struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+commit_timing_manager_get_timer(struct wl_client *client,
+				struct wl_resource *resource,
+				uint32_t id,
+				struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct weston_commit_timer *timer;
+	struct wl_resource *timer_res;
+
+	if (surface->commit_timer) {
+		wl_resource_post_error(resource,
+				       WP_COMMIT_TIMING_MANAGER_V1_ERROR_COMMIT_TIMER_EXISTS,
+				       "Surface already has a commit timer");
+		return;
+	}
+
+	timer_res = wl_resource_create(client, &wp_commit_timer_v1_interface,
+				       wl_resource_get_version(resource), id);
+	if (timer_res == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	timer = xzalloc(sizeof *timer);
+	timer->surface = surface;
+	surface->commit_timer = timer;
+	wl_resource_set_implementation(timer_res, &commit_timer_interface,
+				       timer, free_commit_timer);
+}
+
+static const struct wp_commit_timing_manager_v1_interface
+commit_timing_manager_implementation = {
+	destroy_commit_timing_manager,
+	commit_timing_manager_get_timer,
+};
+
+static void
+bind_commit_timing_manager(struct wl_client *client, void *data,
+			   uint32_t version, uint32_t id)
+{
+	struct weston_compositor *compositor = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client,
+				      &wp_commit_timing_manager_v1_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &commit_timing_manager_implementation,
+				       compositor, NULL);
+}
+
+static void
+bind_content_type_manager(struct wl_client *client, void *data,
+			  uint32_t version, uint32_t id)
+{
+	struct weston_compositor *compositor = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client,
+				      &wp_content_type_manager_v1_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &content_type_manager_implementation,
+				       compositor, NULL);
+}
+
 static void
 bind_tearing_controller(struct wl_client *client, void *data,
 			uint32_t version, uint32_t id)
@@ -9353,11 +12105,12 @@ debug_scene_view_print(FILE *fp, struct weston_view *view, int view_idx)
 	if (view->alpha < 1.0)
 		fprintf(fp, "\t\talpha: %f\n", view->alpha);
 
-	if (view->output_mask != 0) {
+	if (!weston_output_mask_is_empty(&view->output_mask)) {
 		bool first_output = true;
 		fprintf(fp, "\t\toutputs: ");
 		wl_list_for_each(output, &ec->output_list, link) {
-			if (!(view->output_mask & (1 << output->id)))
+			if (!weston_output_mask_has(&view->output_mask,
+						    output->id))
 				continue;
 			fprintf(fp, "%s%d (%s)%s",
 				(first_output) ? "" : ", ",
@@ -9586,7 +12339,8 @@ weston_compositor_create(struct wl_display *display,
 	wl_signal_init(&ec->output_capture.ask_auth);
 	ec->session_active = true;
 
-	ec->output_id_pool = 0;
+	weston_output_mask_init(&ec->output_id_pool);
+	ec->subsurface_order_serial = 1;
 	ec->repaint_msec = DEFAULT_REPAINT_WINDOW;
 
 	ec->activate_serial = 1;
@@ -9607,6 +12361,11 @@ weston_compositor_create(struct wl_display *display,
 			      ec, bind_viewporter))
 		goto fail;
 
+	if (!wl_global_create(ec->wl_display,
+			      &wp_fractional_scale_manager_v1_interface, 1,
+			      ec, bind_fractional_scale_manager))
+		goto fail;
+
 	if (!wl_global_create(ec->wl_display, &zxdg_output_manager_v1_interface, 2,
 			      ec, bind_xdg_output_manager))
 		goto fail;
@@ -9625,6 +12384,16 @@ weston_compositor_create(struct wl_display *display,
 			      ec, bind_tearing_controller))
 		goto fail;
 
+	if (!wl_global_create(ec->wl_display,
+			      &wp_content_type_manager_v1_interface, 1,
+			      ec, bind_content_type_manager))
+		goto fail;
+
+	if (!wl_global_create(ec->wl_display,
+			      &wp_commit_timing_manager_v1_interface, 1,
+			      ec, bind_commit_timing_manager))
+		goto fail;
+
 	if (weston_input_init(ec) != 0)
 		goto fail;
 
@@ -9634,8 +12403,18 @@ weston_compositor_create(struct wl_display *display,
 	ec->color_transform_id_generator = weston_idalloc_create(ec);
 
 	wl_list_init(&ec->view_list);
+	wl_list_init(&ec->pick_index.dirty_list);
+	pixman_region32_init(&ec->repick.region);
+	ec->repick.all = true;
+	object_pool_init(&ec->view_pool, sizeof(struct weston_view));
+	object_pool_init(&ec->paint_node_pool,
+			 sizeof(struct weston_paint_node));
 	wl_list_init(&ec->plane_list);
+	wl_list_init(&ec->commit_queue_list);
 	wl_list_init(&ec->layer_list);
+	wl_list_init(&ec->xkb_keymap_cache);
+	wl_list_init(&ec->client_memory_list);
+	weston_compositor_client_requests_init(ec);
 	wl_list_init(&ec->seat_list);
 	wl_list_init(&ec->pending_output_list);
 	wl_list_init(&ec->output_list);
@@ -9658,9 +12437,21 @@ weston_compositor_create(struct wl_display *display,
 	wl_display_init_shm(ec->wl_display);
 
 	loop = wl_display_get_event_loop(ec->wl_display);
+	ec->priority_loop = wl_event_loop_create();
+	if (!ec->priority_loop)
+		goto fail;
+	ec->priority_loop_source =
+		wl_event_loop_add_fd(loop,
+				     wl_event_loop_get_fd(ec->priority_loop),
+				     WL_EVENT_READABLE,
+				     priority_loop_handler, ec);
+
 	ec->idle_source = wl_event_loop_add_timer(loop, idle_handler, ec);
 	ec->repaint_timer =
-		wl_event_loop_add_timer(loop, output_repaint_timer_handler,
+		wl_event_loop_add_timer(ec->priority_loop,
+					output_repaint_timer_handler, ec);
+	ec->occluded_frame_timer =
+		wl_event_loop_add_timer(loop, occluded_frame_timer_handler,
 					ec);
 
 	weston_layer_init(&ec->fade_layer, ec);
@@ -9682,6 +12473,50 @@ weston_compositor_create(struct wl_display *display,
 						weston_timeline_create_subscription,
 						weston_timeline_destroy_subscription,
 						ec);
+
+	ec->latency_scope =
+		weston_compositor_add_log_scope(ec, "latency",
+						"Frame latency statistics\n",
+						weston_latency_debug_scope_cb,
+						NULL, ec);
+
+	ec->repaint_profile_scope =
+		weston_compositor_add_log_scope(ec, "repaint-profile",
+						"Time taken by the phases of "
+						"output repaints\n",
+						weston_repaint_profile_debug_scope_cb,
+						NULL, ec);
+
+	ec->client_memory_scope =
+		weston_compositor_add_log_scope(ec, "client-memory",
+						"Memory held for every client, "
+						"with high-water marks\n",
+						weston_client_memory_debug_scope_cb,
+						NULL, ec);
+
+	ec->client_requests_scope =
+		weston_compositor_add_log_scope(ec, "client-requests",
+						"Requests dispatched for every "
+						"client, with high-water marks\n",
+						weston_client_requests_debug_scope_cb,
+						NULL, ec);
+
+	ec->client_damage_scope =
+		weston_compositor_add_log_scope(ec, "client-damage",
+						"Merging of fragmented client "
+						"damage as it arrives\n",
+						weston_client_damage_debug_scope_cb,
+						NULL, ec);
+
+	ec->scene_record_scope =
+		weston_compositor_add_log_scope(ec, "scene-record",
+						"Surface commits, for "
+						"weston-scene-replay\n",
+						weston_scene_record_subscribe_cb,
+						NULL, ec);
+
+	weston_compositor_perf_hud_init(ec);
+
 	ec->libseat_debug =
 		weston_compositor_add_log_scope(ec, "libseat-debug",
 						"libseat debug messages\n",
@@ -9705,6 +12540,7 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 
 	wl_event_source_remove(ec->idle_source);
 	wl_event_source_remove(ec->repaint_timer);
+	wl_event_source_remove(ec->occluded_frame_timer);
 
 	if (ec->touch_calibration)
 		weston_compositor_destroy_touch_calibrator(ec);
@@ -9855,6 +12691,29 @@ weston_compositor_backends_loaded(struct weston_compositor *compositor)
 	return 0;
 }
 
+/** Get the event loop for sources which must not wait behind clients
+ *
+ * \param compositor The compositor instance.
+ * \return The priority event loop.
+ *
+ * The priority loop is dispatched from the display's event loop like any
+ * other source, and also in between the requests of a client which goes
+ * over weston_compositor::client_request_budget. Its sources, e.g. the
+ * repaint timer, the DRM fd for page flip events and the libinput fd, can
+ * thus run while a client floods the compositor.
+ *
+ * Handlers on it may run in between two requests of a client, so they
+ * must not destroy client objects which take requests. They can check
+ * weston_compositor::preempted_client to defer such work.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT struct wl_event_loop *
+weston_compositor_get_priority_loop(struct weston_compositor *compositor)
+{
+	return compositor->priority_loop;
+}
+
 /** Read the current time from the Presentation clock
  *
  * \param compositor
@@ -10143,6 +13002,9 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 
 	weston_compositor_destroy_backends(compositor);
 
+	wl_event_source_remove(compositor->priority_loop_source);
+	wl_event_loop_destroy(compositor->priority_loop);
+
 	/* The backend is responsible for destroying the heads. */
 	assert(wl_list_empty(&compositor->head_list));
 
@@ -10157,12 +13019,41 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 	weston_log_scope_destroy(compositor->timeline);
 	compositor->timeline = NULL;
 
+	weston_log_scope_destroy(compositor->latency_scope);
+	compositor->latency_scope = NULL;
+
+	weston_log_scope_destroy(compositor->repaint_profile_scope);
+	compositor->repaint_profile_scope = NULL;
+
+	weston_log_scope_destroy(compositor->client_memory_scope);
+	compositor->client_memory_scope = NULL;
+	weston_compositor_client_memory_fini(compositor);
+
+	weston_log_scope_destroy(compositor->client_requests_scope);
+	compositor->client_requests_scope = NULL;
+	weston_compositor_client_requests_fini(compositor);
+
+	weston_log_scope_destroy(compositor->client_damage_scope);
+	compositor->client_damage_scope = NULL;
+
+	weston_log_scope_destroy(compositor->scene_record_scope);
+	compositor->scene_record_scope = NULL;
+
 	weston_log_scope_destroy(compositor->libseat_debug);
 	compositor->libseat_debug = NULL;
 
 	weston_idalloc_destroy(compositor->color_transform_id_generator);
 	weston_idalloc_destroy(compositor->color_profile_id_generator);
 
+	weston_output_mask_fini(&compositor->output_id_pool);
+
+	weston_compositor_release_pick_index(compositor);
+	pixman_region32_fini(&compositor->repick.region);
+	object_pool_release(&compositor->view_pool);
+	object_pool_release(&compositor->paint_node_pool);
+	free(compositor->gl_program_cache_dir);
+	free(compositor->color_lut_cache_dir);
+
 	if (compositor->default_dmabuf_feedback) {
 		weston_dmabuf_feedback_destroy(compositor->default_dmabuf_feedback);
 		weston_dmabuf_feedback_format_table_destroy(compositor->dmabuf_feedback_format_table);
@@ -10433,6 +13324,47 @@ weston_renderbuffer_unref(struct weston_renderbuffer *renderbuffer)
 	renderbuffer->destroy(renderbuffer);
 }
 
+/** Render the output damage into a renderbuffer
+ *
+ * \param output The output to repaint.
+ * \param output_damage The damage to repaint, in global coordinates.
+ * \param renderbuffer The renderbuffer to render into, or NULL for the
+ * renderer's default one.
+ *
+ * Backends call this rather than the renderer hook directly, so that the
+ * time the renderer takes is profiled apart from the backend's own.
+ */
+WL_EXPORT void
+weston_renderer_repaint_output(struct weston_output *output,
+			       pixman_region32_t *output_damage,
+			       struct weston_renderbuffer *renderbuffer)
+{
+	struct weston_repaint_profile *profile = output->repaint_profile;
+	struct weston_output *mirror;
+	int64_t start = weston_repaint_profile_now();
+	int64_t elapsed;
+
+	weston_output_capture_info_add_damage(output, output_damage);
+
+	output->compositor->renderer->repaint_output(output, output_damage,
+						     renderbuffer);
+
+	elapsed = weston_repaint_profile_now() - start;
+	profile->samples_nsec[profile->next][WESTON_REPAINT_PHASE_RENDERER] += elapsed;
+	profile->samples_nsec[profile->next][WESTON_REPAINT_PHASE_BACKEND] -= elapsed;
+
+	/* Outputs mirroring this one may copy its image instead of
+	 * compositing the scene again; let them pick up what changed. */
+	wl_list_for_each(mirror, &output->compositor->output_list, link) {
+		if (mirror->mirror_of != output || !mirror->enabled)
+			continue;
+
+		pixman_region32_union(&mirror->mirror_damage,
+				      &mirror->mirror_damage, output_damage);
+		weston_output_schedule_repaint(mirror);
+	}
+}
+
 /** Tell the renderer that the target framebuffer size has changed
  *
  * \param output The output that was resized.
@@ -10460,6 +13392,51 @@ weston_renderer_resize_output(struct weston_output *output,
 	}
 }
 
+/** Read back output pixels without stalling the repaint
+ *
+ * \param output The output to read from.
+ * \param format The pixel format to read the pixels in.
+ * \param x The left edge of the area, in framebuffer coordinates.
+ * \param y The top edge of the area, in framebuffer coordinates with the
+ * same origin as read_pixels() uses.
+ * \param width The width of the area.
+ * \param height The height of the area.
+ * \param done Called with the pixels once they are available.
+ * \param data User data passed to done.
+ *
+ * This has the same semantics as the renderer's read_pixels(), except that
+ * the pixels are handed to done instead of being written into a caller
+ * buffer. Renderers that can read back asynchronously call done from the
+ * event loop once the GPU has finished, others call it before returning.
+ * Requests complete in the order they were made.
+ */
+WL_EXPORT void
+weston_renderer_read_pixels_async(struct weston_output *output,
+				  const struct pixel_format_info *format,
+				  uint32_t x, uint32_t y,
+				  uint32_t width, uint32_t height,
+				  weston_renderer_read_pixels_done_func_t done,
+				  void *data)
+{
+	struct weston_renderer *r = output->compositor->renderer;
+	int stride = width * (format->bpp / 8);
+	void *pixels;
+
+	if (r->read_pixels_async) {
+		r->read_pixels_async(output, format, x, y, width, height,
+				     done, data);
+		return;
+	}
+
+	pixels = malloc(stride * height);
+	if (!pixels ||
+	    r->read_pixels(output, format, pixels, x, y, width, height) < 0)
+		done(data, NULL, 0);
+	else
+		done(data, pixels, stride);
+	free(pixels);
+}
+
 /** Queue a frame timer callback
  *
  * \param output The output to queue a frame timer callback for.
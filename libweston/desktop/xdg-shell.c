@@ -108,6 +108,10 @@ struct weston_desktop_xdg_toplevel {
 
 	struct wl_resource *resource;
 	bool added;
+	/* During an interactive resize, a new size is only sent once the
+	 * client has acked and committed the last one. */
+	bool resize_in_flight;
+	bool resize_held;
 	struct {
 		struct weston_desktop_xdg_toplevel_state state;
 		struct weston_size size;
@@ -614,6 +618,8 @@ weston_desktop_xdg_toplevel_send_configure(struct weston_desktop_xdg_toplevel *t
 
 	configure->state = toplevel->pending.state;
 	configure->size = toplevel->pending.size;
+	toplevel->resize_in_flight = toplevel->pending.state.resizing;
+	toplevel->resize_held = false;
 
 	wl_array_init(&states);
 	if (toplevel->pending.state.maximized) {
@@ -793,6 +799,15 @@ weston_desktop_xdg_toplevel_committed(struct weston_desktop_xdg_toplevel *toplev
 	weston_desktop_api_committed(toplevel->base.desktop,
 				     toplevel->base.desktop_surface,
 				     buf_offset);
+
+	/* The client has drawn every size sent so far. */
+	if (wl_list_empty(&toplevel->base.configure_list)) {
+		toplevel->resize_in_flight = false;
+		if (toplevel->resize_held) {
+			toplevel->resize_held = false;
+			weston_desktop_xdg_surface_schedule_configure(&toplevel->base);
+		}
+	}
 }
 
 static void
@@ -1155,6 +1170,37 @@ weston_desktop_xdg_surface_send_configure(void *user_data)
 	xdg_surface_send_configure(surface->resource, configure->serial);
 }
 
+static void
+weston_desktop_xdg_toplevel_get_configured(struct weston_desktop_xdg_toplevel *toplevel,
+					   struct weston_desktop_xdg_toplevel_state *state,
+					   struct weston_size *size)
+{
+	if (wl_list_empty(&toplevel->base.configure_list)) {
+		/* Last configure is actually the current state, just use it */
+		*state = toplevel->current.state;
+		size->width = toplevel->base.surface->width;
+		size->height = toplevel->base.surface->height;
+	} else {
+		struct weston_desktop_xdg_toplevel_configure *configure =
+			wl_container_of(toplevel->base.configure_list.prev,
+					configure, base.link);
+
+		*state = configure->state;
+		*size = configure->size;
+	}
+}
+
+static bool
+weston_desktop_xdg_toplevel_states_equal(const struct weston_desktop_xdg_toplevel_state *a,
+					 const struct weston_desktop_xdg_toplevel_state *b)
+{
+	return a->activated == b->activated &&
+	       a->fullscreen == b->fullscreen &&
+	       a->maximized == b->maximized &&
+	       a->resizing == b->resizing &&
+	       a->tiled_orientation == b->tiled_orientation;
+}
+
 static bool
 weston_desktop_xdg_toplevel_state_compare(struct weston_desktop_xdg_toplevel *toplevel)
 {
@@ -1166,30 +1212,11 @@ weston_desktop_xdg_toplevel_state_compare(struct weston_desktop_xdg_toplevel *to
 	if (!toplevel->base.configured)
 		return false;
 
-	if (wl_list_empty(&toplevel->base.configure_list)) {
-		/* Last configure is actually the current state, just use it */
-		configured.state = toplevel->current.state;
-		configured.size.width = toplevel->base.surface->width;
-		configured.size.height = toplevel->base.surface->height;
-	} else {
-		struct weston_desktop_xdg_toplevel_configure *configure =
-			wl_container_of(toplevel->base.configure_list.prev,
-					configure, base.link);
-
-		configured.state = configure->state;
-		configured.size = configure->size;
-	}
+	weston_desktop_xdg_toplevel_get_configured(toplevel, &configured.state,
+						   &configured.size);
 
-	if (toplevel->pending.state.activated != configured.state.activated)
-		return false;
-	if (toplevel->pending.state.fullscreen != configured.state.fullscreen)
-		return false;
-	if (toplevel->pending.state.maximized != configured.state.maximized)
-		return false;
-	if (toplevel->pending.state.resizing != configured.state.resizing)
-		return false;
-	if (toplevel->pending.state.tiled_orientation !=
-	    configured.state.tiled_orientation)
+	if (!weston_desktop_xdg_toplevel_states_equal(&toplevel->pending.state,
+						      &configured.state))
 		return false;
 
 	if (toplevel->pending.size.width == configured.size.width &&
@@ -1203,11 +1230,32 @@ weston_desktop_xdg_toplevel_state_compare(struct weston_desktop_xdg_toplevel *to
 	return false;
 }
 
+/* Whether a new size should wait for the client to catch up with the last
+ * one. Clients given a size per pointer motion reallocate buffers for sizes
+ * that are never shown; pacing by their ack and commit gives them one
+ * size per frame they draw. State changes, such as the resize ending, are
+ * never held back. */
+static bool
+weston_desktop_xdg_toplevel_resize_throttled(struct weston_desktop_xdg_toplevel *toplevel)
+{
+	struct weston_desktop_xdg_toplevel_state state;
+	struct weston_size size;
+
+	if (!toplevel->resize_in_flight || !toplevel->pending.state.resizing)
+		return false;
+
+	weston_desktop_xdg_toplevel_get_configured(toplevel, &state, &size);
+
+	return weston_desktop_xdg_toplevel_states_equal(&toplevel->pending.state,
+							&state);
+}
+
 static void
 weston_desktop_xdg_surface_schedule_configure(struct weston_desktop_xdg_surface *surface)
 {
 	struct wl_display *display = weston_desktop_get_display(surface->desktop);
 	struct wl_event_loop *loop = wl_display_get_event_loop(display);
+	struct weston_desktop_xdg_toplevel *toplevel;
 	bool pending_same = false;
 
 	switch (surface->role) {
@@ -1215,7 +1263,13 @@ weston_desktop_xdg_surface_schedule_configure(struct weston_desktop_xdg_surface
 		assert(0 && "not reached");
 		break;
 	case WESTON_DESKTOP_XDG_SURFACE_ROLE_TOPLEVEL:
-		pending_same = weston_desktop_xdg_toplevel_state_compare((struct weston_desktop_xdg_toplevel *) surface);
+		toplevel = (struct weston_desktop_xdg_toplevel *) surface;
+		pending_same = weston_desktop_xdg_toplevel_state_compare(toplevel);
+		if (!pending_same && surface->configure_idle == NULL &&
+		    weston_desktop_xdg_toplevel_resize_throttled(toplevel)) {
+			toplevel->resize_held = true;
+			return;
+		}
 		break;
 	case WESTON_DESKTOP_XDG_SURFACE_ROLE_POPUP:
 		break;
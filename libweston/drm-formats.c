@@ -26,11 +26,105 @@
 #include "config.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include <libweston/libweston.h>
 #include "libweston-internal.h"
 #include "shared/weston-drm-fourcc.h"
 
+static inline unsigned int
+format_array_count(const struct weston_drm_format_array *formats)
+{
+	return formats->arr.size / sizeof(struct weston_drm_format);
+}
+
+/* Index of the first format not below the given one */
+static unsigned int
+format_array_lower_bound(const struct weston_drm_format_array *formats,
+			 uint32_t format)
+{
+	const struct weston_drm_format *fmts = formats->arr.data;
+	unsigned int lo = 0, hi = format_array_count(formats);
+	unsigned int mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (fmts[mid].format < format)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Index of the first modifier not below the given one */
+static unsigned int
+modifiers_lower_bound(const uint64_t *modifiers, unsigned int num_modifiers,
+		      uint64_t modifier)
+{
+	unsigned int lo = 0, hi = num_modifiers;
+	unsigned int mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (modifiers[mid] < modifier)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static int
+modifiers_append(struct wl_array *modifiers, uint64_t modifier)
+{
+	uint64_t *mod;
+
+	mod = wl_array_add(modifiers, sizeof(*mod));
+	if (!mod) {
+		weston_log("%s: out of memory\n", __func__);
+		return -1;
+	}
+	*mod = modifier;
+
+	return 0;
+}
+
+/* Add a format past all formats in the array, keeping it sorted. */
+static struct weston_drm_format *
+format_array_append(struct weston_drm_format_array *formats, uint32_t format)
+{
+	struct weston_drm_format *fmt;
+	unsigned int count = format_array_count(formats);
+
+	assert(count == 0 ||
+	       ((struct weston_drm_format *)formats->arr.data)[count - 1].format < format);
+
+	fmt = wl_array_add(&formats->arr, sizeof(*fmt));
+	if (!fmt) {
+		weston_log("%s: out of memory\n", __func__);
+		return NULL;
+	}
+
+	fmt->format = format;
+	wl_array_init(&fmt->modifiers);
+	formats->latest = count;
+
+	return fmt;
+}
+
+/* Hand the result of a set operation over to formats. */
+static void
+format_array_move(struct weston_drm_format_array *formats,
+		  struct weston_drm_format_array *result)
+{
+	weston_drm_format_array_fini(formats);
+	*formats = *result;
+	weston_drm_format_array_init(result);
+}
+
 /**
  * Initialize a weston_drm_format_array
  *
@@ -40,6 +134,7 @@ WL_EXPORT void
 weston_drm_format_array_init(struct weston_drm_format_array *formats)
 {
 	wl_array_init(&formats->arr);
+	formats->latest = 0;
 }
 
 /**
@@ -61,26 +156,6 @@ weston_drm_format_array_fini(struct weston_drm_format_array *formats)
 	wl_array_release(&formats->arr);
 }
 
-static int
-add_format_and_modifiers(struct weston_drm_format_array *formats,
-			 uint32_t format, struct wl_array *modifiers)
-{
-	struct weston_drm_format *fmt;
-	int ret;
-
-	fmt = weston_drm_format_array_add_format(formats, format);
-	if (!fmt)
-		return -1;
-
-	ret = wl_array_copy(&fmt->modifiers, modifiers);
-	if (ret < 0) {
-		weston_log("%s: out of memory\n", __func__);
-		return -1;
-	}
-
-	return 0;
-}
-
 /**
  * Replace the content of a weston_drm_format_array
  *
@@ -96,17 +171,20 @@ WL_EXPORT int
 weston_drm_format_array_replace(struct weston_drm_format_array *formats,
 				const struct weston_drm_format_array *source_formats)
 {
-	struct weston_drm_format *source_fmt;
-	int ret;
+	struct weston_drm_format *source_fmt, *fmt;
 
 	weston_drm_format_array_fini(formats);
 	weston_drm_format_array_init(formats);
 
 	wl_array_for_each(source_fmt, &source_formats->arr) {
-		ret = add_format_and_modifiers(formats, source_fmt->format,
-					       &source_fmt->modifiers);
-		if (ret < 0)
+		fmt = format_array_append(formats, source_fmt->format);
+		if (!fmt)
 			return -1;
+
+		if (wl_array_copy(&fmt->modifiers, &source_fmt->modifiers) < 0) {
+			weston_log("%s: out of memory\n", __func__);
+			return -1;
+		}
 	}
 
 	return 0;
@@ -115,7 +193,9 @@ weston_drm_format_array_replace(struct weston_drm_format_array *formats,
 /**
  * Add format to weston_drm_format_array
  *
- * Adding repeated formats is considered an error.
+ * Adding repeated formats is considered an error. The format is inserted at
+ * its sorted position, so pointers to other formats of the array are
+ * invalidated.
  *
  * @param formats The weston_drm_format_array that receives the format
  * @param format The format to add to the array
@@ -126,18 +206,24 @@ weston_drm_format_array_add_format(struct weston_drm_format_array *formats,
 				   uint32_t format)
 {
 	struct weston_drm_format *fmt;
+	unsigned int count = format_array_count(formats);
+	unsigned int pos = format_array_lower_bound(formats, format);
 
 	/* We should not try to add repeated formats to an array. */
-	assert(!weston_drm_format_array_find_format(formats, format));
+	assert(pos == count ||
+	       ((struct weston_drm_format *)formats->arr.data)[pos].format != format);
 
-	fmt = wl_array_add(&formats->arr, sizeof(*fmt));
-	if (!fmt) {
+	if (!wl_array_add(&formats->arr, sizeof(*fmt))) {
 		weston_log("%s: out of memory\n", __func__);
 		return NULL;
 	}
 
+	fmt = (struct weston_drm_format *)formats->arr.data + pos;
+	memmove(fmt + 1, fmt, (count - pos) * sizeof(*fmt));
+
 	fmt->format = format;
 	wl_array_init(&fmt->modifiers);
+	formats->latest = pos;
 
 	return fmt;
 }
@@ -146,22 +232,23 @@ weston_drm_format_array_add_format(struct weston_drm_format_array *formats,
  * Remove latest format added to a weston_drm_format_array
  *
  * Calling this function for an empty array is an error, at least one element
- * must be in the array.
+ * must be in the array, and no other format may have been added or removed
+ * since the one to remove.
  *
  * @param formats The weston_drm_format_array from which the format is removed
  */
 WL_EXPORT void
 weston_drm_format_array_remove_latest_format(struct weston_drm_format_array *formats)
 {
-	struct wl_array *array = &formats->arr;
 	struct weston_drm_format *fmt;
+	unsigned int count = format_array_count(formats);
 
-	assert(array->size >= sizeof(*fmt));
-
-	array->size -= sizeof(*fmt);
+	assert(formats->latest < count);
 
-	fmt = array->data + array->size;
+	fmt = (struct weston_drm_format *)formats->arr.data + formats->latest;
 	wl_array_release(&fmt->modifiers);
+	memmove(fmt, fmt + 1, (count - formats->latest - 1) * sizeof(*fmt));
+	formats->arr.size -= sizeof(*fmt);
 }
 
 /**
@@ -175,11 +262,11 @@ WL_EXPORT struct weston_drm_format *
 weston_drm_format_array_find_format(const struct weston_drm_format_array *formats,
 				    uint32_t format)
 {
-	struct weston_drm_format *fmt;
+	struct weston_drm_format *fmts = formats->arr.data;
+	unsigned int pos = format_array_lower_bound(formats, format);
 
-	wl_array_for_each(fmt, &formats->arr)
-		if (fmt->format == format)
-			return fmt;
+	if (pos < format_array_count(formats) && fmts[pos].format == format)
+		return &fmts[pos];
 
 	return NULL;
 }
@@ -213,32 +300,111 @@ WL_EXPORT bool
 weston_drm_format_array_equal(const struct weston_drm_format_array *formats_A,
 			      const struct weston_drm_format_array *formats_B)
 {
-	struct weston_drm_format *fmt_A, *fmt_B;
-	const uint64_t *modifiers_A;
-	unsigned num_modifiers_A, num_modifiers_B;
+	const struct weston_drm_format *fmts_A = formats_A->arr.data;
+	const struct weston_drm_format *fmts_B = formats_B->arr.data;
 	unsigned int i;
 
 	if (formats_A->arr.size != formats_B->arr.size)
 		return false;
 
-	wl_array_for_each(fmt_A, &formats_A->arr) {
-		fmt_B = weston_drm_format_array_find_format(formats_B,
-							    fmt_A->format);
-		if (!fmt_B)
+	/* Both sorted, so equal sets match element by element. */
+	for (i = 0; i < format_array_count(formats_A); i++) {
+		if (fmts_A[i].format != fmts_B[i].format ||
+		    fmts_A[i].modifiers.size != fmts_B[i].modifiers.size)
 			return false;
-
-		modifiers_A = weston_drm_format_get_modifiers(fmt_A, &num_modifiers_A);
-		weston_drm_format_get_modifiers(fmt_B, &num_modifiers_B);
-		if (num_modifiers_A != num_modifiers_B)
+		if (fmts_A[i].modifiers.size &&
+		    memcmp(fmts_A[i].modifiers.data, fmts_B[i].modifiers.data,
+			   fmts_A[i].modifiers.size) != 0)
 			return false;
-		for (i = 0; i < num_modifiers_A; i++)
-			if (!weston_drm_format_has_modifier(fmt_B, modifiers_A[i]))
-				return false;
 	}
 
 	return true;
 }
 
+enum modifiers_op {
+	MODIFIERS_UNION,
+	MODIFIERS_INTERSECT,
+	MODIFIERS_SUBTRACT,
+};
+
+/* Merge two sorted modifier sets into result. */
+static int
+modifiers_merge(const struct weston_drm_format *fmt_A,
+		const struct weston_drm_format *fmt_B,
+		enum modifiers_op op, struct wl_array *result)
+{
+	const uint64_t *mods_A, *mods_B;
+	unsigned int num_A, num_B;
+	unsigned int i = 0, j = 0;
+	int ret = 0;
+
+	mods_A = weston_drm_format_get_modifiers(fmt_A, &num_A);
+	mods_B = weston_drm_format_get_modifiers(fmt_B, &num_B);
+
+	while (ret == 0 && (i < num_A || j < num_B)) {
+		if (j == num_B || (i < num_A && mods_A[i] < mods_B[j])) {
+			if (op != MODIFIERS_INTERSECT)
+				ret = modifiers_append(result, mods_A[i]);
+			i++;
+		} else if (i == num_A || mods_B[j] < mods_A[i]) {
+			if (op == MODIFIERS_UNION)
+				ret = modifiers_append(result, mods_B[j]);
+			j++;
+		} else {
+			if (op != MODIFIERS_SUBTRACT)
+				ret = modifiers_append(result, mods_A[i]);
+			i++;
+			j++;
+		}
+	}
+
+	return ret;
+}
+
+/* Append a copy of a format and its modifiers. */
+static int
+format_array_append_copy(struct weston_drm_format_array *formats,
+			 const struct weston_drm_format *source)
+{
+	struct weston_drm_format *fmt;
+
+	fmt = format_array_append(formats, source->format);
+	if (!fmt)
+		return -1;
+
+	if (wl_array_copy(&fmt->modifiers,
+			  (struct wl_array *)&source->modifiers) < 0) {
+		weston_log("%s: out of memory\n", __func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Append the result of merging the modifiers of a format present in both
+ * arrays. Intersection and subtraction drop the format if no modifier is
+ * left. */
+static int
+format_array_append_merged(struct weston_drm_format_array *formats,
+			   const struct weston_drm_format *fmt_A,
+			   const struct weston_drm_format *fmt_B,
+			   enum modifiers_op op)
+{
+	struct weston_drm_format *fmt;
+
+	fmt = format_array_append(formats, fmt_A->format);
+	if (!fmt)
+		return -1;
+
+	if (modifiers_merge(fmt_A, fmt_B, op, &fmt->modifiers) < 0)
+		return -1;
+
+	if (op != MODIFIERS_UNION && fmt->modifiers.size == 0)
+		weston_drm_format_array_remove_latest_format(formats);
+
+	return 0;
+}
+
 /**
  * Joins two weston_drm_format_array, keeping the result in A
  *
@@ -250,58 +416,43 @@ WL_EXPORT int
 weston_drm_format_array_join(struct weston_drm_format_array *formats_A,
 			     const struct weston_drm_format_array *formats_B)
 {
-	struct weston_drm_format *fmt_A, *fmt_B;
-	const uint64_t *modifiers;
-	unsigned int num_modifiers;
-	unsigned int i;
-	int ret;
-
-	wl_array_for_each(fmt_B, &formats_B->arr) {
-		fmt_A = weston_drm_format_array_find_format(formats_A,
-							    fmt_B->format);
-		if (!fmt_A) {
-			fmt_A = weston_drm_format_array_add_format(formats_A,
-								   fmt_B->format);
-			if (!fmt_A)
-				return -1;
-		}
-
-		modifiers = weston_drm_format_get_modifiers(fmt_B, &num_modifiers);
-		for (i = 0; i < num_modifiers; i++) {
-			if (weston_drm_format_has_modifier(fmt_A, modifiers[i]))
-				continue;
-			ret = weston_drm_format_add_modifier(fmt_A, modifiers[i]);
-			if (ret < 0)
-				return -1;
-		}
-	}
-
-	return 0;
-}
+	struct weston_drm_format_array formats_result;
+	const struct weston_drm_format *fmts_A = formats_A->arr.data;
+	const struct weston_drm_format *fmts_B = formats_B->arr.data;
+	unsigned int num_A = format_array_count(formats_A);
+	unsigned int num_B = format_array_count(formats_B);
+	unsigned int i = 0, j = 0;
 
-static int
-modifiers_intersect(const struct weston_drm_format *fmt_A,
-		    const struct weston_drm_format *fmt_B,
-		    struct wl_array *modifiers_result)
-{
-	const uint64_t *modifiers;
-	unsigned int num_modifiers;
-	uint64_t *mod;
-	unsigned int i;
+	weston_drm_format_array_init(&formats_result);
 
-	modifiers = weston_drm_format_get_modifiers(fmt_A, &num_modifiers);
-	for (i = 0; i < num_modifiers; i++) {
-		if (!weston_drm_format_has_modifier(fmt_B, modifiers[i]))
-			continue;
-		mod = wl_array_add(modifiers_result, sizeof(modifiers[i]));
-		if (!mod) {
-			weston_log("%s: out of memory\n", __func__);
-			return -1;
+	while (i < num_A || j < num_B) {
+		if (j == num_B ||
+		    (i < num_A && fmts_A[i].format < fmts_B[j].format)) {
+			if (format_array_append_copy(&formats_result,
+						     &fmts_A[i]) < 0)
+				goto err;
+			i++;
+		} else if (i == num_A || fmts_B[j].format < fmts_A[i].format) {
+			if (format_array_append_copy(&formats_result,
+						     &fmts_B[j]) < 0)
+				goto err;
+			j++;
+		} else {
+			if (format_array_append_merged(&formats_result,
+						       &fmts_A[i], &fmts_B[j],
+						       MODIFIERS_UNION) < 0)
+				goto err;
+			i++;
+			j++;
 		}
-		*mod = modifiers[i];
 	}
 
+	format_array_move(formats_A, &formats_result);
 	return 0;
+
+err:
+	weston_drm_format_array_fini(&formats_result);
+	return -1;
 }
 
 /**
@@ -316,35 +467,30 @@ weston_drm_format_array_intersect(struct weston_drm_format_array *formats_A,
 				  const struct weston_drm_format_array *formats_B)
 {
 	struct weston_drm_format_array formats_result;
-	struct weston_drm_format *fmt_result, *fmt_A, *fmt_B;
-	int ret;
+	const struct weston_drm_format *fmts_A = formats_A->arr.data;
+	const struct weston_drm_format *fmts_B = formats_B->arr.data;
+	unsigned int num_A = format_array_count(formats_A);
+	unsigned int num_B = format_array_count(formats_B);
+	unsigned int i = 0, j = 0;
 
 	weston_drm_format_array_init(&formats_result);
 
-	wl_array_for_each(fmt_A, &formats_A->arr) {
-		fmt_B = weston_drm_format_array_find_format(formats_B,
-							    fmt_A->format);
-		if (!fmt_B)
-			continue;
-
-		fmt_result = weston_drm_format_array_add_format(&formats_result,
-								fmt_A->format);
-		if (!fmt_result)
-			goto err;
-
-		ret = modifiers_intersect(fmt_A, fmt_B, &fmt_result->modifiers);
-		if (ret < 0)
-			goto err;
-
-		if (fmt_result->modifiers.size == 0)
-			weston_drm_format_array_remove_latest_format(&formats_result);
+	while (i < num_A && j < num_B) {
+		if (fmts_A[i].format < fmts_B[j].format) {
+			i++;
+		} else if (fmts_B[j].format < fmts_A[i].format) {
+			j++;
+		} else {
+			if (format_array_append_merged(&formats_result,
+						       &fmts_A[i], &fmts_B[j],
+						       MODIFIERS_INTERSECT) < 0)
+				goto err;
+			i++;
+			j++;
+		}
 	}
 
-	ret = weston_drm_format_array_replace(formats_A, &formats_result);
-	if (ret < 0)
-		goto err;
-
-	weston_drm_format_array_fini(&formats_result);
+	format_array_move(formats_A, &formats_result);
 	return 0;
 
 err:
@@ -352,31 +498,6 @@ err:
 	return -1;
 }
 
-static int
-modifiers_subtract(const struct weston_drm_format *fmt_A,
-		   const struct weston_drm_format *fmt_B,
-		   struct wl_array *modifiers_result)
-{
-	const uint64_t *modifiers;
-	unsigned int num_modifiers;
-	uint64_t *mod;
-	unsigned int i;
-
-	modifiers = weston_drm_format_get_modifiers(fmt_A, &num_modifiers);
-	for (i = 0; i < num_modifiers; i++) {
-		if (weston_drm_format_has_modifier(fmt_B, modifiers[i]))
-			continue;
-		mod = wl_array_add(modifiers_result, sizeof(modifiers[i]));
-		if (!mod) {
-			weston_log("%s: out of memory\n", __func__);
-			return -1;
-		}
-		*mod = modifiers[i];
-	}
-
-	return 0;
-}
-
 /**
  * Compute the subtraction between two DRM-format arrays, keeping the result in A
  *
@@ -389,41 +510,31 @@ weston_drm_format_array_subtract(struct weston_drm_format_array *formats_A,
 				 const struct weston_drm_format_array *formats_B)
 {
 	struct weston_drm_format_array formats_result;
-	struct weston_drm_format *fmt_result, *fmt_A, *fmt_B;
-	int ret;
+	const struct weston_drm_format *fmts_A = formats_A->arr.data;
+	const struct weston_drm_format *fmts_B = formats_B->arr.data;
+	unsigned int num_A = format_array_count(formats_A);
+	unsigned int num_B = format_array_count(formats_B);
+	unsigned int i, j = 0;
 
 	weston_drm_format_array_init(&formats_result);
 
-	wl_array_for_each(fmt_A, &formats_A->arr) {
-		fmt_B = weston_drm_format_array_find_format(formats_B,
-							    fmt_A->format);
-		if (!fmt_B) {
-			ret = add_format_and_modifiers(&formats_result, fmt_A->format,
-						       &fmt_A->modifiers);
-			if (ret < 0)
-				goto err;
+	for (i = 0; i < num_A; i++) {
+		while (j < num_B && fmts_B[j].format < fmts_A[i].format)
+			j++;
 
+		if (j < num_B && fmts_B[j].format == fmts_A[i].format) {
+			if (format_array_append_merged(&formats_result,
+						       &fmts_A[i], &fmts_B[j],
+						       MODIFIERS_SUBTRACT) < 0)
+				goto err;
 			continue;
 		}
 
-		fmt_result = weston_drm_format_array_add_format(&formats_result,
-								fmt_A->format);
-		if (!fmt_result)
-			goto err;
-
-		ret = modifiers_subtract(fmt_A, fmt_B, &fmt_result->modifiers);
-		if (ret < 0)
+		if (format_array_append_copy(&formats_result, &fmts_A[i]) < 0)
 			goto err;
-
-		if (fmt_result->modifiers.size == 0)
-			weston_drm_format_array_remove_latest_format(&formats_result);
 	}
 
-	ret = weston_drm_format_array_replace(formats_A, &formats_result);
-	if (ret < 0)
-		goto err;
-
-	weston_drm_format_array_fini(&formats_result);
+	format_array_move(formats_A, &formats_result);
 	return 0;
 
 err:
@@ -445,17 +556,26 @@ WL_EXPORT int
 weston_drm_format_add_modifier(struct weston_drm_format *format,
 			       uint64_t modifier)
 {
-	uint64_t *mod;
+	unsigned int num_modifiers = format->modifiers.size / sizeof(uint64_t);
+	unsigned int pos;
+	uint64_t *mods;
+
+	pos = modifiers_lower_bound(format->modifiers.data, num_modifiers,
+				    modifier);
 
 	/* We should not try to add repeated modifiers to a set. */
-	assert(!weston_drm_format_has_modifier(format, modifier));
+	assert(pos == num_modifiers ||
+	       ((uint64_t *)format->modifiers.data)[pos] != modifier);
 
-	mod = wl_array_add(&format->modifiers, sizeof(*mod));
-	if (!mod) {
+	if (!wl_array_add(&format->modifiers, sizeof(*mods))) {
 		weston_log("%s: out of memory\n", __func__);
 		return -1;
 	}
-	*mod = modifier;
+
+	mods = format->modifiers.data;
+	memmove(&mods[pos + 1], &mods[pos],
+		(num_modifiers - pos) * sizeof(*mods));
+	mods[pos] = modifier;
 
 	return 0;
 }
@@ -474,19 +594,19 @@ weston_drm_format_has_modifier(const struct weston_drm_format *format,
 {
 	const uint64_t *modifiers;
 	unsigned int num_modifiers;
-	unsigned int i;
+	unsigned int pos;
 
 	modifiers = weston_drm_format_get_modifiers(format, &num_modifiers);
-	for (i = 0; i < num_modifiers; i++)
-		if (modifiers[i] == modifier)
-			return true;
+	pos = modifiers_lower_bound(modifiers, num_modifiers, modifier);
 
-	return false;
+	return pos < num_modifiers && modifiers[pos] == modifier;
 }
 
 /**
  * Get array of modifiers and modifiers count from a weston_drm_format
  *
+ * The modifiers are in ascending order.
+ *
  * @param format The weston_drm_format that contains the modifiers
  * @param count_out Parameter that receives the modifiers count
  * @return The array of modifiers
@@ -0,0 +1,355 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "frame-latency.h"
+#include "libweston-internal.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+
+/**
+ * Frame latency statistics: for every surface, the time from the commit
+ * of a new buffer to the presentation of the first frame showing it, and
+ * for every output, the same over all its surfaces plus the time from the
+ * start of a repaint to its presentation.
+ *
+ * A commit is stamped in weston_surface_commit_state(), handed to the
+ * surface's main output at repaint the same way presentation feedback is,
+ * and completed in weston_output_finish_frame() with the presentation
+ * timestamp the backend got, e.g. from the DRM page flip event. All
+ * times are on the presentation clock.
+ *
+ * The 'latency' debug scope prints the statistics gathered so far.
+ */
+
+static unsigned int
+weston_latency_bucket(uint64_t usec)
+{
+	unsigned int shift;
+
+	if (usec < WESTON_LATENCY_SUB_BUCKETS)
+		return usec;
+
+	shift = 63 - __builtin_clzll(usec) - WESTON_LATENCY_SUB_BITS;
+	if (shift >= WESTON_LATENCY_MAGNITUDES)
+		return (WESTON_LATENCY_MAGNITUDES + 1) *
+		       WESTON_LATENCY_SUB_BUCKETS - 1;
+
+	return (shift + 1) * WESTON_LATENCY_SUB_BUCKETS +
+	       (usec >> shift) - WESTON_LATENCY_SUB_BUCKETS;
+}
+
+/** Largest value counted in a bucket */
+static uint64_t
+weston_latency_bucket_max(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < WESTON_LATENCY_SUB_BUCKETS)
+		return bucket;
+
+	shift = bucket / WESTON_LATENCY_SUB_BUCKETS - 1;
+
+	return (((uint64_t) (bucket % WESTON_LATENCY_SUB_BUCKETS) +
+		 WESTON_LATENCY_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+void
+weston_latency_histogram_add(struct weston_latency_histogram *hist,
+			     int64_t nsec)
+{
+	uint64_t usec = nsec > 0 ? nsec / 1000 : 0;
+
+	hist->buckets[weston_latency_bucket(usec)]++;
+	hist->count++;
+	hist->sum_usec += usec;
+	hist->max_usec = MAX(hist->max_usec, usec);
+}
+
+/** Get a percentile of a histogram, in microseconds
+ *
+ * The value returned is the upper end of the bucket the percentile falls
+ * in, so it over-estimates by less than 1/16.
+ */
+uint64_t
+weston_latency_histogram_percentile(const struct weston_latency_histogram *hist,
+				    double percentile)
+{
+	uint64_t target, seen = 0;
+	unsigned int i;
+
+	if (hist->count == 0)
+		return 0;
+
+	target = (uint64_t) (hist->count * percentile / 100.0 + 0.5);
+	target = MAX(target, 1);
+
+	for (i = 0; i < ARRAY_LENGTH(hist->buckets); i++) {
+		seen += hist->buckets[i];
+		if (seen >= target)
+			return MIN(weston_latency_bucket_max(i), hist->max_usec);
+	}
+
+	return hist->max_usec;
+}
+
+/** Stamp a commit attaching a new buffer
+ *
+ * Only the oldest commit not yet repainted counts, so that frames a
+ * client commits faster than they are shown make the latency grow.
+ */
+void
+weston_surface_latency_commit(struct weston_surface *surface)
+{
+	struct weston_surface_latency *latency = surface->latency;
+
+	if (!latency) {
+		latency = xzalloc(sizeof(*latency));
+		wl_list_init(&latency->in_flight_link);
+		surface->latency = latency;
+	}
+
+	if (latency->commit_pending)
+		return;
+
+	weston_compositor_read_presentation_clock(surface->compositor,
+						  &latency->commit_time);
+	latency->commit_pending = true;
+}
+
+void
+weston_surface_latency_destroy(struct weston_surface *surface)
+{
+	if (!surface->latency)
+		return;
+
+	wl_list_remove(&surface->latency->in_flight_link);
+	free(surface->latency);
+	surface->latency = NULL;
+}
+
+void
+weston_output_latency_init(struct weston_output *output)
+{
+	output->latency = xzalloc(sizeof(*output->latency));
+	wl_list_init(&output->latency->in_flight);
+}
+
+static void
+weston_output_latency_discard(struct weston_output *output)
+{
+	struct weston_surface_latency *latency, *tmp;
+
+	wl_list_for_each_safe(latency, tmp, &output->latency->in_flight,
+			      in_flight_link) {
+		wl_list_remove(&latency->in_flight_link);
+		wl_list_init(&latency->in_flight_link);
+	}
+	output->latency->repaint_pending = false;
+}
+
+void
+weston_output_latency_release(struct weston_output *output)
+{
+	if (!output->latency)
+		return;
+
+	weston_output_latency_discard(output);
+	free(output->latency);
+	output->latency = NULL;
+}
+
+void
+weston_output_latency_repaint_begin(struct weston_output *output,
+				    const struct timespec *now)
+{
+	output->latency->repaint_time = *now;
+}
+
+/** Hand the pending commit of a surface repainted on its main output over
+ * to that output, as its presentation feedback is
+ */
+void
+weston_output_latency_take(struct weston_output *output,
+			   struct weston_surface *surface)
+{
+	struct weston_surface_latency *latency = surface->latency;
+
+	if (!latency || !latency->commit_pending)
+		return;
+
+	/* a surface going back to the screen before its last frame did */
+	if (!wl_list_empty(&latency->in_flight_link))
+		return;
+
+	latency->in_flight_time = latency->commit_time;
+	latency->commit_pending = false;
+	wl_list_insert(&output->latency->in_flight, &latency->in_flight_link);
+}
+
+void
+weston_output_latency_repaint_done(struct weston_output *output, bool ok)
+{
+	output->latency->repaint_pending = ok;
+}
+
+/** Give the frames in flight back to their surfaces when the repaint
+ * loop stops without presenting them
+ */
+void
+weston_output_latency_put_back(struct weston_output *output)
+{
+	struct weston_surface_latency *latency, *tmp;
+
+	wl_list_for_each_safe(latency, tmp, &output->latency->in_flight,
+			      in_flight_link) {
+		if (!latency->commit_pending) {
+			latency->commit_time = latency->in_flight_time;
+			latency->commit_pending = true;
+		}
+		wl_list_remove(&latency->in_flight_link);
+		wl_list_init(&latency->in_flight_link);
+	}
+	output->latency->repaint_pending = false;
+}
+
+/** Account the frames in flight as presented at stamp, or drop them if
+ * stamp is NULL because the backend does not know when they were
+ */
+void
+weston_output_latency_present(struct weston_output *output,
+			      const struct timespec *stamp)
+{
+	struct weston_output_latency *out = output->latency;
+	struct weston_surface_latency *latency, *tmp;
+	int64_t nsec;
+
+	if (!stamp) {
+		weston_output_latency_discard(output);
+		return;
+	}
+
+	if (out->repaint_pending) {
+		weston_latency_histogram_add(&out->repaint,
+					     timespec_sub_to_nsec(stamp,
+								  &out->repaint_time));
+		out->repaint_pending = false;
+	}
+
+	wl_list_for_each_safe(latency, tmp, &out->in_flight, in_flight_link) {
+		nsec = timespec_sub_to_nsec(stamp, &latency->in_flight_time);
+		weston_latency_histogram_add(&latency->commit, nsec);
+		weston_latency_histogram_add(&out->commit, nsec);
+
+		wl_list_remove(&latency->in_flight_link);
+		wl_list_init(&latency->in_flight_link);
+	}
+}
+
+static void
+weston_latency_histogram_print(struct weston_log_subscription *sub,
+			       const char *what,
+			       const struct weston_latency_histogram *hist)
+{
+	weston_log_subscription_printf(sub,
+		"\t%s: count=%" PRIu64 " mean_us=%" PRIu64
+		" p50_us=%" PRIu64 " p90_us=%" PRIu64 " p99_us=%" PRIu64
+		" max_us=%" PRIu64 "\n",
+		what, hist->count,
+		hist->count ? hist->sum_usec / hist->count : 0,
+		weston_latency_histogram_percentile(hist, 50.0),
+		weston_latency_histogram_percentile(hist, 90.0),
+		weston_latency_histogram_percentile(hist, 99.0),
+		hist->max_usec);
+}
+
+/* Whether pnode is the first paint node of its surface in the list */
+static bool
+paint_node_is_first_of_surface(struct weston_output *output,
+			       struct weston_paint_node *pnode)
+{
+	struct weston_paint_node *it;
+
+	wl_list_for_each(it, &output->paint_node_z_order_list, z_order_link) {
+		if (it == pnode)
+			return true;
+		if (it->surface == pnode->surface)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Called when the 'latency' debug scope is bound by a client. This
+ * one-shot weston-debug scope prints the latency statistics gathered since
+ * each output was created and each surface first committed, and then
+ * terminates the stream.
+ */
+void
+weston_latency_debug_scope_cb(struct weston_log_subscription *sub, void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_output *output;
+	struct weston_paint_node *pnode;
+	struct weston_surface *surface;
+	char desc[512];
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		weston_log_subscription_printf(sub, "Output %u (%s):\n",
+					       output->id, output->name);
+		weston_latency_histogram_print(sub, "commit-to-present",
+					       &output->latency->commit);
+		weston_latency_histogram_print(sub, "repaint-to-present",
+					       &output->latency->repaint);
+
+		wl_list_for_each(pnode, &output->paint_node_z_order_list,
+				 z_order_link) {
+			surface = pnode->surface;
+			if (surface->output != output || !surface->latency ||
+			    !surface->latency->commit.count ||
+			    !paint_node_is_first_of_surface(output, pnode))
+				continue;
+
+			if (!surface->get_label ||
+			    surface->get_label(surface, desc, sizeof(desc)) < 0)
+				strcpy(desc, "[no description available]");
+
+			weston_log_subscription_printf(sub, "\tSurface %s:\n",
+						       desc);
+			weston_latency_histogram_print(sub, "\tcommit-to-present",
+						       &surface->latency->commit);
+		}
+	}
+
+	weston_log_subscription_complete(sub);
+}
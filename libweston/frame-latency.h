@@ -0,0 +1,123 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_FRAME_LATENCY_H
+#define WESTON_FRAME_LATENCY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <wayland-util.h>
+
+struct weston_log_subscription;
+struct weston_output;
+struct weston_surface;
+
+/** Sub-buckets per power of two: latencies are kept to within 1/16 */
+#define WESTON_LATENCY_SUB_BITS 4
+#define WESTON_LATENCY_SUB_BUCKETS (1 << WESTON_LATENCY_SUB_BITS)
+/** Powers of two covered, from 1 us to about 30 s */
+#define WESTON_LATENCY_MAGNITUDES 21
+
+/** Log-linear histogram of latencies in microseconds, like an HDR
+ * histogram with a fixed precision of WESTON_LATENCY_SUB_BITS bits
+ */
+struct weston_latency_histogram {
+	uint64_t count;
+	uint64_t sum_usec;
+	uint64_t max_usec;
+	uint32_t buckets[WESTON_LATENCY_MAGNITUDES * WESTON_LATENCY_SUB_BUCKETS +
+			 WESTON_LATENCY_SUB_BUCKETS];
+};
+
+/** Latency statistics of a surface, allocated on its first commit */
+struct weston_surface_latency {
+	/** commit to presentation, for the surface's main output */
+	struct weston_latency_histogram commit;
+
+	bool commit_pending;		/**< committed, but not yet repainted */
+	struct timespec commit_time;	/**< oldest such commit */
+
+	struct wl_list in_flight_link;	/**< weston_output_latency::in_flight */
+	struct timespec in_flight_time;	/**< commit time of the frame in flight */
+};
+
+/** Latency statistics of an output */
+struct weston_output_latency {
+	/** commit to presentation, of all surfaces on the output */
+	struct weston_latency_histogram commit;
+	/** start of repaint to presentation */
+	struct weston_latency_histogram repaint;
+
+	bool repaint_pending;		/**< repainted, awaiting finish_frame */
+	struct timespec repaint_time;
+
+	struct wl_list in_flight;	/**< weston_surface_latency::in_flight_link */
+};
+
+void
+weston_latency_histogram_add(struct weston_latency_histogram *hist,
+			     int64_t nsec);
+
+uint64_t
+weston_latency_histogram_percentile(const struct weston_latency_histogram *hist,
+				    double percentile);
+
+void
+weston_surface_latency_commit(struct weston_surface *surface);
+
+void
+weston_surface_latency_destroy(struct weston_surface *surface);
+
+void
+weston_output_latency_init(struct weston_output *output);
+
+void
+weston_output_latency_release(struct weston_output *output);
+
+void
+weston_output_latency_repaint_begin(struct weston_output *output,
+				    const struct timespec *now);
+
+void
+weston_output_latency_take(struct weston_output *output,
+			   struct weston_surface *surface);
+
+void
+weston_output_latency_repaint_done(struct weston_output *output, bool ok);
+
+void
+weston_output_latency_put_back(struct weston_output *output);
+
+void
+weston_output_latency_present(struct weston_output *output,
+			      const struct timespec *stamp);
+
+void
+weston_latency_debug_scope_cb(struct weston_log_subscription *sub,
+			      void *data);
+
+#endif /* WESTON_FRAME_LATENCY_H */
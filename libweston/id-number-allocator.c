@@ -25,6 +25,8 @@
 
 #include "config.h"
 
+#include <strings.h>
+
 #include "id-number-allocator.h"
 #include "shared/helpers.h"
 #include "shared/xalloc.h"
@@ -124,25 +126,18 @@ weston_idalloc_get_id(struct weston_idalloc *idalloc)
 	/* Sanity check: lowest free bucket should not be full. */
 	weston_assert_uint32_neq(idalloc->compositor, *bucket, 0xffffffff);
 
-	for (i = 0; i < 32; i++) {
-		/* Id already used, skip it. */
-		if ((*bucket >> i) & 1)
-			continue;
+	/* The lowest free id is the lowest zero bit on the bucket. */
+	i = ffs(~*bucket) - 1;
 
-		/* Found free id, take it and set it to 1 on the bucket. */
-		*bucket |= 1 << i;
-		id = (32 * idalloc->lowest_free_bucket) + i;
+	/* Take it and set it to 1 on the bucket. */
+	*bucket |= 1u << i;
+	id = (32 * idalloc->lowest_free_bucket) + i;
 
-		/* Bucket may become full... */
-		if (*bucket == 0xffffffff)
-			update_lowest_free_bucket(idalloc);
-
-		return id;
-	}
+	/* Bucket may become full... */
+	if (*bucket == 0xffffffff)
+		update_lowest_free_bucket(idalloc);
 
-	/* We need to find an available id. */
-	weston_assert_not_reached(idalloc->compositor,
-				  "should be able to allocate unique id");
+	return id;
 }
 
 /**
@@ -181,5 +176,5 @@ weston_idalloc_put_id(struct weston_idalloc *idalloc, uint32_t id)
 		idalloc->lowest_free_bucket = bucket_index;
 
 	/* Zero the bit on the bucket. */
-	*bucket &= ~(1 << id_index_on_bucket);
+	*bucket &= ~(1u << id_index_on_bucket);
 }
@@ -285,6 +285,150 @@ weston_pointer_cleanup_pointer_client(struct weston_pointer *pointer,
 	}
 }
 
+/** Input resources of a client on a seat
+ *
+ * Holds the wl_keyboard, wl_touch and tablet resources of the client that
+ * are not in the focus list of their device. A focus change then moves
+ * the resources of one client at once, instead of picking them out of
+ * those of every client bound to the seat.
+ */
+struct weston_seat_client {
+	struct weston_seat *seat;
+	struct wl_list link;		/* weston_seat::client_list */
+	struct wl_list client_link;	/* weston_input_client::seat_client_list */
+
+	struct wl_list keyboard_resources;
+	struct wl_list touch_resources;
+	struct wl_list tablet_resources;	/* of every tablet */
+	struct wl_list tablet_tool_resources;	/* of every tool */
+};
+
+/** The seat clients of a client, found through its destroy listener */
+struct weston_input_client {
+	struct wl_listener destroy_listener;
+	struct wl_list seat_client_list;	/* weston_seat_client::client_link */
+};
+
+static void
+weston_seat_client_destroy(struct weston_seat_client *seat_client)
+{
+	/* Resources left in the lists stay linked to each other only, and
+	 * unlink themselves when they are destroyed. */
+	wl_list_remove(&seat_client->keyboard_resources);
+	wl_list_remove(&seat_client->touch_resources);
+	wl_list_remove(&seat_client->tablet_resources);
+	wl_list_remove(&seat_client->tablet_tool_resources);
+	wl_list_remove(&seat_client->link);
+	wl_list_remove(&seat_client->client_link);
+	free(seat_client);
+}
+
+/* Clients are destroyed before their resources, so the seat clients go
+ * first and leave the resources to themselves. */
+static void
+input_client_destroyed(struct wl_listener *listener, void *data)
+{
+	struct weston_input_client *input_client =
+		container_of(listener, struct weston_input_client,
+			     destroy_listener);
+	struct weston_seat_client *seat_client, *tmp;
+
+	wl_list_for_each_safe(seat_client, tmp,
+			      &input_client->seat_client_list, client_link)
+		weston_seat_client_destroy(seat_client);
+
+	free(input_client);
+}
+
+static struct weston_seat_client *
+weston_seat_get_client(struct weston_seat *seat, struct wl_client *client)
+{
+	struct weston_input_client *input_client;
+	struct weston_seat_client *seat_client;
+	struct wl_listener *listener;
+
+	listener = wl_client_get_destroy_listener(client,
+						  input_client_destroyed);
+	if (!listener)
+		return NULL;
+
+	input_client = container_of(listener, struct weston_input_client,
+				    destroy_listener);
+	wl_list_for_each(seat_client, &input_client->seat_client_list,
+			 client_link) {
+		if (seat_client->seat == seat)
+			return seat_client;
+	}
+
+	return NULL;
+}
+
+static struct weston_seat_client *
+weston_seat_ensure_client(struct weston_seat *seat, struct wl_client *client)
+{
+	struct weston_input_client *input_client;
+	struct weston_seat_client *seat_client;
+	struct wl_listener *listener;
+
+	seat_client = weston_seat_get_client(seat, client);
+	if (seat_client)
+		return seat_client;
+
+	listener = wl_client_get_destroy_listener(client,
+						  input_client_destroyed);
+	if (listener) {
+		input_client = container_of(listener,
+					    struct weston_input_client,
+					    destroy_listener);
+	} else {
+		input_client = zalloc(sizeof *input_client);
+		if (!input_client)
+			return NULL;
+
+		wl_list_init(&input_client->seat_client_list);
+		input_client->destroy_listener.notify = input_client_destroyed;
+		wl_client_add_destroy_listener(client,
+					       &input_client->destroy_listener);
+	}
+
+	seat_client = zalloc(sizeof *seat_client);
+	if (!seat_client)
+		return NULL;
+
+	seat_client->seat = seat;
+	wl_list_init(&seat_client->keyboard_resources);
+	wl_list_init(&seat_client->touch_resources);
+	wl_list_init(&seat_client->tablet_resources);
+	wl_list_init(&seat_client->tablet_tool_resources);
+	wl_list_insert(&seat->client_list, &seat_client->link);
+	wl_list_insert(&input_client->seat_client_list,
+		       &seat_client->client_link);
+
+	return seat_client;
+}
+
+static struct weston_seat_client *
+weston_seat_get_client_for_surface(struct weston_seat *seat,
+				   struct weston_surface *surface)
+{
+	if (!surface || !surface->resource)
+		return NULL;
+
+	return weston_seat_get_client(seat,
+				      wl_resource_get_client(surface->resource));
+}
+
+/* The seat client the resources in a non-empty focus list came from */
+static struct weston_seat_client *
+weston_seat_get_focus_client(struct weston_seat *seat,
+			     struct wl_list *focus_resource_list)
+{
+	struct wl_resource *resource =
+		wl_resource_from_link(focus_resource_list->next);
+
+	return weston_seat_get_client(seat, wl_resource_get_client(resource));
+}
+
 static void
 unbind_pointer_client_resource(struct wl_resource *resource)
 {
@@ -453,19 +597,20 @@ move_resources(struct wl_list *destination, struct wl_list *source)
 	wl_list_init(source);
 }
 
+/* Empties a focus list into the list of the client the resources belong
+ * to. Without one, the client is going away, and its resources are left
+ * linked to each other until they are destroyed too. */
 static void
-move_resources_for_client(struct wl_list *destination,
-			  struct wl_list *source,
-			  struct wl_client *client)
+release_focus_resources(struct wl_list *destination,
+			struct wl_list *focus_resource_list)
 {
-	struct wl_resource *resource, *tmp;
-	wl_resource_for_each_safe(resource, tmp, source) {
-		if (wl_resource_get_client(resource) == client) {
-			wl_list_remove(wl_resource_get_link(resource));
-			wl_list_insert(destination,
-				       wl_resource_get_link(resource));
-		}
+	if (destination) {
+		move_resources(destination, focus_resource_list);
+		return;
 	}
+
+	wl_list_remove(focus_resource_list);
+	wl_list_init(focus_resource_list);
 }
 
 static void
@@ -1086,20 +1231,21 @@ send_modifiers_to_resource(struct weston_keyboard *keyboard,
 				   keyboard->modifiers.group);
 }
 
+/* To the wl_keyboard resources of a client without keyboard focus */
 static void
-send_modifiers_to_client_in_list(struct wl_client *client,
-				 struct wl_list *list,
-				 uint32_t serial,
-				 struct weston_keyboard *keyboard)
+send_modifiers_to_client(struct weston_keyboard *keyboard,
+			 struct wl_client *client,
+			 uint32_t serial)
 {
+	struct weston_seat_client *seat_client;
 	struct wl_resource *resource;
 
-	wl_resource_for_each(resource, list) {
-		if (wl_resource_get_client(resource) == client)
-			send_modifiers_to_resource(keyboard,
-						   resource,
-						   serial);
-	}
+	seat_client = weston_seat_get_client(keyboard->seat, client);
+	if (!seat_client)
+		return;
+
+	wl_resource_for_each(resource, &seat_client->keyboard_resources)
+		send_modifiers_to_resource(keyboard, resource, serial);
 }
 
 static struct weston_pointer_client *
@@ -1127,28 +1273,6 @@ find_pointer_client_for_view(struct weston_pointer *pointer, struct weston_view
 	return find_pointer_client_for_surface(pointer, view->surface);
 }
 
-static struct wl_resource *
-find_resource_for_surface(struct wl_list *list, struct weston_surface *surface)
-{
-	if (!surface)
-		return NULL;
-
-	if (!surface->resource)
-		return NULL;
-
-	return wl_resource_find_for_client(list, wl_resource_get_client(surface->resource));
-}
-
-static struct wl_resource *
-find_resource_for_view(struct wl_list *list, struct weston_view *view)
-{
-	if (!view)
-		return NULL;
-
-	return find_resource_for_surface(list,
-					 view->surface);
-}
-
 /** Send wl_keyboard.modifiers events to focused resources and pointer
  *  focused resources.
  *
@@ -1191,10 +1315,7 @@ weston_keyboard_send_modifiers(struct weston_keyboard *keyboard,
 		struct wl_client *pointer_client =
 			wl_resource_get_client(pointer->focus->surface->resource);
 
-		send_modifiers_to_client_in_list(pointer_client,
-						 &keyboard->resource_list,
-						 serial,
-						 keyboard);
+		send_modifiers_to_client(keyboard, pointer_client, serial);
 	}
 }
 
@@ -1333,7 +1454,6 @@ weston_keyboard_create(void)
 	if (keyboard == NULL)
 	    return NULL;
 
-	wl_list_init(&keyboard->resource_list);
 	wl_list_init(&keyboard->focus_resource_list);
 	wl_list_init(&keyboard->focus_resource_listener.link);
 	keyboard->focus_resource_listener.notify = keyboard_focus_resource_destroyed;
@@ -1353,17 +1473,19 @@ weston_xkb_info_destroy(struct weston_xkb_info *xkb_info);
 static void
 weston_keyboard_destroy(struct weston_keyboard *keyboard)
 {
+	struct weston_seat_client *seat_client;
 	struct wl_resource *resource;
 
-	wl_resource_for_each(resource, &keyboard->resource_list) {
-		wl_resource_set_user_data(resource, NULL);
+	wl_list_for_each(seat_client, &keyboard->seat->client_list, link) {
+		wl_resource_for_each(resource,
+				     &seat_client->keyboard_resources)
+			wl_resource_set_user_data(resource, NULL);
 	}
 
 	wl_resource_for_each(resource, &keyboard->focus_resource_list) {
 		wl_resource_set_user_data(resource, NULL);
 	}
 
-	wl_list_remove(&keyboard->resource_list);
 	wl_list_remove(&keyboard->focus_resource_list);
 
 	xkb_state_unref(keyboard->xkb_state.state);
@@ -1393,7 +1515,6 @@ weston_touch_create(void)
 		return NULL;
 
 	wl_list_init(&touch->device_list);
-	wl_list_init(&touch->resource_list);
 	wl_list_init(&touch->focus_resource_list);
 	wl_list_init(&touch->focus_view_listener.link);
 	touch->focus_view_listener.notify = touch_focus_view_destroyed;
@@ -1411,19 +1532,20 @@ weston_touch_create(void)
 static void
 weston_touch_destroy(struct weston_touch *touch)
 {
+	struct weston_seat_client *seat_client;
 	struct wl_resource *resource;
 
 	assert(wl_list_empty(&touch->device_list));
 
-	wl_resource_for_each(resource, &touch->resource_list) {
-		wl_resource_set_user_data(resource, NULL);
+	wl_list_for_each(seat_client, &touch->seat->client_list, link) {
+		wl_resource_for_each(resource, &seat_client->touch_resources)
+			wl_resource_set_user_data(resource, NULL);
 	}
 
 	wl_resource_for_each(resource, &touch->focus_resource_list) {
 		wl_resource_set_user_data(resource, NULL);
 	}
 
-	wl_list_remove(&touch->resource_list);
 	wl_list_remove(&touch->focus_resource_list);
 	wl_list_remove(&touch->focus_view_listener.link);
 	wl_list_remove(&touch->focus_resource_listener.link);
@@ -1440,7 +1562,6 @@ weston_tablet_create(void)
 	if (tablet == NULL)
 		return NULL;
 
-	wl_list_init(&tablet->resource_list);
 	wl_list_init(&tablet->tool_list);
 
 	return tablet;
@@ -1449,12 +1570,21 @@ weston_tablet_create(void)
 WL_EXPORT void
 weston_tablet_destroy(struct weston_tablet *tablet)
 {
-	struct wl_resource *resource;
+	struct weston_seat_client *seat_client;
+	struct wl_resource *resource, *tmp;
 	struct weston_tablet_tool *tool, *tmptool;
 
-	wl_resource_for_each(resource, &tablet->resource_list) {
-		zwp_tablet_v2_send_removed(resource);
-		wl_resource_set_user_data(resource, NULL);
+	wl_list_for_each(seat_client, &tablet->seat->client_list, link) {
+		wl_resource_for_each_safe(resource, tmp,
+					  &seat_client->tablet_resources) {
+			if (wl_resource_get_user_data(resource) != tablet)
+				continue;
+
+			zwp_tablet_v2_send_removed(resource);
+			wl_resource_set_user_data(resource, NULL);
+			wl_list_remove(wl_resource_get_link(resource));
+			wl_list_init(wl_resource_get_link(resource));
+		}
 	}
 
 	/* Remove the tablet from the list */
@@ -1464,10 +1594,8 @@ weston_tablet_destroy(struct weston_tablet *tablet)
 	wl_list_for_each_safe(tool, tmptool, &tablet->tool_list, link)
 		weston_seat_release_tablet_tool(tool);
 
-	if (wl_list_empty(&tablet->resource_list)) {
-		free(tablet->name);
-		free(tablet);
-	}
+	free(tablet->name);
+	free(tablet);
 }
 
 WL_EXPORT void
@@ -1478,6 +1606,7 @@ weston_tablet_tool_set_focus(struct weston_tablet_tool *tool,
 	struct wl_list *focus_resource_list;
 	struct wl_resource *resource;
 	struct weston_seat *seat = tool->seat;
+	struct weston_seat_client *seat_client;
 	uint32_t msecs;
 
 	focus_resource_list = &tool->focus_resource_list;
@@ -1492,24 +1621,43 @@ weston_tablet_tool_set_focus(struct weston_tablet_tool *tool,
 			zwp_tablet_tool_v2_send_frame(resource, msecs);
 		}
 
-		move_resources(&tool->resource_list, focus_resource_list);
+		seat_client = weston_seat_get_focus_client(seat,
+							   focus_resource_list);
+		release_focus_resources(seat_client ?
+					&seat_client->tablet_tool_resources :
+					NULL,
+					focus_resource_list);
 	}
 
-	if (find_resource_for_view(&tool->resource_list, view)) {
-		struct wl_client *surface_client =
-			wl_resource_get_client(view->surface->resource);
+	seat_client = view ?
+		weston_seat_get_client_for_surface(seat, view->surface) : NULL;
+	if (seat_client) {
+		struct wl_resource *tmp;
 
-		move_resources_for_client(focus_resource_list,
-					  &tool->resource_list,
-					  surface_client);
+		wl_resource_for_each_safe(resource, tmp,
+					  &seat_client->tablet_tool_resources) {
+			if (wl_resource_get_user_data(resource) != tool)
+				continue;
 
-		tool->focus_serial = wl_display_next_serial(seat->compositor->wl_display);
-		wl_resource_for_each(resource, focus_resource_list) {
-			struct wl_resource *tr;
+			wl_list_remove(wl_resource_get_link(resource));
+			wl_list_insert(focus_resource_list,
+				       wl_resource_get_link(resource));
+		}
+	}
 
-			tr = wl_resource_find_for_client(&tool->current_tablet->resource_list,
-							 surface_client);
+	if (seat_client && !wl_list_empty(focus_resource_list)) {
+		struct wl_resource *tr = NULL;
 
+		wl_resource_for_each(resource, &seat_client->tablet_resources) {
+			if (wl_resource_get_user_data(resource) ==
+			    tool->current_tablet) {
+				tr = resource;
+				break;
+			}
+		}
+
+		tool->focus_serial = wl_display_next_serial(seat->compositor->wl_display);
+		wl_resource_for_each(resource, focus_resource_list) {
 			zwp_tablet_tool_v2_send_proximity_in(resource, tool->focus_serial,
 							   tr, view->surface->resource);
 
@@ -1808,7 +1956,6 @@ weston_tablet_tool_create(void)
 	if (tool == NULL)
 		return NULL;
 
-	wl_list_init(&tool->resource_list);
 	wl_list_init(&tool->focus_resource_list);
 
 	wl_list_init(&tool->sprite_destroy_listener.link);
@@ -1833,21 +1980,29 @@ weston_tablet_tool_create(void)
 WL_EXPORT void
 weston_tablet_tool_destroy(struct weston_tablet_tool *tool)
 {
+	struct weston_seat_client *seat_client;
 	struct wl_resource *resource, *tmp;
 
 	if (tool->sprite)
 		tablet_tool_unmap_sprite(tool);
 
-	wl_resource_for_each_safe(resource, tmp, &tool->resource_list) {
-		zwp_tablet_tool_v2_send_removed(resource);
-		wl_resource_set_user_data(resource, NULL);
+	wl_list_for_each(seat_client, &tool->seat->client_list, link) {
+		wl_resource_for_each_safe(resource, tmp,
+					  &seat_client->tablet_tool_resources) {
+			if (wl_resource_get_user_data(resource) != tool)
+				continue;
+
+			zwp_tablet_tool_v2_send_removed(resource);
+			wl_resource_set_user_data(resource, NULL);
+			wl_list_remove(wl_resource_get_link(resource));
+			wl_list_init(wl_resource_get_link(resource));
+		}
 	}
 	wl_resource_for_each(resource, &tool->focus_resource_list) {
 		wl_resource_set_user_data(resource, NULL);
 	}
 
 	wl_list_remove(&tool->link);
-	wl_list_remove(&tool->resource_list);
 	wl_list_remove(&tool->focus_resource_list);
 	wl_list_remove(&tool->focus_view_listener.link);
 	wl_list_remove(&tool->focus_resource_listener.link);
@@ -1864,8 +2019,7 @@ weston_tablet_tool_cursor_move(struct weston_tablet_tool *tool,
 		struct weston_coord_surface hotspot_inv;
 
 		hotspot_inv = weston_coord_surface_invert(tool->hotspot);
-		weston_view_set_position_with_offset(tool->sprite,
-						     pos, hotspot_inv);
+		weston_view_move_cursor(tool->sprite, pos, hotspot_inv);
 	}
 }
 
@@ -1960,10 +2114,7 @@ weston_pointer_set_focus(struct weston_pointer *pointer,
 		serial = wl_display_next_serial(display);
 
 		if (kbd && kbd->focus != view->surface)
-			send_modifiers_to_client_in_list(surface_client,
-							 &kbd->resource_list,
-							 serial,
-							 kbd);
+			send_modifiers_to_client(kbd, surface_client, serial);
 
 		pointer->focus_client = pointer_client;
 
@@ -2020,6 +2171,7 @@ weston_keyboard_set_focus(struct weston_keyboard *keyboard,
 			  struct weston_surface *surface)
 {
 	struct weston_seat *seat = keyboard->seat;
+	struct weston_seat_client *seat_client;
 	struct wl_resource *resource;
 	struct wl_display *display = keyboard->seat->compositor->wl_display;
 	uint32_t serial;
@@ -2041,19 +2193,20 @@ weston_keyboard_set_focus(struct weston_keyboard *keyboard,
 			wl_keyboard_send_leave(resource, serial,
 					keyboard->focus->resource);
 		}
-		move_resources(&keyboard->resource_list, focus_resource_list);
+		seat_client = weston_seat_get_focus_client(seat,
+							   focus_resource_list);
+		release_focus_resources(seat_client ?
+					&seat_client->keyboard_resources : NULL,
+					focus_resource_list);
 	}
 
-	if (find_resource_for_surface(&keyboard->resource_list, surface) &&
+	seat_client = weston_seat_get_client_for_surface(seat, surface);
+	if (seat_client && !wl_list_empty(&seat_client->keyboard_resources) &&
 	    keyboard->focus != surface) {
-		struct wl_client *surface_client =
-			wl_resource_get_client(surface->resource);
-
 		serial = wl_display_next_serial(display);
 
-		move_resources_for_client(focus_resource_list,
-					  &keyboard->resource_list,
-					  surface_client);
+		move_resources(focus_resource_list,
+			       &seat_client->keyboard_resources);
 		send_enter_to_resource_list(focus_resource_list,
 					    keyboard,
 					    surface,
@@ -2186,8 +2339,7 @@ weston_pointer_move_to(struct weston_pointer *pointer,
 		struct weston_coord_surface hotspot_inv;
 
 		hotspot_inv = weston_coord_surface_invert(pointer->hotspot);
-		weston_view_set_position_with_offset(pointer->sprite,
-						     pos, hotspot_inv);
+		weston_view_move_cursor(pointer->sprite, pos, hotspot_inv);
 	}
 
 	pointer->grab->interface->focus(pointer->grab);
@@ -2599,19 +2751,22 @@ send_modifiers(struct wl_resource *resource, uint32_t serial, struct weston_keyb
 }
 
 static struct weston_xkb_info *
-weston_xkb_info_create(struct xkb_keymap *keymap);
+weston_compositor_get_xkb_info(struct weston_compositor *ec,
+			       struct xkb_keymap *keymap);
 
 static void
 update_keymap(struct weston_seat *seat)
 {
 	struct weston_keyboard *keyboard = weston_seat_get_keyboard(seat);
+	struct weston_seat_client *seat_client;
 	struct wl_resource *resource;
 	struct weston_xkb_info *xkb_info;
 	struct xkb_state *state;
 	xkb_mod_mask_t latched_mods;
 	xkb_mod_mask_t locked_mods;
 
-	xkb_info = weston_xkb_info_create(keyboard->pending_keymap);
+	xkb_info = weston_compositor_get_xkb_info(seat->compositor,
+						  keyboard->pending_keymap);
 
 	xkb_keymap_unref(keyboard->pending_keymap);
 	keyboard->pending_keymap = NULL;
@@ -2644,8 +2799,11 @@ update_keymap(struct weston_seat *seat)
 	xkb_state_unref(keyboard->xkb_state.state);
 	keyboard->xkb_state.state = state;
 
-	wl_resource_for_each(resource, &keyboard->resource_list)
-		weston_keyboard_send_keymap(keyboard, resource);
+	wl_list_for_each(seat_client, &seat->client_list, link) {
+		wl_resource_for_each(resource,
+				     &seat_client->keyboard_resources)
+			weston_keyboard_send_keymap(keyboard, resource);
+	}
 	wl_resource_for_each(resource, &keyboard->focus_resource_list)
 		weston_keyboard_send_keymap(keyboard, resource);
 
@@ -2654,8 +2812,11 @@ update_keymap(struct weston_seat *seat)
 	if (!latched_mods && !locked_mods)
 		return;
 
-	wl_resource_for_each(resource, &keyboard->resource_list)
-		send_modifiers(resource, wl_display_get_serial(seat->compositor->wl_display), keyboard);
+	wl_list_for_each(seat_client, &seat->client_list, link) {
+		wl_resource_for_each(resource,
+				     &seat_client->keyboard_resources)
+			send_modifiers(resource, wl_display_get_serial(seat->compositor->wl_display), keyboard);
+	}
 	wl_resource_for_each(resource, &keyboard->focus_resource_list)
 		send_modifiers(resource, wl_display_get_serial(seat->compositor->wl_display), keyboard);
 }
@@ -2815,6 +2976,7 @@ notify_keyboard_focus_out(struct weston_seat *seat)
 WL_EXPORT void
 weston_touch_set_focus(struct weston_touch *touch, struct weston_view *view)
 {
+	struct weston_seat_client *seat_client;
 	struct wl_list *focus_resource_list;
 
 	focus_resource_list = &touch->focus_resource_list;
@@ -2831,22 +2993,24 @@ weston_touch_set_focus(struct weston_touch *touch, struct weston_view *view)
 	wl_list_init(&touch->focus_view_listener.link);
 
 	if (!wl_list_empty(focus_resource_list)) {
-		move_resources(&touch->resource_list,
-			       focus_resource_list);
+		seat_client = weston_seat_get_focus_client(touch->seat,
+							   focus_resource_list);
+		release_focus_resources(seat_client ?
+					&seat_client->touch_resources : NULL,
+					focus_resource_list);
 	}
 
 	if (view) {
-		struct wl_client *surface_client;
-
 		if (!view->surface->resource) {
 			touch->focus = NULL;
 			return;
 		}
 
-		surface_client = wl_resource_get_client(view->surface->resource);
-		move_resources_for_client(focus_resource_list,
-					  &touch->resource_list,
-					  surface_client);
+		seat_client = weston_seat_get_client_for_surface(touch->seat,
+								 view->surface);
+		if (seat_client)
+			move_resources(focus_resource_list,
+				       &seat_client->touch_resources);
 		wl_resource_add_destroy_listener(view->surface->resource,
 						 &touch->focus_resource_listener);
 		wl_signal_add(&view->destroy_signal, &touch->focus_view_listener);
@@ -3177,13 +3341,20 @@ tablet_add_resource(struct weston_tablet *tablet,
 		    struct wl_client *client,
 		    struct wl_resource *tablet_seat_resource)
 {
+	struct weston_seat_client *seat_client;
 	struct wl_resource *tablet_resource;
 
+	seat_client = weston_seat_ensure_client(tablet->seat, client);
+	if (!seat_client) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
 	tablet_resource = wl_resource_create(client,
 					     &zwp_tablet_v2_interface,
 					     1, 0);
 
-	wl_list_insert(&tablet->resource_list,
+	wl_list_insert(&seat_client->tablet_resources,
 		       wl_resource_get_link(tablet_resource));
 	wl_resource_set_implementation(tablet_resource,
 				       &tablet_interface,
@@ -3333,13 +3504,20 @@ tablet_tool_add_resource(struct weston_tablet_tool *tool,
 			 struct wl_client *client,
 			 struct wl_resource *tablet_seat_resource)
 {
+	struct weston_seat_client *seat_client;
 	struct wl_resource *tool_resource;
 
+	seat_client = weston_seat_ensure_client(tool->seat, client);
+	if (!seat_client) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
 	tool_resource = wl_resource_create(client,
 					   &zwp_tablet_tool_v2_interface,
 					   1, 0);
 
-	wl_list_insert(&tool->resource_list,
+	wl_list_insert(&seat_client->tablet_tool_resources,
 		       wl_resource_get_link(tool_resource));
 	wl_resource_set_implementation(tool_resource,
 				       &tablet_tool_interface,
@@ -3702,6 +3880,7 @@ seat_get_keyboard(struct wl_client *client, struct wl_resource *resource,
 	 * capabilities and the client trying to use the old ones.
 	 */
 	struct weston_keyboard *keyboard = seat ? seat->keyboard_state : NULL;
+	struct weston_seat_client *seat_client;
 	struct wl_resource *cr;
 
 	cr = wl_resource_create(client, &wl_keyboard_interface,
@@ -3720,10 +3899,17 @@ seat_get_keyboard(struct wl_client *client, struct wl_resource *resource,
 	if (!keyboard)
 		return;
 
+	seat_client = weston_seat_ensure_client(seat, client);
+	if (!seat_client) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
 	/* May be moved to focused list later by either
 	 * weston_keyboard_set_focus or directly if this client is already
 	 * focused */
-	wl_list_insert(&keyboard->resource_list, wl_resource_get_link(cr));
+	wl_list_insert(&seat_client->keyboard_resources,
+		       wl_resource_get_link(cr));
 
 	if (wl_resource_get_version(cr) >= WL_KEYBOARD_REPEAT_INFO_SINCE_VERSION) {
 		wl_keyboard_send_repeat_info(cr,
@@ -3795,6 +3981,7 @@ seat_get_touch(struct wl_client *client, struct wl_resource *resource,
 	 * capabilities and the client trying to use the old ones.
 	 */
 	struct weston_touch *touch = seat ? seat->touch_state : NULL;
+	struct weston_seat_client *seat_client;
 	struct wl_resource *cr;
 
 	cr = wl_resource_create(client, &wl_touch_interface,
@@ -3813,12 +4000,18 @@ seat_get_touch(struct wl_client *client, struct wl_resource *resource,
 	if (!touch)
 		return;
 
+	seat_client = weston_seat_ensure_client(seat, client);
+	if (!seat_client) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
 	if (touch->focus &&
 	    wl_resource_get_client(touch->focus->surface->resource) == client) {
 		wl_list_insert(&touch->focus_resource_list,
 			       wl_resource_get_link(cr));
 	} else {
-		wl_list_insert(&touch->resource_list,
+		wl_list_insert(&seat_client->touch_resources,
 			       wl_resource_get_link(cr));
 	}
 }
@@ -3968,9 +4161,175 @@ weston_xkb_info_destroy(struct weston_xkb_info *xkb_info)
 	free(xkb_info);
 }
 
+/*
+ * Keymaps compiled from rule names, most recently used first. An entry
+ * holds a reference on the weston_xkb_info, so that the keymap and its
+ * serialized copy in the read-only anonymous file are shared by all the
+ * keyboards using it, and survive a seat going away and coming back.
+ */
+#define XKB_KEYMAP_CACHE_SIZE 8
+
+struct weston_xkb_keymap_cache_entry {
+	struct wl_list link;	/* weston_compositor::xkb_keymap_cache */
+	struct xkb_rule_names names;
+	struct weston_xkb_info *xkb_info;
+};
+
+static bool
+xkb_rule_name_equal(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	return strcmp(a, b) == 0;
+}
+
+static bool
+xkb_rule_names_equal(const struct xkb_rule_names *a,
+		     const struct xkb_rule_names *b)
+{
+	return xkb_rule_name_equal(a->rules, b->rules) &&
+	       xkb_rule_name_equal(a->model, b->model) &&
+	       xkb_rule_name_equal(a->layout, b->layout) &&
+	       xkb_rule_name_equal(a->variant, b->variant) &&
+	       xkb_rule_name_equal(a->options, b->options);
+}
+
+static void
+xkb_rule_names_release(struct xkb_rule_names *names)
+{
+	free((char *) names->rules);
+	free((char *) names->model);
+	free((char *) names->layout);
+	free((char *) names->variant);
+	free((char *) names->options);
+}
+
+static bool
+xkb_rule_names_copy(struct xkb_rule_names *dst,
+		    const struct xkb_rule_names *src)
+{
+	*dst = (struct xkb_rule_names) {
+		.rules = src->rules ? strdup(src->rules) : NULL,
+		.model = src->model ? strdup(src->model) : NULL,
+		.layout = src->layout ? strdup(src->layout) : NULL,
+		.variant = src->variant ? strdup(src->variant) : NULL,
+		.options = src->options ? strdup(src->options) : NULL,
+	};
+
+	if (xkb_rule_names_equal(dst, src))
+		return true;
+
+	xkb_rule_names_release(dst);
+	return false;
+}
+
+static void
+xkb_keymap_cache_entry_destroy(struct weston_xkb_keymap_cache_entry *entry)
+{
+	wl_list_remove(&entry->link);
+	weston_xkb_info_destroy(entry->xkb_info);
+	xkb_rule_names_release(&entry->names);
+	free(entry);
+}
+
+static struct weston_xkb_info *
+weston_xkb_info_create(struct xkb_keymap *keymap);
+
+/** Get a keymap compiled from XKB rule names
+ *
+ * \param ec The compositor.
+ * \param names The rule names to compile the keymap from.
+ * \return A new reference to the keymap, or NULL if it fails to compile.
+ *
+ * Compiling a keymap takes tens of milliseconds, so the last few keymaps
+ * are kept around and handed out again for the same rule names. Handing
+ * the keymap to weston_seat_init_keyboard() or weston_seat_update_keymap()
+ * then also shares the keymap file sent to clients.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT struct xkb_keymap *
+weston_compositor_get_keymap(struct weston_compositor *ec,
+			     const struct xkb_rule_names *names)
+{
+	struct weston_xkb_keymap_cache_entry *entry;
+	struct xkb_keymap *keymap;
+
+	wl_list_for_each(entry, &ec->xkb_keymap_cache, link) {
+		if (!xkb_rule_names_equal(&entry->names, names))
+			continue;
+
+		wl_list_remove(&entry->link);
+		wl_list_insert(&ec->xkb_keymap_cache, &entry->link);
+
+		return xkb_keymap_ref(entry->xkb_info->keymap);
+	}
+
+	keymap = xkb_keymap_new_from_names(ec->xkb_context, names, 0);
+	if (!keymap)
+		return NULL;
+
+	/* Not being able to cache the keymap is no reason to fail. */
+	entry = zalloc(sizeof *entry);
+	if (!entry)
+		return keymap;
+
+	if (!xkb_rule_names_copy(&entry->names, names)) {
+		free(entry);
+		return keymap;
+	}
+
+	entry->xkb_info = weston_xkb_info_create(keymap);
+	if (!entry->xkb_info) {
+		xkb_rule_names_release(&entry->names);
+		free(entry);
+		return keymap;
+	}
+
+	wl_list_insert(&ec->xkb_keymap_cache, &entry->link);
+
+	if (wl_list_length(&ec->xkb_keymap_cache) > XKB_KEYMAP_CACHE_SIZE) {
+		entry = wl_container_of(ec->xkb_keymap_cache.prev, entry, link);
+		xkb_keymap_cache_entry_destroy(entry);
+	}
+
+	return keymap;
+}
+
+/*
+ * Reuse the weston_xkb_info of a keymap that came from the cache or is
+ * the global one, instead of serializing it into another file.
+ */
+static struct weston_xkb_info *
+weston_compositor_get_xkb_info(struct weston_compositor *ec,
+			       struct xkb_keymap *keymap)
+{
+	struct weston_xkb_keymap_cache_entry *entry;
+
+	if (ec->xkb_info && ec->xkb_info->keymap == keymap) {
+		ec->xkb_info->ref_count++;
+		return ec->xkb_info;
+	}
+
+	wl_list_for_each(entry, &ec->xkb_keymap_cache, link) {
+		if (entry->xkb_info->keymap == keymap) {
+			entry->xkb_info->ref_count++;
+			return entry->xkb_info;
+		}
+	}
+
+	return weston_xkb_info_create(keymap);
+}
+
 void
 weston_compositor_xkb_destroy(struct weston_compositor *ec)
 {
+	struct weston_xkb_keymap_cache_entry *entry, *tmp;
+
+	wl_list_for_each_safe(entry, tmp, &ec->xkb_keymap_cache, link)
+		xkb_keymap_cache_entry_destroy(entry);
+
 	free((char *) ec->xkb_names.rules);
 	free((char *) ec->xkb_names.model);
 	free((char *) ec->xkb_names.layout);
@@ -4051,9 +4410,7 @@ weston_compositor_build_global_keymap(struct weston_compositor *ec)
 	if (ec->xkb_info != NULL)
 		return 0;
 
-	keymap = xkb_keymap_new_from_names(ec->xkb_context,
-					   &ec->xkb_names,
-					   0);
+	keymap = weston_compositor_get_keymap(ec, &ec->xkb_names);
 	if (keymap == NULL) {
 		weston_log("failed to compile global XKB keymap\n");
 		weston_log("  tried rules %s, model %s, layout %s, variant %s, "
@@ -4064,7 +4421,7 @@ weston_compositor_build_global_keymap(struct weston_compositor *ec)
 		return -1;
 	}
 
-	ec->xkb_info = weston_xkb_info_create(keymap);
+	ec->xkb_info = weston_compositor_get_xkb_info(ec, keymap);
 	xkb_keymap_unref(keymap);
 	if (ec->xkb_info == NULL)
 		return -1;
@@ -4106,7 +4463,9 @@ weston_seat_init_keyboard(struct weston_seat *seat, struct xkb_keymap *keymap)
 	}
 
 	if (keymap != NULL) {
-		keyboard->xkb_info = weston_xkb_info_create(keymap);
+		keyboard->xkb_info =
+			weston_compositor_get_xkb_info(seat->compositor,
+						       keymap);
 		if (keyboard->xkb_info == NULL)
 			goto err;
 	} else {
@@ -4286,7 +4645,6 @@ weston_seat_add_tablet_tool(struct weston_seat *seat)
 	if (tool == NULL)
 		return NULL;
 
-	wl_list_init(&tool->resource_list);
 	tool->seat = seat;
 
 	return tool;
@@ -4320,6 +4678,7 @@ weston_seat_init(struct weston_seat *seat, struct weston_compositor *ec,
 	wl_list_init(&seat->tablet_list);
 	wl_list_init(&seat->tablet_tool_list);
 	wl_signal_init(&seat->tablet_tool_added_signal);
+	wl_list_init(&seat->client_list);
 
 	seat->global = wl_global_create(ec->wl_display, &wl_seat_interface,
 					MIN(wl_seat_interface.version, 7),
@@ -4342,6 +4701,7 @@ weston_seat_release(struct weston_seat *seat)
 	struct wl_resource *resource;
 	struct weston_tablet *tablet, *tmp;
 	struct weston_tablet_tool *tool, *tmp_tool;
+	struct weston_seat_client *seat_client, *tmp_client;
 
 	wl_resource_for_each(resource, &seat->base_resource_list) {
 		wl_resource_set_user_data(resource, NULL);
@@ -4369,6 +4729,8 @@ weston_seat_release(struct weston_seat *seat)
 		weston_tablet_destroy(tablet);
 	wl_list_for_each_safe(tool, tmp_tool, &seat->tablet_tool_list, link)
 		weston_tablet_tool_destroy(tool);
+	wl_list_for_each_safe(seat_client, tmp_client, &seat->client_list, link)
+		weston_seat_client_destroy(seat_client);
 
 	free (seat->seat_name);
 
@@ -35,6 +35,7 @@
 #include <linux/input.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 #include <assert.h>
 #include <libinput.h>
 
@@ -42,6 +43,7 @@
 #include "backend.h"
 #include "libweston-internal.h"
 #include "libinput-device.h"
+#include "libinput-seat.h"
 #include "shared/helpers.h"
 #include "shared/timespec-util.h"
 
@@ -52,6 +54,15 @@ struct tablet_output_listener {
 	struct wl_list tablet_list;
 };
 
+static struct udev_input *
+evdev_device_get_input(struct evdev_device *device)
+{
+	struct udev_seat *seat = container_of(device->seat,
+					      struct udev_seat, base);
+
+	return seat->input;
+}
+
 void
 evdev_led_update(struct evdev_device *device, enum weston_led weston_leds)
 {
@@ -64,7 +75,9 @@ evdev_led_update(struct evdev_device *device, enum weston_led weston_leds)
 	if (weston_leds & LED_SCROLL_LOCK)
 		leds |= LIBINPUT_LED_SCROLL_LOCK;
 
+	udev_input_lock(evdev_device_get_input(device));
 	libinput_device_led_update(device->device, leds);
+	udev_input_unlock(evdev_device_get_input(device));
 }
 
 static void
@@ -109,18 +122,13 @@ handle_keyboard_key(struct libinput_device *libinput_device,
 		   key_state, STATE_UPDATE_AUTOMATIC);
 }
 
-static bool
-handle_pointer_motion(struct libinput_device *libinput_device,
-		      struct libinput_event_pointer *pointer_event)
+static struct weston_pointer_motion_event
+pointer_motion_event_from_libinput(struct libinput_event_pointer *pointer_event)
 {
-	struct evdev_device *device =
-		libinput_device_get_user_data(libinput_device);
 	struct weston_pointer_motion_event event = { 0 };
 	struct timespec time;
 	double dx_unaccel, dy_unaccel;
 
-	ensure_pointer_capability(libinput_device);
-
 	timespec_from_usec(&time,
 			   libinput_event_pointer_get_time_usec(pointer_event));
 	dx_unaccel = libinput_event_pointer_get_dx_unaccelerated(pointer_event);
@@ -134,11 +142,68 @@ handle_pointer_motion(struct libinput_device *libinput_device,
 	event.rel = weston_coord(libinput_event_pointer_get_dx(pointer_event),
 				 libinput_event_pointer_get_dy(pointer_event));
 	event.rel_unaccel = weston_coord(dx_unaccel, dy_unaccel);
-	notify_motion(device->seat, &time, &event);
+
+	return event;
+}
+
+static bool
+handle_pointer_motion(struct libinput_device *libinput_device,
+		      struct libinput_event_pointer *pointer_event)
+{
+	struct evdev_device *device =
+		libinput_device_get_user_data(libinput_device);
+	struct weston_pointer_motion_event event;
+
+	ensure_pointer_capability(libinput_device);
+
+	event = pointer_motion_event_from_libinput(pointer_event);
+	notify_motion(device->seat, &event.time, &event);
 
 	return true;
 }
 
+/** Merge a relative motion event into the one held back for the device
+ *
+ * The deltas add up, so relative pointer clients get exactly the motion
+ * of the individual events, and the pointer ends where they would have
+ * moved it unless it hit the edge of the outputs on the way. The merged
+ * event has the time of the latest one. evdev_device_flush_motion() sends
+ * it, as one motion and one frame.
+ */
+void
+evdev_device_queue_motion(struct evdev_device *device,
+			  struct libinput_event_pointer *pointer_event)
+{
+	struct weston_pointer_motion_event *queued = &device->queued_motion;
+	struct weston_pointer_motion_event event;
+
+	ensure_pointer_capability(device->device);
+
+	event = pointer_motion_event_from_libinput(pointer_event);
+	if (!device->motion_queued) {
+		*queued = event;
+		device->motion_queued = true;
+		return;
+	}
+
+	queued->time = event.time;
+	queued->rel = weston_coord_add(queued->rel, event.rel);
+	queued->rel_unaccel = weston_coord_add(queued->rel_unaccel,
+					       event.rel_unaccel);
+}
+
+void
+evdev_device_flush_motion(struct evdev_device *device)
+{
+	if (!device->motion_queued)
+		return;
+
+	device->motion_queued = false;
+	notify_motion(device->seat, &device->queued_motion.time,
+		      &device->queued_motion);
+	notify_pointer_frame(device->seat);
+}
+
 static bool
 handle_pointer_motion_absolute(
 	struct libinput_device *libinput_device,
@@ -362,15 +427,19 @@ touch_get_calibration(struct weston_touch_device *device,
 		      struct weston_touch_device_matrix *cal)
 {
 	struct evdev_device *evdev_device = device->backend_data;
+	struct udev_input *input = evdev_device_get_input(evdev_device);
 
+	udev_input_lock(input);
 	libinput_device_config_calibration_get_matrix(evdev_device->device,
 						      cal->m);
+	udev_input_unlock(input);
 }
 
 static void
 do_set_calibration(struct evdev_device *evdev_device,
 		   const struct weston_touch_device_matrix *cal)
 {
+	struct udev_input *input = evdev_device_get_input(evdev_device);
 	enum libinput_config_status status;
 
 	weston_log("input device %s: applying calibration:\n",
@@ -380,8 +449,10 @@ do_set_calibration(struct evdev_device *evdev_device,
 	weston_log_continue(STAMP_SPACE "  %f %f %f\n",
 			    cal->m[3], cal->m[4], cal->m[5]);
 
+	udev_input_lock(input);
 	status = libinput_device_config_calibration_set_matrix(evdev_device->device,
 							       cal->m);
+	udev_input_unlock(input);
 	if (status != LIBINPUT_CONFIG_STATUS_SUCCESS)
 		weston_log("Error: Failed to apply calibration.\n");
 }
@@ -437,6 +508,171 @@ create_touch_device(struct evdev_device *device)
 	return touch_device;
 }
 
+/* Resampled events are for this long before the timer fires, so that the
+ * position can mostly be interpolated between two device reports. */
+#define RESAMPLE_LATENCY_USEC 5000
+/* Extrapolate no further than this past the latest report */
+#define RESAMPLE_MAX_PREDICT_USEC 8000
+/* Reports further apart belong to different strokes */
+#define RESAMPLE_MAX_SPAN_USEC 20000
+/* The timer fires this long before the repaint deadline of the output */
+#define RESAMPLE_LEAD_MSEC 1
+
+static void
+evdev_device_resample_arm(struct evdev_device *device);
+
+static bool
+evdev_device_resampling(struct evdev_device *device)
+{
+	return evdev_device_get_input(device)->resample && device->output;
+}
+
+static void
+evdev_resample_push(struct evdev_resample_track *track,
+		    const struct evdev_resample_sample *sample, bool hold)
+{
+	if (track->count == 2)
+		track->samples[0] = track->samples[1];
+	else
+		track->count++;
+
+	track->samples[track->count - 1] = *sample;
+	track->held = hold;
+	track->fresh = hold;
+}
+
+static double
+lerp(double a, double b, double t)
+{
+	return a + (b - a) * t;
+}
+
+/** Position of a track at the given time
+ *
+ * Interpolates between the two latest reports, or extrapolates past the
+ * latest one by at most half the time between them. The track stays held
+ * until its latest report has been sent as it is, so that motion ends
+ * exactly where the device said.
+ */
+static struct evdev_resample_sample
+evdev_resample_track_at(struct evdev_resample_track *track, int64_t target)
+{
+	const struct evdev_resample_sample *a = &track->samples[0];
+	const struct evdev_resample_sample *b = &track->samples[track->count - 1];
+	struct evdev_resample_sample out = *b;
+	int64_t span = b->time_usec - a->time_usec;
+	double t;
+
+	out.time_usec = MAX(b->time_usec, target);
+
+	if (target >= b->time_usec && !track->fresh) {
+		track->held = false;
+		return out;
+	}
+	track->fresh = false;
+
+	if (track->count < 2 || span <= 0 || span > RESAMPLE_MAX_SPAN_USEC) {
+		track->held = false;
+		return out;
+	}
+
+	t = (double) (MIN(target, b->time_usec +
+			  MIN(span / 2, RESAMPLE_MAX_PREDICT_USEC)) -
+		      a->time_usec) / span;
+	t = MAX(t, 0.0);
+
+	out.time_usec = target;
+	out.pos.c = weston_coord(lerp(a->pos.c.x, b->pos.c.x, t),
+				 lerp(a->pos.c.y, b->pos.c.y, t));
+	out.norm.x = lerp(a->norm.x, b->norm.x, t);
+	out.norm.y = lerp(a->norm.y, b->norm.y, t);
+	out.pressure = CLIP(lerp(a->pressure, b->pressure, t), 0.0, 65535.0);
+
+	return out;
+}
+
+static struct evdev_resample_track *
+evdev_device_touch_track(struct evdev_device *device, int32_t slot)
+{
+	struct evdev_resample_track *track;
+
+	wl_array_for_each(track, &device->touch_tracks) {
+		if (track->slot == slot)
+			return track;
+	}
+
+	track = wl_array_add(&device->touch_tracks, sizeof *track);
+	if (!track)
+		return NULL;
+
+	memset(track, 0, sizeof *track);
+	track->slot = slot;
+
+	return track;
+}
+
+static void
+evdev_device_remove_touch_track(struct evdev_device *device, int32_t slot)
+{
+	struct evdev_resample_track *track;
+	struct evdev_resample_track *last;
+
+	last = (struct evdev_resample_track *)
+		((char *) device->touch_tracks.data +
+		 device->touch_tracks.size) - 1;
+
+	wl_array_for_each(track, &device->touch_tracks) {
+		if (track->slot != slot)
+			continue;
+
+		*track = *last;
+		device->touch_tracks.size -= sizeof *track;
+		return;
+	}
+}
+
+static void
+notify_touch_sample(struct evdev_device *device, int32_t slot,
+		    const struct evdev_resample_sample *sample, int touch_type)
+{
+	struct timespec time;
+
+	timespec_from_usec(&time, sample->time_usec);
+
+	if (weston_touch_device_can_calibrate(device->touch_device)) {
+		notify_touch_normalized(device->touch_device, &time, slot,
+					&sample->pos, &sample->norm,
+					touch_type);
+	} else {
+		notify_touch(device->touch_device, &time, slot,
+			     &sample->pos, touch_type);
+	}
+	device->touch_sent = true;
+}
+
+/* Sends the touch motion held back as it is, before events that must not
+ * be reordered with it. Returns true if there was any. */
+static bool
+evdev_device_flush_touch(struct evdev_device *device)
+{
+	struct evdev_resample_track *track;
+	bool sent = false;
+
+	wl_array_for_each(track, &device->touch_tracks) {
+		if (!track->held)
+			continue;
+
+		notify_touch_sample(device, track->slot,
+				    &track->samples[track->count - 1],
+				    WL_TOUCH_MOTION);
+		track->held = false;
+		track->fresh = false;
+		sent = true;
+	}
+
+	return sent;
+}
+
 static void
 handle_touch_with_coords(struct libinput_device *libinput_device,
 			 struct libinput_event_touch *touch_event,
@@ -444,19 +680,17 @@ handle_touch_with_coords(struct libinput_device *libinput_device,
 {
 	struct evdev_device *device =
 		libinput_device_get_user_data(libinput_device);
+	struct evdev_resample_sample sample;
+	struct evdev_resample_track *track = NULL;
 	double x;
 	double y;
-	struct weston_point2d_device_normalized norm;
 	uint32_t width, height;
-	struct timespec time;
 	int32_t slot;
-	struct weston_coord_global pos;
 
 	if (!device->output)
 		return;
 
-	timespec_from_usec(&time,
-			   libinput_event_touch_get_time_usec(touch_event));
+	sample.time_usec = libinput_event_touch_get_time_usec(touch_event);
 	slot = libinput_event_touch_get_seat_slot(touch_event);
 
 	width = device->output->current_mode->width;
@@ -464,17 +698,32 @@ handle_touch_with_coords(struct libinput_device *libinput_device,
 	x =  libinput_event_touch_get_x_transformed(touch_event, width);
 	y =  libinput_event_touch_get_y_transformed(touch_event, height);
 
-	pos = weston_coord_global_from_output_point(x, y, device->output);
+	sample.pos = weston_coord_global_from_output_point(x, y,
+							   device->output);
+	sample.norm.x = libinput_event_touch_get_x_transformed(touch_event, 1);
+	sample.norm.y = libinput_event_touch_get_y_transformed(touch_event, 1);
+	sample.pressure = 0.0;
 
-	if (weston_touch_device_can_calibrate(device->touch_device)) {
-		norm.x = libinput_event_touch_get_x_transformed(touch_event, 1);
-		norm.y = libinput_event_touch_get_y_transformed(touch_event, 1);
-		notify_touch_normalized(device->touch_device, &time, slot,
-					&pos, &norm, touch_type);
-	} else {
-		notify_touch(device->touch_device, &time, slot,
-			     &pos, touch_type);
+	if (evdev_device_resampling(device)) {
+		if (touch_type == WL_TOUCH_DOWN)
+			evdev_device_flush_touch(device);
+
+		track = evdev_device_touch_track(device, slot);
+	}
+
+	if (track && touch_type == WL_TOUCH_DOWN)
+		track->count = 0;
+
+	if (track && touch_type == WL_TOUCH_MOTION) {
+		evdev_resample_push(track, &sample, true);
+		evdev_device_resample_arm(device);
+		return;
 	}
+
+	if (track)
+		evdev_resample_push(track, &sample, false);
+
+	notify_touch_sample(device, slot, &sample, touch_type);
 }
 
 static void
@@ -503,7 +752,11 @@ handle_touch_up(struct libinput_device *libinput_device,
 	timespec_from_usec(&time,
 			   libinput_event_touch_get_time_usec(touch_event));
 
+	evdev_device_flush_touch(device);
+	evdev_device_remove_touch_track(device, slot);
+
 	notify_touch(device->touch_device, &time, slot, NULL, WL_TOUCH_UP);
+	device->touch_sent = true;
 }
 
 static void
@@ -513,6 +766,11 @@ handle_touch_frame(struct libinput_device *libinput_device,
 	struct evdev_device *device =
 		libinput_device_get_user_data(libinput_device);
 
+	/* A frame of held back motion only goes out with that motion */
+	if (evdev_device_resampling(device) && !device->touch_sent)
+		return;
+
+	device->touch_sent = false;
 	notify_touch_frame(device->touch_device);
 }
 
@@ -610,6 +868,121 @@ async_notify_tablet_tool_frame(struct weston_tablet_tool *tool,
 	tool->frame_time = *time;
 }
 
+enum evdev_tool_axis {
+	EVDEV_TOOL_AXIS_MOTION = 1 << 0,
+	EVDEV_TOOL_AXIS_PRESSURE = 1 << 1,
+	EVDEV_TOOL_AXIS_DISTANCE = 1 << 2,
+	EVDEV_TOOL_AXIS_TILT = 1 << 3,
+};
+
+static void
+notify_tablet_sample(struct evdev_device *device,
+		     const struct evdev_resample_sample *sample)
+{
+	struct weston_tablet_tool *tool = device->tool;
+	uint32_t axes = device->tool_held_axes;
+	struct timespec time;
+
+	timespec_from_usec(&time, sample->time_usec);
+
+	if (axes & EVDEV_TOOL_AXIS_MOTION)
+		notify_tablet_tool_motion(tool, &time, sample->pos);
+	if (axes & EVDEV_TOOL_AXIS_PRESSURE)
+		notify_tablet_tool_pressure(tool, &time, sample->pressure);
+	if (axes & EVDEV_TOOL_AXIS_DISTANCE)
+		notify_tablet_tool_distance(tool, &time, device->tool_distance);
+	if (axes & EVDEV_TOOL_AXIS_TILT)
+		notify_tablet_tool_tilt(tool, &time, device->tool_tilt_x,
+					device->tool_tilt_y);
+	async_notify_tablet_tool_frame(tool, &time);
+
+	/* Only position and pressure are resampled, and sent again until
+	 * the latest report went out. */
+	if (device->tool_track.held)
+		device->tool_held_axes &= EVDEV_TOOL_AXIS_MOTION |
+					  EVDEV_TOOL_AXIS_PRESSURE;
+	else
+		device->tool_held_axes = 0;
+}
+
+static void
+evdev_device_flush_tablet(struct evdev_device *device)
+{
+	struct evdev_resample_track *track = &device->tool_track;
+
+	if (!track->held)
+		return;
+
+	track->held = false;
+	track->fresh = false;
+	notify_tablet_sample(device, &track->samples[track->count - 1]);
+}
+
+/* Records the axes of a tablet tool event, with the last values of the
+ * others, and holds them back for the next frame if asked to. */
+static void
+evdev_device_track_tablet(struct evdev_device *device,
+			  struct weston_tablet_tool *tool,
+			  struct libinput_event_tablet_tool *event, bool hold)
+{
+	struct evdev_resample_track *track = &device->tool_track;
+	struct weston_output *output = device->output;
+	struct evdev_resample_sample sample = { 0 };
+	const int NORMALIZED_AXIS_MAX = 65535;
+	uint32_t axes = 0;
+
+	if (device->tool != tool) {
+		evdev_device_flush_tablet(device);
+		device->tool = tool;
+		track->count = 0;
+	}
+
+	if (track->count > 0)
+		sample = track->samples[track->count - 1];
+	sample.time_usec = libinput_event_tablet_tool_get_time_usec(event);
+
+	if (libinput_event_tablet_tool_x_has_changed(event) ||
+	    libinput_event_tablet_tool_y_has_changed(event)) {
+		double x, y;
+
+		x = libinput_event_tablet_tool_get_x_transformed(event,
+				output->current_mode->width);
+		y = libinput_event_tablet_tool_get_y_transformed(event,
+				output->current_mode->height);
+		sample.pos = weston_coord_global_from_output_point(x, y,
+								   output);
+		axes |= EVDEV_TOOL_AXIS_MOTION;
+	}
+
+	if (libinput_event_tablet_tool_pressure_has_changed(event)) {
+		sample.pressure = NORMALIZED_AXIS_MAX *
+			libinput_event_tablet_tool_get_pressure(event);
+		axes |= EVDEV_TOOL_AXIS_PRESSURE;
+	}
+
+	if (libinput_event_tablet_tool_distance_has_changed(event)) {
+		device->tool_distance = NORMALIZED_AXIS_MAX *
+			libinput_event_tablet_tool_get_distance(event);
+		axes |= EVDEV_TOOL_AXIS_DISTANCE;
+	}
+
+	if (libinput_event_tablet_tool_tilt_x_has_changed(event) ||
+	    libinput_event_tablet_tool_tilt_y_has_changed(event)) {
+		device->tool_tilt_x = wl_fixed_from_double(
+			libinput_event_tablet_tool_get_tilt_x(event));
+		device->tool_tilt_y = wl_fixed_from_double(
+			libinput_event_tablet_tool_get_tilt_y(event));
+		axes |= EVDEV_TOOL_AXIS_TILT;
+	}
+
+	evdev_resample_push(track, &sample, hold);
+	if (!hold)
+		return;
+
+	device->tool_held_axes |= axes;
+	evdev_device_resample_arm(device);
+}
+
 static void
 handle_tablet_proximity(struct libinput_device *libinput_device,
 			struct libinput_event_tablet_tool *proximity_event)
@@ -628,8 +1001,12 @@ handle_tablet_proximity(struct libinput_device *libinput_device,
 	tool = libinput_tablet_tool_get_user_data(libinput_tool);
 	tablet = device->tablet;
 
+	evdev_device_flush_tablet(device);
+
 	if (libinput_event_tablet_tool_get_proximity_state(proximity_event) ==
 	    LIBINPUT_TABLET_TOOL_PROXIMITY_STATE_OUT) {
+		device->tool = NULL;
+		device->tool_track.count = 0;
 		notify_tablet_tool_proximity_out(tool, &time);
 		async_notify_tablet_tool_frame(tool, &time);
 		return;
@@ -682,6 +1059,8 @@ handle_tablet_proximity(struct libinput_device *libinput_device,
 
 	notify_tablet_tool_proximity_in(tool, &time, tablet);
 	process_tablet_axis(device->output, tablet, tool, proximity_event);
+	if (evdev_device_resampling(device))
+		evdev_device_track_tablet(device, tool, proximity_event, false);
 	async_notify_tablet_tool_frame(tool, &time);
 }
 
@@ -701,6 +1080,11 @@ handle_tablet_axis(struct libinput_device *libinput_device,
 	timespec_from_usec(&time,
 			   libinput_event_tablet_tool_get_time(axis_event));
 
+	if (evdev_device_resampling(device)) {
+		evdev_device_track_tablet(device, tool, axis_event, true);
+		return;
+	}
+
 	process_tablet_axis(device->output, tablet, tool, axis_event);
 
 	async_notify_tablet_tool_frame(tool, &time);
@@ -721,7 +1105,10 @@ handle_tablet_tip(struct libinput_device *libinput_device,
 	timespec_from_usec(&time,
 			   libinput_event_tablet_tool_get_time(tip_event));
 
+	evdev_device_flush_tablet(device);
 	process_tablet_axis(device->output, device->tablet, tool, tip_event);
+	if (evdev_device_resampling(device))
+		evdev_device_track_tablet(device, tool, tip_event, false);
 
 	if (libinput_event_tablet_tool_get_tip_state(tip_event) ==
 	    LIBINPUT_TABLET_TOOL_TIP_DOWN)
@@ -736,6 +1123,8 @@ static void
 handle_tablet_button(struct libinput_device *libinput_device,
 		     struct libinput_event_tablet_tool *button_event)
 {
+	struct evdev_device *device =
+		libinput_device_get_user_data(libinput_device);
 	struct weston_tablet_tool *tool;
 	struct libinput_tablet_tool *libinput_tool;
 	struct timespec time;
@@ -753,10 +1142,122 @@ handle_tablet_button(struct libinput_device *libinput_device,
 	else
 		state = ZWP_TABLET_TOOL_V2_BUTTON_STATE_RELEASED;
 
+	evdev_device_flush_tablet(device);
 	notify_tablet_tool_button(tool, &time, button, state);
 	async_notify_tablet_tool_frame(tool, &time);
 }
 
+/* Sends everything held back as it is, for when there will be no frame to
+ * resample to. */
+static void
+evdev_device_flush_resampled(struct evdev_device *device)
+{
+	if (evdev_device_flush_touch(device)) {
+		device->touch_sent = false;
+		notify_touch_frame(device->touch_device);
+	}
+	evdev_device_flush_tablet(device);
+}
+
+static int
+evdev_device_resample_timer(void *data)
+{
+	struct evdev_device *device = data;
+	struct evdev_resample_track *track;
+	struct evdev_resample_sample sample;
+	struct timespec now;
+	int64_t target;
+	bool touch = false;
+
+	device->resample_armed = false;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	target = MAX(timespec_to_usec(&now) - RESAMPLE_LATENCY_USEC,
+		     device->resample_last_usec);
+	device->resample_last_usec = target;
+
+	wl_array_for_each(track, &device->touch_tracks) {
+		if (!track->held)
+			continue;
+
+		sample = evdev_resample_track_at(track, target);
+		notify_touch_sample(device, track->slot, &sample,
+				    WL_TOUCH_MOTION);
+		touch = true;
+	}
+	if (touch) {
+		device->touch_sent = false;
+		notify_touch_frame(device->touch_device);
+	}
+
+	if (device->tool_track.held) {
+		sample = evdev_resample_track_at(&device->tool_track, target);
+		notify_tablet_sample(device, &sample);
+	}
+
+	evdev_device_resample_arm(device);
+
+	return 0;
+}
+
+/** Arms the resampling timer for the next repaint of the device's output
+ *
+ * That is the scheduled repaint if there is one, or else the repaint
+ * deadline of the next vblank on the grid of the last one.
+ */
+static void
+evdev_device_resample_arm(struct evdev_device *device)
+{
+	struct weston_output *output = device->output;
+	struct evdev_resample_track *track;
+	struct timespec now, deadline;
+	int64_t refresh_nsec, delay_nsec;
+	bool held = device->tool_track.held;
+
+	wl_array_for_each(track, &device->touch_tracks)
+		held = held || track->held;
+	if (!held || !output || device->resample_armed)
+		return;
+
+	if (!device->resample_timer) {
+		struct wl_event_loop *loop =
+			wl_display_get_event_loop(output->compositor->wl_display);
+
+		device->resample_timer =
+			wl_event_loop_add_timer(loop,
+						evdev_device_resample_timer,
+						device);
+		if (!device->resample_timer) {
+			evdev_device_flush_resampled(device);
+			return;
+		}
+	}
+
+	refresh_nsec = millihz_to_nsec(output->current_mode->refresh ?: 60000);
+	weston_compositor_read_presentation_clock(output->compositor, &now);
+
+	if (output->repaint_status == REPAINT_SCHEDULED) {
+		deadline = output->next_repaint;
+	} else {
+		int64_t since_nsec =
+			timespec_sub_to_nsec(&now, &output->frame_time);
+
+		timespec_add_nsec(&deadline, &output->frame_time,
+				  (since_nsec / refresh_nsec + 1) *
+				  refresh_nsec -
+				  output->compositor->repaint_msec * 1000000LL);
+	}
+
+	delay_nsec = timespec_sub_to_nsec(&deadline, &now) -
+		     RESAMPLE_LEAD_MSEC * 1000000LL;
+	if (delay_nsec < 0 && output->repaint_status != REPAINT_SCHEDULED)
+		delay_nsec += (-delay_nsec / refresh_nsec + 1) * refresh_nsec;
+
+	wl_event_source_timer_update(device->resample_timer,
+				     MAX(delay_nsec / 1000000, 1));
+	device->resample_armed = true;
+}
+
 int
 evdev_device_process_event(struct libinput_event *event)
 {
@@ -949,6 +1450,9 @@ evdev_device_set_output(struct evdev_device *device,
 	if (device->output == output)
 		return;
 
+	/* Held back positions are on the old output */
+	evdev_device_flush_resampled(device);
+
 	if (device->output_destroy_listener.notify) {
 		wl_list_remove(&device->output_destroy_listener.link);
 		device->output_destroy_listener.notify = NULL;
@@ -1015,6 +1519,8 @@ evdev_device_create(struct libinput_device *libinput_device,
 	device->seat = seat;
 	wl_list_init(&device->link);
 	device->device = libinput_device;
+	wl_array_init(&device->touch_tracks);
+	device->tool_track.slot = -1;
 
 	if (libinput_device_has_capability(libinput_device,
 					   LIBINPUT_DEVICE_CAP_KEYBOARD)) {
@@ -1067,6 +1573,10 @@ evdev_device_destroy(struct evdev_device *device)
 	if (device->seat_caps & EVDEV_SEAT_TABLET)
 		weston_seat_release_tablet(device->tablet);
 
+	if (device->resample_timer)
+		wl_event_source_remove(device->resample_timer);
+	wl_array_release(&device->touch_tracks);
+
 	if (device->output)
 		wl_list_remove(&device->output_destroy_listener.link);
 	wl_list_remove(&device->link);
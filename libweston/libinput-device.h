@@ -42,6 +42,24 @@ enum evdev_device_seat_capability {
 	EVDEV_SEAT_TABLET = (1 << 3)
 };
 
+/* A touch point or tablet tool position at one time */
+struct evdev_resample_sample {
+	int64_t time_usec;
+	struct weston_coord_global pos;
+	struct weston_point2d_device_normalized norm;
+	double pressure;
+};
+
+/* Latest samples of a touch point or of a tablet tool, for frame-aligned
+ * resampling */
+struct evdev_resample_track {
+	int32_t slot;		/* touch seat slot, -1 for a tablet tool */
+	bool held;		/* samples[1] not sent as it is yet */
+	bool fresh;		/* samples[1] arrived since the last send */
+	unsigned int count;	/* valid samples, up to 2 */
+	struct evdev_resample_sample samples[2];	/* oldest first */
+};
+
 struct evdev_device {
 	struct weston_seat *seat;
 	enum evdev_device_seat_capability seat_caps;
@@ -55,6 +73,23 @@ struct evdev_device {
 	int fd;
 	bool override_wl_calibration;
 	struct weston_log_pacer unknown_scroll_pacer;
+
+	/* Relative motion held back by evdev_device_queue_motion() */
+	bool motion_queued;
+	struct weston_pointer_motion_event queued_motion;
+
+	/* Touch and tablet motion held back until just before the next
+	 * repaint of the output, with udev_input.resample */
+	struct wl_event_source *resample_timer;
+	bool resample_armed;
+	int64_t resample_last_usec;	/* time of the last resampled send */
+	bool touch_sent;		/* touch events since the last frame */
+	struct wl_array touch_tracks;	/* struct evdev_resample_track */
+	struct evdev_resample_track tool_track;
+	struct weston_tablet_tool *tool;	/* of tool_track, if any */
+	uint32_t tool_held_axes;
+	uint32_t tool_distance;
+	wl_fixed_t tool_tilt_x, tool_tilt_y;
 };
 
 void
@@ -67,6 +102,13 @@ evdev_device_create(struct libinput_device *libinput_device,
 int
 evdev_device_process_event(struct libinput_event *event);
 
+void
+evdev_device_queue_motion(struct evdev_device *device,
+			  struct libinput_event_pointer *pointer_event);
+
+void
+evdev_device_flush_motion(struct evdev_device *device);
+
 void
 evdev_device_set_output(struct evdev_device *device,
 			struct weston_output *output);
@@ -26,11 +26,17 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/eventfd.h>
 #include <libinput.h>
 #include <libudev.h>
 
@@ -42,6 +48,7 @@
 #include "libinput-seat.h"
 #include "libinput-device.h"
 #include "shared/helpers.h"
+#include "shared/xalloc.h"
 
 static void
 process_events(struct udev_input *input);
@@ -49,6 +56,52 @@ static struct udev_seat *
 udev_seat_create(struct udev_input *input, const char *seat_name);
 static void
 udev_seat_destroy(struct udev_seat *seat);
+static void
+udev_input_devices_added(struct udev_input *input);
+static void
+udev_input_remove_deferred_listeners(struct udev_input *input);
+static int
+udev_input_check_devices(struct udev_input *input);
+
+/* Must be a power of two */
+#define UDEV_INPUT_RING_SIZE 256
+
+struct udev_input_thread {
+	struct udev_input *input;
+	pthread_t reader;
+	int quit_fd;
+	int wake_fd;
+	struct wl_event_source *wake_source;
+
+	/* Serialises every use of the libinput context, which is not
+	 * thread-safe. The main loop runs the accessors of a dispatched
+	 * event without it. Recursive, as device configuration and LED
+	 * updates take it again from within event processing. */
+	pthread_mutex_t lock;
+
+	/* Work that has to run on the main thread, like opening devices
+	 * through the launcher, requested by the reader from within
+	 * libinput_dispatch(). The condition is also signalled when the
+	 * reader drops the lock. */
+	pthread_mutex_t call_mutex;
+	pthread_cond_t call_cond;
+	void (*call_func)(void *data);
+	void *call_data;
+	bool done;
+
+	/* Events read but not processed yet. The reader is the only
+	 * writer of head, the main loop the only writer of tail. */
+	struct libinput_event *ring[UDEV_INPUT_RING_SIZE];
+	unsigned int head;
+	unsigned int tail;
+
+	/* Seat to add the devices of before reading them, and whether
+	 * that is done, for udev_input_init() with defer_devices. */
+	char *seat_id;
+	bool devices_added;
+};
+
+static __thread bool udev_input_is_reader;
 
 static struct udev_seat *
 get_udev_seat(struct udev_input *input, struct libinput_device *device)
@@ -179,13 +232,58 @@ udev_input_disable(struct udev_input *input)
 	if (input->suspended)
 		return;
 
-	wl_event_source_remove(input->libinput_source);
-	input->libinput_source = NULL;
+	if (input->libinput_source) {
+		wl_event_source_remove(input->libinput_source);
+		input->libinput_source = NULL;
+	}
+	if (input->process_idle) {
+		wl_event_source_remove(input->process_idle);
+		input->process_idle = NULL;
+	}
+	udev_input_lock(input);
 	libinput_suspend(input->libinput);
+	udev_input_unlock(input);
 	process_events(input);
 	input->suspended = 1;
 }
 
+static void
+udev_input_flush_motion(struct udev_input *input)
+{
+	if (!input->motion_device)
+		return;
+
+	evdev_device_flush_motion(input->motion_device);
+	input->motion_device = NULL;
+}
+
+/* Holds back relative motion, or sends what was held back before any other
+ * event so that the order of events does not change. */
+static bool
+udev_input_coalesce_motion(struct udev_input *input,
+			   struct libinput_event *event)
+{
+	struct libinput_device *libinput_device =
+		libinput_event_get_device(event);
+	struct evdev_device *device =
+		libinput_device_get_user_data(libinput_device);
+
+	if (libinput_event_get_type(event) != LIBINPUT_EVENT_POINTER_MOTION ||
+	    !device) {
+		udev_input_flush_motion(input);
+		return false;
+	}
+
+	if (input->motion_device != device)
+		udev_input_flush_motion(input);
+
+	evdev_device_queue_motion(device,
+				  libinput_event_get_pointer_event(event));
+	input->motion_device = device;
+
+	return true;
+}
+
 static int
 udev_input_process_event(struct libinput_event *event)
 {
@@ -195,12 +293,19 @@ udev_input_process_event(struct libinput_event *event)
 	struct udev_input *input = libinput_get_user_data(libinput);
 	int ret = 0;
 
+	if (input->coalesce_motion && udev_input_coalesce_motion(input, event))
+		return 0;
+
 	switch (libinput_event_get_type(event)) {
 	case LIBINPUT_EVENT_DEVICE_ADDED:
+		udev_input_lock(input);
 		ret = device_added(input, libinput_device);
+		udev_input_unlock(input);
 		break;
 	case LIBINPUT_EVENT_DEVICE_REMOVED:
+		udev_input_lock(input);
 		ret = device_removed(input, libinput_device);
+		udev_input_unlock(input);
 		break;
 	default:
 		evdev_device_process_event(event);
@@ -217,15 +322,58 @@ process_event(struct libinput_event *event)
 		exit(EXIT_FAILURE);
 }
 
+static struct libinput_event *
+udev_input_thread_pop(struct udev_input_thread *thread)
+{
+	struct libinput_event *event;
+	unsigned int head;
+
+	head = __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE);
+	if (thread->tail == head)
+		return NULL;
+
+	event = thread->ring[thread->tail & (UDEV_INPUT_RING_SIZE - 1)];
+	__atomic_store_n(&thread->tail, thread->tail + 1, __ATOMIC_RELEASE);
+
+	return event;
+}
+
+static struct libinput_event *
+udev_input_next_event(struct udev_input *input)
+{
+	struct libinput_event *event;
+
+	if (input->thread) {
+		event = udev_input_thread_pop(input->thread);
+		if (event)
+			return event;
+	}
+
+	/* With a reader thread, events only stay in libinput when the ring
+	 * was full. Check the ring again under the lock to keep them in
+	 * order. */
+	udev_input_lock(input);
+	event = input->thread ? udev_input_thread_pop(input->thread) : NULL;
+	if (!event)
+		event = libinput_get_event(input->libinput);
+	udev_input_unlock(input);
+
+	return event;
+}
+
 static void
 process_events(struct udev_input *input)
 {
 	struct libinput_event *event;
 
-	while ((event = libinput_get_event(input->libinput))) {
+	while ((event = udev_input_next_event(input))) {
 		process_event(event);
+		udev_input_lock(input);
 		libinput_event_destroy(event);
+		udev_input_unlock(input);
 	}
+
+	udev_input_flush_motion(input);
 }
 
 static int
@@ -239,12 +387,391 @@ udev_input_dispatch(struct udev_input *input)
 	return 0;
 }
 
+static void
+udev_input_process_idle(void *data)
+{
+	struct udev_input *input = data;
+
+	input->process_idle = NULL;
+	process_events(input);
+}
+
 static int
 libinput_source_dispatch(int fd, uint32_t mask, void *data)
 {
 	struct udev_input *input = data;
+	struct weston_compositor *c = input->compositor;
+	struct wl_event_loop *loop;
+
+	if (!c->preempted_client)
+		return udev_input_dispatch(input) != 0;
+
+	/* In between two requests of a client only read the devices, so
+	 * that the kernel does not drop events while the client floods us.
+	 * Bindings may destroy clients, so the events are processed once
+	 * the client is done. */
+	if (libinput_dispatch(input->libinput) != 0)
+		weston_log("libinput: Failed to dispatch libinput\n");
+
+	if (!input->process_idle) {
+		loop = wl_display_get_event_loop(c->wl_display);
+		input->process_idle =
+			wl_event_loop_add_idle(loop, udev_input_process_idle,
+					       input);
+	}
+
+	return 0;
+}
+
+void
+udev_input_lock(struct udev_input *input)
+{
+	struct udev_input_thread *thread = input->thread;
 
-	return udev_input_dispatch(input) != 0;
+	if (!thread)
+		return;
+
+	/* The reader may be waiting for us to run something on its behalf
+	 * while it holds the lock, so serve it instead of blocking. */
+	pthread_mutex_lock(&thread->call_mutex);
+	while (pthread_mutex_trylock(&thread->lock) != 0) {
+		void (*func)(void *data) = thread->call_func;
+
+		if (!func) {
+			pthread_cond_wait(&thread->call_cond,
+					  &thread->call_mutex);
+			continue;
+		}
+
+		pthread_mutex_unlock(&thread->call_mutex);
+		func(thread->call_data);
+		pthread_mutex_lock(&thread->call_mutex);
+		thread->call_func = NULL;
+		pthread_cond_broadcast(&thread->call_cond);
+	}
+	pthread_mutex_unlock(&thread->call_mutex);
+}
+
+void
+udev_input_unlock(struct udev_input *input)
+{
+	if (input->thread)
+		pthread_mutex_unlock(&input->thread->lock);
+}
+
+static void
+udev_input_thread_wake(int fd)
+{
+	uint64_t one = 1;
+
+	/* Only fails with the counter saturated, so a wake-up is pending */
+	if (write(fd, &one, sizeof one) < 0)
+		return;
+}
+
+/* Runs func on the main thread and waits for it, called by the reader. */
+static void
+udev_input_thread_call(struct udev_input_thread *thread,
+		       void (*func)(void *data), void *data)
+{
+	pthread_mutex_lock(&thread->call_mutex);
+	thread->call_func = func;
+	thread->call_data = data;
+	pthread_cond_broadcast(&thread->call_cond);
+	pthread_mutex_unlock(&thread->call_mutex);
+
+	udev_input_thread_wake(thread->wake_fd);
+
+	pthread_mutex_lock(&thread->call_mutex);
+	while (thread->call_func)
+		pthread_cond_wait(&thread->call_cond, &thread->call_mutex);
+	pthread_mutex_unlock(&thread->call_mutex);
+}
+
+static void
+udev_input_thread_log_call(void *data)
+{
+	weston_log("%s", (const char *) data);
+}
+
+static void
+udev_input_thread_serve(struct udev_input_thread *thread)
+{
+	void (*func)(void *data);
+
+	pthread_mutex_lock(&thread->call_mutex);
+	func = thread->call_func;
+	pthread_mutex_unlock(&thread->call_mutex);
+
+	if (!func)
+		return;
+
+	func(thread->call_data);
+
+	pthread_mutex_lock(&thread->call_mutex);
+	thread->call_func = NULL;
+	pthread_cond_broadcast(&thread->call_cond);
+	pthread_mutex_unlock(&thread->call_mutex);
+}
+
+/* Moves as many events out of libinput as fit in the ring. Whatever is left
+ * is picked up by the main loop directly. */
+static bool
+udev_input_thread_fill(struct udev_input_thread *thread)
+{
+	struct libinput_event *event;
+	unsigned int head = thread->head;
+	unsigned int tail;
+
+	tail = __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE);
+	while (head - tail < UDEV_INPUT_RING_SIZE &&
+	       (event = libinput_get_event(thread->input->libinput))) {
+		thread->ring[head & (UDEV_INPUT_RING_SIZE - 1)] = event;
+		head++;
+	}
+
+	if (head == thread->head)
+		return false;
+
+	__atomic_store_n(&thread->head, head, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static void *
+udev_input_thread_run(void *data)
+{
+	struct udev_input_thread *thread = data;
+	struct libinput *libinput = thread->input->libinput;
+	struct pollfd fds[2] = {
+		{ .fd = libinput_get_fd(libinput), .events = POLLIN },
+		{ .fd = thread->quit_fd, .events = POLLIN },
+	};
+	bool queued;
+
+	udev_input_is_reader = true;
+
+	if (thread->seat_id) {
+		pthread_mutex_lock(&thread->lock);
+		if (libinput_udev_assign_seat(libinput, thread->seat_id) != 0)
+			udev_input_thread_call(thread,
+					       udev_input_thread_log_call,
+					       (void *) "libinput: failed to add the input devices\n");
+		udev_input_thread_fill(thread);
+		pthread_mutex_unlock(&thread->lock);
+
+		pthread_mutex_lock(&thread->call_mutex);
+		pthread_cond_broadcast(&thread->call_cond);
+		pthread_mutex_unlock(&thread->call_mutex);
+
+		__atomic_store_n(&thread->devices_added, true, __ATOMIC_RELEASE);
+		udev_input_thread_wake(thread->wake_fd);
+	}
+
+	for (;;) {
+		if (poll(fds, ARRAY_LENGTH(fds), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			udev_input_thread_call(thread,
+					       udev_input_thread_log_call,
+					       (void *) "libinput: reader poll failed\n");
+			break;
+		}
+
+		if (fds[1].revents)
+			break;
+
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		pthread_mutex_lock(&thread->lock);
+		if (libinput_dispatch(libinput) != 0)
+			udev_input_thread_call(thread,
+					       udev_input_thread_log_call,
+					       (void *) "libinput: Failed to dispatch libinput\n");
+		queued = udev_input_thread_fill(thread);
+		pthread_mutex_unlock(&thread->lock);
+
+		pthread_mutex_lock(&thread->call_mutex);
+		pthread_cond_broadcast(&thread->call_cond);
+		pthread_mutex_unlock(&thread->call_mutex);
+
+		if (queued)
+			udev_input_thread_wake(thread->wake_fd);
+	}
+
+	pthread_mutex_lock(&thread->call_mutex);
+	thread->done = true;
+	pthread_cond_broadcast(&thread->call_cond);
+	pthread_mutex_unlock(&thread->call_mutex);
+
+	return NULL;
+}
+
+static int
+udev_input_thread_wake_handler(int fd, uint32_t mask, void *data)
+{
+	struct udev_input *input = data;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		weston_log("libinput: failed to read wake-up: %s\n",
+			   strerror(errno));
+
+	udev_input_thread_serve(input->thread);
+	process_events(input);
+
+	if (__atomic_exchange_n(&input->thread->devices_added, false,
+				__ATOMIC_ACQ_REL))
+		udev_input_devices_added(input);
+
+	return 0;
+}
+
+static void
+udev_input_thread_destroy(struct udev_input_thread *thread)
+{
+	struct libinput_event *event;
+
+	if (thread->wake_source)
+		wl_event_source_remove(thread->wake_source);
+
+	while ((event = udev_input_thread_pop(thread)))
+		libinput_event_destroy(event);
+
+	if (thread->wake_fd >= 0)
+		close(thread->wake_fd);
+	if (thread->quit_fd >= 0)
+		close(thread->quit_fd);
+	free(thread->seat_id);
+	pthread_cond_destroy(&thread->call_cond);
+	pthread_mutex_destroy(&thread->call_mutex);
+	pthread_mutex_destroy(&thread->lock);
+	free(thread);
+}
+
+/** Read libinput on a thread of its own
+ *
+ * Dispatches libinput and takes the events out of it as soon as the devices
+ * have data, even while the main loop is busy repainting or with a slow
+ * client, and hands them to the main loop through a ring of events. The
+ * event timestamps are the kernel's, so they are not affected by when the
+ * main loop gets to them.
+ *
+ * Must be called after udev_input_init().
+ */
+int
+udev_input_start_thread(struct udev_input *input)
+{
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(input->compositor->wl_display);
+	struct udev_input_thread *thread;
+	pthread_mutexattr_t attr;
+	sigset_t blocked, saved;
+	int ret;
+
+	thread = xzalloc(sizeof *thread);
+	thread->input = input;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&thread->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_mutex_init(&thread->call_mutex, NULL);
+	pthread_cond_init(&thread->call_cond, NULL);
+
+	thread->quit_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	thread->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (thread->quit_fd < 0 || thread->wake_fd < 0)
+		goto err;
+
+	thread->wake_source =
+		wl_event_loop_add_fd(loop, thread->wake_fd, WL_EVENT_READABLE,
+				     udev_input_thread_wake_handler, input);
+	if (!thread->wake_source)
+		goto err;
+
+	/* Process what libinput has queued so far in order, before the
+	 * reader takes over. */
+	process_events(input);
+
+	input->thread = thread;
+
+	/* The reader adds the devices, if that is still to be done */
+	thread->seat_id = input->deferred_seat_id;
+
+	sigfillset(&blocked);
+	pthread_sigmask(SIG_BLOCK, &blocked, &saved);
+	ret = pthread_create(&thread->reader, NULL,
+			     udev_input_thread_run, thread);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (ret != 0) {
+		thread->seat_id = NULL;
+		input->thread = NULL;
+		goto err;
+	}
+
+	if (input->deferred_seat_id) {
+		udev_input_remove_deferred_listeners(input);
+		input->deferred_seat_id = NULL;
+	}
+
+	if (input->libinput_source) {
+		wl_event_source_remove(input->libinput_source);
+		input->libinput_source = NULL;
+	}
+
+	weston_log("libinput: reading input devices on a thread\n");
+
+	return 0;
+
+err:
+	weston_log("libinput: failed to start the reader thread\n");
+	udev_input_thread_destroy(thread);
+	return -1;
+}
+
+static void
+udev_input_stop_thread(struct udev_input *input)
+{
+	struct udev_input_thread *thread = input->thread;
+
+	udev_input_thread_wake(thread->quit_fd);
+
+	/* The reader may still need something from the main thread before
+	 * it gets to see the quit request. */
+	pthread_mutex_lock(&thread->call_mutex);
+	while (!thread->done) {
+		if (thread->call_func) {
+			pthread_mutex_unlock(&thread->call_mutex);
+			udev_input_thread_serve(thread);
+			pthread_mutex_lock(&thread->call_mutex);
+			continue;
+		}
+		pthread_cond_wait(&thread->call_cond, &thread->call_mutex);
+	}
+	pthread_mutex_unlock(&thread->call_mutex);
+
+	pthread_join(thread->reader, NULL);
+
+	input->thread = NULL;
+	udev_input_thread_destroy(thread);
+}
+
+struct udev_input_open_call {
+	struct udev_input *input;
+	const char *path;
+	int flags;
+	int fd;
+};
+
+static void
+open_restricted_call(void *data)
+{
+	struct udev_input_open_call *call = data;
+	struct weston_launcher *launcher = call->input->compositor->launcher;
+
+	call->fd = weston_launcher_open(launcher, call->path, call->flags);
 }
 
 static int
@@ -252,8 +779,24 @@ open_restricted(const char *path, int flags, void *user_data)
 {
 	struct udev_input *input = user_data;
 	struct weston_launcher *launcher = input->compositor->launcher;
+	struct udev_input_open_call call = { input, path, flags, -1 };
+
+	if (!udev_input_is_reader)
+		return weston_launcher_open(launcher, path, flags);
+
+	/* The launcher belongs to the main thread */
+	udev_input_thread_call(input->thread, open_restricted_call, &call);
+
+	return call.fd;
+}
+
+static void
+close_restricted_call(void *data)
+{
+	struct udev_input_open_call *call = data;
+	struct weston_launcher *launcher = call->input->compositor->launcher;
 
-	return weston_launcher_open(launcher, path, flags);
+	weston_launcher_close(launcher, call->fd);
 }
 
 static void
@@ -261,8 +804,14 @@ close_restricted(int fd, void *user_data)
 {
 	struct udev_input *input = user_data;
 	struct weston_launcher *launcher = input->compositor->launcher;
+	struct udev_input_open_call call = { input, NULL, 0, fd };
 
-	weston_launcher_close(launcher, fd);
+	if (!udev_input_is_reader) {
+		weston_launcher_close(launcher, fd);
+		return;
+	}
+
+	udev_input_thread_call(input->thread, close_restricted_call, &call);
 }
 
 const struct libinput_interface libinput_interface = {
@@ -276,21 +825,28 @@ udev_input_enable(struct udev_input *input)
 	struct wl_event_loop *loop;
 	struct weston_compositor *c = input->compositor;
 	int fd;
-	struct udev_seat *seat;
-	int devices_found = 0;
+	int ret;
 
-	loop = wl_display_get_event_loop(c->wl_display);
+	/* Read input in between the requests of a flooding client, too */
+	loop = weston_compositor_get_priority_loop(c);
 	fd = libinput_get_fd(input->libinput);
-	input->libinput_source =
-		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
-				     libinput_source_dispatch, input);
-	if (!input->libinput_source) {
-		return -1;
+	/* The reader thread, if any, keeps polling libinput instead */
+	if (!input->thread) {
+		input->libinput_source =
+			wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+					     libinput_source_dispatch, input);
+		if (!input->libinput_source) {
+			return -1;
+		}
 	}
 
 	if (input->suspended) {
-		if (libinput_resume(input->libinput) != 0) {
-			wl_event_source_remove(input->libinput_source);
+		udev_input_lock(input);
+		ret = libinput_resume(input->libinput);
+		udev_input_unlock(input);
+		if (ret != 0) {
+			if (input->libinput_source)
+				wl_event_source_remove(input->libinput_source);
 			input->libinput_source = NULL;
 			return -1;
 		}
@@ -298,6 +854,20 @@ udev_input_enable(struct udev_input *input)
 		process_events(input);
 	}
 
+	/* There is nothing to check before the devices are added */
+	if (input->deferred_seat_id)
+		return 0;
+
+	return udev_input_check_devices(input);
+}
+
+static int
+udev_input_check_devices(struct udev_input *input)
+{
+	struct weston_compositor *c = input->compositor;
+	struct udev_seat *seat;
+	int devices_found = 0;
+
 	wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
 		evdev_notify_keyboard_focus(&seat->base, &seat->devices_list);
 
@@ -330,13 +900,119 @@ libinput_log_func(struct libinput *libinput,
 		  enum libinput_log_priority priority,
 		  const char *format, va_list args)
 {
-	weston_vlog(format, args);
+	struct udev_input *input = libinput_get_user_data(libinput);
+	char *msg;
+
+	if (!udev_input_is_reader) {
+		weston_vlog(format, args);
+		return;
+	}
+
+	/* Logging is not thread-safe either, hand it to the main thread */
+	if (vasprintf(&msg, format, args) < 0)
+		return;
+	udev_input_thread_call(input->thread, udev_input_thread_log_call, msg);
+	free(msg);
+}
+
+static void
+udev_input_devices_added(struct udev_input *input)
+{
+	if (input->suspended)
+		return;
+
+	if (udev_input_check_devices(input) < 0)
+		weston_compositor_exit_with_code(input->compositor,
+						 EXIT_FAILURE);
+}
+
+static void
+udev_input_remove_deferred_listeners(struct udev_input *input)
+{
+	wl_list_remove(&input->output_created_listener.link);
+	wl_list_init(&input->output_created_listener.link);
+	wl_list_remove(&input->first_frame_listener.link);
+	wl_list_init(&input->first_frame_listener.link);
+	wl_list_remove(&input->first_output_destroy_listener.link);
+	wl_list_init(&input->first_output_destroy_listener.link);
 }
 
+/* Adds the devices on the main thread, once the first output is up. From
+ * the moment a device is opened, its events wait in the kernel's buffer
+ * until libinput reads them, so none get lost to a busy main loop. */
+static void
+udev_input_add_deferred_devices(struct udev_input *input)
+{
+	char *seat_id = input->deferred_seat_id;
+	int ret;
+
+	udev_input_remove_deferred_listeners(input);
+	input->deferred_seat_id = NULL;
+
+	udev_input_lock(input);
+	ret = libinput_udev_assign_seat(input->libinput, seat_id);
+	udev_input_unlock(input);
+	free(seat_id);
+
+	if (ret != 0) {
+		weston_log("libinput: failed to add the input devices\n");
+		weston_compositor_exit_with_code(input->compositor,
+						 EXIT_FAILURE);
+		return;
+	}
+
+	process_events(input);
+	udev_input_devices_added(input);
+}
+
+static void
+udev_input_first_frame(struct wl_listener *listener, void *data)
+{
+	struct udev_input *input =
+		container_of(listener, struct udev_input, first_frame_listener);
+
+	udev_input_add_deferred_devices(input);
+}
+
+static void
+udev_input_first_output_destroy(struct wl_listener *listener, void *data)
+{
+	struct udev_input *input =
+		container_of(listener, struct udev_input,
+			     first_output_destroy_listener);
+
+	udev_input_add_deferred_devices(input);
+}
+
+static void
+udev_input_output_created(struct wl_listener *listener, void *data)
+{
+	struct udev_input *input =
+		container_of(listener, struct udev_input,
+			     output_created_listener);
+	struct weston_output *output = data;
+
+	wl_list_remove(&input->output_created_listener.link);
+	wl_list_init(&input->output_created_listener.link);
+
+	wl_signal_add(&output->frame_signal, &input->first_frame_listener);
+	wl_signal_add(&output->destroy_signal,
+		      &input->first_output_destroy_listener);
+}
+
+/** Create the libinput context of a seat
+ *
+ * With defer_devices, the input devices are added only once the first
+ * output has shown its first frame, or right away by the reader thread if
+ * udev_input_start_thread() follows, so that startup does not wait for
+ * opening many or slow devices. Without any device, and input required,
+ * the compositor then exits instead of this failing.
+ */
 int
 udev_input_init(struct udev_input *input, struct weston_compositor *c,
 		struct udev *udev, const char *seat_id,
-		udev_configure_device_t configure_device)
+		udev_configure_device_t configure_device,
+		bool defer_devices)
 {
 	enum libinput_log_priority priority = LIBINPUT_LOG_PRIORITY_INFO;
 	const char *log_priority = NULL;
@@ -368,6 +1044,23 @@ udev_input_init(struct udev_input *input, struct weston_compositor *c,
 
 	libinput_log_set_priority(input->libinput, priority);
 
+	wl_list_init(&input->output_created_listener.link);
+	input->first_frame_listener.notify = udev_input_first_frame;
+	wl_list_init(&input->first_frame_listener.link);
+	input->first_output_destroy_listener.notify =
+		udev_input_first_output_destroy;
+	wl_list_init(&input->first_output_destroy_listener.link);
+
+	if (defer_devices) {
+		input->deferred_seat_id = xstrdup(seat_id);
+		input->output_created_listener.notify =
+			udev_input_output_created;
+		wl_signal_add(&c->output_created_signal,
+			      &input->output_created_listener);
+
+		return udev_input_enable(input);
+	}
+
 	if (libinput_udev_assign_seat(input->libinput, seat_id) != 0) {
 		libinput_unref(input->libinput);
 		return -1;
@@ -383,8 +1076,14 @@ udev_input_destroy(struct udev_input *input)
 {
 	struct udev_seat *seat, *next;
 
+	if (input->thread)
+		udev_input_stop_thread(input);
 	if (input->libinput_source)
 		wl_event_source_remove(input->libinput_source);
+	if (input->process_idle)
+		wl_event_source_remove(input->process_idle);
+	udev_input_remove_deferred_listeners(input);
+	free(input->deferred_seat_id);
 	wl_list_for_each_safe(seat, next, &input->compositor->seat_list, base.link)
 		udev_seat_destroy(seat);
 	libinput_unref(input->libinput);
@@ -458,6 +1157,7 @@ udev_seat_create(struct udev_input *input, const char *seat_name)
 		return NULL;
 
 	weston_seat_init(&seat->base, c, seat_name);
+	seat->input = input;
 	seat->base.led_update = udev_seat_led_update;
 
 	seat->output_create_listener.notify = notify_output_create;
@@ -34,9 +34,11 @@
 #include <libweston/libweston.h>
 
 struct libinput_device;
+struct udev_input_thread;
 
 struct udev_seat {
 	struct weston_seat base;
+	struct udev_input *input;
 	struct wl_list devices_list;
 	struct wl_listener output_create_listener;
 	struct wl_listener output_heads_listener;
@@ -47,10 +49,33 @@ typedef void (*udev_configure_device_t)(struct weston_compositor *compositor,
 
 struct udev_input {
 	struct libinput *libinput;
-	struct wl_event_source *libinput_source;
+	struct wl_event_source *libinput_source;	/**< on priority loop */
+	/* Processes events read while a client was preempted */
+	struct wl_event_source *process_idle;
 	struct weston_compositor *compositor;
 	int suspended;
 	udev_configure_device_t configure_device;
+
+	/* Merge runs of relative motion events from one device, within a
+	 * dispatch of libinput events */
+	bool coalesce_motion;
+	/* Device with motion held back, if any */
+	struct evdev_device *motion_device;
+
+	/* Send touch and tablet motion once per output frame, resampled
+	 * to just before the repaint */
+	bool resample;
+
+	/* Reader thread, if libinput is read off the main loop */
+	struct udev_input_thread *thread;
+
+	/* Seat whose devices are still to be added, see
+	 * udev_input_init(). Without a reader thread, that waits for the
+	 * first frame of the first output. */
+	char *deferred_seat_id;
+	struct wl_listener output_created_listener;
+	struct wl_listener first_frame_listener;
+	struct wl_listener first_output_destroy_listener;
 };
 
 int
@@ -62,9 +87,16 @@ udev_input_init(struct udev_input *input,
 		struct weston_compositor *c,
 		struct udev *udev,
 		const char *seat_id,
-		udev_configure_device_t configure_device);
+		udev_configure_device_t configure_device,
+		bool defer_devices);
 void
 udev_input_destroy(struct udev_input *input);
+int
+udev_input_start_thread(struct udev_input *input);
+void
+udev_input_lock(struct udev_input *input);
+void
+udev_input_unlock(struct udev_input *input);
 
 struct udev_seat *
 udev_seat_get_named(struct udev_input *u,
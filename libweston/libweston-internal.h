@@ -68,11 +68,33 @@ struct linux_dmabuf_memory {
 	void (*destroy)(struct linux_dmabuf_memory *dmabuf);
 };
 
+/** Completion callback of weston_renderer_read_pixels_async()
+ *
+ * \param data The user data passed with the request.
+ * \param pixels The pixels laid out as read_pixels() would write them, or
+ * NULL if the read back failed. Only valid during the call.
+ * \param stride The row stride of pixels in bytes.
+ */
+typedef void (*weston_renderer_read_pixels_done_func_t)(void *data,
+							 const void *pixels,
+							 int stride);
+
 struct weston_renderer {
 	int (*read_pixels)(struct weston_output *output,
 			   const struct pixel_format_info *format, void *pixels,
 			   uint32_t x, uint32_t y,
 			   uint32_t width, uint32_t height);
+
+	/** See weston_renderer_read_pixels_async()
+	 *
+	 * Optional, read_pixels() is used when not set.
+	 */
+	void (*read_pixels_async)(struct weston_output *output,
+				  const struct pixel_format_info *format,
+				  uint32_t x, uint32_t y,
+				  uint32_t width, uint32_t height,
+				  weston_renderer_read_pixels_done_func_t done,
+				  void *data);
 	void (*repaint_output)(struct weston_output *output,
 			       pixman_region32_t *output_damage,
 			       struct weston_renderbuffer *renderbuffer);
@@ -87,6 +109,13 @@ struct weston_renderer {
 
 	void (*flush_damage)(struct weston_paint_node *pnode);
 	void (*attach)(struct weston_paint_node *pnode);
+
+	/** See weston_view_prewarm()
+	 *
+	 * Optional.
+	 */
+	void (*prewarm)(struct weston_paint_node *pnode);
+
 	void (*destroy)(struct weston_compositor *ec);
 
 	/** See weston_surface_copy_content() */
@@ -95,6 +124,18 @@ struct weston_renderer {
 				    int src_x, int src_y,
 				    int width, int height);
 
+	/** See weston_surface_thumbnail_async()
+	 *
+	 * Optional. Draws the surface tree area box, in surface coordinates,
+	 * scaled down to width x height, and hands the PIXMAN_a8b8g8r8
+	 * pixels to done.
+	 */
+	void (*surface_thumbnail_async)(struct weston_surface *surface,
+					const struct weston_geometry *box,
+					int width, int height,
+					weston_renderer_read_pixels_done_func_t done,
+					void *data);
+
 	/** See weston_compositor_import_dmabuf() */
 	bool (*import_dmabuf)(struct weston_compositor *ec,
 			      struct linux_dmabuf_buffer *buffer);
@@ -142,6 +183,40 @@ struct weston_renderer {
 	void (*remove_renderbuffer_dmabuf)(struct weston_output *output,
 					   struct weston_renderbuffer *renderbuffer);
 
+	/**
+	 * Copy the frame being presented into a DMABUF renderbuffer
+	 *
+	 * \param output The output whose frame to copy.
+	 * \param renderbuffer A renderbuffer from create_renderbuffer_dmabuf()
+	 * for this output, of the output's size.
+	 * \param damage The region to copy, in output pixel coordinates.
+	 * \return True on success, false if the renderer cannot copy.
+	 *
+	 * Only valid while the output's frame_signal is emitted, when the
+	 * renderer's target still holds the new frame. This is a GPU copy,
+	 * the pixels are not read back. Optional.
+	 */
+	bool (*copy_output_to_renderbuffer)(struct weston_output *output,
+					    struct weston_renderbuffer *renderbuffer,
+					    pixman_region32_t *damage);
+
+	/**
+	 * Scale the frame being presented into a DMABUF renderbuffer
+	 *
+	 * \param output The output whose frame to scale.
+	 * \param renderbuffer A renderbuffer from create_renderbuffer_dmabuf()
+	 * for this output, of any size.
+	 * \param size The size of the renderbuffer, in pixels.
+	 * \return True on success, false if the renderer cannot scale.
+	 *
+	 * Like copy_output_to_renderbuffer(), but the whole frame is filtered
+	 * to fill the renderbuffer. Also valid right after the backend
+	 * repainted the output. Optional.
+	 */
+	bool (*scale_output_to_renderbuffer)(struct weston_output *output,
+					     struct weston_renderbuffer *renderbuffer,
+					     const struct weston_size *size);
+
 	/* Allocate a DMABUF that can be imported as renderbuffer
 	 *
 	 * \param renderer The renderer that allocated the DMABUF
@@ -172,11 +247,51 @@ struct weston_tearing_control {
 	bool may_tear;
 };
 
+struct weston_commit_timer {
+	struct weston_surface *surface;
+	bool has_timestamp;
+	struct timespec timestamp;
+};
+
+/* A content update held back until the repaint presenting at or after
+ * target, in the presentation clock. A zero target follows the update
+ * queued before it. Updates with an acquire_wait are further held until
+ * their linux-drm-syncobj acquire point has a fence, and with a
+ * fence_source until their acquire fence signals. Updates of sub-surfaces
+ * are queued on their main surface, in order with its own. */
+struct weston_queued_commit {
+	struct wl_list link; /* weston_surface::commit_queue of main_surface */
+	struct weston_surface *surface;
+	struct weston_surface *main_surface;
+	struct weston_surface_state state;
+	struct weston_buffer_reference buffer_ref;
+	struct timespec target;
+	struct weston_drm_syncobj_wait *acquire_wait;
+	struct wl_event_source *fence_source;
+};
+
+void
+weston_renderer_repaint_output(struct weston_output *output,
+			       pixman_region32_t *output_damage,
+			       struct weston_renderbuffer *renderbuffer);
+
 void
 weston_renderer_resize_output(struct weston_output *output,
 			      const struct weston_size *fb_size,
 			      const struct weston_geometry *area);
 
+void
+weston_renderer_read_pixels_async(struct weston_output *output,
+				  const struct pixel_format_info *format,
+				  uint32_t x, uint32_t y,
+				  uint32_t width, uint32_t height,
+				  weston_renderer_read_pixels_done_func_t done,
+				  void *data);
+
+void
+weston_output_report_render_done(struct weston_output *output,
+				 const struct timespec *done);
+
 static inline void
 check_compositing_area(const struct weston_size *fb_size,
 		       const struct weston_geometry *area)
@@ -247,6 +362,9 @@ weston_compositor_read_presentation_clock(
 			struct weston_compositor *compositor,
 			struct timespec *ts);
 
+struct wl_event_loop *
+weston_compositor_get_priority_loop(struct weston_compositor *compositor);
+
 int
 weston_compositor_init_renderer(struct weston_compositor *compositor,
 				enum weston_renderer_type renderer_type,
@@ -449,6 +567,13 @@ weston_surface_to_buffer_region(struct weston_surface *surface,
 void
 weston_surface_schedule_repaint(struct weston_surface *surface);
 
+typedef void (*weston_surface_tree_func_t)(struct weston_surface *surface,
+					   float x, float y, void *data);
+void
+weston_surface_tree_for_each(struct weston_surface *surface,
+			     float x, float y,
+			     weston_surface_tree_func_t func, void *data);
+
 /* weston_spring */
 
 void
@@ -476,6 +601,11 @@ bool
 weston_view_takes_input_at_point(struct weston_view *view,
 				 struct weston_coord_surface surf_pos);
 
+void
+weston_view_move_cursor(struct weston_view *view,
+			struct weston_coord_global pos,
+			struct weston_coord_surface offset);
+
 void
 weston_paint_node_move_to_plane(struct weston_paint_node *pnode,
 				struct weston_plane *plane);
@@ -504,8 +634,13 @@ struct weston_drm_format {
 	struct wl_array modifiers;
 };
 
+/* Formats are kept sorted by fourcc, and the modifiers of each format in
+ * ascending order, so lookups are binary searches and set operations are
+ * merges. */
 struct weston_drm_format_array {
 	struct wl_array arr;
+	/* Index of the format added last, for remove_latest_format */
+	unsigned int latest;
 };
 
 void
@@ -580,49 +715,64 @@ enum paint_node_status {
  * A generic data structure unique for surface-view-output combination.
  */
 struct weston_paint_node {
+	/* Members are grouped by access: the ones read for every node on
+	 * every repaint by paint_node_update_late(), the visibility and
+	 * damage passes and the renderers come first, so that they share
+	 * the leading cache lines. List links, only touched when nodes come
+	 * and go or are re-sorted, are last.
+	 */
+
 	/* Immutable members: */
 
-	/* struct weston_surface::paint_node_list */
-	struct wl_list surface_link;
 	struct weston_surface *surface;
-
-	/* struct weston_view::paint_node_list */
-	struct wl_list view_link;
 	struct weston_view *view;
-
-	/* struct weston_output::paint_node_list */
-	struct wl_list output_link;
 	struct weston_output *output;
 
 	/* Mutable members: */
 
 	enum paint_node_status status;
-	struct weston_matrix buffer_to_output_matrix;
-	struct weston_matrix output_to_buffer_matrix;
-	bool needs_filtering;
+	struct weston_plane *plane;
+	struct weston_plane *plane_next;
 
 	bool valid_transform;
+	bool needs_filtering;
+	bool is_fully_opaque;
+	bool is_fully_blended;
+	bool is_direct;
+	bool draw_solid;
+	bool need_hole;
+	bool surf_xform_valid;
 	enum wl_output_transform transform;
+	uint32_t psf_flags; /* presentation-feedback flags */
+	uint32_t try_view_on_plane_failure_reasons;
 
-	/* struct weston_output::paint_node_z_order_list */
-	struct wl_list z_order_link;
+	/* Moving average of the fraction of repaints with a new buffer */
+	float update_rate;
+	/* How much an overlay plane is worth for this node, see the DRM
+	 * backend's drm_output_update_overlay_scores() */
+	float plane_score;
+
+	struct weston_solid_buffer_values solid;
 
 	pixman_region32_t visible;
 	pixman_region32_t damage; /* In global coordinates */
-	struct weston_plane *plane;
-	struct weston_plane *plane_next;
+
+	struct weston_matrix buffer_to_output_matrix;
+	struct weston_matrix output_to_buffer_matrix;
 
 	struct weston_surface_color_transform surf_xform;
-	bool surf_xform_valid;
 
-	uint32_t try_view_on_plane_failure_reasons;
-	bool is_fully_opaque;
-	bool is_fully_blended;
-	bool is_direct;
-	bool draw_solid;
-	struct weston_solid_buffer_values solid;
-	bool need_hole;
-	uint32_t psf_flags; /* presentation-feedback flags */
+	/* struct weston_output::paint_node_z_order_list */
+	struct wl_list z_order_link;
+
+	/* struct weston_surface::paint_node_list */
+	struct wl_list surface_link;
+
+	/* struct weston_view::paint_node_list */
+	struct wl_list view_link;
+
+	/* struct weston_output::paint_node_list */
+	struct wl_list output_link;
 };
 
 struct weston_paint_node *
@@ -645,6 +795,15 @@ weston_surface_build_buffer_matrix(const struct weston_surface *surface,
 void
 weston_output_update_matrix(struct weston_output *output);
 
+void
+weston_compositor_build_view_list(struct weston_compositor *compositor);
+
+void
+weston_output_update_visibility(struct weston_output *output);
+
+void
+weston_output_accumulate_damage(struct weston_output *output);
+
 void
 convert_size_by_transform_scale(int32_t *width_out, int32_t *height_out,
 				int32_t width, int32_t height,
@@ -25,6 +25,7 @@
 
 #include "config.h"
 
+#include <assert.h>
 #include <errno.h>
 #include <stdint.h>
 #include <unistd.h>
@@ -476,6 +477,58 @@ err:
 	return NULL;
 }
 
+/** Narrow a scanout tranche down to the formats of a KMS plane
+ *
+ * Scanout tranches start out with the formats of all KMS planes. A backend
+ * that knows which plane a surface would be scanned out on can restrict
+ * the tranche to that plane's format/modifier pairs, so that clients do
+ * not pick a pair only some other plane supports. Pairs the renderer does
+ * not support are left out, as they are not in the table.
+ *
+ * @param tranche The scanout tranche
+ * @param format_table The dma-buf feedback formats table
+ * @param formats The plane's formats, or NULL for the formats of all planes
+ * @return 0 on success, -1 on failure
+ */
+WL_EXPORT int
+weston_dmabuf_feedback_tranche_set_scanout_formats(struct weston_dmabuf_feedback_tranche *tranche,
+						   struct weston_dmabuf_feedback_format_table *format_table,
+						   const struct weston_drm_format_array *formats)
+{
+	struct weston_drm_format *fmt;
+	struct wl_array indices;
+	uint16_t *index, *index_ptr;
+
+	assert(tranche->flags & ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT);
+
+	if (!formats)
+		return wl_array_copy(&tranche->formats_indices,
+				     &format_table->scanout_formats_indices);
+
+	wl_array_init(&indices);
+
+	wl_array_for_each(index, &format_table->scanout_formats_indices) {
+		fmt = weston_drm_format_array_find_format(formats,
+							  format_table->data[*index].format);
+		if (!fmt ||
+		    !weston_drm_format_has_modifier(fmt,
+						    format_table->data[*index].modifier))
+			continue;
+
+		index_ptr = wl_array_add(&indices, sizeof(*index_ptr));
+		if (!index_ptr) {
+			wl_array_release(&indices);
+			return -1;
+		}
+		*index_ptr = *index;
+	}
+
+	wl_array_release(&tranche->formats_indices);
+	tranche->formats_indices = indices;
+
+	return 0;
+}
+
 static void
 weston_dmabuf_feedback_tranche_destroy(struct weston_dmabuf_feedback_tranche *tranche)
 {
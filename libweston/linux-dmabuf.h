@@ -123,6 +123,15 @@ struct weston_dmabuf_feedback {
 	 * actions_needed_dmabuf_feedback. */
 	struct timespec timer;
 	uint32_t action_needed;
+
+	/* Hysteresis for the scanout tranche of this surface: repaints that
+	 * agreed on action_needed since the timer started, how long an action
+	 * must keep being needed before it is taken, and when the tranche was
+	 * last changed. hold_seconds grows while the tranche keeps flipping
+	 * back and forth. */
+	uint32_t votes;
+	time_t hold_seconds;
+	struct timespec last_change;
 };
 
 struct weston_dmabuf_feedback_tranche {
@@ -197,4 +206,9 @@ weston_dmabuf_feedback_tranche_create(struct weston_dmabuf_feedback *dmabuf_feed
 				      dev_t target_device, uint32_t flags,
 				      enum weston_dmabuf_feedback_tranche_preference preference);
 
+int
+weston_dmabuf_feedback_tranche_set_scanout_formats(struct weston_dmabuf_feedback_tranche *tranche,
+						   struct weston_dmabuf_feedback_format_table *format_table,
+						   const struct weston_drm_format_array *formats);
+
 #endif /* WESTON_LINUX_DMABUF_H */
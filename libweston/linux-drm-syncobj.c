@@ -0,0 +1,684 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <xf86drm.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "linux-drm-syncobj.h"
+#include "linux-drm-syncobj-v1-server-protocol.h"
+#include "shared/fd-util.h"
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+#include "libweston-internal.h"
+
+/* Added in Linux 6.6 */
+#ifndef DRM_IOCTL_SYNCOBJ_EVENTFD
+struct drm_syncobj_eventfd {
+	__u32 handle;
+	__u32 flags;
+	__u64 point;
+	__s32 fd;
+	__u32 pad;
+};
+#define DRM_IOCTL_SYNCOBJ_EVENTFD DRM_IOWR(0xCF, struct drm_syncobj_eventfd)
+#endif
+
+struct linux_drm_syncobj {
+	struct weston_compositor *compositor;
+	int refcount;
+
+	/* Our own reference to the DRM device file; syncobj handles belong
+	 * to it and must outlive the backend for late buffer releases. */
+	int drm_fd;
+
+	/* Binary syncobj that fences are staged in on their way into or
+	 * out of a timeline */
+	uint32_t scratch;
+
+	struct wl_listener compositor_destroy_listener;
+};
+
+struct weston_drm_syncobj_timeline {
+	struct linux_drm_syncobj *syncobj;
+	int refcount;
+	uint32_t handle;
+};
+
+struct weston_drm_syncobj_surface {
+	struct wl_resource *resource;
+	struct weston_surface *surface;
+
+	/* Pending points, consumed by wl_surface.commit */
+	struct weston_drm_syncobj_timeline *acquire_timeline;
+	uint64_t acquire_point;
+	struct weston_drm_syncobj_timeline *release_timeline;
+	uint64_t release_point;
+};
+
+static void
+linux_drm_syncobj_unref(struct linux_drm_syncobj *syncobj)
+{
+	if (--syncobj->refcount > 0)
+		return;
+
+	drmSyncobjDestroy(syncobj->drm_fd, syncobj->scratch);
+	close(syncobj->drm_fd);
+	free(syncobj);
+}
+
+static struct weston_drm_syncobj_timeline *
+timeline_ref(struct weston_drm_syncobj_timeline *timeline)
+{
+	timeline->refcount++;
+
+	return timeline;
+}
+
+static void
+timeline_unref(struct weston_drm_syncobj_timeline *timeline)
+{
+	if (!timeline || --timeline->refcount > 0)
+		return;
+
+	drmSyncobjDestroy(timeline->syncobj->drm_fd, timeline->handle);
+	linux_drm_syncobj_unref(timeline->syncobj);
+	free(timeline);
+}
+
+/* Export the fence of a timeline point as a sync file. Fails rather than
+ * blocks when no fence has been submitted for the point yet.
+ *
+ * \return a sync file fd, or -1 on failure
+ */
+static int
+timeline_export_sync_file(struct weston_drm_syncobj_timeline *timeline,
+			  uint64_t point)
+{
+	struct linux_drm_syncobj *syncobj = timeline->syncobj;
+	int fd = -1;
+
+	if (drmSyncobjTransfer(syncobj->drm_fd, syncobj->scratch, 0,
+			       timeline->handle, point, 0) < 0)
+		return -1;
+
+	if (drmSyncobjExportSyncFile(syncobj->drm_fd, syncobj->scratch,
+				     &fd) < 0)
+		return -1;
+
+	return fd;
+}
+
+/* Signal a timeline point once a fence signals, or right away without one. */
+static int
+timeline_signal(struct weston_drm_syncobj_timeline *timeline,
+		uint64_t point, int fence_fd)
+{
+	struct linux_drm_syncobj *syncobj = timeline->syncobj;
+
+	if (fence_fd < 0)
+		return drmSyncobjTimelineSignal(syncobj->drm_fd,
+						&timeline->handle, &point, 1);
+
+	if (drmSyncobjImportSyncFile(syncobj->drm_fd, syncobj->scratch,
+				     fence_fd) < 0)
+		return -1;
+
+	return drmSyncobjTransfer(syncobj->drm_fd, timeline->handle, point,
+				  syncobj->scratch, 0, 0);
+}
+
+static int
+wait_handle_event(int fd, uint32_t mask, void *data)
+{
+	struct weston_drm_syncobj_wait *wait = data;
+	uint64_t count;
+	int fence_fd;
+
+	if (read(fd, &count, sizeof count) < 0 && errno == EAGAIN)
+		return 0;
+
+	fence_fd = timeline_export_sync_file(wait->timeline, wait->point);
+	wait->done(wait, fence_fd);
+
+	return 0;
+}
+
+/* Have the kernel signal an eventfd once a fence is submitted for the
+ * point. Returns NULL with errno set on failure. */
+static struct weston_drm_syncobj_wait *
+weston_drm_syncobj_wait_create(struct weston_drm_syncobj_timeline *timeline,
+			       uint64_t point)
+{
+	struct linux_drm_syncobj *syncobj = timeline->syncobj;
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(syncobj->compositor->wl_display);
+	struct drm_syncobj_eventfd args = {
+		.handle = timeline->handle,
+		.flags = DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+		.point = point,
+	};
+	struct weston_drm_syncobj_wait *wait;
+	int fd;
+
+	fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd < 0)
+		return NULL;
+
+	args.fd = fd;
+	if (drmIoctl(syncobj->drm_fd, DRM_IOCTL_SYNCOBJ_EVENTFD, &args) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	wait = xzalloc(sizeof *wait);
+	wait->timeline = timeline_ref(timeline);
+	wait->point = point;
+	wait->eventfd = fd;
+	wait->source = wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+					    wait_handle_event, wait);
+	if (!wait->source) {
+		weston_drm_syncobj_wait_destroy(wait);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return wait;
+}
+
+void
+weston_drm_syncobj_wait_destroy(struct weston_drm_syncobj_wait *wait)
+{
+	if (wait->source)
+		wl_event_source_remove(wait->source);
+	close(wait->eventfd);
+	timeline_unref(wait->timeline);
+	free(wait);
+}
+
+/** Signal the release point of a buffer release made by set_release_point
+ *
+ * Called instead of sending zwp_linux_buffer_release_v1 events once the
+ * last reference to the release is dropped. The point signals together
+ * with the release fence the renderer left behind, if any.
+ */
+void
+weston_drm_syncobj_buffer_release_destroy(struct weston_buffer_release *buffer_release)
+{
+	struct weston_drm_syncobj_timeline *timeline =
+		buffer_release->release_timeline;
+
+	if (timeline_signal(timeline, buffer_release->release_point,
+			    buffer_release->fence_fd) < 0 &&
+	    buffer_release->fence_fd >= 0) {
+		weston_log("linux-drm-syncobj: failed to attach release fence "
+			   "to timeline point %"PRIu64", signalling it now\n",
+			   buffer_release->release_point);
+		timeline_signal(timeline, buffer_release->release_point, -1);
+	}
+
+	fd_clear(&buffer_release->fence_fd);
+	timeline_unref(timeline);
+	free(buffer_release);
+}
+
+static void
+syncobj_surface_clear_points(struct weston_drm_syncobj_surface *ss)
+{
+	timeline_unref(ss->acquire_timeline);
+	ss->acquire_timeline = NULL;
+	timeline_unref(ss->release_timeline);
+	ss->release_timeline = NULL;
+}
+
+/** Turn the pending points of a surface into pending explicit sync state
+ *
+ * Called from wl_surface.commit. The release point becomes the pending
+ * buffer release, and the acquire point becomes the pending acquire
+ * fence, which the renderer waits for on the GPU and the DRM backend
+ * hands to KMS as IN_FENCE_FD.
+ *
+ * An acquire fence can only be exported once the client has submitted
+ * the work for it. If it has not yet, *wait is set to a wait the caller
+ * must hold the content update back on, sub-surface updates included.
+ * This never blocks: the global is only advertised where the kernel can
+ * notify us of the submission.
+ *
+ * \return false if a protocol error was posted
+ */
+bool
+weston_drm_syncobj_surface_commit(struct weston_drm_syncobj_surface *ss,
+				  struct weston_drm_syncobj_wait **wait)
+{
+	struct weston_surface *surface = ss->surface;
+	struct weston_buffer *buffer = surface->pending.buffer;
+	struct weston_buffer_release *buffer_release;
+	int fence_fd;
+
+	*wait = NULL;
+
+	if (!buffer) {
+		if (ss->acquire_timeline || ss->release_timeline) {
+			wl_resource_post_error(ss->resource,
+				WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_BUFFER,
+				"no buffer attached for the timeline points");
+			return false;
+		}
+		return true;
+	}
+
+	if (!ss->acquire_timeline) {
+		wl_resource_post_error(ss->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_ACQUIRE_POINT,
+			"buffer attached without an acquire point");
+		return false;
+	}
+
+	if (!ss->release_timeline) {
+		wl_resource_post_error(ss->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_RELEASE_POINT,
+			"buffer attached without a release point");
+		return false;
+	}
+
+	if (buffer->type == WESTON_BUFFER_SHM ||
+	    buffer->type == WESTON_BUFFER_SOLID) {
+		wl_resource_post_error(ss->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_UNSUPPORTED_BUFFER,
+			"buffer type does not support explicit sync");
+		return false;
+	}
+
+	if (ss->acquire_timeline == ss->release_timeline &&
+	    ss->release_point <= ss->acquire_point) {
+		wl_resource_post_error(ss->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_CONFLICTING_POINTS,
+			"release point %"PRIu64" not after acquire point %"PRIu64,
+			ss->release_point, ss->acquire_point);
+		return false;
+	}
+
+	fence_fd = timeline_export_sync_file(ss->acquire_timeline,
+					     ss->acquire_point, 0);
+	if (fence_fd < 0) {
+		*wait = weston_drm_syncobj_wait_create(ss->acquire_timeline,
+						       ss->acquire_point);
+		if (!*wait && errno == ENOMEM) {
+			wl_client_post_no_memory(wl_resource_get_client(ss->resource));
+			return false;
+		}
+		if (!*wait) {
+			wl_resource_post_error(ss->resource,
+				WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_ACQUIRE_POINT,
+				"acquire point %"PRIu64" cannot be waited on",
+				ss->acquire_point);
+			return false;
+		}
+	}
+
+	fd_update(&surface->pending.acquire_fence_fd, fence_fd);
+
+	buffer_release = xzalloc(sizeof *buffer_release);
+	buffer_release->fence_fd = -1;
+	buffer_release->release_timeline = ss->release_timeline;
+	buffer_release->release_point = ss->release_point;
+	ss->release_timeline = NULL;
+	weston_buffer_release_reference(&surface->pending.buffer_release_ref,
+					buffer_release);
+
+	syncobj_surface_clear_points(ss);
+
+	return true;
+}
+
+/* The wl_surface is going away; requests now fail with no_surface. */
+void
+weston_drm_syncobj_surface_detach(struct weston_drm_syncobj_surface *ss)
+{
+	ss->surface = NULL;
+	syncobj_surface_clear_points(ss);
+}
+
+static void
+syncobj_surface_set_point(struct weston_drm_syncobj_surface *ss,
+			  struct weston_drm_syncobj_timeline **timeline,
+			  uint64_t *point,
+			  struct wl_resource *timeline_resource,
+			  uint32_t point_hi, uint32_t point_lo)
+{
+	struct weston_drm_syncobj_timeline *new_timeline =
+		wl_resource_get_user_data(timeline_resource);
+
+	if (!ss->surface) {
+		wl_resource_post_error(ss->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_SURFACE,
+			"surface no longer exists");
+		return;
+	}
+
+	timeline_ref(new_timeline);
+	timeline_unref(*timeline);
+	*timeline = new_timeline;
+	*point = (uint64_t)point_hi << 32 | point_lo;
+}
+
+static void
+syncobj_surface_destroy(struct wl_client *client,
+			struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+syncobj_surface_set_acquire_point(struct wl_client *client,
+				  struct wl_resource *resource,
+				  struct wl_resource *timeline_resource,
+				  uint32_t point_hi, uint32_t point_lo)
+{
+	struct weston_drm_syncobj_surface *ss =
+		wl_resource_get_user_data(resource);
+
+	syncobj_surface_set_point(ss, &ss->acquire_timeline,
+				  &ss->acquire_point, timeline_resource,
+				  point_hi, point_lo);
+}
+
+static void
+syncobj_surface_set_release_point(struct wl_client *client,
+				  struct wl_resource *resource,
+				  struct wl_resource *timeline_resource,
+				  uint32_t point_hi, uint32_t point_lo)
+{
+	struct weston_drm_syncobj_surface *ss =
+		wl_resource_get_user_data(resource);
+
+	syncobj_surface_set_point(ss, &ss->release_timeline,
+				  &ss->release_point, timeline_resource,
+				  point_hi, point_lo);
+}
+
+static const struct wp_linux_drm_syncobj_surface_v1_interface
+syncobj_surface_implementation = {
+	syncobj_surface_destroy,
+	syncobj_surface_set_acquire_point,
+	syncobj_surface_set_release_point,
+};
+
+static void
+destroy_syncobj_surface(struct wl_resource *resource)
+{
+	struct weston_drm_syncobj_surface *ss =
+		wl_resource_get_user_data(resource);
+
+	if (ss->surface)
+		ss->surface->syncobj_surface = NULL;
+
+	syncobj_surface_clear_points(ss);
+	free(ss);
+}
+
+static void
+syncobj_timeline_destroy(struct wl_client *client,
+			 struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct wp_linux_drm_syncobj_timeline_v1_interface
+syncobj_timeline_implementation = {
+	syncobj_timeline_destroy,
+};
+
+static void
+destroy_syncobj_timeline(struct wl_resource *resource)
+{
+	struct weston_drm_syncobj_timeline *timeline =
+		wl_resource_get_user_data(resource);
+
+	timeline_unref(timeline);
+}
+
+static void
+syncobj_manager_destroy(struct wl_client *client,
+			struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+syncobj_manager_get_surface(struct wl_client *client,
+			    struct wl_resource *resource,
+			    uint32_t id,
+			    struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct weston_drm_syncobj_surface *ss;
+
+	/* Mixing in zwp_linux_surface_synchronization_v1 would give one
+	 * content update two sets of fences. */
+	if (surface->syncobj_surface || surface->synchronization_resource) {
+		wl_resource_post_error(resource,
+			WP_LINUX_DRM_SYNCOBJ_MANAGER_V1_ERROR_SURFACE_EXISTS,
+			"wl_surface@%"PRIu32" already has a synchronization object",
+			wl_resource_get_id(surface_resource));
+		return;
+	}
+
+	ss = xzalloc(sizeof *ss);
+	ss->resource = wl_resource_create(client,
+					  &wp_linux_drm_syncobj_surface_v1_interface,
+					  wl_resource_get_version(resource), id);
+	if (!ss->resource) {
+		free(ss);
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	ss->surface = surface;
+	surface->syncobj_surface = ss;
+	wl_resource_set_implementation(ss->resource,
+				       &syncobj_surface_implementation,
+				       ss, destroy_syncobj_surface);
+}
+
+static void
+syncobj_manager_import_timeline(struct wl_client *client,
+				struct wl_resource *resource,
+				uint32_t id, int32_t fd)
+{
+	struct linux_drm_syncobj *syncobj = wl_resource_get_user_data(resource);
+	struct weston_drm_syncobj_timeline *timeline;
+	struct wl_resource *timeline_resource;
+	uint32_t handle;
+	int ret;
+
+	ret = drmSyncobjFDToHandle(syncobj->drm_fd, fd, &handle);
+	close(fd);
+	if (ret < 0) {
+		wl_resource_post_error(resource,
+			WP_LINUX_DRM_SYNCOBJ_MANAGER_V1_ERROR_INVALID_TIMELINE,
+			"failed to import DRM syncobj timeline");
+		return;
+	}
+
+	timeline_resource =
+		wl_resource_create(client,
+				   &wp_linux_drm_syncobj_timeline_v1_interface,
+				   wl_resource_get_version(resource), id);
+	if (!timeline_resource) {
+		drmSyncobjDestroy(syncobj->drm_fd, handle);
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	timeline = xzalloc(sizeof *timeline);
+	timeline->syncobj = syncobj;
+	syncobj->refcount++;
+	timeline->refcount = 1;
+	timeline->handle = handle;
+
+	wl_resource_set_implementation(timeline_resource,
+				       &syncobj_timeline_implementation,
+				       timeline, destroy_syncobj_timeline);
+}
+
+static const struct wp_linux_drm_syncobj_manager_v1_interface
+syncobj_manager_implementation = {
+	syncobj_manager_destroy,
+	syncobj_manager_get_surface,
+	syncobj_manager_import_timeline,
+};
+
+static void
+bind_linux_drm_syncobj(struct wl_client *client, void *data,
+		       uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client,
+				      &wp_linux_drm_syncobj_manager_v1_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &syncobj_manager_implementation,
+				       data, NULL);
+}
+
+static void
+linux_drm_syncobj_compositor_destroy(struct wl_listener *listener,
+				     void *data)
+{
+	struct linux_drm_syncobj *syncobj =
+		container_of(listener, struct linux_drm_syncobj,
+			     compositor_destroy_listener);
+
+	wl_list_remove(&syncobj->compositor_destroy_listener.link);
+	linux_drm_syncobj_unref(syncobj);
+}
+
+/* Whether the kernel can notify us of fence submission through an eventfd,
+ * which came with Linux 6.6. Without it, waiting for a point to materialize
+ * would block the compositor on the client. */
+static bool
+linux_drm_syncobj_has_eventfd(int drm_fd)
+{
+	struct drm_syncobj_eventfd args = {
+		.flags = DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+	};
+	uint32_t handle;
+	int ret;
+
+	if (drmSyncobjCreate(drm_fd, 0, &handle) < 0)
+		return false;
+
+	args.handle = handle;
+	args.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (args.fd < 0) {
+		drmSyncobjDestroy(drm_fd, handle);
+		return false;
+	}
+
+	ret = drmIoctl(drm_fd, DRM_IOCTL_SYNCOBJ_EVENTFD, &args);
+
+	close(args.fd);
+	drmSyncobjDestroy(drm_fd, handle);
+
+	return ret == 0;
+}
+
+/** Advertise linux_drm_syncobj support
+ *
+ * Calling this initializes the wp_linux_drm_syncobj_manager_v1 protocol
+ * support on top of the given DRM device, if it supports timeline
+ * syncobjs and eventfd notification of them. Clients then pass explicit sync points as DRM syncobj
+ * timelines rather than sync files. Do not call this function multiple
+ * times in the compositor's lifetime.
+ *
+ * \param compositor The compositor to init for.
+ * \param drm_fd A DRM device file descriptor, not consumed.
+ * \return Zero on success or when timelines are unsupported, -1 on failure.
+ */
+WL_EXPORT int
+linux_drm_syncobj_setup(struct weston_compositor *compositor, int drm_fd)
+{
+	struct linux_drm_syncobj *syncobj;
+	uint64_t cap = 0;
+
+	if (drmGetCap(drm_fd, DRM_CAP_SYNCOBJ_TIMELINE, &cap) < 0 || !cap) {
+		weston_log("DRM device lacks timeline syncobjs, "
+			   "not advertising linux-drm-syncobj.\n");
+		return 0;
+	}
+
+	if (!linux_drm_syncobj_has_eventfd(drm_fd)) {
+		weston_log("Kernel lacks DRM syncobj eventfd support, "
+			   "not advertising linux-drm-syncobj.\n");
+		return 0;
+	}
+
+	syncobj = xzalloc(sizeof *syncobj);
+	syncobj->compositor = compositor;
+	syncobj->refcount = 1;
+	syncobj->drm_fd = fcntl(drm_fd, F_DUPFD_CLOEXEC, 0);
+	if (syncobj->drm_fd < 0)
+		goto err_fd;
+
+	if (drmSyncobjCreate(syncobj->drm_fd, 0, &syncobj->scratch) < 0)
+		goto err_scratch;
+
+	if (!wl_global_create(compositor->wl_display,
+			      &wp_linux_drm_syncobj_manager_v1_interface,
+			      1, syncobj, bind_linux_drm_syncobj))
+		goto err_global;
+
+	syncobj->compositor_destroy_listener.notify =
+		linux_drm_syncobj_compositor_destroy;
+	wl_signal_add(&compositor->destroy_signal,
+		      &syncobj->compositor_destroy_listener);
+
+	return 0;
+
+err_global:
+	drmSyncobjDestroy(syncobj->drm_fd, syncobj->scratch);
+err_scratch:
+	close(syncobj->drm_fd);
+err_fd:
+	free(syncobj);
+	return -1;
+}
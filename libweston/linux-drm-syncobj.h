@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_LINUX_DRM_SYNCOBJ_H
+#define WESTON_LINUX_DRM_SYNCOBJ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct weston_buffer_release;
+struct weston_compositor;
+struct weston_drm_syncobj_surface;
+struct weston_drm_syncobj_timeline;
+struct wl_event_source;
+
+/* Wait for a timeline point to materialize, that is, for a fence to be
+ * submitted for it, without blocking the event loop. done is called from
+ * the event loop with a sync file for the point, or -1 on failure, and
+ * must destroy the wait. */
+struct weston_drm_syncobj_wait {
+	struct weston_drm_syncobj_timeline *timeline;
+	uint64_t point;
+	int eventfd;
+	struct wl_event_source *source;
+
+	void (*done)(struct weston_drm_syncobj_wait *wait, int fence_fd);
+	void *data;
+};
+
+int
+linux_drm_syncobj_setup(struct weston_compositor *compositor, int drm_fd);
+
+bool
+weston_drm_syncobj_surface_commit(struct weston_drm_syncobj_surface *ss,
+				  struct weston_drm_syncobj_wait **wait);
+
+void
+weston_drm_syncobj_surface_detach(struct weston_drm_syncobj_surface *ss);
+
+void
+weston_drm_syncobj_wait_destroy(struct weston_drm_syncobj_wait *wait);
+
+void
+weston_drm_syncobj_buffer_release_destroy(struct weston_buffer_release *buffer_release);
+
+#endif /* WESTON_LINUX_DRM_SYNCOBJ_H */
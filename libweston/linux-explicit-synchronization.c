@@ -180,7 +180,7 @@ linux_explicit_synchronization_get_synchronization(struct wl_client *client,
 	struct weston_surface *surface =
 		wl_resource_get_user_data(surface_resource);
 
-	if (surface->synchronization_resource) {
+	if (surface->synchronization_resource || surface->syncobj_surface) {
 		wl_resource_post_error(
 			resource,
 			ZWP_LINUX_EXPLICIT_SYNCHRONIZATION_V1_ERROR_SYNCHRONIZATION_EXISTS,
@@ -30,6 +30,7 @@
 #include <poll.h>
 #include <stddef.h>
 #include <sys/ioctl.h>
+#include <linux/dma-buf.h>
 #include <wayland-server-core.h>
 
 #ifdef HAVE_LINUX_SYNC_FILE_H
@@ -41,6 +42,23 @@
 #include "linux-sync-file.h"
 #include "shared/timespec-util.h"
 
+/* Added in Linux 6.0 */
+#ifndef DMA_BUF_IOCTL_IMPORT_SYNC_FILE
+struct dma_buf_import_sync_file {
+	__u32 flags;
+	__s32 fd;
+};
+#define DMA_BUF_IOCTL_IMPORT_SYNC_FILE _IOW(DMA_BUF_BASE, 3, struct dma_buf_import_sync_file)
+#endif
+
+#ifndef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+struct dma_buf_export_sync_file {
+	__u32 flags;
+	__s32 fd;
+};
+#define DMA_BUF_IOCTL_EXPORT_SYNC_FILE _IOWR(DMA_BUF_BASE, 2, struct dma_buf_export_sync_file)
+#endif
+
 /* Check that a file descriptor represents a valid sync file
  *
  * \param fd[in] a file descriptor
@@ -57,6 +75,19 @@ linux_sync_file_is_valid(int fd)
 	return file_info.num_fences > 0;
 }
 
+/* Check without blocking whether all fences in a sync file have signalled
+ *
+ * \param fd[in] a sync file descriptor
+ * \return true if the sync file has signalled or is in an error state
+ */
+bool
+linux_sync_file_is_signalled(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	return poll(&pfd, 1, 0) != 0;
+}
+
 /* Read the timestamp stored in a sync file
  *
  * \param fd[in] fd a file descriptor for a sync file
@@ -81,3 +112,50 @@ weston_linux_sync_file_read_timestamp(int fd, struct timespec *ts)
 
 	return 0;
 }
+
+/* Make a sync file the implicit write fence of a dmabuf
+ *
+ * Consumers of the dmabuf which honour implicit synchronization then wait
+ * for the fence themselves, so the producer can hand the buffer over right
+ * away instead of waiting for the fence to signal first.
+ *
+ * \param dmabuf_fd[in] a dmabuf file descriptor
+ * \param sync_file_fd[in] a sync file, not consumed
+ * \return 0 on success, -1 if the kernel lacks support or on error
+ */
+WL_EXPORT int
+weston_linux_sync_file_attach_to_dmabuf(int dmabuf_fd, int sync_file_fd)
+{
+	struct dma_buf_import_sync_file args = {
+		.flags = DMA_BUF_SYNC_WRITE,
+		.fd = sync_file_fd,
+	};
+
+	if (ioctl(dmabuf_fd, DMA_BUF_IOCTL_IMPORT_SYNC_FILE, &args) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* Take the implicit write fence of a dmabuf as a sync file
+ *
+ * This is what a reader of the dmabuf honouring implicit synchronization
+ * would wait for, so it can stand in for an explicit acquire fence. A
+ * dmabuf nobody writes to gives an already signalled sync file.
+ *
+ * \param dmabuf_fd[in] a dmabuf file descriptor
+ * \return a new sync file fd, or -1 if the kernel lacks support or on error
+ */
+WL_EXPORT int
+weston_linux_sync_file_export_from_dmabuf(int dmabuf_fd)
+{
+	struct dma_buf_export_sync_file args = {
+		.flags = DMA_BUF_SYNC_READ,
+		.fd = -1,
+	};
+
+	if (ioctl(dmabuf_fd, DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &args) < 0)
+		return -1;
+
+	return args.fd;
+}
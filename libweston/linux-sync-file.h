@@ -32,7 +32,16 @@
 bool
 linux_sync_file_is_valid(int fd);
 
+bool
+linux_sync_file_is_signalled(int fd);
+
 int
 weston_linux_sync_file_read_timestamp(int fd, struct timespec *ts);
 
+int
+weston_linux_sync_file_attach_to_dmabuf(int dmabuf_fd, int sync_file_fd);
+
+int
+weston_linux_sync_file_export_from_dmabuf(int dmabuf_fd);
+
 #endif /* WESTON_LINUX_SYNC_FILE_H */
@@ -29,6 +29,7 @@
 
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
+#include "backend.h"
 #include "libweston-internal.h"
 #include "output-capture.h"
 #include "pixel-formats.h"
@@ -83,8 +84,22 @@
  * who provide pixel sources are also responsible for keeping the buffer
  * requirements information up-to-date with
  * weston_output_update_capture_info().
+ *
+ * Incremental capture
+ *
+ * For weston_capture_source_v1.capture_damage, weston_capture_source
+ * remembers the buffer of its last completed capture and accumulates the
+ * output repaint damage since the frame that capture holds. When the task
+ * is pulled, the damage moves into the task and tells the provider which
+ * part of the buffer it must write; anything else may be written as well,
+ * as it has not changed. Only the renderer pixel sources track damage,
+ * since the repaint damage does not cover what happens on hardware planes
+ * or in the borders.
  */
 
+/* Past this, the damage is collapsed to its bounding box */
+#define CAPTURE_DAMAGE_MAX_RECTS 32
+
 /** Implementation of weston_capture_source_v1 protocol object */
 struct weston_capture_source {
 	struct wl_resource *resource;
@@ -98,6 +113,12 @@ struct weston_capture_source {
 	struct weston_output *output;
 
 	struct weston_capture_task *pending;
+
+	/* The buffer the last completed capture wrote into, and the damage
+	 * since the frame it holds, in buffer coordinates. */
+	struct weston_buffer *last_buffer;
+	struct wl_listener last_buffer_destroy_listener;
+	pixman_region32_t damage;
 };
 
 /** A pending task to capture an output */
@@ -110,6 +131,12 @@ struct weston_capture_task {
 
 	struct weston_buffer *buffer;
 	struct wl_listener buffer_resource_destroy_listener;
+
+	/* Requested with capture_damage */
+	bool incremental;
+
+	/* The part of the buffer to write, set when pulled */
+	pixman_region32_t damage;
 };
 
 /** Buffer requirements broadcasting for a pixel source */
@@ -119,6 +146,9 @@ struct weston_output_capture_source_info {
 	int width;
 	int height;
 	uint32_t drm_format;
+
+	/* dmabufs of any size and format are accepted */
+	bool scaling;
 };
 
 /** Capture records for an output */
@@ -132,6 +162,47 @@ struct weston_output_capture_info {
 	struct weston_output_capture_source_info source_info[WESTON_OUTPUT_CAPTURE_SOURCE__COUNT];
 };
 
+static bool
+capture_source_tracks_damage(struct weston_capture_source *csrc)
+{
+	if (csrc->pixel_source != WESTON_OUTPUT_CAPTURE_SOURCE_FRAMEBUFFER &&
+	    csrc->pixel_source != WESTON_OUTPUT_CAPTURE_SOURCE_BLENDING)
+		return false;
+
+	return wl_resource_get_version(csrc->resource) >=
+	       WESTON_CAPTURE_SOURCE_V1_CAPTURE_DAMAGE_SINCE_VERSION;
+}
+
+static void
+capture_source_forget_buffer(struct weston_capture_source *csrc)
+{
+	csrc->last_buffer = NULL;
+	wl_list_remove(&csrc->last_buffer_destroy_listener.link);
+	wl_list_init(&csrc->last_buffer_destroy_listener.link);
+}
+
+static void
+capture_source_last_buffer_destroy_handler(struct wl_listener *l, void *data)
+{
+	struct weston_capture_source *csrc =
+		wl_container_of(l, csrc, last_buffer_destroy_listener);
+
+	capture_source_forget_buffer(csrc);
+}
+
+static void
+capture_source_remember_buffer(struct weston_capture_source *csrc,
+			       struct weston_buffer *buffer)
+{
+	if (csrc->last_buffer == buffer)
+		return;
+
+	capture_source_forget_buffer(csrc);
+	csrc->last_buffer = buffer;
+	wl_resource_add_destroy_listener(buffer->resource,
+					 &csrc->last_buffer_destroy_listener);
+}
+
 /** Create capture tracking information on weston_output enable */
 struct weston_output_capture_info *
 weston_output_capture_info_create(void)
@@ -166,6 +237,7 @@ weston_output_capture_info_destroy(struct weston_output_capture_info **cip)
 	/* Unlink sources. They get destroyed by their wl_resource later. */
 	wl_list_for_each_safe(csrc, tmp, &ci->capture_source_list, link) {
 		csrc->output = NULL;
+		capture_source_forget_buffer(csrc);
 
 		wl_list_remove(&csrc->link);
 		wl_list_init(&csrc->link);
@@ -193,6 +265,50 @@ weston_output_capture_info_repaint_done(struct weston_output_capture_info *ci)
 	assert(wl_list_empty(&ci->pending_capture_list));
 }
 
+/** Record what a repaint is about to change in the output image
+ *
+ * This is called with the damage the renderer repaints, before it gets to
+ * service any capture task, so that incremental captures of this repaint
+ * already include it.
+ *
+ * \param output The output being repainted.
+ * \param output_damage The repaint damage, in global coordinates.
+ */
+void
+weston_output_capture_info_add_damage(struct weston_output *output,
+				      pixman_region32_t *output_damage)
+{
+	struct weston_output_capture_info *ci = output->capture_info;
+	struct weston_capture_source *csrc;
+	pixman_region32_t damage;
+	pixman_box32_t extents;
+	bool converted = false;
+
+	wl_list_for_each(csrc, &ci->capture_source_list, link) {
+		if (!capture_source_tracks_damage(csrc))
+			continue;
+
+		if (!converted) {
+			pixman_region32_init(&damage);
+			weston_region_global_to_output(&damage, output,
+						       output_damage);
+			converted = true;
+		}
+
+		pixman_region32_union(&csrc->damage, &csrc->damage, &damage);
+		if (pixman_region32_n_rects(&csrc->damage) >
+		    CAPTURE_DAMAGE_MAX_RECTS) {
+			extents = *pixman_region32_extents(&csrc->damage);
+			pixman_region32_fini(&csrc->damage);
+			pixman_region32_init_with_extents(&csrc->damage,
+							  &extents);
+		}
+	}
+
+	if (converted)
+		pixman_region32_fini(&damage);
+}
+
 static bool
 source_info_is_available(const struct weston_output_capture_source_info *csi)
 {
@@ -214,6 +330,11 @@ capture_info_send_source_info(struct weston_output_capture_info *ci,
 						     csi->drm_format);
 		weston_capture_source_v1_send_size(csrc->resource,
 						   csi->width, csi->height);
+
+		if (csi->scaling &&
+		    wl_resource_get_version(csrc->resource) >=
+		    WESTON_CAPTURE_SOURCE_V1_SCALING_SINCE_VERSION)
+			weston_capture_source_v1_send_scaling(csrc->resource);
 	}
 }
 
@@ -255,6 +376,7 @@ weston_output_update_capture_info(struct weston_output *output,
 {
 	struct weston_output_capture_info *ci = output->capture_info;
 	struct weston_output_capture_source_info *csi;
+	struct weston_capture_source *csrc;
 
 	csi = capture_info_get_csi(ci, src);
 
@@ -267,6 +389,12 @@ weston_output_update_capture_info(struct weston_output *output,
 	csi->height = height;
 	csi->drm_format = format->format;
 
+	/* Buffers of the old requirements are no base for increments. */
+	wl_list_for_each(csrc, &ci->capture_source_list, link) {
+		if (csrc->pixel_source == src)
+			capture_source_forget_buffer(csrc);
+	}
+
 	if (source_info_is_available(csi)) {
 		capture_info_send_source_info(ci, csi);
 	} else {
@@ -286,10 +414,45 @@ weston_output_update_capture_info(struct weston_output *output,
 	}
 }
 
+/** Advertise scaled capture into dmabufs
+ *
+ * This is called by renderers that can scale and convert the pixel source
+ * into a dmabuf of any size and format on capture. Capture tasks may then
+ * carry such buffers, and the provider must check the buffer size and
+ * format itself.
+ *
+ * \param output The output whose capture info to update.
+ * \param src The source type on the output.
+ * \param scaling Whether any dmabuf is accepted.
+ */
+WL_EXPORT void
+weston_output_set_capture_scaling(struct weston_output *output,
+				  enum weston_output_capture_source src,
+				  bool scaling)
+{
+	struct weston_output_capture_info *ci = output->capture_info;
+	struct weston_output_capture_source_info *csi;
+
+	csi = capture_info_get_csi(ci, src);
+	if (csi->scaling == scaling)
+		return;
+
+	csi->scaling = scaling;
+
+	if (source_info_is_available(csi))
+		capture_info_send_source_info(ci, csi);
+}
+
 static bool
 buffer_is_compatible(struct weston_buffer *buffer,
+		     struct weston_capture_source *csrc,
 		     struct weston_output_capture_source_info *csi)
 {
+	if (csi->scaling && buffer->type == WESTON_BUFFER_DMABUF &&
+	    wl_resource_get_version(csrc->resource) >=
+	    WESTON_CAPTURE_SOURCE_V1_SCALING_SINCE_VERSION)
+		return true;
+
 	return buffer->width == csi->width &&
 	       buffer->height == csi->height &&
 	       buffer->pixel_format->format == csi->drm_format &&
@@ -307,6 +470,7 @@ weston_capture_task_destroy(struct weston_capture_task *ct)
 	ct->owner->pending = NULL;
 	wl_list_remove(&ct->link);
 	wl_list_remove(&ct->buffer_resource_destroy_listener.link);
+	pixman_region32_fini(&ct->damage);
 	free(ct);
 }
 
@@ -325,7 +489,8 @@ weston_capture_task_buffer_destroy_handler(struct wl_listener *l, void *data)
 
 static struct weston_capture_task *
 weston_capture_task_create(struct weston_capture_source *csrc,
-			   struct weston_buffer *buffer)
+			   struct weston_buffer *buffer,
+			   bool incremental)
 {
 	struct weston_capture_task *ct;
 
@@ -334,6 +499,9 @@ weston_capture_task_create(struct weston_capture_source *csrc,
 	ct->owner = csrc;
 	/* Owner will explicitly destroy us if the owner gets destroyed. */
 
+	ct->incremental = incremental;
+	pixman_region32_init(&ct->damage);
+
 	ct->buffer = buffer;
 	ct->buffer_resource_destroy_listener.notify = weston_capture_task_buffer_destroy_handler;
 	wl_resource_add_destroy_listener(buffer->resource,
@@ -367,6 +535,28 @@ capture_is_authorized(struct weston_capture_source *csrc)
 	return att.authorized && !att.denied;
 }
 
+static void
+capture_task_take_damage(struct weston_capture_task *ct,
+			 struct weston_output_capture_source_info *csi)
+{
+	struct weston_capture_source *csrc = ct->owner;
+	struct weston_buffer *buffer = ct->buffer;
+
+	pixman_region32_fini(&ct->damage);
+	pixman_region32_init_rect(&ct->damage, 0, 0,
+				  buffer->width, buffer->height);
+
+	/* The buffer still holds the last capture, so only what changed
+	 * since needs writing. Not so for scaled captures. */
+	if (ct->incremental && csrc->last_buffer == buffer &&
+	    buffer->width == csi->width && buffer->height == csi->height)
+		pixman_region32_intersect(&ct->damage, &ct->damage,
+					  &csrc->damage);
+
+	/* Whatever repaints from now on goes to the next capture. */
+	pixman_region32_clear(&csrc->damage);
+}
+
 /** Fetch the next capture task
  *
  * This is used by renderers and DRM-backend to get the next capture task
@@ -414,12 +604,14 @@ weston_output_pull_capture_task(struct weston_output *output,
 		 * Tell the client to retry, if requirements changed after
 		 * the task was filed.
 		 */
-		if (!buffer_is_compatible(ct->buffer, csi)) {
+		if (!buffer_is_compatible(ct->buffer, ct->owner, csi)) {
 			weston_capture_source_v1_send_retry(ct->owner->resource);
 			weston_capture_task_destroy(ct);
 			continue;
 		}
 
+		capture_task_take_damage(ct, csi);
+
 		/* pass ct ownership to the caller */
 		wl_list_remove(&ct->link);
 		wl_list_init(&ct->link);
@@ -450,14 +642,45 @@ weston_capture_task_get_buffer(struct weston_capture_task *ct)
 	return ct->buffer;
 }
 
+/** Get the part of the destination buffer to write
+ *
+ * This is the whole buffer, unless the task is an incremental capture into
+ * the buffer of the previous one, in which case it is what changed on the
+ * output since. It may be empty. Writing more than this is harmless, as the
+ * rest of the buffer already has the current image.
+ */
+WL_EXPORT pixman_region32_t *
+weston_capture_task_get_damage(struct weston_capture_task *ct)
+{
+	return &ct->damage;
+}
+
 /** Signal completion of the capture task
  *
- * Sends 'complete' protocol event to the client, and destroys the task.
+ * Sends 'damage' events for incremental captures and the 'complete'
+ * protocol event to the client, and destroys the task.
  */
 WL_EXPORT void
 weston_capture_task_retire_complete(struct weston_capture_task *ct)
 {
-	weston_capture_source_v1_send_complete(ct->owner->resource);
+	struct weston_capture_source *csrc = ct->owner;
+	pixman_box32_t *rects;
+	int n_rects, i;
+
+	if (ct->incremental) {
+		rects = pixman_region32_rectangles(&ct->damage, &n_rects);
+		for (i = 0; i < n_rects; i++)
+			weston_capture_source_v1_send_damage(csrc->resource,
+							     rects[i].x1,
+							     rects[i].y1,
+							     rects[i].x2 - rects[i].x1,
+							     rects[i].y2 - rects[i].y1);
+	}
+
+	if (capture_source_tracks_damage(csrc))
+		capture_source_remember_buffer(csrc, ct->buffer);
+
+	weston_capture_source_v1_send_complete(csrc->resource);
 	weston_capture_task_destroy(ct);
 }
 
@@ -469,6 +692,9 @@ WL_EXPORT void
 weston_capture_task_retire_failed(struct weston_capture_task *ct,
 				  const char *err_msg)
 {
+	/* The buffer contents are undefined now. */
+	capture_source_forget_buffer(ct->owner);
+
 	weston_capture_source_v1_send_failed(ct->owner->resource, err_msg);
 	weston_capture_task_destroy(ct);
 }
@@ -484,6 +710,8 @@ destroy_capture_source(struct wl_resource *csrc_resource)
 	if (csrc->pending)
 		weston_capture_task_destroy(csrc->pending);
 
+	capture_source_forget_buffer(csrc);
+	pixman_region32_fini(&csrc->damage);
 	wl_list_remove(&csrc->link);
 	free(csrc);
 }
@@ -496,9 +724,10 @@ weston_capture_source_v1_destroy(struct wl_client *client,
 }
 
 static void
-weston_capture_source_v1_capture(struct wl_client *client,
-				 struct wl_resource *csrc_resource,
-				 struct wl_resource *buffer_resource)
+capture_source_capture(struct wl_client *client,
+		       struct wl_resource *csrc_resource,
+		       struct wl_resource *buffer_resource,
+		       bool incremental)
 {
 	struct weston_output_capture_source_info *csi;
 	struct weston_capture_source *csrc;
@@ -537,18 +766,35 @@ weston_capture_source_v1_capture(struct wl_client *client,
 	}
 
 	/* If the buffer not up-to-date with the size and format? */
-	if (!buffer_is_compatible(buffer, csi)) {
+	if (!buffer_is_compatible(buffer, csrc, csi)) {
 		weston_capture_source_v1_send_retry(csrc->resource);
 		return;
 	}
 
-	csrc->pending = weston_capture_task_create(csrc, buffer);
+	csrc->pending = weston_capture_task_create(csrc, buffer, incremental);
 	weston_output_schedule_repaint(csrc->output);
 }
 
+static void
+weston_capture_source_v1_capture(struct wl_client *client,
+				 struct wl_resource *csrc_resource,
+				 struct wl_resource *buffer_resource)
+{
+	capture_source_capture(client, csrc_resource, buffer_resource, false);
+}
+
+static void
+weston_capture_source_v1_capture_damage(struct wl_client *client,
+					struct wl_resource *csrc_resource,
+					struct wl_resource *buffer_resource)
+{
+	capture_source_capture(client, csrc_resource, buffer_resource, true);
+}
+
 static const struct weston_capture_source_v1_interface weston_capture_source_v1_impl = {
 	.destroy = weston_capture_source_v1_destroy,
 	.capture = weston_capture_source_v1_capture,
+	.capture_damage = weston_capture_source_v1_capture_damage,
 };
 
 static int32_t
@@ -594,6 +840,10 @@ weston_capture_v1_create(struct wl_client *client,
 
 	csrc->pixel_source = isrc;
 	wl_list_init(&csrc->link);
+	csrc->last_buffer_destroy_listener.notify =
+		capture_source_last_buffer_destroy_handler;
+	wl_list_init(&csrc->last_buffer_destroy_listener.link);
+	pixman_region32_init(&csrc->damage);
 
 	csrc->resource = wl_resource_create(client,
 					    &weston_capture_source_v1_interface,
@@ -665,7 +915,7 @@ weston_compositor_install_capture_protocol(struct weston_compositor *compositor)
 	compositor->output_capture.weston_capture_v1 =
 		wl_global_create(compositor->wl_display,
 				 &weston_capture_v1_interface,
-				 1, NULL, bind_weston_capture);
+				 3, NULL, bind_weston_capture);
 	abort_oom_if_null(compositor->output_capture.weston_capture_v1);
 }
 
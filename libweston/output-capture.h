@@ -58,6 +58,10 @@ weston_output_capture_info_destroy(struct weston_output_capture_info **cip);
 void
 weston_output_capture_info_repaint_done(struct weston_output_capture_info *ci);
 
+void
+weston_output_capture_info_add_damage(struct weston_output *output,
+				      pixman_region32_t *output_damage);
+
 /*
  * For actual capturing implementations (renderers, DRM-backend):
  */
@@ -68,6 +72,11 @@ weston_output_update_capture_info(struct weston_output *output,
 				  int width, int height,
 				  const struct pixel_format_info *format);
 
+void
+weston_output_set_capture_scaling(struct weston_output *output,
+				  enum weston_output_capture_source src,
+				  bool scaling);
+
 bool
 weston_output_has_renderer_capture_tasks(struct weston_output *output);
 
@@ -82,6 +91,9 @@ weston_output_pull_capture_task(struct weston_output *output,
 struct weston_buffer *
 weston_capture_task_get_buffer(struct weston_capture_task *ct);
 
+pixman_region32_t *
+weston_capture_task_get_damage(struct weston_capture_task *ct);
+
 void
 weston_capture_task_retire_failed(struct weston_capture_task *ct,
 				  const char *err_msg);
@@ -0,0 +1,297 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libweston/libweston.h>
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+
+/*
+ * Output IDs below 64 live in an inline word, so the common case never
+ * allocates; only compositors with more outputs grow the high words.
+ */
+
+static uint64_t
+output_mask_word(const struct weston_output_mask *mask, unsigned int word)
+{
+	if (word == 0)
+		return mask->low;
+	if (word - 1 < mask->num_high)
+		return mask->high[word - 1];
+	return 0;
+}
+
+/**
+ * Initialize an empty output mask
+ *
+ * A zero-filled struct weston_output_mask is a valid empty mask as well.
+ *
+ * \param mask The mask to initialize
+ */
+WL_EXPORT void
+weston_output_mask_init(struct weston_output_mask *mask)
+{
+	mask->low = 0;
+	mask->high = NULL;
+	mask->num_high = 0;
+}
+
+/**
+ * Release the storage of an output mask, leaving it empty
+ *
+ * \param mask The mask to finish
+ */
+WL_EXPORT void
+weston_output_mask_fini(struct weston_output_mask *mask)
+{
+	free(mask->high);
+	weston_output_mask_init(mask);
+}
+
+/**
+ * Remove all outputs from a mask, keeping its storage
+ *
+ * \param mask The mask to clear
+ */
+WL_EXPORT void
+weston_output_mask_clear(struct weston_output_mask *mask)
+{
+	mask->low = 0;
+	if (mask->num_high)
+		memset(mask->high, 0, mask->num_high * sizeof(*mask->high));
+}
+
+/**
+ * Add an output ID to a mask
+ *
+ * \param mask The mask
+ * \param id The weston_output::id to add
+ */
+WL_EXPORT void
+weston_output_mask_set(struct weston_output_mask *mask, uint32_t id)
+{
+	unsigned int word = id / 64;
+	unsigned int num_high;
+
+	if (word == 0) {
+		mask->low |= UINT64_C(1) << id;
+		return;
+	}
+
+	if (word > mask->num_high) {
+		num_high = word;
+		mask->high = xrealloc(mask->high, num_high * sizeof(*mask->high));
+		memset(&mask->high[mask->num_high], 0,
+		       (num_high - mask->num_high) * sizeof(*mask->high));
+		mask->num_high = num_high;
+	}
+
+	mask->high[word - 1] |= UINT64_C(1) << (id % 64);
+}
+
+/**
+ * Remove an output ID from a mask
+ *
+ * \param mask The mask
+ * \param id The weston_output::id to remove
+ */
+WL_EXPORT void
+weston_output_mask_unset(struct weston_output_mask *mask, uint32_t id)
+{
+	unsigned int word = id / 64;
+
+	if (word == 0)
+		mask->low &= ~(UINT64_C(1) << id);
+	else if (word <= mask->num_high)
+		mask->high[word - 1] &= ~(UINT64_C(1) << (id % 64));
+}
+
+/**
+ * Check whether a mask contains an output ID
+ *
+ * \param mask The mask
+ * \param id The weston_output::id to look for
+ * \return True if the ID is in the mask
+ */
+WL_EXPORT bool
+weston_output_mask_has(const struct weston_output_mask *mask, uint32_t id)
+{
+	return (output_mask_word(mask, id / 64) >> (id % 64)) & 1;
+}
+
+/**
+ * Check whether a mask contains no output at all
+ *
+ * \param mask The mask
+ * \return True if the mask is empty
+ */
+WL_EXPORT bool
+weston_output_mask_is_empty(const struct weston_output_mask *mask)
+{
+	unsigned int i;
+
+	if (mask->low)
+		return false;
+
+	for (i = 0; i < mask->num_high; i++)
+		if (mask->high[i])
+			return false;
+
+	return true;
+}
+
+/**
+ * Count the outputs in a mask
+ *
+ * \param mask The mask
+ * \return The number of output IDs in the mask
+ */
+WL_EXPORT unsigned int
+weston_output_mask_count(const struct weston_output_mask *mask)
+{
+	unsigned int count = __builtin_popcountll(mask->low);
+	unsigned int i;
+
+	for (i = 0; i < mask->num_high; i++)
+		count += __builtin_popcountll(mask->high[i]);
+
+	return count;
+}
+
+/**
+ * Check whether two masks contain the same outputs
+ *
+ * \param a One mask
+ * \param b The other mask
+ * \return True if the masks are equal
+ */
+WL_EXPORT bool
+weston_output_mask_equal(const struct weston_output_mask *a,
+			 const struct weston_output_mask *b)
+{
+	unsigned int num_words = MAX(a->num_high, b->num_high) + 1;
+	unsigned int i;
+
+	for (i = 0; i < num_words; i++)
+		if (output_mask_word(a, i) != output_mask_word(b, i))
+			return false;
+
+	return true;
+}
+
+/**
+ * Add all outputs of one mask to another
+ *
+ * \param dst The mask receiving the outputs
+ * \param src The mask whose outputs are added
+ */
+WL_EXPORT void
+weston_output_mask_union(struct weston_output_mask *dst,
+			 const struct weston_output_mask *src)
+{
+	unsigned int i;
+
+	dst->low |= src->low;
+
+	if (src->num_high > dst->num_high) {
+		dst->high = xrealloc(dst->high,
+				     src->num_high * sizeof(*dst->high));
+		memset(&dst->high[dst->num_high], 0,
+		       (src->num_high - dst->num_high) * sizeof(*dst->high));
+		dst->num_high = src->num_high;
+	}
+
+	for (i = 0; i < src->num_high; i++)
+		dst->high[i] |= src->high[i];
+}
+
+/**
+ * Make one mask contain the same outputs as another
+ *
+ * \param dst The mask to overwrite
+ * \param src The mask to copy
+ */
+WL_EXPORT void
+weston_output_mask_copy(struct weston_output_mask *dst,
+			const struct weston_output_mask *src)
+{
+	weston_output_mask_clear(dst);
+	weston_output_mask_union(dst, src);
+}
+
+/**
+ * Find the next output ID in a mask
+ *
+ * Skips over whole empty words, so iterating a sparse mask is cheap. See
+ * weston_output_mask_for_each().
+ *
+ * \param mask The mask
+ * \param after Only IDs greater than this are returned; -1 to start
+ * \return The next output ID in the mask, or -1 if there is none
+ */
+WL_EXPORT int
+weston_output_mask_next(const struct weston_output_mask *mask, int after)
+{
+	unsigned int start = after + 1;
+	unsigned int word = start / 64;
+	uint64_t bits;
+
+	if (word > mask->num_high)
+		return -1;
+
+	bits = output_mask_word(mask, word) & (~UINT64_C(0) << (start % 64));
+	while (!bits) {
+		if (++word > mask->num_high)
+			return -1;
+		bits = output_mask_word(mask, word);
+	}
+
+	return word * 64 + __builtin_ctzll(bits);
+}
+
+/**
+ * Find the lowest output ID not in a mask
+ *
+ * \param mask The mask
+ * \return The lowest ID that is not in the mask
+ */
+WL_EXPORT uint32_t
+weston_output_mask_first_unset(const struct weston_output_mask *mask)
+{
+	unsigned int word;
+	uint64_t bits;
+
+	for (word = 0; word <= mask->num_high; word++) {
+		bits = ~output_mask_word(mask, word);
+		if (bits)
+			return word * 64 + __builtin_ctzll(bits);
+	}
+
+	return word * 64;
+}
@@ -0,0 +1,356 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <linux/input.h>
+#include <string.h>
+
+#include <libweston/libweston.h>
+#include "libweston-internal.h"
+#include "perf-hud.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+
+/**
+ * Performance HUD: a graph of the last frames of an output drawn by the
+ * renderer over its top left corner, toggled with the debug binding
+ * shift+mod+space-p.
+ *
+ * Every column is one frame: its height is the time from the start of the
+ * repaint to the presentation, green if the targeted vblank was made and
+ * red otherwise, with the time to render completion (when the renderer
+ * reports it, e.g. from the GL render fence) overlaid in blue. The grey
+ * line is one refresh period, and the graph two. Red ticks under the graph
+ * mark the frames that missed vblanks, taller for more of them. The row of
+ * squares below shows the plane assignment of the last frame: grey for
+ * paint nodes composited by the renderer, yellow for the ones the backend
+ * put on other planes.
+ *
+ * libweston has no font rendering, hence the graph instead of figures;
+ * the 'latency' and 'repaint-profile' debug scopes print those.
+ */
+
+#define HUD_MARGIN 16
+#define HUD_PADDING 4
+#define HUD_COLUMN 3
+#define HUD_GRAPH_HEIGHT 64
+#define HUD_TICK_HEIGHT 2
+#define HUD_NODE_SIZE 6
+#define HUD_WIDTH (WESTON_PERF_HUD_FRAMES * HUD_COLUMN)
+#define HUD_HEIGHT (HUD_GRAPH_HEIGHT + 2 + 4 * HUD_TICK_HEIGHT + 2 + \
+		    HUD_NODE_SIZE)
+
+static const float hud_background[4] = { 0.0f, 0.0f, 0.0f, 0.7f };
+static const float hud_refresh_line[4] = { 0.5f, 0.5f, 0.5f, 0.5f };
+static const float hud_frame_ok[4] = { 0.1f, 0.7f, 0.1f, 1.0f };
+static const float hud_frame_late[4] = { 0.9f, 0.1f, 0.1f, 1.0f };
+static const float hud_render[4] = { 0.2f, 0.5f, 0.9f, 1.0f };
+static const float hud_primary_node[4] = { 0.6f, 0.6f, 0.6f, 1.0f };
+static const float hud_plane_node[4] = { 0.9f, 0.8f, 0.1f, 1.0f };
+
+static int64_t
+hud_refresh_nsec(struct weston_output *output)
+{
+	if (!output->current_mode || output->current_mode->refresh == 0)
+		return 0;
+
+	return millihz_to_nsec(output->current_mode->refresh);
+}
+
+static void
+hud_reset(struct weston_output *output)
+{
+	struct weston_output_perf_hud *hud = output->perf_hud;
+
+	hud->next = 0;
+	hud->count = 0;
+	hud->pending = false;
+}
+
+static void
+perf_hud_binding(struct weston_keyboard *keyboard,
+		 const struct timespec *time, uint32_t key, void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_output *output;
+
+	compositor->perf_hud = !compositor->perf_hud;
+
+	/* Start over from a clean graph, and wipe the HUD off when hiding
+	 * it. */
+	wl_list_for_each(output, &compositor->output_list, link)
+		hud_reset(output);
+
+	weston_compositor_damage_all(compositor);
+}
+
+void
+weston_compositor_perf_hud_init(struct weston_compositor *compositor)
+{
+	weston_compositor_add_debug_binding(compositor, KEY_P,
+					    perf_hud_binding, compositor);
+}
+
+void
+weston_output_perf_hud_init(struct weston_output *output)
+{
+	output->perf_hud = xzalloc(sizeof(*output->perf_hud));
+}
+
+void
+weston_output_perf_hud_release(struct weston_output *output)
+{
+	free(output->perf_hud);
+	output->perf_hud = NULL;
+}
+
+void
+weston_output_perf_hud_repaint_begin(struct weston_output *output,
+				     const struct timespec *now)
+{
+	struct weston_output_perf_hud *hud = output->perf_hud;
+	int64_t refresh = hud_refresh_nsec(output);
+	int64_t since;
+
+	if (!output->compositor->perf_hud)
+		return;
+
+	memset(&hud->current, 0, sizeof(hud->current));
+	hud->repaint_time = *now;
+
+	/* The repaint targets the first vblank after it starts. */
+	hud->target = *now;
+	if (refresh > 0) {
+		since = timespec_sub_to_nsec(now, &output->frame_time);
+		if (since < 0)
+			since = 0;
+		timespec_add_nsec(&hud->target, &output->frame_time,
+				  (since / refresh + 1) * refresh);
+	}
+}
+
+void
+weston_output_perf_hud_repaint_done(struct weston_output *output, bool ok)
+{
+	struct weston_output_perf_hud *hud = output->perf_hud;
+	struct weston_paint_node *pnode;
+
+	if (!output->compositor->perf_hud || !ok)
+		return;
+
+	wl_list_for_each(pnode, &output->paint_node_z_order_list,
+			 z_order_link) {
+		if (pnode->plane == &output->primary_plane)
+			hud->current.primary_nodes++;
+		else
+			hud->current.plane_nodes++;
+	}
+
+	hud->pending = true;
+}
+
+/** Record the time from the start of the repaint to render completion
+ *
+ * The render fence may signal after the frame was presented, in which
+ * case the time goes to the frame last added to the graph.
+ */
+void
+weston_output_perf_hud_render_done(struct weston_output *output,
+				   int64_t nsec)
+{
+	struct weston_output_perf_hud *hud = output->perf_hud;
+	unsigned int last;
+
+	if (!output->compositor->perf_hud || nsec < 0)
+		return;
+
+	if (hud->pending) {
+		hud->current.render_usec = nsec / 1000;
+	} else if (hud->count > 0) {
+		last = (hud->next + WESTON_PERF_HUD_FRAMES - 1) %
+		       WESTON_PERF_HUD_FRAMES;
+		hud->frames[last].render_usec = nsec / 1000;
+	}
+}
+
+void
+weston_output_perf_hud_present(struct weston_output *output,
+			       const struct timespec *stamp)
+{
+	struct weston_output_perf_hud *hud = output->perf_hud;
+	int64_t refresh = hud_refresh_nsec(output);
+	int64_t late;
+
+	if (!hud->pending)
+		return;
+	hud->pending = false;
+
+	if (!stamp)
+		return;
+
+	hud->current.frame_usec =
+		timespec_sub_to_nsec(stamp, &hud->repaint_time) / 1000;
+
+	late = timespec_sub_to_nsec(stamp, &hud->target);
+	if (refresh > 0 && late > 0)
+		hud->current.missed = (late + refresh / 2) / refresh;
+
+	hud->frames[hud->next] = hud->current;
+	hud->next = (hud->next + 1) % WESTON_PERF_HUD_FRAMES;
+	if (hud->count < WESTON_PERF_HUD_FRAMES)
+		hud->count++;
+}
+
+static void
+hud_origin(struct weston_output *output, int32_t *x, int32_t *y)
+{
+	*x = (int32_t) output->pos.c.x + HUD_MARGIN;
+	*y = (int32_t) output->pos.c.y + HUD_MARGIN;
+}
+
+/** Add the HUD area to the damage of the primary plane
+ *
+ * The HUD changes with every frame, so it is redrawn with every repaint
+ * of the renderer.
+ */
+void
+weston_output_perf_hud_damage(struct weston_output *output,
+			      pixman_region32_t *damage)
+{
+	pixman_region32_t area;
+	int32_t x, y;
+
+	if (!output->compositor->perf_hud)
+		return;
+
+	hud_origin(output, &x, &y);
+	pixman_region32_init_rect(&area, x - HUD_PADDING, y - HUD_PADDING,
+				  HUD_WIDTH + 2 * HUD_PADDING,
+				  HUD_HEIGHT + 2 * HUD_PADDING);
+	pixman_region32_intersect(&area, &area, &output->region);
+	pixman_region32_union(damage, damage, &area);
+	pixman_region32_fini(&area);
+}
+
+static void
+hud_add_rect(struct weston_perf_hud_rect *rects, int *n, int max,
+	     int32_t x, int32_t y, int32_t width, int32_t height,
+	     const float color[4])
+{
+	struct weston_perf_hud_rect *rect;
+
+	if (*n >= max || width <= 0 || height <= 0)
+		return;
+
+	rect = &rects[(*n)++];
+	rect->x = x;
+	rect->y = y;
+	rect->width = width;
+	rect->height = height;
+	memcpy(rect->color, color, sizeof(rect->color));
+}
+
+/* Bar height for a time, the graph spanning two refresh periods */
+static int32_t
+hud_bar_height(uint32_t usec, int64_t refresh_usec)
+{
+	int64_t height = (int64_t) usec * (HUD_GRAPH_HEIGHT / 2) / refresh_usec;
+
+	return MIN(height, HUD_GRAPH_HEIGHT);
+}
+
+/** Get the rectangles to draw the HUD of an output with
+ *
+ * \param output The output being repainted.
+ * \param rects Array to fill, back to front.
+ * \param max Size of the array, WESTON_PERF_HUD_MAX_RECTS is enough.
+ * \return The number of rectangles, 0 when the HUD is hidden.
+ */
+WL_EXPORT int
+weston_output_perf_hud_get_rects(struct weston_output *output,
+				 struct weston_perf_hud_rect *rects,
+				 int max)
+{
+	struct weston_output_perf_hud *hud = output->perf_hud;
+	const struct weston_perf_hud_frame *frame;
+	int64_t refresh_usec = hud_refresh_nsec(output) / 1000;
+	int32_t x0, y0, x, h, ticks_y, nodes_y;
+	unsigned int i, nodes;
+	int n = 0;
+
+	if (!output->compositor->perf_hud)
+		return 0;
+
+	if (refresh_usec <= 0)
+		refresh_usec = 16667;
+
+	hud_origin(output, &x0, &y0);
+	ticks_y = y0 + HUD_GRAPH_HEIGHT + 2;
+	nodes_y = ticks_y + 4 * HUD_TICK_HEIGHT + 2;
+
+	hud_add_rect(rects, &n, max, x0 - HUD_PADDING, y0 - HUD_PADDING,
+		     HUD_WIDTH + 2 * HUD_PADDING, HUD_HEIGHT + 2 * HUD_PADDING,
+		     hud_background);
+	hud_add_rect(rects, &n, max, x0, y0 + HUD_GRAPH_HEIGHT / 2,
+		     HUD_WIDTH, 1, hud_refresh_line);
+
+	/* Oldest frame on the left */
+	for (i = 0; i < hud->count; i++) {
+		frame = &hud->frames[(hud->next + WESTON_PERF_HUD_FRAMES -
+				      hud->count + i) % WESTON_PERF_HUD_FRAMES];
+		x = x0 + i * HUD_COLUMN;
+
+		h = hud_bar_height(frame->frame_usec, refresh_usec);
+		hud_add_rect(rects, &n, max, x, y0 + HUD_GRAPH_HEIGHT - h,
+			     HUD_COLUMN - 1, h,
+			     frame->missed ? hud_frame_late : hud_frame_ok);
+
+		h = hud_bar_height(frame->render_usec, refresh_usec);
+		hud_add_rect(rects, &n, max, x, y0 + HUD_GRAPH_HEIGHT - h,
+			     HUD_COLUMN - 1, h, hud_render);
+
+		h = MIN(frame->missed, 4u) * HUD_TICK_HEIGHT;
+		hud_add_rect(rects, &n, max, x, ticks_y, HUD_COLUMN - 1, h,
+			     hud_frame_late);
+	}
+
+	if (hud->count == 0)
+		return n;
+
+	frame = &hud->frames[(hud->next + WESTON_PERF_HUD_FRAMES - 1) %
+			     WESTON_PERF_HUD_FRAMES];
+	nodes = frame->primary_nodes + frame->plane_nodes;
+	for (i = 0; i < MIN(nodes, (unsigned int) WESTON_PERF_HUD_NODES); i++) {
+		hud_add_rect(rects, &n, max,
+			     x0 + i * (HUD_NODE_SIZE + 2), nodes_y,
+			     HUD_NODE_SIZE, HUD_NODE_SIZE,
+			     i < frame->primary_nodes ?
+			     hud_primary_node : hud_plane_node);
+	}
+
+	return n;
+}
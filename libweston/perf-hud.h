@@ -0,0 +1,107 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_PERF_HUD_H
+#define WESTON_PERF_HUD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <pixman.h>
+
+struct weston_compositor;
+struct weston_output;
+
+/** Frames shown in the HUD graph */
+#define WESTON_PERF_HUD_FRAMES 64
+/** Paint nodes shown in the plane assignment row */
+#define WESTON_PERF_HUD_NODES 24
+/** Rectangles the HUD is drawn with, at most */
+#define WESTON_PERF_HUD_MAX_RECTS (2 + 3 * WESTON_PERF_HUD_FRAMES + \
+				   WESTON_PERF_HUD_NODES)
+
+/** What the HUD shows of one frame */
+struct weston_perf_hud_frame {
+	uint32_t frame_usec;	/**< start of repaint to presentation */
+	uint32_t render_usec;	/**< start of repaint to render completion */
+	uint32_t primary_nodes;	/**< paint nodes composited by the renderer */
+	uint32_t plane_nodes;	/**< paint nodes on other planes */
+	uint32_t missed;	/**< vblanks missed after the targeted one */
+};
+
+/** Performance HUD state of an output */
+struct weston_output_perf_hud {
+	struct weston_perf_hud_frame frames[WESTON_PERF_HUD_FRAMES];
+	unsigned int next;	/**< slot of the next presented frame */
+	unsigned int count;	/**< frames presented so far, up to the size */
+
+	bool pending;		/**< repainted, awaiting finish_frame */
+	struct weston_perf_hud_frame current;
+	struct timespec repaint_time;	/**< on the presentation clock */
+	struct timespec target;		/**< vblank the repaint targets */
+};
+
+/** A solid rectangle of the HUD, in global coordinates */
+struct weston_perf_hud_rect {
+	int32_t x, y;
+	int32_t width, height;
+	float color[4];		/**< premultiplied sRGB */
+};
+
+void
+weston_compositor_perf_hud_init(struct weston_compositor *compositor);
+
+void
+weston_output_perf_hud_init(struct weston_output *output);
+
+void
+weston_output_perf_hud_release(struct weston_output *output);
+
+void
+weston_output_perf_hud_repaint_begin(struct weston_output *output,
+				     const struct timespec *now);
+
+void
+weston_output_perf_hud_repaint_done(struct weston_output *output, bool ok);
+
+void
+weston_output_perf_hud_render_done(struct weston_output *output,
+				   int64_t nsec);
+
+void
+weston_output_perf_hud_present(struct weston_output *output,
+			       const struct timespec *stamp);
+
+void
+weston_output_perf_hud_damage(struct weston_output *output,
+			      pixman_region32_t *damage);
+
+int
+weston_output_perf_hud_get_rects(struct weston_output *output,
+				 struct weston_perf_hud_rect *rects,
+				 int max);
+
+#endif /* WESTON_PERF_HUD_H */
@@ -26,8 +26,10 @@
 
 #include "config.h"
 
+#include <assert.h>
 #include <endian.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -655,6 +657,78 @@ static const struct pixel_format_info pixel_format_table[] = {
 	},
 };
 
+/* Open-addressed hash indices over pixel_format_table, keyed by fourcc and
+ * by opaque substitute. Slots hold the table index plus one, zero marks an
+ * empty slot. Kept under half full, lookups settle within a probe or two. */
+#define FORMAT_INDEX_BITS 8
+#define FORMAT_INDEX_SIZE (1u << FORMAT_INDEX_BITS)
+
+static uint8_t format_index[FORMAT_INDEX_SIZE];
+static uint8_t opaque_substitute_index[FORMAT_INDEX_SIZE];
+static pthread_once_t format_index_once = PTHREAD_ONCE_INIT;
+
+static_assert(ARRAY_LENGTH(pixel_format_table) < FORMAT_INDEX_SIZE / 2,
+	      "pixel format index too small");
+
+static inline unsigned int
+format_index_hash(uint32_t key)
+{
+	/* Fibonacci hashing spreads the ASCII fourcc bytes well. */
+	return (key * 2654435761u) >> (32 - FORMAT_INDEX_BITS);
+}
+
+static inline uint32_t
+format_index_key(const struct pixel_format_info *info, bool by_substitute)
+{
+	return by_substitute ? info->opaque_substitute : info->format;
+}
+
+static void
+format_index_insert(uint8_t *slots, bool by_substitute, unsigned int i)
+{
+	uint32_t key = format_index_key(&pixel_format_table[i], by_substitute);
+	unsigned int slot = format_index_hash(key);
+
+	for (; slots[slot]; slot = (slot + 1) & (FORMAT_INDEX_SIZE - 1)) {
+		/* Keep the first entry for a key, as a linear scan would. */
+		if (format_index_key(&pixel_format_table[slots[slot] - 1],
+				     by_substitute) == key)
+			return;
+	}
+
+	slots[slot] = i + 1;
+}
+
+static void
+format_index_build(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(pixel_format_table); i++) {
+		format_index_insert(format_index, false, i);
+		if (pixel_format_table[i].opaque_substitute)
+			format_index_insert(opaque_substitute_index, true, i);
+	}
+}
+
+static const struct pixel_format_info *
+format_index_lookup(const uint8_t *slots, bool by_substitute, uint32_t key)
+{
+	const struct pixel_format_info *info;
+	unsigned int slot;
+
+	pthread_once(&format_index_once, format_index_build);
+
+	for (slot = format_index_hash(key); slots[slot];
+	     slot = (slot + 1) & (FORMAT_INDEX_SIZE - 1)) {
+		info = &pixel_format_table[slots[slot] - 1];
+		if (format_index_key(info, by_substitute) == key)
+			return info;
+	}
+
+	return NULL;
+}
+
 WL_EXPORT const struct pixel_format_info *
 pixel_format_get_info_shm(uint32_t format)
 {
@@ -669,14 +743,7 @@ pixel_format_get_info_shm(uint32_t format)
 WL_EXPORT const struct pixel_format_info *
 pixel_format_get_info(uint32_t format)
 {
-	unsigned int i;
-
-	for (i = 0; i < ARRAY_LENGTH(pixel_format_table); i++) {
-		if (pixel_format_table[i].format == format)
-			return &pixel_format_table[i];
-	}
-
-	return NULL;
+	return format_index_lookup(format_index, false, format);
 }
 
 WL_EXPORT const struct pixel_format_info *
@@ -735,6 +802,13 @@ pixel_format_is_opaque(const struct pixel_format_info *info)
 	return !info->opaque_substitute;
 }
 
+WL_EXPORT bool
+pixel_format_is_yuv(const struct pixel_format_info *info)
+{
+	/* Only the RGB formats describe their channel depths. */
+	return info->bits.r == 0 && info->bits.g == 0 && info->bits.b == 0;
+}
+
 WL_EXPORT const struct pixel_format_info *
 pixel_format_get_opaque_substitute(const struct pixel_format_info *info)
 {
@@ -747,14 +821,11 @@ pixel_format_get_opaque_substitute(const struct pixel_format_info *info)
 WL_EXPORT const struct pixel_format_info *
 pixel_format_get_info_by_opaque_substitute(uint32_t format)
 {
-	unsigned int i;
-
-	for (i = 0; i < ARRAY_LENGTH(pixel_format_table); i++) {
-		if (pixel_format_table[i].opaque_substitute == format)
-			return &pixel_format_table[i];
-	}
+	/* Formats without a substitute are not in the index. */
+	if (format == 0)
+		return NULL;
 
-	return NULL;
+	return format_index_lookup(opaque_substitute_index, true, format);
 }
 
 WL_EXPORT unsigned int
@@ -248,6 +248,18 @@ pixel_format_get_plane_count(const struct pixel_format_info *format);
 bool
 pixel_format_is_opaque(const struct pixel_format_info *format);
 
+/**
+ * Determine if a pixel format stores YCbCr rather than RGB
+ *
+ * Such formats must be converted to RGB with some colour encoding and
+ * quantization range before they can be blended or displayed.
+ *
+ * @param format Pixel format info structure
+ * @returns True if the format is a YUV format, false for RGB formats
+ */
+bool
+pixel_format_is_yuv(const struct pixel_format_info *format);
+
 /**
  * Get compatible opaque equivalent for a format
  *
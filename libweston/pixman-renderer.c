@@ -28,6 +28,9 @@
 #include "config.h"
 
 #include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -36,6 +39,7 @@
 #include "color.h"
 #include "pixel-formats.h"
 #include "output-capture.h"
+#include "perf-hud.h"
 #include "shared/helpers.h"
 #include "shared/weston-drm-fourcc.h"
 #include "shared/xalloc.h"
@@ -49,12 +53,22 @@ struct pixman_output_state {
 	const struct pixel_format_info *hw_format;
 	struct weston_size fb_size;
 	struct wl_list renderbuffer_list;
+	/* shadow areas skipped by direct copies, in global coordinates */
+	pixman_region32_t shadow_damage;
+};
+
+/* Image wrapping a wl_shm buffer, kept across attaches of the buffer */
+struct pixman_buffer_state {
+	pixman_image_t *image;
+	struct wl_listener destroy_listener;
 };
 
 struct pixman_surface_state {
 	struct weston_surface *surface;
 
 	pixman_image_t *image;
+	/* fill color when image is a solid fill rather than bits */
+	pixman_color_t solid_color;
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_release_reference buffer_release_ref;
 
@@ -70,6 +84,42 @@ struct pixman_renderbuffer {
 	struct wl_list link;
 };
 
+/* Output rows each band covers at least when repainting in tiles */
+#define PIXMAN_BAND_MIN_ROWS 16
+/* Bands queued per repaint thread, so that busy bands balance out */
+#define PIXMAN_BANDS_PER_THREAD 4
+
+/** One horizontal slice of the output damage, repainted on its own */
+struct pixman_repaint_band {
+	/* private image sharing the bits of the output's target image */
+	pixman_image_t *target;
+	/* damage in this band, in global coordinates */
+	pixman_region32_t damage;
+};
+
+/** Worker threads repainting the bands of one output at a time
+ *
+ * The repainting thread publishes the bands under the mutex and then
+ * takes bands from the same queue as the workers until none are left.
+ * Workers only read compositor state, which cannot change while the
+ * repainting thread waits for the last band to complete.
+ */
+struct pixman_repaint_pool {
+	pthread_t *threads;
+	int n_threads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	bool quit;
+
+	struct weston_output *output;
+	struct pixman_repaint_band *bands;
+	int n_bands;
+	int next_band;
+	int pending;
+};
+
 struct pixman_renderer {
 	struct weston_renderer base;
 
@@ -77,6 +127,9 @@ struct pixman_renderer {
 	pixman_image_t *debug_color;
 	struct weston_binding *debug_binding;
 
+	/* NULL unless repainting in tiles is enabled */
+	struct pixman_repaint_pool *pool;
+
 	struct wl_signal destroy_signal;
 };
 
@@ -234,9 +287,9 @@ composite_whole(pixman_op_t op,
 				 dest_width, dest_height);
 }
 
-static void
-composite_clipped(struct weston_output *output,
-		  pixman_image_t *src,
+/* Returns how many times the destination was composited over. */
+static int
+composite_clipped(pixman_image_t *src,
 		  pixman_image_t *mask,
 		  pixman_image_t *dest,
 		  const pixman_transform_t *transform,
@@ -304,11 +357,28 @@ composite_clipped(struct weston_output *output,
 		pixman_image_unref(boximg);
 	}
 
-	if (n_box > 1) {
-		weston_log_paced(&output->pixman_overdraw_pacer, 1, 0,
-				 "Pixman-renderer warning: %dx overdraw\n",
-				 n_box);
-	}
+	return n_box;
+}
+
+static pixman_image_t *
+image_create_alias(pixman_image_t *image)
+{
+	return pixman_image_create_bits_no_clear(pixman_image_get_format(image),
+						 pixman_image_get_width(image),
+						 pixman_image_get_height(image),
+						 pixman_image_get_data(image),
+						 pixman_image_get_stride(image));
+}
+
+/* A private source image for one band: compositing sets the transform,
+ * filter and repeat mode on the source, which bands cannot share. */
+static pixman_image_t *
+surface_state_clone_image(struct pixman_surface_state *ps)
+{
+	if (!pixman_image_get_data(ps->image))
+		return pixman_image_create_solid_fill(&ps->solid_color);
+
+	return image_create_alias(ps->image);
 }
 
 /** Paint an intersected region
@@ -318,12 +388,14 @@ composite_clipped(struct weston_output *output,
  * \param source_clip The region of the source image to use, in source image
  *                    coordinates. If NULL, use the whole source image.
  * \param pixman_op Compositing operator, either SRC or OVER.
+ * \param band The band being repainted on a repaint thread, or NULL.
  */
 static void
 repaint_region(struct weston_paint_node *pnode,
 	       pixman_region32_t *repaint_output,
 	       pixman_region32_t *source_clip,
-	       pixman_op_t pixman_op)
+	       pixman_op_t pixman_op,
+	       const struct pixman_repaint_band *band)
 {
 	struct weston_output *output = pnode->output;
 	struct weston_view *ev = pnode->view;
@@ -332,16 +404,25 @@ repaint_region(struct weston_paint_node *pnode,
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
 	struct pixman_output_state *po = get_output_state(output);
 	pixman_image_t *target_image;
+	pixman_image_t *src_image;
 	pixman_transform_t transform;
 	pixman_filter_t filter;
 	pixman_image_t *mask_image;
 	pixman_color_t mask = { 0, };
+	int n_box;
 
-	if (po->shadow_image)
+	if (band)
+		target_image = band->target;
+	else if (po->shadow_image)
 		target_image = po->shadow_image;
 	else
 		target_image = po->hw_buffer;
 
+	if (band)
+		src_image = surface_state_clone_image(ps);
+	else
+		src_image = pixman_image_ref(ps->image);
+
  	/* Clip rendering to the damaged output region */
 	pixman_image_set_clip_region32(target_image, repaint_output);
 
@@ -363,15 +444,24 @@ repaint_region(struct weston_paint_node *pnode,
 		mask_image = NULL;
 	}
 
-	if (source_clip)
-		composite_clipped(output, ps->image, mask_image, target_image,
-				  &transform, filter, source_clip);
-	else
-		composite_whole(pixman_op, ps->image, mask_image,
+	if (source_clip) {
+		n_box = composite_clipped(src_image, mask_image, target_image,
+					  &transform, filter, source_clip);
+
+		/* The pacer is not thread-safe. */
+		if (n_box > 1 && !band) {
+			weston_log_paced(&output->pixman_overdraw_pacer, 1, 0,
+					 "Pixman-renderer warning: %dx overdraw\n",
+					 n_box);
+		}
+	} else {
+		composite_whole(pixman_op, src_image, mask_image,
 				target_image, &transform, filter);
+	}
 
 	if (mask_image)
 		pixman_image_unref(mask_image);
+	pixman_image_unref(src_image);
 
 	if (ps->buffer_ref.buffer)
 		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
@@ -392,7 +482,8 @@ repaint_region(struct weston_paint_node *pnode,
 
 static void
 draw_node_translated(struct weston_paint_node *pnode,
-		     pixman_region32_t *repaint_global)
+		     pixman_region32_t *repaint_global,
+		     const struct pixman_repaint_band *band)
 {
 	struct weston_output *output = pnode->output;
 	struct weston_surface *surface = pnode->surface;
@@ -425,7 +516,7 @@ draw_node_translated(struct weston_paint_node *pnode,
 						       &repaint_output);
 
 			repaint_region(pnode, &repaint_output, NULL,
-				       PIXMAN_OP_SRC);
+				       PIXMAN_OP_SRC, band);
 		}
 	}
 
@@ -437,7 +528,8 @@ draw_node_translated(struct weston_paint_node *pnode,
 					       output,
 					       &repaint_output);
 
-		repaint_region(pnode, &repaint_output, NULL, PIXMAN_OP_OVER);
+		repaint_region(pnode, &repaint_output, NULL, PIXMAN_OP_OVER,
+			       band);
 	}
 
 	pixman_region32_fini(&surface_blend);
@@ -446,7 +538,8 @@ draw_node_translated(struct weston_paint_node *pnode,
 
 static void
 draw_node_source_clipped(struct weston_paint_node *pnode,
-			 pixman_region32_t *repaint_global)
+			 pixman_region32_t *repaint_global,
+			 const struct pixman_repaint_band *band)
 {
 	struct weston_surface *surface = pnode->surface;
 	struct weston_output *output = pnode->output;
@@ -474,7 +567,8 @@ draw_node_source_clipped(struct weston_paint_node *pnode,
 	weston_region_global_to_output(&repaint_output, output,
 				       &repaint_output);
 
-	repaint_region(pnode, &repaint_output, &buffer_region, PIXMAN_OP_OVER);
+	repaint_region(pnode, &repaint_output, &buffer_region, PIXMAN_OP_OVER,
+		       band);
 
 	pixman_region32_fini(&repaint_output);
 	pixman_region32_fini(&buffer_region);
@@ -483,7 +577,8 @@ draw_node_source_clipped(struct weston_paint_node *pnode,
 
 static void
 draw_paint_node(struct weston_paint_node *pnode,
-		pixman_region32_t *damage /* in global coordinates */)
+		pixman_region32_t *damage /* in global coordinates */,
+		const struct pixman_repaint_band *band)
 {
 	struct pixman_surface_state *ps = get_surface_state(pnode->surface);
 	/* repaint bounding region in global coordinates: */
@@ -526,7 +621,7 @@ draw_paint_node(struct weston_paint_node *pnode,
 		 * Also the boundingbox is accurate rather than an
 		 * approximation.
 		 */
-		draw_node_translated(pnode, &repaint);
+		draw_node_translated(pnode, &repaint, band);
 	} else {
 		/* The complex case: the view transformation does not allow
 		 * converting opaque etc. regions into global coordinate space.
@@ -535,24 +630,224 @@ draw_paint_node(struct weston_paint_node *pnode,
 		 * to be used whole. Source clipping does not work with
 		 * PIXMAN_OP_SRC.
 		 */
-		draw_node_source_clipped(pnode, &repaint);
+		draw_node_source_clipped(pnode, &repaint, band);
 	}
 
 out:
 	pixman_region32_fini(&repaint);
 }
 static void
-repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+repaint_surfaces(struct weston_output *output, pixman_region32_t *damage,
+		 const struct pixman_repaint_band *band)
 {
 	struct weston_paint_node *pnode;
 
 	wl_list_for_each_reverse(pnode, &output->paint_node_z_order_list,
 				 z_order_link) {
 		if (pnode->plane == &output->primary_plane)
-			draw_paint_node(pnode, damage);
+			draw_paint_node(pnode, damage, band);
 	}
 }
 
+/* Called with the pool mutex held, returns with it held. */
+static bool
+repaint_pool_run_band(struct pixman_repaint_pool *pool)
+{
+	struct pixman_repaint_band *band;
+
+	if (pool->next_band >= pool->n_bands)
+		return false;
+
+	band = &pool->bands[pool->next_band++];
+	pthread_mutex_unlock(&pool->mutex);
+
+	repaint_surfaces(pool->output, &band->damage, band);
+
+	pthread_mutex_lock(&pool->mutex);
+	if (--pool->pending == 0)
+		pthread_cond_signal(&pool->done_cond);
+
+	return true;
+}
+
+static void *
+repaint_pool_worker(void *data)
+{
+	struct pixman_repaint_pool *pool = data;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (!pool->quit) {
+		if (!repaint_pool_run_band(pool))
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+static void
+repaint_pool_destroy(struct pixman_repaint_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->n_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool);
+}
+
+static struct pixman_repaint_pool *
+repaint_pool_create(int n_threads)
+{
+	struct pixman_repaint_pool *pool;
+	sigset_t blocked, saved;
+
+	pool = xzalloc(sizeof *pool);
+	pool->threads = xcalloc(n_threads, sizeof *pool->threads);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	/* Leave signal handling to the main loop, but keep SIGBUS for the
+	 * wl_shm access guards around client buffers. */
+	sigfillset(&blocked);
+	sigdelset(&blocked, SIGBUS);
+	pthread_sigmask(SIG_BLOCK, &blocked, &saved);
+
+	for (; pool->n_threads < n_threads; pool->n_threads++) {
+		if (pthread_create(&pool->threads[pool->n_threads], NULL,
+				   repaint_pool_worker, pool) != 0)
+			break;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+	if (pool->n_threads == 0) {
+		repaint_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+/* Make sure repaint threads find nothing to set up or tear down in the
+ * surface states they read. */
+static void
+prepare_paint_nodes(struct weston_output *output)
+{
+	struct weston_paint_node *pnode;
+	struct pixman_surface_state *ps;
+
+	wl_list_for_each(pnode, &output->paint_node_z_order_list,
+			 z_order_link) {
+		if (pnode->plane != &output->primary_plane)
+			continue;
+
+		ps = get_surface_state(pnode->surface);
+		if (ps->image && ps->buffer_ref.buffer &&
+		    !ps->buffer_ref.buffer->shm_buffer) {
+			pixman_image_unref(ps->image);
+			ps->image = NULL;
+		}
+	}
+}
+
+/** Repaint the damage in horizontal bands spread over the repaint pool
+ *
+ * Each band composites into its own image aliasing the target, so the
+ * clip regions of concurrent bands do not interfere, and the result is
+ * the same as repainting the whole damage at once.
+ *
+ * Returns false if the damage is not worth splitting, without painting
+ * anything.
+ */
+static bool
+repaint_surfaces_tiled(struct weston_output *output,
+		       pixman_region32_t *damage)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_repaint_pool *pool = pr->pool;
+	struct pixman_repaint_band *bands;
+	pixman_image_t *target_image;
+	pixman_box32_t *extents;
+	int rows, n_bands, i;
+
+	/* The debug overlay shares one solid fill image. */
+	if (!pool || pr->repaint_debug)
+		return false;
+
+	extents = pixman_region32_extents(damage);
+	rows = extents->y2 - extents->y1;
+	n_bands = MIN((pool->n_threads + 1) * PIXMAN_BANDS_PER_THREAD,
+		      rows / PIXMAN_BAND_MIN_ROWS);
+	if (n_bands < 2)
+		return false;
+
+	if (po->shadow_image)
+		target_image = po->shadow_image;
+	else
+		target_image = po->hw_buffer;
+
+	prepare_paint_nodes(output);
+
+	bands = xcalloc(n_bands, sizeof *bands);
+	for (i = 0; i < n_bands; i++) {
+		int y1 = extents->y1 + rows * i / n_bands;
+		int y2 = extents->y1 + rows * (i + 1) / n_bands;
+
+		bands[i].target = image_create_alias(target_image);
+		abort_oom_if_null(bands[i].target);
+		pixman_region32_init_rect(&bands[i].damage, extents->x1, y1,
+					  extents->x2 - extents->x1, y2 - y1);
+		pixman_region32_intersect(&bands[i].damage,
+					  &bands[i].damage, damage);
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->output = output;
+	pool->bands = bands;
+	pool->n_bands = n_bands;
+	pool->next_band = 0;
+	pool->pending = n_bands;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	while (repaint_pool_run_band(pool))
+		;
+	while (pool->pending > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+
+	pool->output = NULL;
+	pool->bands = NULL;
+	pool->n_bands = 0;
+	pool->next_band = 0;
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < n_bands; i++) {
+		pixman_region32_fini(&bands[i].damage);
+		pixman_image_unref(bands[i].target);
+	}
+	free(bands);
+
+	return true;
+}
+
+static void
+repaint_output_region(struct weston_output *output, pixman_region32_t *damage)
+{
+	if (!repaint_surfaces_tiled(output, damage))
+		repaint_surfaces(output, damage, NULL);
+}
+
 static void
 copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
 {
@@ -580,12 +875,59 @@ copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
 	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
 }
 
+/* Draw the performance HUD of the core straight into the hardware buffer */
+static void
+draw_perf_hud(struct weston_output *output)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct weston_perf_hud_rect rects[WESTON_PERF_HUD_MAX_RECTS];
+	pixman_region32_t region;
+	pixman_image_t *color;
+	int n, i;
+
+	n = weston_output_perf_hud_get_rects(output, rects,
+					     ARRAY_LENGTH(rects));
+
+	for (i = 0; i < n; i++) {
+		pixman_color_t c = {
+			.red = rects[i].color[0] * 0xffff,
+			.green = rects[i].color[1] * 0xffff,
+			.blue = rects[i].color[2] * 0xffff,
+			.alpha = rects[i].color[3] * 0xffff,
+		};
+
+		pixman_region32_init_rect(&region, rects[i].x, rects[i].y,
+					  rects[i].width, rects[i].height);
+		weston_region_global_to_output(&region, output, &region);
+		pixman_image_set_clip_region32(po->hw_buffer, &region);
+		pixman_region32_fini(&region);
+
+		color = pixman_image_create_solid_fill(&c);
+		pixman_image_composite32(PIXMAN_OP_OVER,
+					 color, /* src */
+					 NULL /* mask */,
+					 po->hw_buffer, /* dest */
+					 0, 0, /* src_x, src_y */
+					 0, 0, /* mask_x, mask_y */
+					 0, 0, /* dest_x, dest_y */
+					 po->fb_size.width, /* width */
+					 po->fb_size.height /* height */);
+		pixman_image_unref(color);
+	}
+
+	pixman_image_set_clip_region32(po->hw_buffer, NULL);
+}
+
 static void
-pixman_renderer_do_capture(struct weston_buffer *into, pixman_image_t *from)
+pixman_renderer_do_capture(struct weston_buffer *into, pixman_image_t *from,
+			   pixman_region32_t *damage)
 {
 	struct wl_shm_buffer *shm = into->shm_buffer;
 	pixman_image_t *dest;
 
+	if (!pixman_region32_not_empty(damage))
+		return;
+
 	assert(into->type == WESTON_BUFFER_SHM);
 	assert(shm);
 
@@ -596,6 +938,7 @@ pixman_renderer_do_capture(struct weston_buffer *into, pixman_image_t *from)
 					wl_shm_buffer_get_data(shm),
 					into->stride);
 	abort_oom_if_null(dest);
+	pixman_image_set_clip_region32(dest, damage);
 
 	pixman_image_composite32(PIXMAN_OP_SRC, from, NULL /* mask */, dest,
 				 0, 0, /* src_x, src_y */
@@ -632,11 +975,132 @@ pixman_renderer_do_capture_tasks(struct weston_output *output,
 			continue;
 		}
 
-		pixman_renderer_do_capture(buffer, from);
+		pixman_renderer_do_capture(buffer, from,
+					   weston_capture_task_get_damage(ct));
 		weston_capture_task_retire_complete(ct);
 	}
 }
 
+/** Find the paint node that alone determines the damaged output contents
+ *
+ * That is an opaque client buffer in the output's pixel format, mapped
+ * 1:1 onto the output, covering all of the damage. Compositing it is a
+ * plain copy into the hardware buffer.
+ */
+static struct weston_paint_node *
+find_direct_copy_node(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct weston_paint_node *pnode;
+	struct pixman_surface_state *ps;
+	const struct weston_matrix *m;
+	pixman_region32_t uncovered;
+	bool covered;
+
+	wl_list_for_each(pnode, &output->paint_node_z_order_list,
+			 z_order_link) {
+		if (pnode->plane != &output->primary_plane)
+			continue;
+
+		if (pixman_region32_not_empty(&pnode->visible))
+			break;
+	}
+	if (&pnode->z_order_link == &output->paint_node_z_order_list)
+		return NULL;
+
+	if (!pnode->surf_xform_valid || !pnode->is_fully_opaque ||
+	    pnode->draw_solid || pnode->needs_filtering)
+		return NULL;
+
+	ps = get_surface_state(pnode->surface);
+	if (!ps->image || !ps->buffer_ref.buffer ||
+	    !ps->buffer_ref.buffer->shm_buffer)
+		return NULL;
+
+	if (pixman_image_get_format(ps->image) !=
+	    pixman_image_get_format(po->hw_buffer))
+		return NULL;
+
+	/* Only an integer translation from output to buffer pixels */
+	m = &pnode->output_to_buffer_matrix;
+	if (m->d[0] != 1.0f || m->d[4] != 0.0f ||
+	    m->d[1] != 0.0f || m->d[5] != 1.0f ||
+	    m->d[3] != 0.0f || m->d[7] != 0.0f || m->d[15] != 1.0f ||
+	    m->d[12] != (int32_t)m->d[12] || m->d[13] != (int32_t)m->d[13])
+		return NULL;
+
+	pixman_region32_init(&uncovered);
+	pixman_region32_subtract(&uncovered, damage, &pnode->visible);
+	covered = !pixman_region32_not_empty(&uncovered);
+	pixman_region32_fini(&uncovered);
+
+	return covered ? pnode : NULL;
+}
+
+/** Copy a client buffer straight into the hardware buffer
+ *
+ * \param damage The region to copy, in global coordinates.
+ * \return False if the paint nodes need compositing, having copied
+ * nothing.
+ */
+static bool
+repaint_direct_copy(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct weston_paint_node *pnode;
+	struct pixman_surface_state *ps;
+	pixman_region32_t repaint_output;
+	pixman_box32_t *boxes;
+	int32_t dx, dy;
+	int n_box, i;
+
+	if (!output->compositor->pixman_direct_copy || pr->repaint_debug)
+		return false;
+
+	/* Blending captures read the shadow image. */
+	if (po->shadow_image && weston_output_has_renderer_capture_tasks(output))
+		return false;
+
+	pnode = find_direct_copy_node(output, damage);
+	if (!pnode)
+		return false;
+
+	ps = get_surface_state(pnode->surface);
+	dx = pnode->output_to_buffer_matrix.d[12];
+	dy = pnode->output_to_buffer_matrix.d[13];
+
+	pixman_region32_init(&repaint_output);
+	weston_region_global_to_output(&repaint_output, output, damage);
+
+	/* Compositing leaves the output to buffer transform on the image,
+	 * while the copy below offsets by it already. */
+	pixman_image_set_transform(ps->image, NULL);
+	pixman_image_set_filter(ps->image, PIXMAN_FILTER_NEAREST, NULL, 0);
+	pixman_image_set_repeat(ps->image, PIXMAN_REPEAT_NONE);
+
+	wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
+
+	boxes = pixman_region32_rectangles(&repaint_output, &n_box);
+	for (i = 0; i < n_box; i++) {
+		pixman_image_composite32(PIXMAN_OP_SRC,
+					 ps->image, /* src */
+					 NULL /* mask */,
+					 po->hw_buffer, /* dest */
+					 boxes[i].x1 + dx, boxes[i].y1 + dy,
+					 0, 0, /* mask_x, mask_y */
+					 boxes[i].x1, boxes[i].y1,
+					 boxes[i].x2 - boxes[i].x1,
+					 boxes[i].y2 - boxes[i].y1);
+	}
+
+	wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
+
+	pixman_region32_fini(&repaint_output);
+
+	return true;
+}
+
 static void
 pixman_renderer_output_set_buffer(struct weston_output *output,
 				  pixman_image_t *buffer);
@@ -669,14 +1133,24 @@ pixman_renderer_repaint_output(struct weston_output *output,
 	}
 
 	if (po->shadow_image) {
-		repaint_surfaces(output, output_damage);
-		pixman_renderer_do_capture_tasks(output,
-						 WESTON_OUTPUT_CAPTURE_SOURCE_BLENDING,
-						 po->shadow_image, po->shadow_format);
-		copy_to_hw_buffer(output, &renderbuffer->damage);
-	} else {
-		repaint_surfaces(output, &renderbuffer->damage);
+		/* Direct copies bypass the shadow, which then catches up on
+		 * the next repaint that composites into it. */
+		pixman_region32_union(&po->shadow_damage, &po->shadow_damage,
+				      output_damage);
+
+		if (!repaint_direct_copy(output, &renderbuffer->damage)) {
+			repaint_output_region(output, &po->shadow_damage);
+			pixman_region32_clear(&po->shadow_damage);
+			pixman_renderer_do_capture_tasks(output,
+							 WESTON_OUTPUT_CAPTURE_SOURCE_BLENDING,
+							 po->shadow_image,
+							 po->shadow_format);
+			copy_to_hw_buffer(output, &renderbuffer->damage);
+		}
+	} else if (!repaint_direct_copy(output, &renderbuffer->damage)) {
+		repaint_output_region(output, &renderbuffer->damage);
 	}
+	draw_perf_hud(output);
 	pixman_renderer_do_capture_tasks(output,
 					 WESTON_OUTPUT_CAPTURE_SOURCE_FRAMEBUFFER,
 					 po->hw_buffer, po->hw_format);
@@ -693,6 +1167,55 @@ pixman_renderer_flush_damage(struct weston_paint_node *pnode)
 	/* No-op for pixman renderer */
 }
 
+static void
+pixman_buffer_state_handle_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_buffer *buffer = data;
+	struct pixman_buffer_state *pb =
+		container_of(listener, struct pixman_buffer_state,
+			     destroy_listener);
+
+	assert(pb == buffer->renderer_private);
+	buffer->renderer_private = NULL;
+
+	wl_list_remove(&pb->destroy_listener.link);
+	pixman_image_unref(pb->image);
+	free(pb);
+}
+
+/* Return a new reference to the image wrapping a wl_shm buffer, so that
+ * reattaching the same buffer does not create a new image every time. */
+static pixman_image_t *
+ensure_buffer_image(struct weston_buffer *buffer,
+		    const struct pixel_format_info *pixel_info)
+{
+	struct pixman_buffer_state *pb = buffer->renderer_private;
+	void *data = wl_shm_buffer_get_data(buffer->shm_buffer);
+
+	if (!pb) {
+		pb = xzalloc(sizeof *pb);
+		buffer->renderer_private = pb;
+		pb->destroy_listener.notify = pixman_buffer_state_handle_destroy;
+		wl_signal_add(&buffer->destroy_signal, &pb->destroy_listener);
+	}
+
+	/* Resizing the wl_shm_pool can move its mapping. */
+	if (pb->image && pixman_image_get_data(pb->image) != data) {
+		pixman_image_unref(pb->image);
+		pb->image = NULL;
+	}
+
+	if (!pb->image) {
+		pb->image = pixman_image_create_bits(pixel_info->pixman_format,
+						     buffer->width,
+						     buffer->height,
+						     data, buffer->stride);
+		abort_oom_if_null(pb->image);
+	}
+
+	return pixman_image_ref(pb->image);
+}
+
 static void
 buffer_state_handle_buffer_destroy(struct wl_listener *listener, void *data)
 {
@@ -726,6 +1249,7 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 		ps->image = NULL;
 	}
 
+	ps->solid_color = color;
 	ps->image = pixman_image_create_solid_fill(&color);
 }
 
@@ -796,10 +1320,7 @@ pixman_renderer_attach(struct weston_paint_node *pnode)
 		return;
 	}
 
-	ps->image = pixman_image_create_bits(pixel_info->pixman_format,
-		buffer->width, buffer->height,
-		wl_shm_buffer_get_data(shm_buffer),
-		buffer->stride);
+	ps->image = ensure_buffer_image(buffer, pixel_info);
 
 	ps->buffer_destroy_listener.notify =
 		buffer_state_handle_buffer_destroy;
@@ -885,6 +1406,8 @@ pixman_renderer_destroy(struct weston_compositor *ec)
 
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
+	if (pr->pool)
+		repaint_pool_destroy(pr->pool);
 	free(pr);
 
 	ec->renderer = NULL;
@@ -922,6 +1445,88 @@ pixman_renderer_surface_copy_content(struct weston_surface *surface,
 	return 0;
 }
 
+struct pixman_thumbnail {
+	pixman_image_t *target;
+	const struct weston_geometry *box;
+	float scale;
+};
+
+static void
+pixman_thumbnail_draw_surface(struct weston_surface *surface,
+			      float x, float y, void *data)
+{
+	struct pixman_thumbnail *thumb = data;
+	struct pixman_surface_state *ps;
+	struct weston_matrix matrix;
+	pixman_transform_t transform;
+	int x1, y1, x2, y2;
+
+	if (!weston_surface_is_mapped(surface) || !surface->renderer_state)
+		return;
+
+	ps = get_surface_state(surface);
+	if (!ps->image)
+		return;
+
+	/* Thumbnail pixels to buffer pixels */
+	weston_matrix_init(&matrix);
+	weston_matrix_scale(&matrix, 1.0f / thumb->scale,
+			    1.0f / thumb->scale, 1);
+	weston_matrix_translate(&matrix, thumb->box->x - x,
+				thumb->box->y - y, 0);
+	weston_matrix_multiply(&matrix, &surface->surface_to_buffer_matrix);
+	weston_matrix_to_pixman_transform(&transform, &matrix);
+
+	/* The area of the surface in the thumbnail, which also bounds solid
+	 * fill images. */
+	x1 = floorf((x - thumb->box->x) * thumb->scale);
+	y1 = floorf((y - thumb->box->y) * thumb->scale);
+	x2 = ceilf((x - thumb->box->x + surface->width) * thumb->scale);
+	y2 = ceilf((y - thumb->box->y + surface->height) * thumb->scale);
+
+	pixman_image_set_transform(ps->image, &transform);
+	pixman_image_set_filter(ps->image, PIXMAN_FILTER_GOOD, NULL, 0);
+	pixman_image_set_repeat(ps->image, PIXMAN_REPEAT_NONE);
+	pixman_image_composite32(PIXMAN_OP_OVER,
+				 ps->image,	/* src */
+				 NULL,		/* mask */
+				 thumb->target,	/* dest */
+				 x1, y1,	/* src_x, src_y */
+				 0, 0,		/* mask_x, mask_y */
+				 x1, y1,	/* dest_x, dest_y */
+				 x2 - x1, y2 - y1);
+	pixman_image_set_transform(ps->image, NULL);
+}
+
+static void
+pixman_renderer_surface_thumbnail_async(struct weston_surface *surface,
+					const struct weston_geometry *box,
+					int width, int height,
+					weston_renderer_read_pixels_done_func_t done,
+					void *data)
+{
+	struct pixman_thumbnail thumb = {
+		.box = box,
+		.scale = (float) width / box->width,
+	};
+
+	/* Pixman has nothing to wait for, the thumbnail is done when this
+	 * returns. Compositing straight at the small size keeps it cheap. */
+	thumb.target = pixman_image_create_bits(PIXMAN_a8b8g8r8,
+						width, height, NULL, 0);
+	if (!thumb.target) {
+		done(data, NULL, 0);
+		return;
+	}
+
+	weston_surface_tree_for_each(surface, 0.0f, 0.0f,
+				     pixman_thumbnail_draw_surface, &thumb);
+
+	done(data, pixman_image_get_data(thumb.target),
+	     pixman_image_get_stride(thumb.target));
+	pixman_image_unref(thumb.target);
+}
+
 static bool
 pixman_renderer_resize_output(struct weston_output *output,
 			      const struct weston_size *fb_size,
@@ -1026,6 +1631,8 @@ pixman_renderer_init(struct weston_compositor *ec)
 	renderer->base.destroy = pixman_renderer_destroy;
 	renderer->base.surface_copy_content =
 		pixman_renderer_surface_copy_content;
+	renderer->base.surface_thumbnail_async =
+		pixman_renderer_surface_thumbnail_async;
 	renderer->base.type = WESTON_RENDERER_PIXMAN;
 	renderer->base.pixman = &pixman_renderer_interface;
 	ec->renderer = &renderer->base;
@@ -1036,6 +1643,18 @@ pixman_renderer_init(struct weston_compositor *ec)
 		weston_compositor_add_debug_binding(ec, KEY_R,
 						    debug_binding, ec);
 
+	/* The repainting thread takes bands too. */
+	if (ec->pixman_repaint_threads > 1) {
+		renderer->pool =
+			repaint_pool_create(ec->pixman_repaint_threads - 1);
+		if (renderer->pool)
+			weston_log("Pixman renderer repaints in bands on %d "
+				   "threads.\n", renderer->pool->n_threads + 1);
+		else
+			weston_log("Pixman renderer failed to start repaint "
+				   "threads, repainting single-threaded.\n");
+	}
+
 	info_argb8888 = pixel_format_get_info_shm(WL_SHM_FORMAT_ARGB8888);
 	info_xrgb8888 = pixel_format_get_info_shm(WL_SHM_FORMAT_XRGB8888);
 
@@ -1115,9 +1734,11 @@ pixman_renderer_output_create(struct weston_output *output,
 		po->shadow_format = pixel_format_get_info(DRM_FORMAT_XRGB8888);
 
 	wl_list_init(&po->renderbuffer_list);
+	pixman_region32_init(&po->shadow_damage);
 
 	if (!pixman_renderer_resize_output(output, &options->fb_size, &area)) {
 		output->renderer_state = NULL;
+		pixman_region32_fini(&po->shadow_damage);
 		free(po);
 		return -1;
 	}
@@ -1150,23 +1771,41 @@ pixman_renderer_output_destroy(struct weston_output *output)
 		weston_renderbuffer_unref(&renderbuffer->base);
 	}
 
+	pixman_region32_fini(&po->shadow_damage);
 	free(po);
 }
 
 static void
 pixman_renderer_renderbuffer_destroy(struct weston_renderbuffer *renderbuffer);
 
+/* A new renderbuffer holds none of the output contents yet, so it starts out
+ * fully damaged. From then on it accumulates the damage of every repaint
+ * until it gets drawn into again, the equivalent of buffer age for the
+ * renderbuffers of a multi-buffered output.
+ */
+static void
+pixman_renderbuffer_init(struct pixman_renderbuffer *renderbuffer,
+			 struct weston_output *output)
+{
+	struct pixman_output_state *po = get_output_state(output);
+
+	assert(po);
+
+	pixman_region32_init(&renderbuffer->base.damage);
+	pixman_region32_copy(&renderbuffer->base.damage, &output->region);
+	renderbuffer->base.refcount = 2;
+	renderbuffer->base.destroy = pixman_renderer_renderbuffer_destroy;
+	wl_list_insert(&po->renderbuffer_list, &renderbuffer->link);
+}
+
 static struct weston_renderbuffer *
 pixman_renderer_create_image_from_ptr(struct weston_output *output,
 				      const struct pixel_format_info *format,
 				      int width, int height, uint32_t *ptr,
 				      int rowstride)
 {
-	struct pixman_output_state *po = get_output_state(output);
 	struct pixman_renderbuffer *renderbuffer;
 
-	assert(po);
-
 	renderbuffer = xzalloc(sizeof(*renderbuffer));
 
 	renderbuffer->image = pixman_image_create_bits(format->pixman_format,
@@ -1177,10 +1816,7 @@ pixman_renderer_create_image_from_ptr(struct weston_output *output,
 		return NULL;
 	}
 
-	pixman_region32_init(&renderbuffer->base.damage);
-	renderbuffer->base.refcount = 2;
-	renderbuffer->base.destroy = pixman_renderer_renderbuffer_destroy;
-	wl_list_insert(&po->renderbuffer_list, &renderbuffer->link);
+	pixman_renderbuffer_init(renderbuffer, output);
 
 	return &renderbuffer->base;
 }
@@ -1190,11 +1826,8 @@ pixman_renderer_create_image(struct weston_output *output,
 			     const struct pixel_format_info *format, int width,
 			     int height)
 {
-	struct pixman_output_state *po = get_output_state(output);
 	struct pixman_renderbuffer *renderbuffer;
 
-	assert(po);
-
 	renderbuffer = xzalloc(sizeof(*renderbuffer));
 
 	renderbuffer->image =
@@ -1205,10 +1838,7 @@ pixman_renderer_create_image(struct weston_output *output,
 		return NULL;
 	}
 
-	pixman_region32_init(&renderbuffer->base.damage);
-	renderbuffer->base.refcount = 2;
-	renderbuffer->base.destroy = pixman_renderer_renderbuffer_destroy;
-	wl_list_insert(&po->renderbuffer_list, &renderbuffer->link);
+	pixman_renderbuffer_init(renderbuffer, output);
 
 	return &renderbuffer->base;
 }
@@ -135,6 +135,7 @@ enum gl_extension_flag {
 	EXTENSION_OES_MAPBUFFER                   = 1ull << 14,
 	EXTENSION_OES_RGB8_RGBA8                  = 1ull << 15,
 	EXTENSION_OES_TEXTURE_FLOAT_LINEAR        = 1ull << 16,
+	EXTENSION_OES_GET_PROGRAM_BINARY          = 1ull << 17,
 };
 
 enum gl_feature_flag {
@@ -164,6 +165,32 @@ enum gl_feature_flag {
 	/* GL renderer can instrument output repaint time and report it through
 	 * the timeline logging scope. */
 	FEATURE_GPU_TIMELINE = 1ull << 5,
+
+	/* GL renderer can retrieve linked programs as binaries and load them
+	 * back, which allows caching them on disk across runs. */
+	FEATURE_PROGRAM_BINARY = 1ull << 6,
+
+	/* GL renderer can upload wl_shm damage through a ring of Pixel Buffer
+	 * Objects bound to the GL_PIXEL_UNPACK_BUFFER target, mapped
+	 * unsynchronized with map_buffer_range(). Each PBO is reused once the
+	 * native fence sync created after its upload has signalled. */
+	FEATURE_ASYNC_UPLOAD = 1ull << 7,
+
+	/* GL renderer can allocate immutable texture storage with
+	 * tex_storage_2d(), so that wl_shm textures are allocated once and
+	 * then only ever updated with glTexSubImage2D(). */
+	FEATURE_TEXTURE_STORAGE = 1ull << 8,
+};
+
+/* Number of staging buffers in the asynchronous upload ring */
+#define GL_UPLOAD_RING_SIZE 4
+
+struct gl_upload_staging {
+	GLuint pbo;
+	size_t size;
+	/* Signals when the uploads out of pbo are complete. */
+	EGLSyncKHR sync;
+	int fd;
 };
 
 /* Keep the following in sync with vertex.glsl. */
@@ -290,7 +317,10 @@ struct gl_shader_config {
 			GLuint tex;
 			GLfloat scale_offset[2];
 		} lut3d;
-		GLfloat matrix[9];
+		struct {
+			GLfloat matrix[9];
+			GLfloat offset[3];
+		} mat;
 	} color_mapping;
 
 	union {
@@ -328,9 +358,25 @@ struct gl_renderer {
 
 	/* Vertex streams. */
 	struct wl_array position_stream;
+	struct wl_array texcoord_stream; /* batched atlas draws only */
 	struct wl_array barycentric_stream;
 	struct wl_array indices;
 
+	/* Reused by draw_paint_node() for every paint node, see there. */
+	pixman_region32_t scratch_region[3];
+	struct wl_array quad_scratch; /* struct clipper_quad */
+	struct wl_array band_scratch; /* pixman_box32_t */
+
+	/* Pending draw of solid color sub-meshes from consecutive paint nodes,
+	 * held in the vertex streams in clip space. See repaint_region(). */
+	struct {
+		struct weston_paint_node *pnode; /* first node, for errors */
+		struct gl_shader_config sconf;
+		int nvtx;
+		int nidx;
+	} batch;
+	bool blend; /* last GL_BLEND state set by repaint_views() */
+
 	EGLDeviceEXT egl_device;
 	const char *drm_device;
 
@@ -394,21 +440,69 @@ struct gl_renderer {
 	/* GL_OES_texture_3d */
 	PFNGLTEXIMAGE3DOESPROC tex_image_3d;
 
+	/* GL_EXT_texture_storage */
+	PFNGLTEXSTORAGE2DEXTPROC tex_storage_2d;
+
 	/* GL_EXT_disjoint_timer_query */
 	PFNGLGENQUERIESEXTPROC gen_queries;
 	PFNGLDELETEQUERIESEXTPROC delete_queries;
 	PFNGLBEGINQUERYEXTPROC begin_query;
 	PFNGLENDQUERYEXTPROC end_query;
-#if !defined(NDEBUG)
 	PFNGLGETQUERYOBJECTIVEXTPROC get_query_object_iv;
-#endif
 	PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_object_ui64v;
 
+	/* GL_OES_get_program_binary */
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+
 	uint64_t features;
 
 	GLenum pbo_usage;
 
+	struct gl_upload_staging upload_ring[GL_UPLOAD_RING_SIZE];
+
+	/* Read and draw framebuffers for early-release dmabuf copies */
+	GLuint copy_fbo[2];
+	int upload_next;
+
+	/** dmabuf EGLImages for reuse, in most recently used order
+	 *
+	 * Uses struct gl_dmabuf_image::link.
+	 */
 	struct wl_list dmabuf_images;
+
+	/** Unused wl_shm textures for reuse, in most recently used order
+	 *
+	 * Uses struct gl_shm_texture::link.
+	 */
+	struct wl_list shm_textures;
+	int shm_texture_count;
+
+	/** wl_shm buffer states owning their textures, most recently drawn
+	 * first; the least recently drawn are evicted to system memory to
+	 * stay within memory_budget
+	 *
+	 * Uses struct gl_buffer_state::lru_link.
+	 */
+	struct wl_list shm_texture_lru;
+	/** Bytes of textures to keep at most, 0 for no limit */
+	uint64_t memory_budget;
+	struct {
+		uint64_t shm_textures;	/* of wl_shm buffer states */
+		uint64_t shm_pool;	/* unused ones, kept for reuse */
+		uint64_t atlas;		/* atlas pages */
+		uint64_t evicted;	/* in system memory */
+		uint64_t evictions;
+		uint64_t restores;
+	} memory;
+	struct weston_log_scope *memory_scope;
+
+	/** Texture pages shared by small wl_shm buffers
+	 *
+	 * Uses struct gl_atlas_page::link.
+	 */
+	struct wl_list atlas_pages;
+
 	struct wl_list dmabuf_formats;
 	struct wl_list pending_capture_list;
 
@@ -422,8 +516,20 @@ struct gl_renderer {
 	 * Uses struct gl_shader::link.
 	 */
 	struct wl_list shader_list;
+	/** Shader programs of shader_list keyed by their requirements */
+	struct hash_table *shader_table;
 	struct weston_log_scope *shader_scope;
 
+	/** Per paint node GPU timer queries, see gpu_timing_begin() */
+	struct weston_log_scope *gpu_timing_scope;
+	bool gpu_timing_active;
+
+	/** On-disk program binary cache, see gl_program_cache_init() */
+	struct {
+		char *dir; /* NULL when disabled */
+		uint64_t identity;
+	} program_cache;
+
 	struct dmabuf_allocator *allocator;
 };
 
@@ -538,9 +644,22 @@ bool
 gl_renderer_use_program(struct gl_renderer *gr,
 			const struct gl_shader_config *sconf);
 
+bool
+gl_renderer_ensure_program(struct gl_renderer *gr,
+			   const struct gl_shader_requirements *reqs);
+
 struct weston_log_scope *
 gl_shader_scope_create(struct gl_renderer *gr);
 
+char *
+gl_shader_requirements_to_string(const struct gl_shader_requirements *req);
+
+void
+gl_program_cache_init(struct gl_renderer *gr, const char *dir);
+
+void
+gl_renderer_load_program_cache(struct gl_renderer *gr);
+
 bool
 gl_shader_config_set_color_transform(struct gl_renderer *gr,
 				     struct gl_shader_config *sconf,
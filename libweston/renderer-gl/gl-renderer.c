@@ -39,14 +39,17 @@
 #include <sys/stat.h>
 #include <ctype.h>
 #include <float.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <linux/input.h>
+#include <poll.h>
 #include <unistd.h>
 
 #ifdef HAVE_GBM
 #include <gbm.h>
 #endif
 
+#include "client-memory.h"
 #include "linux-sync-file.h"
 #include "timeline.h"
 
@@ -58,6 +61,7 @@
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
 #include "linux-explicit-synchronization.h"
 #include "output-capture.h"
+#include "perf-hud.h"
 #include "pixel-formats.h"
 
 #include "shared/fd-util.h"
@@ -128,11 +132,23 @@ struct gl_output_state {
 	EGLSyncKHR render_sync;
 	GLuint render_query;
 
+	/* struct gl_node_timing, queried in the last repaint */
+	struct wl_array node_timings;
+	/* GLuint, timer queries for node_timings, kept for reuse */
+	struct wl_array node_queries;
+
 	/* struct timeline_render_point::link */
 	struct wl_list timeline_render_point_list;
 
 	const struct pixel_format_info *shadow_format;
 	struct gl_fbo_texture shadow;
+	/* Some output mirrors this one and samples its shadow. */
+	bool mirror_source;
+	/* The shadow holds every view of the last repaint, i.e. nothing
+	 * was on a hardware plane. */
+	bool shadow_complete;
+	/* The shadow was skipped while mirroring another output. */
+	bool shadow_stale;
 
 	/* struct gl_renderbuffer::link */
 	struct wl_list renderbuffer_list;
@@ -141,13 +157,18 @@ struct gl_output_state {
 struct gl_renderer;
 
 struct gl_capture_task {
+	/* Either a capture task, or a read_pixels_async() request. */
 	struct weston_capture_task *task;
+	weston_renderer_read_pixels_done_func_t done;
+	void *data;
+
 	struct wl_event_source *source;
 	struct gl_renderer *gr;
 	struct wl_list link;
 	GLuint pbo;
 	int stride;
 	int height;
+	int row; /* of the capture buffer to copy to */
 	bool reverse;
 	EGLSyncKHR sync;
 	int fd;
@@ -230,9 +251,100 @@ struct gl_buffer_state {
 	GLuint textures[3];
 	int num_textures;
 
+	/* wl_shm textures: what they were allocated for, and whether they
+	 * have storage yet, so full uploads can use glTexSubImage2D() */
+	const struct pixel_format_info *shm_format;
+	int32_t shm_width, shm_height;
+	bool has_storage;
+
+	/* Small wl_shm buffers: slot in a shared texture page, with
+	 * atlas_x/atlas_y the position of the buffer's top-left texel */
+	struct gl_atlas_page *atlas_page;
+	int atlas_slot;
+	int atlas_x, atlas_y;
+
+	/* Textures owned by a wl_shm buffer state: their size, 0 if there
+	 * are none of its own, when they were last drawn, and their content
+	 * while evicted to system memory, see shm_texture_evict() */
+	uint64_t texture_size;
+	struct wl_list lru_link; /* gl_renderer::shm_texture_lru */
+	struct timespec last_drawn;
+	void *evicted_pixels;
+	bool no_evict;
+
+	/* wl_shm textures are charged to the surface's client, at the size
+	 * of the data they hold */
+	struct weston_client_memory *client_memory;
+	uint64_t texture_bytes;
+
 	struct wl_listener destroy_listener;
 };
 
+/* Small wl_shm buffers can share texture pages instead of getting textures
+ * of their own, so that cursors, tooltips and menus need neither texture
+ * allocations nor texture switches between their draws. A page is a grid of
+ * slots; every buffer is surrounded by a one texel gutter that repeats its
+ * edges, so that linear filtering never samples a neighbour. */
+#define GL_ATLAS_PAGE_SIZE 1024
+#define GL_ATLAS_SLOT_SIZE 128
+#define GL_ATLAS_SLOTS_PER_ROW (GL_ATLAS_PAGE_SIZE / GL_ATLAS_SLOT_SIZE)
+
+struct gl_atlas_page {
+	struct wl_list link; /* gl_renderer::atlas_pages */
+	GLenum gl_format;
+	GLenum gl_pixel_type;
+	GLuint tex;
+	uint64_t size;
+	uint64_t used_slots; /* one bit per slot */
+};
+
+static_assert(GL_ATLAS_SLOTS_PER_ROW * GL_ATLAS_SLOTS_PER_ROW <= 64,
+	      "Atlas slots must fit gl_atlas_page::used_slots");
+
+/* Unused wl_shm textures to keep for buffers that come and go at the same
+ * size, like popups, menus and shm video frames. */
+#define GL_SHM_TEXTURE_POOL_SIZE 8
+
+struct gl_shm_texture {
+	struct wl_list link; /* gl_renderer::shm_textures */
+	const struct pixel_format_info *format;
+	int32_t width, height;
+	GLuint textures[3];
+	int num_textures;
+	uint64_t size;
+};
+
+/* wl_shm textures drawn this recently are never evicted, so that the
+ * outputs repainting in turn do not take them from each other. */
+#define GL_EVICT_IDLE_MSEC 1000
+
+/* Unused dmabuf EGLImages to keep for clients that recreate wl_buffers for
+ * the same dmabufs. Each one pins the buffer memory, so keep few. */
+#define GL_DMABUF_IMAGE_CACHE_SIZE 16
+
+/* Identifies the memory and layout behind a dmabuf import, regardless of
+ * the file descriptors the client passed this time. */
+struct gl_dmabuf_image_key {
+	int32_t width;
+	int32_t height;
+	uint32_t format;
+	uint64_t modifier;
+	int n_planes;
+	struct {
+		dev_t dev;
+		ino_t ino;
+		uint32_t offset;
+		uint32_t stride;
+	} plane[MAX_DMABUF_PLANES];
+};
+
+struct gl_dmabuf_image {
+	struct wl_list link; /* gl_renderer::dmabuf_images */
+	struct gl_dmabuf_image_key key;
+	EGLImageKHR image;
+	int refcount; /* number of gl_buffer_state using the image */
+};
+
 struct gl_surface_state {
 	struct weston_surface *surface;
 
@@ -247,6 +359,10 @@ struct gl_surface_state {
 	   Used only in the context of a gl_renderer_repaint_output call. */
 	bool used_in_output_repaint;
 
+	/* Renderer-owned copy of the last dmabuf, when released early */
+	struct gl_buffer_state *copy;
+	int32_t copy_width, copy_height;
+
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
 };
@@ -255,6 +371,7 @@ struct timeline_render_point {
 	struct wl_list link; /* gl_output_state::timeline_render_point_list */
 
 	int fd;
+	bool has_query; /* timeline GPU query was submitted */
 	GLuint query;
 	struct weston_output *output;
 	struct wl_event_source *event_source;
@@ -276,6 +393,7 @@ static const struct gl_extension_table extension_table[] = {
 	EXT("GL_NV_pixel_buffer_object", EXTENSION_NV_PIXEL_BUFFER_OBJECT),
 	EXT("GL_OES_EGL_image", EXTENSION_OES_EGL_IMAGE),
 	EXT("GL_OES_EGL_image_external", EXTENSION_OES_EGL_IMAGE_EXTERNAL),
+	EXT("GL_OES_get_program_binary", EXTENSION_OES_GET_PROGRAM_BINARY),
 	EXT("GL_OES_mapbuffer", EXTENSION_OES_MAPBUFFER),
 	EXT("GL_OES_rgb8_rgba8", EXTENSION_OES_RGB8_RGBA8),
 	EXT("GL_OES_texture_float_linear", EXTENSION_OES_TEXTURE_FLOAT_LINEAR),
@@ -501,19 +619,27 @@ gl_extensions_add(const struct gl_extension_table *table,
 	free(map);
 }
 
+/* Elapsed time queries cannot nest, so per paint node timing takes
+ * precedence over the timing of the whole repaint. */
+static bool
+timeline_has_render_query(struct gl_renderer *gr)
+{
+	return gl_features_has(gr, FEATURE_GPU_TIMELINE) &&
+	       weston_log_scope_enabled(gr->compositor->timeline) &&
+	       !gr->gpu_timing_active;
+}
+
 static void
 timeline_begin_render_query(struct gl_renderer *gr, GLuint query)
 {
-	if (gl_features_has(gr, FEATURE_GPU_TIMELINE) &&
-	    weston_log_scope_is_enabled(gr->compositor->timeline))
+	if (timeline_has_render_query(gr))
 		gr->begin_query(GL_TIME_ELAPSED_EXT, query);
 }
 
 static void
 timeline_end_render_query(struct gl_renderer *gr)
 {
-	if (gl_features_has(gr, FEATURE_GPU_TIMELINE) &&
-	    weston_log_scope_is_enabled(gr->compositor->timeline))
+	if (timeline_has_render_query(gr))
 		gr->end_query(GL_TIME_ELAPSED_EXT);
 }
 
@@ -532,8 +658,15 @@ timeline_render_point_handler(int fd, uint32_t mask, void *data)
 	struct timeline_render_point *trp = data;
 	struct timespec end;
 
-	if ((mask & WL_EVENT_READABLE) &&
-	    (weston_linux_sync_file_read_timestamp(trp->fd, &end) == 0)) {
+	if (!(mask & WL_EVENT_READABLE) ||
+	    weston_linux_sync_file_read_timestamp(trp->fd, &end) != 0) {
+		timeline_render_point_destroy(trp);
+		return 0;
+	}
+
+	weston_output_report_render_done(trp->output, &end);
+
+	if (trp->has_query) {
 		struct gl_renderer *gr = get_renderer(trp->output->compositor);
 		struct timespec begin;
 		GLuint64 elapsed;
@@ -586,10 +719,16 @@ timeline_submit_render_sync(struct gl_renderer *gr,
 	struct wl_event_loop *loop;
 	int fd;
 	struct timeline_render_point *trp;
+	bool has_query;
+
+	if (sync == EGL_NO_SYNC_KHR)
+		return;
 
-	if (!gl_features_has(gr, FEATURE_GPU_TIMELINE) ||
-	    !weston_log_scope_is_enabled(gr->compositor->timeline) ||
-	    sync == EGL_NO_SYNC_KHR)
+	/* The render completion time also feeds the adaptive repaint
+	 * window and the performance HUD, which need no GPU query. */
+	has_query = timeline_has_render_query(gr);
+	if (!has_query && !gr->compositor->repaint_window_adaptive &&
+	    !gr->compositor->perf_hud)
 		return;
 
 	go = get_output_state(output);
@@ -606,6 +745,7 @@ timeline_submit_render_sync(struct gl_renderer *gr,
 	}
 
 	trp->fd = fd;
+	trp->has_query = has_query;
 	trp->query = query;
 	trp->output = output;
 	trp->event_source = wl_event_loop_add_fd(loop, fd,
@@ -866,10 +1006,11 @@ gl_renderer_do_read_pixels(struct gl_renderer *gr,
 static bool
 gl_renderer_do_capture(struct gl_renderer *gr, struct gl_output_state *go,
 		       struct weston_buffer *into,
-		       const struct weston_geometry *rect)
+		       const struct weston_geometry *rect, int row)
 {
 	struct wl_shm_buffer *shm = into->shm_buffer;
 	const struct pixel_format_info *fmt = into->pixel_format;
+	uint8_t *pixels;
 	bool ret;
 
 	assert(into->type == WESTON_BUFFER_SHM);
@@ -877,7 +1018,9 @@ gl_renderer_do_capture(struct gl_renderer *gr, struct gl_output_state *go,
 
 	wl_shm_buffer_begin_access(shm);
 
-	ret = gl_renderer_do_read_pixels(gr, go, fmt, wl_shm_buffer_get_data(shm),
+	pixels = wl_shm_buffer_get_data(shm);
+	ret = gl_renderer_do_read_pixels(gr, go, fmt,
+					 pixels + row * into->stride,
 					 into->stride, rect);
 
 	wl_shm_buffer_end_access(shm);
@@ -923,6 +1066,25 @@ destroy_capture_task(struct gl_capture_task *gl_task)
 	free(gl_task);
 }
 
+static void
+copy_read_pixels(struct gl_capture_task *gl_task)
+{
+	struct gl_renderer *gr = gl_task->gr;
+	void *src;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, gl_task->pbo);
+	src = gr->map_buffer_range(GL_PIXEL_PACK_BUFFER, 0,
+				   gl_task->stride * gl_task->height,
+				   GL_MAP_READ_BIT);
+	if (src) {
+		gl_task->done(gl_task->data, src, gl_task->stride);
+		gr->unmap_buffer(GL_PIXEL_PACK_BUFFER);
+	} else {
+		gl_task->done(gl_task->data, NULL, 0);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
 static void
 copy_capture(struct gl_capture_task *gl_task)
 {
@@ -940,6 +1102,7 @@ copy_capture(struct gl_capture_task *gl_task)
 				   gl_task->stride * gl_task->height,
 				   GL_MAP_READ_BIT);
 	dst = wl_shm_buffer_get_data(shm);
+	dst += gl_task->row * gl_task->stride;
 	wl_shm_buffer_begin_access(shm);
 
 	if (!gl_task->reverse) {
@@ -958,6 +1121,46 @@ copy_capture(struct gl_capture_task *gl_task)
 	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 }
 
+static void
+retire_capture_task(struct gl_capture_task *gl_task, bool success)
+{
+	if (gl_task->task) {
+		if (success) {
+			copy_capture(gl_task);
+			weston_capture_task_retire_complete(gl_task->task);
+		} else {
+			weston_capture_task_retire_failed(gl_task->task,
+							  "GL: capture failed");
+		}
+	} else if (success) {
+		copy_read_pixels(gl_task);
+	} else {
+		gl_task->done(gl_task->data, NULL, 0);
+	}
+
+	destroy_capture_task(gl_task);
+}
+
+static void
+retire_read_pixels_before(struct gl_capture_task *gl_task)
+{
+	struct gl_capture_task *older, *tmp;
+
+	if (gl_task->task)
+		return;
+
+	/* Read backs of a context execute in order, so everything queued
+	 * before this one is done too. Retire those first to keep the
+	 * completion order that read_pixels_async() promises. */
+	wl_list_for_each_reverse_safe(older, tmp,
+				      &gl_task->gr->pending_capture_list, link) {
+		if (older == gl_task)
+			break;
+		if (!older->task)
+			retire_capture_task(older, true);
+	}
+}
+
 static int
 async_capture_handler(void *data)
 {
@@ -965,9 +1168,8 @@ async_capture_handler(void *data)
 
 	assert(gl_task);
 
-	copy_capture(gl_task);
-	weston_capture_task_retire_complete(gl_task->task);
-	destroy_capture_task(gl_task);
+	retire_read_pixels_before(gl_task);
+	retire_capture_task(gl_task, true);
 
 	return 0;
 }
@@ -980,50 +1182,19 @@ async_capture_handler_fd(int fd, uint32_t mask, void *data)
 	assert(gl_task);
 	assert(fd == gl_task->fd);
 
-	if (mask & WL_EVENT_READABLE) {
-		copy_capture(gl_task);
-		weston_capture_task_retire_complete(gl_task->task);
-	} else {
-		weston_capture_task_retire_failed(gl_task->task,
-						  "GL: capture failed");
-	}
-	destroy_capture_task(gl_task);
+	retire_read_pixels_before(gl_task);
+	retire_capture_task(gl_task, mask & WL_EVENT_READABLE);
 
 	return 0;
 }
 
 static void
-gl_renderer_do_read_pixels_async(struct gl_renderer *gr,
-				 struct gl_output_state *go,
-				 struct weston_output *output,
-				 struct weston_capture_task *task,
-				 const struct weston_geometry *rect)
+queue_capture_task(struct gl_renderer *gr, struct weston_output *output,
+		   struct gl_capture_task *gl_task)
 {
-	struct weston_buffer *buffer = weston_capture_task_get_buffer(task);
-	const struct pixel_format_info *fmt = buffer->pixel_format;
-	struct gl_capture_task *gl_task;
 	struct wl_event_loop *loop;
 	int refresh_mhz, refresh_msec;
 
-	assert(gl_features_has(gr, FEATURE_ASYNC_READBACK));
-	assert(output->current_mode->refresh > 0);
-	assert(buffer->type == WESTON_BUFFER_SHM);
-	assert(fmt->gl_type != 0);
-	assert(fmt->gl_format != 0);
-
-	if (gl_extensions_has(gr, EXTENSION_ANGLE_PACK_REVERSE_ROW_ORDER) &&
-	    is_y_flipped(go))
-		glPixelStorei(GL_PACK_REVERSE_ROW_ORDER_ANGLE, GL_TRUE);
-
-	gl_task = create_capture_task(task, gr, rect);
-
-	glBindBuffer(GL_PIXEL_PACK_BUFFER, gl_task->pbo);
-	glBufferData(GL_PIXEL_PACK_BUFFER, gl_task->stride * gl_task->height,
-		     NULL, gr->pbo_usage);
-	glReadPixels(rect->x, rect->y, rect->width, rect->height,
-		     fmt->gl_format, fmt->gl_type, 0);
-	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
-
 	loop = wl_display_get_event_loop(gr->compositor->wl_display);
 	gl_task->sync = create_render_sync(gr);
 
@@ -1049,18 +1220,154 @@ gl_renderer_do_read_pixels_async(struct gl_renderer *gr,
 		gl_task->source = wl_event_loop_add_timer(loop,
 							  async_capture_handler,
 							  gl_task);
-		refresh_mhz = output->current_mode->refresh;
+		refresh_mhz = output && output->current_mode->refresh > 0 ?
+			      output->current_mode->refresh : 60000;
 		refresh_msec = millihz_to_nsec(refresh_mhz) / 1000000;
 		wl_event_source_timer_update(gl_task->source, 5 * refresh_msec);
 	}
 
 	wl_list_insert(&gr->pending_capture_list, &gl_task->link);
+}
+
+static void
+gl_renderer_do_read_pixels_async(struct gl_renderer *gr,
+				 struct gl_output_state *go,
+				 struct weston_output *output,
+				 struct weston_capture_task *task,
+				 const struct weston_geometry *rect, int row)
+{
+	struct weston_buffer *buffer = weston_capture_task_get_buffer(task);
+	const struct pixel_format_info *fmt = buffer->pixel_format;
+	struct gl_capture_task *gl_task;
+
+	assert(gl_features_has(gr, FEATURE_ASYNC_READBACK));
+	assert(output->current_mode->refresh > 0);
+	assert(buffer->type == WESTON_BUFFER_SHM);
+	assert(fmt->gl_type != 0);
+	assert(fmt->gl_format != 0);
+
+	if (gl_extensions_has(gr, EXTENSION_ANGLE_PACK_REVERSE_ROW_ORDER) &&
+	    is_y_flipped(go))
+		glPixelStorei(GL_PACK_REVERSE_ROW_ORDER_ANGLE, GL_TRUE);
+
+	gl_task = create_capture_task(task, gr, rect);
+	gl_task->row = row;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, gl_task->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, gl_task->stride * gl_task->height,
+		     NULL, gr->pbo_usage);
+	glReadPixels(rect->x, rect->y, rect->width, rect->height,
+		     fmt->gl_format, fmt->gl_type, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	queue_capture_task(gr, output, gl_task);
 
 	if (gl_extensions_has(gr, EXTENSION_ANGLE_PACK_REVERSE_ROW_ORDER) &&
 	    is_y_flipped(go))
 		glPixelStorei(GL_PACK_REVERSE_ROW_ORDER_ANGLE, GL_FALSE);
 }
 
+static EGLImageKHR
+import_simple_dmabuf(struct gl_renderer *gr,
+		     const struct dmabuf_attributes *attributes);
+
+/* Blits rect of the current framebuffer into the whole dmabuf, scaling and
+ * converting to its format on the way. The client waits for the implicit
+ * fences of the dmabuf, so there is nothing to wait for here. */
+static bool
+gl_renderer_do_capture_scaled(struct gl_renderer *gr,
+			      struct gl_output_state *go,
+			      struct weston_buffer *buffer,
+			      const struct weston_geometry *rect)
+{
+	EGLImageKHR image;
+	GLint read_fbo;
+	GLuint fbo, rb;
+	GLenum status;
+	int32_t src_y1, src_y2, dst_y1, dst_y2;
+	bool ret = false;
+
+	image = import_simple_dmabuf(gr, &buffer->dmabuf->attributes);
+	if (image == EGL_NO_IMAGE_KHR)
+		return false;
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &read_fbo);
+
+	glGenRenderbuffers(1, &rb);
+	glBindRenderbuffer(GL_RENDERBUFFER, rb);
+	gr->image_target_renderbuffer_storage(GL_RENDERBUFFER, image);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				  GL_RENDERBUFFER, rb);
+
+	status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		weston_log("%s: fbo error: %#x\n", __func__, status);
+		goto out;
+	}
+
+	/* The rectangle has the bottom-left origin of glReadPixels(). An EGL
+	 * window surface has the bottom row first, the dmabuf the top one
+	 * unless it is y-inverted. */
+	if (is_y_flipped(go)) {
+		src_y1 = rect->y + rect->height;
+		src_y2 = rect->y;
+	} else {
+		src_y1 = rect->y;
+		src_y2 = rect->y + rect->height;
+	}
+	if (buffer->buffer_origin == ORIGIN_TOP_LEFT) {
+		dst_y1 = 0;
+		dst_y2 = buffer->height;
+	} else {
+		dst_y1 = buffer->height;
+		dst_y2 = 0;
+	}
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+	glBlitFramebuffer(rect->x, src_y1, rect->x + rect->width, src_y2,
+			  0, dst_y1, buffer->width, dst_y2,
+			  GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glFlush();
+	ret = true;
+
+out:
+	glBindFramebuffer(GL_FRAMEBUFFER, read_fbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(1, &rb);
+	gr->destroy_image(gr->egl_display, image);
+
+	return ret;
+}
+
+/* Narrows the framebuffer rectangle of a capture to the rows that hold the
+ * damage of the task, full rows keeping the copy a plain one. The rest of
+ * the buffer still has the current image. Returns the first buffer row. */
+static int
+capture_damage_rows(struct gl_output_state *go, struct weston_capture_task *ct,
+		    struct weston_geometry *rect)
+{
+	pixman_region32_t *damage = weston_capture_task_get_damage(ct);
+	pixman_box32_t *extents = pixman_region32_extents(damage);
+
+	if (!pixman_region32_not_empty(damage)) {
+		rect->height = 0;
+		return 0;
+	}
+
+	/* Because glReadPixels has bottom-left origin */
+	if (is_y_flipped(go))
+		rect->y += rect->height - extents->y2;
+	else
+		rect->y += extents->y1;
+	rect->height = extents->y2 - extents->y1;
+
+	return extents->y1;
+}
+
 static void
 gl_renderer_do_capture_tasks(struct gl_renderer *gr,
 			     struct weston_output *output,
@@ -1069,7 +1376,8 @@ gl_renderer_do_capture_tasks(struct gl_renderer *gr,
 	struct gl_output_state *go = get_output_state(output);
 	const struct pixel_format_info *format;
 	struct weston_capture_task *ct;
-	struct weston_geometry rect;
+	struct weston_geometry rect, rows;
+	int row;
 
 	switch (source) {
 	case WESTON_OUTPUT_CAPTURE_SOURCE_FRAMEBUFFER:
@@ -1095,6 +1403,15 @@ gl_renderer_do_capture_tasks(struct gl_renderer *gr,
 						     rect.height, format))) {
 		struct weston_buffer *buffer = weston_capture_task_get_buffer(ct);
 
+		/* Any size and format, see weston_output_set_capture_scaling() */
+		if (buffer->type == WESTON_BUFFER_DMABUF) {
+			if (gl_renderer_do_capture_scaled(gr, go, buffer, &rect))
+				weston_capture_task_retire_complete(ct);
+			else
+				weston_capture_task_retire_failed(ct, "GL: dmabuf capture failed");
+			continue;
+		}
+
 		assert(buffer->width == rect.width);
 		assert(buffer->height == rect.height);
 		assert(buffer->pixel_format->format == format->format);
@@ -1110,12 +1427,20 @@ gl_renderer_do_capture_tasks(struct gl_renderer *gr,
 			continue;
 		}
 
+		rows = rect;
+		row = capture_damage_rows(go, ct, &rows);
+		if (rows.height == 0) {
+			weston_capture_task_retire_complete(ct);
+			continue;
+		}
+
 		if (gl_features_has(gr, FEATURE_ASYNC_READBACK)) {
-			gl_renderer_do_read_pixels_async(gr, go, output, ct, &rect);
+			gl_renderer_do_read_pixels_async(gr, go, output, ct,
+							 &rows, row);
 			continue;
 		}
 
-		if (gl_renderer_do_capture(gr, go, buffer, &rect))
+		if (gl_renderer_do_capture(gr, go, buffer, &rows, row))
 			weston_capture_task_retire_complete(ct);
 		else
 			weston_capture_task_retire_failed(ct, "GL: capture failed");
@@ -1298,7 +1623,14 @@ gl_shader_config_init_for_paint_node(struct gl_shader_config *sconf,
 
 	weston_matrix_multiply(&sconf->projection, &go->output_matrix);
 
-	if (buffer->buffer_origin == ORIGIN_TOP_LEFT) {
+	if (gs->buffer->atlas_page) {
+		weston_matrix_translate(&sconf->surface_to_buffer,
+					gs->buffer->atlas_x,
+					gs->buffer->atlas_y, 0);
+		weston_matrix_scale(&sconf->surface_to_buffer,
+				    1.0f / GL_ATLAS_PAGE_SIZE,
+				    1.0f / GL_ATLAS_PAGE_SIZE, 1);
+	} else if (buffer->buffer_origin == ORIGIN_TOP_LEFT) {
 		weston_matrix_scale(&sconf->surface_to_buffer,
 				    1.0f / buffer->width,
 				    1.0f / buffer->height, 1);
@@ -1327,7 +1659,8 @@ gl_shader_config_init_for_paint_node(struct gl_shader_config *sconf,
  * vertical bands.
  */
 static int
-compress_bands(pixman_box32_t *inrects, int nrects, pixman_box32_t **outrects)
+compress_bands(pixman_box32_t *inrects, int nrects, struct wl_array *bands,
+	       pixman_box32_t **outrects)
 {
 	pixman_box32_t *out;
 	int i, j, nout;
@@ -1337,7 +1670,12 @@ compress_bands(pixman_box32_t *inrects, int nrects, pixman_box32_t **outrects)
 	/* nrects is an upper bound - we're not too worried about
 	 * allocating a little extra
 	 */
-	out = malloc(sizeof(pixman_box32_t) * nrects);
+	bands->size = 0;
+	out = wl_array_add(bands, sizeof(pixman_box32_t) * nrects);
+	if (!out) {
+		*outrects = inrects;
+		return nrects;
+	}
 	out[0] = inrects[0];
 	nout = 1;
 	for (i = 1; i < nrects; i++) {
@@ -1379,18 +1717,20 @@ global_to_surface(pixman_box32_t *rect, struct weston_view *ev,
 
 /* Transform damage 'region' in global coordinates to damage 'quads' in surface
  * coordinates. 'quads' and 'nquads' are output arguments set if 'quads' is
- * NULL, no transformation happens otherwise. Caller must free 'quads' if
- * set. Caller must ensure 'region' is not empty.
+ * NULL, no transformation happens otherwise. 'quads' lives in the renderer
+ * and is only valid until the next call for another paint node. Caller must
+ * ensure 'region' is not empty.
  */
 static void
-transform_damage(const struct weston_paint_node *pnode,
+transform_damage(struct gl_renderer *gr,
+		 const struct weston_paint_node *pnode,
 		 pixman_region32_t *region,
 		 struct clipper_quad **quads,
 		 int *nquads)
 {
 	pixman_box32_t *rects;
 	int nrects, i;
-	bool compress, axis_aligned;
+	bool axis_aligned;
 	struct clipper_quad *quads_alloc;
 	struct clipper_vertex polygon[4];
 	struct weston_view *view;
@@ -1399,12 +1739,19 @@ transform_damage(const struct weston_paint_node *pnode,
 		return;
 
 	rects = pixman_region32_rectangles(region, &nrects);
-	compress = nrects >= 4;
-	if (compress)
-		nrects = compress_bands(rects, nrects, &rects);
+	if (nrects >= 4)
+		nrects = compress_bands(rects, nrects, &gr->band_scratch,
+					&rects);
 
 	assert(nrects > 0);
-	*quads = quads_alloc = malloc(nrects * sizeof *quads_alloc);
+	gr->quad_scratch.size = 0;
+	quads_alloc = wl_array_add(&gr->quad_scratch,
+				   nrects * sizeof *quads_alloc);
+	if (!quads_alloc) {
+		*nquads = 0;
+		return;
+	}
+	*quads = quads_alloc;
 	*nquads = nrects;
 
 	/* All the damage rects are axis-aligned in global space. This implies
@@ -1420,9 +1767,6 @@ transform_damage(const struct weston_paint_node *pnode,
 		global_to_surface(&rects[i], view, polygon);
 		clipper_quad_init(&quads_alloc[i], polygon, axis_aligned);
 	}
-
-	if (compress)
-		free(rects);
 }
 
 /* Set barycentric coordinates of a sub-mesh of 'count' vertices. 8 barycentric
@@ -1562,54 +1906,302 @@ draw_mesh(struct gl_renderer *gr,
 	if (!gl_renderer_use_program(gr, sconf))
 		gl_renderer_send_shader_error(pnode); /* Use fallback shader. */
 
+	/* Only batched atlas draws carry texture coordinates, held in the
+	 * texcoord stream alongside the positions. */
+	if (sconf->req.texcoord_input == SHADER_TEXCOORD_INPUT_ATTRIB) {
+		glEnableVertexAttribArray(SHADER_ATTRIB_LOC_TEXCOORD);
+		glVertexAttribPointer(SHADER_ATTRIB_LOC_TEXCOORD, 2, GL_FLOAT,
+				      GL_FALSE, 0, gr->texcoord_stream.data);
+	}
+
 	glVertexAttribPointer(SHADER_ATTRIB_LOC_POSITION, 2, GL_FLOAT, GL_FALSE,
 			      0, positions);
 	glDrawElements(GL_TRIANGLE_STRIP, nidx, GL_UNSIGNED_SHORT, indices);
 
+	if (sconf->req.texcoord_input == SHADER_TEXCOORD_INPUT_ATTRIB)
+		glDisableVertexAttribArray(SHADER_ATTRIB_LOC_TEXCOORD);
+
 	if (gr->debug_mode == DEBUG_MODE_WIREFRAME)
 		glDisableVertexAttribArray(SHADER_ATTRIB_LOC_BARYCENTRIC);
 }
 
+/* Solid color draws don't use texture coordinates, so consecutive ones that
+ * only differ in their projection can be merged by transforming positions to
+ * clip space on the CPU. The projection must be affine in x and y for 2D
+ * clip-space positions to be exact. Debug modes draw each node separately.
+ *
+ * Draws sampling the same atlas page are merged the same way, with their
+ * texture coordinates also computed on the CPU and passed as an attribute.
+ */
+static bool
+gl_shader_config_can_batch(const struct gl_renderer *gr,
+			   struct weston_paint_node *pnode,
+			   const struct gl_shader_config *sconf)
+{
+	const float *d = sconf->projection.d;
+	struct gl_surface_state *gs = get_surface_state(pnode->surface);
+
+	if (gr->debug_mode)
+		return false;
+
+	if (sconf->req.variant != SHADER_VARIANT_SOLID &&
+	    !(gs->buffer && gs->buffer->atlas_page &&
+	      sconf->input_tex[0] == gs->buffer->atlas_page->tex))
+		return false;
+
+	return d[2] == 0.0f && d[6] == 0.0f && d[14] == 0.0f &&
+	       d[3] == 0.0f && d[7] == 0.0f && d[15] == 1.0f;
+}
+
 static void
-repaint_region(struct gl_renderer *gr,
-	       struct weston_paint_node *pnode,
-	       struct clipper_quad *quads,
-	       int nquads,
-	       pixman_region32_t *region,
-	       struct gl_shader_config *sconf,
-	       bool opaque)
+gl_shader_config_init_for_batch(struct gl_shader_config *dst,
+				const struct gl_shader_config *src)
 {
-	pixman_box32_t *rects;
-	struct clipper_vertex *positions;
-	uint32_t *barycentrics = NULL;
-	uint16_t *indices;
-	int i, j, n, nrects, positions_size, barycentrics_size, indices_size;
-	int nvtx = 0, nidx = 0;
-	bool wireframe = gr->debug_mode == DEBUG_MODE_WIREFRAME;
+	*dst = *src;
+	weston_matrix_init(&dst->projection);
+	weston_matrix_init(&dst->surface_to_buffer);
+	if (dst->req.variant != SHADER_VARIANT_SOLID)
+		dst->req.texcoord_input = SHADER_TEXCOORD_INPUT_ATTRIB;
+}
 
-	/* Build-time sub-mesh constants. Clipping emits 8 vertices max.
-	 * store_indices() store at most 10 indices. */
-	const int nvtx_max = 8;
-	const int nidx_max = 10;
+/* The unions hold only the members the requirements select, and the
+ * configs are not zeroed as a whole, so compare field by field. */
+static bool
+gl_shader_config_color_equal(const struct gl_shader_config *a,
+			     const struct gl_shader_config *b)
+{
+	switch (a->req.color_pre_curve) {
+	case SHADER_COLOR_CURVE_IDENTITY:
+		break;
+	case SHADER_COLOR_CURVE_LUT_3x1D:
+		if (a->color_pre_curve.lut_3x1d.tex !=
+		    b->color_pre_curve.lut_3x1d.tex ||
+		    memcmp(a->color_pre_curve.lut_3x1d.scale_offset,
+			   b->color_pre_curve.lut_3x1d.scale_offset,
+			   sizeof a->color_pre_curve.lut_3x1d.scale_offset))
+			return false;
+		break;
+	case SHADER_COLOR_CURVE_LINPOW:
+	case SHADER_COLOR_CURVE_POWLIN:
+		if (a->color_pre_curve.parametric.clamped_input !=
+		    b->color_pre_curve.parametric.clamped_input ||
+		    memcmp(a->color_pre_curve.parametric.params,
+			   b->color_pre_curve.parametric.params,
+			   sizeof a->color_pre_curve.parametric.params))
+			return false;
+		break;
+	}
 
-	rects = pixman_region32_rectangles(region, &nrects);
-	assert((nrects > 0) && (nquads > 0));
+	switch (a->req.color_mapping) {
+	case SHADER_COLOR_MAPPING_IDENTITY:
+		break;
+	case SHADER_COLOR_MAPPING_3DLUT:
+		if (a->color_mapping.lut3d.tex != b->color_mapping.lut3d.tex ||
+		    memcmp(a->color_mapping.lut3d.scale_offset,
+			   b->color_mapping.lut3d.scale_offset,
+			   sizeof a->color_mapping.lut3d.scale_offset))
+			return false;
+		break;
+	case SHADER_COLOR_MAPPING_MATRIX:
+		if (memcmp(a->color_mapping.mat.matrix,
+			   b->color_mapping.mat.matrix,
+			   sizeof a->color_mapping.mat.matrix) ||
+		    memcmp(a->color_mapping.mat.offset,
+			   b->color_mapping.mat.offset,
+			   sizeof a->color_mapping.mat.offset))
+			return false;
+		break;
+	}
 
-	/* Worst case allocation sizes per sub-mesh. */
-	n = nquads * nrects;
-	positions_size = n * nvtx_max * sizeof *positions;
-	barycentrics_size = ROUND_UP_N(n * nvtx_max * sizeof *barycentrics, 32);
-	indices_size = ROUND_UP_N(n * nidx_max * sizeof *indices, 32);
+	switch (a->req.color_post_curve) {
+	case SHADER_COLOR_CURVE_IDENTITY:
+		break;
+	case SHADER_COLOR_CURVE_LUT_3x1D:
+		if (a->color_post_curve.lut_3x1d.tex !=
+		    b->color_post_curve.lut_3x1d.tex ||
+		    memcmp(a->color_post_curve.lut_3x1d.scale_offset,
+			   b->color_post_curve.lut_3x1d.scale_offset,
+			   sizeof a->color_post_curve.lut_3x1d.scale_offset))
+			return false;
+		break;
+	case SHADER_COLOR_CURVE_LINPOW:
+	case SHADER_COLOR_CURVE_POWLIN:
+		if (a->color_post_curve.parametric.clamped_input !=
+		    b->color_post_curve.parametric.clamped_input ||
+		    memcmp(a->color_post_curve.parametric.params,
+			   b->color_post_curve.parametric.params,
+			   sizeof a->color_post_curve.parametric.params))
+			return false;
+		break;
+	}
 
-	positions = wl_array_add(&gr->position_stream, positions_size);
-	indices = wl_array_add(&gr->indices, indices_size);
-	if (wireframe)
-		barycentrics = wl_array_add(&gr->barycentric_stream,
-					    barycentrics_size);
+	return true;
+}
 
-	/* A node's damage mesh is created by clipping damage quads to surface
-	 * rects and by chaining the resulting sub-meshes into an indexed
-	 * triangle strip. Damage quads are transformed to surface space in a
+static bool
+batch_is_compatible(struct gl_renderer *gr,
+		    const struct gl_shader_config *sconf)
+{
+	const struct gl_shader_config *batch = &gr->batch.sconf;
+	struct gl_shader_config batched;
+
+	if (gr->batch.nvtx == 0)
+		return false;
+
+	gl_shader_config_init_for_batch(&batched, sconf);
+
+	/* The matrices are identity in both, see
+	 * gl_shader_config_init_for_batch(). gl_shader_requirements has
+	 * no padding. */
+	return memcmp(&batched.req, &batch->req, sizeof batched.req) == 0 &&
+	       batched.view_alpha == batch->view_alpha &&
+	       memcmp(batched.unicolor, batch->unicolor,
+		      sizeof batched.unicolor) == 0 &&
+	       memcmp(batched.tint, batch->tint, sizeof batched.tint) == 0 &&
+	       batched.input_tex_filter == batch->input_tex_filter &&
+	       memcmp(batched.input_tex, batch->input_tex,
+		      sizeof batched.input_tex) == 0 &&
+	       batched.wireframe_tex == batch->wireframe_tex &&
+	       gl_shader_config_color_equal(&batched, batch);
+}
+
+static void
+flush_batch(struct gl_renderer *gr)
+{
+	if (gr->batch.nvtx == 0)
+		return;
+
+	/* Subtracting 2 removes the last chaining indices. */
+	draw_mesh(gr, gr->batch.pnode, &gr->batch.sconf,
+		  gr->position_stream.data, NULL, gr->indices.data,
+		  gr->batch.nidx - 2, false);
+
+	gr->batch.nvtx = gr->batch.nidx = 0;
+	gr->position_stream.size = 0;
+	gr->texcoord_stream.size = 0;
+	gr->indices.size = 0;
+}
+
+static void
+set_blend(struct gl_renderer *gr, bool blend)
+{
+	/* A pending batch was built for the current blend state. */
+	if (gr->blend != blend)
+		flush_batch(gr);
+
+	gr->blend = blend;
+	if (blend)
+		glEnable(GL_BLEND);
+	else
+		glDisable(GL_BLEND);
+}
+
+static void
+transform_positions(const struct weston_matrix *matrix,
+		    struct clipper_vertex *positions, int count)
+{
+	const float *d = matrix->d;
+	float x, y;
+	int i;
+
+	/* Unless the view or the output is rotated, the projection only
+	 * scales and translates. */
+	if (!(matrix->type & (WESTON_MATRIX_TRANSFORM_ROTATE |
+			      WESTON_MATRIX_TRANSFORM_OTHER))) {
+		for (i = 0; i < count; i++) {
+			positions[i].x = d[0] * positions[i].x + d[12];
+			positions[i].y = d[5] * positions[i].y + d[13];
+		}
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		x = positions[i].x;
+		y = positions[i].y;
+		positions[i].x = d[0] * x + d[4] * y + d[12];
+		positions[i].y = d[1] * x + d[5] * y + d[13];
+	}
+}
+
+static void
+store_texcoords(const struct weston_matrix *surface_to_buffer,
+		const struct clipper_vertex *positions,
+		struct clipper_vertex *texcoords, int count)
+{
+	const float *d = surface_to_buffer->d;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		texcoords[i].x = d[0] * positions[i].x + d[4] * positions[i].y +
+				 d[12];
+		texcoords[i].y = d[1] * positions[i].x + d[5] * positions[i].y +
+				 d[13];
+	}
+}
+
+static void
+repaint_region(struct gl_renderer *gr,
+	       struct weston_paint_node *pnode,
+	       struct clipper_quad *quads,
+	       int nquads,
+	       pixman_region32_t *region,
+	       struct gl_shader_config *sconf,
+	       bool opaque)
+{
+	pixman_box32_t *rects;
+	struct clipper_vertex *positions;
+	struct clipper_vertex *texcoords = NULL;
+	uint32_t *barycentrics = NULL;
+	uint16_t *indices;
+	int i, j, n, nrects, positions_size, barycentrics_size, indices_size;
+	int nvtx, nidx;
+	bool wireframe = gr->debug_mode == DEBUG_MODE_WIREFRAME;
+	bool batch = gl_shader_config_can_batch(gr, pnode, sconf);
+	bool textured = batch && sconf->req.variant != SHADER_VARIANT_SOLID;
+
+	/* Build-time sub-mesh constants. Clipping emits 8 vertices max.
+	 * store_indices() store at most 10 indices. */
+	const int nvtx_max = 8;
+	const int nidx_max = 10;
+
+	rects = pixman_region32_rectangles(region, &nrects);
+	assert((nrects > 0) && (nquads > 0));
+
+	/* Append to the pending batch, or draw it first to keep the
+	 * painter's order. */
+	if (!batch || !batch_is_compatible(gr, sconf)) {
+		flush_batch(gr);
+		if (batch) {
+			gr->batch.pnode = pnode;
+			gl_shader_config_init_for_batch(&gr->batch.sconf,
+							sconf);
+		}
+	}
+	nvtx = gr->batch.nvtx;
+	nidx = gr->batch.nidx;
+
+	/* Worst case allocation sizes per sub-mesh. */
+	n = nquads * nrects;
+	positions_size = n * nvtx_max * sizeof *positions;
+	barycentrics_size = ROUND_UP_N(n * nvtx_max * sizeof *barycentrics, 32);
+	indices_size = ROUND_UP_N(n * nidx_max * sizeof *indices, 32);
+
+	/* The streams may be reallocated, already batched vertices included. */
+	wl_array_add(&gr->position_stream, positions_size);
+	wl_array_add(&gr->indices, indices_size);
+	positions = gr->position_stream.data;
+	indices = gr->indices.data;
+	if (textured) {
+		wl_array_add(&gr->texcoord_stream, positions_size);
+		texcoords = gr->texcoord_stream.data;
+	}
+	if (wireframe)
+		barycentrics = wl_array_add(&gr->barycentric_stream,
+					    barycentrics_size);
+
+	/* A node's damage mesh is created by clipping damage quads to surface
+	 * rects and by chaining the resulting sub-meshes into an indexed
+	 * triangle strip. Damage quads are transformed to surface space in a
 	 * prior pass for clipping to take place there. A surface rect is always
 	 * axis-aligned in surface space. In the common (and fast) case, a
 	 * damage quad is axis-aligned and clipping generates an axis-aligned
@@ -1624,11 +2216,21 @@ repaint_region(struct gl_renderer *gr,
 	 *    '.    /    _.-'!   counter-clockwise winding order.
 	 *      '. / _.-'    !
 	 *        4 -------- 3   Triangle strip: 0, 5, 1, 4, 2, 3.
+	 *
+	 * Batched sub-meshes are chained the same way after the ones of the
+	 * previous nodes, with their vertices in clip space.
 	 */
 	for (i = 0; i < nquads; i++) {
 		for (j = 0; j < nrects; j++) {
 			n = clipper_quad_clip_box32(&quads[i], &rects[j],
 						    &positions[nvtx]);
+			if (textured)
+				store_texcoords(&sconf->surface_to_buffer,
+						&positions[nvtx],
+						&texcoords[nvtx], n);
+			if (batch)
+				transform_positions(&sconf->projection,
+						    &positions[nvtx], n);
 			nidx += store_indices(n, nvtx, &indices[nidx]);
 			if (wireframe)
 				store_wireframes(n, &barycentrics[nvtx]);
@@ -1637,14 +2239,31 @@ repaint_region(struct gl_renderer *gr,
 			/* Highly unlikely flush to prevent index wraparound.
 			 * Subtracting 2 removes the last chaining indices. */
 			if ((nvtx + nvtx_max) > UINT16_MAX) {
-				draw_mesh(gr, pnode, sconf, positions,
-					  barycentrics, indices, nidx - 2,
-					  opaque);
+				if (batch)
+					draw_mesh(gr, gr->batch.pnode,
+						  &gr->batch.sconf, positions,
+						  NULL, indices, nidx - 2,
+						  opaque);
+				else
+					draw_mesh(gr, pnode, sconf, positions,
+						  barycentrics, indices,
+						  nidx - 2, opaque);
 				nvtx = nidx = 0;
 			}
 		}
 	}
 
+	if (batch) {
+		/* Keep the sub-meshes for the next compatible node. */
+		gr->batch.nvtx = nvtx;
+		gr->batch.nidx = nidx;
+		gr->position_stream.size = nvtx * sizeof *positions;
+		gr->texcoord_stream.size = textured ?
+					   nvtx * sizeof *texcoords : 0;
+		gr->indices.size = nidx * sizeof *indices;
+		return;
+	}
+
 	if (nvtx)
 		draw_mesh(gr, pnode, sconf, positions, barycentrics, indices,
 			  nidx - 2, opaque);
@@ -1655,6 +2274,163 @@ repaint_region(struct gl_renderer *gr,
 		gr->barycentric_stream.size = 0;
 }
 
+/* GPU time spent drawing one paint node. The surface may be gone by the
+ * time the result is read, so whatever describes it is copied. */
+struct gl_node_timing {
+	GLuint query;
+	pid_t pid;
+	uint32_t surface_id;
+	struct gl_shader_requirements req;
+	char label[64];
+};
+
+/*
+ * Start timing the draws of a paint node. Batching merges the geometry of
+ * consecutive nodes, so the batch of the previous node is flushed first
+ * and the one of this node in gpu_timing_end().
+ */
+static void
+gpu_timing_begin(struct gl_renderer *gr, struct weston_paint_node *pnode,
+		 const struct gl_shader_config *sconf)
+{
+	struct gl_output_state *go = get_output_state(pnode->output);
+	struct weston_surface *surface = pnode->surface;
+	struct gl_node_timing *timing;
+	size_t n;
+
+	if (!gr->gpu_timing_active)
+		return;
+
+	flush_batch(gr);
+
+	n = go->node_timings.size / sizeof *timing;
+	if (go->node_queries.size / sizeof(GLuint) <= n) {
+		GLuint *query = abort_oom_if_null(wl_array_add(&go->node_queries,
+							       sizeof *query));
+
+		gr->gen_queries(1, query);
+	}
+
+	timing = abort_oom_if_null(wl_array_add(&go->node_timings,
+						sizeof *timing));
+
+	timing->query = ((GLuint *) go->node_queries.data)[n];
+	timing->pid = 0;
+	timing->surface_id = 0;
+	timing->req = sconf->req;
+	if (surface->resource) {
+		wl_client_get_credentials(wl_resource_get_client(surface->resource),
+					  &timing->pid, NULL, NULL);
+		timing->surface_id = wl_resource_get_id(surface->resource);
+	}
+	if (!surface->get_label ||
+	    surface->get_label(surface, timing->label,
+			       sizeof timing->label) < 0)
+		strcpy(timing->label, "[no description available]");
+
+	gr->begin_query(GL_TIME_ELAPSED_EXT, timing->query);
+}
+
+static void
+gpu_timing_end(struct gl_renderer *gr)
+{
+	if (!gr->gpu_timing_active)
+		return;
+
+	flush_batch(gr);
+	gr->end_query(GL_TIME_ELAPSED_EXT);
+}
+
+/*
+ * Report the node timings of the previous repaint of an output. They are
+ * read one frame late, when the GPU is done with them, instead of
+ * stalling on the results.
+ */
+static void
+gpu_timing_collect(struct gl_renderer *gr, struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct weston_log_scope *scope = gr->gpu_timing_scope;
+	struct gl_node_timing *timing;
+	GLint available, disjoint = 0;
+	GLuint64 elapsed, total = 0;
+	int pending = 0;
+	char *desc;
+
+	if (go->node_timings.size == 0)
+		return;
+
+	if (!weston_log_scope_enabled(scope))
+		goto out;
+
+	/* A disjoint operation, e.g. a frequency change, makes the results
+	 * meaningless. Reading the flag also resets it. */
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+	if (disjoint) {
+		weston_log_scope_printf(scope, "output \"%s\": GPU timings "
+					"discarded, disjoint operation\n",
+					output->name);
+		goto out;
+	}
+
+	wl_array_for_each(timing, &go->node_timings) {
+		gr->get_query_object_iv(timing->query,
+					GL_QUERY_RESULT_AVAILABLE_EXT,
+					&available);
+		if (available) {
+			gr->get_query_object_ui64v(timing->query,
+						   GL_QUERY_RESULT_EXT,
+						   &elapsed);
+			total += elapsed;
+		}
+	}
+
+	weston_log_scope_printf(scope, "output \"%s\": %.3f ms in %zu paint "
+				"nodes\n", output->name, total / 1e6,
+				go->node_timings.size / sizeof *timing);
+
+	wl_array_for_each(timing, &go->node_timings) {
+		gr->get_query_object_iv(timing->query,
+					GL_QUERY_RESULT_AVAILABLE_EXT,
+					&available);
+		if (!available) {
+			pending++;
+			continue;
+		}
+
+		gr->get_query_object_ui64v(timing->query, GL_QUERY_RESULT_EXT,
+					   &elapsed);
+		desc = gl_shader_requirements_to_string(&timing->req);
+		weston_log_scope_printf(scope, "  %8.3f ms  PID %d, surface "
+					"ID %u, %s\n  %11s shader %s\n",
+					elapsed / 1e6, timing->pid,
+					timing->surface_id, timing->label,
+					"", desc ? desc : "?");
+		free(desc);
+	}
+
+	if (pending > 0)
+		weston_log_scope_printf(scope, "  %d results not ready\n",
+					pending);
+
+out:
+	go->node_timings.size = 0;
+}
+
+static void
+shm_texture_restore(struct gl_renderer *gr, struct gl_buffer_state *gb);
+
+static void
+shm_texture_touch(struct gl_renderer *gr, struct gl_buffer_state *gb)
+{
+	gb->last_drawn = gr->compositor->last_repaint_start;
+	if (gb->evicted_pixels)
+		return;
+
+	wl_list_remove(&gb->lru_link);
+	wl_list_insert(&gr->shm_texture_lru, &gb->lru_link);
+}
+
 static void
 draw_paint_node(struct weston_paint_node *pnode,
 		pixman_region32_t *damage /* in global coordinates */)
@@ -1664,11 +2440,12 @@ draw_paint_node(struct weston_paint_node *pnode,
 	struct gl_buffer_state *gb = gs->buffer;
 	struct weston_buffer *buffer = gs->buffer_ref.buffer;
 	/* repaint bounding region in global coordinates: */
-	pixman_region32_t repaint;
+	pixman_region32_t *repaint = &gr->scratch_region[0];
 	/* opaque region in surface coordinates: */
-	pixman_region32_t surface_opaque;
+	pixman_region32_t *surface_opaque = &gr->scratch_region[1];
 	/* non-opaque region in surface coordinates: */
-	pixman_region32_t surface_blend;
+	pixman_region32_t *surface_blend = &gr->scratch_region[2];
+	pixman_box32_t surface_box;
 	GLint filter;
 	struct gl_shader_config sconf;
 	struct clipper_quad *quads = NULL;
@@ -1678,14 +2455,19 @@ draw_paint_node(struct weston_paint_node *pnode,
 	    !buffer->direct_display)
 		return;
 
-	pixman_region32_init(&repaint);
-	pixman_region32_intersect(&repaint, &pnode->visible, damage);
+	if (gb->texture_size > 0 && pixman_region32_not_empty(&pnode->visible))
+		shm_texture_touch(gr, gb);
 
-	if (!pixman_region32_not_empty(&repaint))
-		goto out;
+	pixman_region32_intersect(repaint, &pnode->visible, damage);
+
+	if (!pixman_region32_not_empty(repaint))
+		return;
+
+	if (gb->evicted_pixels && !pnode->draw_solid)
+		shm_texture_restore(gr, gb);
 
 	if (!pnode->draw_solid && ensure_surface_buffer_is_ready(gr, gs) < 0)
-		goto out;
+		return;
 
 	if (pnode->needs_filtering)
 		filter = GL_LINEAR;
@@ -1693,36 +2475,40 @@ draw_paint_node(struct weston_paint_node *pnode,
 		filter = GL_NEAREST;
 
 	if (!gl_shader_config_init_for_paint_node(&sconf, pnode, filter))
-		goto out;
+		return;
+
+	/* The regions below are renderer scratch space, so that their
+	 * rectangle arrays get reused from one paint node to the next
+	 * instead of going through malloc every frame. */
+	surface_box = (pixman_box32_t) {
+		0, 0, pnode->surface->width, pnode->surface->height
+	};
 
 	/* XXX: Should we be using ev->transform.opaque here? */
 	if (pnode->is_fully_opaque)
-		pixman_region32_init_rect(&surface_opaque, 0, 0,
-					  pnode->surface->width,
-					  pnode->surface->height);
-	else {
-		pixman_region32_init(&surface_opaque);
-		pixman_region32_copy(&surface_opaque, &pnode->surface->opaque);
-	}
+		pixman_region32_reset(surface_opaque, &surface_box);
+	else
+		pixman_region32_copy(surface_opaque, &pnode->surface->opaque);
 
 	if (pnode->view->geometry.scissor_enabled)
-		pixman_region32_intersect(&surface_opaque,
-					  &surface_opaque,
+		pixman_region32_intersect(surface_opaque,
+					  surface_opaque,
 					  &pnode->view->geometry.scissor);
 
 	/* blended region is whole surface minus opaque region: */
-	pixman_region32_init_rect(&surface_blend, 0, 0,
-				  pnode->surface->width, pnode->surface->height);
+	pixman_region32_reset(surface_blend, &surface_box);
 	if (pnode->view->geometry.scissor_enabled)
-		pixman_region32_intersect(&surface_blend, &surface_blend,
+		pixman_region32_intersect(surface_blend, surface_blend,
 					  &pnode->view->geometry.scissor);
-	pixman_region32_subtract(&surface_blend, &surface_blend,
-				 &surface_opaque);
+	pixman_region32_subtract(surface_blend, surface_blend,
+				 surface_opaque);
 
 	if (pnode->draw_solid)
 		prepare_placeholder(&sconf, pnode);
 
-	if (pixman_region32_not_empty(&surface_opaque)) {
+	gpu_timing_begin(gr, pnode, &sconf);
+
+	if (pixman_region32_not_empty(surface_opaque)) {
 		struct gl_shader_config alt = sconf;
 
 		if (alt.req.variant == SHADER_VARIANT_RGBA) {
@@ -1734,33 +2520,23 @@ draw_paint_node(struct weston_paint_node *pnode,
 			alt.req.variant = SHADER_VARIANT_RGBX;
 		}
 
-		if (pnode->view->alpha < 1.0)
-			glEnable(GL_BLEND);
-		else
-			glDisable(GL_BLEND);
+		set_blend(gr, pnode->view->alpha < 1.0);
 
-		transform_damage(pnode, &repaint, &quads, &nquads);
-		repaint_region(gr, pnode, quads, nquads, &surface_opaque, &alt,
+		transform_damage(gr, pnode, repaint, &quads, &nquads);
+		repaint_region(gr, pnode, quads, nquads, surface_opaque, &alt,
 			       true);
 		gs->used_in_output_repaint = true;
 	}
 
-	if (pixman_region32_not_empty(&surface_blend)) {
-		glEnable(GL_BLEND);
-		transform_damage(pnode, &repaint, &quads, &nquads);
-		repaint_region(gr, pnode, quads, nquads, &surface_blend, &sconf,
+	if (pixman_region32_not_empty(surface_blend)) {
+		set_blend(gr, true);
+		transform_damage(gr, pnode, repaint, &quads, &nquads);
+		repaint_region(gr, pnode, quads, nquads, surface_blend, &sconf,
 			       false);
 		gs->used_in_output_repaint = true;
 	}
 
-	if (quads)
-		free(quads);
-
-	pixman_region32_fini(&surface_blend);
-	pixman_region32_fini(&surface_opaque);
-
-out:
-	pixman_region32_fini(&repaint);
+	gpu_timing_end(gr);
 }
 
 static void
@@ -1780,6 +2556,7 @@ repaint_views(struct weston_output *output, pixman_region32_t *damage)
 		    pnode->need_hole)
 			draw_paint_node(pnode, damage);
 	}
+	flush_batch(gr);
 
 	glDisableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
 }
@@ -1790,12 +2567,17 @@ gl_renderer_create_fence_fd(struct weston_output *output);
 /* Updates the release fences of surfaces that were used in the current output
  * repaint. Should only be used from gl_renderer_repaint_output, so that the
  * information in gl_surface_state.used_in_output_repaint is accurate.
+ *
+ * Every release fence is the same render fence, so it is exported from EGL
+ * once and then only duplicated for each surface.
  */
 static void
 update_buffer_release_fences(struct weston_compositor *compositor,
 			     struct weston_output *output)
 {
 	struct weston_paint_node *pnode;
+	int render_fence_fd = -1;
+	bool exported = false;
 
 	wl_list_for_each_reverse(pnode, &output->paint_node_z_order_list,
 				 z_order_link) {
@@ -1815,7 +2597,13 @@ update_buffer_release_fences(struct weston_compositor *compositor,
 		if (!gs->used_in_output_repaint || !buffer_release)
 			continue;
 
-		fence_fd = gl_renderer_create_fence_fd(output);
+		if (!exported) {
+			render_fence_fd = gl_renderer_create_fence_fd(output);
+			exported = true;
+		}
+
+		fence_fd = render_fence_fd >= 0 ?
+			   fcntl(render_fence_fd, F_DUPFD_CLOEXEC, 0) : -1;
 
 		/* If we have a buffer_release then it means we support fences,
 		 * and we should be able to create the release fence. If we
@@ -1853,6 +2641,8 @@ update_buffer_release_fences(struct weston_compositor *compositor,
 		 */
 		fd_update(&buffer_release->fence_fd, fence_fd);
 	}
+
+	fd_clear(&render_fence_fd);
 }
 
 /* Update the wireframe texture. The texture is either created, deleted or
@@ -2075,6 +2865,60 @@ draw_output_borders(struct weston_output *output,
 	glDisableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
 }
 
+/* Draw the performance HUD of the core over the composited area, which
+ * must be the current viewport. */
+static void
+draw_perf_hud(struct weston_output *output)
+{
+	static const GLushort indices[] = { 0, 1, 3, 3, 1, 2 };
+	struct weston_perf_hud_rect rects[WESTON_PERF_HUD_MAX_RECTS];
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_shader_config sconf = {
+		.req = {
+			.variant = SHADER_VARIANT_SOLID,
+			.input_is_premult = true,
+		},
+		.projection = go->output_matrix,
+		.view_alpha = 1.0f,
+	};
+	struct weston_color_transform *ctransf;
+	int n, i;
+
+	n = weston_output_perf_hud_get_rects(output, rects,
+					     ARRAY_LENGTH(rects));
+	if (n == 0)
+		return;
+
+	ctransf = output->color_outcome->from_sRGB_to_output;
+	if (!gl_shader_config_set_color_transform(gr, &sconf, ctransf)) {
+		weston_log("GL-renderer: %s failed to generate a color transformation.\n", __func__);
+		return;
+	}
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glEnableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
+
+	for (i = 0; i < n; i++) {
+		const struct weston_perf_hud_rect *r = &rects[i];
+		GLfloat position[] = {
+			r->x, r->y,
+			r->x + r->width, r->y,
+			r->x + r->width, r->y + r->height,
+			r->x, r->y + r->height,
+		};
+
+		copy_uniform4f(sconf.unicolor, r->color);
+		gl_renderer_use_program(gr, &sconf);
+		glVertexAttribPointer(SHADER_ATTRIB_LOC_POSITION, 2, GL_FLOAT,
+				      GL_FALSE, 0, position);
+		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+	}
+
+	glDisableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
+}
+
 static void
 output_get_border_damage(struct weston_output *output,
 			 enum gl_border_status border_status,
@@ -2226,11 +3070,19 @@ pixman_region_to_egl(struct weston_output *output,
 	pixman_region32_fini(&transformed);
 }
 
+/* Draw the shadow of @src into the current framebuffer of @output. @src is
+ * either the output's own state or, for a mirror, the state of the output
+ * being mirrored; both cover the same global area, so the shadow is just
+ * scaled to fit.
+ */
 static void
 blit_shadow_to_output(struct weston_output *output,
+		      const struct gl_output_state *src,
 		      pixman_region32_t *output_damage)
 {
 	struct gl_output_state *go = get_output_state(output);
+	bool scaled = src->area.width != go->area.width ||
+		      src->area.height != go->area.height;
 	struct gl_shader_config sconf = {
 		.req = {
 			.variant = SHADER_VARIANT_RGBA,
@@ -2247,8 +3099,8 @@ blit_shadow_to_output(struct weston_output *output,
 				WESTON_MATRIX_TRANSFORM_TRANSLATE,
 		},
 		.view_alpha = 1.0f,
-		.input_tex_filter = GL_NEAREST,
-		.input_tex[0] = go->shadow.tex,
+		.input_tex_filter = scaled ? GL_LINEAR : GL_NEAREST,
+		.input_tex[0] = src->shadow.tex,
 	};
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	double width = go->area.width;
@@ -2258,8 +3110,8 @@ blit_shadow_to_output(struct weston_output *output,
 	int n_rects;
 	int i;
 	pixman_region32_t translated_damage;
-	struct { GLfloat x, y; } position[4];
-	struct { GLfloat s, t; } texcoord[4];
+	struct { GLfloat x, y; } *position;
+	struct { GLfloat s, t; } *texcoord;
 
 	ctransf = output->color_outcome->from_blend_to_output;
 	if (!gl_shader_config_set_color_transform(gr, &sconf, ctransf)) {
@@ -2279,81 +3131,169 @@ blit_shadow_to_output(struct weston_output *output,
 	weston_region_global_to_output(&translated_damage, output,
 				       &translated_damage);
 
-	glEnableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
-	glEnableVertexAttribArray(SHADER_ATTRIB_LOC_TEXCOORD);
-
+	/* All damaged rectangles go out in a single draw. */
 	rects = pixman_region32_rectangles(&translated_damage, &n_rects);
+	if (n_rects == 0)
+		goto out;
+
+	position = xmalloc(n_rects * 6 * sizeof *position);
+	texcoord = xmalloc(n_rects * 6 * sizeof *texcoord);
 	for (i = 0; i < n_rects; i++) {
 		const GLfloat x1 = rects[i].x1 / width;
 		const GLfloat x2 = rects[i].x2 / width;
 		const GLfloat y1 = rects[i].y1 / height;
 		const GLfloat y2 = rects[i].y2 / height;
-		const GLfloat y1_flipped = 1.0f - y1;
-		const GLfloat y2_flipped = 1.0f - y2;
-
-		position[0].x = x1;
-		position[0].y = y1;
-		position[1].x = x2;
-		position[1].y = y1;
-		position[2].x = x2;
-		position[2].y = y2;
-		position[3].x = x1;
-		position[3].y = y2;
-
-		texcoord[0].s = x1;
-		texcoord[0].t = is_y_flipped(go) ?  y1_flipped : y1;
-		texcoord[1].s = x2;
-		texcoord[1].t = is_y_flipped(go) ?  y1_flipped : y1;
-		texcoord[2].s = x2;
-		texcoord[2].t = is_y_flipped(go) ?  y2_flipped : y2;
-		texcoord[3].s = x1;
-		texcoord[3].t = is_y_flipped(go) ?  y2_flipped : y2;
-
-		glVertexAttribPointer(SHADER_ATTRIB_LOC_POSITION, 2, GL_FLOAT,
-				      GL_FALSE, 0, position);
+		const GLfloat t1 = is_y_flipped(src) ? 1.0f - y1 : y1;
+		const GLfloat t2 = is_y_flipped(src) ? 1.0f - y2 : y2;
+		const GLfloat corners[6][4] = {
+			{ x1, y1, x1, t1 }, { x2, y1, x2, t1 },
+			{ x2, y2, x2, t2 }, { x1, y1, x1, t1 },
+			{ x2, y2, x2, t2 }, { x1, y2, x1, t2 },
+		};
+		int j;
 
-		glVertexAttribPointer(SHADER_ATTRIB_LOC_TEXCOORD, 2, GL_FLOAT,
-				      GL_FALSE, 0, texcoord);
-		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+		for (j = 0; j < 6; j++) {
+			position[i * 6 + j].x = corners[j][0];
+			position[i * 6 + j].y = corners[j][1];
+			texcoord[i * 6 + j].s = corners[j][2];
+			texcoord[i * 6 + j].t = corners[j][3];
+		}
 	}
 
+	glEnableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
+	glEnableVertexAttribArray(SHADER_ATTRIB_LOC_TEXCOORD);
+
+	glVertexAttribPointer(SHADER_ATTRIB_LOC_POSITION, 2, GL_FLOAT,
+			      GL_FALSE, 0, position);
+	glVertexAttribPointer(SHADER_ATTRIB_LOC_TEXCOORD, 2, GL_FLOAT,
+			      GL_FALSE, 0, texcoord);
+	glDrawArrays(GL_TRIANGLES, 0, n_rects * 6);
+
 	glDisableVertexAttribArray(SHADER_ATTRIB_LOC_TEXCOORD);
 	glDisableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
 
+	free(texcoord);
+	free(position);
+
+out:
 	glBindTexture(GL_TEXTURE_2D, 0);
 	pixman_region32_fini(&translated_damage);
 }
 
-/* NOTE: We now allow falling back to ARGB gl visuals when XRGB is
- * unavailable, so we're assuming the background has no transparency
- * and that everything with a blend, like drop shadows, will have something
- * opaque (like the background) drawn underneath it.
- *
- * Depending on the underlying hardware, violating that assumption could
- * result in seeing through to another display plane.
- */
-static void
-gl_renderer_repaint_output(struct weston_output *output,
-			   pixman_region32_t *output_damage,
-			   struct weston_renderbuffer *renderbuffer)
+static bool
+output_all_on_primary_plane(struct weston_output *output)
 {
-	struct gl_output_state *go = get_output_state(output);
-	struct weston_compositor *compositor = output->compositor;
-	struct gl_renderer *gr = get_renderer(compositor);
-	static int errored;
 	struct weston_paint_node *pnode;
-	const int32_t area_y =
-		is_y_flipped(go) ? go->fb_size.height - go->area.height - go->area.y : go->area.y;
-	struct gl_renderbuffer *rb;
 
-	assert(output->from_blend_to_output_by_backend ||
-	       output->color_outcome->from_blend_to_output == NULL ||
-	       shadow_exists(go));
+	wl_list_for_each(pnode, &output->paint_node_z_order_list,
+			 z_order_link) {
+		if (pnode->plane != &output->primary_plane)
+			return false;
+	}
 
-	if (use_output(output) < 0)
-		return;
+	return true;
+}
 
-	/* Accumulate damage in all renderbuffers */
+/* Return the state of the output this one mirrors, when its last frame
+ * can simply be scaled onto this one instead of compositing the scene a
+ * second time. The mirrored output is asked to keep a shadow otherwise.
+ */
+static struct gl_output_state *
+output_get_mirror_source(struct weston_output *output)
+{
+	struct weston_output *source = output->mirror_of;
+	struct gl_output_state *src;
+	pixman_box32_t *a, *b;
+
+	if (!source || !source->enabled || !source->renderer_state ||
+	    source->transform != output->transform)
+		return NULL;
+
+	a = pixman_region32_extents(&source->region);
+	b = pixman_region32_extents(&output->region);
+	if (a->x1 != b->x1 || a->y1 != b->y1 ||
+	    a->x2 != b->x2 || a->y2 != b->y2)
+		return NULL;
+
+	src = get_output_state(source);
+	src->mirror_source = true;
+	if (!shadow_exists(src) || !src->shadow_complete)
+		return NULL;
+
+	if (!output_all_on_primary_plane(output))
+		return NULL;
+
+	return src;
+}
+
+/* Give an output that is being mirrored a shadow to composite into, so
+ * its mirrors can sample it. Returns true when the new shadow needs a
+ * full repaint.
+ */
+static bool
+output_ensure_mirror_shadow(struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+
+	if (!go->mirror_source || shadow_exists(go))
+		return false;
+
+	if (!go->shadow_format)
+		go->shadow_format = pixel_format_get_info(DRM_FORMAT_ABGR8888);
+
+	if (!gl_fbo_texture_init(&go->shadow, go->area.width, go->area.height,
+				 go->shadow_format->gl_format, GL_RGBA,
+				 go->shadow_format->gl_type)) {
+		weston_log("Output %s failed to create a shadow for its "
+			   "mirrors.\n", output->name);
+		go->shadow_format = NULL;
+		go->mirror_source = false;
+		return false;
+	}
+
+	return true;
+}
+
+/* NOTE: We now allow falling back to ARGB gl visuals when XRGB is
+ * unavailable, so we're assuming the background has no transparency
+ * and that everything with a blend, like drop shadows, will have something
+ * opaque (like the background) drawn underneath it.
+ *
+ * Depending on the underlying hardware, violating that assumption could
+ * result in seeing through to another display plane.
+ */
+static void
+gl_renderer_repaint_output(struct weston_output *output,
+			   pixman_region32_t *output_damage,
+			   struct weston_renderbuffer *renderbuffer)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct weston_compositor *compositor = output->compositor;
+	struct gl_renderer *gr = get_renderer(compositor);
+	static int errored;
+	struct weston_paint_node *pnode;
+	const int32_t area_y =
+		is_y_flipped(go) ? go->fb_size.height - go->area.height - go->area.y : go->area.y;
+	struct gl_renderbuffer *rb;
+	struct gl_output_state *mirror;
+	bool shadow_full_redraw;
+
+	assert(output->from_blend_to_output_by_backend ||
+	       weston_color_transform_is_identity(output->color_outcome->from_blend_to_output) ||
+	       shadow_exists(go));
+
+	if (use_output(output) < 0)
+		return;
+
+	gl_renderer_enforce_memory_budget(gr);
+
+	mirror = output_get_mirror_source(output);
+	shadow_full_redraw = output_ensure_mirror_shadow(output) ||
+			     (go->shadow_stale && !mirror);
+	go->shadow_stale = mirror && shadow_exists(go);
+	go->shadow_complete = output_all_on_primary_plane(output);
+
+	/* Accumulate damage in all renderbuffers */
 	wl_list_for_each(rb, &go->renderbuffer_list, link) {
 		pixman_region32_union(&rb->base.damage,
 				      &rb->base.damage,
@@ -2377,6 +3317,11 @@ gl_renderer_repaint_output(struct weston_output *output,
 		}
 	}
 
+	gpu_timing_collect(gr, output);
+	gr->gpu_timing_active =
+		gl_extensions_has(gr, EXTENSION_EXT_DISJOINT_TIMER_QUERY) &&
+		weston_log_scope_enabled(gr->gpu_timing_scope);
+
 	timeline_begin_render_query(gr, go->render_query);
 
 	/* Calculate the global GL matrix */
@@ -2388,8 +3333,13 @@ gl_renderer_repaint_output(struct weston_output *output,
 			    2.0 / go->area.width,
 			    go->y_flip * 2.0 / go->area.height, 1);
 
-	/* If using shadow, redirect all drawing to it first. */
-	if (shadow_exists(go)) {
+	/* A mirror only scales the other output's shadow; otherwise, if
+	 * using shadow, redirect all drawing to it first. */
+	if (mirror) {
+		glBindFramebuffer(GL_FRAMEBUFFER, rb->fbo);
+		glViewport(go->area.x, area_y,
+			   go->area.width, go->area.height);
+	} else if (shadow_exists(go)) {
 		glBindFramebuffer(GL_FRAMEBUFFER, go->shadow.fbo);
 		glViewport(0, 0, go->area.width, go->area.height);
 	} else {
@@ -2407,7 +3357,7 @@ gl_renderer_repaint_output(struct weston_output *output,
 	 * clear any debug left over on this buffer. This precludes the use of
 	 * EGL_EXT_swap_buffers_with_damage and EGL_KHR_partial_update, since we
 	 * damage the whole area. */
-	if (gr->debug_clear) {
+	if (gr->debug_clear && !mirror) {
 		pixman_region32_t undamaged;
 		pixman_region32_t *damaged =
 			shadow_exists(go) ? output_damage : &rb->base.damage;
@@ -2436,9 +3386,13 @@ gl_renderer_repaint_output(struct weston_output *output,
 		free(egl_rects);
 	}
 
-	if (shadow_exists(go)) {
+	if (mirror) {
+		blit_shadow_to_output(output, mirror, gr->debug_clear ?
+				      &output->region : &rb->base.damage);
+	} else if (shadow_exists(go)) {
 		/* Repaint into shadow. */
-		if (compositor->test_data.test_quirks.gl_force_full_redraw_of_shadow_fb)
+		if (compositor->test_data.test_quirks.gl_force_full_redraw_of_shadow_fb ||
+		    shadow_full_redraw)
 			repaint_views(output, &output->region);
 		else
 			repaint_views(output, output_damage);
@@ -2446,12 +3400,13 @@ gl_renderer_repaint_output(struct weston_output *output,
 		glBindFramebuffer(GL_FRAMEBUFFER, rb->fbo);
 		glViewport(go->area.x, area_y,
 			   go->area.width, go->area.height);
-		blit_shadow_to_output(output, gr->debug_clear ?
+		blit_shadow_to_output(output, go, gr->debug_clear ?
 				      &output->region : &rb->base.damage);
 	} else {
 		repaint_views(output, &rb->base.damage);
 	}
 
+	draw_perf_hud(output);
 	draw_output_borders(output, rb->border_damage);
 
 	gl_renderer_do_capture_tasks(gr, output,
@@ -2504,6 +3459,7 @@ gl_renderer_repaint_output(struct weston_output *output,
 	 */
 	timeline_submit_render_sync(gr, output, go->render_sync,
 				    go->render_query);
+	gr->gpu_timing_active = false;
 
 	update_buffer_release_fences(compositor, output);
 
@@ -2573,6 +3529,48 @@ gl_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
+static void
+gl_renderer_read_pixels_async(struct weston_output *output,
+			      const struct pixel_format_info *format,
+			      uint32_t x, uint32_t y,
+			      uint32_t width, uint32_t height,
+			      weston_renderer_read_pixels_done_func_t done,
+			      void *data)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct weston_geometry rect = {
+		.x = x + go->area.x,
+		.y = y + go->fb_size.height - go->area.y - go->area.height,
+		.width = width,
+		.height = height,
+	};
+	struct gl_capture_task *gl_task;
+
+	if (format->gl_format == 0 || format->gl_type == 0 ||
+	    use_output(output) < 0) {
+		done(data, NULL, 0);
+		return;
+	}
+
+	gl_task = create_capture_task(NULL, gr, &rect);
+	gl_task->done = done;
+	gl_task->data = data;
+	gl_task->stride = (format->bpp / 8) * width;
+	gl_task->reverse = false;
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, gl_task->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, gl_task->stride * gl_task->height,
+		     NULL, gr->pbo_usage);
+	glReadPixels(rect.x, rect.y, rect.width, rect.height,
+		     format->gl_format, format->gl_type, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	queue_capture_task(gr, output, gl_task);
+}
+
 static GLenum
 gl_format_from_internal(GLenum internal_format)
 {
@@ -2590,10 +3588,213 @@ gl_format_from_internal(GLenum internal_format)
 	}
 }
 
+static void
+upload_staging_release(struct gl_renderer *gr, struct gl_upload_staging *st)
+{
+	if (st->sync != EGL_NO_SYNC_KHR)
+		gr->destroy_sync(gr->egl_display, st->sync);
+	if (st->fd != EGL_NO_NATIVE_FENCE_FD_ANDROID)
+		close(st->fd);
+
+	st->sync = EGL_NO_SYNC_KHR;
+	st->fd = EGL_NO_NATIVE_FENCE_FD_ANDROID;
+}
+
+static bool
+upload_staging_is_idle(struct gl_renderer *gr, struct gl_upload_staging *st)
+{
+	struct pollfd pfd;
+
+	if (st->sync == EGL_NO_SYNC_KHR)
+		return true;
+
+	/* The native fence only exists once the commands following the
+	 * sync creation got flushed, which is at the latest on swap. */
+	if (st->fd == EGL_NO_NATIVE_FENCE_FD_ANDROID)
+		st->fd = gr->dup_native_fence_fd(gr->egl_display, st->sync);
+	if (st->fd == EGL_NO_NATIVE_FENCE_FD_ANDROID)
+		return false;
+
+	pfd.fd = st->fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) <= 0)
+		return false;
+
+	upload_staging_release(gr, st);
+
+	return true;
+}
+
+/* Align staged rectangles for any wl_shm pixel type. */
+#define UPLOAD_STAGING_ALIGN 8
+
+/** Upload shm damage through the next staging buffer of the ring
+ *
+ * The damage is packed into a PBO mapped without synchronization, which
+ * only works because the PBO is not reused before its previous uploads
+ * completed. The texture updates out of the PBO then run asynchronously
+ * to the compositor.
+ *
+ * Returns false, having uploaded nothing, if the feature is unavailable,
+ * the buffer has several planes or the next staging buffer is still busy.
+ */
+static bool
+gl_renderer_upload_damage_async(struct gl_renderer *gr,
+				struct weston_surface *surface,
+				struct weston_buffer *buffer,
+				struct gl_buffer_state *gb,
+				const pixman_box32_t *rectangles, int n)
+{
+	struct gl_upload_staging *st = &gr->upload_ring[gr->upload_next];
+	int cpp = buffer->stride / gb->pitch;
+	uint8_t *data, *dst;
+	size_t size = 0, offset = 0;
+	int i, y;
+
+	if (!gl_features_has(gr, FEATURE_ASYNC_UPLOAD) ||
+	    gb->num_textures != 1 || n == 0)
+		return false;
+
+	if (!upload_staging_is_idle(gr, st))
+		return false;
+
+	for (i = 0; i < n; i++) {
+		pixman_box32_t r = weston_surface_to_buffer_rect(surface,
+								 rectangles[i]);
+		int row = ROUND_UP_N((r.x2 - r.x1) * cpp, 4);
+
+		size = ROUND_UP_N(size, UPLOAD_STAGING_ALIGN);
+		size += (size_t) row * (r.y2 - r.y1);
+	}
+
+	if (st->pbo == 0)
+		glGenBuffers(1, &st->pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, st->pbo);
+	if (st->size < size) {
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL,
+			     GL_STREAM_DRAW);
+		st->size = size;
+	}
+
+	dst = gr->map_buffer_range(GL_PIXEL_UNPACK_BUFFER, 0, size,
+				   GL_MAP_WRITE_BIT |
+				   GL_MAP_INVALIDATE_BUFFER_BIT |
+				   GL_MAP_UNSYNCHRONIZED_BIT);
+	if (!dst) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	for (i = 0; i < n; i++) {
+		pixman_box32_t r = weston_surface_to_buffer_rect(surface,
+								 rectangles[i]);
+		int width = (r.x2 - r.x1) * cpp;
+		int row = ROUND_UP_N(width, 4);
+		const uint8_t *src = data + gb->offset[0] +
+				     r.y1 * buffer->stride + r.x1 * cpp;
+
+		offset = ROUND_UP_N(offset, UPLOAD_STAGING_ALIGN);
+		for (y = r.y1; y < r.y2; y++) {
+			memcpy(dst + offset, src, width);
+			offset += row;
+			src += buffer->stride;
+		}
+	}
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+	/* The contents are undefined if the mapping got lost meanwhile. */
+	if (!gr->unmap_buffer(GL_PIXEL_UNPACK_BUFFER)) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, gb->textures[0]);
+	offset = 0;
+	for (i = 0; i < n; i++) {
+		pixman_box32_t r = weston_surface_to_buffer_rect(surface,
+								 rectangles[i]);
+		int row = ROUND_UP_N((r.x2 - r.x1) * cpp, 4);
+
+		offset = ROUND_UP_N(offset, UPLOAD_STAGING_ALIGN);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, r.x2 - r.x1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0,
+				r.x1, r.y1,
+				r.x2 - r.x1, r.y2 - r.y1,
+				gl_format_from_internal(gb->gl_format[0]),
+				gb->gl_pixel_type,
+				(void *)(uintptr_t) offset);
+		offset += (size_t) row * (r.y2 - r.y1);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	st->sync = create_render_sync(gr);
+	gr->upload_next = (gr->upload_next + 1) % GL_UPLOAD_RING_SIZE;
+
+	return true;
+}
+
+static void
+atlas_upload_box(struct gl_buffer_state *gb, const uint8_t *data,
+		 int src_x, int src_y, int width, int height,
+		 int dst_x, int dst_y)
+{
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, src_x);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, src_y);
+	glTexSubImage2D(GL_TEXTURE_2D, 0,
+			gb->atlas_x + dst_x, gb->atlas_y + dst_y,
+			width, height,
+			gl_format_from_internal(gb->gl_format[0]),
+			gb->gl_pixel_type, data);
+}
+
+/* Uploads a rectangle of a buffer to its atlas slot, repeating whatever
+ * part of the buffer's edges it contains into the gutter. */
+static void
+atlas_upload_rect(struct gl_buffer_state *gb, const uint8_t *data,
+		  pixman_box32_t r)
+{
+	int right = gb->shm_width - 1;
+	int bottom = gb->shm_height - 1;
+	int w, h;
+
+	r.x1 = MAX(r.x1, 0);
+	r.y1 = MAX(r.y1, 0);
+	r.x2 = MIN(r.x2, gb->shm_width);
+	r.y2 = MIN(r.y2, gb->shm_height);
+	w = r.x2 - r.x1;
+	h = r.y2 - r.y1;
+	if (w <= 0 || h <= 0)
+		return;
+
+	atlas_upload_box(gb, data, r.x1, r.y1, w, h, r.x1, r.y1);
+
+	if (r.x1 == 0)
+		atlas_upload_box(gb, data, 0, r.y1, 1, h, -1, r.y1);
+	if (r.x2 == gb->shm_width)
+		atlas_upload_box(gb, data, right, r.y1, 1, h, right + 1, r.y1);
+	if (r.y1 == 0)
+		atlas_upload_box(gb, data, r.x1, 0, w, 1, r.x1, -1);
+	if (r.y2 == gb->shm_height)
+		atlas_upload_box(gb, data, r.x1, bottom, w, 1, r.x1, bottom + 1);
+
+	if (r.x1 == 0 && r.y1 == 0)
+		atlas_upload_box(gb, data, 0, 0, 1, 1, -1, -1);
+	if (r.x2 == gb->shm_width && r.y1 == 0)
+		atlas_upload_box(gb, data, right, 0, 1, 1, right + 1, -1);
+	if (r.x1 == 0 && r.y2 == gb->shm_height)
+		atlas_upload_box(gb, data, 0, bottom, 1, 1, -1, bottom + 1);
+	if (r.x2 == gb->shm_width && r.y2 == gb->shm_height)
+		atlas_upload_box(gb, data, right, bottom, 1, 1,
+				 right + 1, bottom + 1);
+}
+
 static void
 gl_renderer_flush_damage(struct weston_paint_node *pnode)
 {
 	struct weston_surface *surface = pnode->surface;
+	struct gl_renderer *gr = get_renderer(surface->compositor);
 	const struct weston_testsuite_quirks *quirks =
 		&surface->compositor->test_data.test_quirks;
 	struct weston_buffer *buffer = surface->buffer_ref.buffer;
@@ -2621,8 +3822,34 @@ gl_renderer_flush_damage(struct weston_paint_node *pnode)
 	    !gb->needs_full_upload)
 		goto done;
 
+	if (gb->evicted_pixels)
+		shm_texture_restore(gr, gb);
+
 	data = wl_shm_buffer_get_data(buffer->shm_buffer);
 
+	if (gb->atlas_page) {
+		pixman_box32_t full = { 0, 0, buffer->width, buffer->height };
+
+		wl_shm_buffer_begin_access(buffer->shm_buffer);
+		glBindTexture(GL_TEXTURE_2D, gb->textures[0]);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, gb->pitch);
+		if (gb->needs_full_upload || quirks->gl_force_full_upload) {
+			atlas_upload_rect(gb, data + gb->offset[0], full);
+		} else {
+			rectangles = pixman_region32_rectangles(&gb->texture_damage,
+								&n);
+			for (i = 0; i < n; i++) {
+				pixman_box32_t r;
+
+				r = weston_surface_to_buffer_rect(surface,
+								  rectangles[i]);
+				atlas_upload_rect(gb, data + gb->offset[0], r);
+			}
+		}
+		wl_shm_buffer_end_access(buffer->shm_buffer);
+		goto done;
+	}
+
 	if (gb->needs_full_upload || quirks->gl_force_full_upload) {
 		wl_shm_buffer_begin_access(buffer->shm_buffer);
 
@@ -2633,6 +3860,15 @@ gl_renderer_flush_damage(struct weston_paint_node *pnode)
 			glBindTexture(GL_TEXTURE_2D, gb->textures[j]);
 			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT,
 				      gb->pitch / hsub);
+			if (gb->has_storage) {
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+						buffer->width / hsub,
+						buffer->height / vsub,
+						gl_format_from_internal(gb->gl_format[j]),
+						gb->gl_pixel_type,
+						data + gb->offset[j]);
+				continue;
+			}
 			glTexImage2D(GL_TEXTURE_2D, 0,
 				     gb->gl_format[j],
 				     buffer->width / hsub,
@@ -2643,10 +3879,15 @@ gl_renderer_flush_damage(struct weston_paint_node *pnode)
 				     data + gb->offset[j]);
 		}
 		wl_shm_buffer_end_access(buffer->shm_buffer);
+		gb->has_storage = true;
 		goto done;
 	}
 
 	rectangles = pixman_region32_rectangles(&gb->texture_damage, &n);
+	if (gl_renderer_upload_damage_async(gr, surface, buffer, gb,
+					    rectangles, n))
+		goto done;
+
 	wl_shm_buffer_begin_access(buffer->shm_buffer);
 	for (i = 0; i < n; i++) {
 		pixman_box32_t r;
@@ -2688,15 +3929,223 @@ done:
 	weston_buffer_release_reference(&gs->buffer_release_ref, NULL);
 }
 
+static void
+dmabuf_image_destroy(struct gl_renderer *gr, struct gl_dmabuf_image *img)
+{
+	gr->destroy_image(gr->egl_display, img->image);
+	wl_list_remove(&img->link);
+	free(img);
+}
+
+static void
+dmabuf_image_cache_trim(struct gl_renderer *gr)
+{
+	struct gl_dmabuf_image *img, *tmp;
+	unsigned unused = 0;
+
+	/* The list is in most recently used order. */
+	wl_list_for_each_safe(img, tmp, &gr->dmabuf_images, link) {
+		if (img->refcount > 0)
+			continue;
+		if (++unused > GL_DMABUF_IMAGE_CACHE_SIZE)
+			dmabuf_image_destroy(gr, img);
+	}
+}
+
+/* Destroys a buffer state's EGLImage, or returns it to the dmabuf image
+ * cache if it came from there. */
+static void
+release_image(struct gl_renderer *gr, EGLImageKHR image)
+{
+	struct gl_dmabuf_image *img;
+
+	wl_list_for_each(img, &gr->dmabuf_images, link) {
+		if (img->image != image)
+			continue;
+
+		assert(img->refcount > 0);
+		img->refcount--;
+		dmabuf_image_cache_trim(gr);
+		return;
+	}
+
+	gr->destroy_image(gr->egl_display, image);
+}
+
+static void
+atlas_page_destroy(struct gl_renderer *gr, struct gl_atlas_page *page)
+{
+	gr->memory.atlas -= page->size;
+	glDeleteTextures(1, &page->tex);
+	wl_list_remove(&page->link);
+	free(page);
+}
+
+static void
+atlas_slot_release(struct gl_buffer_state *gb)
+{
+	struct gl_atlas_page *page = gb->atlas_page;
+
+	page->used_slots &= ~(1ull << gb->atlas_slot);
+	if (page->used_slots == 0)
+		atlas_page_destroy(gb->gr, page);
+	gb->atlas_page = NULL;
+}
+
+static void
+shm_texture_destroy(struct gl_renderer *gr, struct gl_shm_texture *tex)
+{
+	glDeleteTextures(tex->num_textures, tex->textures);
+	wl_list_remove(&tex->link);
+	gr->shm_texture_count--;
+	gr->memory.shm_pool -= tex->size;
+	free(tex);
+}
+
+/* Bytes of a texel of a wl_shm texture, as drivers usually store it */
+static uint32_t
+gl_texel_size(GLenum format, GLenum type)
+{
+	switch (format) {
+	case GL_R8_EXT:
+	case GL_LUMINANCE:
+		return 1;
+	case GL_RG8_EXT:
+	case GL_LUMINANCE_ALPHA:
+		return 2;
+	case GL_RGBA16_EXT:
+	case GL_RGBA16F:
+		return 8;
+	}
+
+	switch (type) {
+	case GL_UNSIGNED_SHORT_5_6_5:
+	case GL_UNSIGNED_SHORT_4_4_4_4:
+	case GL_UNSIGNED_SHORT_5_5_5_1:
+		return 2;
+	default:
+		return 4;
+	}
+}
+
+static uint64_t
+shm_texture_size(struct gl_buffer_state *gb)
+{
+	uint64_t size = 0;
+	int i;
+
+	for (i = 0; i < gb->num_textures; i++) {
+		int hsub = pixel_format_hsub(gb->shm_format, i);
+		int vsub = pixel_format_vsub(gb->shm_format, i);
+
+		size += (uint64_t) (gb->shm_width / hsub) *
+			(gb->shm_height / vsub) *
+			gl_texel_size(gb->gl_format[i], gb->gl_pixel_type);
+	}
+
+	return size;
+}
+
+/* Accounts for the textures of a new wl_shm buffer state, unless they
+ * belong to an atlas page. */
+static void
+shm_texture_track(struct gl_renderer *gr, struct gl_buffer_state *gb)
+{
+	gb->texture_size = shm_texture_size(gb);
+	gb->last_drawn = gr->compositor->last_repaint_start;
+	gr->memory.shm_textures += gb->texture_size;
+	wl_list_insert(&gr->shm_texture_lru, &gb->lru_link);
+}
+
+static void
+shm_texture_untrack(struct gl_renderer *gr, struct gl_buffer_state *gb)
+{
+	if (gb->evicted_pixels) {
+		gr->memory.evicted -= gb->texture_size;
+		free(gb->evicted_pixels);
+		gb->evicted_pixels = NULL;
+	} else {
+		gr->memory.shm_textures -= gb->texture_size;
+	}
+
+	wl_list_remove(&gb->lru_link);
+	wl_list_init(&gb->lru_link);
+	gb->texture_size = 0;
+}
+
+/* Hands a buffer state's wl_shm textures to the pool, dropping the least
+ * recently used ones past its size. */
+static void
+shm_texture_pool_put(struct gl_renderer *gr, struct gl_buffer_state *gb)
+{
+	struct gl_shm_texture *tex;
+
+	tex = xzalloc(sizeof(*tex));
+	tex->format = gb->shm_format;
+	tex->width = gb->shm_width;
+	tex->height = gb->shm_height;
+	ARRAY_COPY(tex->textures, gb->textures);
+	tex->num_textures = gb->num_textures;
+	tex->size = shm_texture_size(gb);
+	wl_list_insert(&gr->shm_textures, &tex->link);
+	gr->memory.shm_pool += tex->size;
+
+	if (++gr->shm_texture_count > GL_SHM_TEXTURE_POOL_SIZE) {
+		tex = container_of(gr->shm_textures.prev,
+				   struct gl_shm_texture, link);
+		shm_texture_destroy(gr, tex);
+	}
+}
+
+/* Gives a new wl_shm buffer state textures already allocated for its size
+ * and format, if the pool has some. */
+static bool
+shm_texture_pool_take(struct gl_renderer *gr, struct gl_buffer_state *gb)
+{
+	struct gl_shm_texture *tex;
+
+	wl_list_for_each(tex, &gr->shm_textures, link) {
+		if (tex->format != gb->shm_format ||
+		    tex->width != gb->shm_width ||
+		    tex->height != gb->shm_height)
+			continue;
+
+		ARRAY_COPY(gb->textures, tex->textures);
+		gb->num_textures = tex->num_textures;
+		gb->has_storage = true;
+
+		wl_list_remove(&tex->link);
+		gr->shm_texture_count--;
+		gr->memory.shm_pool -= tex->size;
+		free(tex);
+		return true;
+	}
+
+	return false;
+}
+
 static void
 destroy_buffer_state(struct gl_buffer_state *gb)
 {
 	int i;
 
-	glDeleteTextures(gb->num_textures, gb->textures);
+	if (gb->texture_size > 0)
+		shm_texture_untrack(gb->gr, gb);
+
+	if (gb->atlas_page)
+		atlas_slot_release(gb);
+	else if (gb->shm_format && gb->has_storage)
+		shm_texture_pool_put(gb->gr, gb);
+	else
+		glDeleteTextures(gb->num_textures, gb->textures);
 
 	for (i = 0; i < gb->num_images; i++)
-		gb->gr->destroy_image(gb->gr->egl_display, gb->images[i]);
+		release_image(gb->gr, gb->images[i]);
+
+	weston_client_memory_uncharge(gb->client_memory,
+				      WESTON_CLIENT_MEMORY_GL_TEXTURE,
+				      gb->texture_bytes);
+	weston_client_memory_unref(gb->client_memory);
 
 	pixman_region32_fini(&gb->texture_damage);
 	wl_list_remove(&gb->destroy_listener.link);
@@ -2734,6 +4183,307 @@ ensure_textures(struct gl_buffer_state *gb, GLenum target, int num_textures)
 	glBindTexture(target, 0);
 }
 
+/* Sized internal format to allocate immutable storage for a wl_shm texture
+ * plane with, or GL_NONE if there is none for this format and type. */
+static GLenum
+gl_sized_format(struct gl_renderer *gr, GLenum format, GLenum type)
+{
+	switch (format) {
+	case GL_R8_EXT:
+	case GL_RG8_EXT:
+	case GL_RGB10_A2:
+	case GL_RGBA16_EXT:
+	case GL_RGBA16F:
+		return format;
+	case GL_RGBA:
+		if (type == GL_UNSIGNED_BYTE)
+			return GL_RGBA8;
+		if (type == GL_UNSIGNED_SHORT_4_4_4_4)
+			return GL_RGBA4;
+		if (type == GL_UNSIGNED_SHORT_5_5_5_1)
+			return GL_RGB5_A1;
+		if (type == GL_UNSIGNED_INT_2_10_10_10_REV_EXT)
+			return GL_RGB10_A2_EXT;
+		break;
+	case GL_RGB:
+		if (type == GL_UNSIGNED_BYTE)
+			return GL_RGB8;
+		if (type == GL_UNSIGNED_SHORT_5_6_5)
+			return GL_RGB565;
+		break;
+	case GL_BGRA_EXT:
+		if (type == GL_UNSIGNED_BYTE &&
+		    gl_extensions_has(gr, EXTENSION_EXT_TEXTURE_STORAGE))
+			return GL_BGRA8_EXT;
+		break;
+	}
+
+	return GL_NONE;
+}
+
+/* Allocates immutable storage for new wl_shm textures, when every plane has
+ * a sized format. Otherwise the first full upload allocates it. */
+static void
+allocate_shm_storage(struct gl_renderer *gr, struct gl_buffer_state *gb)
+{
+	GLenum sized_format[3];
+	int i;
+
+	if (!gl_features_has(gr, FEATURE_TEXTURE_STORAGE))
+		return;
+
+	for (i = 0; i < gb->num_textures; i++) {
+		sized_format[i] = gl_sized_format(gr, gb->gl_format[i],
+						  gb->gl_pixel_type);
+		if (sized_format[i] == GL_NONE)
+			return;
+	}
+
+	for (i = 0; i < gb->num_textures; i++) {
+		int hsub = pixel_format_hsub(gb->shm_format, i);
+		int vsub = pixel_format_vsub(gb->shm_format, i);
+
+		glBindTexture(GL_TEXTURE_2D, gb->textures[i]);
+		gr->tex_storage_2d(GL_TEXTURE_2D, 1, sized_format[i],
+				   gb->shm_width / hsub,
+				   gb->shm_height / vsub);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	gb->has_storage = true;
+}
+
+static uint64_t
+gl_renderer_memory_used(struct gl_renderer *gr)
+{
+	return gr->memory.shm_textures + gr->memory.shm_pool +
+	       gr->memory.atlas;
+}
+
+/* Moves the texture of a wl_shm buffer state to system memory, as the
+ * wl_shm buffer may have been released to its client already, for
+ * shm_texture_restore() to upload again when it is next needed. Only
+ * single-plane 8-bit RGBA and BGRA textures are read back. */
+static bool
+shm_texture_evict(struct gl_renderer *gr, struct gl_buffer_state *gb)
+{
+	int32_t width = gb->shm_width;
+	int32_t height = gb->shm_height;
+	uint8_t *pixels;
+	GLenum status;
+	GLuint fbo;
+	int32_t i;
+
+	if (gb->no_evict || gb->num_textures != 1 || !gb->has_storage ||
+	    gb->needs_full_upload || gb->gl_pixel_type != GL_UNSIGNED_BYTE ||
+	    (gb->gl_format[0] != GL_RGBA && gb->gl_format[0] != GL_BGRA_EXT))
+		return false;
+
+	pixels = malloc((size_t) width * height * 4);
+	if (!pixels)
+		return false;
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, gb->textures[0], 0);
+	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status == GL_FRAMEBUFFER_COMPLETE)
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+			     pixels);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		free(pixels);
+		gb->no_evict = true;
+		return false;
+	}
+
+	/* Back in the order the texture is specified with */
+	if (gb->gl_format[0] == GL_BGRA_EXT) {
+		for (i = 0; i < width * height; i++) {
+			uint8_t r = pixels[4 * i];
+
+			pixels[4 * i] = pixels[4 * i + 2];
+			pixels[4 * i + 2] = r;
+		}
+	}
+
+	glDeleteTextures(gb->num_textures, gb->textures);
+	gb->num_textures = 0;
+	gb->has_storage = false;
+	gb->evicted_pixels = pixels;
+
+	wl_list_remove(&gb->lru_link);
+	wl_list_init(&gb->lru_link);
+	gr->memory.shm_textures -= gb->texture_size;
+	gr->memory.evicted += gb->texture_size;
+	gr->memory.evictions++;
+
+	return true;
+}
+
+static void
+shm_texture_restore(struct gl_renderer *gr, struct gl_buffer_state *gb)
+{
+	ensure_textures(gb, GL_TEXTURE_2D, 1);
+
+	if (gb->needs_full_upload) {
+		/* New content is coming anyway. */
+		allocate_shm_storage(gr, gb);
+	} else {
+		glBindTexture(GL_TEXTURE_2D, gb->textures[0]);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+		glTexImage2D(GL_TEXTURE_2D, 0, gb->gl_format[0],
+			     gb->shm_width, gb->shm_height, 0,
+			     gl_format_from_internal(gb->gl_format[0]),
+			     gb->gl_pixel_type, gb->evicted_pixels);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		gb->has_storage = true;
+	}
+
+	free(gb->evicted_pixels);
+	gb->evicted_pixels = NULL;
+
+	wl_list_insert(&gr->shm_texture_lru, &gb->lru_link);
+	gr->memory.evicted -= gb->texture_size;
+	gr->memory.shm_textures += gb->texture_size;
+	gr->memory.restores++;
+}
+
+/* Frees textures past the memory budget: first the unused ones kept for
+ * reuse, then those of wl_shm buffers not drawn for a while, such as
+ * occluded or unmapped surfaces, least recently drawn first. */
+static void
+gl_renderer_enforce_memory_budget(struct gl_renderer *gr)
+{
+	const struct timespec *now = &gr->compositor->last_repaint_start;
+	struct gl_buffer_state *gb, *tmp;
+	struct gl_shm_texture *tex;
+
+	if (gr->memory_budget == 0 ||
+	    gl_renderer_memory_used(gr) <= gr->memory_budget)
+		return;
+
+	while (!wl_list_empty(&gr->shm_textures) &&
+	       gl_renderer_memory_used(gr) > gr->memory_budget) {
+		tex = container_of(gr->shm_textures.prev,
+				   struct gl_shm_texture, link);
+		shm_texture_destroy(gr, tex);
+	}
+
+	wl_list_for_each_reverse_safe(gb, tmp, &gr->shm_texture_lru,
+				      lru_link) {
+		if (gl_renderer_memory_used(gr) <= gr->memory_budget ||
+		    timespec_sub_to_msec(now, &gb->last_drawn) <
+		    GL_EVICT_IDLE_MSEC)
+			break;
+
+		shm_texture_evict(gr, gb);
+	}
+}
+
+static void
+gl_renderer_memory_scope_cb(struct weston_log_subscription *sub, void *data)
+{
+	struct gl_renderer *gr = data;
+
+	if (gr->memory_budget)
+		weston_log_subscription_printf(sub, "budget: %" PRIu64 " KiB\n",
+					       gr->memory_budget / 1024);
+	else
+		weston_log_subscription_printf(sub, "budget: none\n");
+
+	weston_log_subscription_printf(sub,
+		"in use: %" PRIu64 " KiB\n"
+		"\twl_shm textures: %" PRIu64 " KiB\n"
+		"\tunused wl_shm textures: %" PRIu64 " KiB (%d)\n"
+		"\tatlas pages: %" PRIu64 " KiB\n"
+		"evicted to system memory: %" PRIu64 " KiB\n"
+		"evictions: %" PRIu64 ", restores: %" PRIu64 "\n",
+		gl_renderer_memory_used(gr) / 1024,
+		gr->memory.shm_textures / 1024,
+		gr->memory.shm_pool / 1024, gr->shm_texture_count,
+		gr->memory.atlas / 1024,
+		gr->memory.evicted / 1024,
+		gr->memory.evictions, gr->memory.restores);
+
+	weston_log_subscription_complete(sub);
+}
+
+static struct gl_atlas_page *
+atlas_page_create(struct gl_renderer *gr, GLenum gl_format,
+		  GLenum gl_pixel_type)
+{
+	struct gl_atlas_page *page;
+	GLenum sized_format = gl_sized_format(gr, gl_format, gl_pixel_type);
+
+	page = xzalloc(sizeof(*page));
+	page->gl_format = gl_format;
+	page->gl_pixel_type = gl_pixel_type;
+	page->size = (uint64_t) GL_ATLAS_PAGE_SIZE * GL_ATLAS_PAGE_SIZE *
+		     gl_texel_size(gl_format, gl_pixel_type);
+	gr->memory.atlas += page->size;
+
+	glGenTextures(1, &page->tex);
+	glBindTexture(GL_TEXTURE_2D, page->tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	if (gl_features_has(gr, FEATURE_TEXTURE_STORAGE) &&
+	    sized_format != GL_NONE)
+		gr->tex_storage_2d(GL_TEXTURE_2D, 1, sized_format,
+				   GL_ATLAS_PAGE_SIZE, GL_ATLAS_PAGE_SIZE);
+	else
+		glTexImage2D(GL_TEXTURE_2D, 0, gl_format,
+			     GL_ATLAS_PAGE_SIZE, GL_ATLAS_PAGE_SIZE, 0,
+			     gl_format_from_internal(gl_format),
+			     gl_pixel_type, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	wl_list_insert(gr->atlas_pages.prev, &page->link);
+
+	return page;
+}
+
+/* Places a small single-plane wl_shm buffer state in a free atlas slot,
+ * creating a page if all of them are full. */
+static bool
+atlas_slot_acquire(struct gl_renderer *gr, struct gl_buffer_state *gb)
+{
+	struct gl_atlas_page *page;
+	const uint64_t all_slots = (uint64_t) -1 >>
+		(64 - GL_ATLAS_SLOTS_PER_ROW * GL_ATLAS_SLOTS_PER_ROW);
+	int slot;
+
+	if (!gr->compositor->gl_shm_atlas ||
+	    gb->shm_width > GL_ATLAS_SLOT_SIZE - 2 ||
+	    gb->shm_height > GL_ATLAS_SLOT_SIZE - 2)
+		return false;
+
+	wl_list_for_each(page, &gr->atlas_pages, link) {
+		if (page->gl_format == gb->gl_format[0] &&
+		    page->gl_pixel_type == gb->gl_pixel_type &&
+		    page->used_slots != all_slots)
+			break;
+	}
+	if (&page->link == &gr->atlas_pages)
+		page = atlas_page_create(gr, gb->gl_format[0],
+					 gb->gl_pixel_type);
+
+	slot = ffsll(~page->used_slots) - 1;
+	page->used_slots |= 1ull << slot;
+
+	gb->atlas_page = page;
+	gb->atlas_slot = slot;
+	gb->atlas_x = (slot % GL_ATLAS_SLOTS_PER_ROW) * GL_ATLAS_SLOT_SIZE + 1;
+	gb->atlas_y = (slot / GL_ATLAS_SLOTS_PER_ROW) * GL_ATLAS_SLOT_SIZE + 1;
+	gb->textures[0] = page->tex;
+	gb->num_textures = 1;
+	gb->has_storage = true;
+
+	return true;
+}
+
 static void
 gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 {
@@ -2876,6 +4626,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 	gb->gr = gr;
 
 	wl_list_init(&gb->destroy_listener.link);
+	wl_list_init(&gb->lru_link);
 	pixman_region32_init(&gb->texture_damage);
 
 	gb->pitch = pitch;
@@ -2885,11 +4636,27 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 	gb->gl_channel_order = buffer->pixel_format->gl_channel_order;
 	gb->gl_pixel_type = gl_pixel_type;
 	gb->needs_full_upload = true;
+	gb->shm_format = buffer->pixel_format;
+	gb->shm_width = buffer->width;
+	gb->shm_height = buffer->height;
+
+	gb->client_memory = weston_client_memory_ref(buffer->client_memory);
+	gb->texture_bytes = (uint64_t) buffer->stride * buffer->height;
+	weston_client_memory_charge(gb->client_memory,
+				    WESTON_CLIENT_MEMORY_GL_TEXTURE,
+				    gb->texture_bytes);
 
 	gs->buffer = gb;
 	gs->surface = es;
 
-	ensure_textures(gb, GL_TEXTURE_2D, num_planes);
+	if (num_planes == 1 && atlas_slot_acquire(gr, gb))
+		return;
+
+	if (!shm_texture_pool_take(gr, gb)) {
+		ensure_textures(gb, GL_TEXTURE_2D, num_planes);
+		allocate_shm_storage(gr, gb);
+	}
+	shm_texture_track(gr, gb);
 }
 
 static bool
@@ -3119,10 +4886,78 @@ import_simple_dmabuf(struct gl_renderer *gr,
 		}
 	}
 
-	attribs[atti++] = EGL_NONE;
+	attribs[atti++] = EGL_NONE;
+
+	return gr->create_image(gr->egl_display, EGL_NO_CONTEXT,
+				EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+}
+
+static bool
+dmabuf_image_key_init(struct gl_dmabuf_image_key *key,
+		      const struct dmabuf_attributes *attributes)
+{
+	struct stat st;
+	int i;
+
+	/* Zeroed as a whole, because keys are compared with memcmp(). */
+	memset(key, 0, sizeof *key);
+
+	key->width = attributes->width;
+	key->height = attributes->height;
+	key->format = attributes->format;
+	key->modifier = attributes->modifier;
+	key->n_planes = attributes->n_planes;
+
+	for (i = 0; i < attributes->n_planes; i++) {
+		if (fstat(attributes->fd[i], &st) < 0)
+			return false;
+
+		key->plane[i].dev = st.st_dev;
+		key->plane[i].ino = st.st_ino;
+		key->plane[i].offset = attributes->offset[i];
+		key->plane[i].stride = attributes->stride[i];
+	}
+
+	return true;
+}
+
+/* Like import_simple_dmabuf(), but reuses the EGLImage of an earlier import
+ * of the same dmabuf if there is one. Video stacks often destroy and
+ * recreate wl_buffers for a pool of dmabufs, and creating an EGLImage is
+ * not cheap. The image must be given back with release_image().
+ */
+static EGLImageKHR
+import_dmabuf_image(struct gl_renderer *gr,
+		    const struct dmabuf_attributes *attributes)
+{
+	struct gl_dmabuf_image_key key;
+	struct gl_dmabuf_image *img;
+	EGLImageKHR image;
+
+	if (!dmabuf_image_key_init(&key, attributes))
+		return import_simple_dmabuf(gr, attributes);
+
+	wl_list_for_each(img, &gr->dmabuf_images, link) {
+		if (memcmp(&img->key, &key, sizeof key) != 0)
+			continue;
+
+		img->refcount++;
+		wl_list_remove(&img->link);
+		wl_list_insert(&gr->dmabuf_images, &img->link);
+		return img->image;
+	}
+
+	image = import_simple_dmabuf(gr, attributes);
+	if (image == EGL_NO_IMAGE_KHR)
+		return image;
 
-	return gr->create_image(gr->egl_display, EGL_NO_CONTEXT,
-				EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+	img = xzalloc(sizeof *img);
+	img->key = key;
+	img->image = image;
+	img->refcount = 1;
+	wl_list_insert(&gr->dmabuf_images, &img->link);
+
+	return image;
 }
 
 static EGLImageKHR
@@ -3147,7 +4982,7 @@ import_dmabuf_single_plane(struct gl_renderer *gr,
 	plane.stride[0] = attributes->stride[descriptor->plane_index];
 	plane.modifier = attributes->modifier;
 
-	image = import_simple_dmabuf(gr, &plane);
+	image = import_dmabuf_image(gr, &plane);
 	if (image == EGL_NO_IMAGE_KHR) {
 		weston_log("Failed to import plane %d as %.4s\n",
 		           descriptor->plane_index,
@@ -3202,8 +5037,7 @@ import_yuv_dmabuf(struct gl_renderer *gr, struct gl_buffer_state *gb,
 		                                           &format->plane[j]);
 		if (gb->images[j] == EGL_NO_IMAGE_KHR) {
 			while (--j >= 0) {
-				gr->destroy_image(gb->gr->egl_display,
-						  gb->images[j]);
+				release_image(gr, gb->images[j]);
 				gb->images[j] = NULL;
 			}
 			return false;
@@ -3319,7 +5153,7 @@ import_dmabuf(struct gl_renderer *gr,
 	pixman_region32_init(&gb->texture_damage);
 	wl_list_init(&gb->destroy_listener.link);
 
-	egl_image = import_simple_dmabuf(gr, &dmabuf->attributes);
+	egl_image = import_dmabuf_image(gr, &dmabuf->attributes);
 	if (egl_image != EGL_NO_IMAGE_KHR) {
 		GLenum target = choose_texture_target(gr, &dmabuf->attributes);
 
@@ -3547,6 +5381,118 @@ gl_renderer_attach_buffer(struct weston_surface *surface,
 	glActiveTexture(GL_TEXTURE0);
 }
 
+static struct gl_buffer_state *
+ensure_dmabuf_copy(struct gl_surface_state *gs, struct gl_renderer *gr,
+		   struct weston_buffer *buffer)
+{
+	struct gl_buffer_state *copy = gs->copy;
+
+	if (copy && gs->copy_width == buffer->width &&
+	    gs->copy_height == buffer->height)
+		return copy;
+
+	if (copy)
+		destroy_buffer_state(copy);
+
+	copy = xzalloc(sizeof *copy);
+	copy->gr = gr;
+	pixman_region32_init(&copy->texture_damage);
+	wl_list_init(&copy->destroy_listener.link);
+	ensure_textures(copy, GL_TEXTURE_2D, 1);
+	glBindTexture(GL_TEXTURE_2D, copy->textures[0]);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, buffer->width, buffer->height,
+		     0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	gs->copy = copy;
+	gs->copy_width = buffer->width;
+	gs->copy_height = buffer->height;
+
+	return copy;
+}
+
+/* Copies a single-plane RGB dmabuf into a texture of our own, so that the
+ * buffer can go back to the client now rather than at its next commit.
+ * The release fence, or the implicit fence the flush attaches to the
+ * dmabuf, covers the copy. */
+static bool
+gl_renderer_copy_dmabuf(struct weston_surface *surface,
+			struct weston_buffer *buffer)
+{
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(surface);
+	struct gl_buffer_state *gb = gs->buffer;
+	struct weston_buffer_release *buffer_release =
+		gs->buffer_release_ref.buffer_release;
+	struct gl_buffer_state *copy;
+	EGLSyncKHR sync;
+	GLint fbo;
+	bool ok;
+	int fence_fd = -1;
+
+	if (!surface->compositor->early_buffer_release ||
+	    buffer->type != WESTON_BUFFER_DMABUF ||
+	    gr->gl_version < gl_version(3, 0) ||
+	    gb->num_textures != 1 ||
+	    (gb->shader_variant != SHADER_VARIANT_RGBA &&
+	     gb->shader_variant != SHADER_VARIANT_RGBX))
+		return false;
+
+	/* Explicitly synchronized clients need a fence to go with the
+	 * early release. */
+	if (buffer_release &&
+	    !egl_display_has(gr, EXTENSION_ANDROID_NATIVE_FENCE_SYNC))
+		return false;
+
+	copy = ensure_dmabuf_copy(gs, gr, buffer);
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
+	if (!gr->copy_fbo[0])
+		glGenFramebuffers(2, gr->copy_fbo);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, gr->copy_fbo[0]);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, gb->textures[0], 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gr->copy_fbo[1]);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, copy->textures[0], 0);
+
+	ok = glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) ==
+	     GL_FRAMEBUFFER_COMPLETE &&
+	     glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) ==
+	     GL_FRAMEBUFFER_COMPLETE;
+	if (ok)
+		glBlitFramebuffer(0, 0, buffer->width, buffer->height,
+				  0, 0, buffer->width, buffer->height,
+				  GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+	if (!ok)
+		return false;
+
+	if (buffer_release) {
+		sync = create_render_sync(gr);
+		glFlush();
+		if (sync != EGL_NO_SYNC_KHR) {
+			fence_fd = gr->dup_native_fence_fd(gr->egl_display,
+							   sync);
+			gr->destroy_sync(gr->egl_display, sync);
+		}
+		if (fence_fd == EGL_NO_NATIVE_FENCE_FD_ANDROID)
+			return false;
+		fd_update(&buffer_release->fence_fd, fence_fd);
+	} else {
+		/* Submit the read before the client hears it may write. */
+		glFlush();
+	}
+
+	copy->shader_variant = gb->shader_variant;
+	gs->buffer = copy;
+
+	return true;
+}
+
 static const struct weston_drm_format_array *
 gl_renderer_get_supported_formats(struct weston_compositor *ec)
 {
@@ -3638,7 +5584,9 @@ gl_renderer_attach(struct weston_paint_node *pnode)
 	struct weston_buffer *buffer = es->buffer_ref.buffer;
 	struct gl_surface_state *gs = get_surface_state(es);
 
-	if (gs->buffer_ref.buffer == buffer)
+	/* A dmabuf released early may come back with new content. */
+	if (gs->buffer_ref.buffer == buffer &&
+	    (!gs->copy || gs->buffer != gs->copy))
 		return;
 
 	/* SHM buffers are a little special in that they are allocated
@@ -3683,6 +5631,21 @@ gl_renderer_attach(struct weston_paint_node *pnode)
 		goto out;
 	}
 
+	weston_buffer_release_reference(&gs->buffer_release_ref,
+					es->buffer_release_ref.buffer_release);
+	if (gl_renderer_copy_dmabuf(es, buffer)) {
+		/* Like SHM after upload: only our copy is sampled. */
+		weston_buffer_reference(&gs->buffer_ref, buffer,
+					BUFFER_WILL_NOT_BE_ACCESSED);
+		weston_buffer_release_reference(&gs->buffer_release_ref, NULL);
+		return;
+	}
+
+	if (gs->copy) {
+		destroy_buffer_state(gs->copy);
+		gs->copy = NULL;
+	}
+
 success:
 	weston_buffer_reference(&gs->buffer_ref, buffer,
 				BUFFER_MAY_BE_ACCESSED);
@@ -3697,6 +5660,35 @@ out:
 	weston_buffer_release_reference(&gs->buffer_release_ref, NULL);
 }
 
+static void
+gl_renderer_prewarm(struct weston_paint_node *pnode)
+{
+	struct gl_renderer *gr = get_renderer(pnode->surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(pnode->surface);
+	struct weston_buffer *buffer = pnode->surface->buffer_ref.buffer;
+	struct gl_shader_config sconf;
+
+	/* Direct-display buffers are never imported, they only ever get the
+	 * placeholder when they end up being composited. */
+	if (!buffer || buffer->direct_display)
+		return;
+
+	if (use_output(pnode->output) < 0)
+		return;
+
+	/* The import is skipped on the next repaint since the surface state
+	 * will already be holding this buffer. */
+	gl_renderer_attach(pnode);
+	if (!gs->buffer || gs->buffer_ref.buffer != buffer)
+		return;
+
+	if (!gl_shader_config_init_for_paint_node(&sconf, pnode, GL_LINEAR))
+		return;
+
+	if (!gl_renderer_ensure_program(gr, &sconf.req))
+		weston_log("GL-renderer: failed to prewarm shader program.\n");
+}
+
 static void
 gl_renderer_buffer_init(struct weston_compositor *etc,
 			struct weston_buffer *buffer)
@@ -3764,6 +5756,7 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 		.view_alpha = 1.0f,
 		.input_tex_filter = GL_NEAREST,
 	};
+	GLfloat texcoords[4 * 2];
 	const pixman_format_code_t format = PIXMAN_a8b8g8r8;
 	const GLenum gl_format = GL_RGBA; /* PIXMAN_a8b8g8r8 little-endian */
 	struct gl_renderer *gr = get_renderer(surface->compositor);
@@ -3796,8 +5789,23 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 		break;
 	}
 
+	if (gb->evicted_pixels)
+		shm_texture_restore(gr, gb);
+
 	gl_shader_config_set_input_textures(&sconf, gs);
 
+	ARRAY_COPY(texcoords, verts);
+	if (gb->atlas_page) {
+		int i;
+
+		for (i = 0; i < 4; i++) {
+			texcoords[2 * i] = (gb->atlas_x + verts[2 * i] * cw) /
+					   GL_ATLAS_PAGE_SIZE;
+			texcoords[2 * i + 1] = (gb->atlas_y + verts[2 * i + 1] * ch) /
+					       GL_ATLAS_PAGE_SIZE;
+		}
+	}
+
 	glGenTextures(1, &tex);
 	glBindTexture(GL_TEXTURE_2D, tex);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, cw, ch,
@@ -3832,7 +5840,7 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	glVertexAttribPointer(SHADER_ATTRIB_LOC_POSITION, 2, GL_FLOAT, GL_FALSE,
 			      0, verts);
 	glVertexAttribPointer(SHADER_ATTRIB_LOC_TEXCOORD, 2, GL_FLOAT, GL_FALSE,
-			      0, verts);
+			      0, texcoords);
 	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 	glDisableVertexAttribArray(SHADER_ATTRIB_LOC_TEXCOORD);
 	glDisableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
@@ -3848,6 +5856,160 @@ out:
 	return ret;
 }
 
+struct gl_thumbnail {
+	struct gl_renderer *gr;
+	const struct weston_geometry *box;
+};
+
+static void
+gl_thumbnail_draw_surface(struct weston_surface *surface, float x, float y,
+			  void *data)
+{
+	struct gl_thumbnail *thumb = data;
+	struct gl_renderer *gr = thumb->gr;
+	const struct weston_geometry *box = thumb->box;
+	struct gl_surface_state *gs;
+	struct gl_buffer_state *gb;
+	struct weston_buffer *buffer;
+	struct gl_shader_config sconf;
+	GLfloat positions[4 * 2] = {
+		0.0f, 0.0f,
+		surface->width, 0.0f,
+		surface->width, surface->height,
+		0.0f, surface->height,
+	};
+
+	if (!weston_surface_is_mapped(surface) || !surface->renderer_state)
+		return;
+
+	gs = get_surface_state(surface);
+	gb = gs->buffer;
+	buffer = gs->buffer_ref.buffer;
+	if (!gb || !buffer || buffer->direct_display)
+		return;
+
+	if (gb->evicted_pixels)
+		shm_texture_restore(gr, gb);
+
+	sconf = (struct gl_shader_config) {
+		.req.texcoord_input = SHADER_TEXCOORD_INPUT_SURFACE,
+		.surface_to_buffer = surface->surface_to_buffer_matrix,
+		.view_alpha = 1.0f,
+		.input_tex_filter = GL_LINEAR,
+	};
+
+	/* Surface coordinates to clip space, the viewport scales down.
+	 * The top row goes first in memory, as glReadPixels() returns it. */
+	weston_matrix_init(&sconf.projection);
+	weston_matrix_translate(&sconf.projection, x - box->x, y - box->y, 0);
+	weston_matrix_scale(&sconf.projection,
+			    2.0f / box->width, 2.0f / box->height, 1);
+	weston_matrix_translate(&sconf.projection, -1.0f, -1.0f, 0);
+
+	if (gb->atlas_page) {
+		weston_matrix_translate(&sconf.surface_to_buffer,
+					gb->atlas_x, gb->atlas_y, 0);
+		weston_matrix_scale(&sconf.surface_to_buffer,
+				    1.0f / GL_ATLAS_PAGE_SIZE,
+				    1.0f / GL_ATLAS_PAGE_SIZE, 1);
+	} else if (buffer->buffer_origin == ORIGIN_TOP_LEFT) {
+		weston_matrix_scale(&sconf.surface_to_buffer,
+				    1.0f / buffer->width,
+				    1.0f / buffer->height, 1);
+	} else {
+		weston_matrix_scale(&sconf.surface_to_buffer,
+				    1.0f / buffer->width,
+				    -1.0f / buffer->height, 1);
+		weston_matrix_translate(&sconf.surface_to_buffer, 0, 1, 0);
+	}
+
+	gl_shader_config_set_input_textures(&sconf, gs);
+
+	if (!gl_renderer_use_program(gr, &sconf))
+		return;
+
+	glVertexAttribPointer(SHADER_ATTRIB_LOC_POSITION, 2, GL_FLOAT, GL_FALSE,
+			      0, positions);
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
+
+static void
+gl_renderer_surface_thumbnail_async(struct weston_surface *surface,
+				    const struct weston_geometry *box,
+				    int width, int height,
+				    weston_renderer_read_pixels_done_func_t done,
+				    void *data)
+{
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+	struct gl_thumbnail thumb = { .gr = gr, .box = box };
+	struct weston_geometry rect = { 0, 0, width, height };
+	struct gl_capture_task *gl_task;
+	int stride = width * 4; /* PIXMAN_a8b8g8r8 */
+	void *pixels;
+	GLuint fbo;
+	GLuint tex;
+	GLenum status;
+
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height,
+		     0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, tex, 0);
+
+	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		weston_log("%s: fbo error: %#x\n", __func__, status);
+		done(data, NULL, 0);
+		goto out;
+	}
+
+	glViewport(0, 0, width, height);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glEnableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
+
+	weston_surface_tree_for_each(surface, 0.0f, 0.0f,
+				     gl_thumbnail_draw_surface, &thumb);
+
+	glDisableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
+	glDisable(GL_BLEND);
+
+	if (!gl_features_has(gr, FEATURE_ASYNC_READBACK)) {
+		pixels = malloc(stride * height);
+		if (pixels)
+			glReadPixels(0, 0, width, height, GL_RGBA,
+				     GL_UNSIGNED_BYTE, pixels);
+		done(data, pixels, pixels ? stride : 0);
+		free(pixels);
+		goto out;
+	}
+
+	gl_task = create_capture_task(NULL, gr, &rect);
+	gl_task->done = done;
+	gl_task->data = data;
+	gl_task->stride = stride;
+	gl_task->reverse = false;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, gl_task->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, gl_task->stride * gl_task->height,
+		     NULL, gr->pbo_usage);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	queue_capture_task(gr, surface->output, gl_task);
+
+out:
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &tex);
+}
+
 static void
 surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 {
@@ -3860,6 +6022,9 @@ surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 		destroy_buffer_state(gs->buffer);
 	gs->buffer = NULL;
 
+	if (gs->copy)
+		destroy_buffer_state(gs->copy);
+
 	weston_buffer_reference(&gs->buffer_ref, NULL,
 				BUFFER_WILL_NOT_BE_ACCESSED);
 	weston_buffer_release_reference(&gs->buffer_release_ref, NULL);
@@ -3934,7 +6099,7 @@ gl_renderer_log_extensions(struct gl_renderer *gr,
 	int l;
 	int len;
 
-	if (!weston_log_scope_is_enabled(gr->renderer_scope))
+	if (!weston_log_scope_enabled(gr->renderer_scope))
 		return;
 
 	l = weston_log_scope_printf(gr->renderer_scope, "%s:", name);
@@ -4023,7 +6188,12 @@ gl_renderer_output_set_border(struct weston_output *output,
 static void
 gl_renderer_remove_renderbuffer(struct gl_renderbuffer *renderbuffer)
 {
+	/* Already dropped, e.g. by a resize, while a user held it. */
+	if (wl_list_empty(&renderbuffer->link))
+		return;
+
 	wl_list_remove(&renderbuffer->link);
+	wl_list_init(&renderbuffer->link);
 	weston_renderbuffer_unref(&renderbuffer->base);
 }
 
@@ -4064,6 +6234,16 @@ gl_renderer_resize_output(struct weston_output *output,
 					  fb_size->width, fb_size->height,
 					  output->compositor->read_format);
 
+	/* Scaled capture blits into an imported dmabuf. */
+	if (gr->gl_version >= gl_version(3, 0) && gr->base.import_dmabuf) {
+		weston_output_set_capture_scaling(output,
+						  WESTON_OUTPUT_CAPTURE_SOURCE_FRAMEBUFFER,
+						  true);
+		weston_output_set_capture_scaling(output,
+						  WESTON_OUTPUT_CAPTURE_SOURCE_FULL_FRAMEBUFFER,
+						  true);
+	}
+
 	if (!shfmt)
 		return true;
 
@@ -4109,6 +6289,21 @@ gl_renderer_create_window_surface(struct gl_renderer *gr,
 	return egl_surface;
 }
 
+/* The format to blend in when the output needs a shadow for the color
+ * transformation from blending space. */
+static const struct pixel_format_info *
+gl_renderer_get_shadow_format(struct weston_output *output)
+{
+	switch (output->compositor->gl_shadow_format) {
+	case WESTON_GL_SHADOW_FORMAT_RGB10A2:
+		return pixel_format_get_info(DRM_FORMAT_ABGR2101010);
+	case WESTON_GL_SHADOW_FORMAT_FP16:
+		break;
+	}
+
+	return pixel_format_get_info(DRM_FORMAT_ABGR16161616F);
+}
+
 static int
 gl_renderer_output_create(struct weston_output *output,
 			  EGLSurface surface,
@@ -4118,6 +6313,7 @@ gl_renderer_output_create(struct weston_output *output,
 	struct gl_output_state *go;
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	const struct weston_testsuite_quirks *quirks;
+	bool ok;
 
 	quirks = &output->compositor->test_data.test_quirks;
 
@@ -4132,33 +6328,46 @@ gl_renderer_output_create(struct weston_output *output,
 		gr->gen_queries(1, &go->render_query);
 
 	wl_list_init(&go->timeline_render_point_list);
+	wl_array_init(&go->node_timings);
+	wl_array_init(&go->node_queries);
 
 	go->render_sync = EGL_NO_SYNC_KHR;
 
-	if ((output->color_outcome->from_blend_to_output != NULL &&
+	/* An identity transformation from blending space can be skipped,
+	 * so views are drawn straight into the framebuffer. */
+	if ((!weston_color_transform_is_identity(output->color_outcome->from_blend_to_output) &&
 	     output->from_blend_to_output_by_backend == false) ||
 	    quirks->gl_force_full_redraw_of_shadow_fb) {
 		assert(gl_features_has(gr, FEATURE_COLOR_TRANSFORMS));
 
-		go->shadow_format =
-			pixel_format_get_info(DRM_FORMAT_ABGR16161616F);
+		go->shadow_format = gl_renderer_get_shadow_format(output);
 	}
 
 	wl_list_init(&go->renderbuffer_list);
 
 	output->renderer_state = go;
 
-	if (!gl_renderer_resize_output(output, fb_size, area)) {
-		weston_log("Output %s failed to create 16F shadow.\n",
-			   output->name);
+	ok = gl_renderer_resize_output(output, fb_size, area);
+	if (!ok && go->shadow_format->format != DRM_FORMAT_ABGR16161616F) {
+		weston_log("Output %s failed to create %s shadow, "
+			   "falling back to ABGR16161616F.\n",
+			   output->name, go->shadow_format->drm_format_name);
+		go->shadow_format =
+			pixel_format_get_info(DRM_FORMAT_ABGR16161616F);
+		ok = gl_renderer_resize_output(output, fb_size, area);
+	}
+
+	if (!ok) {
+		weston_log("Output %s failed to create %s shadow.\n",
+			   output->name, go->shadow_format->drm_format_name);
 		output->renderer_state = NULL;
 		free(go);
 		return -1;
 	}
 
 	if (shadow_exists(go)) {
-		weston_log("Output %s uses 16F shadow.\n",
-			   output->name);
+		weston_log("Output %s uses %s shadow.\n",
+			   output->name, go->shadow_format->drm_format_name);
 	}
 
 	return 0;
@@ -4293,6 +6502,91 @@ gl_renderer_remove_renderbuffer_dmabuf(struct weston_output *output,
 	gl_renderer_remove_renderbuffer(gl_renderbuffer);
 }
 
+static bool
+gl_renderer_copy_output_to_renderbuffer(struct weston_output *output,
+					struct weston_renderbuffer *renderbuffer,
+					pixman_region32_t *damage)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderbuffer *rb = to_gl_renderbuffer(renderbuffer);
+	pixman_box32_t *rects;
+	GLint read_fbo;
+	int32_t src_y1, src_y2;
+	int i, n_rects;
+
+	if (gr->gl_version < gl_version(3, 0))
+		return false;
+
+	/* Called from the frame signal: the framebuffer just repainted is
+	 * still bound and holds the new frame. */
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &read_fbo);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, rb->fbo);
+
+	rects = pixman_region32_rectangles(damage, &n_rects);
+	for (i = 0; i < n_rects; i++) {
+		/* The renderbuffer has the top row first, an EGL window
+		 * surface the bottom one; reverse the source rows then. */
+		if (is_y_flipped(go)) {
+			src_y1 = go->fb_size.height - go->area.y - rects[i].y1;
+			src_y2 = go->fb_size.height - go->area.y - rects[i].y2;
+		} else {
+			src_y1 = go->area.y + rects[i].y1;
+			src_y2 = go->area.y + rects[i].y2;
+		}
+
+		glBlitFramebuffer(go->area.x + rects[i].x1, src_y1,
+				  go->area.x + rects[i].x2, src_y2,
+				  rects[i].x1, rects[i].y1,
+				  rects[i].x2, rects[i].y2,
+				  GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, read_fbo);
+
+	return true;
+}
+
+static bool
+gl_renderer_scale_output_to_renderbuffer(struct weston_output *output,
+					 struct weston_renderbuffer *renderbuffer,
+					 const struct weston_size *size)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderbuffer *rb = to_gl_renderbuffer(renderbuffer);
+	GLint read_fbo;
+	int32_t src_y1, src_y2;
+
+	if (gr->gl_version < gl_version(3, 0))
+		return false;
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &read_fbo);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, rb->fbo);
+
+	if (is_y_flipped(go)) {
+		src_y1 = go->fb_size.height - go->area.y;
+		src_y2 = go->fb_size.height - go->area.y - go->area.height;
+	} else {
+		src_y1 = go->area.y;
+		src_y2 = go->area.y + go->area.height;
+	}
+
+	/* The scaled pixels of a damaged rectangle depend on its neighbours
+	 * through the filter, and blitting rectangles one by one leaves seams
+	 * between them; the whole area is scaled in one go. */
+	glBlitFramebuffer(go->area.x, src_y1,
+			  go->area.x + go->area.width, src_y2,
+			  0, 0, size->width, size->height,
+			  GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, read_fbo);
+
+	return true;
+}
+
 #ifdef HAVE_GBM
 static void
 gl_renderer_dmabuf_destroy(struct linux_dmabuf_memory *dmabuf)
@@ -4396,6 +6690,12 @@ gl_renderer_output_destroy(struct weston_output *output)
 	if (gl_features_has(gr, FEATURE_GPU_TIMELINE))
 		gr->delete_queries(1, &go->render_query);
 
+	if (go->node_queries.size > 0)
+		gr->delete_queries(go->node_queries.size / sizeof(GLuint),
+				   go->node_queries.data);
+	wl_array_release(&go->node_queries);
+	wl_array_release(&go->node_timings);
+
 	wl_list_for_each_safe(trp, tmp, &go->timeline_render_point_list, link)
 		timeline_render_point_destroy(trp);
 
@@ -4473,23 +6773,46 @@ gl_renderer_destroy(struct weston_compositor *ec)
 {
 	struct gl_renderer *gr = get_renderer(ec);
 	struct dmabuf_format *format, *next_format;
+	struct gl_dmabuf_image *img, *next_img;
+	struct gl_shm_texture *tex, *next_tex;
+	struct gl_atlas_page *page, *next_page;
 	struct gl_capture_task *gl_task, *tmp;
+	int i;
 
 	wl_signal_emit(&gr->destroy_signal, gr);
 
 	if (gr->display_bound)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
-	wl_list_for_each_safe(gl_task, tmp, &gr->pending_capture_list, link)
+	wl_list_for_each_safe(gl_task, tmp, &gr->pending_capture_list, link) {
+		if (gl_task->done)
+			gl_task->done(gl_task->data, NULL, 0);
 		destroy_capture_task(gl_task);
+	}
+
+	for (i = 0; i < GL_UPLOAD_RING_SIZE; i++) {
+		upload_staging_release(gr, &gr->upload_ring[i]);
+		if (gr->upload_ring[i].pbo)
+			glDeleteBuffers(1, &gr->upload_ring[i].pbo);
+	}
+
+	if (gr->copy_fbo[0])
+		glDeleteFramebuffers(2, gr->copy_fbo);
 
 	gl_renderer_shader_list_destroy(gr);
 	if (gr->fallback_shader)
 		gl_shader_destroy(gr, gr->fallback_shader);
+	free(gr->program_cache.dir);
 
 	if (gr->wireframe_size)
 		glDeleteTextures(1, &gr->wireframe_tex);
 
+	wl_list_for_each_safe(tex, next_tex, &gr->shm_textures, link)
+		shm_texture_destroy(gr, tex);
+
+	wl_list_for_each_safe(page, next_page, &gr->atlas_pages, link)
+		atlas_page_destroy(gr, page);
+
 	/* Work around crash in egl_dri2.c's dri2_make_current() - when does this apply? */
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
@@ -4498,6 +6821,9 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	wl_list_for_each_safe(format, next_format, &gr->dmabuf_formats, link)
 		dmabuf_format_destroy(format);
 
+	wl_list_for_each_safe(img, next_img, &gr->dmabuf_images, link)
+		dmabuf_image_destroy(gr, img);
+
 	weston_drm_format_array_fini(&gr->supported_formats);
 
 	gl_renderer_allocator_destroy(gr->allocator);
@@ -4506,12 +6832,20 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	eglReleaseThread();
 
 	wl_array_release(&gr->position_stream);
+	wl_array_release(&gr->texcoord_stream);
 	wl_array_release(&gr->barycentric_stream);
 	wl_array_release(&gr->indices);
+	wl_array_release(&gr->quad_scratch);
+	wl_array_release(&gr->band_scratch);
+	for (i = 0; i < (int)ARRAY_LENGTH(gr->scratch_region); i++)
+		pixman_region32_fini(&gr->scratch_region[i]);
 
 	if (gr->debug_mode_binding)
 		weston_binding_destroy(gr->debug_mode_binding);
 
+	hash_table_destroy(gr->shader_table);
+	weston_log_scope_destroy(gr->memory_scope);
+	weston_log_scope_destroy(gr->gpu_timing_scope);
 	weston_log_scope_destroy(gr->shader_scope);
 	weston_log_scope_destroy(gr->renderer_scope);
 	free(gr);
@@ -4556,6 +6890,7 @@ gl_renderer_display_create(struct weston_compositor *ec,
 {
 	struct gl_renderer *gr;
 	int ret;
+	int i;
 
 	gr = zalloc(sizeof *gr);
 	if (gr == NULL)
@@ -4563,7 +6898,13 @@ gl_renderer_display_create(struct weston_compositor *ec,
 
 	gr->compositor = ec;
 	wl_list_init(&gr->shader_list);
+	for (i = 0; i < (int)ARRAY_LENGTH(gr->scratch_region); i++)
+		pixman_region32_init(&gr->scratch_region[i]);
 	gr->platform = options->egl_platform;
+	for (i = 0; i < GL_UPLOAD_RING_SIZE; i++) {
+		gr->upload_ring[i].sync = EGL_NO_SYNC_KHR;
+		gr->upload_ring[i].fd = EGL_NO_NATIVE_FENCE_FD_ANDROID;
+	}
 
 	gr->renderer_scope = weston_compositor_add_log_scope(ec, "gl-renderer",
 		"GL-renderer verbose messages\n", NULL, NULL, gr);
@@ -4574,6 +6915,27 @@ gl_renderer_display_create(struct weston_compositor *ec,
 	if (!gr->shader_scope)
 		goto fail;
 
+	gr->gpu_timing_scope =
+		weston_compositor_add_log_scope(ec, "gl-gpu-timing",
+			"GPU time of every paint node drawn by the GL-renderer, "
+			"with its client, surface and shader, one frame late.\n"
+			"Needs GL_EXT_disjoint_timer_query. Replaces the GPU "
+			"times of whole repaints in the timeline while "
+			"subscribed.\n", NULL, NULL, gr);
+	if (!gr->gpu_timing_scope)
+		goto fail;
+
+	gr->memory_scope =
+		weston_compositor_add_log_scope(ec, "gl-memory",
+			"Texture memory of the GL-renderer, against its "
+			"budget.\n", gl_renderer_memory_scope_cb, NULL, gr);
+	if (!gr->memory_scope)
+		goto fail;
+
+	gr->shader_table = hash_table_create();
+	if (!gr->shader_table)
+		goto fail;
+
 	if (gl_renderer_setup_egl_client_extensions(gr) < 0)
 		goto fail;
 
@@ -4582,8 +6944,10 @@ gl_renderer_display_create(struct weston_compositor *ec,
 	gr->base.resize_output = gl_renderer_resize_output;
 	gr->base.flush_damage = gl_renderer_flush_damage;
 	gr->base.attach = gl_renderer_attach;
+	gr->base.prewarm = gl_renderer_prewarm;
 	gr->base.destroy = gl_renderer_destroy;
 	gr->base.surface_copy_content = gl_renderer_surface_copy_content;
+	gr->base.surface_thumbnail_async = gl_renderer_surface_thumbnail_async;
 	gr->base.fill_buffer_info = gl_renderer_fill_buffer_info;
 	gr->base.buffer_init = gl_renderer_buffer_init;
 	gr->base.type = WESTON_RENDERER_GL;
@@ -4649,6 +7013,10 @@ gl_renderer_display_create(struct weston_compositor *ec,
 		gr->base.get_supported_formats = gl_renderer_get_supported_formats;
 		gr->base.create_renderbuffer_dmabuf = gl_renderer_create_renderbuffer_dmabuf;
 		gr->base.remove_renderbuffer_dmabuf = gl_renderer_remove_renderbuffer_dmabuf;
+		gr->base.copy_output_to_renderbuffer =
+			gl_renderer_copy_output_to_renderbuffer;
+		gr->base.scale_output_to_renderbuffer =
+			gl_renderer_scale_output_to_renderbuffer;
 		ret = populate_supported_formats(ec, &gr->supported_formats);
 		if (ret < 0)
 			goto fail_terminate;
@@ -4665,6 +7033,15 @@ gl_renderer_display_create(struct weston_compositor *ec,
 		}
 	}
 	wl_list_init(&gr->dmabuf_formats);
+	wl_list_init(&gr->dmabuf_images);
+	wl_list_init(&gr->shm_textures);
+	wl_list_init(&gr->shm_texture_lru);
+	wl_list_init(&gr->atlas_pages);
+
+	gr->memory_budget = (uint64_t) ec->gl_memory_budget_mb << 20;
+	if (gr->memory_budget)
+		weston_log("GL renderer texture memory budget: %d MiB.\n",
+			   ec->gl_memory_budget_mb);
 
 	wl_signal_init(&gr->destroy_signal);
 
@@ -4717,6 +7094,9 @@ fail_terminate:
 	weston_drm_format_array_fini(&gr->supported_formats);
 	eglTerminate(gr->egl_display);
 fail:
+	hash_table_destroy(gr->shader_table);
+	weston_log_scope_destroy(gr->memory_scope);
+	weston_log_scope_destroy(gr->gpu_timing_scope);
 	weston_log_scope_destroy(gr->shader_scope);
 	weston_log_scope_destroy(gr->renderer_scope);
 	free(gr);
@@ -4880,10 +7260,8 @@ gl_renderer_setup(struct weston_compositor *ec)
 		GET_PROC_ADDRESS(gr->delete_queries, "glDeleteQueriesEXT");
 		GET_PROC_ADDRESS(gr->begin_query, "glBeginQueryEXT");
 		GET_PROC_ADDRESS(gr->end_query, "glEndQueryEXT");
-#if !defined(NDEBUG)
 		GET_PROC_ADDRESS(gr->get_query_object_iv,
 				 "glGetQueryObjectivEXT");
-#endif
 		GET_PROC_ADDRESS(gr->get_query_object_ui64v,
 				 "glGetQueryObjectui64vEXT");
 		GET_PROC_ADDRESS(get_query_iv, "glGetQueryivEXT");
@@ -4916,6 +7294,14 @@ gl_renderer_setup(struct weston_compositor *ec)
 		gr->pbo_usage = GL_STREAM_DRAW;
 		gr->features |= FEATURE_ASYNC_READBACK;
 	}
+	if (gl_features_has(gr, FEATURE_ASYNC_READBACK))
+		gr->base.read_pixels_async = gl_renderer_read_pixels_async;
+
+	/* Async upload feature. */
+	if (gr->gl_version >= gl_version(3, 0) &&
+	    egl_display_has(gr, EXTENSION_KHR_GET_ALL_PROC_ADDRESSES) &&
+	    egl_display_has(gr, EXTENSION_ANDROID_NATIVE_FENCE_SYNC))
+		gr->features |= FEATURE_ASYNC_UPLOAD;
 
 	/* Color transforms feature. */
 	if ((gr->gl_version >= gl_version(3, 2) &&
@@ -4929,11 +7315,47 @@ gl_renderer_setup(struct weston_compositor *ec)
 		gr->features |= FEATURE_COLOR_TRANSFORMS;
 	}
 
+	/* Texture storage feature. */
+	if (gr->gl_version >= gl_version(3, 0) &&
+	    egl_display_has(gr, EXTENSION_KHR_GET_ALL_PROC_ADDRESSES)) {
+		GET_PROC_ADDRESS(gr->tex_storage_2d, "glTexStorage2D");
+		gr->features |= FEATURE_TEXTURE_STORAGE;
+	} else if (gl_extensions_has(gr, EXTENSION_EXT_TEXTURE_STORAGE)) {
+		GET_PROC_ADDRESS(gr->tex_storage_2d, "glTexStorage2DEXT");
+		gr->features |= FEATURE_TEXTURE_STORAGE;
+	}
+
 	/* GPU timeline feature. */
 	if (egl_display_has(gr, EXTENSION_ANDROID_NATIVE_FENCE_SYNC) &&
 	    gl_extensions_has(gr, EXTENSION_EXT_DISJOINT_TIMER_QUERY))
 		gr->features |= FEATURE_GPU_TIMELINE;
 
+	/* Program binary feature. */
+	if (gr->gl_version >= gl_version(3, 0) &&
+	    egl_display_has(gr, EXTENSION_KHR_GET_ALL_PROC_ADDRESSES)) {
+		GET_PROC_ADDRESS(gr->get_program_binary, "glGetProgramBinary");
+		GET_PROC_ADDRESS(gr->program_binary, "glProgramBinary");
+	} else if (gl_extensions_has(gr, EXTENSION_OES_GET_PROGRAM_BINARY)) {
+		GET_PROC_ADDRESS(gr->get_program_binary,
+				 "glGetProgramBinaryOES");
+		GET_PROC_ADDRESS(gr->program_binary, "glProgramBinaryOES");
+	}
+	if (gr->program_binary) {
+		GLint num_formats = 0;
+
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &num_formats);
+		if (num_formats > 0)
+			gr->features |= FEATURE_PROGRAM_BINARY;
+	}
+
+	if (ec->gl_program_cache_dir) {
+		if (gl_features_has(gr, FEATURE_PROGRAM_BINARY))
+			gl_program_cache_init(gr, ec->gl_program_cache_dir);
+		else
+			weston_log("GL program cache disabled: program "
+				   "binaries not supported.\n");
+	}
+
 	wl_list_init(&gr->pending_capture_list);
 
 	glActiveTexture(GL_TEXTURE0);
@@ -4944,6 +7366,8 @@ gl_renderer_setup(struct weston_compositor *ec)
 		return -1;
 	}
 
+	gl_renderer_load_program_cache(gr);
+
 	gr->debug_mode_binding =
 		weston_compositor_add_debug_binding(ec, KEY_M,
 						    debug_mode_binding, ec);
@@ -4957,6 +7381,10 @@ gl_renderer_setup(struct weston_compositor *ec)
 			    yesno(gl_extensions_has(gr, EXTENSION_ANGLE_PACK_REVERSE_ROW_ORDER)));
 	weston_log_continue(STAMP_SPACE "glReadPixels supports PBO: %s\n",
 			    yesno(gl_features_has(gr, FEATURE_ASYNC_READBACK)));
+	weston_log_continue(STAMP_SPACE "wl_shm uploads through PBO: %s\n",
+			    yesno(gl_features_has(gr, FEATURE_ASYNC_UPLOAD)));
+	weston_log_continue(STAMP_SPACE "wl_shm immutable textures: %s\n",
+			    yesno(gl_features_has(gr, FEATURE_TEXTURE_STORAGE)));
 	weston_log_continue(STAMP_SPACE "wl_shm 10 bpc formats: %s\n",
 			    yesno(gr->gl_version >= gl_version(3, 0) ||
 				  gl_extensions_has(gr, EXTENSION_EXT_TEXTURE_TYPE_2_10_10_10_REV)));
@@ -4971,6 +7399,8 @@ gl_renderer_setup(struct weston_compositor *ec)
 			    yesno(gl_extensions_has(gr, EXTENSION_OES_EGL_IMAGE_EXTERNAL)));
 	weston_log_continue(STAMP_SPACE "GPU timeline: %s\n",
 			    yesno(gl_features_has(gr, FEATURE_GPU_TIMELINE)));
+	weston_log_continue(STAMP_SPACE "program binaries: %s\n",
+			    yesno(gl_features_has(gr, FEATURE_PROGRAM_BINARY)));
 
 	return 0;
 }
@@ -418,7 +418,10 @@ gl_shader_config_set_color_transform(struct gl_renderer *gr,
 		break;
 	case SHADER_COLOR_MAPPING_MATRIX:
 		assert(sconf->req.color_mapping == SHADER_COLOR_MAPPING_MATRIX);
-		ARRAY_COPY(sconf->color_mapping.matrix, gl_xform->mapping.mat.matrix);
+		ARRAY_COPY(sconf->color_mapping.mat.matrix,
+			   gl_xform->mapping.mat.matrix);
+		ARRAY_COPY(sconf->color_mapping.mat.offset,
+			   gl_xform->mapping.mat.offset);
 		ret = true;
 		break;
 	case SHADER_COLOR_MAPPING_IDENTITY:
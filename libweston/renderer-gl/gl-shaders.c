@@ -33,6 +33,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
@@ -43,6 +49,7 @@
 #include "gl-renderer.h"
 #include "gl-renderer-internal.h"
 #include "pixel-formats.h"
+#include "shared/hash.h"
 #include "shared/helpers.h"
 #include "shared/timespec-util.h"
 
@@ -57,7 +64,6 @@ struct gl_shader {
 	struct timespec last_used;
 	struct gl_shader_requirements key;
 	GLuint program;
-	GLuint vertex_shader, fragment_shader;
 	GLint proj_uniform;
 	GLint surface_to_buffer_uniform;
 	GLint tex_uniforms[3];
@@ -80,7 +86,10 @@ struct gl_shader {
 			GLint tex_uniform;
 			GLint scale_offset_uniform;
 		} lut3d;
-		GLint matrix_uniform;
+		struct {
+			GLint matrix_uniform;
+			GLint offset_uniform;
+		} mat;
 	} color_mapping;
 	union {
 		struct {
@@ -230,8 +239,8 @@ compile_shader(GLenum type, int count, const char **sources)
 	return s;
 }
 
-static char *
-create_shader_description_string(const struct gl_shader_requirements *req)
+char *
+gl_shader_requirements_to_string(const struct gl_shader_requirements *req)
 {
 	int size;
 	char *str;
@@ -299,83 +308,311 @@ create_fragment_shader_config_string(const struct gl_shader_requirements *req)
 	return str;
 }
 
-static struct gl_shader *
-gl_shader_create(struct gl_renderer *gr,
-		 const struct gl_shader_requirements *requirements)
+#define GL_PROGRAM_CACHE_MAGIC 0x43425057 /* "WPBC" */
+#define GL_PROGRAM_CACHE_MAX_BINARY (16 * 1024 * 1024)
+
+/** Header of a program binary cache file
+ *
+ * The file name carries the driver identity and the requirements key. The
+ * header repeats both so that a renamed or foreign file gets rejected.
+ */
+struct gl_program_cache_header {
+	uint32_t magic;
+	uint32_t binary_format;
+	uint64_t identity;
+	struct gl_shader_requirements key;
+	uint32_t binary_length;
+};
+
+static uint64_t
+gl_program_cache_hash(uint64_t hash, const char *str)
 {
-	bool verbose = weston_log_scope_is_enabled(gr->shader_scope);
-	struct gl_shader *shader = NULL;
-	char msg[512];
+	/* FNV-1a, including the terminator so that concatenations differ */
+	do {
+		hash ^= str ? (uint8_t) *str : 0;
+		hash *= 0x100000001b3ull;
+	} while (str && *str++);
+
+	return hash;
+}
+
+static uint32_t
+gl_shader_requirements_to_u32(const struct gl_shader_requirements *req)
+{
+	uint32_t k;
+
+	static_assert(sizeof(k) == sizeof(*req),
+		      "requirements key must fit in 32 bits");
+	memcpy(&k, req, sizeof k);
+
+	return k;
+}
+
+static char *
+gl_program_cache_path(struct gl_renderer *gr,
+		      const struct gl_shader_requirements *req)
+{
+	char *path;
+
+	if (asprintf(&path, "%s/gl-program-%016" PRIx64 "-%08" PRIx32 ".bin",
+		     gr->program_cache.dir, gr->program_cache.identity,
+		     gl_shader_requirements_to_u32(req)) < 0)
+		return NULL;
+
+	return path;
+}
+
+/** Set up the on-disk program binary cache
+ *
+ * \param gr The GL renderer, with its context current.
+ * \param dir The cache directory, created if it does not exist.
+ *
+ * Cached binaries are only valid for the exact driver and shader sources
+ * that produced them, so all of those go into the identity hash which
+ * prefixes every cache file name.
+ */
+void
+gl_program_cache_init(struct gl_renderer *gr, const char *dir)
+{
+	uint64_t identity = 0xcbf29ce484222325ull;
+
+	if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		weston_log("Warning: cannot create GL program cache %s: %s\n",
+			   dir, strerror(errno));
+		return;
+	}
+
+	identity = gl_program_cache_hash(identity,
+		(const char *) glGetString(GL_VENDOR));
+	identity = gl_program_cache_hash(identity,
+		(const char *) glGetString(GL_RENDERER));
+	identity = gl_program_cache_hash(identity,
+		(const char *) glGetString(GL_VERSION));
+	identity = gl_program_cache_hash(identity,
+		(const char *) glGetString(GL_SHADING_LANGUAGE_VERSION));
+	identity = gl_program_cache_hash(identity, vertex_shader);
+	identity = gl_program_cache_hash(identity, fragment_shader);
+
+	gr->program_cache.dir = strdup(dir);
+	gr->program_cache.identity = identity;
+}
+
+static GLuint
+gl_program_cache_load(struct gl_renderer *gr,
+		      const struct gl_shader_requirements *req)
+{
+	struct gl_program_cache_header header;
+	void *binary = NULL;
+	GLuint program = GL_NONE;
 	GLint status;
-	const char *sources[3];
-	char *conf = NULL;
+	char *path;
+	FILE *fp;
 
-	shader = zalloc(sizeof *shader);
-	if (!shader) {
-		weston_log("could not create shader\n");
-		goto error_vertex;
+	path = gl_program_cache_path(gr, req);
+	if (!path)
+		return GL_NONE;
+
+	fp = fopen(path, "re");
+	if (!fp) {
+		free(path);
+		return GL_NONE;
 	}
 
-	wl_list_init(&shader->link);
-	shader->key = *requirements;
+	if (fread(&header, sizeof header, 1, fp) != 1 ||
+	    header.magic != GL_PROGRAM_CACHE_MAGIC ||
+	    header.identity != gr->program_cache.identity ||
+	    memcmp(&header.key, req, sizeof *req) != 0 ||
+	    header.binary_length == 0 ||
+	    header.binary_length > GL_PROGRAM_CACHE_MAX_BINARY)
+		goto out;
+
+	binary = malloc(header.binary_length);
+	if (!binary || fread(binary, header.binary_length, 1, fp) != 1)
+		goto out;
+
+	program = glCreateProgram();
+	gr->program_binary(program, header.binary_format, binary,
+			   header.binary_length);
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		glDeleteProgram(program);
+		program = GL_NONE;
+	}
 
-	if (verbose) {
-		char *desc;
+out:
+	fclose(fp);
+	/* The driver refuses binaries it no longer understands, e.g. after
+	 * an update that kept the version strings. Drop such files so that
+	 * they get replaced. */
+	if (program == GL_NONE)
+		unlink(path);
+	free(binary);
+	free(path);
+
+	return program;
+}
 
-		desc = create_shader_description_string(requirements);
-		weston_log_scope_printf(gr->shader_scope,
-					"Compiling shader program for: %s\n",
-					desc);
-		free(desc);
+static void
+gl_program_cache_store(struct gl_renderer *gr, GLuint program,
+		       const struct gl_shader_requirements *req)
+{
+	struct gl_program_cache_header header = {
+		.magic = GL_PROGRAM_CACHE_MAGIC,
+		.identity = gr->program_cache.identity,
+		.key = *req,
+	};
+	GLint length = 0;
+	GLenum format;
+	void *binary;
+	char *path, *tmp;
+	FILE *fp;
+	bool ok;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if (length <= 0 || length > GL_PROGRAM_CACHE_MAX_BINARY)
+		return;
+
+	binary = malloc(length);
+	if (!binary)
+		return;
+
+	gr->get_program_binary(program, length, &length, &format, binary);
+	header.binary_format = format;
+	header.binary_length = length;
+
+	path = gl_program_cache_path(gr, req);
+	if (!path || asprintf(&tmp, "%s.tmp", path) < 0)
+		goto out;
+
+	/* Write to a temporary file and rename it into place, so that a
+	 * crash or a concurrent instance never leaves a torn binary. */
+	fp = fopen(tmp, "we");
+	if (fp) {
+		ok = fwrite(&header, sizeof header, 1, fp) == 1 &&
+		     fwrite(binary, length, 1, fp) == 1;
+		if (fclose(fp) != 0)
+			ok = false;
+		if (!ok || rename(tmp, path) < 0) {
+			weston_log("Warning: failed to write GL program cache "
+				   "file %s\n", path);
+			unlink(tmp);
+		}
 	}
+	free(tmp);
+
+out:
+	free(path);
+	free(binary);
+}
+
+static GLuint
+gl_shader_compile_program(const struct gl_shader_requirements *requirements)
+{
+	GLuint program = GL_NONE;
+	GLuint vertex_shader_id, fragment_shader_id;
+	char msg[512];
+	GLint status;
+	const char *sources[3];
+	char *conf;
 
-	conf = create_vertex_shader_config_string(&shader->key);
+	conf = create_vertex_shader_config_string(requirements);
 	if (!conf)
-		goto error_vertex;
+		return GL_NONE;
 
 	sources[0] = conf;
 	sources[1] = vertex_shader;
-	shader->vertex_shader = compile_shader(GL_VERTEX_SHADER, 2, sources);
-	if (shader->vertex_shader == GL_NONE)
-		goto error_vertex;
-
+	vertex_shader_id = compile_shader(GL_VERTEX_SHADER, 2, sources);
 	free(conf);
-	conf = create_fragment_shader_config_string(&shader->key);
+	if (vertex_shader_id == GL_NONE)
+		return GL_NONE;
+
+	conf = create_fragment_shader_config_string(requirements);
 	if (!conf)
 		goto error_fragment;
 
 	sources[0] = "#version 100\n";
 	sources[1] = conf;
 	sources[2] = fragment_shader;
-	shader->fragment_shader = compile_shader(GL_FRAGMENT_SHADER,
-						 3, sources);
-	if (shader->fragment_shader == GL_NONE)
+	fragment_shader_id = compile_shader(GL_FRAGMENT_SHADER, 3, sources);
+	free(conf);
+	if (fragment_shader_id == GL_NONE)
 		goto error_fragment;
 
-	shader->program = glCreateProgram();
-	glAttachShader(shader->program, shader->vertex_shader);
-	glAttachShader(shader->program, shader->fragment_shader);
+	program = glCreateProgram();
+	glAttachShader(program, vertex_shader_id);
+	glAttachShader(program, fragment_shader_id);
 
-	glBindAttribLocation(shader->program, SHADER_ATTRIB_LOC_POSITION,
-			     "position");
+	glBindAttribLocation(program, SHADER_ATTRIB_LOC_POSITION, "position");
 	if (requirements->texcoord_input == SHADER_TEXCOORD_INPUT_ATTRIB)
-		glBindAttribLocation(shader->program,
-				     SHADER_ATTRIB_LOC_TEXCOORD, "texcoord");
+		glBindAttribLocation(program, SHADER_ATTRIB_LOC_TEXCOORD,
+				     "texcoord");
 	if (requirements->wireframe)
-		glBindAttribLocation(shader->program,
-				     SHADER_ATTRIB_LOC_BARYCENTRIC,
+		glBindAttribLocation(program, SHADER_ATTRIB_LOC_BARYCENTRIC,
 				     "barycentric");
 
-	glLinkProgram(shader->program);
-	glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
+	glLinkProgram(program);
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
 	if (!status) {
-		glGetProgramInfoLog(shader->program, sizeof msg, NULL, msg);
+		glGetProgramInfoLog(program, sizeof msg, NULL, msg);
 		weston_log("link info: %s\n", msg);
-		goto error_link;
+		glDeleteProgram(program);
+		program = GL_NONE;
 	}
 
-	glDeleteShader(shader->vertex_shader);
-	glDeleteShader(shader->fragment_shader);
+	glDeleteShader(fragment_shader_id);
+
+error_fragment:
+	glDeleteShader(vertex_shader_id);
+
+	return program;
+}
+
+static struct gl_shader *
+gl_shader_create(struct gl_renderer *gr,
+		 const struct gl_shader_requirements *requirements)
+{
+	bool verbose = weston_log_scope_enabled(gr->shader_scope);
+	struct gl_shader *shader = NULL;
+	char *desc = NULL;
+
+	shader = zalloc(sizeof *shader);
+	if (!shader) {
+		weston_log("could not create shader\n");
+		return NULL;
+	}
+
+	wl_list_init(&shader->link);
+	shader->key = *requirements;
+
+	if (verbose)
+		desc = gl_shader_requirements_to_string(requirements);
+
+	if (gr->program_cache.dir)
+		shader->program = gl_program_cache_load(gr, requirements);
+
+	if (shader->program != GL_NONE) {
+		if (verbose)
+			weston_log_scope_printf(gr->shader_scope,
+						"Loaded cached shader program "
+						"for: %s\n", desc);
+	} else {
+		if (verbose)
+			weston_log_scope_printf(gr->shader_scope,
+						"Compiling shader program "
+						"for: %s\n", desc);
+
+		shader->program = gl_shader_compile_program(requirements);
+		if (shader->program == GL_NONE) {
+			free(desc);
+			free(shader);
+			return NULL;
+		}
+
+		if (gr->program_cache.dir)
+			gl_program_cache_store(gr, shader->program,
+					       requirements);
+	}
+	free(desc);
 
 	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
 	shader->surface_to_buffer_uniform =
@@ -448,45 +685,50 @@ gl_shader_create(struct gl_renderer *gr,
 					     "color_mapping_lut_scale_offset");
 		break;
 	case SHADER_COLOR_MAPPING_MATRIX:
-		shader->color_mapping.matrix_uniform =
+		shader->color_mapping.mat.matrix_uniform =
 			glGetUniformLocation(shader->program,
 					     "color_mapping_matrix");
+		shader->color_mapping.mat.offset_uniform =
+			glGetUniformLocation(shader->program,
+					     "color_mapping_offset");
 		break;
 	case SHADER_COLOR_MAPPING_IDENTITY:
 		break;
 	}
-	free(conf);
 
+	if (hash_table_insert(gr->shader_table,
+			      gl_shader_requirements_to_u32(requirements),
+			      shader) < 0) {
+		weston_log("could not index shader\n");
+		glDeleteProgram(shader->program);
+		free(shader);
+		return NULL;
+	}
 	wl_list_insert(&gr->shader_list, &shader->link);
 
 	return shader;
-
-error_link:
-	glDeleteProgram(shader->program);
-	glDeleteShader(shader->fragment_shader);
-
-error_fragment:
-	glDeleteShader(shader->vertex_shader);
-
-error_vertex:
-	free(conf);
-	free(shader);
-	return NULL;
 }
 
 void
 gl_shader_destroy(struct gl_renderer *gr, struct gl_shader *shader)
 {
+	uint32_t key;
 	char *desc;
 
-	if (weston_log_scope_is_enabled(gr->shader_scope)) {
-		desc = create_shader_description_string(&shader->key);
+	if (weston_log_scope_enabled(gr->shader_scope)) {
+		desc = gl_shader_requirements_to_string(&shader->key);
 		weston_log_scope_printf(gr->shader_scope,
 					"Deleting shader program for: %s\n",
 					desc);
 		free(desc);
 	}
 
+	/* The fallback shader is not indexed, and may share its key with
+	 * an indexed one. */
+	key = gl_shader_requirements_to_u32(&shader->key);
+	if (hash_table_lookup(gr->shader_table, key) == shader)
+		hash_table_remove(gr->shader_table, key);
+
 	glDeleteProgram(shader->program);
 	wl_list_remove(&shader->link);
 	free(shader);
@@ -536,7 +778,7 @@ gl_shader_scope_new_subscription(struct weston_log_subscription *subs,
 	wl_list_for_each(shader, &gr->shader_list, link) {
 		count++;
 		msecs = timespec_sub_to_msec(&now, &shader->last_used);
-		desc = create_shader_description_string(&shader->key);
+		desc = gl_shader_requirements_to_string(&shader->key);
 		weston_log_subscription_printf(subs,
 					       "%6u: (%.1f) %s\n",
 					       shader->program,
@@ -574,11 +816,13 @@ gl_renderer_create_fallback_shader(struct gl_renderer *gr)
 		return NULL;
 
 	/*
-	 * This shader must be exempt from any automatic garbage collection.
-	 * It is destroyed explicitly.
+	 * This shader must be exempt from any automatic garbage collection
+	 * and lookups. It is destroyed explicitly.
 	 */
 	wl_list_remove(&shader->link);
 	wl_list_init(&shader->link);
+	hash_table_remove(gr->shader_table,
+			  gl_shader_requirements_to_u32(&shader->key));
 
 	return shader;
 }
@@ -596,10 +840,12 @@ gl_renderer_get_program(struct gl_renderer *gr,
 	    gl_shader_requirements_cmp(&reqs, &gr->current_shader->key) == 0)
 		return gr->current_shader;
 
-	wl_list_for_each(shader, &gr->shader_list, link) {
-		if (gl_shader_requirements_cmp(&reqs, &shader->key) == 0)
-			return shader;
-	}
+	/* The requirements key is padding-free and exactly 32 bits, so it is
+	 * its own perfect hash. */
+	shader = hash_table_lookup(gr->shader_table,
+				   gl_shader_requirements_to_u32(&reqs));
+	if (shader)
+		return shader;
 
 	shader = gl_shader_create(gr, &reqs);
 	if (shader)
@@ -608,6 +854,87 @@ gl_renderer_get_program(struct gl_renderer *gr,
 	return NULL;
 }
 
+/** Make sure the program for the given requirements exists
+ *
+ * Compiles and links the program now if it has not been created yet, so that
+ * the first draw using it does not have to. The current program is left
+ * untouched.
+ *
+ * 
+eturn True if the program exists, false if it failed to build.
+ */
+bool
+gl_renderer_ensure_program(struct gl_renderer *gr,
+			   const struct gl_shader_requirements *reqs)
+{
+	return gl_renderer_get_program(gr, reqs) != NULL;
+}
+
+/** Create the programs stored in the program binary cache
+ *
+ * This warms up the renderer with every shader variant that earlier runs
+ * on the same driver needed, so that their first use does not stall a
+ * frame. Files left behind by other drivers or shader sources are removed.
+ */
+void
+gl_renderer_load_program_cache(struct gl_renderer *gr)
+{
+	struct gl_shader_requirements reqs;
+	struct gl_shader *shader;
+	struct dirent *entry;
+	struct timespec now;
+	uint64_t identity;
+	uint32_t key;
+	int count = 0;
+	int end;
+	DIR *dir;
+
+	if (!gr->program_cache.dir)
+		return;
+
+	dir = opendir(gr->program_cache.dir);
+	if (!dir)
+		return;
+
+	weston_compositor_read_presentation_clock(gr->compositor, &now);
+
+	while ((entry = readdir(dir))) {
+		end = 0;
+		if (sscanf(entry->d_name,
+			   "gl-program-%16" SCNx64 "-%8" SCNx32 ".bin%n",
+			   &identity, &key, &end) != 2 ||
+		    entry->d_name[end] != '\0')
+			continue;
+
+		if (identity != gr->program_cache.identity) {
+			unlinkat(dirfd(dir), entry->d_name, 0);
+			continue;
+		}
+
+		memcpy(&reqs, &key, sizeof reqs);
+		if (reqs.pad_bits_ != 0)
+			continue;
+
+		if (gr->fallback_shader &&
+		    gl_shader_requirements_cmp(&reqs,
+					       &gr->fallback_shader->key) == 0)
+			continue;
+
+		shader = gl_renderer_get_program(gr, &reqs);
+		if (!shader)
+			continue;
+
+		/* Give the warmed-up programs the usual grace period before
+		 * garbage collection. */
+		shader->last_used = now;
+		count++;
+	}
+	closedir(dir);
+
+	weston_log("GL program cache: %d programs loaded from %s\n",
+		   count, gr->program_cache.dir);
+}
+
 void
 gl_renderer_garbage_collect_programs(struct gl_renderer *gr)
 {
@@ -734,10 +1061,13 @@ gl_shader_load_config(struct gl_shader *shader,
 			     1, sconf->color_mapping.lut3d.scale_offset);
 		break;
 	case SHADER_COLOR_MAPPING_MATRIX:
-		assert(shader->color_mapping.matrix_uniform != -1);
-		glUniformMatrix3fv(shader->color_mapping.matrix_uniform,
+		assert(shader->color_mapping.mat.matrix_uniform != -1);
+		assert(shader->color_mapping.mat.offset_uniform != -1);
+		glUniformMatrix3fv(shader->color_mapping.mat.matrix_uniform,
 				   1, GL_FALSE,
-				   sconf->color_mapping.matrix);
+				   sconf->color_mapping.mat.matrix);
+		glUniform3fv(shader->color_mapping.mat.offset_uniform,
+			     1, sconf->color_mapping.mat.offset);
 		break;
 	}
 
@@ -798,7 +1128,8 @@ gl_renderer_use_program(struct gl_renderer *gr,
 		return false;
 	}
 
-	if (shader != gr->fallback_shader) {
+	if (shader != gr->fallback_shader &&
+	    gr->shader_list.next != &shader->link) {
 		/* Update list order for most recently used. */
 		wl_list_remove(&shader->link);
 		wl_list_insert(&gr->shader_list, &shader->link);
@@ -0,0 +1,128 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "repaint-profile.h"
+#include "shared/helpers.h"
+
+static const char * const phase_names[] = {
+	[WESTON_REPAINT_PHASE_VIEW_LIST] = "view-list",
+	[WESTON_REPAINT_PHASE_PAINT_NODES] = "paint-nodes",
+	[WESTON_REPAINT_PHASE_ASSIGN_PLANES] = "assign-planes",
+	[WESTON_REPAINT_PHASE_VISIBILITY] = "visibility",
+	[WESTON_REPAINT_PHASE_DAMAGE] = "damage",
+	[WESTON_REPAINT_PHASE_RENDERER] = "renderer",
+	[WESTON_REPAINT_PHASE_BACKEND] = "backend",
+};
+
+static_assert(ARRAY_LENGTH(phase_names) == WESTON_REPAINT_PHASE_COUNT,
+	      "every repaint phase needs a name");
+
+/** Close the row of the current repaint and start a new one */
+void
+weston_repaint_profile_commit(struct weston_repaint_profile *profile)
+{
+	profile->next = (profile->next + 1) % WESTON_REPAINT_PROFILE_WINDOW;
+	if (profile->count < WESTON_REPAINT_PROFILE_WINDOW)
+		profile->count++;
+
+	memset(profile->samples_nsec[profile->next], 0,
+	       sizeof(profile->samples_nsec[profile->next]));
+}
+
+static void
+weston_repaint_profile_print(struct weston_log_subscription *sub,
+			     const struct weston_repaint_profile *profile)
+{
+	unsigned int phase, i, row;
+	int64_t sum, max, last, total_sum = 0, total_max = 0, total;
+
+	weston_log_subscription_printf(sub, "\trepaints=%u\n", profile->count);
+	if (profile->count == 0)
+		return;
+
+	for (phase = 0; phase < WESTON_REPAINT_PHASE_COUNT; phase++) {
+		sum = 0;
+		max = 0;
+		for (i = 0; i < profile->count; i++) {
+			row = (profile->next + WESTON_REPAINT_PROFILE_WINDOW -
+			       1 - i) % WESTON_REPAINT_PROFILE_WINDOW;
+			sum += profile->samples_nsec[row][phase];
+			max = MAX(max, profile->samples_nsec[row][phase]);
+		}
+		last = profile->samples_nsec[(profile->next +
+					      WESTON_REPAINT_PROFILE_WINDOW - 1) %
+					     WESTON_REPAINT_PROFILE_WINDOW][phase];
+
+		weston_log_subscription_printf(sub,
+			"\t%s: avg_us=%" PRId64 " max_us=%" PRId64
+			" last_us=%" PRId64 "\n", phase_names[phase],
+			sum / profile->count / 1000, max / 1000, last / 1000);
+	}
+
+	for (i = 0; i < profile->count; i++) {
+		row = (profile->next + WESTON_REPAINT_PROFILE_WINDOW - 1 - i) %
+		      WESTON_REPAINT_PROFILE_WINDOW;
+		total = 0;
+		for (phase = 0; phase < WESTON_REPAINT_PHASE_COUNT; phase++)
+			total += profile->samples_nsec[row][phase];
+		total_sum += total;
+		total_max = MAX(total_max, total);
+	}
+
+	weston_log_subscription_printf(sub,
+		"\ttotal: avg_us=%" PRId64 " max_us=%" PRId64 "\n",
+		total_sum / profile->count / 1000, total_max / 1000);
+}
+
+/**
+ * Called when the 'repaint-profile' debug scope is bound by a client. This
+ * one-shot weston-debug scope prints, for each output, the time the phases
+ * of its last repaints took, and then terminates the stream.
+ */
+void
+weston_repaint_profile_debug_scope_cb(struct weston_log_subscription *sub,
+				      void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_output *output;
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		weston_log_subscription_printf(sub, "Output %u (%s), last %u "
+					       "repaints:\n", output->id,
+					       output->name,
+					       WESTON_REPAINT_PROFILE_WINDOW);
+		weston_repaint_profile_print(sub, output->repaint_profile);
+	}
+
+	weston_log_subscription_complete(sub);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_REPAINT_PROFILE_H
+#define WESTON_REPAINT_PROFILE_H
+
+#include <stdint.h>
+#include <time.h>
+
+struct weston_log_subscription;
+struct weston_output;
+
+/** Phases of weston_output_repaint() that are timed */
+enum weston_repaint_phase {
+	WESTON_REPAINT_PHASE_VIEW_LIST = 0,	/**< rebuilding the view list */
+	WESTON_REPAINT_PHASE_PAINT_NODES,	/**< paint node updates */
+	WESTON_REPAINT_PHASE_ASSIGN_PLANES,	/**< backend plane assignment */
+	WESTON_REPAINT_PHASE_VISIBILITY,	/**< weston_output_update_visibility() */
+	WESTON_REPAINT_PHASE_DAMAGE,		/**< weston_output_accumulate_damage() */
+	WESTON_REPAINT_PHASE_RENDERER,		/**< renderer repaint_output() */
+	WESTON_REPAINT_PHASE_BACKEND,		/**< backend repaint, renderer excluded */
+	WESTON_REPAINT_PHASE_COUNT,
+};
+
+/** Repaints the rolling statistics are computed over */
+#define WESTON_REPAINT_PROFILE_WINDOW 64
+
+/** Time spent in each phase over the last repaints of an output */
+struct weston_repaint_profile {
+	int64_t samples_nsec[WESTON_REPAINT_PROFILE_WINDOW][WESTON_REPAINT_PHASE_COUNT];
+	unsigned int next;	/**< row of the repaint being timed */
+	unsigned int count;	/**< complete rows */
+};
+
+static inline int64_t
+weston_repaint_profile_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Charge the time since start to a phase of the current repaint
+ *
+ * \return The current time, to start the next phase from.
+ */
+static inline int64_t
+weston_repaint_profile_mark(struct weston_repaint_profile *profile,
+			    enum weston_repaint_phase phase, int64_t start)
+{
+	int64_t now = weston_repaint_profile_now();
+
+	profile->samples_nsec[profile->next][phase] += now - start;
+
+	return now;
+}
+
+void
+weston_repaint_profile_commit(struct weston_repaint_profile *profile);
+
+void
+weston_repaint_profile_debug_scope_cb(struct weston_log_subscription *sub,
+				      void *data);
+
+#endif /* WESTON_REPAINT_PROFILE_H */
@@ -0,0 +1,243 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <drm_fourcc.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "libweston-internal.h"
+#include "pixel-formats.h"
+#include "scene-record.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+
+/**
+ * Scene recording: the 'scene-record' debug scope writes a line for every
+ * commit that attaches a buffer to a surface, and for every surface that
+ * is destroyed after having been recorded, so that weston-scene-replay can
+ * later play the same scene evolution back against any backend and
+ * renderer, e.g.
+ *
+ *	weston-debug -o trace scene-record
+ *	weston-scene-replay trace
+ *
+ * Lines are, after a header naming the format version:
+ *
+ *	<usec> commit surface=<id> parent=<id> pid=<pid> role=<role>
+ *		size=<w>x<h> scale=<n> format=<fourcc> color=<argb>
+ *		hash=<hash> damage=<x>,<y>,<w>x<h> pos=<x>,<y>
+ *	<usec> unmap surface=<id>
+ *	<usec> destroy surface=<id>
+ *
+ * on a single line each. Times are those of the presentation clock.
+ * Surface ids are given by the recorder and never reused; the parent is
+ * that of a sub-surface, or 0. The damage is the bounding box of the
+ * damage in surface coordinates, and pos the position of the surface in
+ * the global space, or relative to its parent for a sub-surface.
+ *
+ * Buffer contents are not recorded: wl_shm buffers are summarised by a
+ * hash of a grid of sampled pixels and, for 8-bit RGB formats, their
+ * average color, which is what the replay fills damage with. Other buffers
+ * get a hash and color of 0.
+ */
+
+#define SAMPLE_GRID 16
+
+static const char *
+scene_record_role(struct weston_surface *surface)
+{
+	return surface->role_name ? surface->role_name : "none";
+}
+
+static uint32_t
+scene_record_id(struct weston_surface *surface)
+{
+	struct weston_compositor *compositor = surface->compositor;
+
+	if (surface->scene_record_id == 0)
+		surface->scene_record_id = ++compositor->scene_record_next_id;
+
+	return surface->scene_record_id;
+}
+
+static void
+scene_record_sample_shm(struct weston_buffer *buffer,
+			uint64_t *hash, uint32_t *color)
+{
+	const struct pixel_format_info *info = buffer->pixel_format;
+	uint64_t sum[4] = { 0 };
+	bool has_color;
+	uint8_t *data;
+	int cpp, x, y, i;
+
+	*hash = 0xcbf29ce484222325ull; /* FNV-1a */
+	*color = 0;
+
+	if (!info || info->num_planes != 1 || info->bpp % 8 != 0)
+		return;
+
+	cpp = info->bpp / 8;
+	has_color = info->format == DRM_FORMAT_ARGB8888 ||
+		    info->format == DRM_FORMAT_XRGB8888;
+
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+
+	for (y = 0; y < SAMPLE_GRID; y++) {
+		for (x = 0; x < SAMPLE_GRID; x++) {
+			uint8_t *p = data +
+				(int64_t) (y * buffer->height / SAMPLE_GRID) *
+				buffer->stride +
+				(x * buffer->width / SAMPLE_GRID) * cpp;
+
+			for (i = 0; i < cpp; i++) {
+				*hash ^= p[i];
+				*hash *= 0x100000001b3ull;
+			}
+
+			if (has_color)
+				for (i = 0; i < 4; i++)
+					sum[i] += p[i];
+		}
+	}
+
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+	if (!has_color)
+		return;
+
+	for (i = 0; i < 4; i++)
+		sum[i] /= SAMPLE_GRID * SAMPLE_GRID;
+	if (info->format == DRM_FORMAT_XRGB8888)
+		sum[3] = 0xff;
+
+	/* Little-endian B, G, R, A in memory */
+	*color = sum[3] << 24 | sum[2] << 16 | sum[1] << 8 | sum[0];
+}
+
+/** Records a commit of a surface, called once its state is applied when
+ * the commit attached a buffer or removed one.
+ *
+ * \param surface The committed surface.
+ * \param sub The sub-surface of the surface, or NULL if it is none.
+ */
+void
+weston_surface_scene_record_commit(struct weston_surface *surface,
+				   struct weston_subsurface *sub)
+{
+	struct weston_compositor *compositor = surface->compositor;
+	struct weston_log_scope *scope = compositor->scene_record_scope;
+	struct weston_buffer *buffer = surface->buffer_ref.buffer;
+	struct weston_coord pos = { 0, 0 };
+	pixman_box32_t *damage;
+	struct timespec now;
+	uint32_t parent = 0;
+	uint32_t color = 0;
+	pid_t pid = 0;
+	uint64_t hash = 0;
+	uint32_t id;
+
+	if (!weston_log_scope_is_enabled(scope))
+		return;
+
+	weston_compositor_read_presentation_clock(compositor, &now);
+	id = scene_record_id(surface);
+
+	if (!buffer) {
+		weston_log_scope_printf(scope, "%" PRId64 " unmap surface=%u\n",
+					timespec_to_usec(&now), id);
+		return;
+	}
+
+	if (sub) {
+		if (sub->parent)
+			parent = scene_record_id(sub->parent);
+		pos = sub->position.offset.c;
+	} else if (!wl_list_empty(&surface->views)) {
+		struct weston_view *view =
+			container_of(surface->views.next,
+				     struct weston_view, surface_link);
+
+		pos = weston_view_get_pos_offset_global(view).c;
+	}
+
+	if (buffer->type == WESTON_BUFFER_SHM)
+		scene_record_sample_shm(buffer, &hash, &color);
+	else if (buffer->type == WESTON_BUFFER_SOLID)
+		color = (uint32_t) (buffer->solid.a * 255.0f) << 24 |
+			(uint32_t) (buffer->solid.r * 255.0f) << 16 |
+			(uint32_t) (buffer->solid.g * 255.0f) << 8 |
+			(uint32_t) (buffer->solid.b * 255.0f);
+
+	if (surface->resource)
+		wl_client_get_credentials(wl_resource_get_client(surface->resource),
+					  &pid, NULL, NULL);
+
+	damage = pixman_region32_extents(&surface->damage);
+
+	weston_log_scope_printf(scope,
+		"%" PRId64 " commit surface=%u parent=%u pid=%d role=%s "
+		"size=%dx%d scale=%d format=0x%08x color=0x%08x "
+		"hash=%016" PRIx64 " damage=%d,%d,%dx%d pos=%d,%d\n",
+		timespec_to_usec(&now), id, parent, (int) pid,
+		scene_record_role(surface),
+		buffer->width, buffer->height,
+		surface->buffer_viewport.buffer.scale,
+		buffer->pixel_format ? buffer->pixel_format->format : 0,
+		color, hash,
+		damage->x1, damage->y1,
+		damage->x2 - damage->x1, damage->y2 - damage->y1,
+		(int) pos.x, (int) pos.y);
+}
+
+/** Records the destruction of a surface that commits were recorded for */
+void
+weston_surface_scene_record_destroy(struct weston_surface *surface)
+{
+	struct weston_log_scope *scope = surface->compositor->scene_record_scope;
+	struct timespec now;
+
+	if (surface->scene_record_id == 0 ||
+	    !weston_log_scope_is_enabled(scope))
+		return;
+
+	weston_compositor_read_presentation_clock(surface->compositor, &now);
+	weston_log_scope_printf(scope, "%" PRId64 " destroy surface=%u\n",
+				timespec_to_usec(&now),
+				surface->scene_record_id);
+}
+
+void
+weston_scene_record_subscribe_cb(struct weston_log_subscription *sub,
+				 void *data)
+{
+	weston_log_subscription_printf(sub, "weston-scene-record %d\n",
+				       WESTON_SCENE_RECORD_VERSION);
+}
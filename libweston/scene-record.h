@@ -0,0 +1,48 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_SCENE_RECORD_H
+#define WESTON_SCENE_RECORD_H
+
+struct weston_compositor;
+struct weston_log_subscription;
+struct weston_subsurface;
+struct weston_surface;
+
+/** Version of the trace format, on its first line */
+#define WESTON_SCENE_RECORD_VERSION 1
+
+void
+weston_surface_scene_record_commit(struct weston_surface *surface,
+				   struct weston_subsurface *sub);
+
+void
+weston_surface_scene_record_destroy(struct weston_surface *surface);
+
+void
+weston_scene_record_subscribe_cb(struct weston_log_subscription *sub,
+				 void *data);
+
+#endif /* WESTON_SCENE_RECORD_H */
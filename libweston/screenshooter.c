@@ -33,11 +33,19 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/uio.h>
 
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #include <libweston/libweston.h>
 #include "shared/helpers.h"
+#include "shared/simd.h"
 #include "shared/timespec-util.h"
+#include "shared/xalloc.h"
 #include "backend.h"
 #include "libweston-internal.h"
 #include "pixel-formats.h"
@@ -51,6 +59,12 @@ struct screenshooter_frame_listener {
 	struct weston_output *output;
 	weston_screenshooter_done_func_t done;
 	void *data;
+
+	/* Set once the read back is in flight. */
+	bool reading;
+	pixman_format_code_t pixman_format;
+	int width, height;
+	bool yflip;
 };
 
 static void
@@ -80,6 +94,29 @@ copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
 	uint32_t *src = vsrc;
 	uint32_t *end = dst + bytes / 4;
 
+#if defined(WESTON_SIMD_SSE2)
+	const __m128i ag = _mm_set1_epi32(0xff00ff00);
+	const __m128i b = _mm_set1_epi32(0x000000ff);
+
+	for (; end - dst >= 4; dst += 4, src += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) src);
+		__m128i tmp = _mm_and_si128(v, ag);
+
+		tmp = _mm_or_si128(tmp, _mm_and_si128(_mm_srli_epi32(v, 16), b));
+		tmp = _mm_or_si128(tmp, _mm_slli_epi32(_mm_and_si128(v, b), 16));
+		_mm_storeu_si128((__m128i *) dst, tmp);
+	}
+#elif defined(WESTON_SIMD_NEON)
+	for (; end - dst >= 16; dst += 16, src += 16) {
+		uint8x16x4_t v = vld4q_u8((const uint8_t *) src);
+		uint8x16_t tmp = v.val[0];
+
+		v.val[0] = v.val[2];
+		v.val[2] = tmp;
+		vst4q_u8((uint8_t *) dst, v);
+	}
+#endif
+
 	while (dst < end) {
 		uint32_t v = *src++;
 		/*                    A R G B */
@@ -117,70 +154,110 @@ copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
 }
 
 static void
-screenshooter_frame_notify(struct wl_listener *listener, void *data)
+screenshooter_read_done(void *data, const void *pixels, int src_stride)
 {
-	struct screenshooter_frame_listener *l =
-		container_of(listener,
-			     struct screenshooter_frame_listener,
-			     frame_listener);
-	struct weston_output *output = l->output;
-	struct weston_compositor *compositor = output->compositor;
-	const pixman_format_code_t pixman_format =
-		compositor->read_format->pixman_format;
+	struct screenshooter_frame_listener *l = data;
 	int32_t stride;
-	uint8_t *pixels, *d, *s;
+	uint8_t *d, *s;
 
-	weston_output_disable_planes_decr(output);
-	wl_list_remove(&listener->link);
-	wl_list_remove(&l->buffer_destroy_listener.link);
+	if (!l->buffer) {
+		/* The buffer went away while reading, done was already
+		 * called. */
+		free(l);
+		return;
+	}
 
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(pixman_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
+	wl_list_remove(&l->buffer_destroy_listener.link);
 
-	if (pixels == NULL) {
+	if (!pixels) {
 		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
 		free(l);
 		return;
 	}
 
-	compositor->renderer->read_pixels(output,
-			     compositor->read_format, pixels,
-			     0, 0, output->current_mode->width,
-			     output->current_mode->height);
-
 	stride = l->buffer->stride;
 
 	d = wl_shm_buffer_get_data(l->buffer->shm_buffer);
-	s = pixels + stride * (l->buffer->height - 1);
+	s = (uint8_t *) pixels + src_stride * (l->height - 1);
 
 	wl_shm_buffer_begin_access(l->buffer->shm_buffer);
 
-	switch (pixman_format) {
-	case PIXMAN_a8r8g8b8:
-	case PIXMAN_x8r8g8b8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_bgra_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_bgra(d, pixels, output->current_mode->height, stride);
-		break;
-	case PIXMAN_x8b8g8r8:
-	case PIXMAN_a8b8g8r8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_rgba_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_rgba(d, pixels, output->current_mode->height, stride);
-		break;
-	default:
-		break;
+	if (src_stride == stride) {
+		switch (l->pixman_format) {
+		case PIXMAN_a8r8g8b8:
+		case PIXMAN_x8r8g8b8:
+			if (l->yflip)
+				copy_bgra_yflip(d, s, l->height, stride);
+			else
+				copy_bgra(d, (uint8_t *) pixels, l->height,
+					  stride);
+			break;
+		case PIXMAN_x8b8g8r8:
+		case PIXMAN_a8b8g8r8:
+			if (l->yflip)
+				copy_rgba_yflip(d, s, l->height, stride);
+			else
+				copy_rgba(d, (uint8_t *) pixels, l->height,
+					  stride);
+			break;
+		default:
+			break;
+		}
+	} else {
+		int y;
+
+		/* The buffer is wider than the output, copy row by row. */
+		for (y = 0; y < l->height; y++) {
+			const uint8_t *row = l->yflip ?
+				s - y * src_stride :
+				(const uint8_t *) pixels + y * src_stride;
+
+			switch (l->pixman_format) {
+			case PIXMAN_a8r8g8b8:
+			case PIXMAN_x8r8g8b8:
+				memcpy(d + y * stride, row, src_stride);
+				break;
+			case PIXMAN_x8b8g8r8:
+			case PIXMAN_a8b8g8r8:
+				copy_row_swap_RB(d + y * stride, (void *) row,
+						 src_stride);
+				break;
+			default:
+				break;
+			}
+		}
 	}
 
 	wl_shm_buffer_end_access(l->buffer->shm_buffer);
 
 	l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
-	free(pixels);
 	free(l);
 }
 
+static void
+screenshooter_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_frame_listener *l =
+		container_of(listener,
+			     struct screenshooter_frame_listener,
+			     frame_listener);
+	struct weston_output *output = l->output;
+	struct weston_compositor *compositor = output->compositor;
+
+	weston_output_disable_planes_decr(output);
+	wl_list_remove(&listener->link);
+
+	l->reading = true;
+	l->pixman_format = compositor->read_format->pixman_format;
+	l->width = output->current_mode->width;
+	l->height = output->current_mode->height;
+	l->yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	weston_renderer_read_pixels_async(output, compositor->read_format,
+					  0, 0, l->width, l->height,
+					  screenshooter_read_done, l);
+}
+
 static void
 buffer_destroy_handle(struct wl_listener *listener, void *data)
 {
@@ -189,11 +266,17 @@ buffer_destroy_handle(struct wl_listener *listener, void *data)
 			     struct screenshooter_frame_listener,
 			     buffer_destroy_listener);
 
-	weston_output_disable_planes_decr(l->output);
 	wl_list_remove(&listener->link);
-	wl_list_remove(&l->frame_listener.link);
 	l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
 
+	if (l->reading) {
+		/* screenshooter_read_done() frees us. */
+		l->buffer = NULL;
+		return;
+	}
+
+	weston_output_disable_planes_decr(l->output);
+	wl_list_remove(&l->frame_listener.link);
 	free(l);
 }
 
@@ -225,6 +308,7 @@ weston_screenshooter_shoot(struct weston_output *output,
 	l->output = output;
 	l->done = done;
 	l->data = data;
+	l->reading = false;
 
 	l->frame_listener.notify = screenshooter_frame_notify;
 	wl_signal_add(&output->frame_signal, &l->frame_listener);
@@ -238,14 +322,61 @@ weston_screenshooter_shoot(struct weston_output *output,
 	return 0;
 }
 
+/* Frames queued for the encoder before the compositor waits for it. */
+#define RECORDER_MAX_QUEUED 16
+
+/* Longest stretch of recording a seek has to replay. */
+#define RECORDER_KEYFRAME_INTERVAL_MS 2000
+
+/* Fast enough to keep up with a full-screen repaint at 60 Hz. */
+#define RECORDER_ZSTD_LEVEL 1
+
 struct weston_recorder {
 	struct weston_output *output;
-	uint32_t *frame, *rect;
-	uint32_t *tmpbuf;
+	uint32_t *frame, *rect, *delta;
 	uint32_t total;
 	int fd;
 	struct wl_listener frame_listener;
 	int count, destroying;
+	bool detached;
+	int pending_reads;
+	bool do_yflip;
+	int width, height;
+
+	/* wcap v2 state, owned by the worker */
+	struct wl_array payload;
+	struct wl_array index;
+	uint64_t offset;
+	bool have_keyframe;
+	uint32_t keyframe_msecs;
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *zstd;
+	void *compressed;
+	size_t compressed_size;
+#endif
+
+	/* Diffing and run-length encoding happen on a worker thread; frame,
+	 * rect, delta and fd belong to it while it runs. The mutex covers
+	 * the queue, quit, total and count. */
+	pthread_t thread;
+	bool thread_running;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t space_cond;
+	struct wl_list queue;
+	int queued;
+	bool quit;
+};
+
+/** A frame whose damage extents are being read back, then encoded */
+struct weston_recorder_read {
+	struct weston_recorder *recorder;
+	uint32_t msecs;
+	pixman_region32_t damage;
+
+	/* damage extents, top row first */
+	uint32_t *pixels;
+	struct wl_list link;
 };
 
 static uint32_t *
@@ -286,86 +417,181 @@ component_delta(uint32_t next, uint32_t prev)
 	return (dr << 16) | (dg << 8) | (db << 0);
 }
 
+/* The delta of every pixel against the previous frame, with the previous
+ * frame updated to the new one. Same result as component_delta(), which
+ * is a per-byte subtraction with the alpha byte cleared. */
 static void
-weston_recorder_destroy(struct weston_recorder *recorder);
+recorder_delta_row(uint32_t *restrict delta, uint32_t *restrict frame,
+		   const uint32_t *restrict src, int width)
+{
+	int k = 0;
+
+#if defined(WESTON_SIMD_SSE2)
+	const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+
+	for (; k + 4 <= width; k += 4) {
+		__m128i next = _mm_loadu_si128((const __m128i *) (src + k));
+		__m128i prev = _mm_loadu_si128((const __m128i *) (frame + k));
+
+		_mm_storeu_si128((__m128i *) (delta + k),
+				 _mm_and_si128(_mm_sub_epi8(next, prev), rgb));
+		_mm_storeu_si128((__m128i *) (frame + k), next);
+	}
+#elif defined(WESTON_SIMD_NEON)
+	const uint32x4_t rgb = vdupq_n_u32(0x00ffffff);
+
+	for (; k + 4 <= width; k += 4) {
+		uint32x4_t next = vld1q_u32(src + k);
+		uint32x4_t prev = vld1q_u32(frame + k);
+		uint8x16_t d = vsubq_u8(vreinterpretq_u8_u32(next),
+					vreinterpretq_u8_u32(prev));
+
+		vst1q_u32(delta + k, vandq_u32(vreinterpretq_u32_u8(d), rgb));
+		vst1q_u32(frame + k, next);
+	}
+#endif
+
+	for (; k < width; k++) {
+		delta[k] = component_delta(src[k], frame[k]);
+		frame[k] = src[k];
+	}
+}
 
 static void
-weston_recorder_frame_notify(struct wl_listener *listener, void *data)
+recorder_payload_append(struct weston_recorder *recorder,
+			const void *data, size_t size)
 {
-	struct weston_recorder *recorder =
-		container_of(listener, struct weston_recorder, frame_listener);
-	struct weston_output *output = recorder->output;
-	struct weston_compositor *compositor = output->compositor;
-	uint32_t msecs = timespec_to_msec(&output->frame_time);
-	pixman_box32_t *r;
-	pixman_region32_t damage, transformed_damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
+	memcpy(abort_oom_if_null(wl_array_add(&recorder->payload, size)),
+	       data, size);
+}
+
+static uint32_t
+weston_recorder_write_frame(struct weston_recorder *recorder,
+			    uint32_t msecs, uint32_t flags)
+{
+	struct wcap_frame_header_v2 header;
+	struct wcap_index_entry *entry;
+	const void *data = recorder->payload.data;
+	size_t size = recorder->payload.size;
 	struct iovec v[2];
-	int do_yflip;
-	int y_orig;
-	uint32_t *outbuf;
+	ssize_t written;
 
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
+#ifdef HAVE_ZSTD
+	if (recorder->zstd) {
+		size_t bound = ZSTD_compressBound(size);
 
-	pixman_region32_init(&damage);
-	pixman_region32_init(&transformed_damage);
-	pixman_region32_intersect(&damage, &output->region, data);
-	weston_region_global_to_output(&transformed_damage,
-				       output,
-				       &damage);
-	pixman_region32_fini(&damage);
+		if (recorder->compressed_size < bound) {
+			recorder->compressed =
+				xrealloc(recorder->compressed, bound);
+			recorder->compressed_size = bound;
+		}
 
-	r = pixman_region32_rectangles(&transformed_damage, &n);
-	if (n == 0) {
-		pixman_region32_fini(&transformed_damage);
-		return;
+		size = ZSTD_compressCCtx(recorder->zstd,
+					 recorder->compressed, bound,
+					 data, recorder->payload.size,
+					 RECORDER_ZSTD_LEVEL);
+		if (ZSTD_isError(size)) {
+			weston_log("recorder: compression failed: %s\n",
+				   ZSTD_getErrorName(size));
+			return 0;
+		}
+		data = recorder->compressed;
 	}
+#endif
 
 	header.msecs = msecs;
-	header.nrects = n;
+	header.flags = flags;
+	header.size = size;
+	header.uncompressed_size = recorder->payload.size;
 	v[0].iov_base = &header;
 	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current_mode->width;
+	v[1].iov_base = (void *) data;
+	v[1].iov_len = size;
+	written = writev(recorder->fd, v, 2);
+	if (written < 0)
+		return 0;
+
+	entry = abort_oom_if_null(wl_array_add(&recorder->index,
+					       sizeof *entry));
+	entry->offset = recorder->offset;
+	entry->msecs = msecs;
+	entry->flags = flags;
+	recorder->offset += written;
+
+	return written;
+}
+
+static uint32_t
+weston_recorder_encode(struct weston_recorder *recorder,
+		       struct weston_recorder_read *read)
+{
+	pixman_box32_t *r, *extents, full;
+	int i, j, k, n, width, height, run, stride, src_stride;
+	uint32_t delta, prev, nrects, *d, *p;
+	const uint32_t *s;
+	bool keyframe;
+	int y_orig;
+
+	r = pixman_region32_rectangles(&read->damage, &n);
+	extents = pixman_region32_extents(&read->damage);
+	src_stride = extents->x2 - extents->x1;
+	stride = recorder->width;
+
+	keyframe = !recorder->have_keyframe ||
+		   read->msecs - recorder->keyframe_msecs >=
+		   RECORDER_KEYFRAME_INTERVAL_MS;
+
+	if (keyframe) {
+		/* Bring the reference frame up to date, then encode all
+		 * of it against black. */
+		for (i = 0; i < n; i++) {
+			for (y_orig = r[i].y1; y_orig < r[i].y2; y_orig++) {
+				s = read->pixels +
+				    (y_orig - extents->y1) * src_stride +
+				    (r[i].x1 - extents->x1);
+				memcpy(recorder->frame + stride * y_orig + r[i].x1,
+				       s, (r[i].x2 - r[i].x1) * 4);
+			}
+		}
+
+		full.x1 = 0;
+		full.y1 = 0;
+		full.x2 = recorder->width;
+		full.y2 = recorder->height;
+		r = &full;
+		n = 1;
+
+		recorder->have_keyframe = true;
+		recorder->keyframe_msecs = read->msecs;
+	}
+
+	recorder->payload.size = 0;
+	nrects = n;
+	recorder_payload_append(recorder, &nrects, sizeof nrects);
+	recorder_payload_append(recorder, r, n * sizeof *r);
 
 	for (i = 0; i < n; i++) {
 		width = r[i].x2 - r[i].x1;
 		height = r[i].y2 - r[i].y1;
 
-		if (do_yflip)
-			y_orig = output->current_mode->height - r[i].y2;
-		else
-			y_orig = r[i].y1;
-
-		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
-				r[i].x1, y_orig, width, height);
-
-		p = outbuf;
+		p = recorder->rect;
 		run = prev = 0; /* quiet gcc */
 		for (j = 0; j < height; j++) {
-			if (do_yflip)
-				s = recorder->rect + width * j;
-			else
-				s = recorder->rect + width * (height - j - 1);
 			y_orig = r[i].y2 - j - 1;
 			d = recorder->frame + stride * y_orig + r[i].x1;
 
+			if (keyframe) {
+				for (k = 0; k < width; k++)
+					recorder->delta[k] = d[k] & 0x00ffffff;
+			} else {
+				s = read->pixels +
+				    (y_orig - extents->y1) * src_stride +
+				    (r[i].x1 - extents->x1);
+				recorder_delta_row(recorder->delta, d, s, width);
+			}
+
 			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
+				delta = recorder->delta[k];
 				if (run == 0 || delta == prev) {
 					run++;
 				} else {
@@ -378,24 +604,188 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 
 		p = output_run(p, prev, run);
 
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
+		recorder_payload_append(recorder, recorder->rect,
+					(p - recorder->rect) * 4);
+	}
+
+	return weston_recorder_write_frame(recorder, read->msecs,
+					   keyframe ? WCAP_FRAME_KEYFRAME : 0);
+}
 
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - outbuf) * 4,
-			(float) (p - outbuf) / (width * height),
-			recorder->total / 1024 / 1024);
-#endif
+static void
+weston_recorder_write_index(struct weston_recorder *recorder)
+{
+	struct wcap_trailer trailer;
+	struct iovec v[2];
+
+	trailer.index_offset = recorder->offset;
+	trailer.count = recorder->index.size / sizeof(struct wcap_index_entry);
+	trailer.magic = WCAP_INDEX_MAGIC;
+
+	v[0].iov_base = recorder->index.data;
+	v[0].iov_len = recorder->index.size;
+	v[1].iov_base = &trailer;
+	v[1].iov_len = sizeof trailer;
+	if (writev(recorder->fd, v, 2) < 0)
+		weston_log("recorder: failed to write the frame index: %s\n",
+			   strerror(errno));
+}
+
+static void
+weston_recorder_read_free(struct weston_recorder_read *read)
+{
+	pixman_region32_fini(&read->damage);
+	free(read->pixels);
+	free(read);
+}
+
+static void *
+weston_recorder_worker(void *data)
+{
+	struct weston_recorder *recorder = data;
+	struct weston_recorder_read *read;
+	uint32_t total;
+
+	pthread_mutex_lock(&recorder->mutex);
+	for (;;) {
+		while (wl_list_empty(&recorder->queue) && !recorder->quit)
+			pthread_cond_wait(&recorder->work_cond,
+					  &recorder->mutex);
+
+		/* Only stop once everything queued is in the file. */
+		if (wl_list_empty(&recorder->queue))
+			break;
+
+		read = container_of(recorder->queue.next,
+				    struct weston_recorder_read, link);
+		wl_list_remove(&read->link);
+		recorder->queued--;
+		pthread_cond_signal(&recorder->space_cond);
+		pthread_mutex_unlock(&recorder->mutex);
+
+		total = weston_recorder_encode(recorder, read);
+		weston_recorder_read_free(read);
+
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->total += total;
+		recorder->count++;
+	}
+	pthread_mutex_unlock(&recorder->mutex);
+
+	return NULL;
+}
+
+static void
+weston_recorder_destroy(struct weston_recorder *recorder);
+
+static void
+weston_recorder_read_done(void *data, const void *pixels, int src_stride)
+{
+	struct weston_recorder_read *read = data;
+	struct weston_recorder *recorder = read->recorder;
+	pixman_box32_t *extents;
+	int width, height, row, src_row;
+
+	recorder->pending_reads--;
+	if (!pixels)
+		goto err;
+
+	/* The pixels are only ours until we return; hand the worker a
+	 * copy in output order. */
+	extents = pixman_region32_extents(&read->damage);
+	width = extents->x2 - extents->x1;
+	height = extents->y2 - extents->y1;
+	read->pixels = malloc(width * height * 4);
+	if (!read->pixels) {
+		weston_log("%s: out of memory, dropping frame\n", __func__);
+		goto err;
+	}
+
+	for (row = 0; row < height; row++) {
+		src_row = recorder->do_yflip ? height - row - 1 : row;
+		memcpy(read->pixels + row * width,
+		       (const uint8_t *) pixels + src_row * src_stride,
+		       width * 4);
+	}
+
+	pthread_mutex_lock(&recorder->mutex);
+	while (recorder->queued >= RECORDER_MAX_QUEUED)
+		pthread_cond_wait(&recorder->space_cond, &recorder->mutex);
+	wl_list_insert(recorder->queue.prev, &read->link);
+	recorder->queued++;
+	pthread_cond_signal(&recorder->work_cond);
+	pthread_mutex_unlock(&recorder->mutex);
+	goto out;
+
+err:
+	weston_recorder_read_free(read);
+out:
+	if (recorder->detached)
+		weston_recorder_destroy(recorder);
+}
+
+static void
+weston_recorder_read(struct weston_recorder *recorder,
+		     struct weston_recorder_read *read)
+{
+	struct weston_output *output = recorder->output;
+	pixman_box32_t *extents;
+	int y_orig;
+
+	/* Read the damage extents in one go, the rectangles are encoded
+	 * from it once the pixels arrive. */
+	extents = pixman_region32_extents(&read->damage);
+	if (recorder->do_yflip)
+		y_orig = output->current_mode->height - extents->y2;
+	else
+		y_orig = extents->y1;
+
+	recorder->pending_reads++;
+	weston_renderer_read_pixels_async(output,
+					  output->compositor->read_format,
+					  extents->x1, y_orig,
+					  extents->x2 - extents->x1,
+					  extents->y2 - extents->y1,
+					  weston_recorder_read_done, read);
+}
+
+static void
+weston_recorder_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct weston_recorder *recorder =
+		container_of(listener, struct weston_recorder, frame_listener);
+	struct weston_output *output = recorder->output;
+	struct weston_recorder_read *read;
+	pixman_region32_t damage;
+
+	read = xzalloc(sizeof *read);
+	read->recorder = recorder;
+	read->msecs = timespec_to_msec(&output->frame_time);
+
+	pixman_region32_init(&damage);
+	pixman_region32_init(&read->damage);
+	pixman_region32_intersect(&damage, &output->region, data);
+	weston_region_global_to_output(&read->damage,
+				       output,
+				       &damage);
+	pixman_region32_fini(&damage);
+
+	if (recorder->destroying) {
+		wl_list_remove(&recorder->frame_listener.link);
+		weston_output_disable_planes_decr(output);
 	}
 
-	pixman_region32_fini(&transformed_damage);
-	recorder->count++;
+	if (pixman_region32_not_empty(&read->damage)) {
+		weston_recorder_read(recorder, read);
+	} else {
+		pixman_region32_fini(&read->damage);
+		free(read);
+	}
 
-	if (recorder->destroying)
+	if (recorder->destroying) {
+		recorder->detached = true;
 		weston_recorder_destroy(recorder);
+	}
 }
 
 static void
@@ -404,7 +794,16 @@ weston_recorder_free(struct weston_recorder *recorder)
 	if (recorder == NULL)
 		return;
 
-	free(recorder->tmpbuf);
+	pthread_cond_destroy(&recorder->space_cond);
+	pthread_cond_destroy(&recorder->work_cond);
+	pthread_mutex_destroy(&recorder->mutex);
+#ifdef HAVE_ZSTD
+	ZSTD_freeCCtx(recorder->zstd);
+	free(recorder->compressed);
+#endif
+	wl_array_release(&recorder->index);
+	wl_array_release(&recorder->payload);
+	free(recorder->delta);
 	free(recorder->rect);
 	free(recorder->frame);
 	free(recorder);
@@ -416,10 +815,9 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_recorder *recorder;
 	int stride, size;
-	struct { uint32_t magic, format, width, height; } header;
-	int do_yflip;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	struct wcap_header_v2 header = { 0 };
+	sigset_t blocked, saved;
+	int ret;
 
 	recorder = zalloc(sizeof *recorder);
 	if (recorder == NULL) {
@@ -427,26 +825,38 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		return NULL;
 	}
 
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->work_cond, NULL);
+	pthread_cond_init(&recorder->space_cond, NULL);
+	wl_list_init(&recorder->queue);
+	wl_array_init(&recorder->payload);
+	wl_array_init(&recorder->index);
+
+	recorder->do_yflip =
+		!!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
 	stride = output->current_mode->width;
 	size = stride * 4 * output->current_mode->height;
+	recorder->width = stride;
+	recorder->height = output->current_mode->height;
 	recorder->frame = zalloc(size);
 	recorder->rect = malloc(size);
+	recorder->delta = malloc(stride * 4);
 	recorder->output = output;
 
-	if ((recorder->frame == NULL) || (recorder->rect == NULL)) {
+	if ((recorder->frame == NULL) || (recorder->rect == NULL) ||
+	    (recorder->delta == NULL)) {
 		weston_log("%s: out of memory\n", __func__);
 		goto err_recorder;
 	}
 
-	if (!do_yflip) {
-		recorder->tmpbuf = malloc(size);
-		if (recorder->tmpbuf == NULL) {
-			weston_log("%s: out of memory\n", __func__);
-			goto err_recorder;
-		}
-	}
-
-	header.magic = WCAP_HEADER_MAGIC;
+	header.magic = WCAP_HEADER_MAGIC_V2;
+	header.compression = WCAP_COMPRESSION_NONE;
+#ifdef HAVE_ZSTD
+	recorder->zstd = ZSTD_createCCtx();
+	if (recorder->zstd)
+		header.compression = WCAP_COMPRESSION_ZSTD;
+#endif
 
 	switch (compositor->read_format->pixman_format) {
 	case PIXMAN_x8r8g8b8:
@@ -473,6 +883,21 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	header.width = output->current_mode->width;
 	header.height = output->current_mode->height;
 	recorder->total += write(recorder->fd, &header, sizeof header);
+	recorder->offset = sizeof header;
+
+	/* Leave signal handling to the main loop. */
+	sigfillset(&blocked);
+	pthread_sigmask(SIG_BLOCK, &blocked, &saved);
+	ret = pthread_create(&recorder->thread, NULL,
+			     weston_recorder_worker, recorder);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (ret != 0) {
+		weston_log("failed to start the recorder thread: %s\n",
+			   strerror(ret));
+		close(recorder->fd);
+		goto err_recorder;
+	}
+	recorder->thread_running = true;
 
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
@@ -489,9 +914,21 @@ err_recorder:
 static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
-	wl_list_remove(&recorder->frame_listener.link);
+	/* Read backs still in flight write to the file, the last one to
+	 * complete finishes the destruction. */
+	if (recorder->pending_reads > 0)
+		return;
+
+	if (recorder->thread_running) {
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->quit = true;
+		pthread_cond_signal(&recorder->work_cond);
+		pthread_mutex_unlock(&recorder->mutex);
+		pthread_join(recorder->thread, NULL);
+		weston_recorder_write_index(recorder);
+	}
+
 	close(recorder->fd);
-	weston_output_disable_planes_decr(recorder->output);
 	weston_recorder_free(recorder);
 }
 
@@ -516,8 +953,10 @@ weston_recorder_start(struct weston_output *output, const char *filename)
 WL_EXPORT void
 weston_recorder_stop(struct weston_recorder *recorder)
 {
+	pthread_mutex_lock(&recorder->mutex);
 	weston_log("stopping recorder, total file size %dM, %d frames\n",
 		   recorder->total / (1024 * 1024), recorder->count);
+	pthread_mutex_unlock(&recorder->mutex);
 
 	recorder->destroying = 1;
 	weston_output_schedule_repaint(recorder->output);
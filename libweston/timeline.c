@@ -36,6 +36,10 @@
 #include <libweston/weston-log.h>
 #include "timeline.h"
 #include "weston-log-internal.h"
+#include "shared/timespec-util.h"
+
+/** Binary records between two descriptions of the same object */
+#define TIMELINE_BINARY_DESCRIBE_INTERVAL 16384
 
 /**
  * Timeline itself is not a subscriber but a scope (a producer of data), and it
@@ -221,6 +225,24 @@ weston_timeline_subscription_surface_ensure(struct weston_timeline_subscription
 	return sub_obj;
 }
 
+static struct weston_timeline_subscription_object *
+weston_timeline_subscription_name_ensure(struct weston_timeline_subscription *tl_sub,
+					 const char *name)
+{
+	struct weston_timeline_subscription_object *sub_obj;
+
+	/* point names are string literals, so the pointer identifies them;
+	 * they live forever and need no destroy listener */
+	sub_obj = weston_timeline_subscription_search(tl_sub, (void *) name);
+	if (!sub_obj) {
+		sub_obj = weston_timeline_subscription_object_create((void *) name,
+								     tl_sub);
+		wl_list_init(&sub_obj->destroy_listener.link);
+	}
+
+	return sub_obj;
+}
+
 static void
 fprint_quoted_string(struct weston_log_subscription *sub, const char *str)
 {
@@ -385,6 +407,140 @@ weston_timeline_refresh_subscription_objects(struct weston_compositor *wc,
 	}
 }
 
+static bool
+weston_timeline_binary_check_description(struct weston_timeline_subscription *tl_sub,
+					  struct weston_timeline_subscription_object *sub_obj)
+{
+	if (!weston_timeline_check_object_refresh(sub_obj) &&
+	    tl_sub->records - sub_obj->described_at <
+	    TIMELINE_BINARY_DESCRIBE_INTERVAL)
+		return false;
+
+	sub_obj->described_at = tl_sub->records;
+	return true;
+}
+
+static void
+emit_binary_record(struct weston_log_subscription *sub,
+		   struct weston_timeline_subscription *tl_sub,
+		   const struct weston_timeline_record *rec)
+{
+	weston_log_subscription_write(sub, (const char *) rec, sizeof(*rec));
+	tl_sub->records++;
+}
+
+static void
+emit_binary_description(struct weston_log_subscription *sub,
+			struct weston_timeline_subscription *tl_sub,
+			enum weston_timeline_record_type type,
+			struct weston_timeline_subscription_object *sub_obj,
+			uint32_t parent, const char *label, uint64_t timestamp)
+{
+	struct weston_timeline_record rec = {
+		.type = type,
+		.id = sub_obj->id,
+		.timestamp = timestamp,
+	};
+
+	rec.object.parent = parent;
+	if (label)
+		snprintf(rec.object.label, sizeof(rec.object.label), "%s", label);
+
+	emit_binary_record(sub, tl_sub, &rec);
+}
+
+static uint32_t
+emit_binary_surface(struct weston_log_subscription *sub,
+		    struct weston_timeline_subscription *tl_sub,
+		    struct weston_surface *s, uint64_t timestamp)
+{
+	struct weston_timeline_subscription_object *sub_obj;
+	struct weston_surface *mains;
+	uint32_t parent = 0;
+	char d[512];
+
+	mains = weston_surface_get_main_surface(s);
+	if (mains != s)
+		parent = emit_binary_surface(sub, tl_sub, mains, timestamp);
+
+	sub_obj = weston_timeline_subscription_surface_ensure(tl_sub, s);
+	assert(sub_obj->id != 0);
+	if (weston_timeline_binary_check_description(tl_sub, sub_obj)) {
+		if (!s->get_label || s->get_label(s, d, sizeof(d)) < 0)
+			d[0] = '\0';
+		emit_binary_description(sub, tl_sub,
+					WESTON_TIMELINE_RECORD_SURFACE, sub_obj,
+					parent, d, timestamp);
+	}
+
+	return sub_obj->id;
+}
+
+/** Write one timeline point as a binary record, preceded by the
+ * descriptions of the name and objects it refers to where needed.
+ */
+static void
+weston_timeline_point_binary(struct weston_log_subscription *sub,
+			     const struct timespec *ts, const char *name,
+			     va_list argp)
+{
+	struct weston_timeline_subscription *tl_sub;
+	struct weston_timeline_subscription_object *sub_obj;
+	struct weston_timeline_record rec = {};
+	struct weston_output *output;
+	uint64_t timestamp = timespec_to_nsec(ts);
+	enum timeline_type otype;
+	void *obj;
+
+	tl_sub = weston_log_subscription_get_data(sub);
+	if (!tl_sub)
+		return;
+
+	sub_obj = weston_timeline_subscription_name_ensure(tl_sub, name);
+	if (weston_timeline_binary_check_description(tl_sub, sub_obj))
+		emit_binary_description(sub, tl_sub, WESTON_TIMELINE_RECORD_NAME,
+					sub_obj, 0, name, timestamp);
+
+	rec.type = WESTON_TIMELINE_RECORD_POINT;
+	rec.id = sub_obj->id;
+	rec.timestamp = timestamp;
+
+	while (1) {
+		otype = va_arg(argp, enum timeline_type);
+		if (otype == TLT_END)
+			break;
+
+		obj = va_arg(argp, void *);
+		switch (otype) {
+		case TLT_OUTPUT:
+			output = obj;
+			sub_obj = weston_timeline_subscription_output_ensure(tl_sub,
+									     output);
+			if (weston_timeline_binary_check_description(tl_sub, sub_obj))
+				emit_binary_description(sub, tl_sub,
+							WESTON_TIMELINE_RECORD_OUTPUT,
+							sub_obj, 0, output->name,
+							timestamp);
+			rec.point.output = sub_obj->id;
+			break;
+		case TLT_SURFACE:
+			rec.point.surface = emit_binary_surface(sub, tl_sub, obj,
+								timestamp);
+			break;
+		case TLT_VBLANK:
+			rec.point.vblank = timespec_to_nsec(obj);
+			break;
+		case TLT_GPU:
+			rec.point.gpu = timespec_to_nsec(obj);
+			break;
+		case TLT_END:
+			break;
+		}
+	}
+
+	emit_binary_record(sub, tl_sub, &rec);
+}
+
 typedef int (*type_func)(struct timeline_emit_context *ctx, void *obj);
 
 static const type_func type_dispatch[] = {
@@ -400,9 +556,12 @@ static const type_func type_dispatch[] = {
  * The TL_POINT() is a wrapper over this function, but it  uses the weston_compositor
  * instance to pass the timeline scope.
  *
+ * Subscriptions taking binary data get a struct weston_timeline_record
+ * instead of a line of JSON.
+ *
  * @param timeline_scope the timeline scope
  * @param name the name of the timeline point. Interpretable by the tool reading
- * the output (wesgr).
+ * the output (wesgr). Must be a string literal.
  *
  * @ingroup log
  */
@@ -416,7 +575,7 @@ weston_timeline_point(struct weston_log_scope *timeline_scope,
 	char buf[512];
 	struct weston_log_subscription *sub = NULL;
 
-	if (!weston_log_scope_is_enabled(timeline_scope))
+	if (!weston_log_scope_enabled(timeline_scope))
 		return;
 
 	clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -425,6 +584,13 @@ weston_timeline_point(struct weston_log_scope *timeline_scope,
 		va_list argp;
 		struct timeline_emit_context ctx = {};
 
+		if (weston_log_subscription_is_binary(sub)) {
+			va_start(argp, name);
+			weston_timeline_point_binary(sub, &ts, name, argp);
+			va_end(argp);
+			continue;
+		}
+
 		memset(buf, 0, sizeof(buf));
 		ctx.cur = fmemopen(buf, sizeof(buf), "w");
 		ctx.subscription = sub;
@@ -28,7 +28,9 @@
 #define WESTON_TIMELINE_H
 
 #include <wayland-util.h>
+#include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <libweston/weston-log.h>
 #include <wayland-server-core.h>
@@ -43,6 +45,51 @@ enum timeline_type {
 	TLT_GPU,
 };
 
+/** Kinds of records in the binary timeline encoding
+ *
+ * @ingroup internal-log
+ */
+enum weston_timeline_record_type {
+	WESTON_TIMELINE_RECORD_NAME = 1,	/**< a timeline point name */
+	WESTON_TIMELINE_RECORD_OUTPUT,		/**< a weston_output */
+	WESTON_TIMELINE_RECORD_SURFACE,		/**< a weston_surface */
+	WESTON_TIMELINE_RECORD_POINT,		/**< a timeline point */
+};
+
+#define WESTON_TIMELINE_RECORD_LABEL_LEN 44
+
+/** Fixed-size record of the binary timeline encoding, written to
+ * subscribers that take binary data instead of the JSON wesgr reads.
+ *
+ * Names, outputs and surfaces get an ID, described by a record of their
+ * own before the first point referring to them, and again now and then
+ * so that a ring holding the most recent records can still resolve them.
+ * Native byte order; tools/timeline-to-trace.py reads these.
+ *
+ * @ingroup internal-log
+ */
+struct weston_timeline_record {
+	uint32_t type;		/**< enum weston_timeline_record_type */
+	uint32_t id;		/**< object or name ID; for points, the name ID */
+	uint64_t timestamp;	/**< CLOCK_MONOTONIC, in nanoseconds */
+	union {
+		struct {
+			uint32_t output;	/**< output ID, or 0 */
+			uint32_t surface;	/**< surface ID, or 0 */
+			uint64_t vblank;	/**< in nanoseconds, or 0 */
+			uint64_t gpu;		/**< in nanoseconds, or 0 */
+			uint8_t pad[24];
+		} point;
+		struct {
+			uint32_t parent;	/**< main surface ID, or 0 */
+			char label[WESTON_TIMELINE_RECORD_LABEL_LEN];
+		} object;
+	};
+};
+
+static_assert(sizeof(struct weston_timeline_record) == 64,
+	      "binary timeline records are 64 bytes");
+
 /** Timeline subscription created for each subscription
  *
  * Created automatically by weston_log_scope::new_subscription and
@@ -53,6 +100,7 @@ enum timeline_type {
 struct weston_timeline_subscription {
 	unsigned int next_id;
 	struct wl_list objects; /**< weston_timeline_subscription_object::subscription_link */
+	uint64_t records;	/**< binary records written */
 };
 
 /**
@@ -65,6 +113,7 @@ struct weston_timeline_subscription_object {
 	void *object;                           /**< points to the object */
 	unsigned int id;
 	bool force_refresh;
+	uint64_t described_at;	/**< record count when last described, binary only */
 	struct wl_list subscription_link;       /**< weston_timeline_subscription::objects */
 	struct wl_listener destroy_listener;
 };
@@ -90,7 +139,8 @@ struct weston_timeline_subscription_object {
  * @ingroup log
  */
 #define TL_POINT(ec, ...) do { \
-	weston_timeline_point(ec->timeline, __VA_ARGS__); \
+	if (weston_log_scope_enabled(ec->timeline)) \
+		weston_timeline_point(ec->timeline, __VA_ARGS__); \
 } while (0)
 
 void
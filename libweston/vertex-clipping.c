@@ -28,6 +28,7 @@
 #include <string.h>
 
 #include "shared/helpers.h"
+#include "shared/simd.h"
 #include "vertex-clipping.h"
 
 struct clip_context {
@@ -291,6 +292,29 @@ clip_polygon_bottom(struct clip_context *ctx, const struct polygon8 *src,
 	return ctx->vertices - dst;
 }
 
+/* Get rid of duplicate vertices. */
+static int
+clip_remove_duplicates(const struct polygon8 *p,
+		       struct clipper_vertex *restrict vertices)
+{
+	int i, n;
+
+	vertices[0] = p->pos[0];
+	n = 1;
+	for (i = 1; i < p->n; i++) {
+		if (clipper_float_difference(vertices[n - 1].x, p->pos[i].x) == 0.0f &&
+		    clipper_float_difference(vertices[n - 1].y, p->pos[i].y) == 0.0f)
+			continue;
+		vertices[n] = p->pos[i];
+		n++;
+	}
+	if (clipper_float_difference(vertices[n - 1].x, p->pos[0].x) == 0.0f &&
+	    clipper_float_difference(vertices[n - 1].y, p->pos[0].y) == 0.0f)
+		n--;
+
+	return n;
+}
+
 /* General purpose clipping function. Compute the boundary vertices of the
  * intersection of a 'polygon' and a clipping 'box'. 'polygon' points to an
  * array of 4 vertices defining a convex polygon of any winding order. 'box'
@@ -309,7 +333,6 @@ clip(const struct clipper_vertex polygon[4],
 {
 	struct clip_context ctx;
 	struct polygon8 p, tmp;
-	int i, n;
 
 	memcpy(ctx.box, box, 2 * sizeof *box);
 	memcpy(p.pos, polygon, 4 * sizeof *polygon);
@@ -319,21 +342,7 @@ clip(const struct clipper_vertex polygon[4],
 	tmp.n = clip_polygon_top(&ctx, &p, tmp.pos);
 	p.n = clip_polygon_bottom(&ctx, &tmp, p.pos);
 
-	/* Get rid of duplicate vertices */
-	vertices[0] = p.pos[0];
-	n = 1;
-	for (i = 1; i < p.n; i++) {
-		if (clipper_float_difference(vertices[n - 1].x, p.pos[i].x) == 0.0f &&
-		    clipper_float_difference(vertices[n - 1].y, p.pos[i].y) == 0.0f)
-			continue;
-		vertices[n] = p.pos[i];
-		n++;
-	}
-	if (clipper_float_difference(vertices[n - 1].x, p.pos[0].x) == 0.0f &&
-	    clipper_float_difference(vertices[n - 1].y, p.pos[0].y) == 0.0f)
-		n--;
-
-	return n;
+	return clip_remove_duplicates(&p, vertices);
 }
 
 WESTON_EXPORT_FOR_TESTS void
@@ -360,36 +369,184 @@ clipper_quad_init(struct clipper_quad *quad,
 	}
 }
 
-WESTON_EXPORT_FOR_TESTS int
-clipper_quad_clip(struct clipper_quad *quad,
+/* Aligned case: quad edges are parallel to clipping box edges, there will be
+ * either four or zero edges. We just need to clamp the quad edges to the
+ * clipping box edges and test for non-zero area.
+ */
+static int
+clip_aligned(const struct clipper_quad *quad,
+	     const struct clipper_vertex box[2],
+	     struct clipper_vertex *restrict vertices)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		vertices[i].x = CLIP(quad->polygon[i].x, box[0].x, box[1].x);
+		vertices[i].y = CLIP(quad->polygon[i].y, box[0].y, box[1].y);
+	}
+
+	if ((vertices[0].x != vertices[2].x) &&
+	    (vertices[0].y != vertices[2].y))
+		return 4;
+	else
+		return 0;
+}
+
+/* Simple bounding box check to discard early an unaligned quad that does not
+ * intersect with the clipping box.
+ */
+static bool
+clip_bbox_rejects(const struct clipper_quad *quad,
+		  const struct clipper_vertex box[2])
+{
+	return (quad->bbox[0].x >= box[1].x) || (quad->bbox[1].x <= box[0].x) ||
+	       (quad->bbox[0].y >= box[1].y) || (quad->bbox[1].y <= box[0].y);
+}
+
+#if defined(WESTON_SIMD_SSE2)
+
+/* The vector versions compute exactly what the scalar ones do: the min/max
+ * and comparison instructions have the same operand order and NaN handling
+ * as the MIN(), MAX() and CLIP() macros and the C comparisons.
+ */
+static int
+clip_aligned_simd(const struct clipper_quad *quad,
 		  const struct clipper_vertex box[2],
 		  struct clipper_vertex *restrict vertices)
 {
-	int i, n;
+	__m128 lo = _mm_setr_ps(box[0].x, box[0].y, box[0].x, box[0].y);
+	__m128 hi = _mm_setr_ps(box[1].x, box[1].y, box[1].x, box[1].y);
+	__m128 v01 = _mm_loadu_ps(&quad->polygon[0].x);
+	__m128 v23 = _mm_loadu_ps(&quad->polygon[2].x);
+
+	_mm_storeu_ps(&vertices[0].x, _mm_min_ps(_mm_max_ps(v01, lo), hi));
+	_mm_storeu_ps(&vertices[2].x, _mm_min_ps(_mm_max_ps(v23, lo), hi));
+
+	if ((vertices[0].x != vertices[2].x) &&
+	    (vertices[0].y != vertices[2].y))
+		return 4;
+	else
+		return 0;
+}
 
-	/* Aligned case: quad edges are parallel to clipping box edges, there
-	 * will be either four or zero edges. We just need to clamp the quad
-	 * edges to the clipping box edges and test for non-zero area:
-	 */
-	if (quad->axis_aligned) {
-		for (i = 0; i < 4; i++) {
-			vertices[i].x = CLIP(quad->polygon[i].x,
-					     box[0].x, box[1].x);
-			vertices[i].y = CLIP(quad->polygon[i].y,
-					     box[0].y, box[1].y);
-		}
-		if ((vertices[0].x != vertices[2].x) &&
-		    (vertices[0].y != vertices[2].y))
-			return 4;
-		else
+static bool
+clip_bbox_rejects_simd(const struct clipper_quad *quad,
+		       const struct clipper_vertex box[2])
+{
+	__m128 a = _mm_setr_ps(quad->bbox[0].x, quad->bbox[0].y,
+			       box[0].x, box[0].y);
+	__m128 b = _mm_setr_ps(box[1].x, box[1].y,
+			       quad->bbox[1].x, quad->bbox[1].y);
+
+	return _mm_movemask_ps(_mm_cmpge_ps(a, b)) != 0;
+}
+
+/* Whether all the quad vertices are inside the clipping box, using the same
+ * inclusive left/top and exclusive right/bottom tests as the clipper.
+ */
+static bool
+clip_quad_inside_simd(const struct clipper_quad *quad,
+		      const struct clipper_vertex box[2])
+{
+	__m128 v01 = _mm_loadu_ps(&quad->polygon[0].x);
+	__m128 v23 = _mm_loadu_ps(&quad->polygon[2].x);
+	__m128 x = _mm_shuffle_ps(v01, v23, _MM_SHUFFLE(2, 0, 2, 0));
+	__m128 y = _mm_shuffle_ps(v01, v23, _MM_SHUFFLE(3, 1, 3, 1));
+	__m128 in;
+
+	in = _mm_and_ps(_mm_cmpge_ps(x, _mm_set1_ps(box[0].x)),
+			_mm_cmplt_ps(x, _mm_set1_ps(box[1].x)));
+	in = _mm_and_ps(in, _mm_cmpge_ps(y, _mm_set1_ps(box[0].y)));
+	in = _mm_and_ps(in, _mm_cmplt_ps(y, _mm_set1_ps(box[1].y)));
+
+	return _mm_movemask_ps(in) == 0xf;
+}
+
+#elif defined(WESTON_SIMD_NEON)
+
+static int
+clip_aligned_simd(const struct clipper_quad *quad,
+		  const struct clipper_vertex box[2],
+		  struct clipper_vertex *restrict vertices)
+{
+	float32x2_t lo2 = vld1_f32(&box[0].x);
+	float32x2_t hi2 = vld1_f32(&box[1].x);
+	float32x4_t lo = vcombine_f32(lo2, lo2);
+	float32x4_t hi = vcombine_f32(hi2, hi2);
+	float32x4_t v01 = vld1q_f32(&quad->polygon[0].x);
+	float32x4_t v23 = vld1q_f32(&quad->polygon[2].x);
+
+	vst1q_f32(&vertices[0].x, vminq_f32(vmaxq_f32(v01, lo), hi));
+	vst1q_f32(&vertices[2].x, vminq_f32(vmaxq_f32(v23, lo), hi));
+
+	if ((vertices[0].x != vertices[2].x) &&
+	    (vertices[0].y != vertices[2].y))
+		return 4;
+	else
+		return 0;
+}
+
+static bool
+clip_bbox_rejects_simd(const struct clipper_quad *quad,
+		       const struct clipper_vertex box[2])
+{
+	float32x4_t a = vcombine_f32(vld1_f32(&quad->bbox[0].x),
+				     vld1_f32(&box[0].x));
+	float32x4_t b = vcombine_f32(vld1_f32(&box[1].x),
+				     vld1_f32(&quad->bbox[1].x));
+
+	return vmaxvq_u32(vcgeq_f32(a, b)) != 0;
+}
+
+static bool
+clip_quad_inside_simd(const struct clipper_quad *quad,
+		      const struct clipper_vertex box[2])
+{
+	float32x4x2_t v = vld2q_f32(&quad->polygon[0].x);
+	uint32x4_t in;
+
+	in = vandq_u32(vcgeq_f32(v.val[0], vdupq_n_f32(box[0].x)),
+		       vcltq_f32(v.val[0], vdupq_n_f32(box[1].x)));
+	in = vandq_u32(in, vcgeq_f32(v.val[1], vdupq_n_f32(box[0].y)));
+	in = vandq_u32(in, vcltq_f32(v.val[1], vdupq_n_f32(box[1].y)));
+
+	return vminvq_u32(in) != 0;
+}
+
+#endif
+
+static int
+clip_quad(const struct clipper_quad *quad,
+	  const struct clipper_vertex box[2],
+	  struct clipper_vertex *restrict vertices,
+	  bool use_simd)
+{
+	struct polygon8 p;
+	int n;
+
+#if defined(WESTON_HAVE_SIMD)
+	if (use_simd) {
+		if (quad->axis_aligned)
+			return clip_aligned_simd(quad, box, vertices);
+
+		if (clip_bbox_rejects_simd(quad, box))
 			return 0;
+
+		/* A quad inside the clipping box goes through every clipping
+		 * pass unchanged, skip them. */
+		if (clip_quad_inside_simd(quad, box)) {
+			memcpy(p.pos, quad->polygon, 4 * sizeof *p.pos);
+			p.n = 4;
+			n = clip_remove_duplicates(&p, vertices);
+			return n < 3 ? 0 : n;
+		}
 	}
+#endif
 
-	/* Unaligned case: first, simple bounding box check to discard early a
-	 * quad that does not intersect with the clipping box:
-	 */
-	if ((quad->bbox[0].x >= box[1].x) || (quad->bbox[1].x <= box[0].x) ||
-	    (quad->bbox[0].y >= box[1].y) || (quad->bbox[1].y <= box[0].y))
+	if (quad->axis_aligned)
+		return clip_aligned(quad, box, vertices);
+
+	if (clip_bbox_rejects(quad, box))
 		return 0;
 
 	/* Then use our general purpose clipping algorithm:
@@ -402,6 +559,22 @@ clipper_quad_clip(struct clipper_quad *quad,
 	return n;
 }
 
+WESTON_EXPORT_FOR_TESTS int
+clipper_quad_clip(struct clipper_quad *quad,
+		  const struct clipper_vertex box[2],
+		  struct clipper_vertex *restrict vertices)
+{
+	return clip_quad(quad, box, vertices, true);
+}
+
+WESTON_EXPORT_FOR_TESTS int
+clipper_quad_clip_scalar(struct clipper_quad *quad,
+			 const struct clipper_vertex box[2],
+			 struct clipper_vertex *restrict vertices)
+{
+	return clip_quad(quad, box, vertices, false);
+}
+
 WESTON_EXPORT_FOR_TESTS int
 clipper_quad_clip_box32(struct clipper_quad *quad,
 			const struct pixman_box32 *box,
@@ -66,6 +66,15 @@ clipper_quad_clip(struct clipper_quad *quad,
 		  const struct clipper_vertex box[2],
 		  struct clipper_vertex *restrict vertices);
 
+/*
+ * Same as 'clipper_quad_clip()' but never using the SSE2 or NEON fast paths.
+ * This is the reference the vector code is tested against.
+ */
+int
+clipper_quad_clip_scalar(struct clipper_quad *quad,
+			 const struct clipper_vertex box[2],
+			 struct clipper_vertex *restrict vertices);
+
 /*
  * Utility function calling 'clipper_quad_clip()' but taking a pixman_box32
  * pointer as clipping box.
@@ -32,6 +32,11 @@
 #include "weston-log-internal.h"
 
 #include <stdio.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 /** File type of stream
  */
@@ -88,6 +93,7 @@ weston_log_subscriber_create_log(FILE *dump_to)
 
 
 	file->base.write = weston_log_file_write;
+	file->base.record = NULL;
 	file->base.destroy = weston_log_subscriber_destroy_log;
 	file->base.destroy_subscription = NULL;
 	file->base.complete = NULL;
@@ -96,3 +102,252 @@ weston_log_subscriber_create_log(FILE *dump_to)
 
 	return &file->base;
 }
+
+/** Records in the queue of the asynchronous log are aligned to this */
+#define WESTON_LOG_QUEUE_ALIGN 16
+
+enum weston_log_queue_record_state {
+	WESTON_LOG_QUEUE_EMPTY = 0,	/**< reserved, not written yet */
+	WESTON_LOG_QUEUE_DATA,		/**< bytes to write out */
+	WESTON_LOG_QUEUE_PAD,		/**< filler up to the end of the queue */
+};
+
+/** Header of a queue record, as large as WESTON_LOG_QUEUE_ALIGN */
+struct weston_log_queue_record {
+	uint32_t len;		/**< record length, header and padding included */
+	uint32_t state;		/**< enum weston_log_queue_record_state */
+	uint32_t size;		/**< payload length, without padding */
+	uint32_t reserved;
+};
+
+/** File type of stream, written out by a thread of its own
+ *
+ * Writers reserve room in a byte queue by moving head forward with a
+ * compare-and-swap, copy their data in and publish the record by setting
+ * its state. The writer thread consumes published records in order from
+ * tail. Neither side takes a lock; when the queue is full, messages are
+ * dropped and counted rather than waiting for the disk.
+ */
+struct weston_debug_log_file_async {
+	struct weston_log_subscriber base;
+	FILE *file;
+
+	char *buf;
+	uint32_t size;
+	uint64_t head;		/**< bytes reserved since creation */
+	uint64_t tail;		/**< bytes consumed since creation */
+	uint64_t dropped;	/**< messages that did not fit */
+	uint64_t dropped_reported;
+
+	pthread_t thread;
+	sem_t wake;
+	bool quit;
+};
+
+static struct weston_debug_log_file_async *
+to_weston_debug_log_file_async(struct weston_log_subscriber *sub)
+{
+	return container_of(sub, struct weston_debug_log_file_async, base);
+}
+
+static struct weston_log_queue_record *
+log_queue_record_at(struct weston_debug_log_file_async *stream, uint64_t pos)
+{
+	return (struct weston_log_queue_record *) &stream->buf[pos % stream->size];
+}
+
+static void
+weston_log_file_async_write(struct weston_log_subscriber *sub,
+			    const char *data, size_t len)
+{
+	struct weston_debug_log_file_async *stream =
+		to_weston_debug_log_file_async(sub);
+	struct weston_log_queue_record *rec;
+	uint64_t head, tail, pad;
+	uint32_t need, off;
+
+	if (len > stream->size / 2) {
+		__atomic_fetch_add(&stream->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	need = ROUND_UP_N(sizeof(*rec) + len, WESTON_LOG_QUEUE_ALIGN);
+
+	head = __atomic_load_n(&stream->head, __ATOMIC_RELAXED);
+	do {
+		tail = __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE);
+		off = head % stream->size;
+		/* Records never wrap; pad to the start of the queue. */
+		pad = off + need > stream->size ? stream->size - off : 0;
+
+		if (head + pad + need - tail > stream->size) {
+			__atomic_fetch_add(&stream->dropped, 1,
+					   __ATOMIC_RELAXED);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&stream->head, &head,
+					      head + pad + need, false,
+					      __ATOMIC_ACQ_REL,
+					      __ATOMIC_RELAXED));
+
+	if (pad) {
+		rec = log_queue_record_at(stream, head);
+		rec->len = pad;
+		rec->size = 0;
+		__atomic_store_n(&rec->state, WESTON_LOG_QUEUE_PAD,
+				 __ATOMIC_RELEASE);
+		head += pad;
+	}
+
+	rec = log_queue_record_at(stream, head);
+	rec->len = need;
+	rec->size = len;
+	memcpy(rec + 1, data, len);
+	__atomic_store_n(&rec->state, WESTON_LOG_QUEUE_DATA, __ATOMIC_RELEASE);
+
+	sem_post(&stream->wake);
+}
+
+/* Write out every record published so far. Only called from the writer
+ * thread, or once it has stopped. */
+static void
+weston_log_file_async_drain(struct weston_debug_log_file_async *stream)
+{
+	struct weston_log_queue_record *rec;
+	uint64_t tail = stream->tail;
+	uint64_t dropped;
+	uint32_t state, len;
+
+	for (;;) {
+		if (tail == __atomic_load_n(&stream->head, __ATOMIC_ACQUIRE))
+			break;
+
+		rec = log_queue_record_at(stream, tail);
+		state = __atomic_load_n(&rec->state, __ATOMIC_ACQUIRE);
+		if (state == WESTON_LOG_QUEUE_EMPTY)
+			break;
+
+		if (state == WESTON_LOG_QUEUE_DATA)
+			fwrite(rec + 1, rec->size, 1, stream->file);
+
+		/* Clear the whole record, so that a record reserved here
+		 * later reads as unpublished until its writer is done. */
+		len = rec->len;
+		memset(rec, 0, len);
+		tail += len;
+		__atomic_store_n(&stream->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	dropped = __atomic_load_n(&stream->dropped, __ATOMIC_RELAXED);
+	if (dropped != stream->dropped_reported) {
+		fprintf(stream->file, "[%" PRIu64 " log messages dropped]\n",
+			dropped - stream->dropped_reported);
+		stream->dropped_reported = dropped;
+	}
+
+	fflush(stream->file);
+}
+
+static void *
+weston_log_file_async_thread(void *data)
+{
+	struct weston_debug_log_file_async *stream = data;
+
+	for (;;) {
+		while (sem_wait(&stream->wake) < 0)
+			;
+
+		/* Take every wake-up already posted: one drain covers all
+		 * of them. */
+		while (sem_trywait(&stream->wake) == 0)
+			;
+
+		weston_log_file_async_drain(stream);
+
+		if (__atomic_load_n(&stream->quit, __ATOMIC_ACQUIRE))
+			break;
+	}
+
+	return NULL;
+}
+
+static void
+weston_log_subscriber_destroy_log_async(struct weston_log_subscriber *subscriber)
+{
+	struct weston_debug_log_file_async *stream =
+		to_weston_debug_log_file_async(subscriber);
+
+	weston_log_subscriber_release(subscriber);
+
+	__atomic_store_n(&stream->quit, true, __ATOMIC_RELEASE);
+	sem_post(&stream->wake);
+	pthread_join(stream->thread, NULL);
+
+	/* Anything published after the thread's last look. */
+	weston_log_file_async_drain(stream);
+
+	sem_destroy(&stream->wake);
+	free(stream->buf);
+	free(stream);
+}
+
+/** Creates a file type of subscriber that writes from a thread
+ *
+ * Like weston_log_subscriber_create_log(), but the caller only copies its
+ * messages into a queue of @p size bytes, and a thread of the subscriber
+ * writes them to the file. A slow file then no longer stalls the
+ * compositor. Messages that find the queue full are dropped; their number
+ * is written to the file once there is room again.
+ *
+ * Should be destroyed using weston_log_subscriber_destroy(), which writes
+ * out what is still queued.
+ *
+ * @param dump_to if specified, used for writing data to
+ * @param size size of the queue in bytes
+ * @returns a weston_log_subscriber object or NULL in case of failure
+ *
+ * @sa weston_log_subscriber_destroy
+ */
+WL_EXPORT struct weston_log_subscriber *
+weston_log_subscriber_create_log_async(FILE *dump_to, size_t size)
+{
+	struct weston_debug_log_file_async *stream;
+
+	if (size < 4096 || size > UINT32_MAX)
+		return NULL;
+
+	stream = zalloc(sizeof(*stream));
+	if (!stream)
+		return NULL;
+
+	stream->file = dump_to ? dump_to : stderr;
+	stream->size = size & ~(uint32_t) (WESTON_LOG_QUEUE_ALIGN - 1);
+	stream->buf = zalloc(stream->size);
+	if (!stream->buf)
+		goto err_stream;
+
+	if (sem_init(&stream->wake, 0, 0) < 0)
+		goto err_buf;
+
+	if (pthread_create(&stream->thread, NULL,
+			   weston_log_file_async_thread, stream) != 0)
+		goto err_sem;
+
+	stream->base.write = weston_log_file_async_write;
+	stream->base.record = NULL;
+	stream->base.destroy = weston_log_subscriber_destroy_log_async;
+	stream->base.destroy_subscription = NULL;
+	stream->base.complete = NULL;
+
+	wl_list_init(&stream->base.subscription_list);
+
+	return &stream->base;
+
+err_sem:
+	sem_destroy(&stream->wake);
+err_buf:
+	free(stream->buf);
+err_stream:
+	free(stream);
+	return NULL;
+}
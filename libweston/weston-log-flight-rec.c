@@ -34,16 +34,51 @@
 #include <assert.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/time.h>
 
+/** Records are aligned to this, and never wrap around the end of a ring */
+#define WESTON_RING_ALIGN 16
+
+/** Upper bound of arguments a deferred record can hold */
+#define WESTON_RING_MAX_ARGS 16
+
+/** Longest conversion specification a deferred record accepts */
+#define WESTON_RING_MAX_SPEC 32
+
+/** Rings of threads other than the first one are this much smaller */
+#define WESTON_RING_THREAD_DIV 4
+
+enum weston_ring_record_type {
+	WESTON_RING_RECORD_PAD = 0,	/**< filler up to the end of the ring */
+	WESTON_RING_RECORD_DATA,	/**< bytes as given to write() */
+	WESTON_RING_RECORD_FORMAT,	/**< format string and its arguments */
+};
+
+struct weston_ring_record {
+	uint64_t seq;		/**< global order, to merge the rings of all threads */
+	uint32_t len;		/**< record length, header and padding included */
+	uint16_t type;		/**< enum weston_ring_record_type */
+	uint16_t size;		/**< payload length, without padding */
+};
+
+/** A single-producer ring: only the owning thread ever writes to it, so
+ * appending a record takes no lock. head and tail count bytes since
+ * creation; they are published with release stores so that a dump from
+ * another thread sees whole records.
+ */
 struct weston_ring_buffer {
-	uint32_t append_pos;	/**< where in the buffer we are */
+	uint64_t head;		/**< where the next record goes */
+	uint64_t tail;		/**< start of the oldest complete record */
 	uint32_t size;		/**< max length of the ring buffer */
 	char *buf;		/**< the buffer itself */
 	FILE *file;		/**< where to write in case we need to dump the buf */
-	bool overlap;		/**< in case buff overlaps, hint from where to print buf contents */
+	bool in_use;		/**< owned by a live thread */
+	struct weston_debug_log_flight_recorder *recorder;
+	struct wl_list link;	/**< weston_debug_log_flight_recorder::ring_list */
 };
 
 /** allows easy access to the ring buffer in case of a core dump
@@ -52,20 +87,106 @@ WL_EXPORT struct weston_ring_buffer *weston_primary_flight_recorder_ring_buffer
 
 /** A black box type of stream, used to aggregate data continuously, and
  * when needed, to dump its contents for inspection.
+ *
+ * Every thread writing to it gets a ring buffer of its own, looked up
+ * through a thread-specific key. Rings of exited threads keep their
+ * contents and are handed to the next new thread.
  */
 struct weston_debug_log_flight_recorder {
 	struct weston_log_subscriber base;
-	struct weston_ring_buffer rb;
+	struct weston_ring_buffer *rb;	/**< ring of the creating thread */
+	uint64_t seq;			/**< next record sequence number */
+	size_t thread_ring_size;
+	pthread_key_t ring_key;
+	pthread_mutex_t ring_lock;	/**< protects ring_list */
+	struct wl_list ring_list;	/**< weston_ring_buffer::link */
 };
 
-static void
-weston_ring_buffer_init(struct weston_ring_buffer *rb, size_t size, char *buf)
+enum weston_ring_arg {
+	WESTON_RING_ARG_INT,
+	WESTON_RING_ARG_LONG,
+	WESTON_RING_ARG_LLONG,
+	WESTON_RING_ARG_SIZE,
+	WESTON_RING_ARG_INTMAX,
+	WESTON_RING_ARG_PTRDIFF,
+	WESTON_RING_ARG_DOUBLE,
+	WESTON_RING_ARG_PTR,
+	WESTON_RING_ARG_STR,
+	WESTON_RING_ARG_PERCENT,	/**< "%%", takes no argument */
+};
+
+/** One conversion specification of a format string */
+struct weston_ring_spec {
+	const char *start;	/**< the '%' */
+	size_t len;		/**< up to and including the conversion */
+	bool star_width;
+	bool star_prec;
+	bool has_prec;
+	enum weston_ring_arg arg;
+};
+
+union weston_ring_slot {
+	int64_t i;
+	double d;
+	const void *p;
+};
+
+static size_t
+weston_ring_record_len(size_t payload)
 {
-	rb->append_pos = 0;
-	rb->size = size - 1;
-	rb->buf = buf;
-	rb->overlap = false;
+	size_t len = sizeof(struct weston_ring_record) + payload;
+
+	return (len + WESTON_RING_ALIGN - 1) & ~(size_t)(WESTON_RING_ALIGN - 1);
+}
+
+static size_t
+weston_ring_buffer_max_payload(struct weston_ring_buffer *rb)
+{
+	return MIN(UINT16_MAX, rb->size / 2) - WESTON_RING_ALIGN -
+	       sizeof(struct weston_ring_record);
+}
+
+static struct weston_ring_buffer *
+weston_ring_buffer_create(struct weston_debug_log_flight_recorder *flight_rec,
+			  size_t size)
+{
+	struct weston_ring_buffer *rb;
+
+	rb = zalloc(sizeof(*rb));
+	if (!rb)
+		return NULL;
+
+	size &= ~(size_t)(WESTON_RING_ALIGN - 1);
+	rb->buf = zalloc(size);
+	if (!rb->buf) {
+		free(rb);
+		return NULL;
+	}
+
+	rb->size = size;
 	rb->file = stderr;
+	rb->recorder = flight_rec;
+
+	/* write some data to the rb such that the memory gets mapped */
+	memset(rb->buf, 0xff, rb->size);
+
+	return rb;
+}
+
+static void
+weston_ring_buffer_destroy(struct weston_ring_buffer *rb)
+{
+	wl_list_remove(&rb->link);
+	free(rb->buf);
+	free(rb);
+}
+
+static void
+weston_ring_buffer_release(void *data)
+{
+	struct weston_ring_buffer *rb = data;
+
+	__atomic_store_n(&rb->in_use, false, __ATOMIC_RELEASE);
 }
 
 static struct weston_debug_log_flight_recorder *
@@ -74,79 +195,112 @@ to_flight_recorder(struct weston_log_subscriber *sub)
 	return container_of(sub, struct weston_debug_log_flight_recorder, base);
 }
 
-static void
-weston_log_flight_recorder_adjust_end(struct weston_ring_buffer *rb,
-				      size_t bytes_to_advance)
+/** Find the ring of the calling thread, adopting or creating one the
+ * first time a thread writes. Only that first write takes a lock.
+ */
+static struct weston_ring_buffer *
+weston_log_flight_recorder_get_ring(struct weston_debug_log_flight_recorder *flight_rec)
 {
-	if (rb->append_pos == rb->size - bytes_to_advance)
-		rb->append_pos = 0;
-	else
-		rb->append_pos += bytes_to_advance;
+	struct weston_ring_buffer *rb, *it;
+
+	rb = pthread_getspecific(flight_rec->ring_key);
+	if (rb)
+		return rb;
+
+	pthread_mutex_lock(&flight_rec->ring_lock);
+	wl_list_for_each(it, &flight_rec->ring_list, link) {
+		if (!__atomic_load_n(&it->in_use, __ATOMIC_ACQUIRE)) {
+			rb = it;
+			break;
+		}
+	}
+	if (!rb) {
+		rb = weston_ring_buffer_create(flight_rec,
+					       flight_rec->thread_ring_size);
+		if (rb)
+			wl_list_insert(flight_rec->ring_list.prev, &rb->link);
+	}
+	if (rb)
+		rb->in_use = true;
+	pthread_mutex_unlock(&flight_rec->ring_lock);
+
+	if (rb)
+		pthread_setspecific(flight_rec->ring_key, rb);
+
+	return rb;
 }
 
+/** Drop the oldest records until len more bytes fit */
 static void
-weston_log_flight_recorder_write_chunks(struct weston_ring_buffer *rb,
-					const char *data, size_t len)
+weston_ring_buffer_make_room(struct weston_ring_buffer *rb, size_t len)
 {
-	/* no of chunks that matches our buffer size */
-	size_t nr_chunks = len / rb->size;
-
-	/* bytes left that do not fill entire buffer */
-	size_t bytes_left_last_chunk = len % rb->size;
-	const char *c_data = data;
-
-	/* might overlap multiple times, memcpy is redundant,
-	 * that's why we don't even modify append_pos */
-	while (nr_chunks-- > 0) {
-		memcpy(&rb->buf[rb->append_pos], c_data, rb->size);
-		c_data += rb->size;
-	}
+	uint64_t tail = rb->tail;
+	struct weston_ring_record *rec;
 
-	if (bytes_left_last_chunk)
-		memcpy(&rb->buf[rb->append_pos], c_data, bytes_left_last_chunk);
+	while (rb->head + len - tail > rb->size) {
+		rec = (struct weston_ring_record *) &rb->buf[tail % rb->size];
+		tail += rec->len;
+	}
 
-	/* adjust append_pos */
-	weston_log_flight_recorder_adjust_end(rb, bytes_left_last_chunk);
+	__atomic_store_n(&rb->tail, tail, __ATOMIC_RELEASE);
 }
 
-static void
-weston_log_flight_recorder_write_chunks_overlap(struct weston_ring_buffer *rb,
-					 const char *data, size_t len)
+static struct weston_ring_record *
+weston_ring_buffer_reserve(struct weston_ring_buffer *rb, size_t len)
 {
-	size_t transfer_remains =
-		(rb->append_pos + len) - rb->size;
-	size_t transfer_to_end = len - transfer_remains;
-	const char *c_data = data;
+	uint32_t pos = rb->head % rb->size;
+	uint32_t room = rb->size - pos;
+	struct weston_ring_record *rec;
+
+	/* records never wrap: pad out the end of the ring instead */
+	if (room < len) {
+		weston_ring_buffer_make_room(rb, room);
+		rec = (struct weston_ring_record *) &rb->buf[pos];
+		rec->seq = 0;
+		rec->len = room;
+		rec->type = WESTON_RING_RECORD_PAD;
+		rec->size = 0;
+		__atomic_store_n(&rb->head, rb->head + room, __ATOMIC_RELEASE);
+		pos = 0;
+	}
 
-	/* transfer what remains until the end of the buffer */
-	memcpy(&rb->buf[rb->append_pos], c_data, transfer_to_end);
-	c_data += transfer_to_end;
+	weston_ring_buffer_make_room(rb, len);
 
-	/* reset append_pos as we filled up the buffer */
-	rb->append_pos = 0;
+	return (struct weston_ring_record *) &rb->buf[pos];
+}
+
+static void
+weston_ring_buffer_commit(struct weston_ring_buffer *rb,
+			  struct weston_ring_record *rec,
+			  enum weston_ring_record_type type, size_t payload)
+{
+	rec->seq = __atomic_fetch_add(&rb->recorder->seq, 1, __ATOMIC_RELAXED);
+	rec->len = weston_ring_record_len(payload);
+	rec->type = type;
+	rec->size = payload;
 
-	/* transfer what remains */
-	weston_log_flight_recorder_write_chunks(rb, c_data, transfer_remains);
-	rb->overlap = true;
+	__atomic_store_n(&rb->head, rb->head + rec->len, __ATOMIC_RELEASE);
 }
 
 static void
 weston_log_flight_recorder_write_data(struct weston_ring_buffer *rb,
 				      const char *data, size_t len)
 {
-	/*
-	 * If append_pos is at the beginning of the buffer, we determine if we
-	 * should do it in chunks, and if there are any bytes left we transfer
-	 * those as well.
-	 *
-	 * If the append_pos is somewhere inside the buffer we determine how
-	 * many bytes we need to transfer between we reach the end and overlap,
-	 * then we proceed as in the first step.
-	 */
-	if (rb->append_pos == 0)
-		weston_log_flight_recorder_write_chunks(rb, data, len);
-	else
-		weston_log_flight_recorder_write_chunks_overlap(rb, data, len);
+	size_t max_payload = weston_ring_buffer_max_payload(rb);
+	struct weston_ring_record *rec;
+	size_t chunk;
+
+	/* data bigger than a record is split, each chunk in order */
+	while (len > 0) {
+		chunk = MIN(len, max_payload);
+		rec = weston_ring_buffer_reserve(rb,
+						 weston_ring_record_len(chunk));
+		memcpy(rec + 1, data, chunk);
+		weston_ring_buffer_commit(rb, rec, WESTON_RING_RECORD_DATA,
+					  chunk);
+		data += chunk;
+		len -= chunk;
+	}
 }
 
 static void
@@ -155,47 +309,448 @@ weston_log_flight_recorder_write(struct weston_log_subscriber *sub,
 {
 	struct weston_debug_log_flight_recorder *flight_rec =
 		to_flight_recorder(sub);
-	struct weston_ring_buffer *rb = &flight_rec->rb;
+	struct weston_ring_buffer *rb;
+
+	rb = weston_log_flight_recorder_get_ring(flight_rec);
+	if (!rb)
+		return;
+
+	weston_log_flight_recorder_write_data(rb, data, len);
+}
 
-	/* in case the data is bigger than the size of the buf */
-	if (rb->size < len) {
-		weston_log_flight_recorder_write_data(rb, data, len);
+/** Parse the conversion specification at p, which points at a '%'
+ *
+ * Only what can be replayed later from a copy of the argument is
+ * accepted: no positional arguments, %n, %m, wide characters or long
+ * doubles.
+ *
+ * @returns false if the specification is not supported
+ */
+static bool
+weston_ring_parse_spec(const char *p, struct weston_ring_spec *spec)
+{
+	const char *c = p + 1;
+	int lmod = 0;
+
+	spec->start = p;
+	spec->star_width = false;
+	spec->star_prec = false;
+	spec->has_prec = false;
+
+	if (*c == '%') {
+		spec->len = 2;
+		spec->arg = WESTON_RING_ARG_PERCENT;
+		return true;
+	}
+
+	while (*c && strchr("-+ #0'", *c))
+		c++;
+
+	if (*c == '*') {
+		spec->star_width = true;
+		c++;
 	} else {
-		/* if we can transfer it without wrapping it do it at once */
-		if (rb->append_pos <= rb->size - len) {
-			memcpy(&rb->buf[rb->append_pos], data, len);
-
-			/*
-			 * adjust append_pos, take care of the situation were
-			 * to fill up the entire buf
-			 */
-			weston_log_flight_recorder_adjust_end(rb, len);
+		while (*c >= '0' && *c <= '9')
+			c++;
+	}
+	if (*c == '$')
+		return false;
+
+	if (*c == '.') {
+		spec->has_prec = true;
+		c++;
+		if (*c == '*') {
+			spec->star_prec = true;
+			c++;
 		} else {
-			weston_log_flight_recorder_write_data(rb, data, len);
+			while (*c >= '0' && *c <= '9')
+				c++;
+		}
+	}
+
+	switch (*c) {
+	case 'h':
+		c++;
+		if (*c == 'h')
+			c++;
+		break;
+	case 'l':
+		c++;
+		lmod = 1;
+		if (*c == 'l') {
+			c++;
+			lmod = 2;
+		}
+		break;
+	case 'z':
+		c++;
+		lmod = 'z';
+		break;
+	case 'j':
+		c++;
+		lmod = 'j';
+		break;
+	case 't':
+		c++;
+		lmod = 't';
+		break;
+	case 'L':
+	case 'q':
+		return false;
+	}
+
+	switch (*c) {
+	case 'd':
+	case 'i':
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		switch (lmod) {
+		case 1:
+			spec->arg = WESTON_RING_ARG_LONG;
+			break;
+		case 2:
+			spec->arg = WESTON_RING_ARG_LLONG;
+			break;
+		case 'z':
+			spec->arg = WESTON_RING_ARG_SIZE;
+			break;
+		case 'j':
+			spec->arg = WESTON_RING_ARG_INTMAX;
+			break;
+		case 't':
+			spec->arg = WESTON_RING_ARG_PTRDIFF;
+			break;
+		default:
+			spec->arg = WESTON_RING_ARG_INT;
+			break;
+		}
+		break;
+	case 'c':
+		if (lmod)
+			return false;
+		spec->arg = WESTON_RING_ARG_INT;
+		break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		spec->arg = WESTON_RING_ARG_DOUBLE;
+		break;
+	case 'p':
+		spec->arg = WESTON_RING_ARG_PTR;
+		break;
+	case 's':
+		if (lmod)
+			return false;
+		spec->arg = WESTON_RING_ARG_STR;
+		break;
+	default:
+		return false;
+	}
+
+	spec->len = c + 1 - p;
+
+	return spec->len < WESTON_RING_MAX_SPEC;
+}
+
+static int64_t
+weston_ring_fetch_int(enum weston_ring_arg arg, va_list *ap)
+{
+	switch (arg) {
+	case WESTON_RING_ARG_LONG:
+		return va_arg(*ap, long);
+	case WESTON_RING_ARG_LLONG:
+		return va_arg(*ap, long long);
+	case WESTON_RING_ARG_SIZE:
+		return va_arg(*ap, size_t);
+	case WESTON_RING_ARG_INTMAX:
+		return va_arg(*ap, intmax_t);
+	case WESTON_RING_ARG_PTRDIFF:
+		return va_arg(*ap, ptrdiff_t);
+	default:
+		return va_arg(*ap, int);
+	}
+}
+
+/** Store a message as its format string and arguments, leaving the
+ * formatting to the time the flight recorder is displayed. The payload
+ * is the NUL-terminated format string, padded to 8 bytes, followed by
+ * one 8-byte slot per non-string argument and then by the strings.
+ */
+static bool
+weston_log_flight_recorder_record(struct weston_log_subscriber *sub,
+				  const char *fmt, va_list ap)
+{
+	struct weston_debug_log_flight_recorder *flight_rec =
+		to_flight_recorder(sub);
+	union weston_ring_slot slots[3 * WESTON_RING_MAX_ARGS];
+	const char *strs[WESTON_RING_MAX_ARGS];
+	size_t str_lens[WESTON_RING_MAX_ARGS];
+	struct weston_ring_buffer *rb;
+	struct weston_ring_record *rec;
+	struct weston_ring_spec spec;
+	unsigned int nslots = 0, nstrs = 0, i;
+	size_t fmt_len, str_bytes = 0, payload;
+	int64_t prec = -1;
+	bool ok = true;
+	const char *p;
+	va_list aq;
+	char *dst;
+
+	rb = weston_log_flight_recorder_get_ring(flight_rec);
+	if (!rb)
+		return true;
+
+	va_copy(aq, ap);
+	for (p = strchr(fmt, '%'); p; p = strchr(p + spec.len, '%')) {
+		if (!weston_ring_parse_spec(p, &spec) ||
+		    nslots + 3 > ARRAY_LENGTH(slots) ||
+		    nstrs == ARRAY_LENGTH(strs)) {
+			ok = false;
+			break;
+		}
+		if (spec.arg == WESTON_RING_ARG_PERCENT)
+			continue;
+
+		if (spec.star_width)
+			slots[nslots++].i = va_arg(aq, int);
+		if (spec.star_prec) {
+			prec = va_arg(aq, int);
+			slots[nslots++].i = prec;
+		} else if (spec.has_prec) {
+			prec = strtol(strchr(spec.start, '.') + 1, NULL, 10);
+		} else {
+			prec = -1;
+		}
+
+		switch (spec.arg) {
+		case WESTON_RING_ARG_DOUBLE:
+			slots[nslots++].d = va_arg(aq, double);
+			break;
+		case WESTON_RING_ARG_PTR:
+			slots[nslots++].p = va_arg(aq, void *);
+			break;
+		case WESTON_RING_ARG_STR:
+			strs[nstrs] = va_arg(aq, const char *);
+			if (!strs[nstrs])
+				strs[nstrs] = "(null)";
+			/* a precision limits how much of the string is read */
+			str_lens[nstrs] = prec >= 0 ?
+				strnlen(strs[nstrs], prec) : strlen(strs[nstrs]);
+			str_bytes += str_lens[nstrs] + 1;
+			nstrs++;
+			break;
+		default:
+			slots[nslots++].i = weston_ring_fetch_int(spec.arg, &aq);
+			break;
+		}
+	}
+	va_end(aq);
+
+	if (!ok)
+		return false;
+
+	fmt_len = (strlen(fmt) + 1 + 7) & ~(size_t)7;
+	payload = fmt_len + nslots * sizeof(slots[0]) + str_bytes;
+	if (payload > weston_ring_buffer_max_payload(rb))
+		return false;
+
+	rec = weston_ring_buffer_reserve(rb, weston_ring_record_len(payload));
+	dst = (char *) (rec + 1);
+
+	strcpy(dst, fmt);
+	dst += fmt_len;
+	memcpy(dst, slots, nslots * sizeof(slots[0]));
+	dst += nslots * sizeof(slots[0]);
+	for (i = 0; i < nstrs; i++) {
+		memcpy(dst, strs[i], str_lens[i]);
+		dst[str_lens[i]] = '\0';
+		dst += str_lens[i] + 1;
+	}
+
+	weston_ring_buffer_commit(rb, rec, WESTON_RING_RECORD_FORMAT, payload);
+
+	return true;
+}
+
+/** Format a deferred record, the inverse of
+ * weston_log_flight_recorder_record()
+ */
+static void
+weston_ring_record_display_format(const struct weston_ring_record *rec,
+				  FILE *file)
+{
+	const char *fmt = (const char *) (rec + 1);
+	const char *end = fmt + rec->size;
+	size_t fmt_len = (strlen(fmt) + 1 + 7) & ~(size_t)7;
+	const union weston_ring_slot *slot;
+	struct weston_ring_spec spec;
+	const char *p = fmt, *c, *str;
+	char buf[WESTON_RING_MAX_SPEC + 32];
+	unsigned int nslots = 0;
+	int64_t width, prec;
+	char *b;
+
+	/* the strings follow the slots; count the slots to find them */
+	for (c = strchr(fmt, '%'); c; c = strchr(c + spec.len, '%')) {
+		if (!weston_ring_parse_spec(c, &spec))
+			return;
+		if (spec.arg == WESTON_RING_ARG_PERCENT)
+			continue;
+		nslots += spec.star_width + spec.star_prec +
+			  (spec.arg != WESTON_RING_ARG_STR);
+	}
+	slot = (const union weston_ring_slot *) (fmt + fmt_len);
+	str = (const char *) (slot + nslots);
+
+	while ((c = strchr(p, '%'))) {
+		fwrite(p, 1, c - p, file);
+		if (!weston_ring_parse_spec(c, &spec))
+			return;
+		p = c + spec.len;
+
+		if (spec.arg == WESTON_RING_ARG_PERCENT) {
+			fputc('%', file);
+			continue;
+		}
+
+		width = spec.star_width ? (slot++)->i : 0;
+		prec = spec.star_prec ? (slot++)->i : 0;
+
+		/* rebuild the specification with the stored widths */
+		b = buf;
+		for (c = spec.start; c < p; c++) {
+			if (*c == '.' && c[1] == '*' && prec < 0) {
+				c++;
+			} else if (*c == '*' && c[-1] == '.') {
+				b += sprintf(b, "%d", (int) prec);
+			} else if (*c == '*') {
+				b += sprintf(b, "%d", (int) width);
+			} else {
+				*b++ = *c;
+			}
 		}
+		*b = '\0';
+
+		switch (spec.arg) {
+		case WESTON_RING_ARG_INT:
+			fprintf(file, buf, (int) (slot++)->i);
+			break;
+		case WESTON_RING_ARG_LONG:
+			fprintf(file, buf, (long) (slot++)->i);
+			break;
+		case WESTON_RING_ARG_LLONG:
+			fprintf(file, buf, (long long) (slot++)->i);
+			break;
+		case WESTON_RING_ARG_SIZE:
+			fprintf(file, buf, (size_t) (slot++)->i);
+			break;
+		case WESTON_RING_ARG_INTMAX:
+			fprintf(file, buf, (intmax_t) (slot++)->i);
+			break;
+		case WESTON_RING_ARG_PTRDIFF:
+			fprintf(file, buf, (ptrdiff_t) (slot++)->i);
+			break;
+		case WESTON_RING_ARG_DOUBLE:
+			fprintf(file, buf, (slot++)->d);
+			break;
+		case WESTON_RING_ARG_PTR:
+			fprintf(file, buf, (slot++)->p);
+			break;
+		case WESTON_RING_ARG_STR:
+			if (str >= end)
+				return;
+			fprintf(file, buf, str);
+			str += strlen(str) + 1;
+			break;
+		case WESTON_RING_ARG_PERCENT:
+			break;
+		}
+	}
+
+	fputs(p, file);
+}
+
+struct weston_ring_cursor {
+	struct weston_ring_buffer *rb;
+	uint64_t pos;
+	uint64_t end;
+};
+
+static const struct weston_ring_record *
+weston_ring_cursor_peek(struct weston_ring_cursor *cur)
+{
+	const struct weston_ring_record *rec;
+
+	while (cur->pos < cur->end) {
+		rec = (const struct weston_ring_record *)
+			&cur->rb->buf[cur->pos % cur->rb->size];
+		/* a writer may have overwritten what we were about to read */
+		if (rec->len == 0 || rec->len > cur->rb->size)
+			break;
+		if (rec->type != WESTON_RING_RECORD_PAD)
+			return rec;
+		cur->pos += rec->len;
 	}
 
+	cur->pos = cur->end;
+	return NULL;
 }
 
+/** Display the records of all rings, merged back into the order they
+ * were written in
+ */
 static void
-weston_log_subscriber_display_flight_rec_data(struct weston_ring_buffer *rb,
+weston_log_subscriber_display_flight_rec_data(struct weston_debug_log_flight_recorder *flight_rec,
 					      FILE *file)
 {
+	struct weston_ring_cursor cursors[32];
+	const struct weston_ring_record *rec, *next;
+	struct weston_ring_buffer *rb;
+	unsigned int ncursors = 0, i, pick;
 	FILE *file_d = stderr;
+
 	if (file)
 		file_d = file;
 
-	if (!rb->overlap) {
-		if (rb->append_pos)
-			fwrite(rb->buf, sizeof(char), rb->append_pos, file_d);
+	pthread_mutex_lock(&flight_rec->ring_lock);
+	wl_list_for_each(rb, &flight_rec->ring_list, link) {
+		if (ncursors == ARRAY_LENGTH(cursors))
+			break;
+		cursors[ncursors].rb = rb;
+		cursors[ncursors].end = __atomic_load_n(&rb->head,
+							__ATOMIC_ACQUIRE);
+		cursors[ncursors].pos = __atomic_load_n(&rb->tail,
+							__ATOMIC_ACQUIRE);
+		ncursors++;
+	}
+	pthread_mutex_unlock(&flight_rec->ring_lock);
+
+	for (;;) {
+		rec = NULL;
+		pick = 0;
+		for (i = 0; i < ncursors; i++) {
+			next = weston_ring_cursor_peek(&cursors[i]);
+			if (next && (!rec || next->seq < rec->seq)) {
+				rec = next;
+				pick = i;
+			}
+		}
+		if (!rec)
+			break;
+
+		if (rec->type == WESTON_RING_RECORD_DATA)
+			fwrite(rec + 1, sizeof(char), rec->size, file_d);
 		else
-			fwrite(rb->buf, sizeof(char), rb->size, file_d);
-	} else {
-		/* from append_pos to size */
-		fwrite(&rb->buf[rb->append_pos], sizeof(char),
-		       rb->size - rb->append_pos, file_d);
-		/* from 0 to append_pos */
-		fwrite(rb->buf, sizeof(char), rb->append_pos, file_d);
+			weston_ring_record_display_format(rec, file_d);
+
+		cursors[pick].pos += rec->len;
 	}
 }
 
@@ -204,23 +759,28 @@ weston_log_subscriber_display_flight_rec(struct weston_log_subscriber *sub)
 {
 	struct weston_debug_log_flight_recorder *flight_rec =
 		to_flight_recorder(sub);
-	struct weston_ring_buffer *rb = &flight_rec->rb;
 
-	weston_log_subscriber_display_flight_rec_data(rb, rb->file);
+	weston_log_subscriber_display_flight_rec_data(flight_rec,
+						      flight_rec->rb->file);
 }
 
 static void
 weston_log_subscriber_destroy_flight_rec(struct weston_log_subscriber *sub)
 {
 	struct weston_debug_log_flight_recorder *flight_rec = to_flight_recorder(sub);
+	struct weston_ring_buffer *rb, *tmp;
 
 	/* Resets weston_primary_flight_recorder_ring_buffer to NULL if it
 	 * is the destroyed subscriber */
-	if (weston_primary_flight_recorder_ring_buffer == &flight_rec->rb)
+	if (weston_primary_flight_recorder_ring_buffer == flight_rec->rb)
 		weston_primary_flight_recorder_ring_buffer = NULL;
 
 	weston_log_subscriber_release(sub);
-	free(flight_rec->rb.buf);
+
+	pthread_key_delete(flight_rec->ring_key);
+	wl_list_for_each_safe(rb, tmp, &flight_rec->ring_list, link)
+		weston_ring_buffer_destroy(rb);
+	pthread_mutex_destroy(&flight_rec->ring_lock);
 	free(flight_rec);
 }
 
@@ -229,6 +789,10 @@ weston_log_subscriber_destroy_flight_rec(struct weston_log_subscriber *sub)
  * Allocates both the flight recorder and the underlying ring buffer. Use
  * weston_log_subscriber_destroy() to clean-up.
  *
+ * Every thread writing to the flight recorder gets a ring buffer of its
+ * own, so that writing never takes a lock. The calling thread gets one of
+ * \c size bytes, other threads get a quarter of that.
+ *
  * @param size specify the maximum size (in bytes) of the backing storage
  * for the flight recorder
  * @returns a weston_log_subscriber object or NULL in case of failure
@@ -237,32 +801,47 @@ WL_EXPORT struct weston_log_subscriber *
 weston_log_subscriber_create_flight_rec(size_t size)
 {
 	struct weston_debug_log_flight_recorder *flight_rec;
-	char *weston_rb;
+	struct weston_ring_buffer *rb;
 
 	assert("Can't create more than one flight recorder." &&
 			!weston_primary_flight_recorder_ring_buffer);
 
+	size = MAX(size, 4096);
+
 	flight_rec = zalloc(sizeof(*flight_rec));
 	if (!flight_rec)
 		return NULL;
 
 	flight_rec->base.write = weston_log_flight_recorder_write;
+	flight_rec->base.record = weston_log_flight_recorder_record;
 	flight_rec->base.destroy = weston_log_subscriber_destroy_flight_rec;
 	flight_rec->base.destroy_subscription = NULL;
 	flight_rec->base.complete = NULL;
 	wl_list_init(&flight_rec->base.subscription_list);
 
-	weston_rb = zalloc(sizeof(char) * size);
-	if (!weston_rb) {
+	flight_rec->thread_ring_size = MAX(size / WESTON_RING_THREAD_DIV, 4096);
+	wl_list_init(&flight_rec->ring_list);
+
+	if (pthread_key_create(&flight_rec->ring_key,
+			       weston_ring_buffer_release) != 0) {
+		free(flight_rec);
+		return NULL;
+	}
+
+	rb = weston_ring_buffer_create(flight_rec, size);
+	if (!rb) {
+		pthread_key_delete(flight_rec->ring_key);
 		free(flight_rec);
 		return NULL;
 	}
 
-	weston_ring_buffer_init(&flight_rec->rb, size, weston_rb);
-	weston_primary_flight_recorder_ring_buffer = &flight_rec->rb;
+	pthread_mutex_init(&flight_rec->ring_lock, NULL);
+	rb->in_use = true;
+	wl_list_insert(&flight_rec->ring_list, &rb->link);
+	pthread_setspecific(flight_rec->ring_key, rb);
 
-	/* write some data to the rb such that the memory gets mapped */
-	memset(flight_rec->rb.buf, 0xff, flight_rec->rb.size);
+	flight_rec->rb = rb;
+	weston_primary_flight_recorder_ring_buffer = rb;
 
 	return &flight_rec->base;
 }
@@ -282,6 +861,6 @@ weston_log_flight_recorder_display_buffer(FILE *file)
 	if (!weston_primary_flight_recorder_ring_buffer)
 		return;
 
-	weston_log_subscriber_display_flight_rec_data(weston_primary_flight_recorder_ring_buffer,
+	weston_log_subscriber_display_flight_rec_data(weston_primary_flight_recorder_ring_buffer->recorder,
 						      file);
 }
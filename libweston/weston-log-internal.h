@@ -25,6 +25,9 @@
 #ifndef WESTON_LOG_INTERNAL_H
 #define WESTON_LOG_INTERNAL_H
 
+#include <stdarg.h>
+#include <stdbool.h>
+
 #include "wayland-util.h"
 
 struct weston_log_subscription;
@@ -52,6 +55,11 @@ struct weston_log_subscription;
 struct weston_log_subscriber {
 	/** write the data pointed by @param data */
 	void (*write)(struct weston_log_subscriber *sub, const char *data, size_t len);
+	/** Optionally, record a printf-style message without formatting
+	 * it, keeping the arguments to format them later. Returns false if
+	 * the message can't be recorded that way, in which case it is
+	 * formatted and passed to write() instead. */
+	bool (*record)(struct weston_log_subscriber *sub, const char *fmt, va_list ap);
 	/** For destroying the subscriber */
 	void (*destroy)(struct weston_log_subscriber *sub);
 	/** For the type of streams that required additional destroy operation
@@ -62,6 +70,9 @@ struct weston_log_subscriber {
 	 * stream.
 	 */
 	void (*complete)(struct weston_log_subscriber *sub);
+	/** Takes the binary encoding of scopes that have one, e.g. the
+	 * timeline, rather than their text output. */
+	bool binary;
 	struct wl_list subscription_list;       /**< weston_log_subscription::owner_link */
 };
 
@@ -0,0 +1,184 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <libweston/weston-log.h>
+#include "shared/helpers.h"
+#include <libweston/libweston.h>
+
+#include "weston-log-internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define WESTON_LOG_MMAP_MAGIC "WESTRING"
+#define WESTON_LOG_MMAP_VERSION 1
+#define WESTON_LOG_MMAP_DATA_OFFSET 4096
+
+/** Layout of the start of the file; the ring itself begins at
+ * data_offset. Everything is in native byte order.
+ */
+struct weston_log_mmap_header {
+	char magic[8];		/**< WESTON_LOG_MMAP_MAGIC, not NUL-terminated */
+	uint32_t version;	/**< WESTON_LOG_MMAP_VERSION */
+	uint32_t data_offset;	/**< where the ring starts in the file */
+	uint64_t size;		/**< length of the ring */
+	uint64_t head;		/**< bytes ever written; the ring offset is head % size */
+};
+
+/** Memory-mapped ring file type of stream
+ *
+ * The file is mapped shared, so what was written survives a crash of the
+ * compositor and can be read back afterwards.
+ */
+struct weston_debug_log_mmap {
+	struct weston_log_subscriber base;
+	struct weston_log_mmap_header *header;
+	char *ring;
+	size_t map_size;
+};
+
+static struct weston_debug_log_mmap *
+to_weston_debug_log_mmap(struct weston_log_subscriber *sub)
+{
+	return container_of(sub, struct weston_debug_log_mmap, base);
+}
+
+static void
+weston_log_mmap_write(struct weston_log_subscriber *sub,
+		      const char *data, size_t len)
+{
+	struct weston_debug_log_mmap *stream = to_weston_debug_log_mmap(sub);
+	uint64_t size = stream->header->size;
+	uint64_t head = stream->header->head;
+	size_t pos, chunk;
+
+	/* only the last lap of anything larger than the ring survives */
+	if (len > size) {
+		head += len - size;
+		data += len - size;
+		len = size;
+	}
+
+	pos = head % size;
+	chunk = MIN(len, size - pos);
+	memcpy(&stream->ring[pos], data, chunk);
+	memcpy(stream->ring, data + chunk, len - chunk);
+
+	__atomic_store_n(&stream->header->head, head + len, __ATOMIC_RELEASE);
+}
+
+static void
+weston_log_subscriber_destroy_mmap(struct weston_log_subscriber *subscriber)
+{
+	struct weston_debug_log_mmap *stream =
+		to_weston_debug_log_mmap(subscriber);
+
+	weston_log_subscriber_release(subscriber);
+	munmap(stream->header, stream->map_size);
+	free(stream);
+}
+
+/** Creates a memory-mapped ring file type of subscriber
+ *
+ * Data is written into a ring of \c size bytes in a file mapped shared,
+ * overwriting the oldest data once full. The subscriber takes the binary
+ * encoding of the scopes that have one, like the timeline.
+ *
+ * Should be destroyed using weston_log_subscriber_destroy()
+ *
+ * @param path the file to create, truncated if it exists
+ * @param size the size of the ring, in bytes
+ * @returns a weston_log_subscriber object or NULL in case of failure
+ *
+ * @sa weston_log_subscriber_destroy
+ *
+ */
+WL_EXPORT struct weston_log_subscriber *
+weston_log_subscriber_create_mmap(const char *path, size_t size)
+{
+	struct weston_debug_log_mmap *stream;
+	void *map;
+	int fd;
+
+	if (size == 0)
+		return NULL;
+
+	stream = zalloc(sizeof(*stream));
+	if (!stream)
+		return NULL;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		weston_log("Error: cannot open log ring '%s': %s\n",
+			   path, strerror(errno));
+		free(stream);
+		return NULL;
+	}
+
+	stream->map_size = WESTON_LOG_MMAP_DATA_OFFSET + size;
+	if (ftruncate(fd, stream->map_size) < 0) {
+		weston_log("Error: cannot size log ring '%s': %s\n",
+			   path, strerror(errno));
+		close(fd);
+		free(stream);
+		return NULL;
+	}
+
+	map = mmap(NULL, stream->map_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		weston_log("Error: cannot map log ring '%s': %s\n",
+			   path, strerror(errno));
+		free(stream);
+		return NULL;
+	}
+
+	stream->header = map;
+	stream->ring = (char *) map + WESTON_LOG_MMAP_DATA_OFFSET;
+	stream->header->version = WESTON_LOG_MMAP_VERSION;
+	stream->header->data_offset = WESTON_LOG_MMAP_DATA_OFFSET;
+	stream->header->size = size;
+	stream->header->head = 0;
+	memcpy(stream->header->magic, WESTON_LOG_MMAP_MAGIC,
+	       sizeof(stream->header->magic));
+
+	stream->base.write = weston_log_mmap_write;
+	stream->base.record = NULL;
+	stream->base.destroy = weston_log_subscriber_destroy_mmap;
+	stream->base.destroy_subscription = NULL;
+	stream->base.complete = NULL;
+	stream->base.binary = true;
+
+	wl_list_init(&stream->base.subscription_list);
+
+	return &stream->base;
+}
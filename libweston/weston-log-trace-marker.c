@@ -0,0 +1,278 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <libweston/weston-log.h>
+#include "shared/helpers.h"
+#include <libweston/libweston.h>
+
+#include "weston-log-internal.h"
+#include "timeline.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_MARKER_MAX 256
+
+static const char *const trace_marker_paths[] = {
+	"/sys/kernel/tracing/trace_marker",
+	"/sys/kernel/debug/tracing/trace_marker",
+};
+
+struct trace_marker_label {
+	uint32_t id;
+	char label[WESTON_TIMELINE_RECORD_LABEL_LEN];
+};
+
+/** Kernel trace_marker type of stream
+ *
+ * Takes the binary timeline and writes each point to the trace_marker file
+ * of ftrace as a systrace instant event, which Perfetto and trace-cmd show
+ * next to the scheduling and DRM events of the kernel. The kernel stamps
+ * the write, so the point lands on the same clock as everything else.
+ */
+struct weston_debug_log_trace_marker {
+	struct weston_log_subscriber base;
+	int fd;
+	pid_t pid;
+
+	/* Points only carry IDs. Names and outputs are few and kept here;
+	 * surfaces come and go, their descriptions go to the trace instead. */
+	struct wl_array names;		/* struct trace_marker_label */
+	struct wl_array outputs;	/* struct trace_marker_label */
+	uint32_t last_surface;
+};
+
+static struct weston_debug_log_trace_marker *
+to_weston_debug_log_trace_marker(struct weston_log_subscriber *sub)
+{
+	return container_of(sub, struct weston_debug_log_trace_marker, base);
+}
+
+static void
+trace_marker_label_set(struct wl_array *labels,
+		       const struct weston_timeline_record *rec)
+{
+	struct trace_marker_label *entry;
+
+	wl_array_for_each(entry, labels) {
+		if (entry->id == rec->id)
+			goto found;
+	}
+
+	entry = wl_array_add(labels, sizeof *entry);
+	if (!entry)
+		return;
+	entry->id = rec->id;
+
+found:
+	memcpy(entry->label, rec->object.label, sizeof entry->label);
+	entry->label[sizeof entry->label - 1] = '\0';
+}
+
+static const char *
+trace_marker_label_get(struct wl_array *labels, uint32_t id)
+{
+	struct trace_marker_label *entry;
+
+	wl_array_for_each(entry, labels) {
+		if (entry->id == id)
+			return entry->label;
+	}
+
+	return "?";
+}
+
+static void
+trace_marker_emit(struct weston_debug_log_trace_marker *stream,
+		  const char *buf, int len)
+{
+	if (len <= 0)
+		return;
+	if (len >= TRACE_MARKER_MAX)
+		len = TRACE_MARKER_MAX - 1;
+
+	/* Nothing to be done about a full or disabled trace buffer, and
+	 * the compositor must not stall on it. */
+	if (write(stream->fd, buf, len) < 0)
+		return;
+}
+
+static void
+trace_marker_point(struct weston_debug_log_trace_marker *stream,
+		   const struct weston_timeline_record *rec)
+{
+	char buf[TRACE_MARKER_MAX];
+	int len;
+
+	len = snprintf(buf, sizeof buf, "I|%d|%s", stream->pid,
+		       trace_marker_label_get(&stream->names, rec->id));
+
+	if (rec->point.output != 0 && len < (int) sizeof buf)
+		len += snprintf(buf + len, sizeof buf - len, " output=%s",
+				trace_marker_label_get(&stream->outputs,
+						       rec->point.output));
+	if (rec->point.surface != 0 && len < (int) sizeof buf)
+		len += snprintf(buf + len, sizeof buf - len, " surface=%u",
+				rec->point.surface);
+	if (rec->point.vblank != 0 && len < (int) sizeof buf)
+		len += snprintf(buf + len, sizeof buf - len,
+				" vblank_ns=%" PRIu64, rec->point.vblank);
+	if (rec->point.gpu != 0 && len < (int) sizeof buf)
+		len += snprintf(buf + len, sizeof buf - len,
+				" gpu_ns=%" PRIu64, rec->point.gpu);
+
+	trace_marker_emit(stream, buf, len);
+}
+
+static void
+trace_marker_surface(struct weston_debug_log_trace_marker *stream,
+		     const struct weston_timeline_record *rec)
+{
+	char label[WESTON_TIMELINE_RECORD_LABEL_LEN];
+	char buf[TRACE_MARKER_MAX];
+	int len;
+
+	/* IDs only go up, so anything at or below the last one seen is a
+	 * repeated description. */
+	if (rec->id <= stream->last_surface)
+		return;
+	stream->last_surface = rec->id;
+
+	memcpy(label, rec->object.label, sizeof label);
+	label[sizeof label - 1] = '\0';
+
+	len = snprintf(buf, sizeof buf, "I|%d|surface %u: %s",
+		       stream->pid, rec->id, label);
+	if (rec->object.parent != 0 && len < (int) sizeof buf)
+		len += snprintf(buf + len, sizeof buf - len, " (main %u)",
+				rec->object.parent);
+
+	trace_marker_emit(stream, buf, len);
+}
+
+static void
+weston_log_trace_marker_write(struct weston_log_subscriber *sub,
+			      const char *data, size_t len)
+{
+	struct weston_debug_log_trace_marker *stream =
+		to_weston_debug_log_trace_marker(sub);
+	struct weston_timeline_record rec;
+
+	/* Only the timeline has this encoding; anything else is dropped. */
+	if (len % sizeof rec != 0)
+		return;
+
+	for (; len > 0; data += sizeof rec, len -= sizeof rec) {
+		memcpy(&rec, data, sizeof rec);
+
+		switch (rec.type) {
+		case WESTON_TIMELINE_RECORD_NAME:
+			trace_marker_label_set(&stream->names, &rec);
+			break;
+		case WESTON_TIMELINE_RECORD_OUTPUT:
+			trace_marker_label_set(&stream->outputs, &rec);
+			break;
+		case WESTON_TIMELINE_RECORD_SURFACE:
+			trace_marker_surface(stream, &rec);
+			break;
+		case WESTON_TIMELINE_RECORD_POINT:
+			trace_marker_point(stream, &rec);
+			break;
+		}
+	}
+}
+
+static void
+weston_log_subscriber_destroy_trace_marker(struct weston_log_subscriber *subscriber)
+{
+	struct weston_debug_log_trace_marker *stream =
+		to_weston_debug_log_trace_marker(subscriber);
+
+	weston_log_subscriber_release(subscriber);
+	wl_array_release(&stream->names);
+	wl_array_release(&stream->outputs);
+	close(stream->fd);
+	free(stream);
+}
+
+/** Creates a kernel trace_marker type of subscriber
+ *
+ * Meant for the timeline scope: each timeline point is written to the
+ * ftrace trace_marker file as it happens, so that a system-wide trace taken
+ * with Perfetto or trace-cmd shows the repaint loop of the compositor next
+ * to scheduling, DRM and GPU driver events. Writing only costs a system
+ * call while tracing is off; the points go nowhere then.
+ *
+ * Should be destroyed using weston_log_subscriber_destroy()
+ *
+ * @returns a weston_log_subscriber object or NULL if tracefs is not
+ * available
+ *
+ * @sa weston_log_subscriber_destroy
+ *
+ */
+WL_EXPORT struct weston_log_subscriber *
+weston_log_subscriber_create_trace_marker(void)
+{
+	struct weston_debug_log_trace_marker *stream;
+	unsigned int i;
+	int fd = -1;
+
+	for (i = 0; i < ARRAY_LENGTH(trace_marker_paths) && fd < 0; i++)
+		fd = open(trace_marker_paths[i], O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		weston_log("Error: cannot open the kernel trace_marker: %s\n",
+			   strerror(errno));
+		return NULL;
+	}
+
+	stream = zalloc(sizeof(*stream));
+	if (!stream) {
+		close(fd);
+		return NULL;
+	}
+
+	stream->fd = fd;
+	stream->pid = getpid();
+	wl_array_init(&stream->names);
+	wl_array_init(&stream->outputs);
+
+	stream->base.write = weston_log_trace_marker_write;
+	stream->base.record = NULL;
+	stream->base.destroy = weston_log_subscriber_destroy_trace_marker;
+	stream->base.destroy_subscription = NULL;
+	stream->base.complete = NULL;
+	stream->base.binary = true;
+
+	wl_list_init(&stream->base.subscription_list);
+
+	return &stream->base;
+}
@@ -80,6 +80,8 @@ struct weston_log_context {
  * @ingroup log
  */
 struct weston_log_scope {
+	/* First, for weston_log_scope_enabled() */
+	struct weston_log_scope_state state;
 	char *name;
 	char *desc;
 	weston_log_scope_cb new_subscription;
@@ -179,7 +181,7 @@ weston_log_subscription_destroy_pending(struct weston_log_subscription *sub)
  *
  * @memberof weston_log_subscription
  */
-static void
+WL_EXPORT void
 weston_log_subscription_write(struct weston_log_subscription *sub,
 			      const char *data, size_t len)
 {
@@ -187,6 +189,40 @@ weston_log_subscription_write(struct weston_log_subscription *sub,
 		sub->owner->write(sub->owner, data, len);
 }
 
+/** Whether the stream's subscription takes binary records
+ *
+ * @memberof weston_log_subscription
+ */
+WL_EXPORT bool
+weston_log_subscription_is_binary(struct weston_log_subscription *sub)
+{
+	return sub->owner && sub->owner->binary;
+}
+
+/** Let the stream's subscription record a message unformatted
+ *
+ * @returns true if the subscriber took the message, false if it has to be
+ * formatted and written instead
+ *
+ * @memberof weston_log_subscription
+ */
+static bool
+weston_log_subscription_record(struct weston_log_subscription *sub,
+			       const char *fmt, va_list ap)
+{
+	va_list aq;
+	bool ret;
+
+	if (!sub->owner || !sub->owner->record)
+		return false;
+
+	va_copy(aq, ap);
+	ret = sub->owner->record(sub->owner, fmt, aq);
+	va_end(aq);
+
+	return ret;
+}
+
 /** Write a formatted string to the stream's subscription
  *
  * @memberof weston_log_subscription
@@ -202,6 +238,9 @@ weston_log_subscription_vprintf(struct weston_log_subscription *sub,
 	if (!weston_log_scope_is_enabled(sub->source))
 		return;
 
+	if (weston_log_subscription_record(sub, fmt, ap))
+		return;
+
 	len = vasprintf(&str, fmt, ap);
 	if (len >= 0) {
 		weston_log_subscription_write(sub, str, len);
@@ -314,6 +353,7 @@ weston_log_subscription_add(struct weston_log_scope *scope,
 
 	sub->source = scope;
 	wl_list_insert(&scope->subscription_list, &sub->source_link);
+	scope->state.enabled = true;
 }
 
 /** Removes the subscription from the scope's subscription list
@@ -324,8 +364,11 @@ void
 weston_log_subscription_remove(struct weston_log_subscription *sub)
 {
 	assert(sub);
-	if (sub->source)
+	if (sub->source) {
 		wl_list_remove(&sub->source_link);
+		sub->source->state.enabled =
+			!wl_list_empty(&sub->source->subscription_list);
+	}
 	sub->source = NULL;
 }
 
@@ -720,10 +763,7 @@ weston_log_scope_destroy(struct weston_log_scope *scope)
 WL_EXPORT bool
 weston_log_scope_is_enabled(struct weston_log_scope *scope)
 {
-	if (!scope)
-		return false;
-
-	return !wl_list_empty(&scope->subscription_list);
+	return weston_log_scope_enabled(scope);
 }
 
 /** Close the stream's complete callback if one was installed/created.
@@ -793,11 +833,17 @@ weston_log_scope_write(struct weston_log_scope *scope,
  * \param fmt Printf-style format string.
  * \param ap Formatting arguments.
  *
- * Writes to formatted string to all subscribed clients' streams.
+ * Writes to formatted string to all subscribed clients' streams. Streams
+ * that can record the format string and arguments as they are, like the
+ * flight recorder, get those instead, and the string is only formatted
+ * when one of the other streams needs it.
  *
  * The behavioral details for each stream are the same as for
  * weston_debug_stream_write().
  *
+ * \return The length of the formatted string, or 0 if no stream needed
+ * it formatted.
+ *
  * \memberof weston_log_scope
  */
 WL_EXPORT int
@@ -805,20 +851,37 @@ weston_log_scope_vprintf(struct weston_log_scope *scope,
 			 const char *fmt, va_list ap)
 {
 	static const char oom[] = "Out of memory";
-	char *str;
+	struct weston_log_subscription *sub;
+	char *str = NULL;
+	bool formatted = false;
+	va_list aq;
 	int len = 0;
 
 	if (!weston_log_scope_is_enabled(scope))
 		return len;
 
-	len = vasprintf(&str, fmt, ap);
-	if (len >= 0) {
-		weston_log_scope_write(scope, str, len);
-		free(str);
-	} else {
-		weston_log_scope_write(scope, oom, sizeof oom - 1);
+	/* Format at most once, and only for the subscribers that can't
+	 * record the message as it is. */
+	wl_list_for_each(sub, &scope->subscription_list, source_link) {
+		if (weston_log_subscription_record(sub, fmt, ap))
+			continue;
+
+		if (!formatted) {
+			va_copy(aq, ap);
+			len = vasprintf(&str, fmt, aq);
+			va_end(aq);
+			formatted = true;
+		}
+
+		if (len >= 0)
+			weston_log_subscription_write(sub, str, len);
+		else
+			weston_log_subscription_write(sub, oom, sizeof oom - 1);
 	}
 
+	if (len >= 0)
+		free(str);
+
 	return len;
 }
 
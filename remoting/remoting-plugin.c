@@ -41,6 +41,7 @@
 #include <gst/allocators/gstdmabuf.h>
 #include <gst/app/gstappsrc.h>
 #include <gst/video/gstvideometa.h>
+#include <gst/video/video.h>
 
 #include <libweston/remoting-plugin.h>
 #include <libweston/backend-drm.h>
@@ -50,9 +51,17 @@
 #include "shared/string-helpers.h"
 #include "backend.h"
 #include "libweston-internal.h"
+#include "linux-sync-file.h"
 
 #define MAX_RETRY_COUNT	3
 
+/* Quality adaptation, see remoting_output_adapt_handler() */
+#define ADAPT_PERIOD_MSEC	1000
+/* Periods without congestion before trying the next better level */
+#define ADAPT_RECOVER_PERIODS	5
+/* Frames the pipeline may hold before it counts as falling behind */
+#define ADAPT_MAX_IN_FLIGHT	2
+
 struct weston_remoting {
 	struct weston_compositor *compositor;
 	struct wl_list output_list;
@@ -93,6 +102,31 @@ static const struct remoted_output_support_gbm_format supported_formats[] = {
 	}
 };
 
+/* Steps down from the configured quality on a congested link */
+struct remoting_quality_level {
+	/* Of the encoder's configured bitrate or quality */
+	int percent;
+	/* Only every n-th frame is composited and sent */
+	int frame_divisor;
+};
+
+static const struct remoting_quality_level quality_levels[] = {
+	{ 100, 1 },
+	{ 70, 1 },
+	{ 50, 1 },
+	{ 50, 2 },
+	{ 35, 2 },
+	{ 25, 3 },
+	{ 15, 4 },
+};
+
+/* Encoder properties scaled by the quality level, by preference; the
+ * encoder is the element named "encoder" in the pipeline. */
+static const char *const encoder_quality_properties[] = {
+	"bitrate",	/* x264enc, vaapih264enc, ... */
+	"quality",	/* jpegenc */
+};
+
 struct remoted_output {
 	struct weston_output *output;
 	int (*saved_enable)(struct weston_output *output);
@@ -102,6 +136,7 @@ struct remoted_output {
 	char *host;
 	int port;
 	char *gst_pipeline;
+	bool dmabuf;
 	const struct remoted_output_support_gbm_format *format;
 
 	struct weston_head *head;
@@ -120,6 +155,23 @@ struct remoted_output {
 	GstClockTime start_time;
 	int retry_count;
 	enum dpms_enum dpms;
+
+	bool adaptive;
+	struct {
+		struct wl_event_source *timer;
+		int level;
+		int clear_periods;
+
+		GstElement *encoder;
+		GParamSpec *property;
+		gint64 base_value;
+
+		/* Pushed and not released yet */
+		int frames_in_flight;
+		/* Since the last period */
+		int max_in_flight;
+		int qos_events;
+	} adapt;
 };
 
 struct mem_free_cb_data {
@@ -183,28 +235,159 @@ remoting_gst_bus_sync_handler(GstBus *bus, GstMessage *message,
 	return GST_BUS_PASS;
 }
 
+/* The frames are dmabufs either way. Advertising them as such lets
+ * hardware encoders import them, instead of the pipeline mapping them
+ * into system memory. */
+static GstCaps *
+remoting_gst_caps_new(struct remoted_output *output)
+{
+	struct weston_mode *mode = output->output->current_mode;
+	GstCaps *caps;
+
+	if (!output->dmabuf)
+		return gst_caps_new_simple("video/x-raw",
+					   "format", G_TYPE_STRING,
+						     output->format->gst_format_string,
+					   "width", G_TYPE_INT, mode->width,
+					   "height", G_TYPE_INT, mode->height,
+					   "framerate", GST_TYPE_FRACTION,
+							mode->refresh, 1000,
+					   NULL);
+
+#if GST_CHECK_VERSION(1, 24, 0)
+	{
+		/* Virtual outputs are always allocated linear. */
+		gchar *drm_format =
+			gst_video_dma_drm_fourcc_to_string(output->format->gbm_format,
+							   DRM_FORMAT_MOD_LINEAR);
+
+		caps = gst_caps_new_simple("video/x-raw",
+					   "format", G_TYPE_STRING, "DMA_DRM",
+					   "drm-format", G_TYPE_STRING, drm_format,
+					   "width", G_TYPE_INT, mode->width,
+					   "height", G_TYPE_INT, mode->height,
+					   "framerate", GST_TYPE_FRACTION,
+							mode->refresh, 1000,
+					   NULL);
+		g_free(drm_format);
+	}
+#else
+	caps = gst_caps_new_simple("video/x-raw",
+				   "format", G_TYPE_STRING,
+					     output->format->gst_format_string,
+				   "width", G_TYPE_INT, mode->width,
+				   "height", G_TYPE_INT, mode->height,
+				   "framerate", GST_TYPE_FRACTION,
+						mode->refresh, 1000,
+				   NULL);
+#endif
+	if (caps)
+		gst_caps_set_features(caps, 0,
+				      gst_caps_features_new(GST_CAPS_FEATURE_MEMORY_DMABUF,
+							    NULL));
+
+	return caps;
+}
+
+static void
+remoting_gst_adapt_apply(struct remoted_output *output)
+{
+	const struct remoting_quality_level *level =
+		&quality_levels[output->adapt.level];
+	GParamSpec *pspec = output->adapt.property;
+	gint64 value;
+
+	if (!output->adapt.encoder || !pspec)
+		return;
+
+	value = MAX(output->adapt.base_value * level->percent / 100, 1);
+	if (pspec->value_type == G_TYPE_UINT)
+		g_object_set(output->adapt.encoder, pspec->name,
+			     (guint)value, NULL);
+	else
+		g_object_set(output->adapt.encoder, pspec->name,
+			     (gint)value, NULL);
+}
+
+/* Look up what to turn down in a new pipeline. Without an encoder
+ * property to scale, only the framerate is adapted. */
+static void
+remoting_gst_adapt_init(struct remoted_output *output)
+{
+	GstElement *encoder;
+	GParamSpec *pspec;
+	GValue value = G_VALUE_INIT;
+	gint64 base;
+	unsigned int i;
+
+	output->adapt.property = NULL;
+	encoder = gst_bin_get_by_name(GST_BIN(output->pipeline), "encoder");
+	if (!encoder) {
+		weston_log("gst: no element named \"encoder\" in the "
+			   "pipeline, adapting the framerate only\n");
+		return;
+	}
+	output->adapt.encoder = encoder;
+
+	for (i = 0; i < ARRAY_LENGTH(encoder_quality_properties); i++) {
+		pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(encoder),
+						     encoder_quality_properties[i]);
+		if (!pspec || !(pspec->flags & G_PARAM_WRITABLE) ||
+		    (pspec->value_type != G_TYPE_UINT &&
+		     pspec->value_type != G_TYPE_INT))
+			continue;
+
+		g_value_init(&value, pspec->value_type);
+		g_object_get_property(G_OBJECT(encoder), pspec->name, &value);
+		if (pspec->value_type == G_TYPE_UINT)
+			base = g_value_get_uint(&value);
+		else
+			base = g_value_get_int(&value);
+		g_value_unset(&value);
+
+		/* Often stands for a bitrate the encoder picks itself */
+		if (base <= 0)
+			continue;
+
+		output->adapt.property = pspec;
+		output->adapt.base_value = base;
+		break;
+	}
+
+	if (!output->adapt.property)
+		weston_log("gst: encoder %s has no bitrate or quality to "
+			   "scale, adapting the framerate only\n",
+			   GST_OBJECT_NAME(encoder));
+
+	/* A restarted pipeline keeps the level reached */
+	remoting_gst_adapt_apply(output);
+}
+
 static int
 remoting_gst_pipeline_init(struct remoted_output *output)
 {
 	GstCaps *caps;
 	GError *err = NULL;
 	GstStateChangeReturn ret;
-	struct weston_mode *mode = output->output->current_mode;
 
 	if (!output->gst_pipeline) {
 		char pipeline_str[1024];
 		/* TODO: use encodebin instead of jpegenc */
+		const char *encoder = output->dmabuf ?
+			"vaapih264enc name=encoder ! rtph264pay" :
+			"videoconvert ! video/x-raw,format=I420 ! "
+			"jpegenc name=encoder ! rtpjpegpay";
+
 		snprintf(pipeline_str, sizeof(pipeline_str),
 			 "rtpbin name=rtpbin "
-			 "appsrc name=src ! videoconvert ! "
-			 "video/x-raw,format=I420 ! jpegenc ! rtpjpegpay ! "
+			 "appsrc name=src ! %s ! "
 			 "rtpbin.send_rtp_sink_0 "
 			 "rtpbin.send_rtp_src_0 ! "
 			 "udpsink name=sink host=%s port=%d "
 			 "rtpbin.send_rtcp_src_0 ! "
 			 "udpsink host=%s port=%d sync=false async=false "
 			 "udpsrc port=%d ! rtpbin.recv_rtcp_sink_0",
-			 output->host, output->port, output->host,
+			 encoder, output->host, output->port, output->host,
 			 output->port + 1, output->port + 2);
 		output->gst_pipeline = strdup(pipeline_str);
 	}
@@ -233,14 +416,7 @@ remoting_gst_pipeline_init(struct remoted_output *output)
 		goto err;
 	}
 
-	caps = gst_caps_new_simple("video/x-raw",
-				   "format", G_TYPE_STRING,
-					     output->format->gst_format_string,
-				   "width", G_TYPE_INT, mode->width,
-				   "height", G_TYPE_INT, mode->height,
-				   "framerate", GST_TYPE_FRACTION,
-						mode->refresh, 1000,
-				   NULL);
+	caps = remoting_gst_caps_new(output);
 	if (!caps) {
 		weston_log("Could not create gstreamer caps.\n");
 		goto err;
@@ -261,6 +437,9 @@ remoting_gst_pipeline_init(struct remoted_output *output)
 	gst_bus_set_sync_handler(output->bus, remoting_gst_bus_sync_handler,
 				 &output->gstpipe, NULL);
 
+	if (output->adaptive)
+		remoting_gst_adapt_init(output);
+
 	output->start_time = 0;
 	ret = gst_element_set_state(output->pipeline, GST_STATE_PLAYING);
 	if (ret == GST_STATE_CHANGE_FAILURE) {
@@ -271,6 +450,10 @@ remoting_gst_pipeline_init(struct remoted_output *output)
 	return 0;
 
 err:
+	if (output->adapt.encoder) {
+		gst_object_unref(output->adapt.encoder);
+		output->adapt.encoder = NULL;
+	}
 	gst_object_unref(GST_OBJECT(output->pipeline));
 	output->pipeline = NULL;
 	return -1;
@@ -282,6 +465,10 @@ remoting_gst_pipeline_deinit(struct remoted_output *output)
 	if (!output->pipeline)
 		return;
 
+	if (output->adapt.encoder) {
+		gst_object_unref(output->adapt.encoder);
+		output->adapt.encoder = NULL;
+	}
 	gst_element_set_state(output->pipeline, GST_STATE_NULL);
 	if (output->bus)
 		gst_object_unref(GST_OBJECT(output->bus));
@@ -335,6 +522,10 @@ remoting_gst_bus_message_handler(struct remoted_output *output)
 			output->retry_count = 0;
 		break;
 	}
+	case GST_MESSAGE_QOS:
+		/* An element dropped or delayed a late frame */
+		output->adapt.qos_events++;
+		break;
 	case GST_MESSAGE_WARNING:
 		gst_message_parse_warning(message, &error, &debug);
 		weston_log("gst: Warning: %s: %s\n",
@@ -363,6 +554,9 @@ remoting_output_buffer_release(struct remoted_output *output, void *buffer)
 	const struct weston_drm_virtual_output_api *api
 		= output->remoting->virtual_output_api;
 
+	if (output->adapt.frames_in_flight > 0)
+		output->adapt.frames_in_flight--;
+
 	api->buffer_released(buffer);
 }
 
@@ -464,6 +658,17 @@ weston_remoting_get(struct weston_compositor *compositor)
 	return remoting;
 }
 
+/* Composite frames at the rate the quality level allows */
+static int64_t
+remoting_output_frame_msec(struct remoted_output *output)
+{
+	const struct remoting_quality_level *level =
+		&quality_levels[output->adapt.level];
+
+	return millihz_to_nsec(output->output->current_mode->refresh) /
+	       1000000 * level->frame_divisor;
+}
+
 static int
 remoting_output_finish_frame_handler(void *data)
 {
@@ -481,7 +686,7 @@ remoting_output_finish_frame_handler(void *data)
 	}
 
 	if (output->dpms == WESTON_DPMS_ON) {
-		msec = millihz_to_nsec(output->output->current_mode->refresh) / 1000000;
+		msec = remoting_output_frame_msec(output);
 		wl_event_source_timer_update(output->finish_frame_timer, msec);
 	} else {
 		wl_event_source_timer_update(output->finish_frame_timer, 0);
@@ -555,6 +760,10 @@ remoting_output_gst_push_buffer(struct remoted_output *output,
 
 	gst_app_src_push_buffer(output->appsrc, buffer);
 	output->submitted_frame = true;
+
+	output->adapt.frames_in_flight++;
+	output->adapt.max_in_flight = MAX(output->adapt.max_in_flight,
+					  output->adapt.frames_in_flight);
 }
 
 static int
@@ -623,6 +832,13 @@ remoting_output_frame(struct weston_output *output_base, int fd, int stride,
 		return 0;
 	}
 
+	/* Or when the pipeline can wait for the implicit fence itself */
+	if (weston_linux_sync_file_attach_to_dmabuf(fd, output->fence_sync_fd) == 0) {
+		close(output->fence_sync_fd);
+		remoting_output_gst_push_buffer(output, buf);
+		return 0;
+	}
+
 	frame_data = zalloc(sizeof *frame_data);
 	if (!frame_data) {
 		close(output->fence_sync_fd);
@@ -679,8 +895,7 @@ remoting_output_start_repaint_loop(struct weston_output *output)
 
 	remoted_output->saved_start_repaint_loop(output);
 
-	msec = millihz_to_nsec(remoted_output->output->current_mode->refresh)
-			/ 1000000;
+	msec = remoting_output_frame_msec(remoted_output);
 	wl_event_source_timer_update(remoted_output->finish_frame_timer, msec);
 
 	return 0;
@@ -698,6 +913,49 @@ remoting_output_set_dpms(struct weston_output *base_output, enum dpms_enum level
 	remoting_output_finish_frame_handler(output);
 }
 
+/* Each period, step the quality down if the pipeline fell behind or
+ * dropped late frames, and back up after a while without. Stepping
+ * down at once and up slowly keeps the stream from oscillating. */
+static int
+remoting_output_adapt_handler(void *data)
+{
+	struct remoted_output *output = data;
+	int max_level = ARRAY_LENGTH(quality_levels) - 1;
+	int level = output->adapt.level;
+	bool congested;
+
+	congested = output->adapt.qos_events > 0 ||
+		    output->adapt.max_in_flight > ADAPT_MAX_IN_FLIGHT;
+
+	if (!output->pipeline || output->dpms != WESTON_DPMS_ON) {
+		output->adapt.clear_periods = 0;
+	} else if (congested) {
+		output->adapt.clear_periods = 0;
+		level = MIN(level + 1, max_level);
+	} else if (++output->adapt.clear_periods >= ADAPT_RECOVER_PERIODS) {
+		output->adapt.clear_periods = 0;
+		level = MAX(level - 1, 0);
+	}
+
+	output->adapt.qos_events = 0;
+	output->adapt.max_in_flight = output->adapt.frames_in_flight;
+
+	if (level != output->adapt.level) {
+		weston_log("remoting: %s: %s quality to %d%% of the encoder "
+			   "settings at 1/%d of the frame rate\n",
+			   output->output->name,
+			   level > output->adapt.level ? "lowering" : "raising",
+			   quality_levels[level].percent,
+			   quality_levels[level].frame_divisor);
+		output->adapt.level = level;
+		remoting_gst_adapt_apply(output);
+	}
+
+	wl_event_source_timer_update(output->adapt.timer, ADAPT_PERIOD_MSEC);
+
+	return 0;
+}
+
 static int
 remoting_output_enable(struct weston_output *output)
 {
@@ -730,6 +988,15 @@ remoting_output_enable(struct weston_output *output)
 					remoting_output_finish_frame_handler,
 					remoted_output);
 
+	if (remoted_output->adaptive) {
+		remoted_output->adapt.timer =
+			wl_event_loop_add_timer(loop,
+						remoting_output_adapt_handler,
+						remoted_output);
+		wl_event_source_timer_update(remoted_output->adapt.timer,
+					     ADAPT_PERIOD_MSEC);
+	}
+
 	remoted_output->dpms = WESTON_DPMS_ON;
 	return 0;
 }
@@ -740,6 +1007,10 @@ remoting_output_disable(struct weston_output *output)
 	struct remoted_output *remoted_output = lookup_remoted_output(output);
 
 	wl_event_source_remove(remoted_output->finish_frame_timer);
+	if (remoted_output->adapt.timer) {
+		wl_event_source_remove(remoted_output->adapt.timer);
+		remoted_output->adapt.timer = NULL;
+	}
 	remoting_gst_pipeline_deinit(remoted_output);
 
 	return remoted_output->saved_disable(output);
@@ -921,6 +1192,25 @@ remoting_output_set_gst_pipeline(struct weston_output *output,
 	remoted_output->gst_pipeline = strdup(gst_pipeline);
 }
 
+static void
+remoting_output_set_dmabuf(struct weston_output *output, bool dmabuf)
+{
+	struct remoted_output *remoted_output = lookup_remoted_output(output);
+
+	if (remoted_output)
+		remoted_output->dmabuf = dmabuf;
+}
+
+static void
+remoting_output_set_adaptive_quality(struct weston_output *output,
+				     bool adaptive)
+{
+	struct remoted_output *remoted_output = lookup_remoted_output(output);
+
+	if (remoted_output)
+		remoted_output->adaptive = adaptive;
+}
+
 static const struct weston_remoting_api remoting_api = {
 	remoting_output_create,
 	remoting_output_is_remoted,
@@ -930,6 +1220,8 @@ static const struct weston_remoting_api remoting_api = {
 	remoting_output_set_host,
 	remoting_output_set_port,
 	remoting_output_set_gst_pipeline,
+	remoting_output_set_dmabuf,
+	remoting_output_set_adaptive_quality,
 };
 
 WL_EXPORT int
@@ -361,11 +361,7 @@ static const cairo_user_data_key_t weston_cairo_util_load_cairo_surface_key;
 cairo_surface_t *
 load_cairo_surface(const char *filename)
 {
-	cairo_surface_t *surface;
-	cairo_status_t ret;
 	struct weston_image *image;
-	int width, height, stride;
-	void *data;
 
 	image = weston_image_load(filename, WESTON_IMAGE_LOAD_IMAGE |
 					    WESTON_IMAGE_LOAD_ICC);
@@ -373,6 +369,18 @@ load_cairo_surface(const char *filename)
 		return NULL;
 	}
 
+	return cairo_surface_create_for_weston_image(image);
+}
+
+/* Wraps an already loaded image; the surface takes ownership of it. */
+cairo_surface_t *
+cairo_surface_create_for_weston_image(struct weston_image *image)
+{
+	cairo_surface_t *surface;
+	cairo_status_t ret;
+	int width, height, stride;
+	void *data;
+
 	data = pixman_image_get_data(image->pixman_image);
 	width = pixman_image_get_width(image->pixman_image);
 	height = pixman_image_get_height(image->pixman_image);
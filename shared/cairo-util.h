@@ -49,9 +49,14 @@ tile_source(cairo_t *cr, cairo_surface_t *surface,
 void
 rounded_rect(cairo_t *cr, int x0, int y0, int x1, int y1, int radius);
 
+struct weston_image;
+
 cairo_surface_t *
 load_cairo_surface(const char *filename);
 
+cairo_surface_t *
+cairo_surface_create_for_weston_image(struct weston_image *image);
+
 struct weston_image *
 load_cairo_surface_get_user_data(cairo_surface_t *surface);
 
@@ -433,6 +433,10 @@ frame_set_title(struct frame *frame, const char *title)
 {
 	char *dup = NULL;
 
+	if (title == frame->title ||
+	    (title && frame->title && strcmp(title, frame->title) == 0))
+		return 0;
+
 	if (title) {
 		dup = strdup(title);
 		if (!dup)
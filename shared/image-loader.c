@@ -26,18 +26,28 @@
 
 #include "config.h"
 
+#include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <png.h>
 #include <pixman.h>
 
 #include "shared/helpers.h"
 #include "shared/os-compatibility.h"
+#include "shared/simd.h"
+#include "shared/string-helpers.h"
 #include "shared/xalloc.h"
 #include "image-loader.h"
 
@@ -49,6 +59,13 @@
 #include <webp/decode.h>
 #endif
 
+/* AVX2 is picked at run time where the compiler can target it. */
+#if defined(WESTON_SIMD_SSE2) && defined(__x86_64__) && \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define HAVE_PREMULTIPLY_AVX2 1
+#endif
+
 static int
 stride_for_width(int width)
 {
@@ -94,6 +111,17 @@ icc_profile_data_create(void *profdata, uint32_t proflen)
 
 #ifdef HAVE_JPEG
 
+/* libjpeg-turbo can write ARGB32 rows itself, with its own SIMD colour
+ * conversion, instead of us expanding RGB afterwards. It fills X with 0xff. */
+#if defined(JCS_EXTENSIONS) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define JPEG_OUTPUT_COLOR_SPACE JCS_EXT_BGRX
+#define JPEG_OUTPUT_NEEDS_SWIZZLE 0
+#else
+#define JPEG_OUTPUT_COLOR_SPACE JCS_RGB
+#define JPEG_OUTPUT_NEEDS_SWIZZLE 1
+#endif
+
+#if JPEG_OUTPUT_NEEDS_SWIZZLE
 static void
 swizzle_row(JSAMPLE *row, JDIMENSION width)
 {
@@ -108,6 +136,7 @@ swizzle_row(JSAMPLE *row, JDIMENSION width)
 		d--;
 	}
 }
+#endif
 
 struct jpeg_image_data {
 	JSAMPLE *volatile data;
@@ -136,8 +165,10 @@ load_jpeg_image(struct jpeg_decompress_struct *cinfo,
 			rows[i] = jpeg_image_data->data + (first + i) * stride;
 
 		jpeg_read_scanlines(cinfo, rows, ARRAY_LENGTH(rows));
+#if JPEG_OUTPUT_NEEDS_SWIZZLE
 		for (i = 0; first + i < cinfo->output_scanline; i++)
 			swizzle_row(rows[i], cinfo->output_width);
+#endif
 	}
 	jpeg_image_data->all_data_read = true;
 
@@ -207,7 +238,7 @@ load_jpeg(FILE *fp, uint32_t image_load_flags)
 		jpeg_save_markers(&cinfo, JPEG_APP0 + 2, 0xFFFF);
 
 	jpeg_read_header(&cinfo, TRUE);
-	cinfo.out_color_space = JCS_RGB;
+	cinfo.out_color_space = JPEG_OUTPUT_COLOR_SPACE;
 	jpeg_start_decompress(&cinfo);
 
 	image = xzalloc(sizeof(*image));
@@ -262,15 +293,15 @@ multiply_alpha(int alpha, int color)
     return ((temp + (temp >> 8)) >> 8);
 }
 
+/* Turns n RGBA pixels into premultiplied ARGB32 in place. multiply_alpha()
+ * is exact for alpha 0 and 255, so the vector versions need no special
+ * cases and produce the same bytes as the scalar one. */
 static void
-premultiply_data(png_structp   png,
-		 png_row_infop row_info,
-		 png_bytep     data)
+premultiply_row_c(uint8_t *p, unsigned int n)
 {
     unsigned int i;
-    png_bytep p;
 
-    for (i = 0, p = data; i < row_info->rowbytes; i += 4, p += 4) {
+    for (i = 0; i < n; i++, p += 4) {
 	uint32_t alpha = p[3];
 	uint32_t w;
 
@@ -293,6 +324,160 @@ premultiply_data(png_structp   png,
     }
 }
 
+#if defined(WESTON_SIMD_SSE2)
+
+/* Two RGBA pixels widened to 16 bits. */
+static inline __m128i
+premultiply_2px_sse2(__m128i px)
+{
+	const __m128i keep_rgb = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+	const __m128i alpha_one = _mm_setr_epi16(0, 0, 0, 0xff, 0, 0, 0, 0xff);
+	__m128i alpha, t;
+
+	alpha = _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3));
+	alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+	alpha = _mm_or_si128(_mm_and_si128(alpha, keep_rgb), alpha_one);
+
+	t = _mm_add_epi16(_mm_mullo_epi16(px, alpha), _mm_set1_epi16(0x80));
+	t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+
+	/* RGBA to BGRA */
+	t = _mm_shufflelo_epi16(t, _MM_SHUFFLE(3, 0, 1, 2));
+	return _mm_shufflehi_epi16(t, _MM_SHUFFLE(3, 0, 1, 2));
+}
+
+static void
+premultiply_row_sse2(uint8_t *p, unsigned int n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int i;
+
+	for (i = 0; i + 4 <= n; i += 4, p += 16) {
+		__m128i px = _mm_loadu_si128((const __m128i *) p);
+		__m128i lo = premultiply_2px_sse2(_mm_unpacklo_epi8(px, zero));
+		__m128i hi = premultiply_2px_sse2(_mm_unpackhi_epi8(px, zero));
+
+		_mm_storeu_si128((__m128i *) p, _mm_packus_epi16(lo, hi));
+	}
+
+	premultiply_row_c(p, n - i);
+}
+
+#ifdef HAVE_PREMULTIPLY_AVX2
+
+static void __attribute__((target("avx2")))
+premultiply_row_avx2(uint8_t *p, unsigned int n)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i keep_rgb = _mm256_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0,
+						   -1, -1, -1, 0, -1, -1, -1, 0);
+	const __m256i alpha_one = _mm256_setr_epi16(0, 0, 0, 0xff, 0, 0, 0, 0xff,
+						    0, 0, 0, 0xff, 0, 0, 0, 0xff);
+	const __m256i bias = _mm256_set1_epi16(0x80);
+	unsigned int i;
+	int h;
+
+	for (i = 0; i + 8 <= n; i += 8, p += 32) {
+		__m256i px = _mm256_loadu_si256((const __m256i *) p);
+		__m256i half[2] = {
+			_mm256_unpacklo_epi8(px, zero),
+			_mm256_unpackhi_epi8(px, zero),
+		};
+
+		for (h = 0; h < 2; h++) {
+			__m256i alpha, t;
+
+			alpha = _mm256_shufflelo_epi16(half[h], _MM_SHUFFLE(3, 3, 3, 3));
+			alpha = _mm256_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+			alpha = _mm256_or_si256(_mm256_and_si256(alpha, keep_rgb),
+						alpha_one);
+
+			t = _mm256_add_epi16(_mm256_mullo_epi16(half[h], alpha), bias);
+			t = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+			t = _mm256_shufflelo_epi16(t, _MM_SHUFFLE(3, 0, 1, 2));
+			half[h] = _mm256_shufflehi_epi16(t, _MM_SHUFFLE(3, 0, 1, 2));
+		}
+
+		/* unpack and pack both work within 128-bit lanes, so the
+		 * pixel order comes back unchanged. */
+		_mm256_storeu_si256((__m256i *) p,
+				    _mm256_packus_epi16(half[0], half[1]));
+	}
+
+	premultiply_row_sse2(p, n - i);
+}
+
+#endif /* HAVE_PREMULTIPLY_AVX2 */
+
+#elif defined(WESTON_SIMD_NEON)
+
+static inline uint8x8_t
+multiply_alpha_neon(uint8x8_t alpha, uint8x8_t color)
+{
+	uint16x8_t t = vmlal_u8(vdupq_n_u16(0x80), alpha, color);
+
+	return vshrn_n_u16(vsraq_n_u16(t, t, 8), 8);
+}
+
+static void
+premultiply_row_neon(uint8_t *p, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i + 16 <= n; i += 16, p += 64) {
+		uint8x16x4_t in = vld4q_u8(p);
+		uint8x16x4_t out;
+
+		out.val[0] = vcombine_u8(multiply_alpha_neon(vget_low_u8(in.val[3]),
+							     vget_low_u8(in.val[2])),
+					 multiply_alpha_neon(vget_high_u8(in.val[3]),
+							     vget_high_u8(in.val[2])));
+		out.val[1] = vcombine_u8(multiply_alpha_neon(vget_low_u8(in.val[3]),
+							     vget_low_u8(in.val[1])),
+					 multiply_alpha_neon(vget_high_u8(in.val[3]),
+							     vget_high_u8(in.val[1])));
+		out.val[2] = vcombine_u8(multiply_alpha_neon(vget_low_u8(in.val[3]),
+							     vget_low_u8(in.val[0])),
+					 multiply_alpha_neon(vget_high_u8(in.val[3]),
+							     vget_high_u8(in.val[0])));
+		out.val[3] = in.val[3];
+
+		vst4q_u8(p, out);
+	}
+
+	premultiply_row_c(p, n - i);
+}
+
+#endif
+
+static void (*premultiply_row)(uint8_t *p, unsigned int n);
+static pthread_once_t premultiply_row_once = PTHREAD_ONCE_INIT;
+
+static void
+premultiply_row_select(void)
+{
+#if defined(WESTON_SIMD_SSE2)
+	premultiply_row = premultiply_row_sse2;
+#ifdef HAVE_PREMULTIPLY_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		premultiply_row = premultiply_row_avx2;
+#endif
+#elif defined(WESTON_SIMD_NEON)
+	premultiply_row = premultiply_row_neon;
+#else
+	premultiply_row = premultiply_row_c;
+#endif
+}
+
+static void
+premultiply_data(png_structp   png,
+		 png_row_infop row_info,
+		 png_bytep     data)
+{
+	pthread_once(&premultiply_row_once, premultiply_row_select);
+	premultiply_row(data, row_info->rowbytes / 4);
+}
+
 static void
 read_func(png_structp png, png_bytep data, png_size_t size)
 {
@@ -493,7 +678,8 @@ load_webp(FILE *fp, uint32_t image_load_flags)
 		return NULL;
 	}
 
-	config.output.colorspace = MODE_BGRA;
+	/* premultiplied, as PIXMAN_a8r8g8b8 expects */
+	config.output.colorspace = MODE_bgrA;
 	config.output.u.RGBA.stride = stride_for_width(config.input.width);
 	config.output.u.RGBA.size =
 		config.output.u.RGBA.stride * config.input.height;
@@ -623,6 +809,447 @@ weston_image_load(const char *filename, uint32_t image_load_flags)
 	return image;
 }
 
+/* Decoded images are cached as a small header followed by the raw
+ * pixels, so that a cache hit is a single mmap(). */
+#define IMAGE_CACHE_MAGIC 0x474d4957 /* "WIMG" */
+#define IMAGE_CACHE_VERSION 1
+#define IMAGE_CACHE_HEADER_SIZE 64
+
+struct image_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	int64_t source_mtime;
+	int64_t source_size;
+	int32_t max_width;
+	int32_t max_height;
+	uint32_t format;
+	int32_t width;
+	int32_t height;
+	int32_t stride;
+};
+
+struct image_cache_mapping {
+	void *data;
+	size_t size;
+};
+
+static void
+image_cache_mapping_destroy(pixman_image_t *image, void *data)
+{
+	struct image_cache_mapping *mapping = data;
+
+	munmap(mapping->data, mapping->size);
+	free(mapping);
+}
+
+static char *
+image_cache_path(const char *filename,
+		 const struct weston_image_load_options *options)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *home;
+	const unsigned char *p;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	int32_t dims[2] = { options->max_width, options->max_height };
+	char *source;
+	char *path;
+	size_t i;
+
+	source = realpath(filename, NULL);
+	if (!source)
+		return NULL;
+
+	/* FNV-1a over the source path and the requested size */
+	for (p = (const unsigned char *) source; *p; p++)
+		hash = (hash ^ *p) * 0x100000001b3ull;
+	for (i = 0, p = (const unsigned char *) dims; i < sizeof dims; i++)
+		hash = (hash ^ p[i]) * 0x100000001b3ull;
+	free(source);
+
+	if (base && base[0] == '/') {
+		str_printf(&path, "%s/weston/images/%016" PRIx64 ".raw",
+			   base, hash);
+	} else {
+		home = getenv("HOME");
+		if (!home || home[0] != '/')
+			return NULL;
+		str_printf(&path, "%s/.cache/weston/images/%016" PRIx64 ".raw",
+			   home, hash);
+	}
+
+	return path;
+}
+
+static bool
+image_cache_header_matches(const struct image_cache_header *header,
+			   const struct stat *source,
+			   const struct weston_image_load_options *options)
+{
+	return header->magic == IMAGE_CACHE_MAGIC &&
+	       header->version == IMAGE_CACHE_VERSION &&
+	       header->source_mtime == (int64_t) source->st_mtime &&
+	       header->source_size == (int64_t) source->st_size &&
+	       header->max_width == options->max_width &&
+	       header->max_height == options->max_height;
+}
+
+static struct weston_image *
+image_cache_load(const char *path, const struct stat *source,
+		 const struct weston_image_load_options *options)
+{
+	const struct image_cache_header *header;
+	struct image_cache_mapping *mapping;
+	struct weston_image *image;
+	pixman_image_t *pixman_image;
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size < IMAGE_CACHE_HEADER_SIZE) {
+		close(fd);
+		return NULL;
+	}
+
+	/* Private and writable, so that a user drawing into the image
+	 * only ever touches its own copy of the pages. */
+	data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		    fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	header = data;
+	if (!image_cache_header_matches(header, source, options) ||
+	    header->width <= 0 || header->height <= 0 ||
+	    header->stride < header->width * 4 ||
+	    (uint64_t) header->stride * header->height >
+	    (uint64_t) st.st_size - IMAGE_CACHE_HEADER_SIZE) {
+		munmap(data, st.st_size);
+		return NULL;
+	}
+
+	pixman_image = pixman_image_create_bits(header->format,
+						header->width, header->height,
+						(uint32_t *) ((char *) data +
+							      IMAGE_CACHE_HEADER_SIZE),
+						header->stride);
+	if (!pixman_image) {
+		munmap(data, st.st_size);
+		return NULL;
+	}
+
+	mapping = xzalloc(sizeof *mapping);
+	mapping->data = data;
+	mapping->size = st.st_size;
+	pixman_image_set_destroy_function(pixman_image,
+					  image_cache_mapping_destroy, mapping);
+
+	image = xzalloc(sizeof *image);
+	image->pixman_image = pixman_image;
+
+	return image;
+}
+
+static int
+mkdir_parents(char *path)
+{
+	char *p;
+
+	for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+			*p = '/';
+			return -1;
+		}
+		*p = '/';
+	}
+
+	return 0;
+}
+
+static bool
+write_all(int fd, const void *data, size_t size)
+{
+	const char *p = data;
+	ssize_t len;
+
+	while (size > 0) {
+		len = write(fd, p, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return false;
+		p += len;
+		size -= len;
+	}
+
+	return true;
+}
+
+static void
+image_cache_store(char *path, const struct stat *source,
+		  const struct weston_image_load_options *options,
+		  pixman_image_t *pixman_image)
+{
+	char header_data[IMAGE_CACHE_HEADER_SIZE] = { 0 };
+	struct image_cache_header header = {
+		.magic = IMAGE_CACHE_MAGIC,
+		.version = IMAGE_CACHE_VERSION,
+		.source_mtime = source->st_mtime,
+		.source_size = source->st_size,
+		.max_width = options->max_width,
+		.max_height = options->max_height,
+		.format = pixman_image_get_format(pixman_image),
+		.width = pixman_image_get_width(pixman_image),
+		.height = pixman_image_get_height(pixman_image),
+		.stride = pixman_image_get_stride(pixman_image),
+	};
+	char *tmp;
+	bool ok;
+	int fd;
+
+	static_assert(sizeof header <= IMAGE_CACHE_HEADER_SIZE,
+		      "image cache header does not fit");
+
+	if (mkdir_parents(path) < 0)
+		return;
+
+	/* Write aside and rename, so concurrent readers never see a
+	 * partial entry. */
+	str_printf(&tmp, "%s.XXXXXX", path);
+	if (!tmp)
+		return;
+
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		free(tmp);
+		return;
+	}
+
+	memcpy(header_data, &header, sizeof header);
+	ok = write_all(fd, header_data, sizeof header_data) &&
+	     write_all(fd, pixman_image_get_data(pixman_image),
+		       (size_t) header.stride * header.height);
+	close(fd);
+
+	if (!ok || rename(tmp, path) < 0)
+		unlink(tmp);
+
+	free(tmp);
+}
+
+static pixman_image_t *
+image_downscale(pixman_image_t *src, int32_t max_width, int32_t max_height)
+{
+	int width = pixman_image_get_width(src);
+	int height = pixman_image_get_height(src);
+	pixman_transform_t transform;
+	pixman_image_t *dst;
+	int dst_width, dst_height;
+	double scale;
+
+	scale = MAX((double) max_width / width, (double) max_height / height);
+	if (scale >= 1.0)
+		return NULL;
+
+	dst_width = MAX(1, (int) ceil(width * scale));
+	dst_height = MAX(1, (int) ceil(height * scale));
+
+	dst = pixman_image_create_bits(pixman_image_get_format(src),
+				       dst_width, dst_height, NULL, 0);
+	if (!dst)
+		return NULL;
+
+	pixman_transform_init_scale(&transform,
+				    pixman_double_to_fixed((double) width / dst_width),
+				    pixman_double_to_fixed((double) height / dst_height));
+	pixman_image_set_transform(src, &transform);
+	pixman_image_set_filter(src, PIXMAN_FILTER_GOOD, NULL, 0);
+	pixman_image_composite32(PIXMAN_OP_SRC, src, NULL, dst,
+				 0, 0, 0, 0, 0, 0, dst_width, dst_height);
+	pixman_image_set_transform(src, NULL);
+
+	return dst;
+}
+
+/**
+ * Load an image, optionally downscaled and through the decoded-image cache.
+ *
+ * \param filename The full image filename, i.e. the path plus filename.
+ * \param options How to load the image.
+ * \return A struct weston_image on success, NULL on failure.
+ *
+ * When options->max_width and options->max_height are both positive, an
+ * image larger than needed is scaled down to the smallest size that still
+ * covers that area, keeping its aspect ratio. Images are never scaled up.
+ *
+ * With options->use_cache, the resulting pixels are kept in
+ * $XDG_CACHE_HOME/weston/images and mapped back in on the next load as long
+ * as the source file's size and modification time are unchanged. ICC
+ * profiles are not cached, so the cache is bypassed when
+ * WESTON_IMAGE_LOAD_ICC is requested.
+ */
+struct weston_image *
+weston_image_load_with_options(const char *filename,
+			       const struct weston_image_load_options *options)
+{
+	struct weston_image *image;
+	pixman_image_t *scaled;
+	char *cache_path = NULL;
+	struct stat st;
+
+	if (!filename || !*filename)
+		return NULL;
+
+	if (options->use_cache &&
+	    options->flags == WESTON_IMAGE_LOAD_IMAGE &&
+	    stat(filename, &st) == 0) {
+		cache_path = image_cache_path(filename, options);
+		image = cache_path ?
+			image_cache_load(cache_path, &st, options) : NULL;
+		if (image) {
+			free(cache_path);
+			return image;
+		}
+	}
+
+	image = weston_image_load(filename, options->flags);
+	if (!image || !image->pixman_image)
+		goto out;
+
+	if (options->max_width > 0 && options->max_height > 0) {
+		scaled = image_downscale(image->pixman_image,
+					 options->max_width,
+					 options->max_height);
+		if (scaled) {
+			pixman_image_unref(image->pixman_image);
+			image->pixman_image = scaled;
+		}
+	}
+
+	if (cache_path)
+		image_cache_store(cache_path, &st, options,
+				  image->pixman_image);
+
+out:
+	free(cache_path);
+	return image;
+}
+
+struct weston_image_async {
+	pthread_t thread;
+	int fd[2];
+	char *filename;
+	struct weston_image_load_options options;
+	struct weston_image *image;
+};
+
+static void *
+image_async_thread(void *data)
+{
+	struct weston_image_async *async = data;
+
+	async->image = weston_image_load_with_options(async->filename,
+						      &async->options);
+
+	/* Readers see EOF on fd[0] once the image is ready. */
+	close(async->fd[1]);
+
+	return NULL;
+}
+
+/**
+ * Start loading an image on a worker thread.
+ *
+ * \param filename The full image filename, i.e. the path plus filename.
+ * \param options How to load the image, see weston_image_load_with_options.
+ * \return A handle for the pending load, NULL on failure.
+ *
+ * The file descriptor returned by weston_image_async_get_fd() becomes
+ * readable once decoding is done. The caller must then, or whenever it gives
+ * up on the image, call weston_image_async_finish() exactly once.
+ */
+struct weston_image_async *
+weston_image_load_async(const char *filename,
+			const struct weston_image_load_options *options)
+{
+	struct weston_image_async *async;
+	sigset_t blocked, saved;
+	int ret;
+
+	if (!filename || !*filename)
+		return NULL;
+
+	async = xzalloc(sizeof *async);
+	async->filename = xstrdup(filename);
+	async->options = *options;
+
+	if (pipe(async->fd) < 0)
+		goto err_free;
+
+	if (os_fd_set_cloexec(async->fd[0]) < 0 ||
+	    os_fd_set_cloexec(async->fd[1]) < 0)
+		goto err_pipe;
+
+	/* Leave signal handling to the caller's main loop. */
+	sigfillset(&blocked);
+	pthread_sigmask(SIG_BLOCK, &blocked, &saved);
+	ret = pthread_create(&async->thread, NULL, image_async_thread, async);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (ret != 0)
+		goto err_pipe;
+
+	return async;
+
+err_pipe:
+	close(async->fd[0]);
+	close(async->fd[1]);
+err_free:
+	free(async->filename);
+	free(async);
+	return NULL;
+}
+
+/**
+ * Get a file descriptor that becomes readable when the load is done.
+ *
+ * \param async The pending load.
+ * \return A file descriptor owned by \p async.
+ */
+int
+weston_image_async_get_fd(struct weston_image_async *async)
+{
+	return async->fd[0];
+}
+
+/**
+ * Wait for an asynchronous load and release it.
+ *
+ * \param async The pending load, freed by this call.
+ * \return The loaded image, or NULL if it could not be loaded.
+ *
+ * This blocks if the worker has not finished yet. Callers that are no longer
+ * interested in the image destroy the returned image themselves.
+ */
+struct weston_image *
+weston_image_async_finish(struct weston_image_async *async)
+{
+	struct weston_image *image;
+
+	pthread_join(async->thread, NULL);
+	image = async->image;
+
+	close(async->fd[0]);
+	free(async->filename);
+	free(async);
+
+	return image;
+}
+
 /**
  * Destroy a struct weston_image object.
  *
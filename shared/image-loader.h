@@ -26,6 +26,8 @@
 #ifndef _IMAGE_LOADER_H
 #define _IMAGE_LOADER_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <pixman.h>
 
 enum weston_image_load_flags {
@@ -44,9 +46,36 @@ struct weston_image {
         struct icc_profile_data *icc_profile_data;
 };
 
+struct weston_image_load_options {
+        /** enum weston_image_load_flags */
+        uint32_t flags;
+        /** When both are positive, downscale the image to the smallest
+         * size that still covers max_width x max_height. */
+        int32_t max_width;
+        int32_t max_height;
+        /** Keep the decoded pixels in the user's cache directory. */
+        bool use_cache;
+};
+
+struct weston_image_async;
+
 struct weston_image *
 weston_image_load(const char *filename, uint32_t image_load_flags);
 
+struct weston_image *
+weston_image_load_with_options(const char *filename,
+                               const struct weston_image_load_options *options);
+
+struct weston_image_async *
+weston_image_load_async(const char *filename,
+                        const struct weston_image_load_options *options);
+
+int
+weston_image_async_get_fd(struct weston_image_async *async);
+
+struct weston_image *
+weston_image_async_finish(struct weston_image_async *async);
+
 void
 weston_image_destroy(struct weston_image *image);
 
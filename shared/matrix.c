@@ -133,6 +133,15 @@ weston_matrix_transform_coord(const struct weston_matrix *matrix,
 	struct weston_coord out;
 	struct weston_vector t = { { c.x, c.y, 0.0, 1.0 } };
 
+	/* Without rotation or projection, x and y only get scaled and
+	 * translated, and w stays 1. Same single precision as below. */
+	if (!(matrix->type & (WESTON_MATRIX_TRANSFORM_ROTATE |
+			      WESTON_MATRIX_TRANSFORM_OTHER))) {
+		out.x = t.f[0] * matrix->d[0] + matrix->d[12];
+		out.y = t.f[1] * matrix->d[5] + matrix->d[13];
+		return out;
+	}
+
 	weston_matrix_transform(matrix, &t);
 
 	assert(fabsf(t.f[3]) > 1e-6);
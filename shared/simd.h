@@ -0,0 +1,49 @@
+/*
+ * Copyright © 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_SIMD_H
+#define WESTON_SIMD_H
+
+/*
+ * SSE2 and NEON are part of the x86-64 and AArch64 baselines, so vector
+ * code paths using them are selected at build time, with no run-time
+ * dispatch. Anything wider has to be checked for at run time by the user.
+ *
+ * WESTON_SIMD_SSE2 or WESTON_SIMD_NEON tells which intrinsics are
+ * available, WESTON_HAVE_SIMD that either one is.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define WESTON_SIMD_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define WESTON_SIMD_NEON 1
+#endif
+
+#if defined(WESTON_SIMD_SSE2) || defined(WESTON_SIMD_NEON)
+#define WESTON_HAVE_SIMD 1
+#endif
+
+#endif /* WESTON_SIMD_H */
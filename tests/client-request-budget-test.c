@@ -0,0 +1,142 @@
+/*
+ * Copyright © 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libweston-internal.h"
+#include "client-requests.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+
+#define BUDGET 16
+#define FLOOD 2000
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = WESTON_RENDERER_PIXMAN;
+	setup.width = 320;
+	setup.height = 240;
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.logging_scopes = "log,test-harness-plugin";
+	setup.refresh = HIGHEST_OUTPUT_REFRESH;
+
+	weston_ini_setup(&setup,
+			 cfgln("[core]"),
+			 cfgln("client-request-budget=%d", BUDGET));
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+/*
+ * A client sends far more requests than the budget in one go. The
+ * compositor must dispatch its priority loop in between them, and still
+ * handle every request and repaint as usual.
+ */
+TEST(flood_with_budget)
+{
+	struct wet_testsuite_data *suite_data = TEST_GET_SUITE_DATA();
+	struct client *client;
+	struct wl_surface *surface;
+	struct buffer *buf;
+	pixman_color_t red;
+	int frame;
+	int i;
+
+	color_rgb888(&red, 255, 0, 0);
+
+	client = create_client_and_test_surface(100, 50, 100, 100);
+	assert(client);
+	surface = client->surface->wl_surface;
+
+	buf = create_shm_buffer_a8r8g8b8(client, 100, 100);
+	fill_image_with_color(buf->image, &red);
+	wl_surface_attach(surface, buf->proxy, 0, 0);
+
+	/* libwayland-client writes these out whenever its buffer fills up,
+	 * so the compositor reads many more than BUDGET at once. */
+	for (i = 0; i < FLOOD; i++)
+		wl_surface_damage_buffer(surface, i % 100, i / 100 % 100, 1, 1);
+
+	client_push_breakpoint(client, suite_data,
+			       WESTON_TEST_BREAKPOINT_POST_REPAINT,
+			       (struct wl_proxy *) client->output->wl_output);
+
+	frame_callback_set(surface, &frame);
+	wl_surface_commit(surface);
+
+	RUN_INSIDE_BREAKPOINT(client, suite_data) {
+		struct weston_compositor *compositor = breakpoint->compositor;
+		struct weston_client_requests *requests;
+		struct weston_surface *wsurface;
+		struct wl_resource *res;
+		bool preempted = false;
+
+		assert(breakpoint->template_->breakpoint ==
+		       WESTON_TEST_BREAKPOINT_POST_REPAINT);
+		assert(compositor->client_request_budget == BUDGET);
+
+		/* the test client runs inside the compositor process */
+		wl_list_for_each(requests, &compositor->client_requests_list,
+				 link) {
+			if (requests->pid != getpid())
+				continue;
+			if (requests->total < FLOOD)
+				continue;
+
+			testlog("peak %u requests per dispatch, "
+				"%u times over budget\n",
+				requests->peak_dispatch, requests->over_budget);
+			assert(requests->peak_dispatch > BUDGET);
+			assert(requests->over_budget > 0);
+			preempted = true;
+		}
+		assert(preempted);
+
+		/* the surface is still shown */
+		res = wl_client_get_object(suite_data->wl_client,
+					   wl_proxy_get_id((struct wl_proxy *)
+							   surface));
+		assert(res);
+		wsurface = wl_resource_get_user_data(res);
+		assert(weston_surface_is_mapped(wsurface));
+		assert(wsurface->buffer_ref.buffer);
+		assert(wsurface->buffer_ref.buffer->resource);
+	}
+
+	frame_callback_wait(client, &frame);
+	client_roundtrip(client);
+
+	buffer_destroy(buf);
+	client_destroy(client);
+}
@@ -0,0 +1,387 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Cost of the color-lcms transformations, run with 'meson test --benchmark'.
+ * For every pair of profiles in a small corpus of matrix-shaper and cLUT ICC
+ * profiles this reports how long a surface-to-blend transformation takes to
+ * create, which pipeline the GL renderer gets to build a shader for, and,
+ * for pipelines that fall back to a 3D LUT, the time to fill the LUT and
+ * its interpolation error at a few sizes. That is the data needed to trade
+ * the 3D LUT size off against precision. Nothing is asserted.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include <libweston/libweston.h>
+#include "libweston-internal.h"
+#include "libweston/color-lcms/color-lcms.h"
+#include "color-properties.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "weston-test-runner.h"
+#include "weston-test-fixture-compositor.h"
+#include "lcms_util.h"
+
+#define BENCH_CREATE_ITERATIONS 16
+#define BENCH_CURVE_ITERATIONS 64
+#define BENCH_PRECISION_SAMPLES 65536
+
+/* Sizes of 3D LUT to compare; 33 is what color-lcms uses. */
+static const unsigned lut_sizes[] = { 9, 17, 33, 65 };
+
+enum profile_type {
+	PTYPE_MATRIX_SHAPER,
+	PTYPE_CLUT,
+};
+
+struct bench_profile_desc {
+	const char *name;
+	const struct lcms_pipeline *pipeline;
+	enum profile_type type;
+	int clut_dim_size;
+	float clut_roundtrip_tolerance;
+	double vcgt_exponents[COLOR_CHAN_NUM];
+};
+
+static const struct bench_profile_desc corpus[] = {
+	{ "sRGB MAT",          &pipeline_sRGB,     PTYPE_MATRIX_SHAPER },
+	{ "adobeRGB MAT",      &pipeline_adobeRGB, PTYPE_MATRIX_SHAPER },
+	{ "BT2020 MAT",        &pipeline_BT2020,   PTYPE_MATRIX_SHAPER },
+	{ "adobeRGB MAT VCGT", &pipeline_adobeRGB, PTYPE_MATRIX_SHAPER, 0, 0.0f, { 1.1, 1.2, 1.3 } },
+	{ "sRGB CLUT",         &pipeline_sRGB,     PTYPE_CLUT, 17, 0.0005f },
+	{ "adobeRGB CLUT",     &pipeline_adobeRGB, PTYPE_CLUT, 17, 0.0065f },
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	/* color-lcms needs a renderer with color operations. */
+	setup.renderer = WESTON_RENDERER_GL;
+	setup.shell = SHELL_TEST_DESKTOP;
+
+	weston_ini_setup(&setup,
+		cfgln("[core]"),
+		cfgln("color-management=true"));
+
+	return weston_test_harness_execute_as_plugin(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+static int64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return timespec_to_nsec(&ts);
+}
+
+/* Deterministic so that every run measures the same points. */
+static uint32_t
+bench_random(uint32_t *seed)
+{
+	*seed = *seed * 1103515245u + 12345u;
+
+	return *seed >> 8;
+}
+
+static struct weston_color_profile *
+bench_profile_create(struct weston_compositor *compositor,
+		     const struct bench_profile_desc *desc)
+{
+	struct weston_color_manager *cm = compositor->color_manager;
+	struct weston_color_profile *cprof = NULL;
+	cmsHPROFILE profile = NULL;
+	cmsUInt32Number len = 0;
+	char *errmsg = NULL;
+	void *icc;
+	bool saved;
+
+	switch (desc->type) {
+	case PTYPE_MATRIX_SHAPER:
+		profile = build_lcms_matrix_shaper_profile_output(NULL,
+								  desc->pipeline,
+								  desc->vcgt_exponents);
+		break;
+	case PTYPE_CLUT:
+		profile = build_lcms_clut_profile_output(NULL,
+							 desc->pipeline,
+							 desc->vcgt_exponents,
+							 desc->clut_dim_size,
+							 desc->clut_roundtrip_tolerance);
+		break;
+	}
+	assert(profile);
+
+	saved = cmsSaveProfileToMem(profile, NULL, &len);
+	assert(saved);
+	icc = xzalloc(len);
+	saved = cmsSaveProfileToMem(profile, icc, &len);
+	assert(saved);
+	cmsCloseProfile(profile);
+
+	if (!cm->get_color_profile_from_icc(cm, icc, len, desc->name,
+					    &cprof, &errmsg)) {
+		testlog("%s: %s\n", desc->name, errmsg);
+		free(errmsg);
+	}
+	free(icc);
+
+	return cprof;
+}
+
+/* Sample the LUT like GL_LINEAR on a 3D texture does, with the texel
+ * centers mapped onto [0.0, 1.0]. */
+static void
+lut_sample(const float *lut, unsigned len, const float in[3], float out[3])
+{
+	unsigned lo[3];
+	float frac[3];
+	unsigned c, corner;
+
+	for (c = 0; c < 3; c++) {
+		float pos = in[c] * (len - 1);
+
+		lo[c] = MIN((unsigned)pos, len - 2);
+		frac[c] = pos - lo[c];
+		out[c] = 0.0f;
+	}
+
+	for (corner = 0; corner < 8; corner++) {
+		unsigned r = lo[0] + (corner & 1);
+		unsigned g = lo[1] + ((corner >> 1) & 1);
+		unsigned b = lo[2] + ((corner >> 2) & 1);
+		const float *texel = lut + 3 * (len * len * b + len * g + r);
+		float weight = 1.0f;
+
+		for (c = 0; c < 3; c++)
+			weight *= (corner >> c) & 1 ? frac[c] : 1.0f - frac[c];
+
+		for (c = 0; c < 3; c++)
+			out[c] += weight * texel[c];
+	}
+}
+
+/* Two-norm error of the interpolated LUT against LittleCMS evaluating the
+ * same mapping directly, in units of 1/255. */
+static void
+lut_error(struct cmlcms_color_transform *xform, const float *lut, unsigned len,
+	  double *max_err, double *mean_err)
+{
+	uint32_t seed = 1;
+	double sum = 0.0;
+	unsigned i, c;
+
+	*max_err = 0.0;
+
+	for (i = 0; i < BENCH_PRECISION_SAMPLES; i++) {
+		float in[3], ref[3], got[3];
+		double err = 0.0;
+
+		for (c = 0; c < 3; c++)
+			in[c] = (bench_random(&seed) & 0xffff) / 65535.0f;
+
+		cmsDoTransform(xform->cmap_3dlut, in, ref, 1);
+		lut_sample(lut, len, in, got);
+
+		for (c = 0; c < 3; c++) {
+			float d = got[c] - CLIP(ref[c], 0.0f, 1.0f);
+
+			err += d * d;
+		}
+		err = sqrt(err) * 255.0;
+
+		*max_err = MAX(*max_err, err);
+		sum += err;
+	}
+
+	*mean_err = sum / BENCH_PRECISION_SAMPLES;
+}
+
+static void
+bench_curve(struct weston_color_transform *xform, const char *which,
+	    const struct weston_color_curve *curve)
+{
+	unsigned len = curve->u.lut_3x1d.optimal_len;
+	float *values;
+	int64_t start;
+	int i;
+
+	if (curve->type != WESTON_COLOR_CURVE_TYPE_LUT_3x1D)
+		return;
+
+	values = xcalloc(3 * len, sizeof *values);
+
+	start = bench_now();
+	for (i = 0; i < BENCH_CURVE_ITERATIONS; i++)
+		curve->u.lut_3x1d.fill_in(xform, values, len);
+	testlog("    %s curve 3x1D LUT [%u]: %10.1f us to fill\n", which, len,
+		(bench_now() - start) / 1000.0 / BENCH_CURVE_ITERATIONS);
+
+	free(values);
+}
+
+static void
+bench_lut3d(struct weston_color_transform *xform_base)
+{
+	struct cmlcms_color_transform *xform = to_cmlcms_xform(xform_base);
+	unsigned optimal = xform_base->mapping.u.lut3d.optimal_len;
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(lut_sizes); i++) {
+		unsigned len = lut_sizes[i];
+		float *lut;
+		double max_err, mean_err;
+		int64_t elapsed;
+
+		lut = xcalloc(3 * len * len * len, sizeof *lut);
+
+		elapsed = bench_now();
+		xform_base->mapping.u.lut3d.fill_in(xform_base, lut, len);
+		elapsed = bench_now() - elapsed;
+
+		lut_error(xform, lut, len, &max_err, &mean_err);
+
+		/* The GL renderer uploads the LUT as GL_RGB32F. */
+		testlog("    3D LUT %2u%s: %10.1f us to fill, %7u KiB texture, "
+			"error max %.3f mean %.3f /255\n",
+			len, len == optimal ? "*" : " ", elapsed / 1000.0,
+			(unsigned)(3 * sizeof(float) * len * len * len / 1024),
+			max_err, mean_err);
+
+		free(lut);
+	}
+}
+
+static void
+bench_transform(struct weston_compositor *compositor,
+		struct weston_surface *surface, struct weston_output *output,
+		const char *in_name, const char *out_name)
+{
+	struct weston_color_manager *cm = compositor->color_manager;
+	struct weston_surface_color_transform surf_xform = {};
+	struct weston_color_transform *xform;
+	int64_t elapsed = 0;
+	int64_t start;
+	char *str;
+	bool ok;
+	int i;
+
+	/* Nothing else holds the transformation, so releasing it destroys
+	 * it, and every iteration creates it from scratch. */
+	for (i = 0; i < BENCH_CREATE_ITERATIONS; i++) {
+		start = bench_now();
+		ok = cm->get_surface_color_transform(cm, surface, output,
+						     &surf_xform);
+		elapsed += bench_now() - start;
+		assert(ok);
+
+		weston_surface_color_transform_fini(&surf_xform);
+	}
+
+	ok = cm->get_surface_color_transform(cm, surface, output,
+					     &surf_xform);
+	assert(ok);
+	xform = surf_xform.transform;
+
+	str = xform ? weston_color_transform_string(xform) :
+		      xstrdup("pipeline: identity\n");
+	testlog("%s -> %s: %10.1f us to create, %s", in_name, out_name,
+		elapsed / 1000.0 / BENCH_CREATE_ITERATIONS, str);
+	free(str);
+
+	if (xform) {
+		bench_curve(xform, "pre", &xform->pre_curve);
+		if (xform->mapping.type == WESTON_COLOR_MAPPING_TYPE_3D_LUT)
+			bench_lut3d(xform);
+		bench_curve(xform, "post", &xform->post_curve);
+	}
+
+	weston_surface_color_transform_fini(&surf_xform);
+}
+
+PLUGIN_TEST(color_lcms_transforms)
+{
+	/* struct weston_compositor *compositor; */
+	struct weston_color_manager *cm = compositor->color_manager;
+	const struct weston_render_intent_info *intent;
+	struct weston_color_profile *profiles[ARRAY_LENGTH(corpus)];
+	struct weston_color_profile *stock;
+	struct weston_output *output;
+	struct weston_surface *surface;
+	unsigned i, j;
+
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+	intent = weston_render_intent_info_from(compositor,
+						WESTON_RENDER_INTENT_PERCEPTUAL);
+	surface = weston_surface_create(compositor);
+	assert(surface);
+
+	stock = cm->ref_stock_sRGB_color_profile(cm);
+	for (i = 0; i < ARRAY_LENGTH(corpus); i++)
+		profiles[i] = bench_profile_create(compositor, &corpus[i]);
+
+	for (i = 0; i < ARRAY_LENGTH(corpus); i++) {
+		if (!profiles[i] ||
+		    !weston_output_set_color_profile(output, profiles[i]))
+			continue;
+
+		weston_surface_set_color_profile(surface, stock, intent);
+		bench_transform(compositor, surface, output,
+				"stock sRGB", corpus[i].name);
+
+		for (j = 0; j < ARRAY_LENGTH(corpus); j++) {
+			if (!profiles[j])
+				continue;
+
+			weston_surface_set_color_profile(surface, profiles[j],
+							 intent);
+			bench_transform(compositor, surface, output,
+					corpus[j].name, corpus[i].name);
+		}
+	}
+
+	weston_output_set_color_profile(output, NULL);
+	weston_surface_set_color_profile(surface, NULL, NULL);
+	weston_surface_unref(surface);
+
+	for (i = 0; i < ARRAY_LENGTH(corpus); i++)
+		weston_color_profile_unref(profiles[i]);
+	weston_color_profile_unref(stock);
+}
@@ -50,20 +50,6 @@ enum image_descr_info_event {
 	IMAGE_DESCR_INFO_EVENT_TARGET_LUMINANCE,
 };
 
-const struct lcms_pipeline pipeline_sRGB = {
-	.color_space = "sRGB",
-	.prim_output = {
-		.Red =   { 0.640, 0.330, 1.0 },
-		.Green = { 0.300, 0.600, 1.0 },
-		.Blue =  { 0.150, 0.060, 1.0 }
-	},
-	.pre_fn = TRANSFER_FN_SRGB_EOTF,
-	.mat = LCMSMAT3(1.0, 0.0, 0.0,
-			0.0, 1.0, 0.0,
-			0.0, 0.0, 1.0),
-	.post_fn = TRANSFER_FN_SRGB_EOTF_INVERSE
-};
-
 struct image_description {
 	struct xx_image_description_v4 *xx_image_descr;
 
@@ -0,0 +1,235 @@
+/*
+ * Copyright © 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "shared/timespec-util.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "commit-timing-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.refresh = HIGHEST_OUTPUT_REFRESH;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+static struct wp_commit_timer_v1 *
+create_commit_timer(struct client *client,
+		    struct wp_commit_timing_manager_v1 **manager)
+{
+	*manager = bind_to_singleton_global(client,
+					    &wp_commit_timing_manager_v1_interface,
+					    1);
+	return wp_commit_timing_manager_v1_get_timer(*manager,
+						     client->surface->wl_surface);
+}
+
+TEST(commit_timer_double_create)
+{
+	struct wp_commit_timing_manager_v1 *manager;
+	struct wp_commit_timer_v1 *timer[2];
+	struct client *client;
+
+	client = create_client_and_test_surface(100, 50, 123, 77);
+
+	timer[0] = create_commit_timer(client, &manager);
+	timer[1] = wp_commit_timing_manager_v1_get_timer(manager,
+							 client->surface->wl_surface);
+
+	expect_protocol_error(client, &wp_commit_timing_manager_v1_interface,
+			      WP_COMMIT_TIMING_MANAGER_V1_ERROR_COMMIT_TIMER_EXISTS);
+
+	wp_commit_timer_v1_destroy(timer[1]);
+	wp_commit_timer_v1_destroy(timer[0]);
+	wp_commit_timing_manager_v1_destroy(manager);
+	client_destroy(client);
+}
+
+TEST(commit_timer_double_timestamp)
+{
+	struct wp_commit_timing_manager_v1 *manager;
+	struct wp_commit_timer_v1 *timer;
+	struct client *client;
+
+	client = create_client_and_test_surface(100, 50, 123, 77);
+
+	timer = create_commit_timer(client, &manager);
+	wp_commit_timer_v1_set_timestamp(timer, 0, 1, 0);
+	wp_commit_timer_v1_set_timestamp(timer, 0, 2, 0);
+
+	expect_protocol_error(client, &wp_commit_timer_v1_interface,
+			      WP_COMMIT_TIMER_V1_ERROR_TIMESTAMP_EXISTS);
+
+	wp_commit_timer_v1_destroy(timer);
+	wp_commit_timing_manager_v1_destroy(manager);
+	client_destroy(client);
+}
+
+TEST(commit_timer_bad_nsec)
+{
+	struct wp_commit_timing_manager_v1 *manager;
+	struct wp_commit_timer_v1 *timer;
+	struct client *client;
+
+	client = create_client_and_test_surface(100, 50, 123, 77);
+
+	timer = create_commit_timer(client, &manager);
+	wp_commit_timer_v1_set_timestamp(timer, 0, 1, 1000000000);
+
+	expect_protocol_error(client, &wp_commit_timer_v1_interface,
+			      WP_COMMIT_TIMER_V1_ERROR_INVALID_TIMESTAMP);
+
+	wp_commit_timer_v1_destroy(timer);
+	wp_commit_timing_manager_v1_destroy(manager);
+	client_destroy(client);
+}
+
+TEST(commit_timer_past_timestamp_applies)
+{
+	struct wp_commit_timing_manager_v1 *manager;
+	struct wp_commit_timer_v1 *timer;
+	struct client *client;
+	struct surface *surface;
+	int done;
+
+	client = create_client_and_test_surface(100, 50, 123, 77);
+	surface = client->surface;
+
+	timer = create_commit_timer(client, &manager);
+
+	/* A target long gone must not hold the update back. */
+	wp_commit_timer_v1_set_timestamp(timer, 0, 1, 0);
+	wl_surface_attach(surface->wl_surface, surface->buffer->proxy, 0, 0);
+	wl_surface_damage(surface->wl_surface, 0, 0, 100, 100);
+	frame_callback_set(surface->wl_surface, &done);
+	wl_surface_commit(surface->wl_surface);
+	frame_callback_wait(client, &done);
+
+	wp_commit_timer_v1_destroy(timer);
+	wp_commit_timing_manager_v1_destroy(manager);
+	client_destroy(client);
+}
+
+static void
+presentation_clock_id(void *data, struct wp_presentation *wp_presentation,
+		      uint32_t clk_id)
+{
+	clockid_t *clock_id = data;
+
+	*clock_id = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id,
+};
+
+TEST(commit_timer_future_timestamp_waits)
+{
+	struct wp_commit_timing_manager_v1 *manager;
+	struct wp_commit_timer_v1 *timer;
+	struct wp_presentation *presentation;
+	struct rectangle clip = { 123, 77, 100, 50 };
+	clockid_t clock_id = -1;
+	struct client *client;
+	struct surface *surface;
+	struct buffer *buffer;
+	struct buffer *shot;
+	pixman_image_t *expected;
+	pixman_color_t red;
+	struct timespec target, now;
+	uint32_t sec_hi, sec_lo, nsec;
+	int done;
+
+	client = create_client_and_test_surface(clip.x, clip.y,
+						clip.width, clip.height);
+	surface = client->surface;
+
+	presentation = bind_to_singleton_global(client,
+						&wp_presentation_interface, 1);
+	wp_presentation_add_listener(presentation, &presentation_listener,
+				     &clock_id);
+	client_roundtrip(client);
+	assert(clock_id >= 0);
+
+	timer = create_commit_timer(client, &manager);
+
+	buffer = create_shm_buffer_a8r8g8b8(client, clip.width, clip.height);
+	fill_image_with_color(buffer->image, color_rgb888(&red, 255, 0, 0));
+
+	/* Far enough ahead that an update applied right away, or spun on
+	 * every refresh, would be obvious. */
+	clock_gettime(clock_id, &target);
+	timespec_add_msec(&target, &target, 300);
+	timespec_to_proto(&target, &sec_hi, &sec_lo, &nsec);
+
+	wp_commit_timer_v1_set_timestamp(timer, sec_hi, sec_lo, nsec);
+	wl_surface_attach(surface->wl_surface, buffer->proxy, 0, 0);
+	wl_surface_damage(surface->wl_surface, 0, 0, clip.width, clip.height);
+	frame_callback_set(surface->wl_surface, &done);
+	wl_surface_commit(surface->wl_surface);
+	frame_callback_wait(client, &done);
+
+	/* The update goes into the repaint whose frame reaches the screen
+	 * at the target, which starts at most a repaint window earlier. */
+	clock_gettime(clock_id, &now);
+	testlog("Frame %" PRId64 " ms after the target\n",
+		timespec_sub_to_msec(&now, &target));
+	assert(timespec_sub_to_msec(&target, &now) < 20);
+
+	/* And it did reach the screen. */
+	shot = capture_screenshot_of_output(client, NULL);
+	assert(shot);
+	expected = pixman_image_create_bits_no_clear(PIXMAN_a8r8g8b8,
+						     pixman_image_get_width(shot->image),
+						     pixman_image_get_height(shot->image),
+						     NULL, 0);
+	assert(expected);
+	pixman_image_composite32(PIXMAN_OP_SRC, buffer->image, NULL, expected,
+				 0, 0, 0, 0, clip.x, clip.y,
+				 clip.width, clip.height);
+	assert(check_images_match(shot->image, expected, &clip, NULL));
+
+	pixman_image_unref(expected);
+	buffer_destroy(shot);
+	buffer_destroy(buffer);
+	wp_presentation_destroy(presentation);
+	wp_commit_timer_v1_destroy(timer);
+	wp_commit_timing_manager_v1_destroy(manager);
+	client_destroy(client);
+}
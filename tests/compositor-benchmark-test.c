@@ -0,0 +1,419 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Microbenchmarks of the compositor hot paths, run with 'meson test
+ * --benchmark'. Every benchmark is timed on synthetic scenes of 10 to 10000
+ * solid color views and reports the time per operation, so that changes to
+ * the scene graph code can be compared against each other. Nothing is
+ * asserted about the timings.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include <libweston/libweston.h>
+#include "libweston-internal.h"
+#include "vertex-clipping.h"
+#include "shared/hash.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "weston-test-runner.h"
+#include "weston-test-fixture-compositor.h"
+
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+
+/* Roughly the number of views processed by each timed loop. */
+#define BENCH_VIEW_BUDGET 200000
+#define BENCH_MIN_ITERATIONS 8
+
+#define BENCH_PICKS 4096
+#define BENCH_SHADER_VARIANTS 64
+
+struct setup_args {
+	struct fixture_metadata meta;
+	enum weston_renderer_type renderer;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{
+		.renderer = WESTON_RENDERER_NOOP,
+		.meta.name = "noop",
+	},
+	{
+		.renderer = WESTON_RENDERER_PIXMAN,
+		.meta.name = "pixman",
+	},
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = arg->renderer;
+	setup.width = OUTPUT_WIDTH;
+	setup.height = OUTPUT_HEIGHT;
+	setup.shell = SHELL_TEST_DESKTOP;
+
+	return weston_test_harness_execute_as_plugin(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
+
+static const int scene_sizes[] = { 10, 100, 1000, 10000 };
+
+struct bench_scene {
+	struct weston_compositor *compositor;
+	struct weston_output *output;
+	struct weston_layer layer;
+	struct weston_buffer_reference *buffer;
+	struct weston_surface **surfaces;
+	struct weston_view **views;
+	int count;
+	uint32_t seed;
+};
+
+/* Deterministic so that every run measures the same scenes. */
+static uint32_t
+bench_random(struct bench_scene *scene, uint32_t max)
+{
+	scene->seed = scene->seed * 1103515245u + 12345u;
+
+	return (scene->seed >> 8) % max;
+}
+
+static int64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return timespec_to_nsec(&ts);
+}
+
+static int
+bench_iterations(int count)
+{
+	return MAX(BENCH_MIN_ITERATIONS, BENCH_VIEW_BUDGET / count);
+}
+
+static void
+bench_report(const char *name, int count, int64_t elapsed, int ops)
+{
+	testlog("%-20s %5d views: %12.1f ns/op (%d ops)\n",
+		name, count, (double)elapsed / ops, ops);
+}
+
+static void
+bench_scene_init(struct bench_scene *scene,
+		 struct weston_compositor *compositor, int count)
+{
+	int i;
+
+	scene->compositor = compositor;
+	scene->output = container_of(compositor->output_list.next,
+				     struct weston_output, link);
+	scene->count = count;
+	scene->seed = 1;
+	scene->surfaces = xzalloc(count * sizeof(*scene->surfaces));
+	scene->views = xzalloc(count * sizeof(*scene->views));
+	scene->buffer = weston_buffer_create_solid_rgba(compositor,
+							0.5, 0.5, 0.5, 1.0);
+	assert(scene->buffer);
+
+	weston_layer_init(&scene->layer, compositor);
+	weston_layer_set_position(&scene->layer, WESTON_LAYER_POSITION_NORMAL);
+
+	for (i = 0; i < count; i++) {
+		struct weston_surface *surface;
+		struct weston_view *view;
+		struct weston_coord_global pos;
+
+		surface = weston_surface_create(compositor);
+		assert(surface);
+		view = weston_view_create(surface);
+		assert(view);
+
+		weston_surface_attach_solid(surface, scene->buffer,
+					    32 + bench_random(scene, 256),
+					    32 + bench_random(scene, 256));
+		/* Otherwise damage accumulation drops the buffer. */
+		surface->keep_buffer = true;
+		weston_surface_map(surface);
+
+		pos.c = weston_coord(bench_random(scene, OUTPUT_WIDTH - 32),
+				     bench_random(scene, OUTPUT_HEIGHT - 32));
+		weston_view_set_position(view, pos);
+		weston_view_move_to_layer(view, &scene->layer.view_list);
+		weston_view_update_transform(view);
+
+		scene->surfaces[i] = surface;
+		scene->views[i] = view;
+	}
+
+	weston_compositor_build_view_list(compositor);
+}
+
+static void
+bench_scene_fini(struct bench_scene *scene)
+{
+	int i;
+
+	/* Destroys all views too. */
+	for (i = 0; i < scene->count; i++)
+		weston_surface_unref(scene->surfaces[i]);
+
+	weston_layer_fini(&scene->layer);
+	weston_buffer_destroy_solid(scene->buffer);
+	weston_compositor_build_view_list(scene->compositor);
+
+	free(scene->views);
+	free(scene->surfaces);
+}
+
+static void
+bench_view_list(struct bench_scene *scene)
+{
+	int iterations = bench_iterations(scene->count);
+	int64_t start;
+	int i;
+
+	start = bench_now();
+	for (i = 0; i < iterations; i++)
+		weston_compositor_build_view_list(scene->compositor);
+	bench_report("view-list", scene->count, bench_now() - start, iterations);
+}
+
+static void
+bench_pick(struct bench_scene *scene)
+{
+	struct weston_coord_global pos[BENCH_PICKS];
+	int64_t start;
+	int i;
+
+	for (i = 0; i < BENCH_PICKS; i++)
+		pos[i].c = weston_coord(bench_random(scene, OUTPUT_WIDTH),
+					bench_random(scene, OUTPUT_HEIGHT));
+
+	/* Let the first pick pay for (re)building the pick index. */
+	weston_compositor_pick_view(scene->compositor, pos[0]);
+
+	start = bench_now();
+	for (i = 0; i < BENCH_PICKS; i++)
+		weston_compositor_pick_view(scene->compositor, pos[i]);
+	bench_report("pick", scene->count, bench_now() - start, BENCH_PICKS);
+}
+
+static void
+bench_visibility(struct bench_scene *scene)
+{
+	int iterations = bench_iterations(scene->count);
+	int64_t start;
+	int i;
+
+	start = bench_now();
+	for (i = 0; i < iterations; i++)
+		weston_output_update_visibility(scene->output);
+	bench_report("visibility", scene->count, bench_now() - start, iterations);
+}
+
+static void
+bench_damage(struct bench_scene *scene)
+{
+	int iterations = bench_iterations(scene->count);
+	int64_t elapsed = 0;
+	int64_t start;
+	int i, j;
+
+	for (i = 0; i < iterations; i++) {
+		/* Damage a corner of every surface, as a commit would. */
+		for (j = 0; j < scene->count; j++) {
+			struct weston_surface *surface = scene->surfaces[j];
+
+			pixman_region32_union_rect(&surface->damage,
+						   &surface->damage, 0, 0,
+						   surface->width / 2,
+						   surface->height / 2);
+		}
+
+		start = bench_now();
+		weston_output_accumulate_damage(scene->output);
+		elapsed += bench_now() - start;
+	}
+	bench_report("damage", scene->count, elapsed, iterations);
+}
+
+static void
+bench_transform_region(struct bench_scene *scene)
+{
+	int iterations = bench_iterations(scene->count);
+	int side = 1;
+	pixman_box32_t *boxes;
+	pixman_region32_t src, dest;
+	struct weston_matrix matrix;
+	int64_t start;
+	int i;
+
+	while (side * side < scene->count)
+		side++;
+
+	/* One rectangle per view, spaced so that pixman can't merge them. */
+	boxes = xzalloc(scene->count * sizeof(*boxes));
+	for (i = 0; i < scene->count; i++) {
+		boxes[i].x1 = (i % side) * 4;
+		boxes[i].y1 = (i / side) * 4;
+		boxes[i].x2 = boxes[i].x1 + 2;
+		boxes[i].y2 = boxes[i].y1 + 2;
+	}
+	pixman_region32_init_rects(&src, boxes, scene->count);
+	pixman_region32_init(&dest);
+	free(boxes);
+
+	/* An output transform: rotate by 90 degrees, scale and translate. */
+	weston_matrix_init(&matrix);
+	weston_matrix_rotate_xy(&matrix, 0.0f, 1.0f);
+	weston_matrix_scale(&matrix, 2.0f, 2.0f, 1.0f);
+	weston_matrix_translate(&matrix, OUTPUT_WIDTH, 0.0f, 0.0f);
+
+	start = bench_now();
+	for (i = 0; i < iterations; i++)
+		weston_matrix_transform_region(&dest, &matrix, &src);
+	bench_report("transform-region", scene->count, bench_now() - start,
+		     iterations);
+
+	assert(pixman_region32_n_rects(&dest) == scene->count);
+
+	pixman_region32_fini(&dest);
+	pixman_region32_fini(&src);
+}
+
+static void
+bench_vertex_clip(struct bench_scene *scene)
+{
+	const struct clipper_vertex box[2] = {
+		{ OUTPUT_WIDTH / 4, OUTPUT_HEIGHT / 4 },
+		{ OUTPUT_WIDTH * 3 / 4, OUTPUT_HEIGHT * 3 / 4 },
+	};
+	struct clipper_vertex vertices[8];
+	struct clipper_quad *quads;
+	int iterations = bench_iterations(scene->count);
+	int64_t start;
+	int i, j;
+
+	/* Every view rotated by 30 degrees around its top-left corner, as
+	 * the renderers see a rotated surface. */
+	quads = xzalloc(scene->count * sizeof(*quads));
+	for (i = 0; i < scene->count; i++) {
+		struct weston_surface *surface = scene->surfaces[i];
+		struct weston_coord_global pos =
+			weston_view_get_pos_offset_global(scene->views[i]);
+		float w = surface->width, h = surface->height;
+		struct clipper_vertex polygon[4] = {
+			{ pos.c.x, pos.c.y },
+			{ pos.c.x + w * 0.866f, pos.c.y + w * 0.5f },
+			{ pos.c.x + w * 0.866f - h * 0.5f,
+			  pos.c.y + w * 0.5f + h * 0.866f },
+			{ pos.c.x - h * 0.5f, pos.c.y + h * 0.866f },
+		};
+
+		clipper_quad_init(&quads[i], polygon, false);
+	}
+
+	start = bench_now();
+	for (i = 0; i < iterations; i++)
+		for (j = 0; j < scene->count; j++)
+			clipper_quad_clip(&quads[j], box, vertices);
+	bench_report("vertex-clip", scene->count, bench_now() - start,
+		     iterations * scene->count);
+
+	free(quads);
+}
+
+/*
+ * The GL renderer is not available here, so this times the lookup
+ * gl_renderer_get_program() makes for every paint node: a hash table of
+ * shader programs keyed by the 32-bit shader requirements.
+ */
+static void
+bench_shader_lookup(struct bench_scene *scene)
+{
+	static int programs[BENCH_SHADER_VARIANTS];
+	uint32_t keys[BENCH_SHADER_VARIANTS];
+	struct hash_table *table;
+	int iterations = bench_iterations(scene->count);
+	int64_t start;
+	void *found = NULL;
+	int i, j;
+
+	table = hash_table_create();
+	assert(table);
+
+	for (i = 0; i < BENCH_SHADER_VARIANTS; i++) {
+		keys[i] = (i + 1) * 2654435761u;
+		hash_table_insert(table, keys[i], &programs[i]);
+	}
+
+	start = bench_now();
+	for (i = 0; i < iterations; i++)
+		for (j = 0; j < scene->count; j++)
+			found = hash_table_lookup(table,
+						  keys[j % BENCH_SHADER_VARIANTS]);
+	bench_report("shader-lookup", scene->count, bench_now() - start,
+		     iterations * scene->count);
+
+	assert(found);
+	hash_table_destroy(table);
+}
+
+PLUGIN_TEST(compositor_hot_paths)
+{
+	/* struct weston_compositor *compositor; */
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(scene_sizes); i++) {
+		struct bench_scene scene;
+
+		bench_scene_init(&scene, compositor, scene_sizes[i]);
+
+		bench_view_list(&scene);
+		bench_pick(&scene);
+		bench_visibility(&scene);
+		bench_damage(&scene);
+		bench_transform_region(&scene);
+		bench_vertex_clip(&scene);
+		bench_shader_lookup(&scene);
+
+		bench_scene_fini(&scene);
+	}
+}
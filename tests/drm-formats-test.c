@@ -26,6 +26,7 @@
 #include "config.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include <libweston/libweston.h>
 #include <libweston-internal.h>
@@ -570,3 +571,155 @@ TEST(subtract_arrays_modifier_invalid)
         weston_drm_format_array_fini(&format_array_A);
         weston_drm_format_array_fini(&format_array_B);
 }
+
+static void
+assert_format_array_sorted(const struct weston_drm_format_array *formats)
+{
+        const struct weston_drm_format *fmt, *prev = NULL;
+        const uint64_t *modifiers;
+        unsigned int num_modifiers, i;
+
+        wl_array_for_each(fmt, &formats->arr) {
+                assert(!prev || prev->format < fmt->format);
+                modifiers = weston_drm_format_get_modifiers(fmt, &num_modifiers);
+                for (i = 1; i < num_modifiers; i++)
+                        assert(modifiers[i - 1] < modifiers[i]);
+                prev = fmt;
+        }
+}
+
+TEST(arrays_are_kept_sorted)
+{
+        struct weston_drm_format_array format_array;
+        uint32_t formats[] = {5, 1, 4, 2, 3};
+        uint64_t modifiers[] = {DRM_FORMAT_MOD_INVALID, 13, 11, 15, 12, 14};
+        struct weston_drm_format *fmt;
+        unsigned int i;
+
+        weston_drm_format_array_init(&format_array);
+
+        ADD_FORMATS_AND_MODS(&format_array, formats, modifiers);
+        assert_format_array_sorted(&format_array);
+
+        for (i = 0; i < ARRAY_LENGTH(formats); i++) {
+                fmt = weston_drm_format_array_find_format(&format_array, formats[i]);
+                assert(fmt && fmt->format == formats[i]);
+        }
+        assert(!weston_drm_format_array_find_format(&format_array, 0));
+        assert(!weston_drm_format_array_find_format(&format_array, 6));
+
+        /* The latest format is removed, even when it is not the last one. */
+        ADD_FORMATS_AND_MODS(&format_array, (uint32_t[]){0}, modifiers);
+        weston_drm_format_array_remove_latest_format(&format_array);
+        assert(!weston_drm_format_array_find_format(&format_array, 0));
+        assert(weston_drm_format_array_count_pairs(&format_array) ==
+               ARRAY_LENGTH(formats) * ARRAY_LENGTH(modifiers));
+
+        weston_drm_format_array_fini(&format_array);
+}
+
+/* Deterministic pseudo-random content, so failures reproduce. */
+static uint32_t
+lcg_next(uint32_t *state)
+{
+        *state = *state * 1664525u + 1013904223u;
+        return *state >> 8;
+}
+
+static void
+format_array_fill_random(struct weston_drm_format_array *formats,
+                         uint32_t *state, bool *present, unsigned int stride)
+{
+        struct weston_drm_format *fmt;
+        unsigned int f, m;
+        int ret;
+
+        /* Walk formats and modifiers in a scrambled order. */
+        for (f = 0; f < 32; f++) {
+                uint32_t format = (f * 7) % 32;
+
+                if (lcg_next(state) % 3 == 0)
+                        continue;
+
+                fmt = weston_drm_format_array_add_format(formats, format);
+                assert(fmt);
+                for (m = 0; m < 16; m++) {
+                        uint64_t modifier = (m * 5) % 16;
+
+                        if (lcg_next(state) % 2 == 0)
+                                continue;
+                        ret = weston_drm_format_add_modifier(fmt, modifier);
+                        assert(ret == 0);
+                        present[format * stride + modifier] = true;
+                }
+        }
+}
+
+static bool
+format_array_has_pair(const struct weston_drm_format_array *formats,
+                      uint32_t format, uint64_t modifier)
+{
+        struct weston_drm_format *fmt;
+
+        fmt = weston_drm_format_array_find_format(formats, format);
+
+        return fmt && weston_drm_format_has_modifier(fmt, modifier);
+}
+
+TEST(set_operations_match_pairwise_definition)
+{
+        struct weston_drm_format_array format_array_A, format_array_B;
+        struct weston_drm_format_array joined, intersected, subtracted;
+        bool in_A[32 * 16], in_B[32 * 16];
+        uint32_t state = 1;
+        unsigned int round, f, m;
+        int ret;
+
+        for (round = 0; round < 64; round++) {
+                memset(in_A, 0, sizeof(in_A));
+                memset(in_B, 0, sizeof(in_B));
+
+                weston_drm_format_array_init(&format_array_A);
+                weston_drm_format_array_init(&format_array_B);
+                format_array_fill_random(&format_array_A, &state, in_A, 16);
+                format_array_fill_random(&format_array_B, &state, in_B, 16);
+
+                weston_drm_format_array_init(&joined);
+                weston_drm_format_array_init(&intersected);
+                weston_drm_format_array_init(&subtracted);
+                ret = weston_drm_format_array_replace(&joined, &format_array_A);
+                assert(ret == 0);
+                ret = weston_drm_format_array_replace(&intersected, &format_array_A);
+                assert(ret == 0);
+                ret = weston_drm_format_array_replace(&subtracted, &format_array_A);
+                assert(ret == 0);
+                assert(weston_drm_format_array_equal(&joined, &format_array_A));
+
+                ret = weston_drm_format_array_join(&joined, &format_array_B);
+                assert(ret == 0);
+                ret = weston_drm_format_array_intersect(&intersected, &format_array_B);
+                assert(ret == 0);
+                ret = weston_drm_format_array_subtract(&subtracted, &format_array_B);
+                assert(ret == 0);
+
+                assert_format_array_sorted(&joined);
+                assert_format_array_sorted(&intersected);
+                assert_format_array_sorted(&subtracted);
+
+                for (f = 0; f < 32; f++) {
+                        for (m = 0; m < 16; m++) {
+                                bool a = in_A[f * 16 + m], b = in_B[f * 16 + m];
+
+                                assert(format_array_has_pair(&joined, f, m) == (a || b));
+                                assert(format_array_has_pair(&intersected, f, m) == (a && b));
+                                assert(format_array_has_pair(&subtracted, f, m) == (a && !b));
+                        }
+                }
+
+                weston_drm_format_array_fini(&format_array_A);
+                weston_drm_format_array_fini(&format_array_B);
+                weston_drm_format_array_fini(&joined);
+                weston_drm_format_array_fini(&intersected);
+                weston_drm_format_array_fini(&subtracted);
+        }
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright © 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "fractional-scale-v1-client-protocol.h"
+
+struct setup_args {
+	struct fixture_metadata meta;
+	const char *scale;
+	uint32_t expected_scale;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{
+		.meta.name = "integer scale",
+		.scale = "2",
+		.expected_scale = 2 * 120,
+	},
+	{
+		.meta.name = "fractional scale",
+		.scale = "1.5",
+		.expected_scale = 180,
+	},
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.refresh = HIGHEST_OUTPUT_REFRESH;
+
+	weston_ini_setup(&setup,
+			 cfgln("[output]"),
+			 cfgln("name=headless"),
+			 cfgln("scale=%s", arg->scale));
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
+
+static void
+handle_preferred_scale(void *data, struct wp_fractional_scale_v1 *info,
+		       uint32_t scale)
+{
+	uint32_t *preferred = data;
+
+	*preferred = scale;
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+	handle_preferred_scale,
+};
+
+TEST(test_fractional_scale_preferred)
+{
+	const struct setup_args *args = &my_setup_args[get_test_fixture_index()];
+	struct wp_fractional_scale_manager_v1 *manager;
+	struct wp_fractional_scale_v1 *fs;
+	struct client *client;
+	uint32_t preferred = 0;
+
+	client = create_client_and_test_surface(100, 50, 123, 77);
+
+	manager = bind_to_singleton_global(client,
+					   &wp_fractional_scale_manager_v1_interface,
+					   1);
+	fs = wp_fractional_scale_manager_v1_get_fractional_scale(manager,
+								 client->surface->wl_surface);
+	wp_fractional_scale_v1_add_listener(fs, &fractional_scale_listener,
+					    &preferred);
+	client_roundtrip(client);
+
+	/* The output scale, in 120ths, while wl_output rounds it up. */
+	assert(preferred == args->expected_scale);
+	assert(client->output->scale == 2);
+
+	wp_fractional_scale_v1_destroy(fs);
+	wp_fractional_scale_manager_v1_destroy(manager);
+	client_destroy(client);
+}
+
+TEST(test_fractional_scale_double_create)
+{
+	struct wp_fractional_scale_manager_v1 *manager;
+	struct wp_fractional_scale_v1 *fs[2];
+	struct client *client;
+
+	client = create_client_and_test_surface(100, 50, 123, 77);
+
+	manager = bind_to_singleton_global(client,
+					   &wp_fractional_scale_manager_v1_interface,
+					   1);
+	fs[0] = wp_fractional_scale_manager_v1_get_fractional_scale(manager,
+								    client->surface->wl_surface);
+	fs[1] = wp_fractional_scale_manager_v1_get_fractional_scale(manager,
+								    client->surface->wl_surface);
+
+	expect_protocol_error(client, &wp_fractional_scale_manager_v1_interface,
+			      WP_FRACTIONAL_SCALE_MANAGER_V1_ERROR_FRACTIONAL_SCALE_EXISTS);
+
+	wp_fractional_scale_v1_destroy(fs[1]);
+	wp_fractional_scale_v1_destroy(fs[0]);
+	wp_fractional_scale_manager_v1_destroy(manager);
+	client_destroy(client);
+}
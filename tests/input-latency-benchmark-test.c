@@ -0,0 +1,311 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Input-to-photon latency benchmark, run with 'meson test --benchmark'.
+ * The client injects pointer motion timestamped with the presentation
+ * clock, answers every motion event with a new frame, and reads the time
+ * that frame was presented from wp_presentation feedback. The latency
+ * distribution is logged per renderer, split into the time until the
+ * compositor delivered the input, the time until the client committed
+ * its response, and the time until that was presented. Nothing is
+ * asserted about the timings.
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "weston-test-client-helper.h"
+#include "presentation-time-client-protocol.h"
+#include "weston-test-fixture-compositor.h"
+
+#define SURFACE_X 40
+#define SURFACE_Y 40
+#define SURFACE_SIZE 200
+#define SAMPLES 200
+
+struct setup_args {
+	struct fixture_metadata meta;
+	enum weston_renderer_type renderer;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{
+		.renderer = WESTON_RENDERER_PIXMAN,
+		.meta.name = "pixman",
+	},
+	{
+		.renderer = WESTON_RENDERER_GL,
+		.meta.name = "GL",
+	},
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = arg->renderer;
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.refresh = 60000;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
+
+struct latency_sample {
+	int64_t dispatch_usec;	/* injection to delivery by the compositor */
+	int64_t client_usec;	/* delivery to the commit of the response */
+	int64_t present_usec;	/* commit to presentation */
+	int64_t total_usec;
+};
+
+struct presentation {
+	struct wp_presentation *wp_presentation;
+	clockid_t clock_id;
+	bool has_clock_id;
+};
+
+static void
+presentation_clock_id(void *data, struct wp_presentation *wp_presentation,
+		      uint32_t clk_id)
+{
+	struct presentation *pres = data;
+
+	pres->clock_id = clk_id;
+	pres->has_clock_id = true;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id,
+};
+
+static void
+presentation_bind(struct client *client, struct presentation *pres)
+{
+	struct global *g;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, wp_presentation_interface.name) == 0)
+			break;
+	}
+	assert(&g->link != &client->global_list);
+
+	pres->wp_presentation =
+		wl_registry_bind(client->wl_registry, g->name,
+				 &wp_presentation_interface, 1);
+	wp_presentation_add_listener(pres->wp_presentation,
+				     &presentation_listener, pres);
+	client_roundtrip(client);
+	assert(pres->has_clock_id);
+}
+
+struct feedback {
+	bool done;
+	bool presented;
+	struct timespec time;
+};
+
+static void
+feedback_sync_output(void *data,
+		     struct wp_presentation_feedback *presentation_feedback,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data,
+		   struct wp_presentation_feedback *presentation_feedback,
+		   uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+		   uint32_t refresh_nsec, uint32_t seq_hi, uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct feedback *fb = data;
+
+	timespec_from_proto(&fb->time, tv_sec_hi, tv_sec_lo, tv_nsec);
+	fb->presented = true;
+	fb->done = true;
+}
+
+static void
+feedback_discarded(void *data,
+		   struct wp_presentation_feedback *presentation_feedback)
+{
+	struct feedback *fb = data;
+
+	fb->done = true;
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+static int
+compare_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a;
+	int64_t y = *(const int64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+log_distribution(const char *name, struct latency_sample *samples, int n,
+		 size_t offset)
+{
+	int64_t *values = xcalloc(n, sizeof *values);
+	int64_t sum = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		values[i] = *(int64_t *) ((char *) &samples[i] + offset);
+		sum += values[i];
+	}
+	qsort(values, n, sizeof *values, compare_int64);
+
+	testlog("%-10s min %7.3f ms, mean %7.3f ms, p50 %7.3f ms, "
+		"p90 %7.3f ms, p99 %7.3f ms, max %7.3f ms\n", name,
+		values[0] / 1e3, sum / (double) n / 1e3,
+		values[n / 2] / 1e3, values[n * 9 / 10] / 1e3,
+		values[n * 99 / 100] / 1e3, values[n - 1] / 1e3);
+
+	free(values);
+}
+
+TEST(input_to_photon_latency)
+{
+	const struct setup_args *args = &my_setup_args[get_test_fixture_index()];
+	struct latency_sample samples[SAMPLES];
+	struct presentation pres = { 0 };
+	struct buffer *buffers[2];
+	struct client *client;
+	struct pointer *pointer;
+	struct surface *surface;
+	int n = 0;
+	int i;
+
+	client = create_client_and_test_surface(SURFACE_X, SURFACE_Y,
+						SURFACE_SIZE, SURFACE_SIZE);
+	assert(client);
+	surface = client->surface;
+	pointer = client->input->pointer;
+	presentation_bind(client, &pres);
+
+	for (i = 0; i < 2; i++)
+		buffers[i] = create_shm_buffer_a8r8g8b8(client, SURFACE_SIZE,
+							SURFACE_SIZE);
+
+	/* Spread injections over the refresh cycle, reproducibly */
+	srand(1);
+
+	for (i = 0; i < SAMPLES; i++) {
+		pixman_color_t color;
+		struct wp_presentation_feedback *obj;
+		struct feedback fb = { 0 };
+		struct timespec inject, commit;
+		struct buffer *buffer = buffers[i % 2];
+		uint32_t sec_hi, sec_lo, nsec;
+		int x = 10 + i % 100;
+		int y = 10 + i % 2;
+
+		usleep(rand() % 16667);
+
+		client->test->input_dispatched = (struct timespec) { 0 };
+		clock_gettime(pres.clock_id, &inject);
+		timespec_to_proto(&inject, &sec_hi, &sec_lo, &nsec);
+		weston_test_move_pointer(client->test->weston_test,
+					 sec_hi, sec_lo, nsec,
+					 SURFACE_X + x, SURFACE_Y + y);
+
+		while (pointer->focus != surface ||
+		       pointer->x != x || pointer->y != y ||
+		       timespec_is_zero(&client->test->input_dispatched))
+			assert(wl_display_dispatch(client->wl_display) >= 0);
+
+		/* The response: a new frame of a different color */
+		color_rgb888(&color, i * 5, 255 - i, i % 2 ? 255 : 0);
+		fill_image_with_color(buffer->image, &color);
+		wl_surface_attach(surface->wl_surface, buffer->proxy, 0, 0);
+		wl_surface_damage(surface->wl_surface, 0, 0,
+				  SURFACE_SIZE, SURFACE_SIZE);
+		obj = wp_presentation_feedback(pres.wp_presentation,
+					       surface->wl_surface);
+		wp_presentation_feedback_add_listener(obj, &feedback_listener,
+						      &fb);
+		wl_surface_commit(surface->wl_surface);
+		clock_gettime(pres.clock_id, &commit);
+
+		while (!fb.done)
+			assert(wl_display_dispatch(client->wl_display) >= 0);
+		wp_presentation_feedback_destroy(obj);
+
+		if (!fb.presented)
+			continue;
+
+		samples[n].dispatch_usec =
+			timespec_sub_to_nsec(&client->test->input_dispatched,
+					     &inject) / 1000;
+		samples[n].client_usec =
+			timespec_sub_to_nsec(&commit,
+					     &client->test->input_dispatched) / 1000;
+		samples[n].present_usec =
+			timespec_sub_to_nsec(&fb.time, &commit) / 1000;
+		samples[n].total_usec =
+			timespec_sub_to_nsec(&fb.time, &inject) / 1000;
+		n++;
+	}
+
+	assert(n > 0);
+
+	testlog("%s: input-to-photon latency over %d frames\n",
+		args->meta.name, n);
+	log_distribution("dispatch", samples, n,
+			 offsetof(struct latency_sample, dispatch_usec));
+	log_distribution("client", samples, n,
+			 offsetof(struct latency_sample, client_usec));
+	log_distribution("present", samples, n,
+			 offsetof(struct latency_sample, present_usec));
+	log_distribution("total", samples, n,
+			 offsetof(struct latency_sample, total_usec));
+
+	for (i = 0; i < 2; i++)
+		buffer_destroy(buffers[i]);
+	wp_presentation_destroy(pres.wp_presentation);
+	client_destroy(client);
+}
@@ -585,6 +585,108 @@ test_commit_changes_after_render_order_set_layer_destroy(
 #undef LAYER_NUM
 }
 
+static void
+test_transaction_screen_render_order(struct test_context *ctx)
+{
+#define LAYER_NUM (3)
+	const struct ivi_layout_interface *lyt = ctx->layout_interface;
+	struct weston_output *output;
+	struct ivi_layout_transaction *transaction;
+	struct ivi_layout_layer *ivilayers[LAYER_NUM] = {};
+	const struct ivi_layout_layer_properties *prop;
+	struct ivi_layout_layer **array = NULL;
+	int32_t length = 0;
+	uint32_t i;
+
+	if (!iassert(!wl_list_empty(&ctx->compositor->output_list)))
+		return;
+
+	output = wl_container_of(ctx->compositor->output_list.next, output, link);
+
+	for (i = 0; i < LAYER_NUM; i++)
+		ivilayers[i] = lyt->layer_create_with_dimension(IVI_TEST_LAYER_ID(i), 200, 300);
+
+	transaction = lyt->transaction_create();
+	iassert(lyt->transaction_screen_set_render_order(transaction, output,
+							 ivilayers, LAYER_NUM) == IVI_SUCCEEDED);
+	lyt->transaction_layer_set_visibility(transaction, ivilayers[0], true);
+
+	/* nothing staged in a transaction is applied by a plain commit */
+	lyt->commit_changes();
+
+	lyt->get_layers_on_screen(output, &length, &array);
+	iassert(length == 0 && array == NULL);
+
+	prop = lyt->get_properties_of_layer(ivilayers[0]);
+	iassert(prop->visibility == false);
+
+	iassert(lyt->transaction_commit(transaction) == IVI_SUCCEEDED);
+
+	lyt->get_layers_on_screen(output, &length, &array);
+	iassert(length == LAYER_NUM);
+	for (i = 0; i < LAYER_NUM; i++)
+		iassert(array[i] == ivilayers[i]);
+
+	if (length > 0)
+		free(array);
+
+	iassert(prop->visibility == true);
+
+	lyt->screen_set_render_order(output, NULL, 0);
+	lyt->commit_changes();
+
+	for (i = 0; i < LAYER_NUM; i++)
+		lyt->layer_destroy(ivilayers[i]);
+#undef LAYER_NUM
+}
+
+static void
+test_transaction_commit_after_layer_destroy(struct test_context *ctx)
+{
+#define LAYER_NUM (3)
+	const struct ivi_layout_interface *lyt = ctx->layout_interface;
+	struct weston_output *output;
+	struct ivi_layout_transaction *transaction;
+	struct ivi_layout_layer *ivilayers[LAYER_NUM] = {};
+	struct ivi_layout_layer **array;
+	int32_t length = 0;
+	uint32_t i;
+
+	if (!iassert(!wl_list_empty(&ctx->compositor->output_list)))
+		return;
+
+	output = wl_container_of(ctx->compositor->output_list.next, output, link);
+
+	for (i = 0; i < LAYER_NUM; i++)
+		ivilayers[i] = lyt->layer_create_with_dimension(IVI_TEST_LAYER_ID(i), 200, 300);
+
+	transaction = lyt->transaction_create();
+	lyt->transaction_screen_set_render_order(transaction, output,
+						 ivilayers, LAYER_NUM);
+	lyt->transaction_layer_set_visibility(transaction, ivilayers[1], true);
+
+	lyt->layer_destroy(ivilayers[1]);
+
+	lyt->transaction_commit(transaction);
+
+	lyt->get_layers_on_screen(output, &length, &array);
+	iassert(length == LAYER_NUM - 1);
+	if (length == LAYER_NUM - 1) {
+		iassert(array[0] == ivilayers[0]);
+		iassert(array[1] == ivilayers[2]);
+	}
+
+	if (length > 0)
+		free(array);
+
+	lyt->screen_set_render_order(output, NULL, 0);
+	lyt->commit_changes();
+
+	lyt->layer_destroy(ivilayers[0]);
+	lyt->layer_destroy(ivilayers[2]);
+#undef LAYER_NUM
+}
+
 static void
 test_layer_properties_changed_notification_callback(struct wl_listener *listener, void *data)
 {
@@ -766,6 +868,8 @@ run_internal_tests(struct test_context *ctx)
 	test_screen_add_layers(ctx);
 	test_screen_remove_layer(ctx);
 	test_commit_changes_after_render_order_set_layer_destroy(ctx);
+	test_transaction_screen_render_order(ctx);
+	test_transaction_commit_after_layer_destroy(ctx);
 
 	test_layer_properties_changed_notification(ctx);
 	test_layer_create_notification(ctx);
@@ -0,0 +1,79 @@
+/*
+ * Copyright © 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+
+#include <libweston/libweston.h>
+#include "weston-test-runner.h"
+#include "weston-test-fixture-compositor.h"
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.shell = SHELL_TEST_DESKTOP;
+
+	return weston_test_harness_execute_as_plugin(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+PLUGIN_TEST(keymap_cache)
+{
+	/* struct weston_compositor *compositor; */
+	struct xkb_rule_names pc105 = {
+		.rules = "evdev", .model = "pc105", .layout = "us",
+	};
+	struct xkb_rule_names pc104 = {
+		.rules = "evdev", .model = "pc104", .layout = "us",
+	};
+	struct xkb_keymap *first, *second, *other;
+
+	first = weston_compositor_get_keymap(compositor, &pc105);
+	assert(first);
+
+	/* the same rule names give the same keymap */
+	second = weston_compositor_get_keymap(compositor, &pc105);
+	assert(second == first);
+	xkb_keymap_unref(second);
+
+	other = weston_compositor_get_keymap(compositor, &pc104);
+	assert(other);
+	assert(other != first);
+
+	/* the global keymap is compiled through the cache as well */
+	second = weston_compositor_get_keymap(compositor,
+					      &compositor->xkb_names);
+	assert(second);
+	if (compositor->xkb_info)
+		assert(second == compositor->xkb_info->keymap);
+	xkb_keymap_unref(second);
+
+	xkb_keymap_unref(other);
+	xkb_keymap_unref(first);
+}
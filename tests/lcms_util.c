@@ -39,6 +39,57 @@
 
 static const cmsCIExyY wp_d65 = { 0.31271, 0.32902, 1.0 };
 
+/*
+ * Using currently destination gamut bigger than source.
+ * Using https://www.colour-science.org/ we can extract conversion matrix:
+ * import colour
+ * colour.matrix_RGB_to_RGB(colour.RGB_COLOURSPACES['sRGB'], colour.RGB_COLOURSPACES['Adobe RGB (1998)'], None)
+ * colour.matrix_RGB_to_RGB(colour.RGB_COLOURSPACES['sRGB'], colour.RGB_COLOURSPACES['ITU-R BT.2020'], None)
+ */
+
+const struct lcms_pipeline pipeline_sRGB = {
+	.color_space = "sRGB",
+	.prim_output = {
+		.Red =   { 0.640, 0.330, 1.0 },
+		.Green = { 0.300, 0.600, 1.0 },
+		.Blue =  { 0.150, 0.060, 1.0 }
+	},
+	.pre_fn = TRANSFER_FN_SRGB_EOTF,
+	.mat = LCMSMAT3(1.0, 0.0, 0.0,
+			0.0, 1.0, 0.0,
+			0.0, 0.0, 1.0),
+	.post_fn = TRANSFER_FN_SRGB_EOTF_INVERSE
+};
+
+const struct lcms_pipeline pipeline_adobeRGB = {
+	.color_space = "adobeRGB",
+	.prim_output = {
+		.Red =   { 0.640, 0.330, 1.0 },
+		.Green = { 0.210, 0.710, 1.0 },
+		.Blue =  { 0.150, 0.060, 1.0 }
+	},
+	.pre_fn = TRANSFER_FN_SRGB_EOTF,
+	.mat = LCMSMAT3( 0.715127, 0.284868, 0.000005,
+			 0.000001, 0.999995, 0.000004,
+			-0.000003, 0.041155, 0.958848),
+	.post_fn = TRANSFER_FN_ADOBE_RGB_EOTF_INVERSE
+};
+
+const struct lcms_pipeline pipeline_BT2020 = {
+	.color_space = "bt2020",
+	.prim_output = {
+		.Red =   { 0.708, 0.292, 1.0 },
+		.Green = { 0.170, 0.797, 1.0 },
+		.Blue =  { 0.131, 0.046, 1.0 }
+	},
+	.pre_fn = TRANSFER_FN_SRGB_EOTF,
+	.mat = LCMSMAT3(0.627402, 0.329292, 0.043306,
+			0.069095, 0.919544, 0.011360,
+			0.016394, 0.088028, 0.895578),
+	/* this is equivalent to BT.1886 with zero black level */
+	.post_fn = TRANSFER_FN_POWER2_4_EOTF_INVERSE,
+};
+
 /*
  * MPE tone curves can only use LittleCMS parametric curve types 6-8 and not
  * inverses.
@@ -53,6 +53,10 @@ struct lcms_pipeline {
 	enum transfer_fn post_fn;
 };
 
+extern const struct lcms_pipeline pipeline_sRGB;
+extern const struct lcms_pipeline pipeline_adobeRGB;
+extern const struct lcms_pipeline pipeline_BT2020;
+
 cmsToneCurve *
 build_MPE_curve(cmsContext ctx, enum transfer_fn fn);
 
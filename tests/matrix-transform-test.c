@@ -461,3 +461,76 @@ TEST(output_matrix_to_standard_transform)
 		output_test_all_transforms(&output, 1024, 768, 1920, 1080, scale);
 	}
 }
+
+static int64_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	int64_t area = 0;
+	int nrects, i;
+
+	rects = pixman_region32_rectangles(region, &nrects);
+	for (i = 0; i < nrects; i++)
+		area += (int64_t)(rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	return area;
+}
+
+TEST(transform_region_right_angles)
+{
+	struct weston_matrix m;
+	pixman_region32_t src, dest;
+
+	pixman_region32_init_rect(&src, 0, 0, 100, 20);
+	pixman_region32_union_rect(&src, &src, 0, 50, 30, 30);
+	pixman_region32_init(&dest);
+
+	/* Rotated by 90 degrees and scaled, the damage stays the two
+	 * rectangles it was rather than the box around them. */
+	weston_matrix_init(&m);
+	weston_matrix_rotate_xy(&m, 0.0f, 1.0f);
+	weston_matrix_scale(&m, 2.0f, 2.0f, 1.0f);
+	weston_matrix_translate(&m, 500.0f, 10.0f, 0.0f);
+
+	weston_matrix_transform_region(&dest, &m, &src);
+	assert(region_area(&dest) == 4 * region_area(&src));
+
+	pixman_region32_fini(&dest);
+	pixman_region32_fini(&src);
+}
+
+TEST(transform_region_arbitrary_rotation)
+{
+	struct weston_matrix m;
+	pixman_region32_t src, dest;
+	pixman_box32_t *extents;
+	int64_t bbox_area;
+	float c = cosf(M_PI / 4.0f), s = sinf(M_PI / 4.0f);
+
+	pixman_region32_init_rect(&src, 0, 0, 100, 100);
+	pixman_region32_init(&dest);
+
+	weston_matrix_init(&m);
+	weston_matrix_rotate_xy(&m, c, s);
+	weston_matrix_translate(&m, 200.0f, 200.0f, 0.0f);
+
+	weston_matrix_transform_region(&dest, &m, &src);
+
+	/* Still covers the whole rotated square... */
+	assert(pixman_region32_contains_point(&dest, 200, 201, NULL));
+	assert(pixman_region32_contains_point(&dest, 200, 340, NULL));
+	assert(pixman_region32_contains_point(&dest, 130, 270, NULL));
+	assert(pixman_region32_contains_point(&dest, 269, 270, NULL));
+
+	/* ...but not the corners of its bounding box. */
+	extents = pixman_region32_extents(&dest);
+	bbox_area = (int64_t)(extents->x2 - extents->x1) *
+		    (extents->y2 - extents->y1);
+	assert(!pixman_region32_contains_point(&dest, extents->x1,
+					       extents->y1, NULL));
+	assert(region_area(&dest) < bbox_area * 3 / 4);
+
+	pixman_region32_fini(&dest);
+	pixman_region32_fini(&src);
+}
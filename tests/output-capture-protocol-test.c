@@ -25,10 +25,24 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/dma-buf.h>
+#include <linux/udmabuf.h>
+
 #include "weston-test-client-helper.h"
 #include "weston-test-fixture-compositor.h"
+#include "shared/helpers.h"
+#include "shared/os-compatibility.h"
 #include "shared/xalloc.h"
 #include "weston-output-capture-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
 #include "shared/weston-drm-fourcc.h"
 
 struct setup_args {
@@ -83,9 +97,14 @@ struct capturer {
 	struct {
 		bool size;
 		bool format;
+		bool scaling;
 		bool reply;
 	} events;
 
+	/* damage events of the last capture_damage */
+	int damage_rects;
+	int64_t damage_area;
+
 	char *last_failure;
 };
 
@@ -156,12 +175,43 @@ capture_source_handle_failed(void *data,
 	capt->last_failure = msg ? xstrdup(msg) : NULL;
 }
 
+static void
+capture_source_handle_scaling(void *data,
+			      struct weston_capture_source_v1 *proxy)
+{
+	struct capturer *capt = data;
+
+	assert(capt->source == proxy);
+
+	capt->events.scaling = true;
+}
+
+static void
+capture_source_handle_damage(void *data,
+			     struct weston_capture_source_v1 *proxy,
+			     int32_t x, int32_t y,
+			     int32_t width, int32_t height)
+{
+	struct capturer *capt = data;
+
+	assert(capt->source == proxy);
+	assert(capt->state == CAPTURE_TASK_PENDING);
+	assert(x >= 0 && y >= 0 && width > 0 && height > 0);
+	assert(x + width <= capt->width);
+	assert(y + height <= capt->height);
+
+	capt->damage_rects++;
+	capt->damage_area += (int64_t)width * height;
+}
+
 static const struct weston_capture_source_v1_listener capture_source_handlers = {
 	.format = capture_source_handle_format,
 	.size = capture_source_handle_size,
 	.complete = capture_source_handle_complete,
 	.retry = capture_source_handle_retry,
 	.failed = capture_source_handle_failed,
+	.scaling = capture_source_handle_scaling,
+	.damage = capture_source_handle_damage,
 };
 
 static struct capturer *
@@ -175,7 +225,7 @@ capturer_create(struct client *client,
 
 	capt->factory = bind_to_singleton_global(client,
 						 &weston_capture_v1_interface,
-						 1);
+						 3);
 
 	capt->source = weston_capture_v1_create(capt->factory,
 						output->wl_output, src);
@@ -338,3 +388,341 @@ TEST(writeback_on_headless_fails)
 	buffer_destroy(buf);
 	client_destroy(client);
 }
+
+/* A linear dmabuf from /dev/udmabuf, which the test can map directly */
+struct udmabuf {
+	int memfd;
+	int dmabuf_fd;
+	void *data;
+	size_t size;
+	int width;
+	int height;
+	int stride;
+
+	struct wl_buffer *proxy;
+	bool failed;
+};
+
+static void
+dmabuf_params_handle_created(void *data,
+			     struct zwp_linux_buffer_params_v1 *params,
+			     struct wl_buffer *proxy)
+{
+	struct udmabuf *buf = data;
+
+	buf->proxy = proxy;
+}
+
+static void
+dmabuf_params_handle_failed(void *data,
+			    struct zwp_linux_buffer_params_v1 *params)
+{
+	struct udmabuf *buf = data;
+
+	buf->failed = true;
+}
+
+static const struct zwp_linux_buffer_params_v1_listener dmabuf_params_handlers = {
+	.created = dmabuf_params_handle_created,
+	.failed = dmabuf_params_handle_failed,
+};
+
+static void
+udmabuf_destroy(struct udmabuf *buf)
+{
+	if (buf->proxy)
+		wl_buffer_destroy(buf->proxy);
+	if (buf->data)
+		munmap(buf->data, buf->size);
+	if (buf->dmabuf_fd >= 0)
+		close(buf->dmabuf_fd);
+	close(buf->memfd);
+	free(buf);
+}
+
+/* Returns NULL if the system or the compositor cannot do it. */
+static struct udmabuf *
+udmabuf_create(struct client *client, int width, int height,
+	       uint32_t drm_format)
+{
+	struct udmabuf_create create = {};
+	struct zwp_linux_dmabuf_v1 *dmabuf;
+	struct zwp_linux_buffer_params_v1 *params;
+	struct udmabuf *buf;
+	int dev;
+
+	dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (dev < 0) {
+		testlog("No /dev/udmabuf: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	buf = xzalloc(sizeof *buf);
+	buf->width = width;
+	buf->height = height;
+	buf->stride = width * 4;
+	buf->size = ROUND_UP_N((size_t)buf->stride * height,
+			       (size_t)sysconf(_SC_PAGESIZE));
+	buf->dmabuf_fd = -1;
+
+	/* udmabuf wants a memfd which cannot shrink */
+	buf->memfd = os_create_anonymous_file(buf->size);
+	assert(buf->memfd >= 0);
+
+	create.memfd = buf->memfd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.offset = 0;
+	create.size = buf->size;
+	buf->dmabuf_fd = ioctl(dev, UDMABUF_CREATE, &create);
+	close(dev);
+	if (buf->dmabuf_fd < 0) {
+		testlog("UDMABUF_CREATE failed: %s\n", strerror(errno));
+		udmabuf_destroy(buf);
+		return NULL;
+	}
+
+	buf->data = mmap(NULL, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 buf->memfd, 0);
+	assert(buf->data != MAP_FAILED);
+
+	dmabuf = bind_to_singleton_global(client,
+					  &zwp_linux_dmabuf_v1_interface, 3);
+	params = zwp_linux_dmabuf_v1_create_params(dmabuf);
+	zwp_linux_buffer_params_v1_add_listener(params,
+						&dmabuf_params_handlers, buf);
+	zwp_linux_buffer_params_v1_add(params, buf->dmabuf_fd, 0, 0,
+				       buf->stride,
+				       DRM_FORMAT_MOD_LINEAR >> 32,
+				       DRM_FORMAT_MOD_LINEAR & 0xffffffff);
+	zwp_linux_buffer_params_v1_create(params, width, height, drm_format, 0);
+	while (!buf->proxy && !buf->failed)
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+	zwp_linux_buffer_params_v1_destroy(params);
+	zwp_linux_dmabuf_v1_destroy(dmabuf);
+
+	if (buf->failed) {
+		testlog("The compositor cannot import a linear dmabuf\n");
+		udmabuf_destroy(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+/* Waits for the implicit fences of the capture, and copies the pixels. */
+static pixman_image_t *
+udmabuf_read_image(struct udmabuf *buf)
+{
+	struct dma_buf_sync sync = {
+		.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ,
+	};
+	pixman_image_t *wrap;
+	pixman_image_t *image;
+
+	assert(ioctl(buf->dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync) == 0);
+
+	/* DRM_FORMAT_ABGR8888 */
+	wrap = pixman_image_create_bits(PIXMAN_a8b8g8r8,
+					buf->width, buf->height,
+					buf->data, buf->stride);
+	assert(wrap);
+	image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+					 buf->width, buf->height, NULL, 0);
+	assert(image);
+	pixman_image_composite32(PIXMAN_OP_SRC, wrap, NULL, image,
+				 0, 0, 0, 0, 0, 0, buf->width, buf->height);
+	pixman_image_unref(wrap);
+
+	sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+	assert(ioctl(buf->dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync) == 0);
+
+	return image;
+}
+
+static void
+fill_top_red_bottom_blue(pixman_image_t *image, int width, int height)
+{
+	pixman_color_t red;
+	pixman_color_t blue;
+	pixman_rectangle16_t bottom = {
+		.x = 0, .y = height / 2, .width = width, .height = height / 2,
+	};
+
+	color_rgb888(&red, 255, 0, 0);
+	color_rgb888(&blue, 0, 0, 255);
+
+	fill_image_with_color(image, &red);
+	pixman_image_fill_rectangles(PIXMAN_OP_SRC, image, &blue, 1, &bottom);
+}
+
+static bool
+check_capture_area(pixman_image_t *shot, pixman_image_t *expected,
+		   const struct rectangle *clip, int seq_no)
+{
+	pixman_image_t *diff;
+	char *fname;
+	bool match;
+
+	match = check_images_match(shot, expected, clip, NULL);
+	if (!match) {
+		diff = visualize_image_difference(shot, expected, clip, NULL);
+		fname = output_filename_for_test_case("error", seq_no, "png");
+		write_image_as_png(diff, fname);
+		free(fname);
+		pixman_image_unref(diff);
+	}
+
+	return match;
+}
+
+/*
+ * Scaled capture into dmabufs needs the GL renderer with dmabuf import, which
+ * the test environment may lack. Pixman never offers it, and wl_shm buffers
+ * must match the size either way, as retry_on_wrong_size checks.
+ *
+ * Where it is offered, an output with a red top half and a blue bottom half
+ * is captured at half the size into a dmabuf of another format than the
+ * output's. The pixels next to the seam mix when filtered, so only the
+ * inside of each half is compared.
+ */
+TEST(scaling_only_with_gpu)
+{
+	const struct setup_args *fix = &my_setup_args[get_test_fixture_index()];
+	struct client *client;
+	struct capturer *capt;
+	struct buffer *content;
+	struct udmabuf *dst;
+	pixman_image_t *shot;
+	pixman_image_t *expected;
+	struct rectangle top;
+	struct rectangle bottom;
+	int width;
+	int height;
+	int frame;
+
+	client = create_client_and_test_surface(0, 0, 100, 60);
+	capt = capturer_create(client, client->output,
+			       WESTON_CAPTURE_V1_SOURCE_FRAMEBUFFER);
+	client_roundtrip(client);
+
+	assert(capt->events.format);
+	assert(capt->events.size);
+	if (fix->renderer == WESTON_RENDERER_PIXMAN)
+		assert(!capt->events.scaling);
+
+	if (!capt->events.scaling) {
+		testlog("No scaled capture, not checking its contents\n");
+		goto out_capt;
+	}
+
+	assert(capt->drm_format != DRM_FORMAT_ABGR8888 && "fix this test");
+	width = capt->width / 2;
+	height = capt->height / 2;
+	dst = udmabuf_create(client, width, height, DRM_FORMAT_ABGR8888);
+	if (!dst)
+		goto out_capt;
+
+	/* move the pointer clearly away from the output */
+	weston_test_move_pointer(client->test->weston_test, 0, 1, 0,
+				 capt->width + 10, capt->height + 10);
+
+	content = create_shm_buffer_a8r8g8b8(client, capt->width, capt->height);
+	fill_top_red_bottom_blue(content->image, capt->width, capt->height);
+	wl_surface_attach(client->surface->wl_surface, content->proxy, 0, 0);
+	wl_surface_damage_buffer(client->surface->wl_surface, 0, 0,
+				 capt->width, capt->height);
+	frame_callback_set(client->surface->wl_surface, &frame);
+	wl_surface_commit(client->surface->wl_surface);
+	frame_callback_wait(client, &frame);
+
+	capt->state = CAPTURE_TASK_PENDING;
+	capt->events.reply = false;
+	weston_capture_source_v1_capture(capt->source, dst->proxy);
+	while (!capt->events.reply)
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+	assert(capt->state == CAPTURE_TASK_COMPLETE);
+
+	shot = udmabuf_read_image(dst);
+	expected = pixman_image_create_bits(PIXMAN_a8r8g8b8, width, height,
+					    NULL, 0);
+	assert(expected);
+	fill_top_red_bottom_blue(expected, width, height);
+
+	top = (struct rectangle) {
+		.x = 0, .y = 0, .width = width, .height = height / 2 - 2,
+	};
+	bottom = (struct rectangle) {
+		.x = 0, .y = height / 2 + 2,
+		.width = width, .height = height - height / 2 - 2,
+	};
+	assert(check_capture_area(shot, expected, &top, 0));
+	assert(check_capture_area(shot, expected, &bottom, 1));
+
+	pixman_image_unref(expected);
+	pixman_image_unref(shot);
+	buffer_destroy(content);
+	udmabuf_destroy(dst);
+
+out_capt:
+	capturer_destroy(capt);
+	client_destroy(client);
+}
+
+static void
+capturer_capture_damage(struct client *client, struct capturer *capt,
+			struct buffer *buf)
+{
+	capt->state = CAPTURE_TASK_PENDING;
+	capt->events.reply = false;
+	capt->damage_rects = 0;
+	capt->damage_area = 0;
+
+	weston_capture_source_v1_capture_damage(capt->source, buf->proxy);
+	while (!capt->events.reply)
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+
+	assert(capt->state == CAPTURE_TASK_COMPLETE);
+}
+
+/*
+ * An incremental capture writes everything into a buffer it has not seen
+ * before, and at most that into the buffer of the previous capture.
+ */
+TEST(capture_damage_full_on_new_buffer)
+{
+	const struct setup_args *fix = &my_setup_args[get_test_fixture_index()];
+	struct client *client;
+	struct capturer *capt;
+	struct buffer *buf, *other;
+	int64_t full;
+
+	client = create_client();
+	capt = capturer_create(client, client->output,
+			       WESTON_CAPTURE_V1_SOURCE_FRAMEBUFFER);
+	client_roundtrip(client);
+
+	assert(capt->events.format);
+	assert(capt->events.size);
+	full = (int64_t)capt->width * capt->height;
+
+	buf = create_shm_buffer(client, capt->width, capt->height,
+				fix->expected_drm_format);
+	other = create_shm_buffer(client, capt->width, capt->height,
+				  fix->expected_drm_format);
+
+	capturer_capture_damage(client, capt, buf);
+	assert(capt->damage_rects == 1);
+	assert(capt->damage_area == full);
+
+	capturer_capture_damage(client, capt, buf);
+	assert(capt->damage_area <= full);
+
+	capturer_capture_damage(client, capt, other);
+	assert(capt->damage_rects == 1);
+	assert(capt->damage_area == full);
+
+	capturer_destroy(capt);
+	buffer_destroy(other);
+	buffer_destroy(buf);
+	client_destroy(client);
+}
@@ -48,6 +48,15 @@
 		.transform_name = #t,					\
 		.meta.name = "GL " #s " " #t,				\
 	}
+#define PIXMAN_TILED(s, t)						\
+	{								\
+		.renderer = WESTON_RENDERER_PIXMAN,			\
+		.scale = s,						\
+		.transform = WL_OUTPUT_TRANSFORM_ ## t,			\
+		.transform_name = #t,					\
+		.pixman_repaint_threads = 4,				\
+		.meta.name = "pixman tiled " #s " " #t,			\
+	}
 
 struct setup_args {
 	struct fixture_metadata meta;
@@ -55,6 +64,7 @@ struct setup_args {
 	int scale;
 	enum wl_output_transform transform;
 	const char *transform_name;
+	int pixman_repaint_threads;
 };
 
 static const struct setup_args my_setup_args[] = {
@@ -72,6 +82,9 @@ static const struct setup_args my_setup_args[] = {
 	RENDERERS(2, 180),
 	RENDERERS(2, FLIPPED),
 	RENDERERS(3, FLIPPED_270),
+	PIXMAN_TILED(1, NORMAL),
+	PIXMAN_TILED(1, 90),
+	PIXMAN_TILED(2, FLIPPED),
 };
 
 static enum test_result_code
@@ -93,6 +106,13 @@ fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
 	setup.transform = arg->transform;
 	setup.shell = SHELL_TEST_DESKTOP;
 
+	if (arg->pixman_repaint_threads) {
+		weston_ini_setup(&setup,
+				 cfgln("[core]"),
+				 cfgln("pixman-repaint-threads=%d",
+				       arg->pixman_repaint_threads));
+	}
+
 	return weston_test_harness_execute_as_client(harness, &setup);
 }
 DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
@@ -234,3 +234,81 @@ TEST(test_surface_unmaps_on_null)
 	buffer_destroy(buf);
 	client_destroy(client);
 }
+
+TEST(opaque_surface_culls_views_below)
+{
+	struct wet_testsuite_data *suite_data = TEST_GET_SUITE_DATA();
+	struct rectangle full = { 0, 0, 320, 240 };
+	struct client *client;
+	struct buffer *buf;
+	pixman_color_t red;
+
+	color_rgb888(&red, 255, 0, 0);
+
+	client = create_client_and_test_surface(0, 0, 320, 240);
+	assert(client);
+
+	/* move the pointer clearly away from our screenshooting area */
+	weston_test_move_pointer(client->test->weston_test, 0, 1, 0, 2, 30);
+
+	client_push_breakpoint(client, suite_data,
+			       WESTON_TEST_BREAKPOINT_POST_REPAINT,
+			       (struct wl_proxy *) client->output->wl_output);
+
+	/* cover the whole output with an opaque surface */
+	surface_set_opaque_rect(client->surface, &full);
+	buf = surface_commit_color(client, client->surface->wl_surface, &red,
+				   320, 240);
+
+	RUN_INSIDE_BREAKPOINT(client, suite_data) {
+		struct weston_compositor *compositor;
+		struct weston_output *output;
+		struct weston_paint_node *pnode;
+
+		assert(breakpoint->template_->breakpoint ==
+		       WESTON_TEST_BREAKPOINT_POST_REPAINT);
+		compositor = breakpoint->compositor;
+		output = next_output(compositor, NULL);
+
+		/* the background below gets no paint node at all */
+		pnode = next_pnode_from_z(output, NULL);
+		assert(pnode);
+		assert(pnode->view->surface->resource);
+		assert(output->z_order_occluder == pnode->view);
+		assert(!next_pnode_from_z(output, pnode));
+	}
+
+	client_push_breakpoint(client, suite_data,
+			       WESTON_TEST_BREAKPOINT_POST_REPAINT,
+			       (struct wl_proxy *) client->output->wl_output);
+
+	wl_surface_set_opaque_region(client->surface->wl_surface, NULL);
+	wl_surface_damage_buffer(client->surface->wl_surface, 0, 0, 320, 240);
+	wl_surface_commit(client->surface->wl_surface);
+
+	RUN_INSIDE_BREAKPOINT(client, suite_data) {
+		struct weston_compositor *compositor;
+		struct weston_output *output;
+		struct weston_paint_node *pnode;
+
+		assert(breakpoint->template_->breakpoint ==
+		       WESTON_TEST_BREAKPOINT_POST_REPAINT);
+		compositor = breakpoint->compositor;
+		output = next_output(compositor, NULL);
+
+		/* once uncovered, the background is back */
+		pnode = next_pnode_from_z(output, NULL);
+		assert(pnode);
+		assert(pnode->view->surface->resource);
+		assert(!output->z_order_occluder);
+
+		pnode = next_pnode_from_z(output, pnode);
+		assert(pnode);
+		assert(!pnode->view->surface->resource);
+		assert(pnode->view->surface->buffer_ref.buffer->type ==
+		       WESTON_BUFFER_SOLID);
+	}
+
+	buffer_destroy(buf);
+	client_destroy(client);
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright © 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "shared/weston-drm-fourcc.h"
+
+struct setup_args {
+	struct fixture_metadata meta;
+	bool direct_copy;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{
+		.direct_copy = false,
+		.meta.name = "pixman composite"
+	},
+	{
+		.direct_copy = true,
+		.meta.name = "pixman direct-copy"
+	},
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = WESTON_RENDERER_PIXMAN;
+	setup.width = 320;
+	setup.height = 240;
+	setup.shell = SHELL_TEST_DESKTOP;
+
+	weston_ini_setup(&setup,
+			 cfgln("[core]"),
+			 cfgln("pixman-direct-copy=%s",
+			       arg->direct_copy ? "true" : "false"));
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
+
+/* Four quadrants of different colors, so that reading at an offset shows */
+static void
+draw_quadrants(pixman_image_t *image, const uint32_t colors[4])
+{
+	int width = pixman_image_get_width(image);
+	int height = pixman_image_get_height(image);
+	pixman_color_t color;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		pixman_rectangle16_t rect = {
+			.x = (i % 2) * width / 2,
+			.y = (i / 2) * height / 2,
+			.width = width / 2,
+			.height = height / 2,
+		};
+
+		color_rgb888(&color, colors[i] >> 16, colors[i] >> 8, colors[i]);
+		pixman_image_fill_rectangles(PIXMAN_OP_SRC, image, &color,
+					     1, &rect);
+	}
+}
+
+/*
+ * An opaque window away from the output origin, updated with damage inside
+ * itself after having been composited, is what gets copied directly. The
+ * screen must show the window contents where the window is, whichever way
+ * the renderer takes.
+ */
+TEST(opaque_window_at_offset)
+{
+	static const uint32_t before[4] = {
+		0xff0000, 0x00ff00, 0x0000ff, 0xffff00,
+	};
+	static const uint32_t after[4] = {
+		0x00ffff, 0xff00ff, 0x808080, 0xffffff,
+	};
+	struct rectangle clip = { 37, 53, 100, 80 };
+	struct client *client;
+	struct buffer *shot;
+	pixman_image_t *expected;
+	bool match;
+	int done;
+
+	client = create_client();
+	client->surface = create_test_surface(client);
+	client->surface->width = clip.width;
+	client->surface->height = clip.height;
+	client->surface->buffer = create_shm_buffer(client, clip.width,
+						    clip.height,
+						    DRM_FORMAT_XRGB8888);
+	draw_quadrants(client->surface->buffer->image, before);
+
+	/* Map, then move, so that the window gets composited once. */
+	move_client_frame_sync(client, 11, 17);
+	move_client_frame_sync(client, clip.x, clip.y);
+
+	/* New contents in the same buffer, damage inside the window */
+	draw_quadrants(client->surface->buffer->image, after);
+	wl_surface_attach(client->surface->wl_surface,
+			  client->surface->buffer->proxy, 0, 0);
+	wl_surface_damage(client->surface->wl_surface, 0, 0,
+			  clip.width, clip.height);
+	frame_callback_set(client->surface->wl_surface, &done);
+	wl_surface_commit(client->surface->wl_surface);
+	frame_callback_wait(client, &done);
+
+	shot = capture_screenshot_of_output(client, NULL);
+	assert(shot);
+
+	expected = pixman_image_create_bits_no_clear(PIXMAN_a8r8g8b8,
+						     pixman_image_get_width(shot->image),
+						     pixman_image_get_height(shot->image),
+						     NULL, 0);
+	assert(expected);
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 client->surface->buffer->image, NULL, expected,
+				 0, 0, 0, 0, clip.x, clip.y,
+				 clip.width, clip.height);
+
+	match = check_images_match(shot->image, expected, &clip, NULL);
+	if (!match) {
+		pixman_image_t *diff;
+		char *fname;
+
+		diff = visualize_image_difference(shot->image, expected,
+						  &clip, NULL);
+		fname = output_filename_for_test_case("error", 0, "png");
+		write_image_as_png(diff, fname);
+		free(fname);
+		pixman_image_unref(diff);
+	}
+	assert(match);
+
+	pixman_image_unref(expected);
+	buffer_destroy(shot);
+	client_destroy(client);
+}
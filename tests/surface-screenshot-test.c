@@ -214,11 +214,89 @@ out:
 	free(pixels);
 }
 
+static void
+thumbnail_done(void *data, const void *pixels, int width, int height,
+	       int stride)
+{
+	const char *prefix = "surfacethumb-";
+	const char *suffix = ".pam";
+	const size_t bytespp = 4; /* PIXMAN_a8b8g8r8 */
+	char *desc = data;
+	char fname[1024];
+	uint8_t *copy = NULL;
+	size_t sz;
+	int ret;
+	int y;
+	FILE *fp;
+
+	if (!pixels) {
+		weston_log("thumbnail of '%s' failed\n", desc);
+		goto out;
+	}
+
+	sz = width * bytespp * height;
+	copy = malloc(sz);
+	if (!copy) {
+		weston_log("%s: failed to malloc %zu B\n", __func__, sz);
+		goto out;
+	}
+
+	for (y = 0; y < height; y++)
+		memcpy(copy + y * width * bytespp,
+		       (const uint8_t *) pixels + y * stride, width * bytespp);
+	unpremultiply_and_swap_a8b8g8r8_to_PAMrgba(copy, sz);
+
+	fp = file_create_dated(NULL, prefix, suffix, fname, sizeof(fname));
+	if (!fp) {
+		weston_log("Cannot open '%s*%s' for writing: %s\n",
+			   prefix, suffix, strerror(errno));
+		goto out;
+	}
+
+	ret = write_PAM_image_rgba(fp, width, height, copy, sz, desc);
+	if (fclose(fp) != 0 || ret < 0)
+		weston_log("writing thumbnail of '%s' failed.\n", desc);
+	else
+		weston_log("successfully shot a %dx%d thumbnail of '%s' "
+			   "into '%s'\n", width, height, desc, fname);
+
+out:
+	free(copy);
+	free(desc);
+}
+
+static void
+trigger_thumbnail_binding(struct weston_keyboard *keyboard,
+			  const struct timespec *time,
+			  uint32_t key, void *data)
+{
+	struct weston_seat *seat = keyboard->seat;
+	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
+	struct weston_surface *surface;
+	char *desc;
+
+	if (!pointer || !pointer->focus)
+		return;
+
+	surface = pointer->focus->surface;
+	desc = malloc(512);
+	if (!desc)
+		return;
+
+	if (!surface->get_label ||
+	    surface->get_label(surface, desc, 512) < 0)
+		snprintf(desc, 512, "(unknown)");
+
+	weston_surface_thumbnail_async(surface, 256, thumbnail_done, desc);
+}
+
 WL_EXPORT int
 wet_module_init(struct weston_compositor *ec,
 		int *argc, char *argv[])
 {
 	weston_compositor_add_debug_binding(ec, KEY_H, trigger_binding, ec);
+	weston_compositor_add_debug_binding(ec, KEY_J,
+					    trigger_thumbnail_binding, ec);
 
 	return 0;
 }
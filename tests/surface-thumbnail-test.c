@@ -0,0 +1,219 @@
+/*
+ * Copyright © 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "libweston-internal.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+
+struct setup_args {
+	struct fixture_metadata meta;
+	enum weston_renderer_type renderer;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{
+		.meta.name = "pixman",
+		.renderer = WESTON_RENDERER_PIXMAN,
+	},
+	{
+		.meta.name = "GL",
+		.renderer = WESTON_RENDERER_GL,
+	},
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = arg->renderer;
+	setup.width = 320;
+	setup.height = 240;
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.logging_scopes = "log,test-harness-plugin";
+	setup.refresh = HIGHEST_OUTPUT_REFRESH;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
+
+#define SURFACE_WIDTH 200
+#define SURFACE_HEIGHT 100
+#define THUMB_SIZE 50
+
+struct thumbnail {
+	struct weston_surface *surface;
+	bool done;
+	pixman_image_t *image;	/* a8r8g8b8 copy, NULL on failure */
+};
+
+/* Runs in the compositor */
+static void
+thumbnail_done(void *data, const void *pixels, int width, int height,
+	       int stride)
+{
+	struct thumbnail *thumb = data;
+	pixman_image_t *image;
+
+	if (pixels) {
+		image = pixman_image_create_bits(PIXMAN_a8b8g8r8, width, height,
+						 (uint32_t *) pixels, stride);
+		assert(image);
+		thumb->image = image_convert_to_a8r8g8b8(image);
+		pixman_image_unref(image);
+	}
+
+	thumb->done = true;
+}
+
+/* Runs in the compositor, where the renderer may be used */
+static void
+request_thumbnail(void *data)
+{
+	struct thumbnail *thumb = data;
+
+	weston_surface_thumbnail_async(thumb->surface, THUMB_SIZE,
+				       thumbnail_done, thumb);
+}
+
+static void
+fill_halves(pixman_image_t *image, int width, int height)
+{
+	pixman_color_t red;
+	pixman_color_t blue;
+	pixman_rectangle16_t right = {
+		.x = width / 2, .y = 0, .width = width / 2, .height = height,
+	};
+
+	color_rgb888(&red, 255, 0, 0);
+	color_rgb888(&blue, 0, 0, 255);
+
+	fill_image_with_color(image, &red);
+	pixman_image_fill_rectangles(PIXMAN_OP_SRC, image, &blue, 1, &right);
+}
+
+static bool
+check_thumbnail_area(pixman_image_t *thumb, pixman_image_t *expected,
+		     const struct rectangle *clip)
+{
+	pixman_image_t *diff;
+	char *fname;
+	bool match;
+
+	match = check_images_match(thumb, expected, clip, NULL);
+	if (!match) {
+		diff = visualize_image_difference(thumb, expected, clip, NULL);
+		fname = output_filename_for_test_case("error", clip->x, "png");
+		write_image_as_png(diff, fname);
+		free(fname);
+		pixman_image_unref(diff);
+	}
+
+	return match;
+}
+
+/*
+ * The thumbnail of a surface twice as wide as high, left half red and
+ * right half blue, is scaled down to fit THUMB_SIZE and keeps the halves.
+ * The pixels next to the edges and to the seam mix with their neighbours
+ * when filtered, so only the inside of each half is compared.
+ */
+TEST(thumbnail_scaled_down)
+{
+	struct wet_testsuite_data *suite_data = TEST_GET_SUITE_DATA();
+	struct thumbnail thumb = {};
+	struct client *client;
+	struct wl_surface *surface;
+	struct buffer *buf;
+	pixman_image_t *expected;
+	const int width = THUMB_SIZE;
+	const int height = THUMB_SIZE * SURFACE_HEIGHT / SURFACE_WIDTH;
+	const struct rectangle left = {
+		.x = 2, .y = 2, .width = width / 2 - 4, .height = height - 4,
+	};
+	const struct rectangle right = {
+		.x = width / 2 + 2, .y = 2,
+		.width = width / 2 - 4, .height = height - 4,
+	};
+
+	client = create_client_and_test_surface(20, 20, SURFACE_WIDTH,
+						SURFACE_HEIGHT);
+	assert(client);
+	surface = client->surface->wl_surface;
+
+	buf = create_shm_buffer_a8r8g8b8(client, SURFACE_WIDTH, SURFACE_HEIGHT);
+	fill_halves(buf->image, SURFACE_WIDTH, SURFACE_HEIGHT);
+	wl_surface_attach(surface, buf->proxy, 0, 0);
+	wl_surface_damage_buffer(surface, 0, 0, SURFACE_WIDTH, SURFACE_HEIGHT);
+
+	client_push_breakpoint(client, suite_data,
+			       WESTON_TEST_BREAKPOINT_POST_REPAINT,
+			       (struct wl_proxy *) client->output->wl_output);
+	wl_surface_commit(surface);
+
+	RUN_INSIDE_BREAKPOINT(client, suite_data) {
+		struct weston_compositor *compositor = breakpoint->compositor;
+		struct wl_event_loop *loop;
+		struct wl_resource *res;
+
+		res = wl_client_get_object(suite_data->wl_client,
+					   wl_proxy_get_id((struct wl_proxy *)
+							   surface));
+		assert(res);
+		thumb.surface = wl_resource_get_user_data(res);
+		assert(weston_surface_is_mapped(thumb.surface));
+
+		/* The compositor is stopped here, so it is safe to add an
+		 * idle, and the renderer is only used from its thread. */
+		loop = wl_display_get_event_loop(compositor->wl_display);
+		wl_event_loop_add_idle(loop, request_thumbnail, &thumb);
+	}
+
+	while (!thumb.done)
+		client_roundtrip(client);
+
+	assert(thumb.image);
+	assert(pixman_image_get_width(thumb.image) == width);
+	assert(pixman_image_get_height(thumb.image) == height);
+
+	expected = pixman_image_create_bits(PIXMAN_a8r8g8b8, width, height,
+					    NULL, 0);
+	assert(expected);
+	fill_halves(expected, width, height);
+
+	assert(check_thumbnail_area(thumb.image, expected, &left));
+	assert(check_thumbnail_area(thumb.image, expected, &right));
+
+	pixman_image_unref(expected);
+	pixman_image_unref(thumb.image);
+	buffer_destroy(buf);
+	client_destroy(client);
+}
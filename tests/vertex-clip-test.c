@@ -31,6 +31,7 @@
 #include "config.h"
 
 #include "weston-test-runner.h"
+#include "shared/helpers.h"
 #include "vertex-clipping.h"
 
 #define BOX(x1,y1,x2,y2)    { { x1, y1 }, { x2, y2 } }
@@ -758,6 +759,59 @@ TEST_P(quad_clip_box32_expected, quad_clip_box32_expected_data)
 	assert_vertices(clipped, clipped_n, tdata->clipped, tdata->clipped_n);
 }
 
+/* clipper_quad_clip() vs clipper_quad_clip_scalar() tests: */
+
+/* Sweep a clipping box over rotated and axis-aligned rectangles so that every
+ * clipping case gets hit, and check that the SSE2/NEON paths produce exactly
+ * what the scalar reference does. Rotations use Pythagorean triples for exact
+ * sines and cosines. */
+TEST(quad_clip_matches_scalar)
+{
+	static const float rotations[][2] = {
+		{  1.0f,            0.0f          },
+		{  3.0f / 5.0f,     4.0f / 5.0f   },
+		{  4.0f / 5.0f,    -3.0f / 5.0f   },
+		{  5.0f / 13.0f,   12.0f / 13.0f  },
+		{ -12.0f / 13.0f,   5.0f / 13.0f  },
+		{  8.0f / 17.0f,  -15.0f / 17.0f  },
+		{ -15.0f / 17.0f,  -8.0f / 17.0f  },
+	};
+	static const struct clipper_vertex rect[4] =
+		QUAD(-2.0f, -1.5f, 2.0f, 1.5f);
+	struct clipper_vertex polygon[4], box[2];
+	struct clipper_vertex clipped[8], expected[8];
+	struct clipper_quad quad;
+	int clipped_n, expected_n;
+	unsigned int r, i;
+	int x, y;
+
+	for (r = 0; r < ARRAY_LENGTH(rotations); r++) {
+		float c = rotations[r][0], s = rotations[r][1];
+
+		for (i = 0; i < 4; i++) {
+			polygon[i].x = c * rect[i].x - s * rect[i].y;
+			polygon[i].y = s * rect[i].x + c * rect[i].y;
+		}
+		clipper_quad_init(&quad, polygon, r == 0);
+
+		for (y = -12; y <= 12; y++) {
+			for (x = -12; x <= 12; x++) {
+				box[0].x = x * 0.25f;
+				box[0].y = y * 0.25f;
+				box[1].x = box[0].x + 3.0f;
+				box[1].y = box[0].y + 2.5f;
+
+				clipped_n = clipper_quad_clip(&quad, box,
+							      clipped);
+				expected_n = clipper_quad_clip_scalar(&quad, box,
+								      expected);
+				assert_vertices(clipped, clipped_n,
+						expected, expected_n);
+			}
+		}
+	}
+}
+
 /* clipper_float_difference() tests: */
 
 TEST(float_difference_different)
@@ -42,6 +42,7 @@
 #include "shared/weston-drm-fourcc.h"
 #include "shared/os-compatibility.h"
 #include "shared/string-helpers.h"
+#include "shared/timespec-util.h"
 #include "shared/xalloc.h"
 #include <libweston/zalloc.h>
 #include "weston-test-client-helper.h"
@@ -595,8 +596,20 @@ test_handle_pointer_position(void *data, struct weston_test *weston_test,
 		test->pointer_x, test->pointer_y);
 }
 
+static void
+test_handle_input_dispatched(void *data, struct weston_test *weston_test,
+			     uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+			     uint32_t tv_nsec)
+{
+	struct test *test = data;
+
+	timespec_from_proto(&test->input_dispatched,
+			    tv_sec_hi, tv_sec_lo, tv_nsec);
+}
+
 static const struct weston_test_listener test_listener = {
 	test_handle_pointer_position,
+	test_handle_input_dispatched,
 };
 
 static void
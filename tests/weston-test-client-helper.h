@@ -82,6 +82,8 @@ struct test {
 	int pointer_x;
 	int pointer_y;
 	uint32_t n_egl_buffers;
+	/* presentation clock time the last injected input was delivered */
+	struct timespec input_dispatched;
 };
 
 struct input {
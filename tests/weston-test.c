@@ -251,6 +251,18 @@ notify_pointer_position(struct weston_test *test, struct wl_resource *resource)
 					  wl_fixed_from_double(pointer->pos.c.y));
 }
 
+static void
+notify_input_dispatched(struct weston_test *test, struct wl_resource *resource)
+{
+	struct timespec now;
+	uint32_t tv_sec_hi, tv_sec_lo, tv_nsec;
+
+	weston_compositor_read_presentation_clock(test->compositor, &now);
+	timespec_to_proto(&now, &tv_sec_hi, &tv_sec_lo, &tv_nsec);
+	weston_test_send_input_dispatched(resource, tv_sec_hi, tv_sec_lo,
+					  tv_nsec);
+}
+
 static void
 test_surface_committed(struct weston_surface *surface,
 		       struct weston_coord_surface new_origin)
@@ -406,6 +418,7 @@ move_pointer(struct wl_client *client, struct wl_resource *resource,
 	notify_motion(seat, &time, &event);
 
 	notify_pointer_position(test, resource);
+	notify_input_dispatched(test, resource);
 }
 
 static void
@@ -421,6 +434,7 @@ send_button(struct wl_client *client, struct wl_resource *resource,
 	timespec_from_proto(&time, tv_sec_hi, tv_sec_lo, tv_nsec);
 
 	notify_button(seat, &time, button, state);
+	notify_input_dispatched(test, resource);
 }
 
 static void
@@ -440,6 +454,7 @@ send_axis(struct wl_client *client, struct wl_resource *resource,
 	axis_event.discrete = 0;
 
 	notify_axis(seat, &time, &axis_event);
+	notify_input_dispatched(test, resource);
 }
 
 static void
@@ -477,6 +492,7 @@ send_key(struct wl_client *client, struct wl_resource *resource,
 	timespec_from_proto(&time, tv_sec_hi, tv_sec_lo, tv_nsec);
 
 	notify_key(seat, &time, key, state, STATE_UPDATE_AUTOMATIC);
+	notify_input_dispatched(test, resource);
 }
 
 static void
@@ -550,6 +566,8 @@ send_touch(struct wl_client *client, struct wl_resource *resource,
 		pos.c = weston_coord_from_fixed(x, y);
 		notify_touch(device, &time, touch_id, &pos, touch_type);
 	}
+
+	notify_input_dispatched(test, resource);
 }
 
 static void
@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+# encoding=utf-8
+# Copyright © 2026 Collabora Ltd.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+# Prints a binary protocol ring, as written by weston --protocol-file, in
+# the style of the proto log scope.
+#
+# Messages are named and their arguments typed from the protocol XML files
+# given with -p; without them, opcodes and raw argument values are printed.
+
+import argparse
+import struct
+import sys
+import xml.etree.ElementTree as ET
+
+HEADER = struct.Struct('=8sIIQQ')
+RECORD = struct.Struct('=IIQ48s')
+MESSAGE = struct.Struct('=IIHBB9I')
+
+RECORD_INTERFACE = 1
+RECORD_MESSAGE = 2
+RECORD_STRING = 3
+
+RECORD_ARGS = 9
+
+
+def read_records(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    magic, version, data_offset, size, head = HEADER.unpack_from(data)
+    if magic != b'WESTRING' or version != 1:
+        sys.exit('{}: not a weston ring file'.format(path))
+
+    ring = data[data_offset:data_offset + size]
+    if head <= size:
+        buf = ring[:head]
+    else:
+        start = head % size
+        buf = ring[start:] + ring[:start]
+        # a record cut in two by the wrap-around is lost
+        buf = buf[len(buf) % RECORD.size:]
+
+    for off in range(0, len(buf) - RECORD.size + 1, RECORD.size):
+        yield RECORD.unpack_from(buf, off)
+
+
+def label(raw):
+    return raw.split(b'\0', 1)[0].decode('utf-8', 'replace')
+
+
+def load_protocols(paths):
+    """Maps interface names to their (requests, events), each a list of
+    (message name, [(argument type, interface)]) by opcode."""
+    interfaces = {}
+
+    def messages(iface, tag):
+        result = []
+        for msg in iface.findall(tag):
+            args = []
+            for arg in msg.findall('arg'):
+                atype = arg.get('type')
+                aiface = arg.get('interface')
+                if atype == 'new_id' and not aiface:
+                    # untyped new_id, as in wl_registry.bind
+                    args += [('string', None), ('uint', None)]
+                args.append((atype, aiface))
+            result.append((msg.get('name'), args))
+        return result
+
+    for path in paths:
+        for iface in ET.parse(path).getroot().findall('interface'):
+            interfaces[iface.get('name')] = (messages(iface, 'request'),
+                                              messages(iface, 'event'))
+
+    return interfaces
+
+
+def format_arg(atype, aiface, raw, string, client, objects):
+    if atype == 'int':
+        return str(raw - (1 << 32) if raw & 0x80000000 else raw)
+    if atype == 'uint':
+        return str(raw)
+    if atype == 'fixed':
+        val = raw - (1 << 32) if raw & 0x80000000 else raw
+        return '{:f}'.format(val / 256.0)
+    if atype == 'string':
+        return 'nil' if string is None else '"{}"'.format(string)
+    if atype == 'object':
+        if raw == 0:
+            return 'nil'
+        return '{}@{}'.format(objects.get((client, raw), aiface or '?'),
+                              raw)
+    if atype == 'new_id':
+        if raw == 0:
+            return 'new id {}@nil'.format(aiface or '[unknown]')
+        if aiface:
+            objects[(client, raw)] = aiface
+        return 'new id {}@{}'.format(aiface or '[unknown]', raw)
+    if atype == 'array':
+        return 'array[{}]'.format(raw)
+    if atype == 'fd':
+        return 'fd {}'.format(raw)
+    return str(raw)
+
+
+def dump(records, protocols, out):
+    interfaces = {}
+    objects = {}
+    pending = None
+
+    def flush():
+        iface_id, timestamp, msg, pieces = pending
+        strings = {i: label(s) for i, s in pieces.items()}
+        client, obj, opcode, event, n_args = msg[:5]
+        raw_args = msg[5:]
+        iface = interfaces.get(iface_id, 'interface{}'.format(iface_id))
+        objects[(client, obj)] = iface
+
+        name = '{} {}'.format('event' if event else 'request', opcode)
+        arg_types = None
+        if iface in protocols:
+            table = protocols[iface][1 if event else 0]
+            if opcode < len(table):
+                name, arg_types = table[opcode]
+
+        args = []
+        for i in range(min(n_args, RECORD_ARGS)):
+            if arg_types and i < len(arg_types):
+                atype, aiface = arg_types[i]
+                if atype == 'new_id' and not aiface and i >= 2:
+                    # the interface name of an untyped new_id
+                    aiface = strings.get(i - 2)
+            else:
+                atype, aiface = None, None
+            if atype == 'string' or (atype is None and i in strings):
+                atype = 'string'
+            args.append(format_arg(atype, aiface, raw_args[i],
+                                   strings.get(i), client, objects))
+        if n_args > RECORD_ARGS:
+            args.append('...')
+
+        out.write('[{:14.6f}] client PID {} {} {}@{}.{}({})\n'.format(
+            timestamp / 1e9, client, 'ev' if event else 'rq',
+            iface, obj, name, ', '.join(args)))
+
+    for rtype, rid, timestamp, payload in records:
+        if rtype == RECORD_STRING:
+            if pending:
+                # the pieces of a string arrive in order
+                strings = pending[3]
+                strings[rid] = strings.get(rid, b'') + payload
+            continue
+
+        if pending:
+            flush()
+            pending = None
+
+        if rtype == RECORD_INTERFACE:
+            interfaces[rid] = label(payload)
+        elif rtype == RECORD_MESSAGE:
+            pending = (rid, timestamp, MESSAGE.unpack(payload), {})
+
+    if pending:
+        flush()
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description='Print a weston binary protocol capture')
+    parser.add_argument('input', help='file given to weston --protocol-file')
+    parser.add_argument('-p', '--protocol', action='append', default=[],
+                        metavar='XML',
+                        help='protocol XML file naming the messages, '
+                             'like wayland.xml; can be repeated')
+    args = parser.parse_args()
+
+    dump(read_records(args.input), load_protocols(args.protocol),
+         sys.stdout)
@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+# encoding=utf-8
+# Copyright © 2026 Collabora Ltd.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+# Converts a binary timeline ring, as written by weston --timeline-file, to
+# the Chrome trace event JSON format, which Perfetto and chrome://tracing
+# can open.
+#
+# Repaints show up as slices on a track per output, GPU work as slices on
+# a second track per output, other points as instant events.
+
+import argparse
+import json
+import struct
+import sys
+
+HEADER = struct.Struct('=8sIIQQ')
+RECORD = struct.Struct('=IIQ48s')
+POINT = struct.Struct('=IIQQ24x')
+OBJECT = struct.Struct('=I44s')
+
+RECORD_NAME = 1
+RECORD_OUTPUT = 2
+RECORD_SURFACE = 3
+RECORD_POINT = 4
+
+# timeline point names delimiting slices: begin -> (end, slice name, on GPU)
+SLICES = {
+    'core_repaint_begin': ('core_repaint_posted', 'repaint', False),
+    'renderer_gpu_begin': ('renderer_gpu_end', 'gpu', True),
+}
+SLICE_ENDS = {end: (begin, gpu) for begin, (end, _, gpu) in SLICES.items()}
+
+
+def read_records(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    magic, version, data_offset, size, head = HEADER.unpack_from(data)
+    if magic != b'WESTRING' or version != 1:
+        sys.exit('{}: not a weston timeline ring'.format(path))
+
+    ring = data[data_offset:data_offset + size]
+    if head <= size:
+        buf = ring[:head]
+    else:
+        start = head % size
+        buf = ring[start:] + ring[:start]
+        # a record cut in two by the wrap-around is lost
+        buf = buf[len(buf) % RECORD.size:]
+
+    for off in range(0, len(buf) - RECORD.size + 1, RECORD.size):
+        yield RECORD.unpack_from(buf, off)
+
+
+def label(raw):
+    return raw.split(b'\0', 1)[0].decode('utf-8', 'replace')
+
+
+def convert(records):
+    names = {}
+    outputs = {}
+    surfaces = {}
+    events = []
+    tracks = set()
+
+    def track(output, gpu):
+        tid = output * 2 + (1 if gpu else 0)
+        tracks.add((tid, output, gpu))
+        return tid
+
+    for rtype, rid, timestamp, payload in records:
+        if rtype == RECORD_NAME:
+            names[rid] = label(OBJECT.unpack(payload)[1])
+        elif rtype == RECORD_OUTPUT:
+            outputs[rid] = label(OBJECT.unpack(payload)[1])
+        elif rtype == RECORD_SURFACE:
+            parent, desc = OBJECT.unpack(payload)
+            surfaces[rid] = (label(desc), parent)
+        elif rtype == RECORD_POINT:
+            output, surface, vblank, gpu = POINT.unpack(payload)
+            name = names.get(rid, 'point {}'.format(rid))
+            ts = (gpu or timestamp) / 1000.0
+            args = {}
+            if surface:
+                desc, parent = surfaces.get(surface, ('', 0))
+                args['surface'] = desc or 'surface {}'.format(surface)
+                if parent:
+                    args['main_surface'] = parent
+            if vblank:
+                args['vblank'] = vblank / 1000.0
+
+            if name in SLICES:
+                _, slice_name, on_gpu = SLICES[name]
+                events.append({'name': slice_name, 'ph': 'B', 'ts': ts,
+                               'pid': 1, 'tid': track(output, on_gpu),
+                               'args': args})
+            elif name in SLICE_ENDS:
+                _, on_gpu = SLICE_ENDS[name]
+                events.append({'name': name, 'ph': 'E', 'ts': ts,
+                               'pid': 1, 'tid': track(output, on_gpu)})
+            else:
+                events.append({'name': name, 'ph': 'i', 's': 't',
+                               'ts': ts, 'pid': 1,
+                               'tid': track(output, False), 'args': args})
+            if vblank:
+                events.append({'name': 'vblank', 'ph': 'i', 's': 't',
+                               'ts': vblank / 1000.0, 'pid': 1,
+                               'tid': track(output, False)})
+
+    events.append({'name': 'process_name', 'ph': 'M', 'pid': 1,
+                   'args': {'name': 'weston'}})
+    for tid, output, gpu in sorted(tracks):
+        oname = outputs.get(output, 'output {}'.format(output)) \
+            if output else 'compositor'
+        events.append({'name': 'thread_name', 'ph': 'M', 'pid': 1,
+                       'tid': tid,
+                       'args': {'name': oname + (' GPU' if gpu else '')}})
+
+    return {'traceEvents': events, 'displayTimeUnit': 'ms'}
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description='Convert a weston binary timeline to a Chrome trace')
+    parser.add_argument('input', help='file given to weston --timeline-file')
+    parser.add_argument('output', nargs='?', help='JSON output, or stdout')
+    args = parser.parse_args()
+
+    trace = convert(read_records(args.input))
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
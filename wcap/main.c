@@ -36,9 +36,12 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <cairo.h>
 
+#include "shared/helpers.h"
+#include "shared/simd.h"
 #include "wcap-decode.h"
 
 static void
@@ -98,6 +101,165 @@ int clamp_uv(int u)
 		return clamp;
 }
 
+#ifdef WESTON_HAVE_SIMD
+
+/* Eight pixels of two rows at a time. The results match rgb_to_yuv() and
+ * clamp_uv() exactly: luma uses the same 16.16 sums, and chroma sums the
+ * (c - y) differences of each 2x2 block before scaling, which is the same
+ * integer as scaling each one. */
+
+#if defined(WESTON_SIMD_SSE2)
+
+static inline void
+unpack_rgb(uint32_t format, const uint32_t *p,
+	   __m128i *r, __m128i *g, __m128i *b)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	__m128i lo = _mm_loadu_si128((const __m128i *) p);
+	__m128i hi = _mm_loadu_si128((const __m128i *) (p + 4));
+	__m128i c0, c2;
+
+	c0 = _mm_packs_epi32(_mm_and_si128(lo, mask),
+			     _mm_and_si128(hi, mask));
+	*g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), mask),
+			     _mm_and_si128(_mm_srli_epi32(hi, 8), mask));
+	c2 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), mask),
+			     _mm_and_si128(_mm_srli_epi32(hi, 16), mask));
+
+	*r = format == WCAP_FORMAT_XRGB8888 ? c2 : c0;
+	*b = format == WCAP_FORMAT_XRGB8888 ? c0 : c2;
+}
+
+static inline __m128i
+mul_u16(__m128i x, uint16_t c, __m128i *hi)
+{
+	__m128i k = _mm_set1_epi16((int16_t) c);
+	__m128i l = _mm_mullo_epi16(x, k);
+	__m128i h = _mm_mulhi_epu16(x, k);
+
+	*hi = _mm_unpackhi_epi16(l, h);
+	return _mm_unpacklo_epi16(l, h);
+}
+
+static inline __m128i
+luma(__m128i r, __m128i g, __m128i b)
+{
+	__m128i rh, gh, bh, lo, hi;
+
+	lo = _mm_add_epi32(_mm_add_epi32(mul_u16(r, 19595, &rh),
+					 mul_u16(g, 38469, &gh)),
+			   mul_u16(b, 7472, &bh));
+	hi = _mm_add_epi32(_mm_add_epi32(rh, gh), bh);
+
+	return _mm_packs_epi32(_mm_srli_epi32(lo, 16), _mm_srli_epi32(hi, 16));
+}
+
+static inline void
+chroma(__m128i d1, __m128i d2, int32_t coeff, unsigned char *out)
+{
+	__m128i sum, pair, val;
+	int32_t packed;
+
+	sum = _mm_madd_epi16(_mm_add_epi16(d1, d2), _mm_set1_epi16(1));
+
+	/* |sum| <= 1020, so (sum, sum) . (coeff - coeff / 2, coeff / 2)
+	 * multiplies by coeff without overflowing the 16-bit halves. */
+	pair = _mm_or_si128(_mm_and_si128(sum, _mm_set1_epi32(0xffff)),
+			    _mm_slli_epi32(sum, 16));
+	val = _mm_madd_epi16(pair,
+			     _mm_set1_epi32(((coeff - coeff / 2) << 16) |
+					    (coeff / 2)));
+	val = _mm_add_epi32(_mm_srai_epi32(val, 18), _mm_set1_epi32(128));
+	val = _mm_packs_epi32(val, val);
+	packed = _mm_cvtsi128_si32(_mm_packus_epi16(val, val));
+	memcpy(out, &packed, sizeof packed);
+}
+
+static void
+convert_block_yv12(uint32_t format, const uint32_t *p1, const uint32_t *p2,
+		   unsigned char *y1, unsigned char *y2,
+		   unsigned char *u, unsigned char *v)
+{
+	__m128i r1, g1, b1, r2, g2, b2, l1, l2;
+
+	unpack_rgb(format, p1, &r1, &g1, &b1);
+	unpack_rgb(format, p2, &r2, &g2, &b2);
+	l1 = luma(r1, g1, b1);
+	l2 = luma(r2, g2, b2);
+
+	_mm_storel_epi64((__m128i *) y1, _mm_packus_epi16(l1, l1));
+	_mm_storel_epi64((__m128i *) y2, _mm_packus_epi16(l2, l2));
+	chroma(_mm_sub_epi16(r1, l1), _mm_sub_epi16(r2, l2), 46727, u);
+	chroma(_mm_sub_epi16(b1, l1), _mm_sub_epi16(b2, l2), 36962, v);
+}
+
+#elif defined(WESTON_SIMD_NEON)
+
+static inline void
+unpack_rgb(uint32_t format, const uint32_t *p,
+	   uint16x8_t *r, uint16x8_t *g, uint16x8_t *b)
+{
+	uint8x8x4_t px = vld4_u8((const uint8_t *) p);
+
+	*g = vmovl_u8(px.val[1]);
+	*r = vmovl_u8(format == WCAP_FORMAT_XRGB8888 ? px.val[2] : px.val[0]);
+	*b = vmovl_u8(format == WCAP_FORMAT_XRGB8888 ? px.val[0] : px.val[2]);
+}
+
+static inline uint16x8_t
+luma(uint16x8_t r, uint16x8_t g, uint16x8_t b)
+{
+	uint32x4_t lo, hi;
+
+	lo = vmull_n_u16(vget_low_u16(r), 19595);
+	lo = vmlal_n_u16(lo, vget_low_u16(g), 38469);
+	lo = vmlal_n_u16(lo, vget_low_u16(b), 7472);
+	hi = vmull_n_u16(vget_high_u16(r), 19595);
+	hi = vmlal_n_u16(hi, vget_high_u16(g), 38469);
+	hi = vmlal_n_u16(hi, vget_high_u16(b), 7472);
+
+	return vcombine_u16(vshrn_n_u32(lo, 16), vshrn_n_u32(hi, 16));
+}
+
+static inline void
+chroma(int16x8_t d1, int16x8_t d2, int32_t coeff, unsigned char *out)
+{
+	int32x4_t val;
+	uint16x4_t c;
+	uint32_t packed;
+
+	val = vpaddlq_s16(vaddq_s16(d1, d2));
+	val = vmulq_n_s32(val, coeff);
+	val = vaddq_s32(vshrq_n_s32(val, 18), vdupq_n_s32(128));
+	c = vqmovun_s32(val);
+	packed = vget_lane_u32(vreinterpret_u32_u8(vqmovn_u16(vcombine_u16(c, c))), 0);
+	memcpy(out, &packed, sizeof packed);
+}
+
+static void
+convert_block_yv12(uint32_t format, const uint32_t *p1, const uint32_t *p2,
+		   unsigned char *y1, unsigned char *y2,
+		   unsigned char *u, unsigned char *v)
+{
+	uint16x8_t r1, g1, b1, r2, g2, b2, l1, l2;
+
+	unpack_rgb(format, p1, &r1, &g1, &b1);
+	unpack_rgb(format, p2, &r2, &g2, &b2);
+	l1 = luma(r1, g1, b1);
+	l2 = luma(r2, g2, b2);
+
+	vst1_u8(y1, vmovn_u16(l1));
+	vst1_u8(y2, vmovn_u16(l2));
+	chroma(vreinterpretq_s16_u16(vsubq_u16(r1, l1)),
+	       vreinterpretq_s16_u16(vsubq_u16(r2, l2)), 46727, u);
+	chroma(vreinterpretq_s16_u16(vsubq_u16(b1, l1)),
+	       vreinterpretq_s16_u16(vsubq_u16(b2, l2)), 36962, v);
+}
+
+#endif
+
+#endif /* WESTON_HAVE_SIMD */
+
 static void
 convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 {
@@ -117,6 +279,16 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 		p2 = p1 + decoder->width;
 		end = p1 + decoder->width;
 
+#ifdef WESTON_HAVE_SIMD
+		for (; end - p1 >= 8; p1 += 8, p2 += 8) {
+			convert_block_yv12(format, p1, p2, y1, y2, u, v);
+			y1 += 8;
+			y2 += 8;
+			u += 4;
+			v += 4;
+		}
+#endif
+
 		while (p1 < end) {
 			u_accum = 0;
 			v_accum = 0;
@@ -193,6 +365,132 @@ output_yuv_frame(struct wcap_decoder *decoder, int depth)
 	fwrite(out, 1, size, stdout);
 }
 
+/* Which frame each output tick shows, stepping through the frame index the
+ * same way the replay loop in main() steps through the file. */
+static uint32_t *
+map_ticks(const struct wcap_decoder *decoder, uint32_t frame_time,
+	  uint32_t *n_ticks)
+{
+	const struct wcap_index_entry *index = decoder->index;
+	uint32_t f = 0, msecs, count = 0, alloc = 0;
+	uint32_t *ticks = NULL, *tmp;
+
+	msecs = index[0].msecs;
+	for (;;) {
+		if (count == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			tmp = realloc(ticks, alloc * sizeof *ticks);
+			if (!tmp) {
+				free(ticks);
+				return NULL;
+			}
+			ticks = tmp;
+		}
+		ticks[count++] = f;
+
+		msecs += frame_time;
+		while (index[f].msecs < msecs) {
+			if (f + 1 == decoder->index_count)
+				goto done;
+			f++;
+		}
+	}
+
+done:
+	*n_ticks = count;
+	return ticks;
+}
+
+struct png_dump {
+	const char *filename;
+	const struct wcap_decoder *decoder;
+	const uint32_t *ticks;
+	uint32_t n_ticks;
+
+	pthread_mutex_t mutex;
+	uint32_t next_tick;
+};
+
+/* Each worker takes the ticks showing frames between two keyframes, so it
+ * only ever decodes forward from the keyframe it seeked to. */
+static void *
+png_dump_worker(void *data)
+{
+	struct png_dump *dump = data;
+	const struct wcap_decoder *main_decoder = dump->decoder;
+	struct wcap_decoder *decoder;
+	char filename[200];
+	uint32_t t, end, k;
+
+	decoder = wcap_decoder_create(dump->filename);
+	if (!decoder)
+		return NULL;
+
+	for (;;) {
+		pthread_mutex_lock(&dump->mutex);
+		t = dump->next_tick;
+		if (t >= dump->n_ticks) {
+			pthread_mutex_unlock(&dump->mutex);
+			break;
+		}
+
+		for (k = dump->ticks[t] + 1; k < main_decoder->index_count; k++)
+			if (main_decoder->index[k].flags & WCAP_FRAME_KEYFRAME)
+				break;
+		for (end = t; end < dump->n_ticks && dump->ticks[end] < k; end++)
+			;
+		dump->next_tick = end;
+		pthread_mutex_unlock(&dump->mutex);
+
+		for (; t < end; t++) {
+			if (!wcap_decoder_seek(decoder, dump->ticks[t]))
+				break;
+			snprintf(filename, sizeof filename,
+				 "wcap-frame-%d.png", t);
+			write_png(decoder, filename);
+			fprintf(stderr, "wrote %s\n", filename);
+		}
+	}
+
+	wcap_decoder_destroy(decoder);
+
+	return NULL;
+}
+
+static void
+dump_all_pngs(const char *filename, struct wcap_decoder *decoder,
+	      const uint32_t *ticks, uint32_t n_ticks)
+{
+	struct png_dump dump = {
+		.filename = filename,
+		.decoder = decoder,
+		.ticks = ticks,
+		.n_ticks = n_ticks,
+	};
+	pthread_t threads[16];
+	long n_threads;
+	int i, started = 0;
+
+	n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_threads < 1)
+		n_threads = 1;
+	if (n_threads > (long) ARRAY_LENGTH(threads))
+		n_threads = ARRAY_LENGTH(threads);
+
+	pthread_mutex_init(&dump.mutex, NULL);
+	for (i = 0; i < n_threads; i++)
+		if (pthread_create(&threads[started], NULL,
+				   png_dump_worker, &dump) == 0)
+			started++;
+
+	if (started == 0)
+		png_dump_worker(&dump);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&dump.mutex);
+}
+
 static void
 usage(int exit_code)
 {
@@ -218,6 +516,7 @@ int main(int argc, char *argv[])
 	char filename[200];
 	char *mode;
 	uint32_t msecs, frame_time;
+	uint32_t *ticks, n_ticks;
 
 	for (i = 1, j = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--yuv4mpeg2-444") == 0) {
@@ -268,6 +567,32 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	frame_time = 1000 * denom / num;
+
+	/* With a frame index, PNGs come straight from the nearest keyframe
+	 * instead of a replay of everything before them. */
+	if (!yuv4mpeg2 && (all || output_frame >= 0) &&
+	    decoder->index_count > 0 && frame_time > 0 &&
+	    (ticks = map_ticks(decoder, frame_time, &n_ticks))) {
+		if (all) {
+			dump_all_pngs(argv[1], decoder, ticks, n_ticks);
+		} else if ((uint32_t) output_frame < n_ticks &&
+			   wcap_decoder_seek(decoder, ticks[output_frame])) {
+			snprintf(filename, sizeof filename,
+				 "wcap-frame-%d.png", output_frame);
+			write_png(decoder, filename);
+			fprintf(stderr, "wrote %s\n", filename);
+		}
+
+		fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
+			decoder->width, decoder->height, n_ticks);
+
+		free(ticks);
+		wcap_decoder_destroy(decoder);
+
+		return EXIT_SUCCESS;
+	}
+
 	if (yuv4mpeg2) {
 		if (yuv4mpeg2 == 444) {
 			mode = "C444";
@@ -282,7 +607,6 @@ int main(int argc, char *argv[])
 	i = 0;
 	has_frame = wcap_decoder_get_frame(decoder);
 	msecs = decoder->msecs;
-	frame_time = 1000 * denom / num;
 	while (has_frame) {
 		if (all || i == output_frame) {
 			snprintf(filename, sizeof filename,
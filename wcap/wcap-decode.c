@@ -36,15 +36,20 @@
 #include <string.h>
 #include <fcntl.h>
 
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #include <cairo.h>
 
 #include "wcap-decode.h"
 
-static void
+static const uint32_t *
 wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
-			      struct wcap_rectangle *rect)
+			      const struct wcap_rectangle *rect,
+			      const uint32_t *p)
 {
-	uint32_t v, *p = decoder->p, *d;
+	uint32_t v, *d;
 	int width = rect->x2 - rect->x1, height = rect->y2 - rect->y1;
 	int x, i, j, k, l, count = width * height;
 	unsigned char r, g, b, dr, dg, db;
@@ -82,14 +87,15 @@ wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
 		printf("rle encoding longer than expected (%d expected %d)\n",
 		       i, count);
 
-	decoder->p = p;
+	return p;
 }
 
-int
-wcap_decoder_get_frame(struct wcap_decoder *decoder)
+static int
+wcap_decoder_get_frame_v1(struct wcap_decoder *decoder)
 {
 	struct wcap_rectangle *rects;
 	struct wcap_frame_header *header;
+	const uint32_t *p;
 	uint32_t i;
 
 	if (decoder->p == decoder->end)
@@ -100,13 +106,162 @@ wcap_decoder_get_frame(struct wcap_decoder *decoder)
 	decoder->count++;
 
 	rects = (void *) (header + 1);
-	decoder->p = (uint32_t *) (rects + header->nrects);
+	p = (const uint32_t *) (rects + header->nrects);
 	for (i = 0; i < header->nrects; i++)
-		wcap_decoder_decode_rectangle(decoder, &rects[i]);
+		p = wcap_decoder_decode_rectangle(decoder, &rects[i], p);
+	decoder->p = (void *) p;
+
+	return 1;
+}
+
+static const void *
+wcap_decoder_uncompress(struct wcap_decoder *decoder,
+			const struct wcap_frame_header_v2 *header)
+{
+	const void *payload = header + 1;
+#ifdef HAVE_ZSTD
+	size_t size;
+	void *scratch;
+#endif
+
+	switch (decoder->compression) {
+	case WCAP_COMPRESSION_NONE:
+		return header->size == header->uncompressed_size ?
+		       payload : NULL;
+#ifdef HAVE_ZSTD
+	case WCAP_COMPRESSION_ZSTD:
+		if (decoder->scratch_size < header->uncompressed_size) {
+			scratch = realloc(decoder->scratch,
+					  header->uncompressed_size);
+			if (!scratch)
+				return NULL;
+			decoder->scratch = scratch;
+			decoder->scratch_size = header->uncompressed_size;
+		}
+
+		size = ZSTD_decompress(decoder->scratch,
+				       header->uncompressed_size,
+				       payload, header->size);
+		if (ZSTD_isError(size) || size != header->uncompressed_size)
+			return NULL;
+
+		return decoder->scratch;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+static int
+wcap_decoder_get_frame_v2(struct wcap_decoder *decoder)
+{
+	const struct wcap_frame_header_v2 *header = decoder->p;
+	const struct wcap_rectangle *rects;
+	const uint32_t *payload, *p;
+	uint32_t i, nrects;
+
+	if ((char *) decoder->data_end - (char *) decoder->p <
+	    (ptrdiff_t) sizeof *header)
+		return 0;
+	if ((char *) decoder->data_end - (char *) (header + 1) <
+	    (ptrdiff_t) header->size)
+		return 0;
+
+	payload = wcap_decoder_uncompress(decoder, header);
+	if (!payload || header->uncompressed_size < sizeof nrects) {
+		fprintf(stderr, "corrupt frame %u\n", decoder->count);
+		return 0;
+	}
+
+	if (header->flags & WCAP_FRAME_KEYFRAME)
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+
+	decoder->msecs = header->msecs;
+	decoder->count++;
+
+	nrects = payload[0];
+	rects = (const struct wcap_rectangle *) (payload + 1);
+	p = (const uint32_t *) (rects + nrects);
+	for (i = 0; i < nrects; i++)
+		p = wcap_decoder_decode_rectangle(decoder, &rects[i], p);
+
+	decoder->p = (char *) (header + 1) + header->size;
 
 	return 1;
 }
 
+int
+wcap_decoder_get_frame(struct wcap_decoder *decoder)
+{
+	if (decoder->version == 2)
+		return wcap_decoder_get_frame_v2(decoder);
+	else
+		return wcap_decoder_get_frame_v1(decoder);
+}
+
+/** Decode frame number \p frame, counting from 0
+ *
+ * With an index, decoding starts at the closest keyframe before the frame;
+ * otherwise the file is replayed from the start. Returns 1 if the frame
+ * exists, 0 if not.
+ */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t frame)
+{
+	uint32_t start = 0;
+
+	if (decoder->index) {
+		if (frame >= decoder->index_count)
+			return 0;
+
+		for (start = frame; start > 0; start--)
+			if (decoder->index[start].flags & WCAP_FRAME_KEYFRAME)
+				break;
+	}
+
+	/* Keep going from where we are when that is closer. */
+	if (decoder->count == 0 || decoder->count - 1 > frame ||
+	    decoder->count < start) {
+		decoder->p = decoder->index ?
+			     (char *) decoder->map + decoder->index[start].offset :
+			     decoder->first;
+		decoder->count = start;
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+	}
+
+	while (decoder->count < frame + 1)
+		if (!wcap_decoder_get_frame(decoder))
+			return 0;
+
+	return 1;
+}
+
+static void
+wcap_decoder_read_index(struct wcap_decoder *decoder)
+{
+	const struct wcap_trailer *trailer;
+	uint64_t end, size;
+
+	if (decoder->size < sizeof(struct wcap_header_v2) + sizeof *trailer)
+		return;
+
+	trailer = (const void *) ((char *) decoder->end - sizeof *trailer);
+	if (trailer->magic != WCAP_INDEX_MAGIC)
+		return;
+
+	end = decoder->size - sizeof *trailer;
+	size = (uint64_t) trailer->count * sizeof(struct wcap_index_entry);
+	if (trailer->index_offset > end || end - trailer->index_offset != size)
+		return;
+
+	decoder->index = (const void *) ((char *) decoder->map +
+					 trailer->index_offset);
+	decoder->index_count = trailer->count;
+	decoder->data_end = (char *) decoder->map + trailer->index_offset;
+}
+
 struct wcap_decoder *
 wcap_decoder_create(const char *filename)
 {
@@ -143,6 +298,27 @@ wcap_decoder_create(const char *filename)
 	decoder->height = header->height;
 	decoder->p = header + 1;
 	decoder->end = decoder->map + decoder->size;
+	decoder->version = 1;
+	decoder->index = NULL;
+	decoder->index_count = 0;
+	decoder->scratch = NULL;
+	decoder->scratch_size = 0;
+
+	if (header->magic == WCAP_HEADER_MAGIC_V2) {
+		struct wcap_header_v2 *header_v2 = decoder->map;
+
+		decoder->version = 2;
+		decoder->compression = header_v2->compression;
+		decoder->p = header_v2 + 1;
+		decoder->data_end = decoder->end;
+		wcap_decoder_read_index(decoder);
+#ifndef HAVE_ZSTD
+		if (decoder->compression == WCAP_COMPRESSION_ZSTD)
+			fprintf(stderr, "%s is zstd compressed, which this "
+				"build cannot read\n", filename);
+#endif
+	}
+	decoder->first = decoder->p;
 
 	frame_size = header->width * header->height * 4;
 	decoder->frame = malloc(frame_size);
@@ -161,6 +337,7 @@ wcap_decoder_destroy(struct wcap_decoder *decoder)
 {
 	munmap(decoder->map, decoder->size);
 	close(decoder->fd);
+	free(decoder->scratch);
 	free(decoder->frame);
 	free(decoder);
 }
@@ -26,9 +26,12 @@
 #ifndef _WCAP_DECODE_
 #define _WCAP_DECODE_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define WCAP_HEADER_MAGIC	0x57434150
+#define WCAP_HEADER_MAGIC_V2	0x57434132
+#define WCAP_INDEX_MAGIC	0x57494458
 
 #define WCAP_FORMAT_XRGB8888	0x34325258
 #define WCAP_FORMAT_XBGR8888	0x34324258
@@ -50,6 +53,51 @@ struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
 
+/*
+ * Version 2 files start with struct wcap_header_v2. Each frame is a
+ * struct wcap_frame_header_v2 followed by a payload of size bytes. Once
+ * uncompressed, the payload holds a uint32_t rectangle count, the
+ * rectangles and then their RLE runs, exactly as version 1 stores them.
+ * Keyframes are encoded against a black frame, so decoding can start at
+ * any of them. A struct wcap_index_entry for every frame, followed by a
+ * struct wcap_trailer, ends the file. A recording that was cut short has
+ * no index but is still readable front to back.
+ */
+
+enum wcap_compression {
+	WCAP_COMPRESSION_NONE = 0,
+	WCAP_COMPRESSION_ZSTD = 1,
+};
+
+#define WCAP_FRAME_KEYFRAME	0x1
+
+struct wcap_header_v2 {
+	uint32_t magic;
+	uint32_t format;
+	uint32_t width, height;
+	uint32_t compression;
+	uint32_t reserved;
+};
+
+struct wcap_frame_header_v2 {
+	uint32_t msecs;
+	uint32_t flags;
+	uint32_t size;
+	uint32_t uncompressed_size;
+};
+
+struct wcap_index_entry {
+	uint64_t offset;
+	uint32_t msecs;
+	uint32_t flags;
+};
+
+struct wcap_trailer {
+	uint64_t index_offset;
+	uint32_t count;
+	uint32_t magic;
+};
+
 struct wcap_decoder {
 	int fd;
 	size_t size;
@@ -59,9 +107,19 @@ struct wcap_decoder {
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
+
+	/* version 2 only */
+	int version;
+	uint32_t compression;
+	void *first, *data_end;
+	const struct wcap_index_entry *index;
+	uint32_t index_count;
+	void *scratch;
+	size_t scratch_size;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t frame);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
 
@@ -48,6 +48,7 @@
 #include "shared/cairo-util.h"
 #include "shared/hash.h"
 #include "shared/helpers.h"
+#include "shared/xalloc.h"
 #include "shared/xcb-xwayland.h"
 #include "xwayland-shell-v1-server-protocol.h"
 
@@ -132,17 +133,30 @@ struct motif_wm_hints {
 
 static const char *xwayland_surface_role = "xwayland";
 
+/* Number of properties weston_wm_window_get_property_table() tracks. */
+#define WM_WINDOW_PROPERTY_COUNT 11
+
 struct weston_output_weak_ref {
 	struct weston_output *output;
 	struct wl_listener destroy_listener;
 };
 
+enum wm_decoration {
+	WM_DECORATION_NONE = 0,
+	WM_DECORATION_FULLSCREEN,
+	WM_DECORATION_FRAME,
+	WM_DECORATION_SHADOW,
+};
+
 struct weston_wm_window {
 	struct weston_wm *wm;
 	xcb_window_t id;
 	xcb_window_t frame_id;
 	struct frame *frame;
 	cairo_surface_t *cairo_surface;
+	/* What the frame window currently shows, to skip redrawing it */
+	enum wm_decoration drawn_decoration;
+	int drawn_width, drawn_height;
 	uint32_t surface_id;
 	uint64_t surface_serial;
 	struct weston_surface *surface;
@@ -151,6 +165,11 @@ struct weston_wm_window {
 	struct wl_event_source *repaint_source;
 	struct wl_event_source *configure_source;
 	int properties_dirty;
+	bool properties_pending;
+	xcb_get_property_cookie_t property_cookie[WM_WINDOW_PROPERTY_COUNT];
+	bool geometry_pending;
+	xcb_get_geometry_cookie_t geometry_cookie;
+	struct wl_list fetch_link; /* weston_wm::property_fetch_list */
 	int pid;
 	char *machine;
 	char *class;
@@ -476,42 +495,103 @@ dump_property(FILE *fp, struct weston_wm *wm,
 	}
 }
 
+struct wm_property_dump {
+	struct wl_list link; /* weston_wm::property_dump_list */
+	xcb_get_property_cookie_t cookie;
+	xcb_atom_t atom;
+	char *prefix;
+};
+
+/* Queue a debug dump of a property; the reply is written to the wm-debug
+ * scope from the event loop once it arrives instead of blocking here.
+ */
 static void
-read_and_dump_property(FILE *fp, struct weston_wm *wm,
-		       xcb_window_t window, xcb_atom_t property)
+queue_property_dump(struct weston_wm *wm, const char *prefix,
+		    xcb_window_t window, xcb_atom_t property)
 {
-	xcb_get_property_reply_t *reply;
-	xcb_get_property_cookie_t cookie;
+	struct wm_property_dump *dump;
 
-	cookie = xcb_get_property(wm->conn, 0, window,
-				  property, XCB_ATOM_ANY, 0, 2048);
-	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+	dump = zalloc(sizeof *dump);
+	if (!dump)
+		return;
 
-	dump_property(fp, wm, property, reply);
+	dump->prefix = strdup(prefix);
+	dump->atom = property;
+	dump->cookie = xcb_get_property(wm->conn, 0, window,
+					property, XCB_ATOM_ANY, 0, 2048);
+	wl_list_insert(wm->property_dump_list.prev, &dump->link);
+}
 
-	free(reply);
+static void
+property_dump_destroy(struct weston_wm *wm, struct wm_property_dump *dump,
+		      bool discard)
+{
+	if (discard)
+		xcb_discard_reply(wm->conn, dump->cookie.sequence);
+	wl_list_remove(&dump->link);
+	free(dump->prefix);
+	free(dump);
+}
+
+static void
+flush_property_dumps(struct weston_wm *wm)
+{
+	struct wm_property_dump *dump, *tmp;
+	xcb_generic_error_t *error;
+	void *reply;
+	FILE *fp;
+	char *logstr;
+	size_t logsize;
+
+	/* Replies arrive in request order, so stop at the first one that
+	 * is still in flight.
+	 */
+	wl_list_for_each_safe(dump, tmp, &wm->property_dump_list, link) {
+		reply = NULL;
+		error = NULL;
+		if (!xcb_poll_for_reply(wm->conn, dump->cookie.sequence,
+					&reply, &error))
+			break;
+		free(error);
+
+		fp = open_memstream(&logstr, &logsize);
+		if (fp) {
+			fprintf(fp, "%s", dump->prefix ? dump->prefix : "");
+			dump_property(fp, wm, dump->atom, reply);
+			if (fclose(fp) == 0)
+				weston_log_scope_write(wm->server->wm_debug,
+						       logstr, logsize);
+			free(logstr);
+		}
+
+		free(reply);
+		property_dump_destroy(wm, dump, false);
+	}
 }
 
 /* We reuse some predefined, but otherwise useles atoms
  * as local type placeholders that never touch the X11 server,
- * to make weston_wm_window_read_properties() less exceptional.
+ * to make weston_wm_window_apply_properties() less exceptional.
  */
 #define TYPE_WM_PROTOCOLS	XCB_ATOM_CUT_BUFFER0
 #define TYPE_MOTIF_WM_HINTS	XCB_ATOM_CUT_BUFFER1
 #define TYPE_NET_WM_STATE	XCB_ATOM_CUT_BUFFER2
 #define TYPE_WM_NORMAL_HINTS	XCB_ATOM_CUT_BUFFER3
 
+struct wm_window_property {
+	xcb_atom_t atom;
+	xcb_atom_t type;
+	void *ptr;
+};
+
 static void
-weston_wm_window_read_properties(struct weston_wm_window *window)
+weston_wm_window_get_property_table(struct weston_wm_window *window,
+				    struct wm_window_property *props)
 {
 	struct weston_wm *wm = window->wm;
 
 #define F(field) (&window->field)
-	const struct {
-		xcb_atom_t atom;
-		xcb_atom_t type;
-		void *ptr;
-	} props[] = {
+	const struct wm_window_property table[] = {
 		{ XCB_ATOM_WM_CLASS,           XCB_ATOM_STRING,            F(class) },
 		{ XCB_ATOM_WM_NAME,            XCB_ATOM_STRING,            F(name) },
 		{ XCB_ATOM_WM_TRANSIENT_FOR,   XCB_ATOM_WINDOW,            F(transient_for) },
@@ -526,24 +606,84 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	};
 #undef F
 
-	xcb_get_property_cookie_t cookie[ARRAY_LENGTH(props)];
-	xcb_get_property_reply_t *reply;
-	void *p;
-	uint32_t *xid;
-	xcb_atom_t *atom;
+	assert(ARRAY_LENGTH(table) == WM_WINDOW_PROPERTY_COUNT);
+	memcpy(props, table, sizeof table);
+}
+
+static void
+weston_wm_window_resolve_geometry(struct weston_wm_window *window)
+{
+	xcb_get_geometry_reply_t *geometry_reply;
+
+	if (!window->geometry_pending)
+		return;
+	window->geometry_pending = false;
+
+	geometry_reply = xcb_get_geometry_reply(window->wm->conn,
+						window->geometry_cookie, NULL);
+	/* technically we should use XRender and check the visual format's
+	alpha_mask, but checking depth is simpler and works in all known cases */
+	if (geometry_reply != NULL)
+		window->has_alpha = geometry_reply->depth == 32;
+	free(geometry_reply);
+}
+
+static void
+weston_wm_window_discard_properties(struct weston_wm_window *window)
+{
+	uint32_t i;
+
+	if (!window->properties_pending)
+		return;
+	window->properties_pending = false;
+
+	for (i = 0; i < WM_WINDOW_PROPERTY_COUNT; i++)
+		xcb_discard_reply(window->wm->conn,
+				  window->property_cookie[i].sequence);
+}
+
+/* Send one GetProperty per tracked property without waiting for any of
+ * the replies. A batch that is still in flight is stale by now and gets
+ * discarded.
+ */
+static void
+weston_wm_window_fetch_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct wm_window_property props[WM_WINDOW_PROPERTY_COUNT];
 	uint32_t i;
-	char name[1024];
 
 	if (!window->properties_dirty)
 		return;
 	window->properties_dirty = 0;
 
-	for (i = 0; i < ARRAY_LENGTH(props); i++)
-		cookie[i] = xcb_get_property(wm->conn,
-					     0, /* delete */
-					     window->id,
-					     props[i].atom,
-					     XCB_ATOM_ANY, 0, 2048);
+	weston_wm_window_discard_properties(window);
+	weston_wm_window_get_property_table(window, props);
+
+	for (i = 0; i < WM_WINDOW_PROPERTY_COUNT; i++)
+		window->property_cookie[i] =
+			xcb_get_property(wm->conn,
+					 0, /* delete */
+					 window->id,
+					 props[i].atom,
+					 XCB_ATOM_ANY, 0, 2048);
+	window->properties_pending = true;
+}
+
+static void
+weston_wm_window_apply_properties(struct weston_wm_window *window,
+				  xcb_get_property_reply_t **replies)
+{
+	struct weston_wm *wm = window->wm;
+	struct wm_window_property props[WM_WINDOW_PROPERTY_COUNT];
+	xcb_get_property_reply_t *reply;
+	void *p;
+	uint32_t *xid;
+	xcb_atom_t *atom;
+	uint32_t i, j;
+	char name[1024];
+
+	weston_wm_window_get_property_table(window, props);
 
 	window->decorate = window->override_redirect ? 0 : MWM_DECOR_EVERYTHING;
 	window->size_hints.flags = 0;
@@ -551,8 +691,8 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	window->delete_window = 0;
 	window->take_focus = 0;
 
-	for (i = 0; i < ARRAY_LENGTH(props); i++)  {
-		reply = xcb_get_property_reply(wm->conn, cookie[i], NULL);
+	for (i = 0; i < WM_WINDOW_PROPERTY_COUNT; i++)  {
+		reply = replies[i];
 		if (!reply)
 			/* Bad window, typically */
 			continue;
@@ -589,10 +729,10 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 			break;
 		case TYPE_WM_PROTOCOLS:
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++)
-				if (atom[i] == wm->atom.wm_delete_window) {
+			for (j = 0; j < reply->value_len; j++)
+				if (atom[j] == wm->atom.wm_delete_window) {
 					window->delete_window = 1;
-				} else if (atom[i] == wm->atom.wm_take_focus) {
+				} else if (atom[j] == wm->atom.wm_take_focus) {
 					window->take_focus = 1;
 				}
 			break;
@@ -608,12 +748,12 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		case TYPE_NET_WM_STATE:
 			window->fullscreen = 0;
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++) {
-				if (atom[i] == wm->atom.net_wm_state_fullscreen)
+			for (j = 0; j < reply->value_len; j++) {
+				if (atom[j] == wm->atom.net_wm_state_fullscreen)
 					window->fullscreen = 1;
-				if (atom[i] == wm->atom.net_wm_state_maximized_vert)
+				if (atom[j] == wm->atom.net_wm_state_maximized_vert)
 					window->maximized_vert = 1;
-				if (atom[i] == wm->atom.net_wm_state_maximized_horz)
+				if (atom[j] == wm->atom.net_wm_state_maximized_horz)
 					window->maximized_horz = 1;
 			}
 			break;
@@ -659,6 +799,90 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 #undef TYPE_NET_WM_STATE
 #undef TYPE_WM_NORMAL_HINTS
 
+/* Collect the replies of the batch in flight. @last is the reply to the
+ * final request of the batch when the caller already polled for it;
+ * everything before it has arrived by then, so nothing here blocks.
+ */
+static void
+weston_wm_window_finish_properties(struct weston_wm_window *window,
+				   bool have_last,
+				   xcb_get_property_reply_t *last)
+{
+	xcb_get_property_reply_t *replies[WM_WINDOW_PROPERTY_COUNT];
+	uint32_t i;
+
+	window->properties_pending = false;
+	weston_wm_window_resolve_geometry(window);
+
+	for (i = 0; i < WM_WINDOW_PROPERTY_COUNT; i++) {
+		if (have_last && i == WM_WINDOW_PROPERTY_COUNT - 1)
+			replies[i] = last;
+		else
+			replies[i] = xcb_get_property_reply(window->wm->conn,
+							    window->property_cookie[i],
+							    NULL);
+	}
+
+	weston_wm_window_apply_properties(window, replies);
+}
+
+/* Bring the window's cached properties up to date right now. Used where
+ * the WM must act on the current values; the request batch has usually
+ * been sent from the event loop already, so this rarely waits.
+ */
+static void
+weston_wm_window_read_properties(struct weston_wm_window *window)
+{
+	weston_wm_window_fetch_properties(window);
+	if (window->properties_pending)
+		weston_wm_window_finish_properties(window, false, NULL);
+}
+
+static void
+weston_wm_window_queue_property_fetch(struct weston_wm_window *window)
+{
+	window->properties_dirty = 1;
+	if (wl_list_empty(&window->fetch_link))
+		wl_list_insert(window->wm->property_fetch_list.prev,
+			       &window->fetch_link);
+}
+
+/* Called from the event loop after each batch of X events: apply the
+ * property batches whose replies have all arrived, then send one batch
+ * for every window whose properties changed since.
+ */
+static void
+weston_wm_process_property_fetches(struct weston_wm *wm)
+{
+	struct weston_wm_window *window, *tmp;
+	xcb_generic_error_t *error;
+	void *last;
+	uint32_t seq;
+
+	wl_list_for_each_safe(window, tmp, &wm->property_fetch_list,
+			      fetch_link) {
+		if (window->properties_pending && !window->properties_dirty) {
+			seq = window->property_cookie[WM_WINDOW_PROPERTY_COUNT - 1].sequence;
+			last = NULL;
+			error = NULL;
+			if (xcb_poll_for_reply(wm->conn, seq, &last, &error)) {
+				free(error);
+				weston_wm_window_finish_properties(window,
+								   true, last);
+			}
+		}
+
+		weston_wm_window_fetch_properties(window);
+
+		if (!window->properties_pending) {
+			wl_list_remove(&window->fetch_link);
+			wl_list_init(&window->fetch_link);
+		}
+	}
+
+	flush_property_dumps(wm);
+}
+
 static void
 weston_wm_window_get_frame_size(struct weston_wm_window *window,
 				int *width, int *height)
@@ -1273,6 +1497,9 @@ weston_wm_handle_map_request(struct weston_wm *wm, xcb_generic_event_t *event)
 	window->map_request_valid = true;
 	window->map_request = window->pos;
 
+	/* Unmapping dropped the contents of the frame window */
+	window->drawn_decoration = WM_DECORATION_NONE;
+
 	if (window->frame_id == XCB_WINDOW_NONE)
 		weston_wm_window_create_frame(window); /* sets frame_id */
 	assert(window->frame_id != XCB_WINDOW_NONE);
@@ -1367,19 +1594,45 @@ weston_wm_window_draw_decoration(struct weston_wm_window *window)
 {
 	cairo_t *cr;
 	int width, height;
+	enum wm_decoration decoration;
 	const char *how;
 
 	weston_wm_window_get_frame_size(window, &width, &height);
 
+	if (window->fullscreen)
+		decoration = WM_DECORATION_FULLSCREEN;
+	else if (window->decorate)
+		decoration = WM_DECORATION_FRAME;
+	else
+		decoration = WM_DECORATION_SHADOW;
+
+	if (decoration == WM_DECORATION_FRAME)
+		frame_set_title(window->frame, window->name);
+
+	/* The X server keeps the contents of the mapped frame window, so
+	 * focus changes of other windows and repaints for the sake of the
+	 * pending state need not render anything. */
+	if (window->drawn_decoration == decoration &&
+	    window->drawn_width == width && window->drawn_height == height &&
+	    (decoration != WM_DECORATION_FRAME ||
+	     !(frame_status(window->frame) & FRAME_STATUS_REPAINT))) {
+		wm_printf(window->wm, "XWM: draw decoration, win %d, "
+			  "unchanged\n", window->id);
+		return;
+	}
+
+	window->drawn_decoration = decoration;
+	window->drawn_width = width;
+	window->drawn_height = height;
+
 	cairo_xcb_surface_set_size(window->cairo_surface, width, height);
 	cr = cairo_create(window->cairo_surface);
 
-	if (window->fullscreen) {
+	if (decoration == WM_DECORATION_FULLSCREEN) {
 		how = "fullscreen";
 		/* nothing */
-	} else if (window->decorate) {
+	} else if (decoration == WM_DECORATION_FRAME) {
 		how = "decorate";
-		frame_set_title(window->frame, window->name);
 		frame_repaint(window->frame, cr);
 	} else {
 		how = "shadow";
@@ -1410,12 +1663,18 @@ weston_wm_window_set_pending_state(struct weston_wm_window *window)
 	if (!window->surface)
 		return;
 
+	weston_wm_window_resolve_geometry(window);
 	weston_wm_window_get_frame_size(window, &width, &height);
 	weston_wm_window_get_child_position(window, &x, &y);
 
 	pixman_region32_fini(&window->surface->pending.opaque);
 	if (window->has_alpha) {
 		pixman_region32_init(&window->surface->pending.opaque);
+	} else if (window->fullscreen) {
+		/* Nothing but the X window: the whole surface is opaque,
+		 * which lets the backend scan it out directly. */
+		pixman_region32_init_rect(&window->surface->pending.opaque,
+					  0, 0, width, height);
 	} else {
 		/* We leave an extra pixel around the X window area to
 		 * make sure we don't sample from the undefined alpha
@@ -1426,6 +1685,11 @@ weston_wm_window_set_pending_state(struct weston_wm_window *window)
 					  window->height + 2);
 	}
 
+	if (window->fullscreen && window->has_alpha)
+		wm_printf(window->wm, "XWM: win %d is fullscreen with an alpha "
+			  "channel, it cannot be scanned out directly\n",
+			  window->id);
+
 	if (window->decorate && !window->fullscreen) {
 		frame_input_rect(window->frame, &input_x, &input_y,
 				 &input_w, &input_h);
@@ -1480,6 +1744,7 @@ weston_wm_window_set_pending_state_OR(struct weston_wm_window *window)
 	if (!window->surface)
 		return;
 
+	weston_wm_window_resolve_geometry(window);
 	weston_wm_window_get_frame_size(window, &width, &height);
 	pixman_region32_fini(&window->surface->pending.opaque);
 	if (window->has_alpha) {
@@ -1558,7 +1823,7 @@ weston_wm_handle_property_notify(struct weston_wm *wm, xcb_generic_event_t *even
 		return;
 	}
 
-	window->properties_dirty = 1;
+	weston_wm_window_queue_property_fetch(window);
 
 	if (wm_debug_is_enabled(wm))
 		fp = open_memstream(&logstr, &logsize);
@@ -1571,20 +1836,17 @@ weston_wm_handle_property_notify(struct weston_wm *wm, xcb_generic_event_t *even
 		if (property_notify->state == XCB_PROPERTY_DELETE)
 			fprintf(fp, "deleted %s\n",
 					get_atom_name(wm->conn, property_notify->atom));
-		else
-			read_and_dump_property(fp, wm, property_notify->window,
-					       property_notify->atom);
 
-		if (fclose(fp) == 0)
-			weston_log_scope_write(wm->server->wm_debug,
-						 logstr, logsize);
+		if (fclose(fp) == 0) {
+			if (property_notify->state == XCB_PROPERTY_DELETE)
+				weston_log_scope_write(wm->server->wm_debug,
+						       logstr, logsize);
+			else
+				queue_property_dump(wm, logstr,
+						    property_notify->window,
+						    property_notify->atom);
+		}
 		free(logstr);
-	} else {
-		/* read_and_dump_property() is a X11 roundtrip.
-		 * Mimic it to maintain ordering semantics between debug
-		 * and non-debug paths.
-		 */
-		get_atom_name(wm->conn, property_notify->atom);
 	}
 
 	if (property_notify->atom == wm->atom.net_wm_name ||
@@ -1599,8 +1861,6 @@ weston_wm_window_create(struct weston_wm *wm,
 {
 	struct weston_wm_window *window;
 	uint32_t values[1];
-	xcb_get_geometry_cookie_t geometry_cookie;
-	xcb_get_geometry_reply_t *geometry_reply;
 
 	window = zalloc(sizeof *window);
 	if (window == NULL) {
@@ -1608,7 +1868,9 @@ weston_wm_window_create(struct weston_wm *wm,
 		return;
 	}
 
-	geometry_cookie = xcb_get_geometry(wm->conn, id);
+	/* Resolved together with the first property batch. */
+	window->geometry_cookie = xcb_get_geometry(wm->conn, id);
+	window->geometry_pending = true;
 
 	values[0] = XCB_EVENT_MASK_PROPERTY_CHANGE |
 	            XCB_EVENT_MASK_FOCUS_CHANGE;
@@ -1616,7 +1878,6 @@ weston_wm_window_create(struct weston_wm *wm,
 
 	window->wm = wm;
 	window->id = id;
-	window->properties_dirty = 1;
 	window->override_redirect = override;
 	window->width = width;
 	window->height = height;
@@ -1634,16 +1895,15 @@ weston_wm_window_create(struct weston_wm *wm,
 	window->decor_left = -1;
 	window->decor_right = -1;
 	wl_list_init(&window->link);
+	wl_list_init(&window->fetch_link);
 	weston_output_weak_ref_init(&window->legacy_fullscreen_output);
 
-	geometry_reply = xcb_get_geometry_reply(wm->conn, geometry_cookie, NULL);
-	/* technically we should use XRender and check the visual format's
-	alpha_mask, but checking depth is simpler and works in all known cases */
-	if (geometry_reply != NULL)
-		window->has_alpha = geometry_reply->depth == 32;
-	free(geometry_reply);
-
 	hash_table_insert(wm->window_hash, id, window);
+
+	/* Get the property requests on the wire now, so the replies are
+	 * usually in by the time MapRequest needs them.
+	 */
+	weston_wm_window_queue_property_fetch(window);
 }
 
 static void
@@ -1660,6 +1920,11 @@ weston_wm_window_destroy(struct weston_wm_window *window)
 	if (window->cairo_surface)
 		cairo_surface_destroy(window->cairo_surface);
 
+	weston_wm_window_discard_properties(window);
+	if (window->geometry_pending)
+		xcb_discard_reply(wm->conn, window->geometry_cookie.sequence);
+	wl_list_remove(&window->fetch_link);
+
 	if (window->frame_id) {
 		xcb_reparent_window(wm->conn, window->id, wm->wm_window, 0, 0);
 		xcb_destroy_window(wm->conn, window->frame_id);
@@ -2164,25 +2429,33 @@ static const struct cursor_alternatives cursors[] = {
 	{left_ptrs, ARRAY_LENGTH(left_ptrs)},
 };
 
+/* Cursors are loaded on first use, as going through the cursor theme for
+ * all of them would hold up the start of the WM. XCB_CURSOR_NONE marks a
+ * cursor not loaded yet, -1 one which could not be loaded. */
 static void
 weston_wm_create_cursors(struct weston_wm *wm)
 {
-	const char *name;
-	int i, count = ARRAY_LENGTH(cursors);
+	wm->cursors = xcalloc(ARRAY_LENGTH(cursors), sizeof(xcb_cursor_t));
+	wm->last_cursor = -1;
+}
+
+static xcb_cursor_t
+weston_wm_get_cursor(struct weston_wm *wm, int cursor)
+{
 	size_t j;
 
-	wm->cursors = malloc(count * sizeof(xcb_cursor_t));
-	for (i = 0; i < count; i++) {
-		for (j = 0; j < cursors[i].count; j++) {
-			name = cursors[i].names[j];
-			wm->cursors[i] =
-				xcb_cursor_library_load_cursor(wm, name);
-			if (wm->cursors[i] != (xcb_cursor_t)-1)
-				break;
-		}
+	if (wm->cursors[cursor] != XCB_CURSOR_NONE)
+		return wm->cursors[cursor];
+
+	for (j = 0; j < cursors[cursor].count; j++) {
+		wm->cursors[cursor] =
+			xcb_cursor_library_load_cursor(wm,
+						       cursors[cursor].names[j]);
+		if (wm->cursors[cursor] != (xcb_cursor_t)-1)
+			break;
 	}
 
-	wm->last_cursor = -1;
+	return wm->cursors[cursor];
 }
 
 static void
@@ -2190,8 +2463,11 @@ weston_wm_destroy_cursors(struct weston_wm *wm)
 {
 	uint8_t i;
 
-	for (i = 0; i < ARRAY_LENGTH(cursors); i++)
-		xcb_free_cursor(wm->conn, wm->cursors[i]);
+	for (i = 0; i < ARRAY_LENGTH(cursors); i++) {
+		if (wm->cursors[i] != XCB_CURSOR_NONE &&
+		    wm->cursors[i] != (xcb_cursor_t)-1)
+			xcb_free_cursor(wm->conn, wm->cursors[i]);
+	}
 
 	free(wm->cursors);
 }
@@ -2234,7 +2510,9 @@ weston_wm_window_set_cursor(struct weston_wm *wm, xcb_window_t window_id,
 
 	wm->last_cursor = cursor;
 
-	cursor_value_list = wm->cursors[cursor];
+	cursor_value_list = weston_wm_get_cursor(wm, cursor);
+	if (cursor_value_list == (xcb_cursor_t)-1)
+		cursor_value_list = XCB_CURSOR_NONE;
 	xcb_change_window_attributes (wm->conn, window_id,
 				      XCB_CW_CURSOR, &cursor_value_list);
 	xcb_flush(wm->conn);
@@ -2534,8 +2812,9 @@ weston_wm_handle_event(int fd, uint32_t mask, void *data)
 		count++;
 	}
 
-	if (count != 0)
-		xcb_flush(wm->conn);
+	weston_wm_process_property_fetches(wm);
+
+	xcb_flush(wm->conn);
 
 	return count;
 }
@@ -2923,6 +3202,8 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 		      &wm->kill_listener);
 	wl_list_init(&wm->unpaired_window_list);
 	wl_list_init(&wm->unpaired_surface_list);
+	wl_list_init(&wm->property_fetch_list);
+	wl_list_init(&wm->property_dump_list);
 
 	weston_wm_create_cursors(wm);
 	weston_wm_window_set_cursor(wm, wm->screen->root, XWM_CURSOR_LEFT_PTR);
@@ -2943,6 +3224,11 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 void
 weston_wm_destroy(struct weston_wm *wm)
 {
+	struct wm_property_dump *dump, *tmp;
+
+	wl_list_for_each_safe(dump, tmp, &wm->property_dump_list, link)
+		property_dump_destroy(wm, dump, true);
+
 	wl_global_destroy(wm->xwayland_shell_global);
 	/* FIXME: Free windows in hash. */
 	hash_table_destroy(wm->window_hash);
@@ -3178,6 +3464,11 @@ send_fullscreen(struct weston_surface *surface, bool fullscreen)
 		window->saved_width = window->width;
 		window->saved_height = window->height;
 	}
+
+	/* Drop or bring back the decorations, frame extents and input
+	 * region now rather than with the next configure, which is not
+	 * sent if the size does not change. */
+	weston_wm_window_schedule_repaint(window);
 }
 
 static const struct weston_xwayland_client_interface shell_client = {
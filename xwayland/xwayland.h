@@ -74,6 +74,8 @@ struct weston_wm {
 	struct wl_listener activate_listener;
 	struct wl_listener kill_listener;
 	struct wl_list unpaired_window_list;
+	struct wl_list property_fetch_list; /* weston_wm_window::fetch_link */
+	struct wl_list property_dump_list; /* wm_property_dump::link */
 
 	xcb_window_t selection_window;
 	xcb_window_t selection_owner;